@@ -0,0 +1,69 @@
+# Profile-guided build, run by the rpiplay-pgo target with cmake -P.
+#
+# Builds an instrumented rpiplay-replay and rpiplay-bench in BINARY_DIR, plays
+# every --record capture in TRAINING_DIR through them with the dummy renderers,
+# then builds everything again in the same directory with the profiles. GCC
+# keeps a profile next to each object file, so both stages share the tree.
+# Mirror captures go through decryption, the NAL rewrite and the video pipeline
+# as fast as they decode, audio captures through the jitter buffer at their
+# recorded pace and, through rpiplay-bench, their AAC-ELD frames through fdk-aac.
+
+if(NOT TRAINING_DIR)
+	message(FATAL_ERROR "Set PGO_TRAINING_DIR to a directory of mirror-*.cap and audio-*.cap recordings")
+endif()
+file(GLOB mirror_captures "${TRAINING_DIR}/mirror-*.cap")
+file(GLOB audio_captures "${TRAINING_DIR}/audio-*.cap")
+if(NOT mirror_captures AND NOT audio_captures)
+	message(FATAL_ERROR "No recordings in ${TRAINING_DIR}, make some with rpiplay --record")
+endif()
+
+file(MAKE_DIRECTORY "${BINARY_DIR}")
+
+function(pgo_build stage)
+	execute_process(COMMAND "${CMAKE_COMMAND}" -G "${GENERATOR}" -DCMAKE_BUILD_TYPE=${BUILD_TYPE}
+			-DPGO=${stage} "${SOURCE_DIR}"
+		WORKING_DIRECTORY "${BINARY_DIR}" RESULT_VARIABLE result)
+	if(NOT result EQUAL 0)
+		message(FATAL_ERROR "Configuring the ${stage} build failed")
+	endif()
+	# The targets given, or all of them
+	set(targets ${ARGN})
+	if(NOT targets)
+		set(targets all)
+	endif()
+	foreach(target ${targets})
+		execute_process(COMMAND "${CMAKE_COMMAND}" --build . --target ${target}
+			WORKING_DIRECTORY "${BINARY_DIR}" RESULT_VARIABLE result)
+		if(NOT result EQUAL 0)
+			message(FATAL_ERROR "The ${stage} build of ${target} failed")
+		endif()
+	endforeach()
+endfunction()
+
+function(pgo_train)
+	message(STATUS "PGO: ${ARGV}")
+	execute_process(COMMAND ${ARGV} WORKING_DIRECTORY "${BINARY_DIR}" RESULT_VARIABLE result OUTPUT_QUIET)
+	if(NOT result EQUAL 0)
+		message(FATAL_ERROR "Training run failed: ${ARGV}")
+	endif()
+endfunction()
+
+pgo_build(generate rpiplay-replay rpiplay-bench)
+# Profiles of an earlier run would add up with this one's
+file(GLOB_RECURSE old_profiles "${BINARY_DIR}/*.gcda")
+if(old_profiles)
+	file(REMOVE ${old_profiles})
+endif()
+
+set(replay "${BINARY_DIR}/rpiplay-replay")
+set(bench "${BINARY_DIR}/rpiplay-bench")
+foreach(capture ${mirror_captures})
+	pgo_train("${replay}" -vr dummy -ar dummy -max "${capture}")
+endforeach()
+foreach(capture ${audio_captures})
+	pgo_train("${replay}" -vr dummy -ar dummy "${capture}")
+	pgo_train("${bench}" -f aac_decode -t 1 -audio "${capture}")
+endforeach()
+
+pgo_build(use)
+message(STATUS "PGO: optimized binaries are in ${BINARY_DIR}")
@@ -0,0 +1,313 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include "aes_af_alg.h"
+
+#if defined(__linux__)
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <linux/if_alg.h>
+
+#ifndef SOL_ALG
+#define SOL_ALG 279
+#endif
+
+#define AES_AF_ALG_BLOCK_SIZE 16
+/* Pages one read of the socket writes to and one splice moves at most, ALG_MAX_PAGES and the default pipe size */
+#define AES_AF_ALG_MAX_PAGES 16
+/* Inputs from this size are spliced, below it copying them costs less than the extra system calls */
+#define AES_AF_ALG_SPLICE_MIN 4096
+#define AES_AF_ALG_NAME_SIZE 64
+
+struct aes_af_alg_s {
+    /* The socket the key is set on and the one the operations run on */
+    int tfm;
+    int op;
+    bool ctr;
+    bool decrypt;
+    size_t page_size;
+    /* Large inputs are spliced through it, -1 until the first */
+    int pipe[2];
+};
+
+static pthread_once_t aes_af_alg_once = PTHREAD_ONCE_INIT;
+/* Drivers for cbc(aes) and ctr(aes), empty if there is no engine */
+static char aes_af_alg_drivers[2][AES_AF_ALG_NAME_SIZE];
+
+/* The kernel's own implementations, which run on the CPU like OpenSSL does */
+static bool
+aes_af_alg_is_software(const char *driver)
+{
+    static const char *const software[] = {
+        "generic", "neon", "aes-ce", "aes-arm", "aesni", "vaes", "riscv", "cryptd", "("
+    };
+    for (size_t i = 0; i < sizeof(software) / sizeof(software[0]); i++) {
+        if (strstr(driver, software[i])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Picks the driver of the highest priority for each mode out of /proc/crypto */
+static void
+aes_af_alg_probe(void)
+{
+    FILE *file = fopen("/proc/crypto", "r");
+    if (!file) {
+        return;
+    }
+    char line[128];
+    char name[AES_AF_ALG_NAME_SIZE] = "", driver[AES_AF_ALG_NAME_SIZE] = "", type[AES_AF_ALG_NAME_SIZE] = "";
+    int priority = 0, best[2] = { -1, -1 };
+    bool usable = true;
+    bool more = true;
+    while (more) {
+        more = fgets(line, sizeof(line), file) != NULL;
+        if (!more || line[0] == '\n') {
+            // An empty line ends an entry
+            int ctr = !strcmp(name, "ctr(aes)") ? 1 : !strcmp(name, "cbc(aes)") ? 0 : -1;
+            if (ctr >= 0 && usable && !strcmp(type, "skcipher") && !aes_af_alg_is_software(driver) &&
+                priority > best[ctr]) {
+                best[ctr] = priority;
+                snprintf(aes_af_alg_drivers[ctr], AES_AF_ALG_NAME_SIZE, "%s", driver);
+            }
+            name[0] = driver[0] = type[0] = '\0';
+            priority = 0;
+            usable = true;
+            continue;
+        }
+        char key[32], value[AES_AF_ALG_NAME_SIZE];
+        if (sscanf(line, "%31s : %63s", key, value) != 2) {
+            continue;
+        }
+        if (!strcmp(key, "name")) {
+            strcpy(name, value);
+        } else if (!strcmp(key, "driver")) {
+            strcpy(driver, value);
+        } else if (!strcmp(key, "type")) {
+            strcpy(type, value);
+        } else if (!strcmp(key, "priority")) {
+            priority = atoi(value);
+        } else if (!strcmp(key, "selftest")) {
+            usable = usable && strcmp(value, "failed");
+        } else if (!strcmp(key, "internal")) {
+            usable = usable && strcmp(value, "yes");
+        }
+    }
+    fclose(file);
+}
+
+const char *
+aes_af_alg_driver(bool ctr)
+{
+    pthread_once(&aes_af_alg_once, aes_af_alg_probe);
+    return aes_af_alg_drivers[ctr][0] ? aes_af_alg_drivers[ctr] : NULL;
+}
+
+aes_af_alg_t *
+aes_af_alg_init(const uint8_t key[16], bool ctr, bool decrypt)
+{
+    const char *driver = aes_af_alg_driver(ctr);
+    if (!driver) {
+        return NULL;
+    }
+    aes_af_alg_t *af_alg = calloc(1, sizeof(aes_af_alg_t));
+    if (!af_alg) {
+        return NULL;
+    }
+    af_alg->ctr = ctr;
+    // CTR runs the same operation both ways
+    af_alg->decrypt = decrypt && !ctr;
+    af_alg->page_size = sysconf(_SC_PAGESIZE);
+    af_alg->op = -1;
+    af_alg->pipe[0] = af_alg->pipe[1] = -1;
+
+    // Bound to the driver rather than the mode, so the kernel can't pick its software AES instead
+    struct sockaddr_alg addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.salg_family = AF_ALG;
+    strcpy((char *) addr.salg_type, "skcipher");
+    snprintf((char *) addr.salg_name, sizeof(addr.salg_name), "%s", driver);
+    af_alg->tfm = socket(AF_ALG, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (af_alg->tfm < 0 || bind(af_alg->tfm, (struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+        setsockopt(af_alg->tfm, SOL_ALG, ALG_SET_KEY, key, AES_AF_ALG_BLOCK_SIZE) < 0 ||
+        (af_alg->op = accept4(af_alg->tfm, NULL, NULL, SOCK_CLOEXEC)) < 0) {
+        aes_af_alg_destroy(af_alg);
+        return NULL;
+    }
+    return af_alg;
+}
+
+/* Bytes from p up to len that fit the pages one read or splice takes, in whole blocks */
+static int
+aes_af_alg_fit(aes_af_alg_t *af_alg, const uint8_t *p, int len)
+{
+    size_t room = AES_AF_ALG_MAX_PAGES * af_alg->page_size - (uintptr_t) p % af_alg->page_size;
+    if ((size_t) len > room) {
+        len = (int) (room - room % AES_AF_ALG_BLOCK_SIZE);
+    }
+    return len;
+}
+
+/* Starts an operation from iv on len bytes of in, spliced or copied */
+static int
+aes_af_alg_send(aes_af_alg_t *af_alg, const uint8_t *iv, const uint8_t *in, int len, bool spliced)
+{
+    char control[CMSG_SPACE(sizeof(uint32_t)) + CMSG_SPACE(sizeof(struct af_alg_iv) + AES_AF_ALG_BLOCK_SIZE)];
+    struct iovec iov = { (void *) in, len };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    memset(control, 0, sizeof(control));
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_ALG;
+    cmsg->cmsg_type = ALG_SET_OP;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(uint32_t));
+    *(uint32_t *) CMSG_DATA(cmsg) = af_alg->decrypt ? ALG_OP_DECRYPT : ALG_OP_ENCRYPT;
+    cmsg = CMSG_NXTHDR(&msg, cmsg);
+    cmsg->cmsg_level = SOL_ALG;
+    cmsg->cmsg_type = ALG_SET_IV;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(struct af_alg_iv) + AES_AF_ALG_BLOCK_SIZE);
+    struct af_alg_iv *alg_iv = (struct af_alg_iv *) CMSG_DATA(cmsg);
+    alg_iv->ivlen = AES_AF_ALG_BLOCK_SIZE;
+    memcpy(alg_iv->iv, iv, AES_AF_ALG_BLOCK_SIZE);
+
+    if (!spliced) {
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        return sendmsg(af_alg->op, &msg, 0) == len ? 0 : -1;
+    }
+    // The operation and IV go first on their own, the pages of in follow without being copied
+    if (sendmsg(af_alg->op, &msg, MSG_MORE) < 0) {
+        return -1;
+    }
+    ssize_t moved = vmsplice(af_alg->pipe[1], &iov, 1, 0);
+    if (moved != len) {
+        return -1;
+    }
+    return splice(af_alg->pipe[0], NULL, af_alg->op, NULL, len, 0) == len ? 0 : -1;
+}
+
+/* Adds blocks to a 128bit big endian counter block */
+static void
+aes_af_alg_add_blocks(uint8_t counter[AES_AF_ALG_BLOCK_SIZE], uint64_t blocks)
+{
+    for (int i = AES_AF_ALG_BLOCK_SIZE - 1; i >= 0 && blocks; i--) {
+        uint64_t sum = (uint64_t) counter[i] + (blocks & 0xff);
+        counter[i] = (uint8_t) sum;
+        blocks = (blocks >> 8) + (sum >> 8);
+    }
+}
+
+int
+aes_af_alg_crypt(aes_af_alg_t *af_alg, uint8_t iv[16], const uint8_t *in, uint8_t *out, int len)
+{
+    assert(len % AES_AF_ALG_BLOCK_SIZE == 0);
+    int done = 0;
+    while (done < len) {
+        // An operation the size of what one read writes, so the kernel never has to chain two itself
+        int n = aes_af_alg_fit(af_alg, in + done, len - done);
+        n = aes_af_alg_fit(af_alg, out + done, n);
+        // Only CBC decryption takes its next iv from here
+        uint8_t next_iv[AES_AF_ALG_BLOCK_SIZE] = {0};
+        if (!af_alg->ctr && af_alg->decrypt) {
+            // The last ciphertext block, out may overwrite it
+            memcpy(next_iv, in + done + n - AES_AF_ALG_BLOCK_SIZE, AES_AF_ALG_BLOCK_SIZE);
+        }
+
+        // Spliced pages are read in place, which CBC can't do when they are also the output
+        bool overlap = in + done < out + done + n && out + done < in + done + n;
+        bool spliced = n >= AES_AF_ALG_SPLICE_MIN && !overlap;
+        if (spliced && af_alg->pipe[0] < 0 && pipe2(af_alg->pipe, O_CLOEXEC) < 0) {
+            af_alg->pipe[0] = af_alg->pipe[1] = -1;
+            spliced = false;
+        }
+        if (aes_af_alg_send(af_alg, iv, in + done, n, spliced) < 0) {
+            break;
+        }
+        ssize_t received;
+        do {
+            received = read(af_alg->op, out + done, n);
+        } while (received < 0 && errno == EINTR);
+        if (received != n) {
+            break;
+        }
+
+        if (af_alg->ctr) {
+            aes_af_alg_add_blocks(iv, n / AES_AF_ALG_BLOCK_SIZE);
+        } else if (af_alg->decrypt) {
+            memcpy(iv, next_iv, AES_AF_ALG_BLOCK_SIZE);
+        } else {
+            memcpy(iv, out + done + n - AES_AF_ALG_BLOCK_SIZE, AES_AF_ALG_BLOCK_SIZE);
+        }
+        done += n;
+    }
+    return done;
+}
+
+void
+aes_af_alg_destroy(aes_af_alg_t *af_alg)
+{
+    if (af_alg) {
+        int fds[] = { af_alg->pipe[0], af_alg->pipe[1], af_alg->op, af_alg->tfm };
+        for (size_t i = 0; i < sizeof(fds) / sizeof(fds[0]); i++) {
+            if (fds[i] >= 0) {
+                close(fds[i]);
+            }
+        }
+        free(af_alg);
+    }
+}
+
+#else
+
+const char *
+aes_af_alg_driver(bool ctr)
+{
+    return NULL;
+}
+
+aes_af_alg_t *
+aes_af_alg_init(const uint8_t key[16], bool ctr, bool decrypt)
+{
+    return NULL;
+}
+
+int
+aes_af_alg_crypt(aes_af_alg_t *af_alg, uint8_t iv[16], const uint8_t *in, uint8_t *out, int len)
+{
+    return 0;
+}
+
+void
+aes_af_alg_destroy(aes_af_alg_t *af_alg)
+{
+}
+
+#endif
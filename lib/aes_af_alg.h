@@ -0,0 +1,42 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#ifndef AES_AF_ALG_H
+#define AES_AF_ALG_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * AES-128 CTR and CBC decryption on a hardware engine the kernel drives,
+ * through its AF_ALG sockets. Several ARM SoCs, Rockchip and Allwinner among
+ * them, have such an engine, which OpenSSL doesn't know about. Only drivers
+ * of an engine are used, not the kernel's own software AES, which would run
+ * on the same cores as OpenSSL with system calls on top. Large inputs are
+ * spliced into the socket instead of copied. Linux only, elsewhere there is
+ * never an engine.
+ */
+
+typedef struct aes_af_alg_s aes_af_alg_t;
+
+/* Name of the engine's driver for ctr(aes) or cbc(aes), NULL if there is none */
+const char *aes_af_alg_driver(bool ctr);
+/* NULL if there is no engine for the mode or the kernel refuses the key */
+aes_af_alg_t *aes_af_alg_init(const uint8_t key[16], bool ctr, bool decrypt);
+/*
+ * Runs len bytes, a multiple of the block size, from iv, which is moved on to the block after them.
+ * Returns how many bytes were done, less than len if the engine failed, with iv at the first one not done.
+ */
+int aes_af_alg_crypt(aes_af_alg_t *af_alg, uint8_t iv[16], const uint8_t *in, uint8_t *out, int len);
+void aes_af_alg_destroy(aes_af_alg_t *af_alg);
+
+#endif //AES_AF_ALG_H
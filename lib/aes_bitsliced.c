@@ -0,0 +1,449 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include <string.h>
+
+#include "aes_bitsliced.h"
+
+/*
+ * The layout and the circuits follow the constant time AES of BearSSL (aes_ct.c),
+ * with every word widened to a vector. Before the ortho transform, word 2i holds
+ * column i of the first block of a lane and word 2i+1 that of the second. After it,
+ * word n holds bit n of all 32 bytes.
+ */
+
+typedef aes_bitsliced_word_t word_t;
+
+#define SWAPN(cl, ch, s, x, y) do { \
+        word_t a = (x), b = (y); \
+        (x) = (a & (cl)) | ((b & (cl)) << (s)); \
+        (y) = ((a & (ch)) >> (s)) | (b & (ch)); \
+    } while (0)
+
+#define SWAP2(x, y) SWAPN(0x55555555u, 0xAAAAAAAAu, 1, x, y)
+#define SWAP4(x, y) SWAPN(0x33333333u, 0xCCCCCCCCu, 2, x, y)
+#define SWAP8(x, y) SWAPN(0x0F0F0F0Fu, 0xF0F0F0F0u, 4, x, y)
+
+/* Its own inverse */
+static void
+aes_bitsliced_ortho(word_t *q)
+{
+    SWAP2(q[0], q[1]);
+    SWAP2(q[2], q[3]);
+    SWAP2(q[4], q[5]);
+    SWAP2(q[6], q[7]);
+
+    SWAP4(q[0], q[2]);
+    SWAP4(q[1], q[3]);
+    SWAP4(q[4], q[6]);
+    SWAP4(q[5], q[7]);
+
+    SWAP8(q[0], q[4]);
+    SWAP8(q[1], q[5]);
+    SWAP8(q[2], q[6]);
+    SWAP8(q[3], q[7]);
+}
+
+/* The S-box circuit of Boyar and Peralta, 113 gates */
+static void
+aes_bitsliced_sbox(word_t *q)
+{
+    word_t x0, x1, x2, x3, x4, x5, x6, x7;
+    word_t y1, y2, y3, y4, y5, y6, y7, y8, y9;
+    word_t y10, y11, y12, y13, y14, y15, y16, y17, y18, y19;
+    word_t y20, y21;
+    word_t z0, z1, z2, z3, z4, z5, z6, z7, z8, z9;
+    word_t z10, z11, z12, z13, z14, z15, z16, z17;
+    word_t t0, t1, t2, t3, t4, t5, t6, t7, t8, t9;
+    word_t t10, t11, t12, t13, t14, t15, t16, t17, t18, t19;
+    word_t t20, t21, t22, t23, t24, t25, t26, t27, t28, t29;
+    word_t t30, t31, t32, t33, t34, t35, t36, t37, t38, t39;
+    word_t t40, t41, t42, t43, t44, t45, t46, t47, t48, t49;
+    word_t t50, t51, t52, t53, t54, t55, t56, t57, t58, t59;
+    word_t t60, t61, t62, t63, t64, t65, t66, t67;
+    word_t s0, s1, s2, s3, s4, s5, s6, s7;
+
+    x0 = q[7];
+    x1 = q[6];
+    x2 = q[5];
+    x3 = q[4];
+    x4 = q[3];
+    x5 = q[2];
+    x6 = q[1];
+    x7 = q[0];
+
+    // Top linear transformation
+    y14 = x3 ^ x5;
+    y13 = x0 ^ x6;
+    y9 = x0 ^ x3;
+    y8 = x0 ^ x5;
+    t0 = x1 ^ x2;
+    y1 = t0 ^ x7;
+    y4 = y1 ^ x3;
+    y12 = y13 ^ y14;
+    y2 = y1 ^ x0;
+    y5 = y1 ^ x6;
+    y3 = y5 ^ y8;
+    t1 = x4 ^ y12;
+    y15 = t1 ^ x5;
+    y20 = t1 ^ x1;
+    y6 = y15 ^ x7;
+    y10 = y15 ^ t0;
+    y11 = y20 ^ y9;
+    y7 = x7 ^ y11;
+    y17 = y10 ^ y11;
+    y19 = y10 ^ y8;
+    y16 = t0 ^ y11;
+    y21 = y13 ^ y16;
+    y18 = x0 ^ y16;
+
+    // Non-linear section
+    t2 = y12 & y15;
+    t3 = y3 & y6;
+    t4 = t3 ^ t2;
+    t5 = y4 & x7;
+    t6 = t5 ^ t2;
+    t7 = y13 & y16;
+    t8 = y5 & y1;
+    t9 = t8 ^ t7;
+    t10 = y2 & y7;
+    t11 = t10 ^ t7;
+    t12 = y9 & y11;
+    t13 = y14 & y17;
+    t14 = t13 ^ t12;
+    t15 = y8 & y10;
+    t16 = t15 ^ t12;
+    t17 = t4 ^ t14;
+    t18 = t6 ^ t16;
+    t19 = t9 ^ t14;
+    t20 = t11 ^ t16;
+    t21 = t17 ^ y20;
+    t22 = t18 ^ y19;
+    t23 = t19 ^ y21;
+    t24 = t20 ^ y18;
+
+    t25 = t21 ^ t22;
+    t26 = t21 & t23;
+    t27 = t24 ^ t26;
+    t28 = t25 & t27;
+    t29 = t28 ^ t22;
+    t30 = t23 ^ t24;
+    t31 = t22 ^ t26;
+    t32 = t31 & t30;
+    t33 = t32 ^ t24;
+    t34 = t23 ^ t33;
+    t35 = t27 ^ t33;
+    t36 = t24 & t35;
+    t37 = t36 ^ t34;
+    t38 = t27 ^ t36;
+    t39 = t29 & t38;
+    t40 = t25 ^ t39;
+
+    t41 = t40 ^ t37;
+    t42 = t29 ^ t33;
+    t43 = t29 ^ t40;
+    t44 = t33 ^ t37;
+    t45 = t42 ^ t41;
+    z0 = t44 & y15;
+    z1 = t37 & y6;
+    z2 = t33 & x7;
+    z3 = t43 & y16;
+    z4 = t40 & y1;
+    z5 = t29 & y7;
+    z6 = t42 & y11;
+    z7 = t45 & y17;
+    z8 = t41 & y10;
+    z9 = t44 & y12;
+    z10 = t37 & y3;
+    z11 = t33 & y4;
+    z12 = t43 & y13;
+    z13 = t40 & y5;
+    z14 = t29 & y2;
+    z15 = t42 & y9;
+    z16 = t45 & y14;
+    z17 = t41 & y8;
+
+    // Bottom linear transformation
+    t46 = z15 ^ z16;
+    t47 = z10 ^ z11;
+    t48 = z5 ^ z13;
+    t49 = z9 ^ z10;
+    t50 = z2 ^ z12;
+    t51 = z2 ^ z5;
+    t52 = z7 ^ z8;
+    t53 = z0 ^ z3;
+    t54 = z6 ^ z7;
+    t55 = z16 ^ z17;
+    t56 = z12 ^ t48;
+    t57 = t50 ^ t53;
+    t58 = z4 ^ t46;
+    t59 = z3 ^ t54;
+    t60 = t46 ^ t57;
+    t61 = z14 ^ t57;
+    t62 = t52 ^ t58;
+    t63 = t49 ^ t58;
+    t64 = z4 ^ t59;
+    t65 = t61 ^ t62;
+    t66 = z1 ^ t63;
+    s0 = t59 ^ t63;
+    s6 = t56 ^ ~t62;
+    s7 = t48 ^ ~t60;
+    t67 = t64 ^ t65;
+    s3 = t53 ^ t66;
+    s4 = t51 ^ t66;
+    s5 = t47 ^ t65;
+    s1 = t64 ^ ~s3;
+    s2 = t55 ^ ~t67;
+
+    q[7] = s0;
+    q[6] = s1;
+    q[5] = s2;
+    q[4] = s3;
+    q[3] = s4;
+    q[2] = s5;
+    q[1] = s6;
+    q[0] = s7;
+}
+
+/*
+ * The S-box is S(x) = A(I(x)) ^ 0x63 with I the inversion in GF(256) and A linear,
+ * so its inverse is B(S(B(x ^ 0x63)) ^ 0x63) with B the inverse of A.
+ */
+static void
+aes_bitsliced_inverse_affine(word_t *q)
+{
+    word_t q0 = ~q[0], q1 = ~q[1], q2 = q[2], q3 = q[3];
+    word_t q4 = q[4], q5 = ~q[5], q6 = ~q[6], q7 = q[7];
+
+    q[7] = q1 ^ q4 ^ q6;
+    q[6] = q0 ^ q3 ^ q5;
+    q[5] = q7 ^ q2 ^ q4;
+    q[4] = q6 ^ q1 ^ q3;
+    q[3] = q5 ^ q0 ^ q2;
+    q[2] = q4 ^ q7 ^ q1;
+    q[1] = q3 ^ q6 ^ q0;
+    q[0] = q2 ^ q5 ^ q7;
+}
+
+static void
+aes_bitsliced_inverse_sbox(word_t *q)
+{
+    aes_bitsliced_inverse_affine(q);
+    aes_bitsliced_sbox(q);
+    aes_bitsliced_inverse_affine(q);
+}
+
+static void
+aes_bitsliced_shift_rows(word_t *q)
+{
+    for (int i = 0; i < 8; i++) {
+        word_t x = q[i];
+        q[i] = (x & 0x000000FFu)
+            | ((x & 0x0000FC00u) >> 2) | ((x & 0x00000300u) << 6)
+            | ((x & 0x00F00000u) >> 4) | ((x & 0x000F0000u) << 4)
+            | ((x & 0xC0000000u) >> 6) | ((x & 0x3F000000u) << 2);
+    }
+}
+
+static void
+aes_bitsliced_inverse_shift_rows(word_t *q)
+{
+    for (int i = 0; i < 8; i++) {
+        word_t x = q[i];
+        q[i] = (x & 0x000000FFu)
+            | ((x & 0x00003F00u) << 2) | ((x & 0x0000C000u) >> 6)
+            | ((x & 0x000F0000u) << 4) | ((x & 0x00F00000u) >> 4)
+            | ((x & 0x03000000u) << 6) | ((x & 0xFC000000u) >> 2);
+    }
+}
+
+static inline word_t
+rotr16(word_t x)
+{
+    return (x << 16) | (x >> 16);
+}
+
+static void
+aes_bitsliced_mix_columns(word_t *q)
+{
+    word_t q0 = q[0], q1 = q[1], q2 = q[2], q3 = q[3];
+    word_t q4 = q[4], q5 = q[5], q6 = q[6], q7 = q[7];
+    word_t r0 = (q0 >> 8) | (q0 << 24);
+    word_t r1 = (q1 >> 8) | (q1 << 24);
+    word_t r2 = (q2 >> 8) | (q2 << 24);
+    word_t r3 = (q3 >> 8) | (q3 << 24);
+    word_t r4 = (q4 >> 8) | (q4 << 24);
+    word_t r5 = (q5 >> 8) | (q5 << 24);
+    word_t r6 = (q6 >> 8) | (q6 << 24);
+    word_t r7 = (q7 >> 8) | (q7 << 24);
+
+    q[0] = q7 ^ r7 ^ r0 ^ rotr16(q0 ^ r0);
+    q[1] = q0 ^ r0 ^ q7 ^ r7 ^ r1 ^ rotr16(q1 ^ r1);
+    q[2] = q1 ^ r1 ^ r2 ^ rotr16(q2 ^ r2);
+    q[3] = q2 ^ r2 ^ q7 ^ r7 ^ r3 ^ rotr16(q3 ^ r3);
+    q[4] = q3 ^ r3 ^ q7 ^ r7 ^ r4 ^ rotr16(q4 ^ r4);
+    q[5] = q4 ^ r4 ^ r5 ^ rotr16(q5 ^ r5);
+    q[6] = q5 ^ r5 ^ r6 ^ rotr16(q6 ^ r6);
+    q[7] = q6 ^ r6 ^ r7 ^ rotr16(q7 ^ r7);
+}
+
+static void
+aes_bitsliced_inverse_mix_columns(word_t *q)
+{
+    word_t q0 = q[0], q1 = q[1], q2 = q[2], q3 = q[3];
+    word_t q4 = q[4], q5 = q[5], q6 = q[6], q7 = q[7];
+    word_t r0 = (q0 >> 8) | (q0 << 24);
+    word_t r1 = (q1 >> 8) | (q1 << 24);
+    word_t r2 = (q2 >> 8) | (q2 << 24);
+    word_t r3 = (q3 >> 8) | (q3 << 24);
+    word_t r4 = (q4 >> 8) | (q4 << 24);
+    word_t r5 = (q5 >> 8) | (q5 << 24);
+    word_t r6 = (q6 >> 8) | (q6 << 24);
+    word_t r7 = (q7 >> 8) | (q7 << 24);
+
+    q[0] = q5 ^ q6 ^ q7 ^ r0 ^ r5 ^ r7 ^ rotr16(q0 ^ q5 ^ q6 ^ r0 ^ r5);
+    q[1] = q0 ^ q5 ^ r0 ^ r1 ^ r5 ^ r6 ^ r7 ^ rotr16(q1 ^ q5 ^ q7 ^ r1 ^ r5 ^ r6);
+    q[2] = q0 ^ q1 ^ q6 ^ r1 ^ r2 ^ r6 ^ r7 ^ rotr16(q0 ^ q2 ^ q6 ^ r2 ^ r6 ^ r7);
+    q[3] = q0 ^ q1 ^ q2 ^ q5 ^ q6 ^ r0 ^ r2 ^ r3 ^ r5 ^ rotr16(q0 ^ q1 ^ q3 ^ q5 ^ q6 ^ q7 ^ r0 ^ r3 ^ r5 ^ r7);
+    q[4] = q1 ^ q2 ^ q3 ^ q5 ^ r1 ^ r3 ^ r4 ^ r5 ^ r6 ^ r7 ^ rotr16(q1 ^ q2 ^ q4 ^ q5 ^ q7 ^ r1 ^ r4 ^ r5 ^ r6);
+    q[5] = q2 ^ q3 ^ q4 ^ q6 ^ r2 ^ r4 ^ r5 ^ r6 ^ r7 ^ rotr16(q2 ^ q3 ^ q5 ^ q6 ^ r2 ^ r5 ^ r6 ^ r7);
+    q[6] = q3 ^ q4 ^ q5 ^ q7 ^ r3 ^ r5 ^ r6 ^ r7 ^ rotr16(q3 ^ q4 ^ q6 ^ q7 ^ r3 ^ r6 ^ r7);
+    q[7] = q4 ^ q5 ^ q6 ^ r4 ^ r6 ^ r7 ^ rotr16(q4 ^ q5 ^ q7 ^ r4 ^ r7);
+}
+
+static inline void
+aes_bitsliced_add_round_key(word_t *q, const word_t *round_key)
+{
+    for (int i = 0; i < 8; i++) {
+        q[i] ^= round_key[i];
+    }
+}
+
+static inline uint32_t
+load_le32(const uint8_t *p)
+{
+    return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static inline void
+store_le32(uint8_t *p, uint32_t x)
+{
+    p[0] = (uint8_t) x;
+    p[1] = (uint8_t) (x >> 8);
+    p[2] = (uint8_t) (x >> 16);
+    p[3] = (uint8_t) (x >> 24);
+}
+
+/* Lane k gets blocks 2k and 2k+1 */
+static void
+aes_bitsliced_load(word_t *q, const uint8_t *in)
+{
+    for (int lane = 0; lane < 4; lane++) {
+        for (int i = 0; i < 4; i++) {
+            q[2 * i][lane] = load_le32(in + 32 * lane + 4 * i);
+            q[2 * i + 1][lane] = load_le32(in + 32 * lane + 16 + 4 * i);
+        }
+    }
+    aes_bitsliced_ortho(q);
+}
+
+static void
+aes_bitsliced_store(word_t *q, uint8_t *out)
+{
+    aes_bitsliced_ortho(q);
+    for (int lane = 0; lane < 4; lane++) {
+        for (int i = 0; i < 4; i++) {
+            store_le32(out + 32 * lane + 4 * i, q[2 * i][lane]);
+            store_le32(out + 32 * lane + 16 + 4 * i, q[2 * i + 1][lane]);
+        }
+    }
+}
+
+static uint32_t
+aes_bitsliced_sub_word(uint32_t x)
+{
+    word_t q[8];
+
+    memset(q, 0, sizeof(q));
+    q[0][0] = x;
+    aes_bitsliced_ortho(q);
+    aes_bitsliced_sbox(q);
+    aes_bitsliced_ortho(q);
+    return q[0][0];
+}
+
+void
+aes_bitsliced_init(aes_bitsliced_key_t *key, const uint8_t raw[16])
+{
+    uint32_t w[44];
+    uint32_t rcon = 1;
+
+    for (int i = 0; i < 4; i++) {
+        w[i] = load_le32(raw + 4 * i);
+    }
+    for (int i = 4; i < 44; i++) {
+        uint32_t tmp = w[i - 1];
+        if (i % 4 == 0) {
+            tmp = aes_bitsliced_sub_word((tmp << 24) | (tmp >> 8)) ^ rcon;
+            rcon = (rcon << 1) ^ (0x11b & -(rcon >> 7));
+        }
+        w[i] = w[i - 4] ^ tmp;
+    }
+
+    for (int round = 0; round < 11; round++) {
+        word_t *q = key->round_keys[round];
+        for (int i = 0; i < 4; i++) {
+            uint32_t x = w[4 * round + i];
+            q[2 * i] = (word_t) { x, x, x, x };
+            q[2 * i + 1] = q[2 * i];
+        }
+        aes_bitsliced_ortho(q);
+    }
+}
+
+void
+aes_bitsliced_encrypt(const aes_bitsliced_key_t *key, const uint8_t *in, uint8_t *out)
+{
+    word_t q[8];
+
+    aes_bitsliced_load(q, in);
+    aes_bitsliced_add_round_key(q, key->round_keys[0]);
+    for (int round = 1; round < 10; round++) {
+        aes_bitsliced_sbox(q);
+        aes_bitsliced_shift_rows(q);
+        aes_bitsliced_mix_columns(q);
+        aes_bitsliced_add_round_key(q, key->round_keys[round]);
+    }
+    aes_bitsliced_sbox(q);
+    aes_bitsliced_shift_rows(q);
+    aes_bitsliced_add_round_key(q, key->round_keys[10]);
+    aes_bitsliced_store(q, out);
+}
+
+void
+aes_bitsliced_decrypt(const aes_bitsliced_key_t *key, const uint8_t *in, uint8_t *out)
+{
+    word_t q[8];
+
+    aes_bitsliced_load(q, in);
+    aes_bitsliced_add_round_key(q, key->round_keys[10]);
+    for (int round = 9; round > 0; round--) {
+        aes_bitsliced_inverse_shift_rows(q);
+        aes_bitsliced_inverse_sbox(q);
+        aes_bitsliced_add_round_key(q, key->round_keys[round]);
+        aes_bitsliced_inverse_mix_columns(q);
+    }
+    aes_bitsliced_inverse_shift_rows(q);
+    aes_bitsliced_inverse_sbox(q);
+    aes_bitsliced_add_round_key(q, key->round_keys[0]);
+    aes_bitsliced_store(q, out);
+}
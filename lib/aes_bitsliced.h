@@ -0,0 +1,42 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#ifndef AES_BITSLICED_H
+#define AES_BITSLICED_H
+
+#include <stdint.h>
+
+/*
+ * AES-128 on several blocks at once without table lookups, so its timing
+ * doesn't depend on the key or the data. The blocks are spread over the
+ * bits of eight words, one word per bit of a byte, and the S-box is a
+ * circuit of logic operations on them. Words are 128 bit vectors of four
+ * lanes, each lane holding two blocks, which compile to NEON on ARM and
+ * SSE2 on x86. It is for cores without AES instructions, where OpenSSL
+ * may fall back to table based code.
+ */
+
+#define AES_BITSLICED_BLOCKS 8
+
+typedef uint32_t aes_bitsliced_word_t __attribute__((vector_size(16)));
+
+typedef struct {
+    /* Round keys in the bitsliced layout */
+    aes_bitsliced_word_t round_keys[11][8];
+} aes_bitsliced_key_t;
+
+void aes_bitsliced_init(aes_bitsliced_key_t *key, const uint8_t raw[16]);
+/* Encrypt and decrypt AES_BITSLICED_BLOCKS blocks, in and out may be the same */
+void aes_bitsliced_encrypt(const aes_bitsliced_key_t *key, const uint8_t *in, uint8_t *out);
+void aes_bitsliced_decrypt(const aes_bitsliced_key_t *key, const uint8_t *in, uint8_t *out);
+
+#endif //AES_BITSLICED_H
@@ -0,0 +1,378 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "airplay.h"
+#include "raop.h"
+#include "dnssd.h"
+#include "frame_bus.h"
+#include "threads.h"
+
+static const unsigned char airplay_default_hw_addr[] = { 0x48, 0x5d, 0x60, 0x7c, 0xee, 0x22 };
+
+struct airplay_queue_s {
+    int kinds;
+    /* Guards the ring and dropping_video, fd is readable exactly while count is not 0 */
+    mutex_handle_t mutex;
+    const frame_bus_frame_t **frames;
+    unsigned int length;
+    unsigned int head;
+    unsigned int count;
+    /* A video frame was dropped, the ones after it are too up to the next keyframe */
+    bool dropping_video;
+    int fd;
+
+    uint64_t queued;
+    uint64_t dropped;
+};
+
+struct airplay_s {
+    raop_t *raop;
+    dnssd_t *dnssd;
+    unsigned short port;
+    bool running;
+    int width;
+    int height;
+    int refresh_rate;
+
+    airplay_queue_t *queues[AIRPLAY_MAX_QUEUES];
+    int queue_count;
+
+    unsigned int connections;
+};
+
+static void
+airplay_conn_init(void *cls)
+{
+    airplay_t *airplay = cls;
+    __atomic_fetch_add(&airplay->connections, 1, __ATOMIC_RELAXED);
+}
+
+static void
+airplay_conn_destroy(void *cls)
+{
+    airplay_t *airplay = cls;
+    __atomic_fetch_sub(&airplay->connections, 1, __ATOMIC_RELAXED);
+}
+
+/* Frames only go to the queues, through the frame bus */
+static void
+airplay_audio_process(void *cls, raop_ntp_t *ntp, aac_decode_struct *data)
+{
+}
+
+static int
+airplay_video_process(void *cls, raop_ntp_t *ntp, h264_decode_struct *data)
+{
+    return 0;
+}
+
+static void
+airplay_get_display_caps(void *cls, raop_display_caps_t *caps)
+{
+    airplay_t *airplay = cls;
+    if (airplay->width > 0 && airplay->height > 0) {
+        caps->width = airplay->width;
+        caps->height = airplay->height;
+    }
+    if (airplay->refresh_rate > 0) {
+        caps->refresh_rate = airplay->refresh_rate;
+    }
+}
+
+/* Called on a frame bus thread of a session, any number of them may push at once */
+static void
+airplay_queue_frame(void *cls, const frame_bus_frame_t *frame)
+{
+    airplay_queue_t *queue = cls;
+    bool drop = false;
+
+    MUTEX_LOCK(queue->mutex);
+    if (frame->kind == FRAME_BUS_VIDEO) {
+        if (queue->dropping_video && frame->keyframe) {
+            queue->dropping_video = false;
+        }
+        drop = queue->dropping_video;
+    }
+    if (!drop && queue->count == queue->length) {
+        drop = true;
+        if (frame->kind == FRAME_BUS_VIDEO) {
+            queue->dropping_video = true;
+        }
+    }
+    if (drop) {
+        queue->dropped++;
+    } else {
+        frame_bus_frame_retain(frame);
+        queue->frames[(queue->head + queue->count) % queue->length] = frame;
+        if (queue->count++ == 0) {
+            uint64_t one = 1;
+            if (write(queue->fd, &one, sizeof(one)) < 0) {
+                // Only fails once the counter is near overflow, which reading keeps it from
+            }
+        }
+        queue->queued++;
+    }
+    MUTEX_UNLOCK(queue->mutex);
+}
+
+unsigned int
+airplay_get_api_version(void)
+{
+    return AIRPLAY_API_VERSION;
+}
+
+airplay_t *
+airplay_create(const airplay_config_t *config)
+{
+    raop_callbacks_t raop_cbs;
+    airplay_t *airplay;
+    const unsigned char *hw_addr;
+    int error = 0;
+
+    if (!config || config->api_version >> 16 != AIRPLAY_API_VERSION_MAJOR || !config->name) {
+        return NULL;
+    }
+    airplay = calloc(1, sizeof(airplay_t));
+    if (!airplay) {
+        return NULL;
+    }
+    airplay->port = config->port;
+    airplay->width = config->width;
+    airplay->height = config->height;
+    airplay->refresh_rate = config->refresh_rate;
+
+    memset(&raop_cbs, 0, sizeof(raop_cbs));
+    raop_cbs.cls = airplay;
+    raop_cbs.conn_init = airplay_conn_init;
+    raop_cbs.conn_destroy = airplay_conn_destroy;
+    raop_cbs.audio_process = airplay_audio_process;
+    raop_cbs.video_process = airplay_video_process;
+    raop_cbs.get_display_caps = airplay_get_display_caps;
+    airplay->raop = raop_init(10, &raop_cbs);
+    if (!airplay->raop) {
+        free(airplay);
+        return NULL;
+    }
+    if (config->log_callback) {
+        raop_set_log_callback(airplay->raop, config->log_callback, config->log_cls);
+        raop_set_log_level(airplay->raop, config->log_level);
+    }
+    if (config->keyfile && raop_set_keyfile(airplay->raop, config->keyfile) < 0) {
+        raop_destroy(airplay->raop);
+        free(airplay);
+        return NULL;
+    }
+
+    hw_addr = config->hw_addr ? config->hw_addr : airplay_default_hw_addr;
+    airplay->dnssd = dnssd_init(config->name, strlen(config->name), (const char *) hw_addr, 6, &error);
+    if (error) {
+        raop_destroy(airplay->raop);
+        free(airplay);
+        return NULL;
+    }
+    dnssd_set_hevc(airplay->dnssd, config->hevc);
+    raop_set_dnssd(airplay->raop, airplay->dnssd);
+    return airplay;
+}
+
+airplay_queue_t *
+airplay_queue_create(airplay_t *airplay, int kinds, unsigned int length)
+{
+    airplay_queue_t *queue;
+
+    if (airplay->running || airplay->queue_count >= AIRPLAY_MAX_QUEUES || length == 0 ||
+        !(kinds & (AIRPLAY_FRAME_VIDEO | AIRPLAY_FRAME_CODEC | AIRPLAY_FRAME_AUDIO))) {
+        return NULL;
+    }
+    queue = calloc(1, sizeof(airplay_queue_t));
+    if (!queue) {
+        return NULL;
+    }
+    queue->kinds = kinds;
+    queue->length = length;
+    queue->frames = calloc(length, sizeof(frame_bus_frame_t *));
+    queue->fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (!queue->frames || queue->fd < 0) {
+        free(queue->frames);
+        if (queue->fd >= 0) close(queue->fd);
+        free(queue);
+        return NULL;
+    }
+    MUTEX_CREATE(queue->mutex);
+
+    // The frame bus enums have the same values, the queue does its own dropping
+    frame_bus_subscriber_config_t config = {
+        "airplay_queue", kinds, length, 0, FRAME_BUS_DROP_TO_KEYFRAME, airplay_queue_frame, queue
+    };
+    if (raop_add_frame_consumer(airplay->raop, &config) < 0) {
+        MUTEX_DESTROY(queue->mutex);
+        close(queue->fd);
+        free(queue->frames);
+        free(queue);
+        return NULL;
+    }
+    airplay->queues[airplay->queue_count++] = queue;
+    return queue;
+}
+
+int
+airplay_start(airplay_t *airplay)
+{
+    unsigned short port = airplay->port;
+
+    if (airplay->running) {
+        return 0;
+    }
+    if (raop_start(airplay->raop, &port) < 0) {
+        return -1;
+    }
+    raop_set_port(airplay->raop, port);
+    if (dnssd_register_raop(airplay->dnssd, port) != 0 || dnssd_register_airplay(airplay->dnssd, port + 1) != 0) {
+        dnssd_unregister_raop(airplay->dnssd);
+        raop_stop(airplay->raop);
+        return -1;
+    }
+    airplay->port = port;
+    airplay->running = true;
+    return 0;
+}
+
+unsigned short
+airplay_get_port(airplay_t *airplay)
+{
+    return airplay->running ? airplay->port : 0;
+}
+
+void
+airplay_get_stats(airplay_t *airplay, airplay_stats_t *stats)
+{
+    memset(stats, 0, sizeof(airplay_stats_t));
+    stats->connections = __atomic_load_n(&airplay->connections, __ATOMIC_RELAXED);
+    for (int i = 0; i < airplay->queue_count; i++) {
+        airplay_queue_stats_t queue_stats;
+        airplay_queue_get_stats(airplay->queues[i], &queue_stats);
+        stats->frames_queued += queue_stats.queued;
+        stats->frames_dropped += queue_stats.dropped;
+    }
+}
+
+void
+airplay_stop(airplay_t *airplay)
+{
+    if (!airplay->running) {
+        return;
+    }
+    dnssd_unregister_airplay(airplay->dnssd);
+    dnssd_unregister_raop(airplay->dnssd);
+    raop_stop(airplay->raop);
+    airplay->running = false;
+}
+
+void
+airplay_destroy(airplay_t *airplay)
+{
+    if (!airplay) {
+        return;
+    }
+    airplay_stop(airplay);
+    // Joins the frame bus threads, nothing pushes to the queues after it
+    raop_destroy(airplay->raop);
+    dnssd_destroy(airplay->dnssd);
+    for (int i = 0; i < airplay->queue_count; i++) {
+        airplay_queue_t *queue = airplay->queues[i];
+        for (unsigned int j = 0; j < queue->count; j++) {
+            frame_bus_frame_release(queue->frames[(queue->head + j) % queue->length]);
+        }
+        MUTEX_DESTROY(queue->mutex);
+        close(queue->fd);
+        free(queue->frames);
+        free(queue);
+    }
+    free(airplay);
+}
+
+airplay_frame_t *
+airplay_queue_pop(airplay_queue_t *queue, int timeout_ms)
+{
+    const frame_bus_frame_t *frame = NULL;
+    struct pollfd pfd = { queue->fd, POLLIN, 0 };
+
+    for (;;) {
+        MUTEX_LOCK(queue->mutex);
+        if (queue->count > 0) {
+            frame = queue->frames[queue->head];
+            queue->head = (queue->head + 1) % queue->length;
+            if (--queue->count == 0) {
+                uint64_t value;
+                if (read(queue->fd, &value, sizeof(value)) < 0) {
+                    // Already reset
+                }
+            }
+        }
+        MUTEX_UNLOCK(queue->mutex);
+        // Another thread popping the same queue may take the frame between the poll and the lock
+        if (frame || timeout_ms == 0 || poll(&pfd, 1, timeout_ms) <= 0) {
+            break;
+        }
+    }
+    return (airplay_frame_t *) frame;
+}
+
+int
+airplay_queue_get_fd(airplay_queue_t *queue)
+{
+    return queue->fd;
+}
+
+void
+airplay_queue_get_stats(airplay_queue_t *queue, airplay_queue_stats_t *stats)
+{
+    MUTEX_LOCK(queue->mutex);
+    stats->length = queue->count;
+    stats->queued = queue->queued;
+    stats->dropped = queue->dropped;
+    MUTEX_UNLOCK(queue->mutex);
+}
+
+void
+airplay_frame_get_info(const airplay_frame_t *frame, airplay_frame_info_t *info)
+{
+    const frame_bus_frame_t *bus_frame = (const frame_bus_frame_t *) frame;
+
+    info->kind = (airplay_frame_kind_t) bus_frame->kind;
+    info->data = bus_frame->data;
+    info->size = bus_frame->data_len;
+    info->pts = bus_frame->pts;
+    info->keyframe = bus_frame->keyframe;
+    info->hevc = bus_frame->codec == VIDEO_CODEC_H265;
+    info->width = bus_frame->width;
+    info->height = bus_frame->height;
+}
+
+void
+airplay_frame_retain(const airplay_frame_t *frame)
+{
+    frame_bus_frame_retain((const frame_bus_frame_t *) frame);
+}
+
+void
+airplay_frame_release(const airplay_frame_t *frame)
+{
+    frame_bus_frame_release((const frame_bus_frame_t *) frame);
+}
@@ -0,0 +1,153 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#ifndef AIRPLAY_H
+#define AIRPLAY_H
+
+#include <stdint.h>
+
+#if defined (WIN32) && defined(DLL_EXPORT)
+# define AIRPLAY_API __declspec(dllexport)
+#elif defined(__GNUC__)
+# define AIRPLAY_API __attribute__((visibility("default")))
+#else
+# define AIRPLAY_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * The receiver for applications that embed it, the API of libairplay.so.
+ *
+ * The mirrored video and the AAC-ELD audio arrive as refcounted frames in
+ * queues the application creates before starting. It takes them on whatever
+ * thread it likes with airplay_queue_pop, or from its own event loop when the
+ * queue's fd turns readable, and holds on to them as long as it needs without
+ * a copy; the receiver never waits for it, a full queue drops. Nothing is
+ * decoded or shown by the receiver itself.
+ *
+ * Only this header is part of the API, everything else in the library may
+ * change between releases. Binaries built against another major version are
+ * refused by airplay_create.
+ */
+
+#define AIRPLAY_API_VERSION_MAJOR 1
+#define AIRPLAY_API_VERSION_MINOR 0
+#define AIRPLAY_API_VERSION ((AIRPLAY_API_VERSION_MAJOR << 16) | AIRPLAY_API_VERSION_MINOR)
+
+/* Queues per receiver */
+#define AIRPLAY_MAX_QUEUES 4
+
+typedef struct airplay_s airplay_t;
+typedef struct airplay_queue_s airplay_queue_t;
+typedef struct airplay_frame_s airplay_frame_t;
+
+typedef enum {
+    /* Annex-B access unit */
+    AIRPLAY_FRAME_VIDEO = 1,
+    /* Annex-B parameter sets of the access units that follow, width and height set */
+    AIRPLAY_FRAME_CODEC = 2,
+    /* AAC-ELD frame, 480 samples at 44100 Hz */
+    AIRPLAY_FRAME_AUDIO = 4
+} airplay_frame_kind_t;
+
+typedef void (*airplay_log_callback_t)(void *cls, int level, const char *msg);
+
+typedef struct {
+    /* AIRPLAY_API_VERSION of the header the caller was built with */
+    unsigned int api_version;
+    /* Shown on the senders */
+    const char *name;
+    /* 6 bytes the receiver is known by, NULL for a fixed default */
+    const unsigned char *hw_addr;
+    /* Pairing identity, created if missing, NULL for a new one each start */
+    const char *keyfile;
+    /* Port to listen on, 0 for any */
+    unsigned short port;
+    /* Display advertised to senders, 0 for 1920x1080 at 60 Hz */
+    int width;
+    int height;
+    int refresh_rate;
+    /* Offer HEVC mirroring, the application decodes it */
+    int hevc;
+    /* Syslog levels 0-7 up to log_level go to log_callback, NULL for warnings and errors on stderr */
+    airplay_log_callback_t log_callback;
+    void *log_cls;
+    int log_level;
+} airplay_config_t;
+
+typedef struct {
+    airplay_frame_kind_t kind;
+    /* Valid while the frame is retained */
+    const unsigned char *data;
+    int size;
+    /* us on CLOCK_MONOTONIC when the frame is due, 0 for codec frames */
+    uint64_t pts;
+    /* Video frame decoding can start at */
+    int keyframe;
+    /* Video in HEVC rather than H.264 */
+    int hevc;
+    /* Of codec frames */
+    int width;
+    int height;
+} airplay_frame_info_t;
+
+typedef struct {
+    unsigned int connections;
+    uint64_t frames_queued;
+    uint64_t frames_dropped;
+} airplay_stats_t;
+
+typedef struct {
+    /* Frames waiting */
+    unsigned int length;
+    uint64_t queued;
+    /* Dropped as the queue was full, or as video after one until the next keyframe */
+    uint64_t dropped;
+} airplay_queue_stats_t;
+
+/* AIRPLAY_API_VERSION of the library */
+AIRPLAY_API unsigned int airplay_get_api_version(void);
+
+/* NULL if config is for another major version or the receiver could not be set up */
+AIRPLAY_API airplay_t *airplay_create(const airplay_config_t *config);
+/* A queue for the airplay_frame_kind_t flags in kinds, holding up to length frames. Only before airplay_start.
+ * It belongs to the receiver and goes with airplay_destroy. */
+AIRPLAY_API airplay_queue_t *airplay_queue_create(airplay_t *airplay, int kinds, unsigned int length);
+/* Listens and announces the receiver, 0 on success */
+AIRPLAY_API int airplay_start(airplay_t *airplay);
+AIRPLAY_API unsigned short airplay_get_port(airplay_t *airplay);
+AIRPLAY_API void airplay_get_stats(airplay_t *airplay, airplay_stats_t *stats);
+/* Closes the connections and withdraws the announcement, airplay_start starts again */
+AIRPLAY_API void airplay_stop(airplay_t *airplay);
+/* Frames the application still holds stay valid until it releases them */
+AIRPLAY_API void airplay_destroy(airplay_t *airplay);
+
+/* The next frame, waiting up to timeout_ms (-1 for no limit). The caller holds a reference to it,
+ * NULL on timeout */
+AIRPLAY_API airplay_frame_t *airplay_queue_pop(airplay_queue_t *queue, int timeout_ms);
+/* Readable while the queue holds frames, for poll and epoll; must not be read or closed */
+AIRPLAY_API int airplay_queue_get_fd(airplay_queue_t *queue);
+AIRPLAY_API void airplay_queue_get_stats(airplay_queue_t *queue, airplay_queue_stats_t *stats);
+
+AIRPLAY_API void airplay_frame_get_info(const airplay_frame_t *frame, airplay_frame_info_t *info);
+/* Frames may be retained and released on any thread */
+AIRPLAY_API void airplay_frame_retain(const airplay_frame_t *frame);
+AIRPLAY_API void airplay_frame_release(const airplay_frame_t *frame);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //AIRPLAY_H
@@ -0,0 +1,120 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <string.h>
+#include <assert.h>
+
+#include "audio_capture.h"
+
+static void
+audio_capture_index_packet(const unsigned char *record, const unsigned char *data, capture_file_index_entry_t *entry)
+{
+    audio_capture_packet_t packet;
+
+    memcpy(&packet, record, sizeof(packet));
+    entry->arrival_time = packet.arrival_time;
+    entry->type = packet.channel;
+    // The RTP timestamp, the header is not encrypted
+    if (packet.channel == AUDIO_CAPTURE_CHANNEL_DATA && packet.size >= 12) {
+        entry->pts = ((uint32_t) data[4] << 24) | ((uint32_t) data[5] << 16) | ((uint32_t) data[6] << 8) | data[7];
+    }
+}
+
+static const capture_file_format_t audio_capture_format = {
+    sizeof(audio_capture_header_t), sizeof(audio_capture_packet_t), offsetof(audio_capture_packet_t, size),
+    audio_capture_index_packet
+};
+
+static bool
+audio_capture_header_valid(const audio_capture_header_t *header)
+{
+    return !memcmp(header->magic, AUDIO_CAPTURE_MAGIC, sizeof(header->magic)) &&
+           header->version == AUDIO_CAPTURE_VERSION &&
+           header->packet_header_size == sizeof(audio_capture_packet_t);
+}
+
+audio_capture_t *
+audio_capture_open(logger_t *logger, const char *filename, const audio_capture_header_t *header)
+{
+    audio_capture_header_t file_header = *header;
+
+    memcpy(file_header.magic, AUDIO_CAPTURE_MAGIC, sizeof(file_header.magic));
+    file_header.version = AUDIO_CAPTURE_VERSION;
+    file_header.packet_header_size = sizeof(audio_capture_packet_t);
+    return capture_file_open(logger, filename, &audio_capture_format, &file_header);
+}
+
+int
+audio_capture_write(audio_capture_t *capture, const audio_capture_packet_t *packet, const unsigned char *data)
+{
+    assert(packet);
+    return capture_file_write(capture, packet, data, packet->size);
+}
+
+void
+audio_capture_close(audio_capture_t *capture)
+{
+    capture_file_close(capture);
+}
+
+audio_capture_reader_t *
+audio_capture_reader_open(const char *filename, audio_capture_header_t *header)
+{
+    capture_file_reader_t *reader;
+
+    reader = capture_file_reader_open(filename, header, sizeof(audio_capture_header_t));
+    if (!reader) {
+        return NULL;
+    }
+    if (!audio_capture_header_valid(header)) {
+        capture_file_reader_close(reader);
+        return NULL;
+    }
+    return reader;
+}
+
+int
+audio_capture_reader_next(audio_capture_reader_t *reader, audio_capture_packet_t *packet)
+{
+    return capture_file_reader_next(reader, packet, sizeof(audio_capture_packet_t));
+}
+
+int
+audio_capture_reader_data(audio_capture_reader_t *reader, unsigned char *data, uint32_t size)
+{
+    return capture_file_reader_payload(reader, data, size);
+}
+
+void
+audio_capture_reader_close(audio_capture_reader_t *reader)
+{
+    capture_file_reader_close(reader);
+}
+
+audio_capture_map_t *
+audio_capture_map_open(const char *filename, audio_capture_header_t *header)
+{
+    capture_file_map_t *map;
+
+    map = capture_file_map_open(filename, &audio_capture_format);
+    if (!map) {
+        return NULL;
+    }
+    memcpy(header, capture_file_map_get_header(map), sizeof(audio_capture_header_t));
+    if (!audio_capture_header_valid(header)) {
+        capture_file_map_close(map);
+        return NULL;
+    }
+    return map;
+}
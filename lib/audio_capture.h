@@ -0,0 +1,86 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#ifndef AUDIO_CAPTURE_H
+#define AUDIO_CAPTURE_H
+
+#include <stdint.h>
+#include "logger.h"
+#include "capture_file.h"
+
+/*
+ * Capture of the audio datagrams of a session as they came off the wire,
+ * for replaying them offline, written through capture_file.
+ *
+ * A capture file is an audio_capture_header_t followed by one
+ * audio_capture_packet_t and its datagram per packet, all in host byte
+ * order. Data and control datagrams are kept in arrival order. The header
+ * holds the key material, so capture files are as sensitive as the session
+ * itself.
+ *
+ * In the index, type is the channel of a packet and pts the RTP timestamp of
+ * a data packet, 0 for control packets.
+ */
+
+#define AUDIO_CAPTURE_MAGIC "RPAUDCP1"
+#define AUDIO_CAPTURE_VERSION 1
+
+#define AUDIO_CAPTURE_CHANNEL_DATA 0
+#define AUDIO_CAPTURE_CHANNEL_CONTROL 1
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t packet_header_size;
+    /* Key material as received in SETUP, the stream key is derived from it */
+    unsigned char aeskey[16];
+    unsigned char aesiv[16];
+    unsigned char ecdh_secret[32];
+    /* Whether the sender answered resend requests */
+    uint32_t resend;
+    /* The stream's raop_audio_compression_t and samples per frame, 0 in captures of AAC-ELD from
+     * before they were recorded */
+    uint16_t compression;
+    uint16_t samples_per_frame;
+} audio_capture_header_t;
+
+typedef struct {
+    /* Local time at which the datagram was received, in us */
+    uint64_t arrival_time;
+    /* Remote minus local clock at arrival, to map sync packets to the local clock */
+    int64_t clock_offset;
+    uint32_t size;
+    uint8_t channel;
+    uint8_t reserved[3];
+} audio_capture_packet_t;
+
+typedef capture_file_t audio_capture_t;
+typedef capture_file_reader_t audio_capture_reader_t;
+typedef capture_file_map_t audio_capture_map_t;
+
+audio_capture_t *audio_capture_open(logger_t *logger, const char *filename, const audio_capture_header_t *header);
+/* Queues a datagram for writing, returns -1 if it had to be dropped. Only one thread may write. */
+int audio_capture_write(audio_capture_t *capture, const audio_capture_packet_t *packet, const unsigned char *data);
+/* Writes out everything still queued */
+void audio_capture_close(audio_capture_t *capture);
+
+audio_capture_reader_t *audio_capture_reader_open(const char *filename, audio_capture_header_t *header);
+/* Reads the next packet header, returns 1 on success, 0 at the end of the capture and -1 on error */
+int audio_capture_reader_next(audio_capture_reader_t *reader, audio_capture_packet_t *packet);
+/* Reads the datagram of the packet last returned by audio_capture_reader_next */
+int audio_capture_reader_data(audio_capture_reader_t *reader, unsigned char *data, uint32_t size);
+void audio_capture_reader_close(audio_capture_reader_t *reader);
+
+/* Maps a capture for random access, read with the capture_file_map functions. NULL if it is no audio capture. */
+audio_capture_map_t *audio_capture_map_open(const char *filename, audio_capture_header_t *header);
+
+#endif //AUDIO_CAPTURE_H
@@ -0,0 +1,334 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "audio_playout.h"
+#include "threads.h"
+#include "stream.h"
+#include "trace.h"
+#include "thread_attr.h"
+
+/* Queued packets, a little under three seconds of AAC-ELD */
+#define AUDIO_PLAYOUT_CAPACITY 256
+
+/* Packets are handed to the renderer this long before their pts, in microseconds */
+#define AUDIO_PLAYOUT_LEAD_TIME 50000
+
+/* Longest single sleep, so a queue that fills up early is noticed */
+#define AUDIO_PLAYOUT_MAX_SLEEP 20000
+
+/* Initial payload storage per entry, grown for larger packets */
+#define AUDIO_PLAYOUT_SLOT_SIZE 2048
+
+typedef struct {
+    unsigned char *data;
+    unsigned int data_len;
+    unsigned int data_size;
+    uint64_t pts;
+} audio_playout_entry_t;
+
+struct audio_playout_s {
+    logger_t *logger;
+    raop_ntp_t *ntp;
+    raop_callbacks_t *callbacks;
+
+    /* The entry at head is only touched by the playout thread, the one at tail by the queueing thread */
+    audio_playout_entry_t entries[AUDIO_PLAYOUT_CAPACITY];
+    unsigned int head;
+    unsigned int tail;
+
+    /* MUTEX LOCKED VARIABLES START */
+    bool running;
+    bool flush;
+    unsigned int flush_tail;
+    bool volume_changed;
+    float volume;
+    audio_playout_stats_t stats;
+    thread_handle_t thread;
+    mutex_handle_t mutex;
+    cond_handle_t cond;
+    /* MUTEX LOCKED VARIABLES END */
+};
+
+audio_playout_t *
+audio_playout_init(logger_t *logger, raop_ntp_t *ntp, raop_callbacks_t *callbacks)
+{
+    audio_playout_t *playout;
+
+    assert(logger);
+    assert(callbacks);
+
+    playout = calloc(1, sizeof(audio_playout_t));
+    if (!playout) {
+        return NULL;
+    }
+    playout->logger = logger;
+    playout->ntp = ntp;
+    playout->callbacks = callbacks;
+    MUTEX_CREATE(playout->mutex);
+    COND_CREATE_MONOTONIC(playout->cond);
+    return playout;
+}
+
+static void
+audio_playout_wait_until(audio_playout_t *playout, uint64_t time)
+{
+    struct timespec abstime;
+    abstime.tv_sec = time / 1000000;
+    abstime.tv_nsec = (time % 1000000) * 1000;
+    COND_TIMEDWAIT(playout->cond, playout->mutex, abstime);
+}
+
+static void
+audio_playout_frame_release(void *opaque, unsigned char *buffer)
+{
+    free(buffer);
+}
+
+/* Moves the entry's storage into a frame for the renderer, the slot allocates anew when it is next queued */
+static void
+audio_playout_process_frame(audio_playout_t *playout, audio_playout_entry_t *entry, aac_decode_struct *aac_data)
+{
+    stream_frame_t *frame;
+
+    frame = stream_frame_new(entry->data, entry->data, entry->data_len, entry->pts, audio_playout_frame_release, NULL);
+    entry->data = NULL;
+    entry->data_size = 0;
+    if (!frame) {
+        logger_log(playout->logger, LOGGER_ERR, "audio_playout could not allocate a stream frame");
+        return;
+    }
+    playout->callbacks->audio_process_frame(playout->callbacks->cls, playout->ntp, frame, aac_data);
+}
+
+static THREAD_RETVAL
+audio_playout_thread(void *arg)
+{
+    audio_playout_t *playout = arg;
+    assert(playout);
+
+    thread_attr_apply(playout->logger, THREAD_ROLE_AUDIO, "rp-playout");
+    MUTEX_LOCK(playout->mutex);
+    while (playout->running) {
+        if (playout->flush) {
+            playout->flush = false;
+            playout->head = playout->flush_tail;
+            playout->stats.flushes++;
+            MUTEX_UNLOCK(playout->mutex);
+            if (playout->callbacks->audio_flush) {
+                playout->callbacks->audio_flush(playout->callbacks->cls);
+            }
+            MUTEX_LOCK(playout->mutex);
+            continue;
+        }
+        if (playout->volume_changed) {
+            float volume = playout->volume;
+            playout->volume_changed = false;
+            MUTEX_UNLOCK(playout->mutex);
+            if (playout->callbacks->audio_set_volume) {
+                playout->callbacks->audio_set_volume(playout->callbacks->cls, volume);
+            }
+            MUTEX_LOCK(playout->mutex);
+            continue;
+        }
+
+        unsigned int depth = playout->tail - playout->head;
+        if (depth == 0) {
+            COND_WAIT(playout->cond, playout->mutex);
+            continue;
+        }
+
+        /* Wait for the packet's turn, unless the queue is filling up */
+        audio_playout_entry_t *entry = &playout->entries[playout->head % AUDIO_PLAYOUT_CAPACITY];
+        uint64_t now = raop_ntp_get_local_time(playout->ntp);
+        uint64_t due = entry->pts > AUDIO_PLAYOUT_LEAD_TIME ? entry->pts - AUDIO_PLAYOUT_LEAD_TIME : 0;
+        if (now < due && depth < AUDIO_PLAYOUT_CAPACITY / 2) {
+            audio_playout_wait_until(playout, due - now > AUDIO_PLAYOUT_MAX_SLEEP ? now + AUDIO_PLAYOUT_MAX_SLEEP : due);
+            continue;
+        }
+        if (now > entry->pts) {
+            playout->stats.late++;
+        }
+        MUTEX_UNLOCK(playout->mutex);
+
+        aac_decode_struct aac_data;
+        aac_data.data_len = entry->data_len;
+        aac_data.data = entry->data;
+        aac_data.pts = entry->pts;
+        trace_event(TRACE_AUDIO_PLAYOUT, entry->data_len, entry->pts);
+        if (entry->data_len == 0) {
+            /* Lost packet, there is no buffer to hand over */
+            aac_data.data = NULL;
+            playout->callbacks->audio_process(playout->callbacks->cls, playout->ntp, &aac_data);
+        } else if (playout->callbacks->audio_process_frame) {
+            audio_playout_process_frame(playout, entry, &aac_data);
+        } else {
+            playout->callbacks->audio_process(playout->callbacks->cls, playout->ntp, &aac_data);
+        }
+
+        MUTEX_LOCK(playout->mutex);
+        playout->head++;
+        playout->stats.played++;
+    }
+    MUTEX_UNLOCK(playout->mutex);
+
+    logger_log(playout->logger, LOGGER_DEBUG, "audio_playout exiting thread");
+    return 0;
+}
+
+int
+audio_playout_start(audio_playout_t *playout)
+{
+    assert(playout);
+
+    MUTEX_LOCK(playout->mutex);
+    if (playout->running) {
+        MUTEX_UNLOCK(playout->mutex);
+        return 0;
+    }
+    playout->head = playout->tail = 0;
+    playout->flush = false;
+    playout->volume_changed = false;
+    memset(&playout->stats, 0, sizeof(audio_playout_stats_t));
+    playout->running = true;
+    THREAD_CREATE(playout->thread, audio_playout_thread, playout);
+    MUTEX_UNLOCK(playout->mutex);
+    return 0;
+}
+
+void
+audio_playout_stop(audio_playout_t *playout)
+{
+    assert(playout);
+
+    MUTEX_LOCK(playout->mutex);
+    if (!playout->running) {
+        MUTEX_UNLOCK(playout->mutex);
+        return;
+    }
+    playout->running = false;
+    COND_SIGNAL(playout->cond);
+    MUTEX_UNLOCK(playout->mutex);
+
+    THREAD_JOIN(playout->thread);
+
+    logger_log(playout->logger, LOGGER_INFO, "audio_playout played %llu of %llu packets, lost = %llu, late = %llu, overflows = %llu, flushes = %llu, peak depth = %u",
+               (unsigned long long) playout->stats.played, (unsigned long long) playout->stats.queued,
+               (unsigned long long) playout->stats.lost,
+               (unsigned long long) playout->stats.late, (unsigned long long) playout->stats.overflows,
+               (unsigned long long) playout->stats.flushes, playout->stats.peak_depth);
+}
+
+/*
+ * Copies the packet to the queue, never blocks. Returns -1 if the queue is full.
+ * A data_len of 0 queues a packet lost in the network, it is handed to
+ * audio_process at its pts like any other so the renderer can conceal it.
+ */
+int
+audio_playout_queue(audio_playout_t *playout, const unsigned char *data, unsigned int data_len, uint64_t pts)
+{
+    assert(playout);
+
+    MUTEX_LOCK(playout->mutex);
+    unsigned int tail = playout->tail;
+    unsigned int depth = tail - playout->head;
+    if (depth >= AUDIO_PLAYOUT_CAPACITY) {
+        playout->stats.overflows++;
+        MUTEX_UNLOCK(playout->mutex);
+        return -1;
+    }
+    MUTEX_UNLOCK(playout->mutex);
+
+    audio_playout_entry_t *entry = &playout->entries[tail % AUDIO_PLAYOUT_CAPACITY];
+    if (data_len > entry->data_size) {
+        unsigned int data_size = data_len > AUDIO_PLAYOUT_SLOT_SIZE ? data_len : AUDIO_PLAYOUT_SLOT_SIZE;
+        unsigned char *entry_data = realloc(entry->data, data_size);
+        if (!entry_data) {
+            return -1;
+        }
+        entry->data = entry_data;
+        entry->data_size = data_size;
+    }
+    if (data_len > 0) {
+        memcpy(entry->data, data, data_len);
+    } else {
+        playout->stats.lost++;
+    }
+    entry->data_len = data_len;
+    entry->pts = pts;
+
+    MUTEX_LOCK(playout->mutex);
+    playout->tail = tail + 1;
+    playout->stats.queued++;
+    if (depth + 1 > playout->stats.peak_depth) {
+        playout->stats.peak_depth = depth + 1;
+    }
+    COND_SIGNAL(playout->cond);
+    MUTEX_UNLOCK(playout->mutex);
+    return 0;
+}
+
+void
+audio_playout_flush(audio_playout_t *playout)
+{
+    assert(playout);
+
+    MUTEX_LOCK(playout->mutex);
+    /* Only what is queued so far gets dropped */
+    playout->flush = true;
+    playout->flush_tail = playout->tail;
+    COND_SIGNAL(playout->cond);
+    MUTEX_UNLOCK(playout->mutex);
+}
+
+void
+audio_playout_set_volume(audio_playout_t *playout, float volume)
+{
+    assert(playout);
+
+    MUTEX_LOCK(playout->mutex);
+    playout->volume = volume;
+    playout->volume_changed = true;
+    COND_SIGNAL(playout->cond);
+    MUTEX_UNLOCK(playout->mutex);
+}
+
+void
+audio_playout_get_stats(audio_playout_t *playout, audio_playout_stats_t *stats)
+{
+    assert(playout);
+    assert(stats);
+
+    MUTEX_LOCK(playout->mutex);
+    memcpy(stats, &playout->stats, sizeof(audio_playout_stats_t));
+    stats->depth = playout->tail - playout->head;
+    MUTEX_UNLOCK(playout->mutex);
+}
+
+void
+audio_playout_destroy(audio_playout_t *playout)
+{
+    if (playout) {
+        audio_playout_stop(playout);
+        for (int i = 0; i < AUDIO_PLAYOUT_CAPACITY; i++) {
+            free(playout->entries[i].data);
+        }
+        COND_DESTROY(playout->cond);
+        MUTEX_DESTROY(playout->mutex);
+        free(playout);
+    }
+}
@@ -0,0 +1,53 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#ifndef AUDIO_PLAYOUT_H
+#define AUDIO_PLAYOUT_H
+
+#include <stdint.h>
+#include "logger.h"
+#include "raop.h"
+#include "raop_ntp.h"
+
+/*
+ * Audio playout thread. The network thread queues audio packets without
+ * blocking, and the playout thread hands each one to the audio callbacks
+ * shortly before its pts. Flush and volume changes go through the same
+ * thread, so the renderer is only ever called from one thread.
+ */
+
+typedef struct audio_playout_s audio_playout_t;
+
+typedef struct {
+    /* Packets queued, handed to the renderer, and handed over after their pts */
+    uint64_t queued;
+    uint64_t played;
+    uint64_t late;
+    /* Lost packets queued as gaps to conceal */
+    uint64_t lost;
+    /* Packets dropped because the queue was full, and flushes */
+    uint64_t overflows;
+    uint64_t flushes;
+    unsigned int depth;
+    unsigned int peak_depth;
+} audio_playout_stats_t;
+
+audio_playout_t *audio_playout_init(logger_t *logger, raop_ntp_t *ntp, raop_callbacks_t *callbacks);
+int audio_playout_start(audio_playout_t *playout);
+void audio_playout_stop(audio_playout_t *playout);
+int audio_playout_queue(audio_playout_t *playout, const unsigned char *data, unsigned int data_len, uint64_t pts);
+void audio_playout_flush(audio_playout_t *playout);
+void audio_playout_set_volume(audio_playout_t *playout, float volume);
+void audio_playout_get_stats(audio_playout_t *playout, audio_playout_stats_t *stats);
+void audio_playout_destroy(audio_playout_t *playout);
+
+#endif //AUDIO_PLAYOUT_H
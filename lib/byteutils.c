@@ -73,6 +73,13 @@ float byteutils_get_float(unsigned char* b, int offset) {
     return *((float*)(b + offset));
 }
 
+/**
+ * Writes a little endian unsigned 16 bit integer to the buffer at position offset
+ */
+void byteutils_put_short(unsigned char* b, int offset, uint16_t value) {
+    *((uint16_t*)(b + offset)) = value;
+}
+
 /**
  * Writes a little endian unsigned 32 bit integer to the buffer at position offset
  */
@@ -80,6 +87,34 @@ void byteutils_put_int(unsigned char* b, int offset, uint32_t value) {
     *((uint32_t*)(b + offset)) = value;
 }
 
+/**
+ * Writes a little endian unsigned 64 bit integer to the buffer at position offset
+ */
+void byteutils_put_long(unsigned char* b, int offset, uint64_t value) {
+    *((uint64_t*)(b + offset)) = value;
+}
+
+/**
+ * Writes a big endian unsigned 16 bit integer to the buffer at position offset
+ */
+void byteutils_put_short_be(unsigned char* b, int offset, uint16_t value) {
+    byteutils_put_short(b, offset, htons(value));
+}
+
+/**
+ * Writes a big endian unsigned 32 bit integer to the buffer at position offset
+ */
+void byteutils_put_int_be(unsigned char* b, int offset, uint32_t value) {
+    byteutils_put_int(b, offset, htonl(value));
+}
+
+/**
+ * Writes a float to the buffer at position offset
+ */
+void byteutils_put_float(unsigned char* b, int offset, float value) {
+    *((float*)(b + offset)) = value;
+}
+
 /**
  * Reads an ntp timestamp and returns it as micro seconds since the Unix epoch
  */
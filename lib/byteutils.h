@@ -23,6 +23,12 @@ uint16_t byteutils_get_short_be(unsigned char* b, int offset);
 uint32_t byteutils_get_int_be(unsigned char* b, int offset);
 uint64_t byteutils_get_long_be(unsigned char* b, int offset);
 float byteutils_get_float(unsigned char* b, int offset);
+void byteutils_put_short(unsigned char* b, int offset, uint16_t value);
+void byteutils_put_int(unsigned char* b, int offset, uint32_t value);
+void byteutils_put_long(unsigned char* b, int offset, uint64_t value);
+void byteutils_put_short_be(unsigned char* b, int offset, uint16_t value);
+void byteutils_put_int_be(unsigned char* b, int offset, uint32_t value);
+void byteutils_put_float(unsigned char* b, int offset, float value);
 
 #define SECONDS_FROM_1900_TO_1970 2208988800ULL
 
@@ -0,0 +1,483 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "capture_file.h"
+#include "spsc_ring.h"
+#include "threads.h"
+#include "thread_attr.h"
+
+/* Records and payload bytes that may wait for the writer before records get dropped */
+#define CAPTURE_FILE_QUEUE_LENGTH 1024
+#define CAPTURE_FILE_QUEUE_BYTES (32 * 1024 * 1024)
+
+typedef struct {
+    uint32_t payload_size;
+    /* Record header followed by the payload */
+    unsigned char data[];
+} capture_file_entry_t;
+
+struct capture_file_s {
+    logger_t *logger;
+    FILE *file;
+    capture_file_format_t format;
+
+    spsc_ring_t *queue;
+    thread_handle_t thread;
+
+    /* Payload bytes waiting in the queue */
+    uint64_t queued_bytes;
+
+    uint64_t records;
+    uint64_t bytes;
+    uint64_t dropped_records;
+    int write_error;
+
+    /* Kept by the writer thread, written out on close. Not written if it could not grow. */
+    capture_file_index_entry_t *index;
+    uint64_t index_count;
+    uint64_t index_capacity;
+    int index_error;
+    /* Where the next record goes */
+    uint64_t position;
+};
+
+struct capture_file_reader_s {
+    FILE *file;
+    /* End of the records if the file has an index, 0 if not */
+    off_t records_end;
+};
+
+struct capture_file_map_s {
+    const unsigned char *data;
+    size_t size;
+    const capture_file_index_entry_t *index;
+    uint64_t count;
+    /* The index built by walking the records of a file without one */
+    capture_file_index_entry_t *walked;
+    int indexed;
+};
+
+static void
+capture_file_add_entry(capture_file_t *capture, const unsigned char *record, const unsigned char *payload,
+                       uint32_t payload_size)
+{
+    capture_file_index_entry_t *entry;
+
+    if (capture->index_error) {
+        return;
+    }
+    if (capture->index_count == capture->index_capacity) {
+        uint64_t capacity = capture->index_capacity ? capture->index_capacity * 2 : 4096;
+        capture_file_index_entry_t *index = realloc(capture->index, capacity * sizeof(capture_file_index_entry_t));
+        if (!index) {
+            logger_log(capture->logger, LOGGER_WARNING, "capture_file out of memory for the index, the capture will have none");
+            capture->index_error = 1;
+            return;
+        }
+        capture->index = index;
+        capture->index_capacity = capacity;
+    }
+    entry = &capture->index[capture->index_count++];
+    memset(entry, 0, sizeof(capture_file_index_entry_t));
+    entry->offset = capture->position;
+    entry->payload_size = payload_size;
+    if (capture->format.index_record) {
+        capture->format.index_record(record, payload, entry);
+    }
+}
+
+/* Appends the index, after the writer thread finished */
+static int
+capture_file_write_index(capture_file_t *capture)
+{
+    static const unsigned char padding[8] = { 0 };
+    capture_file_index_footer_t footer;
+    size_t padding_size = (8 - capture->position % 8) % 8;
+
+    memset(&footer, 0, sizeof(footer));
+    memcpy(footer.magic, CAPTURE_FILE_INDEX_MAGIC, sizeof(footer.magic));
+    footer.entry_size = sizeof(capture_file_index_entry_t);
+    footer.entry_count = capture->index_count;
+    footer.records_end = capture->position;
+    footer.index_offset = capture->position + padding_size;
+    if ((padding_size && fwrite(padding, padding_size, 1, capture->file) != 1) ||
+        (capture->index_count &&
+         fwrite(capture->index, sizeof(capture_file_index_entry_t), capture->index_count, capture->file) != capture->index_count) ||
+        fwrite(&footer, sizeof(footer), 1, capture->file) != 1) {
+        return -1;
+    }
+    return 0;
+}
+
+static THREAD_RETVAL
+capture_file_thread(void *arg)
+{
+    capture_file_t *capture = arg;
+    capture_file_entry_t *entry;
+
+    thread_attr_apply(capture->logger, THREAD_ROLE_NONE, "rp-capture");
+    while ((entry = spsc_ring_pop_wait(capture->queue)) != NULL) {
+        size_t size = capture->format.record_size + entry->payload_size;
+        if (!capture->write_error && fwrite(entry->data, size, 1, capture->file) != 1) {
+            logger_log(capture->logger, LOGGER_ERR, "capture_file could not write record, stopping capture");
+            capture->write_error = 1;
+        }
+        if (capture->write_error) {
+            __atomic_fetch_add(&capture->dropped_records, 1, __ATOMIC_RELAXED);
+        } else {
+            capture_file_add_entry(capture, entry->data, entry->data + capture->format.record_size, entry->payload_size);
+            capture->position += size;
+            __atomic_fetch_add(&capture->records, 1, __ATOMIC_RELAXED);
+            __atomic_fetch_add(&capture->bytes, entry->payload_size, __ATOMIC_RELAXED);
+        }
+        __atomic_fetch_sub(&capture->queued_bytes, entry->payload_size, __ATOMIC_RELAXED);
+        free(entry);
+    }
+    return 0;
+}
+
+capture_file_t *
+capture_file_open(logger_t *logger, const char *filename, const capture_file_format_t *format, const void *header)
+{
+    capture_file_t *capture;
+    int fd;
+
+    assert(filename);
+    assert(format);
+    assert(header);
+
+    capture = calloc(1, sizeof(capture_file_t));
+    if (!capture) {
+        return NULL;
+    }
+    capture->logger = logger;
+    capture->format = *format;
+    capture->position = format->header_size;
+    capture->queue = spsc_ring_init(CAPTURE_FILE_QUEUE_LENGTH);
+    if (!capture->queue) {
+        free(capture);
+        return NULL;
+    }
+    /* The headers hold the session keys, so only the owner may read them, also when the file was there before */
+    fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd >= 0 && fchmod(fd, 0600) == 0) {
+        capture->file = fdopen(fd, "wb");
+    }
+    if (!capture->file) {
+        logger_log(logger, LOGGER_ERR, "capture_file could not open %s", filename);
+        if (fd >= 0) close(fd);
+        spsc_ring_destroy(capture->queue);
+        free(capture);
+        return NULL;
+    }
+    if (fwrite(header, format->header_size, 1, capture->file) != 1) {
+        logger_log(logger, LOGGER_ERR, "capture_file could not write to %s", filename);
+        fclose(capture->file);
+        spsc_ring_destroy(capture->queue);
+        free(capture);
+        return NULL;
+    }
+
+    THREAD_CREATE(capture->thread, capture_file_thread, capture);
+    logger_log(logger, LOGGER_INFO, "capture_file recording to %s", filename);
+    return capture;
+}
+
+int
+capture_file_write(capture_file_t *capture, const void *record, const unsigned char *payload, uint32_t payload_size)
+{
+    capture_file_entry_t *entry;
+    uint64_t queued_bytes;
+
+    assert(capture);
+    assert(record);
+
+    queued_bytes = __atomic_load_n(&capture->queued_bytes, __ATOMIC_RELAXED);
+    if (queued_bytes + payload_size > CAPTURE_FILE_QUEUE_BYTES) {
+        __atomic_fetch_add(&capture->dropped_records, 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+    entry = malloc(sizeof(capture_file_entry_t) + capture->format.record_size + payload_size);
+    if (!entry) {
+        __atomic_fetch_add(&capture->dropped_records, 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+    entry->payload_size = payload_size;
+    memcpy(entry->data, record, capture->format.record_size);
+    memcpy(entry->data + capture->format.record_size, payload, payload_size);
+
+    __atomic_fetch_add(&capture->queued_bytes, payload_size, __ATOMIC_RELAXED);
+    if (spsc_ring_push(capture->queue, entry) < 0) {
+        __atomic_fetch_sub(&capture->queued_bytes, payload_size, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&capture->dropped_records, 1, __ATOMIC_RELAXED);
+        free(entry);
+        return -1;
+    }
+    return 0;
+}
+
+void
+capture_file_get_stats(capture_file_t *capture, capture_file_stats_t *stats)
+{
+    assert(capture);
+    assert(stats);
+    stats->records = __atomic_load_n(&capture->records, __ATOMIC_RELAXED);
+    stats->bytes = __atomic_load_n(&capture->bytes, __ATOMIC_RELAXED);
+    stats->dropped_records = __atomic_load_n(&capture->dropped_records, __ATOMIC_RELAXED);
+}
+
+void
+capture_file_close(capture_file_t *capture)
+{
+    capture_file_stats_t stats;
+
+    if (!capture) {
+        return;
+    }
+    spsc_ring_close(capture->queue);
+    THREAD_JOIN(capture->thread);
+    if (!capture->write_error && !capture->index_error && capture_file_write_index(capture) < 0) {
+        logger_log(capture->logger, LOGGER_ERR, "capture_file could not write the index, the capture is still readable");
+    }
+    if (fclose(capture->file) != 0) {
+        logger_log(capture->logger, LOGGER_ERR, "capture_file could not finish writing the capture");
+    }
+
+    capture_file_get_stats(capture, &stats);
+    logger_log(capture->logger, LOGGER_INFO, "capture_file wrote %llu records, %llu bytes, dropped %llu records",
+               (unsigned long long) stats.records, (unsigned long long) stats.bytes,
+               (unsigned long long) stats.dropped_records);
+    spsc_ring_destroy(capture->queue);
+    free(capture->index);
+    free(capture);
+}
+
+capture_file_reader_t *
+capture_file_reader_open(const char *filename, void *header, size_t header_size)
+{
+    capture_file_reader_t *reader;
+    capture_file_index_footer_t footer;
+
+    assert(filename);
+    assert(header);
+
+    reader = calloc(1, sizeof(capture_file_reader_t));
+    if (!reader) {
+        return NULL;
+    }
+    reader->file = fopen(filename, "rb");
+    if (!reader->file) {
+        free(reader);
+        return NULL;
+    }
+    if (fread(header, header_size, 1, reader->file) != 1) {
+        capture_file_reader_close(reader);
+        return NULL;
+    }
+    // The records stop where the index starts
+    if (fseeko(reader->file, -(off_t) sizeof(footer), SEEK_END) == 0 &&
+        fread(&footer, sizeof(footer), 1, reader->file) == 1 &&
+        !memcmp(footer.magic, CAPTURE_FILE_INDEX_MAGIC, sizeof(footer.magic)) &&
+        footer.records_end >= header_size && footer.records_end <= footer.index_offset) {
+        reader->records_end = (off_t) footer.records_end;
+    }
+    if (fseeko(reader->file, (off_t) header_size, SEEK_SET) != 0) {
+        capture_file_reader_close(reader);
+        return NULL;
+    }
+    return reader;
+}
+
+int
+capture_file_reader_next(capture_file_reader_t *reader, void *record, size_t record_size)
+{
+    size_t ret;
+
+    assert(reader);
+    assert(record);
+
+    if (reader->records_end && ftello(reader->file) >= reader->records_end) {
+        return 0;
+    }
+    ret = fread(record, 1, record_size, reader->file);
+    if (ret == 0 && feof(reader->file)) {
+        return 0;
+    }
+    return ret == record_size ? 1 : -1;
+}
+
+int
+capture_file_reader_payload(capture_file_reader_t *reader, unsigned char *payload, uint32_t payload_size)
+{
+    assert(reader);
+    if (payload_size == 0) {
+        return 0;
+    }
+    return fread(payload, payload_size, 1, reader->file) == 1 ? 0 : -1;
+}
+
+void
+capture_file_reader_close(capture_file_reader_t *reader)
+{
+    if (reader) {
+        fclose(reader->file);
+        free(reader);
+    }
+}
+
+/* The footer's index if it describes this file, NULL if there is none */
+static const capture_file_index_entry_t *
+capture_file_map_find_index(const unsigned char *data, size_t size, size_t header_size, uint64_t *count)
+{
+    capture_file_index_footer_t footer;
+
+    if (size < header_size + sizeof(footer)) {
+        return NULL;
+    }
+    memcpy(&footer, data + size - sizeof(footer), sizeof(footer));
+    if (memcmp(footer.magic, CAPTURE_FILE_INDEX_MAGIC, sizeof(footer.magic)) ||
+        footer.entry_size != sizeof(capture_file_index_entry_t) || footer.index_offset % 8 ||
+        footer.records_end < header_size || footer.records_end > footer.index_offset ||
+        footer.index_offset > size - sizeof(footer) ||
+        footer.entry_count != (size - sizeof(footer) - footer.index_offset) / sizeof(capture_file_index_entry_t)) {
+        return NULL;
+    }
+    *count = footer.entry_count;
+    return (const capture_file_index_entry_t *) (data + footer.index_offset);
+}
+
+/* Indexes a file without an index by stepping from record to record */
+static int
+capture_file_map_walk(capture_file_map_t *map, const capture_file_format_t *format)
+{
+    uint64_t capacity = 0;
+    size_t offset = format->header_size;
+
+    while (offset + format->record_size <= map->size) {
+        const unsigned char *record = map->data + offset;
+        capture_file_index_entry_t *entry;
+        uint32_t payload_size;
+
+        memcpy(&payload_size, record + format->payload_size_offset, sizeof(payload_size));
+        if (payload_size > map->size - offset - format->record_size) {
+            break;
+        }
+        if (map->count == capacity) {
+            capacity = capacity ? capacity * 2 : 4096;
+            entry = realloc(map->walked, capacity * sizeof(capture_file_index_entry_t));
+            if (!entry) {
+                return -1;
+            }
+            map->walked = entry;
+        }
+        entry = &map->walked[map->count++];
+        memset(entry, 0, sizeof(capture_file_index_entry_t));
+        entry->offset = offset;
+        entry->payload_size = payload_size;
+        if (format->index_record) {
+            format->index_record(record, record + format->record_size, entry);
+        }
+        offset += format->record_size + payload_size;
+    }
+    map->index = map->walked;
+    return 0;
+}
+
+capture_file_map_t *
+capture_file_map_open(const char *filename, const capture_file_format_t *format)
+{
+    capture_file_map_t *map;
+    struct stat st;
+    void *data;
+    int fd;
+
+    assert(filename);
+    assert(format);
+
+    fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return NULL;
+    }
+    if (fstat(fd, &st) < 0 || (uint64_t) st.st_size < format->header_size || (uint64_t) st.st_size > SIZE_MAX) {
+        close(fd);
+        return NULL;
+    }
+    data = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return NULL;
+    }
+    map = calloc(1, sizeof(capture_file_map_t));
+    if (!map) {
+        munmap(data, (size_t) st.st_size);
+        return NULL;
+    }
+    map->data = data;
+    map->size = (size_t) st.st_size;
+    map->index = capture_file_map_find_index(map->data, map->size, format->header_size, &map->count);
+    map->indexed = map->index != NULL;
+    if (!map->indexed && capture_file_map_walk(map, format) < 0) {
+        capture_file_map_close(map);
+        return NULL;
+    }
+    return map;
+}
+
+const unsigned char *
+capture_file_map_get_header(capture_file_map_t *map)
+{
+    assert(map);
+    return map->data;
+}
+
+const capture_file_index_entry_t *
+capture_file_map_get_index(capture_file_map_t *map, uint64_t *count)
+{
+    assert(map);
+    assert(count);
+    *count = map->count;
+    return map->index;
+}
+
+const unsigned char *
+capture_file_map_get_record(capture_file_map_t *map, const capture_file_index_entry_t *entry)
+{
+    assert(map);
+    assert(entry);
+    return map->data + entry->offset;
+}
+
+int
+capture_file_map_is_indexed(capture_file_map_t *map)
+{
+    assert(map);
+    return map->indexed;
+}
+
+void
+capture_file_map_close(capture_file_map_t *map)
+{
+    if (map) {
+        munmap((void *) map->data, map->size);
+        free(map->walked);
+        free(map);
+    }
+}
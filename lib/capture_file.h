@@ -0,0 +1,106 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#ifndef CAPTURE_FILE_H
+#define CAPTURE_FILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "logger.h"
+
+/*
+ * Session capture files for replaying streams offline. A file is a header
+ * followed by records, each a fixed size record header and a payload whose
+ * size the caller keeps in it. Records are written by a background thread so
+ * the receiving thread never waits on the disk; if the writer falls behind,
+ * records are dropped and counted instead.
+ *
+ * When the capture is closed, the writer appends an index for random access:
+ * zero padding up to a multiple of 8 bytes, a capture_file_index_entry_t per
+ * record and a capture_file_index_footer_t as the last bytes of the file.
+ * Files whose writer never closed them have no footer; capture_file_map
+ * indexes those by walking the records instead. Nothing in the file is
+ * aligned but the index, record headers are to be copied out before use.
+ */
+
+#define CAPTURE_FILE_INDEX_MAGIC "RPCAPIX1"
+
+typedef struct capture_file_s capture_file_t;
+typedef struct capture_file_reader_s capture_file_reader_t;
+typedef struct capture_file_map_s capture_file_map_t;
+
+typedef struct {
+    /* Of the record header from the start of the file */
+    uint64_t offset;
+    /* Local time the record was received, in us */
+    uint64_t arrival_time;
+    /* The sender's timestamp, in the unit of the format */
+    uint64_t pts;
+    uint32_t payload_size;
+    /* Kind of record, as the format defines it */
+    uint32_t type;
+} capture_file_index_entry_t;
+
+typedef struct {
+    char magic[8];
+    uint32_t entry_size;
+    uint32_t reserved;
+    uint64_t entry_count;
+    /* End of the last record, the padding follows */
+    uint64_t records_end;
+    uint64_t index_offset;
+} capture_file_index_footer_t;
+
+typedef struct {
+    size_t header_size;
+    size_t record_size;
+    /* Of the uint32_t payload size in the record header */
+    size_t payload_size_offset;
+    /* Fills in arrival_time, pts and type of the entry of a record, called on the writer thread */
+    void (*index_record)(const unsigned char *record, const unsigned char *payload, capture_file_index_entry_t *entry);
+} capture_file_format_t;
+
+typedef struct {
+    uint64_t records;
+    uint64_t bytes;
+    /* Records dropped because the writer fell behind or ran out of memory */
+    uint64_t dropped_records;
+} capture_file_stats_t;
+
+/* Creates the file readable by its owner only, the headers carry the session keys */
+capture_file_t *capture_file_open(logger_t *logger, const char *filename, const capture_file_format_t *format,
+                                  const void *header);
+/* Queues a record for writing, returns -1 if it had to be dropped. Only one thread may write. */
+int capture_file_write(capture_file_t *capture, const void *record, const unsigned char *payload, uint32_t payload_size);
+void capture_file_get_stats(capture_file_t *capture, capture_file_stats_t *stats);
+/* Writes out everything still queued */
+void capture_file_close(capture_file_t *capture);
+
+capture_file_reader_t *capture_file_reader_open(const char *filename, void *header, size_t header_size);
+/* Reads the next record header, returns 1 on success, 0 at the end of the file and -1 on error */
+int capture_file_reader_next(capture_file_reader_t *reader, void *record, size_t record_size);
+/* Reads the payload of the record last returned by capture_file_reader_next */
+int capture_file_reader_payload(capture_file_reader_t *reader, unsigned char *payload, uint32_t payload_size);
+void capture_file_reader_close(capture_file_reader_t *reader);
+
+/* Maps a whole capture read-only, with its index or one built by walking the records. NULL if it can't
+ * be mapped; a record cut short at the end is left out. */
+capture_file_map_t *capture_file_map_open(const char *filename, const capture_file_format_t *format);
+const unsigned char *capture_file_map_get_header(capture_file_map_t *map);
+const capture_file_index_entry_t *capture_file_map_get_index(capture_file_map_t *map, uint64_t *count);
+/* The record header of entry, its payload follows it */
+const unsigned char *capture_file_map_get_record(capture_file_map_t *map, const capture_file_index_entry_t *entry);
+/* Whether the index came from the file rather than a walk */
+int capture_file_map_is_indexed(capture_file_map_t *map);
+void capture_file_map_close(capture_file_map_t *map);
+
+#endif //CAPTURE_FILE_H
@@ -0,0 +1,114 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "cpu_features.h"
+
+#if defined(__linux__) && (defined(__arm__) || defined(__aarch64__))
+#include <sys/auxv.h>
+#endif
+
+/* Bits of AT_HWCAP and AT_HWCAP2, from the kernel's asm/hwcap.h which isn't there when cross compiling */
+#define CPU_FEATURES_ARM_HWCAP_NEON (1ul << 12)
+#define CPU_FEATURES_ARM_HWCAP2_AES (1ul << 0)
+#define CPU_FEATURES_ARM64_HWCAP_AES (1ul << 3)
+
+/* Detected features with this bit set, so 0 means not detected yet */
+#define CPU_FEATURES_VALID (1u << 31)
+
+static unsigned int cpu_features;
+
+static unsigned int
+cpu_features_detect(void)
+{
+    unsigned int features = 0;
+
+#if defined(__aarch64__)
+    // Advanced SIMD is part of ARMv8-A
+    features |= CPU_FEATURE_NEON;
+#if defined(__linux__)
+    if (getauxval(AT_HWCAP) & CPU_FEATURES_ARM64_HWCAP_AES) {
+        features |= CPU_FEATURE_ARM_AES;
+    }
+#endif
+#elif defined(__arm__) && defined(__linux__)
+    // A Pi 2 and later run 32-bit kernels with NEON, the Pi 1 and Zero don't have it
+    if (getauxval(AT_HWCAP) & CPU_FEATURES_ARM_HWCAP_NEON) {
+        features |= CPU_FEATURE_NEON;
+    }
+    if (getauxval(AT_HWCAP2) & CPU_FEATURES_ARM_HWCAP2_AES) {
+        features |= CPU_FEATURE_ARM_AES;
+    }
+#elif (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("ssse3")) {
+        features |= CPU_FEATURE_SSSE3;
+    }
+    if (__builtin_cpu_supports("sse4.1")) {
+        features |= CPU_FEATURE_SSE41;
+    }
+    // Checks the OS saves the AVX registers too
+    if (__builtin_cpu_supports("avx2")) {
+        features |= CPU_FEATURE_AVX2;
+    }
+    if (__builtin_cpu_supports("aes")) {
+        features |= CPU_FEATURE_AESNI;
+    }
+#endif
+    return features;
+}
+
+unsigned int
+cpu_features_get(void)
+{
+    unsigned int features = __atomic_load_n(&cpu_features, __ATOMIC_RELAXED);
+
+    if (!features) {
+        // Racing callers detect the same features, whoever stores last doesn't matter
+        features = cpu_features_detect() | CPU_FEATURES_VALID;
+        __atomic_store_n(&cpu_features, features, __ATOMIC_RELAXED);
+    }
+    return features & ~CPU_FEATURES_VALID;
+}
+
+void
+cpu_features_describe(unsigned int features, char *buf, size_t size)
+{
+    static const struct { unsigned int feature; const char *name; } names[] = {
+        { CPU_FEATURE_NEON, "neon" },
+        { CPU_FEATURE_ARM_AES, "aes" },
+        { CPU_FEATURE_SSSE3, "ssse3" },
+        { CPU_FEATURE_SSE41, "sse4.1" },
+        { CPU_FEATURE_AVX2, "avx2" },
+        { CPU_FEATURE_AESNI, "aes-ni" },
+    };
+    size_t len = 0;
+
+    if (!size) {
+        return;
+    }
+    buf[0] = '\0';
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if (features & names[i].feature) {
+            int ret = snprintf(buf + len, size - len, "%s%s", len ? " " : "", names[i].name);
+            if (ret < 0 || (size_t) ret >= size - len) {
+                break;
+            }
+            len += ret;
+        }
+    }
+    if (!len) {
+        snprintf(buf, size, "none");
+    }
+}
@@ -0,0 +1,45 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#ifndef CPU_FEATURES_H
+#define CPU_FEATURES_H
+
+#include <stddef.h>
+
+/*
+ * Instruction set extensions of the CPU the binary runs on, read once from
+ * the auxiliary vector on ARM and with cpuid on x86. Kernels with several
+ * implementations pick theirs from these at runtime, so one package built
+ * for the baseline of its architecture uses what a Pi 4 or a recent x86 has.
+ */
+
+#define CPU_FEATURE_NEON   (1u << 0)
+#define CPU_FEATURE_ARM_AES (1u << 1)
+#define CPU_FEATURE_SSSE3  (1u << 8)
+#define CPU_FEATURE_SSE41  (1u << 9)
+#define CPU_FEATURE_AVX2   (1u << 10)
+#define CPU_FEATURE_AESNI  (1u << 11)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Thread safe, the detection runs on the first call */
+unsigned int cpu_features_get(void);
+/* Space separated names of features, "none" if there are none */
+void cpu_features_describe(unsigned int features, char *buf, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //CPU_FEATURES_H
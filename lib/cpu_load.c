@@ -0,0 +1,259 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+
+#include "cpu_load.h"
+#include "threads.h"
+#include "thread_attr.h"
+#include "thread_stats.h"
+
+#define CPU_LOAD_INTERVAL_MS 1000
+/* Weight of a new sample, smooths over about three seconds */
+#define CPU_LOAD_SMOOTHING 0.3
+/* A thread this busy is the bottleneck of its stage, whatever the limit */
+#define CPU_LOAD_THREAD_LIMIT 0.95
+/* How far below the limits both have to drop to end an overload */
+#define CPU_LOAD_HYSTERESIS 0.15
+
+typedef struct {
+    int tid;
+    uint64_t cpu_time;
+} cpu_load_thread_t;
+
+struct cpu_load_s {
+    logger_t *logger;
+    double limit;
+    cpu_load_callback_t callback;
+    void *callback_cls;
+
+    thread_handle_t thread;
+    bool running;
+    mutex_handle_t mutex;
+    cond_handle_t cond;
+
+    /* Only touched by the sampling thread */
+    uint64_t last_busy;
+    uint64_t last_total;
+    uint64_t last_sample;
+    cpu_load_thread_t threads[THREAD_STATS_MAX_THREADS];
+    int thread_count;
+
+    /* Guarded by mutex */
+    cpu_load_stats_t stats;
+};
+
+static uint64_t
+cpu_load_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* Busy and total jiffies of all cores since boot, -1 if they can't be read */
+static int
+cpu_load_read_system(uint64_t *busy, uint64_t *total)
+{
+#if defined(__linux__)
+    unsigned long long user, nice, system, idle, iowait, irq, softirq, steal;
+    FILE *file = fopen("/proc/stat", "r");
+    if (!file) {
+        return -1;
+    }
+    int fields = fscanf(file, "cpu %llu %llu %llu %llu %llu %llu %llu %llu",
+                        &user, &nice, &system, &idle, &iowait, &irq, &softirq, &steal);
+    fclose(file);
+    if (fields < 4) {
+        return -1;
+    }
+    if (fields < 8) {
+        iowait = irq = softirq = steal = 0;
+    }
+    *busy = user + nice + system + irq + softirq + steal;
+    *total = *busy + idle + iowait;
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+/* The busiest registered thread since the last sample, as a share of its core */
+static double
+cpu_load_sample_threads(cpu_load_t *cpu_load, uint64_t elapsed, char *busiest_name)
+{
+    thread_stats_t stats[THREAD_STATS_MAX_THREADS];
+    cpu_load_thread_t threads[THREAD_STATS_MAX_THREADS];
+    int count = thread_stats_get(stats, THREAD_STATS_MAX_THREADS);
+    double busiest = 0;
+
+    for (int i = 0; i < count; i++) {
+        threads[i].tid = stats[i].tid;
+        threads[i].cpu_time = stats[i].cpu_time;
+        // Threads that just started have nothing to compare with yet
+        for (int j = 0; j < cpu_load->thread_count; j++) {
+            if (cpu_load->threads[j].tid != stats[i].tid || stats[i].cpu_time < cpu_load->threads[j].cpu_time) {
+                continue;
+            }
+            double share = elapsed ? (double) (stats[i].cpu_time - cpu_load->threads[j].cpu_time) / elapsed : 0;
+            if (share > busiest) {
+                busiest = share;
+                memcpy(busiest_name, stats[i].name, sizeof(stats[i].name));
+            }
+            break;
+        }
+    }
+    memcpy(cpu_load->threads, threads, count * sizeof(cpu_load_thread_t));
+    cpu_load->thread_count = count;
+    return busiest > 1 ? 1 : busiest;
+}
+
+static void
+cpu_load_sample(cpu_load_t *cpu_load)
+{
+    uint64_t now = cpu_load_now();
+    uint64_t busy = 0, total = 0;
+    double system = -1;
+    char busiest_name[16] = "";
+
+    if (cpu_load_read_system(&busy, &total) == 0 && cpu_load->last_total && total > cpu_load->last_total) {
+        system = (double) (busy - cpu_load->last_busy) / (total - cpu_load->last_total);
+    }
+    cpu_load->last_busy = busy;
+    cpu_load->last_total = total;
+    double thread = cpu_load_sample_threads(cpu_load, cpu_load->last_sample ? now - cpu_load->last_sample : 0, busiest_name);
+    cpu_load->last_sample = now;
+
+    MUTEX_LOCK(cpu_load->mutex);
+    cpu_load_stats_t *stats = &cpu_load->stats;
+    if (system >= 0) {
+        stats->system += CPU_LOAD_SMOOTHING * (system - stats->system);
+    }
+    stats->busiest_thread += CPU_LOAD_SMOOTHING * (thread - stats->busiest_thread);
+    memcpy(stats->busiest_name, busiest_name, sizeof(stats->busiest_name));
+    bool was_overloaded = stats->overloaded;
+    bool overloaded = was_overloaded;
+    if (!overloaded && (stats->system >= cpu_load->limit || stats->busiest_thread >= CPU_LOAD_THREAD_LIMIT)) {
+        overloaded = true;
+        stats->overloads++;
+        logger_log(cpu_load->logger, LOGGER_WARNING, "CPU overloaded: %.0f%% of all cores busy, %s at %.0f%% of its core",
+                   stats->system * 100, busiest_name[0] ? busiest_name : "no thread", stats->busiest_thread * 100);
+    } else if (overloaded && stats->system < cpu_load->limit - CPU_LOAD_HYSTERESIS &&
+               stats->busiest_thread < CPU_LOAD_THREAD_LIMIT - CPU_LOAD_HYSTERESIS) {
+        overloaded = false;
+        logger_log(cpu_load->logger, LOGGER_INFO, "CPU load back to %.0f%%", stats->system * 100);
+    }
+    __atomic_store_n(&stats->overloaded, overloaded, __ATOMIC_RELAXED);
+    MUTEX_UNLOCK(cpu_load->mutex);
+
+    if (overloaded != was_overloaded && cpu_load->callback) {
+        cpu_load->callback(cpu_load->callback_cls, overloaded);
+    }
+}
+
+static THREAD_RETVAL
+cpu_load_thread(void *arg)
+{
+    cpu_load_t *cpu_load = arg;
+
+    thread_attr_apply(cpu_load->logger, THREAD_ROLE_NONE, "rp-cpuload");
+    MUTEX_LOCK(cpu_load->mutex);
+    while (cpu_load->running) {
+        MUTEX_UNLOCK(cpu_load->mutex);
+        cpu_load_sample(cpu_load);
+        MUTEX_LOCK(cpu_load->mutex);
+
+        uint64_t wake = cpu_load_now() + CPU_LOAD_INTERVAL_MS * 1000;
+        struct timespec abstime;
+        abstime.tv_sec = wake / 1000000;
+        abstime.tv_nsec = (wake % 1000000) * 1000;
+        while (cpu_load->running && cpu_load_now() < wake) {
+            COND_TIMEDWAIT(cpu_load->cond, cpu_load->mutex, abstime);
+        }
+    }
+    MUTEX_UNLOCK(cpu_load->mutex);
+    return 0;
+}
+
+cpu_load_t *
+cpu_load_init(logger_t *logger, double limit)
+{
+    cpu_load_t *cpu_load = calloc(1, sizeof(cpu_load_t));
+    if (!cpu_load) {
+        return NULL;
+    }
+    cpu_load->logger = logger;
+    cpu_load->limit = limit;
+    MUTEX_CREATE(cpu_load->mutex);
+    COND_CREATE_MONOTONIC(cpu_load->cond);
+    return cpu_load;
+}
+
+void
+cpu_load_set_callback(cpu_load_t *cpu_load, cpu_load_callback_t callback, void *cls)
+{
+    assert(cpu_load);
+    cpu_load->callback = callback;
+    cpu_load->callback_cls = cls;
+}
+
+int
+cpu_load_start(cpu_load_t *cpu_load)
+{
+    assert(cpu_load);
+    if (cpu_load->running) {
+        return 0;
+    }
+    cpu_load->running = true;
+    THREAD_CREATE(cpu_load->thread, cpu_load_thread, cpu_load);
+    if (!cpu_load->thread) {
+        cpu_load->running = false;
+        return -1;
+    }
+    return 0;
+}
+
+bool
+cpu_load_is_overloaded(cpu_load_t *cpu_load)
+{
+    return cpu_load && __atomic_load_n(&cpu_load->stats.overloaded, __ATOMIC_RELAXED);
+}
+
+void
+cpu_load_get_stats(cpu_load_t *cpu_load, cpu_load_stats_t *stats)
+{
+    MUTEX_LOCK(cpu_load->mutex);
+    memcpy(stats, &cpu_load->stats, sizeof(cpu_load_stats_t));
+    MUTEX_UNLOCK(cpu_load->mutex);
+}
+
+void
+cpu_load_destroy(cpu_load_t *cpu_load)
+{
+    if (cpu_load) {
+        MUTEX_LOCK(cpu_load->mutex);
+        bool running = cpu_load->running;
+        cpu_load->running = false;
+        COND_SIGNAL(cpu_load->cond);
+        MUTEX_UNLOCK(cpu_load->mutex);
+        if (running) {
+            THREAD_JOIN(cpu_load->thread);
+        }
+        COND_DESTROY(cpu_load->cond);
+        MUTEX_DESTROY(cpu_load->mutex);
+        free(cpu_load);
+    }
+}
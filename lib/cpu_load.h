@@ -0,0 +1,57 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#ifndef CPU_LOAD_H
+#define CPU_LOAD_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "logger.h"
+
+/*
+ * Watches how busy the machine is, so the receiver can take on less work
+ * before it stutters rather than after. A thread samples once a second the
+ * busy share of all cores from /proc/stat, which includes decoders and
+ * pipelines outside the library, and the CPU time of every thread registered
+ * with thread_stats, since one saturated thread stalls its stage even while
+ * the other cores idle. Both are smoothed over a few seconds. Overload starts
+ * when either goes over the limit and ends once both are well below it, so
+ * a brief peak doesn't flip it back and forth. Linux only, elsewhere it never
+ * reports an overload.
+ */
+
+typedef struct cpu_load_s cpu_load_t;
+
+/* Called from the sampling thread when an overload starts or ends */
+typedef void (*cpu_load_callback_t)(void *cls, bool overloaded);
+
+typedef struct {
+    /* Smoothed busy share of all cores, and of its core for the busiest registered thread, 0 to 1 */
+    double system;
+    double busiest_thread;
+    char busiest_name[16];
+    bool overloaded;
+    /* Times an overload started */
+    uint64_t overloads;
+} cpu_load_stats_t;
+
+/* limit is the busy share, 0 to 1, over which the machine counts as overloaded */
+cpu_load_t *cpu_load_init(logger_t *logger, double limit);
+/* Set before cpu_load_start */
+void cpu_load_set_callback(cpu_load_t *cpu_load, cpu_load_callback_t callback, void *cls);
+/* Starts sampling, returns -1 if the thread could not be started */
+int cpu_load_start(cpu_load_t *cpu_load);
+bool cpu_load_is_overloaded(cpu_load_t *cpu_load);
+void cpu_load_get_stats(cpu_load_t *cpu_load, cpu_load_stats_t *stats);
+void cpu_load_destroy(cpu_load_t *cpu_load);
+
+#endif //CPU_LOAD_H
@@ -19,6 +19,10 @@
  */
 
 #include "crypto.h"
+#include "aes_bitsliced.h"
+#include "aes_af_alg.h"
+#include "cpu_features.h"
+#include "memalign.h"
 
 #include <openssl/evp.h>
 #include <openssl/err.h>
@@ -27,19 +31,227 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <time.h>
+
+#define AES_BITSLICED_BATCH (AES_BITSLICED_BLOCKS * AES_128_BLOCK_SIZE)
+/* CBC is calibrated on audio sized packets, AAC-ELD and ALAC ones are about this long */
+#define AES_CALIBRATE_PACKET 1024
 
 struct aes_ctx_s {
     EVP_CIPHER_CTX *cipher_ctx;
     uint8_t key[AES_128_BLOCK_SIZE];
     uint8_t iv[AES_128_BLOCK_SIZE];
     aes_direction_t direction;
-    uint8_t block_offset;
+    bool ctr;
+    /* CTR only: counter block the keystream last restarted from, and bytes used since */
+    uint8_t counter[AES_128_BLOCK_SIZE];
+    uint64_t stream_offset;
+
+    /* Round keys when CTR and CBC decryption run bitsliced instead of through EVP, NULL otherwise */
+    aes_bitsliced_key_t *bitsliced;
+    /* The kernel's engine when they run on it instead, NULL otherwise */
+    aes_af_alg_t *af_alg;
+    /* Bitsliced or engine CTR: next counter block and the keystream left over, CBC: the previous ciphertext block */
+    uint8_t chain[AES_128_BLOCK_SIZE];
+    uint8_t keystream[AES_BITSLICED_BATCH];
+    int keystream_left;
 };
 
-uint8_t waste[AES_128_BLOCK_SIZE];
+static aes_impl_t aes_impl = AES_IMPL_AUTO;
+/* CBC decryption is calibrated apart, set along with aes_impl */
+static aes_impl_t aes_cbc_impl = AES_IMPL_AUTO;
 
 // Common AES utilities
 
+// Adds blocks to a 128bit big endian counter block
+static void aes_ctr_add_blocks(uint8_t counter[AES_128_BLOCK_SIZE], uint64_t blocks) {
+    for (int i = AES_128_BLOCK_SIZE - 1; i >= 0 && blocks; i--) {
+        uint64_t sum = (uint64_t) counter[i] + (blocks & 0xff);
+        counter[i] = (uint8_t) sum;
+        blocks = (blocks >> 8) + (sum >> 8);
+    }
+}
+
+static void aes_ctr_bitsliced(aes_ctx_t *ctx, const uint8_t *in, uint8_t *out, int len) {
+    while (len > 0) {
+        if (ctx->keystream_left == 0) {
+            uint8_t counters[AES_BITSLICED_BATCH];
+            for (int i = 0; i < AES_BITSLICED_BLOCKS; i++) {
+                memcpy(counters + i * AES_128_BLOCK_SIZE, ctx->chain, AES_128_BLOCK_SIZE);
+                aes_ctr_add_blocks(ctx->chain, 1);
+            }
+            aes_bitsliced_encrypt(ctx->bitsliced, counters, ctx->keystream);
+            ctx->keystream_left = AES_BITSLICED_BATCH;
+        }
+        const uint8_t *keystream = ctx->keystream + AES_BITSLICED_BATCH - ctx->keystream_left;
+        int n = len < ctx->keystream_left ? len : ctx->keystream_left;
+        for (int i = 0; i < n; i++) {
+            out[i] = in[i] ^ keystream[i];
+        }
+        ctx->keystream_left -= n;
+        in += n;
+        out += n;
+        len -= n;
+    }
+}
+
+static void aes_cbc_decrypt_bitsliced(aes_ctx_t *ctx, const uint8_t *in, uint8_t *out, int len) {
+    uint8_t cipher[AES_BITSLICED_BATCH];
+    uint8_t plain[AES_BITSLICED_BATCH];
+
+    assert(len % AES_128_BLOCK_SIZE == 0);
+    while (len > 0) {
+        // Keep the ciphertext, out may overwrite it and the blocks chain on it
+        int n = len < AES_BITSLICED_BATCH ? len : AES_BITSLICED_BATCH;
+        memcpy(cipher, in, n);
+        memset(cipher + n, 0, AES_BITSLICED_BATCH - n);
+        aes_bitsliced_decrypt(ctx->bitsliced, cipher, plain);
+        for (int i = 0; i < AES_128_BLOCK_SIZE; i++) {
+            out[i] = plain[i] ^ ctx->chain[i];
+        }
+        for (int i = AES_128_BLOCK_SIZE; i < n; i++) {
+            out[i] = plain[i] ^ cipher[i - AES_128_BLOCK_SIZE];
+        }
+        memcpy(ctx->chain, cipher + n - AES_128_BLOCK_SIZE, AES_128_BLOCK_SIZE);
+        in += n;
+        out += n;
+        len -= n;
+    }
+}
+
+static uint64_t aes_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* Best of a few runs of the engine on len bytes, the first ones also warm it up. UINT64_MAX if there is none */
+static uint64_t aes_time_af_alg(bool ctr, uint8_t *buf, int len) {
+    static const uint8_t key[AES_128_BLOCK_SIZE] = {0};
+    uint64_t best = UINT64_MAX;
+
+    aes_af_alg_t *af_alg = aes_af_alg_init(key, ctr, !ctr);
+    if (!af_alg) {
+        return UINT64_MAX;
+    }
+    for (int run = 0; run < 4; run++) {
+        uint8_t iv[AES_128_BLOCK_SIZE] = {0};
+        uint64_t start = aes_now_ns();
+        if (aes_af_alg_crypt(af_alg, iv, buf, buf, len) < len) {
+            best = UINT64_MAX;
+            break;
+        }
+        uint64_t end = aes_now_ns();
+        if (end - start < best) best = end - start;
+    }
+    aes_af_alg_destroy(af_alg);
+    return best;
+}
+
+static aes_impl_t aes_fastest(uint64_t evp_time, uint64_t bitsliced_time, uint64_t af_alg_time) {
+    if (af_alg_time < UINT64_MAX && af_alg_time <= evp_time && af_alg_time <= bitsliced_time) {
+        return AES_IMPL_AF_ALG;
+    }
+    return bitsliced_time < evp_time ? AES_IMPL_BITSLICED : AES_IMPL_EVP;
+}
+
+/*
+ * Without AES instructions OpenSSL runs either a NEON or SSSE3 implementation of its own
+ * or table based code, depending on how it was built. Rather than guess which, both are
+ * timed along with a hardware engine if the kernel has one, and the fastest is kept for
+ * every context. CTR is timed on a mirror sized frame and CBC on an audio sized packet,
+ * for which the system calls of the engine weigh much more. The engine wins a tie, it
+ * leaves the cores free.
+ */
+static aes_impl_t aes_calibrate(aes_impl_t *cbc_impl) {
+    static const uint8_t key[AES_128_BLOCK_SIZE] = {0};
+    static uint8_t buf[16384];
+    uint64_t evp_time = UINT64_MAX, bitsliced_time = UINT64_MAX;
+    uint64_t evp_cbc_time = UINT64_MAX, bitsliced_cbc_time = UINT64_MAX;
+    uint64_t af_alg_time = aes_time_af_alg(true, buf, sizeof(buf));
+    uint64_t af_alg_cbc_time = aes_time_af_alg(false, buf, AES_CALIBRATE_PACKET);
+    EVP_CIPHER_CTX *cbc_ctx = EVP_CIPHER_CTX_new();
+    aes_ctx_t ctx;
+    int out_len;
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.cipher_ctx = EVP_CIPHER_CTX_new();
+    ALIGNED_MALLOC(ctx.bitsliced, 16, sizeof(aes_bitsliced_key_t));
+    if (!ctx.cipher_ctx || !cbc_ctx || !ctx.bitsliced ||
+        !EVP_EncryptInit_ex(ctx.cipher_ctx, EVP_aes_128_ctr(), NULL, key, ctx.chain) ||
+        !EVP_DecryptInit_ex(cbc_ctx, EVP_aes_128_cbc(), NULL, key, ctx.chain)) {
+        EVP_CIPHER_CTX_free(ctx.cipher_ctx);
+        EVP_CIPHER_CTX_free(cbc_ctx);
+        if (ctx.bitsliced) ALIGNED_FREE(ctx.bitsliced);
+        *cbc_impl = af_alg_cbc_time < UINT64_MAX ? AES_IMPL_AF_ALG : AES_IMPL_EVP;
+        return af_alg_time < UINT64_MAX ? AES_IMPL_AF_ALG : AES_IMPL_EVP;
+    }
+    EVP_CIPHER_CTX_set_padding(cbc_ctx, 0);
+    aes_bitsliced_init(ctx.bitsliced, key);
+    // Best of a few runs, the first ones also warm up the caches
+    for (int run = 0; run < 4; run++) {
+        uint64_t start = aes_now_ns();
+        EVP_EncryptUpdate(ctx.cipher_ctx, buf, &out_len, buf, sizeof(buf));
+        uint64_t middle = aes_now_ns();
+        aes_ctr_bitsliced(&ctx, buf, buf, sizeof(buf));
+        uint64_t end = aes_now_ns();
+        if (middle - start < evp_time) evp_time = middle - start;
+        if (end - middle < bitsliced_time) bitsliced_time = end - middle;
+
+        start = aes_now_ns();
+        EVP_DecryptUpdate(cbc_ctx, buf, &out_len, buf, AES_CALIBRATE_PACKET);
+        middle = aes_now_ns();
+        aes_cbc_decrypt_bitsliced(&ctx, buf, buf, AES_CALIBRATE_PACKET);
+        end = aes_now_ns();
+        if (middle - start < evp_cbc_time) evp_cbc_time = middle - start;
+        if (end - middle < bitsliced_cbc_time) bitsliced_cbc_time = end - middle;
+    }
+    EVP_CIPHER_CTX_free(ctx.cipher_ctx);
+    EVP_CIPHER_CTX_free(cbc_ctx);
+    ALIGNED_FREE(ctx.bitsliced);
+    *cbc_impl = aes_fastest(evp_cbc_time, bitsliced_cbc_time, af_alg_cbc_time);
+    return aes_fastest(evp_time, bitsliced_time, af_alg_time);
+}
+
+/* The implementation CTR contexts use, or CBC ones with cbc set */
+static aes_impl_t aes_get_impl_for(bool cbc) {
+    aes_impl_t impl = __atomic_load_n(&aes_impl, __ATOMIC_ACQUIRE);
+    if (impl == AES_IMPL_AUTO) {
+        aes_impl_t cbc_impl;
+        // AES instructions are faster than anything else, EVP uses them when they are there
+        if (cpu_features_get() & (CPU_FEATURE_ARM_AES | CPU_FEATURE_AESNI)) {
+            impl = cbc_impl = AES_IMPL_EVP;
+        } else {
+            impl = aes_calibrate(&cbc_impl);
+        }
+        // Racing threads may calibrate twice, they store the same or an equally good result
+        __atomic_store_n(&aes_cbc_impl, cbc_impl, __ATOMIC_RELAXED);
+        __atomic_store_n(&aes_impl, impl, __ATOMIC_RELEASE);
+    }
+    return cbc ? __atomic_load_n(&aes_cbc_impl, __ATOMIC_RELAXED) : impl;
+}
+
+static aes_impl_t aes_get_impl(void) {
+    return aes_get_impl_for(false);
+}
+
+void aes_set_impl(aes_impl_t impl) {
+    __atomic_store_n(&aes_cbc_impl, impl, __ATOMIC_RELAXED);
+    __atomic_store_n(&aes_impl, impl, __ATOMIC_RELEASE);
+}
+
+const char *aes_get_impl_name(void) {
+    switch (aes_get_impl()) {
+    case AES_IMPL_BITSLICED:
+        return "bitsliced";
+    case AES_IMPL_AF_ALG:
+        // Named after the engine's driver, e.g. ctr-aes-rk
+        return aes_af_alg_driver(true) ? aes_af_alg_driver(true) : "openssl";
+    default:
+        return "openssl";
+    }
+}
+
 void handle_error(const char* location) {
     long error = ERR_get_error();
     const char* error_str = ERR_error_string(error, NULL);
@@ -53,8 +265,9 @@ aes_ctx_t *aes_init(const uint8_t *key, const uint8_t *iv, const EVP_CIPHER *typ
     ctx->cipher_ctx = EVP_CIPHER_CTX_new();
     assert(ctx->cipher_ctx != NULL);
 
-    ctx->block_offset = 0;
+    ctx->stream_offset = 0;
     ctx->direction = direction;
+    ctx->ctr = type == EVP_aes_128_ctr();
 
     if (direction == AES_ENCRYPT) {
         if (!EVP_EncryptInit_ex(ctx->cipher_ctx, type, NULL, key, iv)) {
@@ -68,10 +281,98 @@ aes_ctx_t *aes_init(const uint8_t *key, const uint8_t *iv, const EVP_CIPHER *typ
 
     memcpy(ctx->key, key, AES_128_BLOCK_SIZE);
     memcpy(ctx->iv, iv, AES_128_BLOCK_SIZE);
+    memcpy(ctx->counter, iv, AES_128_BLOCK_SIZE);
     EVP_CIPHER_CTX_set_padding(ctx->cipher_ctx, 0);
+
+    // CBC encryption can't run blocks side by side, it stays with EVP. So does a mode the engine has no driver for.
+    ctx->bitsliced = NULL;
+    ctx->af_alg = NULL;
+    aes_impl_t impl = aes_get_impl_for(!ctx->ctr);
+    if ((ctx->ctr || direction == AES_DECRYPT) && impl == AES_IMPL_BITSLICED) {
+        ALIGNED_MALLOC(ctx->bitsliced, 16, sizeof(aes_bitsliced_key_t));
+        assert(ctx->bitsliced != NULL);
+        aes_bitsliced_init(ctx->bitsliced, key);
+    } else if ((ctx->ctr || direction == AES_DECRYPT) && impl == AES_IMPL_AF_ALG) {
+        ctx->af_alg = aes_af_alg_init(key, ctx->ctr, direction == AES_DECRYPT);
+    }
+    memcpy(ctx->chain, iv, AES_128_BLOCK_SIZE);
+    ctx->keystream_left = 0;
     return ctx;
 }
 
+// Restarts the cipher from iv, the cipher and its key schedule stay set up
+static void aes_set_iv(aes_ctx_t *ctx, const uint8_t *iv) {
+    if (ctx->bitsliced || ctx->af_alg) {
+        memcpy(ctx->chain, iv, AES_128_BLOCK_SIZE);
+        ctx->keystream_left = 0;
+        return;
+    }
+    if (ctx->direction == AES_ENCRYPT) {
+        if (!EVP_EncryptInit_ex(ctx->cipher_ctx, NULL, NULL, NULL, iv)) {
+            handle_error(__func__);
+        }
+    } else {
+        if (!EVP_DecryptInit_ex(ctx->cipher_ctx, NULL, NULL, NULL, iv)) {
+            handle_error(__func__);
+        }
+    }
+}
+
+// Leaves an engine that failed for EVP, which carries on from the block the engine stopped at
+static void aes_af_alg_fallback(aes_ctx_t *ctx) {
+    aes_af_alg_destroy(ctx->af_alg);
+    ctx->af_alg = NULL;
+    aes_set_iv(ctx, ctx->chain);
+    // Contexts created later don't try it again
+    __atomic_store_n(&aes_impl, AES_IMPL_EVP, __ATOMIC_RELEASE);
+}
+
+static void aes_ctr_af_alg(aes_ctx_t *ctx, const uint8_t *in, uint8_t *out, int len) {
+    // The rest of the last block's keystream first
+    int n = len < ctx->keystream_left ? len : ctx->keystream_left;
+    const uint8_t *keystream = ctx->keystream + AES_BITSLICED_BATCH - ctx->keystream_left;
+    for (int i = 0; i < n; i++) {
+        out[i] = in[i] ^ keystream[i];
+    }
+    ctx->keystream_left -= n;
+    in += n;
+    out += n;
+    len -= n;
+
+    int whole = len - len % AES_128_BLOCK_SIZE;
+    int done = aes_af_alg_crypt(ctx->af_alg, ctx->chain, in, out, whole);
+    if (done == whole && len > whole) {
+        // A partial block goes in padded with zeros, which come out as the keystream left for the next call
+        int tail = len - whole;
+        uint8_t block[AES_128_BLOCK_SIZE] = {0};
+        memcpy(block, in + whole, tail);
+        if (aes_af_alg_crypt(ctx->af_alg, ctx->chain, block, block, AES_128_BLOCK_SIZE) == AES_128_BLOCK_SIZE) {
+            memcpy(out + whole, block, tail);
+            ctx->keystream_left = AES_128_BLOCK_SIZE - tail;
+            memcpy(ctx->keystream + AES_BITSLICED_BATCH - ctx->keystream_left, block + tail, ctx->keystream_left);
+            done = len;
+        }
+    }
+    if (done < len) {
+        int out_len = 0;
+        aes_af_alg_fallback(ctx);
+        if (!EVP_EncryptUpdate(ctx->cipher_ctx, out + done, &out_len, in + done, len - done)) {
+            handle_error(__func__);
+        }
+    }
+}
+
+static void aes_cbc_decrypt_af_alg(aes_ctx_t *ctx, const uint8_t *in, uint8_t *out, int len) {
+    int done = aes_af_alg_crypt(ctx->af_alg, ctx->chain, in, out, len);
+    if (done < len) {
+        int out_len = 0;
+        aes_af_alg_fallback(ctx);
+        if (!EVP_DecryptUpdate(ctx->cipher_ctx, out + done, &out_len, in + done, len - done)) {
+            handle_error(__func__);
+        }
+    }
+}
+
 void aes_encrypt(aes_ctx_t *ctx, const uint8_t *in, uint8_t *out, int in_len) {
     int out_len_e = 0;
     if (!EVP_EncryptUpdate(ctx->cipher_ctx, out, &out_len_e, in, in_len)) {
@@ -85,6 +386,14 @@ void aes_encrypt(aes_ctx_t *ctx, const uint8_t *in, uint8_t *out, int in_len) {
 }
 
 void aes_decrypt(aes_ctx_t *ctx, const uint8_t *in, uint8_t *out, int in_len) {
+    if (ctx->bitsliced) {
+        aes_cbc_decrypt_bitsliced(ctx, in, out, in_len);
+        return;
+    }
+    if (ctx->af_alg) {
+        aes_cbc_decrypt_af_alg(ctx, in, out, in_len);
+        return;
+    }
     int out_len_d = 0;
     if (!EVP_DecryptUpdate(ctx->cipher_ctx, out, &out_len_d, in, in_len)) {
         handle_error(__func__);
@@ -99,23 +408,13 @@ void aes_decrypt(aes_ctx_t *ctx, const uint8_t *in, uint8_t *out, int in_len) {
 void aes_destroy(aes_ctx_t *ctx) {
     if (ctx) {
         EVP_CIPHER_CTX_free(ctx->cipher_ctx);
-        free(ctx);
-    }
-}
-
-void aes_reset(aes_ctx_t *ctx, const EVP_CIPHER *type, aes_direction_t direction) {
-    if (!EVP_CIPHER_CTX_reset(ctx->cipher_ctx)) {
-        handle_error(__func__);
-    }
-
-    if (direction == AES_ENCRYPT) {
-        if (!EVP_EncryptInit_ex(ctx->cipher_ctx, type, NULL, ctx->key, ctx->iv)) {
-            handle_error(__func__);
-        }
-    } else {
-        if (!EVP_DecryptInit_ex(ctx->cipher_ctx, type, NULL, ctx->key, ctx->iv)) {
-            handle_error(__func__);
+        aes_af_alg_destroy(ctx->af_alg);
+        if (ctx->bitsliced) {
+            // The round keys are as good as the key
+            memset(ctx->bitsliced, 0, sizeof(aes_bitsliced_key_t));
+            ALIGNED_FREE(ctx->bitsliced);
         }
+        free(ctx);
     }
 }
 
@@ -126,22 +425,58 @@ aes_ctx_t *aes_ctr_init(const uint8_t *key, const uint8_t *iv) {
 }
 
 void aes_ctr_encrypt(aes_ctx_t *ctx, const uint8_t *in, uint8_t *out, int len) {
-    aes_encrypt(ctx, in, out, len);
-    ctx->block_offset = (ctx->block_offset + len) % AES_128_BLOCK_SIZE;
+    if (ctx->bitsliced) {
+        aes_ctr_bitsliced(ctx, in, out, len);
+        ctx->stream_offset += len;
+        return;
+    }
+    if (ctx->af_alg) {
+        aes_ctr_af_alg(ctx, in, out, len);
+        ctx->stream_offset += len;
+        return;
+    }
+    // A stream cipher, the update call alone consumes exactly len keystream bytes
+    int out_len = 0;
+    if (!EVP_EncryptUpdate(ctx->cipher_ctx, out, &out_len, in, len)) {
+        handle_error(__func__);
+    }
+    assert(out_len == len);
+    ctx->stream_offset += len;
 }
 
-void aes_ctr_start_fresh_block(aes_ctx_t *ctx) {
-    // Is there a better way to do this?
-    if (ctx->block_offset == 0) return;
-    aes_ctr_encrypt(ctx, waste, waste, AES_128_BLOCK_SIZE - ctx->block_offset);
+void aes_ctr_decrypt(aes_ctx_t *ctx, const uint8_t *in, uint8_t *out, int len) {
+    aes_ctr_encrypt(ctx, in, out, len);
 }
 
-void aes_ctr_decrypt(aes_ctx_t *ctx, const uint8_t *in, uint8_t *out, int len) {
-    aes_encrypt(ctx, in, out, len);
+// Restarts the keystream at the given 128bit big endian counter block
+void aes_ctr_set_counter(aes_ctx_t *ctx, const uint8_t *counter) {
+    assert(ctx->ctr);
+    aes_set_iv(ctx, counter);
+    if (counter != ctx->counter) {
+        memcpy(ctx->counter, counter, AES_128_BLOCK_SIZE);
+    }
+    ctx->stream_offset = 0;
+}
+
+// Restarts the keystream at the start of block number block, counted from the initial IV
+void aes_ctr_seek(aes_ctx_t *ctx, uint64_t block) {
+    uint8_t counter[AES_128_BLOCK_SIZE];
+    memcpy(counter, ctx->iv, AES_128_BLOCK_SIZE);
+    aes_ctr_add_blocks(counter, block);
+    aes_ctr_set_counter(ctx, counter);
+}
+
+// Drops the rest of a partly used keystream block by moving the counter on
+void aes_ctr_start_fresh_block(aes_ctx_t *ctx) {
+    if (ctx->stream_offset % AES_128_BLOCK_SIZE == 0) return;
+    uint8_t counter[AES_128_BLOCK_SIZE];
+    memcpy(counter, ctx->counter, AES_128_BLOCK_SIZE);
+    aes_ctr_add_blocks(counter, ctx->stream_offset / AES_128_BLOCK_SIZE + 1);
+    aes_ctr_set_counter(ctx, counter);
 }
 
 void aes_ctr_reset(aes_ctx_t *ctx) {
-    aes_reset(ctx, EVP_aes_128_ctr(), AES_ENCRYPT);
+    aes_ctr_set_counter(ctx, ctx->iv);
 }
 
 void aes_ctr_destroy(aes_ctx_t *ctx) {
@@ -164,14 +499,60 @@ void aes_cbc_decrypt(aes_ctx_t *ctx, const uint8_t *in, uint8_t *out, int len) {
     aes_decrypt(ctx, in, out, len);
 }
 
+void aes_cbc_set_iv(aes_ctx_t *ctx, const uint8_t *iv) {
+    assert(!ctx->ctr);
+    aes_set_iv(ctx, iv);
+}
+
 void aes_cbc_reset(aes_ctx_t *ctx) {
-    aes_reset(ctx, EVP_aes_128_ctr(), ctx->direction);
+    aes_cbc_set_iv(ctx, ctx->iv);
 }
 
 void aes_cbc_destroy(aes_ctx_t *ctx) {
     aes_destroy(ctx);
 }
 
+/*
+ * EVP has no multi-buffer decrypt for plain CBC or CTR, so the batch runs one
+ * update per message on the same context. What it saves over separate calls is
+ * everything but the cipher itself: no context allocation or key schedule, and
+ * no final call.
+ */
+void aes_decrypt_batch(aes_ctx_t *ctx, const aes_batch_item_t *items, int count) {
+    int out_len;
+    for (int i = 0; i < count; i++) {
+        const uint8_t *iv = items[i].iv ? items[i].iv : ctx->iv;
+        if (ctx->ctr) {
+            aes_ctr_set_counter(ctx, iv);
+        } else {
+            assert(ctx->direction == AES_DECRYPT);
+            assert(items[i].len % AES_128_BLOCK_SIZE == 0);
+            aes_set_iv(ctx, iv);
+        }
+        if (ctx->bitsliced) {
+            if (ctx->ctr) {
+                aes_ctr_bitsliced(ctx, items[i].in, items[i].out, items[i].len);
+            } else {
+                aes_cbc_decrypt_bitsliced(ctx, items[i].in, items[i].out, items[i].len);
+            }
+            out_len = items[i].len;
+        } else if (ctx->af_alg) {
+            if (ctx->ctr) {
+                aes_ctr_af_alg(ctx, items[i].in, items[i].out, items[i].len);
+            } else {
+                aes_cbc_decrypt_af_alg(ctx, items[i].in, items[i].out, items[i].len);
+            }
+            out_len = items[i].len;
+        } else if (!EVP_CipherUpdate(ctx->cipher_ctx, items[i].out, &out_len, items[i].in, items[i].len)) {
+            handle_error(__func__);
+        }
+        assert(out_len == items[i].len);
+        if (ctx->ctr) {
+            ctx->stream_offset += items[i].len;
+        }
+    }
+}
+
 // X25519
 
 struct x25519_key_s {
@@ -299,6 +680,27 @@ void ed25519_key_get_raw(unsigned char data[ED25519_KEY_SIZE], const ed25519_key
     }
 }
 
+ed25519_key_t *ed25519_key_from_private_raw(const unsigned char data[ED25519_KEY_SIZE]) {
+    ed25519_key_t *key;
+
+    key = malloc(sizeof(ed25519_key_t));
+    assert(key);
+
+    key->pkey = EVP_PKEY_new_raw_private_key(EVP_PKEY_ED25519, NULL, data, ED25519_KEY_SIZE);
+    if (!key->pkey) {
+        handle_error(__func__);
+    }
+
+    return key;
+}
+
+void ed25519_key_get_private_raw(unsigned char data[ED25519_KEY_SIZE], const ed25519_key_t *key) {
+    assert(key);
+    if (!EVP_PKEY_get_raw_private_key(key->pkey, data, &(size_t) {ED25519_KEY_SIZE})) {
+        handle_error(__func__);
+    }
+}
+
 ed25519_key_t *ed25519_key_copy(const ed25519_key_t *key) {
     ed25519_key_t *new_key;
 
@@ -368,6 +770,48 @@ void ed25519_key_destroy(ed25519_key_t *key) {
     }
 }
 
+// ChaCha20-Poly1305
+
+struct chacha20_poly1305_ctx_s {
+    EVP_CIPHER_CTX *cipher_ctx;
+};
+
+chacha20_poly1305_ctx_t *chacha20_poly1305_init(const uint8_t *key) {
+    chacha20_poly1305_ctx_t *ctx = malloc(sizeof(chacha20_poly1305_ctx_t));
+    assert(ctx != NULL);
+    ctx->cipher_ctx = EVP_CIPHER_CTX_new();
+    assert(ctx->cipher_ctx != NULL);
+
+    if (!EVP_DecryptInit_ex(ctx->cipher_ctx, EVP_chacha20_poly1305(), NULL, key, NULL)) {
+        handle_error(__func__);
+    }
+    return ctx;
+}
+
+int chacha20_poly1305_decrypt(chacha20_poly1305_ctx_t *ctx, const uint8_t *nonce, const uint8_t *aad, int aad_len,
+                              const uint8_t *in, int len, const uint8_t *tag, uint8_t *out) {
+    int out_len = 0;
+
+    if (!EVP_DecryptInit_ex(ctx->cipher_ctx, NULL, NULL, NULL, nonce) ||
+        !EVP_CIPHER_CTX_ctrl(ctx->cipher_ctx, EVP_CTRL_AEAD_SET_TAG, CHACHA20_POLY1305_TAG_SIZE, (void *) tag) ||
+        (aad_len > 0 && !EVP_DecryptUpdate(ctx->cipher_ctx, NULL, &out_len, aad, aad_len)) ||
+        !EVP_DecryptUpdate(ctx->cipher_ctx, out, &out_len, in, len)) {
+        return -1;
+    }
+    // Only the tag is checked here, a stream cipher has nothing left to write
+    if (EVP_DecryptFinal_ex(ctx->cipher_ctx, out + out_len, &out_len) <= 0) {
+        return -1;
+    }
+    return 0;
+}
+
+void chacha20_poly1305_destroy(chacha20_poly1305_ctx_t *ctx) {
+    if (ctx) {
+        EVP_CIPHER_CTX_free(ctx->cipher_ctx);
+        free(ctx);
+    }
+}
+
 // SHA 512
 
 struct sha_ctx_s {
@@ -33,7 +33,9 @@
 extern "C" {
 #endif
 
-// 128bit AES in CTR mode
+// 128bit AES in CTR and CBC mode
+// A context is meant to be kept for a whole session: the key schedule runs once in
+// aes_*_init, after that only the IV or counter block is set again.
 
 #define AES_128_BLOCK_SIZE 16
 
@@ -41,8 +43,18 @@ typedef enum aes_direction_e { AES_DECRYPT, AES_ENCRYPT } aes_direction_t;
 
 typedef struct aes_ctx_s aes_ctx_t;
 
+// One message of a batch, iv NULL means the IV the context was created with
+typedef struct aes_batch_item_s {
+    const uint8_t *in;
+    uint8_t *out;
+    int len;
+    const uint8_t *iv;
+} aes_batch_item_t;
+
 aes_ctx_t *aes_ctr_init(const uint8_t *key, const uint8_t *iv);
 void aes_ctr_reset(aes_ctx_t *ctx);
+void aes_ctr_set_counter(aes_ctx_t *ctx, const uint8_t *counter);
+void aes_ctr_seek(aes_ctx_t *ctx, uint64_t block);
 void aes_ctr_encrypt(aes_ctx_t *ctx, const uint8_t *in, uint8_t *out, int len);
 void aes_ctr_decrypt(aes_ctx_t *ctx, const uint8_t *in, uint8_t *out, int len);
 void aes_ctr_start_fresh_block(aes_ctx_t *ctx);
@@ -50,10 +62,22 @@ void aes_ctr_destroy(aes_ctx_t *ctx);
 
 aes_ctx_t *aes_cbc_init(const uint8_t *key, const uint8_t *iv, aes_direction_t direction);
 void aes_cbc_reset(aes_ctx_t *ctx);
+void aes_cbc_set_iv(aes_ctx_t *ctx, const uint8_t *iv);
 void aes_cbc_encrypt(aes_ctx_t *ctx, const uint8_t *in, uint8_t *out, int len);
 void aes_cbc_decrypt(aes_ctx_t *ctx, const uint8_t *in, uint8_t *out, int len);
 void aes_cbc_destroy(aes_ctx_t *ctx);
 
+// Decrypts independent messages with one context, each from its own IV (CBC) or counter block (CTR)
+void aes_decrypt_batch(aes_ctx_t *ctx, const aes_batch_item_t *items, int count);
+
+// Where CTR and CBC decryption run. By default OpenSSL on CPUs with AES instructions, and
+// otherwise the fastest of OpenSSL, the bitsliced code in aes_bitsliced.c and a hardware
+// engine of the kernel (aes_af_alg.c), timed once. Applies to contexts created after it is set,
+// a context the engine fails on carries on with OpenSSL.
+typedef enum aes_impl_e { AES_IMPL_AUTO, AES_IMPL_EVP, AES_IMPL_BITSLICED, AES_IMPL_AF_ALG } aes_impl_t;
+void aes_set_impl(aes_impl_t impl);
+const char *aes_get_impl_name(void);
+
 // X25519
 
 #define X25519_KEY_SIZE 32
@@ -76,6 +100,8 @@ typedef struct ed25519_key_s ed25519_key_t;
 ed25519_key_t *ed25519_key_generate(void);
 ed25519_key_t *ed25519_key_from_raw(const unsigned char data[ED25519_KEY_SIZE]);
 void ed25519_key_get_raw(unsigned char data[ED25519_KEY_SIZE], const ed25519_key_t *key);
+ed25519_key_t *ed25519_key_from_private_raw(const unsigned char data[ED25519_KEY_SIZE]);
+void ed25519_key_get_private_raw(unsigned char data[ED25519_KEY_SIZE], const ed25519_key_t *key);
 /*
  * Note that this function does *not copy* the OpenSSL key but only the wrapper. The internal OpenSSL key is still the
  * same. Only the reference count is increased so destroying both the original and the copy is allowed.
@@ -90,6 +116,21 @@ int ed25519_verify(const unsigned char *signature, size_t signature_len,
                    const unsigned char *data, size_t data_len,
                    const ed25519_key_t *key);
 
+// ChaCha20-Poly1305, as AirPlay 2 buffered audio encrypts its packets
+// Like the AES contexts, the key is set once and every message only sets its nonce.
+
+#define CHACHA20_POLY1305_KEY_SIZE 32
+#define CHACHA20_POLY1305_NONCE_SIZE 12
+#define CHACHA20_POLY1305_TAG_SIZE 16
+
+typedef struct chacha20_poly1305_ctx_s chacha20_poly1305_ctx_t;
+
+chacha20_poly1305_ctx_t *chacha20_poly1305_init(const uint8_t *key);
+// Returns -1 if the tag does not match, out then holds nothing usable
+int chacha20_poly1305_decrypt(chacha20_poly1305_ctx_t *ctx, const uint8_t *nonce, const uint8_t *aad, int aad_len,
+                              const uint8_t *in, int len, const uint8_t *tag, uint8_t *out);
+void chacha20_poly1305_destroy(chacha20_poly1305_ctx_t *ctx);
+
 // SHA512
 
 typedef struct sha_ctx_s sha_ctx_t;
@@ -0,0 +1,148 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <time.h>
+#include <assert.h>
+
+#include "decode_scheduler.h"
+#include "threads.h"
+
+/* How far a priority level moves a deadline forward in us, about a frame at 60 fps */
+#define DECODE_SCHEDULER_PRIORITY_STEP 16667
+
+/* On the stack of the waiting thread, for as long as it waits */
+typedef struct decode_scheduler_waiter_s {
+    uint64_t key;
+    uint64_t sequence;
+    struct decode_scheduler_waiter_s *next;
+} decode_scheduler_waiter_t;
+
+struct decode_scheduler_s {
+    mutex_handle_t mutex;
+    cond_handle_t cond;
+
+    /* Guarded by mutex */
+    bool busy;
+    decode_scheduler_waiter_t *waiters;
+    uint64_t sequence;
+    decode_scheduler_stats_t stats;
+};
+
+static uint64_t
+decode_scheduler_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+decode_scheduler_t *
+decode_scheduler_init(void)
+{
+    decode_scheduler_t *scheduler = calloc(1, sizeof(decode_scheduler_t));
+    if (!scheduler) {
+        return NULL;
+    }
+    MUTEX_CREATE(scheduler->mutex);
+    COND_CREATE(scheduler->cond);
+    return scheduler;
+}
+
+/* The waiter whose turn is next, the first of the earliest key. Called with mutex held */
+static decode_scheduler_waiter_t *
+decode_scheduler_next(decode_scheduler_t *scheduler)
+{
+    decode_scheduler_waiter_t *next = scheduler->waiters;
+    for (decode_scheduler_waiter_t *waiter = scheduler->waiters; waiter; waiter = waiter->next) {
+        if (waiter->key < next->key || (waiter->key == next->key && waiter->sequence < next->sequence)) {
+            next = waiter;
+        }
+    }
+    return next;
+}
+
+void
+decode_scheduler_acquire(decode_scheduler_t *scheduler, uint64_t deadline, int priority)
+{
+    assert(scheduler);
+
+    uint64_t advance = priority > 0 ? (uint64_t) priority * DECODE_SCHEDULER_PRIORITY_STEP : 0;
+    MUTEX_LOCK(scheduler->mutex);
+    scheduler->stats.turns++;
+    if (!scheduler->busy && !scheduler->waiters) {
+        scheduler->busy = true;
+        MUTEX_UNLOCK(scheduler->mutex);
+        return;
+    }
+
+    decode_scheduler_waiter_t self = {
+        .key = deadline > advance ? deadline - advance : 0,
+        .sequence = scheduler->sequence++,
+        .next = scheduler->waiters,
+    };
+    scheduler->waiters = &self;
+    uint64_t start = decode_scheduler_now();
+    while (scheduler->busy || decode_scheduler_next(scheduler) != &self) {
+        COND_WAIT(scheduler->cond, scheduler->mutex);
+    }
+
+    bool reordered = false;
+    for (decode_scheduler_waiter_t **link = &scheduler->waiters; *link; ) {
+        if (*link == &self) {
+            *link = self.next;
+            continue;
+        }
+        reordered |= (*link)->sequence < self.sequence;
+        link = &(*link)->next;
+    }
+    scheduler->busy = true;
+    scheduler->stats.waits++;
+    scheduler->stats.reorders += reordered;
+    scheduler->stats.wait_time += decode_scheduler_now() - start;
+    MUTEX_UNLOCK(scheduler->mutex);
+}
+
+void
+decode_scheduler_release(decode_scheduler_t *scheduler)
+{
+    assert(scheduler);
+
+    MUTEX_LOCK(scheduler->mutex);
+    scheduler->busy = false;
+    // Only the next one can go, but every waiter has to check whether it is that one
+    COND_BROADCAST(scheduler->cond);
+    MUTEX_UNLOCK(scheduler->mutex);
+}
+
+void
+decode_scheduler_get_stats(decode_scheduler_t *scheduler, decode_scheduler_stats_t *stats)
+{
+    assert(scheduler);
+
+    MUTEX_LOCK(scheduler->mutex);
+    *stats = scheduler->stats;
+    MUTEX_UNLOCK(scheduler->mutex);
+}
+
+void
+decode_scheduler_destroy(decode_scheduler_t *scheduler)
+{
+    if (!scheduler) {
+        return;
+    }
+    assert(!scheduler->waiters);
+    COND_DESTROY(scheduler->cond);
+    MUTEX_DESTROY(scheduler->mutex);
+    free(scheduler);
+}
@@ -0,0 +1,49 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#ifndef DECODE_SCHEDULER_H
+#define DECODE_SCHEDULER_H
+
+#include <stdint.h>
+
+/*
+ * Lets the submit stages of all sessions hand frames to their renderers one
+ * at a time, earliest deadline first, instead of in the order their threads
+ * happen to wake up. Meant for sessions that share one hardware decoder, or
+ * few cores decoding in software, where a frame handed over ahead of an
+ * earlier one only makes the earlier one late. A waiting frame's deadline is
+ * moved forward by a step per priority level, so the session being watched
+ * wins ties with the others without starving them. What to do with a frame
+ * that waited past its deadline is left to the caller, which checks once it
+ * has its turn.
+ */
+
+typedef struct decode_scheduler_s decode_scheduler_t;
+
+typedef struct {
+    /* Turns taken, and those of them that had to wait for another session */
+    uint64_t turns;
+    uint64_t waits;
+    /* Turns given to a frame that came after one still waiting, for its earlier deadline */
+    uint64_t reorders;
+    /* Time spent waiting in us */
+    uint64_t wait_time;
+} decode_scheduler_stats_t;
+
+decode_scheduler_t *decode_scheduler_init(void);
+/* Blocks until no frame with an earlier deadline, in us of the local clock, waits and nobody else has the turn */
+void decode_scheduler_acquire(decode_scheduler_t *scheduler, uint64_t deadline, int priority);
+void decode_scheduler_release(decode_scheduler_t *scheduler);
+void decode_scheduler_get_stats(decode_scheduler_t *scheduler, decode_scheduler_stats_t *stats);
+void decode_scheduler_destroy(decode_scheduler_t *scheduler);
+
+#endif //DECODE_SCHEDULER_H
@@ -39,6 +39,8 @@
 
 #define MAX_DEVICEID 18
 #define MAX_SERVNAME 256
+/* Our TXT records are well under this, a larger one counts as changed */
+#define MAX_TXTRECORD 1024
 
 #if defined(HAVE_LIBDL) && !defined(__APPLE__)
 # define USE_LIBDL 1
@@ -60,6 +62,7 @@
 # endif
 
 typedef struct _DNSServiceRef_t *DNSServiceRef;
+typedef struct _DNSRecordRef_t *DNSRecordRef;
 typedef union _TXTRecordRef_t { char PrivateData[16]; char *ForceNaturalAlignment; } TXTRecordRef;
 
 typedef uint32_t DNSServiceFlags;
@@ -96,6 +99,15 @@ typedef DNSServiceErrorType (DNSSD_STDCALL *DNSServiceRegister_t)
                 DNSServiceRegisterReply             callBack,
                 void                                *context
         );
+typedef DNSServiceErrorType (DNSSD_STDCALL *DNSServiceUpdateRecord_t)
+        (
+                DNSServiceRef                       sdRef,
+                DNSRecordRef                        RecordRef,
+                DNSServiceFlags                     flags,
+                uint16_t                            rdlen,
+                const void                          *rdata,
+                uint32_t                            ttl
+        );
 typedef void (DNSSD_STDCALL *DNSServiceRefDeallocate_t)(DNSServiceRef sdRef);
 typedef void (DNSSD_STDCALL *TXTRecordCreate_t)
         (
@@ -123,6 +135,8 @@ struct dnssd_s {
 #endif
 
     DNSServiceRegister_t       DNSServiceRegister;
+    /* Optional, without it a changed TXT record is registered again */
+    DNSServiceUpdateRecord_t   DNSServiceUpdateRecord;
     DNSServiceRefDeallocate_t  DNSServiceRefDeallocate;
     TXTRecordCreate_t          TXTRecordCreate;
     TXTRecordSetValue_t        TXTRecordSetValue;
@@ -135,12 +149,21 @@ struct dnssd_s {
 
     DNSServiceRef raop_service;
     DNSServiceRef airplay_service;
+    unsigned short raop_port;
+    unsigned short airplay_port;
 
     char *name;
     int name_len;
 
     char *hw_addr;
     int hw_addr_len;
+
+    int hevc;
+    int buffered_audio;
+    int ptp;
+    int video_url;
+    int audio_only;
+    int busy;
 };
 
 
@@ -166,6 +189,7 @@ dnssd_init(const char* name, int name_len, const char* hw_addr, int hw_addr_len,
 		return NULL;
 	}
 	dnssd->DNSServiceRegister = (DNSServiceRegister_t)GetProcAddress(dnssd->module, "DNSServiceRegister");
+	dnssd->DNSServiceUpdateRecord = (DNSServiceUpdateRecord_t)GetProcAddress(dnssd->module, "DNSServiceUpdateRecord");
 	dnssd->DNSServiceRefDeallocate = (DNSServiceRefDeallocate_t)GetProcAddress(dnssd->module, "DNSServiceRefDeallocate");
 	dnssd->TXTRecordCreate = (TXTRecordCreate_t)GetProcAddress(dnssd->module, "TXTRecordCreate");
 	dnssd->TXTRecordSetValue = (TXTRecordSetValue_t)GetProcAddress(dnssd->module, "TXTRecordSetValue");
@@ -189,6 +213,7 @@ dnssd_init(const char* name, int name_len, const char* hw_addr, int hw_addr_len,
 		return NULL;
 	}
 	dnssd->DNSServiceRegister = (DNSServiceRegister_t)dlsym(dnssd->module, "DNSServiceRegister");
+	dnssd->DNSServiceUpdateRecord = (DNSServiceUpdateRecord_t)dlsym(dnssd->module, "DNSServiceUpdateRecord");
 	dnssd->DNSServiceRefDeallocate = (DNSServiceRefDeallocate_t)dlsym(dnssd->module, "DNSServiceRefDeallocate");
 	dnssd->TXTRecordCreate = (TXTRecordCreate_t)dlsym(dnssd->module, "TXTRecordCreate");
 	dnssd->TXTRecordSetValue = (TXTRecordSetValue_t)dlsym(dnssd->module, "TXTRecordSetValue");
@@ -206,6 +231,7 @@ dnssd_init(const char* name, int name_len, const char* hw_addr, int hw_addr_len,
 	}
 #else
     dnssd->DNSServiceRegister = &DNSServiceRegister;
+    dnssd->DNSServiceUpdateRecord = &DNSServiceUpdateRecord;
     dnssd->DNSServiceRefDeallocate = &DNSServiceRefDeallocate;
     dnssd->TXTRecordCreate = &TXTRecordCreate;
     dnssd->TXTRecordSetValue = &TXTRecordSetValue;
@@ -250,20 +276,32 @@ dnssd_destroy(dnssd_t *dnssd)
     }
 }
 
-int
-dnssd_register_raop(dnssd_t *dnssd, unsigned short port)
+/* The status flags with the busy bit of the receiver's state */
+static void
+dnssd_format_flags(dnssd_t *dnssd, const char *flags, char *buf, size_t size)
 {
-    char servname[MAX_SERVNAME];
+    unsigned long value = strtoul(flags, NULL, 16);
+    if (dnssd->busy) value |= AIRPLAY_FLAGS_BUSY;
+    snprintf(buf, size, "0x%lX", value);
+}
 
-    assert(dnssd);
+static void
+dnssd_build_raop_record(dnssd_t *dnssd)
+{
+    char sf[16];
+    char ft[16];
 
+    dnssd_format_flags(dnssd, RAOP_SF, sf, sizeof(sf));
+    unsigned long features = strtoul(RAOP_FT, NULL, 16);
+    if (dnssd->audio_only) features &= ~AIRPLAY_FEATURES_VISUAL;
+    snprintf(ft, sizeof(ft), "0x%lX", features);
     dnssd->TXTRecordCreate(&dnssd->raop_record, 0, NULL);
     dnssd->TXTRecordSetValue(&dnssd->raop_record, "ch", strlen(RAOP_CH), RAOP_CH);
     dnssd->TXTRecordSetValue(&dnssd->raop_record, "cn", strlen(RAOP_CN), RAOP_CN);
     dnssd->TXTRecordSetValue(&dnssd->raop_record, "da", strlen(RAOP_DA), RAOP_DA);
     dnssd->TXTRecordSetValue(&dnssd->raop_record, "et", strlen(RAOP_ET), RAOP_ET);
     dnssd->TXTRecordSetValue(&dnssd->raop_record, "vv", strlen(RAOP_VV), RAOP_VV);
-    dnssd->TXTRecordSetValue(&dnssd->raop_record, "ft", strlen(RAOP_FT), RAOP_FT);
+    dnssd->TXTRecordSetValue(&dnssd->raop_record, "ft", strlen(ft), ft);
     dnssd->TXTRecordSetValue(&dnssd->raop_record, "am", strlen(GLOBAL_MODEL), GLOBAL_MODEL);
     dnssd->TXTRecordSetValue(&dnssd->raop_record, "md", strlen(RAOP_MD), RAOP_MD);
     dnssd->TXTRecordSetValue(&dnssd->raop_record, "rhd", strlen(RAOP_RHD), RAOP_RHD);
@@ -273,10 +311,20 @@ dnssd_register_raop(dnssd_t *dnssd, unsigned short port)
     dnssd->TXTRecordSetValue(&dnssd->raop_record, "sv", strlen(RAOP_SV), RAOP_SV);
     dnssd->TXTRecordSetValue(&dnssd->raop_record, "tp", strlen(RAOP_TP), RAOP_TP);
     dnssd->TXTRecordSetValue(&dnssd->raop_record, "txtvers", strlen(RAOP_TXTVERS), RAOP_TXTVERS);
-    dnssd->TXTRecordSetValue(&dnssd->raop_record, "sf", strlen(RAOP_SF), RAOP_SF);
+    dnssd->TXTRecordSetValue(&dnssd->raop_record, "sf", strlen(sf), sf);
     dnssd->TXTRecordSetValue(&dnssd->raop_record, "vs", strlen(RAOP_VS), RAOP_VS);
     dnssd->TXTRecordSetValue(&dnssd->raop_record, "vn", strlen(RAOP_VN), RAOP_VN);
     dnssd->TXTRecordSetValue(&dnssd->raop_record, "pk", strlen(RAOP_PK), RAOP_PK);
+}
+
+int
+dnssd_register_raop(dnssd_t *dnssd, unsigned short port)
+{
+    char servname[MAX_SERVNAME];
+
+    assert(dnssd);
+
+    dnssd_build_raop_record(dnssd);
 
     /* Convert hardware address to string */
     if (utils_hwaddr_raop(servname, sizeof(servname), dnssd->hw_addr, dnssd->hw_addr_len) < 0) {
@@ -294,6 +342,7 @@ dnssd_register_raop(dnssd_t *dnssd, unsigned short port)
     strncat(servname, dnssd->name, sizeof(servname)-strlen(servname)-1);
 
     /* Register the service */
+    dnssd->raop_port = port;
     dnssd->DNSServiceRegister(&dnssd->raop_service, 0, 0,
                               servname, "_raop._tcp",
                               NULL, NULL,
@@ -306,12 +355,56 @@ dnssd_register_raop(dnssd_t *dnssd, unsigned short port)
     return 1;
 }
 
-int
-dnssd_register_airplay(dnssd_t *dnssd, unsigned short port)
+void
+dnssd_set_hevc(dnssd_t *dnssd, int enabled)
 {
-    char device_id[3 * MAX_HWADDR_LEN];
+    assert(dnssd);
+    dnssd->hevc = enabled;
+}
 
+void
+dnssd_set_buffered_audio(dnssd_t *dnssd, int enabled)
+{
+    assert(dnssd);
+    dnssd->buffered_audio = enabled;
+}
+
+void
+dnssd_set_ptp(dnssd_t *dnssd, int enabled)
+{
+    assert(dnssd);
+    dnssd->ptp = enabled;
+}
+
+void
+dnssd_set_video_url(dnssd_t *dnssd, int enabled)
+{
     assert(dnssd);
+    dnssd->video_url = enabled;
+}
+
+void
+dnssd_set_audio_only(dnssd_t *dnssd, int enabled)
+{
+    assert(dnssd);
+    dnssd->audio_only = enabled;
+}
+
+void
+dnssd_set_busy(dnssd_t *dnssd, int busy)
+{
+    assert(dnssd);
+    dnssd->busy = busy;
+}
+
+static int
+dnssd_build_airplay_record(dnssd_t *dnssd)
+{
+    char device_id[3 * MAX_HWADDR_LEN];
+    char features[32];
+    char flags[16];
+    unsigned int features_low = AIRPLAY_FEATURES;
+    unsigned int features_high = 0;
 
     /* Convert hardware address to string */
     if (utils_hwaddr_airplay(device_id, sizeof(device_id), dnssd->hw_addr, dnssd->hw_addr_len) < 0) {
@@ -322,15 +415,38 @@ dnssd_register_airplay(dnssd_t *dnssd, unsigned short port)
 
     dnssd->TXTRecordCreate(&dnssd->airplay_record, 0, NULL);
     dnssd->TXTRecordSetValue(&dnssd->airplay_record, "deviceid", strlen(device_id), device_id);
-    dnssd->TXTRecordSetValue(&dnssd->airplay_record, "features", strlen(AIRPLAY_FEATURES), AIRPLAY_FEATURES);
-    dnssd->TXTRecordSetValue(&dnssd->airplay_record, "flags", strlen(AIRPLAY_FLAGS), AIRPLAY_FLAGS);
+    if (dnssd->video_url) features_low |= AIRPLAY_FEATURES_VIDEO_URL;
+    if (dnssd->audio_only) features_low &= ~AIRPLAY_FEATURES_VISUAL;
+    if (dnssd->hevc && !dnssd->audio_only) features_high |= AIRPLAY_FEATURES_HEVC;
+    if (dnssd->buffered_audio) features_high |= AIRPLAY_FEATURES_BUFFERED_AUDIO;
+    if (dnssd->ptp) features_high |= AIRPLAY_FEATURES_PTP;
+    if (features_high) {
+        snprintf(features, sizeof(features), "0x%X,0x%X", features_low, features_high);
+    } else {
+        snprintf(features, sizeof(features), "0x%X", features_low);
+    }
+    dnssd_format_flags(dnssd, AIRPLAY_FLAGS, flags, sizeof(flags));
+    dnssd->TXTRecordSetValue(&dnssd->airplay_record, "features", strlen(features), features);
+    dnssd->TXTRecordSetValue(&dnssd->airplay_record, "flags", strlen(flags), flags);
     dnssd->TXTRecordSetValue(&dnssd->airplay_record, "model", strlen(GLOBAL_MODEL), GLOBAL_MODEL);
     dnssd->TXTRecordSetValue(&dnssd->airplay_record, "pk", strlen(AIRPLAY_PK), AIRPLAY_PK);
     dnssd->TXTRecordSetValue(&dnssd->airplay_record, "pi", strlen(AIRPLAY_PI), AIRPLAY_PI);
     dnssd->TXTRecordSetValue(&dnssd->airplay_record, "srcvers", strlen(AIRPLAY_SRCVERS), AIRPLAY_SRCVERS);
     dnssd->TXTRecordSetValue(&dnssd->airplay_record, "vv", strlen(AIRPLAY_VV), AIRPLAY_VV);
+    return 0;
+}
+
+int
+dnssd_register_airplay(dnssd_t *dnssd, unsigned short port)
+{
+    assert(dnssd);
+
+    if (dnssd_build_airplay_record(dnssd) < 0) {
+        return -1;
+    }
 
     /* Register the service */
+    dnssd->airplay_port = port;
     dnssd->DNSServiceRegister(&dnssd->airplay_service, 0, 0,
                               dnssd->name, "_airplay._tcp",
                               NULL, NULL,
@@ -342,6 +458,88 @@ dnssd_register_airplay(dnssd_t *dnssd, unsigned short port)
     return 1;
 }
 
+/* Copies the bytes of a record, which are gone once it is rebuilt */
+static uint16_t
+dnssd_copy_record(dnssd_t *dnssd, TXTRecordRef *record, char *buf, size_t size)
+{
+    uint16_t len = dnssd->TXTRecordGetLength(record);
+    if (len > size) {
+        return 0;
+    }
+    memcpy(buf, dnssd->TXTRecordGetBytesPtr(record), len);
+    return len;
+}
+
+static int
+dnssd_record_equals(dnssd_t *dnssd, TXTRecordRef *record, const char *buf, uint16_t len)
+{
+    return len && dnssd->TXTRecordGetLength(record) == len && !memcmp(dnssd->TXTRecordGetBytesPtr(record), buf, len);
+}
+
+int
+dnssd_update_raop(dnssd_t *dnssd)
+{
+    assert(dnssd);
+
+    if (!dnssd->raop_service) {
+        return 0;
+    }
+    char old[MAX_TXTRECORD];
+    uint16_t old_len = dnssd_copy_record(dnssd, &dnssd->raop_record, old, sizeof(old));
+    dnssd->TXTRecordDeallocate(&dnssd->raop_record);
+    dnssd_build_raop_record(dnssd);
+    if (dnssd_record_equals(dnssd, &dnssd->raop_record, old, old_len)) {
+        return 0;
+    }
+    if (!dnssd->DNSServiceUpdateRecord) {
+        /* Senders drop the receiver from their lists until it is back */
+        dnssd->TXTRecordDeallocate(&dnssd->raop_record);
+        dnssd->DNSServiceRefDeallocate(dnssd->raop_service);
+        dnssd->raop_service = NULL;
+        return dnssd_register_raop(dnssd, dnssd->raop_port) > 0 ? 0 : -1;
+    }
+
+    /* A NULL record is the primary TXT record of the service */
+    if (dnssd->DNSServiceUpdateRecord(dnssd->raop_service, NULL, 0,
+                                      dnssd->TXTRecordGetLength(&dnssd->raop_record),
+                                      dnssd->TXTRecordGetBytesPtr(&dnssd->raop_record), 0) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+int
+dnssd_update_airplay(dnssd_t *dnssd)
+{
+    assert(dnssd);
+
+    if (!dnssd->airplay_service) {
+        return 0;
+    }
+    char old[MAX_TXTRECORD];
+    uint16_t old_len = dnssd_copy_record(dnssd, &dnssd->airplay_record, old, sizeof(old));
+    dnssd->TXTRecordDeallocate(&dnssd->airplay_record);
+    if (dnssd_build_airplay_record(dnssd) < 0) {
+        return -1;
+    }
+    if (dnssd_record_equals(dnssd, &dnssd->airplay_record, old, old_len)) {
+        return 0;
+    }
+    if (!dnssd->DNSServiceUpdateRecord) {
+        dnssd->TXTRecordDeallocate(&dnssd->airplay_record);
+        dnssd->DNSServiceRefDeallocate(dnssd->airplay_service);
+        dnssd->airplay_service = NULL;
+        return dnssd_register_airplay(dnssd, dnssd->airplay_port) > 0 ? 0 : -1;
+    }
+
+    if (dnssd->DNSServiceUpdateRecord(dnssd->airplay_service, NULL, 0,
+                                      dnssd->TXTRecordGetLength(&dnssd->airplay_record),
+                                      dnssd->TXTRecordGetBytesPtr(&dnssd->airplay_record), 0) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
 const char *
 dnssd_get_airplay_txt(dnssd_t *dnssd, int *length)
 {
@@ -21,9 +21,31 @@ typedef struct dnssd_s dnssd_t;
 
 DNSSD_API dnssd_t *dnssd_init(const char *name, int name_len, const char *hw_addr, int hw_addr_len, int *error);
 
+/* Advertise that mirroring may use HEVC, takes effect with the next dnssd_register_airplay */
+DNSSD_API void dnssd_set_hevc(dnssd_t *dnssd, int enabled);
+DNSSD_API void dnssd_set_buffered_audio(dnssd_t *dnssd, int enabled);
+/* Advertise that senders may sync the receiver to their PTP clock, see raop_set_ptp */
+DNSSD_API void dnssd_set_ptp(dnssd_t *dnssd, int enabled);
+/* Advertise that video URLs can be played on the airplay port, see raop_start_video */
+DNSSD_API void dnssd_set_video_url(dnssd_t *dnssd, int enabled);
+/* Advertise audio only, without screen mirroring, photos or video, see raop_set_audio_only */
+DNSSD_API void dnssd_set_audio_only(dnssd_t *dnssd, int enabled);
+/* Whether the status flags tell senders the receiver takes no more sessions */
+DNSSD_API void dnssd_set_busy(dnssd_t *dnssd, int busy);
+
 DNSSD_API int dnssd_register_raop(dnssd_t *dnssd, unsigned short port);
 DNSSD_API int dnssd_register_airplay(dnssd_t *dnssd, unsigned short port);
 
+/*
+ * Rebuild the TXT record of a registered service from the settings above and
+ * update it in place, so senders see the change without losing the receiver
+ * from their lists. Unchanged records aren't sent again. Where the library
+ * has no DNSServiceUpdateRecord the service is registered again. Return 0,
+ * or -1 on error. The airplay TXT record read before is invalid after it.
+ */
+DNSSD_API int dnssd_update_raop(dnssd_t *dnssd);
+DNSSD_API int dnssd_update_airplay(dnssd_t *dnssd);
+
 DNSSD_API void dnssd_unregister_raop(dnssd_t *dnssd);
 DNSSD_API void dnssd_unregister_airplay(dnssd_t *dnssd);
 
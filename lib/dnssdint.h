@@ -19,9 +19,20 @@
 #define RAOP_VN "65537"
 #define RAOP_PK "b07727d6f6cd6e08b58ede525ec3cdeaa252ad9f683feb212ef8a205246554e7"
 
-#define AIRPLAY_FEATURES "0x5A7FFEE6"
+#define AIRPLAY_FEATURES 0x5A7FFEE6
+/* Bits of the low word, Video and VideoHTTPLiveStreams, while video URLs are played */
+#define AIRPLAY_FEATURES_VIDEO_URL 0x11
+/* Bits of the low word left out by a receiver that only plays audio: video, photos, slideshows,
+ * Screen and ScreenRotate */
+#define AIRPLAY_FEATURES_VISUAL 0x1BF
+/* Bits of the high word of the features */
+#define AIRPLAY_FEATURES_BUFFERED_AUDIO 0x100 /* Bit 40, SupportsBufferedAudio */
+#define AIRPLAY_FEATURES_PTP 0x200 /* Bit 41, SupportsPTP */
+#define AIRPLAY_FEATURES_HEVC 0x400 /* Bit 42, SupportsScreenMultiCodec */
 #define AIRPLAY_SRCVERS "220.68"
 #define AIRPLAY_FLAGS "0x4"
+/* Status flag bit 11, set in flags and sf while the receiver takes no more sessions */
+#define AIRPLAY_FLAGS_BUSY 0x800
 #define AIRPLAY_VV "2"
 #define AIRPLAY_PK "b07727d6f6cd6e08b58ede525ec3cdeaa252ad9f683feb212ef8a205246554e7"
 #define AIRPLAY_PI "2e388006-13ba-4041-9a67-25dd4a43d536"
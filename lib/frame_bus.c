@@ -0,0 +1,280 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "frame_bus.h"
+#include "threads.h"
+#include "thread_attr.h"
+
+typedef struct {
+    frame_bus_t *bus;
+    frame_bus_subscriber_config_t config;
+    char *name;
+
+    /* Video and codec frames come from the mirror thread, audio from the audio thread */
+    spsc_ring_t *video_queue;
+    spsc_ring_t *audio_queue;
+    thread_handle_t thread;
+
+    /* Wakes the subscriber's thread, never held while a frame is delivered */
+    mutex_handle_t mutex;
+    cond_handle_t cond;
+    int closing;
+
+    uint64_t queued_bytes;
+    uint64_t delivered;
+    uint64_t dropped;
+
+    /* Only touched by the video publisher */
+    bool skipping_to_keyframe;
+} frame_bus_subscriber_t;
+
+struct frame_bus_s {
+    logger_t *logger;
+    frame_bus_subscriber_t *subscribers[FRAME_BUS_MAX_SUBSCRIBERS];
+    int subscriber_count;
+    int kinds;
+};
+
+frame_bus_t *
+frame_bus_init(logger_t *logger)
+{
+    frame_bus_t *bus = calloc(1, sizeof(frame_bus_t));
+    if (!bus) {
+        return NULL;
+    }
+    bus->logger = logger;
+    return bus;
+}
+
+static void
+frame_bus_deliver(frame_bus_subscriber_t *subscriber, frame_bus_frame_t *frame)
+{
+    subscriber->config.callback(subscriber->config.cls, frame);
+    __atomic_fetch_sub(&subscriber->queued_bytes, frame->data_len, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&subscriber->delivered, 1, __ATOMIC_RELAXED);
+    frame_bus_frame_release(frame);
+}
+
+static THREAD_RETVAL
+frame_bus_subscriber_thread(void *arg)
+{
+    frame_bus_subscriber_t *subscriber = arg;
+    frame_bus_frame_t *frame;
+    bool closing = false;
+
+    thread_attr_apply(subscriber->bus->logger, THREAD_ROLE_NONE, "rp-framebus");
+    while (true) {
+        bool idle = true;
+        while ((frame = spsc_ring_pop(subscriber->video_queue)) != NULL) {
+            frame_bus_deliver(subscriber, frame);
+            idle = false;
+        }
+        while ((frame = spsc_ring_pop(subscriber->audio_queue)) != NULL) {
+            frame_bus_deliver(subscriber, frame);
+            idle = false;
+        }
+        if (!idle) {
+            continue;
+        }
+        if (closing) {
+            break;
+        }
+        MUTEX_LOCK(subscriber->mutex);
+        if (!subscriber->closing && !spsc_ring_count(subscriber->video_queue) &&
+            !spsc_ring_count(subscriber->audio_queue)) {
+            COND_WAIT(subscriber->cond, subscriber->mutex);
+        }
+        // One more pass empties the queues after closing
+        closing = subscriber->closing;
+        MUTEX_UNLOCK(subscriber->mutex);
+    }
+    return 0;
+}
+
+int
+frame_bus_subscribe(frame_bus_t *bus, const frame_bus_subscriber_config_t *config)
+{
+    frame_bus_subscriber_t *subscriber;
+
+    assert(bus);
+    assert(config);
+    assert(config->callback);
+
+    if (bus->subscriber_count >= FRAME_BUS_MAX_SUBSCRIBERS) {
+        logger_log(bus->logger, LOGGER_ERR, "frame_bus supports at most %d subscribers", FRAME_BUS_MAX_SUBSCRIBERS);
+        return -1;
+    }
+    subscriber = calloc(1, sizeof(frame_bus_subscriber_t));
+    if (!subscriber) {
+        return -1;
+    }
+    subscriber->bus = bus;
+    subscriber->config = *config;
+    subscriber->name = strdup(config->name ? config->name : "subscriber");
+    subscriber->video_queue = spsc_ring_init(config->queue_length);
+    subscriber->audio_queue = spsc_ring_init(config->queue_length);
+    if (!subscriber->name || !subscriber->video_queue || !subscriber->audio_queue) {
+        spsc_ring_destroy(subscriber->video_queue);
+        spsc_ring_destroy(subscriber->audio_queue);
+        free(subscriber->name);
+        free(subscriber);
+        return -1;
+    }
+    subscriber->config.name = subscriber->name;
+    MUTEX_CREATE(subscriber->mutex);
+    COND_CREATE(subscriber->cond);
+    THREAD_CREATE(subscriber->thread, frame_bus_subscriber_thread, subscriber);
+
+    bus->subscribers[bus->subscriber_count] = subscriber;
+    bus->kinds |= config->kinds;
+    __atomic_store_n(&bus->subscriber_count, bus->subscriber_count + 1, __ATOMIC_RELEASE);
+    return bus->subscriber_count - 1;
+}
+
+bool
+frame_bus_wants(frame_bus_t *bus, frame_bus_kind_t kind)
+{
+    return bus && (bus->kinds & kind) != 0;
+}
+
+frame_bus_frame_t *
+frame_bus_frame_create(frame_bus_kind_t kind, const unsigned char *data, int data_len, uint64_t pts)
+{
+    frame_bus_frame_t *frame = malloc(sizeof(frame_bus_frame_t) + data_len);
+    if (!frame) {
+        return NULL;
+    }
+    frame->kind = kind;
+    frame->pts = pts;
+    frame->keyframe = false;
+    frame->codec = VIDEO_CODEC_H264;
+    frame->width = 0;
+    frame->height = 0;
+    frame->nal_count = 0;
+    frame->data_len = data_len;
+    frame->refcount = 1;
+    memcpy(frame->data, data, data_len);
+    return frame;
+}
+
+void
+frame_bus_frame_retain(const frame_bus_frame_t *frame)
+{
+    __atomic_fetch_add(&((frame_bus_frame_t *) frame)->refcount, 1, __ATOMIC_RELAXED);
+}
+
+void
+frame_bus_frame_release(const frame_bus_frame_t *frame)
+{
+    if (frame && __atomic_sub_fetch(&((frame_bus_frame_t *) frame)->refcount, 1, __ATOMIC_ACQ_REL) == 0) {
+        free((frame_bus_frame_t *) frame);
+    }
+}
+
+static void
+frame_bus_drop(frame_bus_subscriber_t *subscriber, frame_bus_frame_t *frame)
+{
+    __atomic_fetch_add(&subscriber->dropped, 1, __ATOMIC_RELAXED);
+    if (frame->kind == FRAME_BUS_VIDEO && subscriber->config.policy == FRAME_BUS_DROP_TO_KEYFRAME) {
+        subscriber->skipping_to_keyframe = true;
+    }
+}
+
+void
+frame_bus_publish(frame_bus_t *bus, frame_bus_frame_t *frame)
+{
+    int count;
+
+    assert(bus);
+
+    if (!frame) {
+        return;
+    }
+    count = __atomic_load_n(&bus->subscriber_count, __ATOMIC_ACQUIRE);
+    for (int i = 0; i < count; i++) {
+        frame_bus_subscriber_t *subscriber = bus->subscribers[i];
+        spsc_ring_t *queue = frame->kind == FRAME_BUS_AUDIO ? subscriber->audio_queue : subscriber->video_queue;
+        uint64_t max_bytes = subscriber->config.max_queued_bytes;
+
+        if (!(subscriber->config.kinds & frame->kind)) {
+            continue;
+        }
+        if (frame->kind == FRAME_BUS_VIDEO && subscriber->skipping_to_keyframe) {
+            if (!frame->keyframe) {
+                __atomic_fetch_add(&subscriber->dropped, 1, __ATOMIC_RELAXED);
+                continue;
+            }
+            subscriber->skipping_to_keyframe = false;
+        }
+        if (max_bytes && __atomic_load_n(&subscriber->queued_bytes, __ATOMIC_RELAXED) + frame->data_len > max_bytes) {
+            frame_bus_drop(subscriber, frame);
+            continue;
+        }
+        frame_bus_frame_retain(frame);
+        __atomic_fetch_add(&subscriber->queued_bytes, frame->data_len, __ATOMIC_RELAXED);
+        if (spsc_ring_push(queue, frame) < 0) {
+            __atomic_fetch_sub(&subscriber->queued_bytes, frame->data_len, __ATOMIC_RELAXED);
+            frame_bus_frame_release(frame);
+            frame_bus_drop(subscriber, frame);
+            continue;
+        }
+        MUTEX_LOCK(subscriber->mutex);
+        COND_SIGNAL(subscriber->cond);
+        MUTEX_UNLOCK(subscriber->mutex);
+    }
+    frame_bus_frame_release(frame);
+}
+
+void
+frame_bus_get_stats(frame_bus_t *bus, int index, frame_bus_subscriber_stats_t *stats)
+{
+    assert(bus);
+    assert(stats);
+    assert(index >= 0 && index < bus->subscriber_count);
+
+    frame_bus_subscriber_t *subscriber = bus->subscribers[index];
+    stats->delivered = __atomic_load_n(&subscriber->delivered, __ATOMIC_RELAXED);
+    stats->dropped = __atomic_load_n(&subscriber->dropped, __ATOMIC_RELAXED);
+    spsc_ring_get_stats(subscriber->video_queue, &stats->video_queue);
+    spsc_ring_get_stats(subscriber->audio_queue, &stats->audio_queue);
+}
+
+void
+frame_bus_destroy(frame_bus_t *bus)
+{
+    if (!bus) {
+        return;
+    }
+    for (int i = 0; i < bus->subscriber_count; i++) {
+        frame_bus_subscriber_t *subscriber = bus->subscribers[i];
+        MUTEX_LOCK(subscriber->mutex);
+        subscriber->closing = 1;
+        COND_SIGNAL(subscriber->cond);
+        MUTEX_UNLOCK(subscriber->mutex);
+        THREAD_JOIN(subscriber->thread);
+
+        logger_log(bus->logger, LOGGER_INFO, "frame_bus %s took %llu frames, dropped %llu",
+                   subscriber->name, (unsigned long long) subscriber->delivered,
+                   (unsigned long long) subscriber->dropped);
+        spsc_ring_destroy(subscriber->video_queue);
+        spsc_ring_destroy(subscriber->audio_queue);
+        MUTEX_DESTROY(subscriber->mutex);
+        COND_DESTROY(subscriber->cond);
+        free(subscriber->name);
+        free(subscriber);
+    }
+    free(bus);
+}
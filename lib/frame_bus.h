@@ -0,0 +1,117 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#ifndef FRAME_BUS_H
+#define FRAME_BUS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "logger.h"
+#include "stream.h"
+#include "spsc_ring.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Fans the frames of a session out to consumers besides the renderers, such
+ * as a recorder or a restreamer. Every subscriber gets its own bounded queue
+ * and thread, frames are shared between them by reference count, so a slow
+ * consumer only ever drops its own frames and never holds up the receive
+ * threads or the others.
+ *
+ * There may be one video publisher (video and codec frames) and one audio
+ * publisher. Subscribers are added before the first frame is published.
+ */
+
+#define FRAME_BUS_MAX_SUBSCRIBERS 8
+
+typedef enum {
+    /* Annex-B access unit */
+    FRAME_BUS_VIDEO = 1,
+    /* Annex-B SPS and PPS, width and height set */
+    FRAME_BUS_CODEC = 2,
+    /* AAC-ELD frame */
+    FRAME_BUS_AUDIO = 4
+} frame_bus_kind_t;
+
+typedef enum {
+    /* A frame that finds the queue full is dropped */
+    FRAME_BUS_DROP_NEWEST,
+    /* As above, and video after a dropped frame is dropped up to the next keyframe,
+     * so a consumer that decodes never sees a broken reference chain */
+    FRAME_BUS_DROP_TO_KEYFRAME
+} frame_bus_policy_t;
+
+typedef struct frame_bus_s frame_bus_t;
+
+typedef struct {
+    frame_bus_kind_t kind;
+    /* us on the local clock, 0 for codec frames */
+    uint64_t pts;
+    /* Video frame with a slice decoding can start at */
+    bool keyframe;
+    video_codec_t codec;
+    int width;
+    int height;
+    /* NAL units in data, nal_count is 0 if the frame was not indexed */
+    int nal_count;
+    h264_nal_unit_t nal_units[H264_MAX_NAL_UNITS];
+    int data_len;
+    int refcount;
+    unsigned char data[];
+} frame_bus_frame_t;
+
+/* Called on the subscriber's thread, the frame is only valid until it returns unless retained */
+typedef void (*frame_bus_callback_t)(void *cls, const frame_bus_frame_t *frame);
+
+typedef struct {
+    /* For the log */
+    const char *name;
+    /* frame_bus_kind_t flags */
+    int kinds;
+    unsigned int queue_length;
+    /* Payload bytes that may wait in the queue, 0 for no limit beyond queue_length */
+    uint64_t max_queued_bytes;
+    frame_bus_policy_t policy;
+    frame_bus_callback_t callback;
+    void *cls;
+} frame_bus_subscriber_config_t;
+
+typedef struct {
+    uint64_t delivered;
+    uint64_t dropped;
+    spsc_ring_stats_t video_queue;
+    spsc_ring_stats_t audio_queue;
+} frame_bus_subscriber_stats_t;
+
+frame_bus_t *frame_bus_init(logger_t *logger);
+/* Returns the subscriber's index or -1 */
+int frame_bus_subscribe(frame_bus_t *bus, const frame_bus_subscriber_config_t *config);
+/* True if any subscriber takes frames of kind, so publishers can skip the copy */
+bool frame_bus_wants(frame_bus_t *bus, frame_bus_kind_t kind);
+/* A frame with a reference held by the caller and data_len bytes of data copied in */
+frame_bus_frame_t *frame_bus_frame_create(frame_bus_kind_t kind, const unsigned char *data, int data_len, uint64_t pts);
+void frame_bus_frame_retain(const frame_bus_frame_t *frame);
+void frame_bus_frame_release(const frame_bus_frame_t *frame);
+/* Queues frame for every subscriber that wants it and gives up the caller's reference. Never blocks. */
+void frame_bus_publish(frame_bus_t *bus, frame_bus_frame_t *frame);
+void frame_bus_get_stats(frame_bus_t *bus, int index, frame_bus_subscriber_stats_t *stats);
+/* Delivers what is still queued, then stops the subscribers' threads */
+void frame_bus_destroy(frame_bus_t *bus);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //FRAME_BUS_H
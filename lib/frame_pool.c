@@ -0,0 +1,324 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "frame_pool.h"
+#include "threads.h"
+#include "thread_stats.h"
+#include "utils.h"
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+/* Size classes go from 1 KB up to 4 MB, which covers the largest IDR frames */
+#define FRAME_POOL_MIN_SHIFT 10
+#define FRAME_POOL_MAX_SHIFT 22
+#define FRAME_POOL_CLASSES (FRAME_POOL_MAX_SHIFT - FRAME_POOL_MIN_SHIFT + 1)
+
+/* Number of idle buffers kept per size class */
+#define FRAME_POOL_MAX_FREE 8
+
+#define FRAME_POOL_NO_CLASS (-1)
+
+/* Header in front of every buffer, padded to keep the payload 16-byte aligned */
+typedef union frame_pool_block_u {
+    struct {
+        union frame_pool_block_u *next;
+        size_t capacity;
+        int size_class;
+        /* Prefaulted and locked in memory, unlocked before it is freed */
+        int locked;
+    } h;
+    unsigned char pad[32];
+} frame_pool_block_t;
+
+struct frame_pool_s {
+    logger_t *logger;
+
+    mutex_handle_t mutex;
+    frame_pool_block_t *free_list[FRAME_POOL_CLASSES];
+    unsigned int free_count[FRAME_POOL_CLASSES];
+
+    frame_pool_stats_t stats;
+
+    /* Limit on stats.bytes_in_use, 0 if unlimited, and the budget shared with other pools */
+    size_t max_bytes;
+    mem_budget_t *shared;
+
+    /* Set by frame_pool_destroy while buffers are still out, the last put frees the pool */
+    int destroyed;
+};
+
+static void
+frame_pool_free_block(frame_pool_block_t *block)
+{
+#if defined(__linux__)
+    if (block && block->h.locked) {
+        munlock(block, sizeof(frame_pool_block_t) + block->h.capacity);
+    }
+#endif
+    free(block);
+}
+
+static int
+frame_pool_size_class(size_t size)
+{
+    int size_class = 0;
+    size_t capacity = (size_t) 1 << FRAME_POOL_MIN_SHIFT;
+    while (capacity < size) {
+        capacity <<= 1;
+        size_class++;
+        if (size_class >= FRAME_POOL_CLASSES) {
+            return FRAME_POOL_NO_CLASS;
+        }
+    }
+    return size_class;
+}
+
+frame_pool_t *
+frame_pool_init(logger_t *logger)
+{
+    frame_pool_t *pool;
+
+    pool = calloc(1, sizeof(frame_pool_t));
+    if (!pool) {
+        return NULL;
+    }
+    pool->logger = logger;
+    MUTEX_CREATE(pool->mutex);
+    return pool;
+}
+
+void
+frame_pool_set_budget(frame_pool_t *pool, size_t max_bytes, mem_budget_t *shared)
+{
+    assert(pool);
+
+    MUTEX_LOCK(pool->mutex);
+    assert(!pool->shared && !pool->stats.buffers_in_use);
+    pool->max_bytes = max_bytes;
+    pool->shared = shared ? mem_budget_retain(shared) : NULL;
+    MUTEX_UNLOCK(pool->mutex);
+}
+
+void *
+frame_pool_get(frame_pool_t *pool, size_t size)
+{
+    frame_pool_block_t *block = NULL;
+    int size_class;
+    size_t capacity;
+
+    assert(pool);
+
+    size_class = frame_pool_size_class(size);
+    if (size_class == FRAME_POOL_NO_CLASS) {
+        capacity = size;
+    } else {
+        capacity = (size_t) 1 << (size_class + FRAME_POOL_MIN_SHIFT);
+    }
+
+    MUTEX_LOCK(pool->mutex);
+    if ((pool->max_bytes && pool->stats.bytes_in_use + capacity > pool->max_bytes) ||
+        (pool->shared && !mem_budget_reserve(pool->shared, capacity))) {
+        pool->stats.over_budget++;
+        MUTEX_UNLOCK(pool->mutex);
+        return NULL;
+    }
+    if (size_class != FRAME_POOL_NO_CLASS && pool->free_list[size_class]) {
+        block = pool->free_list[size_class];
+        pool->free_list[size_class] = block->h.next;
+        pool->free_count[size_class]--;
+        pool->stats.hits++;
+    } else {
+        pool->stats.misses++;
+    }
+    MUTEX_UNLOCK(pool->mutex);
+
+    if (!block) {
+        block = malloc(sizeof(frame_pool_block_t) + capacity);
+        if (!block) {
+            logger_log(pool->logger, LOGGER_ERR, "frame_pool could not allocate %zu bytes", capacity);
+            if (pool->shared) {
+                mem_budget_release(pool->shared, capacity);
+            }
+            return NULL;
+        }
+        block->h.capacity = capacity;
+        block->h.size_class = size_class;
+        block->h.locked = 0;
+
+        MUTEX_LOCK(pool->mutex);
+        pool->stats.bytes_allocated += capacity;
+        MUTEX_UNLOCK(pool->mutex);
+    }
+    thread_stats_add_pool_bytes(capacity);
+    block->h.next = NULL;
+
+    MUTEX_LOCK(pool->mutex);
+    pool->stats.buffers_in_use++;
+    pool->stats.bytes_in_use += capacity;
+    if (pool->stats.buffers_in_use > pool->stats.peak_buffers) {
+        pool->stats.peak_buffers = pool->stats.buffers_in_use;
+    }
+    if (pool->stats.bytes_in_use > pool->stats.peak_bytes) {
+        pool->stats.peak_bytes = pool->stats.bytes_in_use;
+    }
+    MUTEX_UNLOCK(pool->mutex);
+
+    return block + 1;
+}
+
+void
+frame_pool_put(frame_pool_t *pool, void *buf)
+{
+    frame_pool_block_t *block;
+    int size_class;
+    int last;
+
+    assert(pool);
+    if (!buf) {
+        return;
+    }
+    block = ((frame_pool_block_t *) buf) - 1;
+    size_class = block->h.size_class;
+
+    MUTEX_LOCK(pool->mutex);
+    pool->stats.buffers_in_use--;
+    pool->stats.bytes_in_use -= block->h.capacity;
+    if (pool->shared) {
+        mem_budget_release(pool->shared, block->h.capacity);
+    }
+    if (!pool->destroyed && size_class != FRAME_POOL_NO_CLASS && pool->free_count[size_class] < FRAME_POOL_MAX_FREE) {
+        block->h.next = pool->free_list[size_class];
+        pool->free_list[size_class] = block;
+        pool->free_count[size_class]++;
+        block = NULL;
+    } else {
+        pool->stats.bytes_allocated -= block->h.capacity;
+        if (block->h.locked) {
+            pool->stats.bytes_locked -= block->h.capacity;
+        }
+    }
+    last = pool->destroyed && pool->stats.buffers_in_use == 0;
+    MUTEX_UNLOCK(pool->mutex);
+
+    frame_pool_free_block(block);
+    if (last) {
+        MUTEX_DESTROY(pool->mutex);
+        mem_budget_destroy(pool->shared);
+        free(pool);
+    }
+}
+
+int
+frame_pool_prefault(frame_pool_t *pool, size_t size, int count, int lock)
+{
+    int size_class = frame_pool_size_class(size);
+    int added = 0;
+    int failed = 0;
+
+    assert(pool);
+    if (size_class == FRAME_POOL_NO_CLASS) {
+        return -1;
+    }
+    size_t capacity = (size_t) 1 << (size_class + FRAME_POOL_MIN_SHIFT);
+    for (; added < count; added++) {
+        MUTEX_LOCK(pool->mutex);
+        int full = pool->free_count[size_class] >= FRAME_POOL_MAX_FREE;
+        MUTEX_UNLOCK(pool->mutex);
+        if (full) {
+            break;
+        }
+
+        frame_pool_block_t *block = malloc(sizeof(frame_pool_block_t) + capacity);
+        if (!block) {
+            break;
+        }
+        block->h.capacity = capacity;
+        block->h.size_class = size_class;
+        block->h.locked = 0;
+        if (utils_prefault(block, sizeof(frame_pool_block_t) + capacity, lock) < 0) {
+            failed = 1;
+        } else {
+            block->h.locked = lock;
+        }
+
+        MUTEX_LOCK(pool->mutex);
+        block->h.next = pool->free_list[size_class];
+        pool->free_list[size_class] = block;
+        pool->free_count[size_class]++;
+        pool->stats.bytes_allocated += capacity;
+        if (block->h.locked) {
+            pool->stats.bytes_locked += capacity;
+        }
+        MUTEX_UNLOCK(pool->mutex);
+    }
+    return failed ? -1 : added;
+}
+
+size_t
+frame_pool_buffer_size(const void *buf)
+{
+    assert(buf);
+    return (((const frame_pool_block_t *) buf) - 1)->h.capacity;
+}
+
+void
+frame_pool_get_stats(frame_pool_t *pool, frame_pool_stats_t *stats)
+{
+    assert(pool);
+    assert(stats);
+
+    MUTEX_LOCK(pool->mutex);
+    memcpy(stats, &pool->stats, sizeof(frame_pool_stats_t));
+    MUTEX_UNLOCK(pool->mutex);
+}
+
+void
+frame_pool_destroy(frame_pool_t *pool)
+{
+    int in_use;
+
+    if (pool) {
+        MUTEX_LOCK(pool->mutex);
+        for (int i = 0; i < FRAME_POOL_CLASSES; i++) {
+            frame_pool_block_t *block = pool->free_list[i];
+            while (block) {
+                frame_pool_block_t *next = block->h.next;
+                pool->stats.bytes_allocated -= block->h.capacity;
+                if (block->h.locked) {
+                    pool->stats.bytes_locked -= block->h.capacity;
+                }
+                frame_pool_free_block(block);
+                block = next;
+            }
+            pool->free_list[i] = NULL;
+            pool->free_count[i] = 0;
+        }
+        in_use = pool->stats.buffers_in_use;
+        pool->destroyed = in_use != 0;
+        MUTEX_UNLOCK(pool->mutex);
+
+        if (in_use) {
+            /* Renderers may still hold frames, see stream_frame_t */
+            logger_log(pool->logger, LOGGER_DEBUG, "frame_pool destroyed with %u buffers in use, freed once they are returned",
+                       in_use);
+            return;
+        }
+        MUTEX_DESTROY(pool->mutex);
+        mem_budget_destroy(pool->shared);
+        free(pool);
+    }
+}
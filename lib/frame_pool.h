@@ -0,0 +1,73 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#ifndef FRAME_POOL_H
+#define FRAME_POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "logger.h"
+#include "mem_budget.h"
+
+/*
+ * Recycling allocator for frame sized buffers. Requests are rounded up to
+ * a power-of-two size class and served from a per-class free list, so a
+ * steady stream of similarly sized frames never reaches malloc. Requests
+ * larger than the biggest class fall back to plain malloc.
+ *
+ * A pool may be given a budget for the bytes it hands out, and a budget it
+ * shares with other pools. frame_pool_get returns NULL for a buffer that
+ * would go over either, the caller drops what it was for.
+ *
+ * All functions are thread safe. Buffers may still be out when the pool is
+ * destroyed, the pool is then freed once the last of them is returned with
+ * frame_pool_put.
+ */
+
+typedef struct frame_pool_s frame_pool_t;
+
+typedef struct {
+    /* Requests served from a free list / by a new allocation */
+    uint64_t hits;
+    uint64_t misses;
+
+    /* Buffers and bytes currently handed out, with their high-water marks */
+    unsigned int buffers_in_use;
+    unsigned int peak_buffers;
+    size_t bytes_in_use;
+    size_t peak_bytes;
+
+    /* Bytes held by the pool, in use or cached, and those of them locked in memory */
+    size_t bytes_allocated;
+    size_t bytes_locked;
+
+    /* Requests refused because they would have gone over a budget */
+    uint64_t over_budget;
+} frame_pool_stats_t;
+
+frame_pool_t *frame_pool_init(logger_t *logger);
+/* Limits the bytes in use to max_bytes, 0 is unlimited, and reserves them from shared too unless
+ * it is NULL. Set before the first get. */
+void frame_pool_set_budget(frame_pool_t *pool, size_t max_bytes, mem_budget_t *shared);
+/*
+ * Caches up to count buffers of size, which the pool keeps at most a few of per size, with every page
+ * touched and, if lock is set, locked in memory, so the first frames of a stream don't page fault.
+ * Returns the number cached, -1 if some could not be locked.
+ */
+int frame_pool_prefault(frame_pool_t *pool, size_t size, int count, int lock);
+void *frame_pool_get(frame_pool_t *pool, size_t size);
+void frame_pool_put(frame_pool_t *pool, void *buf);
+size_t frame_pool_buffer_size(const void *buf);
+void frame_pool_get_stats(frame_pool_t *pool, frame_pool_stats_t *stats);
+void frame_pool_destroy(frame_pool_t *pool);
+
+#endif //FRAME_POOL_H
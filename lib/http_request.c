@@ -19,34 +19,118 @@
 #include "http_request.h"
 #include "llhttp/llhttp.h"
 
+/* Initial arena size, enough for a typical RTSP request with its plist body */
+#define HTTP_REQUEST_ARENA_SIZE 4096
+#define HTTP_REQUEST_HEADERS_SIZE 16
+
+/* Part of the arena, always followed by a terminating zero */
+typedef struct {
+    int offset;
+    int length;
+} http_span_t;
+
+typedef struct {
+    http_span_t name;
+    http_span_t value;
+} http_header_t;
+
+/*
+ * Names of http_known_header_t, each of a length of its own, so the length
+ * alone picks the one candidate a parsed name has to be compared with.
+ */
+static const char *const http_known_header_names[HTTP_HEADER_KNOWN_COUNT] = {
+    "CSeq",
+    "Content-Type",
+    "Transport",
+    "RTP-Info",
+    "DACP-ID",
+    "Active-Remote"
+};
+
+#define HTTP_KNOWN_HEADER_MAX_LENGTH 13
+
+/* http_known_header_t by name length, the perfect hash of the names above */
+static const signed char http_known_header_by_length[HTTP_KNOWN_HEADER_MAX_LENGTH + 1] = {
+    -1, -1, -1, -1, HTTP_HEADER_CSEQ, -1, -1, HTTP_HEADER_DACP_ID, HTTP_HEADER_RTP_INFO, HTTP_HEADER_TRANSPORT,
+    -1, -1, HTTP_HEADER_CONTENT_TYPE, HTTP_HEADER_ACTIVE_REMOTE
+};
+
 struct http_request_s {
     llhttp_t parser;
     llhttp_settings_t parser_settings;
 
+    /* URL, headers and body are appended to one buffer that is reused by the next request */
+    char *arena;
+    int arena_size;
+    int arena_used;
+
     const char *method;
-    char *url;
+    http_span_t url;
 
-    char **headers;
+    http_header_t *headers;
     int headers_size;
-    int headers_index;
+    int headers_count;
+    int in_value;
+    /* Index into headers of the first of each known name, -1 if missing */
+    int known_headers[HTTP_HEADER_KNOWN_COUNT];
 
-    char *data;
-    int datalen;
+    http_span_t data;
 
     int complete;
 };
 
+static void
+http_span_clear(http_span_t *span)
+{
+    span->offset = -1;
+    span->length = 0;
+}
+
+/*
+ * Appends to span, which is either empty or the last span in the arena.
+ * llhttp may hand over a single element in several pieces.
+ */
+static void
+http_request_append(http_request_t *request, http_span_t *span, const char *at, size_t length)
+{
+    int start;
+
+    if (span->offset == -1) {
+        span->offset = request->arena_used;
+        start = request->arena_used;
+    } else {
+        assert(span->offset + span->length + 1 == request->arena_used);
+        start = request->arena_used - 1;
+    }
+
+    if (start + (int) length + 1 > request->arena_size) {
+        int size = request->arena_size;
+        while (start + (int) length + 1 > size) {
+            size *= 2;
+        }
+        request->arena = realloc(request->arena, size);
+        assert(request->arena);
+        request->arena_size = size;
+    }
+
+    memcpy(request->arena + start, at, length);
+    request->arena[start + length] = '\0';
+    span->length += length;
+    request->arena_used = start + length + 1;
+}
+
+static const char *
+http_request_span(http_request_t *request, const http_span_t *span)
+{
+    return span->offset == -1 ? NULL : request->arena + span->offset;
+}
+
 static int
 on_url(llhttp_t *parser, const char *at, size_t length)
 {
     http_request_t *request = parser->data;
-    int urllen = request->url ? strlen(request->url) : 0;
-
-    request->url = realloc(request->url, urllen+length+1);
-    assert(request->url);
 
-    request->url[urllen] = '\0';
-    strncat(request->url, at, length);
+    http_request_append(request, &request->url, at, length);
     return 0;
 }
 
@@ -55,33 +139,20 @@ on_header_field(llhttp_t *parser, const char *at, size_t length)
 {
     http_request_t *request = parser->data;
 
-    /* Check if our index is a value */
-    if (request->headers_index%2 == 1) {
-        request->headers_index++;
-    }
-
-    /* Allocate space for new field-value pair */
-    if (request->headers_index == request->headers_size) {
-        request->headers_size += 2;
-        request->headers = realloc(request->headers,
-                                   request->headers_size*sizeof(char*));
-        assert(request->headers);
-        request->headers[request->headers_index] = NULL;
-        request->headers[request->headers_index+1] = NULL;
-    }
-
-    /* Allocate space in the current header string */
-    if (request->headers[request->headers_index] == NULL) {
-        request->headers[request->headers_index] = calloc(1, length+1);
-    } else {
-        request->headers[request->headers_index] = realloc(
-                request->headers[request->headers_index],
-                strlen(request->headers[request->headers_index])+length+1
-        );
+    /* Start a new field-value pair after a value */
+    if (request->in_value || request->headers_count == 0) {
+        if (request->headers_count == request->headers_size) {
+            request->headers_size *= 2;
+            request->headers = realloc(request->headers, request->headers_size*sizeof(http_header_t));
+            assert(request->headers);
+        }
+        http_span_clear(&request->headers[request->headers_count].name);
+        http_span_clear(&request->headers[request->headers_count].value);
+        request->headers_count++;
+        request->in_value = 0;
     }
-    assert(request->headers[request->headers_index]);
 
-    strncat(request->headers[request->headers_index], at, length);
+    http_request_append(request, &request->headers[request->headers_count-1].name, at, length);
     return 0;
 }
 
@@ -90,23 +161,40 @@ on_header_value(llhttp_t *parser, const char *at, size_t length)
 {
     http_request_t *request = parser->data;
 
-    /* Check if our index is a field */
-    if (request->headers_index%2 == 0) {
-        request->headers_index++;
-    }
+    assert(request->headers_count > 0);
+    request->in_value = 1;
+    http_request_append(request, &request->headers[request->headers_count-1].value, at, length);
+    return 0;
+}
 
-    /* Allocate space in the current header string */
-    if (request->headers[request->headers_index] == NULL) {
-        request->headers[request->headers_index] = calloc(1, length+1);
-    } else {
-        request->headers[request->headers_index] = realloc(
-                request->headers[request->headers_index],
-                strlen(request->headers[request->headers_index])+length+1
-        );
+/* The known header called name, -1 if it is none */
+static int
+http_request_find_known(const char *name, int length)
+{
+    int known;
+
+    if (length > HTTP_KNOWN_HEADER_MAX_LENGTH) {
+        return -1;
+    }
+    known = http_known_header_by_length[length];
+    if (known < 0 || strcmp(name, http_known_header_names[known])) {
+        return -1;
     }
-    assert(request->headers[request->headers_index]);
+    return known;
+}
+
+static int
+on_headers_complete(llhttp_t *parser)
+{
+    http_request_t *request = parser->data;
 
-    strncat(request->headers[request->headers_index], at, length);
+    for (int i = 0; i < request->headers_count; i++) {
+        const http_header_t *header = &request->headers[i];
+        int known = http_request_find_known(request->arena + header->name.offset, header->name.length);
+        if (known >= 0 && request->known_headers[known] == -1) {
+            request->known_headers[known] = i;
+        }
+    }
     return 0;
 }
 
@@ -115,11 +203,7 @@ on_body(llhttp_t *parser, const char *at, size_t length)
 {
     http_request_t *request = parser->data;
 
-    request->data = realloc(request->data, request->datalen+length);
-    assert(request->data);
-
-    memcpy(request->data+request->datalen, at, length);
-    request->datalen += length;
+    http_request_append(request, &request->data, at, length);
     return 0;
 }
 
@@ -130,7 +214,8 @@ on_message_complete(llhttp_t *parser)
 
     request->method = llhttp_method_name(request->parser.method);
     request->complete = 1;
-    return 0;
+    /* Stop right behind the message, what follows belongs to the next request */
+    return HPE_PAUSED;
 }
 
 http_request_t *
@@ -143,31 +228,53 @@ http_request_init(void)
         return NULL;
     }
 
+    request->arena_size = HTTP_REQUEST_ARENA_SIZE;
+    request->arena = malloc(request->arena_size);
+    request->headers_size = HTTP_REQUEST_HEADERS_SIZE;
+    request->headers = malloc(request->headers_size*sizeof(http_header_t));
+    if (!request->arena || !request->headers) {
+        free(request->arena);
+        free(request->headers);
+        free(request);
+        return NULL;
+    }
+
     llhttp_settings_init(&request->parser_settings);
     request->parser_settings.on_url = &on_url;
     request->parser_settings.on_header_field = &on_header_field;
     request->parser_settings.on_header_value = &on_header_value;
+    request->parser_settings.on_headers_complete = &on_headers_complete;
     request->parser_settings.on_body = &on_body;
     request->parser_settings.on_message_complete = &on_message_complete;
 
+    http_request_reset(request);
+    return request;
+}
+
+void
+http_request_reset(http_request_t *request)
+{
+    assert(request);
+
+    request->arena_used = 0;
+    request->method = NULL;
+    http_span_clear(&request->url);
+    request->headers_count = 0;
+    request->in_value = 0;
+    memset(request->known_headers, -1, sizeof(request->known_headers));
+    http_span_clear(&request->data);
+    request->complete = 0;
+
     llhttp_init(&request->parser, HTTP_REQUEST, &request->parser_settings);
     request->parser.data = request;
-
-    return request;
 }
 
 void
 http_request_destroy(http_request_t *request)
 {
-    int i;
-
     if (request) {
-        free(request->url);
-        for (i=0; i<request->headers_size; i++) {
-            free(request->headers[i]);
-        }
+        free(request->arena);
         free(request->headers);
-        free(request->data);
         free(request);
     }
 }
@@ -175,13 +282,18 @@ http_request_destroy(http_request_t *request)
 int
 http_request_add_data(http_request_t *request, const char *data, int datalen)
 {
-    int ret;
+    llhttp_errno_t ret;
 
     assert(request);
 
-    ret = llhttp_execute(&request->parser,
-                              data, datalen);
-    return ret;
+    if (request->complete) {
+        return 0;
+    }
+    ret = llhttp_execute(&request->parser, data, datalen);
+    if (ret == HPE_PAUSED) {
+        return (int) (llhttp_get_error_pos(&request->parser) - data);
+    }
+    return ret == HPE_OK ? datalen : -1;
 }
 
 int
@@ -195,7 +307,8 @@ int
 http_request_has_error(http_request_t *request)
 {
     assert(request);
-    return (llhttp_get_errno(&request->parser) != HPE_OK);
+    llhttp_errno_t error = llhttp_get_errno(&request->parser);
+    return error != HPE_OK && error != HPE_PAUSED;
 }
 
 const char *
@@ -223,7 +336,7 @@ const char *
 http_request_get_url(http_request_t *request)
 {
     assert(request);
-    return request->url;
+    return http_request_span(request, &request->url);
 }
 
 const char *
@@ -233,21 +346,38 @@ http_request_get_header(http_request_t *request, const char *name)
 
     assert(request);
 
-    for (i=0; i<request->headers_size; i+=2) {
-        if (!strcmp(request->headers[i], name)) {
-            return request->headers[i+1];
+    i = http_request_find_known(name, strlen(name));
+    if (i >= 0) {
+        return http_request_get_known_header(request, i);
+    }
+    for (i=0; i<request->headers_count; i++) {
+        const http_header_t *header = &request->headers[i];
+        if (!strcmp(request->arena + header->name.offset, name)) {
+            return http_request_span(request, &header->value);
         }
     }
     return NULL;
 }
 
+const char *
+http_request_get_known_header(http_request_t *request, http_known_header_t header)
+{
+    assert(request);
+    assert(header >= 0 && header < HTTP_HEADER_KNOWN_COUNT);
+
+    if (request->known_headers[header] == -1) {
+        return NULL;
+    }
+    return http_request_span(request, &request->headers[request->known_headers[header]].value);
+}
+
 const char *
 http_request_get_data(http_request_t *request, int *datalen)
 {
     assert(request);
 
     if (datalen) {
-        *datalen = request->datalen;
+        *datalen = request->data.length;
     }
-    return request->data;
+    return http_request_span(request, &request->data);
 }
@@ -17,9 +17,24 @@
 
 typedef struct http_request_s http_request_t;
 
+/* Headers the handlers look up on every request, indexed once the headers are parsed */
+typedef enum {
+    HTTP_HEADER_CSEQ,
+    HTTP_HEADER_CONTENT_TYPE,
+    HTTP_HEADER_TRANSPORT,
+    HTTP_HEADER_RTP_INFO,
+    HTTP_HEADER_DACP_ID,
+    HTTP_HEADER_ACTIVE_REMOTE,
+    HTTP_HEADER_KNOWN_COUNT
+} http_known_header_t;
 
 http_request_t *http_request_init(void);
+void http_request_reset(http_request_t *request);
 
+/*
+ * Parses data up to the end of one request. Returns the bytes taken, fewer than datalen when
+ * the request is complete and the next one follows in the same data, or -1 on a parse error.
+ */
 int http_request_add_data(http_request_t *request, const char *data, int datalen);
 int http_request_is_complete(http_request_t *request);
 int http_request_has_error(http_request_t *request);
@@ -29,6 +44,8 @@ const char *http_request_get_error_description(http_request_t *request);
 const char *http_request_get_method(http_request_t *request);
 const char *http_request_get_url(http_request_t *request);
 const char *http_request_get_header(http_request_t *request, const char *name);
+/* The first header of a known name, without comparing names */
+const char *http_request_get_known_header(http_request_t *request, http_known_header_t header);
 const char *http_request_get_data(http_request_t *request, int *datalen);
 
 void http_request_destroy(http_request_t *request);
@@ -24,9 +24,17 @@ struct http_response_s {
     int complete;
     int disconnect;
 
+    /* Status line and headers */
     char *data;
     int data_size;
     int data_length;
+
+    /* Body is sent from the caller's buffer, owned only if body_owned is set */
+    char *body;
+    int body_length;
+    int body_owned;
+
+    struct iovec iov[2];
 };
 
 
@@ -91,6 +99,9 @@ void
 http_response_destroy(http_response_t *response)
 {
     if (response) {
+        if (response->body_owned) {
+            free(response->body);
+        }
         free(response->data);
         free(response);
     }
@@ -109,8 +120,8 @@ http_response_add_header(http_response_t *response, const char *name, const char
     http_response_add_data(response, "\r\n", 2);
 }
 
-void
-http_response_finish(http_response_t *response, const char *data, int datalen)
+static void
+http_response_finish_body(http_response_t *response, const char *data, int datalen)
 {
     assert(response);
     assert(datalen==0 || (data && datalen > 0));
@@ -128,8 +139,6 @@ http_response_finish(http_response_t *response, const char *data, int datalen)
         http_response_add_data(response, hdrvalue, strlen(hdrvalue));
         http_response_add_data(response, "\r\n\r\n", 4);
 
-        /* Add data to the end of response */
-        http_response_add_data(response, data, datalen);
     } else {
         /* Add extra end of line after headers */
         http_response_add_data(response, "\r\n", 2);
@@ -137,6 +146,32 @@ http_response_finish(http_response_t *response, const char *data, int datalen)
     response->complete = 1;
 }
 
+void
+http_response_finish(http_response_t *response, const char *data, int datalen)
+{
+    http_response_finish_body(response, data, datalen);
+
+    /* Keep a copy, the caller's buffer may not outlive the response */
+    if (data && datalen > 0) {
+        response->body = malloc(datalen);
+        assert(response->body);
+        memcpy(response->body, data, datalen);
+        response->body_length = datalen;
+        response->body_owned = 1;
+    }
+}
+
+void
+http_response_finish_owned(http_response_t *response, char *data, int datalen)
+{
+    http_response_finish_body(response, data, datalen);
+
+    /* Sent straight from data, which is freed with the response */
+    response->body = data;
+    response->body_length = datalen;
+    response->body_owned = 1;
+}
+
 void
 http_response_set_disconnect(http_response_t *response, int disconnect)
 {
@@ -153,13 +188,17 @@ http_response_get_disconnect(http_response_t *response)
     return response->disconnect;
 }
 
-const char *
-http_response_get_data(http_response_t *response, int *datalen)
+const struct iovec *
+http_response_get_iov(http_response_t *response, int *iovcnt)
 {
     assert(response);
-    assert(datalen);
+    assert(iovcnt);
     assert(response->complete);
 
-    *datalen = response->data_length;
-    return response->data;
+    response->iov[0].iov_base = response->data;
+    response->iov[0].iov_len = response->data_length;
+    response->iov[1].iov_base = response->body;
+    response->iov[1].iov_len = response->body_length;
+    *iovcnt = response->body_length > 0 ? 2 : 1;
+    return response->iov;
 }
@@ -15,17 +15,20 @@
 #ifndef HTTP_RESPONSE_H
 #define HTTP_RESPONSE_H
 
+#include <sys/uio.h>
+
 typedef struct http_response_s http_response_t;
 
 http_response_t *http_response_init(const char *protocol, int code, const char *message);
 
 void http_response_add_header(http_response_t *response, const char *name, const char *value);
 void http_response_finish(http_response_t *response, const char *data, int datalen);
+void http_response_finish_owned(http_response_t *response, char *data, int datalen);
 
 void http_response_set_disconnect(http_response_t *response, int disconnect);
 int http_response_get_disconnect(http_response_t *response);
 
-const char *http_response_get_data(http_response_t *response, int *datalen);
+const struct iovec *http_response_get_iov(http_response_t *response, int *iovcnt);
 
 void http_response_destroy(http_response_t *response);
 
@@ -16,19 +16,48 @@
 #include <string.h>
 #include <stdio.h>
 #include <assert.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 
 #include "httpd.h"
 #include "netutils.h"
 #include "http_request.h"
 #include "compat.h"
 #include "logger.h"
+#include "thread_attr.h"
+
+/* Receive buffer per connection, large enough for most plist bodies in one read */
+#define HTTPD_BUFFER_SIZE 16384
+
+/* Events handled per epoll_wait */
+#define HTTPD_MAX_EVENTS 16
+
+/* Threads running the request handlers, so a slow pairing or SETUP of one sender doesn't hold up the others */
+#define HTTPD_WORKER_COUNT 4
+
+/* Requests of a connection parsed ahead of their responses, when a sender sends several at once */
+#define HTTPD_MAX_PIPELINED 8
 
 struct http_connection_s {
     int connected;
 
     int socket_fd;
     void *user_data;
-    http_request_t *request;
+    /* Complete requests in order from requests[0] to requests[pending - 1], the one being parsed next.
+     * Created as needed and reset after each message */
+    http_request_t *requests[HTTPD_MAX_PIPELINED];
+    int pending;
+    char *buffer;
+    /* Received bytes not parsed yet, left over when more requests came at once than fit */
+    int buffer_pos;
+    int buffer_len;
+
+    /* Handed to a worker with its complete requests, its socket is not watched until the worker is done */
+    int busy;
+    /* Set by the worker when the handler asked to close the connection */
+    int disconnect;
+    /* Next in the work queue or the done list */
+    struct http_connection_s *next;
 };
 typedef struct http_connection_s http_connection_t;
 
@@ -41,7 +70,8 @@ struct httpd_s {
     http_connection_t *connections;
 
     /* These variables only edited mutex locked */
-    int running;
+    /* Edited with run_mutex held, the thread reads running without it */
+    thread_flag_t running;
     int joined;
     thread_handle_t thread;
     mutex_handle_t run_mutex;
@@ -49,6 +79,21 @@ struct httpd_s {
     /* Server fds for accepting connections */
     int server_fd4;
     int server_fd6;
+
+    /* Readiness of all sockets, and an eventfd that httpd_stop and the workers signal */
+    int epoll_fd;
+    int wake_fd;
+    int accepting;
+
+    /* Connections with a request waiting for a worker, and those whose response went out, protected by work_mutex */
+    mutex_handle_t work_mutex;
+    cond_handle_t work_cond;
+    http_connection_t *work_head;
+    http_connection_t *work_tail;
+    http_connection_t *done;
+    int workers_running;
+    thread_handle_t workers[HTTPD_WORKER_COUNT];
+    int worker_count;
 };
 
 httpd_t *
@@ -80,8 +125,13 @@ httpd_init(logger_t *logger, httpd_callbacks_t *callbacks, int max_connections)
     memcpy(&httpd->callbacks, callbacks, sizeof(httpd_callbacks_t));
 
     /* Initial status joined */
-    httpd->running = 0;
+    THREAD_FLAG_STORE(httpd->running, 0);
     httpd->joined = 1;
+    httpd->epoll_fd = -1;
+    httpd->wake_fd = -1;
+    MUTEX_CREATE(httpd->run_mutex);
+    MUTEX_CREATE(httpd->work_mutex);
+    COND_CREATE(httpd->work_cond);
 
     return httpd;
 }
@@ -92,7 +142,13 @@ httpd_destroy(httpd_t *httpd)
     if (httpd) {
         httpd_stop(httpd);
 
+        for (int i = 0; i < httpd->max_connections; i++) {
+            free(httpd->connections[i].buffer);
+        }
         free(httpd->connections);
+        COND_DESTROY(httpd->work_cond);
+        MUTEX_DESTROY(httpd->work_mutex);
+        MUTEX_DESTROY(httpd->run_mutex);
         free(httpd);
     }
 }
@@ -114,15 +170,33 @@ httpd_add_connection(httpd_t *httpd, int fd, unsigned char *local, int local_len
         return -1;
     }
 
+    if (!httpd->connections[i].buffer) {
+        httpd->connections[i].buffer = malloc(HTTPD_BUFFER_SIZE);
+        if (!httpd->connections[i].buffer) {
+            logger_log(httpd->logger, LOGGER_ERR, "Error allocating HTTP receive buffer");
+            return -1;
+        }
+    }
+
     user_data = httpd->callbacks.conn_init(httpd->callbacks.opaque, local, local_len, remote, remote_len);
     if (!user_data) {
         logger_log(httpd->logger, LOGGER_ERR, "Error initializing HTTP request handler");
         return -1;
     }
 
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = &httpd->connections[i];
+    if (epoll_ctl(httpd->epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1) {
+        logger_log(httpd->logger, LOGGER_ERR, "Error watching socket %d", fd);
+        httpd->callbacks.conn_destroy(user_data);
+        return -1;
+    }
+
     httpd->open_connections++;
     httpd->connections[i].socket_fd = fd;
     httpd->connections[i].connected = 1;
+    httpd->connections[i].busy = 0;
     httpd->connections[i].user_data = user_data;
     return 0;
 }
@@ -170,173 +244,373 @@ httpd_accept_connection(httpd_t *httpd, int server_fd, int is_ipv6)
 static void
 httpd_remove_connection(httpd_t *httpd, http_connection_t *connection)
 {
-    if (connection->request) {
-        http_request_destroy(connection->request);
-        connection->request = NULL;
+    for (int i = 0; i < HTTPD_MAX_PIPELINED; i++) {
+        http_request_destroy(connection->requests[i]);
+        connection->requests[i] = NULL;
     }
+    connection->pending = 0;
+    connection->buffer_pos = connection->buffer_len = 0;
     httpd->callbacks.conn_destroy(connection->user_data);
+    epoll_ctl(httpd->epoll_fd, EPOLL_CTL_DEL, connection->socket_fd, NULL);
     shutdown(connection->socket_fd, SHUT_WR);
     closesocket(connection->socket_fd);
     connection->connected = 0;
     httpd->open_connections--;
 }
 
+/*
+ * Watches the server sockets only while there is room for another connection.
+ * Returns -1 if a server socket could not be added to or removed from the epoll set.
+ */
+static int
+httpd_set_accepting(httpd_t *httpd, int accepting)
+{
+    int server_fds[2] = { httpd->server_fd4, httpd->server_fd6 };
+
+    if (httpd->accepting == accepting) {
+        return 0;
+    }
+    for (int i = 0; i < 2; i++) {
+        if (server_fds[i] == -1) {
+            continue;
+        }
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.ptr = i == 0 ? (void *) &httpd->server_fd4 : (void *) &httpd->server_fd6;
+        if (epoll_ctl(httpd->epoll_fd, accepting ? EPOLL_CTL_ADD : EPOLL_CTL_DEL, server_fds[i], &event) == -1) {
+            return -1;
+        }
+    }
+    httpd->accepting = accepting;
+    return 0;
+}
+
+/*
+ * Parses the received bytes into as many requests as they complete, up to HTTPD_MAX_PIPELINED.
+ * Returns -1 if the data is no valid request.
+ */
+static int
+httpd_parse_requests(httpd_t *httpd, http_connection_t *connection)
+{
+    while (connection->buffer_pos < connection->buffer_len && connection->pending < HTTPD_MAX_PIPELINED) {
+        http_request_t **request = &connection->requests[connection->pending];
+        if (!*request && !(*request = http_request_init())) {
+            logger_log(httpd->logger, LOGGER_ERR, "Error allocating HTTP request");
+            return -1;
+        }
+        int ret = http_request_add_data(*request, connection->buffer + connection->buffer_pos,
+                                        connection->buffer_len - connection->buffer_pos);
+        if (ret < 0) {
+            logger_log(httpd->logger, LOGGER_ERR, "httpd error in parsing: %s", http_request_get_error_name(*request));
+            return -1;
+        }
+        connection->buffer_pos += ret;
+        if (http_request_is_complete(*request)) {
+            connection->pending++;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Hands the connection's complete requests to a worker, its socket is left alone until it is done.
+ */
+static void
+httpd_queue_connection(httpd_t *httpd, http_connection_t *connection)
+{
+    connection->busy = 1;
+    connection->next = NULL;
+
+    MUTEX_LOCK(httpd->work_mutex);
+    if (httpd->work_tail) {
+        httpd->work_tail->next = connection;
+    } else {
+        httpd->work_head = connection;
+    }
+    httpd->work_tail = connection;
+    COND_SIGNAL(httpd->work_cond);
+    MUTEX_UNLOCK(httpd->work_mutex);
+}
+
+/*
+ * Reads what is available on the connection and queues it once it holds complete requests.
+ */
+static void
+httpd_handle_connection(httpd_t *httpd, http_connection_t *connection)
+{
+    int ret;
+
+    LOGGER_LOG(httpd->logger, LOGGER_DEBUG, "httpd receiving on socket %d", connection->socket_fd);
+    ret = recv(connection->socket_fd, connection->buffer, HTTPD_BUFFER_SIZE, 0);
+    if (ret == 0) {
+        logger_log(httpd->logger, LOGGER_INFO, "Connection closed for socket %d", connection->socket_fd);
+        httpd_remove_connection(httpd, connection);
+        return;
+    } else if (ret == -1) {
+        logger_log(httpd->logger, LOGGER_ERR, "httpd error in recv on socket %d: %d", connection->socket_fd, SOCKET_GET_ERROR());
+        httpd_remove_connection(httpd, connection);
+        return;
+    }
+
+    /* Parse HTTP requests from data read from connection */
+    connection->buffer_pos = 0;
+    connection->buffer_len = ret;
+    if (httpd_parse_requests(httpd, connection) < 0) {
+        httpd_remove_connection(httpd, connection);
+        return;
+    }
+
+    if (connection->pending > 0) {
+        /* Removed rather than muted, a hangup would be reported regardless */
+        epoll_ctl(httpd->epoll_fd, EPOLL_CTL_DEL, connection->socket_fd, NULL);
+        httpd_queue_connection(httpd, connection);
+    } else {
+        LOGGER_LOG(httpd->logger, LOGGER_DEBUG, "Request not complete, waiting for more data...");
+    }
+}
+
+/*
+ * Runs the handler of a complete request and sends the response, on a worker. With more, further
+ * responses follow right away and the kernel may send them together.
+ * Returns 1 if the connection is to be closed.
+ */
+static int
+httpd_process_request(httpd_t *httpd, http_connection_t *connection, http_request_t *request, int more)
+{
+    http_response_t *response = NULL;
+    int disconnect = 0;
+    int ret;
+
+    // Callback the received data to raop
+    httpd->callbacks.conn_request(connection->user_data, request, &response);
+    http_request_reset(request);
+
+    if (response) {
+        struct iovec iov[2];
+        struct msghdr msg;
+        int iovcnt;
+
+        /* Headers and body go out in one sendmsg, the body is not copied */
+        memcpy(iov, http_response_get_iov(response, &iovcnt), sizeof(iov));
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = iovcnt;
+
+        while (msg.msg_iovlen > 0) {
+            ret = sendmsg(connection->socket_fd, &msg, more ? MSG_MORE : 0);
+            if (ret == -1) {
+                logger_log(httpd->logger, LOGGER_ERR, "httpd error in sending data");
+                break;
+            }
+            /* Skip what was written after a partial send */
+            while (msg.msg_iovlen > 0 && (size_t) ret >= msg.msg_iov->iov_len) {
+                ret -= msg.msg_iov->iov_len;
+                msg.msg_iov++;
+                msg.msg_iovlen--;
+            }
+            if (msg.msg_iovlen > 0) {
+                msg.msg_iov->iov_base = (char *) msg.msg_iov->iov_base + ret;
+                msg.msg_iov->iov_len -= ret;
+            }
+        }
+
+        if (http_response_get_disconnect(response)) {
+            logger_log(httpd->logger, LOGGER_INFO, "Disconnecting on software request");
+            disconnect = 1;
+        }
+    } else {
+        logger_log(httpd->logger, LOGGER_WARNING, "httpd didn't get response");
+    }
+    http_response_destroy(response);
+    return disconnect;
+}
+
+/*
+ * Answers the connection's complete requests in the order they came in.
+ * Returns 1 if the connection is to be closed.
+ */
+static int
+httpd_process_requests(httpd_t *httpd, http_connection_t *connection)
+{
+    int pending = connection->pending;
+    int disconnect = 0;
+
+    for (int i = 0; i < pending && !disconnect; i++) {
+        disconnect = httpd_process_request(httpd, connection, connection->requests[i], i + 1 < pending);
+    }
+    /* The request being parsed moves to the front, the ones handled are reset and follow it */
+    if (pending < HTTPD_MAX_PIPELINED) {
+        http_request_t *request = connection->requests[0];
+        connection->requests[0] = connection->requests[pending];
+        connection->requests[pending] = request;
+    }
+    connection->pending = 0;
+    return disconnect;
+}
+
+/*
+ * Takes connections off the work queue in order. A connection is queued at most once, with all
+ * of its complete requests, so the requests of one sender are handled one after the other.
+ */
+static THREAD_RETVAL
+httpd_worker_thread(void *arg)
+{
+    httpd_t *httpd = arg;
+
+    thread_attr_apply(httpd->logger, THREAD_ROLE_HTTPD, "rp-httpd-work");
+    MUTEX_LOCK(httpd->work_mutex);
+    while (1) {
+        while (httpd->workers_running && !httpd->work_head) {
+            COND_WAIT(httpd->work_cond, httpd->work_mutex);
+        }
+        if (!httpd->workers_running) {
+            break;
+        }
+        http_connection_t *connection = httpd->work_head;
+        httpd->work_head = connection->next;
+        if (!httpd->work_head) {
+            httpd->work_tail = NULL;
+        }
+        MUTEX_UNLOCK(httpd->work_mutex);
+
+        int disconnect = httpd_process_requests(httpd, connection);
+
+        MUTEX_LOCK(httpd->work_mutex);
+        connection->disconnect = disconnect;
+        connection->next = httpd->done;
+        httpd->done = connection;
+        uint64_t value = 1;
+        if (write(httpd->wake_fd, &value, sizeof(value)) < 0) {
+            logger_log(httpd->logger, LOGGER_WARNING, "httpd worker could not wake server thread");
+        }
+    }
+    MUTEX_UNLOCK(httpd->work_mutex);
+    return 0;
+}
+
+/*
+ * Watches the sockets of the connections the workers are done with again, or closes them.
+ * Requests that were received but did not fit the last time are queued first.
+ */
+static void
+httpd_finish_requests(httpd_t *httpd)
+{
+    http_connection_t *connection;
+
+    MUTEX_LOCK(httpd->work_mutex);
+    connection = httpd->done;
+    httpd->done = NULL;
+    MUTEX_UNLOCK(httpd->work_mutex);
+
+    while (connection) {
+        http_connection_t *next = connection->next;
+        connection->busy = 0;
+        if (connection->disconnect || httpd_parse_requests(httpd, connection) < 0) {
+            httpd_remove_connection(httpd, connection);
+        } else if (connection->pending > 0) {
+            httpd_queue_connection(httpd, connection);
+        } else {
+            struct epoll_event event;
+            event.events = EPOLLIN;
+            event.data.ptr = connection;
+            if (epoll_ctl(httpd->epoll_fd, EPOLL_CTL_ADD, connection->socket_fd, &event) == -1) {
+                logger_log(httpd->logger, LOGGER_ERR, "Error watching socket %d", connection->socket_fd);
+                httpd_remove_connection(httpd, connection);
+            }
+        }
+        connection = next;
+    }
+}
+
+static void
+httpd_stop_workers(httpd_t *httpd)
+{
+    MUTEX_LOCK(httpd->work_mutex);
+    httpd->workers_running = 0;
+    COND_BROADCAST(httpd->work_cond);
+    MUTEX_UNLOCK(httpd->work_mutex);
+    for (int i = 0; i < httpd->worker_count; i++) {
+        THREAD_JOIN(httpd->workers[i]);
+    }
+    httpd->worker_count = 0;
+    httpd->work_head = NULL;
+    httpd->work_tail = NULL;
+    httpd->done = NULL;
+}
+
 static THREAD_RETVAL
 httpd_thread(void *arg)
 {
     httpd_t *httpd = arg;
-    char buffer[1024];
+    struct epoll_event events[HTTPD_MAX_EVENTS];
     int i;
 
     assert(httpd);
 
+    thread_attr_apply(httpd->logger, THREAD_ROLE_HTTPD, "rp-httpd");
     while (1) {
-        fd_set rfds;
-        struct timeval tv;
-        int nfds=0;
+        int accept4 = 0, accept6 = 0;
         int ret;
 
-        MUTEX_LOCK(httpd->run_mutex);
-        if (!httpd->running) {
-            MUTEX_UNLOCK(httpd->run_mutex);
+        if (!THREAD_FLAG_LOAD(httpd->running)) {
             break;
         }
-        MUTEX_UNLOCK(httpd->run_mutex);
 
-        /* Set timeout value to 5ms */
-        tv.tv_sec = 1;
-        tv.tv_usec = 5000;
-
-        /* Get the correct nfds value and set rfds */
-        FD_ZERO(&rfds);
-        if (httpd->open_connections < httpd->max_connections) {
-            if (httpd->server_fd4 != -1) {
-                FD_SET(httpd->server_fd4, &rfds);
-                if (nfds <= httpd->server_fd4) {
-                    nfds = httpd->server_fd4+1;
-                }
-            }
-            if (httpd->server_fd6 != -1) {
-                FD_SET(httpd->server_fd6, &rfds);
-                if (nfds <= httpd->server_fd6) {
-                    nfds = httpd->server_fd6+1;
-                }
-            }
+        if (httpd_set_accepting(httpd, httpd->open_connections < httpd->max_connections) == -1) {
+            logger_log(httpd->logger, LOGGER_ERR, "httpd error watching server sockets");
+            break;
         }
-        for (i=0; i<httpd->max_connections; i++) {
-            int socket_fd;
-            if (!httpd->connections[i].connected) {
+
+        /* No timeout needed, httpd_stop signals wake_fd */
+        ret = epoll_wait(httpd->epoll_fd, events, HTTPD_MAX_EVENTS, -1);
+        if (ret == -1) {
+            if (SOCKET_GET_ERROR() == EINTR) {
                 continue;
             }
-            socket_fd = httpd->connections[i].socket_fd;
-            FD_SET(socket_fd, &rfds);
-            if (nfds <= socket_fd) {
-                nfds = socket_fd+1;
-            }
+            logger_log(httpd->logger, LOGGER_ERR, "httpd error in epoll_wait");
+            break;
         }
 
-        ret = select(nfds, &rfds, NULL, NULL, &tv);
-        if (ret == 0) {
-            /* Timeout happened */
-            continue;
-        } else if (ret == -1) {
-            logger_log(httpd->logger, LOGGER_ERR, "httpd error in select");
-            break;
+        /* Connections first, so a slot freed here cannot be reused before its remaining events */
+        for (i = 0; i < ret; i++) {
+            void *ptr = events[i].data.ptr;
+            if (ptr == &httpd->wake_fd) {
+                uint64_t value;
+                if (read(httpd->wake_fd, &value, sizeof(value)) < 0) {
+                    /* Nothing to do, the running flag is checked next */
+                }
+                httpd_finish_requests(httpd);
+            } else if (ptr == &httpd->server_fd4) {
+                accept4 = 1;
+            } else if (ptr == &httpd->server_fd6) {
+                accept6 = 1;
+            } else {
+                http_connection_t *connection = ptr;
+                if (connection->connected && !connection->busy) {
+                    httpd_handle_connection(httpd, connection);
+                }
+            }
         }
 
-        if (httpd->open_connections < httpd->max_connections &&
-            httpd->server_fd4 != -1 && FD_ISSET(httpd->server_fd4, &rfds)) {
+        if (accept4 && httpd->open_connections < httpd->max_connections) {
             ret = httpd_accept_connection(httpd, httpd->server_fd4, 0);
             if (ret == -1) {
                 logger_log(httpd->logger, LOGGER_ERR, "httpd error in accept ipv4");
                 break;
-            } else if (ret == 0) {
-                continue;
             }
         }
-        if (httpd->open_connections < httpd->max_connections &&
-            httpd->server_fd6 != -1 && FD_ISSET(httpd->server_fd6, &rfds)) {
+        if (accept6 && httpd->open_connections < httpd->max_connections) {
             ret = httpd_accept_connection(httpd, httpd->server_fd6, 1);
             if (ret == -1) {
                 logger_log(httpd->logger, LOGGER_ERR, "httpd error in accept ipv6");
                 break;
-            } else if (ret == 0) {
-                continue;
-            }
-        }
-        for (i=0; i<httpd->max_connections; i++) {
-            http_connection_t *connection = &httpd->connections[i];
-
-            if (!connection->connected) {
-                continue;
-            }
-            if (!FD_ISSET(connection->socket_fd, &rfds)) {
-                continue;
-            }
-
-            /* If not in the middle of request, allocate one */
-            if (!connection->request) {
-                connection->request = http_request_init();
-                assert(connection->request);
-            }
-
-            logger_log(httpd->logger, LOGGER_DEBUG, "httpd receiving on socket %d", connection->socket_fd);
-            ret = recv(connection->socket_fd, buffer, sizeof(buffer), 0);
-            if (ret == 0) {
-                logger_log(httpd->logger, LOGGER_INFO, "Connection closed for socket %d", connection->socket_fd);
-                httpd_remove_connection(httpd, connection);
-                continue;
-            }
-
-            /* Parse HTTP request from data read from connection */
-            http_request_add_data(connection->request, buffer, ret);
-            if (http_request_has_error(connection->request)) {
-                logger_log(httpd->logger, LOGGER_ERR, "httpd error in parsing: %s", http_request_get_error_name(connection->request));
-                httpd_remove_connection(httpd, connection);
-                continue;
-            }
-
-            /* If request is finished, process and deallocate */
-            if (http_request_is_complete(connection->request)) {
-                http_response_t *response = NULL;
-                // Callback the received data to raop
-                httpd->callbacks.conn_request(connection->user_data, connection->request, &response);
-                http_request_destroy(connection->request);
-                connection->request = NULL;
-
-                if (response) {
-                    const char *data;
-                    int datalen;
-                    int written;
-                    int ret;
-
-                    /* Get response data and datalen */
-                    data = http_response_get_data(response, &datalen);
-
-                    written = 0;
-                    while (written < datalen) {
-                        ret = send(connection->socket_fd, data+written, datalen-written, 0);
-                        if (ret == -1) {
-                            logger_log(httpd->logger, LOGGER_ERR, "httpd error in sending data");
-                            break;
-                        }
-                        written += ret;
-                    }
-
-                    if (http_response_get_disconnect(response)) {
-                        logger_log(httpd->logger, LOGGER_INFO, "Disconnecting on software request");
-                        httpd_remove_connection(httpd, connection);
-                    }
-                } else {
-                    logger_log(httpd->logger, LOGGER_WARNING, "httpd didn't get response");
-                }
-                http_response_destroy(response);
-            } else {
-                logger_log(httpd->logger, LOGGER_DEBUG, "Request not complete, waiting for more data...");
             }
         }
     }
 
+    /* Requests in progress are finished, queued ones are dropped with their connections */
+    httpd_stop_workers(httpd);
+
     /* Remove all connections that are still connected */
     for (i=0; i<httpd->max_connections; i++) {
         http_connection_t *connection = &httpd->connections[i];
@@ -359,13 +633,17 @@ httpd_thread(void *arg)
         closesocket(httpd->server_fd6);
         httpd->server_fd6 = -1;
     }
+    close(httpd->epoll_fd);
+    httpd->epoll_fd = -1;
 
-    // Ensure running reflects the actual state
+    // Ensure running reflects the actual state. wake_fd goes with it, httpd_stop writes to it under the lock
     MUTEX_LOCK(httpd->run_mutex);
-    httpd->running = 0;
+    close(httpd->wake_fd);
+    httpd->wake_fd = -1;
+    THREAD_FLAG_STORE(httpd->running, 0);
     MUTEX_UNLOCK(httpd->run_mutex);
 
-    logger_log(httpd->logger, LOGGER_DEBUG, "Exiting HTTP thread");
+    LOGGER_LOG(httpd->logger, LOGGER_DEBUG, "Exiting HTTP thread");
 
     return 0;
 }
@@ -380,7 +658,7 @@ httpd_start(httpd_t *httpd, unsigned short *port)
     assert(port);
 
     MUTEX_LOCK(httpd->run_mutex);
-    if (httpd->running || !httpd->joined) {
+    if (THREAD_FLAG_LOAD(httpd->running) || !httpd->joined) {
         MUTEX_UNLOCK(httpd->run_mutex);
         return 0;
     }
@@ -391,11 +669,12 @@ httpd_start(httpd_t *httpd, unsigned short *port)
         MUTEX_UNLOCK(httpd->run_mutex);
         return -1;
     }
-    httpd->server_fd6 = -1;/*= netutils_init_socket(port, 1, 0);
-	if (httpd->server_fd6 == -1) {
-		logger_log(httpd->logger, LOGGER_WARNING, "Error initialising IPv6 socket %d", SOCKET_GET_ERROR());
-		logger_log(httpd->logger, LOGGER_WARNING, "Continuing without IPv6 support");
-	}*/
+    // Same port as the IPv4 socket, senders on IPv6-preferring networks try it first
+    httpd->server_fd6 = netutils_init_socket(port, 1, 0);
+    if (httpd->server_fd6 == -1) {
+        logger_log(httpd->logger, LOGGER_WARNING, "Error initialising IPv6 socket %d", SOCKET_GET_ERROR());
+        logger_log(httpd->logger, LOGGER_WARNING, "Continuing without IPv6 support");
+    }
 
     if (httpd->server_fd4 != -1 && listen(httpd->server_fd4, backlog) == -1) {
         logger_log(httpd->logger, LOGGER_ERR, "Error listening to IPv4 socket");
@@ -413,9 +692,31 @@ httpd_start(httpd_t *httpd, unsigned short *port)
     }
     logger_log(httpd->logger, LOGGER_INFO, "Initialized server socket(s)");
 
-    /* Set values correctly and create new thread */
-    httpd->running = 1;
+    httpd->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    httpd->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = &httpd->wake_fd;
+    if (httpd->epoll_fd == -1 || httpd->wake_fd == -1 ||
+        epoll_ctl(httpd->epoll_fd, EPOLL_CTL_ADD, httpd->wake_fd, &event) == -1) {
+        logger_log(httpd->logger, LOGGER_ERR, "Error initialising epoll %d", SOCKET_GET_ERROR());
+        if (httpd->epoll_fd != -1) close(httpd->epoll_fd);
+        if (httpd->wake_fd != -1) close(httpd->wake_fd);
+        httpd->epoll_fd = httpd->wake_fd = -1;
+        closesocket(httpd->server_fd4);
+        closesocket(httpd->server_fd6);
+        MUTEX_UNLOCK(httpd->run_mutex);
+        return -3;
+    }
+    httpd->accepting = 0;
+
+    /* Set values correctly and create new threads */
+    THREAD_FLAG_STORE(httpd->running, 1);
     httpd->joined = 0;
+    httpd->workers_running = 1;
+    for (httpd->worker_count = 0; httpd->worker_count < HTTPD_WORKER_COUNT; httpd->worker_count++) {
+        THREAD_CREATE(httpd->workers[httpd->worker_count], httpd_worker_thread, httpd);
+    }
     THREAD_CREATE(httpd->thread, httpd_thread, httpd);
     MUTEX_UNLOCK(httpd->run_mutex);
 
@@ -430,7 +731,7 @@ httpd_is_running(httpd_t *httpd)
     assert(httpd);
 
     MUTEX_LOCK(httpd->run_mutex);
-    running = httpd->running || !httpd->joined;
+    running = THREAD_FLAG_LOAD(httpd->running) || !httpd->joined;
     MUTEX_UNLOCK(httpd->run_mutex);
 
     return running;
@@ -442,11 +743,16 @@ httpd_stop(httpd_t *httpd)
     assert(httpd);
 
     MUTEX_LOCK(httpd->run_mutex);
-    if (!httpd->running || httpd->joined) {
+    if (!THREAD_FLAG_LOAD(httpd->running) || httpd->joined) {
         MUTEX_UNLOCK(httpd->run_mutex);
         return;
     }
-    httpd->running = 0;
+    THREAD_FLAG_STORE(httpd->running, 0);
+    // Under the lock, so the thread can't exit and close wake_fd in between
+    uint64_t value = 1;
+    if (write(httpd->wake_fd, &value, sizeof(value)) < 0) {
+        logger_log(httpd->logger, LOGGER_WARNING, "httpd could not wake server thread");
+    }
     MUTEX_UNLOCK(httpd->run_mutex);
 
     THREAD_JOIN(httpd->thread);
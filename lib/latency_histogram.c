@@ -0,0 +1,155 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "latency_histogram.h"
+
+/* Values below 2^SUB_BITS get a bucket each, every larger power of two
+ * is split into 2^(SUB_BITS - 1) equally wide buckets */
+#define LATENCY_HISTOGRAM_SUB_BITS 5
+#define LATENCY_HISTOGRAM_SUB_COUNT (1 << LATENCY_HISTOGRAM_SUB_BITS)
+#define LATENCY_HISTOGRAM_HALF_COUNT (LATENCY_HISTOGRAM_SUB_COUNT / 2)
+
+/* Largest tracked magnitude, 2^36 us is about 19 hours */
+#define LATENCY_HISTOGRAM_MAX_BITS 36
+#define LATENCY_HISTOGRAM_MAX_VALUE ((((uint64_t) 1) << LATENCY_HISTOGRAM_MAX_BITS) - 1)
+#define LATENCY_HISTOGRAM_BUCKETS (LATENCY_HISTOGRAM_SUB_COUNT + \
+        (LATENCY_HISTOGRAM_MAX_BITS - LATENCY_HISTOGRAM_SUB_BITS) * LATENCY_HISTOGRAM_HALF_COUNT)
+
+struct latency_histogram_s {
+    uint64_t counts[LATENCY_HISTOGRAM_BUCKETS];
+    uint64_t total;
+    uint64_t sum;
+    uint64_t min;
+    uint64_t max;
+};
+
+static int
+latency_histogram_bucket(uint64_t value)
+{
+    if (value < LATENCY_HISTOGRAM_SUB_COUNT) {
+        return (int) value;
+    }
+    int msb = 63 - __builtin_clzll(value);
+    int shift = msb - LATENCY_HISTOGRAM_SUB_BITS + 1;
+    int top = (int) (value >> shift);
+    return LATENCY_HISTOGRAM_SUB_COUNT + (shift - 1) * LATENCY_HISTOGRAM_HALF_COUNT + (top - LATENCY_HISTOGRAM_HALF_COUNT);
+}
+
+/* Highest value that falls into the given bucket */
+static uint64_t
+latency_histogram_bucket_value(int bucket)
+{
+    if (bucket < LATENCY_HISTOGRAM_SUB_COUNT) {
+        return bucket;
+    }
+    int shift = (bucket - LATENCY_HISTOGRAM_SUB_COUNT) / LATENCY_HISTOGRAM_HALF_COUNT + 1;
+    uint64_t top = (bucket - LATENCY_HISTOGRAM_SUB_COUNT) % LATENCY_HISTOGRAM_HALF_COUNT + LATENCY_HISTOGRAM_HALF_COUNT;
+    return ((top + 1) << shift) - 1;
+}
+
+latency_histogram_t *
+latency_histogram_init(void)
+{
+    latency_histogram_t *histogram = calloc(1, sizeof(latency_histogram_t));
+    if (!histogram) {
+        return NULL;
+    }
+    histogram->min = UINT64_MAX;
+    return histogram;
+}
+
+void
+latency_histogram_record(latency_histogram_t *histogram, int64_t value)
+{
+    uint64_t v;
+
+    assert(histogram);
+    // Clocks may step backwards, count those samples as zero latency
+    v = value < 0 ? 0 : (uint64_t) value;
+    if (v > LATENCY_HISTOGRAM_MAX_VALUE) {
+        v = LATENCY_HISTOGRAM_MAX_VALUE;
+    }
+
+    __atomic_fetch_add(&histogram->counts[latency_histogram_bucket(v)], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&histogram->sum, v, __ATOMIC_RELAXED);
+    if (v < __atomic_load_n(&histogram->min, __ATOMIC_RELAXED)) {
+        __atomic_store_n(&histogram->min, v, __ATOMIC_RELAXED);
+    }
+    if (v > __atomic_load_n(&histogram->max, __ATOMIC_RELAXED)) {
+        __atomic_store_n(&histogram->max, v, __ATOMIC_RELAXED);
+    }
+    __atomic_fetch_add(&histogram->total, 1, __ATOMIC_RELEASE);
+}
+
+uint64_t
+latency_histogram_get_percentile(latency_histogram_t *histogram, double percentile)
+{
+    uint64_t total, target, seen = 0;
+
+    assert(histogram);
+    total = __atomic_load_n(&histogram->total, __ATOMIC_ACQUIRE);
+    if (total == 0) {
+        return 0;
+    }
+    if (percentile > 100.0) percentile = 100.0;
+    if (percentile < 0.0) percentile = 0.0;
+    target = (uint64_t) ((percentile / 100.0) * total + 0.5);
+    if (target == 0) target = 1;
+
+    for (int i = 0; i < LATENCY_HISTOGRAM_BUCKETS; i++) {
+        seen += __atomic_load_n(&histogram->counts[i], __ATOMIC_RELAXED);
+        if (seen >= target) {
+            uint64_t value = latency_histogram_bucket_value(i);
+            uint64_t max = __atomic_load_n(&histogram->max, __ATOMIC_RELAXED);
+            return value < max ? value : max;
+        }
+    }
+    return __atomic_load_n(&histogram->max, __ATOMIC_RELAXED);
+}
+
+void
+latency_histogram_get_stats(latency_histogram_t *histogram, latency_histogram_stats_t *stats)
+{
+    assert(histogram);
+    assert(stats);
+
+    memset(stats, 0, sizeof(latency_histogram_stats_t));
+    stats->count = __atomic_load_n(&histogram->total, __ATOMIC_ACQUIRE);
+    if (stats->count == 0) {
+        return;
+    }
+    stats->min = __atomic_load_n(&histogram->min, __ATOMIC_RELAXED);
+    stats->max = __atomic_load_n(&histogram->max, __ATOMIC_RELAXED);
+    stats->mean = __atomic_load_n(&histogram->sum, __ATOMIC_RELAXED) / stats->count;
+    stats->p50 = latency_histogram_get_percentile(histogram, 50.0);
+    stats->p95 = latency_histogram_get_percentile(histogram, 95.0);
+    stats->p99 = latency_histogram_get_percentile(histogram, 99.0);
+}
+
+/* Must not race with latency_histogram_record */
+void
+latency_histogram_reset(latency_histogram_t *histogram)
+{
+    assert(histogram);
+    memset(histogram, 0, sizeof(latency_histogram_t));
+    histogram->min = UINT64_MAX;
+}
+
+void
+latency_histogram_destroy(latency_histogram_t *histogram)
+{
+    free(histogram);
+}
@@ -0,0 +1,46 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#include <stdint.h>
+
+/*
+ * HDR style histogram of latencies in microseconds. Values are counted in
+ * log-linear buckets with a relative error below 7%, from 1 us up to
+ * well over an hour, in a fixed amount of memory.
+ *
+ * Recording is lock free and meant for a single writer thread. Any thread
+ * may read the statistics while the writer is running.
+ */
+
+typedef struct latency_histogram_s latency_histogram_t;
+
+typedef struct {
+    uint64_t count;
+    uint64_t min;
+    uint64_t max;
+    uint64_t mean;
+    uint64_t p50;
+    uint64_t p95;
+    uint64_t p99;
+} latency_histogram_stats_t;
+
+latency_histogram_t *latency_histogram_init(void);
+void latency_histogram_record(latency_histogram_t *histogram, int64_t value);
+uint64_t latency_histogram_get_percentile(latency_histogram_t *histogram, double percentile);
+void latency_histogram_get_stats(latency_histogram_t *histogram, latency_histogram_stats_t *stats);
+void latency_histogram_reset(latency_histogram_t *histogram);
+void latency_histogram_destroy(latency_histogram_t *histogram);
+
+#endif //LATENCY_HISTOGRAM_H
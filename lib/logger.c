@@ -14,40 +14,96 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <stdarg.h>
 #include <assert.h>
 
 #include "logger.h"
 #include "compat.h"
 
+/*
+ * Messages are queued in a bounded multi-producer ring and delivered to the
+ * callback by a writer thread, so logging threads never wait on stdio.
+ * Producers format into their own stack and copy the text into a slot; the
+ * arguments cannot be deferred since strings passed with %s may not outlive
+ * the call. Messages that do not fit a slot are delivered synchronously.
+ */
+#define LOGGER_RING_SIZE 1024
+#define LOGGER_SLOT_SIZE 256
+
+typedef struct {
+	/* Ticket the slot expects next, see logger_enqueue */
+	unsigned int seq;
+	int level;
+	char msg[LOGGER_SLOT_SIZE];
+} logger_slot_t;
+
 struct logger_s {
-	mutex_handle_t lvl_mutex;
 	mutex_handle_t cb_mutex;
 
+	/* Read without a lock on every call */
 	int level;
 	void *cls;
 	logger_callback_t callback;
+
+	logger_slot_t *slots;
+	unsigned int head;
+	unsigned int tail;
+	unsigned int dropped;
+
+	/* Writer thread, sleeps on wake_cond while the ring is empty */
+	thread_handle_t thread;
+	mutex_handle_t wake_mutex;
+	cond_handle_t wake_cond;
+	int writer_waiting;
+	int running;
 };
 
+static THREAD_RETVAL logger_thread(void *arg);
+
 logger_t *
 logger_init()
 {
 	logger_t *logger = calloc(1, sizeof(logger_t));
 	assert(logger);
 
-	MUTEX_CREATE(logger->lvl_mutex);
 	MUTEX_CREATE(logger->cb_mutex);
 
 	logger->level = LOGGER_WARNING;
 	logger->callback = NULL;
+
+	logger->slots = calloc(LOGGER_RING_SIZE, sizeof(logger_slot_t));
+	assert(logger->slots);
+	for (unsigned int i = 0; i < LOGGER_RING_SIZE; i++) {
+		logger->slots[i].seq = i;
+	}
+	MUTEX_CREATE(logger->wake_mutex);
+	COND_CREATE(logger->wake_cond);
+	logger->running = 1;
+	THREAD_CREATE(logger->thread, logger_thread, logger);
 	return logger;
 }
 
+size_t
+logger_get_size(logger_t *logger)
+{
+	return logger ? sizeof(logger_t) + LOGGER_RING_SIZE * sizeof(logger_slot_t) : 0;
+}
+
 void
 logger_destroy(logger_t *logger)
 {
-	MUTEX_DESTROY(logger->lvl_mutex);
+	/* The writer drains the ring before it exits */
+	MUTEX_LOCK(logger->wake_mutex);
+	logger->running = 0;
+	COND_SIGNAL(logger->wake_cond);
+	MUTEX_UNLOCK(logger->wake_mutex);
+	THREAD_JOIN(logger->thread);
+
+	COND_DESTROY(logger->wake_cond);
+	MUTEX_DESTROY(logger->wake_mutex);
 	MUTEX_DESTROY(logger->cb_mutex);
+	free(logger->slots);
 	free(logger);
 }
 
@@ -56,9 +112,13 @@ logger_set_level(logger_t *logger, int level)
 {
 	assert(logger);
 
-	MUTEX_LOCK(logger->lvl_mutex);
-	logger->level = level;
-	MUTEX_UNLOCK(logger->lvl_mutex);
+	__atomic_store_n(&logger->level, level, __ATOMIC_RELAXED);
+}
+
+int
+logger_is_enabled(logger_t *logger, int level)
+{
+	return level <= __atomic_load_n(&logger->level, __ATOMIC_RELAXED);
 }
 
 void
@@ -102,38 +162,143 @@ logger_utf8_to_local(const char *str)
 	return ret;
 }
 
+static void
+logger_deliver(logger_t *logger, int level, const char *msg)
+{
+	MUTEX_LOCK(logger->cb_mutex);
+	if (logger->callback) {
+		logger->callback(logger->cls, level, msg);
+		MUTEX_UNLOCK(logger->cb_mutex);
+	} else {
+		char *local;
+		MUTEX_UNLOCK(logger->cb_mutex);
+		local = logger_utf8_to_local(msg);
+		if (local) {
+			fprintf(stderr, "%s\n", local);
+			free(local);
+		} else {
+			fprintf(stderr, "%s\n", msg);
+		}
+	}
+}
+
+/*
+ * Bounded MPSC queue with a sequence number per slot. A producer owns ticket
+ * pos once it moves tail past it, and publishes the slot by setting seq to
+ * pos + 1. Returns -1 without blocking when the ring is full.
+ */
+static int
+logger_enqueue(logger_t *logger, int level, const char *msg, int len)
+{
+	logger_slot_t *slot;
+	unsigned int pos;
+
+	pos = __atomic_load_n(&logger->tail, __ATOMIC_RELAXED);
+	while (1) {
+		int diff;
+		slot = &logger->slots[pos % LOGGER_RING_SIZE];
+		diff = (int) (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - pos);
+		if (diff == 0) {
+			if (__atomic_compare_exchange_n(&logger->tail, &pos, pos + 1, 1,
+			                                __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+				break;
+			}
+		} else if (diff < 0) {
+			return -1;
+		} else {
+			pos = __atomic_load_n(&logger->tail, __ATOMIC_RELAXED);
+		}
+	}
+
+	slot->level = level;
+	memcpy(slot->msg, msg, len + 1);
+	__atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+
+	/* Pairs with the fence in logger_thread before it goes to sleep */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&logger->writer_waiting, __ATOMIC_RELAXED)) {
+		MUTEX_LOCK(logger->wake_mutex);
+		COND_SIGNAL(logger->wake_cond);
+		MUTEX_UNLOCK(logger->wake_mutex);
+	}
+	return 0;
+}
+
+/* Only called from the writer thread */
+static int
+logger_dequeue(logger_t *logger)
+{
+	logger_slot_t *slot = &logger->slots[logger->head % LOGGER_RING_SIZE];
+
+	if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != logger->head + 1) {
+		return 0;
+	}
+	logger_deliver(logger, slot->level, slot->msg);
+	__atomic_store_n(&slot->seq, logger->head + LOGGER_RING_SIZE, __ATOMIC_RELEASE);
+	logger->head++;
+	return 1;
+}
+
+static THREAD_RETVAL
+logger_thread(void *arg)
+{
+	logger_t *logger = arg;
+	int running = 1;
+
+	while (1) {
+		unsigned int dropped;
+
+		while (logger_dequeue(logger));
+
+		dropped = __atomic_exchange_n(&logger->dropped, 0, __ATOMIC_RELAXED);
+		if (dropped) {
+			char buffer[64];
+			snprintf(buffer, sizeof(buffer), "logger dropped %u messages", dropped);
+			logger_deliver(logger, LOGGER_WARNING, buffer);
+		}
+		if (!running) {
+			break;
+		}
+
+		MUTEX_LOCK(logger->wake_mutex);
+		__atomic_store_n(&logger->writer_waiting, 1, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if (logger->running) {
+			logger_slot_t *slot = &logger->slots[logger->head % LOGGER_RING_SIZE];
+			if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != logger->head + 1) {
+				COND_WAIT(logger->wake_cond, logger->wake_mutex);
+			}
+		}
+		__atomic_store_n(&logger->writer_waiting, 0, __ATOMIC_RELAXED);
+		/* One more pass after a stop to flush what was queued before it */
+		running = logger->running;
+		MUTEX_UNLOCK(logger->wake_mutex);
+	}
+	return 0;
+}
+
 void
 logger_log(logger_t *logger, int level, const char *fmt, ...)
 {
 	char buffer[4096];
 	va_list ap;
+	int len;
 
-	MUTEX_LOCK(logger->lvl_mutex);
-	if (level > logger->level) {
-		MUTEX_UNLOCK(logger->lvl_mutex);
+	if (!logger_is_enabled(logger, level)) {
 		return;
 	}
-	MUTEX_UNLOCK(logger->lvl_mutex);
 
 	buffer[sizeof(buffer)-1] = '\0';
 	va_start(ap, fmt);
-	vsnprintf(buffer, sizeof(buffer)-1, fmt, ap);
+	len = vsnprintf(buffer, sizeof(buffer)-1, fmt, ap);
 	va_end(ap);
 
-	MUTEX_LOCK(logger->cb_mutex);
-	if (logger->callback) {
-		logger->callback(logger->cls, level, buffer);
-		MUTEX_UNLOCK(logger->cb_mutex);
-	} else {
-		char *local;
-		MUTEX_UNLOCK(logger->cb_mutex);
-		local = logger_utf8_to_local(buffer);
-		if (local) {
-			fprintf(stderr, "%s\n", local);
-			free(local);
-		} else {
-			fprintf(stderr, "%s\n", buffer);
+	if (len >= 0 && len < LOGGER_SLOT_SIZE) {
+		if (logger_enqueue(logger, level, buffer, len) < 0) {
+			__atomic_fetch_add(&logger->dropped, 1, __ATOMIC_RELAXED);
 		}
+	} else {
+		/* Too long for a slot, may overtake messages still in the ring */
+		logger_deliver(logger, level, buffer);
 	}
 }
-
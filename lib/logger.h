@@ -15,6 +15,8 @@
 #ifndef LOGGER_H
 #define LOGGER_H
 
+#include <stddef.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -29,6 +31,11 @@ extern "C" {
 #define LOGGER_INFO        6       /* informational */
 #define LOGGER_DEBUG       7       /* debug-level messages */
 
+/* Most verbose level compiled in, LOGGER_LOG calls above it cost nothing */
+#ifndef LOGGER_COMPILED_LEVEL
+#define LOGGER_COMPILED_LEVEL LOGGER_DEBUG
+#endif
+
 typedef void (*logger_callback_t)(void *cls, int level, const char *msg);
 
 typedef struct logger_s logger_t;
@@ -39,8 +46,18 @@ void logger_destroy(logger_t *logger);
 void logger_set_level(logger_t *logger, int level);
 void logger_set_callback(logger_t *logger, logger_callback_t callback, void *cls);
 
+int logger_is_enabled(logger_t *logger, int level);
+/* Bytes the logger holds for messages waiting to be written */
+size_t logger_get_size(logger_t *logger);
 void logger_log(logger_t *logger, int level, const char *fmt, ...);
 
+/* Only evaluates the arguments when the message would be logged */
+#define LOGGER_ENABLED(logger, level) \
+	((level) <= LOGGER_COMPILED_LEVEL && logger_is_enabled(logger, level))
+#define LOGGER_DEBUG_ENABLED(logger) LOGGER_ENABLED(logger, LOGGER_DEBUG)
+#define LOGGER_LOG(logger, level, ...) \
+	do { if (LOGGER_ENABLED(logger, level)) logger_log(logger, level, __VA_ARGS__); } while (0)
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,109 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "mem_budget.h"
+
+struct mem_budget_s {
+    size_t limit;
+    size_t used;
+    size_t peak;
+    uint64_t refusals;
+    int refs;
+};
+
+mem_budget_t *
+mem_budget_init(size_t limit)
+{
+    mem_budget_t *budget = calloc(1, sizeof(mem_budget_t));
+    if (!budget) {
+        return NULL;
+    }
+    budget->limit = limit;
+    budget->refs = 1;
+    return budget;
+}
+
+void
+mem_budget_set_limit(mem_budget_t *budget, size_t limit)
+{
+    assert(budget);
+    __atomic_store_n(&budget->limit, limit, __ATOMIC_RELAXED);
+}
+
+size_t
+mem_budget_available(mem_budget_t *budget)
+{
+    size_t limit = __atomic_load_n(&budget->limit, __ATOMIC_RELAXED);
+    size_t used = __atomic_load_n(&budget->used, __ATOMIC_RELAXED);
+
+    if (!limit) {
+        return SIZE_MAX;
+    }
+    return used < limit ? limit - used : 0;
+}
+
+bool
+mem_budget_reserve(mem_budget_t *budget, size_t bytes)
+{
+    size_t limit = __atomic_load_n(&budget->limit, __ATOMIC_RELAXED);
+    size_t used = __atomic_load_n(&budget->used, __ATOMIC_RELAXED);
+
+    do {
+        if (limit && used + bytes > limit) {
+            __atomic_fetch_add(&budget->refusals, 1, __ATOMIC_RELAXED);
+            return false;
+        }
+    } while (!__atomic_compare_exchange_n(&budget->used, &used, used + bytes, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    // The peak only ever grows, a lost race leaves the larger value
+    size_t peak = __atomic_load_n(&budget->peak, __ATOMIC_RELAXED);
+    while (used + bytes > peak &&
+           !__atomic_compare_exchange_n(&budget->peak, &peak, used + bytes, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+    return true;
+}
+
+void
+mem_budget_release(mem_budget_t *budget, size_t bytes)
+{
+    assert(__atomic_load_n(&budget->used, __ATOMIC_RELAXED) >= bytes);
+    __atomic_fetch_sub(&budget->used, bytes, __ATOMIC_RELAXED);
+}
+
+void
+mem_budget_get_stats(mem_budget_t *budget, mem_budget_stats_t *stats)
+{
+    memset(stats, 0, sizeof(mem_budget_stats_t));
+    stats->limit = __atomic_load_n(&budget->limit, __ATOMIC_RELAXED);
+    stats->used = __atomic_load_n(&budget->used, __ATOMIC_RELAXED);
+    stats->peak = __atomic_load_n(&budget->peak, __ATOMIC_RELAXED);
+    stats->refusals = __atomic_load_n(&budget->refusals, __ATOMIC_RELAXED);
+}
+
+mem_budget_t *
+mem_budget_retain(mem_budget_t *budget)
+{
+    __atomic_fetch_add(&budget->refs, 1, __ATOMIC_RELAXED);
+    return budget;
+}
+
+void
+mem_budget_destroy(mem_budget_t *budget)
+{
+    if (budget && __atomic_sub_fetch(&budget->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        free(budget);
+    }
+}
@@ -0,0 +1,56 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#ifndef MEM_BUDGET_H
+#define MEM_BUDGET_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Byte budget shared by the frame pools of all sessions. Pools reserve the
+ * buffers they hand out and release them when they come back, a reservation
+ * that would go over the limit fails and the frame is dropped instead of
+ * pushing the box into swap. All functions are thread safe.
+ *
+ * Pools keep a reference to the budget, so it lives as long as buffers of
+ * any of them are out.
+ */
+
+typedef struct mem_budget_s mem_budget_t;
+
+typedef struct {
+    /* 0 if unlimited */
+    size_t limit;
+    /* Bytes reserved, and their high-water mark */
+    size_t used;
+    size_t peak;
+    /* Reservations that would have gone over the limit */
+    uint64_t refusals;
+} mem_budget_stats_t;
+
+/* A limit of 0 never refuses, it only counts */
+mem_budget_t *mem_budget_init(size_t limit);
+void mem_budget_set_limit(mem_budget_t *budget, size_t limit);
+/* Bytes left under the limit, SIZE_MAX if unlimited */
+size_t mem_budget_available(mem_budget_t *budget);
+
+bool mem_budget_reserve(mem_budget_t *budget, size_t bytes);
+void mem_budget_release(mem_budget_t *budget, size_t bytes);
+
+void mem_budget_get_stats(mem_budget_t *budget, mem_budget_stats_t *stats);
+mem_budget_t *mem_budget_retain(mem_budget_t *budget);
+/* Drops a reference, the budget is freed with the last one */
+void mem_budget_destroy(mem_budget_t *budget);
+
+#endif //MEM_BUDGET_H
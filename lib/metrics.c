@@ -0,0 +1,413 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include <assert.h>
+#include <dirent.h>
+#include <unistd.h>
+
+#include "metrics.h"
+#include "httpd.h"
+#include "thread_stats.h"
+
+#define METRICS_MAX_LABELS 4
+#define METRICS_LABEL_LENGTH 64
+
+/* Scrapers open a connection or two at a time, a few more leave room for a curl next to them */
+#define METRICS_MAX_CONNECTIONS 4
+
+typedef struct {
+    /* Name of the family the sample belongs to, and of the sample itself, e.g. a summary's _count */
+    const char *family;
+    char name[METRICS_LABEL_LENGTH];
+    metrics_type_t type;
+    const char *help;
+    int label_count;
+    char label_names[METRICS_MAX_LABELS][METRICS_LABEL_LENGTH];
+    char label_values[METRICS_MAX_LABELS][METRICS_LABEL_LENGTH];
+    double value;
+} metrics_sample_t;
+
+struct metrics_s {
+    metrics_sample_t *samples;
+    int sample_count;
+    int sample_capacity;
+};
+
+typedef struct {
+    char *data;
+    int len;
+    int size;
+} metrics_buffer_t;
+
+struct metrics_server_s {
+    logger_t *logger;
+    httpd_t *httpd;
+    metrics_collect_cb_t collect;
+    void *opaque;
+};
+
+static const char *metrics_type_names[] = { "counter", "gauge", "summary" };
+
+static metrics_sample_t *
+metrics_add_sample(metrics_t *metrics, const char *family, const char *suffix, metrics_type_t type, const char *help,
+                   const metrics_label_t *labels, int label_count, double value)
+{
+    metrics_sample_t *sample;
+
+    if (metrics->sample_count == metrics->sample_capacity) {
+        int capacity = metrics->sample_capacity ? metrics->sample_capacity * 2 : 64;
+        metrics_sample_t *samples = realloc(metrics->samples, capacity * sizeof(metrics_sample_t));
+        if (!samples) {
+            return NULL;
+        }
+        metrics->samples = samples;
+        metrics->sample_capacity = capacity;
+    }
+    sample = &metrics->samples[metrics->sample_count++];
+    sample->family = family;
+    snprintf(sample->name, sizeof(sample->name), "%s%s", family, suffix);
+    sample->type = type;
+    sample->help = help;
+    sample->label_count = label_count < METRICS_MAX_LABELS ? label_count : METRICS_MAX_LABELS;
+    for (int i = 0; i < sample->label_count; i++) {
+        snprintf(sample->label_names[i], METRICS_LABEL_LENGTH, "%s", labels[i].name);
+        snprintf(sample->label_values[i], METRICS_LABEL_LENGTH, "%s", labels[i].value);
+    }
+    sample->value = value;
+    return sample;
+}
+
+void
+metrics_add(metrics_t *metrics, const char *name, metrics_type_t type, const char *help,
+            const metrics_label_t *labels, int label_count, double value)
+{
+    metrics_add_sample(metrics, name, "", type, help, labels, label_count, value);
+}
+
+void
+metrics_add_latency(metrics_t *metrics, const char *name, const char *help,
+                    const metrics_label_t *labels, int label_count, const latency_histogram_stats_t *stats)
+{
+    static const char *quantiles[] = { "0.5", "0.95", "0.99" };
+    const uint64_t values[] = { stats->p50, stats->p95, stats->p99 };
+    metrics_label_t quantile_labels[METRICS_MAX_LABELS];
+
+    if (label_count > METRICS_MAX_LABELS - 1) {
+        label_count = METRICS_MAX_LABELS - 1;
+    }
+    memcpy(quantile_labels, labels, label_count * sizeof(metrics_label_t));
+    for (int i = 0; i < 3; i++) {
+        quantile_labels[label_count].name = "quantile";
+        quantile_labels[label_count].value = quantiles[i];
+        metrics_add_sample(metrics, name, "", METRICS_SUMMARY, help, quantile_labels, label_count + 1, values[i] / 1000000.0);
+    }
+    metrics_add_sample(metrics, name, "_sum", METRICS_SUMMARY, help, labels, label_count,
+                       (double) stats->mean * stats->count / 1000000.0);
+    metrics_add_sample(metrics, name, "_count", METRICS_SUMMARY, help, labels, label_count, (double) stats->count);
+}
+
+void
+metrics_add_thread_cpu(metrics_t *metrics)
+{
+#if defined(__linux__)
+    DIR *dir = opendir("/proc/self/task");
+    struct dirent *entry;
+    long ticks = sysconf(_SC_CLK_TCK);
+
+    if (!dir || ticks <= 0) {
+        if (dir) closedir(dir);
+        return;
+    }
+    while ((entry = readdir(dir)) != NULL) {
+        char path[300];
+        char stat[512];
+        FILE *file;
+        size_t len;
+
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+        snprintf(path, sizeof(path), "/proc/self/task/%s/stat", entry->d_name);
+        file = fopen(path, "r");
+        if (!file) {
+            continue;
+        }
+        len = fread(stat, 1, sizeof(stat) - 1, file);
+        fclose(file);
+        stat[len] = '\0';
+
+        /* pid (comm) state ..., utime and stime are the 14th and 15th fields, comm may hold spaces */
+        char *comm_start = strchr(stat, '(');
+        char *comm_end = strrchr(stat, ')');
+        unsigned long long utime, stime;
+        if (!comm_start || !comm_end || comm_end < comm_start ||
+            sscanf(comm_end + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu", &utime, &stime) != 2) {
+            continue;
+        }
+        *comm_end = '\0';
+        metrics_label_t labels[] = { { "thread", comm_start + 1 }, { "tid", entry->d_name } };
+        metrics_add(metrics, "raop_thread_cpu_seconds_total", METRICS_COUNTER, "CPU time used by the thread",
+                    labels, 2, (double) (utime + stime) / ticks);
+
+        uint64_t voluntary, involuntary;
+        if (!thread_stats_read_switches(atoi(entry->d_name), &voluntary, &involuntary)) {
+            metrics_label_t switch_labels[] = { { "thread", comm_start + 1 }, { "tid", entry->d_name }, { "kind", "voluntary" } };
+            metrics_add(metrics, "raop_thread_context_switches_total", METRICS_COUNTER, "Context switches of the thread",
+                        switch_labels, 3, (double) voluntary);
+            switch_labels[2].value = "involuntary";
+            metrics_add(metrics, "raop_thread_context_switches_total", METRICS_COUNTER, "Context switches of the thread",
+                        switch_labels, 3, (double) involuntary);
+        }
+    }
+    closedir(dir);
+
+    // Pool usage is only known for the library's own threads
+    thread_stats_t threads[THREAD_STATS_MAX_THREADS];
+    int count = thread_stats_get(threads, THREAD_STATS_MAX_THREADS);
+    for (int i = 0; i < count; i++) {
+        char tid[16];
+        snprintf(tid, sizeof(tid), "%d", threads[i].tid);
+        metrics_label_t labels[] = { { "thread", threads[i].name }, { "tid", tid } };
+        metrics_add(metrics, "raop_thread_pool_bytes_total", METRICS_COUNTER, "Bytes of the buffers the thread took from frame pools",
+                    labels, 2, (double) threads[i].pool_bytes);
+    }
+#else
+    (void) metrics;
+#endif
+}
+
+static void
+metrics_printf(metrics_buffer_t *buffer, const char *fmt, ...)
+{
+    va_list args;
+    int len;
+
+    if (!buffer->data) {
+        return;
+    }
+    for (;;) {
+        va_start(args, fmt);
+        len = vsnprintf(buffer->data + buffer->len, buffer->size - buffer->len, fmt, args);
+        va_end(args);
+        if (len < 0) {
+            return;
+        }
+        if (buffer->len + len < buffer->size) {
+            buffer->len += len;
+            return;
+        }
+        char *data = realloc(buffer->data, buffer->size * 2 + len);
+        if (!data) {
+            free(buffer->data);
+            buffer->data = NULL;
+            return;
+        }
+        buffer->data = data;
+        buffer->size = buffer->size * 2 + len;
+    }
+}
+
+/* Label values and help texts are escaped the same way in both formats */
+static void
+metrics_print_escaped(metrics_buffer_t *buffer, const char *value)
+{
+    for (const char *c = value; *c; c++) {
+        if (*c == '"' || *c == '\\') {
+            metrics_printf(buffer, "\\%c", *c);
+        } else if (*c == '\n') {
+            metrics_printf(buffer, "\\n");
+        } else if ((unsigned char) *c >= 0x20) {
+            metrics_printf(buffer, "%c", *c);
+        }
+    }
+}
+
+static void
+metrics_print_value(metrics_buffer_t *buffer, double value)
+{
+    if (value == (double) (long long) value) {
+        metrics_printf(buffer, "%lld", (long long) value);
+    } else {
+        metrics_printf(buffer, "%.9g", value);
+    }
+}
+
+static void
+metrics_format_text(metrics_t *metrics, metrics_buffer_t *buffer)
+{
+    for (int i = 0; i < metrics->sample_count; i++) {
+        metrics_sample_t *first = &metrics->samples[i];
+        int listed = 0;
+
+        for (int j = 0; j < i && !listed; j++) {
+            listed = !strcmp(metrics->samples[j].family, first->family);
+        }
+        if (listed) {
+            continue;
+        }
+        metrics_printf(buffer, "# HELP %s %s\n# TYPE %s %s\n", first->family, first->help,
+                       first->family, metrics_type_names[first->type]);
+        for (int j = i; j < metrics->sample_count; j++) {
+            metrics_sample_t *sample = &metrics->samples[j];
+            if (strcmp(sample->family, first->family)) {
+                continue;
+            }
+            metrics_printf(buffer, "%s", sample->name);
+            for (int k = 0; k < sample->label_count; k++) {
+                metrics_printf(buffer, "%s%s=\"", k ? "," : "{", sample->label_names[k]);
+                metrics_print_escaped(buffer, sample->label_values[k]);
+                metrics_printf(buffer, "\"%s", k == sample->label_count - 1 ? "}" : "");
+            }
+            metrics_printf(buffer, " ");
+            metrics_print_value(buffer, sample->value);
+            metrics_printf(buffer, "\n");
+        }
+    }
+}
+
+static void
+metrics_format_json(metrics_t *metrics, metrics_buffer_t *buffer)
+{
+    metrics_printf(buffer, "{\"metrics\":[");
+    for (int i = 0; i < metrics->sample_count; i++) {
+        metrics_sample_t *sample = &metrics->samples[i];
+        metrics_printf(buffer, "%s\n{\"name\":\"%s\",\"type\":\"%s\",\"labels\":{", i ? "," : "",
+                       sample->name, metrics_type_names[sample->type]);
+        for (int k = 0; k < sample->label_count; k++) {
+            metrics_printf(buffer, "%s\"%s\":\"", k ? "," : "", sample->label_names[k]);
+            metrics_print_escaped(buffer, sample->label_values[k]);
+            metrics_printf(buffer, "\"");
+        }
+        metrics_printf(buffer, "},\"value\":");
+        metrics_print_value(buffer, sample->value);
+        metrics_printf(buffer, "}");
+    }
+    metrics_printf(buffer, "\n]}\n");
+}
+
+static void *
+metrics_conn_init(void *opaque, unsigned char *local, int locallen, unsigned char *remote, int remotelen)
+{
+    return opaque;
+}
+
+static void
+metrics_conn_request(void *ptr, http_request_t *request, http_response_t **response)
+{
+    metrics_server_t *server = ptr;
+    const char *method = http_request_get_method(request);
+    const char *url = http_request_get_url(request);
+    size_t url_len;
+    int json;
+
+    if (!method || !url) {
+        return;
+    }
+    url_len = strcspn(url, "?");
+    if (strcmp(method, "GET") ||
+        !((url_len == 8 && !strncmp(url, "/metrics", 8)) || (url_len == 13 && !strncmp(url, "/metrics.json", 13)))) {
+        *response = http_response_init("HTTP/1.1", 404, "Not Found");
+        http_response_add_header(*response, "Content-Type", "text/plain");
+        http_response_finish(*response, "Not found\n", 10);
+        return;
+    }
+    json = url_len == 13;
+
+    metrics_t metrics = { NULL, 0, 0 };
+    metrics_buffer_t buffer = { malloc(4096), 0, 4096 };
+    server->collect(server->opaque, &metrics);
+    if (json) {
+        metrics_format_json(&metrics, &buffer);
+    } else {
+        metrics_format_text(&metrics, &buffer);
+    }
+    free(metrics.samples);
+    if (!buffer.data) {
+        logger_log(server->logger, LOGGER_ERR, "metrics could not allocate the response");
+        *response = http_response_init("HTTP/1.1", 500, "Internal Server Error");
+        http_response_finish(*response, "Out of memory\n", 14);
+        return;
+    }
+
+    *response = http_response_init("HTTP/1.1", 200, "OK");
+    http_response_add_header(*response, "Content-Type", json ? "application/json" : "text/plain; version=0.0.4");
+    http_response_finish_owned(*response, buffer.data, buffer.len);
+}
+
+static void
+metrics_conn_destroy(void *ptr)
+{
+}
+
+metrics_server_t *
+metrics_server_init(logger_t *logger, metrics_collect_cb_t collect, void *opaque)
+{
+    metrics_server_t *server;
+    httpd_callbacks_t httpd_cbs;
+
+    assert(collect);
+
+    server = calloc(1, sizeof(metrics_server_t));
+    if (!server) {
+        return NULL;
+    }
+    server->logger = logger;
+    server->collect = collect;
+    server->opaque = opaque;
+
+    memset(&httpd_cbs, 0, sizeof(httpd_cbs));
+    httpd_cbs.opaque = server;
+    httpd_cbs.conn_init = &metrics_conn_init;
+    httpd_cbs.conn_request = &metrics_conn_request;
+    httpd_cbs.conn_destroy = &metrics_conn_destroy;
+    server->httpd = httpd_init(logger, &httpd_cbs, METRICS_MAX_CONNECTIONS);
+    if (!server->httpd) {
+        free(server);
+        return NULL;
+    }
+    return server;
+}
+
+int
+metrics_server_start(metrics_server_t *server, unsigned short *port)
+{
+    assert(server);
+
+    int ret = httpd_start(server->httpd, port);
+    if (ret != 1) {
+        logger_log(server->logger, LOGGER_ERR, "metrics could not listen on port %u", *port);
+        return -1;
+    }
+    logger_log(server->logger, LOGGER_INFO, "metrics served on port %u at /metrics and /metrics.json", *port);
+    return 0;
+}
+
+void
+metrics_server_stop(metrics_server_t *server)
+{
+    if (server) {
+        httpd_stop(server->httpd);
+    }
+}
+
+void
+metrics_server_destroy(metrics_server_t *server)
+{
+    if (server) {
+        httpd_destroy(server->httpd);
+        free(server);
+    }
+}
@@ -0,0 +1,60 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include "logger.h"
+#include "latency_histogram.h"
+
+/*
+ * Metrics scraped over HTTP, as Prometheus text from /metrics and as JSON
+ * from /metrics.json. Nothing is recorded for them: every scrape calls the
+ * collect callback, which reads the counters the threads already keep for
+ * themselves into a fresh metrics_t.
+ */
+
+typedef struct metrics_s metrics_t;
+
+typedef enum {
+    METRICS_COUNTER,
+    METRICS_GAUGE,
+    METRICS_SUMMARY
+} metrics_type_t;
+
+typedef struct {
+    const char *name;
+    const char *value;
+} metrics_label_t;
+
+/* Adds a sample, samples of one name are listed together under one HELP and TYPE */
+void metrics_add(metrics_t *metrics, const char *name, metrics_type_t type, const char *help,
+                 const metrics_label_t *labels, int label_count, double value);
+/* Adds the percentiles and count of a latency histogram as a summary, in seconds */
+void metrics_add_latency(metrics_t *metrics, const char *name, const char *help,
+                         const metrics_label_t *labels, int label_count, const latency_histogram_stats_t *stats);
+/* Adds the CPU time and context switches of every thread of the process, labelled with the thread names,
+ * and what the library's threads took from frame pools (Linux only) */
+void metrics_add_thread_cpu(metrics_t *metrics);
+
+typedef void (*metrics_collect_cb_t)(void *opaque, metrics_t *metrics);
+
+typedef struct metrics_server_s metrics_server_t;
+
+metrics_server_t *metrics_server_init(logger_t *logger, metrics_collect_cb_t collect, void *opaque);
+/* Listens on *port, 0 picks a free one and stores it in *port. Returns -1 on error */
+int metrics_server_start(metrics_server_t *server, unsigned short *port);
+void metrics_server_stop(metrics_server_t *server);
+void metrics_server_destroy(metrics_server_t *server);
+
+#endif //METRICS_H
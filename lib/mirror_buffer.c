@@ -16,8 +16,10 @@
 #include "raop_rtp.h"
 #include "raop_rtp.h"
 #include <stdint.h>
+#include <stdbool.h>
 #include "crypto.h"
 #include "compat.h"
+#include "task_pool.h"
 #include <math.h>
 #include <stdlib.h>
 #include <assert.h>
@@ -26,17 +28,79 @@
 #include <inttypes.h>
 
 //#define DUMP_KEI_IV
+
+/* Frames from this size on are split between the workers, in chunks of at least MIRROR_BUFFER_CHUNK_MIN */
+#define MIRROR_BUFFER_PARALLEL_MIN (64 * 1024)
+#define MIRROR_BUFFER_CHUNK_MIN (16 * 1024)
+
+typedef struct {
+    /* A context of its own, the EVP ones can't be shared between threads */
+    aes_ctx_t *aes_ctx;
+
+    /* The chunk to decrypt and the keystream offset of its first byte */
+    unsigned char *input;
+    unsigned char *output;
+    int len;
+    uint64_t offset;
+} mirror_buffer_chunk_t;
+
 struct mirror_buffer_s {
     logger_t *logger;
+    /* Keeps its keystream position between frames, so a frame may end mid-block */
     aes_ctx_t *aes_ctx;
-    int nextDecryptCount;
-    uint8_t og[16];
+    /* Number of keystream bytes used so far */
+    uint64_t stream_offset;
     /* AES key and IV */
     // Need secondary processing to use
     unsigned char aeskey[RAOP_AESKEY_LEN];
     unsigned char ecdh_secret[32];
+    /* Derived stream key and IV, for the contexts of the workers */
+    unsigned char decrypt_aeskey[16];
+    unsigned char decrypt_aesiv[16];
+    bool has_key;
+
+    /* The chunks of large frames the shared pool decrypts along with the calling thread */
+    task_pool_t *pool;
+    mirror_buffer_chunk_t chunks[MIRROR_BUFFER_MAX_WORKERS];
+    int worker_count;
+
+    uint64_t parallel_frames;
 };
 
+/* Moves the keystream of ctx to offset bytes from its start */
+static void
+mirror_buffer_ctr_seek(aes_ctx_t *ctx, uint64_t offset)
+{
+    aes_ctr_seek(ctx, offset / 16);
+
+    int rest = (int) (offset % 16);
+    if (rest > 0) {
+        // Step into the block, the rest of its keystream is used by what follows
+        uint8_t skip[16] = {0};
+        aes_ctr_decrypt(ctx, skip, skip, rest);
+    }
+}
+
+static void
+mirror_buffer_decrypt_chunk(void *arg)
+{
+    mirror_buffer_chunk_t *chunk = arg;
+
+    mirror_buffer_ctr_seek(chunk->aes_ctx, chunk->offset);
+    aes_ctr_decrypt(chunk->aes_ctx, chunk->input, chunk->output, chunk->len);
+}
+
+static void
+mirror_buffer_stop_workers(mirror_buffer_t *mirror_buffer)
+{
+    for (int i = 0; i < mirror_buffer->worker_count; i++) {
+        aes_ctr_destroy(mirror_buffer->chunks[i].aes_ctx);
+        mirror_buffer->chunks[i].aes_ctx = NULL;
+    }
+    mirror_buffer->worker_count = 0;
+    mirror_buffer->pool = NULL;
+}
+
 void
 mirror_buffer_init_aes(mirror_buffer_t *mirror_buffer, uint64_t streamConnectionID)
 {
@@ -77,8 +141,18 @@ mirror_buffer_init_aes(mirror_buffer_t *mirror_buffer, uint64_t streamConnection
     fclose(keyfile);
 #endif
     // Need to be initialized externally
+    aes_ctr_destroy(mirror_buffer->aes_ctx);
     mirror_buffer->aes_ctx = aes_ctr_init(decrypt_aeskey, decrypt_aesiv);
-    mirror_buffer->nextDecryptCount = 0;
+    mirror_buffer->stream_offset = 0;
+
+    // No chunk is queued between frames, their contexts can be swapped here
+    memcpy(mirror_buffer->decrypt_aeskey, decrypt_aeskey, 16);
+    memcpy(mirror_buffer->decrypt_aesiv, decrypt_aesiv, 16);
+    mirror_buffer->has_key = true;
+    for (int i = 0; i < mirror_buffer->worker_count; i++) {
+        aes_ctr_destroy(mirror_buffer->chunks[i].aes_ctx);
+        mirror_buffer->chunks[i].aes_ctx = aes_ctr_init(decrypt_aeskey, decrypt_aesiv);
+    }
 }
 
 mirror_buffer_t *
@@ -96,47 +170,111 @@ mirror_buffer_init(logger_t *logger,
     memcpy(mirror_buffer->aeskey, aeskey, RAOP_AESKEY_LEN);
     memcpy(mirror_buffer->ecdh_secret, ecdh_secret, 32);
     mirror_buffer->logger = logger;
-    mirror_buffer->nextDecryptCount = 0;
     //mirror_buffer_init_aes(mirror_buffer, aeskey, ecdh_secret, streamConnectionID);
     return mirror_buffer;
 }
 
-void mirror_buffer_decrypt(mirror_buffer_t *mirror_buffer, unsigned char* input, unsigned char* output, int inputLen) {
-    // Start decrypting
-    if (mirror_buffer->nextDecryptCount > 0) {//mirror_buffer->nextDecryptCount = 10
-        for (int i = 0; i < mirror_buffer->nextDecryptCount; i++) {
-            output[i] = (input[i] ^ mirror_buffer->og[(16 - mirror_buffer->nextDecryptCount) + i]);
-        }
+int
+mirror_buffer_set_workers(mirror_buffer_t *mirror_buffer, task_pool_t *pool, int count)
+{
+    mirror_buffer_stop_workers(mirror_buffer);
+    if (!pool) {
+        return 0;
     }
-    // Handling encrypted bytes
-    int encryptlen = ((inputLen - mirror_buffer->nextDecryptCount) / 16) * 16;
-    // Aes decryption
-    aes_ctr_start_fresh_block(mirror_buffer->aes_ctx);
-    aes_ctr_decrypt(mirror_buffer->aes_ctx, input + mirror_buffer->nextDecryptCount,
-                    input + mirror_buffer->nextDecryptCount, encryptlen);
-    // Copy to output
-    memcpy(output + mirror_buffer->nextDecryptCount, input + mirror_buffer->nextDecryptCount, encryptlen);
-    int outputlength = mirror_buffer->nextDecryptCount + encryptlen;
-    // Processing remaining length
-    int restlen = (inputLen - mirror_buffer->nextDecryptCount) % 16;
-    int reststart = inputLen - restlen;
-    mirror_buffer->nextDecryptCount = 0;
-    if (restlen > 0) {
-        memset(mirror_buffer->og, 0, 16);
-        memcpy(mirror_buffer->og, input + reststart, restlen);
-        aes_ctr_decrypt(mirror_buffer->aes_ctx, mirror_buffer->og, mirror_buffer->og, 16);
-        for (int j = 0; j < restlen; j++) {
-            output[reststart + j] = mirror_buffer->og[j];
+    if (count > MIRROR_BUFFER_MAX_WORKERS) {
+        count = MIRROR_BUFFER_MAX_WORKERS;
+    }
+    mirror_buffer->pool = pool;
+    for (int i = 0; i < count; i++) {
+        mirror_buffer_chunk_t *chunk = &mirror_buffer->chunks[i];
+        memset(chunk, 0, sizeof(mirror_buffer_chunk_t));
+        if (mirror_buffer->has_key) {
+            chunk->aes_ctx = aes_ctr_init(mirror_buffer->decrypt_aeskey, mirror_buffer->decrypt_aesiv);
         }
-        outputlength += restlen;
-        mirror_buffer->nextDecryptCount = 16 - restlen;// Difference 16-6=10 bytes
+        mirror_buffer->worker_count++;
+    }
+    return mirror_buffer->worker_count;
+}
+
+/*
+ * Hands all but the last chunk to the pool and decrypts the last one here, which leaves
+ * the keystream of this thread at the end of the frame. Chunks after the first start on a
+ * block boundary of the keystream, so each is found with a plain counter seek.
+ */
+static void
+mirror_buffer_decrypt_parallel(mirror_buffer_t *mirror_buffer, unsigned char *input, unsigned char *output, int len)
+{
+    uint64_t start = mirror_buffer->stream_offset;
+    int chunks = mirror_buffer->worker_count + 1;
+    if (chunks > len / MIRROR_BUFFER_CHUNK_MIN) {
+        chunks = len / MIRROR_BUFFER_CHUNK_MIN;
     }
+    int chunk_len = (len + chunks - 1) / chunks;
+    int pos = 0;
+    task_group_t group;
+
+    task_group_init(&group, mirror_buffer->pool);
+    for (int i = 0; i < chunks - 1; i++) {
+        // Round the end of the chunk up to a block boundary of the keystream
+        int end = (int) (((start + pos + chunk_len + 15) & ~(uint64_t) 15) - start);
+        mirror_buffer_chunk_t *chunk = &mirror_buffer->chunks[i];
+        chunk->input = input + pos;
+        chunk->output = output + pos;
+        chunk->len = end - pos;
+        chunk->offset = start + pos;
+        task_pool_submit(mirror_buffer->pool, &group, TASK_PRIORITY_HIGH, mirror_buffer_decrypt_chunk, chunk);
+        pos = end;
+    }
+
+    mirror_buffer_ctr_seek(mirror_buffer->aes_ctx, start + pos);
+    aes_ctr_decrypt(mirror_buffer->aes_ctx, input + pos, output + pos, len - pos);
+
+    task_group_wait(&group);
+    __atomic_store_n(&mirror_buffer->parallel_frames, mirror_buffer->parallel_frames + 1, __ATOMIC_RELAXED);
+}
+
+bool
+mirror_buffer_splits(mirror_buffer_t *mirror_buffer, int len)
+{
+    return mirror_buffer->worker_count > 0 && mirror_buffer->has_key && len >= MIRROR_BUFFER_PARALLEL_MIN;
+}
+
+void mirror_buffer_decrypt(mirror_buffer_t *mirror_buffer, unsigned char* input, unsigned char* output, int inputLen) {
+    // Payloads are one continuous CTR keystream, input and output may point to the same buffer
+    if (mirror_buffer_splits(mirror_buffer, inputLen)) {
+        mirror_buffer_decrypt_parallel(mirror_buffer, input, output, inputLen);
+    } else {
+        aes_ctr_decrypt(mirror_buffer->aes_ctx, input, output, inputLen);
+    }
+    mirror_buffer->stream_offset += inputLen;
+}
+
+void mirror_buffer_decrypt_in_place(mirror_buffer_t *mirror_buffer, unsigned char* data, int datalen) {
+    mirror_buffer_decrypt(mirror_buffer, data, data, datalen);
+}
+
+uint64_t mirror_buffer_get_offset(mirror_buffer_t *mirror_buffer) {
+    return mirror_buffer->stream_offset;
+}
+
+void mirror_buffer_seek(mirror_buffer_t *mirror_buffer, uint64_t offset) {
+    // Payloads form one continuous CTR keystream, so any offset maps to a counter block plus a position in it
+    if (offset == mirror_buffer->stream_offset) {
+        return;
+    }
+    mirror_buffer_ctr_seek(mirror_buffer->aes_ctx, offset);
+    mirror_buffer->stream_offset = offset;
+}
+
+uint64_t mirror_buffer_get_parallel_frames(mirror_buffer_t *mirror_buffer) {
+    return __atomic_load_n(&mirror_buffer->parallel_frames, __ATOMIC_RELAXED);
 }
 
 void
 mirror_buffer_destroy(mirror_buffer_t *mirror_buffer)
 {
     if (mirror_buffer) {
+        mirror_buffer_stop_workers(mirror_buffer);
         aes_ctr_destroy(mirror_buffer->aes_ctx);
         free(mirror_buffer);
     }
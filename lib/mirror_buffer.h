@@ -16,15 +16,32 @@
 #define MIRROR_BUFFER_H
 
 #include <stdint.h>
+#include <stdbool.h>
 #include "logger.h"
+#include "task_pool.h"
 
 typedef struct mirror_buffer_s mirror_buffer_t;
 
+#define MIRROR_BUFFER_MAX_WORKERS 7
+
 
 mirror_buffer_t *mirror_buffer_init( logger_t *logger,
         const unsigned char *aeskey,
         const unsigned char *ecdh_secret);
 void mirror_buffer_init_aes(mirror_buffer_t *mirror_buffer, uint64_t streamConnectionID);
 void mirror_buffer_decrypt(mirror_buffer_t *raop_mirror, unsigned char* input, unsigned char* output, int datalen);
+void mirror_buffer_decrypt_in_place(mirror_buffer_t *mirror_buffer, unsigned char* data, int datalen);
+uint64_t mirror_buffer_get_offset(mirror_buffer_t *mirror_buffer);
+void mirror_buffer_seek(mirror_buffer_t *mirror_buffer, uint64_t offset);
+/*
+ * Splits large frames into count counter aligned chunks besides the one the caller of
+ * mirror_buffer_decrypt decrypts, for the workers of pool. A NULL pool or 0 decrypts on the
+ * caller alone. Set while no frame is being decrypted. Returns the number of chunks handed out.
+ */
+int mirror_buffer_set_workers(mirror_buffer_t *mirror_buffer, task_pool_t *pool, int count);
+/* Whether a frame of len bytes would be split between the workers */
+bool mirror_buffer_splits(mirror_buffer_t *mirror_buffer, int len);
+/* Frames that were split between the workers */
+uint64_t mirror_buffer_get_parallel_frames(mirror_buffer_t *mirror_buffer);
 void mirror_buffer_destroy(mirror_buffer_t *mirror_buffer);
 #endif //MIRROR_BUFFER_H
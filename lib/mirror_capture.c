@@ -0,0 +1,131 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <string.h>
+#include <assert.h>
+
+#include "mirror_capture.h"
+#include "byteutils.h"
+#include "raop_ntp.h"
+
+static void
+mirror_capture_index_frame(const unsigned char *record, const unsigned char *payload, capture_file_index_entry_t *entry)
+{
+    mirror_capture_frame_t frame;
+
+    memcpy(&frame, record, sizeof(frame));
+    entry->arrival_time = frame.arrival_time;
+    entry->pts = raop_ntp_timestamp_to_micro_seconds(byteutils_get_long(frame.header, 8), false);
+    entry->type = byteutils_get_short(frame.header, 4) & 0xff;
+}
+
+static const capture_file_format_t mirror_capture_format = {
+    sizeof(mirror_capture_header_t), sizeof(mirror_capture_frame_t), offsetof(mirror_capture_frame_t, payload_size),
+    mirror_capture_index_frame
+};
+
+static bool
+mirror_capture_header_valid(const mirror_capture_header_t *header)
+{
+    return !memcmp(header->magic, MIRROR_CAPTURE_MAGIC, sizeof(header->magic)) &&
+           header->version == MIRROR_CAPTURE_VERSION &&
+           header->frame_header_size == sizeof(mirror_capture_frame_t);
+}
+
+mirror_capture_t *
+mirror_capture_open(logger_t *logger, const char *filename, const mirror_capture_header_t *header)
+{
+    mirror_capture_header_t file_header = *header;
+
+    memcpy(file_header.magic, MIRROR_CAPTURE_MAGIC, sizeof(file_header.magic));
+    file_header.version = MIRROR_CAPTURE_VERSION;
+    file_header.frame_header_size = sizeof(mirror_capture_frame_t);
+    return capture_file_open(logger, filename, &mirror_capture_format, &file_header);
+}
+
+int
+mirror_capture_write(mirror_capture_t *capture, const mirror_capture_frame_t *frame, const unsigned char *payload)
+{
+    assert(frame);
+    return capture_file_write(capture, frame, payload, frame->payload_size);
+}
+
+void
+mirror_capture_get_stats(mirror_capture_t *capture, mirror_capture_stats_t *stats)
+{
+    capture_file_stats_t file_stats;
+
+    assert(stats);
+    capture_file_get_stats(capture, &file_stats);
+    stats->frames = file_stats.records;
+    stats->bytes = file_stats.bytes;
+    stats->dropped_frames = file_stats.dropped_records;
+}
+
+void
+mirror_capture_close(mirror_capture_t *capture)
+{
+    capture_file_close(capture);
+}
+
+mirror_capture_reader_t *
+mirror_capture_reader_open(const char *filename, mirror_capture_header_t *header)
+{
+    capture_file_reader_t *reader;
+
+    reader = capture_file_reader_open(filename, header, sizeof(mirror_capture_header_t));
+    if (!reader) {
+        return NULL;
+    }
+    if (!mirror_capture_header_valid(header)) {
+        capture_file_reader_close(reader);
+        return NULL;
+    }
+    return reader;
+}
+
+int
+mirror_capture_reader_next(mirror_capture_reader_t *reader, mirror_capture_frame_t *frame)
+{
+    return capture_file_reader_next(reader, frame, sizeof(mirror_capture_frame_t));
+}
+
+int
+mirror_capture_reader_payload(mirror_capture_reader_t *reader, unsigned char *payload, uint32_t payload_size)
+{
+    return capture_file_reader_payload(reader, payload, payload_size);
+}
+
+void
+mirror_capture_reader_close(mirror_capture_reader_t *reader)
+{
+    capture_file_reader_close(reader);
+}
+
+mirror_capture_map_t *
+mirror_capture_map_open(const char *filename, mirror_capture_header_t *header)
+{
+    capture_file_map_t *map;
+
+    map = capture_file_map_open(filename, &mirror_capture_format);
+    if (!map) {
+        return NULL;
+    }
+    memcpy(header, capture_file_map_get_header(map), sizeof(mirror_capture_header_t));
+    if (!mirror_capture_header_valid(header)) {
+        capture_file_map_close(map);
+        return NULL;
+    }
+    return map;
+}
@@ -0,0 +1,89 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#ifndef MIRROR_CAPTURE_H
+#define MIRROR_CAPTURE_H
+
+#include <stdint.h>
+#include "logger.h"
+#include "capture_file.h"
+
+/*
+ * Capture of a mirror session as it came off the wire, for replaying it
+ * offline, written through capture_file.
+ *
+ * A capture file is a mirror_capture_header_t followed by one
+ * mirror_capture_frame_t and its still encrypted payload per frame, all in
+ * host byte order. The header holds the key material, so capture files are
+ * as sensitive as the session itself.
+ *
+ * In the index, pts is the sender's timestamp of the frame in us and type
+ * the payload type of its header: 0 for video, 1 for the codec parameters.
+ */
+
+#define MIRROR_CAPTURE_MAGIC "RPMIRCP1"
+#define MIRROR_CAPTURE_VERSION 1
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t frame_header_size;
+    /* Decrypted AES key and ECDH secret the stream key is derived from */
+    unsigned char aeskey[16];
+    unsigned char ecdh_secret[32];
+    uint64_t stream_connection_id;
+    uint32_t use_udp;
+    uint32_t reserved;
+} mirror_capture_header_t;
+
+typedef struct {
+    /* The 128 byte header the sender put in front of the payload */
+    unsigned char header[128];
+    /* Local time at which the payload was fully received, in us */
+    uint64_t arrival_time;
+    /* Keystream position of the payload, only set for frames received over UDP */
+    uint64_t key_offset;
+    uint32_t payload_size;
+    uint8_t has_key_offset;
+    uint8_t discontinuity;
+    uint8_t reserved[2];
+} mirror_capture_frame_t;
+
+typedef capture_file_t mirror_capture_t;
+typedef capture_file_reader_t mirror_capture_reader_t;
+typedef capture_file_map_t mirror_capture_map_t;
+
+typedef struct {
+    uint64_t frames;
+    uint64_t bytes;
+    /* Frames dropped because the writer fell behind or ran out of memory */
+    uint64_t dropped_frames;
+} mirror_capture_stats_t;
+
+mirror_capture_t *mirror_capture_open(logger_t *logger, const char *filename, const mirror_capture_header_t *header);
+/* Queues a frame for writing, returns -1 if it had to be dropped. Only one thread may write. */
+int mirror_capture_write(mirror_capture_t *capture, const mirror_capture_frame_t *frame, const unsigned char *payload);
+void mirror_capture_get_stats(mirror_capture_t *capture, mirror_capture_stats_t *stats);
+/* Writes out everything still queued */
+void mirror_capture_close(mirror_capture_t *capture);
+
+mirror_capture_reader_t *mirror_capture_reader_open(const char *filename, mirror_capture_header_t *header);
+/* Reads the next frame header, returns 1 on success, 0 at the end of the capture and -1 on error */
+int mirror_capture_reader_next(mirror_capture_reader_t *reader, mirror_capture_frame_t *frame);
+/* Reads the payload of the frame last returned by mirror_capture_reader_next */
+int mirror_capture_reader_payload(mirror_capture_reader_t *reader, unsigned char *payload, uint32_t payload_size);
+void mirror_capture_reader_close(mirror_capture_reader_t *reader);
+
+/* Maps a capture for random access, read with the capture_file_map functions. NULL if it is no mirror capture. */
+mirror_capture_map_t *mirror_capture_map_open(const char *filename, mirror_capture_header_t *header);
+
+#endif //MIRROR_CAPTURE_H
@@ -0,0 +1,274 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <stdbool.h>
+
+#include "mirror_udp_buffer.h"
+#include "byteutils.h"
+
+/* Frames that can be assembled at the same time, must be a power of two */
+#define MIRROR_UDP_BUFFER_SLOTS 8
+#define MIRROR_UDP_MAX_FRAGMENTS 4096
+#define MIRROR_UDP_MAX_FRAME_LEN (4 * 1024 * 1024)
+
+typedef struct {
+    /* Data available */
+    int filled;
+
+    uint32_t frame_number;
+    int frame_len;
+    int fragment_count;
+    int fragment_size;
+    int received;
+    uint64_t key_offset;
+    uint64_t bitmap[MIRROR_UDP_MAX_FRAGMENTS / 64];
+
+    unsigned char header[128];
+    unsigned char *payload;
+} mirror_udp_buffer_entry_t;
+
+struct mirror_udp_buffer_s {
+    logger_t *logger;
+    frame_pool_t *frame_pool;
+    int depth;
+
+    /* Next frame number to hand out */
+    int is_empty;
+    uint32_t next_frame;
+    int discontinuity;
+
+    mirror_udp_buffer_entry_t entries[MIRROR_UDP_BUFFER_SLOTS];
+    mirror_udp_buffer_stats_t stats;
+};
+
+mirror_udp_buffer_t *
+mirror_udp_buffer_init(logger_t *logger, frame_pool_t *frame_pool, int depth)
+{
+    mirror_udp_buffer_t *mirror_udp_buffer;
+
+    assert(frame_pool);
+    mirror_udp_buffer = calloc(1, sizeof(mirror_udp_buffer_t));
+    if (!mirror_udp_buffer) {
+        return NULL;
+    }
+    if (depth < 1) depth = 1;
+    if (depth > MIRROR_UDP_BUFFER_SLOTS - 1) depth = MIRROR_UDP_BUFFER_SLOTS - 1;
+    mirror_udp_buffer->logger = logger;
+    mirror_udp_buffer->frame_pool = frame_pool;
+    mirror_udp_buffer->depth = depth;
+    mirror_udp_buffer->is_empty = 1;
+    return mirror_udp_buffer;
+}
+
+static void
+mirror_udp_buffer_clear_entry(mirror_udp_buffer_t *mirror_udp_buffer, mirror_udp_buffer_entry_t *entry)
+{
+    if (entry->payload) {
+        frame_pool_put(mirror_udp_buffer->frame_pool, entry->payload);
+    }
+    entry->payload = NULL;
+    entry->filled = 0;
+}
+
+static int
+mirror_udp_buffer_entry_complete(mirror_udp_buffer_entry_t *entry)
+{
+    return entry->filled && entry->received == entry->fragment_count;
+}
+
+int
+mirror_udp_buffer_enqueue(mirror_udp_buffer_t *mirror_udp_buffer, unsigned char *data, int datalen)
+{
+    mirror_udp_buffer_entry_t *entry;
+
+    assert(mirror_udp_buffer);
+    if (datalen < MIRROR_UDP_HEADER_LEN) {
+        mirror_udp_buffer->stats.invalid_packets++;
+        return -1;
+    }
+
+    int fragment_index = byteutils_get_short_be(data, 2);
+    int fragment_count = byteutils_get_short_be(data, 4);
+    int fragment_size = byteutils_get_short_be(data, 6);
+    uint32_t frame_number = byteutils_get_int_be(data, 8);
+    uint32_t frame_len = byteutils_get_int_be(data, 12);
+    uint64_t key_offset = byteutils_get_long_be(data, 16);
+    data += MIRROR_UDP_HEADER_LEN;
+    datalen -= MIRROR_UDP_HEADER_LEN;
+
+    /* Check that the fragment describes a sane frame and carries exactly its share of it */
+    if (fragment_count == 0 || fragment_count > MIRROR_UDP_MAX_FRAGMENTS || fragment_index >= fragment_count ||
+        fragment_size == 0 || frame_len < 128 || frame_len > MIRROR_UDP_MAX_FRAME_LEN ||
+        (uint32_t) (fragment_count - 1) * fragment_size >= frame_len ||
+        (uint32_t) fragment_count * fragment_size < frame_len) {
+        mirror_udp_buffer->stats.invalid_packets++;
+        return -1;
+    }
+    int offset = fragment_index * fragment_size;
+    int expected_len = fragment_index < fragment_count - 1 ? fragment_size : (int) frame_len - offset;
+    if (datalen != expected_len) {
+        mirror_udp_buffer->stats.invalid_packets++;
+        return -1;
+    }
+
+    if (mirror_udp_buffer->is_empty) {
+        mirror_udp_buffer->next_frame = frame_number;
+        mirror_udp_buffer->is_empty = 0;
+    }
+
+    int32_t diff = (int32_t) (frame_number - mirror_udp_buffer->next_frame);
+    if (diff < 0) {
+        /* The frame was already handed out or given up */
+        mirror_udp_buffer->stats.late_packets++;
+        return 0;
+    }
+    if (diff >= MIRROR_UDP_BUFFER_SLOTS) {
+        /* Too far ahead of what we have, restart from this frame */
+        for (int i = 0; i < MIRROR_UDP_BUFFER_SLOTS; i++) {
+            mirror_udp_buffer_entry_t *stale = &mirror_udp_buffer->entries[i];
+            if (stale->filled) {
+                mirror_udp_buffer_clear_entry(mirror_udp_buffer, stale);
+            }
+        }
+        mirror_udp_buffer->stats.lost_frames += diff;
+        mirror_udp_buffer->next_frame = frame_number;
+        mirror_udp_buffer->discontinuity = 1;
+    }
+
+    entry = &mirror_udp_buffer->entries[frame_number & (MIRROR_UDP_BUFFER_SLOTS - 1)];
+    if (entry->filled && (entry->frame_number != frame_number || entry->frame_len != (int) frame_len ||
+                          entry->fragment_count != fragment_count || entry->fragment_size != fragment_size)) {
+        mirror_udp_buffer->stats.invalid_packets++;
+        return -1;
+    }
+    if (!entry->filled) {
+        entry->payload = NULL;
+        if (frame_len > 128) {
+            entry->payload = frame_pool_get(mirror_udp_buffer->frame_pool, frame_len - 128);
+            if (!entry->payload) {
+                return -1;
+            }
+        }
+        entry->filled = 1;
+        entry->frame_number = frame_number;
+        entry->frame_len = frame_len;
+        entry->fragment_count = fragment_count;
+        entry->fragment_size = fragment_size;
+        entry->received = 0;
+        entry->key_offset = key_offset;
+        memset(entry->bitmap, 0, sizeof(entry->bitmap));
+    }
+
+    uint64_t bit = ((uint64_t) 1) << (fragment_index % 64);
+    if (entry->bitmap[fragment_index / 64] & bit) {
+        mirror_udp_buffer->stats.duplicate_packets++;
+        return 0;
+    }
+    entry->bitmap[fragment_index / 64] |= bit;
+    entry->received++;
+
+    /* The first 128 bytes of the frame are the header, the rest is payload */
+    if (offset < 128) {
+        int header_part = datalen < 128 - offset ? datalen : 128 - offset;
+        memcpy(entry->header + offset, data, header_part);
+        data += header_part;
+        datalen -= header_part;
+        offset += header_part;
+    }
+    if (datalen > 0) {
+        memcpy(entry->payload + offset - 128, data, datalen);
+    }
+    return 1;
+}
+
+int
+mirror_udp_buffer_dequeue(mirror_udp_buffer_t *mirror_udp_buffer, mirror_udp_frame_t *frame)
+{
+    assert(mirror_udp_buffer);
+    assert(frame);
+
+    if (mirror_udp_buffer->is_empty) {
+        return 0;
+    }
+    while (1) {
+        mirror_udp_buffer_entry_t *entry = &mirror_udp_buffer->entries[mirror_udp_buffer->next_frame & (MIRROR_UDP_BUFFER_SLOTS - 1)];
+        if (mirror_udp_buffer_entry_complete(entry) && entry->frame_number == mirror_udp_buffer->next_frame) {
+            memcpy(frame->header, entry->header, 128);
+            frame->payload = entry->payload;
+            frame->payload_size = entry->frame_len - 128;
+            frame->key_offset = entry->key_offset;
+            frame->discontinuity = mirror_udp_buffer->discontinuity;
+            entry->payload = NULL;
+            entry->filled = 0;
+            mirror_udp_buffer->discontinuity = 0;
+            mirror_udp_buffer->next_frame++;
+            mirror_udp_buffer->stats.frames++;
+            return 1;
+        }
+
+        /* Give up on the next frame once a frame depth numbers later is complete */
+        bool give_up = false;
+        for (int i = mirror_udp_buffer->depth; i < MIRROR_UDP_BUFFER_SLOTS; i++) {
+            uint32_t later = mirror_udp_buffer->next_frame + i;
+            mirror_udp_buffer_entry_t *later_entry = &mirror_udp_buffer->entries[later & (MIRROR_UDP_BUFFER_SLOTS - 1)];
+            if (mirror_udp_buffer_entry_complete(later_entry) && later_entry->frame_number == later) {
+                give_up = true;
+                break;
+            }
+        }
+        if (!give_up) {
+            return 0;
+        }
+        logger_log(mirror_udp_buffer->logger, LOGGER_DEBUG, "mirror_udp_buffer skipping incomplete frame %u",
+                   mirror_udp_buffer->next_frame);
+        if (entry->filled) {
+            mirror_udp_buffer_clear_entry(mirror_udp_buffer, entry);
+        }
+        mirror_udp_buffer->stats.lost_frames++;
+        mirror_udp_buffer->discontinuity = 1;
+        mirror_udp_buffer->next_frame++;
+    }
+}
+
+void
+mirror_udp_buffer_flush(mirror_udp_buffer_t *mirror_udp_buffer)
+{
+    assert(mirror_udp_buffer);
+    for (int i = 0; i < MIRROR_UDP_BUFFER_SLOTS; i++) {
+        mirror_udp_buffer_entry_t *entry = &mirror_udp_buffer->entries[i];
+        if (entry->filled) {
+            mirror_udp_buffer_clear_entry(mirror_udp_buffer, entry);
+        }
+    }
+    mirror_udp_buffer->is_empty = 1;
+    mirror_udp_buffer->discontinuity = 0;
+}
+
+void
+mirror_udp_buffer_get_stats(mirror_udp_buffer_t *mirror_udp_buffer, mirror_udp_buffer_stats_t *stats)
+{
+    assert(mirror_udp_buffer);
+    assert(stats);
+    memcpy(stats, &mirror_udp_buffer->stats, sizeof(mirror_udp_buffer_stats_t));
+}
+
+void
+mirror_udp_buffer_destroy(mirror_udp_buffer_t *mirror_udp_buffer)
+{
+    if (mirror_udp_buffer) {
+        mirror_udp_buffer_flush(mirror_udp_buffer);
+        free(mirror_udp_buffer);
+    }
+}
@@ -0,0 +1,73 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#ifndef MIRROR_UDP_BUFFER_H
+#define MIRROR_UDP_BUFFER_H
+
+#include <stdint.h>
+#include "logger.h"
+#include "frame_pool.h"
+
+/*
+ * Reorder buffer for mirror frames received over UDP. Every frame, the same
+ * 128 byte header and payload that is sent over the TCP stream, is split into
+ * fragments that each travel in one datagram behind this header, all fields
+ * big-endian:
+ *
+ *   0  sequence number       (16 bit)
+ *   2  fragment index        (16 bit)
+ *   4  fragment count        (16 bit)
+ *   6  fragment size         (16 bit, size of every fragment but the last)
+ *   8  frame number          (32 bit)
+ *  12  frame length          (32 bit, header plus payload)
+ *  16  keystream offset      (64 bit, payload bytes encrypted before this frame)
+ *
+ * Frames are handed out in frame number order. A frame that is still
+ * incomplete once a frame depth numbers later has been completed is given up,
+ * and the keystream offset lets the decrypter continue after the gap.
+ */
+
+#define MIRROR_UDP_HEADER_LEN 24
+/*
+ * No stock sender speaks this framing, so a mirror stream only comes over UDP when the receiver
+ * opted in and the SETUP's Transport header carries this token as well
+ */
+#define MIRROR_UDP_TRANSPORT_TOKEN "x-rpiplay-fragments"
+
+typedef struct mirror_udp_buffer_s mirror_udp_buffer_t;
+
+typedef struct {
+    unsigned char header[128];
+    /* Payload from the frame pool, owned by the caller after dequeue */
+    unsigned char *payload;
+    int payload_size;
+    uint64_t key_offset;
+    /* One or more frames before this one were lost */
+    int discontinuity;
+} mirror_udp_frame_t;
+
+typedef struct {
+    uint64_t frames;
+    uint64_t lost_frames;
+    uint64_t late_packets;
+    uint64_t duplicate_packets;
+    uint64_t invalid_packets;
+} mirror_udp_buffer_stats_t;
+
+mirror_udp_buffer_t *mirror_udp_buffer_init(logger_t *logger, frame_pool_t *frame_pool, int depth);
+int mirror_udp_buffer_enqueue(mirror_udp_buffer_t *mirror_udp_buffer, unsigned char *data, int datalen);
+int mirror_udp_buffer_dequeue(mirror_udp_buffer_t *mirror_udp_buffer, mirror_udp_frame_t *frame);
+void mirror_udp_buffer_flush(mirror_udp_buffer_t *mirror_udp_buffer);
+void mirror_udp_buffer_get_stats(mirror_udp_buffer_t *mirror_udp_buffer, mirror_udp_buffer_stats_t *stats);
+void mirror_udp_buffer_destroy(mirror_udp_buffer_t *mirror_udp_buffer);
+
+#endif //MIRROR_UDP_BUFFER_H
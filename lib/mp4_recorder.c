@@ -0,0 +1,893 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <assert.h>
+#include <fcntl.h>
+
+#include "mp4_recorder.h"
+#include "compat.h"
+
+/* The file is written in blocks of this size, aligned for the page cache */
+#define MP4_RECORDER_WRITE_SIZE (1024 * 1024)
+#define MP4_RECORDER_WRITE_ALIGN 4096
+
+/* A video fragment ends at the first keyframe after MIN, or at MAX when the sender sends none,
+ * an audio fragment at MIN. All in us. */
+#define MP4_FRAGMENT_MIN_DURATION 1000000
+#define MP4_FRAGMENT_MAX_DURATION 2000000
+/* How long audio waits for a codec packet before the file is written without a video track */
+#define MP4_HEADER_WAIT 3000000
+
+#define MP4_MAX_PARAMETER_SET 256
+
+#define VIDEO_TRACK_ID 1
+#define AUDIO_TRACK_ID 2
+#define VIDEO_TIMESCALE 90000
+#define AUDIO_TIMESCALE 44100
+#define AUDIO_FRAME_SAMPLES 480
+
+#define NAL_TYPE_IDR 5
+#define NAL_TYPE_SPS 7
+#define NAL_TYPE_PPS 8
+#define NAL_TYPE_AUD 9
+
+/* sample_depends_on and sample_is_non_sync_sample of the trun sample flags */
+#define SAMPLE_FLAGS_SYNC 0x02000000
+#define SAMPLE_FLAGS_NON_SYNC 0x01010000
+
+/* The AudioSpecificConfig of AirPlay's AAC-ELD, 44100 Hz, stereo, 480 samples per frame */
+static const unsigned char eld_config[] = { 0xf8, 0xe8, 0x50, 0x00 };
+
+typedef struct {
+    unsigned char *data;
+    size_t size;
+    size_t capacity;
+    int error;
+} mp4_buffer_t;
+
+typedef struct {
+    uint32_t size;
+    uint32_t duration;
+    uint32_t flags;
+} mp4_sample_t;
+
+/* Samples of one track collected for the next moof and mdat, times in the track's timescale */
+typedef struct {
+    int track_id;
+    uint32_t timescale;
+    mp4_buffer_t samples;
+    int sample_count;
+    mp4_buffer_t mdat;
+    uint64_t start_dts;
+    uint64_t next_dts;
+} mp4_fragment_t;
+
+struct mp4_recorder_s {
+    logger_t *logger;
+    char *filename;
+    int fd;
+
+    /* Read by mp4_recorder_get_stats from other threads */
+    uint64_t video_frames;
+    uint64_t audio_frames;
+    uint64_t fragments;
+    uint64_t bytes;
+
+    unsigned char *out;
+    size_t out_len;
+    int write_error;
+
+    bool header_written;
+    bool has_video_track;
+    bool warned_late_video;
+    bool warned_codec;
+    unsigned char sps[MP4_MAX_PARAMETER_SET];
+    int sps_len;
+    unsigned char pps[MP4_MAX_PARAMETER_SET];
+    int pps_len;
+    int width;
+    int height;
+    /* Parameter sets changed since the avcC was written and go in band with the next frame */
+    bool parameter_sets_changed;
+
+    bool have_base;
+    uint64_t base_pts;
+    uint32_t sequence_number;
+
+    mp4_fragment_t video;
+    mp4_fragment_t audio;
+
+    /* Video frame waiting for the next one, which tells its duration */
+    const frame_bus_frame_t *held_video;
+    uint64_t held_dts;
+    uint32_t last_video_duration;
+
+    mp4_buffer_t box;
+};
+
+static void
+mp4_buffer_reserve(mp4_buffer_t *buffer, size_t size)
+{
+    if (buffer->size + size <= buffer->capacity) {
+        return;
+    }
+    size_t capacity = buffer->capacity ? buffer->capacity : 4096;
+    while (capacity < buffer->size + size) {
+        capacity *= 2;
+    }
+    unsigned char *data = realloc(buffer->data, capacity);
+    if (!data) {
+        buffer->error = 1;
+        return;
+    }
+    buffer->data = data;
+    buffer->capacity = capacity;
+}
+
+static void
+mp4_put_bytes(mp4_buffer_t *buffer, const void *data, size_t size)
+{
+    mp4_buffer_reserve(buffer, size);
+    if (buffer->error) {
+        return;
+    }
+    memcpy(buffer->data + buffer->size, data, size);
+    buffer->size += size;
+}
+
+static void
+mp4_put8(mp4_buffer_t *buffer, uint8_t value)
+{
+    mp4_put_bytes(buffer, &value, 1);
+}
+
+static void
+mp4_put16(mp4_buffer_t *buffer, uint16_t value)
+{
+    unsigned char b[2] = { value >> 8, value };
+    mp4_put_bytes(buffer, b, sizeof(b));
+}
+
+static void
+mp4_put24(mp4_buffer_t *buffer, uint32_t value)
+{
+    unsigned char b[3] = { value >> 16, value >> 8, value };
+    mp4_put_bytes(buffer, b, sizeof(b));
+}
+
+static void
+mp4_put32(mp4_buffer_t *buffer, uint32_t value)
+{
+    unsigned char b[4] = { value >> 24, value >> 16, value >> 8, value };
+    mp4_put_bytes(buffer, b, sizeof(b));
+}
+
+static void
+mp4_put64(mp4_buffer_t *buffer, uint64_t value)
+{
+    mp4_put32(buffer, value >> 32);
+    mp4_put32(buffer, value);
+}
+
+static void
+mp4_put_zeros(mp4_buffer_t *buffer, size_t count)
+{
+    mp4_buffer_reserve(buffer, count);
+    if (buffer->error) {
+        return;
+    }
+    memset(buffer->data + buffer->size, 0, count);
+    buffer->size += count;
+}
+
+static void
+mp4_patch32(mp4_buffer_t *buffer, size_t offset, uint32_t value)
+{
+    if (buffer->error) {
+        return;
+    }
+    buffer->data[offset] = value >> 24;
+    buffer->data[offset + 1] = value >> 16;
+    buffer->data[offset + 2] = value >> 8;
+    buffer->data[offset + 3] = value;
+}
+
+/* Starts a box whose size is filled in by mp4_box_end, returns its offset */
+static size_t
+mp4_box_start(mp4_buffer_t *buffer, const char *type)
+{
+    size_t offset = buffer->size;
+    mp4_put32(buffer, 0);
+    mp4_put_bytes(buffer, type, 4);
+    return offset;
+}
+
+static size_t
+mp4_full_box_start(mp4_buffer_t *buffer, const char *type, uint8_t version, uint32_t flags)
+{
+    size_t offset = mp4_box_start(buffer, type);
+    mp4_put8(buffer, version);
+    mp4_put24(buffer, flags);
+    return offset;
+}
+
+static void
+mp4_box_end(mp4_buffer_t *buffer, size_t offset)
+{
+    mp4_patch32(buffer, offset, buffer->size - offset);
+}
+
+static void
+mp4_put_matrix(mp4_buffer_t *buffer)
+{
+    static const uint32_t unity[9] = { 0x00010000, 0, 0, 0, 0x00010000, 0, 0, 0, 0x40000000 };
+    for (int i = 0; i < 9; i++) {
+        mp4_put32(buffer, unity[i]);
+    }
+}
+
+/* Finds the next NAL unit of Annex-B data at or after *position, returns false at the end */
+static bool
+mp4_next_nal(const unsigned char *data, int data_len, int *position, int *offset, int *size)
+{
+    int i = *position;
+    while (i + 3 <= data_len && !(data[i] == 0 && data[i + 1] == 0 && data[i + 2] == 1)) {
+        i++;
+    }
+    if (i + 3 >= data_len) {
+        *position = data_len;
+        return false;
+    }
+    int start = i + 3;
+    int end = start;
+    while (end + 3 <= data_len && !(data[end] == 0 && data[end + 1] == 0 && data[end + 2] <= 1)) {
+        end++;
+    }
+    if (end + 3 > data_len) {
+        end = data_len;
+    }
+    *position = end;
+    *offset = start;
+    *size = end - start;
+    return true;
+}
+
+static uint64_t
+mp4_to_timescale(uint64_t us, uint32_t timescale)
+{
+    return us * timescale / 1000000;
+}
+
+static void
+mp4_output(mp4_recorder_t *recorder, const unsigned char *data, size_t size)
+{
+    while (size > 0 && !recorder->write_error) {
+        size_t chunk = MP4_RECORDER_WRITE_SIZE - recorder->out_len;
+        if (chunk > size) {
+            chunk = size;
+        }
+        memcpy(recorder->out + recorder->out_len, data, chunk);
+        recorder->out_len += chunk;
+        data += chunk;
+        size -= chunk;
+        __atomic_fetch_add(&recorder->bytes, chunk, __ATOMIC_RELAXED);
+        if (recorder->out_len == MP4_RECORDER_WRITE_SIZE) {
+            if (write(recorder->fd, recorder->out, recorder->out_len) != (ssize_t) recorder->out_len) {
+                logger_log(recorder->logger, LOGGER_ERR, "mp4_recorder could not write to %s, stopping recording",
+                           recorder->filename);
+                recorder->write_error = 1;
+            }
+            recorder->out_len = 0;
+        }
+    }
+}
+
+static void
+mp4_write_video_trak(mp4_recorder_t *recorder, mp4_buffer_t *b)
+{
+    size_t trak = mp4_box_start(b, "trak");
+    size_t tkhd = mp4_full_box_start(b, "tkhd", 0, 0x000003);
+    mp4_put32(b, 0);
+    mp4_put32(b, 0);
+    mp4_put32(b, VIDEO_TRACK_ID);
+    mp4_put32(b, 0);
+    mp4_put32(b, 0);
+    mp4_put_zeros(b, 8);
+    mp4_put16(b, 0);
+    mp4_put16(b, 0);
+    mp4_put16(b, 0);
+    mp4_put16(b, 0);
+    mp4_put_matrix(b);
+    mp4_put32(b, (uint32_t) recorder->width << 16);
+    mp4_put32(b, (uint32_t) recorder->height << 16);
+    mp4_box_end(b, tkhd);
+
+    size_t mdia = mp4_box_start(b, "mdia");
+    size_t mdhd = mp4_full_box_start(b, "mdhd", 0, 0);
+    mp4_put32(b, 0);
+    mp4_put32(b, 0);
+    mp4_put32(b, VIDEO_TIMESCALE);
+    mp4_put32(b, 0);
+    mp4_put16(b, 0x55c4);
+    mp4_put16(b, 0);
+    mp4_box_end(b, mdhd);
+    size_t hdlr = mp4_full_box_start(b, "hdlr", 0, 0);
+    mp4_put32(b, 0);
+    mp4_put_bytes(b, "vide", 4);
+    mp4_put_zeros(b, 12);
+    mp4_put_bytes(b, "VideoHandler", 13);
+    mp4_box_end(b, hdlr);
+
+    size_t minf = mp4_box_start(b, "minf");
+    size_t vmhd = mp4_full_box_start(b, "vmhd", 0, 1);
+    mp4_put_zeros(b, 8);
+    mp4_box_end(b, vmhd);
+    size_t dinf = mp4_box_start(b, "dinf");
+    size_t dref = mp4_full_box_start(b, "dref", 0, 0);
+    mp4_put32(b, 1);
+    size_t url = mp4_full_box_start(b, "url ", 0, 1);
+    mp4_box_end(b, url);
+    mp4_box_end(b, dref);
+    mp4_box_end(b, dinf);
+
+    size_t stbl = mp4_box_start(b, "stbl");
+    size_t stsd = mp4_full_box_start(b, "stsd", 0, 0);
+    mp4_put32(b, 1);
+    size_t avc1 = mp4_box_start(b, "avc1");
+    mp4_put_zeros(b, 6);
+    mp4_put16(b, 1);
+    mp4_put_zeros(b, 16);
+    mp4_put16(b, recorder->width);
+    mp4_put16(b, recorder->height);
+    mp4_put32(b, 0x00480000);
+    mp4_put32(b, 0x00480000);
+    mp4_put32(b, 0);
+    mp4_put16(b, 1);
+    mp4_put_zeros(b, 32);
+    mp4_put16(b, 0x0018);
+    mp4_put16(b, 0xffff);
+    size_t avcc = mp4_box_start(b, "avcC");
+    mp4_put8(b, 1);
+    mp4_put_bytes(b, recorder->sps + 1, 3);
+    mp4_put8(b, 0xff);
+    mp4_put8(b, 0xe1);
+    mp4_put16(b, recorder->sps_len);
+    mp4_put_bytes(b, recorder->sps, recorder->sps_len);
+    mp4_put8(b, 1);
+    mp4_put16(b, recorder->pps_len);
+    mp4_put_bytes(b, recorder->pps, recorder->pps_len);
+    mp4_box_end(b, avcc);
+    mp4_box_end(b, avc1);
+    mp4_box_end(b, stsd);
+    const char *empty_tables[] = { "stts", "stsc", "stsz", "stco" };
+    for (int i = 0; i < 4; i++) {
+        size_t table = mp4_full_box_start(b, empty_tables[i], 0, 0);
+        if (i == 2) {
+            mp4_put32(b, 0);
+        }
+        mp4_put32(b, 0);
+        mp4_box_end(b, table);
+    }
+    mp4_box_end(b, stbl);
+    mp4_box_end(b, minf);
+    mp4_box_end(b, mdia);
+    mp4_box_end(b, trak);
+}
+
+/* An MPEG-4 descriptor header with a four byte length, as most muxers write it */
+static void
+mp4_put_descriptor(mp4_buffer_t *b, uint8_t tag, uint32_t size)
+{
+    mp4_put8(b, tag);
+    mp4_put8(b, 0x80 | ((size >> 21) & 0x7f));
+    mp4_put8(b, 0x80 | ((size >> 14) & 0x7f));
+    mp4_put8(b, 0x80 | ((size >> 7) & 0x7f));
+    mp4_put8(b, size & 0x7f);
+}
+
+static void
+mp4_write_audio_trak(mp4_recorder_t *recorder, mp4_buffer_t *b)
+{
+    size_t trak = mp4_box_start(b, "trak");
+    size_t tkhd = mp4_full_box_start(b, "tkhd", 0, 0x000003);
+    mp4_put32(b, 0);
+    mp4_put32(b, 0);
+    mp4_put32(b, AUDIO_TRACK_ID);
+    mp4_put32(b, 0);
+    mp4_put32(b, 0);
+    mp4_put_zeros(b, 8);
+    mp4_put16(b, 0);
+    mp4_put16(b, 1);
+    mp4_put16(b, 0x0100);
+    mp4_put16(b, 0);
+    mp4_put_matrix(b);
+    mp4_put32(b, 0);
+    mp4_put32(b, 0);
+    mp4_box_end(b, tkhd);
+
+    size_t mdia = mp4_box_start(b, "mdia");
+    size_t mdhd = mp4_full_box_start(b, "mdhd", 0, 0);
+    mp4_put32(b, 0);
+    mp4_put32(b, 0);
+    mp4_put32(b, AUDIO_TIMESCALE);
+    mp4_put32(b, 0);
+    mp4_put16(b, 0x55c4);
+    mp4_put16(b, 0);
+    mp4_box_end(b, mdhd);
+    size_t hdlr = mp4_full_box_start(b, "hdlr", 0, 0);
+    mp4_put32(b, 0);
+    mp4_put_bytes(b, "soun", 4);
+    mp4_put_zeros(b, 12);
+    mp4_put_bytes(b, "SoundHandler", 13);
+    mp4_box_end(b, hdlr);
+
+    size_t minf = mp4_box_start(b, "minf");
+    size_t smhd = mp4_full_box_start(b, "smhd", 0, 0);
+    mp4_put_zeros(b, 4);
+    mp4_box_end(b, smhd);
+    size_t dinf = mp4_box_start(b, "dinf");
+    size_t dref = mp4_full_box_start(b, "dref", 0, 0);
+    mp4_put32(b, 1);
+    size_t url = mp4_full_box_start(b, "url ", 0, 1);
+    mp4_box_end(b, url);
+    mp4_box_end(b, dref);
+    mp4_box_end(b, dinf);
+
+    size_t stbl = mp4_box_start(b, "stbl");
+    size_t stsd = mp4_full_box_start(b, "stsd", 0, 0);
+    mp4_put32(b, 1);
+    size_t mp4a = mp4_box_start(b, "mp4a");
+    mp4_put_zeros(b, 6);
+    mp4_put16(b, 1);
+    mp4_put_zeros(b, 8);
+    mp4_put16(b, 2);
+    mp4_put16(b, 16);
+    mp4_put32(b, 0);
+    mp4_put32(b, (uint32_t) AUDIO_TIMESCALE << 16);
+    size_t esds = mp4_full_box_start(b, "esds", 0, 0);
+    mp4_put_descriptor(b, 0x03, 3 + 5 + 13 + 5 + sizeof(eld_config) + 5 + 1);
+    mp4_put16(b, AUDIO_TRACK_ID);
+    mp4_put8(b, 0);
+    mp4_put_descriptor(b, 0x04, 13 + 5 + sizeof(eld_config));
+    mp4_put8(b, 0x40);
+    mp4_put8(b, 0x15);
+    mp4_put24(b, 0);
+    mp4_put32(b, 0);
+    mp4_put32(b, 0);
+    mp4_put_descriptor(b, 0x05, sizeof(eld_config));
+    mp4_put_bytes(b, eld_config, sizeof(eld_config));
+    mp4_put_descriptor(b, 0x06, 1);
+    mp4_put8(b, 0x02);
+    mp4_box_end(b, esds);
+    mp4_box_end(b, mp4a);
+    mp4_box_end(b, stsd);
+    const char *empty_tables[] = { "stts", "stsc", "stsz", "stco" };
+    for (int i = 0; i < 4; i++) {
+        size_t table = mp4_full_box_start(b, empty_tables[i], 0, 0);
+        if (i == 2) {
+            mp4_put32(b, 0);
+        }
+        mp4_put32(b, 0);
+        mp4_box_end(b, table);
+    }
+    mp4_box_end(b, stbl);
+    mp4_box_end(b, minf);
+    mp4_box_end(b, mdia);
+    mp4_box_end(b, trak);
+}
+
+static void
+mp4_write_trex(mp4_buffer_t *b, uint32_t track_id, uint32_t default_flags)
+{
+    size_t trex = mp4_full_box_start(b, "trex", 0, 0);
+    mp4_put32(b, track_id);
+    mp4_put32(b, 1);
+    mp4_put32(b, 0);
+    mp4_put32(b, 0);
+    mp4_put32(b, default_flags);
+    mp4_box_end(b, trex);
+}
+
+/* Writes ftyp and moov, with a video track only if a codec packet came in by now */
+static void
+mp4_write_header(mp4_recorder_t *recorder)
+{
+    mp4_buffer_t *b = &recorder->box;
+
+    recorder->has_video_track = recorder->sps_len > 0 && recorder->pps_len > 0;
+    recorder->parameter_sets_changed = false;
+    b->size = 0;
+
+    size_t ftyp = mp4_box_start(b, "ftyp");
+    mp4_put_bytes(b, "isom", 4);
+    mp4_put32(b, 0x200);
+    mp4_put_bytes(b, "isomiso6avc1mp41", 16);
+    mp4_box_end(b, ftyp);
+
+    size_t moov = mp4_box_start(b, "moov");
+    size_t mvhd = mp4_full_box_start(b, "mvhd", 0, 0);
+    mp4_put32(b, 0);
+    mp4_put32(b, 0);
+    mp4_put32(b, 1000);
+    mp4_put32(b, 0);
+    mp4_put32(b, 0x00010000);
+    mp4_put16(b, 0x0100);
+    mp4_put_zeros(b, 10);
+    mp4_put_matrix(b);
+    mp4_put_zeros(b, 24);
+    mp4_put32(b, AUDIO_TRACK_ID + 1);
+    mp4_box_end(b, mvhd);
+    if (recorder->has_video_track) {
+        mp4_write_video_trak(recorder, b);
+    }
+    mp4_write_audio_trak(recorder, b);
+    size_t mvex = mp4_box_start(b, "mvex");
+    if (recorder->has_video_track) {
+        mp4_write_trex(b, VIDEO_TRACK_ID, SAMPLE_FLAGS_NON_SYNC);
+    }
+    mp4_write_trex(b, AUDIO_TRACK_ID, SAMPLE_FLAGS_SYNC);
+    mp4_box_end(b, mvex);
+    mp4_box_end(b, moov);
+
+    if (b->error) {
+        logger_log(recorder->logger, LOGGER_ERR, "mp4_recorder ran out of memory, stopping recording");
+        recorder->write_error = 1;
+        return;
+    }
+    mp4_output(recorder, b->data, b->size);
+    recorder->header_written = true;
+    logger_log(recorder->logger, LOGGER_INFO, "mp4_recorder recording %s to %s",
+               recorder->has_video_track ? "video and audio" : "audio", recorder->filename);
+}
+
+static void
+mp4_flush_fragment(mp4_recorder_t *recorder, mp4_fragment_t *fragment)
+{
+    mp4_buffer_t *b = &recorder->box;
+    bool video = fragment->track_id == VIDEO_TRACK_ID;
+    const mp4_sample_t *samples = (const mp4_sample_t *) fragment->samples.data;
+
+    if (fragment->sample_count == 0) {
+        return;
+    }
+    if (!recorder->header_written) {
+        mp4_write_header(recorder);
+    }
+    if (video && !recorder->has_video_track) {
+        if (!recorder->warned_late_video) {
+            logger_log(recorder->logger, LOGGER_WARNING, "mp4_recorder video started after the file header, not recording it");
+            recorder->warned_late_video = true;
+        }
+    } else if (!fragment->samples.error && !fragment->mdat.error) {
+        b->size = 0;
+        size_t moof = mp4_box_start(b, "moof");
+        size_t mfhd = mp4_full_box_start(b, "mfhd", 0, 0);
+        mp4_put32(b, ++recorder->sequence_number);
+        mp4_box_end(b, mfhd);
+        size_t traf = mp4_box_start(b, "traf");
+        // default-base-is-moof
+        size_t tfhd = mp4_full_box_start(b, "tfhd", 0, 0x020000);
+        mp4_put32(b, fragment->track_id);
+        mp4_box_end(b, tfhd);
+        size_t tfdt = mp4_full_box_start(b, "tfdt", 1, 0);
+        mp4_put64(b, fragment->start_dts);
+        mp4_box_end(b, tfdt);
+        // data-offset, sample-duration and sample-size, and sample-flags for video
+        size_t trun = mp4_full_box_start(b, "trun", 0, video ? 0x000701 : 0x000301);
+        mp4_put32(b, fragment->sample_count);
+        size_t data_offset = b->size;
+        mp4_put32(b, 0);
+        for (int i = 0; i < fragment->sample_count; i++) {
+            mp4_put32(b, samples[i].duration);
+            mp4_put32(b, samples[i].size);
+            if (video) {
+                mp4_put32(b, samples[i].flags);
+            }
+        }
+        mp4_box_end(b, trun);
+        mp4_box_end(b, traf);
+        mp4_box_end(b, moof);
+        mp4_patch32(b, data_offset, b->size - moof + 8);
+        mp4_put32(b, 8 + fragment->mdat.size);
+        mp4_put_bytes(b, "mdat", 4);
+
+        if (!b->error) {
+            mp4_output(recorder, b->data, b->size);
+            mp4_output(recorder, fragment->mdat.data, fragment->mdat.size);
+            __atomic_fetch_add(&recorder->fragments, 1, __ATOMIC_RELAXED);
+        }
+    }
+    if (fragment->samples.error || fragment->mdat.error || b->error) {
+        logger_log(recorder->logger, LOGGER_ERR, "mp4_recorder ran out of memory, dropping a fragment");
+    }
+
+    fragment->start_dts = fragment->next_dts;
+    fragment->sample_count = 0;
+    fragment->samples.size = 0;
+    fragment->samples.error = 0;
+    fragment->mdat.size = 0;
+    fragment->mdat.error = 0;
+    b->error = 0;
+}
+
+static void
+mp4_fragment_add(mp4_fragment_t *fragment, uint32_t size, uint32_t duration, uint32_t flags)
+{
+    mp4_sample_t sample = { size, duration, flags };
+    mp4_put_bytes(&fragment->samples, &sample, sizeof(sample));
+    fragment->sample_count++;
+    fragment->next_dts += duration;
+}
+
+static void
+mp4_put_nal(mp4_buffer_t *mdat, const unsigned char *nal, int size)
+{
+    mp4_put32(mdat, size);
+    mp4_put_bytes(mdat, nal, size);
+}
+
+/* Moves the held video frame into the fragment now that its duration is known */
+static void
+mp4_add_held_video(mp4_recorder_t *recorder, uint32_t duration)
+{
+    mp4_fragment_t *fragment = &recorder->video;
+    const frame_bus_frame_t *frame = recorder->held_video;
+    uint64_t fragment_duration = fragment->next_dts - fragment->start_dts;
+
+    if (fragment->sample_count > 0 &&
+        ((frame->keyframe && fragment_duration >= mp4_to_timescale(MP4_FRAGMENT_MIN_DURATION, VIDEO_TIMESCALE)) ||
+         fragment_duration >= mp4_to_timescale(MP4_FRAGMENT_MAX_DURATION, VIDEO_TIMESCALE))) {
+        mp4_flush_fragment(recorder, fragment);
+    }
+    if (fragment->sample_count == 0) {
+        fragment->start_dts = recorder->held_dts;
+        fragment->next_dts = recorder->held_dts;
+    }
+
+    // Length prefixed NAL units, the parameter sets live in the avcC unless they changed
+    size_t start = fragment->mdat.size;
+    if (recorder->parameter_sets_changed) {
+        mp4_put_nal(&fragment->mdat, recorder->sps, recorder->sps_len);
+        mp4_put_nal(&fragment->mdat, recorder->pps, recorder->pps_len);
+        recorder->parameter_sets_changed = false;
+    }
+    int position = 0, offset, size;
+    while (mp4_next_nal(frame->data, frame->data_len, &position, &offset, &size)) {
+        int type = size > 0 ? frame->data[offset] & 0x1f : 0;
+        if (size > 0 && type != NAL_TYPE_SPS && type != NAL_TYPE_PPS && type != NAL_TYPE_AUD) {
+            mp4_put_nal(&fragment->mdat, frame->data + offset, size);
+        }
+    }
+    if (fragment->mdat.size > start) {
+        mp4_fragment_add(fragment, fragment->mdat.size - start, duration,
+                         frame->keyframe ? SAMPLE_FLAGS_SYNC : SAMPLE_FLAGS_NON_SYNC);
+        __atomic_fetch_add(&recorder->video_frames, 1, __ATOMIC_RELAXED);
+    }
+    frame_bus_frame_release(frame);
+    recorder->held_video = NULL;
+}
+
+static void
+mp4_write_codec(mp4_recorder_t *recorder, const frame_bus_frame_t *frame)
+{
+    unsigned char sps[MP4_MAX_PARAMETER_SET];
+    unsigned char pps[MP4_MAX_PARAMETER_SET];
+    int sps_len = 0, pps_len = 0;
+    int position = 0, offset, size;
+
+    while (mp4_next_nal(frame->data, frame->data_len, &position, &offset, &size)) {
+        int type = size > 0 ? frame->data[offset] & 0x1f : 0;
+        if (type == NAL_TYPE_SPS && size >= 4 && size <= MP4_MAX_PARAMETER_SET) {
+            memcpy(sps, frame->data + offset, size);
+            sps_len = size;
+        } else if (type == NAL_TYPE_PPS && size <= MP4_MAX_PARAMETER_SET) {
+            memcpy(pps, frame->data + offset, size);
+            pps_len = size;
+        }
+    }
+    if (!sps_len || !pps_len) {
+        return;
+    }
+    if (sps_len == recorder->sps_len && pps_len == recorder->pps_len &&
+        !memcmp(sps, recorder->sps, sps_len) && !memcmp(pps, recorder->pps, pps_len)) {
+        return;
+    }
+    memcpy(recorder->sps, sps, sps_len);
+    recorder->sps_len = sps_len;
+    memcpy(recorder->pps, pps, pps_len);
+    recorder->pps_len = pps_len;
+    if (!recorder->header_written) {
+        recorder->width = frame->width;
+        recorder->height = frame->height;
+    } else {
+        recorder->parameter_sets_changed = true;
+    }
+}
+
+static void
+mp4_write_video(mp4_recorder_t *recorder, const frame_bus_frame_t *frame)
+{
+    if (!recorder->sps_len) {
+        // Nothing to decode it with yet
+        return;
+    }
+    uint64_t dts = frame->pts > recorder->base_pts ?
+                   mp4_to_timescale(frame->pts - recorder->base_pts, VIDEO_TIMESCALE) : 0;
+    if (recorder->held_video) {
+        // Decode times have to increase even if the sender repeats a timestamp
+        if (dts <= recorder->held_dts) {
+            dts = recorder->held_dts + 1;
+        }
+        uint32_t duration = dts - recorder->held_dts;
+        mp4_add_held_video(recorder, duration);
+        recorder->last_video_duration = duration;
+    }
+    frame_bus_frame_retain(frame);
+    recorder->held_video = frame;
+    recorder->held_dts = dts;
+}
+
+static void
+mp4_write_audio(mp4_recorder_t *recorder, const frame_bus_frame_t *frame)
+{
+    mp4_fragment_t *fragment = &recorder->audio;
+    uint64_t dts = frame->pts > recorder->base_pts ?
+                   mp4_to_timescale(frame->pts - recorder->base_pts, AUDIO_TIMESCALE) : 0;
+
+    // Stay on the running sample count unless packets went missing
+    if (fragment->sample_count > 0 && llabs((int64_t) dts - (int64_t) fragment->next_dts) > AUDIO_FRAME_SAMPLES) {
+        mp4_flush_fragment(recorder, fragment);
+    }
+    if (fragment->sample_count == 0) {
+        bool continuous = fragment->next_dts > 0 && llabs((int64_t) dts - (int64_t) fragment->next_dts) <= AUDIO_FRAME_SAMPLES;
+        fragment->start_dts = continuous ? fragment->next_dts : dts;
+        fragment->next_dts = fragment->start_dts;
+    }
+    mp4_put_bytes(&fragment->mdat, frame->data, frame->data_len);
+    mp4_fragment_add(fragment, frame->data_len, AUDIO_FRAME_SAMPLES, SAMPLE_FLAGS_SYNC);
+    __atomic_fetch_add(&recorder->audio_frames, 1, __ATOMIC_RELAXED);
+
+    uint64_t duration = fragment->next_dts - fragment->start_dts;
+    uint64_t wait = recorder->header_written || recorder->sps_len ? MP4_FRAGMENT_MIN_DURATION : MP4_HEADER_WAIT;
+    if (duration >= mp4_to_timescale(wait, AUDIO_TIMESCALE)) {
+        mp4_flush_fragment(recorder, fragment);
+    }
+}
+
+mp4_recorder_t *
+mp4_recorder_open(logger_t *logger, const char *filename)
+{
+    mp4_recorder_t *recorder;
+
+    assert(filename);
+
+    recorder = calloc(1, sizeof(mp4_recorder_t));
+    if (!recorder) {
+        return NULL;
+    }
+    recorder->logger = logger;
+    recorder->video.track_id = VIDEO_TRACK_ID;
+    recorder->video.timescale = VIDEO_TIMESCALE;
+    recorder->audio.track_id = AUDIO_TRACK_ID;
+    recorder->audio.timescale = AUDIO_TIMESCALE;
+    recorder->filename = strdup(filename);
+    ALIGNED_MALLOC(recorder->out, MP4_RECORDER_WRITE_ALIGN, MP4_RECORDER_WRITE_SIZE);
+    if (!recorder->filename || !recorder->out) {
+        goto error;
+    }
+    recorder->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (recorder->fd < 0) {
+        logger_log(logger, LOGGER_ERR, "mp4_recorder could not open %s", filename);
+        goto error;
+    }
+    return recorder;
+
+    error:
+    if (recorder->out) {
+        ALIGNED_FREE(recorder->out);
+    }
+    free(recorder->filename);
+    free(recorder);
+    return NULL;
+}
+
+void
+mp4_recorder_write_frame(mp4_recorder_t *recorder, const frame_bus_frame_t *frame)
+{
+    assert(recorder);
+    assert(frame);
+
+    if (recorder->write_error || frame->data_len <= 0) {
+        return;
+    }
+    if (frame->kind != FRAME_BUS_AUDIO && frame->codec != VIDEO_CODEC_H264) {
+        // The video track is written as avc1, HEVC sessions only get their audio recorded
+        if (!recorder->warned_codec) {
+            logger_log(recorder->logger, LOGGER_WARNING, "mp4_recorder only records H.264 video, skipping the HEVC stream");
+            recorder->warned_codec = true;
+        }
+        return;
+    }
+    if (frame->kind == FRAME_BUS_CODEC) {
+        mp4_write_codec(recorder, frame);
+        return;
+    }
+    if (!recorder->have_base) {
+        // Both tracks count from the first frame of either, which keeps them in sync
+        recorder->base_pts = frame->pts;
+        recorder->have_base = true;
+    }
+    if (frame->kind == FRAME_BUS_VIDEO) {
+        mp4_write_video(recorder, frame);
+    } else {
+        mp4_write_audio(recorder, frame);
+    }
+}
+
+void
+mp4_recorder_get_stats(mp4_recorder_t *recorder, mp4_recorder_stats_t *stats)
+{
+    assert(recorder);
+    assert(stats);
+    stats->video_frames = __atomic_load_n(&recorder->video_frames, __ATOMIC_RELAXED);
+    stats->audio_frames = __atomic_load_n(&recorder->audio_frames, __ATOMIC_RELAXED);
+    stats->fragments = __atomic_load_n(&recorder->fragments, __ATOMIC_RELAXED);
+    stats->bytes = __atomic_load_n(&recorder->bytes, __ATOMIC_RELAXED);
+}
+
+void
+mp4_recorder_close(mp4_recorder_t *recorder)
+{
+    mp4_recorder_stats_t stats;
+
+    if (!recorder) {
+        return;
+    }
+    if (recorder->held_video && !recorder->write_error) {
+        mp4_add_held_video(recorder, recorder->last_video_duration ? recorder->last_video_duration : VIDEO_TIMESCALE / 30);
+    }
+    frame_bus_frame_release(recorder->held_video);
+    if (!recorder->write_error) {
+        mp4_flush_fragment(recorder, &recorder->video);
+        mp4_flush_fragment(recorder, &recorder->audio);
+    }
+    if (recorder->out_len > 0 && !recorder->write_error &&
+        write(recorder->fd, recorder->out, recorder->out_len) != (ssize_t) recorder->out_len) {
+        logger_log(recorder->logger, LOGGER_ERR, "mp4_recorder could not write to %s", recorder->filename);
+    }
+    if (close(recorder->fd) != 0) {
+        logger_log(recorder->logger, LOGGER_ERR, "mp4_recorder could not finish writing %s", recorder->filename);
+    }
+    mp4_recorder_get_stats(recorder, &stats);
+    if (stats.bytes == 0) {
+        // A session that never sent a frame leaves no file behind
+        unlink(recorder->filename);
+    } else {
+        logger_log(recorder->logger, LOGGER_INFO,
+                   "mp4_recorder wrote %llu video and %llu audio frames in %llu fragments, %llu bytes",
+                   (unsigned long long) stats.video_frames, (unsigned long long) stats.audio_frames,
+                   (unsigned long long) stats.fragments, (unsigned long long) stats.bytes);
+    }
+
+    free(recorder->video.samples.data);
+    free(recorder->video.mdat.data);
+    free(recorder->audio.samples.data);
+    free(recorder->audio.mdat.data);
+    free(recorder->box.data);
+    ALIGNED_FREE(recorder->out);
+    free(recorder->filename);
+    free(recorder);
+}
@@ -0,0 +1,47 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#ifndef MP4_RECORDER_H
+#define MP4_RECORDER_H
+
+#include <stdint.h>
+#include "logger.h"
+#include "frame_bus.h"
+
+/*
+ * Records a session to fragmented MP4 without transcoding: the H.264 access
+ * units as the mirror stage decrypts them and the AAC-ELD frames as they go
+ * to playout. The avcC comes from the codec packet and the audio
+ * configuration is the fixed 44.1 kHz stereo ELD one AirPlay uses.
+ *
+ * The recorder writes on the calling thread, in large aligned blocks. It is
+ * meant to subscribe to the session's frame_bus, which keeps the disk away
+ * from the receive threads and drops frames if the recorder falls behind.
+ */
+
+typedef struct mp4_recorder_s mp4_recorder_t;
+
+typedef struct {
+    uint64_t video_frames;
+    uint64_t audio_frames;
+    uint64_t fragments;
+    uint64_t bytes;
+} mp4_recorder_stats_t;
+
+mp4_recorder_t *mp4_recorder_open(logger_t *logger, const char *filename);
+/* Takes a codec, video or audio frame */
+void mp4_recorder_write_frame(mp4_recorder_t *recorder, const frame_bus_frame_t *frame);
+void mp4_recorder_get_stats(mp4_recorder_t *recorder, mp4_recorder_stats_t *stats);
+/* Writes out the last fragments and closes the file */
+void mp4_recorder_close(mp4_recorder_t *recorder);
+
+#endif //MP4_RECORDER_H
@@ -13,10 +13,23 @@
  */
 
 #include <stdlib.h>
+#include <stdio.h>
 #include <string.h>
 #include <assert.h>
 
 #include "compat.h"
+#include "netutils.h"
+#include "raop_ntp.h"
+#ifndef WIN32
+#include <netinet/tcp.h>
+#include <ifaddrs.h>
+#endif
+#if defined(__linux__)
+#include <linux/net_tstamp.h>
+#endif
+
+/* Written before any socket is created and only read afterwards */
+static netutils_tuning_t netutils_tuning = { 0, 0, 1, 0, 0xb8 };
 
 int
 netutils_init()
@@ -201,3 +214,287 @@ netutils_parse_address(int family, const char *src, void *dst, int dstlen)
     freeaddrinfo(result);
     return length;
 }
+
+int
+netutils_parse_remote(const unsigned char *remote, int remotelen, unsigned int scope_id, void *dst)
+{
+    struct sockaddr_storage *saddr = dst;
+
+    assert(saddr);
+
+    memset(saddr, 0, sizeof(*saddr));
+    if (remotelen == 4) {
+        struct sockaddr_in *sin = (struct sockaddr_in *) saddr;
+        sin->sin_family = AF_INET;
+        memcpy(&sin->sin_addr.s_addr, remote, 4);
+        return sizeof(*sin);
+    } else if (remotelen == 16) {
+        struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *) saddr;
+        sin6->sin6_family = AF_INET6;
+        memcpy(sin6->sin6_addr.s6_addr, remote, 16);
+        /* Without it sends to fe80:: addresses fail, they are the same on every link */
+        if (IN6_IS_ADDR_LINKLOCAL(&sin6->sin6_addr)) {
+            sin6->sin6_scope_id = scope_id;
+        }
+        return sizeof(*sin6);
+    }
+    return -1;
+}
+
+unsigned int
+netutils_get_scope_id(const unsigned char *local, int locallen)
+{
+    unsigned int scope_id = 0;
+#ifndef WIN32
+    struct ifaddrs *ifaddrs;
+    struct in6_addr addr;
+
+    if (locallen != 16) {
+        return 0;
+    }
+    memcpy(addr.s6_addr, local, 16);
+    if (!IN6_IS_ADDR_LINKLOCAL(&addr) || getifaddrs(&ifaddrs) < 0) {
+        return 0;
+    }
+    for (struct ifaddrs *ifa = ifaddrs; ifa; ifa = ifa->ifa_next) {
+        struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *) ifa->ifa_addr;
+        if (sin6 && sin6->sin6_family == AF_INET6 && IN6_ARE_ADDR_EQUAL(&sin6->sin6_addr, &addr)) {
+            scope_id = sin6->sin6_scope_id;
+            break;
+        }
+    }
+    freeifaddrs(ifaddrs);
+#endif
+    return scope_id;
+}
+
+void
+netutils_set_port(void *sockaddr, unsigned short port)
+{
+    struct sockaddr *address = sockaddr;
+
+    if (address->sa_family == AF_INET6) {
+        ((struct sockaddr_in6 *) address)->sin6_port = htons(port);
+    } else {
+        ((struct sockaddr_in *) address)->sin_port = htons(port);
+    }
+}
+
+int
+netutils_same_host(void *sockaddr1, void *sockaddr2)
+{
+    unsigned char *address1, *address2;
+    int length1, length2;
+
+    address1 = netutils_get_address(sockaddr1, &length1);
+    address2 = netutils_get_address(sockaddr2, &length2);
+    return address1 && address2 && length1 == length2 && !memcmp(address1, address2, length1);
+}
+
+void
+netutils_set_tuning(const netutils_tuning_t *tuning)
+{
+    netutils_tuning = *tuning;
+}
+
+int
+netutils_tuning_parse(const char *spec)
+{
+    netutils_tuning_t tuning = netutils_tuning;
+    const char *p = spec;
+
+    while (*p) {
+        size_t len = strcspn(p, "=");
+        char *end;
+        long value;
+
+        if (p[len] != '=') {
+            return -1;
+        }
+        value = strtol(p + len + 1, &end, 0);
+        if (end == p + len + 1 || (*end && *end != ',')) {
+            return -1;
+        }
+        if (len == 13 && !strncmp(p, "mirror-rcvbuf", len) && value >= 0 && value <= 65536) {
+            tuning.mirror_rcvbuf = value * 1024;
+        } else if (len == 12 && !strncmp(p, "audio-rcvbuf", len) && value >= 0 && value <= 65536) {
+            tuning.audio_rcvbuf = value * 1024;
+        } else if (len == 8 && !strncmp(p, "quickack", len) && (value == 0 || value == 1)) {
+            tuning.quickack = value;
+        } else if (len == 9 && !strncmp(p, "busy-poll", len) && value >= 0 && value <= 1000000) {
+            tuning.busy_poll = value;
+        } else if (len == 10 && !strncmp(p, "timing-tos", len) && value >= -1 && value <= 255) {
+            tuning.timing_tos = value;
+        } else {
+            return -1;
+        }
+        p = *end ? end + 1 : end;
+    }
+    netutils_set_tuning(&tuning);
+    return 0;
+}
+
+/* Reads back an int option, 0 if the socket doesn't have it */
+static int
+netutils_get_option(int fd, int level, int option)
+{
+    int value = 0;
+    socklen_t len = sizeof(value);
+
+    if (getsockopt(fd, level, option, (char *) &value, &len) < 0) {
+        return 0;
+    }
+    return value;
+}
+
+void
+netutils_tune_socket(logger_t *logger, int fd, netutils_socket_role_t role, const char *name)
+{
+    char applied[128];
+    int rcvbuf = role == NETUTILS_SOCKET_MIRROR ? netutils_tuning.mirror_rcvbuf :
+                 role == NETUTILS_SOCKET_AUDIO ? netutils_tuning.audio_rcvbuf : 0;
+    int type = netutils_get_option(fd, SOL_SOCKET, SO_TYPE);
+    int tos_level = IPPROTO_IP, tos_option = IP_TOS;
+    struct sockaddr_storage saddr;
+    socklen_t saddrlen = sizeof(saddr);
+    int pos;
+
+#if defined(IPV6_TCLASS)
+    if (!getsockname(fd, (struct sockaddr *) &saddr, &saddrlen) && saddr.ss_family == AF_INET6) {
+        tos_level = IPPROTO_IPV6;
+        tos_option = IPV6_TCLASS;
+    }
+#endif
+
+    if (rcvbuf > 0) {
+        // Beyond net.core.rmem_max only with CAP_NET_ADMIN, SO_RCVBUF silently caps it
+#if defined(SO_RCVBUFFORCE)
+        if (setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, (char *) &rcvbuf, sizeof(rcvbuf)) < 0)
+#endif
+        if (setsockopt(fd, SOL_SOCKET, SO_RCVBUF, (char *) &rcvbuf, sizeof(rcvbuf)) < 0) {
+            logger_log(logger, LOGGER_WARNING, "%s could not set receive buffer: %s", name, strerror(errno));
+        }
+    }
+#if defined(SO_BUSY_POLL)
+    if (role != NETUTILS_SOCKET_TIMING && netutils_tuning.busy_poll > 0 &&
+        setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &netutils_tuning.busy_poll, sizeof(int)) < 0) {
+        logger_log(logger, LOGGER_WARNING, "%s could not set busy polling, above net.core.busy_read "
+                   "it needs CAP_NET_ADMIN: %s", name, strerror(errno));
+    }
+#endif
+    if (role == NETUTILS_SOCKET_MIRROR && type == SOCK_STREAM) {
+        netutils_rearm_quickack(fd);
+    }
+    if (role == NETUTILS_SOCKET_TIMING && netutils_tuning.timing_tos >= 0 &&
+        setsockopt(fd, tos_level, tos_option, (char *) &netutils_tuning.timing_tos, sizeof(int)) < 0) {
+        logger_log(logger, LOGGER_WARNING, "%s could not mark its packets: %s", name, strerror(errno));
+    }
+
+    // What the kernel made of it, Linux reports twice the receive buffer asked for
+    pos = snprintf(applied, sizeof(applied), "receive buffer %d KB%s",
+                   netutils_get_option(fd, SOL_SOCKET, SO_RCVBUF) / 1024, rcvbuf > 0 ? "" : " (system)");
+#if defined(SO_BUSY_POLL)
+    if (role != NETUTILS_SOCKET_TIMING) {
+        pos += snprintf(applied + pos, sizeof(applied) - pos, ", busy poll %d us",
+                        netutils_get_option(fd, SOL_SOCKET, SO_BUSY_POLL));
+    }
+#endif
+    if (role == NETUTILS_SOCKET_MIRROR && type == SOCK_STREAM) {
+        pos += snprintf(applied + pos, sizeof(applied) - pos, ", quickack %s", netutils_tuning.quickack ? "on" : "off");
+    }
+    if (role == NETUTILS_SOCKET_TIMING) {
+        pos += snprintf(applied + pos, sizeof(applied) - pos, ", tos 0x%02x",
+                        netutils_get_option(fd, tos_level, tos_option));
+    }
+    logger_log(logger, LOGGER_INFO, "%s socket: %s", name, applied);
+}
+
+void
+netutils_rearm_quickack(int fd)
+{
+#if defined(TCP_QUICKACK)
+    int option = 1;
+
+    if (netutils_tuning.quickack) {
+        setsockopt(fd, IPPROTO_TCP, TCP_QUICKACK, &option, sizeof(option));
+    }
+#endif
+}
+
+int
+netutils_enable_timestamps(int fd)
+{
+#if defined(SO_TIMESTAMPNS)
+    int option = 1;
+
+    return setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &option, sizeof(option));
+#else
+    return -1;
+#endif
+}
+
+int
+netutils_enable_send_timestamps(int fd)
+{
+#if defined(SO_TIMESTAMPING)
+    /* Software stamps only: the NIC's own are on its clock, not on the wall clock the others are on */
+    int option = SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_RX_SOFTWARE |
+                 SOF_TIMESTAMPING_SOFTWARE | SOF_TIMESTAMPING_OPT_TSONLY;
+
+    return setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPING, &option, sizeof(option));
+#else
+    return -1;
+#endif
+}
+
+uint64_t
+netutils_get_timestamp(struct msghdr *msg)
+{
+#if defined(SO_TIMESTAMPNS)
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+            struct timespec time;
+            memcpy(&time, CMSG_DATA(cmsg), sizeof(time));
+            /* The kernel stamps with the wall clock */
+            return raop_ntp_convert_wall_time((uint64_t) time.tv_sec * 1000000 + time.tv_nsec / 1000);
+        }
+#if defined(SO_TIMESTAMPING)
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPING) {
+            /* Software, legacy and hardware stamp, only the first one is asked for */
+            struct timespec time[3];
+            memcpy(time, CMSG_DATA(cmsg), sizeof(time));
+            if (time[0].tv_sec || time[0].tv_nsec) {
+                return raop_ntp_convert_wall_time((uint64_t) time[0].tv_sec * 1000000 + time[0].tv_nsec / 1000);
+            }
+        }
+#endif
+    }
+#endif
+    return 0;
+}
+
+uint64_t
+netutils_get_send_timestamp(int fd)
+{
+#if defined(SO_TIMESTAMPING)
+    unsigned char control[NETUTILS_TIMESTAMP_CONTROL_SIZE];
+    struct msghdr msg;
+    uint64_t time = 0;
+
+    /* The stamps are queued on the error queue as the packets leave, for software stamps
+     * usually before sendto returns. Left there they would keep the socket signalling an error */
+    while (1) {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+            break;
+        }
+        uint64_t stamp = netutils_get_timestamp(&msg);
+        if (stamp) time = stamp;
+    }
+    return time;
+#else
+    return 0;
+#endif
+}
@@ -15,11 +15,81 @@
 #ifndef NETUTILS_H
 #define NETUTILS_H
 
+#include <stdint.h>
+#include "logger.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Control space a message needs for its receive timestamp */
+#define NETUTILS_TIMESTAMP_CONTROL_SIZE 64
+
+struct msghdr;
+
+typedef enum {
+    /* Mirror stream, TCP or UDP */
+    NETUTILS_SOCKET_MIRROR,
+    /* Audio data and control */
+    NETUTILS_SOCKET_AUDIO,
+    /* NTP or PTP timing */
+    NETUTILS_SOCKET_TIMING
+} netutils_socket_role_t;
+
+/*
+ * Options the receiving sockets are given, set once before the server is started.
+ * The defaults mark timing packets for expedited forwarding and acknowledge the
+ * mirror stream right away, and keep the system's receive buffers and busy polling.
+ */
+typedef struct {
+    /* SO_RCVBUF in bytes, 0 keeps the system's, which for TCP grows on its own up to tcp_rmem */
+    int mirror_rcvbuf;
+    int audio_rcvbuf;
+    /* Acknowledge the mirror stream without delay, so the sender's congestion window opens faster */
+    int quickack;
+    /* SO_BUSY_POLL of the mirror and audio sockets in us, 0 is off */
+    int busy_poll;
+    /* IP TOS byte or IPv6 traffic class of the timing packets, e.g. 0xb8 for DSCP EF, -1 keeps the system's */
+    int timing_tos;
+} netutils_tuning_t;
+
 int netutils_init();
 void netutils_cleanup();
 
 int netutils_init_socket(unsigned short *port, int use_ipv6, int use_udp);
 unsigned char *netutils_get_address(void *sockaddr, int *length);
 int netutils_parse_address(int family, const char *src, void *dst, int dstlen);
+/* Fills the sockaddr_storage at dst with the 4 or 16 address bytes netutils_get_address gave for a peer,
+ * returns its length or -1. scope_id only applies to IPv6 link-local addresses, see netutils_get_scope_id */
+int netutils_parse_remote(const unsigned char *remote, int remotelen, unsigned int scope_id, void *dst);
+/* The interface a link-local IPv6 address of this host is on, for reaching peers from it, or 0 */
+unsigned int netutils_get_scope_id(const unsigned char *local, int locallen);
+void netutils_set_port(void *sockaddr, unsigned short port);
+/* Whether two addresses are of the same host, ignoring ports; IPv4-mapped IPv6 addresses match IPv4 ones */
+int netutils_same_host(void *sockaddr1, void *sockaddr2);
+
+void netutils_set_tuning(const netutils_tuning_t *tuning);
+/* Parses key=value[,key=value...] with keys mirror-rcvbuf and audio-rcvbuf in KB,
+ * quickack 0 or 1, busy-poll in us and timing-tos, returns -1 if it can't */
+int netutils_tuning_parse(const char *spec);
+/* Applies the tuning of role to fd and logs the values the socket ends up with */
+void netutils_tune_socket(logger_t *logger, int fd, netutils_socket_role_t role, const char *name);
+/* Quick ack mode ends on its own, a mirror stream socket gets it back after every frame */
+void netutils_rearm_quickack(int fd);
+/* Has the kernel stamp the time each packet reaches fd, returns -1 where it can't */
+int netutils_enable_timestamps(int fd);
+/* The time the kernel received a message read by recvmsg with its control, in us of the same
+ * clock as raop_ntp_get_local_time, or 0 if it carries none. For TCP it's the last segment read. */
+uint64_t netutils_get_timestamp(struct msghdr *msg);
+/* Has the kernel stamp the time each packet sent on fd leaves, and those it receives, in place of
+ * netutils_enable_timestamps. Returns -1 where it can't */
+int netutils_enable_send_timestamps(int fd);
+/* The time the last packet sent on fd left, as netutils_get_timestamp, or 0 if it has no stamp (yet).
+ * Takes all stamps queued on fd */
+uint64_t netutils_get_send_timestamp(int fd);
+
+#ifdef __cplusplus
+}
+#endif
 
 #endif
@@ -16,17 +16,40 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
 
 #include <openssl/sha.h> // for SHA512_DIGEST_LENGTH
 
 #include "pairing.h"
 #include "crypto.h"
+#include "threads.h"
+#include "thread_attr.h"
 
 #define SALT_KEY "Pair-Verify-AES-Key"
 #define SALT_IV "Pair-Verify-AES-IV"
 
+/* Ephemeral ECDH keys generated ahead, enough for a few senders connecting at once */
+#define PAIRING_KEY_POOL_SIZE 4
+
 struct pairing_s {
     ed25519_key_t *ed;
+
+    /* Filled by the pool thread once pairing_start_key_pool was called, protected by pool_mutex.
+     * Every key is handed out once and only lives until its pair-verify */
+    logger_t *logger;
+    mutex_handle_t pool_mutex;
+    cond_handle_t pool_cond;
+    x25519_key_t *pool[PAIRING_KEY_POOL_SIZE];
+    int pool_count;
+    int pool_running;
+    thread_handle_t pool_thread;
+    uint64_t pool_hits;
+    uint64_t pool_misses;
 };
 
 typedef enum {
@@ -38,6 +61,7 @@ typedef enum {
 
 struct pairing_session_s {
     status_t status;
+    pairing_t *pairing;
 
     ed25519_key_t *ed_ours;
     ed25519_key_t *ed_theirs;
@@ -66,12 +90,26 @@ derive_key_internal(pairing_session_t *session, const unsigned char *salt, unsig
     return 0;
 }
 
+static pairing_t *
+pairing_alloc(void)
+{
+    pairing_t *pairing;
+
+    pairing = calloc(1, sizeof(pairing_t));
+    if (!pairing) {
+        return NULL;
+    }
+    MUTEX_CREATE(pairing->pool_mutex);
+    COND_CREATE(pairing->pool_cond);
+    return pairing;
+}
+
 pairing_t *
 pairing_init_generate()
 {
     pairing_t *pairing;
 
-    pairing = calloc(1, sizeof(pairing_t));
+    pairing = pairing_alloc();
     if (!pairing) {
         return NULL;
     }
@@ -81,6 +119,131 @@ pairing_init_generate()
     return pairing;
 }
 
+/*
+ * Uses the Ed25519 identity stored in keyfile as its 32 byte private key,
+ * or generates one and saves it there when the file does not exist yet.
+ * Returns NULL if the file is unreadable, malformed or cannot be written.
+ */
+pairing_t *
+pairing_init_load(const char *keyfile)
+{
+    pairing_t *pairing;
+    unsigned char raw[ED25519_KEY_SIZE + 1];
+    FILE *file;
+    size_t len;
+    int fd;
+
+    assert(keyfile);
+
+    file = fopen(keyfile, "rb");
+    if (file) {
+        len = fread(raw, 1, sizeof(raw), file);
+        fclose(file);
+        if (len != ED25519_KEY_SIZE) {
+            return NULL;
+        }
+
+        pairing = pairing_alloc();
+        if (!pairing) {
+            return NULL;
+        }
+        pairing->ed = ed25519_key_from_private_raw(raw);
+        memset(raw, 0, sizeof(raw));
+        return pairing;
+    }
+
+    pairing = pairing_init_generate();
+    if (!pairing) {
+        return NULL;
+    }
+
+    /* Readable by the owner only */
+    fd = open(keyfile, O_WRONLY | O_CREAT | O_EXCL, 0600);
+    if (fd == -1) {
+        pairing_destroy(pairing);
+        return NULL;
+    }
+    ed25519_key_get_private_raw(raw, pairing->ed);
+    len = write(fd, raw, ED25519_KEY_SIZE);
+    memset(raw, 0, sizeof(raw));
+    if (close(fd) == -1 || len != ED25519_KEY_SIZE) {
+        unlink(keyfile);
+        pairing_destroy(pairing);
+        return NULL;
+    }
+    return pairing;
+}
+
+static THREAD_RETVAL
+pairing_pool_thread(void *arg)
+{
+    pairing_t *pairing = arg;
+
+    thread_attr_apply(pairing->logger, THREAD_ROLE_NONE, "rp-pairkeys");
+#if defined(__linux__)
+    // Only this thread, it refills the pool between handshakes and must not compete with streaming
+    setpriority(PRIO_PROCESS, (id_t) syscall(SYS_gettid), 19);
+#endif
+
+    MUTEX_LOCK(pairing->pool_mutex);
+    while (pairing->pool_running) {
+        if (pairing->pool_count == PAIRING_KEY_POOL_SIZE) {
+            COND_WAIT(pairing->pool_cond, pairing->pool_mutex);
+            continue;
+        }
+        MUTEX_UNLOCK(pairing->pool_mutex);
+        x25519_key_t *key = x25519_key_generate();
+        MUTEX_LOCK(pairing->pool_mutex);
+        if (!key) {
+            logger_log(pairing->logger, LOGGER_ERR, "Could not generate an ECDH key for the pool");
+            break;
+        }
+        pairing->pool[pairing->pool_count++] = key;
+    }
+    MUTEX_UNLOCK(pairing->pool_mutex);
+    return 0;
+}
+
+/*
+ * Generates ephemeral ECDH keys on a thread of the lowest priority from now on, so a
+ * pair-verify only takes one. Without it, or while the pool is empty, they are made on the spot.
+ */
+int
+pairing_start_key_pool(pairing_t *pairing, logger_t *logger)
+{
+    assert(pairing);
+    assert(logger);
+
+    MUTEX_LOCK(pairing->pool_mutex);
+    if (pairing->pool_running) {
+        MUTEX_UNLOCK(pairing->pool_mutex);
+        return 0;
+    }
+    pairing->logger = logger;
+    pairing->pool_running = 1;
+    THREAD_CREATE(pairing->pool_thread, pairing_pool_thread, pairing);
+    MUTEX_UNLOCK(pairing->pool_mutex);
+    return 0;
+}
+
+static x25519_key_t *
+pairing_take_ecdh_key(pairing_t *pairing)
+{
+    x25519_key_t *key = NULL;
+
+    MUTEX_LOCK(pairing->pool_mutex);
+    if (pairing->pool_count > 0) {
+        key = pairing->pool[--pairing->pool_count];
+        pairing->pool[pairing->pool_count] = NULL;
+        pairing->pool_hits++;
+        COND_SIGNAL(pairing->pool_cond);
+    } else {
+        pairing->pool_misses++;
+    }
+    MUTEX_UNLOCK(pairing->pool_mutex);
+    return key ? key : x25519_key_generate();
+}
+
 void
 pairing_get_public_key(pairing_t *pairing, unsigned char public_key[ED25519_KEY_SIZE])
 {
@@ -110,6 +273,7 @@ pairing_session_init(pairing_t *pairing)
         return NULL;
     }
 
+    session->pairing = pairing;
     session->ed_ours = ed25519_key_copy(pairing->ed);
 
     session->status = STATUS_INITIAL;
@@ -144,10 +308,13 @@ pairing_session_handshake(pairing_session_t *session, const unsigned char ecdh_k
         return -1;
     }
 
+    x25519_key_destroy(session->ecdh_theirs);
+    ed25519_key_destroy(session->ed_theirs);
+    x25519_key_destroy(session->ecdh_ours);
     session->ecdh_theirs = x25519_key_from_raw(ecdh_key);
     session->ed_theirs = ed25519_key_from_raw(ed_key);
 
-    session->ecdh_ours = x25519_key_generate();
+    session->ecdh_ours = pairing_take_ecdh_key(session->pairing);
 
     x25519_derive_secret(session->ecdh_secret, session->ecdh_ours, session->ecdh_theirs);
 
@@ -237,6 +404,80 @@ pairing_session_finish(pairing_session_t *session, const unsigned char signature
     return 0;
 }
 
+/*
+ * Sender side of pair-verify: creates our ECDH key, whose public half goes to
+ * the receiver in the first pair-verify request together with our Ed25519 key.
+ */
+int
+pairing_session_client_start(pairing_session_t *session, unsigned char ecdh_key[X25519_KEY_SIZE])
+{
+    assert(session);
+
+    if (session->status == STATUS_FINISHED) {
+        return -1;
+    }
+
+    x25519_key_destroy(session->ecdh_ours);
+    session->ecdh_ours = pairing_take_ecdh_key(session->pairing);
+    x25519_key_get_raw(ecdh_key, session->ecdh_ours);
+
+    session->status = STATUS_HANDSHAKE;
+    return 0;
+}
+
+/*
+ * Sender side of pair-verify: checks the receiver's answer to the first request
+ * and produces the encrypted signature for the second one.
+ */
+int
+pairing_session_client_verify(pairing_session_t *session, const unsigned char ecdh_key[X25519_KEY_SIZE],
+                              const unsigned char ed_key[ED25519_KEY_SIZE],
+                              const unsigned char signature[PAIRING_SIG_SIZE],
+                              unsigned char response[PAIRING_SIG_SIZE])
+{
+    unsigned char sig_buffer[PAIRING_SIG_SIZE];
+    unsigned char sig_msg[PAIRING_SIG_SIZE];
+    unsigned char key[AES_128_BLOCK_SIZE];
+    unsigned char iv[AES_128_BLOCK_SIZE];
+    aes_ctx_t *aes_ctx;
+
+    assert(session);
+
+    if (session->status != STATUS_HANDSHAKE) {
+        return -1;
+    }
+
+    session->ecdh_theirs = x25519_key_from_raw(ecdh_key);
+    session->ed_theirs = ed25519_key_from_raw(ed_key);
+    x25519_derive_secret(session->ecdh_secret, session->ecdh_ours, session->ecdh_theirs);
+
+    derive_key_internal(session, (const unsigned char *) SALT_KEY, strlen(SALT_KEY), key, sizeof(key));
+    derive_key_internal(session, (const unsigned char *) SALT_IV, strlen(SALT_IV), iv, sizeof(iv));
+
+    /* The receiver signed its own ECDH key followed by ours */
+    aes_ctx = aes_ctr_init(key, iv);
+    aes_ctr_decrypt(aes_ctx, signature, sig_buffer, PAIRING_SIG_SIZE);
+
+    x25519_key_get_raw(sig_msg, session->ecdh_theirs);
+    x25519_key_get_raw(sig_msg + X25519_KEY_SIZE, session->ecdh_ours);
+
+    if (!ed25519_verify(sig_buffer, PAIRING_SIG_SIZE, sig_msg, PAIRING_SIG_SIZE, session->ed_theirs)) {
+        aes_ctr_destroy(aes_ctx);
+        return -2;
+    }
+
+    /* Our signature continues the same keystream */
+    x25519_key_get_raw(sig_msg, session->ecdh_ours);
+    x25519_key_get_raw(sig_msg + X25519_KEY_SIZE, session->ecdh_theirs);
+
+    ed25519_sign(response, PAIRING_SIG_SIZE, sig_msg, PAIRING_SIG_SIZE, session->ed_ours);
+    aes_ctr_encrypt(aes_ctx, response, response, PAIRING_SIG_SIZE);
+    aes_ctr_destroy(aes_ctx);
+
+    session->status = STATUS_FINISHED;
+    return 0;
+}
+
 void
 pairing_session_destroy(pairing_session_t *session)
 {
@@ -255,6 +496,21 @@ void
 pairing_destroy(pairing_t *pairing)
 {
     if (pairing) {
+        MUTEX_LOCK(pairing->pool_mutex);
+        int running = pairing->pool_running;
+        pairing->pool_running = 0;
+        COND_SIGNAL(pairing->pool_cond);
+        MUTEX_UNLOCK(pairing->pool_mutex);
+        if (running) {
+            THREAD_JOIN(pairing->pool_thread);
+            logger_log(pairing->logger, LOGGER_DEBUG, "pair-verify took %llu ECDH keys from the pool, generated %llu",
+                       (unsigned long long) pairing->pool_hits, (unsigned long long) pairing->pool_misses);
+        }
+        for (int i = 0; i < pairing->pool_count; i++) {
+            x25519_key_destroy(pairing->pool[i]);
+        }
+        COND_DESTROY(pairing->pool_cond);
+        MUTEX_DESTROY(pairing->pool_mutex);
         ed25519_key_destroy(pairing->ed);
         free(pairing);
     }
@@ -14,6 +14,7 @@
  */
 
 #include "crypto.h"
+#include "logger.h"
 
 #ifndef PAIRING_H
 #define PAIRING_H
@@ -24,7 +25,10 @@ typedef struct pairing_s pairing_t;
 typedef struct pairing_session_s pairing_session_t;
 
 pairing_t *pairing_init_generate();
+pairing_t *pairing_init_load(const char *keyfile);
 void pairing_get_public_key(pairing_t *pairing, unsigned char public_key[ED25519_KEY_SIZE]);
+/* Generates the ephemeral keys of pair-verify ahead on a background thread, until pairing_destroy */
+int pairing_start_key_pool(pairing_t *pairing, logger_t *logger);
 
 pairing_session_t *pairing_session_init(pairing_t *pairing);
 void pairing_session_set_setup_status(pairing_session_t *session);
@@ -34,6 +38,12 @@ int pairing_session_handshake(pairing_session_t *session, const unsigned char ec
 int pairing_session_get_public_key(pairing_session_t *session, unsigned char ecdh_key[X25519_KEY_SIZE]);
 int pairing_session_get_signature(pairing_session_t *session, unsigned char signature[PAIRING_SIG_SIZE]);
 int pairing_session_finish(pairing_session_t *session, const unsigned char signature[PAIRING_SIG_SIZE]);
+/* Sender side of pair-verify, for clients such as load generators */
+int pairing_session_client_start(pairing_session_t *session, unsigned char ecdh_key[X25519_KEY_SIZE]);
+int pairing_session_client_verify(pairing_session_t *session, const unsigned char ecdh_key[X25519_KEY_SIZE],
+                                  const unsigned char ed_key[ED25519_KEY_SIZE],
+                                  const unsigned char signature[PAIRING_SIG_SIZE],
+                                  unsigned char response[PAIRING_SIG_SIZE]);
 void pairing_session_destroy(pairing_session_t *session);
 
 void pairing_destroy(pairing_t *pairing);
@@ -1,5 +1,4 @@
 #include <stdint.h>
-#include <math.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <assert.h>
@@ -11,6 +10,30 @@ int shift[] = {7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
                4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
                6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21};
 
+// (1 << 32) * fabs(sin(i + 1)), the usual MD5 constants, so they need not be recomputed every round
+static const uint32_t sin_table[64] = {0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee,
+                                       0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+                                       0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be,
+                                       0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+                                       0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa,
+                                       0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+                                       0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed,
+                                       0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+                                       0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c,
+                                       0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+                                       0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05,
+                                       0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+                                       0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039,
+                                       0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+                                       0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1,
+                                       0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391};
+
+// Message word used by each round
+static const unsigned char word_index[64] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+                                             1, 6, 11, 0, 5, 10, 15, 4, 9, 14, 3, 8, 13, 2, 7, 12,
+                                             5, 8, 11, 14, 1, 4, 7, 10, 13, 0, 3, 6, 9, 12, 15, 2,
+                                             0, 7, 14, 5, 12, 3, 10, 1, 8, 15, 6, 13, 4, 11, 2, 9};
+
 uint32_t F(uint32_t B, uint32_t C, uint32_t D)
 {
    return (B & C) | (~B & D);
@@ -64,19 +87,11 @@ void modified_md5(unsigned char* originalblockIn, unsigned char* keyIn, unsigned
    for (i = 0; i < 64; i++)
    {
       uint32_t input;
-      int j;
-      if (i < 16)
-         j = i;
-      else if (i < 32)
-         j = (5*i + 1) % 16;
-      else if (i < 48)
-         j = (3*i + 5) % 16;
-      else if (i < 64)
-         j = 7*i % 16;
+      int j = word_index[i];
 
       input = blockIn[4*j] << 24 | blockIn[4*j+1] << 16 | blockIn[4*j+2] << 8 | blockIn[4*j+3];
       printf("Key = %08x\n", A);
-      Z = A + input + (int)(long long)((1LL << 32) * fabs(sin(i + 1)));
+      Z = A + input + sin_table[i];
       if (i < 16)
          Z = rol(Z + F(B,C,D), shift[i]);
       else if (i < 32)
@@ -87,7 +102,7 @@ void modified_md5(unsigned char* originalblockIn, unsigned char* keyIn, unsigned
          Z = rol(Z + I(B,C,D), shift[i]);
       if (i == 63)
          printf("Ror is %08x\n", Z);
-      printf("Output of round %d: %08X + %08X = %08X (shift %d, constant %08X)\n", i, Z, B, Z+B, shift[i], (int)(long long)((1LL << 32) * fabs(sin(i + 1))));
+      printf("Output of round %d: %08X + %08X = %08X (shift %d, constant %08X)\n", i, Z, B, Z+B, shift[i], sin_table[i]);
       Z = Z + B;
       tmp = D;
       D = C;
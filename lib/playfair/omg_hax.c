@@ -51,9 +51,36 @@ unsigned char* table_index(int i)
    return &table_s1[((31*i) % 0x28) << 8];
 }
 
+// Offsets of the 256 byte tables picked by message_table_index() and permute_table_2(), so the
+// rounds do not need a multiply and modulo per byte
+static const uint16_t message_table_offset[144] = {0x0000, 0x6100, 0x3200, 0x0300, 0x6400, 0x3500, 0x0600, 0x6700, 0x3800, 0x0900, 0x6a00, 0x3b00,
+                                                   0x0c00, 0x6d00, 0x3e00, 0x0f00, 0x7000, 0x4100, 0x1200, 0x7300, 0x4400, 0x1500, 0x7600, 0x4700,
+                                                   0x1800, 0x7900, 0x4a00, 0x1b00, 0x7c00, 0x4d00, 0x1e00, 0x7f00, 0x5000, 0x2100, 0x8200, 0x5300,
+                                                   0x2400, 0x8500, 0x5600, 0x2700, 0x8800, 0x5900, 0x2a00, 0x8b00, 0x5c00, 0x2d00, 0x8e00, 0x5f00,
+                                                   0x3000, 0x0100, 0x6200, 0x3300, 0x0400, 0x6500, 0x3600, 0x0700, 0x6800, 0x3900, 0x0a00, 0x6b00,
+                                                   0x3c00, 0x0d00, 0x6e00, 0x3f00, 0x1000, 0x7100, 0x4200, 0x1300, 0x7400, 0x4500, 0x1600, 0x7700,
+                                                   0x4800, 0x1900, 0x7a00, 0x4b00, 0x1c00, 0x7d00, 0x4e00, 0x1f00, 0x8000, 0x5100, 0x2200, 0x8300,
+                                                   0x5400, 0x2500, 0x8600, 0x5700, 0x2800, 0x8900, 0x5a00, 0x2b00, 0x8c00, 0x5d00, 0x2e00, 0x8f00,
+                                                   0x6000, 0x3100, 0x0200, 0x6300, 0x3400, 0x0500, 0x6600, 0x3700, 0x0800, 0x6900, 0x3a00, 0x0b00,
+                                                   0x6c00, 0x3d00, 0x0e00, 0x6f00, 0x4000, 0x1100, 0x7200, 0x4300, 0x1400, 0x7500, 0x4600, 0x1700,
+                                                   0x7800, 0x4900, 0x1a00, 0x7b00, 0x4c00, 0x1d00, 0x7e00, 0x4f00, 0x2000, 0x8100, 0x5200, 0x2300,
+                                                   0x8400, 0x5500, 0x2600, 0x8700, 0x5800, 0x2900, 0x8a00, 0x5b00, 0x2c00, 0x8d00, 0x5e00, 0x2f00};
+static const uint16_t permute_table_offset[144] = {0x0000, 0x4700, 0x8e00, 0x4500, 0x8c00, 0x4300, 0x8a00, 0x4100, 0x8800, 0x3f00, 0x8600, 0x3d00,
+                                                   0x8400, 0x3b00, 0x8200, 0x3900, 0x8000, 0x3700, 0x7e00, 0x3500, 0x7c00, 0x3300, 0x7a00, 0x3100,
+                                                   0x7800, 0x2f00, 0x7600, 0x2d00, 0x7400, 0x2b00, 0x7200, 0x2900, 0x7000, 0x2700, 0x6e00, 0x2500,
+                                                   0x6c00, 0x2300, 0x6a00, 0x2100, 0x6800, 0x1f00, 0x6600, 0x1d00, 0x6400, 0x1b00, 0x6200, 0x1900,
+                                                   0x6000, 0x1700, 0x5e00, 0x1500, 0x5c00, 0x1300, 0x5a00, 0x1100, 0x5800, 0x0f00, 0x5600, 0x0d00,
+                                                   0x5400, 0x0b00, 0x5200, 0x0900, 0x5000, 0x0700, 0x4e00, 0x0500, 0x4c00, 0x0300, 0x4a00, 0x0100,
+                                                   0x4800, 0x8f00, 0x4600, 0x8d00, 0x4400, 0x8b00, 0x4200, 0x8900, 0x4000, 0x8700, 0x3e00, 0x8500,
+                                                   0x3c00, 0x8300, 0x3a00, 0x8100, 0x3800, 0x7f00, 0x3600, 0x7d00, 0x3400, 0x7b00, 0x3200, 0x7900,
+                                                   0x3000, 0x7700, 0x2e00, 0x7500, 0x2c00, 0x7300, 0x2a00, 0x7100, 0x2800, 0x6f00, 0x2600, 0x6d00,
+                                                   0x2400, 0x6b00, 0x2200, 0x6900, 0x2000, 0x6700, 0x1e00, 0x6500, 0x1c00, 0x6300, 0x1a00, 0x6100,
+                                                   0x1800, 0x5f00, 0x1600, 0x5d00, 0x1400, 0x5b00, 0x1200, 0x5900, 0x1000, 0x5700, 0x0e00, 0x5500,
+                                                   0x0c00, 0x5300, 0x0a00, 0x5100, 0x0800, 0x4f00, 0x0600, 0x4d00, 0x0400, 0x4b00, 0x0200, 0x4900};
+
 unsigned char* message_table_index(int i)
 {   
-   return &table_s2[(97*i % 144) << 8];   
+   return &table_s2[message_table_offset[i]];
 }
 
 void print_block(char* msg, unsigned char* dword)
@@ -94,7 +121,7 @@ void permute_block_1(unsigned char* block)
 
 unsigned char* permute_table_2(unsigned int i)
 {
-   return &table_s4[((71 * i) % 144) << 8];
+   return &table_s4[permute_table_offset[i]];
 }
 
 void permute_block_2(unsigned char* block, int round)
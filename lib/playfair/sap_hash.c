@@ -39,14 +39,20 @@ void sap_hash(unsigned char* blockIn, unsigned char* keyOut)
       buffer1[i] = in_byte;
    }
    // Next a scrambling
+   // The indices are ((i - k) & 0xffffffff) % 210, an unsigned 32-bit modulo. They are stepped
+   // instead of divided, restarting from 0 where i - k stops wrapping around 2^32.
+   unsigned int xi = (0u - 155) % 210, yi = (0u - 57) % 210, zi = (0u - 13) % 210, wi = 0;
    for (i = 0; i < 840; i++)
    {
-      // We have to do unsigned, 32-bit modulo, or we get the wrong indices
-      x = buffer1[((i-155) & 0xffffffff) % 210];
-      y = buffer1[((i-57) & 0xffffffff) % 210];
-      z = buffer1[((i-13) & 0xffffffff) % 210];
-      w = buffer1[(i & 0xffffffff) % 210];
-      buffer1[i % 210] = (rol8(y, 5) + (rol8(z, 3) ^ w) - rol8(x,7)) & 0xff;
+      x = buffer1[xi];
+      y = buffer1[yi];
+      z = buffer1[zi];
+      w = buffer1[wi];
+      buffer1[wi] = (rol8(y, 5) + (rol8(z, 3) ^ w) - rol8(x,7)) & 0xff;
+      if (++xi == 210 || i + 1 == 155) xi = 0;
+      if (++yi == 210 || i + 1 == 57) yi = 0;
+      if (++zi == 210 || i + 1 == 13) zi = 0;
+      if (++wi == 210) wi = 0;
    }
    printf("Garbling...\n");
    // I have no idea what this is doing (yet), but it gives the right output
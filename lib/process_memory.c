@@ -0,0 +1,84 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "process_memory.h"
+
+int
+process_memory_get(process_memory_t *memory)
+{
+    memset(memory, 0, sizeof(process_memory_t));
+    FILE *file = fopen("/proc/self/status", "r");
+    if (!file) {
+        return -1;
+    }
+    char line[128];
+    unsigned long kb;
+    while (fgets(line, sizeof(line), file)) {
+        if (sscanf(line, "VmRSS: %lu kB", &kb) == 1) {
+            memory->rss = (size_t) kb * 1024;
+        } else if (sscanf(line, "VmHWM: %lu kB", &kb) == 1) {
+            memory->peak_rss = (size_t) kb * 1024;
+        } else if (sscanf(line, "RssAnon: %lu kB", &kb) == 1) {
+            memory->anon = (size_t) kb * 1024;
+        } else if (sscanf(line, "RssFile: %lu kB", &kb) == 1) {
+            memory->file = (size_t) kb * 1024;
+        } else if (sscanf(line, "VmSwap: %lu kB", &kb) == 1) {
+            memory->swap = (size_t) kb * 1024;
+        }
+    }
+    fclose(file);
+    return 0;
+}
+
+int
+process_memory_get_libraries(const char *const *names, size_t *resident, int count)
+{
+    memset(resident, 0, count * sizeof(size_t));
+    FILE *file = fopen("/proc/self/smaps", "r");
+    if (!file) {
+        return -1;
+    }
+    char line[512];
+    int library = -1;
+    unsigned long kb;
+    while (fgets(line, sizeof(line), file)) {
+        if (sscanf(line, "Rss: %lu kB", &kb) == 1) {
+            if (library >= 0) {
+                resident[library] += (size_t) kb * 1024;
+            }
+            continue;
+        }
+        // A mapping starts with its address range, its path is the last field if it has one
+        unsigned long start, end;
+        char separator;
+        if (sscanf(line, "%lx-%lx%c", &start, &end, &separator) != 3 || separator != ' ') {
+            continue;
+        }
+        library = -1;
+        char *path = strchr(line, '/');
+        if (!path) {
+            continue;
+        }
+        path[strcspn(path, "\n")] = '\0';
+        const char *base = strrchr(path, '/') + 1;
+        for (int i = 0; i < count && library < 0; i++) {
+            if (!strncmp(base, names[i], strlen(names[i]))) {
+                library = i;
+            }
+        }
+    }
+    fclose(file);
+    return 0;
+}
@@ -0,0 +1,51 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#ifndef PROCESS_MEMORY_H
+#define PROCESS_MEMORY_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * How much memory the process holds, from /proc/self. The resident set is
+ * split into anonymous memory, the heap and buffers, and file pages, mostly
+ * the code and constant tables of the shared libraries, which the resident
+ * pages of each library's mappings break down further. Linux only,
+ * elsewhere the reads fail.
+ */
+
+typedef struct {
+    /* Resident set and its high-water mark, in bytes */
+    size_t rss;
+    size_t peak_rss;
+    size_t anon;
+    size_t file;
+    size_t swap;
+} process_memory_t;
+
+/* Returns -1 if /proc/self/status can't be read */
+int process_memory_get(process_memory_t *memory);
+/*
+ * Resident bytes of the mappings of each of count libraries, by the start of their file name,
+ * e.g. "libfdk-aac" for /usr/lib/libfdk-aac.so.2. Returns -1 if /proc/self/smaps can't be read.
+ */
+int process_memory_get_libraries(const char *const *names, size_t *resident, int count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //PROCESS_MEMORY_H
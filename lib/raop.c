@@ -16,10 +16,10 @@
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
+#include <time.h>
 
 #include "raop.h"
 #include "raop_rtp.h"
-#include "raop_rtp.h"
 #include "pairing.h"
 #include "httpd.h"
 
@@ -29,7 +29,72 @@
 #include "logger.h"
 #include "compat.h"
 #include "raop_rtp_mirror.h"
+#include "raop_buffered.h"
+#include "crypto.h"
 #include "raop_ntp.h"
+#include "restream.h"
+#include "shm_output.h"
+#include "mp4_recorder.h"
+#include "frame_bus.h"
+#include "threads.h"
+#include "metrics.h"
+#include "setup_timeline.h"
+#include "cpu_load.h"
+#include "thermal.h"
+#include "decode_scheduler.h"
+#include "raop_buffer.h"
+#include "session_summary.h"
+#include "trace.h"
+#include "latency_histogram.h"
+#include "mem_budget.h"
+#include "task_pool.h"
+#include "session_reactor.h"
+
+/* Frame bus queues, the restream one is short since late video is of no use to its viewers */
+#define RAOP_RESTREAM_QUEUE_LENGTH 64
+#define RAOP_RESTREAM_QUEUE_BYTES (16 * 1024 * 1024)
+#define RAOP_RECORDER_QUEUE_LENGTH 1024
+#define RAOP_RECORDER_QUEUE_BYTES (32 * 1024 * 1024)
+/* Writing to shared memory is a copy, the queue only has to ride out the writer being descheduled */
+#define RAOP_SHM_OUTPUT_QUEUE_LENGTH 64
+#define RAOP_SHM_OUTPUT_RING_SIZE (16 * 1024 * 1024)
+#define RAOP_MAX_FRAME_CONSUMERS (FRAME_BUS_MAX_SUBSCRIBERS - 3)
+
+/* Senders whose clock estimate is kept after they went away, for their next session */
+#define RAOP_PARKED_SENDERS 4
+
+typedef struct {
+    unsigned char remote[16];
+    int remotelen;
+    /* 0 if the entry is free */
+    uint64_t parked_at;
+    raop_ntp_sync_t sync;
+} raop_parked_sender_t;
+
+/* RTSP requests the handler latency is kept apart for */
+typedef enum {
+    RAOP_ROUTE_INFO,
+    RAOP_ROUTE_PAIR_SETUP,
+    RAOP_ROUTE_PAIR_VERIFY,
+    RAOP_ROUTE_FP_SETUP,
+    RAOP_ROUTE_OPTIONS,
+    RAOP_ROUTE_SETUP,
+    RAOP_ROUTE_GET_PARAMETER,
+    RAOP_ROUTE_SET_PARAMETER,
+    RAOP_ROUTE_FEEDBACK,
+    RAOP_ROUTE_RECORD,
+    RAOP_ROUTE_SETRATEANCHORTIME,
+    RAOP_ROUTE_FLUSHBUFFERED,
+    RAOP_ROUTE_FLUSH,
+    RAOP_ROUTE_TEARDOWN,
+    RAOP_ROUTE_OTHER,
+    RAOP_ROUTE_COUNT
+} raop_route_t;
+
+static const char *const raop_route_names[RAOP_ROUTE_COUNT] = {
+    "info", "pair-setup", "pair-verify", "fp-setup", "options", "setup", "get_parameter", "set_parameter",
+    "feedback", "record", "setrateanchortime", "flushbuffered", "flush", "teardown", "other"
+};
 
 struct raop_s {
     /* Callbacks for audio and video */
@@ -45,26 +110,384 @@ struct raop_s {
     dnssd_t *dnssd;
 
     unsigned short port;
+
+    /* Mirror latency budget in milliseconds, 0 disables dropping late frames */
+    unsigned int video_latency_budget;
+
+    /* Directory mirror and audio sessions are recorded to, NULL disables recording */
+    char *capture_dir;
+
+    /* Directory sessions are recorded to as MP4, NULL disables it */
+    char *mp4_dir;
+
+    /* File a JSON summary of every connection is appended to as it closes, NULL disables it */
+    char *session_log;
+
+    /* Mirrored video is sent on to these destinations as RTP, NULL if there are none */
+    restream_t *restream;
+    shm_output_t *shm_output;
+
+    /* Frame buffers each session and all of them together may hold, unlimited if 0 */
+    size_t session_memory;
+    mem_budget_t *memory_budget;
+    /* Sessions streaming at once, unlimited if 0, and the connections admitted as one */
+    unsigned int max_sessions;
+    unsigned int admitted_sessions;
+
+    /* Fault in and lock the buffers of each mirror session as it starts */
+    int lock_memory;
+    int coalesce_static;
+    int progressive_video;
+
+    /* Receive each session's timing, audio and UDP video on one reactor thread of its own */
+    int session_reactor;
+    /* Follow the PTP clock of senders that offer it at SETUP */
+    int ptp;
+    /* Offer no screen to mirror to in /info and refuse mirror streams at SETUP */
+    int audio_only;
+    /* Take mirror streams over UDP from senders that ask for the fragment framing */
+    int mirror_udp;
+
+    /* Chunks the large frames of each mirror session are decrypted in besides their own, 0 for none */
+    unsigned int decrypt_threads;
+    /* Workers shared by every session, started with the first session that needs them and
+     * guarded by conns_mutex until then */
+    task_pool_t *task_pool;
+
+    /* Watches the load of the host, NULL if sessions are admitted and served whatever it is */
+    cpu_load_t *cpu_load;
+    /* Watches the temperature of the SoC, NULL if nothing is done about it */
+    thermal_t *thermal;
+    /* Orders the frames of all mirror sessions by deadline, NULL if each submits when it likes */
+    decode_scheduler_t *decode_scheduler;
+
+    /* Milliseconds a sender that went away may take to come back and start from its old clock
+     * estimate, 0 keeps none. The estimates are guarded by conns_mutex. */
+    unsigned int reconnect_grace;
+    raop_parked_sender_t parked[RAOP_PARKED_SENDERS];
+    uint64_t reconnects;
+
+    /* Pin the stages of each session to cores, starting from the core of its slot */
+    int cpu_affinity;
+    /* Bit per slot held by an open connection */
+    unsigned int cpu_slots;
+
+    /* Consumers subscribed to the frame bus of every session, besides the recorder and restream */
+    frame_bus_subscriber_config_t consumers[RAOP_MAX_FRAME_CONSUMERS];
+    int consumer_count;
+
+    /* Serialized /info response, rebuilt when the dnssd configuration changes */
+    mutex_handle_t info_mutex;
+    char *info_data;
+    int info_datalen;
+    /* Whether info_data offers the reduced mode of an overloaded host */
+    bool info_degraded;
+    /* Whether the TXT records and /info tell senders another session would be refused */
+    bool advertised_busy;
+
+    /* Open connections for the metrics scrape. The mutex also guards a connection's streams
+     * against being destroyed while they are read */
+    mutex_handle_t conns_mutex;
+    struct raop_conn_s *conns;
+    unsigned int next_conn_id;
+
+    /* Serves the metrics of the open connections, NULL unless raop_start_metrics was called */
+    metrics_server_t *metrics;
+
+    /* Serves video URL playback on the airplay port, NULL unless raop_start_video was called. The
+     * video_url callbacks are called under video_mutex, which also guards the connection that started
+     * what is playing, so it is stopped if that connection goes away without a /stop */
+    httpd_t *video_httpd;
+    mutex_handle_t video_mutex;
+    struct raop_conn_s *video_conn;
+
+    /* Time the handler of each route took, the httpd workers record them under route_mutex */
+    mutex_handle_t route_mutex;
+    latency_histogram_t *route_latency[RAOP_ROUTE_COUNT];
 };
 
 struct raop_conn_s {
     raop_t *raop;
+    struct raop_conn_s *next;
+    /* Numbers the connections since start, the session label of their metrics */
+    unsigned int id;
+    /* The server's callbacks with the cls of this connection's session */
+    raop_callbacks_t callbacks;
+    /* First core of the connection's stages, -1 if they are not pinned */
+    int cpu_slot;
+    /* Counted in admitted_sessions since its first SETUP */
+    bool admitted;
+    /* Runs the receive loops of raop_ntp, raop_rtp and raop_rtp_mirror if set, destroyed after all of them */
+    session_reactor_t *reactor;
     raop_ntp_t *raop_ntp;
     raop_rtp_t *raop_rtp;
     raop_rtp_mirror_t *raop_rtp_mirror;
+    /* Set up instead of raop_rtp's audio when the sender buffers its audio */
+    raop_buffered_t *raop_buffered;
+    /* Shared by raop_rtp and raop_rtp_mirror, destroyed only after both are */
+    frame_bus_t *frame_bus;
+    mp4_recorder_t *recorder;
     fairplay_t *fairplay;
     pairing_session_t *pairing;
+    /* Milestones from the first request to the first frame shown, NULL if it could not be allocated */
+    setup_timeline_t *setup_timeline;
+    session_summary_t summary;
 
     unsigned char *local;
     int locallen;
 
     unsigned char *remote;
     int remotelen;
+    /* Interface a link-local IPv6 sender is on */
+    unsigned int remote_scope_id;
 
 };
 typedef struct raop_conn_s raop_conn_t;
 
+static void
+raop_restream_frame(void *cls, const frame_bus_frame_t *frame) {
+    // The RTP packetizer only speaks RFC 6184, HEVC sessions are not restreamed
+    if (frame->codec != VIDEO_CODEC_H264) {
+        return;
+    }
+    restream_send_frame(cls, frame->data, frame->data_len, frame->nal_units, frame->nal_count, frame->pts);
+}
+
+static void
+raop_record_frame(void *cls, const frame_bus_frame_t *frame) {
+    mp4_recorder_write_frame(cls, frame);
+}
+
+static void
+raop_shm_output_frame(void *cls, const frame_bus_frame_t *frame) {
+    shm_output_write_frame(cls, frame);
+}
+
+/* A frame bus with the restream, recorder, shared memory and application consumers, NULL if there are none */
+static frame_bus_t *
+raop_frame_bus_init(raop_t *raop, mp4_recorder_t *recorder) {
+    frame_bus_t *frame_bus;
+
+    if (!raop->restream && !recorder && !raop->shm_output && !raop->consumer_count) {
+        return NULL;
+    }
+    frame_bus = frame_bus_init(raop->logger);
+    if (!frame_bus) {
+        return NULL;
+    }
+    if (raop->restream) {
+        frame_bus_subscriber_config_t config = {
+            "restream", FRAME_BUS_VIDEO | FRAME_BUS_CODEC, RAOP_RESTREAM_QUEUE_LENGTH, RAOP_RESTREAM_QUEUE_BYTES,
+            FRAME_BUS_DROP_TO_KEYFRAME, raop_restream_frame, raop->restream
+        };
+        frame_bus_subscribe(frame_bus, &config);
+    }
+    if (recorder) {
+        frame_bus_subscriber_config_t config = {
+            "mp4_recorder", FRAME_BUS_VIDEO | FRAME_BUS_CODEC | FRAME_BUS_AUDIO, RAOP_RECORDER_QUEUE_LENGTH,
+            RAOP_RECORDER_QUEUE_BYTES, FRAME_BUS_DROP_TO_KEYFRAME, raop_record_frame, recorder
+        };
+        frame_bus_subscribe(frame_bus, &config);
+    }
+    if (raop->shm_output) {
+        frame_bus_subscriber_config_t config = {
+            "shm_output", FRAME_BUS_VIDEO | FRAME_BUS_CODEC, RAOP_SHM_OUTPUT_QUEUE_LENGTH, 0,
+            FRAME_BUS_DROP_TO_KEYFRAME, raop_shm_output_frame, raop->shm_output
+        };
+        frame_bus_subscribe(frame_bus, &config);
+    }
+    for (int i = 0; i < raop->consumer_count; i++) {
+        frame_bus_subscribe(frame_bus, &raop->consumers[i]);
+    }
+    return frame_bus;
+}
+
+/* The shared workers, started on first use. NULL if they could not be */
+static task_pool_t *
+raop_get_task_pool(raop_t *raop) {
+    MUTEX_LOCK(raop->conns_mutex);
+    if (!raop->task_pool) {
+        raop->task_pool = task_pool_init(raop->logger, 0, raop->cpu_affinity);
+    }
+    task_pool_t *task_pool = raop->task_pool;
+    MUTEX_UNLOCK(raop->conns_mutex);
+    return task_pool;
+}
+
+/* True while the host can't take on more work, for its CPU load or its temperature */
+static bool
+raop_is_overloaded(raop_t *raop) {
+    return cpu_load_is_overloaded(raop->cpu_load) || thermal_get_level(raop->thermal) == THERMAL_HOT;
+}
+
+/* True while /info offers senders less than the display can show */
+static bool
+raop_is_degraded(raop_t *raop) {
+    return cpu_load_is_overloaded(raop->cpu_load) || thermal_get_level(raop->thermal) >= THERMAL_WARM;
+}
+
+/*
+ * Sets the busy status flag of the TXT records and /info while another sender would be refused
+ * for the session limit, the CPU load or the temperature, so senders can pick another receiver
+ * before trying this one. The records are updated in place. Called as sessions come and go and
+ * overloads start or end.
+ */
+static void
+raop_advertise_state(raop_t *raop) {
+    unsigned int max_sessions = __atomic_load_n(&raop->max_sessions, __ATOMIC_RELAXED);
+    unsigned int admitted = __atomic_load_n(&raop->admitted_sessions, __ATOMIC_RELAXED);
+    bool busy = (max_sessions && admitted >= max_sessions) || (admitted > 0 && raop_is_overloaded(raop));
+
+    MUTEX_LOCK(raop->info_mutex);
+    if (raop->dnssd && busy != raop->advertised_busy) {
+        raop->advertised_busy = busy;
+        dnssd_set_busy(raop->dnssd, busy);
+        if (dnssd_update_airplay(raop->dnssd) < 0 || dnssd_update_raop(raop->dnssd) < 0) {
+            logger_log(raop->logger, LOGGER_WARNING, "Could not update the TXT records");
+        }
+        free(raop->info_data);
+        raop->info_data = NULL;
+        logger_log(raop->logger, LOGGER_INFO, "Advertising the receiver as %s", busy ? "busy" : "available");
+    }
+    MUTEX_UNLOCK(raop->info_mutex);
+}
+
+static void
+raop_cpu_load_changed(void *cls, bool overloaded) {
+    raop_advertise_state(cls);
+}
+
+static void
+raop_thermal_changed(void *cls, thermal_level_t level) {
+    raop_advertise_state(cls);
+}
+
+/* True if the decoder of a mirroring session can't keep up with its sender */
+static bool
+raop_decoder_falling_behind(raop_t *raop) {
+    bool behind = false;
+
+    MUTEX_LOCK(raop->conns_mutex);
+    for (raop_conn_t *conn = raop->conns; conn && !behind; conn = conn->next) {
+        behind = conn->raop_rtp_mirror && raop_rtp_mirror_is_falling_behind(conn->raop_rtp_mirror);
+    }
+    MUTEX_UNLOCK(raop->conns_mutex);
+    return behind;
+}
+
+/*
+ * Counts the connection as a streaming session unless that would go over max_sessions, the
+ * shared memory budget has no room for another session's frames, or the CPU is overloaded or a
+ * decoder falls behind with the sessions streaming already. Called at the first SETUP, before
+ * anything of the session is allocated.
+ */
+static bool
+raop_admit_session(raop_conn_t *conn) {
+    raop_t *raop = conn->raop;
+    unsigned int max_sessions = __atomic_load_n(&raop->max_sessions, __ATOMIC_RELAXED);
+    size_t session_memory = __atomic_load_n(&raop->session_memory, __ATOMIC_RELAXED);
+    unsigned int admitted = __atomic_load_n(&raop->admitted_sessions, __ATOMIC_RELAXED);
+
+    if (conn->admitted) {
+        return true;
+    }
+    if (mem_budget_available(raop->memory_budget) < (session_memory ? session_memory : 1)) {
+        logger_log(raop->logger, LOGGER_WARNING, "Refusing session, the memory budget is used up");
+        return false;
+    }
+    // A lone sender is served degraded rather than not at all
+    if (admitted > 0 && cpu_load_is_overloaded(raop->cpu_load)) {
+        logger_log(raop->logger, LOGGER_WARNING, "Refusing session, the CPU is overloaded with %u streaming", admitted);
+        return false;
+    }
+    if (admitted > 0 && thermal_get_level(raop->thermal) == THERMAL_HOT) {
+        logger_log(raop->logger, LOGGER_WARNING, "Refusing session, the SoC is hot with %u streaming", admitted);
+        return false;
+    }
+    if (admitted > 0 && raop_decoder_falling_behind(raop)) {
+        logger_log(raop->logger, LOGGER_WARNING, "Refusing session, a video decoder is falling behind its sender");
+        return false;
+    }
+    do {
+        if (max_sessions && admitted >= max_sessions) {
+            logger_log(raop->logger, LOGGER_WARNING, "Refusing session, %u are streaming already", admitted);
+            return false;
+        }
+    } while (!__atomic_compare_exchange_n(&raop->admitted_sessions, &admitted, admitted + 1, true,
+                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    conn->admitted = true;
+    raop_advertise_state(raop);
+    return true;
+}
+
+/* Keeps the clock estimate of a closing connection for the next session of its sender */
+static void
+raop_park_sender(raop_conn_t *conn) {
+    raop_t *raop = conn->raop;
+    raop_ntp_sync_t sync;
+
+    if (!__atomic_load_n(&raop->reconnect_grace, __ATOMIC_RELAXED) || !conn->raop_ntp ||
+        conn->remotelen > (int) sizeof(raop->parked[0].remote) || !raop_ntp_get_sync(conn->raop_ntp, &sync)) {
+        return;
+    }
+    MUTEX_LOCK(raop->conns_mutex);
+    // The sender's earlier entry, else a free one or the oldest
+    raop_parked_sender_t *slot = &raop->parked[0];
+    for (int i = 0; i < RAOP_PARKED_SENDERS; i++) {
+        raop_parked_sender_t *parked = &raop->parked[i];
+        if (parked->parked_at && parked->remotelen == conn->remotelen && !memcmp(parked->remote, conn->remote, conn->remotelen)) {
+            slot = parked;
+            break;
+        }
+        if (parked->parked_at < slot->parked_at) {
+            slot = parked;
+        }
+    }
+    memcpy(slot->remote, conn->remote, conn->remotelen);
+    slot->remotelen = conn->remotelen;
+    slot->parked_at = raop_ntp_get_local_time(NULL);
+    slot->sync = sync;
+    MUTEX_UNLOCK(raop->conns_mutex);
+}
+
+/* Takes the clock estimate the connection's sender left within the grace period, returns false if there is none */
+static bool
+raop_unpark_sender(raop_conn_t *conn, raop_ntp_sync_t *sync, uint64_t *away) {
+    raop_t *raop = conn->raop;
+    uint64_t grace = (uint64_t) __atomic_load_n(&raop->reconnect_grace, __ATOMIC_RELAXED) * 1000;
+    uint64_t now = raop_ntp_get_local_time(NULL);
+    bool found = false;
+
+    MUTEX_LOCK(raop->conns_mutex);
+    for (int i = 0; i < RAOP_PARKED_SENDERS; i++) {
+        raop_parked_sender_t *parked = &raop->parked[i];
+        if (!parked->parked_at || parked->remotelen != conn->remotelen || memcmp(parked->remote, conn->remote, conn->remotelen)) {
+            continue;
+        }
+        if (now - parked->parked_at <= grace) {
+            *sync = parked->sync;
+            *away = now - parked->parked_at;
+            raop->reconnects++;
+            found = true;
+        }
+        parked->parked_at = 0;
+        break;
+    }
+    MUTEX_UNLOCK(raop->conns_mutex);
+    return found;
+}
+
+/* Drains the frame bus into its consumers, which the RTP sessions must no longer publish to */
+static void
+conn_destroy_frame_bus(raop_conn_t *conn) {
+    frame_bus_destroy(conn->frame_bus);
+    conn->frame_bus = NULL;
+    mp4_recorder_close(conn->recorder);
+    conn->recorder = NULL;
+}
+
 #include "raop_handlers.h"
+#include "raop_video_handlers.h"
 
 static void *
 conn_init(void *opaque, unsigned char *local, int locallen, unsigned char *remote, int remotelen) {
@@ -93,6 +516,26 @@ conn_init(void *opaque, unsigned char *local, int locallen, unsigned char *remot
         return NULL;
     }
 
+    memcpy(&conn->callbacks, &raop->callbacks, sizeof(raop_callbacks_t));
+    if (raop->callbacks.session_init) {
+        conn->callbacks.cls = raop->callbacks.session_init(raop->callbacks.cls);
+        if (!conn->callbacks.cls) {
+            logger_log(raop->logger, LOGGER_WARNING, "Refusing connection, all sessions are in use");
+            pairing_session_destroy(conn->pairing);
+            fairplay_destroy(conn->fairplay);
+            free(conn);
+            return NULL;
+        }
+    }
+    conn->cpu_slot = -1;
+    for (int i = 0; raop->cpu_affinity && i < 32; i++) {
+        if (!(raop->cpu_slots & (1u << i))) {
+            raop->cpu_slots |= 1u << i;
+            conn->cpu_slot = i;
+            break;
+        }
+    }
+
     if (locallen == 4) {
         logger_log(conn->raop->logger, LOGGER_INFO,
                    "Local: %d.%d.%d.%d",
@@ -124,14 +567,60 @@ conn_init(void *opaque, unsigned char *local, int locallen, unsigned char *remot
 
     conn->locallen = locallen;
     conn->remotelen = remotelen;
+    conn->remote_scope_id = netutils_get_scope_id(local, locallen);
+
+    conn->summary.start = time(NULL);
+    conn->summary.start_time = session_summary_now();
+    if (remotelen == 4) {
+        snprintf(conn->summary.remote, sizeof(conn->summary.remote), "%d.%d.%d.%d",
+                 remote[0], remote[1], remote[2], remote[3]);
+    } else if (remotelen == 16) {
+        char *p = conn->summary.remote;
+        for (int i = 0; i < 16; i += 2) {
+            p += sprintf(p, "%s%02x%02x", i ? ":" : "", remote[i], remote[i + 1]);
+        }
+    }
 
     if (raop->callbacks.conn_init) {
         raop->callbacks.conn_init(raop->callbacks.cls);
     }
 
+    MUTEX_LOCK(raop->conns_mutex);
+    conn->id = ++raop->next_conn_id;
+    conn->summary.id = conn->id;
+    conn->setup_timeline = setup_timeline_init(raop->logger, conn->id);
+    conn->next = raop->conns;
+    raop->conns = conn;
+    MUTEX_UNLOCK(raop->conns_mutex);
+
     return conn;
 }
 
+/* Keeps the counters of the streams for the session summary, before they are destroyed */
+static void
+conn_save_summary(raop_conn_t *conn) {
+    if (conn->raop_ntp) {
+        raop_ntp_get_stats(conn->raop_ntp, &conn->summary.ntp);
+        conn->summary.has_ntp = 1;
+    }
+    if (conn->raop_rtp) {
+        raop_rtp_stats_t audio;
+        raop_rtp_get_stats(conn->raop_rtp, &audio);
+        if (audio.received_packets) {
+            conn->summary.audio = audio;
+            conn->summary.has_audio = 1;
+        }
+    }
+    if (conn->raop_rtp_mirror) {
+        raop_rtp_mirror_stats_t video;
+        raop_rtp_mirror_get_stats(conn->raop_rtp_mirror, &video);
+        if (video.received_frames) {
+            conn->summary.video = video;
+            conn->summary.has_video = 1;
+        }
+    }
+}
+
 static void
 conn_request(void *ptr, http_request_t *request, http_response_t **response) {
     raop_conn_t *conn = ptr;
@@ -145,10 +634,13 @@ conn_request(void *ptr, http_request_t *request, http_response_t **response) {
 
     method = http_request_get_method(request);
     url = http_request_get_url(request);
-    cseq = http_request_get_header(request, "CSeq");
+    cseq = http_request_get_known_header(request, HTTP_HEADER_CSEQ);
     if (!method || !cseq) {
         return;
     }
+    setup_timeline_mark(conn->setup_timeline, SETUP_FIRST_REQUEST);
+    uint64_t cseq_value = strtoull(cseq, NULL, 10);
+    trace_event(TRACE_RTSP_REQUEST, cseq_value, conn->id);
 
     *response = http_response_init("RTSP/1.0", 200, "OK");
 
@@ -157,32 +649,51 @@ conn_request(void *ptr, http_request_t *request, http_response_t **response) {
     http_response_add_header(*response, "Server", "AirTunes/220.68");
 
     logger_log(conn->raop->logger, LOGGER_DEBUG, "Handling request %s with URL %s", method, url);
+    uint64_t start_time = raop_ntp_get_local_time(NULL);
+    raop_route_t route = RAOP_ROUTE_OTHER;
     raop_handler_t handler = NULL;
     if (!strcmp(method, "GET") && !strcmp(url, "/info")) {
         handler = &raop_handler_info;
+        route = RAOP_ROUTE_INFO;
     } else if (!strcmp(method, "POST") && !strcmp(url, "/pair-setup")) {
         handler = &raop_handler_pairsetup;
+        route = RAOP_ROUTE_PAIR_SETUP;
     } else if (!strcmp(method, "POST") && !strcmp(url, "/pair-verify")) {
         handler = &raop_handler_pairverify;
+        route = RAOP_ROUTE_PAIR_VERIFY;
     } else if (!strcmp(method, "POST") && !strcmp(url, "/fp-setup")) {
         handler = &raop_handler_fpsetup;
+        route = RAOP_ROUTE_FP_SETUP;
     } else if (!strcmp(method, "OPTIONS")) {
         handler = &raop_handler_options;
+        route = RAOP_ROUTE_OPTIONS;
     } else if (!strcmp(method, "SETUP")) {
         handler = &raop_handler_setup;
+        route = RAOP_ROUTE_SETUP;
     } else if (!strcmp(method, "GET_PARAMETER")) {
         handler = &raop_handler_get_parameter;
+        route = RAOP_ROUTE_GET_PARAMETER;
     } else if (!strcmp(method, "SET_PARAMETER")) {
         handler = &raop_handler_set_parameter;
+        route = RAOP_ROUTE_SET_PARAMETER;
     } else if (!strcmp(method, "POST") && !strcmp(url, "/feedback")) {
         handler = &raop_handler_feedback;
+        route = RAOP_ROUTE_FEEDBACK;
     } else if (!strcmp(method, "RECORD")) {
         handler = &raop_handler_record;
+        route = RAOP_ROUTE_RECORD;
+    } else if (!strcmp(method, "SETRATEANCHORTIME")) {
+        handler = &raop_handler_setrateanchortime;
+        route = RAOP_ROUTE_SETRATEANCHORTIME;
+    } else if (!strcmp(method, "FLUSHBUFFERED")) {
+        handler = &raop_handler_flushbuffered;
+        route = RAOP_ROUTE_FLUSHBUFFERED;
     } else if (!strcmp(method, "FLUSH")) {
         const char *rtpinfo;
         int next_seq = -1;
 
-        rtpinfo = http_request_get_header(request, "RTP-Info");
+        route = RAOP_ROUTE_FLUSH;
+        rtpinfo = http_request_get_known_header(request, HTTP_HEADER_RTP_INFO);
         if (rtpinfo) {
             logger_log(conn->raop->logger, LOGGER_DEBUG, "Flush with RTP-Info: %s", rtpinfo);
             if (!strncmp(rtpinfo, "seq=", 4)) {
@@ -195,27 +706,40 @@ conn_request(void *ptr, http_request_t *request, http_response_t **response) {
             logger_log(conn->raop->logger, LOGGER_WARNING, "RAOP not initialized at FLUSH");
         }
     } else if (!strcmp(method, "TEARDOWN")) {
+        route = RAOP_ROUTE_TEARDOWN;
         //http_response_add_header(*response, "Connection", "close");
-        if (conn->raop_rtp != NULL && raop_rtp_is_running(conn->raop_rtp)) {
-            /* Destroy our RTP session */
+        if (conn->raop_buffered != NULL) {
+            raop_buffered_destroy(conn->raop_buffered);
+            conn->raop_buffered = NULL;
+        } else if (conn->raop_rtp != NULL && raop_rtp_is_running(conn->raop_rtp)) {
+            /* Destroy our RTP session, stopping resets its counters */
+            conn_save_summary(conn);
             raop_rtp_stop(conn->raop_rtp);
         } else if (conn->raop_rtp_mirror) {
-            /* Destroy our sessions */
-            raop_rtp_destroy(conn->raop_rtp);
+            /* Destroy our sessions, out of reach of the metrics first */
+            conn_save_summary(conn);
+            MUTEX_LOCK(conn->raop->conns_mutex);
+            raop_rtp_t *raop_rtp = conn->raop_rtp;
+            raop_rtp_mirror_t *raop_rtp_mirror = conn->raop_rtp_mirror;
             conn->raop_rtp = NULL;
-            raop_rtp_mirror_destroy(conn->raop_rtp_mirror);
             conn->raop_rtp_mirror = NULL;
+            MUTEX_UNLOCK(conn->raop->conns_mutex);
+            raop_rtp_destroy(raop_rtp);
+            raop_rtp_mirror_destroy(raop_rtp_mirror);
+            conn_destroy_frame_bus(conn);
         }
     }
     if (handler != NULL) {
         handler(conn, request, *response, &response_data, &response_datalen);
     }
-    http_response_finish(*response, response_data, response_datalen);
-    if (response_data) {
-        free(response_data);
-        response_data = NULL;
-        response_datalen = 0;
-    }
+    int64_t handler_time = (int64_t) (raop_ntp_get_local_time(NULL) - start_time);
+    MUTEX_LOCK(conn->raop->route_mutex);
+    latency_histogram_record(conn->raop->route_latency[route], handler_time);
+    MUTEX_UNLOCK(conn->raop->route_mutex);
+    logger_log(conn->raop->logger, LOGGER_DEBUG, "Handled %s %s in %lld us", method, url, (long long) handler_time);
+    /* The handler's buffer becomes the response body without a copy */
+    http_response_finish_owned(*response, response_data, response_datalen);
+    trace_event(TRACE_RTSP_RESPONSE, cseq_value, response_datalen);
 }
 
 static void
@@ -224,10 +748,27 @@ conn_destroy(void *ptr) {
 
     logger_log(conn->raop->logger, LOGGER_INFO, "Destroying connection");
 
+    MUTEX_LOCK(conn->raop->conns_mutex);
+    for (raop_conn_t **link = &conn->raop->conns; *link; link = &(*link)->next) {
+        if (*link == conn) {
+            *link = conn->next;
+            break;
+        }
+    }
+    MUTEX_UNLOCK(conn->raop->conns_mutex);
+
     if (conn->raop->callbacks.conn_destroy) {
         conn->raop->callbacks.conn_destroy(conn->raop->callbacks.cls);
     }
 
+    conn_save_summary(conn);
+    if (conn->raop->session_log && session_summary_write(&conn->summary, conn->raop->session_log) < 0) {
+        logger_log(conn->raop->logger, LOGGER_WARNING, "Could not write the session summary to %s", conn->raop->session_log);
+    }
+
+    /* Before the NTP session it converts the anchor time with */
+    raop_buffered_destroy(conn->raop_buffered);
+    raop_park_sender(conn);
     if (conn->raop_ntp) {
         raop_ntp_destroy(conn->raop_ntp);
     }
@@ -239,13 +780,142 @@ conn_destroy(void *ptr) {
         /* This is done in case TEARDOWN was not called */
         raop_rtp_mirror_destroy(conn->raop_rtp_mirror);
     }
+    conn_destroy_frame_bus(conn);
+    session_reactor_destroy(conn->reactor);
+    if (conn->setup_timeline) {
+        setup_timeline_log(conn->setup_timeline);
+    }
 
-    conn->raop->callbacks.video_flush(conn->raop->callbacks.cls);
+    conn->callbacks.video_flush(conn->callbacks.cls);
+    if (conn->raop->callbacks.session_destroy) {
+        conn->raop->callbacks.session_destroy(conn->raop->callbacks.cls, conn->callbacks.cls);
+    }
+    if (conn->cpu_slot >= 0) {
+        conn->raop->cpu_slots &= ~(1u << conn->cpu_slot);
+    }
+    if (conn->admitted) {
+        __atomic_fetch_sub(&conn->raop->admitted_sessions, 1, __ATOMIC_RELAXED);
+        raop_advertise_state(conn->raop);
+        /* The audio output latency in /info is measured while playing, rebuild it for the next sender */
+        MUTEX_LOCK(conn->raop->info_mutex);
+        free(conn->raop->info_data);
+        conn->raop->info_data = NULL;
+        MUTEX_UNLOCK(conn->raop->info_mutex);
+    }
 
     free(conn->local);
     free(conn->remote);
     pairing_session_destroy(conn->pairing);
     fairplay_destroy(conn->fairplay);
+    setup_timeline_destroy(conn->setup_timeline);
+    free(conn);
+}
+
+/*
+ * A connection to the airplay port. It pairs and answers /info like one to the RTSP port, but has
+ * no session and no streams, so it is neither counted nor handed to session_init.
+ */
+static void *
+video_conn_init(void *opaque, unsigned char *local, int locallen, unsigned char *remote, int remotelen) {
+    raop_t *raop = opaque;
+    raop_conn_t *conn;
+
+    conn = calloc(1, sizeof(raop_conn_t));
+    if (!conn) {
+        return NULL;
+    }
+    conn->raop = raop;
+    conn->cpu_slot = -1;
+    conn->fairplay = fairplay_init(raop->logger);
+    conn->pairing = pairing_session_init(raop->pairing);
+    if (!conn->fairplay || !conn->pairing) {
+        pairing_session_destroy(conn->pairing);
+        fairplay_destroy(conn->fairplay);
+        free(conn);
+        return NULL;
+    }
+    memcpy(&conn->callbacks, &raop->callbacks, sizeof(raop_callbacks_t));
+    logger_log(raop->logger, LOGGER_INFO, "Video URL connection opened");
+    return conn;
+}
+
+static void
+video_conn_request(void *ptr, http_request_t *request, http_response_t **response) {
+    raop_conn_t *conn = ptr;
+    const char *method = http_request_get_method(request);
+    const char *url = http_request_get_url(request);
+    raop_handler_t handler = NULL;
+    bool known = true;
+    char *response_data = NULL;
+    int response_datalen = 0;
+
+    if (!method || !url) {
+        return;
+    }
+    logger_log(conn->raop->logger, LOGGER_DEBUG, "Handling video request %s with URL %s", method, url);
+
+    /* The sender turns this connection around for events it never needs from us, it only has to be accepted */
+    if (!strcmp(method, "POST") && !strcmp(url, "/reverse")) {
+        *response = http_response_init("HTTP/1.1", 101, "Switching Protocols");
+        http_response_add_header(*response, "Upgrade", "PTTH/1.0");
+        http_response_add_header(*response, "Connection", "Upgrade");
+        http_response_finish(*response, NULL, 0);
+        return;
+    }
+
+    if (!strcmp(method, "GET") && !strcmp(url, "/info")) {
+        handler = &raop_handler_info;
+    } else if (!strcmp(method, "POST") && !strcmp(url, "/pair-setup")) {
+        handler = &raop_handler_pairsetup;
+    } else if (!strcmp(method, "POST") && !strcmp(url, "/pair-verify")) {
+        handler = &raop_handler_pairverify;
+    } else if (!strcmp(method, "POST") && !strcmp(url, "/fp-setup")) {
+        handler = &raop_handler_fpsetup;
+    } else if (!strcmp(method, "GET") && !strcmp(url, "/server-info")) {
+        handler = &raop_video_handler_server_info;
+    } else if (!strcmp(method, "POST") && !strcmp(url, "/play")) {
+        handler = &raop_video_handler_play;
+    } else if (raop_video_path_is(url, "/scrub")) {
+        handler = &raop_video_handler_scrub;
+    } else if (!strcmp(method, "POST") && raop_video_path_is(url, "/rate")) {
+        handler = &raop_video_handler_rate;
+    } else if (!strcmp(method, "POST") && !strcmp(url, "/stop")) {
+        handler = &raop_video_handler_stop;
+    } else if (!strcmp(method, "GET") && !strcmp(url, "/playback-info")) {
+        handler = &raop_video_handler_playback_info;
+    } else if (!raop_video_path_is(url, "/setProperty") && !raop_video_path_is(url, "/getProperty") &&
+               !raop_video_path_is(url, "/action")) {
+        /* Properties such as subtitles and the sender's playlist actions are acknowledged and ignored */
+        known = false;
+        logger_log(conn->raop->logger, LOGGER_DEBUG, "No handler for video request %s %s", method, url);
+    }
+
+    *response = known ? http_response_init("HTTP/1.1", 200, "OK") : http_response_init("HTTP/1.1", 404, "Not Found");
+    if (handler != NULL) {
+        handler(conn, request, *response, &response_data, &response_datalen);
+    }
+    /* Unlike RTSP, an HTTP/1.1 body without a length runs until the connection closes */
+    if (response_datalen == 0) {
+        http_response_add_header(*response, "Content-Length", "0");
+    }
+    http_response_finish_owned(*response, response_data, response_datalen);
+}
+
+static void
+video_conn_destroy(void *ptr) {
+    raop_conn_t *conn = ptr;
+    raop_t *raop = conn->raop;
+
+    MUTEX_LOCK(raop->video_mutex);
+    if (raop->video_conn == conn) {
+        logger_log(raop->logger, LOGGER_INFO, "Video URL connection closed while playing, stopping");
+        raop->callbacks.video_url_stop(raop->callbacks.cls);
+        raop->video_conn = NULL;
+    }
+    MUTEX_UNLOCK(raop->video_mutex);
+    logger_log(raop->logger, LOGGER_INFO, "Video URL connection closed");
+    pairing_session_destroy(conn->pairing);
+    fairplay_destroy(conn->fairplay);
     free(conn);
 }
 
@@ -279,8 +949,11 @@ raop_init(int max_clients, raop_callbacks_t *callbacks) {
 
     /* Initialize the logger */
     raop->logger = logger_init();
+
+    /* A new identity on every start, unless raop_set_keyfile replaces it */
     pairing = pairing_init_generate();
     if (!pairing) {
+        logger_destroy(raop->logger);
         free(raop);
         return NULL;
     }
@@ -303,6 +976,17 @@ raop_init(int max_clients, raop_callbacks_t *callbacks) {
     memcpy(&raop->callbacks, callbacks, sizeof(raop_callbacks_t));
     raop->pairing = pairing;
     raop->httpd = httpd;
+    pairing_start_key_pool(pairing, raop->logger);
+    raop->memory_budget = mem_budget_init(0);
+    assert(raop->memory_budget);
+    MUTEX_CREATE(raop->info_mutex);
+    MUTEX_CREATE(raop->conns_mutex);
+    MUTEX_CREATE(raop->route_mutex);
+    MUTEX_CREATE(raop->video_mutex);
+    for (int i = 0; i < RAOP_ROUTE_COUNT; i++) {
+        raop->route_latency[i] = latency_histogram_init();
+        assert(raop->route_latency[i]);
+    }
     return raop;
 }
 
@@ -310,8 +994,33 @@ void
 raop_destroy(raop_t *raop) {
     if (raop) {
         raop_stop(raop);
+        metrics_server_destroy(raop->metrics);
+        if (raop->video_httpd) {
+            httpd_destroy(raop->video_httpd);
+        }
         pairing_destroy(raop->pairing);
         httpd_destroy(raop->httpd);
+        free(raop->info_data);
+        free(raop->capture_dir);
+        free(raop->mp4_dir);
+        free(raop->session_log);
+        for (int i = 0; i < raop->consumer_count; i++) {
+            free((char *) raop->consumers[i].name);
+        }
+        restream_destroy(raop->restream);
+        shm_output_destroy(raop->shm_output);
+        task_pool_destroy(raop->task_pool);
+        cpu_load_destroy(raop->cpu_load);
+        thermal_destroy(raop->thermal);
+        decode_scheduler_destroy(raop->decode_scheduler);
+        mem_budget_destroy(raop->memory_budget);
+        for (int i = 0; i < RAOP_ROUTE_COUNT; i++) {
+            latency_histogram_destroy(raop->route_latency[i]);
+        }
+        MUTEX_DESTROY(raop->info_mutex);
+        MUTEX_DESTROY(raop->conns_mutex);
+        MUTEX_DESTROY(raop->route_mutex);
+        MUTEX_DESTROY(raop->video_mutex);
         logger_destroy(raop->logger);
         free(raop);
 
@@ -340,6 +1049,311 @@ raop_set_port(raop_t *raop, unsigned short port) {
     raop->port = port;
 }
 
+void
+raop_set_video_latency_budget(raop_t *raop, unsigned int latency_budget_ms) {
+    assert(raop);
+    // Changed from the main thread while sessions are set up on httpd's
+    __atomic_store_n(&raop->video_latency_budget, latency_budget_ms, __ATOMIC_RELAXED);
+}
+
+void
+raop_set_memory_budget(raop_t *raop, size_t session_bytes, size_t total_bytes) {
+    assert(raop);
+    // Sessions set up from now on get the new session limit, the total applies at once
+    __atomic_store_n(&raop->session_memory, session_bytes, __ATOMIC_RELAXED);
+    mem_budget_set_limit(raop->memory_budget, total_bytes);
+}
+
+void
+raop_get_memory_stats(raop_t *raop, raop_memory_stats_t *stats) {
+    assert(raop);
+    mem_budget_stats_t memory;
+    mem_budget_get_stats(raop->memory_budget, &memory);
+    stats->frame_bytes = memory.used;
+    stats->frame_peak = memory.peak;
+    stats->frame_limit = memory.limit;
+    stats->audio_buffer_bytes = raop_buffer_get_total_size();
+    stats->logger_bytes = logger_get_size(raop->logger);
+}
+
+void
+raop_set_max_sessions(raop_t *raop, unsigned int max_sessions) {
+    assert(raop);
+    __atomic_store_n(&raop->max_sessions, max_sessions, __ATOMIC_RELAXED);
+}
+
+void
+raop_set_lock_memory(raop_t *raop, int enabled) {
+    assert(raop);
+    __atomic_store_n(&raop->lock_memory, enabled, __ATOMIC_RELAXED);
+}
+
+void
+raop_set_coalesce_static(raop_t *raop, int enabled) {
+    assert(raop);
+    __atomic_store_n(&raop->coalesce_static, enabled, __ATOMIC_RELAXED);
+}
+
+void
+raop_set_progressive_video(raop_t *raop, int enabled) {
+    assert(raop);
+    __atomic_store_n(&raop->progressive_video, enabled, __ATOMIC_RELAXED);
+}
+
+void
+raop_set_session_reactor(raop_t *raop, int enabled) {
+    assert(raop);
+    __atomic_store_n(&raop->session_reactor, enabled, __ATOMIC_RELAXED);
+}
+
+void
+raop_set_mirror_udp(raop_t *raop, int enabled) {
+    assert(raop);
+    __atomic_store_n(&raop->mirror_udp, enabled, __ATOMIC_RELAXED);
+}
+
+void
+raop_set_ptp(raop_t *raop, int enabled) {
+    assert(raop);
+    __atomic_store_n(&raop->ptp, enabled, __ATOMIC_RELAXED);
+}
+
+void
+raop_set_audio_only(raop_t *raop, int enabled) {
+    assert(raop);
+    MUTEX_LOCK(raop->info_mutex);
+    __atomic_store_n(&raop->audio_only, enabled, __ATOMIC_RELAXED);
+    free(raop->info_data);
+    raop->info_data = NULL;
+    MUTEX_UNLOCK(raop->info_mutex);
+}
+
+void
+raop_set_decrypt_threads(raop_t *raop, unsigned int threads) {
+    assert(raop);
+    __atomic_store_n(&raop->decrypt_threads, threads, __ATOMIC_RELAXED);
+}
+
+int
+raop_set_cpu_limit(raop_t *raop, unsigned int percent) {
+    assert(raop);
+    cpu_load_destroy(raop->cpu_load);
+    raop->cpu_load = NULL;
+    if (percent == 0) {
+        return 0;
+    }
+    raop->cpu_load = cpu_load_init(raop->logger, percent / 100.0);
+    if (raop->cpu_load) {
+        cpu_load_set_callback(raop->cpu_load, raop_cpu_load_changed, raop);
+    }
+    if (!raop->cpu_load || cpu_load_start(raop->cpu_load) < 0) {
+        cpu_load_destroy(raop->cpu_load);
+        raop->cpu_load = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+int
+raop_set_thermal_limit(raop_t *raop, unsigned int celsius) {
+    assert(raop);
+    thermal_destroy(raop->thermal);
+    raop->thermal = NULL;
+    if (celsius == 0) {
+        return 0;
+    }
+    raop->thermal = thermal_init(raop->logger, celsius);
+    if (raop->thermal) {
+        thermal_set_callback(raop->thermal, raop_thermal_changed, raop);
+    }
+    if (!raop->thermal || thermal_start(raop->thermal) < 0) {
+        thermal_destroy(raop->thermal);
+        raop->thermal = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+int
+raop_set_decode_scheduling(raop_t *raop, int enabled) {
+    assert(raop);
+    decode_scheduler_destroy(raop->decode_scheduler);
+    raop->decode_scheduler = enabled ? decode_scheduler_init() : NULL;
+    return enabled && !raop->decode_scheduler ? -1 : 0;
+}
+
+void
+raop_set_reconnect_grace(raop_t *raop, unsigned int grace_ms) {
+    assert(raop);
+    __atomic_store_n(&raop->reconnect_grace, grace_ms, __ATOMIC_RELAXED);
+}
+
+int
+raop_set_keyfile(raop_t *raop, const char *keyfile) {
+    pairing_t *pairing;
+
+    assert(raop);
+    assert(keyfile);
+
+    pairing = pairing_init_load(keyfile);
+    if (!pairing) {
+        logger_log(raop->logger, LOGGER_ERR, "Could not load or create pairing key %s", keyfile);
+        return -1;
+    }
+    // Nothing pairs before raop_start, so the generated identity can go
+    pairing_destroy(raop->pairing);
+    raop->pairing = pairing;
+    pairing_start_key_pool(pairing, raop->logger);
+    return 0;
+}
+
+void
+raop_set_capture_dir(raop_t *raop, const char *capture_dir) {
+    assert(raop);
+    free(raop->capture_dir);
+    raop->capture_dir = capture_dir ? strdup(capture_dir) : NULL;
+}
+
+void
+raop_set_mp4_dir(raop_t *raop, const char *mp4_dir) {
+    assert(raop);
+    free(raop->mp4_dir);
+    raop->mp4_dir = mp4_dir ? strdup(mp4_dir) : NULL;
+}
+
+void
+raop_set_session_log(raop_t *raop, const char *filename) {
+    assert(raop);
+    free(raop->session_log);
+    raop->session_log = filename ? strdup(filename) : NULL;
+}
+
+void
+raop_set_cpu_affinity(raop_t *raop, int enabled) {
+    assert(raop);
+    raop->cpu_affinity = enabled;
+}
+
+int
+raop_add_restream(raop_t *raop, const char *host, unsigned short port) {
+    assert(raop);
+    if (!raop->restream && !(raop->restream = restream_init(raop->logger))) {
+        return -1;
+    }
+    return restream_add_destination(raop->restream, host, port);
+}
+
+int
+raop_set_shm_output(raop_t *raop, const char *name) {
+    assert(raop);
+    assert(!raop->shm_output);
+    raop->shm_output = shm_output_init(raop->logger, name, RAOP_SHM_OUTPUT_RING_SIZE);
+    return raop->shm_output ? 0 : -1;
+}
+
+int
+raop_add_frame_consumer(raop_t *raop, const frame_bus_subscriber_config_t *config) {
+    assert(raop);
+    assert(config);
+    if (raop->consumer_count >= RAOP_MAX_FRAME_CONSUMERS) {
+        logger_log(raop->logger, LOGGER_ERR, "At most %d frame consumers are supported", RAOP_MAX_FRAME_CONSUMERS);
+        return -1;
+    }
+    raop->consumers[raop->consumer_count] = *config;
+    raop->consumers[raop->consumer_count].name = strdup(config->name ? config->name : "consumer");
+    raop->consumer_count++;
+    return 0;
+}
+
+int
+raop_replay_mirror(raop_t *raop, const char *filename, int realtime) {
+    static const unsigned char loopback[] = { 127, 0, 0, 1 };
+    mirror_capture_header_t header;
+    mirror_capture_reader_t *reader;
+    raop_ntp_t *raop_ntp;
+    raop_rtp_mirror_t *raop_rtp_mirror;
+    frame_bus_t *frame_bus;
+    int ret;
+
+    assert(raop);
+    assert(filename);
+
+    reader = mirror_capture_reader_open(filename, &header);
+    if (!reader) {
+        logger_log(raop->logger, LOGGER_ERR, "Could not open mirror capture %s", filename);
+        return -1;
+    }
+    /* Never started, the clock stays at a zero offset and the replay moves the timestamps itself */
+    raop_ntp = raop_ntp_init(raop->logger, loopback, sizeof(loopback), 0);
+    if (!raop_ntp) {
+        mirror_capture_reader_close(reader);
+        return -1;
+    }
+    raop_rtp_mirror = raop_rtp_mirror_init(raop->logger, &raop->callbacks, raop_ntp, loopback, sizeof(loopback),
+                                           header.aeskey, header.ecdh_secret);
+    if (!raop_rtp_mirror) {
+        raop_ntp_destroy(raop_ntp);
+        mirror_capture_reader_close(reader);
+        return -1;
+    }
+    raop_rtp_mirror_set_latency_budget(raop_rtp_mirror, __atomic_load_n(&raop->video_latency_budget, __ATOMIC_RELAXED));
+    raop_rtp_mirror_set_coalesce_static(raop_rtp_mirror, __atomic_load_n(&raop->coalesce_static, __ATOMIC_RELAXED));
+    frame_bus = raop_frame_bus_init(raop, NULL);
+    raop_rtp_mirror_set_frame_bus(raop_rtp_mirror, frame_bus);
+    raop_rtp_init_mirror_aes(raop_rtp_mirror, header.stream_connection_id);
+
+    ret = raop_rtp_mirror_replay(raop_rtp_mirror, reader, realtime);
+
+    raop_rtp_mirror_destroy(raop_rtp_mirror);
+    frame_bus_destroy(frame_bus);
+    raop_ntp_destroy(raop_ntp);
+    mirror_capture_reader_close(reader);
+    return ret;
+}
+
+int
+raop_replay_audio(raop_t *raop, const char *filename, int loss_percent, int jitter_ms) {
+    static const unsigned char loopback[] = { 127, 0, 0, 1 };
+    audio_capture_header_t header;
+    audio_capture_reader_t *reader;
+    raop_ntp_t *raop_ntp;
+    raop_rtp_t *raop_rtp;
+    int ret;
+
+    assert(raop);
+    assert(filename);
+
+    reader = audio_capture_reader_open(filename, &header);
+    if (!reader) {
+        logger_log(raop->logger, LOGGER_ERR, "Could not open audio capture %s", filename);
+        return -1;
+    }
+    /* Never started, the clock stays at a zero offset and the replay moves the sync times itself */
+    raop_ntp = raop_ntp_init(raop->logger, loopback, sizeof(loopback), 0);
+    if (!raop_ntp) {
+        audio_capture_reader_close(reader);
+        return -1;
+    }
+    raop_rtp = raop_rtp_init(raop->logger, &raop->callbacks, raop_ntp, loopback, sizeof(loopback),
+                             header.aeskey, header.aesiv, header.ecdh_secret);
+    if (!raop_rtp) {
+        raop_ntp_destroy(raop_ntp);
+        audio_capture_reader_close(reader);
+        return -1;
+    }
+
+    if (header.compression) {
+        raop_audio_format_t format = { header.compression, 0, header.samples_per_frame, 44100 };
+        raop_rtp_set_audio_format(raop_rtp, &format);
+    }
+    ret = raop_rtp_replay(raop_rtp, reader, header.resend, loss_percent, jitter_ms);
+
+    raop_rtp_destroy(raop_rtp);
+    raop_ntp_destroy(raop_ntp);
+    audio_capture_reader_close(reader);
+    return ret;
+}
+
 unsigned short
 raop_get_port(raop_t *raop) {
     assert(raop);
@@ -362,7 +1376,29 @@ raop_set_log_callback(raop_t *raop, raop_log_callback_t callback, void *cls) {
 void
 raop_set_dnssd(raop_t *raop, dnssd_t *dnssd) {
     assert(dnssd);
+
+    /* The TXT records may not be registered yet, build /info on first use */
+    MUTEX_LOCK(raop->info_mutex);
     raop->dnssd = dnssd;
+    free(raop->info_data);
+    raop->info_data = NULL;
+    MUTEX_UNLOCK(raop->info_mutex);
+}
+
+void
+raop_update_info(raop_t *raop) {
+    assert(raop);
+    assert(raop->dnssd);
+
+    MUTEX_LOCK(raop->info_mutex);
+    dnssd_set_busy(raop->dnssd, raop->advertised_busy);
+    if (dnssd_update_airplay(raop->dnssd) < 0 || dnssd_update_raop(raop->dnssd) < 0) {
+        logger_log(raop->logger, LOGGER_WARNING, "Could not update the TXT records");
+    }
+    free(raop->info_data);
+    raop->info_data = NULL;
+    raop_handler_info_build(raop, &raop->info_data, &raop->info_datalen);
+    MUTEX_UNLOCK(raop->info_mutex);
 }
 
 
@@ -377,4 +1413,328 @@ void
 raop_stop(raop_t *raop) {
     assert(raop);
     httpd_stop(raop->httpd);
-}
\ No newline at end of file
+    if (raop->video_httpd) {
+        httpd_stop(raop->video_httpd);
+    }
+}
+
+int
+raop_start_video(raop_t *raop, unsigned short *port) {
+    httpd_callbacks_t httpd_cbs;
+
+    assert(raop);
+    assert(port);
+
+    if (!raop->callbacks.video_url_play || !raop->callbacks.video_url_scrub || !raop->callbacks.video_url_rate ||
+        !raop->callbacks.video_url_stop || !raop->callbacks.video_url_get_playback) {
+        return -1;
+    }
+    if (!raop->video_httpd) {
+        memset(&httpd_cbs, 0, sizeof(httpd_cbs));
+        httpd_cbs.opaque = raop;
+        httpd_cbs.conn_init = &video_conn_init;
+        httpd_cbs.conn_request = &video_conn_request;
+        httpd_cbs.conn_destroy = &video_conn_destroy;
+        /* The sender's control connection and its reverse one, for a sender or two */
+        raop->video_httpd = httpd_init(raop->logger, &httpd_cbs, 4);
+        if (!raop->video_httpd) {
+            return -1;
+        }
+    }
+    return httpd_start(raop->video_httpd, port);
+}
+static void
+raop_collect_conn_metrics(raop_conn_t *conn, metrics_t *metrics) {
+    char id[16];
+    snprintf(id, sizeof(id), "%u", conn->id);
+    metrics_label_t session[] = { { "session", id } };
+
+    for (int i = SETUP_FIRST_REQUEST + 1; conn->setup_timeline && i < SETUP_MILESTONE_COUNT; i++) {
+        int64_t time = setup_timeline_get(conn->setup_timeline, i);
+        if (time >= 0) {
+            metrics_label_t labels[] = { { "session", id }, { "milestone", setup_timeline_name(i) } };
+            metrics_add(metrics, "raop_setup_milestone_seconds", METRICS_GAUGE, "Time from the first request to a milestone of the setup",
+                        labels, 2, time / 1000000.0);
+        }
+    }
+
+    if (conn->reactor) {
+        session_reactor_stats_t reactor;
+        session_reactor_get_stats(conn->reactor, &reactor);
+        metrics_add(metrics, "raop_session_reactor_wakeups_total", METRICS_COUNTER, "Times the session's reactor thread woke up",
+                    session, 1, (double) reactor.wakeups);
+        metrics_add(metrics, "raop_session_reactor_callbacks_total", METRICS_COUNTER, "Socket and timer callbacks the session's reactor ran",
+                    session, 1, (double) (reactor.io_calls + reactor.timer_calls));
+    }
+
+    if (conn->raop_ntp) {
+        raop_ntp_stats_t ntp;
+        raop_ntp_get_stats(conn->raop_ntp, &ntp);
+        metrics_add(metrics, "raop_ntp_offset_seconds", METRICS_GAUGE, "Offset of the sender's clock",
+                    session, 1, ntp.offset / 1000000.0);
+        metrics_add(metrics, "raop_ntp_delay_seconds", METRICS_GAUGE, "Network delay of the timing exchange",
+                    session, 1, ntp.delay / 1000000.0);
+        metrics_add(metrics, "raop_ntp_jitter_seconds", METRICS_GAUGE, "Jitter of the clock offset",
+                    session, 1, ntp.jitter / 1000000.0);
+        metrics_add(metrics, "raop_ntp_skew_ppm", METRICS_GAUGE, "Rate of the sender's clock against ours",
+                    session, 1, ntp.skew);
+        metrics_add(metrics, "raop_ntp_requests_total", METRICS_COUNTER, "Timing requests sent",
+                    session, 1, (double) ntp.requests);
+        metrics_add(metrics, "raop_ntp_timeouts_total", METRICS_COUNTER, "Timing requests that got no response",
+                    session, 1, (double) ntp.timeouts);
+    }
+
+    if (conn->raop_rtp) {
+        raop_rtp_stats_t rtp;
+        raop_rtp_get_stats(conn->raop_rtp, &rtp);
+        metrics_add(metrics, "raop_audio_packets_received_total", METRICS_COUNTER, "Audio data packets received",
+                    session, 1, (double) rtp.received_packets);
+        metrics_add(metrics, "raop_audio_bytes_received_total", METRICS_COUNTER, "Bytes of the audio data packets received",
+                    session, 1, (double) rtp.received_bytes);
+        metrics_add(metrics, "raop_audio_packets_lost_total", METRICS_COUNTER, "Audio data packets that never arrived on the data socket",
+                    session, 1, (double) rtp.lost_packets);
+        metrics_add(metrics, "raop_audio_packets_reordered_total", METRICS_COUNTER, "Audio data packets that arrived behind a newer one",
+                    session, 1, (double) rtp.reordered_packets);
+        metrics_add(metrics, "raop_audio_packets_duplicate_total", METRICS_COUNTER, "Audio data packets received twice",
+                    session, 1, (double) rtp.duplicate_packets);
+        metrics_add(metrics, "raop_audio_packets_late_total", METRICS_COUNTER, "Audio packets that arrived after their turn",
+                    session, 1, (double) rtp.buffer.too_late_packets);
+        metrics_add(metrics, "raop_audio_packets_skipped_total", METRICS_COUNTER, "Missing audio packets played out as gaps",
+                    session, 1, (double) rtp.buffer.skipped_packets);
+        metrics_add(metrics, "raop_audio_jitter_seconds", METRICS_GAUGE, "Interarrival jitter of the audio packets",
+                    session, 1, rtp.buffer.jitter / 1000000.0);
+        metrics_add(metrics, "raop_audio_buffer_depth_packets", METRICS_GAUGE, "Packets the jitter buffer waits for before skipping a missing one",
+                    session, 1, rtp.buffer.target_depth);
+        metrics_add(metrics, "raop_audio_buffer_queued_packets", METRICS_GAUGE, "Packets in the jitter buffer",
+                    session, 1, rtp.buffer.depth);
+        metrics_add(metrics, "raop_audio_resend_requests_total", METRICS_COUNTER, "Resend requests sent",
+                    session, 1, (double) rtp.buffer.resend_requests);
+        metrics_add(metrics, "raop_audio_packets_recovered_total", METRICS_COUNTER, "Resent audio packets that arrived in time",
+                    session, 1, (double) rtp.buffer.recovered_packets);
+        metrics_add(metrics, "raop_audio_resend_rtt_seconds", METRICS_GAUGE, "Round trip of a resend request",
+                    session, 1, rtp.buffer.resend_rtt / 1000000.0);
+        metrics_add(metrics, "raop_audio_frames_played_total", METRICS_COUNTER, "Audio frames handed to the renderer",
+                    session, 1, (double) rtp.playout.played);
+        metrics_add(metrics, "raop_audio_frames_late_total", METRICS_COUNTER, "Audio frames handed to the renderer after their pts",
+                    session, 1, (double) rtp.playout.late);
+        metrics_add(metrics, "raop_audio_frames_dropped_total", METRICS_COUNTER, "Audio frames dropped because the playout queue was full",
+                    session, 1, (double) rtp.playout.overflows);
+    }
+
+    if (conn->raop_rtp_mirror) {
+        raop_rtp_mirror_stats_t mirror;
+        raop_rtp_mirror_get_stats(conn->raop_rtp_mirror, &mirror);
+        metrics_add(metrics, "raop_video_frames_received_total", METRICS_COUNTER, "Mirrored video frames received",
+                    session, 1, (double) mirror.received_frames);
+        metrics_add(metrics, "raop_video_bytes_received_total", METRICS_COUNTER, "Payload bytes of the video frames received",
+                    session, 1, (double) mirror.received_bytes);
+        metrics_add(metrics, "raop_video_frames_dropped_total", METRICS_COUNTER, "Late video frames skipped to catch up",
+                    session, 1, (double) mirror.dropped_frames);
+        metrics_add(metrics, "raop_video_decoder_resyncs_total", METRICS_COUNTER, "Skips to the next IDR after decoder errors",
+                    session, 1, (double) mirror.decoder_resyncs);
+        metrics_label_t instant_labels[] = { { "session", id }, { "window", "0.5s" } };
+        metrics_add(metrics, "raop_video_bitrate_bps", METRICS_GAUGE, "Bitrate the sender encodes at, by the frames' pts",
+                    instant_labels, 2, (double) mirror.stream.instant_bitrate);
+        metrics_label_t window_labels[] = { { "session", id }, { "window", "5s" } };
+        metrics_add(metrics, "raop_video_bitrate_bps", METRICS_GAUGE, "Bitrate the sender encodes at, by the frames' pts",
+                    window_labels, 2, (double) mirror.stream.bitrate);
+        metrics_label_t sender_labels[] = { { "session", id }, { "side", "sender" } };
+        metrics_add(metrics, "raop_video_frame_rate", METRICS_GAUGE, "Frames per second the sender encodes and the renderer is given",
+                    sender_labels, 2, mirror.stream.frame_rate);
+        metrics_label_t renderer_labels[] = { { "session", id }, { "side", "renderer" } };
+        metrics_add(metrics, "raop_video_frame_rate", METRICS_GAUGE, "Frames per second the sender encodes and the renderer is given",
+                    renderer_labels, 2, mirror.stream.rendered_rate);
+        metrics_add(metrics, "raop_video_idr_interval_seconds", METRICS_GAUGE, "Time between the sender's last two IDRs",
+                    session, 1, mirror.stream.idr_interval / 1000000.0);
+        metrics_add(metrics, "raop_video_falling_behind", METRICS_GAUGE, "1 while the renderer gets under nine in ten of the frames sent",
+                    session, 1, mirror.stream.falling_behind ? 1 : 0);
+        static const char *frame_kinds[STREAM_FRAME_KINDS] = { "idr", "reference", "disposable" };
+        for (int i = 0; i < STREAM_FRAME_KINDS; i++) {
+            metrics_label_t labels[] = { { "session", id }, { "kind", frame_kinds[i] } };
+            metrics_add(metrics, "raop_video_frame_size_bytes", METRICS_GAUGE, "Average size of the frames received, by kind",
+                        labels, 2, (double) mirror.stream.frame_bytes[i]);
+        }
+        metrics_label_t disposable_labels[] = { { "session", id }, { "kind", "disposable" } };
+        metrics_add(metrics, "raop_video_frames_thinned_total", METRICS_COUNTER, "Video frames dropped to thin a stream running late",
+                    disposable_labels, 2, (double) mirror.disposable_drops);
+        metrics_label_t tail_labels[] = { { "session", id }, { "kind", "gop_tail" } };
+        metrics_add(metrics, "raop_video_frames_thinned_total", METRICS_COUNTER, "Video frames dropped to thin a stream running late",
+                    tail_labels, 2, (double) mirror.tail_drops);
+        metrics_label_t static_labels[] = { { "session", id }, { "kind", "static" } };
+        metrics_add(metrics, "raop_video_frames_thinned_total", METRICS_COUNTER, "Video frames dropped to thin a stream running late",
+                    static_labels, 2, (double) mirror.static_drops);
+        metrics_add(metrics, "raop_video_static_frames_total", METRICS_COUNTER, "Video frames repeating the picture before them",
+                    session, 1, (double) mirror.static_frames);
+        metrics_add(metrics, "raop_video_frames_unsynced_total", METRICS_COUNTER, "Video frames held back before the first IDR",
+                    session, 1, (double) mirror.unsynced_frames);
+        metrics_add(metrics, "raop_video_heartbeats_total", METRICS_COUNTER, "Heartbeats on the mirror stream",
+                    session, 1, (double) mirror.heartbeats);
+        metrics_add(metrics, "raop_video_unknown_packets_total", METRICS_COUNTER, "Mirror stream packets of unknown type",
+                    session, 1, (double) mirror.unknown_packets);
+
+        const struct { const char *stage; latency_histogram_stats_t *stats; } stages[] = {
+            { "receive", &mirror.receive_delay },
+            { "decrypt", &mirror.arrival_to_decrypt },
+            { "submit", &mirror.decrypt_to_submit },
+            { "render", &mirror.submit_duration },
+            { "display", &mirror.display_offset },
+        };
+        for (int i = 0; i < 5; i++) {
+            metrics_label_t labels[] = { { "session", id }, { "stage", stages[i].stage } };
+            metrics_add_latency(metrics, "raop_video_latency_seconds", "Time a video frame spends in a stage of the pipeline",
+                                labels, 2, stages[i].stats);
+        }
+
+        const struct { const char *queue; spsc_ring_stats_t *stats; } queues[] = {
+            { "decrypt", &mirror.decrypt_queue },
+            { "submit", &mirror.submit_queue },
+        };
+        for (int i = 0; i < 2; i++) {
+            metrics_label_t labels[] = { { "session", id }, { "queue", queues[i].queue } };
+            metrics_add(metrics, "raop_video_queue_frames", METRICS_GAUGE, "Frames waiting in front of a stage",
+                        labels, 2, queues[i].stats->depth);
+            metrics_add(metrics, "raop_video_queue_full_total", METRICS_COUNTER, "Times a stage found the queue in front of the next one full",
+                        labels, 2, (double) queues[i].stats->full_count);
+        }
+
+        metrics_add(metrics, "raop_video_pool_buffers_in_use", METRICS_GAUGE, "Frame buffers handed out by the pool",
+                    session, 1, mirror.frame_pool.buffers_in_use);
+        metrics_add(metrics, "raop_video_pool_bytes_in_use", METRICS_GAUGE, "Bytes of the frame buffers handed out by the pool",
+                    session, 1, (double) mirror.frame_pool.bytes_in_use);
+        metrics_add(metrics, "raop_video_pool_bytes_allocated", METRICS_GAUGE, "Bytes held by the frame pool, in use or cached",
+                    session, 1, (double) mirror.frame_pool.bytes_allocated);
+        metrics_add(metrics, "raop_video_pool_bytes_locked", METRICS_GAUGE, "Bytes of the frame pool locked in memory",
+                    session, 1, (double) mirror.frame_pool.bytes_locked);
+        metrics_label_t minor_labels[] = { { "session", id }, { "kind", "minor" } };
+        metrics_label_t major_labels[] = { { "session", id }, { "kind", "major" } };
+        metrics_add(metrics, "raop_video_page_faults_total", METRICS_COUNTER, "Page faults taken by the mirror stages and the renderer calls",
+                    minor_labels, 2, (double) mirror.minor_faults);
+        metrics_add(metrics, "raop_video_page_faults_total", METRICS_COUNTER, "Page faults taken by the mirror stages and the renderer calls",
+                    major_labels, 2, (double) mirror.major_faults);
+        metrics_add(metrics, "raop_video_pool_misses_total", METRICS_COUNTER, "Frame buffers the pool had to allocate",
+                    session, 1, (double) mirror.frame_pool.misses);
+        metrics_add(metrics, "raop_video_pool_over_budget_total", METRICS_COUNTER, "Frame buffers refused over the memory budget",
+                    session, 1, (double) mirror.frame_pool.over_budget);
+        metrics_add(metrics, "raop_video_frames_over_budget_total", METRICS_COUNTER, "Video frames dropped over the memory budget",
+                    session, 1, (double) mirror.over_budget_frames);
+        metrics_add(metrics, "raop_video_frames_queue_full_total", METRICS_COUNTER, "Video frames the session reactor dropped with the decrypt stage behind",
+                    session, 1, (double) mirror.queue_full_frames);
+        metrics_add(metrics, "raop_video_parallel_decrypts_total", METRICS_COUNTER, "Video frames decrypted by several threads",
+                    session, 1, (double) mirror.parallel_decrypts);
+        metrics_add(metrics, "raop_video_reconnects_total", METRICS_COUNTER, "Times the sender connected the video stream again",
+                    session, 1, (double) mirror.reconnects);
+        metrics_add(metrics, "raop_video_stream_reads_total", METRICS_COUNTER, "Reads into the receive ring of the TCP video stream",
+                    session, 1, (double) mirror.recv_ring.reads);
+        metrics_add(metrics, "raop_video_ring_frames_total", METRICS_COUNTER, "Video frames parsed in place in the receive ring",
+                    session, 1, (double) mirror.ring_frames);
+        metrics_add(metrics, "raop_video_ring_bytes_in_use", METRICS_GAUGE, "Bytes of the receive ring held by frames in flight",
+                    session, 1, (double) mirror.recv_ring.used);
+    }
+}
+
+/* Runs on the metrics server's thread for every scrape */
+static void
+raop_collect_metrics(void *opaque, metrics_t *metrics) {
+    raop_t *raop = opaque;
+    int sessions = 0;
+
+    MUTEX_LOCK(raop->conns_mutex);
+    for (raop_conn_t *conn = raop->conns; conn; conn = conn->next) {
+        raop_collect_conn_metrics(conn, metrics);
+        sessions++;
+    }
+    MUTEX_UNLOCK(raop->conns_mutex);
+    metrics_add(metrics, "raop_sessions", METRICS_GAUGE, "Open connections", NULL, 0, sessions);
+    metrics_add(metrics, "raop_sessions_streaming", METRICS_GAUGE, "Connections admitted as streaming sessions", NULL, 0,
+                __atomic_load_n(&raop->admitted_sessions, __ATOMIC_RELAXED));
+    MUTEX_LOCK(raop->conns_mutex);
+    uint64_t reconnects = raop->reconnects;
+    MUTEX_UNLOCK(raop->conns_mutex);
+    metrics_add(metrics, "raop_sender_reconnects_total", METRICS_COUNTER,
+                "Sessions that started from the clock estimate of their sender's previous one", NULL, 0, (double) reconnects);
+
+    mem_budget_stats_t memory;
+    mem_budget_get_stats(raop->memory_budget, &memory);
+    metrics_add(metrics, "raop_memory_budget_bytes", METRICS_GAUGE, "Limit on the frame buffers of all sessions, 0 if unlimited",
+                NULL, 0, (double) memory.limit);
+    metrics_add(metrics, "raop_memory_used_bytes", METRICS_GAUGE, "Frame buffers held by all sessions", NULL, 0, (double) memory.used);
+    metrics_add(metrics, "raop_memory_peak_bytes", METRICS_GAUGE, "Most frame buffers all sessions held at once", NULL, 0,
+                (double) memory.peak);
+    metrics_add(metrics, "raop_memory_refusals_total", METRICS_COUNTER, "Frame buffers refused over the shared budget", NULL, 0,
+                (double) memory.refusals);
+    if (raop->cpu_load) {
+        cpu_load_stats_t cpu;
+        cpu_load_get_stats(raop->cpu_load, &cpu);
+        metrics_add(metrics, "raop_cpu_load", METRICS_GAUGE, "Smoothed share of all cores busy", NULL, 0, cpu.system);
+        metrics_add(metrics, "raop_cpu_busiest_thread", METRICS_GAUGE, "Smoothed share of its core the busiest thread uses",
+                    NULL, 0, cpu.busiest_thread);
+        metrics_add(metrics, "raop_cpu_overloaded", METRICS_GAUGE, "1 while new sessions are refused and video is degraded",
+                    NULL, 0, cpu.overloaded);
+        metrics_add(metrics, "raop_cpu_overloads_total", METRICS_COUNTER, "Times the CPU became overloaded", NULL, 0,
+                    (double) cpu.overloads);
+    }
+    if (raop->thermal) {
+        thermal_stats_t thermal;
+        thermal_get_stats(raop->thermal, &thermal);
+        metrics_add(metrics, "raop_soc_temperature_celsius", METRICS_GAUGE, "Smoothed temperature of the SoC", NULL, 0,
+                    thermal.temperature);
+        metrics_add(metrics, "raop_soc_temperature_trend", METRICS_GAUGE, "Degrees per minute the SoC warms up",
+                    NULL, 0, thermal.trend);
+        metrics_add(metrics, "raop_soc_throttled", METRICS_GAUGE, "Throttling state the firmware reports, 0 where there is none",
+                    NULL, 0, thermal.throttled);
+        metrics_add(metrics, "raop_soc_thermal_level", METRICS_GAUGE, "0 normal, 1 warm with video thinned, 2 hot",
+                    NULL, 0, thermal.level);
+        metrics_add(metrics, "raop_soc_thermal_escalations_total", METRICS_COUNTER, "Times the SoC got warmer by a level",
+                    NULL, 0, (double) thermal.escalations);
+    }
+    if (raop->decode_scheduler) {
+        decode_scheduler_stats_t scheduler;
+        decode_scheduler_get_stats(raop->decode_scheduler, &scheduler);
+        metrics_add(metrics, "raop_decode_turns_total", METRICS_COUNTER, "Video frames handed to a renderer in turn", NULL, 0,
+                    (double) scheduler.turns);
+        metrics_add(metrics, "raop_decode_waits_total", METRICS_COUNTER, "Turns that waited for another session's frame", NULL, 0,
+                    (double) scheduler.waits);
+        metrics_add(metrics, "raop_decode_reorders_total", METRICS_COUNTER, "Turns taken ahead of a frame that came earlier",
+                    NULL, 0, (double) scheduler.reorders);
+        metrics_add(metrics, "raop_decode_wait_seconds_total", METRICS_COUNTER, "Time frames waited for their turn", NULL, 0,
+                    scheduler.wait_time / 1000000.0);
+    }
+    MUTEX_LOCK(raop->conns_mutex);
+    task_pool_t *task_pool = raop->task_pool;
+    MUTEX_UNLOCK(raop->conns_mutex);
+    if (task_pool) {
+        task_pool_stats_t pool;
+        task_pool_get_stats(task_pool, &pool);
+        metrics_add(metrics, "raop_task_pool_threads", METRICS_GAUGE, "Workers shared by all sessions", NULL, 0, pool.threads);
+        metrics_add(metrics, "raop_task_pool_tasks_total", METRICS_COUNTER, "Tasks run by the shared workers", NULL, 0,
+                    (double) pool.tasks);
+        metrics_add(metrics, "raop_task_pool_steals_total", METRICS_COUNTER, "Tasks a worker took from another's queue", NULL, 0,
+                    (double) pool.steals);
+        metrics_add(metrics, "raop_task_pool_inline_total", METRICS_COUNTER, "Tasks run by their submitter as the queues were full",
+                    NULL, 0, (double) pool.inline_runs);
+    }
+    for (int i = 0; i < RAOP_ROUTE_COUNT; i++) {
+        latency_histogram_stats_t stats;
+        latency_histogram_get_stats(raop->route_latency[i], &stats);
+        if (stats.count > 0) {
+            metrics_label_t labels[] = { { "route", raop_route_names[i] } };
+            metrics_add_latency(metrics, "raop_rtsp_handler_latency_seconds", "Time the handler of an RTSP request took",
+                                labels, 1, &stats);
+        }
+    }
+    metrics_add_thread_cpu(metrics);
+}
+
+int
+raop_start_metrics(raop_t *raop, unsigned short *port) {
+    assert(raop);
+    assert(port);
+
+    if (!raop->metrics) {
+        raop->metrics = metrics_server_init(raop->logger, raop_collect_metrics, raop);
+        if (!raop->metrics) {
+            return -1;
+        }
+    }
+    return metrics_server_start(raop->metrics, port);
+}
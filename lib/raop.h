@@ -1,9 +1,11 @@
 #ifndef RAOP_H
 #define RAOP_H
 
+#include <stddef.h>
 #include "dnssd.h"
 #include "stream.h"
 #include "raop_ntp.h"
+#include "frame_bus.h"
 
 #if defined (WIN32) && defined(DLL_EXPORT)
 # define RAOP_API __declspec(dllexport)
@@ -31,15 +33,99 @@ typedef struct raop_s raop_t;
 
 typedef void (*raop_log_callback_t)(void *cls, int level, const char *msg);
 
+/* What the renderer reports about its backlog, used for drop decisions */
+typedef struct {
+    /* Frames taken but not shown yet */
+    unsigned int queued_frames;
+    /* From handing a frame over to showing it in us, 0 if unknown */
+    uint64_t latency;
+    uint64_t dropped_frames;
+    /* From the pts of the frame shown last to it reaching the display in us, for glass-to-glass
+     * latency, only set where the renderer knows when its frames are shown */
+    int has_display_offset;
+    int64_t display_offset;
+    /* The stream is shown but not in focus, frames nothing references and the ends of short GOPs
+     * are left out as for a stream running late */
+    int thin;
+    /* Levels the session's frames go ahead of others' with raop_set_decode_scheduling */
+    int priority;
+    /* Times the decoder reported corrupt input, a running count. When it grows the stream skips
+     * to the next IDR rather than have the decoder smear on until then */
+    uint64_t decode_errors;
+} raop_renderer_stats_t;
+
+/* What the library holds in memory, for a report of the process' footprint */
+typedef struct {
+    /* Mirror frame buffers of all sessions, their high-water mark and the budget, 0 if unlimited */
+    size_t frame_bytes;
+    size_t frame_peak;
+    size_t frame_limit;
+    /* Audio jitter buffers of all sessions */
+    size_t audio_buffer_bytes;
+    /* The library's log ring */
+    size_t logger_bytes;
+} raop_memory_stats_t;
+
+/* Compression types of the audio stream, the "ct" of SETUP */
+typedef enum {
+    RAOP_AUDIO_CT_PCM = 1,
+    RAOP_AUDIO_CT_ALAC = 2,
+    RAOP_AUDIO_CT_AAC_LC = 4,
+    RAOP_AUDIO_CT_AAC_ELD = 8
+} raop_audio_compression_t;
+
+/* The audio stream as the sender set it up, AAC-ELD with 480 samples per frame unless it said otherwise */
+typedef struct {
+    int compression;
+    /* The sender's audioFormat bit, 0 if it sent none */
+    uint64_t audio_format;
+    int samples_per_frame;
+    int sample_rate;
+} raop_audio_format_t;
+
+/* Display and audio output advertised in /info, prefilled with the defaults */
+typedef struct {
+    int width;
+    int height;
+    int refresh_rate;
+    /* Frame rate senders should not exceed, 0 for refresh_rate */
+    int max_fps;
+    /* Time from its pts until audio is heard in us, advertised so senders send ahead of it */
+    uint64_t audio_output_latency;
+    /* Screen mirroring may use HEVC, the renderer decodes it */
+    int hevc;
+    /* Senders may buffer audio ahead, the audio output decodes it to PCM */
+    int buffered_audio;
+} raop_display_caps_t;
+
+/* Where a video URL is, in seconds, see raop_start_video */
+typedef struct {
+    double duration;
+    double position;
+    /* 0 while paused */
+    double rate;
+    /* The stream is loaded and can be sought in */
+    int ready_to_play;
+} raop_video_playback_t;
+
 struct raop_callbacks_s {
     void* cls;
 
+    /* Also called with data->data_len 0 at the pts of a packet lost in the network, to conceal it */
     void  (*audio_process)(void *cls, raop_ntp_t *ntp, aac_decode_struct *data);
-    void  (*video_process)(void *cls, raop_ntp_t *ntp, h264_decode_struct *data);
+    /* Returns -1 if the frame could not be taken, video is then dropped until the next IDR frame */
+    int   (*video_process)(void *cls, raop_ntp_t *ntp, h264_decode_struct *data);
 
     /* Optional but recommended callback functions */
     void  (*conn_init)(void *cls);
     void  (*conn_destroy)(void *cls);
+
+    /* Optional per-connection state, so that every sender can have renderers of its own. What
+     * session_init returns replaces cls in the stream callbacks of that connection, from
+     * audio_process to video_get_stats, NULL refuses the connection. session_destroy gets it
+     * back once the connection's streams are gone. */
+    void *(*session_init)(void *cls);
+    void  (*session_destroy)(void *cls, void *session);
     void  (*audio_flush)(void *cls);
     void  (*video_flush)(void *cls);
     void  (*audio_set_volume)(void *cls, float volume);
@@ -47,6 +133,43 @@ struct raop_callbacks_s {
     void  (*audio_set_coverart)(void *cls, const void *buffer, int buflen);
     void  (*audio_remote_control_id)(void *cls, const char *dacp_id, const char *active_remote_header);
     void  (*audio_set_progress)(void *cls, unsigned int start, unsigned int curr, unsigned int end);
+    /* Called at SETUP before any audio of the stream is processed */
+    void  (*audio_set_format)(void *cls, const raop_audio_format_t *format);
+
+    /* Optional zero-copy video input. If video_acquire_buffer returns memory, the frame is received
+     * and decrypted straight into it and handed back through video_submit_buffer instead of
+     * video_process. All three have to be set for the path to be used. */
+    unsigned char *(*video_acquire_buffer)(void *cls, int size, void **handle);
+    void  (*video_submit_buffer)(void *cls, raop_ntp_t *ntp, void *handle, h264_decode_struct *data);
+    void  (*video_release_buffer)(void *cls, void *handle);
+
+    /* Optional variants of audio_process and video_process that hand over the buffer. If set they
+     * are called instead, with data->data pointing at frame->data, and the callee owns the one
+     * reference to frame it is given. */
+    void  (*audio_process_frame)(void *cls, raop_ntp_t *ntp, stream_frame_t *frame, aac_decode_struct *data);
+    int   (*video_process_frame)(void *cls, raop_ntp_t *ntp, stream_frame_t *frame, h264_decode_struct *data);
+
+    /* Optional, used with raop_set_progressive_video: a large video frame in parts of whole NAL units
+     * as they arrive, all with the frame's pts and data->partial set on all but the last. Called from
+     * the mirror thread like video_process, never at the same time. Returns -1 if the frame could not
+     * be taken, no more parts of it follow then and video is dropped until the next IDR frame. */
+    int   (*video_process_part)(void *cls, raop_ntp_t *ntp, h264_decode_struct *data);
+
+    /* Optional renderer queries. video_get_stats is called from the mirror thread for every frame,
+     * before it is submitted while a latency budget is set and after it always, get_display_caps
+     * whenever /info is rebuilt. */
+    void  (*video_get_stats)(void *cls, raop_renderer_stats_t *stats);
+    void  (*get_display_caps)(void *cls, raop_display_caps_t *caps);
+
+    /* Video URL playback, see raop_start_video. Called with the server's cls from the httpd threads
+     * of the airplay port, one at a time, and must not block on the stream. video_url_play replaces
+     * what is playing and starts at start_seconds, or at start_fraction of the duration where the
+     * sender gave that instead. video_url_get_playback returns -1 while nothing is playing. */
+    void  (*video_url_play)(void *cls, const char *url, double start_seconds, double start_fraction);
+    void  (*video_url_scrub)(void *cls, double position);
+    void  (*video_url_rate)(void *cls, double rate);
+    void  (*video_url_stop)(void *cls);
+    int   (*video_url_get_playback)(void *cls, raop_video_playback_t *playback);
 };
 typedef struct raop_callbacks_s raop_callbacks_t;
 
@@ -54,13 +177,143 @@ RAOP_API raop_t *raop_init(int max_clients, raop_callbacks_t *callbacks);
 
 RAOP_API void raop_set_log_level(raop_t *raop, int level);
 RAOP_API void raop_set_log_callback(raop_t *raop, raop_log_callback_t callback, void *cls);
+/*
+ * Keeps the pairing identity in keyfile, creating it with mode 0600 if it doesn't exist, so senders
+ * see the same receiver across restarts. Call after the log callback is set and before raop_start.
+ * Returns -1, keeping the generated identity, if the file is malformed or can't be written.
+ */
+RAOP_API int raop_set_keyfile(raop_t *raop, const char *keyfile);
 RAOP_API void raop_set_port(raop_t *raop, unsigned short port);
 RAOP_API unsigned short raop_get_port(raop_t *raop);
+RAOP_API void raop_set_video_latency_budget(raop_t *raop, unsigned int latency_budget_ms);
+/*
+ * Bytes of frame buffers each session may hold and all of them together, 0 is unlimited. Frames
+ * over either are dropped, and a session is only set up while the total has room for one more.
+ */
+RAOP_API void raop_set_memory_budget(raop_t *raop, size_t session_bytes, size_t total_bytes);
+RAOP_API void raop_get_memory_stats(raop_t *raop, raop_memory_stats_t *stats);
+/*
+ * Senders that may stream at once, 0 is unlimited. Those over it are refused at SETUP, and while
+ * it is reached, or the CPU is overloaded with a session streaming, the TXT records say busy.
+ */
+RAOP_API void raop_set_max_sessions(raop_t *raop, unsigned int max_sessions);
+/*
+ * Faults in the frame buffers and receive ring of every mirror session as it starts and locks them in
+ * memory, so the first IDR doesn't wait on page faults. Locking needs CAP_IPC_LOCK or RLIMIT_MEMLOCK.
+ */
+RAOP_API void raop_set_lock_memory(raop_t *raop, int enabled);
+/*
+ * Leaves out mirrored frames that repeat the picture before them, tiny P-frames of skipped macroblocks
+ * as senders send them for a still screen, where no other frame references them. They are decrypted
+ * but neither decoded nor shown again.
+ */
+RAOP_API void raop_set_coalesce_static(raop_t *raop, int enabled);
+/*
+ * Passes large mirrored frames received over TCP on to video_process_part NAL by NAL as they arrive,
+ * so the decoder works on the first slices of an IDR while the rest is still on the network. Needs
+ * the video_process_part callback, and is off for sessions that are recorded.
+ */
+RAOP_API void raop_set_progressive_video(raop_t *raop, int enabled);
+/*
+ * Receives the timing, audio and UDP video of each session on one epoll thread instead of a thread
+ * each. Video over TCP keeps its receive thread, it waits for the later stages when they fall behind.
+ */
+RAOP_API void raop_set_session_reactor(raop_t *raop, int enabled);
+/*
+ * Receives mirror video over UDP, in the fragment framing of mirror_udp_buffer.h, from senders whose
+ * SETUP Transport header carries MIRROR_UDP_TRANSPORT_TOKEN. Off by default, mirroring then stays on TCP.
+ */
+RAOP_API void raop_set_mirror_udp(raop_t *raop, int enabled);
+/*
+ * Offers senders in /info to sync the session to their PTP clock rather than to their NTP server.
+ * Those that take it up at SETUP are followed as a PTP slave on the ports 319 and 320, see
+ * raop_ntp_set_ptp; advertise it with dnssd_set_ptp.
+ */
+RAOP_API void raop_set_ptp(raop_t *raop, int enabled);
+/*
+ * For receivers without a display: /info offers no screen and none of the video features, and a
+ * sender asking to mirror at SETUP is refused before any of the mirror pipeline is set up for it.
+ * Advertise it with dnssd_set_audio_only.
+ */
+RAOP_API void raop_set_audio_only(raop_t *raop, int enabled);
+/* Threads each mirror session decrypts large frames with besides its own, 0 decrypts on one */
+RAOP_API void raop_set_decrypt_threads(raop_t *raop, unsigned int threads);
+/*
+ * Percent of all cores busy at which the host counts as overloaded, 0 stops watching. While it
+ * is, or a thread uses up its core, a second sender is refused at SETUP, /info offers at most
+ * 720p30 and mirror sessions drop late frames sooner. Call before raop_start.
+ */
+RAOP_API int raop_set_cpu_limit(raop_t *raop, unsigned int percent);
+/*
+ * Temperature of the SoC in degrees Celsius to stay below, 0 stops watching. Once it heads for it
+ * or the firmware caps the clocks, mirror sessions thin their video and /info offers at most 720p30.
+ * At it, or throttled, a second sender is refused at SETUP and late frames are dropped sooner as
+ * well. Call before raop_start.
+ */
+RAOP_API int raop_set_thermal_limit(raop_t *raop, unsigned int celsius);
+/*
+ * Lets the mirror sessions hand their frames to the renderers one at a time, earliest deadline
+ * first, the deadline being a frame's pts plus the latency budget, moved forward by the priority
+ * the renderer reports. A frame that waited past it is dropped as any late frame would be. For
+ * senders sharing a hardware decoder or a few cores. Call before raop_start.
+ */
+RAOP_API int raop_set_decode_scheduling(raop_t *raop, int enabled);
+/*
+ * Milliseconds a sender whose connection went away may take to come back and have its new session
+ * start from the old one's clock estimate, 0 keeps none. A mirror stream that is cut off while its
+ * connection lasts always waits for the sender with the session's keys and keystream position.
+ */
+RAOP_API void raop_set_reconnect_grace(raop_t *raop, unsigned int grace_ms);
+RAOP_API void raop_set_capture_dir(raop_t *raop, const char *capture_dir);
+/* Records every following session to a new fragmented MP4 file in mp4_dir, NULL stops recording */
+RAOP_API void raop_set_mp4_dir(raop_t *raop, const char *mp4_dir);
+/* Appends a line of JSON summing up every connection to filename as it closes, NULL stops it */
+RAOP_API void raop_set_session_log(raop_t *raop, const char *filename);
+/* Pins the receive, decrypt and submit stages of a session to consecutive cores, with every
+ * connection open at once starting one core further along. Core numbers wrap around the cores
+ * online, so with more stages than cores the sessions share them. */
+RAOP_API void raop_set_cpu_affinity(raop_t *raop, int enabled);
+/* Sends mirrored video on to host as RTP without decoding it, can be called for several destinations */
+RAOP_API int raop_add_restream(raop_t *raop, const char *host, unsigned short port);
+/*
+ * Publishes the mirrored access units of every following session in the shared memory object
+ * /dev/shm/<name> for other processes on the host, see shm_output.h for its layout. Call once,
+ * before raop_start. Returns -1 if the object or its reader socket can't be created.
+ */
+RAOP_API int raop_set_shm_output(raop_t *raop, const char *name);
+/*
+ * Subscribes a consumer such as a thumbnailer to the frames of every following session, next to
+ * the recorder and the restream ones. It runs on a thread of its own behind its own queue, so it
+ * cannot hold up the renderers. Returns -1 if there are too many.
+ */
+RAOP_API int raop_add_frame_consumer(raop_t *raop, const frame_bus_subscriber_config_t *config);
+/* Plays a mirror capture into the video callbacks without a sender, returns the frames replayed or -1 */
+RAOP_API int raop_replay_mirror(raop_t *raop, const char *filename, int realtime);
+/*
+ * Plays an audio capture into the audio callbacks without a sender, dropping loss_percent of the
+ * packets and delaying each by up to jitter_ms. Returns the packets replayed or -1.
+ */
+RAOP_API int raop_replay_audio(raop_t *raop, const char *filename, int loss_percent, int jitter_ms);
 RAOP_API void *raop_get_callback_cls(raop_t *raop);
 RAOP_API int raop_start(raop_t *raop, unsigned short *port);
 RAOP_API int raop_is_running(raop_t *raop);
 RAOP_API void raop_stop(raop_t *raop);
+/*
+ * Serves the counters of every open connection and the CPU time of every thread over HTTP on
+ * *port, as Prometheus text from /metrics and as JSON from /metrics.json. They are read when
+ * scraped, so keeping them costs the streams nothing. Returns -1 on error.
+ */
+RAOP_API int raop_start_metrics(raop_t *raop, unsigned short *port);
+/*
+ * Serves the HTTP side of AirPlay on *port, the one the airplay service is registered with, so
+ * senders hand a video's URL over instead of mirroring it: /play, /scrub, /rate, /stop and
+ * /playback-info go to the video_url callbacks, which all have to be set, and /info and pairing
+ * are answered as on the RTSP port. Connections there don't count as sessions. Returns -1 on error.
+ */
+RAOP_API int raop_start_video(raop_t *raop, unsigned short *port);
 RAOP_API void raop_set_dnssd(raop_t *raop, dnssd_t *dnssd);
+/* Pushes changed dnssd settings to the registered TXT records in place and rebuilds /info */
+RAOP_API void raop_update_info(raop_t *raop);
 RAOP_API void raop_destroy(raop_t *raop);
 
 #ifdef __cplusplus
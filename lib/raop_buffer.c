@@ -19,6 +19,7 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <time.h>
 
 #include "raop_buffer.h"
 #include "raop_rtp.h"
@@ -27,7 +28,31 @@
 #include "compat.h"
 #include "stream.h"
 
-#define RAOP_BUFFER_LENGTH 32
+/* Capacity of the buffer, the playout depth adapts below it */
+#define RAOP_BUFFER_LENGTH 64
+
+/* Bytes every buffer allocates up front, and what all of them hold together */
+#define RAOP_BUFFER_SIZE (sizeof(raop_buffer_t) + RAOP_BUFFER_LENGTH * RAOP_BUFFER_SLOT_SIZE)
+static size_t raop_buffer_total_size;
+
+/* Limits and starting point of the adaptive depth, in packets */
+#define RAOP_BUFFER_MIN_DEPTH 2
+#define RAOP_BUFFER_INITIAL_DEPTH 32
+
+/* The depth only shrinks by one packet per interval, in microseconds */
+#define RAOP_BUFFER_SHRINK_INTERVAL 1000000
+
+/* Packet duration assumed until measured, 480 samples at 44.1 kHz */
+#define RAOP_BUFFER_DEFAULT_PACKET_DURATION 10884.0
+
+/* Resend interval used until a round trip is measured, and its lower bound, in microseconds */
+#define RAOP_BUFFER_MIN_RESEND_INTERVAL 20000
+
+/* Requests per missing packet, each one waits twice as long as the previous */
+#define RAOP_BUFFER_MAX_RESEND_ATTEMPTS 4
+
+/* Inline payload storage per entry, large enough for AAC-ELD and ALAC packets */
+#define RAOP_BUFFER_SLOT_SIZE 2048
 
 typedef struct {
     /* Data available */
@@ -37,9 +62,19 @@ typedef struct {
     unsigned short seqnum;
     uint64_t timestamp;
 
-    /* Payload data */
+    /* Payload data, points into the slab or into overflow_data */
     unsigned int payload_size;
     void *payload_data;
+
+    /* Local time of the last resend request for this seqnum, 0 if none */
+    uint64_t resend_time;
+    /* Local time the next request is due, and requests sent so far */
+    uint64_t next_resend;
+    unsigned int resend_attempts;
+
+    /* Kept across packets for payloads larger than the slab slot */
+    unsigned char *overflow_data;
+    unsigned int overflow_size;
 } raop_buffer_entry_t;
 
 struct raop_buffer_s {
@@ -47,6 +82,8 @@ struct raop_buffer_s {
     /* Key and IV used for decryption */
     unsigned char aeskey[RAOP_AESKEY_LEN];
     unsigned char aesiv[RAOP_AESIV_LEN];
+    /* Every packet is decrypted with the same key and IV, so one context is rewound per packet */
+    aes_ctx_t *aes_ctx;
 
     /* First and last seqnum */
     int is_empty;
@@ -55,8 +92,47 @@ struct raop_buffer_s {
 
     /* RTP buffer entries */
     raop_buffer_entry_t entries[RAOP_BUFFER_LENGTH];
+
+    /* Payload storage for all entries, allocated once per session */
+    unsigned char *slab;
+
+    /* Adaptive playout depth, see raop_buffer_adapt_depth */
+    int target_depth;
+    int max_depth;
+    int fixed_depth;
+    int have_last_arrival;
+    uint64_t last_arrival;
+    uint64_t last_timestamp;
+    uint64_t last_shrink;
+    double jitter;
+    double packet_duration;
+    double resend_rtt;
+    /* Furthest a packet arrived behind the newest, recedes by one packet per shrink interval */
+    int reorder_depth;
+    uint64_t last_reorder;
+
+    /* Timestamp of the last packet dequeued, lost packets are placed after it */
+    int have_dequeued;
+    uint64_t dequeued_timestamp;
+
+    /* Time source, CLOCK_MONOTONIC unless a simulation sets its own */
+    raop_buffer_clock_cb_t clock;
+    void *clock_opaque;
+
+    raop_buffer_stats_t stats;
 };
 
+static uint64_t
+raop_buffer_now(raop_buffer_t *raop_buffer)
+{
+    struct timespec time;
+    if (raop_buffer->clock) {
+        return raop_buffer->clock(raop_buffer->clock_opaque);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return ((uint64_t) time.tv_sec) * 1000000 + time.tv_nsec / 1000;
+}
+
 void
 raop_buffer_init_key_iv(raop_buffer_t *raop_buffer,
                         const unsigned char *aeskey,
@@ -76,14 +152,6 @@ raop_buffer_init_key_iv(raop_buffer_t *raop_buffer,
 
     memcpy(raop_buffer->aeskey, eaeskey, 16);
     memcpy(raop_buffer->aesiv, aesiv, RAOP_AESIV_LEN);
-
-#ifdef DUMP_AUDIO
-    if (file_keyiv != NULL) {
-        fwrite(raop_buffer->aeskey, 16, 1, file_keyiv);
-        fwrite(raop_buffer->aesiv, 16, 1, file_keyiv);
-        fclose(file_keyiv);
-    }
-#endif
 }
 
 raop_buffer_t *
@@ -100,16 +168,31 @@ raop_buffer_init(logger_t *logger,
     if (!raop_buffer) {
         return NULL;
     }
+    raop_buffer->slab = malloc(RAOP_BUFFER_LENGTH * RAOP_BUFFER_SLOT_SIZE);
+    if (!raop_buffer->slab) {
+        free(raop_buffer);
+        return NULL;
+    }
     raop_buffer->logger = logger;
     raop_buffer_init_key_iv(raop_buffer, aeskey, aesiv, ecdh_secret);
+    raop_buffer->aes_ctx = aes_cbc_init(raop_buffer->aeskey, raop_buffer->aesiv, AES_DECRYPT);
 
     for (int i = 0; i < RAOP_BUFFER_LENGTH; i++) {
         raop_buffer_entry_t *entry = &raop_buffer->entries[i];
         entry->payload_data = NULL;
         entry->payload_size = 0;
+        entry->overflow_data = NULL;
+        entry->overflow_size = 0;
+        entry->resend_time = 0;
+        entry->next_resend = 0;
+        entry->resend_attempts = 0;
     }
 
+    __atomic_fetch_add(&raop_buffer_total_size, RAOP_BUFFER_SIZE, __ATOMIC_RELAXED);
     raop_buffer->is_empty = 1;
+    raop_buffer->target_depth = RAOP_BUFFER_INITIAL_DEPTH;
+    raop_buffer->max_depth = RAOP_BUFFER_LENGTH;
+    raop_buffer->packet_duration = RAOP_BUFFER_DEFAULT_PACKET_DURATION;
 
     return raop_buffer;
 }
@@ -117,26 +200,21 @@ raop_buffer_init(logger_t *logger,
 void
 raop_buffer_destroy(raop_buffer_t *raop_buffer)
 {
-    for (int i = 0; i < RAOP_BUFFER_LENGTH; i++) {
-        raop_buffer_entry_t *entry = &raop_buffer->entries[i];
-        if (entry->payload_data != NULL) {
-            free(entry->payload_data);
-        }
-    }
-
     if (raop_buffer) {
+        for (int i = 0; i < RAOP_BUFFER_LENGTH; i++) {
+            free(raop_buffer->entries[i].overflow_data);
+        }
+        aes_cbc_destroy(raop_buffer->aes_ctx);
+        free(raop_buffer->slab);
         free(raop_buffer);
+        __atomic_fetch_sub(&raop_buffer_total_size, RAOP_BUFFER_SIZE, __ATOMIC_RELAXED);
     }
+}
 
-#ifdef DUMP_AUDIO
-    if (file_aac != NULL) {
-        fclose(file_aac);
-    }
-    if (file_source != NULL) {
-        fclose(file_source);
-    }
-#endif
-
+size_t
+raop_buffer_get_total_size(void)
+{
+    return __atomic_load_n(&raop_buffer_total_size, __ATOMIC_RELAXED);
 }
 
 static short
@@ -145,54 +223,99 @@ seqnum_cmp(unsigned short s1, unsigned short s2)
     return (s1 - s2);
 }
 
-//#define DUMP_AUDIO
+/*
+ * Sizes the playout depth so that a late or resent packet normally arrives
+ * before its turn: four times the interarrival jitter plus one resend round
+ * trip, in packets, and no less than the recent reordering. The depth grows
+ * at once when conditions get worse and shrinks one packet at a time once
+ * they improve.
+ */
+static void
+raop_buffer_adapt_depth(raop_buffer_t *raop_buffer, uint64_t now)
+{
+    if (raop_buffer->fixed_depth) {
+        return;
+    }
+    double wait = 4.0 * raop_buffer->jitter + raop_buffer->resend_rtt;
+    int desired = (int) (wait / raop_buffer->packet_duration + 0.999) + 1;
+    if (raop_buffer->reorder_depth > 0 && now - raop_buffer->last_reorder >= RAOP_BUFFER_SHRINK_INTERVAL) {
+        raop_buffer->reorder_depth--;
+        raop_buffer->last_reorder = now;
+    }
+    if (desired < raop_buffer->reorder_depth + 1) desired = raop_buffer->reorder_depth + 1;
+    if (desired < RAOP_BUFFER_MIN_DEPTH) desired = RAOP_BUFFER_MIN_DEPTH;
+    if (desired > raop_buffer->max_depth) desired = raop_buffer->max_depth;
+
+    if (desired > raop_buffer->target_depth) {
+        logger_log(raop_buffer->logger, LOGGER_DEBUG, "raop_buffer growing depth %d -> %d, jitter = %.0f us, resend rtt = %.0f us",
+                   raop_buffer->target_depth, desired, raop_buffer->jitter, raop_buffer->resend_rtt);
+        raop_buffer->target_depth = desired;
+        raop_buffer->last_shrink = now;
+        raop_buffer->stats.grow_count++;
+    } else if (desired < raop_buffer->target_depth && now - raop_buffer->last_shrink >= RAOP_BUFFER_SHRINK_INTERVAL) {
+        raop_buffer->target_depth--;
+        raop_buffer->last_shrink = now;
+        raop_buffer->stats.shrink_count++;
+        logger_log(raop_buffer->logger, LOGGER_DEBUG, "raop_buffer shrinking depth to %d, jitter = %.0f us, resend rtt = %.0f us",
+                   raop_buffer->target_depth, raop_buffer->jitter, raop_buffer->resend_rtt);
+    }
+}
+
+static void
+raop_buffer_update_timing(raop_buffer_t *raop_buffer, raop_buffer_entry_t *entry, unsigned short seqnum, uint64_t timestamp,
+                          uint64_t arrival)
+{
+    uint64_t now = raop_buffer_now(raop_buffer);
 
-#ifdef DUMP_AUDIO
-static FILE* file_aac = NULL;
-static FILE* file_source = NULL;
-static FILE* file_keyiv = NULL;
-#endif
+    if (!arrival) {
+        arrival = now;
+    }
 
+    if (entry->resend_time) {
+        /* A packet we asked for came back, use it for the resend round trip */
+        double rtt = (double) (now - entry->resend_time);
+        raop_buffer->resend_rtt = raop_buffer->stats.recovered_packets ? raop_buffer->resend_rtt + (rtt - raop_buffer->resend_rtt) / 8.0 : rtt;
+        raop_buffer->stats.recovered_packets++;
+        entry->resend_time = 0;
+        entry->next_resend = 0;
+        entry->resend_attempts = 0;
+    } else if (raop_buffer->is_empty || seqnum_cmp(seqnum, raop_buffer->last_seqnum) > 0) {
+        /* Interarrival jitter as in RFC 3550 section 6.4.1, on the newest packets only */
+        if (raop_buffer->have_last_arrival && timestamp > raop_buffer->last_timestamp) {
+            int64_t d = ((int64_t) (arrival - raop_buffer->last_arrival)) - ((int64_t) (timestamp - raop_buffer->last_timestamp));
+            if (d < 0) d = -d;
+            raop_buffer->jitter += ((double) d - raop_buffer->jitter) / 16.0;
+            if (!raop_buffer->is_empty && seqnum_cmp(seqnum, raop_buffer->last_seqnum) == 1) {
+                double duration = (double) (timestamp - raop_buffer->last_timestamp);
+                raop_buffer->packet_duration += (duration - raop_buffer->packet_duration) / 16.0;
+            }
+        }
+        raop_buffer->have_last_arrival = 1;
+        raop_buffer->last_arrival = arrival;
+        raop_buffer->last_timestamp = timestamp;
+    }
+    raop_buffer_adapt_depth(raop_buffer, now);
+}
 
 int
 raop_buffer_decrypt(raop_buffer_t *raop_buffer, unsigned char *data, unsigned char* output, unsigned int payload_size, unsigned int *outputlen)
 {
     assert(raop_buffer);
     int encryptedlen;
-#ifdef DUMP_AUDIO
-    if (file_aac == NULL) {
-        file_aac = fopen("/home/pi/Airplay.aac", "wb");
-        file_source = fopen("/home/pi/Airplay.source", "wb");
-        file_keyiv = fopen("/home/pi/Airplay.keyiv", "wb");
-    }
-    // Undecrypted file
-    if (file_source != NULL) {
-        fwrite(&data[12], payloadsize, 1, file_source);
-    }
-#endif
-
     encryptedlen = payload_size / 16*16;
-    memset(output, 0, payload_size);
-    // Need to be initialized internally
-    aes_ctx_t *aes_ctx_audio = aes_cbc_init(raop_buffer->aeskey, raop_buffer->aesiv, AES_DECRYPT);
-    aes_cbc_decrypt(aes_ctx_audio, &data[12], output, encryptedlen);
-    aes_cbc_destroy(aes_ctx_audio);
+    /* Every packet starts over from the session IV */
+    aes_batch_item_t item = { &data[12], output, encryptedlen, NULL };
+    aes_decrypt_batch(raop_buffer->aes_ctx, &item, 1);
 
     memcpy(output + encryptedlen, &data[12 + encryptedlen], payload_size - encryptedlen);
     *outputlen = payload_size;
 
-#ifdef DUMP_AUDIO
-    // Decrypted file
-    if (file_aac != NULL) {
-        fwrite(output, payloadsize, 1, file_aac);
-    }
-#endif
-
     return 1;
 }
 
 int
-raop_buffer_enqueue(raop_buffer_t *raop_buffer, unsigned char *data, unsigned short datalen, uint64_t timestamp, int use_seqnum) {
+raop_buffer_enqueue(raop_buffer_t *raop_buffer, unsigned char *data, unsigned short datalen, uint64_t timestamp, uint64_t arrival,
+                    int use_seqnum) {
     assert(raop_buffer);
 
     /* Check packet data length is valid */
@@ -202,7 +325,7 @@ raop_buffer_enqueue(raop_buffer_t *raop_buffer, unsigned char *data, unsigned sh
     if (datalen == 16 && data[12] == 0x0 && data[13] == 0x68 && data[14] == 0x34 && data[15] == 0x0) {
         return 0;
     }
-    int payload_size = datalen - 12;
+    unsigned int payload_size = datalen - 12;
 
     /* Get correct seqnum for the packet */
     unsigned short seqnum;
@@ -214,6 +337,7 @@ raop_buffer_enqueue(raop_buffer_t *raop_buffer, unsigned char *data, unsigned sh
 
     /* If this packet is too late, just skip it */
     if (!raop_buffer->is_empty && seqnum_cmp(seqnum, raop_buffer->first_seqnum) < 0) {
+        raop_buffer->stats.too_late_packets++;
         return 0;
     }
 
@@ -229,12 +353,29 @@ raop_buffer_enqueue(raop_buffer_t *raop_buffer, unsigned char *data, unsigned sh
         return 0;
     }
 
+    raop_buffer_update_timing(raop_buffer, entry, seqnum, timestamp, arrival);
+
     /* Update the raop_buffer entry header */
     entry->seqnum = seqnum;
     entry->timestamp = timestamp;
     entry->filled = 1;
 
-    entry->payload_data = malloc(payload_size);
+    unsigned char *storage = raop_buffer->slab + (seqnum % RAOP_BUFFER_LENGTH) * RAOP_BUFFER_SLOT_SIZE;
+    if (payload_size > RAOP_BUFFER_SLOT_SIZE) {
+        /* Rare oversized packet, its buffer is kept for the next one */
+        if (payload_size > entry->overflow_size) {
+            unsigned char *overflow_data = realloc(entry->overflow_data, payload_size);
+            if (!overflow_data) {
+                /* Treat it like a lost packet */
+                entry->filled = 0;
+                return 0;
+            }
+            entry->overflow_data = overflow_data;
+            entry->overflow_size = payload_size;
+        }
+        storage = entry->overflow_data;
+    }
+    entry->payload_data = storage;
     int decrypt_ret = raop_buffer_decrypt(raop_buffer, data, entry->payload_data, payload_size, &entry->payload_size);
     assert(decrypt_ret >= 0);
     assert(entry->payload_size <= payload_size);
@@ -252,8 +393,11 @@ raop_buffer_enqueue(raop_buffer_t *raop_buffer, unsigned char *data, unsigned sh
 }
 
 void *
-raop_buffer_dequeue(raop_buffer_t *raop_buffer, unsigned int *length, uint64_t *timestamp, int no_resend) {
+raop_buffer_dequeue(raop_buffer_t *raop_buffer, unsigned int *length, uint64_t *timestamp, int no_resend, int *lost) {
     assert(raop_buffer);
+    assert(lost);
+
+    *lost = 0;
 
     /* Calculate number of entries in the current buffer */
     short entry_count = seqnum_cmp(raop_buffer->last_seqnum, raop_buffer->first_seqnum)+1;
@@ -268,20 +412,34 @@ raop_buffer_dequeue(raop_buffer_t *raop_buffer, unsigned int *length, uint64_t *
     if (no_resend) {
         /* If we do no resends, always return the first entry */
     } else if (!entry->filled) {
-        /* Check how much we have space left in the buffer */
-        if (entry_count < RAOP_BUFFER_LENGTH) {
+        /* Wait for a resend until as many packets are queued as the current depth */
+        if (entry_count < raop_buffer->target_depth) {
             /* Return nothing and hope resend gets on time */
             return NULL;
         }
-        /* Risk of buffer overrun, return empty buffer */
+        /* Out of time for this packet, skip it */
     }
 
     /* Update buffer and validate entry */
     raop_buffer->first_seqnum += 1;
     if (!entry->filled) {
+        entry->resend_time = 0;
+        entry->next_resend = 0;
+        entry->resend_attempts = 0;
+        raop_buffer->stats.skipped_packets++;
+        if (!raop_buffer->have_dequeued) {
+            /* Nothing to place it after, the stream simply starts later */
+            return NULL;
+        }
+        raop_buffer->dequeued_timestamp += (uint64_t) raop_buffer->packet_duration;
+        *timestamp = raop_buffer->dequeued_timestamp;
+        *length = 0;
+        *lost = 1;
         return NULL;
     }
     entry->filled = 0;
+    raop_buffer->have_dequeued = 1;
+    raop_buffer->dequeued_timestamp = entry->timestamp;
 
     /* Return entry payload buffer */
     *timestamp = entry->timestamp;
@@ -292,24 +450,70 @@ raop_buffer_dequeue(raop_buffer_t *raop_buffer, unsigned int *length, uint64_t *
     return data;
 }
 
+/*
+ * Requests every missing packet that is due, one request per contiguous
+ * range. A packet is requested again after one resend round trip, doubling
+ * each time, and given up once its answer could no longer arrive before
+ * dequeue skips it. Cheap enough to be called on every receive loop
+ * iteration, nothing is sent until a request is due.
+ */
 void raop_buffer_handle_resends(raop_buffer_t *raop_buffer, raop_resend_cb_t resend_cb, void *opaque) {
     assert(raop_buffer);
     assert(resend_cb);
 
-    if (seqnum_cmp(raop_buffer->first_seqnum, raop_buffer->last_seqnum) < 0) {
-        int seqnum, count;
+    if (raop_buffer->is_empty) {
+        return;
+    }
+    short entry_count = seqnum_cmp(raop_buffer->last_seqnum, raop_buffer->first_seqnum)+1;
+    if (entry_count <= 1) {
+        return;
+    }
+
+    uint64_t now = raop_buffer_now(raop_buffer);
+    uint64_t interval = (uint64_t) raop_buffer->resend_rtt;
+    if (interval < RAOP_BUFFER_MIN_RESEND_INTERVAL) {
+        interval = RAOP_BUFFER_MIN_RESEND_INTERVAL;
+    }
 
-        for (seqnum = raop_buffer->first_seqnum; seqnum_cmp(seqnum, raop_buffer->last_seqnum) < 0; seqnum++) {
-            raop_buffer_entry_t *entry = &raop_buffer->entries[seqnum % RAOP_BUFFER_LENGTH];
-            if (entry->filled) {
-                break;
+    unsigned short range_start = 0;
+    unsigned short range_count = 0;
+    for (int i = 0; i < entry_count; i++) {
+        unsigned short seqnum = raop_buffer->first_seqnum + i;
+        raop_buffer_entry_t *entry = &raop_buffer->entries[seqnum % RAOP_BUFFER_LENGTH];
+        int due = 0;
+
+        if (!entry->filled && entry->resend_attempts < RAOP_BUFFER_MAX_RESEND_ATTEMPTS &&
+            (entry->resend_attempts == 0 || now >= entry->next_resend)) {
+            /* Dequeue skips this packet once the queue reaches the target depth ahead of it */
+            double remaining = (raop_buffer->target_depth - entry_count + i) * raop_buffer->packet_duration;
+            if (remaining < (double) interval) {
+                entry->resend_attempts = RAOP_BUFFER_MAX_RESEND_ATTEMPTS;
+                raop_buffer->stats.abandoned_packets++;
+            } else {
+                due = 1;
             }
         }
-        if (seqnum_cmp(seqnum, raop_buffer->first_seqnum) == 0) {
-            return;
+
+        if (due) {
+            if (entry->resend_attempts == 0) {
+                raop_buffer->stats.requested_packets++;
+            }
+            entry->resend_time = now;
+            entry->next_resend = now + (interval << entry->resend_attempts);
+            entry->resend_attempts++;
+            if (range_count == 0) {
+                range_start = seqnum;
+            }
+            range_count++;
+        } else if (range_count > 0) {
+            resend_cb(opaque, range_start, range_count);
+            raop_buffer->stats.resend_requests++;
+            range_count = 0;
         }
-        count = seqnum_cmp(seqnum, raop_buffer->first_seqnum);
-        resend_cb(opaque, raop_buffer->first_seqnum, count);
+    }
+    if (range_count > 0) {
+        resend_cb(opaque, range_start, range_count);
+        raop_buffer->stats.resend_requests++;
     }
 }
 
@@ -317,12 +521,15 @@ void raop_buffer_flush(raop_buffer_t *raop_buffer, int next_seq) {
     assert(raop_buffer);
 
     for (int i = 0; i < RAOP_BUFFER_LENGTH; i++) {
-        if (raop_buffer->entries[i].payload_data) {
-            free(raop_buffer->entries[i].payload_data);
-            raop_buffer->entries[i].payload_size = 0;
-        }
+        raop_buffer->entries[i].payload_data = NULL;
+        raop_buffer->entries[i].payload_size = 0;
+        raop_buffer->entries[i].resend_time = 0;
+        raop_buffer->entries[i].next_resend = 0;
+        raop_buffer->entries[i].resend_attempts = 0;
         raop_buffer->entries[i].filled = 0;
     }
+    raop_buffer->have_last_arrival = 0;
+    raop_buffer->have_dequeued = 0;
     if (next_seq < 0 || next_seq > 0xffff) {
         raop_buffer->is_empty = 1;
     } else {
@@ -330,3 +537,47 @@ void raop_buffer_flush(raop_buffer_t *raop_buffer, int next_seq) {
         raop_buffer->last_seqnum = next_seq - 1;
     }
 }
+
+void raop_buffer_note_reorder(raop_buffer_t *raop_buffer, unsigned int distance) {
+    assert(raop_buffer);
+
+    if (distance > RAOP_BUFFER_LENGTH) {
+        distance = RAOP_BUFFER_LENGTH;
+    }
+    if ((int) distance >= raop_buffer->reorder_depth) {
+        raop_buffer->reorder_depth = distance;
+        raop_buffer->last_reorder = raop_buffer_now(raop_buffer);
+    }
+}
+
+void raop_buffer_set_depth(raop_buffer_t *raop_buffer, int max_depth, int fixed) {
+    assert(raop_buffer);
+
+    if (max_depth < RAOP_BUFFER_MIN_DEPTH) max_depth = RAOP_BUFFER_MIN_DEPTH;
+    if (max_depth > RAOP_BUFFER_LENGTH) max_depth = RAOP_BUFFER_LENGTH;
+    raop_buffer->max_depth = max_depth;
+    raop_buffer->fixed_depth = fixed;
+    if (fixed || raop_buffer->target_depth > max_depth) {
+        raop_buffer->target_depth = max_depth;
+    }
+}
+
+void raop_buffer_set_clock(raop_buffer_t *raop_buffer, raop_buffer_clock_cb_t clock, void *opaque) {
+    assert(raop_buffer);
+
+    raop_buffer->clock = clock;
+    raop_buffer->clock_opaque = opaque;
+}
+
+void raop_buffer_get_stats(raop_buffer_t *raop_buffer, raop_buffer_stats_t *stats) {
+    assert(raop_buffer);
+    assert(stats);
+
+    memcpy(stats, &raop_buffer->stats, sizeof(raop_buffer_stats_t));
+    stats->target_depth = raop_buffer->target_depth;
+    stats->depth = raop_buffer->is_empty ? 0 : seqnum_cmp(raop_buffer->last_seqnum, raop_buffer->first_seqnum) + 1;
+    if (stats->depth < 0) stats->depth = 0;
+    stats->jitter = (uint64_t) raop_buffer->jitter;
+    stats->packet_duration = (uint64_t) raop_buffer->packet_duration;
+    stats->resend_rtt = (uint64_t) raop_buffer->resend_rtt;
+}
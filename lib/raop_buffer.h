@@ -15,21 +15,65 @@
 #ifndef RAOP_BUFFER_H
 #define RAOP_BUFFER_H
 
+#include <stddef.h>
+#include <stdint.h>
 #include "logger.h"
-#include "raop_rtp.h"
 
 typedef struct raop_buffer_s raop_buffer_t;
 
+typedef struct {
+    /* Packets the buffer waits for before skipping a missing one, and packets queued now */
+    int target_depth;
+    int depth;
+    /* Interarrival jitter, packet duration and resend round trip, in microseconds */
+    uint64_t jitter;
+    uint64_t packet_duration;
+    uint64_t resend_rtt;
+    /* Adaptation decisions */
+    uint64_t grow_count;
+    uint64_t shrink_count;
+    /* Resend requests sent, and distinct packets they asked for */
+    uint64_t resend_requests;
+    uint64_t requested_packets;
+    /* Resent packets that arrived in time, and packets that arrived after their turn */
+    uint64_t recovered_packets;
+    uint64_t too_late_packets;
+    /* Missing packets given up before their deadline, and missing packets played out as gaps */
+    uint64_t abandoned_packets;
+    uint64_t skipped_packets;
+} raop_buffer_stats_t;
+
 typedef int (*raop_resend_cb_t)(void *opaque, unsigned short seqno, unsigned short count);
+/* Current time in us, on the same clock as the arrival times passed to enqueue */
+typedef uint64_t (*raop_buffer_clock_cb_t)(void *opaque);
 
 raop_buffer_t *raop_buffer_init(logger_t *logger,
                                 const unsigned char *aeskey,
                                 const unsigned char *aesiv,
                                 const unsigned char *ecdh_secret);
-int raop_buffer_enqueue(raop_buffer_t *raop_buffer, unsigned char *data, unsigned short datalen, uint64_t timestamp, int use_seqnum);
-void *raop_buffer_dequeue(raop_buffer_t *raop_buffer, unsigned int *length, uint64_t *timestamp, int no_resend);
+/*
+ * arrival is when the packet reached the host in us, e.g. the kernel's receive timestamp, so scheduling
+ * delay doesn't count as jitter. Any clock will do as long as it's the same for the session, 0 means now.
+ */
+int raop_buffer_enqueue(raop_buffer_t *raop_buffer, unsigned char *data, unsigned short datalen, uint64_t timestamp, uint64_t arrival,
+                        int use_seqnum);
+/*
+ * The returned payload is owned by the buffer and stays valid until the next enqueue or flush.
+ * A missing packet that is skipped returns NULL with *lost set, *length 0 and *timestamp the
+ * time it would have played at, so the audio stage can conceal it.
+ */
+void *raop_buffer_dequeue(raop_buffer_t *raop_buffer, unsigned int *length, uint64_t *timestamp, int no_resend, int *lost);
 void raop_buffer_handle_resends(raop_buffer_t *raop_buffer, raop_resend_cb_t resend_cb, void *opaque);
 void raop_buffer_flush(raop_buffer_t *raop_buffer, int next_seq);
+/* A packet arrived distance packets behind the newest, the depth stays above that until it recedes */
+void raop_buffer_note_reorder(raop_buffer_t *raop_buffer, unsigned int distance);
+void raop_buffer_get_stats(raop_buffer_t *raop_buffer, raop_buffer_stats_t *stats);
+/* Bytes all audio buffers of the process hold, their packet slabs included */
+size_t raop_buffer_get_total_size(void);
+/* Caps the adaptive depth at max_depth packets, at most the buffer length. With fixed the depth stays at max_depth */
+void raop_buffer_set_depth(raop_buffer_t *raop_buffer, int max_depth, int fixed);
+/* Replaces CLOCK_MONOTONIC, so a simulation can run on virtual time. NULL goes back to it */
+void raop_buffer_set_clock(raop_buffer_t *raop_buffer, raop_buffer_clock_cb_t clock, void *opaque);
 
 int raop_buffer_decrypt(raop_buffer_t *raop_buffer, unsigned char *data, unsigned char* output,
                         unsigned int datalen, unsigned int *outputlen);
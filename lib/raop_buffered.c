@@ -0,0 +1,669 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/eventfd.h>
+
+#include "raop_buffered.h"
+#include "netutils.h"
+#include "compat.h"
+#include "crypto.h"
+#include "threads.h"
+#include "trace.h"
+#include "thread_attr.h"
+
+/* Buffered packets, at 352 frames each a little over half a minute of ALAC */
+#define RAOP_BUFFERED_CAPACITY 4096
+
+/* Packets due this far ahead go to the renderer in one burst, in microseconds. It has to fit the
+ * renderer's own queue, the PCM scheduler holds 64 packets */
+#define RAOP_BUFFERED_LEAD_TIME 400000
+
+/* The player wakes up again when the renderer has this much left to play, in microseconds */
+#define RAOP_BUFFERED_REFILL_TIME 200000
+
+/* Initial payload storage per entry, grown for larger packets */
+#define RAOP_BUFFERED_SLOT_SIZE 2048
+
+/* The 2-byte length in front of every packet counts itself */
+#define RAOP_BUFFERED_MAX_PACKET 0xffff
+#define RAOP_BUFFERED_RTP_HEADER 12
+/* Every packet ends with the tag and the last 8 bytes of its nonce */
+#define RAOP_BUFFERED_TRAILER (CHACHA20_POLY1305_TAG_SIZE + 8)
+
+/* Sequence numbers are 24 bits wide */
+#define RAOP_BUFFERED_SEQ_MASK 0xffffff
+
+typedef struct {
+    unsigned char *data;
+    unsigned int data_len;
+    unsigned int data_size;
+    uint32_t seq;
+    uint32_t rtp_time;
+    bool flushed;
+} raop_buffered_entry_t;
+
+struct raop_buffered_s {
+    logger_t *logger;
+    raop_callbacks_t callbacks;
+    raop_ntp_t *ntp;
+    chacha20_poly1305_ctx_t *cipher;
+    int sample_rate;
+
+    /* Entries from release to head were handed to the renderer but may not be heard yet, those from head
+     * to tail are still to hand over. The entry at tail is only touched by the receive thread */
+    raop_buffered_entry_t *entries;
+    unsigned int release;
+    unsigned int head;
+    unsigned int tail;
+
+    /* Receive buffer for one packet, only touched by the receive thread */
+    unsigned char *packet;
+
+    int data_sock;
+    int stream_sock;
+    int wake_fd;
+    unsigned short data_lport;
+
+    /* MUTEX LOCKED VARIABLES START */
+    bool running;
+    bool joined;
+    bool playing;
+    bool has_anchor;
+    uint32_t anchor_rtp_time;
+    uint64_t anchor_local_time;
+    /* The player wants to know as soon as a packet arrives */
+    bool starved;
+    /* Pause, drops what the renderer holds and hands it over again on resume */
+    bool rewind;
+    /* Flush the renderer, packets it was handed were flushed */
+    bool flush_renderer;
+    /* Packets received from now on are dropped while in the flushed range */
+    bool flush_pending;
+    bool flush_has_from;
+    uint32_t flush_from;
+    uint32_t flush_until;
+    bool volume_changed;
+    float volume;
+    raop_buffered_stats_t stats;
+    thread_handle_t thread_receive;
+    thread_handle_t thread_player;
+    mutex_handle_t mutex;
+    /* The player waits on cond, the receive thread on space_cond when the ring is full */
+    cond_handle_t cond;
+    cond_handle_t space_cond;
+    /* MUTEX LOCKED VARIABLES END */
+};
+
+raop_buffered_t *
+raop_buffered_init(logger_t *logger, raop_callbacks_t *callbacks, raop_ntp_t *ntp,
+                   const unsigned char *shk, const raop_audio_format_t *format)
+{
+    raop_buffered_t *raop_buffered;
+
+    assert(logger);
+    assert(callbacks);
+    assert(shk);
+    assert(format);
+
+    raop_buffered = calloc(1, sizeof(raop_buffered_t));
+    if (!raop_buffered) {
+        return NULL;
+    }
+    raop_buffered->entries = calloc(RAOP_BUFFERED_CAPACITY, sizeof(raop_buffered_entry_t));
+    raop_buffered->packet = malloc(RAOP_BUFFERED_MAX_PACKET);
+    if (!raop_buffered->entries || !raop_buffered->packet) {
+        free(raop_buffered->entries);
+        free(raop_buffered->packet);
+        free(raop_buffered);
+        return NULL;
+    }
+    raop_buffered->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (raop_buffered->wake_fd == -1) {
+        free(raop_buffered->entries);
+        free(raop_buffered->packet);
+        free(raop_buffered);
+        return NULL;
+    }
+    raop_buffered->logger = logger;
+    memcpy(&raop_buffered->callbacks, callbacks, sizeof(raop_callbacks_t));
+    raop_buffered->ntp = ntp;
+    raop_buffered->cipher = chacha20_poly1305_init(shk);
+    raop_buffered->sample_rate = format->sample_rate > 0 ? format->sample_rate : 44100;
+    raop_buffered->data_sock = -1;
+    raop_buffered->stream_sock = -1;
+    raop_buffered->joined = true;
+
+    MUTEX_CREATE(raop_buffered->mutex);
+    COND_CREATE_MONOTONIC(raop_buffered->cond);
+    COND_CREATE(raop_buffered->space_cond);
+    return raop_buffered;
+}
+
+/* Whether seq comes at or after ref, in 24-bit sequence number space */
+static bool
+raop_buffered_seq_after(uint32_t seq, uint32_t ref)
+{
+    return ((seq - ref) & RAOP_BUFFERED_SEQ_MASK) < (RAOP_BUFFERED_SEQ_MASK + 1) / 2;
+}
+
+/* With the mutex held */
+static bool
+raop_buffered_seq_flushed(raop_buffered_t *raop_buffered, uint32_t seq)
+{
+    if (raop_buffered_seq_after(seq, raop_buffered->flush_until)) {
+        return false;
+    }
+    return !raop_buffered->flush_has_from || raop_buffered_seq_after(seq, raop_buffered->flush_from);
+}
+
+/* Local time the entry is due at from the anchor, with the mutex held */
+static uint64_t
+raop_buffered_get_pts(raop_buffered_t *raop_buffered, raop_buffered_entry_t *entry)
+{
+    int64_t offset = (int64_t) (int32_t) (entry->rtp_time - raop_buffered->anchor_rtp_time) * 1000000 / raop_buffered->sample_rate;
+    int64_t pts = (int64_t) raop_buffered->anchor_local_time + offset;
+    return pts > 0 ? (uint64_t) pts : 0;
+}
+
+static void
+raop_buffered_wait_until(raop_buffered_t *raop_buffered, uint64_t time)
+{
+    struct timespec abstime;
+    abstime.tv_sec = time / 1000000;
+    abstime.tv_nsec = (time % 1000000) * 1000;
+    COND_TIMEDWAIT(raop_buffered->cond, raop_buffered->mutex, abstime);
+}
+
+static int
+raop_buffered_read_full(int fd, unsigned char *buf, int len)
+{
+    int readstart = 0;
+
+    while (readstart < len) {
+        int ret = recv(fd, buf + readstart, len - readstart, MSG_WAITALL);
+        if (ret == 0) {
+            return 0;
+        } else if (ret < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        readstart += ret;
+    }
+    return 1;
+}
+
+/*
+ * Decrypts a packet of len bytes into the entry. The packet is the RTP header, the
+ * payload, the tag and the nonce, of which the sender only sends the last 8 bytes.
+ * The header's timestamp and SSRC are authenticated along with the payload.
+ */
+static int
+raop_buffered_decrypt(raop_buffered_t *raop_buffered, raop_buffered_entry_t *entry, const unsigned char *packet, int len)
+{
+    unsigned char nonce[CHACHA20_POLY1305_NONCE_SIZE];
+    unsigned int data_len = len - RAOP_BUFFERED_RTP_HEADER - RAOP_BUFFERED_TRAILER;
+
+    if (data_len > entry->data_size) {
+        unsigned int data_size = data_len > RAOP_BUFFERED_SLOT_SIZE ? data_len : RAOP_BUFFERED_SLOT_SIZE;
+        unsigned char *entry_data = realloc(entry->data, data_size);
+        if (!entry_data) {
+            return -1;
+        }
+        entry->data = entry_data;
+        entry->data_size = data_size;
+    }
+    memset(nonce, 0, 4);
+    memcpy(nonce + 4, packet + len - 8, 8);
+    if (chacha20_poly1305_decrypt(raop_buffered->cipher, nonce, packet + 4, 8, packet + RAOP_BUFFERED_RTP_HEADER, data_len,
+                                  packet + len - RAOP_BUFFERED_TRAILER, entry->data) < 0) {
+        return -1;
+    }
+    entry->data_len = data_len;
+    return 0;
+}
+
+static THREAD_RETVAL
+raop_buffered_receive_thread(void *arg)
+{
+    raop_buffered_t *raop_buffered = arg;
+    assert(raop_buffered);
+
+    int stream_fd = -1;
+    unsigned char length[2];
+    unsigned char *packet = raop_buffered->packet;
+
+    thread_attr_apply(raop_buffered->logger, THREAD_ROLE_AUDIO, "rp-buffered-rx");
+
+    while (1) {
+        int ret;
+        MUTEX_LOCK(raop_buffered->mutex);
+        ret = raop_buffered->running;
+        MUTEX_UNLOCK(raop_buffered->mutex);
+        if (!ret) {
+            break;
+        }
+
+        if (stream_fd == -1) {
+            /* Sleep until the sender connects or we are told to stop */
+            struct pollfd pfds[2];
+            pfds[0].fd = raop_buffered->data_sock;
+            pfds[0].events = POLLIN;
+            pfds[1].fd = raop_buffered->wake_fd;
+            pfds[1].events = POLLIN;
+            ret = poll(pfds, 2, -1);
+            if (ret == -1) {
+                if (errno == EINTR) continue;
+                logger_log(raop_buffered->logger, LOGGER_ERR, "raop_buffered error in poll");
+                break;
+            }
+            if (pfds[1].revents) {
+                /* Stop requested */
+                break;
+            }
+            if (!(pfds[0].revents & POLLIN)) {
+                continue;
+            }
+
+            struct sockaddr_storage saddr;
+            socklen_t saddrlen = sizeof(saddr);
+            stream_fd = accept(raop_buffered->data_sock, (struct sockaddr *)&saddr, &saddrlen);
+            if (stream_fd == -1) {
+                logger_log(raop_buffered->logger, LOGGER_ERR, "raop_buffered error in accept %d %s", errno, strerror(errno));
+                break;
+            }
+            logger_log(raop_buffered->logger, LOGGER_DEBUG, "raop_buffered sender connected");
+
+            /* Publish the stream socket so stop can shut it down to interrupt a blocking read */
+            MUTEX_LOCK(raop_buffered->mutex);
+            raop_buffered->stream_sock = stream_fd;
+            ret = raop_buffered->running;
+            MUTEX_UNLOCK(raop_buffered->mutex);
+            if (!ret) break;
+            continue;
+        }
+
+        ret = raop_buffered_read_full(stream_fd, length, 2);
+        int len = ((length[0] << 8) | length[1]) - 2;
+        if (ret > 0 && len > 0) {
+            ret = raop_buffered_read_full(stream_fd, packet, len);
+        }
+        if (ret == 0) {
+            logger_log(raop_buffered->logger, LOGGER_DEBUG, "raop_buffered tcp socket closed");
+            MUTEX_LOCK(raop_buffered->mutex);
+            raop_buffered->stream_sock = -1;
+            MUTEX_UNLOCK(raop_buffered->mutex);
+            closesocket(stream_fd);
+            stream_fd = -1;
+            continue;
+        } else if (ret < 0) {
+            logger_log(raop_buffered->logger, LOGGER_ERR, "raop_buffered error in recv: %d", errno);
+            break;
+        }
+        if (len <= RAOP_BUFFERED_RTP_HEADER + RAOP_BUFFERED_TRAILER) {
+            continue;
+        }
+        uint32_t seq = ((uint32_t) packet[1] << 16) | ((uint32_t) packet[2] << 8) | packet[3];
+        uint32_t rtp_time = ((uint32_t) packet[4] << 24) | ((uint32_t) packet[5] << 16) | ((uint32_t) packet[6] << 8) | packet[7];
+
+        /* Not reading on while the ring is full holds the sender back */
+        MUTEX_LOCK(raop_buffered->mutex);
+        while (raop_buffered->running && raop_buffered->tail - raop_buffered->release >= RAOP_BUFFERED_CAPACITY) {
+            COND_WAIT(raop_buffered->space_cond, raop_buffered->mutex);
+        }
+        if (!raop_buffered->running) {
+            MUTEX_UNLOCK(raop_buffered->mutex);
+            break;
+        }
+        unsigned int tail = raop_buffered->tail;
+        MUTEX_UNLOCK(raop_buffered->mutex);
+
+        raop_buffered_entry_t *entry = &raop_buffered->entries[tail % RAOP_BUFFERED_CAPACITY];
+        ret = raop_buffered_decrypt(raop_buffered, entry, packet, len);
+        entry->seq = seq;
+        entry->rtp_time = rtp_time;
+        entry->flushed = false;
+
+        MUTEX_LOCK(raop_buffered->mutex);
+        if (ret < 0) {
+            raop_buffered->stats.decrypt_errors++;
+        } else if (raop_buffered->flush_pending && raop_buffered_seq_flushed(raop_buffered, seq)) {
+            raop_buffered->stats.flushed++;
+        } else {
+            /* The first packet past the flushed range ends it */
+            if (raop_buffered->flush_pending && raop_buffered_seq_after(seq, raop_buffered->flush_until)) {
+                raop_buffered->flush_pending = false;
+            }
+            raop_buffered->tail = tail + 1;
+            raop_buffered->stats.received++;
+            raop_buffered->stats.received_bytes += entry->data_len;
+            unsigned int depth = raop_buffered->tail - raop_buffered->release;
+            if (depth > raop_buffered->stats.peak_depth) {
+                raop_buffered->stats.peak_depth = depth;
+            }
+            if (raop_buffered->starved) {
+                COND_SIGNAL(raop_buffered->cond);
+            }
+        }
+        MUTEX_UNLOCK(raop_buffered->mutex);
+    }
+
+    if (stream_fd != -1) {
+        MUTEX_LOCK(raop_buffered->mutex);
+        raop_buffered->stream_sock = -1;
+        MUTEX_UNLOCK(raop_buffered->mutex);
+        closesocket(stream_fd);
+    }
+    logger_log(raop_buffered->logger, LOGGER_DEBUG, "raop_buffered exiting receive thread");
+    return 0;
+}
+
+/* Lets go of the entries heard by now, with the mutex held */
+static void
+raop_buffered_release(raop_buffered_t *raop_buffered, uint64_t now)
+{
+    unsigned int release = raop_buffered->release;
+    while (release != raop_buffered->head &&
+           raop_buffered_get_pts(raop_buffered, &raop_buffered->entries[release % RAOP_BUFFERED_CAPACITY]) <= now) {
+        release++;
+    }
+    if (release != raop_buffered->release) {
+        raop_buffered->release = release;
+        COND_SIGNAL(raop_buffered->space_cond);
+    }
+}
+
+static THREAD_RETVAL
+raop_buffered_player_thread(void *arg)
+{
+    raop_buffered_t *raop_buffered = arg;
+    assert(raop_buffered);
+
+    thread_attr_apply(raop_buffered->logger, THREAD_ROLE_AUDIO, "rp-buffered");
+    MUTEX_LOCK(raop_buffered->mutex);
+    while (raop_buffered->running) {
+        if (raop_buffered->rewind) {
+            /* What the renderer holds is played again from the release point on resume */
+            raop_buffered->rewind = false;
+            if (raop_buffered->has_anchor) {
+                raop_buffered_release(raop_buffered, raop_ntp_get_local_time(raop_buffered->ntp));
+            }
+            raop_buffered->head = raop_buffered->release;
+            raop_buffered->flush_renderer = true;
+        }
+        if (raop_buffered->flush_renderer) {
+            raop_buffered->flush_renderer = false;
+            MUTEX_UNLOCK(raop_buffered->mutex);
+            if (raop_buffered->callbacks.audio_flush) {
+                raop_buffered->callbacks.audio_flush(raop_buffered->callbacks.cls);
+            }
+            MUTEX_LOCK(raop_buffered->mutex);
+            continue;
+        }
+        if (raop_buffered->volume_changed) {
+            float volume = raop_buffered->volume;
+            raop_buffered->volume_changed = false;
+            MUTEX_UNLOCK(raop_buffered->mutex);
+            if (raop_buffered->callbacks.audio_set_volume) {
+                raop_buffered->callbacks.audio_set_volume(raop_buffered->callbacks.cls, volume);
+            }
+            MUTEX_LOCK(raop_buffered->mutex);
+            continue;
+        }
+        if (!raop_buffered->playing) {
+            COND_WAIT(raop_buffered->cond, raop_buffered->mutex);
+            raop_buffered->stats.wakeups++;
+            continue;
+        }
+
+        uint64_t now = raop_ntp_get_local_time(raop_buffered->ntp);
+        raop_buffered_release(raop_buffered, now);
+        if (raop_buffered->head == raop_buffered->tail) {
+            raop_buffered->starved = true;
+            COND_WAIT(raop_buffered->cond, raop_buffered->mutex);
+            raop_buffered->starved = false;
+            raop_buffered->stats.wakeups++;
+            continue;
+        }
+
+        /* Sleep until the renderer is about to run out, or until the first packet is due to go out */
+        raop_buffered_entry_t *entry = &raop_buffered->entries[raop_buffered->head % RAOP_BUFFERED_CAPACITY];
+        uint64_t pts = raop_buffered_get_pts(raop_buffered, entry);
+        uint64_t margin = raop_buffered->release != raop_buffered->head ? RAOP_BUFFERED_REFILL_TIME : RAOP_BUFFERED_LEAD_TIME;
+        if (pts > now + margin) {
+            raop_buffered_wait_until(raop_buffered, pts - margin);
+            raop_buffered->stats.wakeups++;
+            continue;
+        }
+
+        /* Hand over everything due before the next wakeup in one burst */
+        uint64_t horizon = now + RAOP_BUFFERED_LEAD_TIME;
+        raop_buffered->stats.batches++;
+        while (raop_buffered->running && raop_buffered->playing && !raop_buffered->rewind &&
+               raop_buffered->head != raop_buffered->tail) {
+            entry = &raop_buffered->entries[raop_buffered->head % RAOP_BUFFERED_CAPACITY];
+            pts = raop_buffered_get_pts(raop_buffered, entry);
+            if (pts >= horizon) {
+                break;
+            }
+            if (entry->flushed) {
+                raop_buffered->head++;
+                continue;
+            }
+            if (pts < now) {
+                /* It could not be heard anymore, e.g. after resuming at a later rtp time */
+                raop_buffered->stats.late++;
+                raop_buffered->head++;
+                continue;
+            }
+            MUTEX_UNLOCK(raop_buffered->mutex);
+
+            /* The entry stays in the ring until it is heard, a pause hands it over again */
+            aac_decode_struct aac_data;
+            aac_data.data_len = entry->data_len;
+            aac_data.data = entry->data;
+            aac_data.pts = pts;
+            trace_event(TRACE_AUDIO_PLAYOUT, entry->data_len, pts);
+            raop_buffered->callbacks.audio_process(raop_buffered->callbacks.cls, raop_buffered->ntp, &aac_data);
+
+            MUTEX_LOCK(raop_buffered->mutex);
+            raop_buffered->head++;
+            raop_buffered->stats.played++;
+        }
+    }
+    MUTEX_UNLOCK(raop_buffered->mutex);
+
+    logger_log(raop_buffered->logger, LOGGER_DEBUG, "raop_buffered exiting player thread");
+    return 0;
+}
+
+int
+raop_buffered_start(raop_buffered_t *raop_buffered, unsigned short *data_lport)
+{
+    unsigned short dport = 0;
+    int dsock;
+
+    assert(raop_buffered);
+
+    MUTEX_LOCK(raop_buffered->mutex);
+    if (raop_buffered->running || !raop_buffered->joined) {
+        MUTEX_UNLOCK(raop_buffered->mutex);
+        return -1;
+    }
+    dsock = netutils_init_socket(&dport, raop_ntp_remote_is_ipv6(raop_buffered->ntp), 0);
+    if (dsock == -1 || listen(dsock, 1) < 0) {
+        logger_log(raop_buffered->logger, LOGGER_ERR, "raop_buffered initializing socket failed");
+        if (dsock != -1) closesocket(dsock);
+        MUTEX_UNLOCK(raop_buffered->mutex);
+        return -1;
+    }
+    raop_buffered->data_sock = dsock;
+    raop_buffered->data_lport = dport;
+    if (data_lport) *data_lport = dport;
+
+    raop_buffered->release = raop_buffered->head = raop_buffered->tail = 0;
+    raop_buffered->playing = false;
+    raop_buffered->has_anchor = false;
+    raop_buffered->flush_pending = false;
+    memset(&raop_buffered->stats, 0, sizeof(raop_buffered_stats_t));
+    raop_buffered->running = true;
+    raop_buffered->joined = false;
+    THREAD_CREATE(raop_buffered->thread_player, raop_buffered_player_thread, raop_buffered);
+    THREAD_CREATE(raop_buffered->thread_receive, raop_buffered_receive_thread, raop_buffered);
+    MUTEX_UNLOCK(raop_buffered->mutex);
+
+    logger_log(raop_buffered->logger, LOGGER_INFO, "raop_buffered listening on port %u", dport);
+    return 0;
+}
+
+void
+raop_buffered_set_anchor(raop_buffered_t *raop_buffered, int rate, uint32_t rtp_time, uint64_t local_time)
+{
+    assert(raop_buffered);
+
+    MUTEX_LOCK(raop_buffered->mutex);
+    if (rate == 0) {
+        /* Keep the anchor, the player still needs it to tell what was heard */
+        if (raop_buffered->playing) {
+            raop_buffered->playing = false;
+            raop_buffered->rewind = true;
+        }
+    } else {
+        raop_buffered->anchor_rtp_time = rtp_time;
+        raop_buffered->anchor_local_time = local_time;
+        raop_buffered->has_anchor = true;
+        raop_buffered->playing = true;
+    }
+    COND_SIGNAL(raop_buffered->cond);
+    MUTEX_UNLOCK(raop_buffered->mutex);
+}
+
+void
+raop_buffered_flush(raop_buffered_t *raop_buffered, bool has_from, uint32_t from_seq, uint32_t until_seq)
+{
+    assert(raop_buffered);
+
+    MUTEX_LOCK(raop_buffered->mutex);
+    raop_buffered->flush_has_from = has_from;
+    raop_buffered->flush_from = from_seq & RAOP_BUFFERED_SEQ_MASK;
+    raop_buffered->flush_until = until_seq & RAOP_BUFFERED_SEQ_MASK;
+    raop_buffered->flush_pending = true;
+    for (unsigned int i = raop_buffered->release; i != raop_buffered->tail; i++) {
+        raop_buffered_entry_t *entry = &raop_buffered->entries[i % RAOP_BUFFERED_CAPACITY];
+        if (entry->flushed || !raop_buffered_seq_flushed(raop_buffered, entry->seq)) {
+            continue;
+        }
+        entry->flushed = true;
+        raop_buffered->stats.flushed++;
+        /* The renderer got it already */
+        if (i - raop_buffered->release < raop_buffered->head - raop_buffered->release) {
+            raop_buffered->flush_renderer = true;
+        }
+    }
+    COND_SIGNAL(raop_buffered->cond);
+    MUTEX_UNLOCK(raop_buffered->mutex);
+}
+
+void
+raop_buffered_set_volume(raop_buffered_t *raop_buffered, float volume)
+{
+    assert(raop_buffered);
+
+    MUTEX_LOCK(raop_buffered->mutex);
+    raop_buffered->volume = volume;
+    raop_buffered->volume_changed = true;
+    COND_SIGNAL(raop_buffered->cond);
+    MUTEX_UNLOCK(raop_buffered->mutex);
+}
+
+void
+raop_buffered_get_stats(raop_buffered_t *raop_buffered, raop_buffered_stats_t *stats)
+{
+    assert(raop_buffered);
+    assert(stats);
+
+    MUTEX_LOCK(raop_buffered->mutex);
+    memcpy(stats, &raop_buffered->stats, sizeof(raop_buffered_stats_t));
+    stats->depth = raop_buffered->tail - raop_buffered->release;
+    MUTEX_UNLOCK(raop_buffered->mutex);
+}
+
+void
+raop_buffered_stop(raop_buffered_t *raop_buffered)
+{
+    assert(raop_buffered);
+
+    MUTEX_LOCK(raop_buffered->mutex);
+    if (raop_buffered->joined) {
+        MUTEX_UNLOCK(raop_buffered->mutex);
+        return;
+    }
+    raop_buffered->running = false;
+    /* A blocking read on the stream returns as soon as the socket is shut down */
+    if (raop_buffered->stream_sock != -1) {
+        shutdown(raop_buffered->stream_sock, SHUT_RDWR);
+    }
+    COND_SIGNAL(raop_buffered->cond);
+    COND_SIGNAL(raop_buffered->space_cond);
+    MUTEX_UNLOCK(raop_buffered->mutex);
+
+    uint64_t wake = 1;
+    if (write(raop_buffered->wake_fd, &wake, sizeof(wake)) < 0) {
+        logger_log(raop_buffered->logger, LOGGER_WARNING, "raop_buffered could not wake receive thread");
+    }
+    THREAD_JOIN(raop_buffered->thread_receive);
+    THREAD_JOIN(raop_buffered->thread_player);
+
+    closesocket(raop_buffered->data_sock);
+    raop_buffered->data_sock = -1;
+    /* Consume the wakeup so the eventfd can be reused on the next start */
+    uint64_t value;
+    if (read(raop_buffered->wake_fd, &value, sizeof(value)) < 0) {
+        value = 0;
+    }
+
+    raop_buffered_stats_t stats;
+    raop_buffered_get_stats(raop_buffered, &stats);
+    logger_log(raop_buffered->logger, LOGGER_INFO, "raop_buffered played %llu of %llu packets in %llu bursts, %llu wakeups, late = %llu, flushed = %llu, decrypt errors = %llu, peak depth = %u",
+               (unsigned long long) stats.played, (unsigned long long) stats.received, (unsigned long long) stats.batches,
+               (unsigned long long) stats.wakeups, (unsigned long long) stats.late, (unsigned long long) stats.flushed,
+               (unsigned long long) stats.decrypt_errors, stats.peak_depth);
+
+    MUTEX_LOCK(raop_buffered->mutex);
+    raop_buffered->joined = true;
+    MUTEX_UNLOCK(raop_buffered->mutex);
+}
+
+void
+raop_buffered_destroy(raop_buffered_t *raop_buffered)
+{
+    if (raop_buffered) {
+        raop_buffered_stop(raop_buffered);
+        for (int i = 0; i < RAOP_BUFFERED_CAPACITY; i++) {
+            free(raop_buffered->entries[i].data);
+        }
+        free(raop_buffered->entries);
+        free(raop_buffered->packet);
+        chacha20_poly1305_destroy(raop_buffered->cipher);
+        close(raop_buffered->wake_fd);
+        COND_DESTROY(raop_buffered->cond);
+        COND_DESTROY(raop_buffered->space_cond);
+        MUTEX_DESTROY(raop_buffered->mutex);
+        free(raop_buffered);
+    }
+}
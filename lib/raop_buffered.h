@@ -0,0 +1,77 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#ifndef RAOP_BUFFERED_H
+#define RAOP_BUFFERED_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "raop.h"
+#include "logger.h"
+#include "raop_ntp.h"
+
+/*
+ * AirPlay 2 buffered audio, the stream type 103 that senders use for music
+ * instead of the realtime stream of raop_rtp. The sender pushes encrypted
+ * packets over TCP as far ahead as the buffer takes them and anchors an RTP
+ * time to its clock with SETRATEANCHORTIME. The receive thread fills a large
+ * ring, only held back by TCP when it is full, and the player thread hands
+ * everything due within the next RAOP_BUFFERED_LEAD_TIME to the audio
+ * callbacks in one go, then sleeps until the renderer is about to run dry.
+ * It wakes a few times a second rather than once per packet.
+ */
+
+/* Bytes of audio the sender may have in flight, advertised in the SETUP response */
+#define RAOP_BUFFERED_AUDIO_BUFFER_SIZE (8 * 1024 * 1024)
+
+typedef struct raop_buffered_s raop_buffered_t;
+
+typedef struct {
+    /* Packets and payload bytes received, and packets whose tag did not match */
+    uint64_t received;
+    uint64_t received_bytes;
+    uint64_t decrypt_errors;
+    /* Packets handed to the renderer, skipped because their pts had passed, and flushed */
+    uint64_t played;
+    uint64_t late;
+    uint64_t flushed;
+    /* Times the player thread woke up, and the bursts it handed packets over in */
+    uint64_t wakeups;
+    uint64_t batches;
+    /* Packets buffered, including those handed over but not heard yet */
+    unsigned int depth;
+    unsigned int peak_depth;
+} raop_buffered_stats_t;
+
+/* shk is the CHACHA20_POLY1305_KEY_SIZE key of the stream, format its compression and sample rate */
+raop_buffered_t *raop_buffered_init(logger_t *logger, raop_callbacks_t *callbacks, raop_ntp_t *ntp,
+                                    const unsigned char *shk, const raop_audio_format_t *format);
+/* Listens for the sender on a new TCP port, returned in data_lport. Returns -1 on error */
+int raop_buffered_start(raop_buffered_t *raop_buffered, unsigned short *data_lport);
+
+/*
+ * Plays rtp_time at local_time from now on, a rate of 0 pauses. A pause drops
+ * what the renderer has not played yet, it is handed over again on resume.
+ */
+void raop_buffered_set_anchor(raop_buffered_t *raop_buffered, int rate, uint32_t rtp_time, uint64_t local_time);
+/*
+ * Drops the packets with sequence numbers from from_seq up to until_seq, both
+ * buffered and still to come. Without has_from everything before until_seq goes.
+ */
+void raop_buffered_flush(raop_buffered_t *raop_buffered, bool has_from, uint32_t from_seq, uint32_t until_seq);
+void raop_buffered_set_volume(raop_buffered_t *raop_buffered, float volume);
+
+void raop_buffered_get_stats(raop_buffered_t *raop_buffered, raop_buffered_stats_t *stats);
+void raop_buffered_stop(raop_buffered_t *raop_buffered);
+void raop_buffered_destroy(raop_buffered_t *raop_buffered);
+
+#endif //RAOP_BUFFERED_H
@@ -0,0 +1,805 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <assert.h>
+#include <time.h>
+#include <poll.h>
+#include <netinet/tcp.h>
+
+#include <openssl/rand.h>
+#include <plist/plist.h>
+
+#include "raop_client.h"
+#include "pairing.h"
+#include "fairplay.h"
+#include "crypto.h"
+#include "mirror_buffer.h"
+#include "byteutils.h"
+#include "netutils.h"
+#include "compat.h"
+
+#define RAOP_CLIENT_USER_AGENT "AirPlay/550.10"
+/* How long the receiver may take to answer an RTSP request, in seconds */
+#define RAOP_CLIENT_TIMEOUT 5
+#define RAOP_CLIENT_MAX_HEADER 4096
+#define RAOP_CLIENT_MAX_BODY (1024 * 1024)
+#define RAOP_CLIENT_MIRROR_HEADER_LEN 128
+#define RAOP_CLIENT_AUDIO_PACKET_LEN 2048
+#define RAOP_CLIENT_AUDIO_SSRC 0x52504c44
+
+#ifdef MSG_NOSIGNAL
+#define RAOP_CLIENT_SEND_FLAGS MSG_NOSIGNAL
+#else
+#define RAOP_CLIENT_SEND_FLAGS 0
+#endif
+
+struct raop_client_s {
+    logger_t *logger;
+
+    /* Receiver address, the port is set per connection */
+    struct sockaddr_storage saddr;
+    socklen_t saddr_len;
+    unsigned short port;
+    char url[128];
+    char dacp_id[17];
+    uint32_t active_remote;
+
+    int rtsp_sock;
+    int cseq;
+
+    pairing_t *pairing;
+    pairing_session_t *pairing_session;
+    fairplay_t *fairplay;
+    unsigned char ekey[72];
+    /* Key FairPlay gives the receiver for ekey, and the IV sent along */
+    unsigned char aeskey[16];
+    unsigned char aesiv[16];
+    unsigned char ecdh_secret[X25519_KEY_SIZE];
+
+    /* Answers the receiver's time requests */
+    int timing_sock;
+    unsigned short timing_lport;
+    thread_handle_t timing_thread;
+    int timing_running;
+
+    int mirror_sock;
+    mirror_buffer_t *mirror_buffer;
+    unsigned char *mirror_packet;
+    int mirror_packet_size;
+
+    int data_sock;
+    int control_sock;
+    struct sockaddr_storage control_saddr;
+    socklen_t control_saddr_len;
+    aes_ctx_t *audio_aes;
+    uint16_t seqnum;
+    int audio_started;
+    int sync_started;
+
+    raop_client_stats_t stats;
+};
+
+static void
+raop_client_set_port(struct sockaddr_storage *saddr, unsigned short port)
+{
+    if (saddr->ss_family == AF_INET6) {
+        ((struct sockaddr_in6 *) saddr)->sin6_port = htons(port);
+    } else {
+        ((struct sockaddr_in *) saddr)->sin_port = htons(port);
+    }
+}
+
+static int
+raop_client_connect_tcp(raop_client_t *client, unsigned short port)
+{
+    struct sockaddr_storage saddr;
+    int nodelay = 1;
+    int sock;
+
+    memcpy(&saddr, &client->saddr, sizeof(saddr));
+    raop_client_set_port(&saddr, port);
+
+    sock = socket(saddr.ss_family, SOCK_STREAM, IPPROTO_TCP);
+    if (sock == -1) {
+        return -1;
+    }
+    if (connect(sock, (struct sockaddr *) &saddr, client->saddr_len) == -1) {
+        logger_log(client->logger, LOGGER_ERR, "raop_client connecting to port %u failed: %s", port, strerror(errno));
+        closesocket(sock);
+        return -1;
+    }
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (char *) &nodelay, sizeof(nodelay));
+    return sock;
+}
+
+static int
+raop_client_send_all(int sock, const unsigned char *data, int len)
+{
+    while (len > 0) {
+        ssize_t ret = send(sock, data, len, RAOP_CLIENT_SEND_FLAGS);
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        data += ret;
+        len -= ret;
+    }
+    return 0;
+}
+
+static int
+raop_client_recv_all(int sock, unsigned char *data, int len)
+{
+    while (len > 0) {
+        ssize_t ret = recv(sock, data, len, 0);
+        if (ret < 0 && errno == EINTR) continue;
+        if (ret <= 0) {
+            return -1;
+        }
+        data += ret;
+        len -= ret;
+    }
+    return 0;
+}
+
+/*
+ * Sends an RTSP request on the control connection and waits for the answer.
+ * Returns the status code, or -1 if the connection failed. The body of the
+ * answer is returned in response if given, to be freed by the caller.
+ */
+static int
+raop_client_request(raop_client_t *client, const char *method, const char *url, const char *content_type,
+                    const unsigned char *body, int body_len, unsigned char **response, int *response_len)
+{
+    char header[RAOP_CLIENT_MAX_HEADER + 1];
+    int header_len;
+    int status = -1;
+    int content_length = 0;
+
+    header_len = snprintf(header, sizeof(header),
+                          "%s %s RTSP/1.0\r\n"
+                          "CSeq: %d\r\n"
+                          "User-Agent: " RAOP_CLIENT_USER_AGENT "\r\n"
+                          "DACP-ID: %s\r\n"
+                          "Active-Remote: %u\r\n",
+                          method, url, ++client->cseq, client->dacp_id, client->active_remote);
+    if (content_type) {
+        header_len += snprintf(header + header_len, sizeof(header) - header_len, "Content-Type: %s\r\n", content_type);
+    }
+    header_len += snprintf(header + header_len, sizeof(header) - header_len, "Content-Length: %d\r\n\r\n", body_len);
+
+    if (raop_client_send_all(client->rtsp_sock, (unsigned char *) header, header_len) < 0 ||
+        (body_len > 0 && raop_client_send_all(client->rtsp_sock, body, body_len) < 0)) {
+        logger_log(client->logger, LOGGER_ERR, "raop_client sending %s %s failed: %s", method, url, strerror(errno));
+        return -1;
+    }
+
+    /* Read up to the end of the header, one byte at a time to leave the body in the socket */
+    header_len = 0;
+    while (header_len < 4 || memcmp(header + header_len - 4, "\r\n\r\n", 4)) {
+        if (header_len == RAOP_CLIENT_MAX_HEADER ||
+            raop_client_recv_all(client->rtsp_sock, (unsigned char *) header + header_len, 1) < 0) {
+            logger_log(client->logger, LOGGER_ERR, "raop_client no answer to %s %s", method, url);
+            return -1;
+        }
+        header_len++;
+    }
+    header[header_len] = '\0';
+
+    sscanf(header, "RTSP/1.0 %d", &status);
+    for (char *line = header; line; line = strstr(line, "\r\n")) {
+        if (line != header) line += 2;
+        if (!strncasecmp(line, "Content-Length:", 15)) {
+            content_length = atoi(line + 15);
+        }
+    }
+    if (content_length < 0 || content_length > RAOP_CLIENT_MAX_BODY) {
+        logger_log(client->logger, LOGGER_ERR, "raop_client invalid answer to %s %s", method, url);
+        return -1;
+    }
+
+    unsigned char *data = malloc(content_length + 1);
+    if (!data || raop_client_recv_all(client->rtsp_sock, data, content_length) < 0) {
+        logger_log(client->logger, LOGGER_ERR, "raop_client incomplete answer to %s %s", method, url);
+        free(data);
+        return -1;
+    }
+    if (response) {
+        *response = data;
+        *response_len = content_length;
+    } else {
+        free(data);
+    }
+    return status;
+}
+
+/* Sends a binary plist and parses the plist in the answer, if there is one */
+static int
+raop_client_request_plist(raop_client_t *client, const char *method, plist_t request, plist_t *response)
+{
+    char *body = NULL;
+    uint32_t body_len = 0;
+    unsigned char *data = NULL;
+    int data_len = 0;
+
+    plist_to_bin(request, &body, &body_len);
+    int status = raop_client_request(client, method, client->url, "application/x-apple-binary-plist",
+                                     (unsigned char *) body, body_len, &data, &data_len);
+    free(body);
+    if (status != 200) {
+        logger_log(client->logger, LOGGER_ERR, "raop_client %s failed with status %d", method, status);
+        free(data);
+        return -1;
+    }
+    *response = NULL;
+    if (data_len > 0) {
+        plist_from_bin((char *) data, data_len, response);
+    }
+    free(data);
+    return 0;
+}
+
+/* Looks up an integer in the first element of the streams array of a SETUP answer */
+static unsigned short
+raop_client_get_stream_port(plist_t response, const char *key)
+{
+    uint64_t port = 0;
+    plist_t streams = plist_dict_get_item(response, "streams");
+    if (PLIST_IS_ARRAY(streams) && plist_array_get_size(streams) > 0) {
+        plist_t port_node = plist_dict_get_item(plist_array_get_item(streams, 0), key);
+        if (PLIST_IS_UINT(port_node)) {
+            plist_get_uint_val(port_node, &port);
+        }
+    }
+    return (unsigned short) port;
+}
+
+static THREAD_RETVAL
+raop_client_timing_thread(void *arg)
+{
+    raop_client_t *client = arg;
+    unsigned char request[128];
+    unsigned char response[32];
+    struct sockaddr_storage saddr;
+    socklen_t saddr_len;
+
+    while (__atomic_load_n(&client->timing_running, __ATOMIC_ACQUIRE)) {
+        struct pollfd pfd = { client->timing_sock, POLLIN, 0 };
+        if (poll(&pfd, 1, 100) <= 0) {
+            continue;
+        }
+        saddr_len = sizeof(saddr);
+        ssize_t len = recvfrom(client->timing_sock, request, sizeof(request), 0, (struct sockaddr *) &saddr, &saddr_len);
+        uint64_t receive_time = raop_client_get_time(client);
+        if (len != 32 || (request[1] & ~0x80) != 0x52) {
+            continue;
+        }
+
+        /* Our origin, receive and transmit times, the receiver's send time comes back as the origin */
+        memset(response, 0, sizeof(response));
+        response[0] = 0x80;
+        response[1] = 0x53 | 0x80;
+        response[3] = 0x07;
+        memcpy(response + 8, request + 24, 8);
+        byteutils_put_ntp_timestamp(response, 16, receive_time);
+        byteutils_put_ntp_timestamp(response, 24, raop_client_get_time(client));
+        sendto(client->timing_sock, (char *) response, sizeof(response), 0, (struct sockaddr *) &saddr, saddr_len);
+        __atomic_add_fetch(&client->stats.timing_requests, 1, __ATOMIC_RELAXED);
+    }
+    return 0;
+}
+
+static int
+raop_client_pair(raop_client_t *client)
+{
+    unsigned char ed_key[ED25519_KEY_SIZE];
+    unsigned char ecdh_key[X25519_KEY_SIZE];
+    unsigned char verify[4 + X25519_KEY_SIZE + ED25519_KEY_SIZE] = { 1, 0, 0, 0 };
+    unsigned char finish[4 + PAIRING_SIG_SIZE] = { 0, 0, 0, 0 };
+    unsigned char *data = NULL;
+    int data_len = 0;
+    int ret;
+
+    /* pair-setup only swaps the Ed25519 keys */
+    pairing_get_public_key(client->pairing, ed_key);
+    ret = raop_client_request(client, "POST", "/pair-setup", "application/octet-stream", ed_key, sizeof(ed_key),
+                              &data, &data_len);
+    if (ret != 200 || data_len != ED25519_KEY_SIZE) {
+        logger_log(client->logger, LOGGER_ERR, "raop_client pair-setup failed with status %d", ret);
+        free(data);
+        return -1;
+    }
+    unsigned char receiver_ed_key[ED25519_KEY_SIZE];
+    memcpy(receiver_ed_key, data, ED25519_KEY_SIZE);
+    free(data);
+
+    if (pairing_session_client_start(client->pairing_session, ecdh_key) < 0) {
+        return -1;
+    }
+    memcpy(verify + 4, ecdh_key, X25519_KEY_SIZE);
+    memcpy(verify + 4 + X25519_KEY_SIZE, ed_key, ED25519_KEY_SIZE);
+    ret = raop_client_request(client, "POST", "/pair-verify", "application/octet-stream", verify, sizeof(verify),
+                              &data, &data_len);
+    if (ret != 200 || data_len != X25519_KEY_SIZE + PAIRING_SIG_SIZE) {
+        logger_log(client->logger, LOGGER_ERR, "raop_client pair-verify failed with status %d", ret);
+        free(data);
+        return -1;
+    }
+    ret = pairing_session_client_verify(client->pairing_session, data, receiver_ed_key, data + X25519_KEY_SIZE,
+                                        finish + 4);
+    free(data);
+    if (ret < 0) {
+        logger_log(client->logger, LOGGER_ERR, "raop_client receiver signature is invalid");
+        return -1;
+    }
+
+    ret = raop_client_request(client, "POST", "/pair-verify", "application/octet-stream", finish, sizeof(finish),
+                              NULL, NULL);
+    if (ret != 200) {
+        logger_log(client->logger, LOGGER_ERR, "raop_client pair-verify was rejected with status %d", ret);
+        return -1;
+    }
+    pairing_get_ecdh_secret_key(client->pairing_session, client->ecdh_secret);
+    return 0;
+}
+
+static int
+raop_client_fairplay(raop_client_t *client)
+{
+    unsigned char setup[16] = { 'F', 'P', 'L', 'Y', 0x03, 0x01, 0x01, 0x00, 0x00, 0x00, 0x00, 0x04, 0x02, 0x00, 0x02, 0xbb };
+    unsigned char handshake[164] = { 'F', 'P', 'L', 'Y', 0x03, 0x01, 0x03, 0x00, 0x00, 0x00, 0x00, 0x98 };
+    unsigned char ekey_header[16] = { 'F', 'P', 'L', 'Y', 0x01, 0x02, 0x01, 0x00, 0x00, 0x00, 0x00, 0x3c };
+    unsigned char reply[32];
+    unsigned char *data = NULL;
+    int data_len = 0;
+    int ret;
+
+    ret = raop_client_request(client, "POST", "/fp-setup", "application/octet-stream", setup, sizeof(setup),
+                              &data, &data_len);
+    free(data);
+    if (ret != 200 || data_len != 142) {
+        logger_log(client->logger, LOGGER_ERR, "raop_client fp-setup failed with status %d", ret);
+        return -1;
+    }
+
+    /* The key message repeats the mode chosen in the setup message */
+    handshake[12] = setup[14];
+    RAND_bytes(handshake + 13, sizeof(handshake) - 13);
+    ret = raop_client_request(client, "POST", "/fp-setup", "application/octet-stream", handshake, sizeof(handshake),
+                              &data, &data_len);
+    if (ret != 200 || data_len != 32 || memcmp(data + 12, handshake + 144, 20)) {
+        logger_log(client->logger, LOGGER_ERR, "raop_client fp-setup handshake failed with status %d", ret);
+        free(data);
+        return -1;
+    }
+    free(data);
+
+    /* The receiver decrypts ekey with the key it derives from our handshake message, doing the same tells us that key */
+    memcpy(client->ekey, ekey_header, sizeof(ekey_header));
+    RAND_bytes(client->ekey + sizeof(ekey_header), sizeof(client->ekey) - sizeof(ekey_header));
+    if (fairplay_handshake(client->fairplay, handshake, reply) < 0 ||
+        fairplay_decrypt(client->fairplay, client->ekey, client->aeskey) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+raop_client_t *
+raop_client_init(logger_t *logger, const char *host, unsigned short port)
+{
+    struct addrinfo hints;
+    struct addrinfo *result;
+    raop_client_t *client;
+
+    assert(host);
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, NULL, &hints, &result) != 0) {
+        logger_log(logger, LOGGER_ERR, "raop_client could not resolve %s", host);
+        return NULL;
+    }
+
+    client = calloc(1, sizeof(raop_client_t));
+    if (!client) {
+        freeaddrinfo(result);
+        return NULL;
+    }
+    client->logger = logger;
+    memcpy(&client->saddr, result->ai_addr, result->ai_addrlen);
+    client->saddr_len = result->ai_addrlen;
+    freeaddrinfo(result);
+    client->port = port;
+    client->rtsp_sock = -1;
+    client->timing_sock = -1;
+    client->mirror_sock = -1;
+    client->data_sock = -1;
+    client->control_sock = -1;
+
+    uint64_t id;
+    RAND_bytes((unsigned char *) &id, sizeof(id));
+    snprintf(client->dacp_id, sizeof(client->dacp_id), "%016llX", (unsigned long long) id);
+    RAND_bytes((unsigned char *) &client->active_remote, sizeof(client->active_remote));
+    snprintf(client->url, sizeof(client->url), "rtsp://%s/%llu", host, (unsigned long long) (id >> 32));
+    RAND_bytes(client->aesiv, sizeof(client->aesiv));
+    RAND_bytes((unsigned char *) &client->seqnum, sizeof(client->seqnum));
+
+    client->pairing = pairing_init_generate();
+    client->pairing_session = pairing_session_init(client->pairing);
+    client->fairplay = fairplay_init(logger);
+    if (!client->pairing_session || !client->fairplay) {
+        raop_client_destroy(client);
+        return NULL;
+    }
+    return client;
+}
+
+int
+raop_client_connect(raop_client_t *client)
+{
+    uint64_t start_time;
+    plist_t request;
+    plist_t response = NULL;
+    int ret;
+
+    assert(client);
+
+    start_time = raop_client_get_time(client);
+    client->rtsp_sock = raop_client_connect_tcp(client, client->port);
+    if (client->rtsp_sock == -1) {
+        return -1;
+    }
+    struct timeval timeout = { RAOP_CLIENT_TIMEOUT, 0 };
+    setsockopt(client->rtsp_sock, SOL_SOCKET, SO_RCVTIMEO, (char *) &timeout, sizeof(timeout));
+
+    ret = raop_client_request(client, "GET", "/info", NULL, NULL, 0, NULL, NULL);
+    if (ret != 200) {
+        logger_log(client->logger, LOGGER_ERR, "raop_client GET /info failed with status %d", ret);
+        return -1;
+    }
+    if (raop_client_pair(client) < 0 || raop_client_fairplay(client) < 0) {
+        return -1;
+    }
+
+    /* The receiver starts asking for our time as soon as it has the timing port */
+    client->timing_sock = netutils_init_socket(&client->timing_lport, client->saddr.ss_family == AF_INET6, 1);
+    if (client->timing_sock == -1) {
+        logger_log(client->logger, LOGGER_ERR, "raop_client could not open the timing socket");
+        return -1;
+    }
+    client->timing_running = 1;
+    THREAD_CREATE(client->timing_thread, raop_client_timing_thread, client);
+
+    request = plist_new_dict();
+    plist_dict_set_item(request, "ekey", plist_new_data((char *) client->ekey, sizeof(client->ekey)));
+    plist_dict_set_item(request, "eiv", plist_new_data((char *) client->aesiv, sizeof(client->aesiv)));
+    plist_dict_set_item(request, "timingPort", plist_new_uint(client->timing_lport));
+    plist_dict_set_item(request, "timingProtocol", plist_new_string("NTP"));
+    plist_dict_set_item(request, "isScreenMirroringSession", plist_new_bool(1));
+    plist_dict_set_item(request, "name", plist_new_string("rpiplay-load"));
+    plist_dict_set_item(request, "model", plist_new_string("rpiplay-load"));
+    ret = raop_client_request_plist(client, "SETUP", request, &response);
+    plist_free(request);
+    plist_free(response);
+    if (ret < 0) {
+        return -1;
+    }
+
+    ret = raop_client_request(client, "RECORD", client->url, NULL, NULL, 0, NULL, NULL);
+    if (ret != 200) {
+        logger_log(client->logger, LOGGER_ERR, "raop_client RECORD failed with status %d", ret);
+        return -1;
+    }
+    client->stats.handshake_time = raop_client_get_time(client) - start_time;
+    logger_log(client->logger, LOGGER_INFO, "raop_client connected in %llu us",
+               (unsigned long long) client->stats.handshake_time);
+    return 0;
+}
+
+int
+raop_client_setup_mirror(raop_client_t *client)
+{
+    uint64_t stream_connection_id;
+    plist_t request, streams, stream;
+    plist_t response = NULL;
+    int ret;
+
+    assert(client);
+
+    RAND_bytes((unsigned char *) &stream_connection_id, sizeof(stream_connection_id));
+    stream_connection_id >>= 1;
+
+    request = plist_new_dict();
+    streams = plist_new_array();
+    stream = plist_new_dict();
+    plist_dict_set_item(stream, "type", plist_new_uint(110));
+    plist_dict_set_item(stream, "streamConnectionID", plist_new_uint(stream_connection_id));
+    plist_array_append_item(streams, stream);
+    plist_dict_set_item(request, "streams", streams);
+    ret = raop_client_request_plist(client, "SETUP", request, &response);
+    plist_free(request);
+    if (ret < 0) {
+        return -1;
+    }
+    unsigned short data_port = raop_client_get_stream_port(response, "dataPort");
+    plist_free(response);
+    if (data_port == 0) {
+        logger_log(client->logger, LOGGER_ERR, "raop_client SETUP returned no mirror port");
+        return -1;
+    }
+
+    client->mirror_buffer = mirror_buffer_init(client->logger, client->aeskey, client->ecdh_secret);
+    if (!client->mirror_buffer) {
+        return -1;
+    }
+    mirror_buffer_init_aes(client->mirror_buffer, stream_connection_id);
+    client->mirror_sock = raop_client_connect_tcp(client, data_port);
+    return client->mirror_sock == -1 ? -1 : 0;
+}
+
+int
+raop_client_setup_audio(raop_client_t *client)
+{
+    unsigned short control_lport = 0;
+    plist_t request, streams, stream;
+    plist_t response = NULL;
+    int ret;
+
+    assert(client);
+
+    client->control_sock = netutils_init_socket(&control_lport, client->saddr.ss_family == AF_INET6, 1);
+    if (client->control_sock == -1) {
+        return -1;
+    }
+
+    request = plist_new_dict();
+    streams = plist_new_array();
+    stream = plist_new_dict();
+    plist_dict_set_item(stream, "type", plist_new_uint(96));
+    /* AAC-ELD, 480 samples per packet */
+    plist_dict_set_item(stream, "ct", plist_new_uint(8));
+    plist_dict_set_item(stream, "audioFormat", plist_new_uint(0x1000000));
+    plist_dict_set_item(stream, "spf", plist_new_uint(480));
+    plist_dict_set_item(stream, "sr", plist_new_uint(44100));
+    plist_dict_set_item(stream, "controlPort", plist_new_uint(control_lport));
+    plist_array_append_item(streams, stream);
+    plist_dict_set_item(request, "streams", streams);
+    ret = raop_client_request_plist(client, "SETUP", request, &response);
+    plist_free(request);
+    if (ret < 0) {
+        return -1;
+    }
+    unsigned short data_port = raop_client_get_stream_port(response, "dataPort");
+    unsigned short control_port = raop_client_get_stream_port(response, "controlPort");
+    plist_free(response);
+    if (data_port == 0 || control_port == 0) {
+        logger_log(client->logger, LOGGER_ERR, "raop_client SETUP returned no audio ports");
+        return -1;
+    }
+
+    struct sockaddr_storage saddr;
+    memcpy(&saddr, &client->saddr, sizeof(saddr));
+    raop_client_set_port(&saddr, data_port);
+    client->data_sock = socket(saddr.ss_family, SOCK_DGRAM, IPPROTO_UDP);
+    if (client->data_sock == -1 || connect(client->data_sock, (struct sockaddr *) &saddr, client->saddr_len) == -1) {
+        return -1;
+    }
+    memcpy(&client->control_saddr, &client->saddr, sizeof(client->control_saddr));
+    raop_client_set_port(&client->control_saddr, control_port);
+    client->control_saddr_len = client->saddr_len;
+
+    /* Same derivation as raop_buffer, the receiver only decrypts */
+    unsigned char eaeskey[64];
+    sha_ctx_t *ctx = sha_init();
+    sha_update(ctx, client->aeskey, 16);
+    sha_update(ctx, client->ecdh_secret, X25519_KEY_SIZE);
+    sha_final(ctx, eaeskey, NULL);
+    sha_destroy(ctx);
+    client->audio_aes = aes_cbc_init(eaeskey, client->aesiv, AES_ENCRYPT);
+
+    /* What a sender sets the volume to after SETUP */
+    const char volume[] = "volume: -15.000000\r\n";
+    ret = raop_client_request(client, "SET_PARAMETER", client->url, "text/parameters", (const unsigned char *) volume,
+                              strlen(volume), NULL, NULL);
+    return ret == 200 ? 0 : -1;
+}
+
+static int
+raop_client_send_mirror(raop_client_t *client, int payload_type, const unsigned char *payload, int payload_len,
+                        uint64_t time, float width, float height)
+{
+    if (client->mirror_sock == -1 || payload_len < 0) {
+        return -1;
+    }
+    if (client->mirror_packet_size < RAOP_CLIENT_MIRROR_HEADER_LEN + payload_len) {
+        unsigned char *packet = realloc(client->mirror_packet, RAOP_CLIENT_MIRROR_HEADER_LEN + payload_len);
+        if (!packet) {
+            return -1;
+        }
+        client->mirror_packet = packet;
+        client->mirror_packet_size = RAOP_CLIENT_MIRROR_HEADER_LEN + payload_len;
+    }
+
+    /* Mirror timestamps are NTP formatted but without the 1900 epoch, little endian like the rest of the header */
+    unsigned char *header = client->mirror_packet;
+    uint64_t ntp_time = ((time / 1000000) << 32) | (((time % 1000000) << 32) / 1000000);
+    memset(header, 0, RAOP_CLIENT_MIRROR_HEADER_LEN);
+    byteutils_put_int(header, 0, payload_len);
+    byteutils_put_short(header, 4, payload_type);
+    byteutils_put_long(header, 8, ntp_time);
+    if (payload_type == 1) {
+        byteutils_put_float(header, 40, width);
+        byteutils_put_float(header, 44, height);
+        byteutils_put_float(header, 56, width);
+        byteutils_put_float(header, 60, height);
+        memcpy(header + RAOP_CLIENT_MIRROR_HEADER_LEN, payload, payload_len);
+    } else {
+        mirror_buffer_decrypt(client->mirror_buffer, (unsigned char *) payload, header + RAOP_CLIENT_MIRROR_HEADER_LEN,
+                              payload_len);
+    }
+
+    uint64_t start = raop_client_get_time(client);
+    int ret = raop_client_send_all(client->mirror_sock, client->mirror_packet, RAOP_CLIENT_MIRROR_HEADER_LEN + payload_len);
+    uint64_t send_time = raop_client_get_time(client) - start;
+    if (ret < 0) {
+        logger_log(client->logger, LOGGER_ERR, "raop_client mirror connection failed: %s", strerror(errno));
+        return -1;
+    }
+
+    client->stats.video_frames++;
+    client->stats.video_bytes += payload_len;
+    client->stats.video_send_time += send_time;
+    if (send_time > client->stats.video_send_time_max) {
+        client->stats.video_send_time_max = send_time;
+    }
+    return 0;
+}
+
+int
+raop_client_send_codec(raop_client_t *client, const unsigned char *avcc, int avcc_len, float width, float height,
+                       uint64_t time)
+{
+    assert(client);
+    return raop_client_send_mirror(client, 1, avcc, avcc_len, time, width, height);
+}
+
+int
+raop_client_send_video(raop_client_t *client, const unsigned char *data, int data_len, uint64_t time)
+{
+    assert(client);
+    return raop_client_send_mirror(client, 0, data, data_len, time, 0, 0);
+}
+
+int
+raop_client_send_audio(raop_client_t *client, const unsigned char *data, int data_len, uint32_t rtp_time)
+{
+    unsigned char packet[12 + RAOP_CLIENT_AUDIO_PACKET_LEN];
+
+    assert(client);
+
+    if (client->data_sock == -1 || data_len < 0 || data_len > RAOP_CLIENT_AUDIO_PACKET_LEN) {
+        return -1;
+    }
+
+    packet[0] = 0x80;
+    packet[1] = client->audio_started ? 0x60 : 0xe0;
+    byteutils_put_short_be(packet, 2, client->seqnum++);
+    byteutils_put_int_be(packet, 4, rtp_time);
+    byteutils_put_int_be(packet, 8, RAOP_CLIENT_AUDIO_SSRC);
+
+    /* Only whole blocks are encrypted, each packet from the session IV */
+    int encrypted_len = data_len / 16 * 16;
+    aes_cbc_reset(client->audio_aes);
+    aes_cbc_encrypt(client->audio_aes, data, packet + 12, encrypted_len);
+    memcpy(packet + 12 + encrypted_len, data + encrypted_len, data_len - encrypted_len);
+
+    if (send(client->data_sock, (char *) packet, 12 + data_len, 0) < 0) {
+        logger_log(client->logger, LOGGER_WARNING, "raop_client sending audio failed: %s", strerror(errno));
+        return -1;
+    }
+    client->audio_started = 1;
+    client->stats.audio_packets++;
+    client->stats.audio_bytes += data_len;
+    return 0;
+}
+
+int
+raop_client_send_sync(raop_client_t *client, uint32_t rtp_time, uint64_t time)
+{
+    unsigned char packet[20];
+
+    assert(client);
+
+    if (client->control_sock == -1) {
+        return -1;
+    }
+    packet[0] = client->sync_started ? 0x80 : 0x90;
+    packet[1] = 0x54 | 0x80;
+    byteutils_put_short_be(packet, 2, 0x0007);
+    byteutils_put_int_be(packet, 4, rtp_time);
+    byteutils_put_ntp_timestamp(packet, 8, time);
+    byteutils_put_int_be(packet, 16, rtp_time);
+
+    if (sendto(client->control_sock, (char *) packet, sizeof(packet), 0, (struct sockaddr *) &client->control_saddr,
+               client->control_saddr_len) < 0) {
+        return -1;
+    }
+    client->sync_started = 1;
+    return 0;
+}
+
+int
+raop_client_feedback(raop_client_t *client)
+{
+    assert(client);
+    return raop_client_request(client, "POST", "/feedback", NULL, NULL, 0, NULL, NULL) == 200 ? 0 : -1;
+}
+
+uint64_t
+raop_client_get_time(raop_client_t *client)
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (uint64_t) time.tv_sec * 1000000 + (uint64_t) (time.tv_nsec / 1000);
+}
+
+void
+raop_client_get_stats(raop_client_t *client, raop_client_stats_t *stats)
+{
+    assert(client);
+    *stats = client->stats;
+    stats->timing_requests = __atomic_load_n(&client->stats.timing_requests, __ATOMIC_RELAXED);
+}
+
+void
+raop_client_teardown(raop_client_t *client)
+{
+    assert(client);
+
+    if (client->rtsp_sock != -1) {
+        raop_client_request(client, "TEARDOWN", client->url, NULL, NULL, 0, NULL, NULL);
+    }
+    if (client->timing_running) {
+        __atomic_store_n(&client->timing_running, 0, __ATOMIC_RELEASE);
+        THREAD_JOIN(client->timing_thread);
+    }
+    if (client->mirror_sock != -1) closesocket(client->mirror_sock);
+    if (client->data_sock != -1) closesocket(client->data_sock);
+    if (client->control_sock != -1) closesocket(client->control_sock);
+    if (client->timing_sock != -1) closesocket(client->timing_sock);
+    if (client->rtsp_sock != -1) closesocket(client->rtsp_sock);
+    client->mirror_sock = -1;
+    client->data_sock = -1;
+    client->control_sock = -1;
+    client->timing_sock = -1;
+    client->rtsp_sock = -1;
+}
+
+void
+raop_client_destroy(raop_client_t *client)
+{
+    if (client) {
+        raop_client_teardown(client);
+        mirror_buffer_destroy(client->mirror_buffer);
+        aes_cbc_destroy(client->audio_aes);
+        free(client->mirror_packet);
+        fairplay_destroy(client->fairplay);
+        pairing_session_destroy(client->pairing_session);
+        pairing_destroy(client->pairing);
+        free(client);
+    }
+}
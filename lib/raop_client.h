@@ -0,0 +1,79 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#ifndef RAOP_CLIENT_H
+#define RAOP_CLIENT_H
+
+#include <stdint.h>
+#include "logger.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * The sender side of a mirroring session, the counterpart of raop_handlers.h:
+ * pairing, FairPlay setup, SETUP and RECORD over RTSP, then encrypted H.264 over
+ * the mirror TCP connection and encrypted AAC-ELD over RTP. The receiver's time
+ * requests are answered from a thread of its own. Meant for load generators and
+ * tests, so it does no discovery and answers no resend requests.
+ *
+ * Times are in us on the sender clock returned by raop_client_get_time, which
+ * like an iOS device counts from an arbitrary epoch.
+ */
+
+typedef struct raop_client_s raop_client_t;
+
+typedef struct {
+    /* From connecting until RECORD was answered, in us */
+    uint64_t handshake_time;
+    uint64_t video_frames;
+    uint64_t video_bytes;
+    /* Time spent waiting for the mirror connection to take frames, in us */
+    uint64_t video_send_time;
+    uint64_t video_send_time_max;
+    uint64_t audio_packets;
+    uint64_t audio_bytes;
+    uint64_t timing_requests;
+} raop_client_stats_t;
+
+raop_client_t *raop_client_init(logger_t *logger, const char *host, unsigned short port);
+/* Connects and runs the handshake up to RECORD, returns -1 on failure */
+int raop_client_connect(raop_client_t *client);
+/* Sets up the mirror stream and connects to it */
+int raop_client_setup_mirror(raop_client_t *client);
+/* Sets up the audio stream, AAC-ELD at 44100 Hz in packets of 480 samples */
+int raop_client_setup_audio(raop_client_t *client);
+
+/* Sends an avcC record with the SPS and PPS, which goes out unencrypted */
+int raop_client_send_codec(raop_client_t *client, const unsigned char *avcc, int avcc_len, float width, float height,
+                           uint64_t time);
+/* Encrypts and sends a frame of length prefixed NAL units captured at time */
+int raop_client_send_video(raop_client_t *client, const unsigned char *data, int data_len, uint64_t time);
+/* Encrypts and sends an AAC-ELD packet, sequence numbers are counted here */
+int raop_client_send_audio(raop_client_t *client, const unsigned char *data, int data_len, uint32_t rtp_time);
+/* Tells the receiver that rtp_time is being sent at time, it plays it 11025 samples later */
+int raop_client_send_sync(raop_client_t *client, uint32_t rtp_time, uint64_t time);
+/* The keep-alive a sender posts every 2 seconds */
+int raop_client_feedback(raop_client_t *client);
+
+uint64_t raop_client_get_time(raop_client_t *client);
+void raop_client_get_stats(raop_client_t *client, raop_client_stats_t *stats);
+/* Sends TEARDOWN and closes all connections */
+void raop_client_teardown(raop_client_t *client);
+void raop_client_destroy(raop_client_t *client);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //RAOP_CLIENT_H
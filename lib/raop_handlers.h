@@ -16,6 +16,7 @@
  * functions and depends on raop internals */
 
 #include "dnssdint.h"
+#include "mirror_udp_buffer.h"
 #include "utils.h"
 #include <ctype.h>
 #include <stdlib.h>
@@ -24,21 +25,24 @@
 typedef void (*raop_handler_t)(raop_conn_t *, http_request_t *,
                                http_response_t *, char **, int *);
 
+/*
+ * Serializes the /info plist, which depends on the dnssd configuration and, while the CPU is
+ * overloaded, offers at most 720p30 so that new senders encode less. Its status flags carry the
+ * busy bit of the TXT records. Called with info_mutex held.
+ */
 static void
-raop_handler_info(raop_conn_t *conn,
-                  http_request_t *request, http_response_t *response,
-                  char **response_data, int *response_datalen)
+raop_handler_info_build(raop_t *raop, char **info_data, int *info_datalen)
 {
-    assert(conn->raop->dnssd);
+    assert(raop->dnssd);
 
     int airplay_txt_len = 0;
-    const char *airplay_txt = dnssd_get_airplay_txt(conn->raop->dnssd, &airplay_txt_len);
+    const char *airplay_txt = dnssd_get_airplay_txt(raop->dnssd, &airplay_txt_len);
 
     int name_len = 0;
-    const char *name = dnssd_get_name(conn->raop->dnssd, &name_len);
+    const char *name = dnssd_get_name(raop->dnssd, &name_len);
 
     int hw_addr_raw_len = 0;
-    const char *hw_addr_raw = dnssd_get_hw_addr(conn->raop->dnssd, &hw_addr_raw_len);
+    const char *hw_addr_raw = dnssd_get_hw_addr(raop->dnssd, &hw_addr_raw_len);
 
     char *hw_addr = calloc(1, 3 * hw_addr_raw_len);
     int hw_addr_len = utils_hwaddr_airplay(hw_addr, 3 * hw_addr_raw_len, hw_addr_raw, hw_addr_raw_len);
@@ -46,12 +50,52 @@ raop_handler_info(raop_conn_t *conn,
     int pk_len = 0;
     char *pk = utils_parse_hex(AIRPLAY_PK, strlen(AIRPLAY_PK), &pk_len);
 
+    raop_display_caps_t caps;
+    caps.width = 1920;
+    caps.height = 1080;
+    caps.refresh_rate = 60;
+    caps.max_fps = 0;
+    caps.audio_output_latency = 0;
+    caps.hevc = 0;
+    caps.buffered_audio = 0;
+    if (raop->callbacks.get_display_caps) {
+        raop->callbacks.get_display_caps(raop->callbacks.cls, &caps);
+    }
+    if (caps.refresh_rate <= 0) caps.refresh_rate = 60;
+    if (caps.max_fps <= 0) caps.max_fps = caps.refresh_rate;
+    raop->info_degraded = raop_is_degraded(raop);
+    if (raop->info_degraded) {
+        if (caps.max_fps > 30) caps.max_fps = 30;
+        if (caps.width > 1280) {
+            caps.height = caps.height * 1280 / caps.width;
+            caps.width = 1280;
+        }
+    }
+
     plist_t r_node = plist_new_dict();
 
     plist_t txt_airplay_node = plist_new_data(airplay_txt, airplay_txt_len);
     plist_dict_set_item(r_node, "txtAirPlay", txt_airplay_node);
 
-    plist_t features_node = plist_new_uint((uint64_t) 0x1E << 32 | 0x5A7FFFF7);
+    uint64_t features = (uint64_t) 0x1E << 32 | 0x5A7FFFF7;
+    int audio_only = __atomic_load_n(&raop->audio_only, __ATOMIC_RELAXED);
+    if (audio_only) {
+        features &= ~(uint64_t) AIRPLAY_FEATURES_VISUAL;
+        caps.hevc = 0;
+    }
+    if (caps.hevc) {
+        // SupportsScreenMultiCodec, senders then offer HEVC in the stream SETUP
+        features |= (uint64_t) 1 << 42;
+    }
+    if (caps.buffered_audio) {
+        // SupportsBufferedAudio, senders then set music up as stream type 103
+        features |= (uint64_t) 1 << 40;
+    }
+    if (__atomic_load_n(&raop->ptp, __ATOMIC_RELAXED)) {
+        // SupportsPTP, senders then ask for timingProtocol PTP at SETUP
+        features |= (uint64_t) 1 << 41;
+    }
+    plist_t features_node = plist_new_uint(features);
     plist_dict_set_item(r_node, "features", features_node);
 
     plist_t name_node = plist_new_string(name);
@@ -82,7 +126,7 @@ raop_handler_info(raop_conn_t *conn,
     plist_t vv_node = plist_new_uint(strtol(AIRPLAY_VV, NULL, 10));
     plist_dict_set_item(r_node, "vv", vv_node);
 
-    plist_t status_flags_node = plist_new_uint(68);
+    plist_t status_flags_node = plist_new_uint(68 | (raop->advertised_busy ? AIRPLAY_FLAGS_BUSY : 0));
     plist_dict_set_item(r_node, "statusFlags", status_flags_node);
 
     plist_t keep_alive_low_power_node = plist_new_bool(1);
@@ -102,7 +146,7 @@ raop_handler_info(raop_conn_t *conn,
 
     plist_t audio_latencies_node = plist_new_array();
     plist_t audio_latencies_0_node = plist_new_dict();
-    plist_t audio_latencies_0_output_latency_micros_node = plist_new_uint(0);
+    plist_t audio_latencies_0_output_latency_micros_node = plist_new_uint(caps.audio_output_latency);
     plist_t audio_latencies_0_type_node = plist_new_uint(100);
     plist_t audio_latencies_0_audio_type_node = plist_new_string("default");
     plist_t audio_latencies_0_input_latency_micros_node = plist_new_uint(0);
@@ -112,7 +156,7 @@ raop_handler_info(raop_conn_t *conn,
     plist_dict_set_item(audio_latencies_0_node, "inputLatencyMicros", audio_latencies_0_input_latency_micros_node);
     plist_array_append_item(audio_latencies_node, audio_latencies_0_node);
     plist_t audio_latencies_1_node = plist_new_dict();
-    plist_t audio_latencies_1_output_latency_micros_node = plist_new_uint(0);
+    plist_t audio_latencies_1_output_latency_micros_node = plist_new_uint(caps.audio_output_latency);
     plist_t audio_latencies_1_type_node = plist_new_uint(101);
     plist_t audio_latencies_1_audio_type_node = plist_new_string("default");
     plist_t audio_latencies_1_input_latency_micros_node = plist_new_uint(0);
@@ -134,12 +178,13 @@ raop_handler_info(raop_conn_t *conn,
     plist_t displays_0_uuid_node = plist_new_string("e0ff8a27-6738-3d56-8a16-cc53aacee925");
     plist_t displays_0_width_physical_node = plist_new_uint(0);
     plist_t displays_0_height_physical_node = plist_new_uint(0);
-    plist_t displays_0_width_node = plist_new_uint(1920);
-    plist_t displays_0_height_node = plist_new_uint(1080);
-    plist_t displays_0_width_pixels_node = plist_new_uint(1920);
-    plist_t displays_0_height_pixels_node = plist_new_uint(1080);
+    plist_t displays_0_width_node = plist_new_uint(caps.width);
+    plist_t displays_0_height_node = plist_new_uint(caps.height);
+    plist_t displays_0_width_pixels_node = plist_new_uint(caps.width);
+    plist_t displays_0_height_pixels_node = plist_new_uint(caps.height);
     plist_t displays_0_rotation_node = plist_new_bool(0);
-    plist_t displays_0_refresh_rate_node = plist_new_real(1.0 / 60.0);
+    plist_t displays_0_refresh_rate_node = plist_new_real(1.0 / caps.refresh_rate);
+    plist_t displays_0_max_fps_node = plist_new_uint(caps.max_fps);
     plist_t displays_0_overscanned_node = plist_new_bool(1);
     plist_t displays_0_features = plist_new_uint(14);
 
@@ -152,18 +197,50 @@ raop_handler_info(raop_conn_t *conn,
     plist_dict_set_item(displays_0_node, "heightPixels", displays_0_height_pixels_node);
     plist_dict_set_item(displays_0_node, "rotation", displays_0_rotation_node);
     plist_dict_set_item(displays_0_node, "refreshRate", displays_0_refresh_rate_node);
+    plist_dict_set_item(displays_0_node, "maxFPS", displays_0_max_fps_node);
     plist_dict_set_item(displays_0_node, "overscanned", displays_0_overscanned_node);
     plist_dict_set_item(displays_0_node, "features", displays_0_features);
     plist_array_append_item(displays_node, displays_0_node);
-    plist_dict_set_item(r_node, "displays", displays_node);
+    if (audio_only) {
+        plist_free(displays_node);
+    } else {
+        plist_dict_set_item(r_node, "displays", displays_node);
+    }
 
-    plist_to_bin(r_node, response_data, (uint32_t *) response_datalen);
-    logger_log(conn->raop->logger, LOGGER_DEBUG, "INFO len = %d", response_datalen);
-    http_response_add_header(response, "Content-Type", "application/x-apple-binary-plist");
+    plist_to_bin(r_node, info_data, (uint32_t *) info_datalen);
+    logger_log(raop->logger, LOGGER_DEBUG, "INFO len = %d", *info_datalen);
+    plist_free(r_node);
     free(pk);
     free(hw_addr);
 }
 
+static void
+raop_handler_info(raop_conn_t *conn,
+                  http_request_t *request, http_response_t *response,
+                  char **response_data, int *response_datalen)
+{
+    raop_t *raop = conn->raop;
+
+    /* Copied out of the plist serialized when dnssd was set or the CPU load last changed, rather than
+     * rebuilt; the body is the response's own, as the cache may be replaced while it is sent */
+    MUTEX_LOCK(raop->info_mutex);
+    if (raop->info_data && raop->info_degraded != raop_is_degraded(raop)) {
+        free(raop->info_data);
+        raop->info_data = NULL;
+    }
+    if (!raop->info_data) {
+        raop_handler_info_build(raop, &raop->info_data, &raop->info_datalen);
+    }
+    *response_data = raop->info_data ? malloc(raop->info_datalen) : NULL;
+    if (*response_data) {
+        memcpy(*response_data, raop->info_data, raop->info_datalen);
+        *response_datalen = raop->info_datalen;
+    }
+    MUTEX_UNLOCK(raop->info_mutex);
+
+    http_response_add_header(response, "Content-Type", "application/x-apple-binary-plist");
+}
+
 static void
 raop_handler_pairsetup(raop_conn_t *conn,
                        http_request_t *request, http_response_t *response,
@@ -188,6 +265,7 @@ raop_handler_pairsetup(raop_conn_t *conn,
         memcpy(*response_data, public_key, sizeof(public_key));
         *response_datalen = sizeof(public_key);
     }
+    setup_timeline_mark(conn->setup_timeline, SETUP_PAIR_SETUP);
 }
 
 static void
@@ -244,6 +322,7 @@ raop_handler_pairverify(raop_conn_t *conn,
                 return;
             }
             http_response_add_header(response, "Content-Type", "application/octet-stream");
+            setup_timeline_mark(conn->setup_timeline, SETUP_PAIR_VERIFY);
             break;
     }
 }
@@ -275,6 +354,7 @@ raop_handler_fpsetup(raop_conn_t *conn,
             http_response_add_header(response, "Content-Type", "application/octet-stream");
             if (!fairplay_handshake(conn->fairplay, data, (unsigned char *) *response_data)) {
                 *response_datalen = 32;
+                setup_timeline_mark(conn->setup_timeline, SETUP_FAIRPLAY);
             } else {
                 // Handle error?
                 free(*response_data);
@@ -292,7 +372,89 @@ raop_handler_options(raop_conn_t *conn,
                      http_request_t *request, http_response_t *response,
                      char **response_data, int *response_datalen)
 {
-    http_response_add_header(response, "Public", "SETUP, RECORD, PAUSE, FLUSH, TEARDOWN, OPTIONS, GET_PARAMETER, SET_PARAMETER");
+    http_response_add_header(response, "Public", "SETUP, RECORD, PAUSE, FLUSH, FLUSHBUFFERED, TEARDOWN, OPTIONS, GET_PARAMETER, SET_PARAMETER, SETRATEANCHORTIME");
+}
+
+/* Copies the string item key of dict to buf, leaves buf alone if there is none */
+static void
+raop_handler_copy_string(plist_t dict, const char *key, char *buf, size_t size)
+{
+    plist_t node = plist_dict_get_item(dict, key);
+    char *value = NULL;
+
+    if (!PLIST_IS_STRING(node)) {
+        return;
+    }
+    plist_get_string_val(node, &value);
+    if (value) {
+        snprintf(buf, size, "%s", value);
+        free(value);
+    }
+}
+
+/* Our PTP clock identity, the EUI-64 of the MAC address we advertise */
+static void
+raop_handler_ptp_clock_identity(raop_t *raop, unsigned char *clock_identity)
+{
+    int hw_addr_len = 0;
+    const char *hw_addr = raop->dnssd ? dnssd_get_hw_addr(raop->dnssd, &hw_addr_len) : NULL;
+
+    memset(clock_identity, 0, RAOP_NTP_PTP_CLOCK_IDENTITY_SIZE);
+    if (hw_addr && hw_addr_len == 6) {
+        memcpy(clock_identity, hw_addr, 3);
+        clock_identity[3] = 0xff;
+        clock_identity[4] = 0xfe;
+        memcpy(clock_identity + 5, hw_addr + 3, 3);
+    }
+}
+
+/* The timingPeerInfo of a PTP SETUP response, the address the sender's PTP messages reach us on */
+static plist_t
+raop_handler_timing_peer_info(raop_conn_t *conn)
+{
+    char address[INET6_ADDRSTRLEN] = "";
+    plist_t peer_info = plist_new_dict();
+    plist_t addresses = plist_new_array();
+
+    inet_ntop(conn->locallen == 16 ? AF_INET6 : AF_INET, conn->local, address, sizeof(address));
+    plist_array_append_item(addresses, plist_new_string(address));
+    plist_dict_set_item(peer_info, "Addresses", addresses);
+    plist_dict_set_item(peer_info, "ID", plist_new_string(address));
+    return peer_info;
+}
+
+static void
+raop_handler_parse_audio_format(raop_conn_t *conn, plist_t req_stream_node, raop_audio_format_t *format)
+{
+    uint64_t value;
+
+    format->compression = RAOP_AUDIO_CT_AAC_ELD;
+    format->audio_format = 0;
+    format->samples_per_frame = 480;
+    format->sample_rate = 44100;
+
+    plist_t req_stream_ct_node = plist_dict_get_item(req_stream_node, "ct");
+    if (req_stream_ct_node) {
+        plist_get_uint_val(req_stream_ct_node, &value);
+        format->compression = (int) value;
+    }
+    plist_t req_stream_audio_format_node = plist_dict_get_item(req_stream_node, "audioFormat");
+    if (req_stream_audio_format_node) {
+        plist_get_uint_val(req_stream_audio_format_node, &format->audio_format);
+    }
+    plist_t req_stream_spf_node = plist_dict_get_item(req_stream_node, "spf");
+    if (req_stream_spf_node) {
+        plist_get_uint_val(req_stream_spf_node, &value);
+        format->samples_per_frame = (int) value;
+    }
+    plist_t req_stream_sr_node = plist_dict_get_item(req_stream_node, "sr");
+    if (req_stream_sr_node) {
+        plist_get_uint_val(req_stream_sr_node, &value);
+        format->sample_rate = (int) value;
+    }
+    logger_log(conn->raop->logger, LOGGER_INFO, "Audio format: ct = %d, audioFormat = 0x%llx, spf = %d, sr = %d",
+               format->compression, (unsigned long long) format->audio_format,
+               format->samples_per_frame, format->sample_rate);
 }
 
 static void
@@ -304,6 +466,7 @@ raop_handler_setup(raop_conn_t *conn,
 
     const char *transport;
     int use_udp;
+    int mirror_udp;
     const char *dacp_id;
     const char *active_remote_header;
 
@@ -312,8 +475,8 @@ raop_handler_setup(raop_conn_t *conn,
 
     data = http_request_get_data(request, &data_len);
 
-    dacp_id = http_request_get_header(request, "DACP-ID");
-    active_remote_header = http_request_get_header(request, "Active-Remote");
+    dacp_id = http_request_get_known_header(request, HTTP_HEADER_DACP_ID);
+    active_remote_header = http_request_get_known_header(request, HTTP_HEADER_ACTIVE_REMOTE);
 
     if (dacp_id && active_remote_header) {
         logger_log(conn->raop->logger, LOGGER_DEBUG, "DACP-ID: %s", dacp_id);
@@ -323,13 +486,16 @@ raop_handler_setup(raop_conn_t *conn,
         }
     }
 
-    transport = http_request_get_header(request, "Transport");
+    transport = http_request_get_known_header(request, HTTP_HEADER_TRANSPORT);
     if (transport) {
         logger_log(conn->raop->logger, LOGGER_DEBUG, "Transport: %s", transport);
         use_udp = strncmp(transport, "RTP/AVP/TCP", 11);
+        mirror_udp = __atomic_load_n(&conn->raop->mirror_udp, __ATOMIC_RELAXED) &&
+                     strstr(transport, MIRROR_UDP_TRANSPORT_TOKEN) != NULL;
     } else {
         logger_log(conn->raop->logger, LOGGER_DEBUG, "Transport: null");
         use_udp = 0;
+        mirror_udp = 0;
     }
 
     // Parsing bplist
@@ -344,10 +510,19 @@ raop_handler_setup(raop_conn_t *conn,
 
     if (PLIST_IS_DATA(req_eiv_node) && PLIST_IS_DATA(req_ekey_node)) {
         // The first SETUP call that initializes keys and timing
+        if (!raop_admit_session(conn)) {
+            http_response_set_disconnect(response, 1);
+            plist_free(res_root_node);
+            plist_free(req_root_node);
+            return;
+        }
 
         unsigned char aesiv[16];
         unsigned char aeskey[16];
         logger_log(conn->raop->logger, LOGGER_DEBUG, "SETUP 1");
+        raop_handler_copy_string(req_root_node, "model", conn->summary.model, sizeof(conn->summary.model));
+        raop_handler_copy_string(req_root_node, "name", conn->summary.name, sizeof(conn->summary.name));
+        raop_handler_copy_string(req_root_node, "osVersion", conn->summary.os_version, sizeof(conn->summary.os_version));
 
         // First setup
         char* eiv = NULL;
@@ -373,15 +548,94 @@ raop_handler_setup(raop_conn_t *conn,
         logger_log(conn->raop->logger, LOGGER_DEBUG, "timing_rport = %llu", timing_rport);
 
         unsigned short timing_lport;
+        if (__atomic_load_n(&conn->raop->session_reactor, __ATOMIC_RELAXED) && !conn->reactor) {
+            conn->reactor = session_reactor_init(conn->raop->logger);
+        }
+        // Senders we offered PTP to may ask for it instead of giving an NTP timing port
+        char timing_protocol[16] = "NTP";
+        raop_handler_copy_string(req_root_node, "timingProtocol", timing_protocol, sizeof(timing_protocol));
+        bool ptp = !strcmp(timing_protocol, "PTP") && __atomic_load_n(&conn->raop->ptp, __ATOMIC_RELAXED);
+        logger_log(conn->raop->logger, LOGGER_DEBUG, "timingProtocol = %s", timing_protocol);
+
         conn->raop_ntp = raop_ntp_init(conn->raop->logger, conn->remote, conn->remotelen, timing_rport);
+        if (conn->raop_ntp) {
+            raop_ntp_set_reactor(conn->raop_ntp, conn->reactor);
+            raop_ntp_set_remote_scope(conn->raop_ntp, conn->remote_scope_id);
+            if (ptp) {
+                unsigned char clock_identity[RAOP_NTP_PTP_CLOCK_IDENTITY_SIZE];
+                raop_handler_ptp_clock_identity(conn->raop, clock_identity);
+                raop_ntp_set_ptp(conn->raop_ntp, clock_identity);
+            }
+        }
+        raop_ntp_sync_t sync;
+        uint64_t away;
+        // A parked estimate may be of the sender's NTP clock, not of its PTP one
+        if (!ptp && raop_unpark_sender(conn, &sync, &away)) {
+            // Video can be shown on time from the first frame instead of after the first samples
+            logger_log(conn->raop->logger, LOGGER_INFO, "Sender back after %llu ms, starting from its clock estimate",
+                       (unsigned long long) away / 1000);
+            raop_ntp_seed_sync(conn->raop_ntp, &sync);
+        }
         raop_ntp_start(conn->raop_ntp, &timing_lport);
 
-        conn->raop_rtp = raop_rtp_init(conn->raop->logger, &conn->raop->callbacks, conn->raop_ntp, conn->remote, conn->remotelen, aeskey, aesiv, ecdh_secret);
-        conn->raop_rtp_mirror = raop_rtp_mirror_init(conn->raop->logger, &conn->raop->callbacks, conn->raop_ntp, conn->remote, conn->remotelen, aeskey, ecdh_secret);
+        if (conn->raop->mp4_dir && !conn->recorder) {
+            char filename[512];
+            char date[32];
+            time_t now = time(NULL);
+            struct tm tm;
+            strftime(date, sizeof(date), "%Y%m%d-%H%M%S", localtime_r(&now, &tm));
+            snprintf(filename, sizeof(filename), "%s/airplay-%s-%u.mp4", conn->raop->mp4_dir, date, timing_lport);
+            conn->recorder = mp4_recorder_open(conn->raop->logger, filename);
+        }
+        if (!conn->frame_bus) {
+            conn->frame_bus = raop_frame_bus_init(conn->raop, conn->recorder);
+        }
+
+        conn->raop_rtp = raop_rtp_init(conn->raop->logger, &conn->callbacks, conn->raop_ntp, conn->remote, conn->remotelen, aeskey, aesiv, ecdh_secret);
+        if (conn->raop_rtp) {
+            raop_rtp_set_capture_dir(conn->raop_rtp, conn->raop->capture_dir);
+            raop_rtp_set_frame_bus(conn->raop_rtp, conn->frame_bus);
+            raop_rtp_set_reactor(conn->raop_rtp, conn->reactor);
+            if (conn->cpu_slot >= 0) {
+                // Audio after the three mirror stages
+                raop_rtp_set_cpu(conn->raop_rtp, conn->cpu_slot + 3);
+            }
+        }
+        // A receiver that only plays audio never has a mirror stream to set up
+        if (!__atomic_load_n(&conn->raop->audio_only, __ATOMIC_RELAXED)) {
+            conn->raop_rtp_mirror = raop_rtp_mirror_init(conn->raop->logger, &conn->callbacks, conn->raop_ntp, conn->remote, conn->remotelen, aeskey, ecdh_secret);
+        }
+        if (conn->raop_rtp_mirror) {
+            raop_rtp_mirror_set_latency_budget(conn->raop_rtp_mirror, __atomic_load_n(&conn->raop->video_latency_budget, __ATOMIC_RELAXED));
+            raop_rtp_mirror_set_memory_budget(conn->raop_rtp_mirror, __atomic_load_n(&conn->raop->session_memory, __ATOMIC_RELAXED),
+                                              conn->raop->memory_budget);
+            raop_rtp_mirror_set_capture_dir(conn->raop_rtp_mirror, conn->raop->capture_dir);
+            raop_rtp_mirror_set_frame_bus(conn->raop_rtp_mirror, conn->frame_bus);
+            raop_rtp_mirror_set_setup_timeline(conn->raop_rtp_mirror, conn->setup_timeline);
+            unsigned int decrypt_threads = __atomic_load_n(&conn->raop->decrypt_threads, __ATOMIC_RELAXED);
+            if (decrypt_threads) {
+                raop_rtp_mirror_set_decrypt_workers(conn->raop_rtp_mirror, raop_get_task_pool(conn->raop), decrypt_threads);
+            }
+            raop_rtp_mirror_set_cpu_load(conn->raop_rtp_mirror, conn->raop->cpu_load);
+            raop_rtp_mirror_set_thermal(conn->raop_rtp_mirror, conn->raop->thermal);
+            raop_rtp_mirror_set_decode_scheduler(conn->raop_rtp_mirror, conn->raop->decode_scheduler);
+            raop_rtp_mirror_set_lock_memory(conn->raop_rtp_mirror, __atomic_load_n(&conn->raop->lock_memory, __ATOMIC_RELAXED));
+            raop_rtp_mirror_set_coalesce_static(conn->raop_rtp_mirror, __atomic_load_n(&conn->raop->coalesce_static, __ATOMIC_RELAXED));
+            raop_rtp_mirror_set_progressive(conn->raop_rtp_mirror, __atomic_load_n(&conn->raop->progressive_video, __ATOMIC_RELAXED));
+            raop_rtp_mirror_set_reactor(conn->raop_rtp_mirror, conn->reactor);
+            if (conn->cpu_slot >= 0) {
+                raop_rtp_mirror_set_cpu(conn->raop_rtp_mirror, conn->cpu_slot);
+            }
+        }
+        setup_timeline_mark(conn->setup_timeline, SETUP_SESSION);
 
         plist_t res_event_port_node = plist_new_uint(conn->raop->port);
-        plist_t res_timing_port_node = plist_new_uint(timing_lport);
-        plist_dict_set_item(res_root_node, "timingPort", res_timing_port_node);
+        if (ptp) {
+            plist_dict_set_item(res_root_node, "timingPeerInfo", raop_handler_timing_peer_info(conn));
+        } else {
+            plist_t res_timing_port_node = plist_new_uint(timing_lport);
+            plist_dict_set_item(res_root_node, "timingPort", res_timing_port_node);
+        }
         plist_dict_set_item(res_root_node, "eventPort", res_event_port_node);
 
         logger_log(conn->raop->logger, LOGGER_DEBUG, "eport = %d, tport = %d", conn->raop->port, timing_lport);
@@ -408,9 +662,13 @@ raop_handler_setup(raop_conn_t *conn,
                     plist_get_uint_val(stream_id_node, &stream_connection_id);
                     logger_log(conn->raop->logger, LOGGER_DEBUG, "streamConnectionID = %llu", stream_connection_id);
 
-                    if (conn->raop_rtp_mirror) {
+                    if (__atomic_load_n(&conn->raop->audio_only, __ATOMIC_RELAXED)) {
+                        logger_log(conn->raop->logger, LOGGER_INFO, "Refusing to mirror, the receiver only plays audio");
+                        http_response_set_disconnect(response, 1);
+                    } else if (conn->raop_rtp_mirror) {
                         raop_rtp_init_mirror_aes(conn->raop_rtp_mirror, stream_connection_id);
-                        raop_rtp_start_mirror(conn->raop_rtp_mirror, use_udp, &dport);
+                        raop_rtp_start_mirror(conn->raop_rtp_mirror, mirror_udp, &dport);
+                        setup_timeline_mark(conn->setup_timeline, SETUP_MIRROR);
                         logger_log(conn->raop->logger, LOGGER_DEBUG, "Mirroring initialized successfully");
                     } else {
                         logger_log(conn->raop->logger, LOGGER_ERR, "Mirroring not initialized at SETUP, playing will fail!");
@@ -429,8 +687,11 @@ raop_handler_setup(raop_conn_t *conn,
                     // Audio
 
                     unsigned short cport = 0, dport = 0;
+                    raop_audio_format_t format;
+                    raop_handler_parse_audio_format(conn, req_stream_node, &format);
 
                     if (conn->raop_rtp) {
+                        raop_rtp_set_audio_format(conn->raop_rtp, &format);
                         raop_rtp_start_audio(conn->raop_rtp, use_udp, remote_cport, &cport, &dport);
                         logger_log(conn->raop->logger, LOGGER_DEBUG, "RAOP initialized success");
                     } else {
@@ -447,6 +708,42 @@ raop_handler_setup(raop_conn_t *conn,
                     plist_dict_set_item(res_stream_node, "type", res_stream_type_node);
                     plist_array_append_item(res_streams_node, res_stream_node);
 
+                    break;
+                } case 103: {
+                    // Buffered audio, the sender pushes it ahead over TCP
+                    unsigned short dport = 0;
+                    raop_audio_format_t format;
+                    raop_handler_parse_audio_format(conn, req_stream_node, &format);
+
+                    char *shk = NULL;
+                    uint64_t shk_len = 0;
+                    plist_t req_stream_shk_node = plist_dict_get_item(req_stream_node, "shk");
+                    if (PLIST_IS_DATA(req_stream_shk_node)) {
+                        plist_get_data_val(req_stream_shk_node, &shk, &shk_len);
+                    }
+                    if (shk_len != CHACHA20_POLY1305_KEY_SIZE || !conn->raop_ntp) {
+                        logger_log(conn->raop->logger, LOGGER_ERR, "Buffered audio without a key or timing at SETUP, playing will fail!");
+                        http_response_set_disconnect(response, 1);
+                    } else {
+                        raop_buffered_destroy(conn->raop_buffered);
+                        conn->raop_buffered = raop_buffered_init(conn->raop->logger, &conn->callbacks, conn->raop_ntp,
+                                                                 (unsigned char *) shk, &format);
+                        if (conn->callbacks.audio_set_format) {
+                            conn->callbacks.audio_set_format(conn->callbacks.cls, &format);
+                        }
+                        if (!conn->raop_buffered || raop_buffered_start(conn->raop_buffered, &dport) < 0) {
+                            logger_log(conn->raop->logger, LOGGER_ERR, "Buffered audio could not be started");
+                            http_response_set_disconnect(response, 1);
+                        }
+                    }
+                    free(shk);
+
+                    plist_t res_stream_node = plist_new_dict();
+                    plist_dict_set_item(res_stream_node, "dataPort", plist_new_uint(dport));
+                    plist_dict_set_item(res_stream_node, "type", plist_new_uint(103));
+                    plist_dict_set_item(res_stream_node, "audioBufferSize", plist_new_uint(RAOP_BUFFERED_AUDIO_BUFFER_SIZE));
+                    plist_array_append_item(res_streams_node, res_stream_node);
+
                     break;
                 }
 
@@ -473,7 +770,7 @@ raop_handler_get_parameter(raop_conn_t *conn,
     const char *data;
     int datalen;
 
-    content_type = http_request_get_header(request, "Content-Type");
+    content_type = http_request_get_known_header(request, HTTP_HEADER_CONTENT_TYPE);
     data = http_request_get_data(request, &datalen);
     if (!strcmp(content_type, "text/parameters")) {
         const char *current = data;
@@ -519,7 +816,7 @@ raop_handler_set_parameter(raop_conn_t *conn,
     const char *data;
     int datalen;
 
-    content_type = http_request_get_header(request, "Content-Type");
+    content_type = http_request_get_known_header(request, HTTP_HEADER_CONTENT_TYPE);
     data = http_request_get_data(request, &datalen);
     if (!strcmp(content_type, "text/parameters")) {
         char *datastr;
@@ -529,11 +826,21 @@ raop_handler_set_parameter(raop_conn_t *conn,
             if ((datalen >= 8) && !strncmp(datastr, "volume: ", 8)) {
                 float vol = 0.0;
                 sscanf(datastr+8, "%f", &vol);
-                raop_rtp_set_volume(conn->raop_rtp, vol);
+                if (conn->raop_buffered) {
+                    raop_buffered_set_volume(conn->raop_buffered, vol);
+                } else {
+                    raop_rtp_set_volume(conn->raop_rtp, vol);
+                }
             } else if ((datalen >= 10) && !strncmp(datastr, "progress: ", 10)) {
                 unsigned int start, curr, end;
                 sscanf(datastr+10, "%u/%u/%u", &start, &curr, &end);
-                raop_rtp_set_progress(conn->raop_rtp, start, curr, end);
+                if (conn->raop_buffered) {
+                    if (conn->callbacks.audio_set_progress) {
+                        conn->callbacks.audio_set_progress(conn->callbacks.cls, start, curr, end);
+                    }
+                } else {
+                    raop_rtp_set_progress(conn->raop_rtp, start, curr, end);
+                }
             }
         } else if (!conn->raop_rtp) {
             logger_log(conn->raop->logger, LOGGER_WARNING, "RAOP not initialized at SET_PARAMETER");
@@ -541,14 +848,23 @@ raop_handler_set_parameter(raop_conn_t *conn,
         free(datastr);
     } else if (!strcmp(content_type, "image/jpeg") || !strcmp(content_type, "image/png")) {
         logger_log(conn->raop->logger, LOGGER_INFO, "Got image data of %d bytes", datalen);
-        if (conn->raop_rtp) {
+        // Without a running raop_rtp audio thread to pass it on, the callback only copies it off to a worker
+        if (conn->raop_buffered) {
+            if (conn->callbacks.audio_set_coverart) {
+                conn->callbacks.audio_set_coverart(conn->callbacks.cls, data, datalen);
+            }
+        } else if (conn->raop_rtp) {
             raop_rtp_set_coverart(conn->raop_rtp, data, datalen);
         } else {
             logger_log(conn->raop->logger, LOGGER_WARNING, "RAOP not initialized at SET_PARAMETER coverart");
         }
     } else if (!strcmp(content_type, "application/x-dmap-tagged")) {
         logger_log(conn->raop->logger, LOGGER_INFO, "Got metadata of %d bytes", datalen);
-        if (conn->raop_rtp) {
+        if (conn->raop_buffered) {
+            if (conn->callbacks.audio_set_metadata) {
+                conn->callbacks.audio_set_metadata(conn->callbacks.cls, data, datalen);
+            }
+        } else if (conn->raop_rtp) {
             raop_rtp_set_metadata(conn->raop_rtp, data, datalen);
         } else {
             logger_log(conn->raop->logger, LOGGER_WARNING, "RAOP not initialized at SET_PARAMETER metadata");
@@ -565,6 +881,102 @@ raop_handler_feedback(raop_conn_t *conn,
     logger_log(conn->raop->logger, LOGGER_DEBUG, "raop_handler_feedback");
 }
 
+/* Local time of the networkTimeSecs and networkTimeFrac of a request, 0 if it has none */
+static uint64_t
+raop_handler_get_network_time(raop_conn_t *conn, plist_t req_root_node)
+{
+    uint64_t secs = 0, frac = 0;
+    plist_t secs_node = plist_dict_get_item(req_root_node, "networkTimeSecs");
+    plist_t frac_node = plist_dict_get_item(req_root_node, "networkTimeFrac");
+    if (!secs_node || !conn->raop_ntp) {
+        return 0;
+    }
+    plist_get_uint_val(secs_node, &secs);
+    if (frac_node) {
+        plist_get_uint_val(frac_node, &frac);
+    }
+    // The sender's clock as our NTP exchange sees it, in its NTP epoch unless it counts from boot.
+    // PTP times have no epoch to take off.
+    uint64_t ntp_timestamp = (secs << 32) | (frac >> 32);
+    bool ntp_epoch = !raop_ntp_is_ptp(conn->raop_ntp) && secs >= 2208988800ULL;
+    uint64_t remote_time = raop_ntp_timestamp_to_micro_seconds(ntp_timestamp, ntp_epoch);
+    return raop_ntp_convert_remote_time(conn->raop_ntp, remote_time);
+}
+
+static void
+raop_handler_setrateanchortime(raop_conn_t *conn,
+                               http_request_t *request, http_response_t *response,
+                               char **response_data, int *response_datalen)
+{
+    const char *data;
+    int data_len;
+    uint64_t rate = 0, rtp_time = 0;
+
+    if (!conn->raop_buffered) {
+        logger_log(conn->raop->logger, LOGGER_WARNING, "Buffered audio not initialized at SETRATEANCHORTIME");
+        return;
+    }
+    data = http_request_get_data(request, &data_len);
+    plist_t req_root_node = NULL;
+    plist_from_bin(data, data_len, &req_root_node);
+    plist_t rate_node = plist_dict_get_item(req_root_node, "rate");
+    if (PLIST_IS_REAL(rate_node)) {
+        double real_rate = 0.0;
+        plist_get_real_val(rate_node, &real_rate);
+        rate = real_rate > 0.0;
+    } else if (rate_node) {
+        plist_get_uint_val(rate_node, &rate);
+    }
+    plist_t rtp_time_node = plist_dict_get_item(req_root_node, "rtpTime");
+    if (rtp_time_node) {
+        plist_get_uint_val(rtp_time_node, &rtp_time);
+    }
+    uint64_t local_time = raop_handler_get_network_time(conn, req_root_node);
+    plist_free(req_root_node);
+
+    logger_log(conn->raop->logger, LOGGER_DEBUG, "SETRATEANCHORTIME rate = %llu, rtpTime = %llu, local time = %llu",
+               (unsigned long long) rate, (unsigned long long) rtp_time, (unsigned long long) local_time);
+    if (rate && !local_time) {
+        logger_log(conn->raop->logger, LOGGER_WARNING, "SETRATEANCHORTIME without a network time, ignoring it");
+        return;
+    }
+    raop_buffered_set_anchor(conn->raop_buffered, (int) rate, (uint32_t) rtp_time, local_time);
+}
+
+static void
+raop_handler_flushbuffered(raop_conn_t *conn,
+                           http_request_t *request, http_response_t *response,
+                           char **response_data, int *response_datalen)
+{
+    const char *data;
+    int data_len;
+    uint64_t from_seq = 0, until_seq = 0;
+
+    if (!conn->raop_buffered) {
+        logger_log(conn->raop->logger, LOGGER_WARNING, "Buffered audio not initialized at FLUSHBUFFERED");
+        return;
+    }
+    data = http_request_get_data(request, &data_len);
+    plist_t req_root_node = NULL;
+    plist_from_bin(data, data_len, &req_root_node);
+    plist_t from_seq_node = plist_dict_get_item(req_root_node, "flushFromSeq");
+    if (from_seq_node) {
+        plist_get_uint_val(from_seq_node, &from_seq);
+    }
+    plist_t until_seq_node = plist_dict_get_item(req_root_node, "flushUntilSeq");
+    if (until_seq_node) {
+        plist_get_uint_val(until_seq_node, &until_seq);
+    }
+    plist_free(req_root_node);
+
+    logger_log(conn->raop->logger, LOGGER_DEBUG, "FLUSHBUFFERED from %s%llu until %llu", from_seq_node ? "" : "before ",
+               (unsigned long long) from_seq, (unsigned long long) until_seq);
+    if (!until_seq_node) {
+        return;
+    }
+    raop_buffered_flush(conn->raop_buffered, from_seq_node != NULL, (uint32_t) from_seq, (uint32_t) until_seq);
+}
+
 static void
 raop_handler_record(raop_conn_t *conn,
                     http_request_t *request, http_response_t *response,
@@ -20,12 +20,17 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdbool.h>
+#include <math.h>
+#include <poll.h>
 
 #include "raop_ntp.h"
 #include "threads.h"
 #include "compat.h"
 #include "netutils.h"
 #include "byteutils.h"
+#include "trace.h"
+#include "thread_attr.h"
+#include "session_reactor.h"
 
 #define RAOP_NTP_DATA_COUNT   8
 #define RAOP_NTP_PHI_PPM   15ull                   // PPM
@@ -36,11 +41,39 @@
 
 #define RAOP_NTP_CLOCK_BASE (2208988800ull << 32)
 
+// Right after start, a burst of requests fills the sample window quickly
+#define RAOP_NTP_BURST_COUNT RAOP_NTP_DATA_COUNT
+#define RAOP_NTP_BURST_INTERVAL 50000ull  // us
+#define RAOP_NTP_POLL_INTERVAL 3000000ull // us
+
+// Samples with a longer round trip are not used, in us
+#define RAOP_NTP_MAX_RTT 1000000ll
+
+// The skew is only estimated over samples spanning this long, and limited to this rate
+#define RAOP_NTP_MIN_SKEW_SPAN 10000000ll // us
+#define RAOP_NTP_MAX_SKEW 0.0002          // 200 ppm
+
+// PTP over UDP, IEEE 1588-2008 annex D: Sync and Delay_Req are sent to the event port, the rest to the general one
+#define RAOP_NTP_PTP_EVENT_PORT 319
+#define RAOP_NTP_PTP_GENERAL_PORT 320
+#define RAOP_NTP_PTP_SYNC 0x0
+#define RAOP_NTP_PTP_DELAY_REQ 0x1
+#define RAOP_NTP_PTP_FOLLOW_UP 0x8
+#define RAOP_NTP_PTP_DELAY_RESP 0x9
+#define RAOP_NTP_PTP_HEADER_SIZE 34
+#define RAOP_NTP_PTP_TIMESTAMP_SIZE 10
+#define RAOP_NTP_PTP_PORT_IDENTITY_SIZE 10
+// In the first flag byte, the sender's time comes in a Follow_Up after the Sync
+#define RAOP_NTP_PTP_TWO_STEP 0x02
+// Senders sync several times a second, after the burst a delay request goes out with the first Sync
+// this long after the last one
+#define RAOP_NTP_PTP_POLL_INTERVAL 1000000ull // us
+
 typedef struct raop_ntp_data_s {
-    uint64_t time; // The local wall clock time at time of ntp packet arrival
+    uint64_t time; // The local time at time of ntp packet arrival
     uint64_t dispersion;
     int64_t delay; // The round trip delay
-    int64_t offset; // The difference between remote and local wall clock time
+    int64_t offset; // The difference between remote and local clock time
 } raop_ntp_data_t;
 
 struct raop_ntp_s {
@@ -55,11 +88,21 @@ struct raop_ntp_s {
     raop_ntp_data_t data[RAOP_NTP_DATA_COUNT];
     int data_index;
 
+    // Requests sent since start, the first RAOP_NTP_BURST_COUNT ones are sent in a burst
+    int request_count;
+
+    mutex_handle_t stats_mutex;
+    raop_ntp_stats_t stats;
+
     // The clock sync params are periodically updated to the AirPlay client's NTP clock
-    mutex_handle_t sync_params_mutex;
+    // The offset is the one at local time sync_time, and changes by sync_skew us per us.
+    // Only the NTP thread writes these, published through the sync_seq seqlock
+    unsigned int sync_seq;
     int64_t sync_offset;
     int64_t sync_dispersion;
     int64_t sync_delay;
+    uint64_t sync_time;
+    double sync_skew;
 
     // Socket address of the AirPlay client
     struct sockaddr_storage remote_saddr;
@@ -72,12 +115,41 @@ struct raop_ntp_s {
     unsigned short timing_lport;
 
     /* MUTEX LOCKED VARIABLES START */
-    /* These variables only edited mutex locked */
-    int running;
+    /* These variables only edited mutex locked, the threads read running without the lock */
+    thread_flag_t running;
     int joined;
 
     // UDP socket
     int tsock;
+
+    // Polls on the session's reactor instead of a thread of its own if set, see raop_ntp_set_reactor
+    session_reactor_t *reactor;
+    int reactor_timer;
+    // A request was sent on the reactor and its response has not come yet
+    bool awaiting_response;
+
+    // Follows the sender's PTP clock as a slave instead of asking its NTP server, see raop_ntp_set_ptp.
+    // tsock is then bound to the event port, gsock to the general one.
+    bool ptp;
+    int gsock;
+    unsigned char ptp_port_identity[RAOP_NTP_PTP_PORT_IDENTITY_SIZE];
+    unsigned char ptp_domain;
+    // The last Sync, the local time it arrived and the remote time it left, 0 until its Follow_Up came
+    uint16_t ptp_sync_seq;
+    int64_t ptp_sync_arrival;
+    int64_t ptp_sync_origin;
+    // The delay request awaiting its response, with the Sync it completes the exchange of
+    uint16_t ptp_delay_seq;
+    int64_t ptp_delay_send;
+    int64_t ptp_delay_sync_arrival;
+    int64_t ptp_delay_sync_origin;
+    uint64_t ptp_next_request;
+
+    // Replaces CLOCK_MONOTONIC for simulations, see raop_ntp_set_clock
+    raop_ntp_clock_cb_t clock;
+    void *clock_opaque;
+    // RAOP_NTP_NO_* flags of the parts of the discipline left out
+    int discipline;
 };
 
 
@@ -101,23 +173,9 @@ raop_ntp_compare(const void* av, const void* bv)
 static int
 raop_ntp_parse_remote_address(raop_ntp_t *raop_ntp, const unsigned char *remote_addr, int remote_addr_len)
 {
-    char current[25];
-    int family;
     int ret;
     assert(raop_ntp);
-    if (remote_addr_len == 4) {
-        family = AF_INET;
-    } else if (remote_addr_len == 16) {
-        family = AF_INET6;
-    } else {
-        return -1;
-    }
-    memset(current, 0, sizeof(current));
-    sprintf(current, "%d.%d.%d.%d", remote_addr[0], remote_addr[1], remote_addr[2], remote_addr[3]);
-    logger_log(raop_ntp->logger, LOGGER_DEBUG, "raop_ntp parse remote ip = %s", current);
-    ret = netutils_parse_address(family, current,
-                                 &raop_ntp->remote_saddr,
-                                 sizeof(raop_ntp->remote_saddr));
+    ret = netutils_parse_remote(remote_addr, remote_addr_len, 0, &raop_ntp->remote_saddr);
     if (ret < 0) {
         return -1;
     }
@@ -143,10 +201,12 @@ raop_ntp_t *raop_ntp_init(logger_t *logger, const unsigned char *remote_addr, in
     }
 
     // Set port on the remote address struct
-    ((struct sockaddr_in *) &raop_ntp->remote_saddr)->sin_port = htons(timing_rport);
+    netutils_set_port(&raop_ntp->remote_saddr, timing_rport);
 
-    raop_ntp->running = 0;
+    THREAD_FLAG_STORE(raop_ntp->running, 0);
     raop_ntp->joined = 1;
+    raop_ntp->reactor_timer = -1;
+    raop_ntp->gsock = -1;
 
     uint64_t time = raop_ntp_get_local_time(raop_ntp);
 
@@ -160,11 +220,13 @@ raop_ntp_t *raop_ntp_init(logger_t *logger, const unsigned char *remote_addr, in
     raop_ntp->sync_delay = 0;
     raop_ntp->sync_dispersion = 0;
     raop_ntp->sync_offset = 0;
+    raop_ntp->sync_time = 0;
+    raop_ntp->sync_skew = 0.0;
 
     MUTEX_CREATE(raop_ntp->run_mutex);
+    MUTEX_CREATE(raop_ntp->stats_mutex);
     MUTEX_CREATE(raop_ntp->wait_mutex);
     COND_CREATE(raop_ntp->wait_cond);
-    MUTEX_CREATE(raop_ntp->sync_params_mutex);
     return raop_ntp;
 }
 
@@ -174,9 +236,9 @@ raop_ntp_destroy(raop_ntp_t *raop_ntp)
     if (raop_ntp) {
         raop_ntp_stop(raop_ntp);
         MUTEX_DESTROY(raop_ntp->run_mutex);
+        MUTEX_DESTROY(raop_ntp->stats_mutex);
         MUTEX_DESTROY(raop_ntp->wait_mutex);
         COND_DESTROY(raop_ntp->wait_cond);
-        MUTEX_DESTROY(raop_ntp->sync_params_mutex);
         free(raop_ntp);
     }
 }
@@ -199,13 +261,17 @@ raop_ntp_init_socket(raop_ntp_t *raop_ntp, int use_ipv6)
         goto sockets_cleanup;
     }
 
-    // We're calling recvfrom without knowing whether there is any data, so we need a timeout
+    // We're calling recvmsg without knowing whether there is any data, so we need a timeout
     struct timeval tv;
     tv.tv_sec = 0;
     tv.tv_usec = 300000;
     if (setsockopt(tsock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) < 0) {
         goto sockets_cleanup;
     }
+    netutils_tune_socket(raop_ntp->logger, tsock, NETUTILS_SOCKET_TIMING, "raop_ntp timing");
+    if (netutils_enable_timestamps(tsock) < 0) {
+        logger_log(raop_ntp->logger, LOGGER_DEBUG, "raop_ntp no kernel receive timestamps, using the time responses are read");
+    }
 
     /* Set socket descriptors */
     raop_ntp->tsock = tsock;
@@ -236,111 +302,603 @@ raop_ntp_flush_socket(int fd)
     }
 }
 
-static THREAD_RETVAL
-raop_ntp_thread(void *arg)
+/*
+ * Least squares slope of offset over local time for the samples in the
+ * window, or 0 while the samples span too short a time to tell.
+ */
+static double
+raop_ntp_estimate_skew(raop_ntp_t *raop_ntp, uint64_t now)
+{
+    double mean_time = 0, mean_offset = 0;
+    int64_t first = 0, last = 0;
+    int count = 0;
+    int64_t base_offset = raop_ntp->data[raop_ntp->data_index].offset;
+
+    if (raop_ntp->discipline & RAOP_NTP_NO_SKEW) {
+        return 0.0;
+    }
+    for (int i = 0; i < RAOP_NTP_DATA_COUNT; ++i) {
+        raop_ntp_data_t *data = &raop_ntp->data[i];
+        if (data->delay == RAOP_NTP_MAX_DISP) continue;
+        int64_t time = (int64_t) (data->time - now);
+        if (count == 0 || time < first) first = time;
+        if (count == 0 || time > last) last = time;
+        mean_time += (double) time;
+        mean_offset += (double) (data->offset - base_offset);
+        count++;
+    }
+    if (count < 3 || last - first < RAOP_NTP_MIN_SKEW_SPAN) {
+        return 0.0;
+    }
+    mean_time /= count;
+    mean_offset /= count;
+
+    double sxx = 0, sxy = 0;
+    for (int i = 0; i < RAOP_NTP_DATA_COUNT; ++i) {
+        raop_ntp_data_t *data = &raop_ntp->data[i];
+        if (data->delay == RAOP_NTP_MAX_DISP) continue;
+        double dx = (double) (int64_t) (data->time - now) - mean_time;
+        double dy = (double) (data->offset - base_offset) - mean_offset;
+        sxx += dx * dx;
+        sxy += dx * dy;
+    }
+    double skew = sxy / sxx;
+    if (skew > RAOP_NTP_MAX_SKEW) skew = RAOP_NTP_MAX_SKEW;
+    if (skew < -RAOP_NTP_MAX_SKEW) skew = -RAOP_NTP_MAX_SKEW;
+    return skew;
+}
+
+/*
+ * Seqlock on the sync params. The sequence is odd while the single writer
+ * updates them; readers retry until they saw an even, unchanged sequence.
+ * Fields are accessed with relaxed atomics so torn reads are only ever
+ * retried, never used.
+ */
+static void
+raop_ntp_publish_sync_params(raop_ntp_t *raop_ntp, int64_t offset, uint64_t time, double skew,
+                             int64_t dispersion, int64_t delay)
+{
+    unsigned int seq = __atomic_load_n(&raop_ntp->sync_seq, __ATOMIC_RELAXED);
+    __atomic_store_n(&raop_ntp->sync_seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&raop_ntp->sync_offset, offset, __ATOMIC_RELAXED);
+    __atomic_store_n(&raop_ntp->sync_time, time, __ATOMIC_RELAXED);
+    __atomic_store(&raop_ntp->sync_skew, &skew, __ATOMIC_RELAXED);
+    __atomic_store_n(&raop_ntp->sync_dispersion, dispersion, __ATOMIC_RELAXED);
+    __atomic_store_n(&raop_ntp->sync_delay, delay, __ATOMIC_RELAXED);
+    __atomic_store_n(&raop_ntp->sync_seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+static void
+raop_ntp_read_sync_params(raop_ntp_t *raop_ntp, int64_t *offset, uint64_t *time, double *skew)
+{
+    unsigned int seq;
+    do {
+        seq = __atomic_load_n(&raop_ntp->sync_seq, __ATOMIC_ACQUIRE);
+        *offset = __atomic_load_n(&raop_ntp->sync_offset, __ATOMIC_RELAXED);
+        *time = __atomic_load_n(&raop_ntp->sync_time, __ATOMIC_RELAXED);
+        __atomic_load(&raop_ntp->sync_skew, skew, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((seq & 1) || seq != __atomic_load_n(&raop_ntp->sync_seq, __ATOMIC_RELAXED));
+}
+
+static void
+raop_ntp_update_rtt_stats(raop_ntp_t *raop_ntp, int64_t rtt, int64_t receive_delay)
+{
+    MUTEX_LOCK(raop_ntp->stats_mutex);
+    raop_ntp_stats_t *stats = &raop_ntp->stats;
+    if (stats->responses == 0 || rtt < stats->min_rtt) stats->min_rtt = rtt;
+    if (stats->responses == 0 || rtt > stats->max_rtt) stats->max_rtt = rtt;
+    stats->last_rtt = rtt;
+    if (receive_delay > stats->max_receive_delay) stats->max_receive_delay = receive_delay;
+    stats->last_receive_delay = receive_delay;
+    stats->responses++;
+    MUTEX_UNLOCK(raop_ntp->stats_mutex);
+}
+
+/*
+ * RMS difference between the offsets in the window and the chosen one, like NTP's peer jitter.
+ */
+static int64_t
+raop_ntp_get_jitter(raop_ntp_t *raop_ntp, int64_t offset)
+{
+    double sum = 0;
+    int count = 0;
+    for (int i = 0; i < RAOP_NTP_DATA_COUNT; ++i) {
+        if (raop_ntp->data[i].delay == RAOP_NTP_MAX_DISP) continue;
+        double diff = (double) (raop_ntp->data[i].offset - offset);
+        sum += diff * diff;
+        count++;
+    }
+    return count ? (int64_t) sqrt(sum / count) : 0;
+}
+
+/* Sends the next request, returns what sendto did */
+static int
+raop_ntp_send_request(raop_ntp_t *raop_ntp)
 {
-    raop_ntp_t *raop_ntp = arg;
-    assert(raop_ntp);
-    unsigned char response[128];
-    int response_len;
     unsigned char request[32] = {0x80, 0xd2, 0x00, 0x07, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
                                  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
     };
+
+    // Flush the socket in case a super delayed response arrived or something
+    raop_ntp_flush_socket(raop_ntp->tsock);
+
+    raop_ntp->request_count++;
+    MUTEX_LOCK(raop_ntp->stats_mutex);
+    raop_ntp->stats.requests++;
+    MUTEX_UNLOCK(raop_ntp->stats_mutex);
+    uint64_t send_time = raop_ntp_get_local_time(raop_ntp);
+    byteutils_put_ntp_timestamp(request, 24, send_time);
+    int send_len = sendto(raop_ntp->tsock, (char *)request, sizeof(request), 0,
+                          (struct sockaddr *) &raop_ntp->remote_saddr, raop_ntp->remote_saddr_len);
+    logger_log(raop_ntp->logger, LOGGER_DEBUG, "raop_ntp send_len = %d", send_len);
+    return send_len;
+}
+
+/*
+ * Takes the sample of one exchange: t0 is the local time our packet left and t3 the one the
+ * remote's packet arrived, t1 and t2 the remote times it received ours and sent its.
+ * receive_delay is the time from the kernel receiving the last packet to this thread reading it.
+ */
+static void
+raop_ntp_add_sample(raop_ntp_t *raop_ntp, int64_t t0, int64_t t1, int64_t t2, int64_t t3, int64_t receive_delay)
+{
     raop_ntp_data_t data_sorted[RAOP_NTP_DATA_COUNT];
     const unsigned  two_pow_n[RAOP_NTP_DATA_COUNT] = {2, 4, 8, 16, 32, 64, 128, 256};
 
+    // With PTP the remote's packet may be the one that came first
+    int64_t span = llabs(t3 - t0);
+    int64_t rtt = (t3 - t0) - (t2 - t1);
+    raop_ntp_update_rtt_stats(raop_ntp, rtt, receive_delay);
+    if (rtt < 0 || rtt > RAOP_NTP_MAX_RTT) {
+        // A response this slow, or one that went back in time, says nothing useful about the offset
+        logger_log(raop_ntp->logger, LOGGER_DEBUG, "raop_ntp rejecting sample with round trip %lld us", rtt);
+        MUTEX_LOCK(raop_ntp->stats_mutex);
+        raop_ntp->stats.rejected++;
+        MUTEX_UNLOCK(raop_ntp->stats_mutex);
+        return;
+    }
+    raop_ntp->data_index = (raop_ntp->data_index + 1) % RAOP_NTP_DATA_COUNT;
+    raop_ntp->data[raop_ntp->data_index].time = t3;
+    raop_ntp->data[raop_ntp->data_index].offset     = ((t1 - t0) + (t2 - t3)) / 2;
+    raop_ntp->data[raop_ntp->data_index].delay      = ((t3 - t0) - (t2 - t1));
+    raop_ntp->data[raop_ntp->data_index].dispersion = RAOP_NTP_R_RHO + RAOP_NTP_S_RHO +  span * RAOP_NTP_PHI_PPM / 1000000u;
+
+    // Sort by delay
+    memcpy(data_sorted, raop_ntp->data, sizeof(data_sorted));
+    qsort(data_sorted, RAOP_NTP_DATA_COUNT, sizeof(data_sorted[0]), raop_ntp_compare);
+
+    uint64_t dispersion = 0ull;
+    int64_t delay = data_sorted[RAOP_NTP_DATA_COUNT - 1].delay;
+
+    // Carry the offset of the minimum delay sample forward to now along the skew
+    double skew = raop_ntp_estimate_skew(raop_ntp, t3);
+    int64_t offset = data_sorted[0].offset + (int64_t) (skew * (double) (t3 - (int64_t) data_sorted[0].time));
+
+    // Calculate dispersion
+    for(int i = 0; i < RAOP_NTP_DATA_COUNT; ++i) {
+        unsigned long long disp = raop_ntp->data[i].dispersion + (t3 - raop_ntp->data[i].time) * RAOP_NTP_PHI_PPM / 1000000u;
+        dispersion += disp / two_pow_n[i];
+    }
+
+    int64_t correction = offset - (raop_ntp->sync_offset +
+            (int64_t) (raop_ntp->sync_skew * (double) (t3 - (int64_t) raop_ntp->sync_time)));
+    raop_ntp_publish_sync_params(raop_ntp, offset, t3, skew, dispersion, delay);
+    trace_event(TRACE_NTP_SAMPLE, (uint64_t) offset, (uint64_t) span);
+
+    MUTEX_LOCK(raop_ntp->stats_mutex);
+    raop_ntp->stats.offset = offset;
+    raop_ntp->stats.delay = delay;
+    raop_ntp->stats.dispersion = dispersion;
+    raop_ntp->stats.jitter = raop_ntp_get_jitter(raop_ntp, data_sorted[0].offset);
+    raop_ntp->stats.skew = skew * 1000000.0;
+    if (!raop_ntp->stats.corrections || offset < raop_ntp->stats.min_offset) raop_ntp->stats.min_offset = offset;
+    if (!raop_ntp->stats.corrections || offset > raop_ntp->stats.max_offset) raop_ntp->stats.max_offset = offset;
+    raop_ntp->stats.corrections++;
+    MUTEX_UNLOCK(raop_ntp->stats_mutex);
+
+    logger_log(raop_ntp->logger, LOGGER_DEBUG, "raop_ntp sync correction = %lld, skew = %.2f ppm", correction, skew * 1000000.0);
+}
+
+static void
+raop_ntp_process_response(raop_ntp_t *raop_ntp, unsigned char *response, struct msghdr *msg)
+{
+    // The kernel's receive time keeps the wait for this thread out of the round trip
+    int64_t now = (int64_t) raop_ntp_get_local_time(raop_ntp);
+    int64_t t3 = (int64_t) netutils_get_timestamp(msg);
+    if (t3 == 0 || t3 > now) {
+        t3 = now;
+    }
+    // Local time of the client when the NTP request packet leaves the client
+    int64_t t0 = (int64_t) byteutils_get_ntp_timestamp(response, 8);
+    // Local time of the server when the NTP request packet arrives at the server
+    int64_t t1 = (int64_t) byteutils_get_ntp_timestamp(response, 16);
+    // Local time of the server when the response message leaves the server
+    int64_t t2 = (int64_t) byteutils_get_ntp_timestamp(response, 24);
+
+    // The iOS device sends its time in micro seconds relative to an arbitrary Epoch (the last boot).
+    // For a little bonus confusion, they add SECONDS_FROM_1900_TO_1970 * 1000000 us.
+    // This means we have to expect some rather huge offset, but its growth or shrink over time should be small.
+    raop_ntp_add_sample(raop_ntp, t0, t1, t2, t3, now - t3);
+}
+
+/*
+ * Reads a response and uses it unless stop interrupted the read. flags MSG_DONTWAIT
+ * returns at once if there is none. Returns what recvmsg did.
+ */
+static int
+raop_ntp_receive_response(raop_ntp_t *raop_ntp, int flags)
+{
+    unsigned char response[128];
+    // Read into an address of its own so a recvmsg cut short by stop can't clobber remote_saddr
+    struct sockaddr_storage response_saddr;
+    unsigned char control[NETUTILS_TIMESTAMP_CONTROL_SIZE];
+    struct iovec iov = { response, sizeof(response) };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = &response_saddr;
+    msg.msg_namelen = sizeof(response_saddr);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    int response_len = recvmsg(raop_ntp->tsock, &msg, flags);
+    if (response_len < 0 || !THREAD_FLAG_LOAD(raop_ntp->running)) {
+        return response_len;
+    }
+    logger_log(raop_ntp->logger, LOGGER_DEBUG, "raop_ntp receive time type_t packetlen = %d", response_len);
+    raop_ntp_process_response(raop_ntp, response, &msg);
+    return response_len;
+}
+
+static void
+raop_ntp_count_timeout(raop_ntp_t *raop_ntp)
+{
+    logger_log(raop_ntp->logger, LOGGER_ERR, "raop_ntp receive timeout");
+    MUTEX_LOCK(raop_ntp->stats_mutex);
+    raop_ntp->stats.timeouts++;
+    MUTEX_UNLOCK(raop_ntp->stats_mutex);
+}
+
+/* Time until the next request, short while the burst lasts */
+static uint64_t
+raop_ntp_interval(raop_ntp_t *raop_ntp)
+{
+    if (raop_ntp->request_count < RAOP_NTP_BURST_COUNT && !(raop_ntp->discipline & RAOP_NTP_NO_BURST)) {
+        return RAOP_NTP_BURST_INTERVAL;
+    }
+    return raop_ntp->ptp ? RAOP_NTP_PTP_POLL_INTERVAL : RAOP_NTP_POLL_INTERVAL;
+}
+
+static THREAD_RETVAL
+raop_ntp_thread(void *arg)
+{
+    raop_ntp_t *raop_ntp = arg;
+    assert(raop_ntp);
+
+    thread_attr_apply(raop_ntp->logger, THREAD_ROLE_NTP, "rp-ntp");
     while (1) {
-        MUTEX_LOCK(raop_ntp->run_mutex);
-        if (!raop_ntp->running) {
-            MUTEX_UNLOCK(raop_ntp->run_mutex);
+        if (!THREAD_FLAG_LOAD(raop_ntp->running)) {
             break;
         }
-        MUTEX_UNLOCK(raop_ntp->run_mutex);
-
-        // Flush the socket in case a super delayed response arrived or something
-        raop_ntp_flush_socket(raop_ntp->tsock);
 
-        // Send request
-        uint64_t send_time = raop_ntp_get_local_time(raop_ntp);
-        byteutils_put_ntp_timestamp(request, 24, send_time);
-        int send_len = sendto(raop_ntp->tsock, (char *)request, sizeof(request), 0,
-                              (struct sockaddr *) &raop_ntp->remote_saddr, raop_ntp->remote_saddr_len);
-        logger_log(raop_ntp->logger, LOGGER_DEBUG, "raop_ntp send_len = %d", send_len);
-        if (send_len < 0) {
+        if (raop_ntp_send_request(raop_ntp) < 0) {
+            if (!THREAD_FLAG_LOAD(raop_ntp->running)) {
+                break;
+            }
             logger_log(raop_ntp->logger, LOGGER_ERR, "raop_ntp error sending request");
         } else {
-            // Read response
-            response_len = recvfrom(raop_ntp->tsock, (char *)response, sizeof(response), 0,
-                                    (struct sockaddr *) &raop_ntp->remote_saddr, &raop_ntp->remote_saddr_len);
+            int response_len = raop_ntp_receive_response(raop_ntp, 0);
+            if (!THREAD_FLAG_LOAD(raop_ntp->running)) {
+                // Woken by stop shutting the socket down
+                break;
+            }
             if (response_len < 0) {
-                logger_log(raop_ntp->logger, LOGGER_ERR, "raop_ntp receive timeout");
-            } else {
-                logger_log(raop_ntp->logger, LOGGER_DEBUG, "raop_ntp receive time type_t packetlen = %d", response_len);
-
-                int64_t t3 = (int64_t) raop_ntp_get_local_time(raop_ntp);
-                // Local time of the client when the NTP request packet leaves the client
-                int64_t t0 = (int64_t) byteutils_get_ntp_timestamp(response, 8);
-                // Local time of the server when the NTP request packet arrives at the server
-                int64_t t1 = (int64_t) byteutils_get_ntp_timestamp(response, 16);
-                // Local time of the server when the response message leaves the server
-                int64_t t2 = (int64_t) byteutils_get_ntp_timestamp(response, 24);
-
-                // The iOS device sends its time in micro seconds relative to an arbitrary Epoch (the last boot).
-                // For a little bonus confusion, they add SECONDS_FROM_1900_TO_1970 * 1000000 us.
-                // This means we have to expect some rather huge offset, but its growth or shrink over time should be small.
-
-                raop_ntp->data_index = (raop_ntp->data_index + 1) % RAOP_NTP_DATA_COUNT;
-                raop_ntp->data[raop_ntp->data_index].time = t3;
-                raop_ntp->data[raop_ntp->data_index].offset     = ((t1 - t0) + (t2 - t3)) / 2;
-                raop_ntp->data[raop_ntp->data_index].delay      = ((t3 - t0) - (t2 - t1));
-                raop_ntp->data[raop_ntp->data_index].dispersion = RAOP_NTP_R_RHO + RAOP_NTP_S_RHO +  (t3 - t0) * RAOP_NTP_PHI_PPM / 1000000u;
-
-                // Sort by delay
-                memcpy(data_sorted, raop_ntp->data, sizeof(data_sorted));
-                qsort(data_sorted, RAOP_NTP_DATA_COUNT, sizeof(data_sorted[0]), raop_ntp_compare);
-
-                uint64_t dispersion = 0ull;
-                int64_t offset = data_sorted[0].offset;
-                int64_t delay = data_sorted[RAOP_NTP_DATA_COUNT - 1].delay;
-
-                // Calculate dispersion
-                for(int i = 0; i < RAOP_NTP_DATA_COUNT; ++i) {
-                    unsigned long long disp = raop_ntp->data[i].dispersion + (t3 - raop_ntp->data[i].time) * RAOP_NTP_PHI_PPM / 1000000u;
-                    dispersion += disp / two_pow_n[i];
-                }
-
-                MUTEX_LOCK(raop_ntp->sync_params_mutex);
-
-                int64_t correction = offset - raop_ntp->sync_offset;
-                raop_ntp->sync_offset = offset;
-                raop_ntp->sync_dispersion = dispersion;
-                raop_ntp->sync_delay = delay;
-                MUTEX_UNLOCK(raop_ntp->sync_params_mutex);
-
-                logger_log(raop_ntp->logger, LOGGER_DEBUG, "raop_ntp sync correction = %lld", correction);
+                raop_ntp_count_timeout(raop_ntp);
             }
         }
 
-        // Sleep for 3 seconds
+        // Sleep until the next request
+        uint64_t interval = raop_ntp_interval(raop_ntp);
         struct timeval now;
         struct timespec wait_time;
         MUTEX_LOCK(raop_ntp->wait_mutex);
         gettimeofday(&now, NULL);
-        wait_time.tv_sec = now.tv_sec + 3;
-        wait_time.tv_nsec = now.tv_usec * 1000;
-        pthread_cond_timedwait(&raop_ntp->wait_cond, &raop_ntp->wait_mutex, &wait_time);
+        uint64_t wake_time = (uint64_t) now.tv_sec * 1000000 + now.tv_usec + interval;
+        wait_time.tv_sec = wake_time / 1000000;
+        wait_time.tv_nsec = (wake_time % 1000000) * 1000;
+        // Stop clears running before it signals under wait_mutex, so the signal can't be missed
+        if (THREAD_FLAG_LOAD(raop_ntp->running)) {
+            COND_TIMEDWAIT(raop_ntp->wait_cond, raop_ntp->wait_mutex, wait_time);
+        }
         MUTEX_UNLOCK(raop_ntp->wait_mutex);
     }
 
     // Ensure running reflects the actual state
     MUTEX_LOCK(raop_ntp->run_mutex);
-    raop_ntp->running = false;
+    THREAD_FLAG_STORE(raop_ntp->running, 0);
     MUTEX_UNLOCK(raop_ntp->run_mutex);
 
     logger_log(raop_ntp->logger, LOGGER_DEBUG, "raop_ntp exiting thread");
     return 0;
 }
 
+/* On the reactor a request whose response hasn't come by the next one timed out */
+static uint64_t
+raop_ntp_reactor_poll(void *arg)
+{
+    raop_ntp_t *raop_ntp = arg;
+
+    if (raop_ntp->awaiting_response) {
+        raop_ntp_count_timeout(raop_ntp);
+    }
+    raop_ntp->awaiting_response = raop_ntp_send_request(raop_ntp) >= 0;
+    if (!raop_ntp->awaiting_response) {
+        logger_log(raop_ntp->logger, LOGGER_ERR, "raop_ntp error sending request");
+    }
+    return raop_ntp_interval(raop_ntp);
+}
+
+static void
+raop_ntp_reactor_read(void *arg, int fd)
+{
+    raop_ntp_t *raop_ntp = arg;
+
+    if (raop_ntp_receive_response(raop_ntp, MSG_DONTWAIT) >= 0) {
+        raop_ntp->awaiting_response = false;
+    }
+}
+
+/* A PTP timestamp, 48 bit seconds and 32 bit nanoseconds, in us */
+static int64_t
+raop_ntp_ptp_get_timestamp(unsigned char *message, int offset)
+{
+    uint64_t seconds = (uint64_t) byteutils_get_short_be(message, offset) << 32 | byteutils_get_int_be(message, offset + 2);
+    uint32_t nanoseconds = byteutils_get_int_be(message, offset + 6);
+    return (int64_t) (seconds * 1000000 + nanoseconds / 1000);
+}
+
+/* The correction field of a PTP header, in us. It counts 2^-16 ns */
+static int64_t
+raop_ntp_ptp_get_correction(unsigned char *message)
+{
+    return ((int64_t) byteutils_get_long_be(message, 8) >> 16) / 1000;
+}
+
+/* Sends a Delay_Req for the last Sync, whose Delay_Resp then completes the exchange */
+static void
+raop_ntp_ptp_send_delay_request(raop_ntp_t *raop_ntp)
+{
+    unsigned char request[RAOP_NTP_PTP_HEADER_SIZE + RAOP_NTP_PTP_TIMESTAMP_SIZE];
+
+    memset(request, 0, sizeof(request));
+    request[0] = RAOP_NTP_PTP_DELAY_REQ;
+    request[1] = 2; // PTP version
+    byteutils_put_short_be(request, 2, sizeof(request));
+    request[4] = raop_ntp->ptp_domain;
+    memcpy(request + 20, raop_ntp->ptp_port_identity, RAOP_NTP_PTP_PORT_IDENTITY_SIZE);
+    byteutils_put_short_be(request, 30, ++raop_ntp->ptp_delay_seq);
+    request[32] = 1; // Control field of a Delay_Req
+    request[33] = 0x7f; // No message interval
+    // The origin timestamp may be left 0, the send time that counts is the kernel's
+
+    raop_ntp->request_count++;
+    MUTEX_LOCK(raop_ntp->stats_mutex);
+    raop_ntp->stats.requests++;
+    MUTEX_UNLOCK(raop_ntp->stats_mutex);
+    uint64_t send_time = raop_ntp_get_local_time(raop_ntp);
+    int send_len = sendto(raop_ntp->tsock, (char *) request, sizeof(request), 0,
+                          (struct sockaddr *) &raop_ntp->remote_saddr, raop_ntp->remote_saddr_len);
+    if (send_len < 0) {
+        logger_log(raop_ntp->logger, LOGGER_ERR, "raop_ntp error sending PTP delay request");
+        return;
+    }
+    uint64_t stamp = netutils_get_send_timestamp(raop_ntp->tsock);
+    raop_ntp->ptp_delay_send = (int64_t) (stamp >= send_time ? stamp : send_time);
+    raop_ntp->ptp_delay_sync_arrival = raop_ntp->ptp_sync_arrival;
+    raop_ntp->ptp_delay_sync_origin = raop_ntp->ptp_sync_origin;
+    raop_ntp->awaiting_response = true;
+    raop_ntp->ptp_next_request = send_time + raop_ntp_interval(raop_ntp);
+}
+
+/* The remote time the last Sync left is known, asks for the delay unless one was asked for recently */
+static void
+raop_ntp_ptp_sync_complete(raop_ntp_t *raop_ntp)
+{
+    if (raop_ntp_get_local_time(raop_ntp) < raop_ntp->ptp_next_request) {
+        return;
+    }
+    if (raop_ntp->awaiting_response) {
+        raop_ntp_count_timeout(raop_ntp);
+    }
+    raop_ntp_ptp_send_delay_request(raop_ntp);
+}
+
+/*
+ * Reads a message from the sender's PTP master on fd and goes on with the exchange, a sample
+ * takes a Sync, its Follow_Up, our Delay_Req and its Delay_Resp. Announce and signaling
+ * messages are ignored: the sender is the master we follow, whatever the best master would be.
+ */
+static void
+raop_ntp_ptp_receive(raop_ntp_t *raop_ntp, int fd)
+{
+    unsigned char message[128];
+    struct sockaddr_storage message_saddr;
+    unsigned char control[NETUTILS_TIMESTAMP_CONTROL_SIZE];
+    struct iovec iov = { message, sizeof(message) };
+    struct msghdr msg;
+
+    if (fd == raop_ntp->tsock) {
+        // Send stamps that came too late for their request
+        netutils_get_send_timestamp(fd);
+    }
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = &message_saddr;
+    msg.msg_namelen = sizeof(message_saddr);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    int message_len = recvmsg(fd, &msg, MSG_DONTWAIT);
+    if (message_len < RAOP_NTP_PTP_HEADER_SIZE + RAOP_NTP_PTP_TIMESTAMP_SIZE || !THREAD_FLAG_LOAD(raop_ntp->running)) {
+        return;
+    }
+    // Other masters on the network, e.g. another sender's, are none of this session's business
+    if (!netutils_same_host(&message_saddr, &raop_ntp->remote_saddr)) {
+        return;
+    }
+    if ((message[1] & 0x0f) != 2) {
+        return;
+    }
+
+    int64_t now = (int64_t) raop_ntp_get_local_time(raop_ntp);
+    uint16_t seq = byteutils_get_short_be(message, 30);
+    switch (message[0] & 0x0f) {
+        case RAOP_NTP_PTP_SYNC: {
+            int64_t arrival = (int64_t) netutils_get_timestamp(&msg);
+            raop_ntp->ptp_domain = message[4];
+            raop_ntp->ptp_sync_seq = seq;
+            raop_ntp->ptp_sync_arrival = arrival == 0 || arrival > now ? now : arrival;
+            raop_ntp->ptp_sync_origin = 0;
+            if (!(message[6] & RAOP_NTP_PTP_TWO_STEP)) {
+                raop_ntp->ptp_sync_origin = raop_ntp_ptp_get_timestamp(message, RAOP_NTP_PTP_HEADER_SIZE) +
+                                            raop_ntp_ptp_get_correction(message);
+                raop_ntp_ptp_sync_complete(raop_ntp);
+            }
+            break;
+        }
+        case RAOP_NTP_PTP_FOLLOW_UP:
+            if (seq != raop_ntp->ptp_sync_seq || !raop_ntp->ptp_sync_arrival) {
+                break;
+            }
+            raop_ntp->ptp_sync_origin = raop_ntp_ptp_get_timestamp(message, RAOP_NTP_PTP_HEADER_SIZE) +
+                                        raop_ntp_ptp_get_correction(message);
+            raop_ntp_ptp_sync_complete(raop_ntp);
+            break;
+        case RAOP_NTP_PTP_DELAY_RESP: {
+            const int identity_offset = RAOP_NTP_PTP_HEADER_SIZE + RAOP_NTP_PTP_TIMESTAMP_SIZE;
+            if (message_len < identity_offset + RAOP_NTP_PTP_PORT_IDENTITY_SIZE || !raop_ntp->awaiting_response ||
+                seq != raop_ntp->ptp_delay_seq ||
+                memcmp(message + identity_offset, raop_ntp->ptp_port_identity, RAOP_NTP_PTP_PORT_IDENTITY_SIZE)) {
+                break;
+            }
+            raop_ntp->awaiting_response = false;
+            int64_t receive = raop_ntp_ptp_get_timestamp(message, RAOP_NTP_PTP_HEADER_SIZE) -
+                              raop_ntp_ptp_get_correction(message);
+            // Our request plays NTP's request and the Sync its response
+            raop_ntp_add_sample(raop_ntp, raop_ntp->ptp_delay_send, receive, raop_ntp->ptp_delay_sync_origin,
+                                raop_ntp->ptp_delay_sync_arrival, now - raop_ntp->ptp_delay_sync_arrival);
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+static void
+raop_ntp_ptp_reactor_read(void *arg, int fd)
+{
+    raop_ntp_ptp_receive(arg, fd);
+}
+
+static THREAD_RETVAL
+raop_ntp_ptp_thread(void *arg)
+{
+    raop_ntp_t *raop_ntp = arg;
+    struct pollfd pfds[2];
+    assert(raop_ntp);
+
+    thread_attr_apply(raop_ntp->logger, THREAD_ROLE_NTP, "rp-ptp");
+    pfds[0].fd = raop_ntp->tsock;
+    pfds[0].events = POLLIN;
+    pfds[1].fd = raop_ntp->gsock;
+    pfds[1].events = POLLIN;
+    while (THREAD_FLAG_LOAD(raop_ntp->running)) {
+        // Stop shuts both sockets down, which wakes the poll
+        if (poll(pfds, 2, -1) < 0) {
+            continue;
+        }
+        for (int i = 0; i < 2; i++) {
+            if (pfds[i].revents) raop_ntp_ptp_receive(raop_ntp, pfds[i].fd);
+        }
+    }
+
+    MUTEX_LOCK(raop_ntp->run_mutex);
+    THREAD_FLAG_STORE(raop_ntp->running, 0);
+    MUTEX_UNLOCK(raop_ntp->run_mutex);
+
+    logger_log(raop_ntp->logger, LOGGER_DEBUG, "raop_ntp exiting PTP thread");
+    return 0;
+}
+
+static int
+raop_ntp_ptp_init_sockets(raop_ntp_t *raop_ntp, int use_ipv6)
+{
+    unsigned short tport = RAOP_NTP_PTP_EVENT_PORT;
+    unsigned short gport = RAOP_NTP_PTP_GENERAL_PORT;
+
+    // Ports below 1024, binding them takes root or CAP_NET_BIND_SERVICE
+    raop_ntp->tsock = netutils_init_socket(&tport, use_ipv6, 1);
+    raop_ntp->gsock = netutils_init_socket(&gport, use_ipv6, 1);
+    if (raop_ntp->tsock == -1 || raop_ntp->gsock == -1) {
+        if (raop_ntp->tsock != -1) closesocket(raop_ntp->tsock);
+        if (raop_ntp->gsock != -1) closesocket(raop_ntp->gsock);
+        raop_ntp->tsock = -1;
+        raop_ntp->gsock = -1;
+        return -1;
+    }
+    netutils_tune_socket(raop_ntp->logger, raop_ntp->tsock, NETUTILS_SOCKET_TIMING, "raop_ntp PTP event");
+    netutils_tune_socket(raop_ntp->logger, raop_ntp->gsock, NETUTILS_SOCKET_TIMING, "raop_ntp PTP general");
+    if (netutils_enable_send_timestamps(raop_ntp->tsock) < 0 && netutils_enable_timestamps(raop_ntp->tsock) < 0) {
+        logger_log(raop_ntp->logger, LOGGER_DEBUG, "raop_ntp no kernel timestamps, using the time messages are sent and read");
+    }
+    raop_ntp->timing_lport = tport;
+    return 0;
+}
+
+void
+raop_ntp_set_ptp(raop_ntp_t *raop_ntp, const unsigned char *clock_identity)
+{
+    assert(raop_ntp);
+    assert(!THREAD_FLAG_LOAD(raop_ntp->running));
+    raop_ntp->ptp = true;
+    memcpy(raop_ntp->ptp_port_identity, clock_identity, RAOP_NTP_PTP_CLOCK_IDENTITY_SIZE);
+    // Our one port
+    byteutils_put_short_be(raop_ntp->ptp_port_identity, RAOP_NTP_PTP_CLOCK_IDENTITY_SIZE, 1);
+    netutils_set_port(&raop_ntp->remote_saddr, RAOP_NTP_PTP_EVENT_PORT);
+}
+
+bool
+raop_ntp_is_ptp(raop_ntp_t *raop_ntp)
+{
+    return raop_ntp->ptp;
+}
+
+bool
+raop_ntp_remote_is_ipv6(raop_ntp_t *raop_ntp)
+{
+    return raop_ntp->remote_saddr.ss_family == AF_INET6;
+}
+
+void
+raop_ntp_set_reactor(raop_ntp_t *raop_ntp, session_reactor_t *reactor)
+{
+    assert(raop_ntp);
+    raop_ntp->reactor = reactor;
+}
+
+void
+raop_ntp_set_remote_scope(raop_ntp_t *raop_ntp, unsigned int scope_id)
+{
+    assert(raop_ntp);
+    assert(!THREAD_FLAG_LOAD(raop_ntp->running));
+    if (raop_ntp->remote_saddr.ss_family == AF_INET6 &&
+        IN6_IS_ADDR_LINKLOCAL(&((struct sockaddr_in6 *) &raop_ntp->remote_saddr)->sin6_addr)) {
+        ((struct sockaddr_in6 *) &raop_ntp->remote_saddr)->sin6_scope_id = scope_id;
+    }
+}
+
 void
 raop_ntp_start(raop_ntp_t *raop_ntp, unsigned short *timing_lport)
 {
@@ -350,7 +908,7 @@ raop_ntp_start(raop_ntp_t *raop_ntp, unsigned short *timing_lport)
     assert(raop_ntp);
 
     MUTEX_LOCK(raop_ntp->run_mutex);
-    if (raop_ntp->running || !raop_ntp->joined) {
+    if (THREAD_FLAG_LOAD(raop_ntp->running) || !raop_ntp->joined) {
         MUTEX_UNLOCK(raop_ntp->run_mutex);
         return;
     }
@@ -359,8 +917,14 @@ raop_ntp_start(raop_ntp_t *raop_ntp, unsigned short *timing_lport)
     if (raop_ntp->remote_saddr.ss_family == AF_INET6) {
         use_ipv6 = 1;
     }
-    use_ipv6 = 0;
-    if (raop_ntp_init_socket(raop_ntp, use_ipv6) < 0) {
+    if (raop_ntp->ptp) {
+        if (raop_ntp_ptp_init_sockets(raop_ntp, use_ipv6) < 0) {
+            logger_log(raop_ntp->logger, LOGGER_ERR, "raop_ntp could not bind the PTP ports %d and %d, they take root or CAP_NET_BIND_SERVICE",
+                       RAOP_NTP_PTP_EVENT_PORT, RAOP_NTP_PTP_GENERAL_PORT);
+            MUTEX_UNLOCK(raop_ntp->run_mutex);
+            return;
+        }
+    } else if (raop_ntp_init_socket(raop_ntp, use_ipv6) < 0) {
         logger_log(raop_ntp->logger, LOGGER_ERR, "raop_ntp initializing timing socket failed");
         MUTEX_UNLOCK(raop_ntp->run_mutex);
         return;
@@ -368,10 +932,44 @@ raop_ntp_start(raop_ntp_t *raop_ntp, unsigned short *timing_lport)
     if (timing_lport) *timing_lport = raop_ntp->timing_lport;
 
     /* Create the thread and initialize running values */
-    raop_ntp->running = 1;
+    THREAD_FLAG_STORE(raop_ntp->running, 1);
     raop_ntp->joined = 0;
-
-    THREAD_CREATE(raop_ntp->thread, raop_ntp_thread, raop_ntp);
+    raop_ntp->request_count = 0;
+    MUTEX_LOCK(raop_ntp->stats_mutex);
+    memset(&raop_ntp->stats, 0, sizeof(raop_ntp_stats_t));
+    MUTEX_UNLOCK(raop_ntp->stats_mutex);
+
+    raop_ntp->awaiting_response = false;
+    raop_ntp->ptp_sync_arrival = 0;
+    raop_ntp->ptp_next_request = 0;
+    if (raop_ntp->ptp && raop_ntp->reactor) {
+        // The sender's Syncs drive the exchange, there's nothing to poll for
+        if (session_reactor_add_fd(raop_ntp->reactor, raop_ntp->tsock, raop_ntp_ptp_reactor_read, raop_ntp) < 0 ||
+            session_reactor_add_fd(raop_ntp->reactor, raop_ntp->gsock, raop_ntp_ptp_reactor_read, raop_ntp) < 0) {
+            logger_log(raop_ntp->logger, LOGGER_ERR, "raop_ntp could not add the PTP sockets to the session reactor");
+            session_reactor_remove_fd(raop_ntp->reactor, raop_ntp->tsock);
+            closesocket(raop_ntp->tsock);
+            closesocket(raop_ntp->gsock);
+            raop_ntp->tsock = -1;
+            raop_ntp->gsock = -1;
+            THREAD_FLAG_STORE(raop_ntp->running, 0);
+            raop_ntp->joined = 1;
+        }
+    } else if (raop_ntp->ptp) {
+        THREAD_CREATE(raop_ntp->thread, raop_ntp_ptp_thread, raop_ntp);
+    } else if (raop_ntp->reactor) {
+        if (session_reactor_add_fd(raop_ntp->reactor, raop_ntp->tsock, raop_ntp_reactor_read, raop_ntp) < 0 ||
+            (raop_ntp->reactor_timer = session_reactor_add_timer(raop_ntp->reactor, 0, raop_ntp_reactor_poll, raop_ntp)) < 0) {
+            logger_log(raop_ntp->logger, LOGGER_ERR, "raop_ntp could not add the timing socket to the session reactor");
+            session_reactor_remove_fd(raop_ntp->reactor, raop_ntp->tsock);
+            closesocket(raop_ntp->tsock);
+            raop_ntp->tsock = -1;
+            THREAD_FLAG_STORE(raop_ntp->running, 0);
+            raop_ntp->joined = 1;
+        }
+    } else {
+        THREAD_CREATE(raop_ntp->thread, raop_ntp_thread, raop_ntp);
+    }
     MUTEX_UNLOCK(raop_ntp->run_mutex);
 }
 
@@ -383,11 +981,11 @@ raop_ntp_stop(raop_ntp_t *raop_ntp)
     /* Check that we are running and thread is not
      * joined (should never be while still running) */
     MUTEX_LOCK(raop_ntp->run_mutex);
-    if (!raop_ntp->running || raop_ntp->joined) {
+    if (!THREAD_FLAG_LOAD(raop_ntp->running) || raop_ntp->joined) {
         MUTEX_UNLOCK(raop_ntp->run_mutex);
         return;
     }
-    raop_ntp->running = 0;
+    THREAD_FLAG_STORE(raop_ntp->running, 0);
     MUTEX_UNLOCK(raop_ntp->run_mutex);
 
     logger_log(raop_ntp->logger, LOGGER_DEBUG, "raop_ntp stopping time thread");
@@ -396,21 +994,126 @@ raop_ntp_stop(raop_ntp_t *raop_ntp)
     COND_SIGNAL(raop_ntp->wait_cond);
     MUTEX_UNLOCK(raop_ntp->wait_mutex);
 
+    if (raop_ntp->reactor) {
+        // Once both are gone none of the callbacks runs any more
+        session_reactor_cancel_timer(raop_ntp->reactor, raop_ntp->reactor_timer);
+        session_reactor_remove_fd(raop_ntp->reactor, raop_ntp->tsock);
+        if (raop_ntp->gsock != -1) {
+            session_reactor_remove_fd(raop_ntp->reactor, raop_ntp->gsock);
+        }
+        raop_ntp->reactor_timer = -1;
+    } else {
+        /* Closing the socket doesn't end a recvmsg that waits for a response, shutting it down does */
+        if (raop_ntp->tsock != -1) {
+            shutdown(raop_ntp->tsock, SHUT_RDWR);
+        }
+        if (raop_ntp->gsock != -1) {
+            shutdown(raop_ntp->gsock, SHUT_RDWR);
+        }
+
+        THREAD_JOIN(raop_ntp->thread);
+    }
+
     if (raop_ntp->tsock != -1) {
         closesocket(raop_ntp->tsock);
         raop_ntp->tsock = -1;
     }
-
-    THREAD_JOIN(raop_ntp->thread);
+    if (raop_ntp->gsock != -1) {
+        closesocket(raop_ntp->gsock);
+        raop_ntp->gsock = -1;
+    }
 
     logger_log(raop_ntp->logger, LOGGER_DEBUG, "raop_ntp stopped time thread");
 
+    raop_ntp_stats_t stats;
+    raop_ntp_get_stats(raop_ntp, &stats);
+    logger_log(raop_ntp->logger, LOGGER_INFO, "raop_ntp %llu requests, %llu responses, %llu timeouts, %llu rejected, rtt %lld/%lld/%lld us (min/last/max), jitter %lld us, skew %.2f ppm, receive delay %lld/%lld us (last/max)",
+               (unsigned long long) stats.requests, (unsigned long long) stats.responses,
+               (unsigned long long) stats.timeouts, (unsigned long long) stats.rejected,
+               stats.min_rtt, stats.last_rtt, stats.max_rtt, stats.jitter, stats.skew,
+               stats.last_receive_delay, stats.max_receive_delay);
+
     /* Mark thread as joined */
     MUTEX_LOCK(raop_ntp->run_mutex);
     raop_ntp->joined = 1;
     MUTEX_UNLOCK(raop_ntp->run_mutex);
 }
 
+bool
+raop_ntp_get_sync(raop_ntp_t *raop_ntp, raop_ntp_sync_t *sync)
+{
+    raop_ntp_read_sync_params(raop_ntp, &sync->offset, &sync->time, &sync->skew);
+    sync->delay = __atomic_load_n(&raop_ntp->sync_delay, __ATOMIC_RELAXED);
+    return sync->time != 0;
+}
+
+void
+raop_ntp_seed_sync(raop_ntp_t *raop_ntp, const raop_ntp_sync_t *sync)
+{
+    uint64_t now = raop_ntp_get_local_time(raop_ntp);
+    int64_t offset = sync->offset + (int64_t) (sync->skew * (double) ((int64_t) now - (int64_t) sync->time));
+
+    assert(!THREAD_FLAG_LOAD(raop_ntp->running));
+    // As samples of the delay the estimate had, the first real ones with a shorter round trip win
+    for (int i = 0; i < RAOP_NTP_DATA_COUNT; ++i) {
+        raop_ntp->data[i].offset = offset;
+        raop_ntp->data[i].delay = sync->delay;
+        raop_ntp->data[i].time = now;
+    }
+    raop_ntp_publish_sync_params(raop_ntp, offset, now, sync->skew, RAOP_NTP_MAX_DISP, sync->delay);
+}
+
+void
+raop_ntp_set_clock(raop_ntp_t *raop_ntp, raop_ntp_clock_cb_t clock, void *opaque)
+{
+    assert(raop_ntp);
+    assert(!THREAD_FLAG_LOAD(raop_ntp->running));
+    raop_ntp->clock = clock;
+    raop_ntp->clock_opaque = opaque;
+    // The empty samples age from the start of the new clock
+    uint64_t now = raop_ntp_get_local_time(raop_ntp);
+    for (int i = 0; i < RAOP_NTP_DATA_COUNT; ++i) {
+        raop_ntp->data[i].time = now;
+    }
+}
+
+void
+raop_ntp_set_discipline(raop_ntp_t *raop_ntp, int flags)
+{
+    assert(raop_ntp);
+    assert(!THREAD_FLAG_LOAD(raop_ntp->running));
+    raop_ntp->discipline = flags;
+}
+
+uint64_t
+raop_ntp_simulate_request(raop_ntp_t *raop_ntp)
+{
+    assert(!THREAD_FLAG_LOAD(raop_ntp->running));
+    raop_ntp->request_count++;
+    MUTEX_LOCK(raop_ntp->stats_mutex);
+    raop_ntp->stats.requests++;
+    MUTEX_UNLOCK(raop_ntp->stats_mutex);
+    return raop_ntp_interval(raop_ntp);
+}
+
+void
+raop_ntp_simulate_response(raop_ntp_t *raop_ntp, uint64_t t0, uint64_t t1, uint64_t t2, uint64_t t3)
+{
+    assert(!THREAD_FLAG_LOAD(raop_ntp->running));
+    raop_ntp_add_sample(raop_ntp, (int64_t) t0, (int64_t) t1, (int64_t) t2, (int64_t) t3, 0);
+}
+
+void
+raop_ntp_get_stats(raop_ntp_t *raop_ntp, raop_ntp_stats_t *stats)
+{
+    assert(raop_ntp);
+    assert(stats);
+
+    MUTEX_LOCK(raop_ntp->stats_mutex);
+    memcpy(stats, &raop_ntp->stats, sizeof(raop_ntp_stats_t));
+    MUTEX_UNLOCK(raop_ntp->stats_mutex);
+}
+
 /**
  * Converts from a little endian ntp timestamp to micro seconds since the Unix epoch.
  * Does the same thing as byteutils_get_ntp_timestamp, except its input is an uint64_t
@@ -425,41 +1128,68 @@ uint64_t raop_ntp_timestamp_to_micro_seconds(uint64_t ntp_timestamp, bool accoun
 }
 
 /**
- * Returns the current time in micro seconds according to the local wall clock.
- * The system Unix time is used as the local wall clock.
+ * Returns the current time in micro seconds according to the local clock.
+ * All media timing runs on CLOCK_MONOTONIC, which the host's time daemon may
+ * slew but never steps, so a correction of the system time can't make the
+ * pts jump. It also goes out as our NTP transmit time, the sender only echoes it.
  */
 uint64_t raop_ntp_get_local_time(raop_ntp_t *raop_ntp) {
+    if (raop_ntp && raop_ntp->clock) {
+        return raop_ntp->clock(raop_ntp->clock_opaque);
+    }
     struct timespec time;
-    clock_gettime(CLOCK_REALTIME, &time);
+    clock_gettime(CLOCK_MONOTONIC, &time);
     return (uint64_t)time.tv_sec * 1000000L + (uint64_t)(time.tv_nsec / 1000);
 }
 
 /**
- * Returns the current time in micro seconds according to the remote wall clock.
+ * Returns the local time for a time in micro seconds on the system wall clock,
+ * e.g. a kernel receive timestamp. The only place the two clocks meet.
+ */
+uint64_t raop_ntp_convert_wall_time(uint64_t wall_time) {
+    struct timespec wall, local;
+    clock_gettime(CLOCK_REALTIME, &wall);
+    clock_gettime(CLOCK_MONOTONIC, &local);
+    int64_t offset = ((int64_t) wall.tv_sec - (int64_t) local.tv_sec) * 1000000 + (wall.tv_nsec - local.tv_nsec) / 1000;
+    return (uint64_t) ((int64_t) wall_time - offset);
+}
+
+/**
+ * Returns the offset between remote and local clock at the given local time.
+ */
+static int64_t
+raop_ntp_get_offset(raop_ntp_t *raop_ntp, uint64_t local_time) {
+    int64_t offset;
+    uint64_t sync_time;
+    double skew;
+    raop_ntp_read_sync_params(raop_ntp, &offset, &sync_time, &skew);
+    return offset + (int64_t) (skew * (double) ((int64_t) local_time - (int64_t) sync_time));
+}
+
+/**
+ * Returns the current time in micro seconds according to the remote clock.
  */
 uint64_t raop_ntp_get_remote_time(raop_ntp_t *raop_ntp) {
-    MUTEX_LOCK(raop_ntp->sync_params_mutex);
-    int64_t offset = raop_ntp->sync_offset;
-    MUTEX_UNLOCK(raop_ntp->sync_params_mutex);
-    return (uint64_t) ((int64_t) raop_ntp_get_local_time(raop_ntp)) + ((int64_t) offset);
+    uint64_t local_time = raop_ntp_get_local_time(raop_ntp);
+    return (uint64_t) ((int64_t) local_time + raop_ntp_get_offset(raop_ntp, local_time));
 }
 
 /**
- * Returns the local wall clock time in micro seconds for the given point in remote clock time
+ * Returns the local time in micro seconds for the given point in remote clock time
  */
 uint64_t raop_ntp_convert_remote_time(raop_ntp_t *raop_ntp, uint64_t remote_time) {
-    MUTEX_LOCK(raop_ntp->sync_params_mutex);
-    uint64_t offset = raop_ntp->sync_offset;
-    MUTEX_UNLOCK(raop_ntp->sync_params_mutex);
-    return (uint64_t) ((int64_t) remote_time) - ((int64_t) offset);
+    int64_t offset;
+    uint64_t sync_time;
+    double skew;
+    raop_ntp_read_sync_params(raop_ntp, &offset, &sync_time, &skew);
+    // Solve local = remote - (offset + skew * (local - sync_time)) for local
+    int64_t since_sync = (int64_t) remote_time - offset - (int64_t) sync_time;
+    return (uint64_t) ((int64_t) sync_time + (int64_t) ((double) since_sync / (1.0 + skew)));
 }
 
 /**
- * Returns the remote wall clock time in micro seconds for the given point in local clock time
+ * Returns the remote clock time in micro seconds for the given point in local clock time
  */
 uint64_t raop_ntp_convert_local_time(raop_ntp_t *raop_ntp, uint64_t local_time) {
-    MUTEX_LOCK(raop_ntp->sync_params_mutex);
-    uint64_t offset = raop_ntp->sync_offset;
-    MUTEX_UNLOCK(raop_ntp->sync_params_mutex);
-    return (uint64_t) ((int64_t) local_time) + ((int64_t) offset);
+    return (uint64_t) ((int64_t) local_time + raop_ntp_get_offset(raop_ntp, local_time));
 }
@@ -19,24 +19,114 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include "logger.h"
+#include "session_reactor.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
 
 typedef struct raop_ntp_s raop_ntp_t;
 
+typedef struct {
+    /* Current estimate: offset of the remote clock, its delay, dispersion and jitter in us, skew in ppm */
+    int64_t offset;
+    int64_t delay;
+    int64_t dispersion;
+    int64_t jitter;
+    double skew;
+    /* Round trip of the last response and its extremes, in us */
+    int64_t last_rtt;
+    int64_t min_rtt;
+    int64_t max_rtt;
+    /* Time from the kernel receiving the last response to this thread reading it and its maximum, in us */
+    int64_t last_receive_delay;
+    int64_t max_receive_delay;
+    /* Requests sent, responses received, requests that timed out, responses not used */
+    uint64_t requests;
+    uint64_t responses;
+    uint64_t timeouts;
+    uint64_t rejected;
+    /* Times the estimate was updated, and the extremes of the offset over them */
+    uint64_t corrections;
+    int64_t min_offset;
+    int64_t max_offset;
+} raop_ntp_stats_t;
+
+/* The clock estimate, to carry over to the next session of the same sender */
+typedef struct {
+    /* Offset of the remote clock at local time time, and its change per us */
+    int64_t offset;
+    uint64_t time;
+    double skew;
+    int64_t delay;
+} raop_ntp_sync_t;
+
 raop_ntp_t *raop_ntp_init(logger_t *logger, const unsigned char *remote_addr, int remote_addr_len, unsigned short timing_rport);
 
+/* Sends the requests and reads the responses on reactor instead of a thread of its own, set before raop_ntp_start */
+void raop_ntp_set_reactor(raop_ntp_t *raop_ntp, session_reactor_t *reactor);
+/* Interface of the sender's link-local IPv6 address from netutils_get_scope_id, set before raop_ntp_start */
+void raop_ntp_set_remote_scope(raop_ntp_t *raop_ntp, unsigned int scope_id);
+
+/* Size of a PTP clock identity, an EUI-64 such as the MAC address with 0xff 0xfe in the middle */
+#define RAOP_NTP_PTP_CLOCK_IDENTITY_SIZE 8
+
+/*
+ * Follows the sender's PTP clock as a PTP slave instead of asking its NTP server, set before
+ * raop_ntp_start. The sender's Syncs are answered with delay requests from clock_identity on the
+ * PTP ports 319 and 320, which take root or CAP_NET_BIND_SERVICE, and the kernel stamps the time
+ * those leave and the Syncs arrive. Times on the remote clock are then PTP times in us.
+ */
+void raop_ntp_set_ptp(raop_ntp_t *raop_ntp, const unsigned char *clock_identity);
+bool raop_ntp_is_ptp(raop_ntp_t *raop_ntp);
+/* The sender connected over IPv6, its other connections come the same way */
+bool raop_ntp_remote_is_ipv6(raop_ntp_t *raop_ntp);
+
 void raop_ntp_start(raop_ntp_t *raop_ntp, unsigned short *timing_lport);
 
 void raop_ntp_stop(raop_ntp_t *raop_ntp);
 
 unsigned short raop_ntp_get_port(raop_ntp_t *raop_ntp);
 
+void raop_ntp_get_stats(raop_ntp_t *raop_ntp, raop_ntp_stats_t *stats);
+/* Returns false while there is no estimate yet */
+bool raop_ntp_get_sync(raop_ntp_t *raop_ntp, raop_ntp_sync_t *sync);
+/* Starts from sync rather than from nothing, call before raop_ntp_start. The samples of the new
+ * session replace it one by one. */
+void raop_ntp_seed_sync(raop_ntp_t *raop_ntp, const raop_ntp_sync_t *sync);
+
+typedef uint64_t (*raop_ntp_clock_cb_t)(void *opaque);
+
+/* Parts of the clock discipline raop_ntp_set_discipline can leave out */
+/* No burst of requests at the start, the first ones go out at the poll interval */
+#define RAOP_NTP_NO_BURST 0x1
+/* No frequency tracking, the offset is held between samples */
+#define RAOP_NTP_NO_SKEW 0x2
+
+/*
+ * For simulations that run raop_ntp_t on virtual time without starting it, all set before the first
+ * request. raop_ntp_set_clock replaces CLOCK_MONOTONIC, for raop_ntp_get_local_time and the conversions
+ * as well, NULL goes back to it. raop_ntp_simulate_request counts a request as sending it would and
+ * returns the time until the next one in us. raop_ntp_simulate_response takes the times of its exchange,
+ * t0 and t3 on the local clock, t1 and t2 on the remote one, as a response read at t3 would.
+ */
+void raop_ntp_set_clock(raop_ntp_t *raop_ntp, raop_ntp_clock_cb_t clock, void *opaque);
+void raop_ntp_set_discipline(raop_ntp_t *raop_ntp, int flags);
+uint64_t raop_ntp_simulate_request(raop_ntp_t *raop_ntp);
+void raop_ntp_simulate_response(raop_ntp_t *raop_ntp, uint64_t t0, uint64_t t1, uint64_t t2, uint64_t t3);
+
 void raop_ntp_destroy(raop_ntp_t *raop_rtp);
 
 uint64_t raop_ntp_timestamp_to_micro_seconds(uint64_t ntp_timestamp, bool account_for_epoch_diff);
 
 uint64_t raop_ntp_get_local_time(raop_ntp_t *raop_ntp);
+uint64_t raop_ntp_convert_wall_time(uint64_t wall_time);
 uint64_t raop_ntp_get_remote_time(raop_ntp_t *raop_ntp);
 uint64_t raop_ntp_convert_remote_time(raop_ntp_t *raop_ntp, uint64_t remote_time);
 uint64_t raop_ntp_convert_local_time(raop_ntp_t *raop_ntp, uint64_t local_time);
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif //RAOP_NTP_H
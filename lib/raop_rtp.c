@@ -12,12 +12,18 @@
  *  Lesser General Public License for more details.
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
 #include <errno.h>
 #include <stdbool.h>
+#include <time.h>
+#include <sys/eventfd.h>
 
 #include "raop_rtp.h"
 #include "raop.h"
@@ -26,48 +32,156 @@
 #include "compat.h"
 #include "logger.h"
 #include "byteutils.h"
+#include "utils.h"
 #include "mirror_buffer.h"
 #include "stream.h"
+#include "audio_playout.h"
+#include "trace.h"
+#include "thread_attr.h"
+#include "uring_recv.h"
+#include "session_reactor.h"
 
 #define NO_FLUSH (-42)
 
 #define RAOP_RTP_SAMPLE_RATE (44100.0 / 1000000.0)
-#define RAOP_RTP_SYNC_DATA_COUNT 8
+#define RAOP_RTP_SYNC_DATA_COUNT 16
+
+/* Largest sender clock rate error the estimator accepts, in ppm */
+#define RAOP_RTP_SYNC_MAX_DRIFT 1000.0
+
+/* A sync packet this far off the current mapping restarts the estimate, in microseconds */
+#define RAOP_RTP_SYNC_MAX_ERROR 50000
+
+/* Datagrams drained per wakeup, and the largest audio or control datagram we accept */
+#define RAOP_RTP_RECV_BATCH 16
+#define RAOP_RTP_RECV_SLOT_SIZE 4096
+
+/* Interval of the resend and playout pass on the session reactor, the timeout of the select loop, in us */
+#define RAOP_RTP_REACTOR_TICK 5000
+
+/* Receive buffers shared with the kernel when the sockets are read through io_uring */
+#define RAOP_RTP_URING_BUFFERS 32
+
+/* Sequence number jumps taken as a restart of the sender, as in RFC 3550 appendix A.1 */
+#define RAOP_RTP_MAX_DROPOUT 3000
+#define RAOP_RTP_MAX_MISORDER 100
+
+/* How long a replayed sender takes to answer a resend request, in microseconds */
+#define RAOP_RTP_REPLAY_RESEND_DELAY 20000
+/* Packets dropped by loss injection that a resend request can still bring back */
+#define RAOP_RTP_REPLAY_STASH_LENGTH 1024
+/* How long the replay keeps asking for missing packets once the capture is used up, in microseconds */
+#define RAOP_RTP_REPLAY_DRAIN_TIME 1000000
 
 typedef struct raop_rtp_sync_data_s {
-    uint64_t ntp_time; // The local wall clock time at the time of rtp_time
-    uint32_t rtp_time; // The remote rtp clock time corresponding to ntp_time
+    uint64_t ntp_time; // The local time at the time of rtp_time
+    uint64_t rtp_time; // The remote rtp clock time corresponding to ntp_time, unwrapped
 } raop_rtp_sync_data_t;
 
+typedef struct raop_rtp_datagram_s {
+    unsigned char data[RAOP_RTP_RECV_SLOT_SIZE];
+    unsigned int len;
+    struct sockaddr_storage saddr;
+    socklen_t saddrlen;
+    /* Kernel receive timestamp in local time, 0 if there is none */
+    uint64_t arrival_time;
+} raop_rtp_datagram_t;
+
+typedef struct raop_rtp_replay_packet_s {
+    struct raop_rtp_replay_packet_s *next;
+    /* Local time at which the packet is handed to the receive path */
+    uint64_t due;
+    int64_t clock_offset;
+    int channel;
+    unsigned int len;
+    unsigned char data[];
+} raop_rtp_replay_packet_t;
+
+typedef struct raop_rtp_replay_s {
+    raop_rtp_t *raop_rtp;
+    /* Packets waiting for their delivery time, earliest first */
+    raop_rtp_replay_packet_t *pending;
+    /* Data packets dropped by loss injection, by seqnum */
+    raop_rtp_replay_packet_t *stash[RAOP_RTP_REPLAY_STASH_LENGTH];
+    int loss_percent;
+    uint64_t jitter;
+    /* Fixed seed, so runs with the same settings drop and delay the same packets */
+    uint32_t random;
+    uint64_t dropped;
+    uint64_t resent;
+} raop_rtp_replay_t;
+
 struct raop_rtp_s {
     logger_t *logger;
     raop_callbacks_t callbacks;
 
     // Time and sync
     raop_ntp_t *ntp;
+    // Current mapping: rtp_sync_rtp_ref plays at rtp_sync_ntp_ref, rtp_sync_scale samples per us
     double rtp_sync_scale;
-    int64_t rtp_sync_offset;
+    uint64_t rtp_sync_rtp_ref;
+    int64_t rtp_sync_ntp_ref;
     raop_rtp_sync_data_t sync_data[RAOP_RTP_SYNC_DATA_COUNT];
     int sync_data_index;
-
-    // Transmission Stats, could be used if a playout buffer is needed
-    // float interarrival_jitter; // As defined by RTP RFC 3550, Section 6.4.1
-    // unsigned int last_packet_transit_time;
-    //int transit = (packet_receive_time - packet_send_time);
-    // int d = transit - last_packet_transit_time;
-    // if (d < 0) d = -d;
-    // interarrival_jitter = (1.f / 16.f) * ((double) d - interarrival_jitter);
+    int sync_data_count;
+
+    /* Sequence accounting of the data packets as in RFC 3550 appendix A.1, only used by the thread.
+     * seq_max is the extended highest sequence number, seq_window has bit n set if seq_max - n arrived */
+    int seq_started;
+    uint32_t seq_base;
+    uint32_t seq_max;
+    uint64_t seq_window;
+    /* Packets expected before the sequence numbers last jumped */
+    uint64_t expected_prior;
+    uint64_t received_packets;
+    uint64_t reordered_packets;
+    uint64_t duplicate_packets;
+    unsigned int max_reorder;
+    uint64_t received_bytes;
 
     /* Buffer to handle all resends */
     raop_buffer_t *buffer;
 
+    /* Hands packets to the audio callbacks shortly before their pts */
+    audio_playout_t *playout;
+
+    /* Receive buffers for one batch of datagrams, only used by the thread */
+    raop_rtp_datagram_t *recv_batch;
+    uint64_t recv_calls;
+    uint64_t recv_datagrams;
+    /* Time from the kernel receiving a datagram to this thread reading it, in us, summed over the timestamped ones */
+    uint64_t recv_delay_total;
+    uint64_t recv_delay_max;
+    uint64_t recv_delay_count;
+
     /* Remote address as sockaddr */
     struct sockaddr_storage remote_saddr;
     socklen_t remote_saddr_len;
 
+    /* Key material of the session, kept for the capture header */
+    unsigned char aeskey[RAOP_AESKEY_LEN];
+    unsigned char aesiv[RAOP_AESIV_LEN];
+    unsigned char ecdh_secret[32];
+
+    /* Directory to record sessions to, or NULL */
+    char *capture_dir;
+    audio_capture_t *capture;
+
+    /* Gets the frames going to playout as well, NULL if nothing subscribed */
+    frame_bus_t *frame_bus;
+
+    /* What the sender said the packets hold at SETUP */
+    raop_audio_format_t format;
+
+    /* Core of the receive thread, -1 leaves it unpinned */
+    int cpu;
+
+    /* Added to every sync time, moves a replayed capture onto the local clock */
+    int64_t sync_offset;
+
     /* MUTEX LOCKED VARIABLES START */
-    /* These variables only edited mutex locked */
-    int running;
+    /* These variables only edited mutex locked, the threads read running without the lock */
+    thread_flag_t running;
     int joined;
 
     float volume;
@@ -84,6 +198,8 @@ struct raop_rtp_s {
     int progress_changed;
 
     int flush;
+    /* Set with any of the above, so the thread only takes the lock when there is something to read */
+    thread_flag_t events;
     thread_handle_t thread;
     mutex_handle_t run_mutex;
     /* MUTEX LOCKED VARIABLES END */
@@ -93,6 +209,12 @@ struct raop_rtp_s {
 
     /* Sockets for control and data */
     int csock, dsock;
+    /* eventfd signalled by stop and the setters above to wake the receive thread */
+    int wake_fd;
+
+    /* Receives on the session's reactor instead of a thread of its own if set */
+    session_reactor_t *reactor;
+    int reactor_timer;
 
     /* Local control, timing and data ports */
     unsigned short control_lport;
@@ -107,23 +229,9 @@ struct raop_rtp_s {
 static int
 raop_rtp_parse_remote(raop_rtp_t *raop_rtp, const unsigned char *remote, int remotelen)
 {
-    char current[25];
-    int family;
     int ret;
     assert(raop_rtp);
-    if (remotelen == 4) {
-        family = AF_INET;
-    } else if (remotelen == 16) {
-        family = AF_INET6;
-    } else {
-        return -1;
-    }
-    memset(current, 0, sizeof(current));
-    sprintf(current, "%d.%d.%d.%d", remote[0], remote[1], remote[2], remote[3]);
-    logger_log(raop_rtp->logger, LOGGER_DEBUG, "raop_rtp parse remote ip = %s", current);
-    ret = netutils_parse_address(family, current,
-                                 &raop_rtp->remote_saddr,
-                                 sizeof(raop_rtp->remote_saddr));
+    ret = netutils_parse_remote(remote, remotelen, 0, &raop_rtp->remote_saddr);
     if (ret < 0) {
         return -1;
     }
@@ -146,27 +254,55 @@ raop_rtp_init(logger_t *logger, raop_callbacks_t *callbacks, raop_ntp_t *ntp, co
     }
     raop_rtp->logger = logger;
     raop_rtp->ntp = ntp;
+    memcpy(raop_rtp->aeskey, aeskey, RAOP_AESKEY_LEN);
+    memcpy(raop_rtp->aesiv, aesiv, RAOP_AESIV_LEN);
+    memcpy(raop_rtp->ecdh_secret, ecdh_secret, sizeof(raop_rtp->ecdh_secret));
 
-    raop_rtp->rtp_sync_offset = 0;
+    raop_rtp->rtp_sync_rtp_ref = 0;
+    raop_rtp->rtp_sync_ntp_ref = 0;
     raop_rtp->rtp_sync_scale = RAOP_RTP_SAMPLE_RATE;
     raop_rtp->sync_data_index = 0;
+    raop_rtp->sync_data_count = 0;
     for (int i = 0; i < RAOP_RTP_SYNC_DATA_COUNT; ++i) {
         raop_rtp->sync_data[i].ntp_time = 0;
         raop_rtp->sync_data[i].rtp_time = 0;
     }
 
     memcpy(&raop_rtp->callbacks, callbacks, sizeof(raop_callbacks_t));
+    raop_rtp->cpu = -1;
+    raop_rtp->format.compression = RAOP_AUDIO_CT_AAC_ELD;
+    raop_rtp->format.samples_per_frame = 480;
+    raop_rtp->format.sample_rate = 44100;
     raop_rtp->buffer = raop_buffer_init(logger, aeskey, aesiv, ecdh_secret);
     if (!raop_rtp->buffer) {
         free(raop_rtp);
         return NULL;
     }
-    if (raop_rtp_parse_remote(raop_rtp, remote, remotelen) < 0) {
+    raop_rtp->playout = audio_playout_init(logger, ntp, &raop_rtp->callbacks);
+    if (!raop_rtp->playout) {
+        raop_buffer_destroy(raop_rtp->buffer);
+        free(raop_rtp);
+        return NULL;
+    }
+    raop_rtp->recv_batch = malloc(RAOP_RTP_RECV_BATCH * sizeof(raop_rtp_datagram_t));
+    if (!raop_rtp->recv_batch) {
+        audio_playout_destroy(raop_rtp->playout);
+        raop_buffer_destroy(raop_rtp->buffer);
+        free(raop_rtp);
+        return NULL;
+    }
+    raop_rtp->reactor_timer = -1;
+    raop_rtp->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (raop_rtp->wake_fd == -1 || raop_rtp_parse_remote(raop_rtp, remote, remotelen) < 0) {
+        if (raop_rtp->wake_fd != -1) close(raop_rtp->wake_fd);
+        audio_playout_destroy(raop_rtp->playout);
+        raop_buffer_destroy(raop_rtp->buffer);
+        free(raop_rtp->recv_batch);
         free(raop_rtp);
         return NULL;
     }
 
-    raop_rtp->running = 0;
+    THREAD_FLAG_STORE(raop_rtp->running, 0);
     raop_rtp->joined = 1;
     raop_rtp->flush = NO_FLUSH;
 
@@ -181,11 +317,15 @@ raop_rtp_destroy(raop_rtp_t *raop_rtp)
     if (raop_rtp) {
         raop_rtp_stop(raop_rtp);
         MUTEX_DESTROY(raop_rtp->run_mutex);
+        close(raop_rtp->wake_fd);
+        audio_playout_destroy(raop_rtp->playout);
         raop_buffer_destroy(raop_rtp->buffer);
+        free(raop_rtp->recv_batch);
         free(raop_rtp->metadata);
         free(raop_rtp->coverart);
         free(raop_rtp->dacp_id);
         free(raop_rtp->active_remote_header);
+        free(raop_rtp->capture_dir);
         free(raop_rtp);
     }
 }
@@ -203,7 +343,8 @@ raop_rtp_resend_callback(void *opaque, unsigned short seqnum, unsigned short cou
     addr = (struct sockaddr *)&raop_rtp->control_saddr;
     addrlen = raop_rtp->control_saddr_len;
 
-    logger_log(raop_rtp->logger, LOGGER_DEBUG, "raop_rtp got resend request %d %d", seqnum, count);
+    LOGGER_LOG(raop_rtp->logger, LOGGER_DEBUG, "raop_rtp got resend request %d %d", seqnum, count);
+    trace_event(TRACE_AUDIO_RESEND_REQUEST, seqnum, count);
     ourseqnum = raop_rtp->control_seqnum++;
 
     /* Fill the request buffer */
@@ -238,6 +379,11 @@ raop_rtp_init_sockets(raop_rtp_t *raop_rtp, int use_ipv6, int use_udp)
     if (csock == -1 || dsock == -1) {
         goto sockets_cleanup;
     }
+    netutils_tune_socket(raop_rtp->logger, csock, NETUTILS_SOCKET_AUDIO, "raop_rtp control");
+    netutils_tune_socket(raop_rtp->logger, dsock, NETUTILS_SOCKET_AUDIO, "raop_rtp data");
+    if (netutils_enable_timestamps(csock) < 0 || netutils_enable_timestamps(dsock) < 0) {
+        logger_log(raop_rtp->logger, LOGGER_DEBUG, "raop_rtp no kernel receive timestamps, jitter includes scheduling delay");
+    }
 
     /* Set socket descriptors */
     raop_rtp->csock = csock;
@@ -254,6 +400,25 @@ raop_rtp_init_sockets(raop_rtp_t *raop_rtp, int use_ipv6, int use_udp)
     return -1;
 }
 
+static void
+raop_rtp_wake(raop_rtp_t *raop_rtp)
+{
+    uint64_t value = 1;
+    if (write(raop_rtp->wake_fd, &value, sizeof(value)) < 0) {
+        logger_log(raop_rtp->logger, LOGGER_WARNING, "raop_rtp could not wake receive thread");
+    }
+}
+
+/* The sender may continue anywhere after a flush, count expected packets from the next one on */
+static void
+raop_rtp_restart_seq(raop_rtp_t *raop_rtp)
+{
+    if (raop_rtp->seq_started) {
+        raop_rtp->expected_prior += raop_rtp->seq_max - raop_rtp->seq_base + 1;
+        raop_rtp->seq_started = 0;
+    }
+}
+
 static int
 raop_rtp_process_events(raop_rtp_t *raop_rtp, void *cb_data)
 {
@@ -273,11 +438,14 @@ raop_rtp_process_events(raop_rtp_t *raop_rtp, void *cb_data)
 
     assert(raop_rtp);
 
-    MUTEX_LOCK(raop_rtp->run_mutex);
-    if (!raop_rtp->running) {
-        MUTEX_UNLOCK(raop_rtp->run_mutex);
+    if (!THREAD_FLAG_LOAD(raop_rtp->running)) {
         return 1;
     }
+    if (!THREAD_FLAG_EXCHANGE(raop_rtp->events, 0)) {
+        return 0;
+    }
+
+    MUTEX_LOCK(raop_rtp->run_mutex);
 
     /* Read the volume level */
     volume = raop_rtp->volume;
@@ -318,16 +486,13 @@ raop_rtp_process_events(raop_rtp_t *raop_rtp, void *cb_data)
     /* Call set_volume callback if changed */
     if (volume_changed) {
         raop_buffer_flush(raop_rtp->buffer, flush);
-        if (raop_rtp->callbacks.audio_set_volume) {
-            raop_rtp->callbacks.audio_set_volume(raop_rtp->callbacks.cls, volume);
-        }
+        audio_playout_set_volume(raop_rtp->playout, volume);
     }
 
-    /* Handle flush if requested */
+    /* Handle flush if requested, the renderer is flushed from the playout thread */
     if (flush != NO_FLUSH) {
-        if (raop_rtp->callbacks.audio_flush) {
-            raop_rtp->callbacks.audio_flush(raop_rtp->callbacks.cls);
-        }
+        raop_rtp_restart_seq(raop_rtp);
+        audio_playout_flush(raop_rtp->playout);
     }
 
     if (metadata != NULL) {
@@ -363,40 +528,446 @@ raop_rtp_process_events(raop_rtp_t *raop_rtp, void *cb_data)
     return 0;
 }
 
+uint64_t raop_rtp_convert_rtp_time(raop_rtp_t *raop_rtp, uint32_t rtp_time) {
+    if (raop_rtp->sync_data_count == 0) {
+        return (uint64_t) (((double) rtp_time) / raop_rtp->rtp_sync_scale);
+    }
+    int32_t delta = (int32_t) (rtp_time - (uint32_t) raop_rtp->rtp_sync_rtp_ref);
+    return (uint64_t) (raop_rtp->rtp_sync_ntp_ref + (int64_t) (((double) delta) / raop_rtp->rtp_sync_scale));
+}
+
+/*
+ * Fits local time against sender rtp time over the last sync packets with
+ * least squares, so both the offset and the rate of the sender clock are
+ * tracked. Conversions then follow a straight line instead of stepping at
+ * every sync packet.
+ */
 void raop_rtp_sync_clock(raop_rtp_t *raop_rtp, uint32_t rtp_time, uint64_t ntp_time) {
+    uint64_t rtp_ext = (1ULL << 32) | rtp_time;
+    if (raop_rtp->sync_data_count > 0) {
+        uint64_t last = raop_rtp->sync_data[raop_rtp->sync_data_index].rtp_time;
+        rtp_ext = last + (int32_t) (rtp_time - (uint32_t) last);
+
+        int64_t error = (int64_t) ntp_time - (int64_t) raop_rtp_convert_rtp_time(raop_rtp, rtp_time);
+        if (error > RAOP_RTP_SYNC_MAX_ERROR || error < -RAOP_RTP_SYNC_MAX_ERROR) {
+            LOGGER_LOG(raop_rtp->logger, LOGGER_DEBUG, "raop_rtp sync off by %lld us, restarting clock estimate", error);
+            raop_rtp->sync_data_count = 0;
+        }
+    }
+
     raop_rtp->sync_data_index = (raop_rtp->sync_data_index + 1) % RAOP_RTP_SYNC_DATA_COUNT;
-    raop_rtp->sync_data[raop_rtp->sync_data_index].rtp_time = rtp_time;
+    raop_rtp->sync_data[raop_rtp->sync_data_index].rtp_time = rtp_ext;
     raop_rtp->sync_data[raop_rtp->sync_data_index].ntp_time = ntp_time;
+    if (raop_rtp->sync_data_count < RAOP_RTP_SYNC_DATA_COUNT) {
+        raop_rtp->sync_data_count++;
+    }
 
-    uint32_t valid_data_count = 0;
-    valid_data_count = 0;
-    int64_t total_offsets = 0;
-    for (int i = 0; i < RAOP_RTP_SYNC_DATA_COUNT; ++i) {
-        if (raop_rtp->sync_data[i].ntp_time == 0) continue;
-        total_offsets += (int64_t) (((double) raop_rtp->sync_data[i].rtp_time) / raop_rtp->rtp_sync_scale) - raop_rtp->sync_data[i].ntp_time;
-        valid_data_count++;
+    /* Work relative to the newest sample to keep the sums precise */
+    int count = raop_rtp->sync_data_count;
+    double mean_rtp = 0, mean_ntp = 0;
+    for (int i = 0; i < count; ++i) {
+        raop_rtp_sync_data_t *data = &raop_rtp->sync_data[(raop_rtp->sync_data_index - i + RAOP_RTP_SYNC_DATA_COUNT) % RAOP_RTP_SYNC_DATA_COUNT];
+        mean_rtp += (double) (int64_t) (data->rtp_time - rtp_ext);
+        mean_ntp += (double) ((int64_t) data->ntp_time - (int64_t) ntp_time);
+    }
+    mean_rtp /= count;
+    mean_ntp /= count;
+
+    double sxx = 0, sxy = 0;
+    for (int i = 0; i < count; ++i) {
+        raop_rtp_sync_data_t *data = &raop_rtp->sync_data[(raop_rtp->sync_data_index - i + RAOP_RTP_SYNC_DATA_COUNT) % RAOP_RTP_SYNC_DATA_COUNT];
+        double dx = (double) (int64_t) (data->rtp_time - rtp_ext) - mean_rtp;
+        double dy = (double) ((int64_t) data->ntp_time - (int64_t) ntp_time) - mean_ntp;
+        sxx += dx * dx;
+        sxy += dx * dy;
+    }
+
+    /* Microseconds per sample, nominal until there is a usable span of samples */
+    double nominal = 1.0 / RAOP_RTP_SAMPLE_RATE;
+    double period = nominal;
+    if (count >= 2 && sxx > 0) {
+        period = sxy / sxx;
+        if (period > nominal * (1.0 + RAOP_RTP_SYNC_MAX_DRIFT / 1000000.0)) {
+            period = nominal * (1.0 + RAOP_RTP_SYNC_MAX_DRIFT / 1000000.0);
+        } else if (period < nominal * (1.0 - RAOP_RTP_SYNC_MAX_DRIFT / 1000000.0)) {
+            period = nominal * (1.0 - RAOP_RTP_SYNC_MAX_DRIFT / 1000000.0);
+        }
     }
-    int64_t avg_offset = total_offsets / valid_data_count;
-    int64_t correction = avg_offset - raop_rtp->rtp_sync_offset;
-    raop_rtp->rtp_sync_offset = avg_offset;
 
-    logger_log(raop_rtp->logger, LOGGER_DEBUG, "raop_rtp sync correction=%lld", correction);
+    int64_t previous = (int64_t) raop_rtp_convert_rtp_time(raop_rtp, rtp_time);
+    raop_rtp->rtp_sync_scale = 1.0 / period;
+    raop_rtp->rtp_sync_rtp_ref = rtp_ext;
+    raop_rtp->rtp_sync_ntp_ref = (int64_t) ntp_time + (int64_t) (mean_ntp - period * mean_rtp);
+
+    int64_t correction = (int64_t) raop_rtp_convert_rtp_time(raop_rtp, rtp_time) - previous;
+    LOGGER_LOG(raop_rtp->logger, LOGGER_DEBUG, "raop_rtp sync correction=%lld, drift=%.1f ppm, samples=%d",
+               correction, (period / nominal - 1.0) * 1000000.0, count);
 }
 
-uint64_t raop_rtp_convert_rtp_time(raop_rtp_t *raop_rtp, uint32_t rtp_time) {
-    return (uint64_t) (((double) rtp_time) / raop_rtp->rtp_sync_scale) - raop_rtp->rtp_sync_offset;
+/* Accounts for the wait between the kernel receiving a datagram and this thread reading it at now */
+static void
+raop_rtp_record_recv_delay(raop_rtp_t *raop_rtp, raop_rtp_datagram_t *datagram, uint64_t now)
+{
+    uint64_t delay;
+
+    if (!datagram->arrival_time || datagram->arrival_time > now) {
+        return;
+    }
+    delay = now - datagram->arrival_time;
+    raop_rtp->recv_delay_total += delay;
+    raop_rtp->recv_delay_count++;
+    if (delay > raop_rtp->recv_delay_max) {
+        raop_rtp->recv_delay_max = delay;
+    }
+}
+
+/*
+ * Reads every datagram queued on sock, up to one batch, into recv_batch.
+ * Returns the number of datagrams read, 0 if none was queued, -1 on error.
+ */
+static int
+raop_rtp_recv_batch(raop_rtp_t *raop_rtp, int sock)
+{
+    raop_rtp_datagram_t *batch = raop_rtp->recv_batch;
+    int count;
+
+#if defined(__linux__)
+    struct mmsghdr msgs[RAOP_RTP_RECV_BATCH];
+    struct iovec iov[RAOP_RTP_RECV_BATCH];
+    unsigned char control[RAOP_RTP_RECV_BATCH][NETUTILS_TIMESTAMP_CONTROL_SIZE];
+
+    memset(msgs, 0, sizeof(msgs));
+    for (int i = 0; i < RAOP_RTP_RECV_BATCH; i++) {
+        iov[i].iov_base = batch[i].data;
+        iov[i].iov_len = sizeof(batch[i].data);
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_name = &batch[i].saddr;
+        msgs[i].msg_hdr.msg_namelen = sizeof(batch[i].saddr);
+        msgs[i].msg_hdr.msg_control = control[i];
+        msgs[i].msg_hdr.msg_controllen = sizeof(control[i]);
+    }
+    count = recvmmsg(sock, msgs, RAOP_RTP_RECV_BATCH, MSG_DONTWAIT, NULL);
+    if (count < 0) {
+        return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+    }
+    uint64_t now = raop_ntp_get_local_time(raop_rtp->ntp);
+    for (int i = 0; i < count; i++) {
+        batch[i].len = msgs[i].msg_len;
+        batch[i].saddrlen = msgs[i].msg_hdr.msg_namelen;
+        batch[i].arrival_time = netutils_get_timestamp(&msgs[i].msg_hdr);
+        raop_rtp_record_recv_delay(raop_rtp, &batch[i], now);
+        if (msgs[i].msg_hdr.msg_flags & MSG_TRUNC) {
+            logger_log(raop_rtp->logger, LOGGER_WARNING, "raop_rtp dropping oversized datagram");
+            batch[i].len = 0;
+        }
+    }
+#else
+    batch[0].saddrlen = sizeof(batch[0].saddr);
+    int ret = recvfrom(sock, (char *) batch[0].data, sizeof(batch[0].data), 0,
+                       (struct sockaddr *) &batch[0].saddr, &batch[0].saddrlen);
+    if (ret < 0) {
+        return -1;
+    }
+    batch[0].len = ret;
+    batch[0].arrival_time = 0;
+    count = 1;
+#endif
+
+    raop_rtp->recv_calls++;
+    raop_rtp->recv_datagrams += count;
+    return count;
+}
+
+static void
+raop_rtp_process_control(raop_rtp_t *raop_rtp, raop_rtp_datagram_t *datagram)
+{
+    unsigned char *packet = datagram->data;
+    unsigned int packetlen = datagram->len;
+
+    if (packetlen < 4) {
+        return;
+    }
+    memcpy(&raop_rtp->control_saddr, &datagram->saddr, datagram->saddrlen);
+    raop_rtp->control_saddr_len = datagram->saddrlen;
+    int type_c = packet[1] & ~0x80;
+    LOGGER_LOG(raop_rtp->logger, LOGGER_DEBUG, "raop_rtp type_c 0x%02x, packetlen = %d", type_c, packetlen);
+    if (type_c == 0x56 && packetlen >= 4 + 12) {
+        /* Handle resent data packet */
+        uint32_t rtp_timestamp =  (packet[4 + 4] << 24) | (packet[4 + 5] << 16) | (packet[4 + 6] << 8) | packet[4 + 7];
+        uint64_t ntp_timestamp = raop_rtp_convert_rtp_time(raop_rtp, rtp_timestamp);
+        if (LOGGER_DEBUG_ENABLED(raop_rtp->logger)) {
+            uint64_t ntp_now = raop_ntp_get_local_time(raop_rtp->ntp);
+            logger_log(raop_rtp->logger, LOGGER_DEBUG, "raop_rtp audio resent: ntp = %llu, now = %llu, latency=%lld, rtp=%u",
+                       ntp_timestamp, ntp_now, ((int64_t) ntp_now) - ((int64_t) ntp_timestamp), rtp_timestamp);
+        }
+        int result = raop_buffer_enqueue(raop_rtp->buffer, packet + 4, packetlen - 4, ntp_timestamp, datagram->arrival_time, 1);
+        assert(result >= 0);
+    } else if (type_c == 0x54 && packetlen >= 20) {
+        // The unit for the rtp clock is 1 / sample rate = 1 / 44100
+        uint32_t sync_rtp = byteutils_get_int_be(packet, 4) - 11025;
+        uint64_t sync_ntp_raw = byteutils_get_long_be(packet, 8);
+        uint64_t sync_ntp_remote = raop_ntp_timestamp_to_micro_seconds(sync_ntp_raw, true);
+        uint64_t sync_ntp_local = raop_ntp_convert_remote_time(raop_rtp->ntp, sync_ntp_remote) + raop_rtp->sync_offset;
+        // It's not clear what the additional rtp timestamp indicates
+        uint32_t next_rtp = byteutils_get_int_be(packet, 16);
+        LOGGER_LOG(raop_rtp->logger, LOGGER_DEBUG, "raop_rtp sync: ntp=%llu, local ntp: %llu, rtp=%u, rtp_next=%u",
+                   sync_ntp_remote, sync_ntp_local, sync_rtp, next_rtp);
+        raop_rtp_sync_clock(raop_rtp, sync_rtp, sync_ntp_local);
+    } else {
+        LOGGER_LOG(raop_rtp->logger, LOGGER_DEBUG, "raop_rtp unknown packet");
+    }
+}
+
+/*
+ * Accounts for a data packet with sequence number seqnum, returns 0 if it arrived before.
+ * Packets behind the newest are reordered, and how far behind they are keeps the jitter
+ * buffer deep enough to wait for them. A jump beyond RAOP_RTP_MAX_DROPOUT ahead or
+ * RAOP_RTP_MAX_MISORDER behind is taken as the sender starting over.
+ */
+static int
+raop_rtp_update_seq(raop_rtp_t *raop_rtp, unsigned short seqnum)
+{
+    int delta = 0;
+
+    if (raop_rtp->seq_started) {
+        delta = (short) (seqnum - (unsigned short) raop_rtp->seq_max);
+        if (delta > RAOP_RTP_MAX_DROPOUT || delta < -RAOP_RTP_MAX_MISORDER) {
+            raop_rtp_restart_seq(raop_rtp);
+        }
+    }
+    if (!raop_rtp->seq_started) {
+        raop_rtp->seq_started = 1;
+        raop_rtp->seq_base = seqnum;
+        raop_rtp->seq_max = seqnum;
+        raop_rtp->seq_window = 1;
+        raop_rtp->received_packets++;
+        return 1;
+    }
+
+    if (delta > 0) {
+        raop_rtp->seq_max += delta;
+        raop_rtp->seq_window = delta < 64 ? (raop_rtp->seq_window << delta) | 1 : 1;
+    } else {
+        unsigned int distance = -delta;
+        if (distance < 64) {
+            if (raop_rtp->seq_window & (1ULL << distance)) {
+                raop_rtp->duplicate_packets++;
+                return 0;
+            }
+            raop_rtp->seq_window |= 1ULL << distance;
+        }
+        raop_rtp->reordered_packets++;
+        if (distance > raop_rtp->max_reorder) {
+            raop_rtp->max_reorder = distance;
+        }
+        raop_buffer_note_reorder(raop_rtp->buffer, distance);
+    }
+    raop_rtp->received_packets++;
+    return 1;
+}
+
+static void
+raop_rtp_process_data(raop_rtp_t *raop_rtp, raop_rtp_datagram_t *datagram)
+{
+    unsigned char *packet = datagram->data;
+    unsigned int packetlen = datagram->len;
+
+    // Len = 16 appears if there is no time
+    if (packetlen >= 12) {
+        uint32_t rtp_timestamp =  (packet[4] << 24) | (packet[5] << 16) | (packet[6] << 8) | packet[7];
+        uint64_t ntp_timestamp = raop_rtp_convert_rtp_time(raop_rtp, rtp_timestamp);
+        trace_event(TRACE_AUDIO_RECEIVED, (packet[2] << 8) | packet[3], rtp_timestamp);
+        if (!raop_rtp_update_seq(raop_rtp, (packet[2] << 8) | packet[3])) {
+            return;
+        }
+        raop_rtp->received_bytes += packetlen;
+        if (LOGGER_DEBUG_ENABLED(raop_rtp->logger)) {
+            uint64_t ntp_now = raop_ntp_get_local_time(raop_rtp->ntp);
+            logger_log(raop_rtp->logger, LOGGER_DEBUG, "raop_rtp audio: ntp = %llu, now = %llu, latency=%lld, rtp=%u",
+                       ntp_timestamp, ntp_now, ((int64_t) ntp_now) - ((int64_t) ntp_timestamp), rtp_timestamp);
+        }
+
+        int result = raop_buffer_enqueue(raop_rtp->buffer, packet, packetlen, ntp_timestamp, datagram->arrival_time, 1);
+        assert(result >= 0);
+    }
+}
+
+/* Queues continuous buffer entries for playout */
+static void
+raop_rtp_queue_playout(raop_rtp_t *raop_rtp, int no_resend)
+{
+    void *payload = NULL;
+    unsigned int payload_size;
+    uint64_t timestamp;
+    int lost;
+
+    while ((payload = raop_buffer_dequeue(raop_rtp->buffer, &payload_size, &timestamp, no_resend, &lost)) || lost) {
+        trace_event(TRACE_AUDIO_DEQUEUED, payload_size, timestamp);
+        // The recorders write an AAC-ELD track, other formats only go to playout
+        if (payload && raop_rtp->format.compression == RAOP_AUDIO_CT_AAC_ELD &&
+            frame_bus_wants(raop_rtp->frame_bus, FRAME_BUS_AUDIO)) {
+            frame_bus_publish(raop_rtp->frame_bus, frame_bus_frame_create(FRAME_BUS_AUDIO, payload, payload_size, timestamp));
+        }
+        if (audio_playout_queue(raop_rtp->playout, payload, payload_size, timestamp) < 0) {
+            LOGGER_LOG(raop_rtp->logger, LOGGER_DEBUG, "raop_rtp playout queue full, dropping packet");
+        }
+    }
+}
+
+/* Records a batch of received datagrams before they are processed */
+static void
+raop_rtp_capture_batch(raop_rtp_t *raop_rtp, int count, int channel)
+{
+    audio_capture_packet_t packet;
+
+    if (!raop_rtp->capture || count <= 0) {
+        return;
+    }
+    memset(&packet, 0, sizeof(packet));
+    uint64_t now = raop_ntp_get_local_time(raop_rtp->ntp);
+    packet.clock_offset = (int64_t) raop_ntp_convert_local_time(raop_rtp->ntp, now) - (int64_t) now;
+    packet.channel = channel;
+    for (int i = 0; i < count; i++) {
+        packet.arrival_time = raop_rtp->recv_batch[i].arrival_time ? raop_rtp->recv_batch[i].arrival_time : now;
+        packet.size = raop_rtp->recv_batch[i].len;
+        audio_capture_write(raop_rtp->capture, &packet, raop_rtp->recv_batch[i].data);
+    }
+}
+
+static void
+raop_rtp_receive_control(raop_rtp_t *raop_rtp)
+{
+    int count = raop_rtp_recv_batch(raop_rtp, raop_rtp->csock);
+    if (count < 0) {
+        logger_log(raop_rtp->logger, LOGGER_WARNING, "raop_rtp error in control recv: %d", SOCKET_GET_ERROR());
+    }
+    raop_rtp_capture_batch(raop_rtp, count, AUDIO_CAPTURE_CHANNEL_CONTROL);
+    for (int i = 0; i < count; i++) {
+        raop_rtp_process_control(raop_rtp, &raop_rtp->recv_batch[i]);
+    }
+}
+
+static void
+raop_rtp_receive_data(raop_rtp_t *raop_rtp)
+{
+    // Receiving audio data here
+    int count = raop_rtp_recv_batch(raop_rtp, raop_rtp->dsock);
+    if (count < 0) {
+        logger_log(raop_rtp->logger, LOGGER_WARNING, "raop_rtp error in data recv: %d", SOCKET_GET_ERROR());
+    }
+    raop_rtp_capture_batch(raop_rtp, count, AUDIO_CAPTURE_CHANNEL_DATA);
+    for (int i = 0; i < count; i++) {
+        raop_rtp_process_data(raop_rtp, &raop_rtp->recv_batch[i]);
+    }
+}
+
+/* Passes on what is continuous and sends the resend requests that are due */
+static void
+raop_rtp_queue_and_resend(raop_rtp_t *raop_rtp)
+{
+    int no_resend = (raop_rtp->control_rport == 0);
+
+    raop_rtp_queue_playout(raop_rtp, no_resend);
+    if (!no_resend) {
+        raop_buffer_handle_resends(raop_rtp->buffer, raop_rtp_resend_callback, raop_rtp);
+    }
+}
+
+/*
+ * Waits for and processes one batch of datagrams from io_uring, one socket after the
+ * other like the select loop does. The sockets and wake_fd are tagged with their fds.
+ * Returns 1 if woken through wake_fd, 0 otherwise and -1 if io_uring can't be used.
+ */
+static int
+raop_rtp_uring_receive(raop_rtp_t *raop_rtp, uring_recv_t *uring)
+{
+    uring_recv_event_t events[RAOP_RTP_RECV_BATCH];
+    const int socks[2] = { raop_rtp->csock, raop_rtp->dsock };
+    int datagrams = 0, woken = 0;
+    uint64_t now;
+    int count;
+
+    /* The timeout only paces the resend requests */
+    count = uring_recv_wait(uring, 5000, events, RAOP_RTP_RECV_BATCH);
+    if (count < 0) {
+        return -1;
+    }
+    now = raop_ntp_get_local_time(raop_rtp->ntp);
+    for (int s = 0; s < 2; s++) {
+        int batch_count = 0;
+        for (int i = 0; i < count; i++) {
+            raop_rtp_datagram_t *datagram = &raop_rtp->recv_batch[batch_count];
+            if (events[i].tag != (uint64_t) socks[s] || !events[i].data) {
+                continue;
+            }
+            if (events[i].truncated || events[i].len > sizeof(datagram->data)) {
+                logger_log(raop_rtp->logger, LOGGER_WARNING, "raop_rtp dropping oversized datagram");
+                datagram->len = 0;
+            } else {
+                memcpy(datagram->data, events[i].data, events[i].len);
+                datagram->len = events[i].len;
+            }
+            memcpy(&datagram->saddr, events[i].saddr, events[i].saddrlen);
+            datagram->saddrlen = events[i].saddrlen;
+            datagram->arrival_time = events[i].timestamp;
+            raop_rtp_record_recv_delay(raop_rtp, datagram, now);
+            batch_count++;
+        }
+        if (socks[s] == raop_rtp->csock) {
+            raop_rtp_capture_batch(raop_rtp, batch_count, AUDIO_CAPTURE_CHANNEL_CONTROL);
+            for (int i = 0; i < batch_count; i++) {
+                raop_rtp_process_control(raop_rtp, &raop_rtp->recv_batch[i]);
+            }
+        } else {
+            raop_rtp_capture_batch(raop_rtp, batch_count, AUDIO_CAPTURE_CHANNEL_DATA);
+            for (int i = 0; i < batch_count; i++) {
+                raop_rtp_process_data(raop_rtp, &raop_rtp->recv_batch[i]);
+            }
+        }
+        datagrams += batch_count;
+    }
+    for (int i = 0; i < count; i++) {
+        if (events[i].tag == (uint64_t) raop_rtp->wake_fd) {
+            woken = 1;
+        }
+    }
+    uring_recv_release(uring, events, count);
+
+    if (woken) {
+        uint64_t value;
+        if (read(raop_rtp->wake_fd, &value, sizeof(value)) < 0) {
+            value = 0;
+        }
+    }
+    if (datagrams) {
+        raop_rtp->recv_calls++;
+        raop_rtp->recv_datagrams += datagrams;
+    }
+    return woken;
 }
 
 static THREAD_RETVAL
 raop_rtp_thread_udp(void *arg)
 {
     raop_rtp_t *raop_rtp = arg;
-    unsigned char packet[RAOP_PACKET_LEN];
-    unsigned int packetlen;
-    struct sockaddr_storage saddr;
-    socklen_t saddrlen;
+    uring_recv_t *uring;
     assert(raop_rtp);
 
+    thread_attr_apply(raop_rtp->logger, THREAD_ROLE_AUDIO, "rp-audio");
+    if (raop_rtp->cpu >= 0 && utils_set_thread_cpu(raop_rtp->cpu) < 0) {
+        logger_log(raop_rtp->logger, LOGGER_DEBUG, "raop_rtp could not pin the receive thread");
+    }
+
+    /* Where the kernel has it, one io_uring wait replaces select and the reads that follow it */
+    uring = uring_recv_init(raop_rtp->logger, RAOP_RTP_URING_BUFFERS, RAOP_RTP_RECV_SLOT_SIZE);
+    if (uring && (uring_recv_add_socket(uring, raop_rtp->csock, raop_rtp->csock) < 0 ||
+                  uring_recv_add_socket(uring, raop_rtp->dsock, raop_rtp->dsock) < 0 ||
+                  uring_recv_add_poll(uring, raop_rtp->wake_fd, raop_rtp->wake_fd) < 0)) {
+        uring_recv_destroy(uring);
+        uring = NULL;
+    }
+
     while(1) {
         fd_set rfds;
         struct timeval tv;
@@ -407,118 +978,198 @@ raop_rtp_thread_udp(void *arg)
             break;
         }
 
-        /* Set timeout value to 5ms */
-        tv.tv_sec = 0;
-        tv.tv_usec = 5000;
-
-        /* Get the correct nfds value */
-        nfds = raop_rtp->csock+1;
-        if (raop_rtp->dsock >= nfds)
-            nfds = raop_rtp->dsock+1;
-
-        /* Set rfds and call select */
-        FD_ZERO(&rfds);
-        FD_SET(raop_rtp->csock, &rfds);
-        FD_SET(raop_rtp->dsock, &rfds);
-
-        ret = select(nfds, &rfds, NULL, NULL, &tv);
-        if (ret == 0) {
-            /* Timeout happened */
-            continue;
-        } else if (ret == -1) {
-            logger_log(raop_rtp->logger, LOGGER_ERR, "raop_rtp error in select");
-            break;
-        }
-
-        if (FD_ISSET(raop_rtp->csock, &rfds)) {
-            saddrlen = sizeof(saddr);
-            packetlen = recvfrom(raop_rtp->csock, (char *)packet, sizeof(packet), 0,
-                                 (struct sockaddr *)&saddr, &saddrlen);
-
-            memcpy(&raop_rtp->control_saddr, &saddr, saddrlen);
-            raop_rtp->control_saddr_len = saddrlen;
-            int type_c = packet[1] & ~0x80;
-            logger_log(raop_rtp->logger, LOGGER_DEBUG, "raop_rtp type_c 0x%02x, packetlen = %d", type_c, packetlen);
-            if (type_c == 0x56) {
-                /* Handle resent data packet */
-                uint32_t rtp_timestamp =  (packet[4 + 4] << 24) | (packet[4 + 5] << 16) | (packet[4 + 6] << 8) | packet[4 + 7];
-                uint64_t ntp_timestamp = raop_rtp_convert_rtp_time(raop_rtp, rtp_timestamp);
-                uint64_t ntp_now = raop_ntp_get_local_time(raop_rtp->ntp);
-                logger_log(raop_rtp->logger, LOGGER_DEBUG, "raop_rtp audio resent: ntp = %llu, now = %llu, latency=%lld, rtp=%u",
-                           ntp_timestamp, ntp_now, ((int64_t) ntp_now) - ((int64_t) ntp_timestamp), rtp_timestamp);
-                int result = raop_buffer_enqueue(raop_rtp->buffer, packet + 4, packetlen - 4, ntp_timestamp, 1);
-                assert(result >= 0);
-            } else if (type_c == 0x54 && packetlen >= 20) {
-                // The unit for the rtp clock is 1 / sample rate = 1 / 44100
-                uint32_t sync_rtp = byteutils_get_int_be(packet, 4) - 11025;
-                uint64_t sync_ntp_raw = byteutils_get_long_be(packet, 8);
-                uint64_t sync_ntp_remote = raop_ntp_timestamp_to_micro_seconds(sync_ntp_raw, true);
-                uint64_t sync_ntp_local = raop_ntp_convert_remote_time(raop_rtp->ntp, sync_ntp_remote);
-                // It's not clear what the additional rtp timestamp indicates
-                uint32_t next_rtp = byteutils_get_int_be(packet, 16);
-                logger_log(raop_rtp->logger, LOGGER_DEBUG, "raop_rtp sync: ntp=%llu, local ntp: %llu, rtp=%u, rtp_next=%u",
-                           sync_ntp_remote, sync_ntp_local, sync_rtp, next_rtp);
-                raop_rtp_sync_clock(raop_rtp, sync_rtp, sync_ntp_local);
-            } else {
-                logger_log(raop_rtp->logger, LOGGER_DEBUG, "raop_rtp unknown packet");
+        if (uring) {
+            ret = raop_rtp_uring_receive(raop_rtp, uring);
+            if (ret < 0) {
+                logger_log(raop_rtp->logger, LOGGER_INFO, "raop_rtp falling back to select for receiving");
+                uring_recv_destroy(uring);
+                uring = NULL;
+                continue;
+            } else if (ret > 0) {
+                continue;
+            }
+        } else {
+            /* Set timeout value to 5ms */
+            tv.tv_sec = 0;
+            tv.tv_usec = 5000;
+
+            /* Get the correct nfds value */
+            nfds = raop_rtp->csock+1;
+            if (raop_rtp->dsock >= nfds)
+                nfds = raop_rtp->dsock+1;
+            if (raop_rtp->wake_fd >= nfds)
+                nfds = raop_rtp->wake_fd+1;
+
+            /* Set rfds and call select, the timeout only paces the resend requests */
+            FD_ZERO(&rfds);
+            FD_SET(raop_rtp->csock, &rfds);
+            FD_SET(raop_rtp->dsock, &rfds);
+            FD_SET(raop_rtp->wake_fd, &rfds);
+
+            ret = select(nfds, &rfds, NULL, NULL, &tv);
+            if (ret == 0) {
+                /* Timeout happened, only resend requests may be due */
+            } else if (ret == -1) {
+                logger_log(raop_rtp->logger, LOGGER_ERR, "raop_rtp error in select");
+                break;
             }
-        }
 
-        if (FD_ISSET(raop_rtp->dsock, &rfds)) {
-            //logger_log(raop_rtp->logger, LOGGER_INFO, "Would have data packet in queue");
-            // Receiving audio data here
-            saddrlen = sizeof(saddr);
-            packetlen = recvfrom(raop_rtp->dsock, (char *)packet, sizeof(packet), 0,
-                                 (struct sockaddr *)&saddr, &saddrlen);
-            // rtp payload type
-            int type_d = packet[1] & ~0x80;
-            //logger_log(raop_rtp->logger, LOGGER_DEBUG, "raop_rtp_thread_udp type_d 0x%02x, packetlen = %d", type_d, packetlen);
-
-            // Len = 16 appears if there is no time
-            if (packetlen >= 12) {
-                int no_resend = (raop_rtp->control_rport == 0);// false
-
-                uint32_t rtp_timestamp =  (packet[4] << 24) | (packet[5] << 16) | (packet[6] << 8) | packet[7];
-                uint64_t ntp_timestamp = raop_rtp_convert_rtp_time(raop_rtp, rtp_timestamp);
-                uint64_t ntp_now = raop_ntp_get_local_time(raop_rtp->ntp);
-                logger_log(raop_rtp->logger, LOGGER_DEBUG, "raop_rtp audio: ntp = %llu, now = %llu, latency=%lld, rtp=%u",
-                           ntp_timestamp, ntp_now, ((int64_t) ntp_now) - ((int64_t) ntp_timestamp), rtp_timestamp);
-
-                int result = raop_buffer_enqueue(raop_rtp->buffer, packet, packetlen, ntp_timestamp, 1);
-                assert(result >= 0);
-
-                // Render continuous buffer entries
-                void *payload = NULL;
-                unsigned int payload_size;
-                uint64_t timestamp;
-                while ((payload = raop_buffer_dequeue(raop_rtp->buffer, &payload_size, &timestamp, no_resend))) {
-                    aac_decode_struct aac_data;
-                    aac_data.data_len = payload_size;
-                    aac_data.data = payload;
-                    aac_data.pts = timestamp;
-                    raop_rtp->callbacks.audio_process(raop_rtp->callbacks.cls, raop_rtp->ntp, &aac_data);
-                    free(payload);
+            if (FD_ISSET(raop_rtp->wake_fd, &rfds)) {
+                /* Stopped or events to process, both are checked at the top of the loop */
+                uint64_t value;
+                if (read(raop_rtp->wake_fd, &value, sizeof(value)) < 0) {
+                    value = 0;
                 }
+                continue;
+            }
 
-                /* Handle possible resend requests */
-                if (!no_resend) {
-                    raop_buffer_handle_resends(raop_rtp->buffer, raop_rtp_resend_callback, raop_rtp);
-                }
+            if (FD_ISSET(raop_rtp->csock, &rfds)) {
+                raop_rtp_receive_control(raop_rtp);
             }
 
+            if (FD_ISSET(raop_rtp->dsock, &rfds)) {
+                raop_rtp_receive_data(raop_rtp);
+            }
         }
+
+        raop_rtp_queue_and_resend(raop_rtp);
     }
 
+    uring_recv_destroy(uring);
+
     // Ensure running reflects the actual state
     MUTEX_LOCK(raop_rtp->run_mutex);
-    raop_rtp->running = false;
+    THREAD_FLAG_STORE(raop_rtp->running, 0);
     MUTEX_UNLOCK(raop_rtp->run_mutex);
 
-    logger_log(raop_rtp->logger, LOGGER_DEBUG, "raop_rtp exiting thread");
+    LOGGER_LOG(raop_rtp->logger, LOGGER_DEBUG, "raop_rtp exiting thread");
 
     return 0;
 }
 
+/* On the session reactor, the part of the loop above each socket is ready for */
+static void
+raop_rtp_reactor_control(void *arg, int fd)
+{
+    raop_rtp_t *raop_rtp = arg;
+    raop_rtp_receive_control(raop_rtp);
+    raop_rtp_queue_and_resend(raop_rtp);
+}
+
+static void
+raop_rtp_reactor_data(void *arg, int fd)
+{
+    raop_rtp_t *raop_rtp = arg;
+    raop_rtp_receive_data(raop_rtp);
+    raop_rtp_queue_and_resend(raop_rtp);
+}
+
+static void
+raop_rtp_reactor_wake(void *arg, int fd)
+{
+    raop_rtp_t *raop_rtp = arg;
+    uint64_t value;
+    if (read(raop_rtp->wake_fd, &value, sizeof(value)) < 0) {
+        value = 0;
+    }
+    raop_rtp_process_events(raop_rtp, NULL);
+}
+
+/* Stands in for the select timeout, which paces the resend requests */
+static uint64_t
+raop_rtp_reactor_tick(void *arg)
+{
+    raop_rtp_queue_and_resend(arg);
+    return RAOP_RTP_REACTOR_TICK;
+}
+
+static int
+raop_rtp_reactor_add(raop_rtp_t *raop_rtp)
+{
+    if (session_reactor_add_fd(raop_rtp->reactor, raop_rtp->wake_fd, raop_rtp_reactor_wake, raop_rtp) < 0 ||
+        session_reactor_add_fd(raop_rtp->reactor, raop_rtp->csock, raop_rtp_reactor_control, raop_rtp) < 0 ||
+        session_reactor_add_fd(raop_rtp->reactor, raop_rtp->dsock, raop_rtp_reactor_data, raop_rtp) < 0 ||
+        (raop_rtp->reactor_timer = session_reactor_add_timer(raop_rtp->reactor, RAOP_RTP_REACTOR_TICK,
+                                                             raop_rtp_reactor_tick, raop_rtp)) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+static void
+raop_rtp_reactor_remove(raop_rtp_t *raop_rtp)
+{
+    session_reactor_cancel_timer(raop_rtp->reactor, raop_rtp->reactor_timer);
+    session_reactor_remove_fd(raop_rtp->reactor, raop_rtp->dsock);
+    session_reactor_remove_fd(raop_rtp->reactor, raop_rtp->csock);
+    session_reactor_remove_fd(raop_rtp->reactor, raop_rtp->wake_fd);
+    raop_rtp->reactor_timer = -1;
+}
+
+void
+raop_rtp_set_capture_dir(raop_rtp_t *raop_rtp, const char *capture_dir)
+{
+    assert(raop_rtp);
+    free(raop_rtp->capture_dir);
+    raop_rtp->capture_dir = capture_dir ? strdup(capture_dir) : NULL;
+}
+
+void
+raop_rtp_set_frame_bus(raop_rtp_t *raop_rtp, frame_bus_t *frame_bus)
+{
+    assert(raop_rtp);
+    raop_rtp->frame_bus = frame_bus;
+}
+
+void
+raop_rtp_set_reactor(raop_rtp_t *raop_rtp, session_reactor_t *reactor)
+{
+    assert(raop_rtp);
+    raop_rtp->reactor = reactor;
+}
+
+void
+raop_rtp_set_cpu(raop_rtp_t *raop_rtp, int cpu)
+{
+    assert(raop_rtp);
+    raop_rtp->cpu = cpu;
+}
+
+void
+raop_rtp_set_audio_format(raop_rtp_t *raop_rtp, const raop_audio_format_t *format)
+{
+    assert(raop_rtp);
+    raop_rtp->format = *format;
+    if (raop_rtp->callbacks.audio_set_format) {
+        raop_rtp->callbacks.audio_set_format(raop_rtp->callbacks.cls, &raop_rtp->format);
+    }
+}
+
+static void
+raop_rtp_open_capture(raop_rtp_t *raop_rtp)
+{
+    audio_capture_header_t header;
+    char filename[512];
+    char date[32];
+    time_t now = time(NULL);
+    struct tm tm;
+
+    if (!raop_rtp->capture_dir) {
+        return;
+    }
+    strftime(date, sizeof(date), "%Y%m%d-%H%M%S", localtime_r(&now, &tm));
+    snprintf(filename, sizeof(filename), "%s/audio-%s-%u.cap", raop_rtp->capture_dir, date, raop_rtp->data_lport);
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.aeskey, raop_rtp->aeskey, sizeof(header.aeskey));
+    memcpy(header.aesiv, raop_rtp->aesiv, sizeof(header.aesiv));
+    memcpy(header.ecdh_secret, raop_rtp->ecdh_secret, sizeof(header.ecdh_secret));
+    header.resend = (raop_rtp->control_rport != 0);
+    header.compression = raop_rtp->format.compression;
+    header.samples_per_frame = raop_rtp->format.samples_per_frame;
+    raop_rtp->capture = audio_capture_open(raop_rtp->logger, filename, &header);
+}
+
 // Start rtp service, three udp ports
 void
 raop_rtp_start_audio(raop_rtp_t *raop_rtp, int use_udp, unsigned short control_rport,
@@ -530,7 +1181,7 @@ raop_rtp_start_audio(raop_rtp_t *raop_rtp, int use_udp, unsigned short control_r
     assert(raop_rtp);
 
     MUTEX_LOCK(raop_rtp->run_mutex);
-    if (raop_rtp->running || !raop_rtp->joined) {
+    if (THREAD_FLAG_LOAD(raop_rtp->running) || !raop_rtp->joined) {
         MUTEX_UNLOCK(raop_rtp->run_mutex);
         return;
     }
@@ -540,7 +1191,6 @@ raop_rtp_start_audio(raop_rtp_t *raop_rtp, int use_udp, unsigned short control_r
     if (raop_rtp->remote_saddr.ss_family == AF_INET6) {
         use_ipv6 = 1;
     }
-    use_ipv6 = 0;
     if (raop_rtp_init_sockets(raop_rtp, use_ipv6, use_udp) < 0) {
         logger_log(raop_rtp->logger, LOGGER_ERR, "raop_rtp initializing sockets failed");
         MUTEX_UNLOCK(raop_rtp->run_mutex);
@@ -549,10 +1199,21 @@ raop_rtp_start_audio(raop_rtp_t *raop_rtp, int use_udp, unsigned short control_r
     if (control_lport) *control_lport = raop_rtp->control_lport;
     if (data_lport) *data_lport = raop_rtp->data_lport;
     /* Create the thread and initialize running values */
-    raop_rtp->running = 1;
+    THREAD_FLAG_STORE(raop_rtp->running, 1);
     raop_rtp->joined = 0;
-
-    THREAD_CREATE(raop_rtp->thread, raop_rtp_thread_udp, raop_rtp);
+    raop_rtp->sync_offset = 0;
+    raop_rtp_open_capture(raop_rtp);
+
+    audio_playout_start(raop_rtp->playout);
+    if (!raop_rtp->reactor) {
+        THREAD_CREATE(raop_rtp->thread, raop_rtp_thread_udp, raop_rtp);
+    } else if (raop_rtp_reactor_add(raop_rtp) < 0) {
+        // Rather than a session without audio
+        logger_log(raop_rtp->logger, LOGGER_WARNING, "raop_rtp could not use the session reactor, receiving on a thread");
+        raop_rtp_reactor_remove(raop_rtp);
+        raop_rtp->reactor = NULL;
+        THREAD_CREATE(raop_rtp->thread, raop_rtp_thread_udp, raop_rtp);
+    }
     MUTEX_UNLOCK(raop_rtp->run_mutex);
 }
 
@@ -571,7 +1232,9 @@ raop_rtp_set_volume(raop_rtp_t *raop_rtp, float volume)
     MUTEX_LOCK(raop_rtp->run_mutex);
     raop_rtp->volume = volume;
     raop_rtp->volume_changed = 1;
+    THREAD_FLAG_STORE(raop_rtp->events, 1);
     MUTEX_UNLOCK(raop_rtp->run_mutex);
+    raop_rtp_wake(raop_rtp);
 }
 
 void
@@ -592,7 +1255,9 @@ raop_rtp_set_metadata(raop_rtp_t *raop_rtp, const char *data, int datalen)
     MUTEX_LOCK(raop_rtp->run_mutex);
     raop_rtp->metadata = metadata;
     raop_rtp->metadata_len = datalen;
+    THREAD_FLAG_STORE(raop_rtp->events, 1);
     MUTEX_UNLOCK(raop_rtp->run_mutex);
+    raop_rtp_wake(raop_rtp);
 }
 
 void
@@ -613,7 +1278,9 @@ raop_rtp_set_coverart(raop_rtp_t *raop_rtp, const char *data, int datalen)
     MUTEX_LOCK(raop_rtp->run_mutex);
     raop_rtp->coverart = coverart;
     raop_rtp->coverart_len = datalen;
+    THREAD_FLAG_STORE(raop_rtp->events, 1);
     MUTEX_UNLOCK(raop_rtp->run_mutex);
+    raop_rtp_wake(raop_rtp);
 }
 
 void
@@ -629,7 +1296,9 @@ raop_rtp_remote_control_id(raop_rtp_t *raop_rtp, const char *dacp_id, const char
     MUTEX_LOCK(raop_rtp->run_mutex);
     raop_rtp->dacp_id = strdup(dacp_id);
     raop_rtp->active_remote_header = strdup(active_remote_header);
+    THREAD_FLAG_STORE(raop_rtp->events, 1);
     MUTEX_UNLOCK(raop_rtp->run_mutex);
+    raop_rtp_wake(raop_rtp);
 }
 
 void
@@ -643,7 +1312,9 @@ raop_rtp_set_progress(raop_rtp_t *raop_rtp, unsigned int start, unsigned int cur
     raop_rtp->progress_curr = curr;
     raop_rtp->progress_end = end;
     raop_rtp->progress_changed = 1;
+    THREAD_FLAG_STORE(raop_rtp->events, 1);
     MUTEX_UNLOCK(raop_rtp->run_mutex);
+    raop_rtp_wake(raop_rtp);
 }
 
 void
@@ -654,7 +1325,61 @@ raop_rtp_flush(raop_rtp_t *raop_rtp, int next_seq)
     /* Call flush in thread instead */
     MUTEX_LOCK(raop_rtp->run_mutex);
     raop_rtp->flush = next_seq;
+    THREAD_FLAG_STORE(raop_rtp->events, 1);
     MUTEX_UNLOCK(raop_rtp->run_mutex);
+    raop_rtp_wake(raop_rtp);
+}
+
+void
+raop_rtp_get_stats(raop_rtp_t *raop_rtp, raop_rtp_stats_t *stats)
+{
+    assert(raop_rtp);
+    assert(stats);
+
+    stats->expected_packets = raop_rtp->expected_prior;
+    if (raop_rtp->seq_started) {
+        stats->expected_packets += raop_rtp->seq_max - raop_rtp->seq_base + 1;
+    }
+    stats->received_packets = raop_rtp->received_packets;
+    stats->lost_packets = stats->expected_packets > stats->received_packets ? stats->expected_packets - stats->received_packets : 0;
+    stats->reordered_packets = raop_rtp->reordered_packets;
+    stats->duplicate_packets = raop_rtp->duplicate_packets;
+    stats->max_reorder = raop_rtp->max_reorder;
+    stats->received_bytes = raop_rtp->received_bytes;
+    raop_buffer_get_stats(raop_rtp->buffer, &stats->buffer);
+    audio_playout_get_stats(raop_rtp->playout, &stats->playout);
+}
+
+static void
+raop_rtp_log_stats(raop_rtp_t *raop_rtp)
+{
+    raop_rtp_stats_t rtp_stats;
+    raop_rtp_get_stats(raop_rtp, &rtp_stats);
+    raop_buffer_stats_t stats = rtp_stats.buffer;
+    logger_log(raop_rtp->logger, LOGGER_INFO, "raop_rtp data packets: %llu received of %llu expected, lost = %llu, reordered = %llu (up to %u behind), duplicates = %llu",
+               (unsigned long long) rtp_stats.received_packets, (unsigned long long) rtp_stats.expected_packets,
+               (unsigned long long) rtp_stats.lost_packets, (unsigned long long) rtp_stats.reordered_packets,
+               rtp_stats.max_reorder, (unsigned long long) rtp_stats.duplicate_packets);
+    logger_log(raop_rtp->logger, LOGGER_INFO, "raop_rtp jitter buffer depth = %d packets, jitter = %llu us, resend rtt = %llu us, grown %llu times, shrunk %llu times",
+               stats.target_depth, (unsigned long long) stats.jitter, (unsigned long long) stats.resend_rtt,
+               (unsigned long long) stats.grow_count, (unsigned long long) stats.shrink_count);
+    logger_log(raop_rtp->logger, LOGGER_INFO, "raop_rtp resends: %llu requests for %llu packets, recovered = %llu, too late = %llu, abandoned = %llu, skipped = %llu",
+               (unsigned long long) stats.resend_requests, (unsigned long long) stats.requested_packets,
+               (unsigned long long) stats.recovered_packets, (unsigned long long) stats.too_late_packets,
+               (unsigned long long) stats.abandoned_packets, (unsigned long long) stats.skipped_packets);
+}
+
+/* Starts the packet accounting of the next session */
+static void
+raop_rtp_reset_stats(raop_rtp_t *raop_rtp)
+{
+    raop_rtp->seq_started = 0;
+    raop_rtp->expected_prior = 0;
+    raop_rtp->received_packets = 0;
+    raop_rtp->reordered_packets = 0;
+    raop_rtp->duplicate_packets = 0;
+    raop_rtp->max_reorder = 0;
+    raop_rtp->received_bytes = 0;
 }
 
 void
@@ -665,19 +1390,40 @@ raop_rtp_stop(raop_rtp_t *raop_rtp)
     /* Check that we are running and thread is not
      * joined (should never be while still running) */
     MUTEX_LOCK(raop_rtp->run_mutex);
-    if (!raop_rtp->running || raop_rtp->joined) {
+    if (!THREAD_FLAG_LOAD(raop_rtp->running) || raop_rtp->joined) {
         MUTEX_UNLOCK(raop_rtp->run_mutex);
         return;
     }
-    raop_rtp->running = 0;
+    THREAD_FLAG_STORE(raop_rtp->running, 0);
     MUTEX_UNLOCK(raop_rtp->run_mutex);
+    if (raop_rtp->reactor) {
+        raop_rtp_reactor_remove(raop_rtp);
+    } else {
+        raop_rtp_wake(raop_rtp);
 
-    /* Join the thread */
-    THREAD_JOIN(raop_rtp->thread);
+        /* Join the thread */
+        THREAD_JOIN(raop_rtp->thread);
+    }
+    audio_playout_stop(raop_rtp->playout);
 
     if (raop_rtp->csock != -1) closesocket(raop_rtp->csock);
     if (raop_rtp->dsock != -1) closesocket(raop_rtp->dsock);
 
+    audio_capture_close(raop_rtp->capture);
+    raop_rtp->capture = NULL;
+
+    logger_log(raop_rtp->logger, LOGGER_INFO, "raop_rtp received %llu datagrams in %llu reads, receive delay %llu/%llu us (mean/max)",
+               (unsigned long long) raop_rtp->recv_datagrams, (unsigned long long) raop_rtp->recv_calls,
+               (unsigned long long) (raop_rtp->recv_delay_count ? raop_rtp->recv_delay_total / raop_rtp->recv_delay_count : 0),
+               (unsigned long long) raop_rtp->recv_delay_max);
+    raop_rtp->recv_datagrams = 0;
+    raop_rtp->recv_calls = 0;
+    raop_rtp->recv_delay_total = 0;
+    raop_rtp->recv_delay_max = 0;
+    raop_rtp->recv_delay_count = 0;
+    raop_rtp_log_stats(raop_rtp);
+    raop_rtp_reset_stats(raop_rtp);
+
     /* Flush buffer into initial state */
     raop_buffer_flush(raop_rtp->buffer, -1);
 
@@ -687,13 +1433,259 @@ raop_rtp_stop(raop_rtp_t *raop_rtp)
     MUTEX_UNLOCK(raop_rtp->run_mutex);
 }
 
+static uint32_t
+raop_rtp_replay_random(raop_rtp_replay_t *replay)
+{
+    /* xorshift32, plenty for picking packets */
+    uint32_t x = replay->random;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    replay->random = x;
+    return x;
+}
+
+static void
+raop_rtp_replay_schedule(raop_rtp_replay_t *replay, raop_rtp_replay_packet_t *packet)
+{
+    raop_rtp_replay_packet_t **link = &replay->pending;
+    while (*link && (*link)->due <= packet->due) {
+        link = &(*link)->next;
+    }
+    packet->next = *link;
+    *link = packet;
+}
+
+/* Applies loss and jitter injection to a packet that is due to arrive */
+static void
+raop_rtp_replay_inject(raop_rtp_replay_t *replay, raop_rtp_replay_packet_t *packet, int resend)
+{
+    if (packet->channel == AUDIO_CAPTURE_CHANNEL_DATA && packet->len >= 12 && replay->loss_percent > 0 &&
+        raop_rtp_replay_random(replay) % 100 < (uint32_t) replay->loss_percent) {
+        replay->dropped++;
+        if (resend) {
+            unsigned short seqnum = (packet->data[2] << 8) | packet->data[3];
+            raop_rtp_replay_packet_t **slot = &replay->stash[seqnum % RAOP_RTP_REPLAY_STASH_LENGTH];
+            free(*slot);
+            *slot = packet;
+        } else {
+            free(packet);
+        }
+        return;
+    }
+    if (replay->jitter) {
+        packet->due += raop_rtp_replay_random(replay) % (replay->jitter + 1);
+    }
+    raop_rtp_replay_schedule(replay, packet);
+}
+
+/* Answers resend requests from the packets loss injection dropped, the way a sender would */
+static int
+raop_rtp_replay_resend_callback(void *opaque, unsigned short seqnum, unsigned short count)
+{
+    raop_rtp_replay_t *replay = opaque;
+    uint64_t now = raop_ntp_get_local_time(replay->raop_rtp->ntp);
+
+    trace_event(TRACE_AUDIO_RESEND_REQUEST, seqnum, count);
+    for (unsigned short i = 0; i < count; i++) {
+        unsigned short resend_seqnum = seqnum + i;
+        raop_rtp_replay_packet_t **slot = &replay->stash[resend_seqnum % RAOP_RTP_REPLAY_STASH_LENGTH];
+        raop_rtp_replay_packet_t *packet = *slot;
+        if (!packet || ((packet->data[2] << 8) | packet->data[3]) != resend_seqnum) {
+            continue;
+        }
+        *slot = NULL;
+
+        raop_rtp_replay_packet_t *resent = malloc(sizeof(raop_rtp_replay_packet_t) + 4 + packet->len);
+        if (resent) {
+            resent->data[0] = 0x80;
+            resent->data[1] = 0x56|0x80;
+            resent->data[2] = (resend_seqnum >> 8);
+            resent->data[3] = resend_seqnum;
+            memcpy(resent->data + 4, packet->data, packet->len);
+            resent->len = packet->len + 4;
+            resent->channel = AUDIO_CAPTURE_CHANNEL_CONTROL;
+            resent->clock_offset = packet->clock_offset;
+            resent->due = now + RAOP_RTP_REPLAY_RESEND_DELAY;
+            if (replay->jitter) {
+                resent->due += raop_rtp_replay_random(replay) % (replay->jitter + 1);
+            }
+            raop_rtp_replay_schedule(replay, resent);
+            replay->resent++;
+        }
+        free(packet);
+    }
+    return 0;
+}
+
+/* Hands a replayed packet to the same processing a received datagram gets */
+static void
+raop_rtp_replay_deliver(raop_rtp_t *raop_rtp, raop_rtp_replay_packet_t *packet, int64_t shift)
+{
+    raop_rtp_datagram_t *datagram = &raop_rtp->recv_batch[0];
+
+    if (packet->len > sizeof(datagram->data)) {
+        return;
+    }
+    memcpy(datagram->data, packet->data, packet->len);
+    datagram->len = packet->len;
+    memset(&datagram->saddr, 0, sizeof(datagram->saddr));
+    datagram->saddrlen = 0;
+    datagram->arrival_time = 0;
+
+    /* The replay clock has a zero offset, put the sender's clock where it was relative to ours */
+    raop_rtp->sync_offset = shift - packet->clock_offset;
+    if (packet->channel == AUDIO_CAPTURE_CHANNEL_CONTROL) {
+        raop_rtp_process_control(raop_rtp, datagram);
+    } else {
+        raop_rtp_process_data(raop_rtp, datagram);
+    }
+}
+
 int
-raop_rtp_is_running(raop_rtp_t *raop_rtp)
+raop_rtp_replay(raop_rtp_t *raop_rtp, audio_capture_reader_t *reader, int resend, int loss_percent, int jitter_ms)
 {
+    raop_rtp_replay_t *replay;
+    raop_rtp_replay_packet_t *next = NULL;
+    audio_capture_packet_t capture_packet;
+    uint64_t first_arrival = 0;
+    uint64_t start_time = 0;
+    uint64_t last_delivery = 0;
+    int packets = 0;
+    int ret = 1;
+
     assert(raop_rtp);
+    assert(reader);
+
+    replay = calloc(1, sizeof(raop_rtp_replay_t));
+    if (!replay) {
+        return -1;
+    }
+    replay->raop_rtp = raop_rtp;
+    replay->loss_percent = loss_percent;
+    replay->jitter = jitter_ms > 0 ? (uint64_t) jitter_ms * 1000 : 0;
+    replay->random = 2463534242u;
+
+    MUTEX_LOCK(raop_rtp->run_mutex);
+    if (THREAD_FLAG_LOAD(raop_rtp->running) || !raop_rtp->joined) {
+        MUTEX_UNLOCK(raop_rtp->run_mutex);
+        free(replay);
+        return -1;
+    }
+    THREAD_FLAG_STORE(raop_rtp->running, 1);
+    raop_rtp->joined = 0;
+    MUTEX_UNLOCK(raop_rtp->run_mutex);
+    audio_playout_start(raop_rtp->playout);
+
+    // The calling thread takes the place of the receive thread
+    while (1) {
+        uint64_t now = raop_ntp_get_local_time(raop_rtp->ntp);
+
+        /* Take in every packet that had arrived by now in the recording */
+        while (ret > 0) {
+            if (!next) {
+                ret = audio_capture_reader_next(reader, &capture_packet);
+                if (ret <= 0) {
+                    break;
+                }
+                next = malloc(sizeof(raop_rtp_replay_packet_t) + capture_packet.size);
+                if (!next || audio_capture_reader_data(reader, next->data, capture_packet.size) < 0) {
+                    logger_log(raop_rtp->logger, LOGGER_ERR, "raop_rtp could not read packet %d of the capture", packets);
+                    free(next);
+                    next = NULL;
+                    ret = -1;
+                    break;
+                }
+                if (packets == 0) {
+                    first_arrival = capture_packet.arrival_time;
+                    start_time = now;
+                }
+                next->due = start_time + (capture_packet.arrival_time - first_arrival);
+                next->clock_offset = capture_packet.clock_offset;
+                next->channel = capture_packet.channel;
+                next->len = capture_packet.size;
+                packets++;
+            }
+            if (next->due > now) {
+                break;
+            }
+            raop_rtp_replay_inject(replay, next, resend);
+            next = NULL;
+        }
+
+        while (replay->pending && replay->pending->due <= now) {
+            raop_rtp_replay_packet_t *packet = replay->pending;
+            replay->pending = packet->next;
+            raop_rtp_replay_deliver(raop_rtp, packet, (int64_t) start_time - (int64_t) first_arrival);
+            free(packet);
+            last_delivery = now;
+        }
+
+        raop_rtp_queue_playout(raop_rtp, !resend);
+        if (resend) {
+            raop_buffer_handle_resends(raop_rtp->buffer, raop_rtp_replay_resend_callback, replay);
+        }
+
+        if (ret <= 0 && !next && !replay->pending &&
+            (ret < 0 || !resend || now - last_delivery >= RAOP_RTP_REPLAY_DRAIN_TIME)) {
+            break;
+        }
+
+        /* Sleep until the next packet is due, but look at resends at least every 5ms */
+        uint64_t wakeup = now + 5000;
+        if (next && next->due < wakeup) {
+            wakeup = next->due;
+        }
+        if (replay->pending && replay->pending->due < wakeup) {
+            wakeup = replay->pending->due;
+        }
+        now = raop_ntp_get_local_time(raop_rtp->ntp);
+        if (wakeup > now) {
+            usleep(wakeup - now);
+        }
+    }
+    if (ret < 0) {
+        logger_log(raop_rtp->logger, LOGGER_ERR, "raop_rtp capture is truncated or corrupt");
+    }
+
+    /* Let the renderer play out what is still queued */
+    audio_playout_stats_t playout_stats;
+    audio_playout_get_stats(raop_rtp->playout, &playout_stats);
+    while (playout_stats.depth > 0) {
+        usleep(10000);
+        audio_playout_get_stats(raop_rtp->playout, &playout_stats);
+    }
+    audio_playout_stop(raop_rtp->playout);
+
+    for (int i = 0; i < RAOP_RTP_REPLAY_STASH_LENGTH; i++) {
+        free(replay->stash[i]);
+    }
+    while (replay->pending) {
+        raop_rtp_replay_packet_t *packet = replay->pending;
+        replay->pending = packet->next;
+        free(packet);
+    }
+    free(next);
+    logger_log(raop_rtp->logger, LOGGER_INFO, "raop_rtp replayed %d packets, dropped %llu, answered %llu with resends",
+               packets, (unsigned long long) replay->dropped, (unsigned long long) replay->resent);
+    raop_rtp_log_stats(raop_rtp);
+    raop_rtp_reset_stats(raop_rtp);
+    free(replay);
+
+    raop_buffer_flush(raop_rtp->buffer, -1);
+    raop_rtp->sync_offset = 0;
+
     MUTEX_LOCK(raop_rtp->run_mutex);
-    int running = raop_rtp->running;
+    THREAD_FLAG_STORE(raop_rtp->running, 0);
+    raop_rtp->joined = 1;
     MUTEX_UNLOCK(raop_rtp->run_mutex);
-    return running;
+    return ret < 0 ? -1 : packets;
+}
+
+int
+raop_rtp_is_running(raop_rtp_t *raop_rtp)
+{
+    assert(raop_rtp);
+    return THREAD_FLAG_LOAD(raop_rtp->running);
 }
 
@@ -19,6 +19,11 @@
 #include "raop.h"
 #include "logger.h"
 #include "raop_ntp.h"
+#include "audio_capture.h"
+#include "frame_bus.h"
+#include "raop_buffer.h"
+#include "audio_playout.h"
+#include "session_reactor.h"
 
 #define RAOP_AESIV_LEN  16
 #define RAOP_AESKEY_LEN 16
@@ -26,9 +31,35 @@
 
 typedef struct raop_rtp_s raop_rtp_t;
 
+typedef struct {
+    /* Data packets received and expected from their sequence numbers, and the difference as in
+     * RFC 3550 appendix A.3. Resent packets arrive on the control socket and aren't counted. */
+    uint64_t received_packets;
+    uint64_t expected_packets;
+    uint64_t lost_packets;
+    /* Packets that arrived behind a newer one, the furthest behind one was, and packets received twice */
+    uint64_t reordered_packets;
+    unsigned int max_reorder;
+    uint64_t duplicate_packets;
+    /* Bytes of the data packets received */
+    uint64_t received_bytes;
+    /* The jitter buffer's counters, its jitter is the RFC 3550 interarrival jitter and too_late_packets the late drops */
+    raop_buffer_stats_t buffer;
+    audio_playout_stats_t playout;
+} raop_rtp_stats_t;
+
 raop_rtp_t *raop_rtp_init(logger_t *logger, raop_callbacks_t *callbacks, raop_ntp_t *ntp, const unsigned char *remote, int remotelen,
                           const unsigned char *aeskey, const unsigned char *aesiv, const unsigned char *ecdh_secret);
 
+void raop_rtp_set_capture_dir(raop_rtp_t *raop_rtp, const char *capture_dir);
+/* Publishes every frame going to playout on bus as well, which the caller keeps alive, NULL stops it */
+void raop_rtp_set_frame_bus(raop_rtp_t *raop_rtp, frame_bus_t *frame_bus);
+/* Receives on reactor, which the caller keeps alive, instead of a thread of its own. Set before starting */
+void raop_rtp_set_reactor(raop_rtp_t *raop_rtp, session_reactor_t *reactor);
+/* Pins the receive thread to cpu, set before starting */
+void raop_rtp_set_cpu(raop_rtp_t *raop_rtp, int cpu);
+/* Tells the audio callbacks what the stream carries, set before starting */
+void raop_rtp_set_audio_format(raop_rtp_t *raop_rtp, const raop_audio_format_t *format);
 void raop_rtp_start_audio(raop_rtp_t *raop_rtp, int use_udp, unsigned short control_rport,
                           unsigned short *control_lport, unsigned short *data_lport);
 
@@ -40,6 +71,13 @@ void raop_rtp_set_progress(raop_rtp_t *raop_rtp, unsigned int start, unsigned in
 void raop_rtp_flush(raop_rtp_t *raop_rtp, int next_seq);
 void raop_rtp_stop(raop_rtp_t *raop_rtp);
 int raop_rtp_is_running(raop_rtp_t *raop_rtp);
+/*
+ * Plays an audio capture through the jitter buffer and playout path from the calling thread, dropping
+ * loss_percent of the data packets and delaying each by up to jitter_ms. Returns the packets replayed or -1.
+ */
+int raop_rtp_replay(raop_rtp_t *raop_rtp, audio_capture_reader_t *reader, int resend, int loss_percent, int jitter_ms);
+/* Counters of the running or last session, read without locking so they may be a packet behind */
+void raop_rtp_get_stats(raop_rtp_t *raop_rtp, raop_rtp_stats_t *stats);
 void raop_rtp_destroy(raop_rtp_t *raop_rtp);
 
 #endif
@@ -21,14 +21,27 @@
 #include <errno.h>
 #include <stdbool.h>
 #include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <time.h>
 
 #include "raop.h"
+#include "raop_rtp.h"
 #include "netutils.h"
 #include "compat.h"
 #include "logger.h"
 #include "byteutils.h"
+#include "utils.h"
 #include "mirror_buffer.h"
+#include "mirror_udp_buffer.h"
+#include "frame_pool.h"
+#include "recv_ring.h"
+#include "spsc_ring.h"
+#include "latency_histogram.h"
+#include "stream_estimator.h"
 #include "stream.h"
+#include "trace.h"
+#include "thread_attr.h"
 
 
 struct h264codec_s {
@@ -45,6 +58,89 @@ struct h264codec_s {
     unsigned char version;
 };
 
+/* Frames a lost UDP frame may be overtaken by before it is skipped */
+#define RAOP_RTP_MIRROR_UDP_REORDER_DEPTH 2
+
+/* Receive ring of the TCP stream, it takes frames in place as long as those in flight leave room */
+#define RAOP_RTP_MIRROR_RING_SIZE (2 * 1024 * 1024)
+
+/* Largest payload a header may announce, anything beyond is a broken stream rather than a frame */
+#define RAOP_RTP_MIRROR_MAX_PAYLOAD (16 * 1024 * 1024)
+
+/* Payloads of packets other than video and codec data up to this size are parsed where they were received */
+#define RAOP_RTP_MIRROR_CONTROL_SIZE 4096
+
+/* Frames in flight between the receive, decrypt and submit stages */
+#define RAOP_RTP_MIRROR_QUEUE_LENGTH 16
+#define RAOP_RTP_MIRROR_FRAME_COUNT (2 * RAOP_RTP_MIRROR_QUEUE_LENGTH + 2)
+
+/* Frame buffers faulted in and locked at the start of a stream with lock_memory: a few IDR sized ones
+ * and the pool's fill of the sizes most other frames come in. The receive ring is locked as well. */
+static const struct {
+    size_t size;
+    int count;
+} raop_rtp_mirror_prefault_sizes[] = {
+    { 512 * 1024, 2 },
+    { 64 * 1024, 8 },
+    { 16 * 1024, 8 },
+};
+
+/* Latency budget in us while the host is overloaded and none was set */
+#define RAOP_RTP_MIRROR_OVERLOAD_BUDGET 250000
+/* Over half the budget late, frames nothing references are dropped, and over three quarters the
+ * last eighth of GOPs of up to 120 frames too */
+#define RAOP_RTP_MIRROR_THIN_TAIL_SHARE 8
+#define RAOP_RTP_MIRROR_THIN_MAX_GOP 120
+
+/* Slices of a P-frame no larger than this skip all or nearly all of their macroblocks, the frame
+ * shows what the one before it did */
+#define RAOP_RTP_MIRROR_STATIC_SLICE_BYTES 48
+
+/* Frames are decrypted this much at a time and their NALs rewritten while the chunk is still in L1 */
+#define RAOP_RTP_MIRROR_FUSED_CHUNK (16 * 1024)
+
+typedef struct raop_rtp_mirror_frame_s {
+    unsigned char header[128];
+    int payload_type;
+
+    /* Received payload, from the frame pool, renderer owned or in the receive ring */
+    unsigned char *payload;
+    void *payload_handle;
+    int payload_size;
+    bool payload_in_ring;
+    /* Receive ring position after the frame, released with the frame, 0 if it took nothing from the ring */
+    uint64_t ring_end;
+
+    /* Data handed to the renderer, may point into payload */
+    unsigned char *data;
+    int data_len;
+    int frame_type;
+    uint64_t pts;
+
+    /* Frame contains an IDR (IRAP for H.265) slice, decoding can restart from here */
+    bool idr;
+    video_codec_t codec;
+
+    /* NAL units in data, filled by the decrypt stage */
+    int nal_count;
+    h264_nal_unit_t nal_units[H264_MAX_NAL_UNITS];
+
+    /* Keystream position of the payload, only known for frames received over UDP */
+    bool has_key_offset;
+    uint64_t key_offset;
+    /* Frames before this one were lost, decoding has to restart at an IDR */
+    bool discontinuity;
+
+    /* Local times at which the payload was fully received, by the kernel where it tells, and decrypted */
+    uint64_t arrival_time;
+    uint64_t decrypt_time;
+
+    /* Queued for decryption while the receive stage is still reading the payload, which has received
+     * bytes of it so far, -1 once the stream was cut off before the end */
+    bool progressive;
+    int received;
+} raop_rtp_mirror_frame_t;
+
 struct raop_rtp_mirror_s {
     logger_t *logger;
     raop_callbacks_t callbacks;
@@ -53,45 +149,210 @@ struct raop_rtp_mirror_s {
     /* Buffer to handle all resends */
     mirror_buffer_t *buffer;
 
+    /* Recycled payload buffers for the mirror thread */
+    frame_pool_t *frame_pool;
+
+    /* TCP stream buffer, created with the first TCP session, frames that fit are parsed in place */
+    recv_ring_t *recv_ring;
+    uint64_t ring_frames;
+
+    /* Reassembles frames when mirroring over UDP */
+    mirror_udp_buffer_t *udp_buffer;
+    int use_udp;
+
+    /* Stage queues, frames cycle free -> decrypt -> submit -> free */
+    raop_rtp_mirror_frame_t frames[RAOP_RTP_MIRROR_FRAME_COUNT];
+    spsc_ring_t *free_frames;
+    /* Every stage returns frames, the lock keeps them to one producer of free_frames at a time */
+    mutex_handle_t free_frames_mutex;
+    spsc_ring_t *decrypt_queue;
+    spsc_ring_t *submit_queue;
+
+    /* Codec of the stream, set by the last codec packet and only touched by the decrypt stage */
+    video_codec_t codec;
+
+    /* Frames later than this (in us) make the submit stage skip to the next IDR, 0 disables */
+    uint64_t latency_budget;
+    /* Halves the budget, or sets one, while the host is overloaded or hot, NULL if nothing watches it */
+    cpu_load_t *cpu_load;
+    thermal_t *thermal;
+    bool catching_up;
+    uint64_t dropped_frames;
+    /* Frames no other picture references, and the ends of GOPs, dropped to thin a stream that runs
+     * late but not over its budget. dropping_tail is set while catching_up is for the latter. */
+    bool dropping_tail;
+    uint64_t disposable_drops;
+    uint64_t tail_drops;
+    /* The renderer's thin as last sampled, the stream is thinned the same way even in time */
+    bool thin;
+    /* Shared with the other sessions, NULL if every session submits whenever it likes. priority
+     * is the renderer's as last sampled. */
+    decode_scheduler_t *decode_scheduler;
+    int priority;
+    /* The renderer's decode_errors as last sampled, once there was a sample */
+    bool has_decode_errors;
+    uint64_t decode_errors;
+    uint64_t decoder_resyncs;
+    /* Frames repeating the picture before them, and those of them nothing references, which are
+     * left out with coalesce_static instead of being decoded and shown again */
+    bool coalesce_static;
+    uint64_t static_frames;
+    uint64_t static_drops;
+    /* Large frames are passed to video_process_part by the decrypt stage as they arrive */
+    bool progressive;
+    uint64_t progressive_frames;
+    /* Frames the decrypt stage pushed to the submit stage and those the submit stage is done with, so
+     * a progressive frame waits until nothing is ahead of it. progress_cond is signalled whenever one
+     * of those or a frame's received moves on while the decrypt stage waits for it. */
+    uint64_t submit_pushed;
+    uint64_t submit_done;
+    int progress_waiting;
+    mutex_handle_t progress_mutex;
+    cond_handle_t progress_cond;
+
+    /* Submit stage, or the decrypt stage while it passes on a progressive frame and the submit stage is
+     * idle: an IDR went to the renderer since the start, frames before one can't be decoded */
+    bool synced;
+    uint64_t unsynced_frames;
+    /* IDRs submitted since the start, and frames since the last one */
+    int gop_index;
+    int gop_frame;
+    /* Frames since the last IDR including the dropped ones, and how many the GOP before it had, 0 if unknown */
+    int gop_position;
+    int gop_length;
+
+    /* Written by the receive stage only */
+    uint64_t heartbeats;
+    uint64_t reports;
+    uint64_t unknown_packets;
+    uint64_t over_budget_frames;
+    uint64_t queue_full_frames;
+    /* Times the sender came back after its stream was cut off */
+    uint64_t reconnects;
+    uint64_t received_frames;
+    uint64_t received_bytes;
+    uint64_t first_arrival;
+    uint64_t last_arrival;
+    /* Bytes received since window_start, for the peak bitrate over a second */
+    uint64_t window_start;
+    uint64_t window_bytes;
+    uint64_t peak_bitrate;
+
+    /* Written by the decrypt stage from codec packets */
+    int width;
+    int height;
+
+    /* Fault in and lock the frame buffers and the receive ring before the stream starts */
+    bool lock_memory;
+    /* Minor and major page faults of each stage so far, and the counts of its thread they start from */
+    uint64_t page_faults[3][2];
+    uint64_t page_fault_base[3][2];
+
+    /* Per session stage latencies, each written by a single stage */
+    latency_histogram_t *receive_delay;
+    latency_histogram_t *arrival_to_decrypt;
+    latency_histogram_t *decrypt_to_submit;
+    latency_histogram_t *submit_duration;
+    latency_histogram_t *display_offset;
+    /* Fed by the decrypt stage with every frame and by the submit stage with those it passes on */
+    stream_estimator_t *estimator;
+
     /* Remote address as sockaddr */
     struct sockaddr_storage remote_saddr;
     socklen_t remote_saddr_len;
 
     /* MUTEX LOCKED VARIABLES START */
-    /* These variables only edited mutex locked */
-    int running;
+    /* These variables only edited mutex locked, the threads read running without the lock */
+    thread_flag_t running;
     int joined;
 
     int flush;
     thread_handle_t thread_mirror;
+    thread_handle_t thread_decrypt;
+    thread_handle_t thread_submit;
     mutex_handle_t run_mutex;
 
     /* MUTEX LOCKED VARIABLES END */
     int mirror_data_sock;
+    int mirror_stream_sock;
+
+    /* eventfd signalled by stop to wake the receive thread */
+    int wake_fd;
+
+    /* Receives datagrams on the session's reactor instead of a thread if set, see raop_rtp_mirror_set_reactor */
+    session_reactor_t *reactor;
+    bool reactor_receiving;
+    /* The reactor dropped a frame, the next one has to wait for an IDR */
+    bool udp_dropped;
 
     unsigned short mirror_data_lport;
+
+    /* Key material of the session, kept for the capture header */
+    unsigned char aeskey[RAOP_AESKEY_LEN];
+    unsigned char ecdh_secret[32];
+    uint64_t stream_connection_id;
+
+    /* Directory sessions are recorded to, NULL disables recording */
+    char *capture_dir;
+    /* Only written by the receive stage while mirroring */
+    mirror_capture_t *capture;
+
+    /* Gets every decrypted frame ahead of the drop decisions, NULL if nothing subscribed */
+    frame_bus_t *frame_bus;
+    /* Setup milestones of the connection, NULL for a replay */
+    setup_timeline_t *setup_timeline;
+
+    /* Added to every video pts, moves a replayed capture onto the local clock */
+    int64_t pts_offset;
+
+    /* Core of the receive stage, decrypt and submit take the next two, -1 leaves them unpinned */
+    int cpu;
 };
 
+static void
+raop_rtp_mirror_destroy_queues(raop_rtp_mirror_t *raop_rtp_mirror)
+{
+    spsc_ring_destroy(raop_rtp_mirror->free_frames);
+    spsc_ring_destroy(raop_rtp_mirror->decrypt_queue);
+    spsc_ring_destroy(raop_rtp_mirror->submit_queue);
+    latency_histogram_destroy(raop_rtp_mirror->receive_delay);
+    latency_histogram_destroy(raop_rtp_mirror->arrival_to_decrypt);
+    latency_histogram_destroy(raop_rtp_mirror->decrypt_to_submit);
+    latency_histogram_destroy(raop_rtp_mirror->submit_duration);
+    latency_histogram_destroy(raop_rtp_mirror->display_offset);
+    stream_estimator_destroy(raop_rtp_mirror->estimator);
+}
+
+static int
+raop_rtp_mirror_init_queues(raop_rtp_mirror_t *raop_rtp_mirror)
+{
+    raop_rtp_mirror->free_frames = spsc_ring_init(RAOP_RTP_MIRROR_FRAME_COUNT);
+    raop_rtp_mirror->decrypt_queue = spsc_ring_init(RAOP_RTP_MIRROR_QUEUE_LENGTH);
+    raop_rtp_mirror->submit_queue = spsc_ring_init(RAOP_RTP_MIRROR_QUEUE_LENGTH);
+    raop_rtp_mirror->receive_delay = latency_histogram_init();
+    raop_rtp_mirror->arrival_to_decrypt = latency_histogram_init();
+    raop_rtp_mirror->decrypt_to_submit = latency_histogram_init();
+    raop_rtp_mirror->submit_duration = latency_histogram_init();
+    raop_rtp_mirror->display_offset = latency_histogram_init();
+    raop_rtp_mirror->estimator = stream_estimator_init();
+    if (!raop_rtp_mirror->free_frames || !raop_rtp_mirror->decrypt_queue || !raop_rtp_mirror->submit_queue ||
+        !raop_rtp_mirror->receive_delay || !raop_rtp_mirror->arrival_to_decrypt || !raop_rtp_mirror->decrypt_to_submit || !raop_rtp_mirror->submit_duration ||
+        !raop_rtp_mirror->display_offset || !raop_rtp_mirror->estimator) {
+        raop_rtp_mirror_destroy_queues(raop_rtp_mirror);
+        return -1;
+    }
+    for (int i = 0; i < RAOP_RTP_MIRROR_FRAME_COUNT; i++) {
+        spsc_ring_push(raop_rtp_mirror->free_frames, &raop_rtp_mirror->frames[i]);
+    }
+    return 0;
+}
+
 static int
 raop_rtp_parse_remote(raop_rtp_mirror_t *raop_rtp_mirror, const unsigned char *remote, int remotelen)
 {
-    char current[25];
-    int family;
     int ret;
     assert(raop_rtp_mirror);
-    if (remotelen == 4) {
-        family = AF_INET;
-    } else if (remotelen == 16) {
-        family = AF_INET6;
-    } else {
-        return -1;
-    }
-    memset(current, 0, sizeof(current));
-    sprintf(current, "%d.%d.%d.%d", remote[0], remote[1], remote[2], remote[3]);
-    logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror parse remote ip = %s", current);
-    ret = netutils_parse_address(family, current,
-                                 &raop_rtp_mirror->remote_saddr,
-                                 sizeof(raop_rtp_mirror->remote_saddr));
+    ret = netutils_parse_remote(remote, remotelen, 0, &raop_rtp_mirror->remote_saddr);
     if (ret < 0) {
         return -1;
     }
@@ -99,6 +360,8 @@ raop_rtp_parse_remote(raop_rtp_mirror_t *raop_rtp_mirror, const unsigned char *r
     return 0;
 }
 
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
 #define NO_FLUSH (-42)
 raop_rtp_mirror_t *raop_rtp_mirror_init(logger_t *logger, raop_callbacks_t *callbacks, raop_ntp_t *ntp,
                                         const unsigned char *remote, int remotelen,
@@ -115,22 +378,64 @@ raop_rtp_mirror_t *raop_rtp_mirror_init(logger_t *logger, raop_callbacks_t *call
     }
     raop_rtp_mirror->logger = logger;
     raop_rtp_mirror->ntp = ntp;
+    memcpy(raop_rtp_mirror->aeskey, aeskey, RAOP_AESKEY_LEN);
+    memcpy(raop_rtp_mirror->ecdh_secret, ecdh_secret, 32);
 
     memcpy(&raop_rtp_mirror->callbacks, callbacks, sizeof(raop_callbacks_t));
+    raop_rtp_mirror->cpu = -1;
     raop_rtp_mirror->buffer = mirror_buffer_init(logger, aeskey, ecdh_secret);
     if (!raop_rtp_mirror->buffer) {
         free(raop_rtp_mirror);
         return NULL;
     }
+    raop_rtp_mirror->frame_pool = frame_pool_init(logger);
+    if (!raop_rtp_mirror->frame_pool) {
+        mirror_buffer_destroy(raop_rtp_mirror->buffer);
+        free(raop_rtp_mirror);
+        return NULL;
+    }
+    raop_rtp_mirror->udp_buffer = mirror_udp_buffer_init(logger, raop_rtp_mirror->frame_pool, RAOP_RTP_MIRROR_UDP_REORDER_DEPTH);
+    if (!raop_rtp_mirror->udp_buffer) {
+        frame_pool_destroy(raop_rtp_mirror->frame_pool);
+        mirror_buffer_destroy(raop_rtp_mirror->buffer);
+        free(raop_rtp_mirror);
+        return NULL;
+    }
+    if (raop_rtp_mirror_init_queues(raop_rtp_mirror) < 0) {
+        mirror_udp_buffer_destroy(raop_rtp_mirror->udp_buffer);
+        frame_pool_destroy(raop_rtp_mirror->frame_pool);
+        mirror_buffer_destroy(raop_rtp_mirror->buffer);
+        free(raop_rtp_mirror);
+        return NULL;
+    }
     if (raop_rtp_parse_remote(raop_rtp_mirror, remote, remotelen) < 0) {
+        raop_rtp_mirror_destroy_queues(raop_rtp_mirror);
+        mirror_udp_buffer_destroy(raop_rtp_mirror->udp_buffer);
+        frame_pool_destroy(raop_rtp_mirror->frame_pool);
+        mirror_buffer_destroy(raop_rtp_mirror->buffer);
+        free(raop_rtp_mirror);
+        return NULL;
+    }
+    raop_rtp_mirror->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (raop_rtp_mirror->wake_fd == -1) {
+        raop_rtp_mirror_destroy_queues(raop_rtp_mirror);
+        mirror_udp_buffer_destroy(raop_rtp_mirror->udp_buffer);
+        frame_pool_destroy(raop_rtp_mirror->frame_pool);
+        mirror_buffer_destroy(raop_rtp_mirror->buffer);
         free(raop_rtp_mirror);
         return NULL;
     }
-    raop_rtp_mirror->running = 0;
+    raop_rtp_mirror->mirror_data_sock = -1;
+    raop_rtp_mirror->mirror_stream_sock = -1;
+    THREAD_FLAG_STORE(raop_rtp_mirror->running, 0);
     raop_rtp_mirror->joined = 1;
     raop_rtp_mirror->flush = NO_FLUSH;
+    raop_rtp_mirror->latency_budget = 0;
 
     MUTEX_CREATE(raop_rtp_mirror->run_mutex);
+    MUTEX_CREATE(raop_rtp_mirror->progress_mutex);
+    MUTEX_CREATE(raop_rtp_mirror->free_frames_mutex);
+    COND_CREATE(raop_rtp_mirror->progress_cond);
     return raop_rtp_mirror;
 }
 
@@ -138,382 +443,2274 @@ void
 raop_rtp_init_mirror_aes(raop_rtp_mirror_t *raop_rtp_mirror, uint64_t streamConnectionID)
 {
     mirror_buffer_init_aes(raop_rtp_mirror->buffer, streamConnectionID);
+    raop_rtp_mirror->stream_connection_id = streamConnectionID;
 }
 
-//#define DUMP_H264
+void
+raop_rtp_mirror_set_latency_budget(raop_rtp_mirror_t *raop_rtp_mirror, unsigned int latency_budget_ms)
+{
+    assert(raop_rtp_mirror);
+    __atomic_store_n(&raop_rtp_mirror->latency_budget, (uint64_t) latency_budget_ms * 1000, __ATOMIC_RELAXED);
+}
 
-#define RAOP_PACKET_LEN 32768
-/**
- * Mirror
- */
-static THREAD_RETVAL
-raop_rtp_mirror_thread(void *arg)
+void
+raop_rtp_mirror_set_memory_budget(raop_rtp_mirror_t *raop_rtp_mirror, size_t max_bytes, mem_budget_t *shared)
 {
-    raop_rtp_mirror_t *raop_rtp_mirror = arg;
     assert(raop_rtp_mirror);
+    frame_pool_set_budget(raop_rtp_mirror->frame_pool, max_bytes, shared);
+}
 
-    int stream_fd = -1;
-    unsigned char packet[128];
-    memset(packet, 0 , 128);
-    unsigned char* payload = NULL;
-    unsigned int readstart = 0;
-
-#ifdef DUMP_H264
-    // C decrypted
-    FILE* file = fopen("/home/pi/Airplay.h264", "wb");
-    // Encrypted source file
-    FILE* file_source = fopen("/home/pi/Airplay.source", "wb");
-    FILE* file_len = fopen("/home/pi/Airplay.len", "wb");
-#endif
+void
+raop_rtp_mirror_set_capture_dir(raop_rtp_mirror_t *raop_rtp_mirror, const char *capture_dir)
+{
+    assert(raop_rtp_mirror);
+    free(raop_rtp_mirror->capture_dir);
+    raop_rtp_mirror->capture_dir = capture_dir ? strdup(capture_dir) : NULL;
+}
 
-    while (1) {
-        fd_set rfds;
-        struct timeval tv;
-        int nfds, ret;
-        MUTEX_LOCK(raop_rtp_mirror->run_mutex);
-        if (!raop_rtp_mirror->running) {
-            MUTEX_UNLOCK(raop_rtp_mirror->run_mutex);
-            break;
-        }
-        MUTEX_UNLOCK(raop_rtp_mirror->run_mutex);
+void
+raop_rtp_mirror_set_frame_bus(raop_rtp_mirror_t *raop_rtp_mirror, frame_bus_t *frame_bus)
+{
+    assert(raop_rtp_mirror);
+    raop_rtp_mirror->frame_bus = frame_bus;
+}
 
-        /* Set timeout value to 5ms */
-        tv.tv_sec = 0;
-        tv.tv_usec = 5000;
+void
+raop_rtp_mirror_set_setup_timeline(raop_rtp_mirror_t *raop_rtp_mirror, setup_timeline_t *setup_timeline)
+{
+    assert(raop_rtp_mirror);
+    raop_rtp_mirror->setup_timeline = setup_timeline;
+}
 
-        /* Get the correct nfds value and set rfds */
-        FD_ZERO(&rfds);
-        if (stream_fd == -1) {
-            FD_SET(raop_rtp_mirror->mirror_data_sock, &rfds);
-            nfds = raop_rtp_mirror->mirror_data_sock+1;
-        } else {
-            FD_SET(stream_fd, &rfds);
-            nfds = stream_fd+1;
-        }
-        ret = select(nfds, &rfds, NULL, NULL, &tv);
-        if (ret == 0) {
-            /* Timeout happened */
-            continue;
-        } else if (ret == -1) {
-            logger_log(raop_rtp_mirror->logger, LOGGER_ERR, "raop_rtp_mirror error in select");
-            break;
-        }
+void
+raop_rtp_mirror_set_cpu(raop_rtp_mirror_t *raop_rtp_mirror, int cpu)
+{
+    assert(raop_rtp_mirror);
+    raop_rtp_mirror->cpu = cpu;
+}
 
-        if (stream_fd == -1 && FD_ISSET(raop_rtp_mirror->mirror_data_sock, &rfds)) {
-            struct sockaddr_storage saddr;
-            socklen_t saddrlen;
+void
+raop_rtp_mirror_set_cpu_load(raop_rtp_mirror_t *raop_rtp_mirror, cpu_load_t *cpu_load)
+{
+    assert(raop_rtp_mirror);
+    raop_rtp_mirror->cpu_load = cpu_load;
+}
 
-            logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror accepting client");
-            saddrlen = sizeof(saddr);
-            stream_fd = accept(raop_rtp_mirror->mirror_data_sock, (struct sockaddr *)&saddr, &saddrlen);
-            if (stream_fd == -1) {
-                logger_log(raop_rtp_mirror->logger, LOGGER_ERR, "raop_rtp_mirror error in accept %d %s", errno, strerror(errno));
-                break;
-            }
+void
+raop_rtp_mirror_set_thermal(raop_rtp_mirror_t *raop_rtp_mirror, thermal_t *thermal)
+{
+    assert(raop_rtp_mirror);
+    raop_rtp_mirror->thermal = thermal;
+}
 
-            // We're calling recv for a certain amount of data, so we need a timeout
-            struct timeval tv;
-            tv.tv_sec = 0;
-            tv.tv_usec = 5000;
-            if (setsockopt(stream_fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) < 0) {
-                logger_log(raop_rtp_mirror->logger, LOGGER_ERR, "raop_rtp_mirror could not set stream socket timeout %d %s", errno, strerror(errno));
-                break;
-            }
-            int option;
-            option = 1;
-            if (setsockopt(stream_fd, SOL_SOCKET, SO_KEEPALIVE, &option, sizeof(option)) < 0) {
-                logger_log(raop_rtp_mirror->logger, LOGGER_WARNING, "raop_rtp_mirror could not set stream socket keepalive %d %s", errno, strerror(errno));
-            }
-            option = 60;
-            if (setsockopt(stream_fd, SOL_TCP, TCP_KEEPIDLE, &option, sizeof(option)) < 0) {
-                logger_log(raop_rtp_mirror->logger, LOGGER_WARNING, "raop_rtp_mirror could not set stream socket keepalive time %d %s", errno, strerror(errno));
-            }
-            option = 10;
-            if (setsockopt(stream_fd, SOL_TCP, TCP_KEEPINTVL, &option, sizeof(option)) < 0) {
-                logger_log(raop_rtp_mirror->logger, LOGGER_WARNING, "raop_rtp_mirror could not set stream socket keepalive interval %d %s", errno, strerror(errno));
-            }
-            option = 6;
-            if (setsockopt(stream_fd, SOL_TCP, TCP_KEEPCNT, &option, sizeof(option)) < 0) {
-                logger_log(raop_rtp_mirror->logger, LOGGER_WARNING, "raop_rtp_mirror could not set stream socket keepalive probes %d %s", errno, strerror(errno));
-            }
-            readstart = 0;
-        }
+void
+raop_rtp_mirror_set_decode_scheduler(raop_rtp_mirror_t *raop_rtp_mirror, decode_scheduler_t *scheduler)
+{
+    assert(raop_rtp_mirror);
+    raop_rtp_mirror->decode_scheduler = scheduler;
+}
 
-        if (stream_fd != -1 && FD_ISSET(stream_fd, &rfds)) {
+void
+raop_rtp_mirror_set_reactor(raop_rtp_mirror_t *raop_rtp_mirror, session_reactor_t *reactor)
+{
+    assert(raop_rtp_mirror);
+    raop_rtp_mirror->reactor = reactor;
+}
 
-            // The first 128 bytes are some kind of header for the payload that follows
-            while (payload == NULL && readstart < 128) {
-                ret = recv(stream_fd, packet + readstart, 128 - readstart, 0);
-                if (ret <= 0) break;
-                readstart = readstart + ret;
-            }
+void
+raop_rtp_mirror_set_lock_memory(raop_rtp_mirror_t *raop_rtp_mirror, int enabled)
+{
+    assert(raop_rtp_mirror);
+    raop_rtp_mirror->lock_memory = enabled;
+}
 
-            if (payload == NULL && ret == 0) {
-                logger_log(raop_rtp_mirror->logger, LOGGER_ERR, "raop_rtp_mirror tcp socket closed");
-                FD_CLR(stream_fd, &rfds);
-                stream_fd = -1;
-                continue;
-            } else if (payload == NULL && ret == -1) {
-                if (errno == EAGAIN || errno == EWOULDBLOCK) continue; // Timeouts can happen even if the connection is fine
-                logger_log(raop_rtp_mirror->logger, LOGGER_ERR, "raop_rtp_mirror error in header recv: %d", errno);
-                break;
-            }
+void
+raop_rtp_mirror_set_coalesce_static(raop_rtp_mirror_t *raop_rtp_mirror, int enabled)
+{
+    assert(raop_rtp_mirror);
+    raop_rtp_mirror->coalesce_static = enabled;
+}
 
-            int payload_size = byteutils_get_int(packet, 0);
-            unsigned short payload_type = byteutils_get_short(packet, 4) & 0xff;
-            unsigned short payload_option = byteutils_get_short(packet, 6);
+void
+raop_rtp_mirror_set_progressive(raop_rtp_mirror_t *raop_rtp_mirror, int enabled)
+{
+    assert(raop_rtp_mirror);
+    raop_rtp_mirror->progressive = enabled && raop_rtp_mirror->callbacks.video_process_part;
+}
 
-            if (payload == NULL) {
-                payload = malloc(payload_size);
-                readstart = 0;
-            }
+void
+raop_rtp_mirror_set_decrypt_workers(raop_rtp_mirror_t *raop_rtp_mirror, task_pool_t *pool, int workers)
+{
+    assert(raop_rtp_mirror);
+    mirror_buffer_set_workers(raop_rtp_mirror->buffer, pool, workers);
+}
 
-            while (readstart < payload_size) {
-                // Payload data
-                ret = recv(stream_fd, payload + readstart, payload_size - readstart, 0);
-                if (ret <= 0) break;
-                readstart = readstart + ret;
-            }
+static void
+raop_rtp_mirror_pin_stage(raop_rtp_mirror_t *raop_rtp_mirror, int stage)
+{
+    static const char *names[] = { "rp-mirror", "rp-decrypt", "rp-submit" };
 
-            if (ret == 0) {
-                logger_log(raop_rtp_mirror->logger, LOGGER_ERR, "raop_rtp_mirror tcp socket closed");
-                break;
-            } else if (ret == -1) {
-                if (errno == EAGAIN || errno == EWOULDBLOCK) continue; // Timeouts can happen even if the connection is fine
-                logger_log(raop_rtp_mirror->logger, LOGGER_ERR, "raop_rtp_mirror error in recv: %d", errno);
-                break;
-            }
+    // Pinning for several senders at once replaces the CPUs of the mirror role
+    thread_attr_apply(raop_rtp_mirror->logger, THREAD_ROLE_MIRROR, names[stage]);
+    if (raop_rtp_mirror->cpu >= 0 && utils_set_thread_cpu(raop_rtp_mirror->cpu + stage) < 0) {
+        logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror could not pin stage %d", stage);
+    }
+    // A new thread after a restart carries on the counts of the one before
+    uint64_t minor, major;
+    if (utils_thread_page_faults(&minor, &major) == 0) {
+        raop_rtp_mirror->page_fault_base[stage][0] = minor - raop_rtp_mirror->page_faults[stage][0];
+        raop_rtp_mirror->page_fault_base[stage][1] = major - raop_rtp_mirror->page_faults[stage][1];
+    }
+}
 
-            if (payload_type == 0) {
-                // Normal video data (VCL NAL)
-
-                // Conveniently, the video data is already stamped with the remote wall clock time,
-                // so no additional clock syncing needed. The only thing odd here is that the video
-                // ntp time stamps don't include the SECONDS_FROM_1900_TO_1970, so it's really just
-                // counting micro seconds since last boot.
-                uint64_t ntp_timestamp_raw = byteutils_get_long(packet, 8);
-                uint64_t ntp_timestamp_remote = raop_ntp_timestamp_to_micro_seconds(ntp_timestamp_raw, false);
-                uint64_t ntp_timestamp = raop_ntp_convert_remote_time(raop_rtp_mirror->ntp, ntp_timestamp_remote);
-
-                uint64_t ntp_now = raop_ntp_get_local_time(raop_rtp_mirror->ntp);
-                logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror video ntp = %llu, now = %llu, latency = %lld",
-                           ntp_timestamp, ntp_now, ((int64_t) ntp_now) - ((int64_t) ntp_timestamp));
-
-#ifdef DUMP_H264
-                fwrite(payload, payload_size, 1, file_source);
-                fwrite(&readstart, sizeof(readstart), 1, file_len);
-#endif
-
-                // Decrypt data
-                unsigned char* payload_decrypted = malloc(payload_size);
-                mirror_buffer_decrypt(raop_rtp_mirror->buffer, payload, payload_decrypted, payload_size);
-
-                int nalu_type = payload[4] & 0x1f;
-                int nalu_size = 0;
-                int nalus_count = 0;
-
-                // It seems the AirPlay protocol prepends NALs with their size, which we're replacing with the 4-byte
-                // start code for the NAL Byte-Stream Format.
-                while (nalu_size < payload_size) {
-                    int nc_len = (payload_decrypted[nalu_size + 0] << 24) | (payload_decrypted[nalu_size + 1] << 16) |
-                                 (payload_decrypted[nalu_size + 2] << 8) | (payload_decrypted[nalu_size + 3]);
-                    assert(nc_len > 0);
-
-                    payload_decrypted[nalu_size + 0] = 0;
-                    payload_decrypted[nalu_size + 1] = 0;
-                    payload_decrypted[nalu_size + 2] = 0;
-                    payload_decrypted[nalu_size + 3] = 1;
-                    nalu_size += nc_len + 4;
-                    nalus_count++;
-                }
+/* Samples the page faults of a stage's thread, after every frame it passes on */
+static void
+raop_rtp_mirror_count_faults(raop_rtp_mirror_t *raop_rtp_mirror, int stage)
+{
+    uint64_t minor, major;
+    if (utils_thread_page_faults(&minor, &major) == 0) {
+        __atomic_store_n(&raop_rtp_mirror->page_faults[stage][0], minor - raop_rtp_mirror->page_fault_base[stage][0], __ATOMIC_RELAXED);
+        __atomic_store_n(&raop_rtp_mirror->page_faults[stage][1], major - raop_rtp_mirror->page_fault_base[stage][1], __ATOMIC_RELAXED);
+    }
+}
 
-                // logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "nalutype = %d", nalu_type);
-                // logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "nalu_size = %d, payloadsize = %d nalus_count = %d",
-                //        nalu_size, payload_size, nalus_count);
-
-#ifdef DUMP_H264
-                fwrite(payload_decrypted, payload_size, 1, file);
-#endif
-
-                h264_decode_struct h264_data;
-                h264_data.data_len = payload_size;
-                h264_data.data = payload_decrypted;
-                h264_data.frame_type = 1;
-                h264_data.pts = ntp_timestamp;
-
-                raop_rtp_mirror->callbacks.video_process(raop_rtp_mirror->callbacks.cls, raop_rtp_mirror->ntp, &h264_data);
-                free(payload_decrypted);
-
-            } else if ((payload_type & 255) == 1) {
-                // The information in the payload contains an SPS and a PPS NAL
-
-                float width_source = byteutils_get_float(packet, 40);
-                float height_source = byteutils_get_float(packet, 44);
-                float width = byteutils_get_float(packet, 56);
-                float height = byteutils_get_float(packet, 60);
-                logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror width_source = %f height_source = %f width = %f height = %f",
-                           width_source, height_source, width, height);
-
-                // The sps_pps is not encrypted
-                h264codec_t h264;
-                h264.version = payload[0];
-                h264.profile_high = payload[1];
-                h264.compatibility = payload[2];
-                h264.level = payload[3];
-                h264.reserved_6_and_nal = payload[4];
-                h264.reserved_3_and_sps = payload[5];
-                h264.sps_size = (short) (((payload[6] & 255) << 8) + (payload[7] & 255));
-                logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror sps size = %d", h264.sps_size);
-                h264.sequence_parameter_set = malloc(h264.sps_size);
-                memcpy(h264.sequence_parameter_set, payload + 8, h264.sps_size);
-                h264.number_of_pps = payload[h264.sps_size + 8];
-                h264.pps_size = (short) (((payload[h264.sps_size + 9] & 2040) + payload[h264.sps_size + 10]) & 255);
-                h264.picture_parameter_set = malloc(h264.pps_size);
-                logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror pps size = %d", h264.pps_size);
-                memcpy(h264.picture_parameter_set, payload + h264.sps_size + 11, h264.pps_size);
-
-                if (h264.sps_size + h264.pps_size < 102400) {
-                    // Copy the sps and pps into a buffer to hand to the decoder
-                    int sps_pps_len = (h264.sps_size + h264.pps_size) + 8;
-                    unsigned char sps_pps[sps_pps_len];
-                    sps_pps[0] = 0;
-                    sps_pps[1] = 0;
-                    sps_pps[2] = 0;
-                    sps_pps[3] = 1;
-                    memcpy(sps_pps + 4, h264.sequence_parameter_set, h264.sps_size);
-                    sps_pps[h264.sps_size + 4] = 0;
-                    sps_pps[h264.sps_size + 5] = 0;
-                    sps_pps[h264.sps_size + 6] = 0;
-                    sps_pps[h264.sps_size + 7] = 1;
-                    memcpy(sps_pps + h264.sps_size + 8, h264.picture_parameter_set, h264.pps_size);
-
-#ifdef DUMP_H264
-                    fwrite(sps_pps, sps_pps_len, 1, file);
-#endif
-
-                    h264_decode_struct h264_data;
-                    h264_data.data_len = sps_pps_len;
-                    h264_data.data = sps_pps;
-                    h264_data.frame_type = 0;
-                    h264_data.pts = 0;
-                    raop_rtp_mirror->callbacks.video_process(raop_rtp_mirror->callbacks.cls, raop_rtp_mirror->ntp, &h264_data);
-                }
-                free(h264.picture_parameter_set);
-                free(h264.sequence_parameter_set);
-            }
+static void
+raop_rtp_mirror_prefault(raop_rtp_mirror_t *raop_rtp_mirror)
+{
+    int failed = 0;
 
-            free(payload);
-            payload = NULL;
-            memset(packet, 0, 128);
-            readstart = 0;
+    if (raop_rtp_mirror->recv_ring && recv_ring_prefault(raop_rtp_mirror->recv_ring, 1) < 0) {
+        failed = 1;
+    }
+    for (size_t i = 0; i < sizeof(raop_rtp_mirror_prefault_sizes) / sizeof(raop_rtp_mirror_prefault_sizes[0]); i++) {
+        if (frame_pool_prefault(raop_rtp_mirror->frame_pool, raop_rtp_mirror_prefault_sizes[i].size,
+                                raop_rtp_mirror_prefault_sizes[i].count, 1) < 0) {
+            failed = 1;
         }
     }
-
-    /* Close the stream file descriptor */
-    if (stream_fd != -1) {
-        closesocket(stream_fd);
+    if (failed) {
+        logger_log(raop_rtp_mirror->logger, LOGGER_WARNING, "raop_rtp_mirror could only fault in the frame buffers, locking them "
+                   "needs CAP_IPC_LOCK or a larger RLIMIT_MEMLOCK");
     }
+}
 
-#ifdef DUMP_H264
-        fclose(file);
-    fclose(file_source);
-    fclose(file_len);
-#endif
-
-    // Ensure running reflects the actual state
-    MUTEX_LOCK(raop_rtp_mirror->run_mutex);
-    raop_rtp_mirror->running = false;
-    MUTEX_UNLOCK(raop_rtp_mirror->run_mutex);
+#define RAOP_PACKET_LEN 32768
 
-    logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror exiting TCP thread");
+static void
+raop_rtp_mirror_open_capture(raop_rtp_mirror_t *raop_rtp_mirror, int use_udp)
+{
+    mirror_capture_header_t header;
+    char filename[512];
+    char date[32];
+    time_t now = time(NULL);
+    struct tm tm;
 
-    return 0;
+    if (!raop_rtp_mirror->capture_dir) {
+        return;
+    }
+    strftime(date, sizeof(date), "%Y%m%d-%H%M%S", localtime_r(&now, &tm));
+    snprintf(filename, sizeof(filename), "%s/mirror-%s-%llu.cap", raop_rtp_mirror->capture_dir, date,
+             (unsigned long long) raop_rtp_mirror->stream_connection_id);
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.aeskey, raop_rtp_mirror->aeskey, sizeof(header.aeskey));
+    memcpy(header.ecdh_secret, raop_rtp_mirror->ecdh_secret, sizeof(header.ecdh_secret));
+    header.stream_connection_id = raop_rtp_mirror->stream_connection_id;
+    header.use_udp = use_udp;
+    raop_rtp_mirror->capture = mirror_capture_open(raop_rtp_mirror->logger, filename, &header);
 }
 
-void
-raop_rtp_start_mirror(raop_rtp_mirror_t *raop_rtp_mirror, int use_udp, unsigned short *mirror_data_lport)
+/* Records a received frame before the decrypt stage touches its payload */
+static void
+raop_rtp_mirror_capture_frame(raop_rtp_mirror_t *raop_rtp_mirror, raop_rtp_mirror_frame_t *frame)
 {
-    logger_log(raop_rtp_mirror->logger, LOGGER_INFO, "raop_rtp_mirror starting mirroring");
-    int use_ipv6 = 0;
-
-    assert(raop_rtp_mirror);
+    mirror_capture_frame_t capture_frame;
 
-    MUTEX_LOCK(raop_rtp_mirror->run_mutex);
-    if (raop_rtp_mirror->running || !raop_rtp_mirror->joined) {
-        MUTEX_UNLOCK(raop_rtp_mirror->run_mutex);
+    if (!raop_rtp_mirror->capture) {
         return;
     }
+    memset(&capture_frame, 0, sizeof(capture_frame));
+    memcpy(capture_frame.header, frame->header, sizeof(capture_frame.header));
+    capture_frame.arrival_time = frame->arrival_time;
+    capture_frame.key_offset = frame->key_offset;
+    capture_frame.payload_size = frame->payload_size;
+    capture_frame.has_key_offset = frame->has_key_offset;
+    capture_frame.discontinuity = frame->discontinuity;
+    mirror_capture_write(raop_rtp_mirror->capture, &capture_frame, frame->payload);
+}
 
-    if (raop_rtp_mirror->remote_saddr.ss_family == AF_INET6) {
-        use_ipv6 = 1;
+static void
+raop_rtp_mirror_release_frame(raop_rtp_mirror_t *raop_rtp_mirror, raop_rtp_mirror_frame_t *frame)
+{
+    if (frame->data && frame->data != frame->payload) {
+        frame_pool_put(raop_rtp_mirror->frame_pool, frame->data);
     }
-    use_ipv6 = 0;
-    if (raop_rtp_init_mirror_sockets(raop_rtp_mirror, use_ipv6) < 0) {
-        logger_log(raop_rtp_mirror->logger, LOGGER_ERR, "raop_rtp_mirror initializing sockets failed");
-        MUTEX_UNLOCK(raop_rtp_mirror->run_mutex);
-        return;
+    if (frame->payload_handle) {
+        raop_rtp_mirror->callbacks.video_release_buffer(raop_rtp_mirror->callbacks.cls, frame->payload_handle);
+    } else if (frame->payload && !frame->payload_in_ring) {
+        frame_pool_put(raop_rtp_mirror->frame_pool, frame->payload);
     }
-    if (mirror_data_lport) *mirror_data_lport = raop_rtp_mirror->mirror_data_lport;
-
-    /* Create the thread and initialize running values */
-    raop_rtp_mirror->running = 1;
-    raop_rtp_mirror->joined = 0;
+    /* Frames are released in the order they were received, so the ring space is too */
+    if (frame->ring_end) {
+        recv_ring_release(raop_rtp_mirror->recv_ring, frame->ring_end);
+    }
+    frame->payload = NULL;
+    frame->payload_handle = NULL;
+    frame->payload_in_ring = false;
+    frame->ring_end = 0;
+    frame->data = NULL;
+    frame->data_len = 0;
+    frame->progressive = false;
+    /* The free ring can hold every frame, so this never fails. Receive, decrypt and submit stage all
+     * release frames, at shutdown at the same time, so pushes are serialized; the pop stays lock free. */
+    MUTEX_LOCK(raop_rtp_mirror->free_frames_mutex);
+    spsc_ring_push(raop_rtp_mirror->free_frames, frame);
+    MUTEX_UNLOCK(raop_rtp_mirror->free_frames_mutex);
+}
 
-    THREAD_CREATE(raop_rtp_mirror->thread_mirror, raop_rtp_mirror_thread, raop_rtp_mirror);
-    MUTEX_UNLOCK(raop_rtp_mirror->run_mutex);
+/*
+ * Reads exactly len bytes, returns 1 on success, 0 if the stream was closed and -1 on error.
+ * timestamp is set to when the kernel received the last of them, 0 if it doesn't tell.
+ */
+static int
+raop_rtp_mirror_read_full(int fd, unsigned char *buf, int len, uint64_t *timestamp)
+{
+    unsigned char control[NETUTILS_TIMESTAMP_CONTROL_SIZE];
+    struct iovec iov;
+    struct msghdr msg;
+    int readstart = 0;
+
+    *timestamp = 0;
+    while (readstart < len) {
+        iov.iov_base = buf + readstart;
+        iov.iov_len = len - readstart;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        int ret = recvmsg(fd, &msg, MSG_WAITALL);
+        if (ret == 0) {
+            return 0;
+        } else if (ret < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        readstart += ret;
+        *timestamp = netutils_get_timestamp(&msg);
+    }
+    return 1;
 }
 
-void raop_rtp_mirror_stop(raop_rtp_mirror_t *raop_rtp_mirror) {
-    assert(raop_rtp_mirror);
+/*
+ * Makes sure the next len bytes of the stream are in the receive ring, reading as much as there is room for.
+ * Returns 1 when they are there or don't fit next to the frames in flight, 0 if the stream was closed and -1 on error.
+ */
+static int
+raop_rtp_mirror_fill_ring(raop_rtp_mirror_t *raop_rtp_mirror, int fd, size_t len, uint64_t *timestamp)
+{
+    recv_ring_t *ring = raop_rtp_mirror->recv_ring;
 
-    /* Check that we are running and thread is not
-     * joined (should never be while still running) */
-    MUTEX_LOCK(raop_rtp_mirror->run_mutex);
-    if (!raop_rtp_mirror->running || raop_rtp_mirror->joined) {
-        MUTEX_UNLOCK(raop_rtp_mirror->run_mutex);
-        return;
+    while (recv_ring_available(ring) < len) {
+        size_t missing = len - recv_ring_available(ring);
+        if (recv_ring_space(ring) < missing) {
+            return 1;
+        }
+        int ret = recv_ring_fill(ring, fd, missing, timestamp);
+        if (ret <= 0) {
+            return ret;
+        }
     }
-    raop_rtp_mirror->running = 0;
-    MUTEX_UNLOCK(raop_rtp_mirror->run_mutex);
+    return 1;
+}
 
-    if (raop_rtp_mirror->mirror_data_sock != -1) {
-        closesocket(raop_rtp_mirror->mirror_data_sock);
-        raop_rtp_mirror->mirror_data_sock = -1;
+/* Reads exactly len bytes like raop_rtp_mirror_read_full, taking those already in the receive ring first */
+static int
+raop_rtp_mirror_read_stream(raop_rtp_mirror_t *raop_rtp_mirror, int fd, unsigned char *buf, int len, uint64_t *timestamp)
+{
+    int buffered = (int) recv_ring_read(raop_rtp_mirror->recv_ring, buf, len);
+    if (buffered == len) {
+        return 1;
     }
+    return raop_rtp_mirror_read_full(fd, buf + buffered, len - buffered, timestamp);
+}
 
-    /* Join the thread */
-    THREAD_JOIN(raop_rtp_mirror->thread_mirror);
+/*
+ * Takes the kernel's receive time as the frame's arrival, so scheduling delay shows up apart from the network's,
+ * and counts the frame as received
+ */
+static void
+raop_rtp_mirror_set_arrival(raop_rtp_mirror_t *raop_rtp_mirror, raop_rtp_mirror_frame_t *frame, uint64_t timestamp)
+{
+    uint64_t now = raop_ntp_get_local_time(raop_rtp_mirror->ntp);
 
-    /* Mark thread as joined */
-    MUTEX_LOCK(raop_rtp_mirror->run_mutex);
-    raop_rtp_mirror->joined = 1;
-    MUTEX_UNLOCK(raop_rtp_mirror->run_mutex);
+    __atomic_store_n(&raop_rtp_mirror->received_frames, raop_rtp_mirror->received_frames + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&raop_rtp_mirror->received_bytes, raop_rtp_mirror->received_bytes + frame->payload_size, __ATOMIC_RELAXED);
+    if (!raop_rtp_mirror->first_arrival) {
+        __atomic_store_n(&raop_rtp_mirror->first_arrival, now, __ATOMIC_RELAXED);
+        raop_rtp_mirror->window_start = now;
+    }
+    __atomic_store_n(&raop_rtp_mirror->last_arrival, now, __ATOMIC_RELAXED);
+    raop_rtp_mirror->window_bytes += frame->payload_size;
+    if (now - raop_rtp_mirror->window_start >= 1000000) {
+        uint64_t bitrate = raop_rtp_mirror->window_bytes * 8 * 1000000 / (now - raop_rtp_mirror->window_start);
+        if (bitrate > raop_rtp_mirror->peak_bitrate) {
+            __atomic_store_n(&raop_rtp_mirror->peak_bitrate, bitrate, __ATOMIC_RELAXED);
+        }
+        raop_rtp_mirror->window_start = now;
+        raop_rtp_mirror->window_bytes = 0;
+    }
+
+    setup_timeline_mark(raop_rtp_mirror->setup_timeline, SETUP_FIRST_FRAME);
+    frame->arrival_time = now;
+    if (timestamp && timestamp <= now) {
+        frame->arrival_time = timestamp;
+        latency_histogram_record(raop_rtp_mirror->receive_delay, (int64_t) (now - timestamp));
+    }
 }
 
-void raop_rtp_mirror_destroy(raop_rtp_mirror_t *raop_rtp_mirror) {
-    if (raop_rtp_mirror) {
-        raop_rtp_mirror_stop(raop_rtp_mirror);
-        MUTEX_DESTROY(raop_rtp_mirror->run_mutex);
-        mirror_buffer_destroy(raop_rtp_mirror->buffer);
-        free(raop_rtp_mirror);
+/* Wakes the decrypt stage if it waits in raop_rtp_mirror_wait_progress, after what it waits for moved on */
+static void
+raop_rtp_mirror_signal_progress(raop_rtp_mirror_t *raop_rtp_mirror)
+{
+    if (__atomic_load_n(&raop_rtp_mirror->progress_waiting, __ATOMIC_SEQ_CST)) {
+        MUTEX_LOCK(raop_rtp_mirror->progress_mutex);
+        COND_SIGNAL(raop_rtp_mirror->progress_cond);
+        MUTEX_UNLOCK(raop_rtp_mirror->progress_mutex);
+    }
+}
+
+/* Waits until more than have bytes of frame were received, or without a frame until the submit stage is idle */
+static void
+raop_rtp_mirror_wait_progress(raop_rtp_mirror_t *raop_rtp_mirror, raop_rtp_mirror_frame_t *frame, int have)
+{
+    __atomic_store_n(&raop_rtp_mirror->progress_waiting, 1, __ATOMIC_SEQ_CST);
+    MUTEX_LOCK(raop_rtp_mirror->progress_mutex);
+    if (frame) {
+        while (__atomic_load_n(&frame->received, __ATOMIC_SEQ_CST) == have) {
+            COND_WAIT(raop_rtp_mirror->progress_cond, raop_rtp_mirror->progress_mutex);
+        }
+    } else {
+        while (__atomic_load_n(&raop_rtp_mirror->submit_done, __ATOMIC_SEQ_CST) != raop_rtp_mirror->submit_pushed) {
+            COND_WAIT(raop_rtp_mirror->progress_cond, raop_rtp_mirror->progress_mutex);
+        }
     }
+    MUTEX_UNLOCK(raop_rtp_mirror->progress_mutex);
+    __atomic_store_n(&raop_rtp_mirror->progress_waiting, 0, __ATOMIC_SEQ_CST);
 }
 
+/*
+ * Reads the rest of a progressive frame's payload, which the decrypt stage already has, publishing how
+ * much arrived after every read. Returns like raop_rtp_mirror_read_full, and marks the frame as cut off
+ * unless it got all of it. The decrypt stage may release the frame as soon as all of it is published.
+ */
 static int
-raop_rtp_init_mirror_sockets(raop_rtp_mirror_t *raop_rtp_mirror, int use_ipv6)
+raop_rtp_mirror_receive_progressive(raop_rtp_mirror_t *raop_rtp_mirror, int fd, raop_rtp_mirror_frame_t *frame)
 {
-    int dsock = -1;
-    unsigned short dport = 0;
+    unsigned char control[NETUTILS_TIMESTAMP_CONTROL_SIZE];
+    struct iovec iov;
+    struct msghdr msg;
+    uint64_t timestamp = 0;
+    int received = frame->received;
+
+    while (received < frame->payload_size) {
+        iov.iov_base = frame->payload + received;
+        iov.iov_len = frame->payload_size - received;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        // Whatever is there, the decrypt stage goes on with every NAL that is complete
+        int ret = recvmsg(fd, &msg, 0);
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        } else if (ret <= 0) {
+            __atomic_store_n(&frame->received, -1, __ATOMIC_SEQ_CST);
+            raop_rtp_mirror_signal_progress(raop_rtp_mirror);
+            return ret;
+        }
+        received += ret;
+        timestamp = netutils_get_timestamp(&msg);
+        if (received < frame->payload_size) {
+            __atomic_store_n(&frame->received, received, __ATOMIC_SEQ_CST);
+            raop_rtp_mirror_signal_progress(raop_rtp_mirror);
+        }
+    }
+    // The arrival is in place before the decrypt stage sees the last bytes
+    raop_rtp_mirror_set_arrival(raop_rtp_mirror, frame, timestamp);
+    trace_event(TRACE_VIDEO_RECEIVED, frame->payload_size, frame->payload_type);
+    __atomic_store_n(&frame->received, received, __ATOMIC_SEQ_CST);
+    raop_rtp_mirror_signal_progress(raop_rtp_mirror);
+    return 1;
+}
 
-    assert(raop_rtp_mirror);
+static void
+raop_rtp_mirror_setup_stream_socket(raop_rtp_mirror_t *raop_rtp_mirror, int stream_fd)
+{
+    int option;
+    option = 1;
+    if (setsockopt(stream_fd, SOL_SOCKET, SO_KEEPALIVE, &option, sizeof(option)) < 0) {
+        logger_log(raop_rtp_mirror->logger, LOGGER_WARNING, "raop_rtp_mirror could not set stream socket keepalive %d %s", errno, strerror(errno));
+    }
+    option = 60;
+    if (setsockopt(stream_fd, SOL_TCP, TCP_KEEPIDLE, &option, sizeof(option)) < 0) {
+        logger_log(raop_rtp_mirror->logger, LOGGER_WARNING, "raop_rtp_mirror could not set stream socket keepalive time %d %s", errno, strerror(errno));
+    }
+    option = 10;
+    if (setsockopt(stream_fd, SOL_TCP, TCP_KEEPINTVL, &option, sizeof(option)) < 0) {
+        logger_log(raop_rtp_mirror->logger, LOGGER_WARNING, "raop_rtp_mirror could not set stream socket keepalive interval %d %s", errno, strerror(errno));
+    }
+    option = 6;
+    if (setsockopt(stream_fd, SOL_TCP, TCP_KEEPCNT, &option, sizeof(option)) < 0) {
+        logger_log(raop_rtp_mirror->logger, LOGGER_WARNING, "raop_rtp_mirror could not set stream socket keepalive probes %d %s", errno, strerror(errno));
+    }
+    /* The receive buffer and busy polling come with the listening socket */
+    netutils_rearm_quickack(stream_fd);
+}
+
+static void
+raop_rtp_mirror_handle_heartbeat(raop_rtp_mirror_t *raop_rtp_mirror, const unsigned char *header,
+                                 const unsigned char *payload, int payload_size)
+{
+    __atomic_store_n(&raop_rtp_mirror->heartbeats, raop_rtp_mirror->heartbeats + 1, __ATOMIC_RELAXED);
+}
+
+/* Binary plist the sender reports its encoder state in, nothing here uses it */
+static void
+raop_rtp_mirror_handle_report(raop_rtp_mirror_t *raop_rtp_mirror, const unsigned char *header,
+                              const unsigned char *payload, int payload_size)
+{
+    __atomic_store_n(&raop_rtp_mirror->reports, raop_rtp_mirror->reports + 1, __ATOMIC_RELAXED);
+    LOGGER_LOG(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror stream report of %d bytes", payload_size);
+}
+
+/*
+ * What to do with each payload type of the mirror stream. Video and codec data go down the
+ * decrypt and submit stages, the rest is handled by the receive stage as it comes in. A
+ * handler gets a NULL payload if it was larger than RAOP_RTP_MIRROR_CONTROL_SIZE.
+ */
+typedef struct {
+    const char *name;
+    bool frame;
+    void (*handle)(raop_rtp_mirror_t *raop_rtp_mirror, const unsigned char *header,
+                   const unsigned char *payload, int payload_size);
+} raop_rtp_mirror_packet_type_t;
+
+static const raop_rtp_mirror_packet_type_t raop_rtp_mirror_packet_types[] = {
+    [0] = { "video", true, NULL },
+    [1] = { "codec", true, NULL },
+    [2] = { "heartbeat", false, raop_rtp_mirror_handle_heartbeat },
+    [5] = { "report", false, raop_rtp_mirror_handle_report },
+};
+
+static const raop_rtp_mirror_packet_type_t *
+raop_rtp_mirror_packet_type(int payload_type)
+{
+    if (payload_type < 0 || payload_type >= (int) (sizeof(raop_rtp_mirror_packet_types) / sizeof(raop_rtp_mirror_packet_types[0])) ||
+        !raop_rtp_mirror_packet_types[payload_type].name) {
+        return NULL;
+    }
+    return &raop_rtp_mirror_packet_types[payload_type];
+}
+
+/* True for the packets that go through the decrypt and submit stages */
+static bool
+raop_rtp_mirror_is_frame(int payload_type)
+{
+    const raop_rtp_mirror_packet_type_t *type = raop_rtp_mirror_packet_type(payload_type);
+    return type && type->frame;
+}
+
+static void
+raop_rtp_mirror_dispatch_packet(raop_rtp_mirror_t *raop_rtp_mirror, int payload_type, const unsigned char *header,
+                                const unsigned char *payload, int payload_size)
+{
+    const raop_rtp_mirror_packet_type_t *type = raop_rtp_mirror_packet_type(payload_type);
+
+    if (!type) {
+        __atomic_store_n(&raop_rtp_mirror->unknown_packets, raop_rtp_mirror->unknown_packets + 1, __ATOMIC_RELAXED);
+        LOGGER_LOG(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror ignoring packet of type %d, %d bytes",
+                   payload_type, payload_size);
+        return;
+    }
+    type->handle(raop_rtp_mirror, header, payload, payload_size);
+}
+
+/* Reads past len bytes of the stream through scratch of RAOP_RTP_MIRROR_CONTROL_SIZE */
+static int
+raop_rtp_mirror_skip_stream(raop_rtp_mirror_t *raop_rtp_mirror, int fd, int len, unsigned char *scratch, uint64_t *timestamp)
+{
+    while (len > 0) {
+        int chunk = MIN(len, RAOP_RTP_MIRROR_CONTROL_SIZE);
+        int ret = raop_rtp_mirror_read_stream(raop_rtp_mirror, fd, scratch, chunk, timestamp);
+        if (ret <= 0) {
+            return ret;
+        }
+        len -= chunk;
+    }
+    return 1;
+}
+
+/*
+ * Receives the payload of a packet that is not a frame and dispatches it. Small payloads are
+ * handled in the receive ring or in scratch, larger ones are skipped over through scratch.
+ */
+static int
+raop_rtp_mirror_receive_packet(raop_rtp_mirror_t *raop_rtp_mirror, int fd, int payload_type, const unsigned char *header, int payload_size,
+                               unsigned char *scratch, uint64_t *timestamp)
+{
+    recv_ring_t *ring = raop_rtp_mirror->recv_ring;
+    const unsigned char *payload = NULL;
+    int ret;
+
+    if (payload_size <= 0) {
+        raop_rtp_mirror_dispatch_packet(raop_rtp_mirror, payload_type, header, NULL, 0);
+        return 1;
+    }
+    if (payload_size <= RAOP_RTP_MIRROR_CONTROL_SIZE) {
+        ret = raop_rtp_mirror_fill_ring(raop_rtp_mirror, fd, payload_size, timestamp);
+        if (ret <= 0) {
+            return ret;
+        }
+        if (recv_ring_available(ring) >= (size_t) payload_size && (payload = recv_ring_peek(ring, payload_size))) {
+            // Released along with the next frame's ring space
+            recv_ring_consume(ring, payload_size);
+        } else {
+            ret = raop_rtp_mirror_read_stream(raop_rtp_mirror, fd, scratch, payload_size, timestamp);
+            if (ret <= 0) {
+                return ret;
+            }
+            payload = scratch;
+        }
+        raop_rtp_mirror_dispatch_packet(raop_rtp_mirror, payload_type, header, payload, payload_size);
+        return 1;
+    }
+    ret = raop_rtp_mirror_skip_stream(raop_rtp_mirror, fd, payload_size, scratch, timestamp);
+    if (ret <= 0) {
+        return ret;
+    }
+    raop_rtp_mirror_dispatch_packet(raop_rtp_mirror, payload_type, header, NULL, payload_size);
+    return 1;
+}
+
+/*
+ * After a read came back with ret, whether the sender is gone rather than the stream broken: it closed
+ * the connection, or the network cut it off as a Wi-Fi dropout does. Logs either way.
+ */
+static bool
+raop_rtp_mirror_stream_lost(raop_rtp_mirror_t *raop_rtp_mirror, int ret)
+{
+    int error = errno;
+    if (ret == 0) {
+        logger_log(raop_rtp_mirror->logger, LOGGER_ERR, "raop_rtp_mirror tcp socket closed");
+        return true;
+    }
+    if (error == ECONNRESET || error == ETIMEDOUT || error == EHOSTUNREACH || error == ENETUNREACH) {
+        logger_log(raop_rtp_mirror->logger, LOGGER_ERR, "raop_rtp_mirror tcp connection lost: %s", strerror(error));
+        return true;
+    }
+    logger_log(raop_rtp_mirror->logger, LOGGER_ERR, "raop_rtp_mirror error in recv: %d", error);
+    return false;
+}
+
+/**
+ * Mirror receive stage, reads frames off the TCP stream. When the sender's connection is lost the
+ * session's keys, its place in the keystream and the decoder's state stay, and the stage waits for
+ * the sender to connect again, picking up at the next IDR.
+ */
+static THREAD_RETVAL
+raop_rtp_mirror_thread(void *arg)
+{
+    raop_rtp_mirror_t *raop_rtp_mirror = arg;
+    assert(raop_rtp_mirror);
+
+    int stream_fd = -1;
+    unsigned char packet[128];
+    unsigned char scratch[RAOP_RTP_MIRROR_CONTROL_SIZE];
+    uint64_t timestamp;
+    raop_rtp_mirror_frame_t *frame = NULL;
+    /* The first frame of a new connection or after a dropped one, the decoder has to wait for an IDR past it */
+    bool connected = false;
+    /* Video payload bytes the sender has encrypted so far, counted from the headers so that a frame that
+     * is skipped or cut off doesn't put the keystream out of step */
+    uint64_t key_offset = 0;
+    /* When the sender's connection was lost, 0 if it wasn't */
+    uint64_t lost_at = 0;
+    bool zero_copy = raop_rtp_mirror->callbacks.video_acquire_buffer &&
+                     raop_rtp_mirror->callbacks.video_submit_buffer &&
+                     raop_rtp_mirror->callbacks.video_release_buffer;
+
+    raop_rtp_mirror_pin_stage(raop_rtp_mirror, 0);
+
+    while (1) {
+        int ret;
+        if (!THREAD_FLAG_LOAD(raop_rtp_mirror->running)) {
+            break;
+        }
+
+        if (stream_fd == -1) {
+            /* Sleep until the sender connects or we are told to stop */
+            struct pollfd pfds[2];
+            pfds[0].fd = raop_rtp_mirror->mirror_data_sock;
+            pfds[0].events = POLLIN;
+            pfds[1].fd = raop_rtp_mirror->wake_fd;
+            pfds[1].events = POLLIN;
+            ret = poll(pfds, 2, -1);
+            if (ret == -1) {
+                if (errno == EINTR) continue;
+                logger_log(raop_rtp_mirror->logger, LOGGER_ERR, "raop_rtp_mirror error in poll");
+                break;
+            }
+            if (pfds[1].revents) {
+                /* Stop requested */
+                break;
+            }
+            if (!(pfds[0].revents & POLLIN)) {
+                continue;
+            }
+
+            struct sockaddr_storage saddr;
+            socklen_t saddrlen;
+
+            LOGGER_LOG(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror accepting client");
+            saddrlen = sizeof(saddr);
+            stream_fd = accept(raop_rtp_mirror->mirror_data_sock, (struct sockaddr *)&saddr, &saddrlen);
+            if (stream_fd == -1) {
+                logger_log(raop_rtp_mirror->logger, LOGGER_ERR, "raop_rtp_mirror error in accept %d %s", errno, strerror(errno));
+                break;
+            }
+            raop_rtp_mirror_setup_stream_socket(raop_rtp_mirror, stream_fd);
+            connected = true;
+            if (lost_at) {
+                __atomic_fetch_add(&raop_rtp_mirror->reconnects, 1, __ATOMIC_RELAXED);
+                logger_log(raop_rtp_mirror->logger, LOGGER_INFO, "raop_rtp_mirror sender reconnected after %llu ms, resuming the stream",
+                           (unsigned long long) (raop_ntp_get_local_time(raop_rtp_mirror->ntp) - lost_at) / 1000);
+                lost_at = 0;
+            }
+            setup_timeline_mark(raop_rtp_mirror->setup_timeline, SETUP_MIRROR_ACCEPT);
+
+            /* Publish the stream socket so stop can shut it down to interrupt a blocking read */
+            MUTEX_LOCK(raop_rtp_mirror->run_mutex);
+            raop_rtp_mirror->mirror_stream_sock = stream_fd;
+            ret = THREAD_FLAG_LOAD(raop_rtp_mirror->running);
+            MUTEX_UNLOCK(raop_rtp_mirror->run_mutex);
+            if (!ret) break;
+            continue;
+        }
+
+        // The first 128 bytes are some kind of header for the payload that follows
+        ret = raop_rtp_mirror_fill_ring(raop_rtp_mirror, stream_fd, 128, &timestamp);
+        if (ret > 0) {
+            ret = raop_rtp_mirror_read_stream(raop_rtp_mirror, stream_fd, packet, 128, &timestamp);
+        }
+        if (ret <= 0) {
+            if (!raop_rtp_mirror_stream_lost(raop_rtp_mirror, ret)) break;
+            goto lost;
+        }
+
+        int payload_size = byteutils_get_int(packet, 0);
+        if (payload_size < 0 || payload_size > RAOP_RTP_MIRROR_MAX_PAYLOAD) {
+            logger_log(raop_rtp_mirror->logger, LOGGER_ERR, "raop_rtp_mirror payload size %d out of range, closing the stream",
+                       payload_size);
+            break;
+        }
+
+        // Heartbeats and the like never take a frame
+        int payload_type = byteutils_get_short(packet, 4) & 0xff;
+        if (!raop_rtp_mirror_is_frame(payload_type)) {
+            ret = raop_rtp_mirror_receive_packet(raop_rtp_mirror, stream_fd, payload_type, packet, payload_size,
+                                                 scratch, &timestamp);
+            if (ret <= 0) {
+                if (!raop_rtp_mirror_stream_lost(raop_rtp_mirror, ret)) break;
+                goto lost;
+            }
+            continue;
+        }
+
+        // Waits here only if all frames are queued in the later stages, a dropped frame's is used again
+        if (frame == NULL) {
+            frame = spsc_ring_pop_wait(raop_rtp_mirror->free_frames);
+            if (frame == NULL) break;
+        }
+
+        memcpy(frame->header, packet, 128);
+        frame->payload_size = payload_size;
+        frame->payload_type = payload_type;
+        frame->payload = NULL;
+        frame->payload_handle = NULL;
+        frame->payload_in_ring = false;
+        frame->has_key_offset = frame->payload_type == 0;
+        frame->key_offset = key_offset;
+        frame->discontinuity = connected && frame->payload_type == 0;
+        if (frame->payload_type == 0) {
+            connected = false;
+            key_offset += frame->payload_size;
+        }
+
+        // Large frames go to the decrypt stage as they arrive, in a buffer of their own, unless they are in already
+        frame->progressive = raop_rtp_mirror->progressive && frame->payload_type == 0 &&
+                             frame->payload_size >= RAOP_RTP_MIRROR_PROGRESSIVE_MIN && !raop_rtp_mirror->capture &&
+                             recv_ring_available(raop_rtp_mirror->recv_ring) < (size_t) frame->payload_size;
+        if (zero_copy && frame->payload_type == 0 && !frame->progressive) {
+            // Let the renderer provide the memory so the frame never gets copied after recv
+            frame->payload = raop_rtp_mirror->callbacks.video_acquire_buffer(raop_rtp_mirror->callbacks.cls,
+                                                                             frame->payload_size, &frame->payload_handle);
+            if (frame->payload == NULL) {
+                frame->payload_handle = NULL;
+            }
+        } else if (frame->payload_size > 0 && !frame->progressive) {
+            // Otherwise the payload stays where it was received if it fits next to the frames in flight
+            ret = raop_rtp_mirror_fill_ring(raop_rtp_mirror, stream_fd, frame->payload_size, &timestamp);
+            if (ret <= 0) {
+                if (!raop_rtp_mirror_stream_lost(raop_rtp_mirror, ret)) break;
+                goto lost;
+            }
+            if (recv_ring_available(raop_rtp_mirror->recv_ring) >= (size_t) frame->payload_size) {
+                frame->payload = recv_ring_peek(raop_rtp_mirror->recv_ring, frame->payload_size);
+                if (frame->payload) {
+                    recv_ring_consume(raop_rtp_mirror->recv_ring, frame->payload_size);
+                    frame->payload_in_ring = true;
+                    __atomic_store_n(&raop_rtp_mirror->ring_frames, raop_rtp_mirror->ring_frames + 1, __ATOMIC_RELAXED);
+                }
+            }
+        }
+        if (frame->payload == NULL) {
+            frame->payload = frame_pool_get(raop_rtp_mirror->frame_pool, frame->payload_size);
+            if (frame->payload == NULL) {
+                // Over the memory budget, the frame is skipped and decoding resumes at the next IDR
+                LOGGER_LOG(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror dropping frame of %d bytes over budget",
+                           frame->payload_size);
+                __atomic_store_n(&raop_rtp_mirror->over_budget_frames, raop_rtp_mirror->over_budget_frames + 1, __ATOMIC_RELAXED);
+                ret = raop_rtp_mirror_skip_stream(raop_rtp_mirror, stream_fd, frame->payload_size, scratch, &timestamp);
+                if (ret <= 0) {
+                    if (!raop_rtp_mirror_stream_lost(raop_rtp_mirror, ret)) break;
+                    goto lost;
+                }
+                connected = true;
+                continue;
+            }
+        }
+
+        if (frame->progressive) {
+            // The decrypt stage starts on what came along with the header, the rest is read as it arrives
+            frame->received = (int) recv_ring_read(raop_rtp_mirror->recv_ring, frame->payload, frame->payload_size);
+            frame->ring_end = recv_ring_position(raop_rtp_mirror->recv_ring);
+            if (spsc_ring_push_wait(raop_rtp_mirror->decrypt_queue, frame) < 0) {
+                break;
+            }
+            // The decrypt stage releases it, possibly as soon as it is complete
+            raop_rtp_mirror_frame_t *progressive = frame;
+            frame = NULL;
+            ret = raop_rtp_mirror_receive_progressive(raop_rtp_mirror, stream_fd, progressive);
+            if (ret <= 0) {
+                if (!raop_rtp_mirror_stream_lost(raop_rtp_mirror, ret)) break;
+                goto lost;
+            }
+            netutils_rearm_quickack(stream_fd);
+            raop_rtp_mirror_count_faults(raop_rtp_mirror, 0);
+            continue;
+        }
+
+        // Payload data, unless it is in the ring already
+        if (!frame->payload_in_ring) {
+            ret = raop_rtp_mirror_read_stream(raop_rtp_mirror, stream_fd, frame->payload, frame->payload_size, &timestamp);
+            if (ret <= 0) {
+                if (!raop_rtp_mirror_stream_lost(raop_rtp_mirror, ret)) break;
+                goto lost;
+            }
+        }
+        frame->ring_end = recv_ring_position(raop_rtp_mirror->recv_ring);
+        raop_rtp_mirror_set_arrival(raop_rtp_mirror, frame, timestamp);
+        netutils_rearm_quickack(stream_fd);
+        trace_event(TRACE_VIDEO_RECEIVED, frame->payload_size, frame->payload_type);
+        raop_rtp_mirror_capture_frame(raop_rtp_mirror, frame);
+
+        // Hand the complete frame to the decrypt stage
+        if (spsc_ring_push_wait(raop_rtp_mirror->decrypt_queue, frame) < 0) {
+            break;
+        }
+        frame = NULL;
+        raop_rtp_mirror_count_faults(raop_rtp_mirror, 0);
+        continue;
+
+    lost:
+        MUTEX_LOCK(raop_rtp_mirror->run_mutex);
+        raop_rtp_mirror->mirror_stream_sock = -1;
+        MUTEX_UNLOCK(raop_rtp_mirror->run_mutex);
+        closesocket(stream_fd);
+        stream_fd = -1;
+        /* A frame cut off goes, and what it took of the ring goes with the next frame's ring space */
+        if (frame) {
+            raop_rtp_mirror_release_frame(raop_rtp_mirror, frame);
+            frame = NULL;
+        }
+        recv_ring_discard(raop_rtp_mirror->recv_ring);
+        lost_at = raop_ntp_get_local_time(raop_rtp_mirror->ntp);
+    }
+
+    /* Close the stream file descriptor */
+    if (stream_fd != -1) {
+        MUTEX_LOCK(raop_rtp_mirror->run_mutex);
+        raop_rtp_mirror->mirror_stream_sock = -1;
+        MUTEX_UNLOCK(raop_rtp_mirror->run_mutex);
+        closesocket(stream_fd);
+    }
+    if (frame) {
+        raop_rtp_mirror_release_frame(raop_rtp_mirror, frame);
+    }
+
+    /* Let the later stages drain and exit */
+    spsc_ring_close(raop_rtp_mirror->decrypt_queue);
+
+    // Ensure running reflects the actual state
+    MUTEX_LOCK(raop_rtp_mirror->run_mutex);
+    THREAD_FLAG_STORE(raop_rtp_mirror->running, 0);
+    MUTEX_UNLOCK(raop_rtp_mirror->run_mutex);
+
+    LOGGER_LOG(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror exiting TCP thread");
+
+    return 0;
+}
+
+/*
+ * Reads one datagram and passes on the frames it completes. A reactor can't wait for the later
+ * stages, without wait a frame they have no room for is dropped and the decoder resumes at the
+ * next IDR. Returns -1 once the stream is to end, 0 otherwise.
+ */
+static int
+raop_rtp_mirror_udp_receive(raop_rtp_mirror_t *raop_rtp_mirror, bool wait)
+{
+    unsigned char packet[65536];
+    unsigned char control[NETUTILS_TIMESTAMP_CONTROL_SIZE];
+    mirror_udp_frame_t udp_frame;
+
+    struct iovec iov = { packet, sizeof(packet) };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    int ret = recvmsg(raop_rtp_mirror->mirror_data_sock, &msg, wait ? 0 : MSG_DONTWAIT);
+    if (ret < 0) {
+        if (errno == EINTR || errno == EAGAIN) return 0;
+        logger_log(raop_rtp_mirror->logger, LOGGER_ERR, "raop_rtp_mirror error in udp recv: %d", errno);
+        return -1;
+    }
+    if (mirror_udp_buffer_enqueue(raop_rtp_mirror->udp_buffer, packet, ret) <= 0) {
+        return 0;
+    }
+
+    while (mirror_udp_buffer_dequeue(raop_rtp_mirror->udp_buffer, &udp_frame)) {
+        int payload_type = byteutils_get_short(udp_frame.header, 4) & 0xff;
+        if (!raop_rtp_mirror_is_frame(payload_type)) {
+            raop_rtp_mirror_dispatch_packet(raop_rtp_mirror, payload_type, udp_frame.header, udp_frame.payload, udp_frame.payload_size);
+            frame_pool_put(raop_rtp_mirror->frame_pool, udp_frame.payload);
+            continue;
+        }
+        raop_rtp_mirror_frame_t *frame;
+        if (wait) {
+            frame = spsc_ring_pop_wait(raop_rtp_mirror->free_frames);
+            if (frame == NULL) {
+                frame_pool_put(raop_rtp_mirror->frame_pool, udp_frame.payload);
+                return -1;
+            }
+        } else if (spsc_ring_count(raop_rtp_mirror->decrypt_queue) >= RAOP_RTP_MIRROR_QUEUE_LENGTH ||
+                   (frame = spsc_ring_pop(raop_rtp_mirror->free_frames)) == NULL) {
+            // Room in the queue first, so the push below can't fail with a frame this thread can't give back
+            LOGGER_LOG(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror dropping frame of %d bytes, the decrypt stage is behind",
+                       udp_frame.payload_size);
+            frame_pool_put(raop_rtp_mirror->frame_pool, udp_frame.payload);
+            __atomic_store_n(&raop_rtp_mirror->queue_full_frames, raop_rtp_mirror->queue_full_frames + 1, __ATOMIC_RELAXED);
+            raop_rtp_mirror->udp_dropped = true;
+            continue;
+        }
+        memcpy(frame->header, udp_frame.header, 128);
+        frame->payload_type = byteutils_get_short(frame->header, 4) & 0xff;
+        frame->payload = udp_frame.payload;
+        frame->payload_handle = NULL;
+        frame->payload_size = udp_frame.payload_size;
+        frame->has_key_offset = true;
+        frame->key_offset = udp_frame.key_offset;
+        frame->discontinuity = udp_frame.discontinuity || (raop_rtp_mirror->udp_dropped && frame->payload_type == 0);
+        if (frame->payload_type == 0) {
+            raop_rtp_mirror->udp_dropped = false;
+        }
+        // A frame is complete with the datagram just read
+        raop_rtp_mirror_set_arrival(raop_rtp_mirror, frame, netutils_get_timestamp(&msg));
+        trace_event(TRACE_VIDEO_RECEIVED, frame->payload_size, frame->payload_type);
+        raop_rtp_mirror_capture_frame(raop_rtp_mirror, frame);
+        if (wait ? spsc_ring_push_wait(raop_rtp_mirror->decrypt_queue, frame) < 0 :
+                   spsc_ring_push(raop_rtp_mirror->decrypt_queue, frame) < 0) {
+            raop_rtp_mirror_release_frame(raop_rtp_mirror, frame);
+            return -1;
+        }
+        raop_rtp_mirror_count_faults(raop_rtp_mirror, 0);
+    }
+    return 0;
+}
+
+static void
+raop_rtp_mirror_udp_finish(raop_rtp_mirror_t *raop_rtp_mirror)
+{
+    mirror_udp_buffer_stats_t stats;
+    mirror_udp_buffer_get_stats(raop_rtp_mirror->udp_buffer, &stats);
+    logger_log(raop_rtp_mirror->logger, LOGGER_INFO, "raop_rtp_mirror udp frames = %llu, lost = %llu, late packets = %llu, duplicates = %llu, invalid = %llu",
+               (unsigned long long) stats.frames, (unsigned long long) stats.lost_frames, (unsigned long long) stats.late_packets,
+               (unsigned long long) stats.duplicate_packets, (unsigned long long) stats.invalid_packets);
+    mirror_udp_buffer_flush(raop_rtp_mirror->udp_buffer);
+
+    /* Let the later stages drain and exit */
+    spsc_ring_close(raop_rtp_mirror->decrypt_queue);
+}
+
+/**
+ * Mirror receive stage for UDP, reassembles frames from datagrams and skips lost ones
+ */
+static THREAD_RETVAL
+raop_rtp_mirror_udp_thread(void *arg)
+{
+    raop_rtp_mirror_t *raop_rtp_mirror = arg;
+    assert(raop_rtp_mirror);
+
+    raop_rtp_mirror_pin_stage(raop_rtp_mirror, 0);
+    mirror_udp_buffer_flush(raop_rtp_mirror->udp_buffer);
+    while (1) {
+        int ret;
+        if (!THREAD_FLAG_LOAD(raop_rtp_mirror->running)) {
+            break;
+        }
+
+        struct pollfd pfds[2];
+        pfds[0].fd = raop_rtp_mirror->mirror_data_sock;
+        pfds[0].events = POLLIN;
+        pfds[1].fd = raop_rtp_mirror->wake_fd;
+        pfds[1].events = POLLIN;
+        ret = poll(pfds, 2, -1);
+        if (ret == -1) {
+            if (errno == EINTR) continue;
+            logger_log(raop_rtp_mirror->logger, LOGGER_ERR, "raop_rtp_mirror error in poll");
+            break;
+        }
+        if (pfds[1].revents) {
+            /* Stop requested */
+            break;
+        }
+        if (!(pfds[0].revents & POLLIN)) {
+            continue;
+        }
+        if (raop_rtp_mirror_udp_receive(raop_rtp_mirror, true) < 0) {
+            break;
+        }
+    }
+
+    raop_rtp_mirror_udp_finish(raop_rtp_mirror);
+
+    MUTEX_LOCK(raop_rtp_mirror->run_mutex);
+    THREAD_FLAG_STORE(raop_rtp_mirror->running, 0);
+    MUTEX_UNLOCK(raop_rtp_mirror->run_mutex);
+
+    LOGGER_LOG(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror exiting UDP thread");
+
+    return 0;
+}
+
+/* The UDP receive stage on the session reactor, the socket is removed once the stream is to end */
+static void
+raop_rtp_mirror_reactor_read(void *arg, int fd)
+{
+    raop_rtp_mirror_t *raop_rtp_mirror = arg;
+
+    if (THREAD_FLAG_LOAD(raop_rtp_mirror->running) && raop_rtp_mirror_udp_receive(raop_rtp_mirror, false) < 0) {
+        session_reactor_remove_fd(raop_rtp_mirror->reactor, fd);
+        spsc_ring_close(raop_rtp_mirror->decrypt_queue);
+    }
+}
+
+/* How far the NAL walk of a frame got, so it can go on as more of the frame is decrypted */
+typedef struct {
+    /* Offset of the next length prefix */
+    int next;
+    int count;
+    bool idr;
+    bool indexed;
+} raop_rtp_mirror_nal_walk_t;
+
+/* Rewrites and indexes every NAL whose length prefix and header lie within the first ready bytes of data */
+static void
+raop_rtp_mirror_walk_nals(raop_rtp_mirror_nal_walk_t *walk, unsigned char *data, int ready, int data_len,
+                          video_codec_t codec, h264_nal_unit_t *nal_units)
+{
+    // It seems the AirPlay protocol prepends NALs with their size, which we're replacing with the 4-byte
+    // start code for the NAL Byte-Stream Format.
+    while (walk->next < data_len && MIN(walk->next + 5, data_len) <= ready) {
+        int nalu_size = walk->next;
+        int nc_len = (data[nalu_size + 0] << 24) | (data[nalu_size + 1] << 16) |
+                     (data[nalu_size + 2] << 8) | (data[nalu_size + 3]);
+        assert(nc_len > 0);
+
+        data[nalu_size + 0] = 0;
+        data[nalu_size + 1] = 0;
+        data[nalu_size + 2] = 0;
+        data[nalu_size + 3] = 1;
+        if (nalu_size + 4 < data_len) {
+            int nal_type = video_nal_type(codec, data[nalu_size + 4]);
+            if (video_nal_is_keyframe(codec, nal_type)) {
+                walk->idr = true;
+            }
+            // Remember where every NAL starts so renderers don't have to scan for start codes again
+            if (walk->count < H264_MAX_NAL_UNITS) {
+                nal_units[walk->count].offset = nalu_size + 4;
+                nal_units[walk->count].size = MIN(nc_len, data_len - nalu_size - 4);
+                nal_units[walk->count].nal_type = nal_type;
+            } else {
+                walk->indexed = false;
+            }
+        }
+        walk->next += nc_len + 4;
+        walk->count++;
+    }
+}
+
+bool
+raop_rtp_mirror_rewrite_nals(unsigned char *data, int data_len, video_codec_t codec, h264_nal_unit_t *nal_units, int *nal_count)
+{
+    raop_rtp_mirror_nal_walk_t walk = { 0, 0, false, true };
+
+    raop_rtp_mirror_walk_nals(&walk, data, data_len, data_len, codec, nal_units);
+    *nal_count = walk.indexed ? MIN(walk.count, H264_MAX_NAL_UNITS) : 0;
+    return walk.idr;
+}
+
+bool
+raop_rtp_mirror_decrypt_nals(mirror_buffer_t *buffer, unsigned char *data, int data_len, video_codec_t codec,
+                             h264_nal_unit_t *nal_units, int *nal_count)
+{
+    raop_rtp_mirror_nal_walk_t walk = { 0, 0, false, true };
+    uint64_t start = mirror_buffer_get_offset(buffer);
+    int pos = 0;
+
+    if (mirror_buffer_splits(buffer, data_len)) {
+        // A split frame ends up in the caches of several cores, there is no chunk to catch while it is hot
+        mirror_buffer_decrypt_in_place(buffer, data, data_len);
+        return raop_rtp_mirror_rewrite_nals(data, data_len, codec, nal_units, nal_count);
+    }
+    while (pos < data_len) {
+        // Chunks end on a block boundary of the keystream, so none but the last leaves a block half used
+        int end = (int) (((start + pos + RAOP_RTP_MIRROR_FUSED_CHUNK) & ~(uint64_t) 15) - start);
+        end = MIN(end, data_len);
+        mirror_buffer_decrypt_in_place(buffer, data + pos, end - pos);
+        pos = end;
+        raop_rtp_mirror_walk_nals(&walk, data, pos, data_len, codec, nal_units);
+    }
+    *nal_count = walk.indexed ? MIN(walk.count, H264_MAX_NAL_UNITS) : 0;
+    return walk.idr;
+}
+
+/* True if every slice of frame is one no other picture predicts from, false if the frame was not indexed */
+static bool
+raop_rtp_mirror_is_disposable(raop_rtp_mirror_frame_t *frame)
+{
+    bool slices = false;
+    for (int i = 0; i < frame->nal_count; i++) {
+        h264_nal_unit_t *nal = &frame->nal_units[i];
+        if (nal->size <= 0 || !video_nal_is_slice(frame->codec, nal->nal_type)) {
+            continue;
+        }
+        if (!video_nal_is_disposable(frame->codec, frame->data[nal->offset])) {
+            return false;
+        }
+        slices = true;
+    }
+    return slices;
+}
+
+/* An unsigned Exp-Golomb value from data at *bit, -1 if it runs past len. Emulation prevention bytes
+ * are not taken out, the first fields of a slice header don't reach far enough to meet one. */
+static int
+raop_rtp_mirror_read_ue(const unsigned char *data, int len, int *bit)
+{
+    int zeros = 0;
+    while (*bit < len * 8 && !(data[*bit / 8] & (0x80 >> (*bit % 8)))) {
+        (*bit)++;
+        if (++zeros > 16) return -1;
+    }
+    (*bit)++;
+    if (*bit + zeros > len * 8) return -1;
+    int value = 0;
+    for (int i = 0; i < zeros; i++, (*bit)++) {
+        value = (value << 1) | ((data[*bit / 8] >> (7 - *bit % 8)) & 1);
+    }
+    return (1 << zeros) - 1 + value;
+}
+
+/*
+ * True if frame most likely repeats the picture before it: every slice is a tiny P-slice, the size
+ * an encoder produces when it skips every macroblock. For H.264 the slice_type in the slice header
+ * has to say P as well, H.265 slices are only judged by their size.
+ */
+static bool
+raop_rtp_mirror_is_static(raop_rtp_mirror_frame_t *frame)
+{
+    bool slices = false;
+    if (frame->idr) {
+        return false;
+    }
+    for (int i = 0; i < frame->nal_count; i++) {
+        h264_nal_unit_t *nal = &frame->nal_units[i];
+        if (nal->size <= 0 || !video_nal_is_slice(frame->codec, nal->nal_type)) {
+            continue;
+        }
+        if (nal->size > RAOP_RTP_MIRROR_STATIC_SLICE_BYTES) {
+            return false;
+        }
+        if (frame->codec == VIDEO_CODEC_H264) {
+            // first_mb_in_slice, then slice_type, which is 0 or 5 for P
+            int bit = 8;
+            int slice_type = raop_rtp_mirror_read_ue(frame->data + nal->offset, nal->size, &bit) < 0 ? -1 :
+                             raop_rtp_mirror_read_ue(frame->data + nal->offset, nal->size, &bit);
+            if (slice_type % 5 != 0) {
+                return false;
+            }
+        }
+        slices = true;
+    }
+    return slices;
+}
+
+static void
+raop_rtp_mirror_process_video(raop_rtp_mirror_t *raop_rtp_mirror, raop_rtp_mirror_frame_t *frame)
+{
+    unsigned char *payload = frame->payload;
+    int payload_size = frame->payload_size;
+
+    // Conveniently, the video data is already stamped with the remote wall clock time,
+    // so no additional clock syncing needed. The only thing odd here is that the video
+    // ntp time stamps don't include the SECONDS_FROM_1900_TO_1970, so it's really just
+    // counting micro seconds since last boot.
+    uint64_t ntp_timestamp_raw = byteutils_get_long(frame->header, 8);
+    uint64_t ntp_timestamp_remote = raop_ntp_timestamp_to_micro_seconds(ntp_timestamp_raw, false);
+    uint64_t ntp_timestamp = raop_ntp_convert_remote_time(raop_rtp_mirror->ntp, ntp_timestamp_remote);
+
+    // Frames may have been lost before this one, continue the keystream where the sender says it is
+    if (frame->has_key_offset) {
+        mirror_buffer_seek(raop_rtp_mirror->buffer, frame->key_offset);
+    }
+
+    // Decrypt data in place, the encrypted payload is not needed afterwards
+    unsigned char* payload_decrypted = payload;
+    bool idr = raop_rtp_mirror_decrypt_nals(raop_rtp_mirror->buffer, payload_decrypted, payload_size, raop_rtp_mirror->codec,
+                                            frame->nal_units, &frame->nal_count);
+
+    frame->data = payload_decrypted;
+    frame->data_len = payload_size;
+    frame->frame_type = 1;
+    frame->pts = ntp_timestamp + raop_rtp_mirror->pts_offset;
+    frame->idr = idr;
+}
+
+/*
+ * An HEVCDecoderConfigurationRecord starts with version 1 like an avcC, but has its reserved bits in
+ * other places: the 6 bits above the avcC's NAL length size are set in every avcC, while in an hvcC
+ * the same byte is part of general_profile_compatibility_flags and the bits that must be set sit at
+ * bytes 13, 15, 16, 17 and 18.
+ */
+static bool
+raop_rtp_mirror_is_hvcc(const unsigned char *payload, int payload_size)
+{
+    if (payload_size < 23 || payload[0] != 1) {
+        return false;
+    }
+    if ((payload[4] & 0xfc) == 0xfc) {
+        return false;
+    }
+    return (payload[13] & 0xf0) == 0xf0 && (payload[15] & 0xfc) == 0xfc && (payload[16] & 0xfc) == 0xfc &&
+           (payload[17] & 0xf8) == 0xf8 && (payload[18] & 0xf8) == 0xf8;
+}
+
+/* Turns the VPS, SPS and PPS arrays of an hvcC into Annex-B NAL units for the decoder */
+static void
+raop_rtp_mirror_process_hvcc(raop_rtp_mirror_t *raop_rtp_mirror, raop_rtp_mirror_frame_t *frame)
+{
+    unsigned char *payload = frame->payload;
+    int payload_size = frame->payload_size;
+    int num_arrays = payload[22];
+    int data_len = 0;
+    int nal_count = 0;
+    int pos;
+
+    // First pass checks the bounds and sizes the Annex-B buffer
+    pos = 23;
+    for (int i = 0; i < num_arrays; i++) {
+        if (pos + 3 > payload_size) {
+            logger_log(raop_rtp_mirror->logger, LOGGER_ERR, "raop_rtp_mirror hvcC truncated");
+            return;
+        }
+        int num_nalus = byteutils_get_short_be(payload, pos + 1);
+        pos += 3;
+        for (int j = 0; j < num_nalus; j++) {
+            if (pos + 2 > payload_size) {
+                logger_log(raop_rtp_mirror->logger, LOGGER_ERR, "raop_rtp_mirror hvcC truncated");
+                return;
+            }
+            int nal_size = byteutils_get_short_be(payload, pos);
+            pos += 2;
+            if (pos + nal_size > payload_size) {
+                logger_log(raop_rtp_mirror->logger, LOGGER_ERR, "raop_rtp_mirror hvcC truncated");
+                return;
+            }
+            pos += nal_size;
+            data_len += nal_size + 4;
+        }
+    }
+    if (data_len == 0) {
+        return;
+    }
+
+    unsigned char *data = frame_pool_get(raop_rtp_mirror->frame_pool, data_len);
+    if (!data) {
+        return;
+    }
+    int offset = 0;
+    pos = 23;
+    for (int i = 0; i < num_arrays; i++) {
+        int num_nalus = byteutils_get_short_be(payload, pos + 1);
+        pos += 3;
+        for (int j = 0; j < num_nalus; j++) {
+            int nal_size = byteutils_get_short_be(payload, pos);
+            pos += 2;
+            data[offset + 0] = 0;
+            data[offset + 1] = 0;
+            data[offset + 2] = 0;
+            data[offset + 3] = 1;
+            memcpy(data + offset + 4, payload + pos, nal_size);
+            if (nal_count < H264_MAX_NAL_UNITS) {
+                frame->nal_units[nal_count].offset = offset + 4;
+                frame->nal_units[nal_count].size = nal_size;
+                frame->nal_units[nal_count].nal_type = nal_size > 0 ? video_nal_type(VIDEO_CODEC_H265, payload[pos]) : 0;
+            }
+            nal_count++;
+            offset += nal_size + 4;
+            pos += nal_size;
+        }
+    }
+    frame->nal_count = nal_count <= H264_MAX_NAL_UNITS ? nal_count : 0;
+    frame->data = data;
+    frame->data_len = data_len;
+    frame->frame_type = 0;
+    frame->pts = 0;
+}
+
+static void
+raop_rtp_mirror_process_codec(raop_rtp_mirror_t *raop_rtp_mirror, raop_rtp_mirror_frame_t *frame)
+{
+    unsigned char *payload = frame->payload;
+
+    // The information in the payload contains an SPS and a PPS NAL
+
+    float width_source = byteutils_get_float(frame->header, 40);
+    float height_source = byteutils_get_float(frame->header, 44);
+    float width = byteutils_get_float(frame->header, 56);
+    float height = byteutils_get_float(frame->header, 60);
+    LOGGER_LOG(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror width_source = %f height_source = %f width = %f height = %f",
+               width_source, height_source, width, height);
+    // A rotated device sends new codec data, the renderers reconfigure themselves once the decoder sees the new SPS
+    if (raop_rtp_mirror->width && ((int) width != raop_rtp_mirror->width || (int) height != raop_rtp_mirror->height)) {
+        logger_log(raop_rtp_mirror->logger, LOGGER_INFO, "raop_rtp_mirror picture size changed from %dx%d to %dx%d",
+                   raop_rtp_mirror->width, raop_rtp_mirror->height, (int) width, (int) height);
+    }
+    __atomic_store_n(&raop_rtp_mirror->width, (int) width, __ATOMIC_RELAXED);
+    __atomic_store_n(&raop_rtp_mirror->height, (int) height, __ATOMIC_RELAXED);
+
+    // The codec data is not encrypted, it is an hvcC when the sender mirrors in HEVC
+    video_codec_t codec = raop_rtp_mirror_is_hvcc(payload, frame->payload_size) ? VIDEO_CODEC_H265 : VIDEO_CODEC_H264;
+    if (codec != raop_rtp_mirror->codec) {
+        logger_log(raop_rtp_mirror->logger, LOGGER_INFO, "raop_rtp_mirror stream is %s",
+                   codec == VIDEO_CODEC_H265 ? "H.265" : "H.264");
+        raop_rtp_mirror->codec = codec;
+    }
+    if (codec == VIDEO_CODEC_H265) {
+        raop_rtp_mirror_process_hvcc(raop_rtp_mirror, frame);
+        return;
+    }
+
+    h264codec_t h264;
+    h264.version = payload[0];
+    h264.profile_high = payload[1];
+    h264.compatibility = payload[2];
+    h264.level = payload[3];
+    h264.reserved_6_and_nal = payload[4];
+    h264.reserved_3_and_sps = payload[5];
+    h264.sps_size = (short) (((payload[6] & 255) << 8) + (payload[7] & 255));
+    LOGGER_LOG(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror sps size = %d", h264.sps_size);
+    h264.sequence_parameter_set = payload + 8;
+    h264.number_of_pps = payload[h264.sps_size + 8];
+    h264.pps_size = (short) (((payload[h264.sps_size + 9] & 2040) + payload[h264.sps_size + 10]) & 255);
+    LOGGER_LOG(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror pps size = %d", h264.pps_size);
+    h264.picture_parameter_set = payload + h264.sps_size + 11;
+
+    if (h264.sps_size + h264.pps_size < 102400) {
+        // Copy the sps and pps into a buffer to hand to the decoder
+        int sps_pps_len = (h264.sps_size + h264.pps_size) + 8;
+        unsigned char *sps_pps = frame_pool_get(raop_rtp_mirror->frame_pool, sps_pps_len);
+        if (!sps_pps) {
+            return;
+        }
+        sps_pps[0] = 0;
+        sps_pps[1] = 0;
+        sps_pps[2] = 0;
+        sps_pps[3] = 1;
+        memcpy(sps_pps + 4, h264.sequence_parameter_set, h264.sps_size);
+        sps_pps[h264.sps_size + 4] = 0;
+        sps_pps[h264.sps_size + 5] = 0;
+        sps_pps[h264.sps_size + 6] = 0;
+        sps_pps[h264.sps_size + 7] = 1;
+        memcpy(sps_pps + h264.sps_size + 8, h264.picture_parameter_set, h264.pps_size);
+
+        frame->nal_units[0].offset = 4;
+        frame->nal_units[0].size = h264.sps_size;
+        frame->nal_units[0].nal_type = h264.sps_size > 0 ? h264.sequence_parameter_set[0] & 0x1f : 0;
+        frame->nal_units[1].offset = h264.sps_size + 8;
+        frame->nal_units[1].size = h264.pps_size;
+        frame->nal_units[1].nal_type = h264.pps_size > 0 ? h264.picture_parameter_set[0] & 0x1f : 0;
+        frame->nal_count = 2;
+
+        frame->data = sps_pps;
+        frame->data_len = sps_pps_len;
+        frame->frame_type = 0;
+        frame->pts = 0;
+    }
+}
+
+/**
+ * Mirror decrypt stage, turns received payloads into Annex-B access units
+ */
+/* Shares a decrypted frame with the frame bus subscribers, one copy for all of them */
+static void
+raop_rtp_mirror_publish_frame(raop_rtp_mirror_t *raop_rtp_mirror, raop_rtp_mirror_frame_t *frame)
+{
+    frame_bus_kind_t kind = frame->payload_type == 1 ? FRAME_BUS_CODEC : FRAME_BUS_VIDEO;
+    frame_bus_frame_t *shared;
+
+    if (!frame_bus_wants(raop_rtp_mirror->frame_bus, kind)) {
+        return;
+    }
+    shared = frame_bus_frame_create(kind, frame->data, frame->data_len, frame->pts);
+    if (!shared) {
+        return;
+    }
+    shared->keyframe = frame->idr;
+    shared->codec = frame->codec;
+    if (kind == FRAME_BUS_CODEC) {
+        shared->width = (int) byteutils_get_float(frame->header, 56);
+        shared->height = (int) byteutils_get_float(frame->header, 60);
+    }
+    shared->nal_count = frame->nal_count;
+    memcpy(shared->nal_units, frame->nal_units, frame->nal_count * sizeof(h264_nal_unit_t));
+    frame_bus_publish(raop_rtp_mirror->frame_bus, shared);
+}
+
+static void raop_rtp_mirror_process_progressive(raop_rtp_mirror_t *raop_rtp_mirror, raop_rtp_mirror_frame_t *frame);
+
+static THREAD_RETVAL
+raop_rtp_mirror_decrypt_thread(void *arg)
+{
+    raop_rtp_mirror_t *raop_rtp_mirror = arg;
+    raop_rtp_mirror_frame_t *frame;
+    assert(raop_rtp_mirror);
+
+    raop_rtp_mirror_pin_stage(raop_rtp_mirror, 1);
+    while ((frame = spsc_ring_pop_wait(raop_rtp_mirror->decrypt_queue)) != NULL) {
+        if (frame->progressive) {
+            // Goes to the renderer from here, it never reaches the submit stage
+            raop_rtp_mirror_process_progressive(raop_rtp_mirror, frame);
+            raop_rtp_mirror_count_faults(raop_rtp_mirror, 1);
+            continue;
+        }
+        frame->data = NULL;
+        frame->data_len = 0;
+        frame->idr = false;
+        frame->nal_count = 0;
+        if (frame->payload_type == 0) {
+            // Normal video data (VCL NAL)
+            raop_rtp_mirror_process_video(raop_rtp_mirror, frame);
+        } else if (frame->payload_type == 1) {
+            raop_rtp_mirror_process_codec(raop_rtp_mirror, frame);
+        }
+        frame->codec = raop_rtp_mirror->codec;
+        frame->decrypt_time = raop_ntp_get_local_time(raop_rtp_mirror->ntp);
+        if (frame->payload_type == 0 && frame->data) {
+            stream_frame_kind_t kind = frame->idr ? STREAM_FRAME_KEY :
+                                       raop_rtp_mirror_is_disposable(frame) ? STREAM_FRAME_DISPOSABLE : STREAM_FRAME_REFERENCE;
+            stream_estimator_add_frame(raop_rtp_mirror->estimator, frame->pts, frame->data_len, kind);
+        }
+        trace_event(TRACE_VIDEO_DECRYPTED, frame->data_len, frame->pts);
+        latency_histogram_record(raop_rtp_mirror->arrival_to_decrypt,
+                                 ((int64_t) frame->decrypt_time) - ((int64_t) frame->arrival_time));
+
+        if (frame->data) {
+            raop_rtp_mirror_publish_frame(raop_rtp_mirror, frame);
+        }
+
+        if (spsc_ring_push_wait(raop_rtp_mirror->submit_queue, frame) < 0) {
+            raop_rtp_mirror_release_frame(raop_rtp_mirror, frame);
+        } else {
+            raop_rtp_mirror->submit_pushed++;
+        }
+        raop_rtp_mirror_count_faults(raop_rtp_mirror, 1);
+    }
+
+    spsc_ring_close(raop_rtp_mirror->submit_queue);
+    LOGGER_LOG(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror exiting decrypt thread");
+    return 0;
+}
+
+/* Decides whether a decoded frame is too late to be worth rendering. Once a frame misses the
+ * latency budget, every following non-IDR frame is dropped until the next IDR, so the decoder
+ * never sees a frame whose reference is missing. AirPlay sends no B-frames, so the GOP boundary
+ * is always safe to resume from. Before the first IDR of the stream nothing is let through.
+ * A stream that is late but within budget is thinned instead: first by the frames the encoder
+ * marked disposable, then, if the sender's GOPs are short, by the end of each GOP, which only
+ * the rest of that GOP references. A stream the renderer shows out of focus, or received while
+ * the SoC runs warm, is always thinned like that, however late it is. */
+/* Takes in what the renderer reported, and skips to the next IDR if its decoder ran into errors
+ * since the last time, as every picture up to there predicts from a broken one */
+static void
+raop_rtp_mirror_update_renderer(raop_rtp_mirror_t *raop_rtp_mirror, const raop_renderer_stats_t *stats)
+{
+    raop_rtp_mirror->thin = stats->thin;
+    raop_rtp_mirror->priority = stats->priority;
+    // Less than before when the renderer went to another session in between
+    bool errors = raop_rtp_mirror->has_decode_errors && stats->decode_errors > raop_rtp_mirror->decode_errors;
+    raop_rtp_mirror->has_decode_errors = true;
+    raop_rtp_mirror->decode_errors = stats->decode_errors;
+    if (errors && raop_rtp_mirror->synced && !raop_rtp_mirror->catching_up) {
+        logger_log(raop_rtp_mirror->logger, LOGGER_INFO, "raop_rtp_mirror decoder reported errors, skipping to next IDR");
+        __atomic_fetch_add(&raop_rtp_mirror->decoder_resyncs, 1, __ATOMIC_RELAXED);
+        raop_rtp_mirror->catching_up = true;
+        raop_rtp_mirror->dropping_tail = false;
+    }
+}
+
+static bool
+raop_rtp_mirror_should_drop(raop_rtp_mirror_t *raop_rtp_mirror, raop_rtp_mirror_frame_t *frame)
+{
+    uint64_t latency_budget = __atomic_load_n(&raop_rtp_mirror->latency_budget, __ATOMIC_RELAXED);
+    thermal_level_t thermal_level = thermal_get_level(raop_rtp_mirror->thermal);
+
+    if (cpu_load_is_overloaded(raop_rtp_mirror->cpu_load) || thermal_level == THERMAL_HOT) {
+        // Late frames only queue up more work for a CPU that can't keep up
+        latency_budget = latency_budget ? latency_budget / 2 : RAOP_RTP_MIRROR_OVERLOAD_BUDGET;
+    }
+    if (frame->discontinuity && !frame->idr && raop_rtp_mirror->synced && !raop_rtp_mirror->catching_up) {
+        // A reference frame may be missing, nothing decodes cleanly until the next IDR
+        logger_log(raop_rtp_mirror->logger, LOGGER_INFO, "raop_rtp_mirror frames were lost, skipping to next IDR");
+        raop_rtp_mirror->catching_up = true;
+    }
+    // Codec data is never dropped, the decoder needs it for every following frame
+    if (frame->frame_type != 1) {
+        return false;
+    }
+    if (!raop_rtp_mirror->synced && !frame->idr) {
+        // After a (re)connect the decoder would only conceal errors until the first IDR
+        __atomic_store_n(&raop_rtp_mirror->unsynced_frames, raop_rtp_mirror->unsynced_frames + 1, __ATOMIC_RELAXED);
+        return true;
+    }
+    if (frame->idr) {
+        if (!raop_rtp_mirror->synced && raop_rtp_mirror->unsynced_frames) {
+            logger_log(raop_rtp_mirror->logger, LOGGER_INFO, "raop_rtp_mirror starting at IDR after holding back %llu frames",
+                       (unsigned long long) raop_rtp_mirror->unsynced_frames);
+        }
+        raop_rtp_mirror->synced = true;
+        if (raop_rtp_mirror->catching_up && !raop_rtp_mirror->dropping_tail) {
+            logger_log(raop_rtp_mirror->logger, LOGGER_INFO, "raop_rtp_mirror caught up at IDR after dropping %llu frames",
+                       (unsigned long long) raop_rtp_mirror->dropped_frames);
+        }
+        raop_rtp_mirror->catching_up = false;
+        raop_rtp_mirror->dropping_tail = false;
+        raop_rtp_mirror->gop_length = raop_rtp_mirror->gop_position;
+        raop_rtp_mirror->gop_position = 1;
+        return false;
+    }
+    int gop_position = raop_rtp_mirror->gop_position++;
+    if (!raop_rtp_mirror->catching_up && raop_rtp_mirror_is_static(frame)) {
+        __atomic_fetch_add(&raop_rtp_mirror->static_frames, 1, __ATOMIC_RELAXED);
+        // On a still slide most frames repeat the last picture. Those nothing predicts from needn't be
+        // decoded and composited again, the picture on screen already is the one they show.
+        if (raop_rtp_mirror->coalesce_static && raop_rtp_mirror_is_disposable(frame)) {
+            __atomic_fetch_add(&raop_rtp_mirror->static_drops, 1, __ATOMIC_RELAXED);
+            // Still counts as shown, the renderer isn't falling behind
+            stream_estimator_add_rendered(raop_rtp_mirror->estimator, frame->pts);
+            return true;
+        }
+    }
+    // A warm SoC decodes less to stay clear of throttling, which would cost far more frames
+    if (!raop_rtp_mirror->catching_up && (raop_rtp_mirror->thin || thermal_level >= THERMAL_WARM)) {
+        if (raop_rtp_mirror_is_disposable(frame)) {
+            __atomic_fetch_add(&raop_rtp_mirror->disposable_drops, 1, __ATOMIC_RELAXED);
+            return true;
+        }
+        int gop_length = raop_rtp_mirror->gop_length;
+        if (gop_length > 0 && gop_length <= RAOP_RTP_MIRROR_THIN_MAX_GOP &&
+            gop_position >= gop_length - gop_length / RAOP_RTP_MIRROR_THIN_TAIL_SHARE) {
+            raop_rtp_mirror->dropping_tail = true;
+            raop_rtp_mirror->catching_up = true;
+        }
+    }
+    if (!raop_rtp_mirror->catching_up) {
+        if (latency_budget == 0) {
+            return false;
+        }
+        int64_t latency = ((int64_t) raop_ntp_get_local_time(raop_rtp_mirror->ntp)) - ((int64_t) frame->pts);
+        if (raop_rtp_mirror->callbacks.video_get_stats) {
+            // The frame only shows once the renderer has worked through what it already holds
+            raop_renderer_stats_t stats;
+            memset(&stats, 0, sizeof(raop_renderer_stats_t));
+            raop_rtp_mirror->callbacks.video_get_stats(raop_rtp_mirror->callbacks.cls, &stats);
+            latency += (int64_t) stats.latency;
+            raop_rtp_mirror_update_renderer(raop_rtp_mirror, &stats);
+            if (raop_rtp_mirror->catching_up) {
+                __atomic_fetch_add(&raop_rtp_mirror->dropped_frames, 1, __ATOMIC_RELAXED);
+                return true;
+            }
+        }
+        if (latency <= (int64_t) latency_budget / 2) {
+            return false;
+        }
+        if (latency <= (int64_t) latency_budget) {
+            if (raop_rtp_mirror_is_disposable(frame)) {
+                __atomic_fetch_add(&raop_rtp_mirror->disposable_drops, 1, __ATOMIC_RELAXED);
+                return true;
+            }
+            int gop_length = raop_rtp_mirror->gop_length;
+            if (latency <= (int64_t) latency_budget * 3 / 4 || gop_length == 0 || gop_length > RAOP_RTP_MIRROR_THIN_MAX_GOP ||
+                gop_position < gop_length - gop_length / RAOP_RTP_MIRROR_THIN_TAIL_SHARE) {
+                return false;
+            }
+            // Only the rest of the GOP refers back to this frame, so it goes as well
+            LOGGER_LOG(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror latency %lld us, dropping the GOP from frame %d of %d",
+                       (long long) latency, gop_position, gop_length);
+            raop_rtp_mirror->dropping_tail = true;
+        } else {
+            logger_log(raop_rtp_mirror->logger, LOGGER_INFO, "raop_rtp_mirror latency %lld us over budget, skipping to next IDR",
+                       (long long) latency);
+            raop_rtp_mirror->dropping_tail = false;
+        }
+        raop_rtp_mirror->catching_up = true;
+    }
+    if (raop_rtp_mirror->dropping_tail) {
+        __atomic_fetch_add(&raop_rtp_mirror->tail_drops, 1, __ATOMIC_RELAXED);
+    } else {
+        __atomic_fetch_add(&raop_rtp_mirror->dropped_frames, 1, __ATOMIC_RELAXED);
+    }
+    return true;
+}
+
+static void
+raop_rtp_mirror_frame_release(void *opaque, unsigned char *buffer)
+{
+    frame_pool_put(opaque, buffer);
+}
+
+/* Hands data to the renderer, moving it out of frame if the renderer takes ownership */
+static int
+raop_rtp_mirror_process(raop_rtp_mirror_t *raop_rtp_mirror, raop_rtp_mirror_frame_t *frame, h264_decode_struct *h264_data)
+{
+    stream_frame_t *stream_frame;
+
+    if (!raop_rtp_mirror->callbacks.video_process_frame) {
+        return raop_rtp_mirror->callbacks.video_process(raop_rtp_mirror->callbacks.cls, raop_rtp_mirror->ntp, h264_data);
+    }
+    // data is either the pooled payload itself or a pooled rewrite of it, never renderer memory here
+    stream_frame = stream_frame_new(frame->data, frame->data, frame->data_len, frame->pts,
+                                    raop_rtp_mirror_frame_release, raop_rtp_mirror->frame_pool);
+    if (frame->data == frame->payload) {
+        frame->payload = NULL;
+    }
+    frame->data = NULL;
+    if (!stream_frame) {
+        logger_log(raop_rtp_mirror->logger, LOGGER_ERR, "raop_rtp_mirror could not allocate a stream frame");
+        return 0;
+    }
+    return raop_rtp_mirror->callbacks.video_process_frame(raop_rtp_mirror->callbacks.cls, raop_rtp_mirror->ntp,
+                                                          stream_frame, h264_data);
+}
+
+/**
+ * Samples how long after its pts the renderer's latest frame reached the display. The pts is
+ * the sender's capture time in our clock, so this is glass-to-glass minus the sender's encoder
+ */
+static void
+raop_rtp_mirror_sample_display(raop_rtp_mirror_t *raop_rtp_mirror)
+{
+    if (!raop_rtp_mirror->callbacks.video_get_stats) {
+        return;
+    }
+    raop_renderer_stats_t stats;
+    memset(&stats, 0, sizeof(raop_renderer_stats_t));
+    raop_rtp_mirror->callbacks.video_get_stats(raop_rtp_mirror->callbacks.cls, &stats);
+    raop_rtp_mirror_update_renderer(raop_rtp_mirror, &stats);
+    if (stats.has_display_offset) {
+        latency_histogram_record(raop_rtp_mirror->display_offset, stats.display_offset);
+        setup_timeline_mark(raop_rtp_mirror->setup_timeline, SETUP_FIRST_DISPLAY);
+    }
+}
+
+/* Fills in what the renderer gets of a frame that is not dropped, and counts the frame in its GOP */
+static void
+raop_rtp_mirror_prepare_submit(raop_rtp_mirror_t *raop_rtp_mirror, raop_rtp_mirror_frame_t *frame, h264_decode_struct *h264_data)
+{
+    memset(h264_data, 0, sizeof(h264_decode_struct));
+    h264_data->data_len = frame->data_len;
+    h264_data->data = frame->data;
+    h264_data->frame_type = frame->frame_type;
+    h264_data->codec = frame->codec;
+    h264_data->idr = frame->idr;
+    h264_data->pts = frame->pts;
+    h264_data->nal_count = frame->nal_count;
+    memcpy(h264_data->nal_units, frame->nal_units, frame->nal_count * sizeof(h264_nal_unit_t));
+    if (frame->frame_type == 1) {
+        if (frame->idr) {
+            raop_rtp_mirror->gop_index++;
+            raop_rtp_mirror->gop_frame = 0;
+        }
+        h264_data->n_gop_index = raop_rtp_mirror->gop_index;
+        h264_data->n_frame_poc = raop_rtp_mirror->gop_frame++;
+        stream_estimator_add_rendered(raop_rtp_mirror->estimator, frame->pts);
+    }
+}
+
+/* Passes bytes from to to of a progressive frame to the renderer as its next part, with the NALs first_nal to last_nal */
+static int
+raop_rtp_mirror_submit_part(raop_rtp_mirror_t *raop_rtp_mirror, raop_rtp_mirror_frame_t *frame, h264_decode_struct *h264_data,
+                            int from, int to, int first_nal, int last_nal, bool partial)
+{
+    h264_data->data = frame->data + from;
+    h264_data->data_len = to - from;
+    h264_data->nal_count = 0;
+    for (int i = first_nal; i < last_nal; i++) {
+        h264_data->nal_units[h264_data->nal_count] = frame->nal_units[i];
+        h264_data->nal_units[h264_data->nal_count++].offset -= from;
+    }
+    h264_data->partial = partial;
+    int ret = raop_rtp_mirror->callbacks.video_process_part(raop_rtp_mirror->callbacks.cls, raop_rtp_mirror->ntp, h264_data);
+    h264_data->part++;
+    return ret;
+}
+
+/*
+ * Decrypts a frame the receive stage is still reading and hands every run of complete NALs to
+ * video_process_part as soon as it is in, from the first slice on, which tells whether the frame is
+ * dropped. Does the submit stage's work for the frame too, once that stage has finished the frames
+ * ahead of it, so the renderer still gets frames in order and from one thread at a time.
+ */
+static void
+raop_rtp_mirror_process_progressive(raop_rtp_mirror_t *raop_rtp_mirror, raop_rtp_mirror_frame_t *frame)
+{
+    raop_rtp_mirror_nal_walk_t walk = { 0, 0, false, true };
+    h264_decode_struct h264_data;
+    int received = 0;
+    int decrypted = 0;
+    /* Bytes and NALs passed on so far, and whether the frame goes to the renderer, -1 until that is decided */
+    int sent = 0;
+    int sent_nals = 0;
+    int submit = -1;
+    uint64_t submit_duration = 0;
+
+    uint64_t ntp_timestamp_raw = byteutils_get_long(frame->header, 8);
+    uint64_t ntp_timestamp_remote = raop_ntp_timestamp_to_micro_seconds(ntp_timestamp_raw, false);
+    frame->pts = raop_ntp_convert_remote_time(raop_rtp_mirror->ntp, ntp_timestamp_remote) + raop_rtp_mirror->pts_offset;
+    frame->data = frame->payload;
+    frame->data_len = frame->payload_size;
+    frame->frame_type = 1;
+    frame->codec = raop_rtp_mirror->codec;
+    frame->idr = false;
+    frame->nal_count = 0;
+    mirror_buffer_seek(raop_rtp_mirror->buffer, frame->key_offset);
+
+    raop_rtp_mirror_wait_progress(raop_rtp_mirror, NULL, 0);
+    __atomic_fetch_add(&raop_rtp_mirror->progressive_frames, 1, __ATOMIC_RELAXED);
+
+    while (decrypted < frame->data_len) {
+        received = __atomic_load_n(&frame->received, __ATOMIC_SEQ_CST);
+        if (received < 0) {
+            break;
+        }
+        // Whole blocks of the keystream only, but for the end of the frame
+        int end = received == frame->data_len ? received :
+                  (int) (((frame->key_offset + received) & ~(uint64_t) 15) - frame->key_offset);
+        if (end <= decrypted) {
+            raop_rtp_mirror_wait_progress(raop_rtp_mirror, frame, received);
+            continue;
+        }
+        mirror_buffer_decrypt_in_place(raop_rtp_mirror->buffer, frame->data + decrypted, end - decrypted);
+        decrypted = end;
+        raop_rtp_mirror_walk_nals(&walk, frame->data, decrypted, frame->data_len, frame->codec, frame->nal_units);
+        if (submit == 0) {
+            continue;
+        }
+
+        // Up to the NAL the walk stopped in, unless that one is decrypted to its end too
+        bool complete = decrypted == frame->data_len;
+        int ready = sent;
+        int ready_nals = sent_nals;
+        if (complete) {
+            ready = frame->data_len;
+            ready_nals = walk.indexed ? MIN(walk.count, H264_MAX_NAL_UNITS) : sent_nals;
+        } else if (walk.indexed && walk.count > 0) {
+            if (walk.next <= decrypted) {
+                ready = walk.next;
+                ready_nals = walk.count;
+            } else {
+                ready = frame->nal_units[walk.count - 1].offset - 4;
+                ready_nals = walk.count - 1;
+            }
+        }
+
+        if (submit < 0) {
+            bool slice = false;
+            for (int i = 0; i < ready_nals && !slice; i++) {
+                slice = video_nal_is_slice(frame->codec, frame->nal_units[i].nal_type);
+            }
+            if (!slice && !complete) {
+                continue;
+            }
+            // Every slice of a picture is of the same kind, the first tells what the frame is
+            frame->idr = walk.idr;
+            frame->nal_count = ready_nals;
+            submit = !raop_rtp_mirror_should_drop(raop_rtp_mirror, frame);
+            if (!submit) {
+                continue;
+            }
+            raop_rtp_mirror_prepare_submit(raop_rtp_mirror, frame, &h264_data);
+            trace_event(TRACE_VIDEO_SUBMITTED, frame->data_len, frame->pts);
+            setup_timeline_mark(raop_rtp_mirror->setup_timeline, SETUP_FIRST_SUBMIT);
+        }
+
+        if (ready > sent || complete) {
+            uint64_t submit_time = raop_ntp_get_local_time(raop_rtp_mirror->ntp);
+            int ret = raop_rtp_mirror_submit_part(raop_rtp_mirror, frame, &h264_data, sent, ready, sent_nals, ready_nals, !complete);
+            submit_duration += raop_ntp_get_local_time(raop_rtp_mirror->ntp) - submit_time;
+            sent = ready;
+            sent_nals = ready_nals;
+            if (ret < 0) {
+                // Nothing more of the frame goes to the renderer
+                submit = 0;
+                if (!raop_rtp_mirror->catching_up) {
+                    logger_log(raop_rtp_mirror->logger, LOGGER_INFO, "raop_rtp_mirror renderer is busy, skipping to next IDR");
+                    raop_rtp_mirror->catching_up = true;
+                }
+            }
+        }
+    }
+
+    if (received < 0) {
+        // The renderer has the start of a picture that won't be complete, it ends there
+        if (submit > 0 && h264_data.part > 0) {
+            raop_rtp_mirror_submit_part(raop_rtp_mirror, frame, &h264_data, sent, sent, sent_nals, sent_nals, false);
+            logger_log(raop_rtp_mirror->logger, LOGGER_INFO, "raop_rtp_mirror frame cut off after %d bytes, skipping to next IDR", sent);
+            raop_rtp_mirror->catching_up = true;
+        }
+        raop_rtp_mirror_release_frame(raop_rtp_mirror, frame);
+        return;
+    }
+
+    frame->idr = walk.idr;
+    frame->nal_count = walk.indexed ? MIN(walk.count, H264_MAX_NAL_UNITS) : 0;
+    frame->decrypt_time = raop_ntp_get_local_time(raop_rtp_mirror->ntp);
+    stream_frame_kind_t kind = frame->idr ? STREAM_FRAME_KEY :
+                               raop_rtp_mirror_is_disposable(frame) ? STREAM_FRAME_DISPOSABLE : STREAM_FRAME_REFERENCE;
+    stream_estimator_add_frame(raop_rtp_mirror->estimator, frame->pts, frame->data_len, kind);
+    trace_event(TRACE_VIDEO_DECRYPTED, frame->data_len, frame->pts);
+    latency_histogram_record(raop_rtp_mirror->arrival_to_decrypt,
+                             ((int64_t) frame->decrypt_time) - ((int64_t) frame->arrival_time));
+    raop_rtp_mirror_publish_frame(raop_rtp_mirror, frame);
+    if (submit > 0) {
+        latency_histogram_record(raop_rtp_mirror->submit_duration, (int64_t) submit_duration);
+        raop_rtp_mirror_sample_display(raop_rtp_mirror);
+    }
+    raop_rtp_mirror_release_frame(raop_rtp_mirror, frame);
+}
+
+/**
+ * Mirror submit stage, the only one that may block in the renderer
+ */
+static THREAD_RETVAL
+raop_rtp_mirror_submit_thread(void *arg)
+{
+    raop_rtp_mirror_t *raop_rtp_mirror = arg;
+    raop_rtp_mirror_frame_t *frame;
+    assert(raop_rtp_mirror);
+
+    raop_rtp_mirror_pin_stage(raop_rtp_mirror, 2);
+    while ((frame = spsc_ring_pop_wait(raop_rtp_mirror->submit_queue)) != NULL) {
+        decode_scheduler_t *scheduler = frame->data ? raop_rtp_mirror->decode_scheduler : NULL;
+        if (scheduler) {
+            // Due by the end of the latency budget, which only a budget makes a frame miss
+            uint64_t budget = __atomic_load_n(&raop_rtp_mirror->latency_budget, __ATOMIC_RELAXED);
+            decode_scheduler_acquire(scheduler, frame->pts + budget, raop_rtp_mirror->priority);
+        }
+        if (frame->data && !raop_rtp_mirror_should_drop(raop_rtp_mirror, frame)) {
+            h264_decode_struct h264_data;
+            raop_rtp_mirror_prepare_submit(raop_rtp_mirror, frame, &h264_data);
+
+            uint64_t submit_time = raop_ntp_get_local_time(raop_rtp_mirror->ntp);
+            trace_event(TRACE_VIDEO_SUBMITTED, frame->data_len, frame->pts);
+            setup_timeline_mark(raop_rtp_mirror->setup_timeline, SETUP_FIRST_SUBMIT);
+            latency_histogram_record(raop_rtp_mirror->decrypt_to_submit,
+                                     ((int64_t) submit_time) - ((int64_t) frame->decrypt_time));
+
+            if (frame->payload_handle && frame->data == frame->payload) {
+                raop_rtp_mirror->callbacks.video_submit_buffer(raop_rtp_mirror->callbacks.cls, raop_rtp_mirror->ntp,
+                                                               frame->payload_handle, &h264_data);
+                // The renderer owns the buffer now
+                frame->payload_handle = NULL;
+                frame->payload = NULL;
+                frame->data = NULL;
+            } else if (raop_rtp_mirror_process(raop_rtp_mirror, frame, &h264_data) < 0 && !raop_rtp_mirror->catching_up) {
+                // The renderer is overloaded and may have decoded part of the frame, resync at the next IDR
+                logger_log(raop_rtp_mirror->logger, LOGGER_INFO, "raop_rtp_mirror renderer is busy, skipping to next IDR");
+                raop_rtp_mirror->catching_up = true;
+            }
+            latency_histogram_record(raop_rtp_mirror->submit_duration,
+                                     ((int64_t) raop_ntp_get_local_time(raop_rtp_mirror->ntp)) - ((int64_t) submit_time));
+            raop_rtp_mirror_sample_display(raop_rtp_mirror);
+        }
+        if (scheduler) {
+            decode_scheduler_release(scheduler);
+        }
+        raop_rtp_mirror_release_frame(raop_rtp_mirror, frame);
+        __atomic_fetch_add(&raop_rtp_mirror->submit_done, 1, __ATOMIC_SEQ_CST);
+        raop_rtp_mirror_signal_progress(raop_rtp_mirror);
+        raop_rtp_mirror_count_faults(raop_rtp_mirror, 2);
+    }
+
+    LOGGER_LOG(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror exiting submit thread");
+    return 0;
+}
+
+static int raop_rtp_init_mirror_sockets(raop_rtp_mirror_t *raop_rtp_mirror, int use_ipv6, int use_udp);
+
+void
+raop_rtp_start_mirror(raop_rtp_mirror_t *raop_rtp_mirror, int use_udp, unsigned short *mirror_data_lport)
+{
+    logger_log(raop_rtp_mirror->logger, LOGGER_INFO, "raop_rtp_mirror starting mirroring");
+    int use_ipv6 = 0;
+
+    assert(raop_rtp_mirror);
+
+    MUTEX_LOCK(raop_rtp_mirror->run_mutex);
+    if (THREAD_FLAG_LOAD(raop_rtp_mirror->running) || !raop_rtp_mirror->joined) {
+        MUTEX_UNLOCK(raop_rtp_mirror->run_mutex);
+        return;
+    }
+
+    if (raop_rtp_mirror->remote_saddr.ss_family == AF_INET6) {
+        use_ipv6 = 1;
+    }
+    raop_rtp_mirror->use_udp = use_udp;
+    raop_rtp_mirror->catching_up = false;
+    raop_rtp_mirror->dropping_tail = false;
+    raop_rtp_mirror->synced = false;
+    raop_rtp_mirror->gop_index = 0;
+    raop_rtp_mirror->gop_frame = 0;
+    raop_rtp_mirror->gop_position = 0;
+    raop_rtp_mirror->gop_length = 0;
+    raop_rtp_mirror->submit_pushed = 0;
+    __atomic_store_n(&raop_rtp_mirror->submit_done, 0, __ATOMIC_SEQ_CST);
+    if (!use_udp && !raop_rtp_mirror->recv_ring) {
+        recv_ring_t *ring = recv_ring_init(raop_rtp_mirror->logger, RAOP_RTP_MIRROR_RING_SIZE);
+        if (!ring) {
+            logger_log(raop_rtp_mirror->logger, LOGGER_ERR, "raop_rtp_mirror could not allocate the receive ring");
+            MUTEX_UNLOCK(raop_rtp_mirror->run_mutex);
+            return;
+        }
+        __atomic_store_n(&raop_rtp_mirror->recv_ring, ring, __ATOMIC_RELEASE);
+    }
+    if (raop_rtp_mirror->lock_memory) {
+        raop_rtp_mirror_prefault(raop_rtp_mirror);
+    }
+    if (raop_rtp_init_mirror_sockets(raop_rtp_mirror, use_ipv6, use_udp) < 0) {
+        logger_log(raop_rtp_mirror->logger, LOGGER_ERR, "raop_rtp_mirror initializing sockets failed");
+        MUTEX_UNLOCK(raop_rtp_mirror->run_mutex);
+        return;
+    }
+    if (mirror_data_lport) *mirror_data_lport = raop_rtp_mirror->mirror_data_lport;
+    raop_rtp_mirror->pts_offset = 0;
+    raop_rtp_mirror->codec = VIDEO_CODEC_H264;
+    raop_rtp_mirror_open_capture(raop_rtp_mirror, use_udp);
+
+    /* Create the threads and initialize running values */
+    THREAD_FLAG_STORE(raop_rtp_mirror->running, 1);
+    raop_rtp_mirror->joined = 0;
+
+    spsc_ring_reopen(raop_rtp_mirror->free_frames);
+    spsc_ring_reopen(raop_rtp_mirror->decrypt_queue);
+    spsc_ring_reopen(raop_rtp_mirror->submit_queue);
+    latency_histogram_reset(raop_rtp_mirror->receive_delay);
+    latency_histogram_reset(raop_rtp_mirror->arrival_to_decrypt);
+    latency_histogram_reset(raop_rtp_mirror->decrypt_to_submit);
+    latency_histogram_reset(raop_rtp_mirror->submit_duration);
+    latency_histogram_reset(raop_rtp_mirror->display_offset);
+    THREAD_CREATE(raop_rtp_mirror->thread_submit, raop_rtp_mirror_submit_thread, raop_rtp_mirror);
+    THREAD_CREATE(raop_rtp_mirror->thread_decrypt, raop_rtp_mirror_decrypt_thread, raop_rtp_mirror);
+    // The TCP stream waits for the later stages when they fall behind, only datagrams can go on the reactor
+    raop_rtp_mirror->reactor_receiving = false;
+    if (use_udp && raop_rtp_mirror->reactor) {
+        mirror_udp_buffer_flush(raop_rtp_mirror->udp_buffer);
+        raop_rtp_mirror->udp_dropped = false;
+        raop_rtp_mirror->reactor_receiving = session_reactor_add_fd(raop_rtp_mirror->reactor, raop_rtp_mirror->mirror_data_sock,
+                                                                    raop_rtp_mirror_reactor_read, raop_rtp_mirror) == 0;
+    }
+    if (raop_rtp_mirror->reactor_receiving) {
+        logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror receiving on the session reactor");
+    } else if (use_udp) {
+        THREAD_CREATE(raop_rtp_mirror->thread_mirror, raop_rtp_mirror_udp_thread, raop_rtp_mirror);
+    } else {
+        THREAD_CREATE(raop_rtp_mirror->thread_mirror, raop_rtp_mirror_thread, raop_rtp_mirror);
+    }
+    MUTEX_UNLOCK(raop_rtp_mirror->run_mutex);
+}
+
+static void
+raop_rtp_mirror_log_latency(raop_rtp_mirror_t *raop_rtp_mirror, const char *name, latency_histogram_stats_t *stats)
+{
+    if (stats->count == 0) {
+        return;
+    }
+    logger_log(raop_rtp_mirror->logger, LOGGER_INFO, "raop_rtp_mirror %s latency over %llu frames: p50 = %llu us, p95 = %llu us, p99 = %llu us, max = %llu us",
+               name, (unsigned long long) stats->count, (unsigned long long) stats->p50, (unsigned long long) stats->p95,
+               (unsigned long long) stats->p99, (unsigned long long) stats->max);
+}
+
+static void
+raop_rtp_mirror_log_stats(raop_rtp_mirror_t *raop_rtp_mirror)
+{
+    raop_rtp_mirror_stats_t stats;
+    raop_rtp_mirror_get_stats(raop_rtp_mirror, &stats);
+    LOGGER_LOG(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror decrypt queue peak = %u/%u, full = %llu; submit queue peak = %u/%u, full = %llu",
+               stats.decrypt_queue.peak_depth, stats.decrypt_queue.capacity, stats.decrypt_queue.full_count,
+               stats.submit_queue.peak_depth, stats.submit_queue.capacity, stats.submit_queue.full_count);
+    raop_rtp_mirror_log_latency(raop_rtp_mirror, "receive", &stats.receive_delay);
+    raop_rtp_mirror_log_latency(raop_rtp_mirror, "arrival to decrypt", &stats.arrival_to_decrypt);
+    raop_rtp_mirror_log_latency(raop_rtp_mirror, "decrypt to submit", &stats.decrypt_to_submit);
+    raop_rtp_mirror_log_latency(raop_rtp_mirror, "renderer submit", &stats.submit_duration);
+    raop_rtp_mirror_log_latency(raop_rtp_mirror, "glass-to-glass", &stats.display_offset);
+    if (stats.dropped_frames) {
+        logger_log(raop_rtp_mirror->logger, LOGGER_INFO, "raop_rtp_mirror dropped %llu late frames",
+                   (unsigned long long) stats.dropped_frames);
+    }
+    if (stats.stream.frame_rate > 0) {
+        logger_log(raop_rtp_mirror->logger, LOGGER_INFO, "raop_rtp_mirror stream at %.1f fps and %llu kbit/s, %.1f fps rendered%s, "
+                   "IDR every %.1f s, average frame %llu bytes for IDRs, %llu for reference and %llu for disposable frames",
+                   stats.stream.frame_rate, (unsigned long long) (stats.stream.bitrate / 1000), stats.stream.rendered_rate,
+                   stats.stream.falling_behind ? ", falling behind" : "", stats.stream.idr_interval / 1000000.0,
+                   (unsigned long long) stats.stream.frame_bytes[STREAM_FRAME_KEY],
+                   (unsigned long long) stats.stream.frame_bytes[STREAM_FRAME_REFERENCE],
+                   (unsigned long long) stats.stream.frame_bytes[STREAM_FRAME_DISPOSABLE]);
+    }
+    if (stats.decoder_resyncs) {
+        logger_log(raop_rtp_mirror->logger, LOGGER_INFO, "raop_rtp_mirror skipped to the next IDR %llu times after decoder errors",
+                   (unsigned long long) stats.decoder_resyncs);
+    }
+    if (stats.disposable_drops || stats.tail_drops) {
+        logger_log(raop_rtp_mirror->logger, LOGGER_INFO, "raop_rtp_mirror thinned %llu disposable frames and %llu from the ends of GOPs",
+                   (unsigned long long) stats.disposable_drops, (unsigned long long) stats.tail_drops);
+    }
+    if (stats.static_frames) {
+        logger_log(raop_rtp_mirror->logger, LOGGER_INFO, "raop_rtp_mirror %llu frames repeated the picture before them, %llu left out",
+                   (unsigned long long) stats.static_frames, (unsigned long long) stats.static_drops);
+    }
+    if (stats.progressive_frames) {
+        logger_log(raop_rtp_mirror->logger, LOGGER_INFO, "raop_rtp_mirror passed %llu frames on in parts as they arrived",
+                   (unsigned long long) stats.progressive_frames);
+    }
+}
+
+void raop_rtp_mirror_stop(raop_rtp_mirror_t *raop_rtp_mirror) {
+    assert(raop_rtp_mirror);
+
+    /* Check that the threads are not joined yet, the receive
+     * thread may already have stopped on its own */
+    MUTEX_LOCK(raop_rtp_mirror->run_mutex);
+    if (raop_rtp_mirror->joined) {
+        MUTEX_UNLOCK(raop_rtp_mirror->run_mutex);
+        return;
+    }
+    THREAD_FLAG_STORE(raop_rtp_mirror->running, 0);
+    /* A blocking read on the stream returns as soon as the socket is shut down */
+    if (raop_rtp_mirror->mirror_stream_sock != -1) {
+        shutdown(raop_rtp_mirror->mirror_stream_sock, SHUT_RDWR);
+    }
+    MUTEX_UNLOCK(raop_rtp_mirror->run_mutex);
+
+    /* Before the queues close, once it is removed the reactor won't queue another frame */
+    if (raop_rtp_mirror->reactor_receiving) {
+        session_reactor_remove_fd(raop_rtp_mirror->reactor, raop_rtp_mirror->mirror_data_sock);
+    }
+
+    uint64_t wake = 1;
+    if (write(raop_rtp_mirror->wake_fd, &wake, sizeof(wake)) < 0) {
+        logger_log(raop_rtp_mirror->logger, LOGGER_WARNING, "raop_rtp_mirror could not wake receive thread");
+    }
+
+    /* Wake up every stage waiting on a queue, queued frames are still drained */
+    spsc_ring_close(raop_rtp_mirror->free_frames);
+    spsc_ring_close(raop_rtp_mirror->decrypt_queue);
+    spsc_ring_close(raop_rtp_mirror->submit_queue);
+
+    /* Join the threads, the later stages exit once the earlier ones are done */
+    if (raop_rtp_mirror->reactor_receiving) {
+        raop_rtp_mirror_udp_finish(raop_rtp_mirror);
+        raop_rtp_mirror->reactor_receiving = false;
+    } else {
+        THREAD_JOIN(raop_rtp_mirror->thread_mirror);
+    }
+    THREAD_JOIN(raop_rtp_mirror->thread_decrypt);
+    THREAD_JOIN(raop_rtp_mirror->thread_submit);
+
+    if (raop_rtp_mirror->mirror_data_sock != -1) {
+        closesocket(raop_rtp_mirror->mirror_data_sock);
+        raop_rtp_mirror->mirror_data_sock = -1;
+    }
+    /* Consume the wakeup so the eventfd can be reused on the next start */
+    uint64_t value;
+    if (read(raop_rtp_mirror->wake_fd, &value, sizeof(value)) < 0) {
+        value = 0;
+    }
+
+    mirror_capture_close(raop_rtp_mirror->capture);
+    raop_rtp_mirror->capture = NULL;
+
+    raop_rtp_mirror_log_stats(raop_rtp_mirror);
+
+    /* Mark thread as joined */
+    MUTEX_LOCK(raop_rtp_mirror->run_mutex);
+    raop_rtp_mirror->joined = 1;
+    MUTEX_UNLOCK(raop_rtp_mirror->run_mutex);
+}
+
+int
+raop_rtp_mirror_replay(raop_rtp_mirror_t *raop_rtp_mirror, mirror_capture_reader_t *reader, int realtime)
+{
+    mirror_capture_frame_t capture_frame;
+    uint64_t first_arrival = 0;
+    uint64_t start_time = 0;
+    bool pts_set = false;
+    int frames = 0;
+    int ret;
+
+    assert(raop_rtp_mirror);
+    assert(reader);
+
+    MUTEX_LOCK(raop_rtp_mirror->run_mutex);
+    if (THREAD_FLAG_LOAD(raop_rtp_mirror->running) || !raop_rtp_mirror->joined) {
+        MUTEX_UNLOCK(raop_rtp_mirror->run_mutex);
+        return -1;
+    }
+    THREAD_FLAG_STORE(raop_rtp_mirror->running, 1);
+    raop_rtp_mirror->joined = 0;
+    raop_rtp_mirror->catching_up = false;
+    raop_rtp_mirror->dropping_tail = false;
+    raop_rtp_mirror->synced = false;
+    raop_rtp_mirror->gop_index = 0;
+    raop_rtp_mirror->gop_frame = 0;
+    raop_rtp_mirror->gop_position = 0;
+    raop_rtp_mirror->gop_length = 0;
+    raop_rtp_mirror->pts_offset = 0;
+    raop_rtp_mirror->codec = VIDEO_CODEC_H264;
+
+    spsc_ring_reopen(raop_rtp_mirror->free_frames);
+    spsc_ring_reopen(raop_rtp_mirror->decrypt_queue);
+    spsc_ring_reopen(raop_rtp_mirror->submit_queue);
+    latency_histogram_reset(raop_rtp_mirror->receive_delay);
+    latency_histogram_reset(raop_rtp_mirror->arrival_to_decrypt);
+    latency_histogram_reset(raop_rtp_mirror->decrypt_to_submit);
+    latency_histogram_reset(raop_rtp_mirror->submit_duration);
+    latency_histogram_reset(raop_rtp_mirror->display_offset);
+    THREAD_CREATE(raop_rtp_mirror->thread_submit, raop_rtp_mirror_submit_thread, raop_rtp_mirror);
+    THREAD_CREATE(raop_rtp_mirror->thread_decrypt, raop_rtp_mirror_decrypt_thread, raop_rtp_mirror);
+    MUTEX_UNLOCK(raop_rtp_mirror->run_mutex);
+
+    // The calling thread takes the place of the receive stage
+    while ((ret = mirror_capture_reader_next(reader, &capture_frame)) > 0) {
+        uint64_t now = raop_ntp_get_local_time(raop_rtp_mirror->ntp);
+        if (frames == 0) {
+            first_arrival = capture_frame.arrival_time;
+            start_time = now;
+        } else if (realtime) {
+            // Keep the spacing the frames originally arrived with
+            int64_t wait = ((int64_t) (capture_frame.arrival_time - first_arrival)) - ((int64_t) (now - start_time));
+            if (wait > 0) {
+                usleep(wait);
+            }
+        }
+
+        raop_rtp_mirror_frame_t *frame = spsc_ring_pop_wait(raop_rtp_mirror->free_frames);
+        if (frame == NULL) {
+            break;
+        }
+        memcpy(frame->header, capture_frame.header, 128);
+        frame->payload_size = capture_frame.payload_size;
+        frame->payload_type = byteutils_get_short(frame->header, 4) & 0xff;
+        frame->payload_handle = NULL;
+        frame->payload = frame_pool_get(raop_rtp_mirror->frame_pool, frame->payload_size);
+        if (frame->payload == NULL ||
+            mirror_capture_reader_payload(reader, frame->payload, capture_frame.payload_size) < 0) {
+            logger_log(raop_rtp_mirror->logger, LOGGER_ERR, "raop_rtp_mirror could not read frame %d of the capture", frames);
+            raop_rtp_mirror_release_frame(raop_rtp_mirror, frame);
+            ret = -1;
+            break;
+        }
+        frame->has_key_offset = capture_frame.has_key_offset;
+        frame->key_offset = capture_frame.key_offset;
+        frame->discontinuity = capture_frame.discontinuity;
+
+        now = raop_ntp_get_local_time(raop_rtp_mirror->ntp);
+        if (frame->payload_type == 0 && !pts_set) {
+            // The sender's clock is long gone, make the first frame due now
+            uint64_t ntp_timestamp_remote = raop_ntp_timestamp_to_micro_seconds(byteutils_get_long(frame->header, 8), false);
+            raop_rtp_mirror->pts_offset = ((int64_t) now) -
+                                          ((int64_t) raop_ntp_convert_remote_time(raop_rtp_mirror->ntp, ntp_timestamp_remote));
+            pts_set = true;
+        }
+        frame->arrival_time = now;
+        trace_event(TRACE_VIDEO_RECEIVED, frame->payload_size, frame->payload_type);
+
+        if (spsc_ring_push_wait(raop_rtp_mirror->decrypt_queue, frame) < 0) {
+            raop_rtp_mirror_release_frame(raop_rtp_mirror, frame);
+            break;
+        }
+        frames++;
+    }
+    if (ret < 0) {
+        logger_log(raop_rtp_mirror->logger, LOGGER_ERR, "raop_rtp_mirror capture is truncated or corrupt");
+    }
+
+    /* Let the later stages drain and exit */
+    spsc_ring_close(raop_rtp_mirror->decrypt_queue);
+    THREAD_JOIN(raop_rtp_mirror->thread_decrypt);
+    THREAD_JOIN(raop_rtp_mirror->thread_submit);
+
+    logger_log(raop_rtp_mirror->logger, LOGGER_INFO, "raop_rtp_mirror replayed %d frames", frames);
+    raop_rtp_mirror_log_stats(raop_rtp_mirror);
+
+    MUTEX_LOCK(raop_rtp_mirror->run_mutex);
+    THREAD_FLAG_STORE(raop_rtp_mirror->running, 0);
+    raop_rtp_mirror->joined = 1;
+    MUTEX_UNLOCK(raop_rtp_mirror->run_mutex);
+    return ret < 0 ? -1 : frames;
+}
+
+bool
+raop_rtp_mirror_is_falling_behind(raop_rtp_mirror_t *raop_rtp_mirror)
+{
+    assert(raop_rtp_mirror);
+    return stream_estimator_is_falling_behind(raop_rtp_mirror->estimator);
+}
+
+void
+raop_rtp_mirror_get_stats(raop_rtp_mirror_t *raop_rtp_mirror, raop_rtp_mirror_stats_t *stats)
+{
+    assert(raop_rtp_mirror);
+    assert(stats);
+
+    memset(stats, 0, sizeof(raop_rtp_mirror_stats_t));
+    spsc_ring_get_stats(raop_rtp_mirror->decrypt_queue, &stats->decrypt_queue);
+    spsc_ring_get_stats(raop_rtp_mirror->submit_queue, &stats->submit_queue);
+    frame_pool_get_stats(raop_rtp_mirror->frame_pool, &stats->frame_pool);
+    latency_histogram_get_stats(raop_rtp_mirror->receive_delay, &stats->receive_delay);
+    latency_histogram_get_stats(raop_rtp_mirror->arrival_to_decrypt, &stats->arrival_to_decrypt);
+    latency_histogram_get_stats(raop_rtp_mirror->decrypt_to_submit, &stats->decrypt_to_submit);
+    latency_histogram_get_stats(raop_rtp_mirror->submit_duration, &stats->submit_duration);
+    latency_histogram_get_stats(raop_rtp_mirror->display_offset, &stats->display_offset);
+    stats->dropped_frames = __atomic_load_n(&raop_rtp_mirror->dropped_frames, __ATOMIC_RELAXED);
+    stats->disposable_drops = __atomic_load_n(&raop_rtp_mirror->disposable_drops, __ATOMIC_RELAXED);
+    stream_estimator_get_stats(raop_rtp_mirror->estimator, &stats->stream);
+    stats->tail_drops = __atomic_load_n(&raop_rtp_mirror->tail_drops, __ATOMIC_RELAXED);
+    stats->static_frames = __atomic_load_n(&raop_rtp_mirror->static_frames, __ATOMIC_RELAXED);
+    stats->static_drops = __atomic_load_n(&raop_rtp_mirror->static_drops, __ATOMIC_RELAXED);
+    stats->unsynced_frames = __atomic_load_n(&raop_rtp_mirror->unsynced_frames, __ATOMIC_RELAXED);
+    stats->decoder_resyncs = __atomic_load_n(&raop_rtp_mirror->decoder_resyncs, __ATOMIC_RELAXED);
+    stats->heartbeats = __atomic_load_n(&raop_rtp_mirror->heartbeats, __ATOMIC_RELAXED);
+    stats->reports = __atomic_load_n(&raop_rtp_mirror->reports, __ATOMIC_RELAXED);
+    stats->unknown_packets = __atomic_load_n(&raop_rtp_mirror->unknown_packets, __ATOMIC_RELAXED);
+    stats->over_budget_frames = __atomic_load_n(&raop_rtp_mirror->over_budget_frames, __ATOMIC_RELAXED);
+    stats->queue_full_frames = __atomic_load_n(&raop_rtp_mirror->queue_full_frames, __ATOMIC_RELAXED);
+    stats->reconnects = __atomic_load_n(&raop_rtp_mirror->reconnects, __ATOMIC_RELAXED);
+    stats->parallel_decrypts = mirror_buffer_get_parallel_frames(raop_rtp_mirror->buffer);
+    stats->progressive_frames = __atomic_load_n(&raop_rtp_mirror->progressive_frames, __ATOMIC_RELAXED);
+    stats->received_frames = __atomic_load_n(&raop_rtp_mirror->received_frames, __ATOMIC_RELAXED);
+    stats->received_bytes = __atomic_load_n(&raop_rtp_mirror->received_bytes, __ATOMIC_RELAXED);
+    stats->width = __atomic_load_n(&raop_rtp_mirror->width, __ATOMIC_RELAXED);
+    stats->height = __atomic_load_n(&raop_rtp_mirror->height, __ATOMIC_RELAXED);
+    uint64_t first_arrival = __atomic_load_n(&raop_rtp_mirror->first_arrival, __ATOMIC_RELAXED);
+    uint64_t last_arrival = __atomic_load_n(&raop_rtp_mirror->last_arrival, __ATOMIC_RELAXED);
+    stats->stream_time = last_arrival > first_arrival ? last_arrival - first_arrival : 0;
+    stats->peak_bitrate = __atomic_load_n(&raop_rtp_mirror->peak_bitrate, __ATOMIC_RELAXED);
+    recv_ring_t *ring = __atomic_load_n(&raop_rtp_mirror->recv_ring, __ATOMIC_ACQUIRE);
+    if (ring) {
+        recv_ring_get_stats(ring, &stats->recv_ring);
+    }
+    stats->ring_frames = __atomic_load_n(&raop_rtp_mirror->ring_frames, __ATOMIC_RELAXED);
+    for (int i = 0; i < 3; i++) {
+        stats->minor_faults += __atomic_load_n(&raop_rtp_mirror->page_faults[i][0], __ATOMIC_RELAXED);
+        stats->major_faults += __atomic_load_n(&raop_rtp_mirror->page_faults[i][1], __ATOMIC_RELAXED);
+    }
+}
+
+void raop_rtp_mirror_destroy(raop_rtp_mirror_t *raop_rtp_mirror) {
+    if (raop_rtp_mirror) {
+        raop_rtp_mirror_stop(raop_rtp_mirror);
+        MUTEX_DESTROY(raop_rtp_mirror->run_mutex);
+        MUTEX_DESTROY(raop_rtp_mirror->progress_mutex);
+        MUTEX_DESTROY(raop_rtp_mirror->free_frames_mutex);
+        COND_DESTROY(raop_rtp_mirror->progress_cond);
+        mirror_buffer_destroy(raop_rtp_mirror->buffer);
+
+        frame_pool_stats_t stats;
+        frame_pool_get_stats(raop_rtp_mirror->frame_pool, &stats);
+        LOGGER_LOG(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror frame pool hits = %llu, misses = %llu, peak buffers = %u, peak bytes = %zu",
+                   (unsigned long long) stats.hits, (unsigned long long) stats.misses, stats.peak_buffers, stats.peak_bytes);
+        if (raop_rtp_mirror->recv_ring) {
+            recv_ring_stats_t ring_stats;
+            recv_ring_get_stats(raop_rtp_mirror->recv_ring, &ring_stats);
+            LOGGER_LOG(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror receive ring reads = %llu, bytes = %llu, frames in place = %llu, peak bytes = %zu/%zu",
+                       (unsigned long long) ring_stats.reads, (unsigned long long) ring_stats.read_bytes,
+                       (unsigned long long) raop_rtp_mirror->ring_frames, ring_stats.peak_used, ring_stats.capacity);
+        }
+        raop_rtp_mirror_destroy_queues(raop_rtp_mirror);
+        mirror_udp_buffer_destroy(raop_rtp_mirror->udp_buffer);
+        frame_pool_destroy(raop_rtp_mirror->frame_pool);
+        recv_ring_destroy(raop_rtp_mirror->recv_ring);
+        close(raop_rtp_mirror->wake_fd);
+        free(raop_rtp_mirror->capture_dir);
+        free(raop_rtp_mirror);
+    }
+}
+
+static int
+raop_rtp_init_mirror_sockets(raop_rtp_mirror_t *raop_rtp_mirror, int use_ipv6, int use_udp)
+{
+    int dsock = -1;
+    unsigned short dport = 0;
 
-    dsock = netutils_init_socket(&dport, use_ipv6, 0);
+    assert(raop_rtp_mirror);
+
+    dsock = netutils_init_socket(&dport, use_ipv6, use_udp);
     if (dsock == -1) {
         goto sockets_cleanup;
     }
 
+    /* Before listen, a TCP receive buffer only gets its window scale from the handshake */
+    netutils_tune_socket(raop_rtp_mirror->logger, dsock, NETUTILS_SOCKET_MIRROR, "raop_rtp_mirror data");
+    if (netutils_enable_timestamps(dsock) < 0) {
+        logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror no kernel receive timestamps");
+    }
+
     /* Listen to the data socket if using TCP */
-    if (listen(dsock, 1) < 0) {
+    if (!use_udp && listen(dsock, 1) < 0) {
         goto sockets_cleanup;
     }
 
@@ -16,21 +16,151 @@
 #define RAOP_RTP_MIRROR_H
 
 #include <stdint.h>
+#include <stdbool.h>
 #include "raop.h"
 #include "logger.h"
 #include "raop_ntp.h"
+#include "frame_pool.h"
+#include "recv_ring.h"
+#include "spsc_ring.h"
+#include "latency_histogram.h"
+#include "mirror_capture.h"
+#include "frame_bus.h"
+#include "stream.h"
+#include "setup_timeline.h"
+#include "cpu_load.h"
+#include "thermal.h"
+#include "decode_scheduler.h"
+#include "task_pool.h"
+#include "stream_estimator.h"
+#include "mirror_buffer.h"
+#include "session_reactor.h"
+
+/* Smallest frame passed on in parts with progressive video, smaller ones arrive within a few ms */
+#define RAOP_RTP_MIRROR_PROGRESSIVE_MIN (64 * 1024)
 
 typedef struct raop_rtp_mirror_s raop_rtp_mirror_t;
 typedef struct h264codec_s h264codec_t;
 
+typedef struct {
+    /* Frames waiting for the decrypt and the submit stage */
+    spsc_ring_stats_t decrypt_queue;
+    spsc_ring_stats_t submit_queue;
+    frame_pool_stats_t frame_pool;
+    /* Reads of the TCP stream, and frames whose payload was used where it was received */
+    recv_ring_stats_t recv_ring;
+    uint64_t ring_frames;
+    /* Frames and payload bytes received */
+    uint64_t received_frames;
+    uint64_t received_bytes;
+    /* Late frames skipped while catching up to the next IDR */
+    uint64_t dropped_frames;
+    /* Frames dropped while running late within budget: disposable ones, and the ends of GOPs */
+    uint64_t disposable_drops;
+    uint64_t tail_drops;
+    /* Frames that repeat the picture before them, and those of them left out with coalesce_static */
+    uint64_t static_frames;
+    uint64_t static_drops;
+    /* Frames held back before the first IDR of the stream, nothing could decode them */
+    uint64_t unsynced_frames;
+    /* Times the renderer's decoder reported errors and the stream skipped to the next IDR */
+    uint64_t decoder_resyncs;
+    /* Packets besides video and codec data: heartbeats, stream reports and types nothing handles */
+    uint64_t heartbeats;
+    uint64_t reports;
+    uint64_t unknown_packets;
+    /* Frames dropped because their payload would have gone over the memory budget */
+    uint64_t over_budget_frames;
+    /* Frames the session reactor dropped because the decrypt stage had no room for them */
+    uint64_t queue_full_frames;
+    /* Times the sender connected the stream again after it was cut off */
+    uint64_t reconnects;
+    /* Frames large enough to be decrypted by several threads */
+    uint64_t parallel_decrypts;
+    /* Frames passed to the renderer in parts while they were still arriving */
+    uint64_t progressive_frames;
+    /* Page faults taken by the receive, decrypt and submit stages, the last includes the renderer */
+    uint64_t minor_faults;
+    uint64_t major_faults;
+    /* Size the sender encodes at from its last codec packet, 0 until one arrived */
+    int width;
+    int height;
+    /* From the first frame received to the last in us, and the highest bitrate over a second in bit/s */
+    uint64_t stream_time;
+    uint64_t peak_bitrate;
+    /* Bitrate, frame rate and frame sizes as the sender encodes them, and what the renderer keeps up with */
+    stream_estimator_stats_t stream;
+    /* Time from the kernel receiving a frame to the receive stage reading it, from full receipt to
+     * decryption, from decryption to the renderer call and spent inside the renderer call, in microseconds */
+    latency_histogram_stats_t receive_delay;
+    latency_histogram_stats_t arrival_to_decrypt;
+    latency_histogram_stats_t decrypt_to_submit;
+    latency_histogram_stats_t submit_duration;
+    /* From the sender's pts to the display, sampled from the renderer after every submitted frame,
+     * empty unless the renderer reports when its frames are shown */
+    latency_histogram_stats_t display_offset;
+} raop_rtp_mirror_stats_t;
+
 raop_rtp_mirror_t *raop_rtp_mirror_init(logger_t *logger, raop_callbacks_t *callbacks, raop_ntp_t *ntp,
                                         const unsigned char *remote, int remotelen,
                                         const unsigned char *aeskey, const unsigned char *ecdh_secret);
 void raop_rtp_init_mirror_aes(raop_rtp_mirror_t *raop_rtp_mirror, uint64_t streamConnectionID);
+void raop_rtp_mirror_set_latency_budget(raop_rtp_mirror_t *raop_rtp_mirror, unsigned int latency_budget_ms);
+/* Bytes of frame buffers the session may hold, 0 is unlimited, drawn from shared as well unless it is NULL.
+ * Frames that don't fit are dropped and decoding resumes at the next IDR. Set before starting. */
+void raop_rtp_mirror_set_memory_budget(raop_rtp_mirror_t *raop_rtp_mirror, size_t max_bytes, mem_budget_t *shared);
+/* Records every following session to a new file in capture_dir, NULL stops recording */
+void raop_rtp_mirror_set_capture_dir(raop_rtp_mirror_t *raop_rtp_mirror, const char *capture_dir);
+/* Publishes every decrypted frame on bus as well, which the caller keeps alive, NULL stops it */
+void raop_rtp_mirror_set_frame_bus(raop_rtp_mirror_t *raop_rtp_mirror, frame_bus_t *frame_bus);
+/* Marks the mirror connection, first frame received, submitted and shown on timeline, which the caller keeps alive */
+void raop_rtp_mirror_set_setup_timeline(raop_rtp_mirror_t *raop_rtp_mirror, setup_timeline_t *setup_timeline);
+/* Pins the receive stage to cpu and the decrypt and submit stages to the next ones, set before starting */
+void raop_rtp_mirror_set_cpu(raop_rtp_mirror_t *raop_rtp_mirror, int cpu);
+/* Drops late frames sooner while cpu_load, which the caller keeps alive, reports an overload */
+void raop_rtp_mirror_set_cpu_load(raop_rtp_mirror_t *raop_rtp_mirror, cpu_load_t *cpu_load);
+/* Thins the stream while thermal, which the caller keeps alive, is warm, and drops late frames sooner while it is hot */
+void raop_rtp_mirror_set_thermal(raop_rtp_mirror_t *raop_rtp_mirror, thermal_t *thermal);
+/* Takes turns with the other sessions on scheduler, which the caller keeps alive, to hand frames to the renderer.
+ * A frame that had to wait is checked against the latency budget once it has its turn. Set before starting */
+void raop_rtp_mirror_set_decode_scheduler(raop_rtp_mirror_t *raop_rtp_mirror, decode_scheduler_t *scheduler);
+/* Receives a stream over UDP on reactor, which the caller keeps alive, instead of a thread. Set before starting */
+void raop_rtp_mirror_set_reactor(raop_rtp_mirror_t *raop_rtp_mirror, session_reactor_t *reactor);
+/* Faults in and locks the frame buffers and receive ring as the stream starts, set before starting */
+void raop_rtp_mirror_set_lock_memory(raop_rtp_mirror_t *raop_rtp_mirror, int enabled);
+/* Leaves out frames that repeat the picture before them where nothing references them */
+void raop_rtp_mirror_set_coalesce_static(raop_rtp_mirror_t *raop_rtp_mirror, int enabled);
+/* Passes frames of RAOP_RTP_MIRROR_PROGRESSIVE_MIN bytes and more received over TCP to video_process_part
+ * as their NALs arrive, if that callback is set. Set before starting. */
+void raop_rtp_mirror_set_progressive(raop_rtp_mirror_t *raop_rtp_mirror, int enabled);
+/* Chunks of large frames such as IDRs that the workers of pool decrypt besides the decrypt stage, set before starting */
+void raop_rtp_mirror_set_decrypt_workers(raop_rtp_mirror_t *raop_rtp_mirror, task_pool_t *pool, int workers);
 void raop_rtp_start_mirror(raop_rtp_mirror_t *raop_rtp_mirror, int use_udp, unsigned short *mirror_data_lport);
 
-static int raop_rtp_init_mirror_sockets(raop_rtp_mirror_t *raop_rtp_mirror, int use_ipv6);
+/**
+ * Feeds a capture through the decrypt and submit stages in place of a socket, at the pace it was
+ * recorded at if realtime is set, otherwise as fast as the renderer takes it. The key material
+ * from the capture header must have been passed to init and init_mirror_aes. Blocks until the
+ * capture is done, returns the number of frames replayed or -1 on error.
+ */
+int raop_rtp_mirror_replay(raop_rtp_mirror_t *raop_rtp_mirror, mirror_capture_reader_t *reader, int realtime);
+
+/*
+ * Replaces the 4-byte length in front of every NAL of a decrypted frame with an Annex-B start code
+ * and indexes the NALs into nal_units, which holds H264_MAX_NAL_UNITS. Returns whether the frame
+ * holds a slice decoding can start at, IDR for H.264 and IRAP for H.265.
+ */
+bool raop_rtp_mirror_rewrite_nals(unsigned char *data, int data_len, video_codec_t codec, h264_nal_unit_t *nal_units, int *nal_count);
+/*
+ * Decrypts a frame in place with buffer and rewrites its NALs as raop_rtp_mirror_rewrite_nals does, in
+ * one pass of cache sized chunks. Frames buffer splits between its workers are decrypted first instead.
+ */
+bool raop_rtp_mirror_decrypt_nals(mirror_buffer_t *buffer, unsigned char *data, int data_len, video_codec_t codec,
+                                  h264_nal_unit_t *nal_units, int *nal_count);
 
+void raop_rtp_mirror_get_stats(raop_rtp_mirror_t *raop_rtp_mirror, raop_rtp_mirror_stats_t *stats);
+/* The renderer was given markedly fewer frames than the sender encoded over the last seconds */
+bool raop_rtp_mirror_is_falling_behind(raop_rtp_mirror_t *raop_rtp_mirror);
 void raop_rtp_mirror_stop(raop_rtp_mirror_t *raop_rtp_mirror);
 void raop_rtp_mirror_destroy(raop_rtp_mirror_t *raop_rtp_mirror);
 #endif //RAOP_RTP_MIRROR_H
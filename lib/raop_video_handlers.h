@@ -0,0 +1,264 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+/* This file should be only included from raop.c after raop_handlers.h, as it
+ * defines static handler functions and depends on raop internals */
+
+/*
+ * The HTTP requests of video URL playback on the airplay port. The sender
+ * hands over the URL of what it would otherwise decode and mirror, then
+ * controls and polls the playback, the receiver fetches the stream itself.
+ * Times are in seconds. The video_url callbacks are called under video_mutex.
+ */
+
+/* Whether url is path, with or without a query */
+static bool
+raop_video_path_is(const char *url, const char *path)
+{
+    size_t len = strlen(path);
+    return !strncmp(url, path, len) && (url[len] == '\0' || url[len] == '?');
+}
+
+/* The value of name in the query of url, e.g. position in /scrub?position=12.5. Returns false if it has none */
+static bool
+raop_video_query_double(const char *url, const char *name, double *value)
+{
+    const char *query = strchr(url, '?');
+    size_t len = strlen(name);
+
+    while (query) {
+        query++;
+        if (!strncmp(query, name, len) && query[len] == '=') {
+            *value = strtod(query + len + 1, NULL);
+            return true;
+        }
+        query = strchr(query, '&');
+    }
+    return false;
+}
+
+/* The value of a "Name: value" line of a text/parameters body, NULL if there is none. Freed by the caller */
+static char *
+raop_video_parameter(const char *data, int datalen, const char *name)
+{
+    const char *end = data + datalen;
+    size_t len = strlen(name);
+
+    for (const char *line = data; line < end; ) {
+        const char *eol = memchr(line, '\n', end - line);
+        if (!eol) eol = end;
+        if ((size_t) (eol - line) > len + 1 && !strncasecmp(line, name, len) && line[len] == ':') {
+            const char *value = line + len + 1;
+            const char *value_end = eol;
+            while (value < value_end && isspace((unsigned char) *value)) value++;
+            while (value_end > value && isspace((unsigned char) value_end[-1])) value_end--;
+            return strndup(value, value_end - value);
+        }
+        line = eol + 1;
+    }
+    return NULL;
+}
+
+static void
+raop_video_handler_server_info(raop_conn_t *conn,
+                               http_request_t *request, http_response_t *response,
+                               char **response_data, int *response_datalen)
+{
+    raop_t *raop = conn->raop;
+    plist_t r_node = plist_new_dict();
+
+    if (raop->dnssd) {
+        int hw_addr_raw_len = 0;
+        const char *hw_addr_raw = dnssd_get_hw_addr(raop->dnssd, &hw_addr_raw_len);
+        char *hw_addr = calloc(1, 3 * hw_addr_raw_len);
+        if (hw_addr && utils_hwaddr_airplay(hw_addr, 3 * hw_addr_raw_len, hw_addr_raw, hw_addr_raw_len) > 0) {
+            plist_dict_set_item(r_node, "deviceid", plist_new_string(hw_addr));
+            plist_dict_set_item(r_node, "macAddress", plist_new_string(hw_addr));
+        }
+        free(hw_addr);
+    }
+    plist_dict_set_item(r_node, "features", plist_new_uint(AIRPLAY_FEATURES | AIRPLAY_FEATURES_VIDEO_URL));
+    plist_dict_set_item(r_node, "model", plist_new_string(GLOBAL_MODEL));
+    plist_dict_set_item(r_node, "protovers", plist_new_string("1.0"));
+    plist_dict_set_item(r_node, "srcvers", plist_new_string(AIRPLAY_SRCVERS));
+
+    plist_to_xml(r_node, response_data, (uint32_t *) response_datalen);
+    plist_free(r_node);
+    http_response_add_header(response, "Content-Type", "text/x-apple-plist+xml");
+}
+
+static void
+raop_video_handler_play(raop_conn_t *conn,
+                        http_request_t *request, http_response_t *response,
+                        char **response_data, int *response_datalen)
+{
+    raop_t *raop = conn->raop;
+    const char *content_type = http_request_get_known_header(request, HTTP_HEADER_CONTENT_TYPE);
+    const char *data;
+    int datalen;
+    char *location = NULL;
+    double start_seconds = 0.0, start_fraction = 0.0;
+
+    data = http_request_get_data(request, &datalen);
+    if (!data || datalen <= 0) {
+        logger_log(raop->logger, LOGGER_ERR, "Video URL play request without a body");
+        return;
+    }
+    if (content_type && !strcmp(content_type, "application/x-apple-binary-plist")) {
+        plist_t root = NULL;
+        plist_from_bin(data, datalen, &root);
+        if (root) {
+            plist_t node = plist_dict_get_item(root, "Content-Location");
+            if (node && plist_get_node_type(node) == PLIST_STRING) {
+                plist_get_string_val(node, &location);
+            }
+            node = plist_dict_get_item(root, "Start-Position-Seconds");
+            if (node && plist_get_node_type(node) == PLIST_REAL) {
+                plist_get_real_val(node, &start_seconds);
+            }
+            node = plist_dict_get_item(root, "Start-Position");
+            if (node && plist_get_node_type(node) == PLIST_REAL) {
+                plist_get_real_val(node, &start_fraction);
+            }
+            plist_free(root);
+        }
+    } else {
+        /* Older senders send text/parameters */
+        location = raop_video_parameter(data, datalen, "Content-Location");
+        char *position = raop_video_parameter(data, datalen, "Start-Position");
+        if (position) {
+            start_fraction = strtod(position, NULL);
+            free(position);
+        }
+    }
+
+    if (!location) {
+        logger_log(raop->logger, LOGGER_ERR, "Video URL play request without a Content-Location");
+        return;
+    }
+    /* Streams the sender only describes over the reverse connection, such as mlhls://, can't be fetched */
+    if (strncmp(location, "http://", 7) && strncmp(location, "https://", 8)) {
+        logger_log(raop->logger, LOGGER_WARNING, "Not playing %s, only http and https URLs are fetched", location);
+        free(location);
+        return;
+    }
+    logger_log(raop->logger, LOGGER_INFO, "Playing video URL %s", location);
+    MUTEX_LOCK(raop->video_mutex);
+    raop->callbacks.video_url_play(raop->callbacks.cls, location, start_seconds, start_fraction);
+    raop->video_conn = conn;
+    MUTEX_UNLOCK(raop->video_mutex);
+    free(location);
+}
+
+static void
+raop_video_handler_scrub(raop_conn_t *conn,
+                         http_request_t *request, http_response_t *response,
+                         char **response_data, int *response_datalen)
+{
+    raop_t *raop = conn->raop;
+    const char *url = http_request_get_url(request);
+    raop_video_playback_t playback;
+    double position;
+
+    if (!strcmp(http_request_get_method(request), "POST")) {
+        if (raop_video_query_double(url, "position", &position)) {
+            MUTEX_LOCK(raop->video_mutex);
+            raop->callbacks.video_url_scrub(raop->callbacks.cls, position);
+            MUTEX_UNLOCK(raop->video_mutex);
+        }
+        return;
+    }
+
+    memset(&playback, 0, sizeof(playback));
+    MUTEX_LOCK(raop->video_mutex);
+    raop->callbacks.video_url_get_playback(raop->callbacks.cls, &playback);
+    MUTEX_UNLOCK(raop->video_mutex);
+    *response_data = malloc(64);
+    if (*response_data) {
+        *response_datalen = snprintf(*response_data, 64, "duration: %f\r\nposition: %f\r\n",
+                                     playback.duration, playback.position);
+        http_response_add_header(response, "Content-Type", "text/parameters");
+    }
+}
+
+static void
+raop_video_handler_rate(raop_conn_t *conn,
+                        http_request_t *request, http_response_t *response,
+                        char **response_data, int *response_datalen)
+{
+    raop_t *raop = conn->raop;
+    double rate;
+
+    if (raop_video_query_double(http_request_get_url(request), "value", &rate)) {
+        MUTEX_LOCK(raop->video_mutex);
+        raop->callbacks.video_url_rate(raop->callbacks.cls, rate);
+        MUTEX_UNLOCK(raop->video_mutex);
+    }
+}
+
+static void
+raop_video_handler_stop(raop_conn_t *conn,
+                        http_request_t *request, http_response_t *response,
+                        char **response_data, int *response_datalen)
+{
+    raop_t *raop = conn->raop;
+
+    logger_log(raop->logger, LOGGER_INFO, "Stopping the video URL");
+    MUTEX_LOCK(raop->video_mutex);
+    raop->callbacks.video_url_stop(raop->callbacks.cls);
+    raop->video_conn = NULL;
+    MUTEX_UNLOCK(raop->video_mutex);
+}
+
+/* A time range of playback-info, everything from the start to duration once the stream is loaded */
+static plist_t
+raop_video_time_ranges(double duration)
+{
+    plist_t ranges = plist_new_array();
+    plist_t range = plist_new_dict();
+    plist_dict_set_item(range, "start", plist_new_real(0.0));
+    plist_dict_set_item(range, "duration", plist_new_real(duration));
+    plist_array_append_item(ranges, range);
+    return ranges;
+}
+
+static void
+raop_video_handler_playback_info(raop_conn_t *conn,
+                                 http_request_t *request, http_response_t *response,
+                                 char **response_data, int *response_datalen)
+{
+    raop_t *raop = conn->raop;
+    raop_video_playback_t playback;
+    int playing;
+
+    memset(&playback, 0, sizeof(playback));
+    MUTEX_LOCK(raop->video_mutex);
+    playing = raop->callbacks.video_url_get_playback(raop->callbacks.cls, &playback) == 0;
+    MUTEX_UNLOCK(raop->video_mutex);
+
+    plist_t r_node = plist_new_dict();
+    /* Senders stop polling and end their session once nothing is ready to play */
+    plist_dict_set_item(r_node, "readyToPlay", plist_new_bool(playing && playback.ready_to_play));
+    if (playing) {
+        plist_dict_set_item(r_node, "duration", plist_new_real(playback.duration));
+        plist_dict_set_item(r_node, "position", plist_new_real(playback.position));
+        plist_dict_set_item(r_node, "rate", plist_new_real(playback.rate));
+        plist_dict_set_item(r_node, "playbackBufferEmpty", plist_new_bool(!playback.ready_to_play));
+        plist_dict_set_item(r_node, "playbackBufferFull", plist_new_bool(0));
+        plist_dict_set_item(r_node, "playbackLikelyToKeepUp", plist_new_bool(playback.ready_to_play));
+        plist_dict_set_item(r_node, "loadedTimeRanges", raop_video_time_ranges(playback.duration));
+        plist_dict_set_item(r_node, "seekableTimeRanges", raop_video_time_ranges(playback.duration));
+    }
+    plist_to_xml(r_node, response_data, (uint32_t *) response_datalen);
+    plist_free(r_node);
+    http_response_add_header(response, "Content-Type", "text/x-apple-plist+xml");
+}
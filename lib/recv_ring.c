@@ -0,0 +1,268 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+
+#include "recv_ring.h"
+#include "netutils.h"
+#include "utils.h"
+
+struct recv_ring_s {
+    logger_t *logger;
+
+    unsigned char *buffer;
+    size_t capacity;
+    /* buffer is followed by a second mapping of itself */
+    bool mirrored;
+    /* Locked in memory by recv_ring_prefault */
+    bool locked;
+
+    /* Stream positions, received and consumed are only written by the receiving thread */
+    uint64_t received;
+    uint64_t consumed;
+    uint64_t released;
+
+    uint64_t reads;
+    uint64_t read_bytes;
+    size_t peak_used;
+};
+
+/* Maps the same pages twice in a row, so reads and writes may run past the end */
+static unsigned char *
+recv_ring_map_mirrored(size_t capacity)
+{
+#if defined(__linux__) && defined(SYS_memfd_create)
+    int fd = (int) syscall(SYS_memfd_create, "rp-recv-ring", 1 /* MFD_CLOEXEC */);
+    if (fd < 0) {
+        return NULL;
+    }
+    if (ftruncate(fd, (off_t) capacity) < 0) {
+        close(fd);
+        return NULL;
+    }
+    // Reserve both halves first, so nothing else can take the second one
+    unsigned char *base = mmap(NULL, 2 * capacity, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) {
+        close(fd);
+        return NULL;
+    }
+    if (mmap(base, capacity, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+        mmap(base + capacity, capacity, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        munmap(base, 2 * capacity);
+        close(fd);
+        return NULL;
+    }
+    close(fd);
+    return base;
+#else
+    (void) capacity;
+    return NULL;
+#endif
+}
+
+recv_ring_t *
+recv_ring_init(logger_t *logger, size_t capacity)
+{
+    recv_ring_t *ring;
+    size_t size = (size_t) sysconf(_SC_PAGESIZE);
+
+    while (size < capacity) {
+        size <<= 1;
+    }
+    ring = calloc(1, sizeof(recv_ring_t));
+    if (!ring) {
+        return NULL;
+    }
+    ring->logger = logger;
+    ring->capacity = size;
+    ring->buffer = recv_ring_map_mirrored(size);
+    ring->mirrored = ring->buffer != NULL;
+    if (!ring->buffer) {
+        logger_log(logger, LOGGER_DEBUG, "recv_ring could not map %zu bytes twice, messages that wrap get copied", size);
+        ring->buffer = malloc(size);
+        if (!ring->buffer) {
+            free(ring);
+            return NULL;
+        }
+    }
+    return ring;
+}
+
+size_t
+recv_ring_space(recv_ring_t *ring)
+{
+    return ring->capacity - (size_t) (ring->received - __atomic_load_n(&ring->released, __ATOMIC_ACQUIRE));
+}
+
+size_t
+recv_ring_available(recv_ring_t *ring)
+{
+    return (size_t) (ring->received - ring->consumed);
+}
+
+int
+recv_ring_fill(recv_ring_t *ring, int fd, size_t want, uint64_t *timestamp)
+{
+    unsigned char control[NETUTILS_TIMESTAMP_CONTROL_SIZE];
+    struct iovec iov[2];
+    struct msghdr msg;
+    size_t space = recv_ring_space(ring);
+    size_t offset = (size_t) (ring->received & (ring->capacity - 1));
+    size_t len = space;
+    int flags = 0;
+    int ret;
+
+    assert(want > 0 && want <= space);
+    if (want > RECV_RING_BATCH_SIZE) {
+        len = want;
+        flags = MSG_WAITALL;
+    }
+
+    memset(&msg, 0, sizeof(msg));
+    iov[0].iov_base = ring->buffer + offset;
+    iov[0].iov_len = len;
+    msg.msg_iovlen = 1;
+    if (!ring->mirrored && offset + len > ring->capacity) {
+        iov[0].iov_len = ring->capacity - offset;
+        iov[1].iov_base = ring->buffer;
+        iov[1].iov_len = len - iov[0].iov_len;
+        msg.msg_iovlen = 2;
+    }
+    msg.msg_iov = iov;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    do {
+        ret = recvmsg(fd, &msg, flags);
+    } while (ret < 0 && errno == EINTR);
+    if (ret <= 0) {
+        return ret;
+    }
+
+    __atomic_store_n(&ring->received, ring->received + ret, __ATOMIC_RELAXED);
+    *timestamp = netutils_get_timestamp(&msg);
+    __atomic_store_n(&ring->reads, ring->reads + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&ring->read_bytes, ring->read_bytes + ret, __ATOMIC_RELAXED);
+    size_t used = ring->capacity - recv_ring_space(ring);
+    if (used > ring->peak_used) {
+        __atomic_store_n(&ring->peak_used, used, __ATOMIC_RELAXED);
+    }
+    return ret;
+}
+
+unsigned char *
+recv_ring_peek(recv_ring_t *ring, size_t len)
+{
+    size_t offset = (size_t) (ring->consumed & (ring->capacity - 1));
+
+    assert(len <= recv_ring_available(ring));
+    if (!ring->mirrored && offset + len > ring->capacity) {
+        return NULL;
+    }
+    return ring->buffer + offset;
+}
+
+size_t
+recv_ring_read(recv_ring_t *ring, unsigned char *buf, size_t len)
+{
+    size_t offset = (size_t) (ring->consumed & (ring->capacity - 1));
+    size_t available = recv_ring_available(ring);
+
+    if (len > available) {
+        len = available;
+    }
+    if (ring->mirrored || offset + len <= ring->capacity) {
+        memcpy(buf, ring->buffer + offset, len);
+    } else {
+        size_t first = ring->capacity - offset;
+        memcpy(buf, ring->buffer + offset, first);
+        memcpy(buf + first, ring->buffer, len - first);
+    }
+    ring->consumed += len;
+    return len;
+}
+
+void
+recv_ring_consume(recv_ring_t *ring, size_t len)
+{
+    assert(len <= recv_ring_available(ring));
+    ring->consumed += len;
+}
+
+void
+recv_ring_discard(recv_ring_t *ring)
+{
+    ring->consumed = ring->received;
+}
+
+uint64_t
+recv_ring_position(recv_ring_t *ring)
+{
+    return ring->consumed;
+}
+
+void
+recv_ring_release(recv_ring_t *ring, uint64_t position)
+{
+    assert(position >= __atomic_load_n(&ring->released, __ATOMIC_RELAXED));
+    __atomic_store_n(&ring->released, position, __ATOMIC_RELEASE);
+}
+
+void
+recv_ring_get_stats(recv_ring_t *ring, recv_ring_stats_t *stats)
+{
+    memset(stats, 0, sizeof(recv_ring_stats_t));
+    stats->capacity = ring->capacity;
+    stats->mirrored = ring->mirrored;
+    stats->reads = __atomic_load_n(&ring->reads, __ATOMIC_RELAXED);
+    stats->read_bytes = __atomic_load_n(&ring->read_bytes, __ATOMIC_RELAXED);
+    // Released first, it can't overtake what was received before
+    uint64_t released = __atomic_load_n(&ring->released, __ATOMIC_ACQUIRE);
+    stats->used = (size_t) (__atomic_load_n(&ring->received, __ATOMIC_RELAXED) - released);
+    stats->peak_used = __atomic_load_n(&ring->peak_used, __ATOMIC_RELAXED);
+}
+
+int
+recv_ring_prefault(recv_ring_t *ring, int lock)
+{
+    // The second mapping shares its pages with the first
+    if (utils_prefault(ring->buffer, ring->capacity, lock) < 0) {
+        return -1;
+    }
+    ring->locked = lock;
+    return 0;
+}
+
+void
+recv_ring_destroy(recv_ring_t *ring)
+{
+    if (ring) {
+        if (ring->mirrored) {
+            munmap(ring->buffer, 2 * ring->capacity);
+        } else {
+            if (ring->locked) {
+                munlock(ring->buffer, ring->capacity);
+            }
+            free(ring->buffer);
+        }
+        free(ring);
+    }
+}
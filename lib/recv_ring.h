@@ -0,0 +1,83 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#ifndef RECV_RING_H
+#define RECV_RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "logger.h"
+
+/*
+ * Receive buffer for a TCP stream of length-prefixed messages. It is filled
+ * with reads as large as the free space, so several small messages come in
+ * one call, and the messages are parsed where they landed. On Linux the
+ * ring is mapped twice back to back, so every message is contiguous even
+ * where it wraps around.
+ *
+ * Bytes go through three positions, all counted from the start of the
+ * stream: received, consumed by the parser and released. Consumed bytes
+ * stay valid until they are released, which may happen on another thread
+ * but has to happen in stream order. Everything else is for the receiving
+ * thread only.
+ */
+
+typedef struct recv_ring_s recv_ring_t;
+
+typedef struct {
+    size_t capacity;
+    bool mirrored;
+    /* Reads from the socket and the bytes they returned */
+    uint64_t reads;
+    uint64_t read_bytes;
+    /* Bytes received but not released yet, and their high-water mark */
+    size_t used;
+    size_t peak_used;
+} recv_ring_stats_t;
+
+/* capacity is rounded up to a power of two of at least a page */
+recv_ring_t *recv_ring_init(logger_t *logger, size_t capacity);
+/* Touches every page of the ring and, if lock is set, locks them in memory. -1 if they could not be locked */
+int recv_ring_prefault(recv_ring_t *ring, int lock);
+
+/*
+ * Receives into the free space, which must hold want bytes. Wants up to
+ * RECV_RING_BATCH_SIZE take whatever the socket has, larger ones wait for
+ * exactly want bytes in a single call. Returns the number of bytes read,
+ * 0 at the end of the stream and -1 on error. timestamp is set to when the
+ * kernel received the last of them, 0 if it doesn't tell.
+ */
+#define RECV_RING_BATCH_SIZE 65536
+int recv_ring_fill(recv_ring_t *ring, int fd, size_t want, uint64_t *timestamp);
+
+/* Bytes received but not consumed, and room for more */
+size_t recv_ring_available(recv_ring_t *ring);
+size_t recv_ring_space(recv_ring_t *ring);
+
+/* The next len unconsumed bytes in one piece, NULL if they wrap around a ring that is not mirrored */
+unsigned char *recv_ring_peek(recv_ring_t *ring, size_t len);
+/* Copies out and consumes up to len bytes, returns how many */
+size_t recv_ring_read(recv_ring_t *ring, unsigned char *buf, size_t len);
+void recv_ring_consume(recv_ring_t *ring, size_t len);
+/* Consumes everything received, for a stream that ended */
+void recv_ring_discard(recv_ring_t *ring);
+/* Position after the last consumed byte, to be released once the data up to there is done with */
+uint64_t recv_ring_position(recv_ring_t *ring);
+
+/* Frees the space up to position, positions must be released in increasing order */
+void recv_ring_release(recv_ring_t *ring, uint64_t position);
+
+void recv_ring_get_stats(recv_ring_t *ring, recv_ring_stats_t *stats);
+void recv_ring_destroy(recv_ring_t *ring);
+
+#endif //RECV_RING_H
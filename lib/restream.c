@@ -0,0 +1,306 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <assert.h>
+
+#include <openssl/rand.h>
+
+#include "restream.h"
+#include "compat.h"
+#include "byteutils.h"
+
+/* Keeps packets under a 1500 byte MTU with room for IP, UDP and tunnel headers */
+#define RESTREAM_MAX_PAYLOAD 1400
+#define RESTREAM_MAX_PARAMETER_SET 256
+
+#define NAL_TYPE_IDR 5
+#define NAL_TYPE_SPS 7
+#define NAL_TYPE_PPS 8
+#define NAL_TYPE_FU_A 28
+
+struct restream_s {
+    logger_t *logger;
+    mutex_handle_t mutex;
+
+    /* MUTEX LOCKED VARIABLES START */
+    int socks[RESTREAM_MAX_DESTINATIONS];
+    int sock_count;
+
+    uint16_t seqnum;
+    uint32_t ssrc;
+
+    /* Last SPS and PPS seen, sent again in front of every IDR frame */
+    unsigned char sps[RESTREAM_MAX_PARAMETER_SET];
+    int sps_len;
+    unsigned char pps[RESTREAM_MAX_PARAMETER_SET];
+    int pps_len;
+
+    unsigned char packet[12 + 2 + RESTREAM_MAX_PAYLOAD];
+    restream_stats_t stats;
+    /* MUTEX LOCKED VARIABLES END */
+};
+
+/* Walks the NAL units of a frame, through its index if it has one and by start codes otherwise */
+typedef struct {
+    const unsigned char *data;
+    int data_len;
+    const h264_nal_unit_t *nal_units;
+    int nal_count;
+    int position;
+} restream_nal_iter_t;
+
+static bool
+restream_nal_next(restream_nal_iter_t *iter, int *offset, int *size)
+{
+    if (iter->nal_count > 0) {
+        if (iter->position >= iter->nal_count) {
+            return false;
+        }
+        *offset = iter->nal_units[iter->position].offset;
+        *size = iter->nal_units[iter->position].size;
+        iter->position++;
+        return true;
+    }
+
+    const unsigned char *data = iter->data;
+    int i = iter->position;
+    while (i + 3 <= iter->data_len && !(data[i] == 0 && data[i + 1] == 0 && data[i + 2] == 1)) {
+        i++;
+    }
+    if (i + 3 >= iter->data_len) {
+        iter->position = iter->data_len;
+        return false;
+    }
+    int start = i + 3;
+    int end = start;
+    while (end + 3 <= iter->data_len && !(data[end] == 0 && data[end + 1] == 0 && data[end + 2] <= 1)) {
+        end++;
+    }
+    if (end + 3 > iter->data_len) {
+        end = iter->data_len;
+    }
+    iter->position = end;
+    *offset = start;
+    *size = end - start;
+    return *size > 0;
+}
+
+restream_t *
+restream_init(logger_t *logger)
+{
+    restream_t *restream = calloc(1, sizeof(restream_t));
+    if (!restream) {
+        return NULL;
+    }
+    restream->logger = logger;
+    RAND_bytes((unsigned char *) &restream->seqnum, sizeof(restream->seqnum));
+    RAND_bytes((unsigned char *) &restream->ssrc, sizeof(restream->ssrc));
+    MUTEX_CREATE(restream->mutex);
+    return restream;
+}
+
+int
+restream_add_destination(restream_t *restream, const char *host, unsigned short port)
+{
+    struct addrinfo hints;
+    struct addrinfo *result;
+    char service[8];
+    int sock;
+
+    assert(restream);
+    assert(host);
+
+    MUTEX_LOCK(restream->mutex);
+    if (restream->sock_count >= RESTREAM_MAX_DESTINATIONS) {
+        MUTEX_UNLOCK(restream->mutex);
+        logger_log(restream->logger, LOGGER_ERR, "restream supports at most %d destinations", RESTREAM_MAX_DESTINATIONS);
+        return -1;
+    }
+    MUTEX_UNLOCK(restream->mutex);
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    snprintf(service, sizeof(service), "%u", port);
+    if (getaddrinfo(host, service, &hints, &result) != 0) {
+        logger_log(restream->logger, LOGGER_ERR, "restream could not resolve %s", host);
+        return -1;
+    }
+    sock = socket(result->ai_family, SOCK_DGRAM, IPPROTO_UDP);
+    if (sock < 0 || connect(sock, result->ai_addr, result->ai_addrlen) < 0) {
+        logger_log(restream->logger, LOGGER_ERR, "restream could not open a socket to %s:%u", host, port);
+        if (sock >= 0) {
+            closesocket(sock);
+        }
+        freeaddrinfo(result);
+        return -1;
+    }
+    freeaddrinfo(result);
+
+    MUTEX_LOCK(restream->mutex);
+    restream->socks[restream->sock_count++] = sock;
+    MUTEX_UNLOCK(restream->mutex);
+    logger_log(restream->logger, LOGGER_INFO, "restream sending RTP to %s:%u", host, port);
+    return 0;
+}
+
+int
+restream_get_destination_count(restream_t *restream)
+{
+    int count;
+    assert(restream);
+    MUTEX_LOCK(restream->mutex);
+    count = restream->sock_count;
+    MUTEX_UNLOCK(restream->mutex);
+    return count;
+}
+
+static void
+restream_send_packet(restream_t *restream, int payload_len, uint32_t rtp_time, bool marker)
+{
+    unsigned char *packet = restream->packet;
+    packet[0] = 0x80;
+    packet[1] = (marker ? 0x80 : 0x00) | RESTREAM_PAYLOAD_TYPE;
+    byteutils_put_short_be(packet, 2, restream->seqnum++);
+    byteutils_put_int_be(packet, 4, rtp_time);
+    byteutils_put_int_be(packet, 8, restream->ssrc);
+
+    for (int i = 0; i < restream->sock_count; i++) {
+        // Never block the mirror pipeline on a slow destination
+        if (send(restream->socks[i], packet, 12 + payload_len, MSG_DONTWAIT) < 0) {
+            restream->stats.send_errors++;
+        }
+    }
+    restream->stats.packets++;
+    restream->stats.bytes += 12 + payload_len;
+}
+
+static void
+restream_send_nal(restream_t *restream, const unsigned char *nal, int size, uint32_t rtp_time, bool last)
+{
+    unsigned char *payload = restream->packet + 12;
+
+    if (size <= RESTREAM_MAX_PAYLOAD) {
+        memcpy(payload, nal, size);
+        restream_send_packet(restream, size, rtp_time, last);
+        return;
+    }
+
+    /* FU-A: the NAL header is split over the FU indicator and the FU header of every fragment */
+    unsigned char indicator = (nal[0] & 0xe0) | NAL_TYPE_FU_A;
+    unsigned char type = nal[0] & 0x1f;
+    const unsigned char *data = nal + 1;
+    int remaining = size - 1;
+    bool first = true;
+    while (remaining > 0) {
+        int chunk = remaining > RESTREAM_MAX_PAYLOAD - 2 ? RESTREAM_MAX_PAYLOAD - 2 : remaining;
+        bool end = chunk == remaining;
+        payload[0] = indicator;
+        payload[1] = (first ? 0x80 : 0x00) | (end ? 0x40 : 0x00) | type;
+        memcpy(payload + 2, data, chunk);
+        restream_send_packet(restream, chunk + 2, rtp_time, last && end);
+        data += chunk;
+        remaining -= chunk;
+        first = false;
+    }
+}
+
+static void
+restream_keep_parameter_set(unsigned char *dest, int *dest_len, const unsigned char *nal, int size)
+{
+    if (size <= RESTREAM_MAX_PARAMETER_SET) {
+        memcpy(dest, nal, size);
+        *dest_len = size;
+    }
+}
+
+void
+restream_send_frame(restream_t *restream, const unsigned char *data, int data_len,
+                    const h264_nal_unit_t *nal_units, int nal_count, uint64_t pts)
+{
+    restream_nal_iter_t iter = { data, data_len, nal_units, nal_count, 0 };
+    uint32_t rtp_time = (uint32_t) (pts * 9 / 100);
+    bool sent_parameter_sets = false;
+    int offset, size;
+    /* Held back until the next NAL unit shows whether it ends the frame and needs the marker */
+    const unsigned char *pending = NULL;
+    int pending_size = 0;
+
+    assert(restream);
+
+    MUTEX_LOCK(restream->mutex);
+    if (restream->sock_count == 0) {
+        MUTEX_UNLOCK(restream->mutex);
+        return;
+    }
+
+    while (restream_nal_next(&iter, &offset, &size)) {
+        const unsigned char *nal = data + offset;
+        int type = nal[0] & 0x1f;
+
+        // Parameter sets, such as the codec packet is made of, only go out in front of IDR frames
+        if (type == NAL_TYPE_SPS) {
+            restream_keep_parameter_set(restream->sps, &restream->sps_len, nal, size);
+            continue;
+        } else if (type == NAL_TYPE_PPS) {
+            restream_keep_parameter_set(restream->pps, &restream->pps_len, nal, size);
+            continue;
+        }
+
+        if (pending) {
+            restream_send_nal(restream, pending, pending_size, rtp_time, false);
+        }
+        if (type == NAL_TYPE_IDR && !sent_parameter_sets && restream->sps_len > 0 && restream->pps_len > 0) {
+            restream_send_nal(restream, restream->sps, restream->sps_len, rtp_time, false);
+            restream_send_nal(restream, restream->pps, restream->pps_len, rtp_time, false);
+            sent_parameter_sets = true;
+        }
+        pending = nal;
+        pending_size = size;
+    }
+    if (pending) {
+        restream_send_nal(restream, pending, pending_size, rtp_time, true);
+        restream->stats.frames++;
+    }
+    MUTEX_UNLOCK(restream->mutex);
+}
+
+void
+restream_get_stats(restream_t *restream, restream_stats_t *stats)
+{
+    assert(restream);
+    assert(stats);
+    MUTEX_LOCK(restream->mutex);
+    *stats = restream->stats;
+    MUTEX_UNLOCK(restream->mutex);
+}
+
+void
+restream_destroy(restream_t *restream)
+{
+    if (restream) {
+        if (restream->stats.frames > 0) {
+            logger_log(restream->logger, LOGGER_INFO, "restream sent %llu frames in %llu packets (%llu bytes), %llu send errors",
+                       (unsigned long long) restream->stats.frames, (unsigned long long) restream->stats.packets,
+                       (unsigned long long) restream->stats.bytes, (unsigned long long) restream->stats.send_errors);
+        }
+        for (int i = 0; i < restream->sock_count; i++) {
+            closesocket(restream->socks[i]);
+        }
+        MUTEX_DESTROY(restream->mutex);
+        free(restream);
+    }
+}
@@ -0,0 +1,50 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#ifndef RESTREAM_H
+#define RESTREAM_H
+
+#include <stdint.h>
+#include "logger.h"
+#include "stream.h"
+
+/*
+ * Sends the mirrored H.264 on to other hosts as RTP (RFC 6184, payload type 96,
+ * packetization-mode=1) without decoding it. Small NAL units go out as they are,
+ * larger ones as FU-A fragments. SPS and PPS are repeated in front of every IDR
+ * frame, so a destination can join at any keyframe without an SDP carrying them.
+ */
+
+#define RESTREAM_PAYLOAD_TYPE 96
+#define RESTREAM_MAX_DESTINATIONS 8
+
+typedef struct restream_s restream_t;
+
+typedef struct {
+    uint64_t frames;
+    uint64_t packets;
+    uint64_t bytes;
+    /* Packets the network stack refused, e.g. while a destination is not listening */
+    uint64_t send_errors;
+} restream_stats_t;
+
+restream_t *restream_init(logger_t *logger);
+/* Adds a destination, host may be a name or an IPv4 or IPv6 address. Returns -1 on failure. */
+int restream_add_destination(restream_t *restream, const char *host, unsigned short port);
+int restream_get_destination_count(restream_t *restream);
+/* Packetizes an Annex-B frame, pts in us. A frame with only SPS and PPS is kept for the next IDR. */
+void restream_send_frame(restream_t *restream, const unsigned char *data, int data_len,
+                         const h264_nal_unit_t *nal_units, int nal_count, uint64_t pts);
+void restream_get_stats(restream_t *restream, restream_stats_t *stats);
+void restream_destroy(restream_t *restream);
+
+#endif //RESTREAM_H
@@ -0,0 +1,351 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include "session_reactor.h"
+#include "threads.h"
+#include "thread_attr.h"
+
+/* A session has a timing socket, two audio sockets, the audio wake fd and a mirror socket */
+#define SESSION_REACTOR_MAX_FDS 8
+#define SESSION_REACTOR_MAX_TIMERS 8
+#define SESSION_REACTOR_MAX_EVENTS 8
+
+typedef struct {
+    /* -1 while the slot is free */
+    int fd;
+    session_reactor_io_func_t func;
+    void *arg;
+} session_reactor_fd_t;
+
+typedef struct {
+    bool active;
+    uint64_t due;
+    session_reactor_timer_func_t func;
+    void *arg;
+} session_reactor_timer_t;
+
+struct session_reactor_s {
+    logger_t *logger;
+    thread_handle_t thread;
+    thread_flag_t running;
+
+    int epoll_fd;
+    /* eventfd that wakes the thread to take another look at the timers or to stop */
+    int wake_fd;
+
+    /* Held by the thread while it runs callbacks and by others while they change the sources */
+    mutex_handle_t mutex;
+    session_reactor_fd_t fds[SESSION_REACTOR_MAX_FDS];
+    session_reactor_timer_t timers[SESSION_REACTOR_MAX_TIMERS];
+
+    session_reactor_stats_t stats;
+};
+
+/* The reactor whose thread this is, its callbacks change sources with the mutex already held */
+static __thread session_reactor_t *session_reactor_self;
+
+static uint64_t
+session_reactor_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void
+session_reactor_lock(session_reactor_t *reactor)
+{
+    if (session_reactor_self != reactor) {
+        MUTEX_LOCK(reactor->mutex);
+    }
+}
+
+static void
+session_reactor_unlock(session_reactor_t *reactor)
+{
+    if (session_reactor_self != reactor) {
+        MUTEX_UNLOCK(reactor->mutex);
+    }
+}
+
+static void
+session_reactor_wake(session_reactor_t *reactor)
+{
+    uint64_t value = 1;
+    if (write(reactor->wake_fd, &value, sizeof(value)) < 0) {
+        logger_log(reactor->logger, LOGGER_WARNING, "session_reactor could not wake its thread");
+    }
+}
+
+/* ms until the first timer is due, rounded up so it is due when the wait ends. -1 without timers */
+static int
+session_reactor_timeout(session_reactor_t *reactor, uint64_t now)
+{
+    uint64_t first = UINT64_MAX;
+    for (int i = 0; i < SESSION_REACTOR_MAX_TIMERS; i++) {
+        if (reactor->timers[i].active && reactor->timers[i].due < first) {
+            first = reactor->timers[i].due;
+        }
+    }
+    if (first == UINT64_MAX) {
+        return -1;
+    }
+    return first <= now ? 0 : (int) ((first - now + 999) / 1000);
+}
+
+static void
+session_reactor_dispatch(session_reactor_t *reactor, struct epoll_event *events, int count)
+{
+    for (int i = 0; i < count; i++) {
+        int fd = events[i].data.fd;
+        if (fd == reactor->wake_fd) {
+            uint64_t value;
+            if (read(reactor->wake_fd, &value, sizeof(value)) < 0) {
+                value = 0;
+            }
+            continue;
+        }
+        // Looked up rather than kept in the event, an earlier callback of this batch may have removed it
+        for (int j = 0; j < SESSION_REACTOR_MAX_FDS; j++) {
+            session_reactor_fd_t *source = &reactor->fds[j];
+            if (source->fd == fd) {
+                __atomic_store_n(&reactor->stats.io_calls, reactor->stats.io_calls + 1, __ATOMIC_RELAXED);
+                source->func(source->arg, fd);
+                break;
+            }
+        }
+    }
+
+    uint64_t now = session_reactor_now();
+    for (int i = 0; i < SESSION_REACTOR_MAX_TIMERS; i++) {
+        session_reactor_timer_t *timer = &reactor->timers[i];
+        if (!timer->active || timer->due > now) {
+            continue;
+        }
+        __atomic_store_n(&reactor->stats.timer_calls, reactor->stats.timer_calls + 1, __ATOMIC_RELAXED);
+        uint64_t next = timer->func(timer->arg);
+        // The callback may have cancelled it
+        if (timer->active) {
+            if (next) {
+                timer->due = now + next;
+            } else {
+                timer->active = false;
+                __atomic_fetch_sub(&reactor->stats.timers, 1, __ATOMIC_RELAXED);
+            }
+        }
+    }
+}
+
+static THREAD_RETVAL
+session_reactor_thread(void *arg)
+{
+    session_reactor_t *reactor = arg;
+    struct epoll_event events[SESSION_REACTOR_MAX_EVENTS];
+
+    // Audio is the most latency critical of what it receives
+    thread_attr_apply(reactor->logger, THREAD_ROLE_AUDIO, "rp-reactor");
+
+    while (THREAD_FLAG_LOAD(reactor->running)) {
+        MUTEX_LOCK(reactor->mutex);
+        int timeout = session_reactor_timeout(reactor, session_reactor_now());
+        MUTEX_UNLOCK(reactor->mutex);
+
+        int count = epoll_wait(reactor->epoll_fd, events, SESSION_REACTOR_MAX_EVENTS, timeout);
+        if (count < 0) {
+            if (errno == EINTR) continue;
+            logger_log(reactor->logger, LOGGER_ERR, "session_reactor error in epoll_wait %d", errno);
+            break;
+        }
+        __atomic_store_n(&reactor->stats.wakeups, reactor->stats.wakeups + 1, __ATOMIC_RELAXED);
+
+        MUTEX_LOCK(reactor->mutex);
+        session_reactor_self = reactor;
+        session_reactor_dispatch(reactor, events, count);
+        session_reactor_self = NULL;
+        MUTEX_UNLOCK(reactor->mutex);
+    }
+    return 0;
+}
+
+session_reactor_t *
+session_reactor_init(logger_t *logger)
+{
+    session_reactor_t *reactor = calloc(1, sizeof(session_reactor_t));
+    if (!reactor) {
+        return NULL;
+    }
+    reactor->logger = logger;
+    for (int i = 0; i < SESSION_REACTOR_MAX_FDS; i++) {
+        reactor->fds[i].fd = -1;
+    }
+
+    reactor->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    reactor->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.fd = reactor->wake_fd;
+    if (reactor->epoll_fd == -1 || reactor->wake_fd == -1 ||
+        epoll_ctl(reactor->epoll_fd, EPOLL_CTL_ADD, reactor->wake_fd, &event) == -1) {
+        logger_log(logger, LOGGER_ERR, "session_reactor could not set up epoll %d", errno);
+        if (reactor->epoll_fd != -1) close(reactor->epoll_fd);
+        if (reactor->wake_fd != -1) close(reactor->wake_fd);
+        free(reactor);
+        return NULL;
+    }
+    MUTEX_CREATE(reactor->mutex);
+
+    THREAD_FLAG_STORE(reactor->running, 1);
+    THREAD_CREATE(reactor->thread, session_reactor_thread, reactor);
+    if (!reactor->thread) {
+        logger_log(logger, LOGGER_ERR, "session_reactor could not start its thread");
+        MUTEX_DESTROY(reactor->mutex);
+        close(reactor->epoll_fd);
+        close(reactor->wake_fd);
+        free(reactor);
+        return NULL;
+    }
+    return reactor;
+}
+
+int
+session_reactor_add_fd(session_reactor_t *reactor, int fd, session_reactor_io_func_t func, void *arg)
+{
+    int ret = -1;
+
+    assert(reactor && func);
+    session_reactor_lock(reactor);
+    for (int i = 0; i < SESSION_REACTOR_MAX_FDS; i++) {
+        session_reactor_fd_t *source = &reactor->fds[i];
+        if (source->fd != -1) {
+            continue;
+        }
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.fd = fd;
+        if (epoll_ctl(reactor->epoll_fd, EPOLL_CTL_ADD, fd, &event) == 0) {
+            source->fd = fd;
+            source->func = func;
+            source->arg = arg;
+            __atomic_fetch_add(&reactor->stats.fds, 1, __ATOMIC_RELAXED);
+            ret = 0;
+        }
+        break;
+    }
+    session_reactor_unlock(reactor);
+    if (ret < 0) {
+        logger_log(reactor->logger, LOGGER_ERR, "session_reactor could not add fd %d", fd);
+    }
+    return ret;
+}
+
+void
+session_reactor_remove_fd(session_reactor_t *reactor, int fd)
+{
+    assert(reactor);
+    session_reactor_lock(reactor);
+    for (int i = 0; i < SESSION_REACTOR_MAX_FDS; i++) {
+        session_reactor_fd_t *source = &reactor->fds[i];
+        if (source->fd == fd) {
+            epoll_ctl(reactor->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+            source->fd = -1;
+            __atomic_fetch_sub(&reactor->stats.fds, 1, __ATOMIC_RELAXED);
+            break;
+        }
+    }
+    session_reactor_unlock(reactor);
+}
+
+int
+session_reactor_add_timer(session_reactor_t *reactor, uint64_t delay, session_reactor_timer_func_t func, void *arg)
+{
+    int timer = -1;
+
+    assert(reactor && func);
+    session_reactor_lock(reactor);
+    for (int i = 0; i < SESSION_REACTOR_MAX_TIMERS; i++) {
+        if (!reactor->timers[i].active) {
+            reactor->timers[i].active = true;
+            reactor->timers[i].due = session_reactor_now() + delay;
+            reactor->timers[i].func = func;
+            reactor->timers[i].arg = arg;
+            __atomic_fetch_add(&reactor->stats.timers, 1, __ATOMIC_RELAXED);
+            timer = i;
+            break;
+        }
+    }
+    session_reactor_unlock(reactor);
+    if (timer < 0) {
+        logger_log(reactor->logger, LOGGER_ERR, "session_reactor has no room for another timer");
+    } else if (session_reactor_self != reactor) {
+        // The thread may be waiting with a timeout for a later timer
+        session_reactor_wake(reactor);
+    }
+    return timer;
+}
+
+void
+session_reactor_cancel_timer(session_reactor_t *reactor, int timer)
+{
+    assert(reactor);
+    if (timer < 0 || timer >= SESSION_REACTOR_MAX_TIMERS) {
+        return;
+    }
+    session_reactor_lock(reactor);
+    if (reactor->timers[timer].active) {
+        reactor->timers[timer].active = false;
+        __atomic_fetch_sub(&reactor->stats.timers, 1, __ATOMIC_RELAXED);
+    }
+    session_reactor_unlock(reactor);
+}
+
+void
+session_reactor_get_stats(session_reactor_t *reactor, session_reactor_stats_t *stats)
+{
+    stats->wakeups = __atomic_load_n(&reactor->stats.wakeups, __ATOMIC_RELAXED);
+    stats->io_calls = __atomic_load_n(&reactor->stats.io_calls, __ATOMIC_RELAXED);
+    stats->timer_calls = __atomic_load_n(&reactor->stats.timer_calls, __ATOMIC_RELAXED);
+    stats->fds = __atomic_load_n(&reactor->stats.fds, __ATOMIC_RELAXED);
+    stats->timers = __atomic_load_n(&reactor->stats.timers, __ATOMIC_RELAXED);
+}
+
+void
+session_reactor_destroy(session_reactor_t *reactor)
+{
+    if (reactor) {
+        THREAD_FLAG_STORE(reactor->running, 0);
+        session_reactor_wake(reactor);
+        THREAD_JOIN(reactor->thread);
+
+        session_reactor_stats_t stats;
+        session_reactor_get_stats(reactor, &stats);
+        if (stats.fds || stats.timers) {
+            logger_log(reactor->logger, LOGGER_WARNING, "session_reactor destroyed with %d fds and %d timers left",
+                       stats.fds, stats.timers);
+        }
+        logger_log(reactor->logger, LOGGER_DEBUG, "session_reactor %llu wakeups, %llu io callbacks, %llu timer callbacks",
+                   (unsigned long long) stats.wakeups, (unsigned long long) stats.io_calls,
+                   (unsigned long long) stats.timer_calls);
+        close(reactor->epoll_fd);
+        close(reactor->wake_fd);
+        MUTEX_DESTROY(reactor->mutex);
+        free(reactor);
+    }
+}
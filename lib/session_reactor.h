@@ -0,0 +1,65 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#ifndef SESSION_REACTOR_H
+#define SESSION_REACTOR_H
+
+#include <stdint.h>
+#include "logger.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * One thread and one epoll set for the sockets and timers of a session, in
+ * place of a receive thread each for audio, timing and a mirror stream over
+ * UDP. Callbacks run on the reactor thread one at a time and must not block,
+ * a source that has to wait for something keeps a thread of its own.
+ * Sources are added and removed from any thread, their own callbacks
+ * included. Once a remove returns, its callback is not running and won't be
+ * called again.
+ */
+
+typedef struct session_reactor_s session_reactor_t;
+
+/* fd can be read without blocking */
+typedef void (*session_reactor_io_func_t)(void *arg, int fd);
+/* Returns the us until it is due again, 0 ends the timer */
+typedef uint64_t (*session_reactor_timer_func_t)(void *arg);
+
+typedef struct {
+    /* Returns from epoll_wait, and callbacks run for readable fds and due timers */
+    uint64_t wakeups;
+    uint64_t io_calls;
+    uint64_t timer_calls;
+    /* fds and timers currently added */
+    int fds;
+    int timers;
+} session_reactor_stats_t;
+
+session_reactor_t *session_reactor_init(logger_t *logger);
+/* Returns 0, or -1 if fd could not be added */
+int session_reactor_add_fd(session_reactor_t *reactor, int fd, session_reactor_io_func_t func, void *arg);
+void session_reactor_remove_fd(session_reactor_t *reactor, int fd);
+/* A timer first due delay us from now. Returns its id, or -1 if there is no room for it */
+int session_reactor_add_timer(session_reactor_t *reactor, uint64_t delay, session_reactor_timer_func_t func, void *arg);
+void session_reactor_cancel_timer(session_reactor_t *reactor, int timer);
+void session_reactor_get_stats(session_reactor_t *reactor, session_reactor_stats_t *stats);
+/* Every source has to be removed first */
+void session_reactor_destroy(session_reactor_t *reactor);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //SESSION_REACTOR_H
@@ -0,0 +1,113 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "session_summary.h"
+
+uint64_t
+session_summary_now(void)
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (uint64_t) time.tv_sec * 1000000 + time.tv_nsec / 1000;
+}
+
+static void
+session_summary_string(FILE *file, const char *key, const char *value)
+{
+    fprintf(file, "\"%s\":\"", key);
+    for (const char *c = value; *c; c++) {
+        if (*c == '"' || *c == '\\') {
+            fprintf(file, "\\%c", *c);
+        } else if ((unsigned char) *c < 0x20) {
+            fprintf(file, "\\u%04x", (unsigned char) *c);
+        } else {
+            fputc(*c, file);
+        }
+    }
+    fputc('"', file);
+}
+
+static void
+session_summary_latency(FILE *file, const char *key, const latency_histogram_stats_t *stats)
+{
+    fprintf(file, "\"%s\":{\"count\":%llu,\"p50\":%.3f,\"p95\":%.3f,\"p99\":%.3f,\"max\":%.3f}", key,
+            (unsigned long long) stats->count, stats->p50 / 1000.0, stats->p95 / 1000.0, stats->p99 / 1000.0,
+            stats->max / 1000.0);
+}
+
+int
+session_summary_write(const session_summary_t *summary, const char *filename)
+{
+    double duration = (session_summary_now() - summary->start_time) / 1000000.0;
+    char start[32];
+    struct tm tm;
+    FILE *file;
+
+    file = fopen(filename, "a");
+    if (!file) {
+        return -1;
+    }
+    strftime(start, sizeof(start), "%Y-%m-%dT%H:%M:%SZ", gmtime_r(&summary->start, &tm));
+    fprintf(file, "{\"session\":%u,\"start\":\"%s\",\"duration\":%.3f,", summary->id, start, duration);
+    session_summary_string(file, "remote", summary->remote);
+    fputc(',', file);
+    session_summary_string(file, "model", summary->model);
+    fputc(',', file);
+    session_summary_string(file, "name", summary->name);
+    fputc(',', file);
+    session_summary_string(file, "os_version", summary->os_version);
+
+    if (summary->has_video) {
+        const raop_rtp_mirror_stats_t *video = &summary->video;
+        double seconds = video->stream_time / 1000000.0;
+        fprintf(file, ",\"video\":{\"width\":%d,\"height\":%d,\"frames\":%llu,\"fps\":%.2f,\"bytes\":%llu,"
+                "\"average_kbps\":%.1f,\"peak_kbps\":%.1f,\"dropped_frames\":%llu,\"latency_ms\":{",
+                video->width, video->height, (unsigned long long) video->received_frames,
+                seconds > 0 ? video->received_frames / seconds : 0.0, (unsigned long long) video->received_bytes,
+                seconds > 0 ? video->received_bytes * 8 / seconds / 1000 : 0.0, video->peak_bitrate / 1000.0,
+                (unsigned long long) video->dropped_frames);
+        session_summary_latency(file, "receive", &video->receive_delay);
+        fputc(',', file);
+        session_summary_latency(file, "decrypt", &video->arrival_to_decrypt);
+        fputc(',', file);
+        session_summary_latency(file, "submit", &video->decrypt_to_submit);
+        fputc(',', file);
+        session_summary_latency(file, "render", &video->submit_duration);
+        fputc(',', file);
+        session_summary_latency(file, "display", &video->display_offset);
+        fprintf(file, "}}");
+    }
+    if (summary->has_audio) {
+        const raop_rtp_stats_t *audio = &summary->audio;
+        fprintf(file, ",\"audio\":{\"packets\":%llu,\"lost\":%llu,\"reordered\":%llu,\"duplicates\":%llu,"
+                "\"resend_requests\":%llu,\"recovered\":%llu,\"gaps\":%llu,\"late\":%llu,\"overflows\":%llu,"
+                "\"jitter_ms\":%.3f}",
+                (unsigned long long) audio->received_packets, (unsigned long long) audio->lost_packets,
+                (unsigned long long) audio->reordered_packets, (unsigned long long) audio->duplicate_packets,
+                (unsigned long long) audio->buffer.resend_requests, (unsigned long long) audio->buffer.recovered_packets,
+                (unsigned long long) audio->buffer.skipped_packets, (unsigned long long) audio->playout.late,
+                (unsigned long long) audio->playout.overflows, audio->buffer.jitter / 1000.0);
+    }
+    if (summary->has_ntp && summary->ntp.corrections) {
+        const raop_ntp_stats_t *ntp = &summary->ntp;
+        fprintf(file, ",\"ntp\":{\"offset_range_ms\":%.3f,\"min_rtt_ms\":%.3f,\"max_rtt_ms\":%.3f,"
+                "\"timeouts\":%llu,\"skew_ppm\":%.2f}",
+                (ntp->max_offset - ntp->min_offset) / 1000.0, ntp->min_rtt / 1000.0, ntp->max_rtt / 1000.0,
+                (unsigned long long) ntp->timeouts, ntp->skew);
+    }
+    fprintf(file, "}\n");
+    return fclose(file) ? -1 : 0;
+}
@@ -0,0 +1,53 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#ifndef SESSION_SUMMARY_H
+#define SESSION_SUMMARY_H
+
+#include <stdint.h>
+#include <time.h>
+#include "raop_ntp.h"
+#include "raop_rtp.h"
+#include "raop_rtp_mirror.h"
+
+/*
+ * One record per connection, written as a line of JSON when it closes, so a
+ * bad session can be looked into without the debug log. The counters are
+ * taken from the streams just before they are destroyed, so each stream
+ * reports its last session on the connection.
+ */
+
+typedef struct {
+    unsigned int id;
+    /* Wall clock time the connection was accepted, and its monotonic time in us */
+    time_t start;
+    uint64_t start_time;
+    char remote[48];
+    /* What the sender said about itself in its first SETUP, empty if it didn't */
+    char model[64];
+    char name[128];
+    char os_version[32];
+
+    int has_video;
+    raop_rtp_mirror_stats_t video;
+    int has_audio;
+    raop_rtp_stats_t audio;
+    int has_ntp;
+    raop_ntp_stats_t ntp;
+} session_summary_t;
+
+/* Monotonic time in us for start_time */
+uint64_t session_summary_now(void);
+/* Appends summary to filename as a line of JSON, returns -1 if it could not be written */
+int session_summary_write(const session_summary_t *summary, const char *filename);
+
+#endif //SESSION_SUMMARY_H
@@ -0,0 +1,135 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <assert.h>
+
+#include "setup_timeline.h"
+
+struct setup_timeline_s {
+    logger_t *logger;
+    unsigned int conn_id;
+    /* Monotonic time of each milestone in us, 0 until it is reached */
+    uint64_t times[SETUP_MILESTONE_COUNT];
+    int logged;
+};
+
+static const char *setup_timeline_names[SETUP_MILESTONE_COUNT] = {
+    "request",
+    "pair_setup",
+    "pair_verify",
+    "fairplay",
+    "session",
+    "mirror",
+    "mirror_accept",
+    "first_frame",
+    "first_submit",
+    "first_display",
+};
+
+static uint64_t
+setup_timeline_now(void)
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    // Never 0, which stands for not reached
+    return (uint64_t) time.tv_sec * 1000000 + time.tv_nsec / 1000 + 1;
+}
+
+setup_timeline_t *
+setup_timeline_init(logger_t *logger, unsigned int conn_id)
+{
+    setup_timeline_t *timeline = calloc(1, sizeof(setup_timeline_t));
+    if (!timeline) {
+        return NULL;
+    }
+    timeline->logger = logger;
+    timeline->conn_id = conn_id;
+    return timeline;
+}
+
+void
+setup_timeline_mark(setup_timeline_t *timeline, setup_milestone_t milestone)
+{
+    uint64_t expected = 0;
+
+    if (!timeline) {
+        return;
+    }
+    assert(milestone < SETUP_MILESTONE_COUNT);
+    if (__atomic_load_n(&timeline->times[milestone], __ATOMIC_RELAXED)) {
+        return;
+    }
+    if (__atomic_compare_exchange_n(&timeline->times[milestone], &expected, setup_timeline_now(), 0,
+                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED) && milestone == SETUP_FIRST_DISPLAY) {
+        setup_timeline_log(timeline);
+    }
+}
+
+int64_t
+setup_timeline_get(setup_timeline_t *timeline, setup_milestone_t milestone)
+{
+    uint64_t start = __atomic_load_n(&timeline->times[SETUP_FIRST_REQUEST], __ATOMIC_RELAXED);
+    uint64_t time = __atomic_load_n(&timeline->times[milestone], __ATOMIC_RELAXED);
+
+    if (!start || !time) {
+        return -1;
+    }
+    return (int64_t) (time - start);
+}
+
+const char *
+setup_timeline_name(setup_milestone_t milestone)
+{
+    assert(milestone < SETUP_MILESTONE_COUNT);
+    return setup_timeline_names[milestone];
+}
+
+void
+setup_timeline_log(setup_timeline_t *timeline)
+{
+    char line[512];
+    int len = 0;
+    int64_t last = 0;
+
+    if (__atomic_exchange_n(&timeline->logged, 1, __ATOMIC_RELAXED)) {
+        return;
+    }
+    // Every phase as the time since the milestone before it, skipping those that were not reached
+    for (int i = SETUP_FIRST_REQUEST + 1; i < SETUP_MILESTONE_COUNT && len < (int) sizeof(line); i++) {
+        int64_t time = setup_timeline_get(timeline, i);
+        if (time < 0) {
+            continue;
+        }
+        len += snprintf(line + len, sizeof(line) - len, "%s%s +%.1f ms", len ? ", " : "",
+                        setup_timeline_names[i], (time - last) / 1000.0);
+        last = time;
+    }
+    if (!len) {
+        return;
+    }
+    int64_t display = setup_timeline_get(timeline, SETUP_FIRST_DISPLAY);
+    if (display >= 0) {
+        logger_log(timeline->logger, LOGGER_INFO, "Connection %u showed its first frame %.1f ms after the first request: %s",
+                   timeline->conn_id, display / 1000.0, line);
+    } else {
+        logger_log(timeline->logger, LOGGER_INFO, "Connection %u setup, no frame shown: %s", timeline->conn_id, line);
+    }
+}
+
+void
+setup_timeline_destroy(setup_timeline_t *timeline)
+{
+    free(timeline);
+}
@@ -0,0 +1,52 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#ifndef SETUP_TIMELINE_H
+#define SETUP_TIMELINE_H
+
+#include <stdint.h>
+#include "logger.h"
+
+/*
+ * When a connection got through each phase of its setup, from the sender's
+ * first request to its first frame being shown, so it can be seen which
+ * phase to shorten. Only the first time a milestone is reached counts, any
+ * thread may mark one and read them.
+ */
+
+typedef enum {
+    SETUP_FIRST_REQUEST,
+    SETUP_PAIR_SETUP,
+    SETUP_PAIR_VERIFY,
+    SETUP_FAIRPLAY,
+    SETUP_SESSION,
+    SETUP_MIRROR,
+    SETUP_MIRROR_ACCEPT,
+    SETUP_FIRST_FRAME,
+    SETUP_FIRST_SUBMIT,
+    SETUP_FIRST_DISPLAY,
+    SETUP_MILESTONE_COUNT
+} setup_milestone_t;
+
+typedef struct setup_timeline_s setup_timeline_t;
+
+setup_timeline_t *setup_timeline_init(logger_t *logger, unsigned int conn_id);
+/* Stamps milestone unless it was reached before, logs the timeline once the first frame is shown. NULL is ignored */
+void setup_timeline_mark(setup_timeline_t *timeline, setup_milestone_t milestone);
+/* Microseconds from the first request to milestone, -1 if either was not reached */
+int64_t setup_timeline_get(setup_timeline_t *timeline, setup_milestone_t milestone);
+const char *setup_timeline_name(setup_milestone_t milestone);
+/* Logs the timeline so far unless the first frame was shown and it was logged then */
+void setup_timeline_log(setup_timeline_t *timeline);
+void setup_timeline_destroy(setup_timeline_t *timeline);
+
+#endif //SETUP_TIMELINE_H
@@ -0,0 +1,340 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/un.h>
+#include <sys/eventfd.h>
+
+#include "shm_output.h"
+#include "compat.h"
+
+/* The ring starts on its own cache line */
+#define SHM_OUTPUT_HEADER_SIZE 64
+
+struct shm_output_s {
+    logger_t *logger;
+    /* "/<name>" as shm_open and shm_unlink take it */
+    char *name;
+    int shm_fd;
+    size_t map_size;
+    shm_output_header_t *header;
+    unsigned char *ring;
+    int listen_fd;
+
+    /* Only the frame bus thread touches these */
+    uint64_t write_pos;
+    /* The last codec frame, retained for readers that connect later */
+    const frame_bus_frame_t *codec;
+    int reader_socks[SHM_OUTPUT_MAX_READERS];
+    int reader_events[SHM_OUTPUT_MAX_READERS];
+
+    mutex_handle_t mutex;
+    /* MUTEX LOCKED VARIABLES START */
+    shm_output_stats_t stats;
+    /* MUTEX LOCKED VARIABLES END */
+};
+
+static int
+shm_output_listen(shm_output_t *output, const char *name)
+{
+    struct sockaddr_un addr;
+    int len = snprintf(addr.sun_path + 1, sizeof(addr.sun_path) - 1, "rpiplay-%s", name);
+
+    if (len < 0 || len >= (int) sizeof(addr.sun_path) - 1) {
+        return -1;
+    }
+    addr.sun_family = AF_UNIX;
+    // Abstract, the address goes away with the socket
+    addr.sun_path[0] = '\0';
+    output->listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (output->listen_fd < 0) {
+        return -1;
+    }
+    if (bind(output->listen_fd, (struct sockaddr *) &addr, offsetof(struct sockaddr_un, sun_path) + 1 + len) < 0 ||
+        listen(output->listen_fd, SHM_OUTPUT_MAX_READERS) < 0) {
+        close(output->listen_fd);
+        output->listen_fd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+shm_output_t *
+shm_output_init(logger_t *logger, const char *name, unsigned int ring_size)
+{
+    shm_output_t *output;
+
+    assert(logger);
+    assert(name);
+
+    if (!*name || strchr(name, '/')) {
+        logger_log(logger, LOGGER_ERR, "shm_output name %s must not be empty or contain a slash", name);
+        return NULL;
+    }
+    output = calloc(1, sizeof(shm_output_t));
+    if (!output) {
+        return NULL;
+    }
+    output->logger = logger;
+    output->shm_fd = -1;
+    output->listen_fd = -1;
+    for (int i = 0; i < SHM_OUTPUT_MAX_READERS; i++) {
+        output->reader_socks[i] = -1;
+        output->reader_events[i] = -1;
+    }
+    output->name = malloc(strlen(name) + 2);
+    if (!output->name) {
+        free(output);
+        return NULL;
+    }
+    sprintf(output->name, "/%s", name);
+
+    ring_size = (ring_size + SHM_OUTPUT_ALIGN - 1) & ~(SHM_OUTPUT_ALIGN - 1);
+    output->map_size = SHM_OUTPUT_HEADER_SIZE + ring_size;
+    output->shm_fd = shm_open(output->name, O_CREAT | O_RDWR | O_TRUNC | O_CLOEXEC, 0644);
+    if (output->shm_fd < 0 || ftruncate(output->shm_fd, output->map_size) < 0) {
+        logger_log(logger, LOGGER_ERR, "shm_output could not create /dev/shm%s", output->name);
+        shm_output_destroy(output);
+        return NULL;
+    }
+    void *map = mmap(NULL, output->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, output->shm_fd, 0);
+    if (map == MAP_FAILED) {
+        logger_log(logger, LOGGER_ERR, "shm_output could not map /dev/shm%s", output->name);
+        shm_output_destroy(output);
+        return NULL;
+    }
+    output->header = map;
+    output->ring = (unsigned char *) map + SHM_OUTPUT_HEADER_SIZE;
+    if (shm_output_listen(output, name) < 0) {
+        logger_log(logger, LOGGER_ERR, "shm_output could not listen for readers at @rpiplay-%s", name);
+        shm_output_destroy(output);
+        return NULL;
+    }
+
+    output->header->version = SHM_OUTPUT_VERSION;
+    output->header->header_size = SHM_OUTPUT_HEADER_SIZE;
+    output->header->data_size = ring_size;
+    output->header->writer_pid = getpid();
+    // Readers that find the magic find the rest
+    __atomic_store_n(&output->header->magic, SHM_OUTPUT_MAGIC, __ATOMIC_RELEASE);
+
+    MUTEX_CREATE(output->mutex);
+    logger_log(logger, LOGGER_INFO, "Publishing mirrored video in /dev/shm%s, %u KB", output->name, ring_size / 1024);
+    return output;
+}
+
+/* Takes the readers that connected since the last frame and gives each an eventfd of its own,
+ * returns how many */
+static int
+shm_output_accept_readers(shm_output_t *output)
+{
+    int sock;
+    int accepted = 0;
+
+    while ((sock = accept4(output->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+        int slot = 0;
+        while (slot < SHM_OUTPUT_MAX_READERS && output->reader_socks[slot] >= 0) slot++;
+        int event = slot < SHM_OUTPUT_MAX_READERS ? eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC) : -1;
+        if (event < 0) {
+            logger_log(output->logger, LOGGER_WARNING, "shm_output takes at most %d readers", SHM_OUTPUT_MAX_READERS);
+            close(sock);
+            continue;
+        }
+
+        char byte = 0;
+        struct iovec iov = { &byte, 1 };
+        union {
+            struct cmsghdr align;
+            char buf[CMSG_SPACE(sizeof(int))];
+        } control;
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof(control.buf);
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &event, sizeof(int));
+        if (sendmsg(sock, &msg, MSG_NOSIGNAL) < 0) {
+            close(event);
+            close(sock);
+            continue;
+        }
+        output->reader_socks[slot] = sock;
+        output->reader_events[slot] = event;
+        accepted++;
+        logger_log(output->logger, LOGGER_INFO, "shm_output reader %d connected", slot);
+        MUTEX_LOCK(output->mutex);
+        output->stats.readers++;
+        MUTEX_UNLOCK(output->mutex);
+    }
+    return accepted;
+}
+
+/* Signals every reader, and lets go of those whose socket closed */
+static void
+shm_output_notify_readers(shm_output_t *output)
+{
+    const uint64_t one = 1;
+
+    for (int i = 0; i < SHM_OUTPUT_MAX_READERS; i++) {
+        if (output->reader_socks[i] < 0) continue;
+        char byte;
+        if (recv(output->reader_socks[i], &byte, 1, MSG_DONTWAIT) == 0) {
+            logger_log(output->logger, LOGGER_INFO, "shm_output reader %d went away", i);
+            close(output->reader_socks[i]);
+            close(output->reader_events[i]);
+            output->reader_socks[i] = -1;
+            output->reader_events[i] = -1;
+            MUTEX_LOCK(output->mutex);
+            output->stats.readers--;
+            MUTEX_UNLOCK(output->mutex);
+            continue;
+        }
+        // A full counter means the reader is far behind, it catches up on the next read anyway
+        if (write(output->reader_events[i], &one, sizeof(one)) < 0) {
+            continue;
+        }
+    }
+}
+
+/* Writes a record at pos, which the caller made sure fits before the end of the ring */
+static uint64_t
+shm_output_put_record(shm_output_t *output, uint64_t pos, const shm_output_record_t *record, const unsigned char *data)
+{
+    unsigned char *at = output->ring + pos % output->header->data_size;
+    uint64_t len = (sizeof(*record) + record->size + SHM_OUTPUT_ALIGN - 1) & ~(uint64_t) (SHM_OUTPUT_ALIGN - 1);
+
+    memcpy(at, record, sizeof(*record));
+    if (record->size) {
+        memcpy(at + sizeof(*record), data, record->size);
+    }
+    return pos + len;
+}
+
+static void
+shm_output_write_record(shm_output_t *output, const frame_bus_frame_t *frame)
+{
+    shm_output_header_t *header = output->header;
+    shm_output_record_t record;
+    uint64_t pos = output->write_pos;
+
+    memset(&record, 0, sizeof(record));
+    record.size = frame->data_len;
+    if (frame->codec == VIDEO_CODEC_H265) record.flags |= SHM_OUTPUT_HEVC;
+    if (frame->kind == FRAME_BUS_CODEC) {
+        record.type = SHM_OUTPUT_CODEC;
+        record.width = frame->width;
+        record.height = frame->height;
+    } else {
+        record.type = SHM_OUTPUT_VIDEO;
+        record.pts = frame->pts;
+        if (frame->keyframe) record.flags |= SHM_OUTPUT_KEYFRAME;
+    }
+    uint64_t len = (sizeof(record) + record.size + SHM_OUTPUT_ALIGN - 1) & ~(uint64_t) (SHM_OUTPUT_ALIGN - 1);
+    if (len > header->data_size / 2) {
+        MUTEX_LOCK(output->mutex);
+        output->stats.oversized++;
+        MUTEX_UNLOCK(output->mutex);
+        return;
+    }
+    uint64_t rest = header->data_size - pos % header->data_size;
+    uint64_t end = pos + (rest < len ? rest : 0) + len;
+
+    // Readers that see the reservation know what is being overwritten, see the seqlock in raop_ntp
+    __atomic_store_n(&header->reserve_pos, end, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    if (rest < len) {
+        shm_output_record_t pad;
+        memset(&pad, 0, sizeof(pad));
+        pad.type = SHM_OUTPUT_PAD;
+        pad.size = rest - sizeof(pad);
+        // Only the header of a pad is written, the rest is left as it is
+        memcpy(output->ring + pos % header->data_size, &pad, sizeof(pad));
+        pos += rest;
+    }
+    pos = shm_output_put_record(output, pos, &record, frame->data);
+    assert(pos == end);
+    output->write_pos = pos;
+    __atomic_store_n(&header->records, header->records + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&header->write_pos, pos, __ATOMIC_RELEASE);
+
+    MUTEX_LOCK(output->mutex);
+    output->stats.records++;
+    output->stats.bytes += frame->data_len;
+    MUTEX_UNLOCK(output->mutex);
+}
+
+void
+shm_output_write_frame(shm_output_t *output, const frame_bus_frame_t *frame)
+{
+    if (frame->kind == FRAME_BUS_CODEC) {
+        frame_bus_frame_retain(frame);
+        if (output->codec) frame_bus_frame_release(output->codec);
+        output->codec = frame;
+    }
+    if (shm_output_accept_readers(output) && output->codec && frame != output->codec) {
+        shm_output_write_record(output, output->codec);
+    }
+    shm_output_write_record(output, frame);
+    shm_output_notify_readers(output);
+}
+
+void
+shm_output_get_stats(shm_output_t *output, shm_output_stats_t *stats)
+{
+    MUTEX_LOCK(output->mutex);
+    *stats = output->stats;
+    MUTEX_UNLOCK(output->mutex);
+}
+
+void
+shm_output_destroy(shm_output_t *output)
+{
+    if (!output) {
+        return;
+    }
+    if (output->header) {
+        shm_output_stats_t stats;
+        shm_output_get_stats(output, &stats);
+        logger_log(output->logger, LOGGER_INFO, "shm_output %llu records, %llu bytes, %llu oversized",
+                   (unsigned long long) stats.records, (unsigned long long) stats.bytes,
+                   (unsigned long long) stats.oversized);
+        munmap(output->header, output->map_size);
+        MUTEX_DESTROY(output->mutex);
+    }
+    for (int i = 0; i < SHM_OUTPUT_MAX_READERS; i++) {
+        if (output->reader_socks[i] >= 0) close(output->reader_socks[i]);
+        if (output->reader_events[i] >= 0) close(output->reader_events[i]);
+    }
+    if (output->listen_fd >= 0) close(output->listen_fd);
+    if (output->codec) frame_bus_frame_release(output->codec);
+    if (output->shm_fd >= 0) {
+        close(output->shm_fd);
+        shm_unlink(output->name);
+    }
+    free(output->name);
+    free(output);
+}
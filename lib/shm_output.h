@@ -0,0 +1,119 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#ifndef SHM_OUTPUT_H
+#define SHM_OUTPUT_H
+
+#include <stdint.h>
+#include "logger.h"
+#include "frame_bus.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Publishes the mirrored access units to other processes on the host through
+ * a POSIX shared memory object, so they can read the stream in place instead
+ * of over a network loopback.
+ *
+ * /dev/shm/<name> holds a shm_output_header_t followed by a ring of data_size
+ * bytes. Records are written one after the other, each a shm_output_record_t
+ * followed by size bytes of Annex-B data and padded to SHM_OUTPUT_ALIGN bytes;
+ * one that does not fit before the end of the ring is preceded by a
+ * SHM_OUTPUT_PAD record filling the rest and starts at the beginning.
+ *
+ * Positions count the bytes written since the start, a record at position p
+ * is at p % data_size in the ring. Before writing, the writer stores the end
+ * of what it is about to write in reserve_pos, after it the same in write_pos
+ * with release order. There is no back pressure: a reader keeps its own
+ * position and reads up to write_pos; having used a record at p it loads
+ * reserve_pos with acquire order, and if that is more than data_size past p
+ * the writer overtook it: it drops the record and starts again at write_pos,
+ * from the next keyframe on.
+ *
+ * Readers that want to sleep until there is more connect a SOCK_SEQPACKET
+ * socket to the abstract address "\0rpiplay-<name>" and get an eventfd of
+ * their own with SCM_RIGHTS, which is signalled after every record. The
+ * current SHM_OUTPUT_CODEC record is written again after one connects, so it
+ * can start decoding at the next keyframe after write_pos.
+ */
+
+#define SHM_OUTPUT_MAGIC 0x48535052 /* "RPSH" */
+#define SHM_OUTPUT_VERSION 1
+#define SHM_OUTPUT_MAX_READERS 8
+/* Records start at multiples of this, a record header fits in any rest of the ring */
+#define SHM_OUTPUT_ALIGN 32
+
+typedef enum {
+    /* Fills the rest of the ring, the next record is at its start */
+    SHM_OUTPUT_PAD = 0,
+    /* An access unit */
+    SHM_OUTPUT_VIDEO = 1,
+    /* The parameter sets of the access units that follow, width and height set */
+    SHM_OUTPUT_CODEC = 2
+} shm_output_type_t;
+
+/* Record flags */
+#define SHM_OUTPUT_KEYFRAME 0x1
+#define SHM_OUTPUT_HEVC 0x2
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    /* Offset of the ring from the start of the object */
+    uint32_t header_size;
+    uint32_t data_size;
+    uint64_t reserve_pos;
+    uint64_t write_pos;
+    /* Records written, pads not counted */
+    uint64_t records;
+    uint32_t writer_pid;
+    uint32_t reserved;
+} shm_output_header_t;
+
+typedef struct {
+    /* shm_output_type_t */
+    uint32_t type;
+    /* Bytes of data after the record, without the padding */
+    uint32_t size;
+    /* us on CLOCK_MONOTONIC when the frame is due, 0 for codec records */
+    uint64_t pts;
+    uint32_t flags;
+    uint16_t width;
+    uint16_t height;
+    uint64_t reserved;
+} shm_output_record_t;
+
+typedef struct shm_output_s shm_output_t;
+
+typedef struct {
+    uint64_t records;
+    uint64_t bytes;
+    /* Access units larger than half the ring, left out */
+    uint64_t oversized;
+    unsigned int readers;
+} shm_output_stats_t;
+
+/* Creates /dev/shm/<name> with a ring of ring_size bytes and the reader socket, NULL on failure */
+shm_output_t *shm_output_init(logger_t *logger, const char *name, unsigned int ring_size);
+/* Writes a video or codec frame of the frame bus, on its subscriber thread */
+void shm_output_write_frame(shm_output_t *output, const frame_bus_frame_t *frame);
+void shm_output_get_stats(shm_output_t *output, shm_output_stats_t *stats);
+/* Unlinks the object, readers that have it mapped keep their mapping */
+void shm_output_destroy(shm_output_t *output);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //SHM_OUTPUT_H
@@ -0,0 +1,210 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include <stdlib.h>
+#include <assert.h>
+
+#include "spsc_ring.h"
+#include "threads.h"
+
+struct spsc_ring_s {
+    unsigned int capacity;
+    unsigned int mask;
+    void **items;
+
+    /* head is only written by the consumer, tail only by the producer */
+    unsigned int head;
+    unsigned int tail;
+
+    /* Sleeping side of the ring, set under mutex */
+    int consumer_waiting;
+    int producer_waiting;
+    int closed;
+    mutex_handle_t mutex;
+    cond_handle_t not_empty;
+    cond_handle_t not_full;
+
+    unsigned int peak_depth;
+    unsigned long long full_count;
+};
+
+spsc_ring_t *
+spsc_ring_init(unsigned int capacity)
+{
+    spsc_ring_t *ring;
+    unsigned int size = 1;
+
+    assert(capacity > 0);
+    while (size < capacity) {
+        size <<= 1;
+    }
+
+    ring = calloc(1, sizeof(spsc_ring_t));
+    if (!ring) {
+        return NULL;
+    }
+    ring->items = calloc(size, sizeof(void *));
+    if (!ring->items) {
+        free(ring);
+        return NULL;
+    }
+    ring->capacity = size;
+    ring->mask = size - 1;
+    MUTEX_CREATE(ring->mutex);
+    COND_CREATE(ring->not_empty);
+    COND_CREATE(ring->not_full);
+    return ring;
+}
+
+static void
+spsc_ring_wake(spsc_ring_t *ring, int *waiting, cond_handle_t *cond)
+{
+    if (__atomic_load_n(waiting, __ATOMIC_SEQ_CST)) {
+        MUTEX_LOCK(ring->mutex);
+        COND_SIGNAL(*cond);
+        MUTEX_UNLOCK(ring->mutex);
+    }
+}
+
+int
+spsc_ring_push(spsc_ring_t *ring, void *item)
+{
+    unsigned int tail, head, depth;
+
+    assert(ring);
+    tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+    head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    depth = tail - head;
+    if (depth >= ring->capacity) {
+        __atomic_fetch_add(&ring->full_count, 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+    ring->items[tail & ring->mask] = item;
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_SEQ_CST);
+
+    if (depth + 1 > __atomic_load_n(&ring->peak_depth, __ATOMIC_RELAXED)) {
+        __atomic_store_n(&ring->peak_depth, depth + 1, __ATOMIC_RELAXED);
+    }
+    spsc_ring_wake(ring, &ring->consumer_waiting, &ring->not_empty);
+    return 0;
+}
+
+void *
+spsc_ring_pop(spsc_ring_t *ring)
+{
+    unsigned int tail, head;
+    void *item;
+
+    assert(ring);
+    head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    if (head == tail) {
+        return NULL;
+    }
+    item = ring->items[head & ring->mask];
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_SEQ_CST);
+
+    spsc_ring_wake(ring, &ring->producer_waiting, &ring->not_full);
+    return item;
+}
+
+int
+spsc_ring_push_wait(spsc_ring_t *ring, void *item)
+{
+    while (1) {
+        if (__atomic_load_n(&ring->closed, __ATOMIC_ACQUIRE)) {
+            return -1;
+        }
+        if (spsc_ring_push(ring, item) == 0) {
+            return 0;
+        }
+        MUTEX_LOCK(ring->mutex);
+        __atomic_store_n(&ring->producer_waiting, 1, __ATOMIC_SEQ_CST);
+        if (spsc_ring_count(ring) >= ring->capacity && !ring->closed) {
+            COND_WAIT(ring->not_full, ring->mutex);
+        }
+        __atomic_store_n(&ring->producer_waiting, 0, __ATOMIC_SEQ_CST);
+        MUTEX_UNLOCK(ring->mutex);
+    }
+}
+
+void *
+spsc_ring_pop_wait(spsc_ring_t *ring)
+{
+    void *item;
+    while (1) {
+        if ((item = spsc_ring_pop(ring)) != NULL) {
+            return item;
+        }
+        if (__atomic_load_n(&ring->closed, __ATOMIC_ACQUIRE)) {
+            return NULL;
+        }
+        MUTEX_LOCK(ring->mutex);
+        __atomic_store_n(&ring->consumer_waiting, 1, __ATOMIC_SEQ_CST);
+        if (spsc_ring_count(ring) == 0 && !ring->closed) {
+            COND_WAIT(ring->not_empty, ring->mutex);
+        }
+        __atomic_store_n(&ring->consumer_waiting, 0, __ATOMIC_SEQ_CST);
+        MUTEX_UNLOCK(ring->mutex);
+    }
+}
+
+unsigned int
+spsc_ring_count(spsc_ring_t *ring)
+{
+    unsigned int tail = __atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST);
+    unsigned int head = __atomic_load_n(&ring->head, __ATOMIC_SEQ_CST);
+    return tail - head;
+}
+
+void
+spsc_ring_close(spsc_ring_t *ring)
+{
+    assert(ring);
+    MUTEX_LOCK(ring->mutex);
+    __atomic_store_n(&ring->closed, 1, __ATOMIC_RELEASE);
+    COND_BROADCAST(ring->not_empty);
+    COND_BROADCAST(ring->not_full);
+    MUTEX_UNLOCK(ring->mutex);
+}
+
+void
+spsc_ring_reopen(spsc_ring_t *ring)
+{
+    assert(ring);
+    MUTEX_LOCK(ring->mutex);
+    __atomic_store_n(&ring->closed, 0, __ATOMIC_RELEASE);
+    MUTEX_UNLOCK(ring->mutex);
+}
+
+void
+spsc_ring_get_stats(spsc_ring_t *ring, spsc_ring_stats_t *stats)
+{
+    assert(ring);
+    assert(stats);
+    stats->capacity = ring->capacity;
+    stats->depth = spsc_ring_count(ring);
+    stats->peak_depth = __atomic_load_n(&ring->peak_depth, __ATOMIC_RELAXED);
+    stats->full_count = __atomic_load_n(&ring->full_count, __ATOMIC_RELAXED);
+}
+
+void
+spsc_ring_destroy(spsc_ring_t *ring)
+{
+    if (ring) {
+        COND_DESTROY(ring->not_empty);
+        COND_DESTROY(ring->not_full);
+        MUTEX_DESTROY(ring->mutex);
+        free(ring->items);
+        free(ring);
+    }
+}
@@ -0,0 +1,44 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+/*
+ * Bounded single-producer single-consumer queue of pointers.
+ * Push and pop are lock free. The *_wait variants sleep on a condition
+ * variable only when the ring is full or empty, and return early once
+ * the ring has been closed.
+ */
+
+typedef struct spsc_ring_s spsc_ring_t;
+
+typedef struct {
+    unsigned int capacity;
+    unsigned int depth;
+    unsigned int peak_depth;
+    /* Number of times the producer found the ring full */
+    unsigned long long full_count;
+} spsc_ring_stats_t;
+
+spsc_ring_t *spsc_ring_init(unsigned int capacity);
+int spsc_ring_push(spsc_ring_t *ring, void *item);
+void *spsc_ring_pop(spsc_ring_t *ring);
+int spsc_ring_push_wait(spsc_ring_t *ring, void *item);
+void *spsc_ring_pop_wait(spsc_ring_t *ring);
+unsigned int spsc_ring_count(spsc_ring_t *ring);
+void spsc_ring_close(spsc_ring_t *ring);
+void spsc_ring_reopen(spsc_ring_t *ring);
+void spsc_ring_get_stats(spsc_ring_t *ring, spsc_ring_stats_t *stats);
+void spsc_ring_destroy(spsc_ring_t *ring);
+
+#endif //SPSC_RING_H
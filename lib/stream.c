@@ -0,0 +1,62 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include <stdlib.h>
+#include <assert.h>
+
+#include "stream.h"
+
+/*
+ * Wraps buffer in a frame holding one reference. On failure buffer is
+ * released right away, so the caller never has to clean up twice.
+ */
+stream_frame_t *
+stream_frame_new(unsigned char *buffer, unsigned char *data, int data_len, uint64_t pts,
+                 stream_frame_release_t release, void *opaque)
+{
+    stream_frame_t *frame;
+
+    assert(release);
+    frame = malloc(sizeof(stream_frame_t));
+    if (!frame) {
+        release(opaque, buffer);
+        return NULL;
+    }
+    frame->data = data;
+    frame->data_len = data_len;
+    frame->pts = pts;
+    frame->refcount = 1;
+    frame->buffer = buffer;
+    frame->release = release;
+    frame->opaque = opaque;
+    return frame;
+}
+
+stream_frame_t *
+stream_frame_ref(stream_frame_t *frame)
+{
+    assert(frame);
+    __atomic_fetch_add(&frame->refcount, 1, __ATOMIC_RELAXED);
+    return frame;
+}
+
+void
+stream_frame_unref(stream_frame_t *frame)
+{
+    if (!frame) {
+        return;
+    }
+    if (__atomic_sub_fetch(&frame->refcount, 1, __ATOMIC_ACQ_REL) == 0) {
+        frame->release(frame->opaque, frame->buffer);
+        free(frame);
+    }
+}
@@ -16,15 +16,70 @@
 #define AIRPLAYSERVER_STREAM_H
 
 #include <stdint.h>
+#include <stdbool.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Maximum number of NAL units indexed per frame, frames with more carry no index */
+#define H264_MAX_NAL_UNITS 32
+
+typedef enum {
+    VIDEO_CODEC_H264,
+    VIDEO_CODEC_H265
+} video_codec_t;
+
+/* NAL unit type of the NAL unit whose header starts with byte */
+static inline int video_nal_type(video_codec_t codec, unsigned char byte) {
+    return codec == VIDEO_CODEC_H265 ? (byte >> 1) & 0x3f : byte & 0x1f;
+}
+
+/* True for the slices decoding can start at: IDR for H.264, IRAP (BLA, IDR, CRA) for H.265 */
+static inline bool video_nal_is_keyframe(video_codec_t codec, int nal_type) {
+    return codec == VIDEO_CODEC_H265 ? nal_type >= 16 && nal_type <= 21 : nal_type == 5;
+}
+
+/* True for the NAL unit types that carry a slice of a picture */
+static inline bool video_nal_is_slice(video_codec_t codec, int nal_type) {
+    return codec == VIDEO_CODEC_H265 ? nal_type < 32 : nal_type >= 1 && nal_type <= 5;
+}
+
+/* True for a slice no other picture predicts from, nal_ref_idc 0 in H.264 and a sub-layer
+ * non-reference picture in H.265. Takes the first byte of the slice's NAL header. */
+static inline bool video_nal_is_disposable(video_codec_t codec, unsigned char byte) {
+    int nal_type = video_nal_type(codec, byte);
+    return codec == VIDEO_CODEC_H265 ? nal_type <= 14 && (nal_type & 1) == 0 : (byte & 0x60) == 0;
+}
+
+/* Location of one NAL unit inside an Annex-B frame. offset points at the NAL
+ * header byte right after the start code, size excludes the start code.
+ * nal_type is a NAL unit type of the stream's codec. */
 typedef struct {
+    int offset;
+    int size;
+    int nal_type;
+} h264_nal_unit_t;
+
+typedef struct {
+    /* Video frames: IDRs since the stream started, and frames since the last one. AirPlay senders
+     * send no B-frames, so the latter is the frame's picture order within its GOP. */
     int n_gop_index;
     int frame_type;
+    video_codec_t codec;
+    /* Video frame with a slice decoding can start at */
+    int idr;
     int n_frame_poc;
     unsigned char *data;
     int data_len;
     unsigned int n_time_stamp;
     uint64_t pts;
+    /* NAL units found while building data, nal_count is 0 if the frame was not indexed */
+    int nal_count;
+    h264_nal_unit_t nal_units[H264_MAX_NAL_UNITS];
+    /* Frames passed on in parts as they arrive: the part's index, and whether more parts of the frame follow */
+    int part;
+    int partial;
 } h264_decode_struct;
 
 typedef struct {
@@ -33,4 +88,33 @@ typedef struct {
     uint64_t pts;
 } aac_decode_struct;
 
+/*
+ * Reference counted frame for handing a buffer over to a renderer instead of lending it.
+ * Whoever holds a reference may keep data after the call that delivered it, for example
+ * queued in a decoder. Once the last reference is dropped the buffer goes back to its
+ * owner through release. References may be dropped from any thread.
+ */
+typedef void (*stream_frame_release_t)(void *opaque, unsigned char *buffer);
+
+typedef struct stream_frame_s {
+    /* Payload, points into buffer */
+    unsigned char *data;
+    int data_len;
+    uint64_t pts;
+
+    int refcount;
+    unsigned char *buffer;
+    stream_frame_release_t release;
+    void *opaque;
+} stream_frame_t;
+
+stream_frame_t *stream_frame_new(unsigned char *buffer, unsigned char *data, int data_len, uint64_t pts,
+                                 stream_frame_release_t release, void *opaque);
+stream_frame_t *stream_frame_ref(stream_frame_t *frame);
+void stream_frame_unref(stream_frame_t *frame);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif //AIRPLAYSERVER_STREAM_H
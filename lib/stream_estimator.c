@@ -0,0 +1,202 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "stream_estimator.h"
+#include "threads.h"
+
+/* Frames remembered, five seconds at over 200 fps */
+#define STREAM_ESTIMATOR_FRAMES 1024
+#define STREAM_ESTIMATOR_WINDOW 5000000
+#define STREAM_ESTIMATOR_INSTANT_WINDOW 500000
+/* Frames the window needs before the renderer can be said to fall behind, a static screen sends few */
+#define STREAM_ESTIMATOR_MIN_FRAMES 30
+/* A pts this far behind the last one starts the stream over */
+#define STREAM_ESTIMATOR_PTS_JUMP 1000000
+
+typedef struct {
+    uint64_t pts;
+    int bytes;
+} stream_estimator_frame_t;
+
+struct stream_estimator_s {
+    mutex_handle_t mutex;
+
+    stream_estimator_frame_t frames[STREAM_ESTIMATOR_FRAMES];
+    unsigned int frame_count;
+    uint64_t rendered[STREAM_ESTIMATOR_FRAMES];
+    unsigned int rendered_count;
+
+    uint64_t last_idr;
+    uint64_t idr_interval;
+    uint64_t kind_frames[STREAM_FRAME_KINDS];
+    uint64_t kind_bytes[STREAM_FRAME_KINDS];
+};
+
+stream_estimator_t *
+stream_estimator_init(void)
+{
+    stream_estimator_t *estimator = calloc(1, sizeof(stream_estimator_t));
+    if (!estimator) {
+        return NULL;
+    }
+    MUTEX_CREATE(estimator->mutex);
+    return estimator;
+}
+
+void
+stream_estimator_add_frame(stream_estimator_t *estimator, uint64_t pts, int bytes, stream_frame_kind_t kind)
+{
+    assert(kind >= 0 && kind < STREAM_FRAME_KINDS);
+    MUTEX_LOCK(estimator->mutex);
+    if (estimator->frame_count) {
+        uint64_t last = estimator->frames[(estimator->frame_count - 1) % STREAM_ESTIMATOR_FRAMES].pts;
+        if (pts + STREAM_ESTIMATOR_PTS_JUMP < last) {
+            // The sender's clock started over, the old frames would make up a window of nonsense
+            estimator->frame_count = 0;
+            estimator->rendered_count = 0;
+            estimator->last_idr = 0;
+        }
+    }
+    estimator->frames[estimator->frame_count % STREAM_ESTIMATOR_FRAMES].pts = pts;
+    estimator->frames[estimator->frame_count % STREAM_ESTIMATOR_FRAMES].bytes = bytes;
+    estimator->frame_count++;
+    if (kind == STREAM_FRAME_KEY) {
+        if (estimator->last_idr && pts > estimator->last_idr) {
+            estimator->idr_interval = pts - estimator->last_idr;
+        }
+        estimator->last_idr = pts;
+    }
+    estimator->kind_frames[kind]++;
+    estimator->kind_bytes[kind] += bytes;
+    MUTEX_UNLOCK(estimator->mutex);
+}
+
+void
+stream_estimator_add_rendered(stream_estimator_t *estimator, uint64_t pts)
+{
+    MUTEX_LOCK(estimator->mutex);
+    estimator->rendered[estimator->rendered_count % STREAM_ESTIMATOR_FRAMES] = pts;
+    estimator->rendered_count++;
+    MUTEX_UNLOCK(estimator->mutex);
+}
+
+/*
+ * The frames of the last window us of pts, counting back from the newest. bytes leaves out the
+ * oldest one's, which arrived before the span starts. Returns how many there are.
+ */
+static unsigned int
+stream_estimator_window(stream_estimator_t *estimator, uint64_t window, uint64_t *oldest, uint64_t *bytes)
+{
+    unsigned int available = estimator->frame_count < STREAM_ESTIMATOR_FRAMES ? estimator->frame_count : STREAM_ESTIMATOR_FRAMES;
+    uint64_t newest = estimator->frames[(estimator->frame_count - 1) % STREAM_ESTIMATOR_FRAMES].pts;
+    unsigned int count = 0;
+
+    *oldest = newest;
+    *bytes = 0;
+    for (unsigned int i = 0; i < available; i++) {
+        stream_estimator_frame_t *frame = &estimator->frames[(estimator->frame_count - 1 - i) % STREAM_ESTIMATOR_FRAMES];
+        if (frame->pts + window < newest) {
+            break;
+        }
+        if (count) {
+            *bytes += (uint64_t) estimator->frames[(estimator->frame_count - i) % STREAM_ESTIMATOR_FRAMES].bytes;
+        }
+        *oldest = frame->pts < *oldest ? frame->pts : *oldest;
+        count++;
+    }
+    return count;
+}
+
+static void
+stream_estimator_compute(stream_estimator_t *estimator, stream_estimator_stats_t *stats)
+{
+    uint64_t oldest, bytes;
+    unsigned int count;
+
+    if (!estimator->frame_count) {
+        return;
+    }
+    uint64_t newest = estimator->frames[(estimator->frame_count - 1) % STREAM_ESTIMATOR_FRAMES].pts;
+
+    count = stream_estimator_window(estimator, STREAM_ESTIMATOR_INSTANT_WINDOW, &oldest, &bytes);
+    if (count > 1 && newest > oldest) {
+        stats->instant_bitrate = bytes * 8 * 1000000 / (newest - oldest);
+    }
+    count = stream_estimator_window(estimator, STREAM_ESTIMATOR_WINDOW, &oldest, &bytes);
+    if (count < 2 || newest <= oldest) {
+        return;
+    }
+    stats->bitrate = bytes * 8 * 1000000 / (newest - oldest);
+    stats->frame_rate = (count - 1) * 1000000.0 / (newest - oldest);
+
+    // Frames of the same span the renderer was given, the ones still on their way to it are few
+    unsigned int available = estimator->rendered_count < STREAM_ESTIMATOR_FRAMES ? estimator->rendered_count : STREAM_ESTIMATOR_FRAMES;
+    unsigned int rendered = 0;
+    for (unsigned int i = 0; i < available; i++) {
+        uint64_t pts = estimator->rendered[(estimator->rendered_count - 1 - i) % STREAM_ESTIMATOR_FRAMES];
+        if (pts >= oldest && pts <= newest) {
+            rendered++;
+        } else if (pts < oldest) {
+            break;
+        }
+    }
+    stats->rendered_rate = stats->frame_rate * rendered / count;
+    stats->falling_behind = count >= STREAM_ESTIMATOR_MIN_FRAMES && rendered * 10 < count * 9;
+}
+
+void
+stream_estimator_get_stats(stream_estimator_t *estimator, stream_estimator_stats_t *stats)
+{
+    memset(stats, 0, sizeof(stream_estimator_stats_t));
+    MUTEX_LOCK(estimator->mutex);
+    stream_estimator_compute(estimator, stats);
+    stats->idr_interval = estimator->idr_interval;
+    for (int i = 0; i < STREAM_FRAME_KINDS; i++) {
+        stats->frames[i] = estimator->kind_frames[i];
+        stats->frame_bytes[i] = estimator->kind_frames[i] ? estimator->kind_bytes[i] / estimator->kind_frames[i] : 0;
+    }
+    MUTEX_UNLOCK(estimator->mutex);
+}
+
+bool
+stream_estimator_is_falling_behind(stream_estimator_t *estimator)
+{
+    stream_estimator_stats_t stats;
+    stream_estimator_get_stats(estimator, &stats);
+    return stats.falling_behind;
+}
+
+void
+stream_estimator_reset(stream_estimator_t *estimator)
+{
+    MUTEX_LOCK(estimator->mutex);
+    estimator->frame_count = 0;
+    estimator->rendered_count = 0;
+    estimator->last_idr = 0;
+    estimator->idr_interval = 0;
+    memset(estimator->kind_frames, 0, sizeof(estimator->kind_frames));
+    memset(estimator->kind_bytes, 0, sizeof(estimator->kind_bytes));
+    MUTEX_UNLOCK(estimator->mutex);
+}
+
+void
+stream_estimator_destroy(stream_estimator_t *estimator)
+{
+    if (estimator) {
+        MUTEX_DESTROY(estimator->mutex);
+        free(estimator);
+    }
+}
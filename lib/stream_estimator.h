@@ -0,0 +1,68 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#ifndef STREAM_ESTIMATOR_H
+#define STREAM_ESTIMATOR_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * What a mirrored stream carries, measured on the sender's pts rather than
+ * on arrival, so the encoder's behaviour shows apart from the network's:
+ * bitrate over the last half second and the last five, frame rate, the
+ * time between IDRs and the average size of keyframes, reference frames
+ * and frames nothing references. Frames passed on to the renderer are
+ * counted as well, so a decoder that takes fewer than the sender encodes
+ * shows as falling behind.
+ *
+ * Frames are added by one thread and the renderer's by one other, any
+ * thread may read the statistics.
+ */
+
+typedef struct stream_estimator_s stream_estimator_t;
+
+typedef enum {
+    STREAM_FRAME_KEY,
+    STREAM_FRAME_REFERENCE,
+    /* Frames no other picture predicts from */
+    STREAM_FRAME_DISPOSABLE,
+    STREAM_FRAME_KINDS
+} stream_frame_kind_t;
+
+typedef struct {
+    /* In bit/s over the last half second and the last five seconds of pts */
+    uint64_t instant_bitrate;
+    uint64_t bitrate;
+    /* Frames per second the sender encodes and the renderer was given, over the last five seconds */
+    double frame_rate;
+    double rendered_rate;
+    /* Time between the last two IDRs in us, 0 until two arrived */
+    uint64_t idr_interval;
+    /* Frames and their average size in bytes since the start, by kind */
+    uint64_t frames[STREAM_FRAME_KINDS];
+    uint64_t frame_bytes[STREAM_FRAME_KINDS];
+    /* The renderer was given under nine in ten of the frames sent over the last five seconds */
+    bool falling_behind;
+} stream_estimator_stats_t;
+
+stream_estimator_t *stream_estimator_init(void);
+/* A frame as the sender encoded it, pts in us of any clock */
+void stream_estimator_add_frame(stream_estimator_t *estimator, uint64_t pts, int bytes, stream_frame_kind_t kind);
+/* A frame the renderer was given */
+void stream_estimator_add_rendered(stream_estimator_t *estimator, uint64_t pts);
+void stream_estimator_get_stats(stream_estimator_t *estimator, stream_estimator_stats_t *stats);
+bool stream_estimator_is_falling_behind(stream_estimator_t *estimator);
+void stream_estimator_reset(stream_estimator_t *estimator);
+void stream_estimator_destroy(stream_estimator_t *estimator);
+
+#endif //STREAM_ESTIMATOR_H
@@ -0,0 +1,348 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <assert.h>
+
+#include "task_pool.h"
+#include "threads.h"
+#include "thread_attr.h"
+#include "utils.h"
+
+/* Tasks each worker holds per priority, more are run by their submitter */
+#define TASK_POOL_QUEUE_SIZE 64
+
+typedef struct {
+    task_func_t func;
+    void *arg;
+    task_group_t *group;
+} task_t;
+
+typedef struct {
+    task_t tasks[TASK_POOL_QUEUE_SIZE];
+    /* Oldest task and the slot after the newest, counting up */
+    unsigned int head;
+    unsigned int tail;
+} task_queue_t;
+
+typedef struct {
+    task_pool_t *pool;
+    int index;
+    thread_handle_t thread;
+    /* Guards the queues against the owner and thieves */
+    mutex_handle_t mutex;
+    task_queue_t queues[TASK_PRIORITY_COUNT];
+} task_pool_worker_t;
+
+struct task_pool_s {
+    logger_t *logger;
+    int pin;
+
+    task_pool_worker_t workers[TASK_POOL_MAX_THREADS];
+    int thread_count;
+    /* Worker the next task from outside the pool is queued with */
+    unsigned int next_worker;
+    /* Workers running a low priority task */
+    unsigned int low_running;
+
+    /* Counts up whenever there may be work for a sleeping worker, guarded by mutex */
+    unsigned int generation;
+    bool running;
+    mutex_handle_t mutex;
+    cond_handle_t work_cond;
+    cond_handle_t done_cond;
+
+    task_pool_stats_t stats;
+};
+
+/* The worker of the calling thread, so its tasks go to its own queue */
+static __thread task_pool_worker_t *task_pool_self;
+
+static int
+task_pool_self_index(task_pool_t *pool)
+{
+    return task_pool_self && task_pool_self->pool == pool ? task_pool_self->index : -1;
+}
+
+static bool
+task_pool_push(task_pool_worker_t *worker, task_priority_t priority, const task_t *task)
+{
+    task_queue_t *queue = &worker->queues[priority];
+    bool pushed = false;
+
+    MUTEX_LOCK(worker->mutex);
+    if (queue->tail - queue->head < TASK_POOL_QUEUE_SIZE) {
+        queue->tasks[queue->tail++ % TASK_POOL_QUEUE_SIZE] = *task;
+        pushed = true;
+    }
+    MUTEX_UNLOCK(worker->mutex);
+    return pushed;
+}
+
+/* The newest task of the own queue of priority, else the oldest of another worker's */
+static bool
+task_pool_take_priority(task_pool_t *pool, int self, task_priority_t priority, task_t *task)
+{
+    for (int i = 0; i < pool->thread_count; i++) {
+        int index = self >= 0 ? (self + i) % pool->thread_count : i;
+        task_pool_worker_t *worker = &pool->workers[index];
+        task_queue_t *queue = &worker->queues[priority];
+        bool taken = false;
+
+        MUTEX_LOCK(worker->mutex);
+        if (queue->tail != queue->head) {
+            if (index == self) {
+                *task = queue->tasks[--queue->tail % TASK_POOL_QUEUE_SIZE];
+            } else {
+                *task = queue->tasks[queue->head++ % TASK_POOL_QUEUE_SIZE];
+            }
+            taken = true;
+        }
+        MUTEX_UNLOCK(worker->mutex);
+        if (taken) {
+            if (index != self) {
+                __atomic_fetch_add(&pool->stats.steals, 1, __ATOMIC_RELAXED);
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Takes the most urgent task there is. A low priority one only while another worker stays free
+ * for the rest, unless the caller is blocked anyway. Returns its priority, or -1 if there is none.
+ */
+static int
+task_pool_take(task_pool_t *pool, int self, bool any_low, task_t *task)
+{
+    for (int priority = 0; priority < TASK_PRIORITY_LOW; priority++) {
+        if (task_pool_take_priority(pool, self, priority, task)) {
+            return priority;
+        }
+    }
+
+    unsigned int low_running = __atomic_load_n(&pool->low_running, __ATOMIC_RELAXED);
+    unsigned int low_limit = pool->thread_count > 1 ? pool->thread_count - 1 : 1;
+    do {
+        if (!any_low && low_running >= low_limit) {
+            return -1;
+        }
+    } while (!__atomic_compare_exchange_n(&pool->low_running, &low_running, low_running + 1, true,
+                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    if (task_pool_take_priority(pool, self, TASK_PRIORITY_LOW, task)) {
+        return TASK_PRIORITY_LOW;
+    }
+    __atomic_fetch_sub(&pool->low_running, 1, __ATOMIC_RELAXED);
+    return -1;
+}
+
+static void
+task_pool_wake(task_pool_t *pool)
+{
+    MUTEX_LOCK(pool->mutex);
+    pool->generation++;
+    COND_SIGNAL(pool->work_cond);
+    MUTEX_UNLOCK(pool->mutex);
+}
+
+static void
+task_pool_run(task_pool_t *pool, const task_t *task, int priority)
+{
+    task->func(task->arg);
+    __atomic_fetch_add(&pool->stats.tasks, 1, __ATOMIC_RELAXED);
+    if (priority == TASK_PRIORITY_LOW) {
+        // A worker may have left a low priority task for this one to finish
+        __atomic_fetch_sub(&pool->low_running, 1, __ATOMIC_RELAXED);
+        task_pool_wake(pool);
+    }
+    if (task->group && __atomic_sub_fetch(&task->group->pending, 1, __ATOMIC_ACQ_REL) == 0) {
+        MUTEX_LOCK(pool->mutex);
+        COND_BROADCAST(pool->done_cond);
+        MUTEX_UNLOCK(pool->mutex);
+    }
+}
+
+static THREAD_RETVAL
+task_pool_thread(void *arg)
+{
+    task_pool_worker_t *worker = arg;
+    task_pool_t *pool = worker->pool;
+    char name[16];
+
+    snprintf(name, sizeof(name), "rp-pool%d", worker->index);
+    thread_attr_apply(pool->logger, THREAD_ROLE_NONE, name);
+    if (pool->pin && utils_set_thread_cpu(worker->index) < 0) {
+        logger_log(pool->logger, LOGGER_DEBUG, "task_pool could not pin worker %d", worker->index);
+    }
+    task_pool_self = worker;
+
+    while (true) {
+        MUTEX_LOCK(pool->mutex);
+        unsigned int seen = pool->generation;
+        bool running = pool->running;
+        MUTEX_UNLOCK(pool->mutex);
+
+        // Once stopping, the queues are emptied whatever the priority
+        task_t task;
+        int priority = task_pool_take(pool, worker->index, !running, &task);
+        if (priority >= 0) {
+            task_pool_run(pool, &task, priority);
+            continue;
+        }
+        if (!running) {
+            break;
+        }
+
+        MUTEX_LOCK(pool->mutex);
+        while (pool->running && pool->generation == seen) {
+            COND_WAIT(pool->work_cond, pool->mutex);
+        }
+        MUTEX_UNLOCK(pool->mutex);
+    }
+    task_pool_self = NULL;
+    return 0;
+}
+
+task_pool_t *
+task_pool_init(logger_t *logger, int threads, int pin)
+{
+    task_pool_t *pool = calloc(1, sizeof(task_pool_t));
+    if (!pool) {
+        return NULL;
+    }
+    if (threads <= 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cores > 0 ? (int) cores : 1;
+    }
+    if (threads > TASK_POOL_MAX_THREADS) {
+        threads = TASK_POOL_MAX_THREADS;
+    }
+    pool->logger = logger;
+    pool->pin = pin;
+    pool->running = true;
+    MUTEX_CREATE(pool->mutex);
+    COND_CREATE(pool->work_cond);
+    COND_CREATE(pool->done_cond);
+
+    for (int i = 0; i < threads; i++) {
+        task_pool_worker_t *worker = &pool->workers[i];
+        worker->pool = pool;
+        worker->index = i;
+        MUTEX_CREATE(worker->mutex);
+    }
+    // Workers look at each other's queues, so all of them exist before any starts
+    pool->thread_count = threads;
+    for (int i = 0; i < threads; i++) {
+        THREAD_CREATE(pool->workers[i].thread, task_pool_thread, &pool->workers[i]);
+        if (!pool->workers[i].thread) {
+            logger_log(logger, LOGGER_ERR, "task_pool could only start %d of %d workers", i, threads);
+            pool->thread_count = i;
+            task_pool_destroy(pool);
+            return NULL;
+        }
+    }
+    pool->stats.threads = threads;
+    return pool;
+}
+
+int
+task_pool_get_threads(task_pool_t *pool)
+{
+    assert(pool);
+    return pool->stats.threads;
+}
+
+void
+task_pool_submit(task_pool_t *pool, task_group_t *group, task_priority_t priority, task_func_t func, void *arg)
+{
+    task_t task = { func, arg, group };
+    int self = task_pool_self_index(pool);
+    unsigned int first = self >= 0 ? (unsigned int) self : __atomic_fetch_add(&pool->next_worker, 1, __ATOMIC_RELAXED);
+
+    assert(priority >= 0 && priority < TASK_PRIORITY_COUNT);
+    if (group) {
+        __atomic_fetch_add(&group->pending, 1, __ATOMIC_RELAXED);
+    }
+    for (int i = 0; i < pool->thread_count; i++) {
+        if (task_pool_push(&pool->workers[(first + i) % pool->thread_count], priority, &task)) {
+            task_pool_wake(pool);
+            return;
+        }
+    }
+    __atomic_fetch_add(&pool->stats.inline_runs, 1, __ATOMIC_RELAXED);
+    task_pool_run(pool, &task, -1);
+}
+
+void
+task_group_init(task_group_t *group, task_pool_t *pool)
+{
+    group->pool = pool;
+    group->pending = 0;
+}
+
+void
+task_group_wait(task_group_t *group)
+{
+    task_pool_t *pool = group->pool;
+    int self = task_pool_self_index(pool);
+
+    while (__atomic_load_n(&group->pending, __ATOMIC_ACQUIRE) > 0) {
+        // Help rather than block, a worker waiting here would otherwise hold up the pool
+        task_t task;
+        int priority = task_pool_take(pool, self, true, &task);
+        if (priority >= 0) {
+            task_pool_run(pool, &task, priority);
+            continue;
+        }
+        // The rest is running on the workers
+        MUTEX_LOCK(pool->mutex);
+        while (__atomic_load_n(&group->pending, __ATOMIC_ACQUIRE) > 0) {
+            COND_WAIT(pool->done_cond, pool->mutex);
+        }
+        MUTEX_UNLOCK(pool->mutex);
+    }
+}
+
+void
+task_pool_get_stats(task_pool_t *pool, task_pool_stats_t *stats)
+{
+    stats->tasks = __atomic_load_n(&pool->stats.tasks, __ATOMIC_RELAXED);
+    stats->steals = __atomic_load_n(&pool->stats.steals, __ATOMIC_RELAXED);
+    stats->inline_runs = __atomic_load_n(&pool->stats.inline_runs, __ATOMIC_RELAXED);
+    stats->threads = pool->stats.threads;
+}
+
+void
+task_pool_destroy(task_pool_t *pool)
+{
+    if (pool) {
+        MUTEX_LOCK(pool->mutex);
+        pool->running = false;
+        COND_BROADCAST(pool->work_cond);
+        MUTEX_UNLOCK(pool->mutex);
+        for (int i = 0; i < pool->thread_count; i++) {
+            THREAD_JOIN(pool->workers[i].thread);
+        }
+        for (int i = 0; i < TASK_POOL_MAX_THREADS; i++) {
+            if (pool->workers[i].pool) {
+                MUTEX_DESTROY(pool->workers[i].mutex);
+            }
+        }
+        COND_DESTROY(pool->done_cond);
+        COND_DESTROY(pool->work_cond);
+        MUTEX_DESTROY(pool->mutex);
+        free(pool);
+    }
+}
@@ -0,0 +1,75 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#ifndef TASK_POOL_H
+#define TASK_POOL_H
+
+#include <stdint.h>
+#include "logger.h"
+
+/*
+ * A fixed set of worker threads shared by everything that wants work done
+ * off its own thread, so that features and sessions don't each start
+ * threads of their own and oversubscribe the cores. Every worker has a
+ * queue per priority. Tasks submitted from a worker go to its own queue
+ * and are taken newest first while they are still in the cache, others are
+ * dealt round the workers. An idle worker steals the oldest task of the
+ * others' queues. Higher priorities always go first, and low priority
+ * tasks never hold every worker, so one is left for latency critical work.
+ */
+
+#define TASK_POOL_MAX_THREADS 8
+
+typedef struct task_pool_s task_pool_t;
+
+typedef enum {
+    /* Work a stream is waiting for, such as the chunks of a frame */
+    TASK_PRIORITY_HIGH,
+    TASK_PRIORITY_NORMAL,
+    /* Background work such as key generation or thumbnails */
+    TASK_PRIORITY_LOW,
+    TASK_PRIORITY_COUNT
+} task_priority_t;
+
+typedef void (*task_func_t)(void *arg);
+
+/* Tasks that are waited for together, lives with the caller */
+typedef struct {
+    task_pool_t *pool;
+    unsigned int pending;
+} task_group_t;
+
+typedef struct {
+    uint64_t tasks;
+    /* Tasks a worker took from another's queue */
+    uint64_t steals;
+    /* Tasks run by their submitter because the queues were full */
+    uint64_t inline_runs;
+    int threads;
+} task_pool_stats_t;
+
+/* threads 0 starts one per online core, pin puts worker n on core n */
+task_pool_t *task_pool_init(logger_t *logger, int threads, int pin);
+int task_pool_get_threads(task_pool_t *pool);
+/*
+ * Queues func(arg) to run on a worker, counted in group unless that is NULL.
+ * When the queues are full it runs on the caller before returning.
+ */
+void task_pool_submit(task_pool_t *pool, task_group_t *group, task_priority_t priority, task_func_t func, void *arg);
+void task_group_init(task_group_t *group, task_pool_t *pool);
+/* Returns once every task of group has run, running queued tasks meanwhile */
+void task_group_wait(task_group_t *group);
+void task_pool_get_stats(task_pool_t *pool, task_pool_stats_t *stats);
+/* Runs the queued tasks, then stops the workers */
+void task_pool_destroy(task_pool_t *pool);
+
+#endif //TASK_POOL_H
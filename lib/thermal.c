@@ -0,0 +1,282 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <assert.h>
+#include <time.h>
+
+#include "thermal.h"
+#include "threads.h"
+#include "thread_attr.h"
+
+#define THERMAL_INTERVAL_MS 2000
+/* Weight of a new sample of the temperature and of its trend */
+#define THERMAL_SMOOTHING 0.3
+#define THERMAL_TREND_SMOOTHING 0.1
+/* Minutes the trend is extrapolated ahead, the time it takes a small enclosure to settle */
+#define THERMAL_HORIZON 2.0
+/* Degrees below the limit at which the receiver is warm whatever the trend */
+#define THERMAL_WARM_MARGIN 5.0
+/* Degrees below where a level started that the temperature has to drop to end it */
+#define THERMAL_HYSTERESIS 3.0
+#define THERMAL_ZONES 16
+
+#define THERMAL_THROTTLED_PATH "/sys/devices/platform/soc/soc:firmware/get_throttled"
+
+struct thermal_s {
+    logger_t *logger;
+    double limit;
+    thermal_callback_t callback;
+    void *callback_cls;
+
+    /* The CPU's thermal zone, empty if there is none */
+    char zone_path[64];
+    bool has_throttled;
+
+    thread_handle_t thread;
+    bool running;
+    mutex_handle_t mutex;
+    cond_handle_t cond;
+
+    /* Only touched by the sampling thread */
+    bool sampled;
+    uint64_t last_sample;
+
+    /* Guarded by mutex */
+    thermal_stats_t stats;
+};
+
+static uint64_t
+thermal_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* Reads the first number of a sysfs file in base, returns -1 if there is none */
+static int
+thermal_read_value(const char *path, int base, unsigned long *value)
+{
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        return -1;
+    }
+    char line[32];
+    char *end = NULL;
+    if (fgets(line, sizeof(line), file)) {
+        *value = strtoul(line, &end, base);
+    }
+    fclose(file);
+    return end && end != line ? 0 : -1;
+}
+
+/* The zone of the CPU or the SoC, or the first one if none says which it is */
+static void
+thermal_find_zone(thermal_t *thermal)
+{
+    thermal->zone_path[0] = '\0';
+    for (int i = 0; i < THERMAL_ZONES; i++) {
+        char path[64];
+        char type[32] = "";
+        snprintf(path, sizeof(path), "/sys/class/thermal/thermal_zone%d/type", i);
+        FILE *file = fopen(path, "r");
+        if (!file) {
+            break;
+        }
+        if (!fgets(type, sizeof(type), file)) {
+            type[0] = '\0';
+        }
+        fclose(file);
+        bool cpu = strstr(type, "cpu") || strstr(type, "soc") || strstr(type, "x86_pkg");
+        if (cpu || !thermal->zone_path[0]) {
+            snprintf(thermal->zone_path, sizeof(thermal->zone_path), "/sys/class/thermal/thermal_zone%d/temp", i);
+        }
+        if (cpu) {
+            break;
+        }
+    }
+}
+
+/* The level the stats call for, with the temperatures margin degrees lower */
+static thermal_level_t
+thermal_level_for(thermal_t *thermal, const thermal_stats_t *stats, double margin)
+{
+    double limit = thermal->limit - margin;
+    if (stats->temperature >= limit || (stats->throttled & THERMAL_THROTTLED)) {
+        return THERMAL_HOT;
+    }
+    double ahead = stats->temperature + (stats->trend > 0 ? stats->trend * THERMAL_HORIZON : 0);
+    if (ahead >= limit || stats->temperature >= limit - THERMAL_WARM_MARGIN ||
+        (stats->throttled & (THERMAL_FREQUENCY_CAPPED | THERMAL_SOFT_LIMIT))) {
+        return THERMAL_WARM;
+    }
+    return THERMAL_NORMAL;
+}
+
+static void
+thermal_sample(thermal_t *thermal)
+{
+    static const char *const names[] = { "normal", "warm", "hot" };
+    uint64_t now = thermal_now();
+    unsigned long millidegrees = 0, throttled = 0;
+    bool has_temperature = thermal->zone_path[0] && thermal_read_value(thermal->zone_path, 10, &millidegrees) == 0;
+    if (thermal->has_throttled && thermal_read_value(THERMAL_THROTTLED_PATH, 16, &throttled) < 0) {
+        throttled = 0;
+    }
+
+    MUTEX_LOCK(thermal->mutex);
+    thermal_stats_t *stats = &thermal->stats;
+    if (has_temperature) {
+        double temperature = millidegrees / 1000.0;
+        if (!thermal->sampled) {
+            stats->temperature = temperature;
+        } else {
+            double previous = stats->temperature;
+            stats->temperature += THERMAL_SMOOTHING * (temperature - stats->temperature);
+            double minutes = (now - thermal->last_sample) / 60000000.0;
+            if (minutes > 0) {
+                stats->trend += THERMAL_TREND_SMOOTHING * ((stats->temperature - previous) / minutes - stats->trend);
+            }
+        }
+        thermal->sampled = true;
+        thermal->last_sample = now;
+    }
+    stats->throttled = throttled & (THERMAL_UNDER_VOLTAGE | THERMAL_FREQUENCY_CAPPED | THERMAL_THROTTLED | THERMAL_SOFT_LIMIT);
+
+    thermal_level_t was = stats->level;
+    thermal_level_t level = thermal_level_for(thermal, stats, 0);
+    if (level > was) {
+        stats->escalations++;
+        logger_log(thermal->logger, LOGGER_WARNING, "SoC %s: %.1f C, rising %.1f C per minute, throttling state 0x%x",
+                   names[level], stats->temperature, stats->trend, stats->throttled);
+    } else {
+        level = thermal_level_for(thermal, stats, THERMAL_HYSTERESIS);
+        if (level < was) {
+            logger_log(thermal->logger, LOGGER_INFO, "SoC back to %s at %.1f C", names[level], stats->temperature);
+        } else {
+            level = was;
+        }
+    }
+    __atomic_store_n(&stats->level, level, __ATOMIC_RELAXED);
+    MUTEX_UNLOCK(thermal->mutex);
+
+    if (level != was && thermal->callback) {
+        thermal->callback(thermal->callback_cls, level);
+    }
+}
+
+static THREAD_RETVAL
+thermal_thread(void *arg)
+{
+    thermal_t *thermal = arg;
+
+    thread_attr_apply(thermal->logger, THREAD_ROLE_NONE, "rp-thermal");
+    MUTEX_LOCK(thermal->mutex);
+    while (thermal->running) {
+        MUTEX_UNLOCK(thermal->mutex);
+        thermal_sample(thermal);
+        MUTEX_LOCK(thermal->mutex);
+
+        uint64_t wake = thermal_now() + THERMAL_INTERVAL_MS * 1000;
+        struct timespec abstime;
+        abstime.tv_sec = wake / 1000000;
+        abstime.tv_nsec = (wake % 1000000) * 1000;
+        while (thermal->running && thermal_now() < wake) {
+            COND_TIMEDWAIT(thermal->cond, thermal->mutex, abstime);
+        }
+    }
+    MUTEX_UNLOCK(thermal->mutex);
+    return 0;
+}
+
+thermal_t *
+thermal_init(logger_t *logger, double limit)
+{
+    thermal_t *thermal = calloc(1, sizeof(thermal_t));
+    if (!thermal) {
+        return NULL;
+    }
+    thermal->logger = logger;
+    thermal->limit = limit;
+    MUTEX_CREATE(thermal->mutex);
+    COND_CREATE_MONOTONIC(thermal->cond);
+    return thermal;
+}
+
+void
+thermal_set_callback(thermal_t *thermal, thermal_callback_t callback, void *cls)
+{
+    assert(thermal);
+    thermal->callback = callback;
+    thermal->callback_cls = cls;
+}
+
+int
+thermal_start(thermal_t *thermal)
+{
+    assert(thermal);
+    if (thermal->running) {
+        return 0;
+    }
+#if defined(__linux__)
+    unsigned long value;
+    thermal_find_zone(thermal);
+    thermal->has_throttled = thermal_read_value(THERMAL_THROTTLED_PATH, 16, &value) == 0;
+#endif
+    if (!thermal->zone_path[0] && !thermal->has_throttled) {
+        logger_log(thermal->logger, LOGGER_INFO, "No temperature sensor found, not watching the temperature");
+        return 0;
+    }
+    thermal->running = true;
+    THREAD_CREATE(thermal->thread, thermal_thread, thermal);
+    if (!thermal->thread) {
+        thermal->running = false;
+        return -1;
+    }
+    return 0;
+}
+
+thermal_level_t
+thermal_get_level(thermal_t *thermal)
+{
+    return thermal ? __atomic_load_n(&thermal->stats.level, __ATOMIC_RELAXED) : THERMAL_NORMAL;
+}
+
+void
+thermal_get_stats(thermal_t *thermal, thermal_stats_t *stats)
+{
+    MUTEX_LOCK(thermal->mutex);
+    memcpy(stats, &thermal->stats, sizeof(thermal_stats_t));
+    MUTEX_UNLOCK(thermal->mutex);
+}
+
+void
+thermal_destroy(thermal_t *thermal)
+{
+    if (thermal) {
+        MUTEX_LOCK(thermal->mutex);
+        bool running = thermal->running;
+        thermal->running = false;
+        COND_SIGNAL(thermal->cond);
+        MUTEX_UNLOCK(thermal->mutex);
+        if (running) {
+            THREAD_JOIN(thermal->thread);
+        }
+        COND_DESTROY(thermal->cond);
+        MUTEX_DESTROY(thermal->mutex);
+        free(thermal);
+    }
+}
@@ -0,0 +1,72 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#ifndef THERMAL_H
+#define THERMAL_H
+
+#include <stdint.h>
+#include "logger.h"
+
+/*
+ * Watches the temperature of the SoC, so a receiver without a fan can do
+ * less work before the firmware throttles its clocks and the frame rate
+ * collapses. A thread samples every few seconds the CPU's thermal zone and,
+ * on a Raspberry Pi, the throttling state the firmware reports, the one
+ * vcgencmd get_throttled shows. The temperature is smoothed, and how fast it
+ * rises is extrapolated a couple of minutes ahead: the receiver gets warm
+ * once it is heading for the limit or the firmware capped its clocks, and
+ * hot once it is there or throttled. It only cools down a few degrees below
+ * where it got warm or hot. Linux only, elsewhere it stays normal.
+ */
+
+typedef struct thermal_s thermal_t;
+
+typedef enum {
+    THERMAL_NORMAL = 0,
+    /* Heading for the limit, or the clocks are capped */
+    THERMAL_WARM,
+    /* At the limit, or throttled */
+    THERMAL_HOT
+} thermal_level_t;
+
+/* Bits of the firmware's throttling state that are about now, not since boot */
+#define THERMAL_UNDER_VOLTAGE 0x1
+#define THERMAL_FREQUENCY_CAPPED 0x2
+#define THERMAL_THROTTLED 0x4
+#define THERMAL_SOFT_LIMIT 0x8
+
+/* Called from the sampling thread when the level changes */
+typedef void (*thermal_callback_t)(void *cls, thermal_level_t level);
+
+typedef struct {
+    /* Smoothed temperature in degrees Celsius, and how fast it rises in degrees per minute */
+    double temperature;
+    double trend;
+    /* Firmware throttling state, 0 where there is none */
+    unsigned int throttled;
+    thermal_level_t level;
+    /* Times the level went up */
+    uint64_t escalations;
+} thermal_stats_t;
+
+/* limit is the temperature in degrees Celsius the receiver should stay below */
+thermal_t *thermal_init(logger_t *logger, double limit);
+/* Set before thermal_start */
+void thermal_set_callback(thermal_t *thermal, thermal_callback_t callback, void *cls);
+/* Starts sampling, unless there is nothing to sample. Returns -1 if the thread could not be started */
+int thermal_start(thermal_t *thermal);
+/* THERMAL_NORMAL for NULL */
+thermal_level_t thermal_get_level(thermal_t *thermal);
+void thermal_get_stats(thermal_t *thermal, thermal_stats_t *stats);
+void thermal_destroy(thermal_t *thermal);
+
+#endif //THERMAL_H
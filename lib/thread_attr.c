@@ -0,0 +1,187 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#if defined(__linux__)
+#include <sched.h>
+#endif
+
+#include "thread_attr.h"
+#include "thread_stats.h"
+#include "utils.h"
+
+/* Stack a real-time thread faults in and locks when it starts, if stacks are to be locked */
+#define THREAD_ATTR_STACK_PREFAULT (64 * 1024)
+
+static const char *thread_role_names[THREAD_ROLE_COUNT] = { "mirror", "audio", "ntp", "httpd" };
+static const char *thread_policy_names[] = { "other", "fifo", "rr" };
+
+/* Written before any thread starts and only read afterwards */
+static thread_attr_t thread_attrs[THREAD_ROLE_COUNT];
+static int thread_attrs_configured;
+static int thread_attrs_lock_stacks;
+#if defined(__linux__)
+static cpu_set_t thread_attrs_default_cpus;
+#endif
+
+void
+thread_attr_set(thread_role_t role, const thread_attr_t *attr)
+{
+    if (role <= THREAD_ROLE_NONE || role >= THREAD_ROLE_COUNT) {
+        return;
+    }
+#if defined(__linux__)
+    if (!thread_attrs_configured && sched_getaffinity(0, sizeof(cpu_set_t), &thread_attrs_default_cpus) < 0) {
+        CPU_ZERO(&thread_attrs_default_cpus);
+    }
+#endif
+    thread_attrs[role] = *attr;
+    thread_attrs_configured = 1;
+}
+
+void
+thread_attr_set_lock_stacks(int enabled)
+{
+    thread_attrs_lock_stacks = enabled;
+}
+
+/* Below the frames of the caller, which have faulted in already */
+static void __attribute__((noinline))
+thread_attr_lock_stack(logger_t *logger, const char *name)
+{
+    static int warned;
+    unsigned char stack[THREAD_ATTR_STACK_PREFAULT];
+
+    if (utils_prefault(stack, sizeof(stack), 1) < 0 && !__atomic_exchange_n(&warned, 1, __ATOMIC_RELAXED)) {
+        logger_log(logger, LOGGER_WARNING, "Could not lock the stack of thread %s in memory, "
+                   "needs CAP_IPC_LOCK or a larger RLIMIT_MEMLOCK", name);
+    }
+}
+
+static int
+thread_attr_lookup(const char *name, size_t len, const char **names, int count)
+{
+    for (int i = 0; i < count; i++) {
+        if (strlen(names[i]) == len && !strncmp(name, names[i], len)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int
+thread_attr_parse(const char *spec)
+{
+    thread_attr_t attr = { THREAD_POLICY_OTHER, 0, 0 };
+    const char *p = spec;
+    char *end;
+    int role, policy;
+    size_t len;
+
+    len = strcspn(p, ":");
+    role = thread_attr_lookup(p, len, thread_role_names, THREAD_ROLE_COUNT);
+    if (role < 0 || p[len] != ':') {
+        return -1;
+    }
+    p += len + 1;
+    len = strcspn(p, ":@");
+    policy = thread_attr_lookup(p, len, thread_policy_names, 3);
+    if (policy < 0) {
+        return -1;
+    }
+    attr.policy = policy;
+    p += len;
+    if (*p == ':') {
+        attr.priority = strtol(p + 1, &end, 10);
+        if (end == p + 1 || attr.priority < 1 || attr.priority > 99) {
+            return -1;
+        }
+        p = end;
+    } else if (attr.policy != THREAD_POLICY_OTHER) {
+        attr.priority = 50;
+    }
+    if (attr.policy == THREAD_POLICY_OTHER && attr.priority) {
+        return -1;
+    }
+    if (*p == '@') {
+        do {
+            long cpu = strtol(p + 1, &end, 10);
+            if (end == p + 1 || cpu < 0 || cpu > 63) {
+                return -1;
+            }
+            attr.cpus |= (uint64_t) 1 << cpu;
+            p = end;
+        } while (*p == ',');
+    }
+    if (*p) {
+        return -1;
+    }
+    thread_attr_set(role, &attr);
+    return 0;
+}
+
+void
+thread_attr_apply(logger_t *logger, thread_role_t role, const char *name)
+{
+    static const thread_attr_t defaults = { THREAD_POLICY_OTHER, 0, 0 };
+    const thread_attr_t *attr = &defaults;
+    struct sched_param param = { .sched_priority = 0 };
+    int policy = SCHED_OTHER;
+    int ret;
+
+#if defined(__linux__)
+    pthread_setname_np(pthread_self(), name);
+#endif
+    thread_stats_register(name);
+    if (!thread_attrs_configured) {
+        return;
+    }
+    if (role > THREAD_ROLE_NONE && role < THREAD_ROLE_COUNT) {
+        attr = &thread_attrs[role];
+    }
+    // New threads inherit the policy and CPUs of the thread that creates them, e.g. a session's
+    // threads those of httpd, so threads of the other roles are set back to the defaults
+    if (attr->policy != THREAD_POLICY_OTHER) {
+        policy = attr->policy == THREAD_POLICY_FIFO ? SCHED_FIFO : SCHED_RR;
+        param.sched_priority = attr->priority;
+    }
+    ret = pthread_setschedparam(pthread_self(), policy, &param);
+    if (ret == EPERM) {
+        logger_log(logger, LOGGER_WARNING, "Not allowed to give thread %s real-time priority, "
+                   "needs CAP_SYS_NICE or an RLIMIT_RTPRIO of %d", name, attr->priority);
+    } else if (ret) {
+        logger_log(logger, LOGGER_WARNING, "Could not set scheduling policy of thread %s: %s", name, strerror(ret));
+    }
+    if (thread_attrs_lock_stacks && attr->policy != THREAD_POLICY_OTHER) {
+        thread_attr_lock_stack(logger, name);
+    }
+#if defined(__linux__)
+    {
+        cpu_set_t set = thread_attrs_default_cpus;
+        if (attr->cpus) {
+            CPU_ZERO(&set);
+            for (int cpu = 0; cpu < 64; cpu++) {
+                if (attr->cpus & ((uint64_t) 1 << cpu)) CPU_SET(cpu, &set);
+            }
+        }
+        if (CPU_COUNT(&set) && pthread_setaffinity_np(pthread_self(), sizeof(set), &set)) {
+            logger_log(logger, LOGGER_WARNING, "Could not pin thread %s to its CPUs", name);
+        }
+    }
+#endif
+}
@@ -0,0 +1,69 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#ifndef THREAD_ATTR_H
+#define THREAD_ATTR_H
+
+#include <stdint.h>
+#include "logger.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Names, scheduling policies and CPU affinity of the library's threads.
+ * Every thread names itself and takes on the attributes of its role when it
+ * starts. Roles are configured once before the server is started. Once any
+ * role is, threads of the other roles and without a role are set back to the
+ * normal policy and the process's CPUs, rather than inheriting those of the
+ * thread that created them.
+ */
+
+typedef enum {
+    THREAD_ROLE_NONE = -1,
+    /* Mirror receive, decrypt and submit, the submit stage also decodes */
+    THREAD_ROLE_MIRROR,
+    /* RTP audio receive and audio playout, which feeds the audio output */
+    THREAD_ROLE_AUDIO,
+    THREAD_ROLE_NTP,
+    THREAD_ROLE_HTTPD,
+    THREAD_ROLE_COUNT
+} thread_role_t;
+
+typedef enum {
+    THREAD_POLICY_OTHER,
+    THREAD_POLICY_FIFO,
+    THREAD_POLICY_RR
+} thread_policy_t;
+
+typedef struct {
+    thread_policy_t policy;
+    /* 1 to 99 for the real-time policies */
+    int priority;
+    /* Bit n allows CPU n, 0 for any */
+    uint64_t cpus;
+} thread_attr_t;
+
+void thread_attr_set(thread_role_t role, const thread_attr_t *attr);
+/* Parses role:policy[:priority][@cpu,...], e.g. audio:fifo:60@3, returns -1 if it can't */
+int thread_attr_parse(const char *spec);
+/* Makes the threads of real-time roles fault in and lock the top of their stacks as they start */
+void thread_attr_set_lock_stacks(int enabled);
+/* Names the calling thread, at most 15 characters, registers it with thread_stats and applies the attributes of role */
+void thread_attr_apply(logger_t *logger, thread_role_t role, const char *name);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //THREAD_ATTR_H
@@ -0,0 +1,164 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+
+#include "thread_stats.h"
+
+typedef struct {
+    int in_use;
+    pthread_t thread;
+    int tid;
+    char name[16];
+    /* Only added to by the thread itself */
+    uint64_t pool_bytes;
+} thread_stats_slot_t;
+
+static pthread_mutex_t thread_stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+static thread_stats_slot_t thread_stats_slots[THREAD_STATS_MAX_THREADS];
+static pthread_once_t thread_stats_once = PTHREAD_ONCE_INIT;
+static pthread_key_t thread_stats_key;
+static __thread thread_stats_slot_t *thread_stats_self;
+
+/* Runs as a registered thread exits, its pthread_t stays valid until then */
+static void
+thread_stats_unregister(void *arg)
+{
+    thread_stats_slot_t *slot = arg;
+
+    pthread_mutex_lock(&thread_stats_mutex);
+    slot->in_use = 0;
+    pthread_mutex_unlock(&thread_stats_mutex);
+}
+
+static void
+thread_stats_init_key(void)
+{
+    pthread_key_create(&thread_stats_key, thread_stats_unregister);
+}
+
+void
+thread_stats_register(const char *name)
+{
+    thread_stats_slot_t *slot = thread_stats_self;
+
+    pthread_once(&thread_stats_once, thread_stats_init_key);
+    pthread_mutex_lock(&thread_stats_mutex);
+    for (int i = 0; !slot && i < THREAD_STATS_MAX_THREADS; i++) {
+        if (!thread_stats_slots[i].in_use) {
+            slot = &thread_stats_slots[i];
+            slot->in_use = 1;
+            slot->thread = pthread_self();
+#if defined(__linux__)
+            slot->tid = (int) syscall(SYS_gettid);
+#else
+            slot->tid = 0;
+#endif
+            __atomic_store_n(&slot->pool_bytes, 0, __ATOMIC_RELAXED);
+        }
+    }
+    if (slot) {
+        strncpy(slot->name, name, sizeof(slot->name) - 1);
+        slot->name[sizeof(slot->name) - 1] = '\0';
+    }
+    pthread_mutex_unlock(&thread_stats_mutex);
+
+    if (slot && !thread_stats_self) {
+        thread_stats_self = slot;
+        pthread_setspecific(thread_stats_key, slot);
+    }
+}
+
+void
+thread_stats_add_pool_bytes(size_t bytes)
+{
+    thread_stats_slot_t *slot = thread_stats_self;
+
+    if (slot) {
+        __atomic_store_n(&slot->pool_bytes, slot->pool_bytes + bytes, __ATOMIC_RELAXED);
+    }
+}
+
+int
+thread_stats_read_switches(int tid, uint64_t *voluntary, uint64_t *involuntary)
+{
+#if defined(__linux__)
+    char path[64];
+    char line[128];
+    int found = 0;
+    FILE *file;
+
+    snprintf(path, sizeof(path), "/proc/self/task/%d/status", tid);
+    file = fopen(path, "r");
+    if (!file) {
+        return -1;
+    }
+    while (found < 2 && fgets(line, sizeof(line), file)) {
+        unsigned long long value;
+        if (sscanf(line, "voluntary_ctxt_switches: %llu", &value) == 1) {
+            *voluntary = value;
+            found++;
+        } else if (sscanf(line, "nonvoluntary_ctxt_switches: %llu", &value) == 1) {
+            *involuntary = value;
+            found++;
+        }
+    }
+    fclose(file);
+    return found == 2 ? 0 : -1;
+#else
+    (void) tid;
+    (void) voluntary;
+    (void) involuntary;
+    return -1;
+#endif
+}
+
+int
+thread_stats_get(thread_stats_t *stats, int max_count)
+{
+    int count = 0;
+
+    pthread_mutex_lock(&thread_stats_mutex);
+    for (int i = 0; i < THREAD_STATS_MAX_THREADS && count < max_count; i++) {
+        thread_stats_slot_t *slot = &thread_stats_slots[i];
+        thread_stats_t *thread = &stats[count];
+        if (!slot->in_use) {
+            continue;
+        }
+        memset(thread, 0, sizeof(thread_stats_t));
+        memcpy(thread->name, slot->name, sizeof(thread->name));
+        thread->tid = slot->tid;
+        thread->pool_bytes = __atomic_load_n(&slot->pool_bytes, __ATOMIC_RELAXED);
+#if defined(__linux__)
+        // The slot is only freed under the mutex as the thread exits, so its pthread_t is still valid here
+        clockid_t clock;
+        struct timespec time;
+        if (!pthread_getcpuclockid(slot->thread, &clock) && !clock_gettime(clock, &time)) {
+            thread->cpu_time = (uint64_t) time.tv_sec * 1000000 + time.tv_nsec / 1000;
+        }
+        thread_stats_read_switches(slot->tid, &thread->voluntary_switches, &thread->involuntary_switches);
+#endif
+        count++;
+    }
+    pthread_mutex_unlock(&thread_stats_mutex);
+    return count;
+}
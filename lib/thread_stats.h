@@ -0,0 +1,57 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#ifndef THREAD_STATS_H
+#define THREAD_STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Where the library's threads spend their CPU time. Threads register as they
+ * name themselves in thread_attr_apply and leave when they exit. Their CPU
+ * clocks and context switches are read when the stats are taken, while the
+ * bytes they take from frame pools are counted by the threads themselves.
+ * CPU times and context switches need Linux, elsewhere they stay 0.
+ */
+
+#define THREAD_STATS_MAX_THREADS 64
+
+typedef struct {
+    char name[16];
+    int tid;
+    /* From the thread's CPU clock, in us */
+    uint64_t cpu_time;
+    uint64_t voluntary_switches;
+    uint64_t involuntary_switches;
+    /* Bytes of the buffers the thread took from frame pools */
+    uint64_t pool_bytes;
+} thread_stats_t;
+
+/* Registers the calling thread under name, again only renames it */
+void thread_stats_register(const char *name);
+/* Counts bytes taken from a frame pool by the calling thread, if it is registered */
+void thread_stats_add_pool_bytes(size_t bytes);
+/* Fills stats with up to max_count registered threads, returns how many */
+int thread_stats_get(thread_stats_t *stats, int max_count);
+/* Voluntary and involuntary context switches of any thread of the process, -1 if they can't be read */
+int thread_stats_read_switches(int tid, uint64_t *voluntary, uint64_t *involuntary);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //THREAD_STATS_H
@@ -34,9 +34,16 @@ typedef HANDLE mutex_handle_t;
 #define MUTEX_UNLOCK(handle) ReleaseMutex(handle)
 #define MUTEX_DESTROY(handle) CloseHandle(handle)
 
+typedef volatile LONG thread_flag_t;
+
+#define THREAD_FLAG_LOAD(flag) InterlockedCompareExchange(&(flag), 0, 0)
+#define THREAD_FLAG_STORE(flag, value) InterlockedExchange(&(flag), value)
+#define THREAD_FLAG_EXCHANGE(flag, value) InterlockedExchange(&(flag), value)
+
 #else /* Use pthread library */
 
 #include <pthread.h>
+#include <time.h>
 #include <unistd.h>
 
 #define sleepms(x) usleep((x)*1000)
@@ -58,9 +65,27 @@ typedef pthread_cond_t cond_handle_t;
 #define MUTEX_DESTROY(handle) pthread_mutex_destroy(&(handle))
 
 #define COND_CREATE(handle) pthread_cond_init(&(handle), NULL)
+/* Timed waits then take an abstime on CLOCK_MONOTONIC, the clock raop_ntp_get_local_time reads */
+#define COND_CREATE_MONOTONIC(handle) do { \
+	pthread_condattr_t cond_attr; \
+	pthread_condattr_init(&cond_attr); \
+	pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC); \
+	pthread_cond_init(&(handle), &cond_attr); \
+	pthread_condattr_destroy(&cond_attr); \
+} while (0)
 #define COND_SIGNAL(handle) pthread_cond_signal(&(handle))
+#define COND_BROADCAST(handle) pthread_cond_broadcast(&(handle))
+#define COND_WAIT(handle, mutex) pthread_cond_wait(&(handle), &(mutex))
+#define COND_TIMEDWAIT(handle, mutex, abstime) pthread_cond_timedwait(&(handle), &(mutex), &(abstime))
 #define COND_DESTROY(handle) pthread_cond_destroy(&(handle))
 
+/* A flag such as running that a thread polls without taking a lock, stores release what was written before */
+typedef int thread_flag_t;
+
+#define THREAD_FLAG_LOAD(flag) __atomic_load_n(&(flag), __ATOMIC_ACQUIRE)
+#define THREAD_FLAG_STORE(flag, value) __atomic_store_n(&(flag), value, __ATOMIC_RELEASE)
+#define THREAD_FLAG_EXCHANGE(flag, value) __atomic_exchange_n(&(flag), value, __ATOMIC_ACQ_REL)
+
 #endif
 
 #endif /* THREADS_H */
@@ -0,0 +1,180 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <assert.h>
+
+#include "trace.h"
+
+#if defined(HAVE_SYS_SDT)
+#include <sys/sdt.h>
+#endif
+
+typedef struct {
+    unsigned int mask;
+    trace_record_t *records;
+    /* Next ticket, each event takes one */
+    uint64_t position;
+} trace_ring_t;
+
+static trace_ring_t *trace_ring;
+
+int
+trace_init(unsigned int capacity)
+{
+    trace_ring_t *ring;
+    unsigned int size = 1;
+
+    assert(capacity > 0);
+    if (__atomic_load_n(&trace_ring, __ATOMIC_ACQUIRE)) {
+        return 0;
+    }
+    while (size < capacity) {
+        size <<= 1;
+    }
+
+    ring = calloc(1, sizeof(trace_ring_t));
+    if (!ring) {
+        return -1;
+    }
+    ring->records = calloc(size, sizeof(trace_record_t));
+    if (!ring->records) {
+        free(ring);
+        return -1;
+    }
+    ring->mask = size - 1;
+    __atomic_store_n(&trace_ring, ring, __ATOMIC_RELEASE);
+    return 0;
+}
+
+#if defined(HAVE_SYS_SDT)
+/* A probe per event, so bpftrace can attach to one by name */
+static void
+trace_probe(trace_event_t event, uint64_t arg0, uint64_t arg1)
+{
+    switch (event) {
+    case TRACE_AUDIO_RECEIVED: DTRACE_PROBE2(rpiplay, audio_received, arg0, arg1); break;
+    case TRACE_AUDIO_RESEND_REQUEST: DTRACE_PROBE2(rpiplay, audio_resend_request, arg0, arg1); break;
+    case TRACE_AUDIO_DEQUEUED: DTRACE_PROBE2(rpiplay, audio_dequeued, arg0, arg1); break;
+    case TRACE_AUDIO_PLAYOUT: DTRACE_PROBE2(rpiplay, audio_playout, arg0, arg1); break;
+    case TRACE_AUDIO_RENDERED: DTRACE_PROBE2(rpiplay, audio_rendered, arg0, arg1); break;
+    case TRACE_VIDEO_RECEIVED: DTRACE_PROBE2(rpiplay, video_received, arg0, arg1); break;
+    case TRACE_VIDEO_DECRYPTED: DTRACE_PROBE2(rpiplay, video_decrypted, arg0, arg1); break;
+    case TRACE_VIDEO_SUBMITTED: DTRACE_PROBE2(rpiplay, video_submitted, arg0, arg1); break;
+    case TRACE_VIDEO_RENDERED: DTRACE_PROBE2(rpiplay, video_rendered, arg0, arg1); break;
+    case TRACE_NTP_SAMPLE: DTRACE_PROBE2(rpiplay, ntp_sample, arg0, arg1); break;
+    case TRACE_RTSP_REQUEST: DTRACE_PROBE2(rpiplay, rtsp_request, arg0, arg1); break;
+    case TRACE_RTSP_RESPONSE: DTRACE_PROBE2(rpiplay, rtsp_response, arg0, arg1); break;
+    }
+}
+#endif
+
+void
+trace_event(trace_event_t event, uint64_t arg0, uint64_t arg1)
+{
+    trace_ring_t *ring = __atomic_load_n(&trace_ring, __ATOMIC_ACQUIRE);
+    trace_record_t *record;
+    struct timespec time;
+    uint64_t ticket;
+
+#if defined(HAVE_SYS_SDT)
+    trace_probe(event, arg0, arg1);
+#endif
+    if (!ring) {
+        return;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    ticket = __atomic_fetch_add(&ring->position, 1, __ATOMIC_RELAXED);
+    record = &ring->records[ticket & ring->mask];
+
+    /* Readers skip records whose seq does not match the ticket they expect */
+    __atomic_store_n(&record->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    record->timestamp = (uint64_t) time.tv_sec * 1000000000ull + time.tv_nsec;
+    record->event = event;
+    record->arg0 = arg0;
+    record->arg1 = arg1;
+    __atomic_store_n(&record->seq, (uint32_t) ticket + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Copies the ring to filename while recording continues. Records being
+ * overwritten during the copy are left out. Returns the number of events
+ * written or -1 on error.
+ */
+int
+trace_dump(const char *filename)
+{
+    trace_ring_t *ring = __atomic_load_n(&trace_ring, __ATOMIC_ACQUIRE);
+    trace_file_header_t header;
+    uint64_t end, start, ticket;
+    long header_pos;
+    FILE *file;
+
+    if (!ring) {
+        return -1;
+    }
+    file = fopen(filename, "wb");
+    if (!file) {
+        return -1;
+    }
+
+    end = __atomic_load_n(&ring->position, __ATOMIC_ACQUIRE);
+    start = end > (uint64_t) ring->mask + 1 ? end - ring->mask - 1 : 0;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TRACE_FILE_MAGIC, sizeof(header.magic));
+    header.version = 1;
+    header.record_size = sizeof(trace_record_t);
+    header_pos = ftell(file);
+    fwrite(&header, sizeof(header), 1, file);
+
+    for (ticket = start; ticket < end; ticket++) {
+        trace_record_t *record = &ring->records[ticket & ring->mask];
+        trace_record_t copy;
+
+        if (__atomic_load_n(&record->seq, __ATOMIC_ACQUIRE) != (uint32_t) ticket + 1) {
+            continue;
+        }
+        memcpy(&copy, record, sizeof(copy));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&record->seq, __ATOMIC_RELAXED) != (uint32_t) ticket + 1) {
+            continue;
+        }
+        if (header.count == 0) {
+            header.overwritten = ticket;
+        }
+        fwrite(&copy, sizeof(copy), 1, file);
+        header.count++;
+    }
+
+    fseek(file, header_pos, SEEK_SET);
+    fwrite(&header, sizeof(header), 1, file);
+    if (fclose(file) != 0) {
+        return -1;
+    }
+    return (int) header.count;
+}
+
+/* Must not race with trace_event, call it once all threads have stopped */
+void
+trace_destroy(void)
+{
+    trace_ring_t *ring = __atomic_exchange_n(&trace_ring, NULL, __ATOMIC_ACQ_REL);
+    if (ring) {
+        free(ring->records);
+        free(ring);
+    }
+}
@@ -0,0 +1,81 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Process wide ring of binary trace events, cheap enough to leave on in
+ * production. Recording is lock free and does nothing until trace_init has
+ * been called; once the ring is full the oldest events are overwritten.
+ *
+ * trace_dump writes a trace_file_header_t followed by header.count
+ * trace_record_t, oldest first, all in host byte order.
+ *
+ * Built with HAVE_SYS_SDT, every event is a USDT probe in the rpiplay
+ * provider as well, named like the event in lower case without the prefix,
+ * e.g. rpiplay:video_submitted, with the same two arguments. The probes fire
+ * whether or not the ring was initialized and cost a nop until attached to.
+ */
+
+typedef enum {
+    TRACE_AUDIO_RECEIVED = 1,   /* seqnum, rtp timestamp */
+    TRACE_AUDIO_RESEND_REQUEST, /* first seqnum, count */
+    TRACE_AUDIO_DEQUEUED,       /* payload size (0 if lost), pts */
+    TRACE_AUDIO_PLAYOUT,        /* payload size (0 if lost), pts */
+    TRACE_AUDIO_RENDERED,       /* decoded size, pts */
+    TRACE_VIDEO_RECEIVED,       /* payload size, payload type */
+    TRACE_VIDEO_DECRYPTED,      /* payload size, pts */
+    TRACE_VIDEO_SUBMITTED,      /* payload size, pts */
+    TRACE_VIDEO_RENDERED,       /* data size, pts */
+    TRACE_NTP_SAMPLE,           /* offset as int64, round trip time */
+    TRACE_RTSP_REQUEST,         /* CSeq, connection id */
+    TRACE_RTSP_RESPONSE,        /* CSeq, body size */
+} trace_event_t;
+
+#define TRACE_FILE_MAGIC "RPTRACE1"
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint64_t count;
+    /* Events lost to wrap-around before the first one in the file */
+    uint64_t overwritten;
+} trace_file_header_t;
+
+typedef struct {
+    /* CLOCK_MONOTONIC in nanoseconds */
+    uint64_t timestamp;
+    uint32_t event;
+    /* Ticket of the event plus one, 0 while it is being written */
+    uint32_t seq;
+    uint64_t arg0;
+    uint64_t arg1;
+} trace_record_t;
+
+int trace_init(unsigned int capacity);
+void trace_event(trace_event_t event, uint64_t arg0, uint64_t arg1);
+int trace_dump(const char *filename);
+void trace_destroy(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //TRACE_H
@@ -0,0 +1,386 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "uring_recv.h"
+#include "netutils.h"
+
+#if defined(__linux__) && defined(HAVE_IO_URING)
+
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+/* Sockets and polled fds per ring, each holds one request */
+#define URING_RECV_MAX_SOURCES 8
+#define URING_RECV_BUFFER_GROUP 0
+
+typedef struct {
+    int fd;
+    uint64_t tag;
+    int poll;
+} uring_recv_source_t;
+
+struct uring_recv_s {
+    logger_t *logger;
+    int fd;
+
+    void *sq_ring;
+    size_t sq_ring_size;
+    unsigned int *sq_tail;
+    unsigned int *sq_array;
+    unsigned int sq_mask;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+    unsigned int to_submit;
+
+    unsigned int *cq_head;
+    unsigned int *cq_tail;
+    unsigned int cq_mask;
+    struct io_uring_cqe *cqes;
+
+    /* Buffers the kernel picks from for each datagram, buffer_stride bytes apart */
+    struct io_uring_buf_ring *buf_ring;
+    size_t buf_ring_size;
+    unsigned char *buffers;
+    unsigned int buffer_count;
+    unsigned int buffer_stride;
+    unsigned short buf_tail;
+
+    /* Where the kernel puts the sender's address, the control messages and the datagram in a buffer, read by every recvmsg */
+    struct msghdr msg;
+
+    uring_recv_source_t sources[URING_RECV_MAX_SOURCES];
+    int source_count;
+};
+
+static int
+uring_recv_enter(uring_recv_t *uring, unsigned int to_submit, unsigned int min_complete, int timeout_us)
+{
+    struct __kernel_timespec ts = { .tv_sec = timeout_us / 1000000, .tv_nsec = (timeout_us % 1000000) * 1000 };
+    struct io_uring_getevents_arg arg = { .ts = (uint64_t) (uintptr_t) &ts };
+    unsigned int flags = IORING_ENTER_EXT_ARG;
+
+    if (min_complete) {
+        flags |= IORING_ENTER_GETEVENTS;
+    }
+    return syscall(__NR_io_uring_enter, uring->fd, to_submit, min_complete, flags, &arg, sizeof(arg));
+}
+
+static void
+uring_recv_buffer_add(uring_recv_t *uring, unsigned short buffer_id)
+{
+    struct io_uring_buf *buf = &uring->buf_ring->bufs[uring->buf_tail & (uring->buffer_count - 1)];
+
+    buf->addr = (uint64_t) (uintptr_t) (uring->buffers + (size_t) buffer_id * uring->buffer_stride);
+    buf->len = uring->buffer_stride;
+    buf->bid = buffer_id;
+    uring->buf_tail++;
+}
+
+/* Queues the request of source index, it goes to the kernel with the next wait */
+static void
+uring_recv_arm(uring_recv_t *uring, int index)
+{
+    uring_recv_source_t *source = &uring->sources[index];
+    unsigned int tail = *uring->sq_tail;
+    unsigned int slot = tail & uring->sq_mask;
+    struct io_uring_sqe *sqe = &uring->sqes[slot];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->fd = source->fd;
+    sqe->user_data = index;
+    if (source->poll) {
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->len = IORING_POLL_ADD_MULTI;
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        sqe->poll32_events = (uint32_t) POLLIN << 16;
+#else
+        sqe->poll32_events = POLLIN;
+#endif
+    } else {
+        sqe->opcode = IORING_OP_RECVMSG;
+        sqe->addr = (uint64_t) (uintptr_t) &uring->msg;
+        sqe->len = 1;
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = URING_RECV_BUFFER_GROUP;
+    }
+    uring->sq_array[slot] = slot;
+    __atomic_store_n(uring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    uring->to_submit++;
+}
+
+uring_recv_t *
+uring_recv_init(logger_t *logger, unsigned int buffer_count, unsigned int buffer_size)
+{
+    struct io_uring_params params;
+    struct io_uring_buf_reg reg;
+    uring_recv_t *uring;
+
+    if (!buffer_count || (buffer_count & (buffer_count - 1)) || buffer_count > 32768) {
+        return NULL;
+    }
+    uring = calloc(1, sizeof(uring_recv_t));
+    if (!uring) {
+        return NULL;
+    }
+    uring->logger = logger;
+    uring->sq_ring = MAP_FAILED;
+    uring->sqes = MAP_FAILED;
+    uring->buf_ring = MAP_FAILED;
+    uring->buffers = MAP_FAILED;
+
+    memset(&params, 0, sizeof(params));
+    uring->fd = syscall(__NR_io_uring_setup, URING_RECV_MAX_SOURCES, &params);
+    if (uring->fd < 0) {
+        logger_log(logger, LOGGER_DEBUG, "uring_recv could not set up io_uring: %s", strerror(errno));
+        free(uring);
+        return NULL;
+    }
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_EXT_ARG)) {
+        logger_log(logger, LOGGER_DEBUG, "uring_recv kernel io_uring too old");
+        goto error;
+    }
+
+    // One mapping holds both rings
+    uring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    if (params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe) > uring->sq_ring_size) {
+        uring->sq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    }
+    uring->sq_ring = mmap(NULL, uring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                          uring->fd, IORING_OFF_SQ_RING);
+    if (uring->sq_ring == MAP_FAILED) {
+        goto error;
+    }
+    uring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    uring->sqes = mmap(NULL, uring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       uring->fd, IORING_OFF_SQES);
+    if (uring->sqes == MAP_FAILED) {
+        goto error;
+    }
+    uring->sq_tail = (unsigned int *) ((char *) uring->sq_ring + params.sq_off.tail);
+    uring->sq_mask = *(unsigned int *) ((char *) uring->sq_ring + params.sq_off.ring_mask);
+    uring->sq_array = (unsigned int *) ((char *) uring->sq_ring + params.sq_off.array);
+    uring->cq_head = (unsigned int *) ((char *) uring->sq_ring + params.cq_off.head);
+    uring->cq_tail = (unsigned int *) ((char *) uring->sq_ring + params.cq_off.tail);
+    uring->cq_mask = *(unsigned int *) ((char *) uring->sq_ring + params.cq_off.ring_mask);
+    uring->cqes = (struct io_uring_cqe *) ((char *) uring->sq_ring + params.cq_off.cqes);
+
+    // Each buffer starts with the recvmsg header, the sender's address and room for a receive timestamp, then the datagram
+    uring->msg.msg_namelen = sizeof(struct sockaddr_storage);
+    uring->msg.msg_controllen = NETUTILS_TIMESTAMP_CONTROL_SIZE;
+    uring->buffer_count = buffer_count;
+    uring->buffer_stride = sizeof(struct io_uring_recvmsg_out) + sizeof(struct sockaddr_storage) +
+                           NETUTILS_TIMESTAMP_CONTROL_SIZE + buffer_size;
+    uring->buffers = mmap(NULL, (size_t) buffer_count * uring->buffer_stride, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    uring->buf_ring_size = buffer_count * sizeof(struct io_uring_buf);
+    uring->buf_ring = mmap(NULL, uring->buf_ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (uring->buffers == MAP_FAILED || uring->buf_ring == MAP_FAILED) {
+        goto error;
+    }
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t) (uintptr_t) uring->buf_ring;
+    reg.ring_entries = buffer_count;
+    reg.bgid = URING_RECV_BUFFER_GROUP;
+    if (syscall(__NR_io_uring_register, uring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        logger_log(logger, LOGGER_DEBUG, "uring_recv could not register buffer ring: %s", strerror(errno));
+        goto error;
+    }
+    for (unsigned int i = 0; i < buffer_count; i++) {
+        uring_recv_buffer_add(uring, i);
+    }
+    __atomic_store_n(&uring->buf_ring->tail, uring->buf_tail, __ATOMIC_RELEASE);
+    return uring;
+
+error:
+    uring_recv_destroy(uring);
+    return NULL;
+}
+
+static int
+uring_recv_add(uring_recv_t *uring, int fd, uint64_t tag, int poll)
+{
+    if (uring->source_count == URING_RECV_MAX_SOURCES) {
+        return -1;
+    }
+    uring->sources[uring->source_count].fd = fd;
+    uring->sources[uring->source_count].tag = tag;
+    uring->sources[uring->source_count].poll = poll;
+    uring_recv_arm(uring, uring->source_count++);
+    return 0;
+}
+
+int
+uring_recv_add_socket(uring_recv_t *uring, int fd, uint64_t tag)
+{
+    return uring_recv_add(uring, fd, tag, 0);
+}
+
+int
+uring_recv_add_poll(uring_recv_t *uring, int fd, uint64_t tag)
+{
+    return uring_recv_add(uring, fd, tag, 1);
+}
+
+int
+uring_recv_wait(uring_recv_t *uring, int timeout_us, uring_recv_event_t *events, int max_events)
+{
+    unsigned int head = *uring->cq_head;
+    unsigned int tail = __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE);
+    int count = 0;
+
+    // Only sleep when nothing is left over from the previous wait
+    if (uring->to_submit || head == tail) {
+        int ret = uring_recv_enter(uring, uring->to_submit, head == tail, timeout_us);
+        if (ret < 0 && errno != ETIME && errno != EINTR && errno != EBUSY) {
+            logger_log(uring->logger, LOGGER_WARNING, "uring_recv io_uring_enter failed: %s", strerror(errno));
+            return -1;
+        }
+        if (ret > 0) {
+            uring->to_submit -= ret;
+        }
+        tail = __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE);
+    }
+
+    while (head != tail && count < max_events) {
+        struct io_uring_cqe *cqe = &uring->cqes[head & uring->cq_mask];
+        int index = (int) cqe->user_data;
+        uring_recv_source_t *source = &uring->sources[index];
+        int res = cqe->res;
+        unsigned int flags = cqe->flags;
+        head++;
+
+        // A multishot request ends on errors and when the kernel runs out of buffers
+        if (!(flags & IORING_CQE_F_MORE)) {
+            uring_recv_arm(uring, index);
+        }
+        if (res == -EINVAL || res == -EOPNOTSUPP) {
+            // Kernels before 6.0 have buffer rings but no multishot recvmsg
+            logger_log(uring->logger, LOGGER_DEBUG, "uring_recv kernel can't receive multishot: %s", strerror(-res));
+            __atomic_store_n(uring->cq_head, head, __ATOMIC_RELEASE);
+            uring_recv_release(uring, events, count);
+            return -1;
+        } else if (res == -ENOBUFS) {
+            logger_log(uring->logger, LOGGER_DEBUG, "uring_recv ran out of buffers");
+            continue;
+        } else if (res < 0) {
+            logger_log(uring->logger, LOGGER_WARNING, "uring_recv receive on fd %d failed: %s", source->fd, strerror(-res));
+            continue;
+        }
+
+        uring_recv_event_t *event = &events[count++];
+        memset(event, 0, sizeof(*event));
+        event->tag = source->tag;
+        if (!source->poll && (flags & IORING_CQE_F_BUFFER)) {
+            unsigned char *buffer;
+            struct io_uring_recvmsg_out *out;
+            struct msghdr control;
+
+            event->buffer_id = flags >> IORING_CQE_BUFFER_SHIFT;
+            buffer = uring->buffers + (size_t) event->buffer_id * uring->buffer_stride;
+            out = (struct io_uring_recvmsg_out *) buffer;
+            event->saddr = (struct sockaddr *) (buffer + sizeof(*out));
+            event->saddrlen = out->namelen < uring->msg.msg_namelen ? out->namelen : uring->msg.msg_namelen;
+            event->data = buffer + sizeof(*out) + uring->msg.msg_namelen + uring->msg.msg_controllen;
+            event->len = out->payloadlen;
+            event->truncated = (out->flags & MSG_TRUNC) != 0;
+            memset(&control, 0, sizeof(control));
+            control.msg_control = buffer + sizeof(*out) + uring->msg.msg_namelen;
+            control.msg_controllen = out->controllen;
+            event->timestamp = netutils_get_timestamp(&control);
+            if (event->len > uring->buffer_stride - (event->data - buffer)) {
+                event->len = uring->buffer_stride - (event->data - buffer);
+            }
+        }
+    }
+    __atomic_store_n(uring->cq_head, head, __ATOMIC_RELEASE);
+    return count;
+}
+
+void
+uring_recv_release(uring_recv_t *uring, uring_recv_event_t *events, int count)
+{
+    int released = 0;
+
+    for (int i = 0; i < count; i++) {
+        if (events[i].data) {
+            uring_recv_buffer_add(uring, events[i].buffer_id);
+            events[i].data = NULL;
+            released = 1;
+        }
+    }
+    if (released) {
+        __atomic_store_n(&uring->buf_ring->tail, uring->buf_tail, __ATOMIC_RELEASE);
+    }
+}
+
+void
+uring_recv_destroy(uring_recv_t *uring)
+{
+    if (!uring) {
+        return;
+    }
+    // Closing the ring cancels the requests still armed before the buffers go away
+    if (uring->fd >= 0) close(uring->fd);
+    if (uring->sqes != MAP_FAILED) munmap(uring->sqes, uring->sqes_size);
+    if (uring->sq_ring != MAP_FAILED) munmap(uring->sq_ring, uring->sq_ring_size);
+    if (uring->buf_ring != MAP_FAILED) munmap(uring->buf_ring, uring->buf_ring_size);
+    if (uring->buffers != MAP_FAILED) munmap(uring->buffers, (size_t) uring->buffer_count * uring->buffer_stride);
+    free(uring);
+}
+
+#else
+
+uring_recv_t *
+uring_recv_init(logger_t *logger, unsigned int buffer_count, unsigned int buffer_size)
+{
+    return NULL;
+}
+
+int
+uring_recv_add_socket(uring_recv_t *uring, int fd, uint64_t tag)
+{
+    return -1;
+}
+
+int
+uring_recv_add_poll(uring_recv_t *uring, int fd, uint64_t tag)
+{
+    return -1;
+}
+
+int
+uring_recv_wait(uring_recv_t *uring, int timeout_us, uring_recv_event_t *events, int max_events)
+{
+    return -1;
+}
+
+void
+uring_recv_release(uring_recv_t *uring, uring_recv_event_t *events, int count)
+{
+}
+
+void
+uring_recv_destroy(uring_recv_t *uring)
+{
+}
+
+#endif
@@ -0,0 +1,57 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#ifndef URING_RECV_H
+#define URING_RECV_H
+
+#include <stdint.h>
+#include "compat.h"
+#include "logger.h"
+
+/*
+ * Datagram receive loop on io_uring, for builds with HAVE_IO_URING on Linux.
+ * Every socket gets one multishot recvmsg that stays armed and receives into
+ * a ring of buffers shared with the kernel, so a single wait both sleeps and
+ * collects whatever arrived on all of them. Polled fds, e.g. an eventfd to be
+ * woken through, only report that they became readable.
+ * uring_recv_init returns NULL and uring_recv_wait -1 where io_uring or a part
+ * of it is missing, callers then fall back to select.
+ */
+
+typedef struct uring_recv_s uring_recv_t;
+
+typedef struct {
+    /* Tag the socket or fd was added with */
+    uint64_t tag;
+    /* Datagram received, NULL for a polled fd that became readable */
+    unsigned char *data;
+    unsigned int len;
+    /* The datagram was larger than the buffer and cut short */
+    int truncated;
+    struct sockaddr *saddr;
+    socklen_t saddrlen;
+    /* Kernel receive timestamp as netutils_get_timestamp returns it, 0 if the socket has none */
+    uint64_t timestamp;
+    unsigned short buffer_id;
+} uring_recv_event_t;
+
+/* buffer_count buffers of buffer_size bytes each, buffer_count a power of two */
+uring_recv_t *uring_recv_init(logger_t *logger, unsigned int buffer_count, unsigned int buffer_size);
+int uring_recv_add_socket(uring_recv_t *uring, int fd, uint64_t tag);
+int uring_recv_add_poll(uring_recv_t *uring, int fd, uint64_t tag);
+/* Returns the number of events, 0 on timeout, -1 if io_uring can't be used after all */
+int uring_recv_wait(uring_recv_t *uring, int timeout_us, uring_recv_event_t *events, int max_events);
+/* Hands the buffers of events back to the kernel, once their data is no longer needed */
+void uring_recv_release(uring_recv_t *uring, uring_recv_event_t *events, int count);
+void uring_recv_destroy(uring_recv_t *uring);
+
+#endif //URING_RECV_H
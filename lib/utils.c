@@ -12,10 +12,21 @@
  *  Lesser General Public License for more details.
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <stdint.h>
 #include <assert.h>
+#if defined(__linux__)
+#include <sched.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#endif
 
 char *
 utils_strsep(char **stringp, const char *delim)
@@ -178,4 +189,59 @@ char *utils_parse_hex(const char *str, int str_len, int *data_len) {
 
     *data_len = (str_len / 2);
     return data;
-}
\ No newline at end of file
+}
+
+int
+utils_set_thread_cpu(int cpu)
+{
+#if defined(__linux__)
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    cpu_set_t set;
+
+    if (cpu < 0 || count < 2) {
+        return -1;
+    }
+    CPU_ZERO(&set);
+    CPU_SET(cpu % count, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0 ? 0 : -1;
+#else
+    return -1;
+#endif
+}
+
+int
+utils_prefault(void *buf, size_t len, int lock)
+{
+#if defined(__linux__)
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    volatile unsigned char *p = buf;
+
+    // A write, reading a fresh page would only map the zero page
+    for (size_t i = 0; i < len; i += page) {
+        p[i] = p[i];
+    }
+    if (len) {
+        p[len - 1] = p[len - 1];
+    }
+    return lock && mlock(buf, len) < 0 ? -1 : 0;
+#else
+    return lock ? -1 : 0;
+#endif
+}
+
+int
+utils_thread_page_faults(uint64_t *minor, uint64_t *major)
+{
+#if defined(__linux__) && defined(RUSAGE_THREAD)
+    struct rusage usage;
+
+    if (getrusage(RUSAGE_THREAD, &usage) < 0) {
+        return -1;
+    }
+    *minor = (uint64_t) usage.ru_minflt;
+    *major = (uint64_t) usage.ru_majflt;
+    return 0;
+#else
+    return -1;
+#endif
+}
@@ -15,9 +15,19 @@
 #ifndef UTILS_H
 #define UTILS_H
 
+#include <stddef.h>
+#include <stdint.h>
+
 char *utils_strsep(char **stringp, const char *delim);
 int utils_read_file(char **dst, const char *pemstr);
 int utils_hwaddr_raop(char *str, int strlen, const char *hwaddr, int hwaddrlen);
 int utils_hwaddr_airplay(char *str, int strlen, const char *hwaddr, int hwaddrlen);
 char *utils_parse_hex(const char *str, int str_len, int *data_len);
+/* Pins the calling thread to cpu modulo the online CPUs, -1 if there is only one or it can't be done */
+int utils_set_thread_cpu(int cpu);
+/* Touches every page of buf so that using it later doesn't fault, and locks them in memory if lock is
+ * set. Returns -1 if they could not be locked */
+int utils_prefault(void *buf, size_t len, int lock);
+/* Minor and major page faults of the calling thread so far, -1 where that can't be told */
+int utils_thread_page_faults(uint64_t *minor, uint64_t *major);
 #endif
\ No newline at end of file
@@ -29,7 +29,7 @@
 #define LEVEL_DEBUG 3
 #define LEVEL_VERBOSE 4
 
-void log(int level, const char* format, ...) {
+inline void log(int level, const char* format, ...) {
     va_list vargs;
     va_start(vargs, format);
     vprintf(format, vargs);
@@ -0,0 +1,182 @@
+/**
+ * RPiPlay - An open-source AirPlay mirroring server for Raspberry Pi
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+#include "aac_decoder.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+#include "fdk-aac/libAACdec/include/aacdecoder_lib.h"
+#include "../lib/frame_pool.h"
+
+struct aac_decoder_s {
+    logger_t *logger;
+    HANDLE_AACDECODER handle;
+    frame_pool_t *pool;
+    aac_decoder_stats_t stats;
+};
+
+static void aac_decoder_frame_release(void *opaque, unsigned char *buffer) {
+    frame_pool_put(opaque, buffer);
+}
+
+static uint64_t aac_decoder_now_us(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (uint64_t) time.tv_sec * 1000000 + time.tv_nsec / 1000;
+}
+
+/* Heap in use, allocations served by mmap included, 0 without glibc 2.33 */
+static size_t aac_decoder_heap_used(void) {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+    struct mallinfo2 info = mallinfo2();
+    return info.uordblks + info.hblkhd;
+#else
+    return 0;
+#endif
+}
+
+aac_decoder_t *aac_decoder_init(logger_t *logger) {
+    aac_decoder_t *decoder;
+    CStreamInfo *stream_info;
+    /* AudioSpecificConfig of the AAC-ELD stream AirPlay mirroring sends, 44.1 kHz stereo */
+    UCHAR eld_conf[] = { 0xF8, 0xE8, 0x50, 0x00 };
+    UCHAR *conf[] = { eld_conf };
+    UINT conf_len = sizeof(eld_conf);
+
+    decoder = calloc(1, sizeof(aac_decoder_t));
+    if (!decoder) {
+        return NULL;
+    }
+    decoder->logger = logger;
+    decoder->pool = frame_pool_init(logger);
+    if (!decoder->pool) {
+        goto error;
+    }
+    // Other threads allocating meanwhile count as well, at startup there is little of that
+    size_t heap_used = aac_decoder_heap_used();
+    decoder->handle = aacDecoder_Open(TT_MP4_RAW, 1);
+    size_t heap_opened = aac_decoder_heap_used();
+    decoder->stats.instance_bytes = heap_opened > heap_used ? heap_opened - heap_used : 0;
+    if (!decoder->handle) {
+        logger_log(logger, LOGGER_ERR, "aacDecoder open failed!");
+        goto error;
+    }
+    if (aacDecoder_ConfigRaw(decoder->handle, conf, &conf_len) != AAC_DEC_OK) {
+        logger_log(logger, LOGGER_ERR, "Unable to set configRaw");
+        goto error;
+    }
+    /* Noise substitution, energy interpolation would delay every frame by one to look ahead */
+    if (aacDecoder_SetParam(decoder->handle, AAC_CONCEAL_METHOD, 1) != AAC_DEC_OK) {
+        logger_log(logger, LOGGER_WARNING, "Unable to set the AAC concealment method");
+    }
+    stream_info = aacDecoder_GetStreamInfo(decoder->handle);
+    if (!stream_info) {
+        logger_log(logger, LOGGER_ERR, "aacDecoder_GetStreamInfo failed!");
+        goto error;
+    }
+    logger_log(logger, LOGGER_DEBUG, "> stream info: channel = %d\tsample_rate = %d\tframe_size = %d\taot = %d\tbitrate = %d",
+               stream_info->channelConfig, stream_info->aacSampleRate,
+               stream_info->aacSamplesPerFrame, stream_info->aot, stream_info->bitRate);
+    // The renderers and the scheduler are opened at AAC_DECODER_SAMPLE_RATE, any other rate would play at the wrong speed
+    if (stream_info->channelConfig != AAC_DECODER_CHANNELS || stream_info->aacSamplesPerFrame != AAC_DECODER_FRAME_SIZE ||
+        stream_info->aacSampleRate != AAC_DECODER_SAMPLE_RATE) {
+        logger_log(logger, LOGGER_ERR, "Unsupported AAC stream");
+        goto error;
+    }
+    return decoder;
+
+error:
+    aac_decoder_destroy(decoder);
+    return NULL;
+}
+
+/* Decodes the frame that was filled in, or conceals one with AACDEC_CONCEAL */
+static stream_frame_t *aac_decoder_output(aac_decoder_t *decoder, INT flags, uint64_t pts, uint64_t start) {
+    AAC_DECODER_ERROR error;
+    int pcm_size = AAC_DECODER_FRAME_SIZE * AAC_DECODER_CHANNELS * sizeof(INT_PCM);
+    unsigned char *pcm;
+
+    pcm = frame_pool_get(decoder->pool, pcm_size);
+    if (!pcm) return NULL;
+    error = aacDecoder_DecodeFrame(decoder->handle, (INT_PCM *) pcm, AAC_DECODER_FRAME_SIZE * AAC_DECODER_CHANNELS, flags);
+    if (error != AAC_DEC_OK) {
+        logger_log(decoder->logger, LOGGER_ERR, "aacDecoder_DecodeFrame error : 0x%x", error);
+        frame_pool_put(decoder->pool, pcm);
+        decoder->stats.errors++;
+        return NULL;
+    }
+    decoder->stats.decode_time += aac_decoder_now_us() - start;
+
+    return stream_frame_new(pcm, pcm, pcm_size, pts, aac_decoder_frame_release, decoder->pool);
+}
+
+/* Every packet holds exactly one AAC frame. Returns NULL if it could not be decoded */
+stream_frame_t *aac_decoder_decode(aac_decoder_t *decoder, const unsigned char *data, int data_len, uint64_t pts) {
+    AAC_DECODER_ERROR error;
+    UCHAR *p_buffer[1] = { (UCHAR *) data };
+    UINT buffer_size = data_len;
+    UINT bytes_valid = data_len;
+    uint64_t start = aac_decoder_now_us();
+
+    if (data_len <= 0) return NULL;
+    decoder->stats.packets++;
+
+    error = aacDecoder_Fill(decoder->handle, p_buffer, &buffer_size, &bytes_valid);
+    if (error != AAC_DEC_OK) {
+        logger_log(decoder->logger, LOGGER_ERR, "aacDecoder_Fill error : %x", error);
+        decoder->stats.errors++;
+        return NULL;
+    }
+    return aac_decoder_output(decoder, 0, pts, start);
+}
+
+/*
+ * Produces a frame in place of a packet that was lost in the network, extrapolated
+ * from the previous ones and faded out over consecutive losses, so the PCM clock
+ * keeps running without a gap.
+ */
+stream_frame_t *aac_decoder_conceal(aac_decoder_t *decoder, uint64_t pts) {
+    decoder->stats.concealed++;
+    return aac_decoder_output(decoder, AACDEC_CONCEAL, pts, aac_decoder_now_us());
+}
+
+/* Drops what the decoder buffered, for when the stream jumps */
+void aac_decoder_flush(aac_decoder_t *decoder) {
+    aacDecoder_SetParam(decoder->handle, AAC_TPDEC_CLEAR_BUFFER, 1);
+}
+
+void aac_decoder_get_stats(aac_decoder_t *decoder, aac_decoder_stats_t *stats) {
+    memcpy(stats, &decoder->stats, sizeof(aac_decoder_stats_t));
+}
+
+void aac_decoder_destroy(aac_decoder_t *decoder) {
+    if (decoder) {
+        if (decoder->handle) {
+            aacDecoder_Close(decoder->handle);
+        }
+        // Frames still held by a sink keep the pool alive until they are released
+        frame_pool_destroy(decoder->pool);
+        free(decoder);
+    }
+}
@@ -0,0 +1,68 @@
+/**
+ * RPiPlay - An open-source AirPlay mirroring server for Raspberry Pi
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+/*
+ * AAC-ELD decoder shared by the audio renderers.
+ * Each packet is decoded once with fdk-aac into a reference counted PCM frame
+ * from a recycling pool, so any number of sinks can hold on to the same samples.
+ * Not thread safe, all calls have to come from the same thread.
+ */
+
+#ifndef AAC_DECODER_H
+#define AAC_DECODER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "../lib/logger.h"
+#include "../lib/stream.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Decoded PCM is interleaved signed 16-bit stereo in host byte order, one packet holds FRAME_SIZE samples per channel */
+#define AAC_DECODER_SAMPLE_RATE 44100
+#define AAC_DECODER_CHANNELS 2
+#define AAC_DECODER_FRAME_SIZE 480
+
+typedef struct aac_decoder_s aac_decoder_t;
+
+typedef struct aac_decoder_stats_s {
+    uint64_t packets;
+    uint64_t errors;
+    /* Frames filled in for packets lost in the network */
+    uint64_t concealed;
+    /* Time spent decoding in us */
+    uint64_t decode_time;
+    /* Heap the decoder instance took when it was opened, 0 where that can't be measured.
+     * Its constant tables are part of the binary. */
+    size_t instance_bytes;
+} aac_decoder_stats_t;
+
+aac_decoder_t *aac_decoder_init(logger_t *logger);
+stream_frame_t *aac_decoder_decode(aac_decoder_t *decoder, const unsigned char *data, int data_len, uint64_t pts);
+stream_frame_t *aac_decoder_conceal(aac_decoder_t *decoder, uint64_t pts);
+void aac_decoder_flush(aac_decoder_t *decoder);
+void aac_decoder_get_stats(aac_decoder_t *decoder, aac_decoder_stats_t *stats);
+void aac_decoder_destroy(aac_decoder_t *decoder);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //AAC_DECODER_H
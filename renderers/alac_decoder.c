@@ -0,0 +1,449 @@
+/**
+ * RPiPlay - An open-source AirPlay mirroring server for Raspberry Pi
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+#include "alac_decoder.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../lib/frame_pool.h"
+
+#include "dsp_kernels.h"
+
+/* Element tags, 3 bits each */
+#define ALAC_ID_SCE 0
+#define ALAC_ID_CPE 1
+#define ALAC_ID_CCE 2
+#define ALAC_ID_LFE 3
+#define ALAC_ID_DSE 4
+#define ALAC_ID_PCE 5
+#define ALAC_ID_FIL 6
+#define ALAC_ID_END 7
+
+/* Adaptive Golomb coding, as in Apple's reference decoder */
+#define ALAC_QBSHIFT 9
+#define ALAC_QB (1 << ALAC_QBSHIFT)
+#define ALAC_MMULSHIFT 2
+#define ALAC_MDENSHIFT (ALAC_QBSHIFT - ALAC_MMULSHIFT - 1)
+#define ALAC_MOFF (1 << (ALAC_MDENSHIFT - 2))
+#define ALAC_BITOFF 24
+#define ALAC_MAX_PREFIX 9
+#define ALAC_MAX_RUN_BITS 16
+#define ALAC_MEAN_CLAMP 0xffff
+
+#define ALAC_MAX_COEFS 32
+/* Zero bytes behind the packet, so the bit reader can always load 8 bytes */
+#define ALAC_PADDING 8
+
+typedef struct alac_bits_s {
+    const uint8_t *data;
+    uint32_t pos;
+    uint32_t end;
+    int overrun;
+} alac_bits_t;
+
+struct alac_decoder_s {
+    logger_t *logger;
+    alac_decoder_config_t config;
+    frame_pool_t *pool;
+    aac_decoder_stats_t stats;
+
+    uint8_t *packet;
+    int packet_capacity;
+
+    int32_t residuals[ALAC_DECODER_MAX_FRAME_LENGTH];
+    int32_t mix_u[ALAC_DECODER_MAX_FRAME_LENGTH];
+    int32_t mix_v[ALAC_DECODER_MAX_FRAME_LENGTH];
+};
+
+static void alac_decoder_frame_release(void *opaque, unsigned char *buffer) {
+    frame_pool_put(opaque, buffer);
+}
+
+static uint64_t alac_decoder_now_us(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (uint64_t) time.tv_sec * 1000000 + time.tv_nsec / 1000;
+}
+
+static inline uint32_t alac_clz(uint32_t value) {
+    return value ? __builtin_clz(value) : 32;
+}
+
+static inline int32_t alac_sign(int32_t value) {
+    return (value > 0) - (value < 0);
+}
+
+/* Wraps to chan_bits like the encoder's arithmetic does */
+static inline int32_t alac_wrap(int32_t value, int shift) {
+    return (int32_t) ((uint32_t) value << shift) >> shift;
+}
+
+/* The next 32 bits, MSB first. Past the end of the packet everything reads as 0 */
+static inline uint32_t alac_bits_peek(alac_bits_t *bits) {
+    const uint8_t *p;
+    uint64_t word;
+
+    if (bits->pos > bits->end) {
+        bits->overrun = 1;
+        return 0;
+    }
+    p = bits->data + (bits->pos >> 3);
+    word = (uint64_t) p[0] << 56 | (uint64_t) p[1] << 48 | (uint64_t) p[2] << 40 | (uint64_t) p[3] << 32 |
+           (uint64_t) p[4] << 24 | (uint64_t) p[5] << 16 | (uint64_t) p[6] << 8 | (uint64_t) p[7];
+    return (uint32_t) ((word << (bits->pos & 7)) >> 32);
+}
+
+static inline uint32_t alac_bits_read(alac_bits_t *bits, int count) {
+    uint32_t value;
+
+    if (count == 0) return 0;
+    value = alac_bits_peek(bits) >> (32 - count);
+    bits->pos += count;
+    return value;
+}
+
+static inline int32_t alac_bits_read_signed(alac_bits_t *bits, int count) {
+    return alac_wrap((int32_t) alac_bits_read(bits, count), 32 - count);
+}
+
+static inline void alac_bits_align(alac_bits_t *bits) {
+    bits->pos = (bits->pos + 7) & ~7u;
+}
+
+/* A Golomb coded value with a unary prefix, prefixes of ALAC_MAX_PREFIX escape to escape_bits raw bits */
+static inline uint32_t alac_read_golomb(alac_bits_t *bits, uint32_t m, int k, int escape_bits) {
+    uint32_t word = alac_bits_peek(bits);
+    uint32_t prefix = alac_clz(~word);
+    uint32_t value;
+
+    if (prefix >= ALAC_MAX_PREFIX) {
+        bits->pos += ALAC_MAX_PREFIX;
+        return alac_bits_read(bits, escape_bits);
+    }
+    bits->pos += prefix + 1;
+    if (k == 1) return prefix;
+
+    value = (word << (prefix + 1)) >> (32 - k);
+    if (value >= 2) {
+        bits->pos += k;
+        return prefix * m + value - 1;
+    }
+    bits->pos += k - 1;
+    return prefix * m;
+}
+
+/* Decodes the residuals of one channel, with the Rice parameter adapting to their running mean */
+static int alac_decode_residuals(alac_bits_t *bits, int32_t *out, int count, uint32_t pb, uint32_t mb,
+                                 uint32_t kb, int chan_bits) {
+    uint32_t wb = (1u << kb) - 1;
+    uint32_t zmode = 0;
+    int c = 0;
+
+    while (c < count) {
+        uint32_t k = 31 - alac_clz((mb >> ALAC_QBSHIFT) + 3);
+        uint32_t n, decoded;
+
+        if (k > kb) k = kb;
+        n = alac_read_golomb(bits, (1u << k) - 1, k, chan_bits);
+        if (bits->overrun) return -1;
+
+        decoded = n + zmode;
+        out[c++] = (int32_t) ((decoded + 1) >> 1) * ((decoded & 1) ? -1 : 1);
+
+        mb = pb * (n + zmode) + mb - ((pb * mb) >> ALAC_QBSHIFT);
+        if (n > ALAC_MEAN_CLAMP) mb = ALAC_MEAN_CLAMP;
+        zmode = 0;
+
+        if ((mb << ALAC_MMULSHIFT) < ALAC_QB && c < count) {
+            // Quiet passages are coded as runs of zeros
+            uint32_t run_k = alac_clz(mb) - ALAC_BITOFF + ((mb + ALAC_MOFF) >> ALAC_MDENSHIFT);
+            uint32_t run = alac_read_golomb(bits, ((1u << run_k) - 1) & wb, run_k, ALAC_MAX_RUN_BITS);
+
+            if (bits->overrun || run > (uint32_t) (count - c)) return -1;
+            memset(out + c, 0, run * sizeof(int32_t));
+            c += run;
+            zmode = run < 65535;
+            mb = 0;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Runs the adaptive predictor over the residuals. The coefficients are kept oldest
+ * sample first, the reverse of the bitstream's order, so a window of the output
+ * lines up with them for the vector dot product.
+ */
+static void alac_unpredict(const int32_t *residuals, int32_t *out, int count, const int16_t *coefs, int order,
+                           int chan_bits, int den_shift) {
+    int shift = 32 - chan_bits;
+    int32_t den_half = den_shift ? 1 << (den_shift - 1) : 0;
+    int32_t weights[ALAC_MAX_COEFS];
+    int32_t (*lpc_dot)(const int32_t *, const int32_t *, int32_t, int) = dsp_kernels_get()->lpc_dot;
+    int j, k;
+
+    out[0] = residuals[0];
+    if (order == 0) {
+        if (residuals != out) memcpy(out + 1, residuals + 1, (count - 1) * sizeof(int32_t));
+        return;
+    }
+    if (order == 31) {
+        int32_t prev = out[0];
+        for (j = 1; j < count; j++) {
+            prev = alac_wrap(residuals[j] + prev, shift);
+            out[j] = prev;
+        }
+        return;
+    }
+
+    for (j = 1; j <= order && j < count; j++) {
+        out[j] = alac_wrap(residuals[j] + out[j - 1], shift);
+    }
+    for (k = 0; k < order; k++) {
+        weights[k] = coefs[order - 1 - k];
+    }
+
+    for (j = order + 1; j < count; j++) {
+        const int32_t *window = out + j - order;
+        int32_t top = out[j - order - 1];
+        int32_t residual = residuals[j];
+        int32_t remaining = residual;
+
+        out[j] = alac_wrap(residual + top + ((lpc_dot(window, weights, top, order) + den_half) >> den_shift), shift);
+
+        // Sign-LMS update, oldest tap first, until the residual is accounted for
+        if (residual > 0) {
+            for (k = 0; k < order; k++) {
+                int32_t diff = top - window[k];
+                int32_t sign = alac_sign(diff);
+                weights[k] = (int16_t) (weights[k] - sign);
+                remaining -= (k + 1) * ((sign * diff) >> den_shift);
+                if (remaining <= 0) break;
+            }
+        } else if (residual < 0) {
+            for (k = 0; k < order; k++) {
+                int32_t diff = top - window[k];
+                int32_t sign = alac_sign(diff);
+                weights[k] = (int16_t) (weights[k] + sign);
+                remaining -= (k + 1) * ((-sign * diff) >> den_shift);
+                if (remaining >= 0) break;
+            }
+        }
+    }
+}
+
+/* Decodes a single (SCE, LFE) or channel pair (CPE) element into out. Returns the sample count or -1 */
+static int alac_decode_element(alac_decoder_t *decoder, alac_bits_t *bits, int channels, int16_t *out) {
+    alac_decoder_config_t *config = &decoder->config;
+    int32_t *mix[2] = { decoder->mix_u, decoder->mix_v };
+    int16_t coefs[2][ALAC_MAX_COEFS];
+    int mode[2], den_shift[2], pb_factor[2], order[2];
+    int mix_bits = 0, mix_res = 0;
+    int header, count, chan_bits;
+    int i, ch;
+
+    alac_bits_read(bits, 4);
+    if (alac_bits_read(bits, 12) != 0) return -1;
+    header = alac_bits_read(bits, 4);
+    if ((header >> 1) & 3) {
+        // Shifted bytes only appear above 16 bits
+        return -1;
+    }
+    count = config->frame_length;
+    if (header & 8) {
+        uint32_t partial = alac_bits_read(bits, 32);
+        if (partial == 0 || partial > config->frame_length) return -1;
+        count = partial;
+    }
+
+    if (header & 1) {
+        // Escape, the samples are stored as they are
+        for (i = 0; i < count; i++) {
+            for (ch = 0; ch < channels; ch++) {
+                mix[ch][i] = alac_bits_read_signed(bits, config->bit_depth);
+            }
+        }
+    } else {
+        // The side channel of a pair takes an extra bit
+        chan_bits = config->bit_depth + channels - 1;
+        mix_bits = alac_bits_read(bits, 8);
+        mix_res = (int8_t) alac_bits_read(bits, 8);
+        for (ch = 0; ch < channels; ch++) {
+            mode[ch] = alac_bits_read(bits, 4);
+            den_shift[ch] = alac_bits_read(bits, 4);
+            pb_factor[ch] = alac_bits_read(bits, 3);
+            order[ch] = alac_bits_read(bits, 5);
+            for (i = 0; i < order[ch]; i++) {
+                coefs[ch][i] = (int16_t) alac_bits_read(bits, 16);
+            }
+        }
+        if (bits->overrun) return -1;
+        for (ch = 0; ch < channels; ch++) {
+            if (alac_decode_residuals(bits, decoder->residuals, count, config->pb * pb_factor[ch] / 4,
+                                      config->mb, config->kb, chan_bits) < 0) {
+                return -1;
+            }
+            if (mode[ch] != 0) {
+                alac_unpredict(decoder->residuals, decoder->residuals, count, NULL, 31, chan_bits, 0);
+            }
+            alac_unpredict(decoder->residuals, mix[ch], count, coefs[ch], order[ch], chan_bits, den_shift[ch]);
+        }
+    }
+    if (bits->overrun) return -1;
+
+    if (channels == 2) {
+        dsp_kernels_get()->unmix(decoder->mix_u, decoder->mix_v, out, count, mix_bits, mix_res);
+    } else {
+        // Mono goes out on both channels
+        for (i = 0; i < count; i++) {
+            out[2 * i] = out[2 * i + 1] = (int16_t) decoder->mix_u[i];
+        }
+    }
+    return count;
+}
+
+/* Walks the elements of a frame up to the first audio element. Returns the sample count or -1 */
+static int alac_decode_frame(alac_decoder_t *decoder, alac_bits_t *bits, int16_t *out) {
+    for (;;) {
+        int tag = alac_bits_read(bits, 3);
+        int count;
+
+        if (bits->overrun) return -1;
+        switch (tag) {
+            case ALAC_ID_SCE:
+            case ALAC_ID_LFE:
+                return alac_decode_element(decoder, bits, 1, out);
+            case ALAC_ID_CPE:
+                return alac_decode_element(decoder, bits, 2, out);
+            case ALAC_ID_DSE:
+                alac_bits_read(bits, 4);
+                {
+                    int aligned = alac_bits_read(bits, 1);
+                    count = alac_bits_read(bits, 8);
+                    if (count == 255) count += alac_bits_read(bits, 8);
+                    if (aligned) alac_bits_align(bits);
+                }
+                bits->pos += count * 8;
+                break;
+            case ALAC_ID_FIL:
+                count = alac_bits_read(bits, 4);
+                if (count == 15) count += alac_bits_read(bits, 8) - 1;
+                bits->pos += count * 8;
+                break;
+            case ALAC_ID_END:
+            default:
+                // Coupling channels and program configs are not used by any encoder
+                return -1;
+        }
+    }
+}
+
+alac_decoder_t *alac_decoder_init(logger_t *logger) {
+    alac_decoder_config_t config = ALAC_DECODER_DEFAULT_CONFIG;
+    alac_decoder_t *decoder;
+
+    decoder = calloc(1, sizeof(alac_decoder_t));
+    if (!decoder) {
+        return NULL;
+    }
+    decoder->logger = logger;
+    decoder->config = config;
+    decoder->pool = frame_pool_init(logger);
+    if (!decoder->pool) {
+        free(decoder);
+        return NULL;
+    }
+    return decoder;
+}
+
+int alac_decoder_set_config(alac_decoder_t *decoder, const alac_decoder_config_t *config) {
+    if (config->bit_depth != 16 || config->channels < 1 || config->channels > AAC_DECODER_CHANNELS ||
+        config->sample_rate != AAC_DECODER_SAMPLE_RATE || config->frame_length == 0 ||
+        config->frame_length > ALAC_DECODER_MAX_FRAME_LENGTH || config->kb == 0 || config->kb > 31) {
+        logger_log(decoder->logger, LOGGER_ERR, "Unsupported ALAC stream: %u bits, %u channels, %u Hz, %u samples per frame",
+                   config->bit_depth, config->channels, config->sample_rate, config->frame_length);
+        return -1;
+    }
+    decoder->config = *config;
+    return 0;
+}
+
+/* Every packet holds exactly one ALAC frame. Returns NULL if it could not be decoded */
+stream_frame_t *alac_decoder_decode(alac_decoder_t *decoder, const unsigned char *data, int data_len, uint64_t pts) {
+    uint64_t start = alac_decoder_now_us();
+    int pcm_size = decoder->config.frame_length * AAC_DECODER_CHANNELS * sizeof(int16_t);
+    unsigned char *pcm;
+    alac_bits_t bits;
+    int count;
+
+    if (data_len <= 0) return NULL;
+    decoder->stats.packets++;
+
+    if (data_len + ALAC_PADDING > decoder->packet_capacity) {
+        uint8_t *packet = realloc(decoder->packet, data_len + ALAC_PADDING);
+        if (!packet) return NULL;
+        decoder->packet = packet;
+        decoder->packet_capacity = data_len + ALAC_PADDING;
+    }
+    memcpy(decoder->packet, data, data_len);
+    memset(decoder->packet + data_len, 0, ALAC_PADDING);
+    bits.data = decoder->packet;
+    bits.pos = 0;
+    bits.end = (uint32_t) data_len * 8;
+    bits.overrun = 0;
+
+    pcm = frame_pool_get(decoder->pool, pcm_size);
+    if (!pcm) return NULL;
+    count = alac_decode_frame(decoder, &bits, (int16_t *) pcm);
+    if (count < 0 || bits.pos > bits.end) {
+        logger_log(decoder->logger, LOGGER_ERR, "Could not decode ALAC packet of %d bytes", data_len);
+        frame_pool_put(decoder->pool, pcm);
+        decoder->stats.errors++;
+        return NULL;
+    }
+    decoder->stats.decode_time += alac_decoder_now_us() - start;
+
+    return stream_frame_new(pcm, pcm, count * AAC_DECODER_CHANNELS * sizeof(int16_t), pts,
+                            alac_decoder_frame_release, decoder->pool);
+}
+
+stream_frame_t *alac_decoder_conceal(alac_decoder_t *decoder, uint64_t pts) {
+    int pcm_size = decoder->config.frame_length * AAC_DECODER_CHANNELS * sizeof(int16_t);
+    unsigned char *pcm;
+
+    decoder->stats.concealed++;
+    pcm = frame_pool_get(decoder->pool, pcm_size);
+    if (!pcm) return NULL;
+    memset(pcm, 0, pcm_size);
+    return stream_frame_new(pcm, pcm, pcm_size, pts, alac_decoder_frame_release, decoder->pool);
+}
+
+void alac_decoder_get_stats(alac_decoder_t *decoder, aac_decoder_stats_t *stats) {
+    memcpy(stats, &decoder->stats, sizeof(aac_decoder_stats_t));
+}
+
+void alac_decoder_destroy(alac_decoder_t *decoder) {
+    if (decoder) {
+        // Frames still held by a sink keep the pool alive until they are released
+        frame_pool_destroy(decoder->pool);
+        free(decoder->packet);
+        free(decoder);
+    }
+}
@@ -0,0 +1,74 @@
+/**
+ * RPiPlay - An open-source AirPlay mirroring server for Raspberry Pi
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+/*
+ * Apple Lossless decoder for the audio-only AirPlay streams senders use for
+ * music. Each packet holds one ALAC frame, decoded into a reference counted
+ * PCM frame of the same layout as the aac_decoder's, so the renderers take
+ * either. The stereo unmix and the 4th and 8th order predictors, the ones
+ * Apple's encoder uses, have NEON and SSE4.1 paths.
+ * Not thread safe, all calls have to come from the same thread.
+ */
+
+#ifndef ALAC_DECODER_H
+#define ALAC_DECODER_H
+
+#include <stdint.h>
+#include "../lib/logger.h"
+#include "../lib/stream.h"
+#include "aac_decoder.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Longest frame taken, AirPlay sends 352 samples per packet */
+#define ALAC_DECODER_MAX_FRAME_LENGTH 4096
+
+/* The ALACSpecificConfig, AirPlay leaves it out and uses the defaults below */
+typedef struct alac_decoder_config_s {
+    uint32_t frame_length;
+    uint8_t bit_depth;
+    uint8_t pb;
+    uint8_t mb;
+    uint8_t kb;
+    uint8_t channels;
+    uint32_t sample_rate;
+} alac_decoder_config_t;
+
+#define ALAC_DECODER_DEFAULT_CONFIG { 352, 16, 40, 10, 14, AAC_DECODER_CHANNELS, AAC_DECODER_SAMPLE_RATE }
+
+typedef struct alac_decoder_s alac_decoder_t;
+
+alac_decoder_t *alac_decoder_init(logger_t *logger);
+/* Only 16 bit mono or stereo at the renderers' sample rate is taken, mono goes out on both channels.
+ * Returns -1 for anything else */
+int alac_decoder_set_config(alac_decoder_t *decoder, const alac_decoder_config_t *config);
+/* Returns NULL if the packet could not be decoded */
+stream_frame_t *alac_decoder_decode(alac_decoder_t *decoder, const unsigned char *data, int data_len, uint64_t pts);
+/* Silence in place of a packet that was lost in the network, ALAC has nothing to extrapolate from */
+stream_frame_t *alac_decoder_conceal(alac_decoder_t *decoder, uint64_t pts);
+/* Packets, errors, concealed frames and decode time, as the aac_decoder counts them */
+void alac_decoder_get_stats(alac_decoder_t *decoder, aac_decoder_stats_t *stats);
+void alac_decoder_destroy(alac_decoder_t *decoder);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //ALAC_DECODER_H
@@ -0,0 +1,88 @@
+/**
+ * RPiPlay - An open-source AirPlay mirroring server for Raspberry Pi
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+#include "arrival_stats.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/* Upper bounds of the gap buckets in ms, the last bucket takes everything longer */
+static const int arrival_stats_bucket_ms[ARRIVAL_STATS_BUCKETS - 1] = { 1, 2, 4, 8, 12, 17, 25, 34, 50, 100, 250 };
+
+void arrival_stats_reset(arrival_stats_t *stats) {
+    memset(stats, 0, sizeof(arrival_stats_t));
+}
+
+void arrival_stats_add(arrival_stats_t *stats, uint64_t arrival, uint64_t pts, int bytes) {
+    int64_t lead = (int64_t) (pts - arrival);
+
+    if (stats->count == 0) {
+        stats->first_arrival = arrival;
+        stats->min_lead = lead;
+        stats->max_lead = lead;
+    } else {
+        int64_t gap = (int64_t) (arrival - stats->last_arrival);
+        int64_t d = gap - (int64_t) (pts - stats->last_pts);
+        int bucket = 0;
+
+        while (bucket < ARRIVAL_STATS_BUCKETS - 1 && gap >= arrival_stats_bucket_ms[bucket] * 1000ll) {
+            bucket++;
+        }
+        stats->gaps[bucket]++;
+
+        if (d < 0) d = -d;
+        stats->jitter += ((double) d - stats->jitter) / 16.0;
+        if (d > stats->max_jitter) stats->max_jitter = d;
+        if (lead < stats->min_lead) stats->min_lead = lead;
+        if (lead > stats->max_lead) stats->max_lead = lead;
+    }
+    stats->total_lead += lead;
+    stats->last_arrival = arrival;
+    stats->last_pts = pts;
+    stats->count++;
+    stats->bytes += bytes;
+}
+
+void arrival_stats_log(const arrival_stats_t *stats, logger_t *logger, const char *name) {
+    char histogram[256];
+    int len = 0;
+    double seconds;
+
+    if (stats->count == 0) {
+        logger_log(logger, LOGGER_INFO, "%s: nothing received", name);
+        return;
+    }
+    seconds = (stats->last_arrival - stats->first_arrival) / 1000000.0;
+    logger_log(logger, LOGGER_INFO, "%s: %llu buffers, %llu bytes in %.1f s (%.1f/s, %.0f kbit/s)", name,
+               (unsigned long long) stats->count, (unsigned long long) stats->bytes, seconds,
+               seconds > 0 ? (stats->count - 1) / seconds : 0.0, seconds > 0 ? stats->bytes * 8 / seconds / 1000 : 0.0);
+    logger_log(logger, LOGGER_INFO, "%s: pts jitter %.2f ms, max %.2f ms; lead to pts min %.1f avg %.1f max %.1f ms", name,
+               stats->jitter / 1000.0, stats->max_jitter / 1000.0, stats->min_lead / 1000.0,
+               (double) stats->total_lead / stats->count / 1000.0, stats->max_lead / 1000.0);
+
+    for (int i = 0; i < ARRIVAL_STATS_BUCKETS && len < sizeof(histogram); i++) {
+        if (i < ARRIVAL_STATS_BUCKETS - 1) {
+            len += snprintf(histogram + len, sizeof(histogram) - len, " <%d:%llu", arrival_stats_bucket_ms[i],
+                            (unsigned long long) stats->gaps[i]);
+        } else {
+            len += snprintf(histogram + len, sizeof(histogram) - len, " >=%d:%llu", arrival_stats_bucket_ms[i - 1],
+                            (unsigned long long) stats->gaps[i]);
+        }
+    }
+    logger_log(logger, LOGGER_INFO, "%s: arrival gaps in ms%s", name, histogram);
+}
@@ -0,0 +1,55 @@
+/**
+ * RPiPlay - An open-source AirPlay mirroring server for Raspberry Pi
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+/*
+ * Arrival timing of the buffers handed to a renderer, for the dummy renderers.
+ * Records the gap between arrivals as a histogram, how much the gaps disagree
+ * with the gaps between pts (RFC 3550 style interarrival jitter) and how far
+ * ahead of its presentation time each buffer arrived.
+ * Not thread safe, callers serialise access.
+ */
+
+#ifndef ARRIVAL_STATS_H
+#define ARRIVAL_STATS_H
+
+#include <stdint.h>
+#include "../lib/logger.h"
+
+#define ARRIVAL_STATS_BUCKETS 12
+
+typedef struct arrival_stats_s {
+    uint64_t count;
+    uint64_t bytes;
+    uint64_t first_arrival;
+    uint64_t last_arrival;
+    uint64_t last_pts;
+    /* Arrival gaps, bucket i counts gaps below arrival_stats_bucket_ms[i] */
+    uint64_t gaps[ARRIVAL_STATS_BUCKETS];
+    /* In microseconds */
+    double jitter;
+    int64_t max_jitter;
+    int64_t min_lead;
+    int64_t max_lead;
+    int64_t total_lead;
+} arrival_stats_t;
+
+void arrival_stats_reset(arrival_stats_t *stats);
+void arrival_stats_add(arrival_stats_t *stats, uint64_t arrival, uint64_t pts, int bytes);
+void arrival_stats_log(const arrival_stats_t *stats, logger_t *logger, const char *name);
+
+#endif //ARRIVAL_STATS_H
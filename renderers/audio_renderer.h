@@ -29,21 +29,51 @@ extern "C" {
 #include "../lib/logger.h"
 #include "../lib/raop_ntp.h"
 #include "video_renderer.h"
+#include "pcm_scheduler.h"
 
 typedef enum audio_device_e { AUDIO_DEVICE_HDMI, AUDIO_DEVICE_ANALOG, AUDIO_DEVICE_NONE } audio_device_t;
 
 typedef enum audio_renderer_type_e {
     AUDIO_RENDERER_DUMMY,
     AUDIO_RENDERER_RPI,
-    AUDIO_RENDERER_GSTREAMER
+    AUDIO_RENDERER_GSTREAMER,
+    AUDIO_RENDERER_PIPEWIRE
 } audio_renderer_type_t;
 
+/* Renderers the fanout renderer plays the same decoded audio on */
+#define AUDIO_RENDERER_MAX_SINKS 4
+
 typedef struct audio_renderer_config_s {
     audio_device_t device;
     const char *alsaString;
     bool low_latency;
+    /* Delay between a packet's pts and its playback in ms (GStreamer renderer) */
+    int presentation_latency;
+    /* Latency in ms the output adds beyond what the device reports, e.g. a TV's own audio processing (alsa renderer) */
+    int output_delay;
+    /* Size of the sink's ring buffer and of one segment of it in ms, 0 for the defaults (GStreamer renderer) */
+    int sink_buffer_time;
+    int sink_latency_time;
 } audio_renderer_config_t;
 
+typedef struct audio_renderer_stats_s {
+    /* Packets taken but not played yet */
+    unsigned int queued_packets;
+    /* Time from taking a packet to playing it in us, 0 if unknown */
+    uint64_t decoder_latency;
+    uint64_t dropped_packets;
+    /* Time from its pts until the latest packet was heard in us, for av_sync */
+    bool has_presentation_offset;
+    int64_t presentation_offset;
+} audio_renderer_stats_t;
+
+typedef struct audio_renderer_caps_s {
+    /* Delay the output adds on top of the packet's pts in us */
+    uint64_t output_latency;
+    /* The output has no volume control of its own, the volume has to be applied to the PCM */
+    bool software_volume;
+} audio_renderer_caps_t;
+
 typedef struct audio_renderer_s audio_renderer_t;
 
 typedef struct audio_renderer_funcs_s {
@@ -52,6 +82,27 @@ typedef struct audio_renderer_funcs_s {
     void (*set_volume)(audio_renderer_t *renderer, float volume);
     void (*flush)(audio_renderer_t *renderer);
     void (*destroy)(audio_renderer_t *renderer);
+    /* Optional, may be left NULL: log the renderer's counters, called from the main thread */
+    void (*log_stats)(audio_renderer_t *renderer);
+    /* Optional, may be left NULL: like render_buffer, but takes over the caller's reference to frame */
+    void (*render_frame)(audio_renderer_t *renderer, raop_ntp_t *ntp, stream_frame_t *frame);
+    /* Optional, may be left NULL, as the video renderer's get_stats and get_caps */
+    void (*get_stats)(audio_renderer_t *renderer, audio_renderer_stats_t *stats);
+    void (*get_caps)(audio_renderer_t *renderer, audio_renderer_caps_t *caps);
+    /* Set instead of render_buffer by renderers that play PCM from the shared aac_decoder,
+     * takes over the caller's reference to frame */
+    void (*render_pcm)(audio_renderer_t *renderer, raop_ntp_t *ntp, stream_frame_t *frame);
+    /* Optional, may be left NULL, as the video renderer's suspend and resume. The audio renderer is
+     * suspended before the video renderer and resumed after it, as it may use the video renderer's clock */
+    void (*suspend)(audio_renderer_t *renderer);
+    int (*resume)(audio_renderer_t *renderer);
+    /* Optional, may be left NULL: play packets delay us later than their pts otherwise would be,
+     * called from the thread that renders */
+    void (*set_delay)(audio_renderer_t *renderer, int64_t delay);
+    /* Set instead of render_pcm by renderers that pull the decoded PCM from a pcm_scheduler on their own
+     * output thread, called once before the first packet. The caller then pushes, flushes and delays
+     * the PCM on the scheduler, and takes the presentation offset from it */
+    void (*set_pcm_source)(audio_renderer_t *renderer, pcm_scheduler_t *scheduler);
 } audio_renderer_funcs_t;
 
 typedef struct audio_renderer_s {
@@ -64,6 +115,9 @@ audio_renderer_t *audio_renderer_dummy_init(logger_t *logger, video_renderer_t *
 audio_renderer_t *audio_renderer_rpi_init(logger_t *logger, video_renderer_t *video_renderer, audio_renderer_config_t const *config);
 audio_renderer_t *audio_renderer_gstreamer_init(logger_t *logger, video_renderer_t *video_renderer, audio_renderer_config_t const *config);
 audio_renderer_t *audio_renderer_alsa_init(logger_t *logger, video_renderer_t *video_renderer, audio_renderer_config_t const *config);
+audio_renderer_t *audio_renderer_pipewire_init(logger_t *logger, video_renderer_t *video_renderer, audio_renderer_config_t const *config);
+/* Takes over sinks, which have to take PCM */
+audio_renderer_t *audio_renderer_fanout_init(logger_t *logger, audio_renderer_t **sinks, int sink_count);
 
 #ifdef __cplusplus
 }
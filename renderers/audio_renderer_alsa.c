@@ -18,75 +18,171 @@
  */
 
 /*
- * AAC renderer using fdk-aac for decoding and ALSA for rendering
+ * PCM renderer using ALSA for output, packets are decoded by the shared aac_decoder.
+ * The buffer starts at 100 ms, or 20 ms in low latency mode, and is tuned to the
+ * device as it plays: repeated underruns grow it, and once a minute passes without
+ * the device running low it is shrunk again at the next flush, when nothing queued
+ * is lost by setting the device up anew.
 */
 
 #include "audio_renderer.h"
 
 #include <stdlib.h>
+#include <string.h>
 
-#include "fdk-aac/libAACdec/include/aacdecoder_lib.h"
 #include "alsa/asoundlib.h"
+#include "../lib/trace.h"
+#include "aac_decoder.h"
 
 // Check ALSA error code and show log
 #define CHK_ALSA_ERRNO(err, msg, r) \
      if ( (err) < 0 )\
         logger_log(r, LOGGER_ERR, "%s: %s", msg, snd_strerror(err))
 
-static bool mHasCtrlVolume;
+// Output sample rate, and the chunk size silence is written in
+#define ALSA_SAMPLE_RATE 44100
+#define ALSA_SILENCE_CHUNK 480
 
+// Beyond this error from pts, output is realigned instead of slewed, in microseconds
+#define ALSA_SYNC_MAX_ERROR 40000
+
+// Initial buffer sizes, in microseconds, and periods in a buffer. Low latency mode aims at 10-20 ms of output latency
+#define ALSA_BUFFER_TIME 100000
+#define ALSA_LOW_LATENCY_BUFFER_TIME 20000
+#define ALSA_PERIODS 4
+
+// Buffer tuning: this many underruns within the window grow the buffer by half, a stable period in which
+// the device never held less than half its buffer shrinks it by a quarter, within the limits. In microseconds
+#define ALSA_TUNE_XRUNS 3
+#define ALSA_TUNE_XRUN_WINDOW 10000000
+#define ALSA_TUNE_STABLE_TIME 60000000
+#define ALSA_TUNE_MIN_BUFFER_TIME 20000
+#define ALSA_TUNE_MAX_BUFFER_TIME 500000
+
+// Drift correction: rate change per second of error, and its limit
+#define ALSA_SYNC_GAIN 0.1
+#define ALSA_SYNC_MAX_ADJUST 0.001
 
 typedef struct audio_renderer_alsa_s {
     audio_renderer_t base;
     audio_renderer_config_t const *config;
 
-    HANDLE_AACDECODER audio_decoder;
     snd_pcm_t *audio_renderer;
-
-    // For volume control
+    bool mmap_access;
+    snd_pcm_uframes_t buffer_size;
+    snd_pcm_uframes_t period_size;
+
+    // Buffer time asked of the device, kept across suspend and resume
+    unsigned int buffer_time;
+    // Underruns not yet seen by the tuner, the ones within the current window and when it began
+    unsigned int new_xruns;
+    unsigned int window_xruns;
+    uint64_t window_start;
+    // When the device was last set up or underran, 0 until the tuner first runs after it was set up
+    uint64_t stable_since;
+    // Lowest delay since then, in frames, and the smaller buffer time for the next flush, 0 for none
+    snd_pcm_sframes_t min_delay;
+    unsigned int shrink_to;
+
+    // Written on the audio thread, read by log_stats
+    uint64_t xruns;
+    uint64_t suspends;
+    uint64_t write_errors;
+    uint64_t retunes;
+    int64_t last_delay;
+
+    // For volume control, per device since several may play at once
     snd_ctl_t *ctl;
     snd_ctl_elem_id_t *ctl_elem_id;
-
+    bool has_ctrl_volume;
+
+    // Aligned and resampled PCM waiting to be written, written once a period is full
+    int16_t *pcm_buffer;
+    snd_pcm_uframes_t pcm_capacity;
+    snd_pcm_uframes_t pcm_frames;
+
+    // Set once the first sample has been aligned to its pts plus delay
+    bool synced;
+    double sync_error;
+    int64_t delay;
+    // Linear resampler state: position past the last input frame, and that frame
+    double resample_phase;
+    int16_t resample_last[2];
 } audio_renderer_alsa_t;
 
 static const audio_renderer_funcs_t audio_renderer_alsa_funcs;
 
-static void audio_renderer_alsa_destroy_decoder(audio_renderer_alsa_t *renderer) {
-    aacDecoder_Close(renderer->audio_decoder);
+static void audio_renderer_rpi_destroy_renderer(audio_renderer_alsa_t *renderer) {
+    CHK_ALSA_ERRNO( snd_pcm_drain( renderer->audio_renderer ), "ALSA PCM drain", renderer->base.logger);
+    CHK_ALSA_ERRNO( snd_pcm_close( renderer->audio_renderer ), "ALSA PCM close", renderer->base.logger);
+    CHK_ALSA_ERRNO( snd_ctl_close(renderer->ctl), "ALSA CTL close", renderer->base.logger);
+    snd_ctl_elem_id_free(renderer->ctl_elem_id);
 }
 
-static int audio_renderer_alsa_init_decoder(audio_renderer_alsa_t *renderer) {
-    int ret;
-    renderer->audio_decoder = aacDecoder_Open(TT_MP4_RAW, 1);
-    if (renderer->audio_decoder == NULL) {
-        logger_log(renderer->base.logger, LOGGER_ERR, "aacDecoder open failed!");
+/*
+ * Sets up the PCM with explicit buffer and period sizes. Low latency mode
+ * prefers MMAP access and starts playback as soon as one period is queued.
+ */
+static int audio_renderer_alsa_set_params(audio_renderer_alsa_t *renderer) {
+    snd_pcm_t *pcm = renderer->audio_renderer;
+    bool low_latency = renderer->config->low_latency;
+    unsigned int buffer_time = renderer->buffer_time;
+    unsigned int period_time = buffer_time / ALSA_PERIODS;
+    unsigned int rate = ALSA_SAMPLE_RATE;
+    snd_pcm_uframes_t buffer_size, period_size;
+    snd_pcm_hw_params_t *hw_params;
+    snd_pcm_sw_params_t *sw_params;
+    int err;
+
+    snd_pcm_hw_params_alloca(&hw_params);
+    if ((err = snd_pcm_hw_params_any(pcm, hw_params)) < 0) {
+        logger_log(renderer->base.logger, LOGGER_ERR, "ALSA: no configurations available: %s", snd_strerror(err));
         return -1;
     }
-    /* ASC config binary data */
-    UCHAR eld_conf[] = { 0xF8, 0xE8, 0x50, 0x00 };
-    UCHAR *conf[] = { eld_conf };
-    static UINT conf_len = sizeof(eld_conf);
-    ret = aacDecoder_ConfigRaw(renderer->audio_decoder, conf, &conf_len);
-    if (ret != AAC_DEC_OK) {
-        logger_log(renderer->base.logger, LOGGER_ERR, "Unable to set configRaw");
-        return -2;
+    CHK_ALSA_ERRNO( snd_pcm_hw_params_set_rate_resample(pcm, hw_params, 1), "ALSA set rate resample", renderer->base.logger );
+
+    renderer->mmap_access = low_latency &&
+            snd_pcm_hw_params_set_access(pcm, hw_params, SND_PCM_ACCESS_MMAP_INTERLEAVED) >= 0;
+    if (!renderer->mmap_access &&
+        (err = snd_pcm_hw_params_set_access(pcm, hw_params, SND_PCM_ACCESS_RW_INTERLEAVED)) < 0) {
+        logger_log(renderer->base.logger, LOGGER_ERR, "ALSA: interleaved access not available: %s", snd_strerror(err));
+        return -1;
     }
-    CStreamInfo *aac_stream_info = aacDecoder_GetStreamInfo(renderer->audio_decoder);
-    if (aac_stream_info == NULL) {
-        logger_log(renderer->base.logger, LOGGER_ERR, "aacDecoder_GetStreamInfo failed!");
-        return -3;
+    if ((err = snd_pcm_hw_params_set_format(pcm, hw_params, SND_PCM_FORMAT_S16_LE)) < 0 ||
+        (err = snd_pcm_hw_params_set_channels(pcm, hw_params, 2)) < 0 ||
+        (err = snd_pcm_hw_params_set_rate_near(pcm, hw_params, &rate, 0)) < 0) {
+        logger_log(renderer->base.logger, LOGGER_ERR, "ALSA: 16 bit stereo at 44100 Hz not available: %s", snd_strerror(err));
+        return -1;
     }
-
-    logger_log(renderer->base.logger, LOGGER_DEBUG, "> stream info: channel = %d\tsample_rate = %d\tframe_size = %d\taot = %d\tbitrate = %d",   \
-            aac_stream_info->channelConfig, aac_stream_info->aacSampleRate,
-            aac_stream_info->aacSamplesPerFrame, aac_stream_info->aot, aac_stream_info->bitRate);
-    return 1;
-}
-
-static void audio_renderer_rpi_destroy_renderer(audio_renderer_alsa_t *renderer) {
-    CHK_ALSA_ERRNO( snd_pcm_drain( renderer->audio_renderer ), "ALSA PCM drain", renderer->base.logger);
-    CHK_ALSA_ERRNO( snd_pcm_close( renderer->audio_renderer ), "ALSA PCM close", renderer->base.logger);
-    CHK_ALSA_ERRNO( snd_ctl_close(renderer->ctl), "ALSA CTL close", renderer->base.logger);
+    CHK_ALSA_ERRNO( snd_pcm_hw_params_set_buffer_time_near(pcm, hw_params, &buffer_time, 0), "ALSA set buffer time", renderer->base.logger );
+    CHK_ALSA_ERRNO( snd_pcm_hw_params_set_period_time_near(pcm, hw_params, &period_time, 0), "ALSA set period time", renderer->base.logger );
+    if ((err = snd_pcm_hw_params(pcm, hw_params)) < 0) {
+        logger_log(renderer->base.logger, LOGGER_ERR, "ALSA: unable to set hw params: %s", snd_strerror(err));
+        return -1;
+    }
+    snd_pcm_hw_params_get_buffer_size(hw_params, &buffer_size);
+    snd_pcm_hw_params_get_period_size(hw_params, &period_size, 0);
+    renderer->buffer_size = buffer_size;
+    renderer->period_size = period_size;
+    renderer->window_xruns = 0;
+    renderer->stable_since = 0;
+    renderer->min_delay = (snd_pcm_sframes_t) buffer_size;
+    renderer->shrink_to = 0;
+
+    snd_pcm_sw_params_alloca(&sw_params);
+    CHK_ALSA_ERRNO( snd_pcm_sw_params_current(pcm, sw_params), "ALSA get sw params", renderer->base.logger );
+    CHK_ALSA_ERRNO( snd_pcm_sw_params_set_start_threshold(pcm, sw_params, low_latency ? period_size : buffer_size - period_size),
+                    "ALSA set start threshold", renderer->base.logger );
+    CHK_ALSA_ERRNO( snd_pcm_sw_params_set_avail_min(pcm, sw_params, period_size), "ALSA set avail min", renderer->base.logger );
+    CHK_ALSA_ERRNO( snd_pcm_sw_params(pcm, sw_params), "ALSA set sw params", renderer->base.logger );
+
+    unsigned int latency = (unsigned int) (buffer_size * 1000000 / rate);
+    logger_log(renderer->base.logger, LOGGER_INFO, "ALSA: %s access, buffer %lu frames (%u us), period %lu frames",
+               renderer->mmap_access ? "mmap" : "rw", buffer_size, latency, period_size);
+    if (low_latency && renderer->buffer_time == ALSA_LOW_LATENCY_BUFFER_TIME && latency > ALSA_LOW_LATENCY_BUFFER_TIME) {
+        logger_log(renderer->base.logger, LOGGER_WARNING, "ALSA: device could not reach low latency, output latency is %u us", latency);
+    }
+    return 0;
 }
 
 static int audio_renderer_rpi_init_renderer( audio_renderer_alsa_t *renderer,
@@ -104,16 +200,7 @@ static int audio_renderer_rpi_init_renderer( audio_renderer_alsa_t *renderer,
         return -51;
     }
 
-    err = snd_pcm_set_params(renderer->audio_renderer,
-                             SND_PCM_FORMAT_S16_LE,
-                             SND_PCM_ACCESS_RW_INTERLEAVED,
-                             2,
-                             44100,
-                             1,
-                             100000);
-
-    if ( err < 0 ) {
-        logger_log(renderer->base.logger, LOGGER_ERR, snd_strerror(err));
+    if (audio_renderer_alsa_set_params(renderer) < 0) {
         return -52;
     }
     // Opening a connection to the sound card to adjust the volume
@@ -129,7 +216,7 @@ static int audio_renderer_rpi_init_renderer( audio_renderer_alsa_t *renderer,
     CHK_ALSA_ERRNO( snd_ctl_elem_list_alloc_space(list, count), "Alloc space for ALSA ctrl ID", renderer->base.logger );
     CHK_ALSA_ERRNO( snd_ctl_elem_list(renderer->ctl, list), "Get ALSA control element list", renderer->base.logger );
 
-    mHasCtrlVolume = true;
+    renderer->has_ctrl_volume = true;
     for ( ;count != 0; count-- ) {
         if ( strstr( snd_ctl_elem_list_get_name(list, count - 1), "Playback Volume" ) ) {
             snd_ctl_elem_id_set_numid( renderer->ctl_elem_id,
@@ -139,7 +226,7 @@ static int audio_renderer_rpi_init_renderer( audio_renderer_alsa_t *renderer,
 
         if (count == 1) {
             logger_log(renderer->base.logger, LOGGER_INFO, "Cannot control Volume for selected device");
-            mHasCtrlVolume = false;
+            renderer->has_ctrl_volume = false;
         }
     }
 
@@ -163,17 +250,20 @@ audio_renderer_t *audio_renderer_alsa_init(logger_t *logger, video_renderer_t *v
         video_renderer = NULL;
     }
     renderer->config = config;
+    renderer->buffer_time = config->low_latency ? ALSA_LOW_LATENCY_BUFFER_TIME : ALSA_BUFFER_TIME;
 
-    if (audio_renderer_alsa_init_decoder(renderer) != 1) {
+    if (audio_renderer_rpi_init_renderer(renderer, video_renderer) != 1) {
         free(renderer);
         renderer = NULL;
         return NULL;
     }
 
-    if (audio_renderer_rpi_init_renderer(renderer, video_renderer) != 1) {
-        audio_renderer_alsa_destroy_decoder(renderer);
+    // Room for a period plus one resampled packet, which may grow by two frames
+    renderer->pcm_capacity = renderer->period_size + AAC_DECODER_FRAME_SIZE + 4;
+    renderer->pcm_buffer = malloc(renderer->pcm_capacity * 2 * sizeof(int16_t));
+    if (!renderer->pcm_buffer) {
+        audio_renderer_rpi_destroy_renderer(renderer);
         free(renderer);
-        renderer = NULL;
         return NULL;
     }
 
@@ -184,68 +274,220 @@ static void audio_renderer_alsa_start(__attribute__((unused)) audio_renderer_t *
     // Nothing to do
 }
 
-#ifdef DUMP_AUDIO
-static FILE* file_pcm = NULL;
-#endif
+static void audio_renderer_alsa_write(audio_renderer_alsa_t *r, const int16_t *data, snd_pcm_sframes_t frames) {
+    while (frames > 0) {
+        snd_pcm_sframes_t written = r->mmap_access ? snd_pcm_mmap_writei(r->audio_renderer, data, frames) :
+                                                     snd_pcm_writei(r->audio_renderer, data, frames);
+        if (written < 0) {
+            if (written == -EPIPE) {
+                __atomic_store_n(&r->xruns, r->xruns + 1, __ATOMIC_RELAXED);
+                r->new_xruns++;
+            } else if (written == -ESTRPIPE) {
+                __atomic_store_n(&r->suspends, r->suspends + 1, __ATOMIC_RELAXED);
+            }
+            written = snd_pcm_recover(r->audio_renderer, (int) written, 0);
+            if (written < 0) {
+                __atomic_store_n(&r->write_errors, r->write_errors + 1, __ATOMIC_RELAXED);
+                logger_log(r->base.logger, LOGGER_ERR, snd_strerror((int) written));
+                return;
+            }
+            // Output restarted after an underrun, align the next packet again
+            r->synced = false;
+            continue;
+        }
+        data += written * 2;
+        frames -= written;
+    }
+}
 
-static void audio_renderer_alsa_render_buffer( audio_renderer_t *renderer,
-                                               __attribute__((unused)) raop_ntp_t *ntp,
-                                               unsigned char *data,
-                                               int data_len,
-                                               __attribute__((unused)) uint64_t pts )
-{
-    if (data_len == 0) return;
-    
-    audio_renderer_alsa_t *r = (audio_renderer_alsa_t *)renderer;
+static void audio_renderer_alsa_write_silence(audio_renderer_alsa_t *r, snd_pcm_sframes_t frames) {
+    static const int16_t silence[ALSA_SILENCE_CHUNK * 2];
+    while (frames > 0) {
+        snd_pcm_sframes_t chunk = frames < ALSA_SILENCE_CHUNK ? frames : ALSA_SILENCE_CHUNK;
+        audio_renderer_alsa_write(r, silence, chunk);
+        frames -= chunk;
+    }
+}
 
-    logger_log(renderer->logger, LOGGER_DEBUG, "Got AAC data of %d bytes", data_len);
+static void audio_renderer_alsa_write_pending(audio_renderer_alsa_t *r) {
+    audio_renderer_alsa_write(r, r->pcm_buffer, r->pcm_frames);
+    r->pcm_frames = 0;
+}
 
-    // We assume that every buffer contains exactly 1 frame.
+/*
+ * Linear interpolation resampler. Consumes frames input frames and advances
+ * step input frames per output frame, carrying the fractional position and
+ * last frame over to the next call. Returns the number of output frames,
+ * at most frames + 2 for the step range used here.
+ */
+static int audio_renderer_alsa_resample(audio_renderer_alsa_t *r, const int16_t *in, int frames,
+                                        int16_t *out, double step) {
+    double pos = r->resample_phase;
+    int count = 0;
+    while (pos < frames) {
+        int i = (int) pos;
+        int32_t frac = (int32_t) ((pos - i) * 65536.0);
+        const int16_t *a = i == 0 ? r->resample_last : &in[(i - 1) * 2];
+        const int16_t *b = &in[i * 2];
+        out[count * 2] = (int16_t) ((a[0] * (65536 - frac) + b[0] * frac) >> 16);
+        out[count * 2 + 1] = (int16_t) ((a[1] * (65536 - frac) + b[1] * frac) >> 16);
+        count++;
+        pos += step;
+    }
+    r->resample_phase = pos - frames;
+    r->resample_last[0] = in[(frames - 1) * 2];
+    r->resample_last[1] = in[(frames - 1) * 2 + 1];
+    return count;
+}
+
+/*
+ * Returns how far behind its pts plus the delay av_sync asked for the next written sample will be heard,
+ * in microseconds.
+ */
+/* The device's period may differ after it was set up again, the pcm buffer has to fit one plus a packet */
+static int audio_renderer_alsa_fit_buffer(audio_renderer_alsa_t *r) {
+    if (r->period_size + AAC_DECODER_FRAME_SIZE + 4 > r->pcm_capacity) {
+        int16_t *pcm_buffer = realloc(r->pcm_buffer, (r->period_size + AAC_DECODER_FRAME_SIZE + 4) * 2 * sizeof(int16_t));
+        if (!pcm_buffer) {
+            return -1;
+        }
+        r->pcm_buffer = pcm_buffer;
+        r->pcm_capacity = r->period_size + AAC_DECODER_FRAME_SIZE + 4;
+    }
+    return 0;
+}
 
-    AAC_DECODER_ERROR error;
+/* Drops what is queued and sets the device up for buffer_time, the next packet is aligned again */
+static void audio_renderer_alsa_retune(audio_renderer_alsa_t *r, unsigned int buffer_time) {
+    unsigned int old_buffer_time = r->buffer_time;
+    CHK_ALSA_ERRNO( snd_pcm_drop(r->audio_renderer), "ALSA PCM drop", r->base.logger );
+    __atomic_store_n(&r->buffer_time, buffer_time, __ATOMIC_RELAXED);
+    if (audio_renderer_alsa_set_params(r) < 0 || audio_renderer_alsa_fit_buffer(r) < 0) {
+        // Back to what worked, the pcm buffer already fits it
+        __atomic_store_n(&r->buffer_time, old_buffer_time, __ATOMIC_RELAXED);
+        audio_renderer_alsa_set_params(r);
+    } else {
+        __atomic_store_n(&r->retunes, r->retunes + 1, __ATOMIC_RELAXED);
+        logger_log(r->base.logger, LOGGER_INFO, "ALSA: buffer time tuned from %u to %u us", old_buffer_time, buffer_time);
+    }
+    CHK_ALSA_ERRNO( snd_pcm_prepare(r->audio_renderer), "ALSA PCM prepare", r->base.logger );
+    r->pcm_frames = 0;
+    r->synced = false;
+}
 
-    UCHAR *p_buffer[1] = {data};
-    UINT buffer_size = data_len;
-    UINT bytes_valid = data_len;
-    error = aacDecoder_Fill(r->audio_decoder, p_buffer, &buffer_size, &bytes_valid);
-    if (error != AAC_DEC_OK) {
-        logger_log(renderer->logger, LOGGER_ERR, "aacDecoder_Fill error : %x", error);
+/*
+ * Grows the buffer right away after repeated underruns, there is a gap anyway. A buffer the device never
+ * ran low on for a while is only marked for shrinking, so playing audio isn't cut into.
+ */
+static void audio_renderer_alsa_tune(audio_renderer_alsa_t *r, uint64_t now) {
+    if (r->stable_since == 0) {
+        r->stable_since = now;
+    }
+    if (r->new_xruns > 0) {
+        if (r->window_xruns == 0 || now - r->window_start > ALSA_TUNE_XRUN_WINDOW) {
+            r->window_xruns = 0;
+            r->window_start = now;
+        }
+        r->window_xruns += r->new_xruns;
+        r->new_xruns = 0;
+        r->stable_since = now;
+        r->min_delay = (snd_pcm_sframes_t) r->buffer_size;
+        r->shrink_to = 0;
+        if (r->window_xruns >= ALSA_TUNE_XRUNS && r->buffer_time < ALSA_TUNE_MAX_BUFFER_TIME) {
+            unsigned int buffer_time = r->buffer_time * 3 / 2;
+            audio_renderer_alsa_retune(r, buffer_time < ALSA_TUNE_MAX_BUFFER_TIME ? buffer_time : ALSA_TUNE_MAX_BUFFER_TIME);
+        }
+        return;
+    }
+    if (now - r->stable_since >= ALSA_TUNE_STABLE_TIME && r->buffer_time > ALSA_TUNE_MIN_BUFFER_TIME) {
+        if (r->min_delay >= (snd_pcm_sframes_t) r->buffer_size / 2) {
+            unsigned int buffer_time = r->buffer_time * 3 / 4;
+            r->shrink_to = buffer_time > ALSA_TUNE_MIN_BUFFER_TIME ? buffer_time : ALSA_TUNE_MIN_BUFFER_TIME;
+        }
+        r->stable_since = now;
+        r->min_delay = (snd_pcm_sframes_t) r->buffer_size;
     }
+}
 
-    INT time_data_size = 4 * 480;
-    INT_PCM *p_time_data = malloc(time_data_size); // The buffer for the decoded AAC frames
-    error = aacDecoder_DecodeFrame(r->audio_decoder, p_time_data, time_data_size, 0);
-    if (error != AAC_DEC_OK) {
-        logger_log(renderer->logger, LOGGER_ERR, "aacDecoder_DecodeFrame error : 0x%x", error);
+static int64_t audio_renderer_alsa_get_sync_error(audio_renderer_alsa_t *r, raop_ntp_t *ntp, uint64_t pts) {
+    snd_pcm_sframes_t delay = 0;
+    if (snd_pcm_delay(r->audio_renderer, &delay) < 0 || delay < 0) {
+        delay = 0;
+    } else if (r->synced && snd_pcm_state(r->audio_renderer) == SND_PCM_STATE_RUNNING) {
+        // Only while playing, the buffer fills up from empty before playback starts
+        if (delay < r->min_delay) r->min_delay = delay;
+        __atomic_store_n(&r->last_delay, (int64_t) delay, __ATOMIC_RELAXED);
     }
+    // Frames still waiting in the pcm buffer play before the next one too
+    delay += r->pcm_frames;
+    uint64_t play_time = raop_ntp_get_local_time(ntp) + (uint64_t) delay * 1000000 / ALSA_SAMPLE_RATE +
+                         (uint64_t) r->config->output_delay * 1000;
+    return (int64_t) play_time - (int64_t) pts - r->delay;
+}
 
-#ifdef DUMP_AUDIO
-    if (file_pcm == NULL) {
-        file_pcm = fopen("/home/pi/Airplay.pcm", "wb");
+static void audio_renderer_alsa_render_pcm(audio_renderer_t *renderer, raop_ntp_t *ntp, stream_frame_t *frame) {
+    audio_renderer_alsa_t *r = (audio_renderer_alsa_t *)renderer;
+    uint64_t pts = frame->pts;
+
+    // Packets hold AAC_DECODER_FRAME_SIZE frames, so they always fit next to a period
+    const int16_t *frames = (const int16_t *) frame->data;
+    snd_pcm_sframes_t frame_count = snd_pcm_bytes_to_frames(r->audio_renderer, frame->data_len);
+    if (frame_count <= 0 || frame_count > AAC_DECODER_FRAME_SIZE) {
+        stream_frame_unref(frame);
+        return;
     }
 
-    fwrite(p_time_data, time_data_size, 1, file_pcm);
-#endif
+    trace_event(TRACE_AUDIO_RENDERED, frame->data_len, pts);
 
-    snd_pcm_sframes_t playedFrames, receivedFrames = snd_pcm_bytes_to_frames(r->audio_renderer,time_data_size);
-    playedFrames = snd_pcm_writei(r->audio_renderer,p_time_data , receivedFrames);
-    if (playedFrames < 0)
-        playedFrames = snd_pcm_recover(r->audio_renderer, (int)playedFrames, 0);
-    if (playedFrames < 0)
-        logger_log(renderer->logger, LOGGER_ERR, snd_strerror((int) playedFrames));
+    int64_t sync_error = audio_renderer_alsa_get_sync_error(r, ntp, pts);
+    if (r->synced && (sync_error > ALSA_SYNC_MAX_ERROR || sync_error < -ALSA_SYNC_MAX_ERROR)) {
+        logger_log(renderer->logger, LOGGER_DEBUG, "ALSA: %lld us off pts, realigning", sync_error);
+        r->synced = false;
+    }
 
-    if (playedFrames > 0 && playedFrames < receivedFrames)
-        logger_log( renderer->logger,
-                    LOGGER_ERR,
-                    "ALSA: Expected write %li, but wrote %li frames)\n", receivedFrames, playedFrames);
+    if (!r->synced) {
+        // Sample-accurate start: pad with silence when early, skip samples when late
+        snd_pcm_sframes_t offset = (snd_pcm_sframes_t) (sync_error * ALSA_SAMPLE_RATE / 1000000);
+        audio_renderer_alsa_write_pending(r);
+        if (offset < 0) {
+            audio_renderer_alsa_write_silence(r, -offset);
+        } else if (offset >= frame_count) {
+            stream_frame_unref(frame);
+            return;
+        } else {
+            frames += offset * 2;
+            frame_count -= offset;
+        }
+        r->synced = true;
+        r->sync_error = 0;
+        r->resample_phase = 1.0;
+        r->resample_last[0] = frames[(frame_count - 1) * 2];
+        r->resample_last[1] = frames[(frame_count - 1) * 2 + 1];
+        memcpy(r->pcm_buffer, frames, frame_count * 2 * sizeof(int16_t));
+        r->pcm_frames = frame_count;
+    } else {
+        // Slew the output rate to remove the remaining drift
+        r->sync_error += ((double) sync_error - r->sync_error) / 8.0;
+        double adjust = r->sync_error / 1000000.0 * ALSA_SYNC_GAIN;
+        if (adjust > ALSA_SYNC_MAX_ADJUST) adjust = ALSA_SYNC_MAX_ADJUST;
+        if (adjust < -ALSA_SYNC_MAX_ADJUST) adjust = -ALSA_SYNC_MAX_ADJUST;
+        r->pcm_frames += audio_renderer_alsa_resample(r, frames, (int) frame_count,
+                                                      r->pcm_buffer + r->pcm_frames * 2, 1.0 + adjust);
+    }
 
-    free(p_time_data);
+    stream_frame_unref(frame);
+
+    // Batch packets until a whole period can be written at once
+    if (r->pcm_frames >= r->period_size) {
+        audio_renderer_alsa_write_pending(r);
+    }
+    audio_renderer_alsa_tune(r, raop_ntp_get_local_time(ntp));
 }
 
 static void audio_renderer_alsa_set_volume(audio_renderer_t *renderer, float volume) {
-    if ( !mHasCtrlVolume ) return;
-
     audio_renderer_alsa_t *r = (audio_renderer_alsa_t *)renderer;
+    if ( !r->has_ctrl_volume ) return;
+
     long raw;
     CHK_ALSA_ERRNO (
             snd_ctl_convert_from_dB(r->ctl, r->ctl_elem_id, (long)volume * 200, &raw, 0),
@@ -259,24 +501,92 @@ static void audio_renderer_alsa_set_volume(audio_renderer_t *renderer, float vol
     CHK_ALSA_ERRNO( snd_ctl_elem_write(r->ctl, value), "Set volume", r->base.logger );
 }
 
-static void audio_renderer_alsa_flush(__attribute__((unused)) audio_renderer_t *renderer) {
-    // Nothing to do
+/* Reports the device delay measured while playing, the buffer asked for until then */
+static void audio_renderer_alsa_get_caps(audio_renderer_t *renderer, audio_renderer_caps_t *caps) {
+    audio_renderer_alsa_t *r = (audio_renderer_alsa_t *)renderer;
+    int64_t delay = __atomic_load_n(&r->last_delay, __ATOMIC_RELAXED);
+    uint64_t latency = delay > 0 ? (uint64_t) delay * 1000000 / ALSA_SAMPLE_RATE :
+                                   __atomic_load_n(&r->buffer_time, __ATOMIC_RELAXED);
+    caps->output_latency = latency + (uint64_t) r->config->output_delay * 1000;
+    caps->software_volume = !r->has_ctrl_volume;
+}
+
+static void audio_renderer_alsa_flush(audio_renderer_t *renderer) {
+    audio_renderer_alsa_t *r = (audio_renderer_alsa_t *)renderer;
+    if (r->shrink_to) {
+        audio_renderer_alsa_retune(r, r->shrink_to);
+        return;
+    }
+    // Drop what is queued so the next packet starts on its pts
+    CHK_ALSA_ERRNO( snd_pcm_drop(r->audio_renderer), "ALSA PCM drop", renderer->logger );
+    CHK_ALSA_ERRNO( snd_pcm_prepare(r->audio_renderer), "ALSA PCM prepare", renderer->logger );
+    r->pcm_frames = 0;
+    r->synced = false;
+}
+
+/* Small changes are slewed in by the resampler, larger ones realign the output */
+static void audio_renderer_alsa_set_delay(audio_renderer_t *renderer, int64_t delay) {
+    audio_renderer_alsa_t *r = (audio_renderer_alsa_t *)renderer;
+    r->delay = delay;
+}
+
+static void audio_renderer_alsa_get_stats(audio_renderer_t *renderer, audio_renderer_stats_t *stats) {
+    audio_renderer_alsa_t *r = (audio_renderer_alsa_t *)renderer;
+    stats->has_presentation_offset = r->synced;
+    stats->presentation_offset = r->delay + (int64_t) r->sync_error;
+}
+
+static void audio_renderer_alsa_log_stats(audio_renderer_t *renderer) {
+    audio_renderer_alsa_t *r = (audio_renderer_alsa_t *)renderer;
+    int64_t delay = __atomic_load_n(&r->last_delay, __ATOMIC_RELAXED);
+    logger_log(renderer->logger, LOGGER_INFO,
+               "ALSA: buffer %u us, device delay %lld us, %llu underruns, %llu suspends, %llu write errors, %llu retunes",
+               __atomic_load_n(&r->buffer_time, __ATOMIC_RELAXED), (long long) (delay * 1000000 / ALSA_SAMPLE_RATE),
+               (unsigned long long) __atomic_load_n(&r->xruns, __ATOMIC_RELAXED),
+               (unsigned long long) __atomic_load_n(&r->suspends, __ATOMIC_RELAXED),
+               (unsigned long long) __atomic_load_n(&r->write_errors, __ATOMIC_RELAXED),
+               (unsigned long long) __atomic_load_n(&r->retunes, __ATOMIC_RELAXED));
 }
 
 static void audio_renderer_alsa_destroy(audio_renderer_t *renderer) {
     if (renderer) {
         audio_renderer_alsa_t *r = (audio_renderer_alsa_t *)renderer;
-        audio_renderer_alsa_flush(renderer);
-        audio_renderer_alsa_destroy_decoder(r);
-        audio_renderer_rpi_destroy_renderer(r);
+        // Already closed if suspended
+        if (r->audio_renderer) {
+            audio_renderer_alsa_flush(renderer);
+            audio_renderer_rpi_destroy_renderer(r);
+        }
+        free(r->pcm_buffer);
         free(renderer);
     }
 }
 
+/* Closes the PCM and the mixer so the device can sleep, the buffers stay */
+static void audio_renderer_alsa_suspend(audio_renderer_t *renderer) {
+    audio_renderer_alsa_t *r = (audio_renderer_alsa_t *)renderer;
+    audio_renderer_alsa_flush(renderer);
+    audio_renderer_rpi_destroy_renderer(r);
+    r->audio_renderer = NULL;
+}
+
+static int audio_renderer_alsa_resume(audio_renderer_t *renderer) {
+    audio_renderer_alsa_t *r = (audio_renderer_alsa_t *)renderer;
+    if (audio_renderer_rpi_init_renderer(r, NULL) != 1) {
+        return -1;
+    }
+    return audio_renderer_alsa_fit_buffer(r);
+}
+
 static const audio_renderer_funcs_t audio_renderer_alsa_funcs = {
     .start = audio_renderer_alsa_start,
-    .render_buffer = audio_renderer_alsa_render_buffer,
+    .render_pcm = audio_renderer_alsa_render_pcm,
     .set_volume = audio_renderer_alsa_set_volume,
     .flush = audio_renderer_alsa_flush,
     .destroy = audio_renderer_alsa_destroy,
+    .log_stats = audio_renderer_alsa_log_stats,
+    .suspend = audio_renderer_alsa_suspend,
+    .resume = audio_renderer_alsa_resume,
+    .get_stats = audio_renderer_alsa_get_stats,
+    .get_caps = audio_renderer_alsa_get_caps,
+    .set_delay = audio_renderer_alsa_set_delay,
 };
@@ -17,6 +17,11 @@
  * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
  */
 
+/*
+ * Measurement sink: discards the audio but counts packets and bytes and records
+ * when they arrive. The summary is logged on destroy and through log_stats.
+ */
+
 #include "audio_renderer.h"
 
 #include <stdlib.h>
@@ -26,8 +31,17 @@
 #include <stdbool.h>
 #include <unistd.h>
 
+#include "../lib/threads.h"
+#include "arrival_stats.h"
+
 typedef struct audio_renderer_dummy_s {
     audio_renderer_t base;
+
+    /* render_buffer runs on the audio thread, log_stats on the main thread */
+    mutex_handle_t stats_mutex;
+    arrival_stats_t arrival;
+    uint64_t flushes;
+    float volume;
 } audio_renderer_dummy_t;
 
 static const audio_renderer_funcs_t audio_renderer_dummy_funcs;
@@ -41,6 +55,7 @@ audio_renderer_t *audio_renderer_dummy_init(logger_t *logger, video_renderer_t *
     renderer->base.logger = logger;
     renderer->base.funcs = &audio_renderer_dummy_funcs;
     renderer->base.type = AUDIO_RENDERER_DUMMY;
+    MUTEX_CREATE(renderer->stats_mutex);
     return &renderer->base;
 }
 
@@ -48,16 +63,51 @@ static void audio_renderer_dummy_start(audio_renderer_t *renderer) {
 }
 
 static void audio_renderer_dummy_render_buffer(audio_renderer_t *renderer, raop_ntp_t *ntp, unsigned char *data, int data_len, uint64_t pts) {
+    audio_renderer_dummy_t *r = (audio_renderer_dummy_t *) renderer;
+    uint64_t arrival = raop_ntp_get_local_time(ntp);
+
+    MUTEX_LOCK(r->stats_mutex);
+    arrival_stats_add(&r->arrival, arrival, pts, data_len);
+    MUTEX_UNLOCK(r->stats_mutex);
 }
 
 static void audio_renderer_dummy_set_volume(audio_renderer_t *renderer, float volume) {
+    audio_renderer_dummy_t *r = (audio_renderer_dummy_t *) renderer;
+    MUTEX_LOCK(r->stats_mutex);
+    r->volume = volume;
+    MUTEX_UNLOCK(r->stats_mutex);
+}
+
+static void audio_renderer_dummy_log_stats(audio_renderer_t *renderer) {
+    audio_renderer_dummy_t *r = (audio_renderer_dummy_t *) renderer;
+
+    MUTEX_LOCK(r->stats_mutex);
+    arrival_stats_log(&r->arrival, renderer->logger, "Audio");
+    logger_log(renderer->logger, LOGGER_INFO, "Audio: %llu flushes, volume %.2f", (unsigned long long) r->flushes, r->volume);
+    MUTEX_UNLOCK(r->stats_mutex);
 }
 
 static void audio_renderer_dummy_flush(audio_renderer_t *renderer) {
+    audio_renderer_dummy_t *r = (audio_renderer_dummy_t *) renderer;
+    MUTEX_LOCK(r->stats_mutex);
+    r->flushes++;
+    MUTEX_UNLOCK(r->stats_mutex);
+}
+
+static void audio_renderer_dummy_suspend(audio_renderer_t *renderer) {
+    logger_log(renderer->logger, LOGGER_DEBUG, "Audio: suspended");
+}
+
+static int audio_renderer_dummy_resume(audio_renderer_t *renderer) {
+    logger_log(renderer->logger, LOGGER_DEBUG, "Audio: resumed");
+    return 0;
 }
 
 static void audio_renderer_dummy_destroy(audio_renderer_t *renderer) {
     if (renderer) {
+        audio_renderer_dummy_t *r = (audio_renderer_dummy_t *) renderer;
+        audio_renderer_dummy_log_stats(renderer);
+        MUTEX_DESTROY(r->stats_mutex);
         free(renderer);
     }
 }
@@ -68,4 +118,7 @@ static const audio_renderer_funcs_t audio_renderer_dummy_funcs = {
     .set_volume = audio_renderer_dummy_set_volume,
     .flush = audio_renderer_dummy_flush,
     .destroy = audio_renderer_dummy_destroy,
+    .log_stats = audio_renderer_dummy_log_stats,
+    .suspend = audio_renderer_dummy_suspend,
+    .resume = audio_renderer_dummy_resume,
 };
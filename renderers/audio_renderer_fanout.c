@@ -0,0 +1,176 @@
+/**
+ * RPiPlay - An open-source AirPlay mirroring server for Raspberry Pi
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+/*
+ * Plays the PCM of the shared aac_decoder on several renderers, e.g. HDMI and a USB DAC.
+ * Every sink gets a reference to the same decoded frame and aligns it to the frame's pts
+ * against its own output latency, so they play in step without decoding twice.
+ */
+
+#include "audio_renderer.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct audio_renderer_fanout_s {
+    audio_renderer_t base;
+    audio_renderer_t *sinks[AUDIO_RENDERER_MAX_SINKS];
+    int sink_count;
+} audio_renderer_fanout_t;
+
+static const audio_renderer_funcs_t audio_renderer_fanout_funcs;
+
+audio_renderer_t *audio_renderer_fanout_init(logger_t *logger, audio_renderer_t **sinks, int sink_count) {
+    audio_renderer_fanout_t *renderer;
+
+    if (sink_count < 1 || sink_count > AUDIO_RENDERER_MAX_SINKS) {
+        return NULL;
+    }
+    for (int i = 0; i < sink_count; i++) {
+        if (!sinks[i]->funcs->render_pcm) {
+            logger_log(logger, LOGGER_ERR, "Audio sink %d does not take PCM", i);
+            return NULL;
+        }
+    }
+    renderer = calloc(1, sizeof(audio_renderer_fanout_t));
+    if (!renderer) {
+        return NULL;
+    }
+    renderer->base.logger = logger;
+    renderer->base.funcs = &audio_renderer_fanout_funcs;
+    renderer->base.type = sinks[0]->type;
+    memcpy(renderer->sinks, sinks, sink_count * sizeof(audio_renderer_t *));
+    renderer->sink_count = sink_count;
+    return &renderer->base;
+}
+
+static void audio_renderer_fanout_start(audio_renderer_t *renderer) {
+    audio_renderer_fanout_t *r = (audio_renderer_fanout_t *) renderer;
+    for (int i = 0; i < r->sink_count; i++) {
+        r->sinks[i]->funcs->start(r->sinks[i]);
+    }
+}
+
+static void audio_renderer_fanout_render_pcm(audio_renderer_t *renderer, raop_ntp_t *ntp, stream_frame_t *frame) {
+    audio_renderer_fanout_t *r = (audio_renderer_fanout_t *) renderer;
+    // Every sink but the last takes a reference of its own, the last one takes over the caller's
+    for (int i = 0; i < r->sink_count; i++) {
+        r->sinks[i]->funcs->render_pcm(r->sinks[i], ntp, i < r->sink_count - 1 ? stream_frame_ref(frame) : frame);
+    }
+}
+
+static void audio_renderer_fanout_set_volume(audio_renderer_t *renderer, float volume) {
+    audio_renderer_fanout_t *r = (audio_renderer_fanout_t *) renderer;
+    for (int i = 0; i < r->sink_count; i++) {
+        r->sinks[i]->funcs->set_volume(r->sinks[i], volume);
+    }
+}
+
+static void audio_renderer_fanout_flush(audio_renderer_t *renderer) {
+    audio_renderer_fanout_t *r = (audio_renderer_fanout_t *) renderer;
+    for (int i = 0; i < r->sink_count; i++) {
+        r->sinks[i]->funcs->flush(r->sinks[i]);
+    }
+}
+
+static void audio_renderer_fanout_log_stats(audio_renderer_t *renderer) {
+    audio_renderer_fanout_t *r = (audio_renderer_fanout_t *) renderer;
+    for (int i = 0; i < r->sink_count; i++) {
+        if (r->sinks[i]->funcs->log_stats) r->sinks[i]->funcs->log_stats(r->sinks[i]);
+    }
+}
+
+/* The sink that is furthest behind decides */
+static void audio_renderer_fanout_get_stats(audio_renderer_t *renderer, audio_renderer_stats_t *stats) {
+    audio_renderer_fanout_t *r = (audio_renderer_fanout_t *) renderer;
+    for (int i = 0; i < r->sink_count; i++) {
+        audio_renderer_stats_t sink_stats = *stats;
+        if (!r->sinks[i]->funcs->get_stats) continue;
+        sink_stats.has_presentation_offset = false;
+        r->sinks[i]->funcs->get_stats(r->sinks[i], &sink_stats);
+        if (sink_stats.queued_packets > stats->queued_packets) stats->queued_packets = sink_stats.queued_packets;
+        if (sink_stats.decoder_latency > stats->decoder_latency) stats->decoder_latency = sink_stats.decoder_latency;
+        if (sink_stats.dropped_packets > stats->dropped_packets) stats->dropped_packets = sink_stats.dropped_packets;
+        if (sink_stats.has_presentation_offset &&
+            (!stats->has_presentation_offset || sink_stats.presentation_offset > stats->presentation_offset)) {
+            stats->has_presentation_offset = true;
+            stats->presentation_offset = sink_stats.presentation_offset;
+        }
+    }
+}
+
+/* Sinks that can't delay their output stay where they are, the ones that can follow av_sync */
+static void audio_renderer_fanout_set_delay(audio_renderer_t *renderer, int64_t delay) {
+    audio_renderer_fanout_t *r = (audio_renderer_fanout_t *) renderer;
+    for (int i = 0; i < r->sink_count; i++) {
+        if (r->sinks[i]->funcs->set_delay) r->sinks[i]->funcs->set_delay(r->sinks[i], delay);
+    }
+}
+
+static void audio_renderer_fanout_get_caps(audio_renderer_t *renderer, audio_renderer_caps_t *caps) {
+    audio_renderer_fanout_t *r = (audio_renderer_fanout_t *) renderer;
+    for (int i = 0; i < r->sink_count; i++) {
+        audio_renderer_caps_t sink_caps = *caps;
+        if (!r->sinks[i]->funcs->get_caps) continue;
+        r->sinks[i]->funcs->get_caps(r->sinks[i], &sink_caps);
+        if (sink_caps.output_latency > caps->output_latency) caps->output_latency = sink_caps.output_latency;
+        // One sink without a mixer takes them all to the software volume, so they stay at the same level
+        if (sink_caps.software_volume) caps->software_volume = true;
+    }
+}
+
+static void audio_renderer_fanout_suspend(audio_renderer_t *renderer) {
+    audio_renderer_fanout_t *r = (audio_renderer_fanout_t *) renderer;
+    for (int i = 0; i < r->sink_count; i++) {
+        if (r->sinks[i]->funcs->suspend) r->sinks[i]->funcs->suspend(r->sinks[i]);
+    }
+}
+
+/* Every sink is tried, so one that can't come back doesn't keep the others down */
+static int audio_renderer_fanout_resume(audio_renderer_t *renderer) {
+    audio_renderer_fanout_t *r = (audio_renderer_fanout_t *) renderer;
+    int ret = 0;
+    for (int i = 0; i < r->sink_count; i++) {
+        if (r->sinks[i]->funcs->resume && r->sinks[i]->funcs->resume(r->sinks[i]) < 0) ret = -1;
+    }
+    return ret;
+}
+
+static void audio_renderer_fanout_destroy(audio_renderer_t *renderer) {
+    if (renderer) {
+        audio_renderer_fanout_t *r = (audio_renderer_fanout_t *) renderer;
+        for (int i = 0; i < r->sink_count; i++) {
+            r->sinks[i]->funcs->destroy(r->sinks[i]);
+        }
+        free(renderer);
+    }
+}
+
+static const audio_renderer_funcs_t audio_renderer_fanout_funcs = {
+    .start = audio_renderer_fanout_start,
+    .render_pcm = audio_renderer_fanout_render_pcm,
+    .set_volume = audio_renderer_fanout_set_volume,
+    .flush = audio_renderer_fanout_flush,
+    .destroy = audio_renderer_fanout_destroy,
+    .log_stats = audio_renderer_fanout_log_stats,
+    .get_stats = audio_renderer_fanout_get_stats,
+    .get_caps = audio_renderer_fanout_get_caps,
+    .suspend = audio_renderer_fanout_suspend,
+    .resume = audio_renderer_fanout_resume,
+    .set_delay = audio_renderer_fanout_set_delay,
+};
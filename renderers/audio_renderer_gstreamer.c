@@ -21,12 +21,28 @@
 #include <assert.h>
 #include <math.h>
 #include <gst/app/gstappsrc.h>
+#include "../lib/trace.h"
+#include "gstreamer_clock.h"
+#include "aac_decoder.h"
+
+extern gstreamer_clock_t *video_renderer_gstreamer_get_clock(video_renderer_t *renderer);
+
+/* Sink buffer and segment in low-latency mode unless configured, in ms */
+#define LOW_LATENCY_BUFFER_TIME 40
+#define LOW_LATENCY_LATENCY_TIME 10
 
 typedef struct audio_renderer_gstreamer_s {
     audio_renderer_t base;
     GstElement *appsrc;
     GstElement *pipeline;
     GstElement *volume;
+    /* Samples are played at their pts unless low-latency mode plays them as soon as they are decoded */
+    bool sync;
+    /* The video renderer's if it is a gstreamer one */
+    gstreamer_clock_t *clock;
+    /* Applied to the sink autoaudiosink picks, in us, 0 leaves the sink's own */
+    gint64 buffer_time;
+    gint64 latency_time;
 } audio_renderer_gstreamer_t;
 
 static const audio_renderer_funcs_t audio_renderer_gstreamer_funcs;
@@ -36,7 +52,7 @@ static gboolean check_plugins(void)
     int i;
     gboolean ret;
     GstRegistry *registry;
-    const gchar *needed[] = {"app", "libav", "playback", "autodetect", NULL};
+    const gchar *needed[] = {"app", "audioconvert", "volume", "autodetect", NULL};
 
     registry = gst_registry_get();
     ret = TRUE;
@@ -53,6 +69,19 @@ static gboolean check_plugins(void)
     return ret;
 }
 
+/* autoaudiosink only creates the real sink once it starts, its buffer is set then */
+static void audio_renderer_gstreamer_element_added(GstBin *bin, GstBin *sub_bin, GstElement *element, gpointer user_data) {
+    audio_renderer_gstreamer_t *r = user_data;
+    GObjectClass *klass = G_OBJECT_GET_CLASS(element);
+    if (!g_object_class_find_property(klass, "buffer-time") || !g_object_class_find_property(klass, "latency-time")) {
+        return;
+    }
+    if (r->buffer_time > 0) g_object_set(element, "buffer-time", r->buffer_time, NULL);
+    if (r->latency_time > 0) g_object_set(element, "latency-time", r->latency_time, NULL);
+    logger_log(r->base.logger, LOGGER_DEBUG, "Audio sink %s buffers %lld us in segments of %lld us",
+               GST_ELEMENT_NAME(element), (long long) r->buffer_time, (long long) r->latency_time);
+}
+
 audio_renderer_t *audio_renderer_gstreamer_init(logger_t *logger, video_renderer_t *video_renderer, audio_renderer_config_t const *config) {
     audio_renderer_gstreamer_t *renderer;
     GError *error = NULL;
@@ -72,57 +101,87 @@ audio_renderer_t *audio_renderer_gstreamer_init(logger_t *logger, video_renderer
 
     assert(check_plugins());
 
-    renderer->pipeline = gst_parse_launch("appsrc name=audio_source stream-type=0 format=GST_FORMAT_TIME is-live=true ! queue ! decodebin !"
-    "audioconvert ! volume name=volume ! level ! autoaudiosink sync=false", &error);
+    renderer->sync = !config->low_latency;
+    int buffer_time = config->sink_buffer_time > 0 ? config->sink_buffer_time : config->low_latency ? LOW_LATENCY_BUFFER_TIME : 0;
+    int latency_time = config->sink_latency_time > 0 ? config->sink_latency_time : config->low_latency ? LOW_LATENCY_LATENCY_TIME : 0;
+    renderer->buffer_time = (gint64) buffer_time * 1000;
+    renderer->latency_time = (gint64) latency_time * 1000;
+
+    // The PCM comes decoded and stamped, it only needs converting to what the sink takes
+    gchar *launch = g_strdup_printf("appsrc name=audio_source stream-type=0 format=GST_FORMAT_TIME is-live=true ! queue !"
+    "audioconvert ! volume name=volume ! autoaudiosink sync=%s", renderer->sync ? "true" : "false");
+    renderer->pipeline = gst_parse_launch(launch, &error);
     g_assert(renderer->pipeline);
+    g_free(launch);
+    if (renderer->buffer_time > 0 || renderer->latency_time > 0) {
+        g_signal_connect(renderer->pipeline, "deep-element-added", G_CALLBACK(audio_renderer_gstreamer_element_added), renderer);
+    }
+    if (renderer->sync) {
+        if (video_renderer && video_renderer->type == VIDEO_RENDERER_GSTREAMER) {
+            renderer->clock = gstreamer_clock_ref(video_renderer_gstreamer_get_clock(video_renderer));
+        } else {
+            renderer->clock = gstreamer_clock_create(config->presentation_latency);
+            assert(renderer->clock);
+        }
+        gstreamer_clock_attach(renderer->clock, renderer->pipeline);
+    }
 
     renderer->appsrc = gst_bin_get_by_name(GST_BIN(renderer->pipeline), "audio_source");
     renderer->volume = gst_bin_get_by_name(GST_BIN(renderer->pipeline), "volume");
 
-    gchar eld_conf[] = {0xF8, 0xE8, 0x50, 0x00};
-    GstBuffer *codec_data = gst_buffer_new_and_alloc(sizeof(eld_conf));
-    GstMapInfo map;
-
-    gst_buffer_map(codec_data, &map, GST_MAP_WRITE);
-    memset(map.data, eld_conf[0], map.size);
-    memset(map.data+1, eld_conf[1], map.size);
-    memset(map.data+2, eld_conf[2], map.size);
-    memset(map.data+3, eld_conf[3], map.size);
-
-    GstCaps *caps = gst_caps_new_simple("audio/mpeg",
-        "rate", G_TYPE_INT, 44100,
-        "channels", G_TYPE_INT, 2,
-        "mpegversion", G_TYPE_INT, 4,
-        "stream-format", G_TYPE_STRING, "raw",
-        "codec_data", GST_TYPE_BUFFER, codec_data,
+    // Packets arrive already decoded by the shared aac_decoder
+    GstCaps *caps = gst_caps_new_simple("audio/x-raw",
+        "format", G_TYPE_STRING, G_BYTE_ORDER == G_LITTLE_ENDIAN ? "S16LE" : "S16BE",
+        "layout", G_TYPE_STRING, "interleaved",
+        "rate", G_TYPE_INT, AAC_DECODER_SAMPLE_RATE,
+        "channels", G_TYPE_INT, AAC_DECODER_CHANNELS,
         NULL);
     g_object_set(renderer->appsrc, "caps", caps, NULL);
-
     gst_caps_unref(caps);
-    gst_buffer_unmap(codec_data, &map);
-    gst_buffer_unref(codec_data);
 
     return &renderer->base;
 }
 
 void audio_renderer_gstreamer_start(audio_renderer_t *renderer) {
     audio_renderer_gstreamer_t *r = (audio_renderer_gstreamer_t *)renderer;
-    gst_element_set_state(r->pipeline, GST_STATE_PLAYING);
+    if (r->sync) {
+        gstreamer_clock_start(r->clock, r->pipeline);
+    } else {
+        gst_element_set_state(r->pipeline, GST_STATE_PLAYING);
+    }
 }
 
-void audio_renderer_gstreamer_render_buffer(audio_renderer_t *renderer, raop_ntp_t *ntp, unsigned char *data, int data_len, uint64_t pts) {
-    GstBuffer *buffer;
-
-    if (data_len == 0) return;
-    
+void audio_renderer_gstreamer_render_pcm(audio_renderer_t *renderer, raop_ntp_t *ntp, stream_frame_t *frame) {
     audio_renderer_gstreamer_t *r = (audio_renderer_gstreamer_t *)renderer;
+    GstBuffer *buffer;
+    uint64_t pts = frame->pts;
+    int data_len = frame->data_len;
 
-    buffer = gst_buffer_new_and_alloc(data_len);
+    if (data_len == 0) {
+        stream_frame_unref(frame);
+        return;
+    }
+    buffer = gst_buffer_new_wrapped_full(GST_MEMORY_FLAG_READONLY, frame->data, data_len, 0, data_len,
+                                         frame, (GDestroyNotify) stream_frame_unref);
     assert(buffer != NULL);
-    GST_BUFFER_DTS(buffer) = (GstClockTime)pts;
-    gst_buffer_fill(buffer, 0, data, data_len);
+    if (r->sync) {
+        GST_BUFFER_PTS(buffer) = gstreamer_clock_stamp(r->clock, pts);
+    }
     gst_app_src_push_buffer(GST_APP_SRC(r->appsrc), buffer);
+    trace_event(TRACE_AUDIO_RENDERED, data_len, pts);
+}
+
+void audio_renderer_gstreamer_get_stats(audio_renderer_t *renderer, audio_renderer_stats_t *stats) {
+    audio_renderer_gstreamer_t *r = (audio_renderer_gstreamer_t *)renderer;
+    stats->decoder_latency = r->sync ? gstreamer_clock_get_latency(r->clock) / GST_USECOND : 0;
+    // Played on the pipeline clock at pts plus the latency
+    stats->has_presentation_offset = r->sync;
+    stats->presentation_offset = (int64_t) stats->decoder_latency;
+}
 
+void audio_renderer_gstreamer_get_caps(audio_renderer_t *renderer, audio_renderer_caps_t *caps) {
+    audio_renderer_gstreamer_t *r = (audio_renderer_gstreamer_t *)renderer;
+    caps->output_latency = r->sync ? gstreamer_clock_get_latency(r->clock) / GST_USECOND : 0;
 }
 
 void audio_renderer_gstreamer_set_volume(audio_renderer_t *renderer, float volume) {
@@ -134,7 +193,25 @@ void audio_renderer_gstreamer_set_volume(audio_renderer_t *renderer, float volum
     }
 }
 
+/* Drops the queued samples and keeps the pipeline playing, as the video renderer's flush does */
 void audio_renderer_gstreamer_flush(audio_renderer_t *renderer) {
+    audio_renderer_gstreamer_t *r = (audio_renderer_gstreamer_t *)renderer;
+    if (GST_STATE(r->pipeline) != GST_STATE_PLAYING) {
+        return;
+    }
+    gst_element_send_event(r->appsrc, gst_event_new_flush_start());
+    gst_element_send_event(r->appsrc, gst_event_new_flush_stop(FALSE));
+}
+
+/* Closes the audio device, the pipeline is kept for resume */
+static void audio_renderer_gstreamer_suspend(audio_renderer_t *renderer) {
+    audio_renderer_gstreamer_t *r = (audio_renderer_gstreamer_t *)renderer;
+    gst_element_set_state(r->pipeline, GST_STATE_NULL);
+}
+
+static int audio_renderer_gstreamer_resume(audio_renderer_t *renderer) {
+    audio_renderer_gstreamer_start(renderer);
+    return 0;
 }
 
 void audio_renderer_gstreamer_destroy(audio_renderer_t *renderer) {
@@ -144,6 +221,7 @@ void audio_renderer_gstreamer_destroy(audio_renderer_t *renderer) {
     gst_object_unref(r->pipeline);
     gst_object_unref(r->appsrc);
     gst_object_unref(r->volume);
+    gstreamer_clock_unref(r->clock);
     if (renderer) {
         free(renderer);
     }
@@ -151,8 +229,12 @@ void audio_renderer_gstreamer_destroy(audio_renderer_t *renderer) {
 
 static const audio_renderer_funcs_t audio_renderer_gstreamer_funcs = {
     .start = audio_renderer_gstreamer_start,
-    .render_buffer = audio_renderer_gstreamer_render_buffer,
     .set_volume = audio_renderer_gstreamer_set_volume,
     .flush = audio_renderer_gstreamer_flush,
     .destroy = audio_renderer_gstreamer_destroy,
+    .render_pcm = audio_renderer_gstreamer_render_pcm,
+    .get_stats = audio_renderer_gstreamer_get_stats,
+    .get_caps = audio_renderer_gstreamer_get_caps,
+    .suspend = audio_renderer_gstreamer_suspend,
+    .resume = audio_renderer_gstreamer_resume,
 };
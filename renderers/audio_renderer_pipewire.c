@@ -0,0 +1,323 @@
+/**
+ * RPiPlay - An open-source AirPlay mirroring server for Raspberry Pi
+ * Copyright (C) 2019 Florian Draschbacher
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+/*
+ * PCM renderer playing straight into the PipeWire graph, packets are decoded by the shared aac_decoder.
+ * PipeWire's realtime thread pulls one quantum at a time from the pcm_scheduler, for the time the graph's
+ * own delay says it will be heard.
+*/
+
+#include "audio_renderer.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <pipewire/pipewire.h>
+#include <spa/param/audio/format-utils.h>
+#include <spa/param/props.h>
+#include <spa/utils/result.h>
+
+#include "aac_decoder.h"
+
+#define PIPEWIRE_SAMPLE_RATE AAC_DECODER_SAMPLE_RATE
+#define PIPEWIRE_CHANNELS AAC_DECODER_CHANNELS
+#define PIPEWIRE_FRAME_BYTES (PIPEWIRE_CHANNELS * sizeof(int16_t))
+
+// Quantum asked of the graph, in frames. Low latency mode asks for about 6 ms, otherwise about 23 ms
+#define PIPEWIRE_QUANTUM 1024
+#define PIPEWIRE_LOW_LATENCY_QUANTUM 256
+
+typedef struct audio_renderer_pipewire_s {
+    audio_renderer_t base;
+    audio_renderer_config_t const *config;
+
+    struct pw_thread_loop *loop;
+    struct pw_stream *stream;
+    float volume;
+
+    // Set before the first packet, read from on the realtime thread
+    pcm_scheduler_t *scheduler;
+
+    // Written by the realtime thread, read by the others
+    uint64_t graph_latency;
+} audio_renderer_pipewire_t;
+
+static const audio_renderer_funcs_t audio_renderer_pipewire_funcs;
+
+/*
+ * Returns when the next sample written will be heard, in raop_ntp's local time. The graph's clock is the
+ * same monotonic clock, its delay covers the rest of the graph up to the device, and what the stream
+ * holds itself plays before the next sample.
+ */
+static uint64_t audio_renderer_pipewire_get_play_time(audio_renderer_pipewire_t *r) {
+    struct pw_time time;
+    uint64_t latency = 0, now;
+    if (pw_stream_get_time_n(r->stream, &time, sizeof(time)) == 0 && time.now > 0 && time.rate.denom > 0) {
+        now = (uint64_t) time.now / 1000;
+        if (time.delay > 0) {
+            latency = (uint64_t) time.delay * 1000000 * time.rate.num / time.rate.denom;
+        }
+        latency += (time.buffered + time.queued / PIPEWIRE_FRAME_BYTES) * 1000000 / PIPEWIRE_SAMPLE_RATE;
+    } else {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        now = (uint64_t) ts.tv_sec * 1000000 + (uint64_t) ts.tv_nsec / 1000;
+    }
+    __atomic_store_n(&r->graph_latency, latency, __ATOMIC_RELAXED);
+    return now + latency + (uint64_t) r->config->output_delay * 1000;
+}
+
+/* Fills one quantum on PipeWire's realtime thread, the scheduler lines it up with the pts */
+static void audio_renderer_pipewire_process(void *data) {
+    audio_renderer_pipewire_t *r = data;
+    struct pw_buffer *buffer = pw_stream_dequeue_buffer(r->stream);
+    if (!buffer) {
+        return;
+    }
+    struct spa_data *d = &buffer->buffer->datas[0];
+    int16_t *out = d->data;
+    if (!out) {
+        pw_stream_queue_buffer(r->stream, buffer);
+        return;
+    }
+    int frames = (int) (d->maxsize / PIPEWIRE_FRAME_BYTES);
+    if (buffer->requested > 0 && buffer->requested < (uint64_t) frames) {
+        frames = (int) buffer->requested;
+    }
+
+    pcm_scheduler_t *scheduler = __atomic_load_n(&r->scheduler, __ATOMIC_ACQUIRE);
+    uint64_t play_time = audio_renderer_pipewire_get_play_time(r);
+    if (scheduler) {
+        pcm_scheduler_read(scheduler, out, frames, play_time);
+    } else {
+        memset(out, 0, frames * PIPEWIRE_FRAME_BYTES);
+    }
+
+    d->chunk->offset = 0;
+    d->chunk->stride = PIPEWIRE_FRAME_BYTES;
+    d->chunk->size = frames * PIPEWIRE_FRAME_BYTES;
+    pw_stream_queue_buffer(r->stream, buffer);
+}
+
+static void audio_renderer_pipewire_state_changed(void *data, enum pw_stream_state old, enum pw_stream_state state,
+                                                  const char *error) {
+    audio_renderer_pipewire_t *r = data;
+    if (state == PW_STREAM_STATE_ERROR) {
+        logger_log(r->base.logger, LOGGER_ERR, "PipeWire: stream error: %s", error ? error : "unknown");
+    } else {
+        logger_log(r->base.logger, LOGGER_DEBUG, "PipeWire: stream %s -> %s",
+                   pw_stream_state_as_string(old), pw_stream_state_as_string(state));
+    }
+}
+
+static const struct pw_stream_events audio_renderer_pipewire_stream_events = {
+    PW_VERSION_STREAM_EVENTS,
+    .state_changed = audio_renderer_pipewire_state_changed,
+    .process = audio_renderer_pipewire_process,
+};
+
+static void audio_renderer_pipewire_destroy_stream(audio_renderer_pipewire_t *r) {
+    if (r->loop) {
+        pw_thread_loop_stop(r->loop);
+    }
+    if (r->stream) {
+        pw_stream_destroy(r->stream);
+        r->stream = NULL;
+    }
+    if (r->loop) {
+        pw_thread_loop_destroy(r->loop);
+        r->loop = NULL;
+    }
+}
+
+static void audio_renderer_pipewire_apply_volume(audio_renderer_pipewire_t *r) {
+    // The sender's volume is in dB from -30 to 0, -144 mutes
+    float gain = r->volume <= -144.0f ? 0.0f : powf(10.0f, r->volume * 2.0f / 20.0f);
+    float volumes[PIPEWIRE_CHANNELS];
+    for (int i = 0; i < PIPEWIRE_CHANNELS; i++) {
+        volumes[i] = gain;
+    }
+    pw_stream_set_control(r->stream, SPA_PROP_channelVolumes, PIPEWIRE_CHANNELS, volumes, 0);
+}
+
+static int audio_renderer_pipewire_init_stream(audio_renderer_pipewire_t *r) {
+    unsigned int quantum = r->config->low_latency ? PIPEWIRE_LOW_LATENCY_QUANTUM : PIPEWIRE_QUANTUM;
+
+    r->loop = pw_thread_loop_new("rpiplay-audio", NULL);
+    if (!r->loop) {
+        logger_log(r->base.logger, LOGGER_ERR, "PipeWire: could not create the thread loop");
+        return -1;
+    }
+
+    struct pw_properties *props = pw_properties_new(PW_KEY_MEDIA_TYPE, "Audio",
+                                                    PW_KEY_MEDIA_CATEGORY, "Playback",
+                                                    PW_KEY_MEDIA_ROLE, "Music",
+                                                    PW_KEY_APP_NAME, "RPiPlay",
+                                                    NULL);
+    pw_properties_setf(props, PW_KEY_NODE_LATENCY, "%u/%u", quantum, PIPEWIRE_SAMPLE_RATE);
+    r->stream = pw_stream_new_simple(pw_thread_loop_get_loop(r->loop), "AirPlay", props,
+                                     &audio_renderer_pipewire_stream_events, r);
+    if (!r->stream) {
+        logger_log(r->base.logger, LOGGER_ERR, "PipeWire: could not create the stream");
+        audio_renderer_pipewire_destroy_stream(r);
+        return -1;
+    }
+
+    uint8_t pod[1024];
+    struct spa_pod_builder builder = SPA_POD_BUILDER_INIT(pod, sizeof(pod));
+    struct spa_audio_info_raw info = SPA_AUDIO_INFO_RAW_INIT(.format = SPA_AUDIO_FORMAT_S16,
+                                                             .rate = PIPEWIRE_SAMPLE_RATE,
+                                                             .channels = PIPEWIRE_CHANNELS);
+    info.position[0] = SPA_AUDIO_CHANNEL_FL;
+    info.position[1] = SPA_AUDIO_CHANNEL_FR;
+    const struct spa_pod *params[1];
+    params[0] = spa_format_audio_raw_build(&builder, SPA_PARAM_EnumFormat, &info);
+
+    int err = pw_stream_connect(r->stream, PW_DIRECTION_OUTPUT, PW_ID_ANY,
+                                PW_STREAM_FLAG_AUTOCONNECT | PW_STREAM_FLAG_MAP_BUFFERS | PW_STREAM_FLAG_RT_PROCESS,
+                                params, 1);
+    if (err < 0) {
+        logger_log(r->base.logger, LOGGER_ERR, "PipeWire: could not connect the stream: %s", spa_strerror(err));
+        audio_renderer_pipewire_destroy_stream(r);
+        return -1;
+    }
+    if (pw_thread_loop_start(r->loop) < 0) {
+        logger_log(r->base.logger, LOGGER_ERR, "PipeWire: could not start the thread loop");
+        audio_renderer_pipewire_destroy_stream(r);
+        return -1;
+    }
+
+    pw_thread_loop_lock(r->loop);
+    audio_renderer_pipewire_apply_volume(r);
+    pw_thread_loop_unlock(r->loop);
+
+    logger_log(r->base.logger, LOGGER_INFO, "PipeWire: asked for a quantum of %u frames (%u us)",
+               quantum, quantum * 1000000 / PIPEWIRE_SAMPLE_RATE);
+    return 0;
+}
+
+audio_renderer_t *audio_renderer_pipewire_init(logger_t *logger, __attribute__((unused)) video_renderer_t *video_renderer,
+                                               audio_renderer_config_t const *config) {
+    audio_renderer_pipewire_t *renderer;
+    renderer = calloc(1, sizeof(audio_renderer_pipewire_t));
+    if (!renderer) {
+        return NULL;
+    }
+    renderer->base.logger = logger;
+    renderer->base.funcs = &audio_renderer_pipewire_funcs;
+    renderer->base.type = AUDIO_RENDERER_PIPEWIRE;
+    renderer->config = config;
+
+    pw_init(NULL, NULL);
+    if (audio_renderer_pipewire_init_stream(renderer) < 0) {
+        free(renderer);
+        pw_deinit();
+        return NULL;
+    }
+    return &renderer->base;
+}
+
+static void audio_renderer_pipewire_start(__attribute__((unused)) audio_renderer_t *renderer) {
+    // Nothing to do
+}
+
+static void audio_renderer_pipewire_set_pcm_source(audio_renderer_t *renderer, pcm_scheduler_t *scheduler) {
+    audio_renderer_pipewire_t *r = (audio_renderer_pipewire_t *)renderer;
+    __atomic_store_n(&r->scheduler, scheduler, __ATOMIC_RELEASE);
+}
+
+static void audio_renderer_pipewire_set_volume(audio_renderer_t *renderer, float volume) {
+    audio_renderer_pipewire_t *r = (audio_renderer_pipewire_t *)renderer;
+    r->volume = volume;
+    if (r->stream) {
+        pw_thread_loop_lock(r->loop);
+        audio_renderer_pipewire_apply_volume(r);
+        pw_thread_loop_unlock(r->loop);
+    }
+}
+
+/* The scheduler drops the queued packets, this drops what the stream holds */
+static void audio_renderer_pipewire_flush(audio_renderer_t *renderer) {
+    audio_renderer_pipewire_t *r = (audio_renderer_pipewire_t *)renderer;
+    if (!r->stream) {
+        return;
+    }
+    pw_thread_loop_lock(r->loop);
+    pw_stream_flush(r->stream, false);
+    pw_thread_loop_unlock(r->loop);
+}
+
+/* Reports the graph's latency once the stream runs, the quantum asked for until then */
+static void audio_renderer_pipewire_get_caps(audio_renderer_t *renderer, audio_renderer_caps_t *caps) {
+    audio_renderer_pipewire_t *r = (audio_renderer_pipewire_t *)renderer;
+    uint64_t latency = __atomic_load_n(&r->graph_latency, __ATOMIC_RELAXED);
+    if (latency == 0) {
+        unsigned int quantum = r->config->low_latency ? PIPEWIRE_LOW_LATENCY_QUANTUM : PIPEWIRE_QUANTUM;
+        latency = (uint64_t) quantum * 1000000 / PIPEWIRE_SAMPLE_RATE;
+    }
+    caps->output_latency = latency + (uint64_t) r->config->output_delay * 1000;
+}
+
+static void audio_renderer_pipewire_log_stats(audio_renderer_t *renderer) {
+    audio_renderer_pipewire_t *r = (audio_renderer_pipewire_t *)renderer;
+    pcm_scheduler_stats_t stats = {0};
+    if (r->scheduler) {
+        pcm_scheduler_get_stats(r->scheduler, &stats);
+    }
+    logger_log(renderer->logger, LOGGER_INFO,
+               "PipeWire: graph latency %llu us, %u packets queued, %llu dropped, %llu underruns, %llu realigns, "
+               "%llu frames concealed",
+               (unsigned long long) __atomic_load_n(&r->graph_latency, __ATOMIC_RELAXED), stats.queued_packets,
+               (unsigned long long) stats.dropped_packets, (unsigned long long) stats.underruns,
+               (unsigned long long) stats.realigns, (unsigned long long) stats.concealed_frames);
+}
+
+static void audio_renderer_pipewire_destroy(audio_renderer_t *renderer) {
+    if (renderer) {
+        audio_renderer_pipewire_t *r = (audio_renderer_pipewire_t *)renderer;
+        audio_renderer_pipewire_destroy_stream(r);
+        free(renderer);
+        pw_deinit();
+    }
+}
+
+/* Leaves the graph so the sink can suspend, the volume stays */
+static void audio_renderer_pipewire_suspend(audio_renderer_t *renderer) {
+    audio_renderer_pipewire_t *r = (audio_renderer_pipewire_t *)renderer;
+    audio_renderer_pipewire_destroy_stream(r);
+}
+
+static int audio_renderer_pipewire_resume(audio_renderer_t *renderer) {
+    audio_renderer_pipewire_t *r = (audio_renderer_pipewire_t *)renderer;
+    return audio_renderer_pipewire_init_stream(r);
+}
+
+static const audio_renderer_funcs_t audio_renderer_pipewire_funcs = {
+    .start = audio_renderer_pipewire_start,
+    .set_pcm_source = audio_renderer_pipewire_set_pcm_source,
+    .set_volume = audio_renderer_pipewire_set_volume,
+    .flush = audio_renderer_pipewire_flush,
+    .destroy = audio_renderer_pipewire_destroy,
+    .log_stats = audio_renderer_pipewire_log_stats,
+    .suspend = audio_renderer_pipewire_suspend,
+    .resume = audio_renderer_pipewire_resume,
+    .get_caps = audio_renderer_pipewire_get_caps,
+};
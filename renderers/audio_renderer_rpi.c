@@ -18,7 +18,7 @@
  */
 
 /* 
- * AAC renderer using fdk-aac for decoding and OpenMAX for rendering
+ * PCM renderer using OpenMAX for output, packets are decoded by the shared aac_decoder
 */
 
 #include "audio_renderer.h"
@@ -30,24 +30,31 @@
 #include <stdbool.h>
 #include <unistd.h>
 
-#include "fdk-aac/libAACdec/include/aacdecoder_lib.h"
-
 #include "bcm_host.h"
 #include "ilclient.h"
 #include "../lib/threads.h"
+#include "../lib/trace.h"
+#include "aac_decoder.h"
 
 #define MIN(X, Y) (((X) < (Y)) ? (X) : (Y))
 
+/* Decoded frames packed into one input buffer outside low latency mode, about 44 ms */
+#define AUDIO_RPI_BATCH_FRAMES 4
+#define AUDIO_RPI_FRAME_BYTES (AAC_DECODER_FRAME_SIZE * AAC_DECODER_CHANNELS * 2)
+/* A frame further than this from the end of the batch starts a new one, in us */
+#define AUDIO_RPI_BATCH_TOLERANCE 2000
+/* How long flush waits for the component to give back its buffers */
+#define AUDIO_RPI_FLUSH_TIMEOUT_MS 250
+
 extern ILCLIENT_T *video_renderer_rpi_get_ilclient(video_renderer_t *renderer);
 extern COMPONENT_T *video_renderer_rpi_get_clock(video_renderer_t *renderer);
+extern int64_t video_renderer_rpi_get_playout_delay(video_renderer_t *renderer);
 
 typedef struct audio_renderer_rpi_s {
     audio_renderer_t base;
     video_renderer_t *video_renderer;
     audio_renderer_config_t const *config;
 
-    HANDLE_AACDECODER audio_decoder;
-
     ILCLIENT_T *client;
     COMPONENT_T *audio_renderer;
     COMPONENT_T *clock; // Owned by the video renderer if one is used, so don't destroy!
@@ -57,44 +64,40 @@ typedef struct audio_renderer_rpi_s {
 
     uint64_t first_packet_time;
     uint64_t last_packet_time;
+    /* The component is gone until resume */
+    bool suspended;
     uint64_t input_frames;
+
+    /* Input buffer being filled with consecutive frames, handed over once the batch is complete */
+    OMX_BUFFERHEADERTYPE *pending;
+    int pending_frames;
+    uint64_t pending_end;
 } audio_renderer_rpi_t;
 
 static const audio_renderer_funcs_t audio_renderer_rpi_funcs;
 
-static void audio_renderer_rpi_destroy_decoder(audio_renderer_rpi_t *renderer) {
-    aacDecoder_Close(renderer->audio_decoder);
-}
-
-static int audio_renderer_rpi_init_decoder(audio_renderer_rpi_t *renderer) {
-    int ret = 0;
-    renderer->audio_decoder = aacDecoder_Open(TT_MP4_RAW, 1);
-    if (renderer->audio_decoder == NULL) {
-        logger_log(renderer->base.logger, LOGGER_ERR, "aacDecoder open faild!");
-        return -1;
+/* Hands the batch being filled to the component */
+static void audio_renderer_rpi_submit(audio_renderer_rpi_t *renderer) {
+    if (!renderer->pending) {
+        return;
     }
-    /* ASC config binary data */
-    UCHAR eld_conf[] = { 0xF8, 0xE8, 0x50, 0x00 };
-    UCHAR *conf[] = { eld_conf };
-    static UINT conf_len = sizeof(eld_conf);
-    ret = aacDecoder_ConfigRaw(renderer->audio_decoder, conf, &conf_len);
-    if (ret != AAC_DEC_OK) {
-        logger_log(renderer->base.logger, LOGGER_ERR, "Unable to set configRaw");
-        return -2;
-    }
-    CStreamInfo *aac_stream_info = aacDecoder_GetStreamInfo(renderer->audio_decoder);
-    if (aac_stream_info == NULL) {
-        logger_log(renderer->base.logger, LOGGER_ERR, "aacDecoder_GetStreamInfo failed!");
-        return -3;
+    if (OMX_EmptyThisBuffer(ILC_GET_HANDLE(renderer->audio_renderer), renderer->pending) != OMX_ErrorNone) {
+        logger_log(renderer->base.logger, LOGGER_ERR, "Audio renderer refused processing buffer");
     }
+    renderer->pending = NULL;
+    renderer->pending_frames = 0;
+}
 
-    logger_log(renderer->base.logger, LOGGER_DEBUG, "> stream info: channel = %d\tsample_rate = %d\tframe_size = %d\taot = %d\tbitrate = %d",   \
-            aac_stream_info->channelConfig, aac_stream_info->aacSampleRate,
-            aac_stream_info->aacSamplesPerFrame, aac_stream_info->aot, aac_stream_info->bitRate);
-    return 1;
+/* Returns the batch being filled unplayed, the component has to have all its buffers back before teardown */
+static void audio_renderer_rpi_drop_pending(audio_renderer_rpi_t *renderer) {
+    if (renderer->pending) {
+        renderer->pending->nFilledLen = 0;
+        audio_renderer_rpi_submit(renderer);
+    }
 }
 
 static void audio_renderer_rpi_destroy_renderer(audio_renderer_rpi_t *renderer) {
+    audio_renderer_rpi_drop_pending(renderer);
     ilclient_disable_tunnel(&renderer->tunnels[0]);
     ilclient_disable_port_buffers(renderer->audio_renderer, 100, NULL, NULL, NULL);
     ilclient_teardown_tunnels(renderer->tunnels);
@@ -152,7 +155,7 @@ static int audio_renderer_rpi_init_renderer(audio_renderer_rpi_t *renderer, vide
         // Create clock if no video renderer is used
         if (ilclient_create_component(renderer->client, &renderer->clock, "clock",
                                       ILCLIENT_DISABLE_ALL_PORTS) != 0) {
-            audio_renderer_rpi_destroy_decoder(renderer);
+            audio_renderer_rpi_destroy_renderer(renderer);
             return -14;
         }
         renderer->components[1] = renderer->clock;
@@ -166,7 +169,7 @@ static int audio_renderer_rpi_init_renderer(audio_renderer_rpi_t *renderer, vide
         clock_state.nWaitMask = 1;
         if (OMX_SetParameter(ilclient_get_handle(renderer->clock), OMX_IndexConfigTimeClockState,
                              &clock_state) != OMX_ErrorNone) {
-            audio_renderer_rpi_destroy_decoder(renderer);
+            audio_renderer_rpi_destroy_renderer(renderer);
             return -13;
         }
     }
@@ -176,7 +179,7 @@ static int audio_renderer_rpi_init_renderer(audio_renderer_rpi_t *renderer, vide
 
     // Setup clock tunnel
     if (ilclient_setup_tunnel(&renderer->tunnels[0], 0, 0) != 0) {
-        audio_renderer_rpi_destroy_decoder(renderer);
+        audio_renderer_rpi_destroy_renderer(renderer);
         return -15;
     }
 
@@ -216,6 +219,23 @@ static int audio_renderer_rpi_init_renderer(audio_renderer_rpi_t *renderer, vide
         return -13;
     }
 
+    // Room for a whole batch in each input buffer, so it goes over in one call
+    OMX_PARAM_PORTDEFINITIONTYPE port_definition;
+    memset(&port_definition, 0, sizeof(OMX_PARAM_PORTDEFINITIONTYPE));
+    port_definition.nSize = sizeof(OMX_PARAM_PORTDEFINITIONTYPE);
+    port_definition.nVersion.nVersion = OMX_VERSION;
+    port_definition.nPortIndex = 100;
+    if (OMX_GetParameter(ilclient_get_handle(renderer->audio_renderer), OMX_IndexParamPortDefinition,
+                         &port_definition) == OMX_ErrorNone &&
+        port_definition.nBufferSize < AUDIO_RPI_BATCH_FRAMES * AUDIO_RPI_FRAME_BYTES) {
+        port_definition.nBufferSize = AUDIO_RPI_BATCH_FRAMES * AUDIO_RPI_FRAME_BYTES;
+        if (OMX_SetParameter(ilclient_get_handle(renderer->audio_renderer), OMX_IndexParamPortDefinition,
+                             &port_definition) != OMX_ErrorNone) {
+            logger_log(renderer->base.logger, LOGGER_DEBUG, "Could not set audio input buffers of %u bytes",
+                       port_definition.nBufferSize);
+        }
+    }
+
     // Set audio device
     const char *device_name = renderer->config->device == AUDIO_DEVICE_HDMI ? "hdmi" : "local";
     OMX_CONFIG_BRCMAUDIODESTINATIONTYPE audio_destination;
@@ -256,15 +276,9 @@ audio_renderer_t *audio_renderer_rpi_init(logger_t *logger, video_renderer_t *vi
     renderer->first_packet_time = 0;
     renderer->input_frames = 0;
 
-    if (audio_renderer_rpi_init_decoder(renderer) != 1) {
-        free(renderer);
-        renderer = NULL;
-    }
-
     if (audio_renderer_rpi_init_renderer(renderer, video_renderer) != 1) {
-        audio_renderer_rpi_destroy_decoder(renderer);
         free(renderer);
-        renderer = NULL;
+        return NULL;
     }
 
     return &renderer->base;
@@ -282,76 +296,67 @@ static void audio_renderer_rpi_start(audio_renderer_t *renderer) {
     ilclient_change_component_state(r->audio_renderer, OMX_StateExecuting);
 }
 
-#ifdef DUMP_AUDIO
-static FILE* file_pcm = NULL;
-#endif
-
-static void audio_renderer_rpi_render_buffer(audio_renderer_t *renderer, raop_ntp_t *ntp, unsigned char *data, int data_len, uint64_t pts) {
-    if (data_len == 0) return;
-    
+static void audio_renderer_rpi_render_pcm(audio_renderer_t *renderer, raop_ntp_t *ntp, stream_frame_t *frame) {
     audio_renderer_rpi_t *r = (audio_renderer_rpi_t *)renderer;
+    uint64_t pts = frame->pts;
+    int time_data_size = frame->data_len;
 
-    logger_log(renderer->logger, LOGGER_DEBUG, "Got AAC data of %d bytes", data_len);
     r->input_frames++;
 
-    // We assume that every buffer contains exactly 1 frame.
-
-    AAC_DECODER_ERROR error = 0;
-
-    UCHAR *p_buffer[1] = {data};
-    UINT buffer_size = data_len;
-    UINT bytes_valid = data_len;
-    error = aacDecoder_Fill(r->audio_decoder, p_buffer, &buffer_size, &bytes_valid);
-    if (error != AAC_DEC_OK) {
-        logger_log(renderer->logger, LOGGER_ERR, "aacDecoder_Fill error : %x", error);
-    }
-
-    INT time_data_size = 4 * 480;
-    INT_PCM *p_time_data = malloc(time_data_size); // The buffer for the decoded AAC frames
-    error = aacDecoder_DecodeFrame(r->audio_decoder, p_time_data, time_data_size, 0);
-    if (error != AAC_DEC_OK) {
-        logger_log(renderer->logger, LOGGER_ERR, "aacDecoder_DecodeFrame error : 0x%x", error);
-    }
+    // Played on the video renderer's clock with the video's playout delay, so lip sync holds as it changes
+    int64_t playout_delay = r->video_renderer ? video_renderer_rpi_get_playout_delay(r->video_renderer) : 0;
 
-#ifdef DUMP_AUDIO
-    if (file_pcm == NULL) {
-        file_pcm = fopen("/home/pi/Airplay.pcm", "wb");
+    // Frames are appended to the batch while they follow on from it, its timestamp is the first one's
+    int batch_frames = r->config->low_latency ? 1 : AUDIO_RPI_BATCH_FRAMES;
+    uint64_t duration = (uint64_t) time_data_size / (AAC_DECODER_CHANNELS * 2) * 1000000 / AAC_DECODER_SAMPLE_RATE;
+    if (r->pending && (pts + AUDIO_RPI_BATCH_TOLERANCE < r->pending_end || pts > r->pending_end + AUDIO_RPI_BATCH_TOLERANCE ||
+                       r->pending->nFilledLen + time_data_size > r->pending->nAllocLen)) {
+        audio_renderer_rpi_submit(r);
     }
 
-    fwrite(p_time_data, time_data_size, 1, file_pcm);
-#endif
-
     int offset = 0;
     while (offset < time_data_size) {
-        int64_t audio_delay = ((int64_t) raop_ntp_get_local_time(ntp)) - ((int64_t) pts);
-        logger_log(renderer->logger, LOGGER_DEBUG, "Audio delay is %lld", audio_delay);
-        if (audio_delay > 100000)
-            r->first_packet_time = 0;
-
-        OMX_BUFFERHEADERTYPE *buffer = ilclient_get_input_buffer(r->audio_renderer, 100, 0);
-        if (!buffer)
-            break;
+        if (!r->pending) {
+            int64_t audio_delay = ((int64_t) raop_ntp_get_local_time(ntp)) - ((int64_t) pts);
+            logger_log(renderer->logger, LOGGER_DEBUG, "Audio delay is %lld", audio_delay);
+            if (audio_delay > playout_delay + 100000)
+                r->first_packet_time = 0;
+
+            OMX_BUFFERHEADERTYPE *buffer = ilclient_get_input_buffer(r->audio_renderer, 100, 0);
+            if (!buffer)
+                break;
+
+            buffer->nFilledLen = 0;
+            buffer->nOffset = 0;
+            buffer->nFlags = 0;
+            if (!r->config->low_latency) buffer->nTimeStamp = ilclient_ticks_from_s64(pts + playout_delay);
+            if (r->first_packet_time == 0) {
+                buffer->nFlags = OMX_BUFFERFLAG_STARTTIME;
+                r->first_packet_time = raop_ntp_get_local_time(ntp);
+                if (!r->config->low_latency) buffer->nTimeStamp = ilclient_ticks_from_s64(r->first_packet_time);
+            }
+            r->pending = buffer;
+        }
 
-        int chunk_size = MIN(time_data_size - offset, buffer->nAllocLen);
-        memcpy(buffer->pBuffer, p_time_data, chunk_size);
+        OMX_BUFFERHEADERTYPE *buffer = r->pending;
+        int chunk_size = MIN(time_data_size - offset, (int) (buffer->nAllocLen - buffer->nFilledLen));
+        memcpy(buffer->pBuffer + buffer->nFilledLen, frame->data + offset, chunk_size);
+        buffer->nFilledLen += chunk_size;
         offset += chunk_size;
 
-        buffer->nFilledLen = chunk_size;
-        buffer->nOffset = 0;
-
-        if (!r->config->low_latency) buffer->nTimeStamp = ilclient_ticks_from_s64(pts);
-        if (r->first_packet_time == 0) {
-            buffer->nFlags = OMX_BUFFERFLAG_STARTTIME;
-            r->first_packet_time = raop_ntp_get_local_time(ntp);
-            if (!r->config->low_latency) buffer->nTimeStamp = ilclient_ticks_from_s64(r->first_packet_time);
+        if (buffer->nFilledLen >= buffer->nAllocLen) {
+            audio_renderer_rpi_submit(r);
         }
-
-        if (OMX_EmptyThisBuffer(ILC_GET_HANDLE(r->audio_renderer), buffer) != OMX_ErrorNone) {
-            logger_log(renderer->logger, LOGGER_ERR, "Audio renderer refused processing buffer");
+    }
+    if (r->pending) {
+        r->pending_end = pts + duration;
+        if (++r->pending_frames >= batch_frames) {
+            audio_renderer_rpi_submit(r);
         }
     }
+    trace_event(TRACE_AUDIO_RENDERED, time_data_size, pts);
 
-    free(p_time_data);
+    stream_frame_unref(frame);
 }
 
 static void audio_renderer_rpi_set_volume(audio_renderer_t *renderer, float volume) {
@@ -374,24 +379,80 @@ static void audio_renderer_rpi_set_volume(audio_renderer_t *renderer, float volu
     }
 }
 
+/*
+ * Timestamped audio plays behind its pts by the playout delay the video renderer holds frames for.
+ * In low latency mode it plays as soon as it is taken, behind what the component still holds.
+ */
+static void audio_renderer_rpi_get_caps(audio_renderer_t *renderer, audio_renderer_caps_t *caps) {
+    audio_renderer_rpi_t *r = (audio_renderer_rpi_t *)renderer;
+    if (!r->config->low_latency) {
+        int64_t playout_delay = r->video_renderer ? video_renderer_rpi_get_playout_delay(r->video_renderer) : 0;
+        caps->output_latency = playout_delay > 0 ? (uint64_t) playout_delay : 0;
+    } else if (!r->suspended) {
+        OMX_PARAM_U32TYPE latency;
+        memset(&latency, 0, sizeof(latency));
+        latency.nSize = sizeof(OMX_PARAM_U32TYPE);
+        latency.nVersion.nVersion = OMX_VERSION;
+        latency.nPortIndex = 100;
+        // Samples the component holds until they are heard
+        if (OMX_GetConfig(ilclient_get_handle(r->audio_renderer), OMX_IndexConfigAudioRenderingLatency,
+                          &latency) == OMX_ErrorNone) {
+            caps->output_latency = (uint64_t) latency.nU32 * 1000000 / AAC_DECODER_SAMPLE_RATE;
+        }
+    }
+}
+
+/*
+ * Drops the batch being filled and whatever the component still holds, so nothing from before
+ * the flush is heard. The wait for the port is bounded like the video renderer's flush.
+ */
 static void audio_renderer_rpi_flush(audio_renderer_t *renderer) {
-    // TODO
+    audio_renderer_rpi_t *r = (audio_renderer_rpi_t *)renderer;
+    if (r->suspended) return;
+    audio_renderer_rpi_drop_pending(r);
+    if (OMX_SendCommand(ILC_GET_HANDLE(r->audio_renderer), OMX_CommandFlush, 100, NULL) != OMX_ErrorNone) {
+        logger_log(renderer->logger, LOGGER_ERR, "Could not flush audio port 100");
+    } else if (ilclient_wait_for_event(r->audio_renderer, OMX_EventCmdComplete, OMX_CommandFlush, 0, 100, 0,
+                                       ILCLIENT_PORT_FLUSH, AUDIO_RPI_FLUSH_TIMEOUT_MS) != 0) {
+        logger_log(renderer->logger, LOGGER_WARNING, "Audio port 100 not flushed within %d ms", AUDIO_RPI_FLUSH_TIMEOUT_MS);
+    }
+    // The next buffer starts the clock again
+    r->first_packet_time = 0;
 }
 
 static void audio_renderer_rpi_destroy(audio_renderer_t *renderer) {
     if (renderer) {
         audio_renderer_rpi_t *r = (audio_renderer_rpi_t *)renderer;
-        audio_renderer_rpi_flush(renderer);
-        audio_renderer_rpi_destroy_decoder(r);
-        audio_renderer_rpi_destroy_renderer(r);
+        if (!r->suspended) audio_renderer_rpi_destroy_renderer(r);
         free(renderer);
     }
 }
 
+/* The clock belongs to the video renderer if there is one, it is taken again from it on resume */
+static void audio_renderer_rpi_suspend(audio_renderer_t *renderer) {
+    audio_renderer_rpi_t *r = (audio_renderer_rpi_t *)renderer;
+    audio_renderer_rpi_destroy_renderer(r);
+    r->first_packet_time = 0;
+    r->suspended = true;
+}
+
+static int audio_renderer_rpi_resume(audio_renderer_t *renderer) {
+    audio_renderer_rpi_t *r = (audio_renderer_rpi_t *)renderer;
+    if (audio_renderer_rpi_init_renderer(r, r->video_renderer) != 1) {
+        return -1;
+    }
+    r->suspended = false;
+    audio_renderer_rpi_start(renderer);
+    return 0;
+}
+
 static const audio_renderer_funcs_t audio_renderer_rpi_funcs = {
     .start = audio_renderer_rpi_start,
-    .render_buffer = audio_renderer_rpi_render_buffer,
+    .render_pcm = audio_renderer_rpi_render_pcm,
     .set_volume = audio_renderer_rpi_set_volume,
     .flush = audio_renderer_rpi_flush,
     .destroy = audio_renderer_rpi_destroy,
+    .suspend = audio_renderer_rpi_suspend,
+    .resume = audio_renderer_rpi_resume,
+    .get_caps = audio_renderer_rpi_get_caps,
 };
@@ -0,0 +1,182 @@
+/**
+ * RPiPlay - An open-source AirPlay mirroring server for Raspberry Pi
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+#include "av_sync.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "../lib/threads.h"
+
+/* Reports of each stream that go into an adjustment, and the weight of the newest one */
+#define AV_SYNC_MIN_REPORTS 32
+#define AV_SYNC_SMOOTHING 16.0
+
+/* Hold and delay changes smaller than this are left alone, in us */
+#define AV_SYNC_TOLERANCE 10000
+
+struct av_sync_s {
+    logger_t *logger;
+    mutex_handle_t mutex;
+
+    /* Smoothed offsets from pts, and how many reports went into them since the last adjustment */
+    double video_arrival;
+    double video_submitted;
+    double video_presented;
+    int video_reports;
+    bool video_paced;
+    double audio_presented;
+    int audio_reports;
+    bool audio_delayable;
+
+    int64_t video_hold;
+    int64_t audio_delay;
+    uint64_t adjustments;
+};
+
+static void av_sync_smooth(double *value, int reports, int64_t sample) {
+    if (reports == 0) {
+        *value = (double) sample;
+    } else {
+        *value += ((double) sample - *value) / AV_SYNC_SMOOTHING;
+    }
+}
+
+static int64_t av_sync_clamp(double value) {
+    if (value < 0) return 0;
+    if (value > AV_SYNC_MAX_CORRECTION) return AV_SYNC_MAX_CORRECTION;
+    return (int64_t) value;
+}
+
+/*
+ * With the mutex held, once both streams have enough reports in. The frame's latency in the
+ * renderer is what it adds after being handed the frame, so video would be presented at its
+ * arrival plus that latency if it wasn't held back, and audio at its offset less the delay
+ * it is played with now. Whichever is later is where both are presented from then on.
+ */
+static void av_sync_adjust(av_sync_t *sync) {
+    double render_latency = sync->video_presented - sync->video_submitted;
+    double video = sync->video_paced ? sync->video_presented : sync->video_arrival + render_latency;
+    double audio = sync->audio_presented - (double) sync->audio_delay;
+    double target = video > audio ? video : audio;
+    int64_t hold = 0, delay = 0;
+
+    if (!sync->video_paced && target > video) hold = av_sync_clamp(target - render_latency);
+    if (sync->audio_delayable && target > audio) delay = av_sync_clamp(target - audio);
+    sync->video_reports = 0;
+    sync->audio_reports = 0;
+
+    if (llabs(hold - sync->video_hold) < AV_SYNC_TOLERANCE && llabs(delay - sync->audio_delay) < AV_SYNC_TOLERANCE) {
+        return;
+    }
+    logger_log(sync->logger, LOGGER_DEBUG, "A/V sync: video %.1f ms and audio %.1f ms after pts, "
+               "holding video to %.1f ms and delaying audio by %.1f ms",
+               video / 1000.0, audio / 1000.0, hold / 1000.0, delay / 1000.0);
+    sync->video_hold = hold;
+    sync->audio_delay = delay;
+    sync->adjustments++;
+}
+
+av_sync_t *av_sync_init(logger_t *logger) {
+    av_sync_t *sync = calloc(1, sizeof(av_sync_t));
+    if (!sync) {
+        return NULL;
+    }
+    sync->logger = logger;
+    MUTEX_CREATE(sync->mutex);
+    return sync;
+}
+
+void av_sync_report_video(av_sync_t *sync, int64_t arrival_offset, int64_t presentation_offset, bool paced) {
+    // A frame that came in before its hold was handed over when the hold ran out
+    int64_t submit_offset = arrival_offset;
+
+    MUTEX_LOCK(sync->mutex);
+    if (sync->video_hold > submit_offset) submit_offset = sync->video_hold;
+    av_sync_smooth(&sync->video_arrival, sync->video_reports, arrival_offset);
+    av_sync_smooth(&sync->video_submitted, sync->video_reports, submit_offset);
+    av_sync_smooth(&sync->video_presented, sync->video_reports, presentation_offset);
+    sync->video_reports++;
+    sync->video_paced = paced;
+    if (sync->video_reports >= AV_SYNC_MIN_REPORTS && sync->audio_reports >= AV_SYNC_MIN_REPORTS) {
+        av_sync_adjust(sync);
+    }
+    MUTEX_UNLOCK(sync->mutex);
+}
+
+void av_sync_report_audio(av_sync_t *sync, int64_t presentation_offset, bool delayable) {
+    MUTEX_LOCK(sync->mutex);
+    av_sync_smooth(&sync->audio_presented, sync->audio_reports, presentation_offset);
+    sync->audio_reports++;
+    sync->audio_delayable = delayable;
+    if (sync->video_reports >= AV_SYNC_MIN_REPORTS && sync->audio_reports >= AV_SYNC_MIN_REPORTS) {
+        av_sync_adjust(sync);
+    }
+    MUTEX_UNLOCK(sync->mutex);
+}
+
+uint64_t av_sync_video_release_time(av_sync_t *sync, uint64_t pts) {
+    int64_t hold;
+
+    MUTEX_LOCK(sync->mutex);
+    hold = sync->video_hold;
+    MUTEX_UNLOCK(sync->mutex);
+    return hold > 0 && pts > 0 ? pts + (uint64_t) hold : 0;
+}
+
+int64_t av_sync_get_audio_delay(av_sync_t *sync) {
+    int64_t delay;
+
+    MUTEX_LOCK(sync->mutex);
+    delay = sync->audio_delay;
+    MUTEX_UNLOCK(sync->mutex);
+    return delay;
+}
+
+void av_sync_flush(av_sync_t *sync) {
+    MUTEX_LOCK(sync->mutex);
+    sync->video_reports = 0;
+    sync->audio_reports = 0;
+    MUTEX_UNLOCK(sync->mutex);
+}
+
+void av_sync_reset(av_sync_t *sync) {
+    MUTEX_LOCK(sync->mutex);
+    sync->video_reports = 0;
+    sync->audio_reports = 0;
+    sync->video_hold = 0;
+    sync->audio_delay = 0;
+    MUTEX_UNLOCK(sync->mutex);
+}
+
+void av_sync_get_stats(av_sync_t *sync, av_sync_stats_t *stats) {
+    MUTEX_LOCK(sync->mutex);
+    stats->video_offset = (int64_t) sync->video_presented;
+    stats->audio_offset = (int64_t) sync->audio_presented;
+    stats->video_hold = sync->video_hold;
+    stats->audio_delay = sync->audio_delay;
+    stats->adjustments = sync->adjustments;
+    MUTEX_UNLOCK(sync->mutex);
+}
+
+void av_sync_destroy(av_sync_t *sync) {
+    if (sync) {
+        MUTEX_DESTROY(sync->mutex);
+        free(sync);
+    }
+}
@@ -0,0 +1,78 @@
+/**
+ * RPiPlay - An open-source AirPlay mirroring server for Raspberry Pi
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+/*
+ * Lip sync between an audio and a video renderer that don't present on a common clock,
+ * e.g. the KMS or FFmpeg video renderer next to the ALSA audio renderer.
+ * The thread that renders each stream reports how long after its pts a frame or packet
+ * was presented, as the renderer measured it, for video from the renderer's presented
+ * callback where it has one. Once enough of both are in, the later of
+ * the two streams sets where both are presented: video that would show up early is held
+ * back before it is handed to its renderer, audio that would play early is delayed
+ * through the audio renderer's set_delay. Renderers that hold frames until their pts
+ * themselves are paced, their video is never held back.
+ * All times are in us on the local clock of raop_ntp_get_local_time.
+ */
+
+#ifndef AV_SYNC_H
+#define AV_SYNC_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "../lib/logger.h"
+
+/* Neither video is held back nor audio delayed by more than this, in us */
+#define AV_SYNC_MAX_CORRECTION 500000
+
+typedef struct av_sync_s av_sync_t;
+
+typedef struct av_sync_stats_s {
+    /* Smoothed time from pts to presentation of each stream, 0 until measured */
+    int64_t video_offset;
+    int64_t audio_offset;
+    /* Time from pts until video is handed to its renderer, and to audio's playback, as currently set */
+    int64_t video_hold;
+    int64_t audio_delay;
+    uint64_t adjustments;
+} av_sync_stats_t;
+
+av_sync_t *av_sync_init(logger_t *logger);
+/* Called from the video thread. arrival_offset is how long after its pts the frame came in,
+ * before it was held back, presentation_offset what the renderer reported for its latest frame */
+void av_sync_report_video(av_sync_t *sync, int64_t arrival_offset, int64_t presentation_offset, bool paced);
+/* Called from the audio thread, delayable if the renderer has set_delay */
+void av_sync_report_audio(av_sync_t *sync, int64_t presentation_offset, bool delayable);
+/* Local time until which the video frame with pts is held back, 0 if it isn't */
+uint64_t av_sync_video_release_time(av_sync_t *sync, uint64_t pts);
+int64_t av_sync_get_audio_delay(av_sync_t *sync);
+/* Drops the measurements after a flush, the hold and the delay stay until new ones are in */
+void av_sync_flush(av_sync_t *sync);
+/* Back to no hold and no delay, for a new sender */
+void av_sync_reset(av_sync_t *sync);
+void av_sync_get_stats(av_sync_t *sync, av_sync_stats_t *stats);
+void av_sync_destroy(av_sync_t *sync);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //AV_SYNC_H
@@ -0,0 +1,86 @@
+/**
+ * RPiPlay - An open-source AirPlay mirroring server for Raspberry Pi
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+
+#include "dsp_kernels.h"
+#include "../lib/cpu_features.h"
+
+static const dsp_kernels_t dsp_kernels_c = { "c", dsp_gain_c, dsp_lpc_dot_c, dsp_unmix_c };
+#if defined(__arm__) || defined(__aarch64__)
+static const dsp_kernels_t dsp_kernels_neon = { "neon", dsp_gain_neon, dsp_lpc_dot_neon, dsp_unmix_neon };
+#elif defined(__x86_64__) || defined(__i386__)
+static const dsp_kernels_t dsp_kernels_sse41 = { "ssse3 sse4.1", dsp_gain_ssse3, dsp_lpc_dot_sse41, dsp_unmix_sse41 };
+static const dsp_kernels_t dsp_kernels_avx2 = { "avx2 sse4.1", dsp_gain_avx2, dsp_lpc_dot_sse41, dsp_unmix_avx2 };
+#endif
+
+/* Rounded Q15 multiply, the same as vqrdmulh and pmulhrsw for gains below unity */
+static inline int16_t dsp_scale(int16_t sample, int32_t gain) {
+    return (int16_t) (((int32_t) sample * gain + (1 << 14)) >> 15);
+}
+
+void dsp_gain_c(int16_t *samples, int count, int16_t gain) {
+    for (int i = 0; i < count; i++) {
+        samples[i] = dsp_scale(samples[i], gain);
+    }
+}
+
+int32_t dsp_lpc_dot_c(const int32_t *window, const int32_t *coefs, int32_t top, int order) {
+    uint32_t sum = 0;
+    for (int i = 0; i < order; i++) {
+        sum += (uint32_t) coefs[i] * (uint32_t) (window[i] - top);
+    }
+    return (int32_t) sum;
+}
+
+void dsp_unmix_c(const int32_t *u, const int32_t *v, int16_t *out, int count, int mix_bits, int mix_res) {
+    if (mix_res == 0) {
+        for (int i = 0; i < count; i++) {
+            out[2 * i] = (int16_t) u[i];
+            out[2 * i + 1] = (int16_t) v[i];
+        }
+        return;
+    }
+    for (int i = 0; i < count; i++) {
+        int32_t left = u[i] + v[i] - ((mix_res * v[i]) >> mix_bits);
+        out[2 * i] = (int16_t) left;
+        out[2 * i + 1] = (int16_t) (left - v[i]);
+    }
+}
+
+static const dsp_kernels_t *dsp_kernels;
+
+const dsp_kernels_t *dsp_kernels_get(void) {
+    const dsp_kernels_t *kernels = __atomic_load_n(&dsp_kernels, __ATOMIC_ACQUIRE);
+    if (kernels) return kernels;
+
+    unsigned int features = cpu_features_get();
+    kernels = &dsp_kernels_c;
+#if defined(__arm__) || defined(__aarch64__)
+    if (features & CPU_FEATURE_NEON) kernels = &dsp_kernels_neon;
+#elif defined(__x86_64__) || defined(__i386__)
+    if (features & CPU_FEATURE_AVX2) {
+        kernels = &dsp_kernels_avx2;
+    } else if ((features & CPU_FEATURE_SSSE3) && (features & CPU_FEATURE_SSE41)) {
+        kernels = &dsp_kernels_sse41;
+    }
+#else
+    (void) features;
+#endif
+    __atomic_store_n(&dsp_kernels, kernels, __ATOMIC_RELEASE);
+    return kernels;
+}
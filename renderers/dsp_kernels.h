@@ -0,0 +1,70 @@
+/**
+ * RPiPlay - An open-source AirPlay mirroring server for Raspberry Pi
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+
+/*
+ * The audio kernels with SIMD implementations: the volume, and the ALAC
+ * predictor and channel unmixing. dsp_kernels_get picks the fastest the CPU
+ * has at runtime rather than at build time, so one package runs at full speed
+ * on a Pi 2 as well as a Pi 5 or an x86 with AVX2.
+ */
+
+#ifndef DSP_KERNELS_H
+#define DSP_KERNELS_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    /* Instruction sets of the implementations, for the log */
+    const char *name;
+    /* Scales count samples in place by a Q15 gain below unity, rounding like vqrdmulh and pmulhrsw */
+    void (*gain)(int16_t *samples, int count, int16_t gain);
+    /* Sum of coefs[i] * (window[i] - top) over order taps, wrapping around like int32 */
+    int32_t (*lpc_dot)(const int32_t *window, const int32_t *coefs, int32_t top, int order);
+    /* Undoes the mid/side style matrixing of an ALAC channel pair into interleaved 16-bit stereo */
+    void (*unmix)(const int32_t *u, const int32_t *v, int16_t *out, int count, int mix_bits, int mix_res);
+} dsp_kernels_t;
+
+/* Thread safe, the choice is made on the first call */
+const dsp_kernels_t *dsp_kernels_get(void);
+
+/* The implementations, only for dsp_kernels.c and comparing them */
+void dsp_gain_c(int16_t *samples, int count, int16_t gain);
+int32_t dsp_lpc_dot_c(const int32_t *window, const int32_t *coefs, int32_t top, int order);
+void dsp_unmix_c(const int32_t *u, const int32_t *v, int16_t *out, int count, int mix_bits, int mix_res);
+#if defined(__arm__) || defined(__aarch64__)
+void dsp_gain_neon(int16_t *samples, int count, int16_t gain);
+int32_t dsp_lpc_dot_neon(const int32_t *window, const int32_t *coefs, int32_t top, int order);
+void dsp_unmix_neon(const int32_t *u, const int32_t *v, int16_t *out, int count, int mix_bits, int mix_res);
+#elif defined(__x86_64__) || defined(__i386__)
+void dsp_gain_ssse3(int16_t *samples, int count, int16_t gain);
+int32_t dsp_lpc_dot_sse41(const int32_t *window, const int32_t *coefs, int32_t top, int order);
+void dsp_unmix_sse41(const int32_t *u, const int32_t *v, int16_t *out, int count, int mix_bits, int mix_res);
+void dsp_gain_avx2(int16_t *samples, int count, int16_t gain);
+void dsp_unmix_avx2(const int32_t *u, const int32_t *v, int16_t *out, int count, int mix_bits, int mix_res);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //DSP_KERNELS_H
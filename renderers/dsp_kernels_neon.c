@@ -0,0 +1,72 @@
+/**
+ * RPiPlay - An open-source AirPlay mirroring server for Raspberry Pi
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+
+/* Built with -mfpu=neon on 32-bit ARM, only called where the CPU has NEON */
+
+#include "dsp_kernels.h"
+
+#if defined(__arm__) || defined(__aarch64__)
+#include <arm_neon.h>
+
+void dsp_gain_neon(int16_t *samples, int count, int16_t gain) {
+    int16x8_t factor = vdupq_n_s16(gain);
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        vst1q_s16(samples + i, vqrdmulhq_s16(vld1q_s16(samples + i), factor));
+    }
+    dsp_gain_c(samples + i, count - i, gain);
+}
+
+int32_t dsp_lpc_dot_neon(const int32_t *window, const int32_t *coefs, int32_t top, int order) {
+    if (order & 3) {
+        return dsp_lpc_dot_c(window, coefs, top, order);
+    }
+    int32x4_t base = vdupq_n_s32(top);
+    int32x4_t acc = vdupq_n_s32(0);
+    for (int i = 0; i < order; i += 4) {
+        acc = vmlaq_s32(acc, vld1q_s32(coefs + i), vsubq_s32(vld1q_s32(window + i), base));
+    }
+#if defined(__aarch64__)
+    return vaddvq_s32(acc);
+#else
+    int32x2_t pair = vadd_s32(vget_low_s32(acc), vget_high_s32(acc));
+    return vget_lane_s32(vpadd_s32(pair, pair), 0);
+#endif
+}
+
+void dsp_unmix_neon(const int32_t *u, const int32_t *v, int16_t *out, int count, int mix_bits, int mix_res) {
+    int i = 0;
+    if (mix_res == 0) {
+        for (; i + 4 <= count; i += 4) {
+            int16x4x2_t pair = { { vmovn_s32(vld1q_s32(u + i)), vmovn_s32(vld1q_s32(v + i)) } };
+            vst2_s16(out + 2 * i, pair);
+        }
+    } else {
+        int32x4_t res = vdupq_n_s32(mix_res);
+        int32x4_t shift = vdupq_n_s32(-mix_bits);
+        for (; i + 4 <= count; i += 4) {
+            int32x4_t side = vld1q_s32(v + i);
+            int32x4_t left = vsubq_s32(vaddq_s32(vld1q_s32(u + i), side), vshlq_s32(vmulq_s32(res, side), shift));
+            int16x4x2_t pair = { { vmovn_s32(left), vmovn_s32(vsubq_s32(left, side)) } };
+            vst2_s16(out + 2 * i, pair);
+        }
+    }
+    dsp_unmix_c(u + i, v + i, out + 2 * i, count - i, mix_bits, mix_res);
+}
+#endif
@@ -0,0 +1,117 @@
+/**
+ * RPiPlay - An open-source AirPlay mirroring server for Raspberry Pi
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+
+/* Built for the baseline, each function enables the instruction set it is only called with */
+
+#include "dsp_kernels.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+__attribute__((target("ssse3")))
+void dsp_gain_ssse3(int16_t *samples, int count, int16_t gain) {
+    __m128i factor = _mm_set1_epi16(gain);
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i *block = (__m128i *) (samples + i);
+        _mm_storeu_si128(block, _mm_mulhrs_epi16(_mm_loadu_si128(block), factor));
+    }
+    dsp_gain_c(samples + i, count - i, gain);
+}
+
+__attribute__((target("avx2")))
+void dsp_gain_avx2(int16_t *samples, int count, int16_t gain) {
+    __m256i factor = _mm256_set1_epi16(gain);
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m256i *block = (__m256i *) (samples + i);
+        _mm256_storeu_si256(block, _mm256_mulhrs_epi16(_mm256_loadu_si256(block), factor));
+    }
+    dsp_gain_c(samples + i, count - i, gain);
+}
+
+__attribute__((target("sse4.1")))
+int32_t dsp_lpc_dot_sse41(const int32_t *window, const int32_t *coefs, int32_t top, int order) {
+    if (order & 3) {
+        return dsp_lpc_dot_c(window, coefs, top, order);
+    }
+    __m128i base = _mm_set1_epi32(top);
+    __m128i acc = _mm_setzero_si128();
+    for (int i = 0; i < order; i += 4) {
+        __m128i diff = _mm_sub_epi32(_mm_loadu_si128((const __m128i *) (window + i)), base);
+        acc = _mm_add_epi32(acc, _mm_mullo_epi32(_mm_loadu_si128((const __m128i *) (coefs + i)), diff));
+    }
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(acc);
+}
+
+__attribute__((target("sse4.1")))
+void dsp_unmix_sse41(const int32_t *u, const int32_t *v, int16_t *out, int count, int mix_bits, int mix_res) {
+    __m128i low = _mm_set1_epi32(0xffff);
+    int i = 0;
+    if (mix_res == 0) {
+        for (; i + 4 <= count; i += 4) {
+            __m128i left = _mm_loadu_si128((const __m128i *) (u + i));
+            __m128i right = _mm_loadu_si128((const __m128i *) (v + i));
+            // Little endian, the low half of each lane is the left sample
+            _mm_storeu_si128((__m128i *) (out + 2 * i),
+                             _mm_or_si128(_mm_and_si128(left, low), _mm_slli_epi32(right, 16)));
+        }
+    } else {
+        __m128i res = _mm_set1_epi32(mix_res);
+        __m128i shift = _mm_cvtsi32_si128(mix_bits);
+        for (; i + 4 <= count; i += 4) {
+            __m128i side = _mm_loadu_si128((const __m128i *) (v + i));
+            __m128i left = _mm_sub_epi32(_mm_add_epi32(_mm_loadu_si128((const __m128i *) (u + i)), side),
+                                         _mm_sra_epi32(_mm_mullo_epi32(res, side), shift));
+            __m128i right = _mm_sub_epi32(left, side);
+            _mm_storeu_si128((__m128i *) (out + 2 * i),
+                             _mm_or_si128(_mm_and_si128(left, low), _mm_slli_epi32(right, 16)));
+        }
+    }
+    dsp_unmix_c(u + i, v + i, out + 2 * i, count - i, mix_bits, mix_res);
+}
+
+__attribute__((target("avx2")))
+void dsp_unmix_avx2(const int32_t *u, const int32_t *v, int16_t *out, int count, int mix_bits, int mix_res) {
+    __m256i low = _mm256_set1_epi32(0xffff);
+    int i = 0;
+    if (mix_res == 0) {
+        for (; i + 8 <= count; i += 8) {
+            __m256i left = _mm256_loadu_si256((const __m256i *) (u + i));
+            __m256i right = _mm256_loadu_si256((const __m256i *) (v + i));
+            _mm256_storeu_si256((__m256i *) (out + 2 * i),
+                                _mm256_or_si256(_mm256_and_si256(left, low), _mm256_slli_epi32(right, 16)));
+        }
+    } else {
+        __m256i res = _mm256_set1_epi32(mix_res);
+        __m128i shift = _mm_cvtsi32_si128(mix_bits);
+        for (; i + 8 <= count; i += 8) {
+            __m256i side = _mm256_loadu_si256((const __m256i *) (v + i));
+            __m256i left = _mm256_sub_epi32(_mm256_add_epi32(_mm256_loadu_si256((const __m256i *) (u + i)), side),
+                                            _mm256_sra_epi32(_mm256_mullo_epi32(res, side), shift));
+            __m256i right = _mm256_sub_epi32(left, side);
+            _mm256_storeu_si256((__m256i *) (out + 2 * i),
+                                _mm256_or_si256(_mm256_and_si256(left, low), _mm256_slli_epi32(right, 16)));
+        }
+    }
+    dsp_unmix_c(u + i, v + i, out + 2 * i, count - i, mix_bits, mix_res);
+}
+#endif
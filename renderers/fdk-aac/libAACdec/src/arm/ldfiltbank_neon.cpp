@@ -0,0 +1,278 @@
+/* -----------------------------------------------------------------------------
+Software License for The Fraunhofer FDK AAC Codec Library for Android
+
+© Copyright  1995 - 2018 Fraunhofer-Gesellschaft zur Förderung der angewandten
+Forschung e.V. All rights reserved.
+
+ 1.    INTRODUCTION
+The Fraunhofer FDK AAC Codec Library for Android ("FDK AAC Codec") is software
+that implements the MPEG Advanced Audio Coding ("AAC") encoding and decoding
+scheme for digital audio. This FDK AAC Codec software is intended to be used on
+a wide variety of Android devices.
+
+AAC's HE-AAC and HE-AAC v2 versions are regarded as today's most efficient
+general perceptual audio codecs. AAC-ELD is considered the best-performing
+full-bandwidth communications codec by independent studies and is widely
+deployed. AAC has been standardized by ISO and IEC as part of the MPEG
+specifications.
+
+Patent licenses for necessary patent claims for the FDK AAC Codec (including
+those of Fraunhofer) may be obtained through Via Licensing
+(www.vialicensing.com) or through the respective patent owners individually for
+the purpose of encoding or decoding bit streams in products that are compliant
+with the ISO/IEC MPEG audio standards. Please note that most manufacturers of
+Android devices already license these patent claims through Via Licensing or
+directly from the patent owners, and therefore FDK AAC Codec software may
+already be covered under those patent licenses when it is used for those
+licensed purposes only.
+
+Commercially-licensed AAC software libraries, including floating-point versions
+with enhanced sound quality, are also available from Fraunhofer. Users are
+encouraged to check the Fraunhofer website for additional applications
+information and documentation.
+
+2.    COPYRIGHT LICENSE
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted without payment of copyright license fees provided that you
+satisfy the following conditions:
+
+You must retain the complete text of this software license in redistributions of
+the FDK AAC Codec or your modifications thereto in source code form.
+
+You must retain the complete text of this software license in the documentation
+and/or other materials provided with redistributions of the FDK AAC Codec or
+your modifications thereto in binary form. You must make available free of
+charge copies of the complete source code of the FDK AAC Codec and your
+modifications thereto to recipients of copies in binary form.
+
+The name of Fraunhofer may not be used to endorse or promote products derived
+from this library without prior written permission.
+
+You may not charge copyright license fees for anyone to use, copy or distribute
+the FDK AAC Codec software or your modifications thereto.
+
+Your modified versions of the FDK AAC Codec must carry prominent notices stating
+that you changed the software and the date of any change. For modified versions
+of the FDK AAC Codec, the term "Fraunhofer FDK AAC Codec Library for Android"
+must be replaced by the term "Third-Party Modified Version of the Fraunhofer FDK
+AAC Codec Library for Android."
+
+3.    NO PATENT LICENSE
+
+NO EXPRESS OR IMPLIED LICENSES TO ANY PATENT CLAIMS, including without
+limitation the patents of Fraunhofer, ARE GRANTED BY THIS SOFTWARE LICENSE.
+Fraunhofer provides no warranty of patent non-infringement with respect to this
+software.
+
+You may use this FDK AAC Codec software or modifications thereto only for
+purposes that are authorized by appropriate patent licenses.
+
+4.    DISCLAIMER
+
+This FDK AAC Codec software is provided by Fraunhofer on behalf of the copyright
+holders and contributors "AS IS" and WITHOUT ANY EXPRESS OR IMPLIED WARRANTIES,
+including but not limited to the implied warranties of merchantability and
+fitness for a particular purpose. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+CONTRIBUTORS BE LIABLE for any direct, indirect, incidental, special, exemplary,
+or consequential damages, including but not limited to procurement of substitute
+goods or services; loss of use, data, or profits, or business interruption,
+however caused and on any theory of liability, whether in contract, strict
+liability, or tort (including negligence), arising in any way out of the use of
+this software, even if advised of the possibility of such damage.
+
+5.    CONTACT INFORMATION
+
+Fraunhofer Institute for Integrated Circuits IIS
+Attention: Audio and Multimedia Departments - FDK AAC LL
+Am Wolfsmantel 33
+91058 Erlangen, Germany
+
+www.iis.fraunhofer.de/amm
+amm-info@iis.fraunhofer.de
+----------------------------------------------------------------------------- */
+
+/**************************** AAC decoder library ******************************
+
+   Author(s):
+
+   Description: low delay filterbank for NEON / AArch64 ASIMD
+
+*******************************************************************************/
+
+/* prevent multiple inclusion with re-definitions */
+#ifndef __INCLUDE_LDFILTBANK_NEON__
+#define __INCLUDE_LDFILTBANK_NEON__
+
+#include <arm_neon.h>
+
+/*
+ * The kernels below are bit-exact with the generic C code in ldfiltbank.cpp
+ * for the one configuration every NEON target builds: 16 bit window tables,
+ * 32 bit PCM_DEC output (PCM_OUT_BITS == DFRACT_BITS) and the WTS0/1/2
+ * exponents of aac_rom.h. Any other configuration keeps the C version.
+ */
+#if defined(WINDOWTABLE_16BIT) && (PCM_OUT_BITS == DFRACT_BITS) && \
+    (WTS0 == 1) && (WTS1 == 0) && (WTS2 == -2)
+
+/* fMultDiv2(FIXP_DBL, FIXP_SGL): (a * (b << 16)) >> 32. vqdmulh only
+ * saturates for 0x80000000 * 0x8000 and no LD window table holds 0x8000. */
+static inline int32x4_t ldfb_fMultDiv2_neon(int32x4_t a, int16x4_t b) {
+  return vshrq_n_s32(vqdmulhq_s32(a, vshll_n_s16(b, 16)), 1);
+}
+
+/* fAddSaturate(a, b >> 1) with fMultDiv2() output in b, see fixpoint_math.h */
+static inline int32x4_t ldfb_fAddSaturate_neon(int32x4_t a, int32x4_t b) {
+  int32x4_t sum = vaddq_s32(vshrq_n_s32(a, 1), vshrq_n_s32(b, 2));
+  sum = vminq_s32(sum, vdupq_n_s32((INT)(MAXVAL_DBL >> 1)));
+  sum = vmaxq_s32(sum, vdupq_n_s32((INT)(MINVAL_DBL >> 1)));
+  return vshlq_n_s32(sum, 1);
+}
+
+static inline int32x4_t ldfb_vrev_s32(int32x4_t a) {
+  a = vrev64q_s32(a);
+  return vcombine_s32(vget_high_s32(a), vget_low_s32(a));
+}
+
+/* Load p[-3] ... p[0] in reversed order */
+static inline int32x4_t ldfb_vld1q_rev_s32(const int32_t *p) {
+  return ldfb_vrev_s32(vld1q_s32(p - 3));
+}
+
+static inline int16x4_t ldfb_vld1_rev_s16(const FIXP_WTB *p) {
+  return vrev64_s16(vld1_s16((const int16_t *)p - 3));
+}
+
+/* Store to p[0] ... p[-3] */
+static inline void ldfb_vst1q_rev_s32(int32_t *p, int32x4_t a) {
+  vst1q_s32(p - 3, ldfb_vrev_s32(a));
+}
+
+static inline int16x4_t ldfb_vld1_s16(const FIXP_WTB *p) {
+  return vld1_s16((const int16_t *)p);
+}
+
+#define FUNCTION_multE2_DinvF_fdk
+static void multE2_DinvF_fdk(PCM_DEC *output, FIXP_DBL *x, const FIXP_WTB *fb,
+                             FIXP_DBL *z, const int N) {
+  int32_t *out = (int32_t *)output;
+  int32_t *xv = (int32_t *)x;
+  int32_t *zv = (int32_t *)z;
+  int i;
+
+  /* z[N / 2 + i] is written before it is read for tmp, as in the C version */
+  for (i = 0; i < (N / 4 & ~3); i += 4) {
+    int32x4_t z0, z2, zh, tmp;
+
+    z2 = vld1q_s32(xv + N / 2 + i);
+    z0 = ldfb_fAddSaturate_neon(
+        z2, ldfb_fMultDiv2_neon(vld1q_s32(zv + N / 2 + i),
+                                ldfb_vld1_s16(fb + 2 * N + i)));
+    zh = ldfb_fAddSaturate_neon(
+        ldfb_vld1q_rev_s32(xv + N / 2 - 1 - i),
+        ldfb_fMultDiv2_neon(vld1q_s32(zv + N + i),
+                            ldfb_vld1_s16(fb + 2 * N + N / 2 + i)));
+    vst1q_s32(zv + N / 2 + i, zh);
+
+    tmp = vaddq_s32(
+        ldfb_fMultDiv2_neon(zh, ldfb_vld1_rev_s16(fb + N + N / 2 - 1 - i)),
+        ldfb_fMultDiv2_neon(vld1q_s32(zv + i), ldfb_vld1_s16(fb + N + N / 2 + i)));
+    ldfb_vst1q_rev_s32(out + N * 3 / 4 - 1 - i, tmp);
+
+    vst1q_s32(zv + i, z0);
+    vst1q_s32(zv + N + i, z2);
+  }
+  for (; i < N / 4; i++) {
+    FIXP_DBL z0, z2, tmp;
+
+    z2 = x[N / 2 + i];
+    z0 = fAddSaturate(z2, (fMultDiv2(z[N / 2 + i], fb[2 * N + i]) >> 1));
+    z[N / 2 + i] = fAddSaturate(
+        x[N / 2 - 1 - i], (fMultDiv2(z[N + i], fb[2 * N + N / 2 + i]) >> 1));
+    tmp = (fMultDiv2(z[N / 2 + i], fb[N + N / 2 - 1 - i]) +
+           fMultDiv2(z[i], fb[N + N / 2 + i]));
+    output[(N * 3 / 4 - 1 - i)] = (PCM_DEC)tmp;
+    z[i] = z0;
+    z[N + i] = z2;
+  }
+
+  for (; i < N / 4 + ((N / 2 - N / 4) & ~3); i += 4) {
+    int32x4_t z0, z2, zh, zl, tmp0, tmp1;
+
+    z2 = vld1q_s32(xv + N / 2 + i);
+    z0 = ldfb_fAddSaturate_neon(
+        z2, ldfb_fMultDiv2_neon(vld1q_s32(zv + N / 2 + i),
+                                ldfb_vld1_s16(fb + 2 * N + i)));
+    zh = ldfb_fAddSaturate_neon(
+        ldfb_vld1q_rev_s32(xv + N / 2 - 1 - i),
+        ldfb_fMultDiv2_neon(vld1q_s32(zv + N + i),
+                            ldfb_vld1_s16(fb + 2 * N + N / 2 + i)));
+    vst1q_s32(zv + N / 2 + i, zh);
+
+    zl = vld1q_s32(zv + i);
+    tmp0 = vaddq_s32(
+        ldfb_fMultDiv2_neon(zh, ldfb_vld1_rev_s16(fb + N / 2 - 1 - i)),
+        ldfb_fMultDiv2_neon(zl, ldfb_vld1_s16(fb + N / 2 + i)));
+    tmp1 = vaddq_s32(
+        ldfb_fMultDiv2_neon(zh, ldfb_vld1_rev_s16(fb + N + N / 2 - 1 - i)),
+        ldfb_fMultDiv2_neon(zl, ldfb_vld1_s16(fb + N + N / 2 + i)));
+
+    /* SATURATE_LEFT_SHIFT(tmp0, WTS0 + 1 - scale, PCM_OUT_BITS) */
+    vst1q_s32(out + i - N / 4, vqshlq_n_s32(tmp0, 1));
+    ldfb_vst1q_rev_s32(out + N * 3 / 4 - 1 - i, tmp1);
+
+    vst1q_s32(zv + i, z0);
+    vst1q_s32(zv + N + i, z2);
+  }
+  for (; i < N / 2; i++) {
+    FIXP_DBL z0, z2, tmp0, tmp1;
+
+    z2 = x[N / 2 + i];
+    z0 = fAddSaturate(z2, (fMultDiv2(z[N / 2 + i], fb[2 * N + i]) >> 1));
+    z[N / 2 + i] = fAddSaturate(
+        x[N / 2 - 1 - i], (fMultDiv2(z[N + i], fb[2 * N + N / 2 + i]) >> 1));
+    tmp0 = (fMultDiv2(z[N / 2 + i], fb[N / 2 - 1 - i]) +
+            fMultDiv2(z[i], fb[N / 2 + i]));
+    tmp1 = (fMultDiv2(z[N / 2 + i], fb[N + N / 2 - 1 - i]) +
+            fMultDiv2(z[i], fb[N + N / 2 + i]));
+    output[(i - N / 4)] = (PCM_DEC)SATURATE_LEFT_SHIFT(tmp0, 1, PCM_OUT_BITS);
+    output[(N * 3 / 4 - 1 - i)] = (PCM_DEC)tmp1;
+    z[i] = z0;
+    z[N + i] = z2;
+  }
+
+  /* Exchange quarter parts of x to bring them in the "right" order */
+  for (i = 0; i < (N / 4 & ~3); i += 4) {
+    int32x4_t tmp0 = ldfb_fMultDiv2_neon(vld1q_s32(zv + i),
+                                         ldfb_vld1_s16(fb + N / 2 + i));
+    vst1q_s32(out + N * 3 / 4 + i, vqshlq_n_s32(tmp0, 1));
+  }
+  for (; i < N / 4; i++) {
+    FIXP_DBL tmp0 = fMultDiv2(z[i], fb[N / 2 + i]);
+    output[(N * 3 / 4 + i)] =
+        (PCM_DEC)SATURATE_LEFT_SHIFT(tmp0, 1, PCM_OUT_BITS);
+  }
+}
+
+#endif /* WINDOWTABLE_16BIT && PCM_OUT_BITS == DFRACT_BITS */
+
+/* fMult(FIXP_DBL, FIXP_DBL): (a * b) >> 31 on AArch64, ((a * b) >> 32) << 1
+ * everywhere else. gain is never 0x80000000, so vqdmulh can't saturate. */
+#define FUNCTION_imdct_apply_gain
+static void imdct_apply_gain(FIXP_DBL *x, const FIXP_DBL gain, const int N) {
+  int32_t *xv = (int32_t *)x;
+  int i;
+
+  for (i = 0; i < (N & ~3); i += 4) {
+    int32x4_t v = vqdmulhq_n_s32(vld1q_s32(xv + i), (int32_t)gain);
+#if !defined(__ARM_ARCH_8__)
+    v = vandq_s32(v, vdupq_n_s32(~1));
+#endif
+    vst1q_s32(xv + i, v);
+  }
+  for (; i < N; i++) {
+    x[i] = fMult(x[i], gain);
+  }
+}
+
+#endif /* #ifndef __INCLUDE_LDFILTBANK_NEON__ */
@@ -112,6 +112,11 @@ amm-info@iis.fraunhofer.de
 #if defined(__arm__)
 #endif
 
+#if defined(FDK_NEON)
+#include "arm/ldfiltbank_neon.cpp"
+#endif
+
+#ifndef FUNCTION_multE2_DinvF_fdk
 static void multE2_DinvF_fdk(PCM_DEC *output, FIXP_DBL *x, const FIXP_WTB *fb,
                              FIXP_DBL *z, const int N) {
   int i;
@@ -214,6 +219,15 @@ static void multE2_DinvF_fdk(PCM_DEC *output, FIXP_DBL *x, const FIXP_WTB *fb,
 #endif
   }
 }
+#endif /* FUNCTION_multE2_DinvF_fdk */
+
+#ifndef FUNCTION_imdct_apply_gain
+static void imdct_apply_gain(FIXP_DBL *x, const FIXP_DBL gain, const int N) {
+  for (int i = 0; i < N; i++) {
+    x[i] = fMult(x[i], gain);
+  }
+}
+#endif /* FUNCTION_imdct_apply_gain */
 
 int InvMdctTransformLowDelay_fdk(FIXP_DBL *mdctData, const int mdctData_e,
                                  PCM_DEC *output, FIXP_DBL *fs_buffer,
@@ -223,7 +237,6 @@ int InvMdctTransformLowDelay_fdk(FIXP_DBL *mdctData, const int mdctData_e,
   int scale = mdctData_e + MDCT_OUT_HEADROOM -
               LDFB_HEADROOM; /* The LDFB_HEADROOM is compensated inside
                                 multE2_DinvF_fdk() below */
-  int i;
 
   /* Select LD window slope */
   switch (N) {
@@ -269,9 +282,7 @@ int InvMdctTransformLowDelay_fdk(FIXP_DBL *mdctData, const int mdctData_e,
   }
 
   if (gain != (FIXP_DBL)0) {
-    for (i = 0; i < N; i++) {
-      mdctData[i] = fMult(mdctData[i], gain);
-    }
+    imdct_apply_gain(mdctData, gain, N);
   }
   scaleValuesSaturate(mdctData, N, scale);
 
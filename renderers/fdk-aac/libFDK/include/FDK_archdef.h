@@ -166,6 +166,13 @@ amm-info@iis.fraunhofer.de
 #define __ARM_ARCH_8__
 #endif
 
+/* Define FDK_NEON if the NEON (AArch64: ASIMD) vector unit may be used. Build
+ * with -DFDK_DISABLE_NEON to keep the scalar code on a NEON capable target. */
+#if defined(__arm__) && (defined(__ARM_NEON) || defined(__ARM_NEON__)) && \
+    !defined(FDK_DISABLE_NEON)
+#define FDK_NEON
+#endif
+
 #ifdef _M_ARM
 #include "armintr.h"
 #endif
@@ -0,0 +1,180 @@
+/* -----------------------------------------------------------------------------
+Software License for The Fraunhofer FDK AAC Codec Library for Android
+
+© Copyright  1995 - 2018 Fraunhofer-Gesellschaft zur Förderung der angewandten
+Forschung e.V. All rights reserved.
+
+ 1.    INTRODUCTION
+The Fraunhofer FDK AAC Codec Library for Android ("FDK AAC Codec") is software
+that implements the MPEG Advanced Audio Coding ("AAC") encoding and decoding
+scheme for digital audio. This FDK AAC Codec software is intended to be used on
+a wide variety of Android devices.
+
+AAC's HE-AAC and HE-AAC v2 versions are regarded as today's most efficient
+general perceptual audio codecs. AAC-ELD is considered the best-performing
+full-bandwidth communications codec by independent studies and is widely
+deployed. AAC has been standardized by ISO and IEC as part of the MPEG
+specifications.
+
+Patent licenses for necessary patent claims for the FDK AAC Codec (including
+those of Fraunhofer) may be obtained through Via Licensing
+(www.vialicensing.com) or through the respective patent owners individually for
+the purpose of encoding or decoding bit streams in products that are compliant
+with the ISO/IEC MPEG audio standards. Please note that most manufacturers of
+Android devices already license these patent claims through Via Licensing or
+directly from the patent owners, and therefore FDK AAC Codec software may
+already be covered under those patent licenses when it is used for those
+licensed purposes only.
+
+Commercially-licensed AAC software libraries, including floating-point versions
+with enhanced sound quality, are also available from Fraunhofer. Users are
+encouraged to check the Fraunhofer website for additional applications
+information and documentation.
+
+2.    COPYRIGHT LICENSE
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted without payment of copyright license fees provided that you
+satisfy the following conditions:
+
+You must retain the complete text of this software license in redistributions of
+the FDK AAC Codec or your modifications thereto in source code form.
+
+You must retain the complete text of this software license in the documentation
+and/or other materials provided with redistributions of the FDK AAC Codec or
+your modifications thereto in binary form. You must make available free of
+charge copies of the complete source code of the FDK AAC Codec and your
+modifications thereto to recipients of copies in binary form.
+
+The name of Fraunhofer may not be used to endorse or promote products derived
+from this library without prior written permission.
+
+You may not charge copyright license fees for anyone to use, copy or distribute
+the FDK AAC Codec software or your modifications thereto.
+
+Your modified versions of the FDK AAC Codec must carry prominent notices stating
+that you changed the software and the date of any change. For modified versions
+of the FDK AAC Codec, the term "Fraunhofer FDK AAC Codec Library for Android"
+must be replaced by the term "Third-Party Modified Version of the Fraunhofer FDK
+AAC Codec Library for Android."
+
+3.    NO PATENT LICENSE
+
+NO EXPRESS OR IMPLIED LICENSES TO ANY PATENT CLAIMS, including without
+limitation the patents of Fraunhofer, ARE GRANTED BY THIS SOFTWARE LICENSE.
+Fraunhofer provides no warranty of patent non-infringement with respect to this
+software.
+
+You may use this FDK AAC Codec software or modifications thereto only for
+purposes that are authorized by appropriate patent licenses.
+
+4.    DISCLAIMER
+
+This FDK AAC Codec software is provided by Fraunhofer on behalf of the copyright
+holders and contributors "AS IS" and WITHOUT ANY EXPRESS OR IMPLIED WARRANTIES,
+including but not limited to the implied warranties of merchantability and
+fitness for a particular purpose. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+CONTRIBUTORS BE LIABLE for any direct, indirect, incidental, special, exemplary,
+or consequential damages, including but not limited to procurement of substitute
+goods or services; loss of use, data, or profits, or business interruption,
+however caused and on any theory of liability, whether in contract, strict
+liability, or tort (including negligence), arising in any way out of the use of
+this software, even if advised of the possibility of such damage.
+
+5.    CONTACT INFORMATION
+
+Fraunhofer Institute for Integrated Circuits IIS
+Attention: Audio and Multimedia Departments - FDK AAC LL
+Am Wolfsmantel 33
+91058 Erlangen, Germany
+
+www.iis.fraunhofer.de/amm
+amm-info@iis.fraunhofer.de
+----------------------------------------------------------------------------- */
+
+/******************* Library for basic calculation routines ********************
+
+   Author(s):
+
+   Description: Scaling operations for NEON / AArch64 ASIMD
+
+*******************************************************************************/
+
+/* prevent multiple inclusion with re-definitions */
+#ifndef __INCLUDE_SCALE_NEON__
+#define __INCLUDE_SCALE_NEON__
+
+#include <arm_neon.h>
+
+/*
+ * All kernels here are bit-exact with the generic C versions in scale.cpp: a
+ * left shift saturates to MAXVAL_DBL / MINVAL_DBL + 1, a right shift clears
+ * values that only keep their sign bit (-1 becomes 0) like scaleValueSaturate().
+ */
+static inline int32x4_t scaleValueSaturate_neon(int32x4_t v, int32x4_t shift,
+                                                INT scalefactor) {
+  if (scalefactor > 0) {
+    v = vqshlq_s32(v, shift);
+    return vmaxq_s32(v, vdupq_n_s32((INT)MINVAL_DBL + 1));
+  }
+  v = vshlq_s32(v, shift);
+  return vbicq_s32(v, vreinterpretq_s32_u32(vceqq_s32(v, vdupq_n_s32(-1))));
+}
+
+#define FUNCTION_scaleValuesSaturate_DBL
+SCALE_INLINE
+void scaleValuesSaturate(FIXP_DBL *vector, /*!< Vector */
+                         INT len,          /*!< Length */
+                         INT scalefactor   /*!< Scalefactor */
+) {
+  INT i;
+
+  /* Return if scalefactor is Zero */
+  if (scalefactor == 0) return;
+
+  scalefactor = fixmax_I(fixmin_I(scalefactor, (INT)DFRACT_BITS - 1),
+                         (INT) - (DFRACT_BITS - 1));
+
+  const int32x4_t shift = vdupq_n_s32(scalefactor);
+  int32_t *v = (int32_t *)vector;
+  for (i = 0; i < (len & ~3); i += 4) {
+    vst1q_s32(v + i,
+              scaleValueSaturate_neon(vld1q_s32(v + i), shift, scalefactor));
+  }
+  for (; i < len; i++) {
+    vector[i] = scaleValueSaturate(vector[i], scalefactor);
+  }
+}
+
+#define FUNCTION_scaleValuesSaturate_SGL_DBL
+SCALE_INLINE
+void scaleValuesSaturate(FIXP_SGL *dst,       /*!< Output */
+                         const FIXP_DBL *src, /*!< Input   */
+                         INT len,             /*!< Length */
+                         INT scalefactor)     /*!< Scalefactor */
+{
+  INT i;
+  scalefactor = fixmax_I(fixmin_I(scalefactor, (INT)DFRACT_BITS - 1),
+                         (INT) - (DFRACT_BITS - 1));
+
+  /* FX_DBL2FX_SGL(fAddSaturate(x, 0x8000)) == min((x >> 1) + 0x4000,
+   * MAXVAL_DBL >> 1) >> 15, the lower clamp of fAddSaturate() can't trigger */
+  const int32x4_t shift = vdupq_n_s32(scalefactor);
+  const int32x4_t rnd = vdupq_n_s32(0x4000);
+  const int32x4_t max = vdupq_n_s32((INT)(MAXVAL_DBL >> 1));
+  const int32_t *s = (const int32_t *)src;
+  for (i = 0; i < (len & ~3); i += 4) {
+    int32x4_t v = vld1q_s32(s + i);
+    if (scalefactor != 0) {
+      v = scaleValueSaturate_neon(v, shift, scalefactor);
+    }
+    v = vminq_s32(vaddq_s32(vshrq_n_s32(v, 1), rnd), max);
+    vst1_s16((int16_t *)dst + i, vshrn_n_s32(v, 15));
+  }
+  for (; i < len; i++) {
+    dst[i] = FX_DBL2FX_SGL(fAddSaturate(scaleValueSaturate(src[i], scalefactor),
+                                        (FIXP_DBL)0x8000));
+  }
+}
+
+#endif /* #ifndef __INCLUDE_SCALE_NEON__ */
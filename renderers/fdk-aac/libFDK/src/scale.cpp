@@ -118,6 +118,10 @@ amm-info@iis.fraunhofer.de
 
 #endif
 
+#if defined(FDK_NEON)
+#include "arm/scale_neon.cpp"
+#endif
+
 #ifndef FUNCTION_scaleValues_SGL
 /*!
  *
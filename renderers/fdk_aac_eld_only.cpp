@@ -0,0 +1,231 @@
+/**
+ * RPiPlay - An open-source AirPlay mirroring server for Raspberry Pi
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+/*
+ * Entry points of the fdk-aac modules left out by FDK_AAC_ELD_ONLY.
+ * AirPlay mirroring only sends AAC-ELD without MPEG Surround or DRC payloads,
+ * so the decoder never needs USAC (LPD/ACELP/FAC, arithmetic coding),
+ * MPEG Surround or unified DRC. These stubs keep the decoder's dispatch
+ * linking without those modules and their ROM tables: opening succeeds with
+ * the tool inactive, and a stream that would need it fails to configure.
+ * Compiled as part of the fdk-aac target, see renderers/CMakeLists.txt.
+ */
+
+#include "fdk-aac/libAACdec/src/usacdec_lpd.h"
+#include "fdk-aac/libAACdec/src/usacdec_fac.h"
+#include "fdk-aac/libAACdec/src/usacdec_lpc.h"
+#include "ac_arith_coder.h"
+#include "sac_dec_lib.h"
+#include "FDK_drcDecLib.h"
+
+/* USAC */
+
+CArcoData *CArco_Create(void) { return NULL; }
+
+void CArco_Destroy(CArcoData *pArcoData) {}
+
+ARITH_CODING_ERROR CArco_DecodeArithData(CArcoData *pArcoData, HANDLE_FDK_BITSTREAM hBs,
+                                         FIXP_DBL *RESTRICT spectrum, int lg, int lg_max,
+                                         int arith_reset_flag) {
+  return ARITH_CODER_ERROR;
+}
+
+AAC_DECODER_ERROR CLpdChannelStream_Read(HANDLE_FDK_BITSTREAM hBs,
+                                         CAacDecoderChannelInfo *pAacDecoderChannelInfo,
+                                         CAacDecoderStaticChannelInfo *pAacDecoderStaticChannelInfo,
+                                         const SamplingRateInfo *pSamplingRateInfo, UINT flags) {
+  return AAC_DEC_UNSUPPORTED_AOT;
+}
+
+void CLpdChannelStream_Decode(CAacDecoderChannelInfo *pAacDecoderChannelInfo,
+                              CAacDecoderStaticChannelInfo *pAacDecoderStaticChannelInfo, UINT flags) {}
+
+AAC_DECODER_ERROR CLpd_RenderTimeSignal(CAacDecoderStaticChannelInfo *pAacDecoderStaticChannelInfo,
+                                        CAacDecoderChannelInfo *pAacDecoderChannelInfo, PCM_DEC *pTimeData,
+                                        INT samplesPerFrame, SamplingRateInfo *pSamplingRateInfo, UINT frameOk,
+                                        const INT aacOutDataHeadroom, UINT flags, UINT strmFlags) {
+  return AAC_DEC_UNSUPPORTED_AOT;
+}
+
+int CLpd_FAC_Read(HANDLE_FDK_BITSTREAM hBs, FIXP_DBL *pFac, SCHAR *pFacScale, int length, int use_gain,
+                  int frame) {
+  return -1;
+}
+
+INT CLpd_FAC_Acelp2Mdct(H_MDCT hMdct, FIXP_DBL *output, FIXP_DBL *pSpec, const SHORT spec_scale[],
+                        const int nSpec, FIXP_DBL *pFac_data, const int fac_data_e, const INT fac_length,
+                        INT nrSamples, const INT tl, const FIXP_WTP *wrs, const INT fr, FIXP_LPC A[16],
+                        INT A_exp, CAcelpStaticMem *acelp_mem, const FIXP_DBL gain, const int last_frame_lost,
+                        const int isFdFac, const UCHAR last_lpd, const int k, int currAliasingSymmetry) {
+  return 0;
+}
+
+void CLpc_Conceal(FIXP_LPC lsp[][M_LP_FILTER_ORDER], FIXP_LPC lpc4_lsf[M_LP_FILTER_ORDER],
+                  FIXP_LPC isf_adaptive_mean[M_LP_FILTER_ORDER], const int first_lpd_flag) {}
+
+void E_LPC_f_lsp_a_conversion(FIXP_LPC *lsp, FIXP_LPC *a, INT *a_exp) {}
+
+void bass_pf_1sf_delay(FIXP_DBL syn[], const INT T_sf[], FIXP_DBL *pit_gain, const int frame_length,
+                       const INT l_frame, const INT l_next, PCM_DEC *synth_out, const INT aacOutDataHeadroom,
+                       FIXP_DBL mem_bpf[]) {}
+
+/* MPEG Surround, the handle stays NULL and every configuration is refused */
+
+SACDEC_ERROR mpegSurroundDecoder_Open(CMpegSurroundDecoder **pMpegSurroundDecoder, int stereoConfigIndex,
+                                      HANDLE_FDK_QMF_DOMAIN pQmfDomain) {
+  *pMpegSurroundDecoder = NULL;
+  return MPS_OK;
+}
+
+void mpegSurroundDecoder_Close(CMpegSurroundDecoder *pMpegSurroundDecoder) {}
+
+SACDEC_ERROR mpegSurroundDecoder_FreeMem(CMpegSurroundDecoder *pMpegSurroundDecoder) { return MPS_OK; }
+
+SAC_INSTANCE_AVAIL mpegSurroundDecoder_IsFullMpegSurroundDecoderInstanceAvailable(
+    CMpegSurroundDecoder *pMpegSurroundDecoder) {
+  return SAC_INSTANCE_NOT_FULL_AVAILABLE;
+}
+
+SACDEC_ERROR mpegSurroundDecoder_Config(CMpegSurroundDecoder *pMpegSurroundDecoder, HANDLE_FDK_BITSTREAM hBs,
+                                        AUDIO_OBJECT_TYPE coreCodec, INT samplingRate, INT frameSize,
+                                        INT numChannels, INT stereoConfigIndex, INT coreSbrFrameLengthIndex,
+                                        INT configBytes, const UCHAR configMode, UCHAR *configChanged) {
+  return MPS_UNSUPPORTED_CONFIG;
+}
+
+SACDEC_ERROR mpegSurroundDecoder_ConfigureQmfDomain(CMpegSurroundDecoder *pMpegSurroundDecoder,
+                                                    SAC_INPUT_CONFIG sac_dec_interface, UINT coreSamplingRate,
+                                                    AUDIO_OBJECT_TYPE coreCodec) {
+  return MPS_OK;
+}
+
+int mpegSurroundDecoder_ParseNoHeader(CMpegSurroundDecoder *pMpegSurroundDecoder, HANDLE_FDK_BITSTREAM hBs,
+                                      int *pMpsDataBits, int fGlobalIndependencyFlag) {
+  return MPS_UNSUPPORTED_CONFIG;
+}
+
+int mpegSurroundDecoder_Parse(CMpegSurroundDecoder *pMpegSurroundDecoder, HANDLE_FDK_BITSTREAM hBs,
+                              int *pMpsDataBits, AUDIO_OBJECT_TYPE coreCodec, int sampleRate, int frameSize,
+                              int fGlobalIndependencyFlag) {
+  return MPS_UNSUPPORTED_CONFIG;
+}
+
+int mpegSurroundDecoder_Apply(CMpegSurroundDecoder *pMpegSurroundDecoder, PCM_MPS *input, PCM_MPS *pTimeData,
+                              const int timeDataSize, int timeDataFrameSize, int *nChannels, int *frameSize,
+                              int sampleRate, AUDIO_OBJECT_TYPE coreCodec, AUDIO_CHANNEL_TYPE channelType[],
+                              UCHAR channelIndices[], const FDK_channelMapDescr *const mapDescr,
+                              const INT inDataHeadroom, INT *outDataHeadroom) {
+  return MPS_NOTOK;
+}
+
+SACDEC_ERROR mpegSurroundDecoder_SetParam(CMpegSurroundDecoder *pMpegSurroundDecoder, const SACDEC_PARAM param,
+                                          const INT value) {
+  return MPS_OK;
+}
+
+UINT mpegSurroundDecoder_GetDelay(const CMpegSurroundDecoder *self) { return 0; }
+
+SACDEC_ERROR mpegSurroundDecoder_IsPseudoLR(CMpegSurroundDecoder *pMpegSurroundDecoder, int *bsPseudoLr) {
+  *bsPseudoLr = 0;
+  return MPS_OK;
+}
+
+int mpegSurroundDecoder_GetLibInfo(LIB_INFO *libInfo) { return 0; }
+
+/* Unified DRC, never active so the decoder skips gain processing and loudness normalization */
+
+DRC_DEC_ERROR FDK_drcDec_Open(HANDLE_DRC_DECODER *phDrcDec, const DRC_DEC_FUNCTIONAL_RANGE functionalRange) {
+  *phDrcDec = NULL;
+  return DRC_DEC_OK;
+}
+
+DRC_DEC_ERROR FDK_drcDec_Close(HANDLE_DRC_DECODER *phDrcDec) {
+  *phDrcDec = NULL;
+  return DRC_DEC_OK;
+}
+
+DRC_DEC_ERROR FDK_drcDec_Init(HANDLE_DRC_DECODER hDrcDec, const int frameSize, const int sampleRate,
+                              const int baseChannelCount) {
+  return DRC_DEC_OK;
+}
+
+DRC_DEC_ERROR FDK_drcDec_SetCodecMode(HANDLE_DRC_DECODER hDrcDec, const DRC_DEC_CODEC_MODE codecMode) {
+  return DRC_DEC_OK;
+}
+
+DRC_DEC_ERROR FDK_drcDec_SetParam(HANDLE_DRC_DECODER hDrcDec, const DRC_DEC_USERPARAM requestType,
+                                  const FIXP_DBL requestValue) {
+  return DRC_DEC_OK;
+}
+
+LONG FDK_drcDec_GetParam(HANDLE_DRC_DECODER hDrcDec, const DRC_DEC_USERPARAM requestType) { return 0; }
+
+void FDK_drcDec_SetChannelGains(HANDLE_DRC_DECODER hDrcDec, const int numChannels, const int frameSize,
+                                FIXP_DBL *channelGainDb, FIXP_DBL *audioBuffer,
+                                const int audioBufferChannelOffset) {}
+
+DRC_DEC_ERROR FDK_drcDec_Preprocess(HANDLE_DRC_DECODER hDrcDec) { return DRC_DEC_NOT_OK; }
+
+DRC_DEC_ERROR FDK_drcDec_ProcessTime(HANDLE_DRC_DECODER hDrcDec, const int delaySamples,
+                                     const DRC_DEC_LOCATION drcLocation, const int channelOffset,
+                                     const int drcChannelOffset, const int numChannelsProcessed,
+                                     FIXP_DBL *realBuffer, const int timeDataChannelOffset) {
+  return DRC_DEC_NOT_OK;
+}
+
+DRC_DEC_ERROR FDK_drcDec_ApplyDownmix(HANDLE_DRC_DECODER hDrcDec, int *reverseInChannelMap,
+                                      int *reverseOutChannelMap, FIXP_DBL *realBuffer, int *pNChannels) {
+  return DRC_DEC_NOT_OK;
+}
+
+DRC_DEC_ERROR FDK_drcDec_ReadUniDrc(HANDLE_DRC_DECODER hDrcDec, HANDLE_FDK_BITSTREAM hBitstream) {
+  return DRC_DEC_UNSUPPORTED_FUNCTION;
+}
+
+DRC_DEC_ERROR FDK_drcDec_ReadUniDrcConfig(HANDLE_DRC_DECODER hDrcDec, HANDLE_FDK_BITSTREAM hBitstream) {
+  return DRC_DEC_UNSUPPORTED_FUNCTION;
+}
+
+DRC_DEC_ERROR FDK_drcDec_ReadUniDrcGain(HANDLE_DRC_DECODER hDrcDec, HANDLE_FDK_BITSTREAM hBitstream) {
+  return DRC_DEC_UNSUPPORTED_FUNCTION;
+}
+
+DRC_DEC_ERROR FDK_drcDec_ReadLoudnessInfoSet(HANDLE_DRC_DECODER hDrcDec, HANDLE_FDK_BITSTREAM hBitstream) {
+  return DRC_DEC_UNSUPPORTED_FUNCTION;
+}
+
+DRC_DEC_ERROR FDK_drcDec_ReadLoudnessBox(HANDLE_DRC_DECODER hDrcDec, HANDLE_FDK_BITSTREAM hBitstream) {
+  return DRC_DEC_UNSUPPORTED_FUNCTION;
+}
+
+DRC_DEC_ERROR FDK_drcDec_ReadDownmixInstructions_Box(HANDLE_DRC_DECODER hDrcDec,
+                                                     HANDLE_FDK_BITSTREAM hBitstream) {
+  return DRC_DEC_UNSUPPORTED_FUNCTION;
+}
+
+DRC_DEC_ERROR FDK_drcDec_ReadUniDrcInstructions_Box(HANDLE_DRC_DECODER hDrcDec,
+                                                    HANDLE_FDK_BITSTREAM hBitstream) {
+  return DRC_DEC_UNSUPPORTED_FUNCTION;
+}
+
+DRC_DEC_ERROR FDK_drcDec_ReadUniDrcCoefficients_Box(HANDLE_DRC_DECODER hDrcDec,
+                                                    HANDLE_FDK_BITSTREAM hBitstream) {
+  return DRC_DEC_UNSUPPORTED_FUNCTION;
+}
+
+DRC_DEC_ERROR FDK_drcDec_GetLibInfo(LIB_INFO *info) { return DRC_DEC_OK; }
@@ -0,0 +1,82 @@
+/**
+ * RPiPlay - An open-source AirPlay mirroring server for Raspberry Pi
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+#include "gstreamer_clock.h"
+#include <assert.h>
+#include <stdlib.h>
+#include "../lib/raop_ntp.h"
+
+struct gstreamer_clock_s {
+    GstClock *clock;
+    GstClockTime latency;
+    /* Local time the clock was created at, in microseconds */
+    uint64_t base_time;
+    gint refs;
+};
+
+gstreamer_clock_t *gstreamer_clock_create(int latency_ms) {
+    gstreamer_clock_t *clock = calloc(1, sizeof(gstreamer_clock_t));
+    if (!clock) {
+        return NULL;
+    }
+    clock->clock = g_object_new(GST_TYPE_SYSTEM_CLOCK, "clock-type", GST_CLOCK_TYPE_MONOTONIC, NULL);
+    assert(clock->clock);
+    clock->latency = latency_ms > 0 ? (GstClockTime) latency_ms * GST_MSECOND : GST_CLOCK_TIME_NONE;
+    clock->base_time = raop_ntp_get_local_time(NULL);
+    clock->refs = 1;
+    return clock;
+}
+
+gstreamer_clock_t *gstreamer_clock_ref(gstreamer_clock_t *clock) {
+    g_atomic_int_inc(&clock->refs);
+    return clock;
+}
+
+void gstreamer_clock_unref(gstreamer_clock_t *clock) {
+    if (clock && g_atomic_int_dec_and_test(&clock->refs)) {
+        gst_object_unref(clock->clock);
+        free(clock);
+    }
+}
+
+GstClockTime gstreamer_clock_get_latency(gstreamer_clock_t *clock) {
+    return GST_CLOCK_TIME_IS_VALID(clock->latency) ? clock->latency : 0;
+}
+
+void gstreamer_clock_attach(gstreamer_clock_t *clock, GstElement *pipeline) {
+    gst_pipeline_use_clock(GST_PIPELINE(pipeline), clock->clock);
+    // The base time is set by hand, keep the pipeline from replacing it on the way to PLAYING
+    gst_element_set_start_time(pipeline, GST_CLOCK_TIME_NONE);
+    gst_element_set_base_time(pipeline, clock->base_time * GST_USECOND);
+    gst_pipeline_set_latency(GST_PIPELINE(pipeline), clock->latency);
+}
+
+void gstreamer_clock_start(gstreamer_clock_t *clock, GstElement *pipeline) {
+    gst_element_set_base_time(pipeline, clock->base_time * GST_USECOND);
+    gst_element_set_state(pipeline, GST_STATE_PLAYING);
+}
+
+GstClockTime gstreamer_clock_stamp(gstreamer_clock_t *clock, uint64_t pts) {
+    // Buffers that were already due when the clock was created are shown right away
+    if (pts <= clock->base_time) return 0;
+    return (pts - clock->base_time) * GST_USECOND;
+}
+
+uint64_t gstreamer_clock_local_time(gstreamer_clock_t *clock, GstClockTime running_time) {
+    return clock->base_time + running_time / GST_USECOND;
+}
@@ -0,0 +1,53 @@
+/**
+ * RPiPlay - An open-source AirPlay mirroring server for Raspberry Pi
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+/*
+ * Presentation clock shared by the GStreamer renderers of a tile.
+ * The pts handed to the renderers are local times in microseconds on
+ * CLOCK_MONOTONIC, as raop_ntp keeps them, so the pipelines run on one
+ * monotonic system clock with one base time, the local time the clock was
+ * created at. Every pipeline attached to it also gets the same fixed
+ * latency instead of the one it computes for its own elements, so a buffer
+ * is presented once the local clock reaches its pts plus that latency
+ * whichever pipeline it went through, and audio and video stay in sync
+ * with each other as they would in a single pipeline.
+ */
+
+#ifndef GSTREAMER_CLOCK_H
+#define GSTREAMER_CLOCK_H
+
+#include <stdint.h>
+#include <gst/gst.h>
+
+typedef struct gstreamer_clock_s gstreamer_clock_t;
+
+/* latency_ms of 0 or less leaves each pipeline its own latency */
+gstreamer_clock_t *gstreamer_clock_create(int latency_ms);
+gstreamer_clock_t *gstreamer_clock_ref(gstreamer_clock_t *clock);
+void gstreamer_clock_unref(gstreamer_clock_t *clock);
+GstClockTime gstreamer_clock_get_latency(gstreamer_clock_t *clock);
+/* Runs pipeline on the clock's time, before it leaves the NULL state */
+void gstreamer_clock_attach(gstreamer_clock_t *clock, GstElement *pipeline);
+/* Sets an attached pipeline playing, nothing waits for a first buffer since the base time is known */
+void gstreamer_clock_start(gstreamer_clock_t *clock, GstElement *pipeline);
+/* Running time of a buffer with the given pts, 0 for one from before the clock was created */
+GstClockTime gstreamer_clock_stamp(gstreamer_clock_t *clock, uint64_t pts);
+/* The other way round, the pts of a buffer stamped with running_time */
+uint64_t gstreamer_clock_local_time(gstreamer_clock_t *clock, GstClockTime running_time);
+
+#endif //GSTREAMER_CLOCK_H
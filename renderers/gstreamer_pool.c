@@ -0,0 +1,56 @@
+/**
+ * RPiPlay - An open-source AirPlay mirroring server for Raspberry Pi
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+#include "gstreamer_pool.h"
+
+int gstreamer_pool_init(gstreamer_pool_t *pool, gsize size, guint min_buffers) {
+    GstStructure *config;
+
+    pool->size = size;
+    pool->pool = gst_buffer_pool_new();
+    if (!pool->pool) return -1;
+
+    // No maximum, so acquiring never blocks when the pipeline holds on to many buffers
+    config = gst_buffer_pool_get_config(pool->pool);
+    gst_buffer_pool_config_set_params(config, NULL, size, min_buffers, 0);
+    if (!gst_buffer_pool_set_config(pool->pool, config) || !gst_buffer_pool_set_active(pool->pool, TRUE)) {
+        gst_object_unref(pool->pool);
+        pool->pool = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+GstBuffer *gstreamer_pool_get(gstreamer_pool_t *pool, gsize size) {
+    GstBuffer *buffer = NULL;
+
+    if (size <= pool->size && gst_buffer_pool_acquire_buffer(pool->pool, &buffer, NULL) == GST_FLOW_OK) {
+        // The pool restores the full size when the buffer comes back
+        gst_buffer_set_size(buffer, size);
+        return buffer;
+    }
+    return gst_buffer_new_allocate(NULL, size, NULL);
+}
+
+void gstreamer_pool_destroy(gstreamer_pool_t *pool) {
+    if (pool->pool) {
+        gst_buffer_pool_set_active(pool->pool, FALSE);
+        gst_object_unref(pool->pool);
+        pool->pool = NULL;
+    }
+}
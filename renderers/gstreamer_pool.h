@@ -0,0 +1,40 @@
+/**
+ * RPiPlay - An open-source AirPlay mirroring server for Raspberry Pi
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+/*
+ * Recycled input buffers for the GStreamer renderers.
+ * Buffers up to the pool's size come from a GstBufferPool and go back to it
+ * once the pipeline has consumed them, so steady streams stop allocating.
+ * Larger requests fall back to a freshly allocated buffer.
+ */
+
+#ifndef GSTREAMER_POOL_H
+#define GSTREAMER_POOL_H
+
+#include <gst/gst.h>
+
+typedef struct gstreamer_pool_s {
+    GstBufferPool *pool;
+    gsize size;
+} gstreamer_pool_t;
+
+int gstreamer_pool_init(gstreamer_pool_t *pool, gsize size, guint min_buffers);
+GstBuffer *gstreamer_pool_get(gstreamer_pool_t *pool, gsize size);
+void gstreamer_pool_destroy(gstreamer_pool_t *pool);
+
+#endif //GSTREAMER_POOL_H
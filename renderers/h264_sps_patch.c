@@ -0,0 +1,567 @@
+/**
+ * RPiPlay - An open-source AirPlay mirroring server for Raspberry Pi
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "h264_sps_patch.h"
+
+#define NAL_UNIT_TYPE_SPS 7
+
+/* The VUI fields add a few bytes, and emulation prevention up to one for every two */
+#define SPS_REWRITE_ROOM(size) ((size) * 2 + 16)
+#define SPS_CACHE_KEY_SIZE 256
+
+#define DEFAULT_REORDER_DEPTH 4
+#define LOW_LATENCY_REORDER_DEPTH 1
+
+/* The SPS written in front of the sender's own. This is what h264-bitstream produced for it,
+ * leading zero byte included, and is kept byte for byte rather than change what the firmware is fed. */
+static const unsigned char inject_sps[] = { 0x00, 0x07, 0x00, 0x00, 0x03, 0x00, 0xfb, 0x04 };
+
+struct h264_sps_patch_s {
+    logger_t *logger;
+    h264_sps_patch_mode_t mode;
+    int reorder_depth;
+
+    /* Last SPS received from the sender and the SPS generated for it */
+    unsigned char cache_key[SPS_CACHE_KEY_SIZE];
+    int cache_key_len;
+    unsigned char cache_value[SPS_REWRITE_ROOM(SPS_CACHE_KEY_SIZE)];
+    int cache_value_len;
+    /* Size of the last SPS passed through for being too large, so it is only logged once */
+    int skipped_size;
+
+    /* Reused buffer for codec data with the patched SPS */
+    unsigned char *buffer;
+    int buffer_size;
+};
+
+int
+h264_sps_patch_reorder_depth(video_renderer_config_t const *config)
+{
+    if (config->reorder_depth >= 0) {
+        return config->reorder_depth;
+    }
+    return config->low_latency ? LOW_LATENCY_REORDER_DEPTH : DEFAULT_REORDER_DEPTH;
+}
+
+h264_sps_patch_t *
+h264_sps_patch_init(logger_t *logger, h264_sps_patch_mode_t mode, int reorder_depth)
+{
+    h264_sps_patch_t *patch = calloc(1, sizeof(h264_sps_patch_t));
+    if (!patch) {
+        return NULL;
+    }
+    patch->logger = logger;
+    patch->mode = mode;
+    patch->reorder_depth = reorder_depth;
+    return patch;
+}
+
+/* Exp-Golomb reader and writer over an RBSP, both set error instead of running past the end */
+typedef struct bit_reader_s {
+    const unsigned char *data;
+    int size;
+    int pos;
+    int error;
+} bit_reader_t;
+
+typedef struct bit_writer_s {
+    unsigned char *data;
+    int size;
+    int pos;
+    int error;
+} bit_writer_t;
+
+static unsigned int
+bit_read(bit_reader_t *r, int bits)
+{
+    unsigned int value = 0;
+    if (r->pos + bits > r->size * 8) {
+        r->error = 1;
+        r->pos = r->size * 8;
+        return 0;
+    }
+    while (bits-- > 0) {
+        value = (value << 1) | ((r->data[r->pos >> 3] >> (7 - (r->pos & 7))) & 1);
+        r->pos++;
+    }
+    return value;
+}
+
+static unsigned int
+bit_read_ue(bit_reader_t *r)
+{
+    int zeros = 0;
+    while (!r->error && bit_read(r, 1) == 0) {
+        if (++zeros > 31) {
+            r->error = 1;
+        }
+    }
+    if (r->error) {
+        return 0;
+    }
+    return ((1u << zeros) - 1) + bit_read(r, zeros);
+}
+
+/* Signed codes are as long as unsigned ones, so they are skipped the same way */
+static void
+bit_skip_se(bit_reader_t *r, unsigned int count)
+{
+    while (count-- > 0) {
+        bit_read_ue(r);
+    }
+}
+
+static void
+bit_write(bit_writer_t *w, unsigned int value, int bits)
+{
+    if (w->pos + bits > w->size * 8) {
+        w->error = 1;
+        return;
+    }
+    while (bits-- > 0) {
+        unsigned char mask = 1 << (7 - (w->pos & 7));
+        if ((value >> bits) & 1) {
+            w->data[w->pos >> 3] |= mask;
+        } else {
+            w->data[w->pos >> 3] &= ~mask;
+        }
+        w->pos++;
+    }
+}
+
+static void
+bit_write_ue(bit_writer_t *w, unsigned int value)
+{
+    int bits = 0;
+    while ((value + 1) >> (bits + 1)) {
+        bits++;
+    }
+    bit_write(w, 0, bits);
+    bit_write(w, value + 1, bits + 1);
+}
+
+/* Strips the emulation prevention bytes, returns the RBSP size or -1 if it doesn't fit */
+static int
+h264_sps_unescape(const unsigned char *nal, int nal_size, unsigned char *rbsp, int rbsp_size)
+{
+    int zeros = 0, len = 0;
+    for (int i = 0; i < nal_size; i++) {
+        if (zeros >= 2 && nal[i] == 0x03) {
+            zeros = 0;
+            continue;
+        }
+        if (len == rbsp_size) {
+            return -1;
+        }
+        rbsp[len++] = nal[i];
+        zeros = nal[i] == 0 ? zeros + 1 : 0;
+    }
+    return len;
+}
+
+/* Adds the emulation prevention bytes, returns the NAL size or 0 if it doesn't fit */
+static int
+h264_sps_escape(const unsigned char *rbsp, int rbsp_size, unsigned char *nal, int nal_size)
+{
+    int zeros = 0, len = 0;
+    for (int i = 0; i < rbsp_size; i++) {
+        if (zeros >= 2 && rbsp[i] <= 0x03) {
+            if (len == nal_size) {
+                return 0;
+            }
+            nal[len++] = 0x03;
+            zeros = 0;
+        }
+        if (len == nal_size) {
+            return 0;
+        }
+        nal[len++] = rbsp[i];
+        zeros = rbsp[i] == 0 ? zeros + 1 : 0;
+    }
+    return len;
+}
+
+static void
+h264_sps_skip_scaling_list(bit_reader_t *r, int size)
+{
+    int last_scale = 8, next_scale = 8;
+    for (int i = 0; i < size && next_scale != 0 && !r->error; i++) {
+        unsigned int code = bit_read_ue(r);
+        int delta = code & 1 ? (int) ((code + 1) / 2) : -(int) (code / 2);
+        next_scale = (last_scale + delta + 256) % 256;
+        last_scale = next_scale == 0 ? last_scale : next_scale;
+    }
+}
+
+static void
+h264_sps_skip_hrd(bit_reader_t *r)
+{
+    unsigned int cpb_cnt = bit_read_ue(r) + 1;
+    if (cpb_cnt > 32) {
+        r->error = 1;
+        return;
+    }
+    bit_read(r, 4 + 4);
+    for (unsigned int i = 0; i < cpb_cnt; i++) {
+        bit_read_ue(r);
+        bit_read_ue(r);
+        bit_read(r, 1);
+    }
+    bit_read(r, 5 + 5 + 5 + 5);
+}
+
+/* The parts of the SPS the patch needs, all positions are bit offsets into the RBSP */
+typedef struct h264_sps_info_s {
+    unsigned int num_ref_frames;
+    int vui_present_pos;
+    int vui_present;
+    int restriction_pos;
+    int restriction_present;
+    unsigned int motion_vectors_over_pic_boundaries;
+    unsigned int max_bytes_per_pic_denom;
+    unsigned int max_bits_per_mb_denom;
+    unsigned int log2_max_mv_length_horizontal;
+    unsigned int log2_max_mv_length_vertical;
+} h264_sps_info_t;
+
+/* Parses the SPS RBSP after the NAL header up to the bitstream restriction, returns -1 on error */
+static int
+h264_sps_parse(bit_reader_t *r, h264_sps_info_t *info)
+{
+    unsigned int profile_idc = bit_read(r, 8);
+    bit_read(r, 8 + 8);
+    bit_read_ue(r);
+    switch (profile_idc) {
+    case 100: case 110: case 122: case 244: case 44: case 83: case 86:
+    case 118: case 128: case 138: case 139: case 134: case 135: {
+        unsigned int chroma_format_idc = bit_read_ue(r);
+        if (chroma_format_idc == 3) {
+            bit_read(r, 1);
+        }
+        bit_read_ue(r);
+        bit_read_ue(r);
+        bit_read(r, 1);
+        if (bit_read(r, 1)) {
+            for (int i = 0; i < (chroma_format_idc != 3 ? 8 : 12); i++) {
+                if (bit_read(r, 1)) {
+                    h264_sps_skip_scaling_list(r, i < 6 ? 16 : 64);
+                }
+            }
+        }
+        break;
+    }
+    default:
+        break;
+    }
+    bit_read_ue(r);
+    unsigned int pic_order_cnt_type = bit_read_ue(r);
+    if (pic_order_cnt_type == 0) {
+        bit_read_ue(r);
+    } else if (pic_order_cnt_type == 1) {
+        bit_read(r, 1);
+        bit_skip_se(r, 2);
+        unsigned int cycle = bit_read_ue(r);
+        if (cycle > 255) {
+            return -1;
+        }
+        bit_skip_se(r, cycle);
+    }
+    info->num_ref_frames = bit_read_ue(r);
+    bit_read(r, 1);
+    bit_read_ue(r);
+    bit_read_ue(r);
+    if (!bit_read(r, 1)) {
+        bit_read(r, 1);
+    }
+    bit_read(r, 1);
+    if (bit_read(r, 1)) {
+        bit_read_ue(r);
+        bit_read_ue(r);
+        bit_read_ue(r);
+        bit_read_ue(r);
+    }
+
+    info->vui_present_pos = r->pos;
+    info->vui_present = bit_read(r, 1);
+    if (!info->vui_present) {
+        return r->error ? -1 : 0;
+    }
+    if (bit_read(r, 1) && bit_read(r, 8) == 255) {
+        bit_read(r, 16 + 16);
+    }
+    if (bit_read(r, 1)) {
+        bit_read(r, 1);
+    }
+    if (bit_read(r, 1)) {
+        bit_read(r, 3 + 1);
+        if (bit_read(r, 1)) {
+            bit_read(r, 8 + 8 + 8);
+        }
+    }
+    if (bit_read(r, 1)) {
+        bit_read_ue(r);
+        bit_read_ue(r);
+    }
+    if (bit_read(r, 1)) {
+        bit_read(r, 32);
+        bit_read(r, 32);
+        bit_read(r, 1);
+    }
+    int nal_hrd = bit_read(r, 1);
+    if (nal_hrd) {
+        h264_sps_skip_hrd(r);
+    }
+    int vcl_hrd = bit_read(r, 1);
+    if (vcl_hrd) {
+        h264_sps_skip_hrd(r);
+    }
+    if (nal_hrd || vcl_hrd) {
+        bit_read(r, 1);
+    }
+    bit_read(r, 1);
+
+    info->restriction_pos = r->pos;
+    info->restriction_present = bit_read(r, 1);
+    if (info->restriction_present) {
+        info->motion_vectors_over_pic_boundaries = bit_read(r, 1);
+        info->max_bytes_per_pic_denom = bit_read_ue(r);
+        info->max_bits_per_mb_denom = bit_read_ue(r);
+        info->log2_max_mv_length_horizontal = bit_read_ue(r);
+        info->log2_max_mv_length_vertical = bit_read_ue(r);
+    }
+    return r->error ? -1 : 0;
+}
+
+/* Rewrites the bitstream restriction of an SPS NAL, copying everything before it bit for bit.
+ * Returns the new NAL size or 0 if it couldn't be written. */
+static int
+h264_sps_patch_restrict(const unsigned char *sps, int sps_size, int reorder_depth, unsigned char *out, int out_size)
+{
+    unsigned char rbsp[SPS_CACHE_KEY_SIZE];
+    unsigned char new_rbsp[SPS_CACHE_KEY_SIZE + 64];
+    // Parsing stops at a missing VUI, the restriction then reads as absent
+    h264_sps_info_t info = {0};
+    int copy_bits;
+
+    if (sps_size < 2 || (sps[0] & 0x1f) != NAL_UNIT_TYPE_SPS) {
+        return 0;
+    }
+    int rbsp_size = h264_sps_unescape(sps + 1, sps_size - 1, rbsp, sizeof(rbsp));
+    if (rbsp_size < 0) {
+        return 0;
+    }
+    bit_reader_t r = { rbsp, rbsp_size, 0, 0 };
+    if (h264_sps_parse(&r, &info) < 0) {
+        return 0;
+    }
+
+    if (!info.restriction_present) {
+        // The values implied when the restriction is absent
+        info.motion_vectors_over_pic_boundaries = 1;
+        info.max_bytes_per_pic_denom = 2;
+        info.max_bits_per_mb_denom = 1;
+        info.log2_max_mv_length_horizontal = 16;
+        info.log2_max_mv_length_vertical = 16;
+    }
+
+    bit_writer_t w = { new_rbsp, sizeof(new_rbsp), 0, 0 };
+    bit_reader_t copy = { rbsp, rbsp_size, 0, 0 };
+    copy_bits = info.vui_present ? info.restriction_pos : info.vui_present_pos;
+    for (; copy_bits >= 8; copy_bits -= 8) {
+        bit_write(&w, bit_read(&copy, 8), 8);
+    }
+    bit_write(&w, bit_read(&copy, copy_bits), copy_bits);
+    if (!info.vui_present) {
+        // A VUI with every flag cleared up to the restriction
+        bit_write(&w, 1, 1);
+        bit_write(&w, 0, 8);
+    }
+    bit_write(&w, 1, 1);
+    bit_write(&w, info.motion_vectors_over_pic_boundaries, 1);
+    bit_write_ue(&w, info.max_bytes_per_pic_denom);
+    bit_write_ue(&w, info.max_bits_per_mb_denom);
+    bit_write_ue(&w, info.log2_max_mv_length_horizontal);
+    bit_write_ue(&w, info.log2_max_mv_length_vertical);
+    bit_write_ue(&w, reorder_depth);
+    // The buffer has to hold the reference frames no matter what
+    bit_write_ue(&w, (unsigned int) reorder_depth > info.num_ref_frames ? (unsigned int) reorder_depth : info.num_ref_frames);
+    // rbsp_trailing_bits
+    bit_write(&w, 1, 1);
+    bit_write(&w, 0, (8 - (w.pos & 7)) & 7);
+    if (w.error || out_size < 1) {
+        return 0;
+    }
+
+    out[0] = sps[0];
+    int new_size = h264_sps_escape(new_rbsp, w.pos / 8, out + 1, out_size - 1);
+    return new_size > 0 ? new_size + 1 : 0;
+}
+
+/* Generates the replacement for the given SPS, or returns 0 if it couldn't be written */
+static int
+h264_sps_patch_generate(h264_sps_patch_t *patch, unsigned char *sps, int sps_size, unsigned char *out, int out_size)
+{
+    if (patch->mode == H264_SPS_PATCH_INJECT) {
+        if (out_size < (int) sizeof(inject_sps)) {
+            return 0;
+        }
+        memcpy(out, inject_sps, sizeof(inject_sps));
+        return sizeof(inject_sps);
+    }
+    return h264_sps_patch_restrict(sps, sps_size, patch->reorder_depth, out, out_size);
+}
+
+/* Finds the first SPS in Annex B data, returns its size or 0 if there is none */
+static int
+h264_sps_patch_find(const unsigned char *data, int data_len, int *sps_start)
+{
+    int start = -1;
+    for (int i = 0; i + 3 <= data_len; i++) {
+        if (data[i] != 0 || data[i + 1] != 0 || data[i + 2] != 0x01) {
+            continue;
+        }
+        if (start >= 0) {
+            // Trailing zeros belong to the next start code
+            int end = i;
+            while (end > start && data[end - 1] == 0) {
+                end--;
+            }
+            *sps_start = start;
+            return end - start;
+        }
+        if (i + 3 < data_len && (data[i + 3] & 0x1f) == NAL_UNIT_TYPE_SPS) {
+            start = i + 3;
+        }
+        i += 2;
+    }
+    if (start >= 0) {
+        *sps_start = start;
+        return data_len - start;
+    }
+    return 0;
+}
+
+/* Returns the SPS that gets written for the given one, generating it only if the
+ * sender's SPS changed since the last codec packet. Returns 0 if it couldn't be written. */
+static int
+h264_sps_patch_get(h264_sps_patch_t *patch, unsigned char *sps, int sps_size, const unsigned char **patched_sps)
+{
+    int out_size;
+
+    if (patch->cache_value_len > 0 && sps_size == patch->cache_key_len && !memcmp(sps, patch->cache_key, sps_size)) {
+        *patched_sps = patch->cache_value;
+        return patch->cache_value_len;
+    }
+    patch->cache_value_len = 0;
+    if (patch->mode != H264_SPS_PATCH_INJECT && sps_size > SPS_CACHE_KEY_SIZE) {
+        if (sps_size != patch->skipped_size) {
+            logger_log(patch->logger, LOGGER_WARNING, "SPS of %d bytes is too large to patch the reorder depth, "
+                       "passing it through", sps_size);
+            patch->skipped_size = sps_size;
+        }
+        return 0;
+    }
+    out_size = patch->mode == H264_SPS_PATCH_INJECT ? (int) sizeof(inject_sps) : SPS_REWRITE_ROOM(sps_size);
+
+    logger_log(patch->logger, LOGGER_DEBUG, "Setting the SPS reorder depth to %d", patch->reorder_depth);
+    int new_sps_size = h264_sps_patch_generate(patch, sps, sps_size, patch->cache_value, out_size);
+    if (new_sps_size == 0) {
+        logger_log(patch->logger, LOGGER_WARNING, "Could not patch the SPS reorder depth");
+        return 0;
+    }
+
+    // The injected SPS doesn't depend on the sender's, which is only cached if it fits the key
+    if (sps_size <= SPS_CACHE_KEY_SIZE) {
+        memcpy(patch->cache_key, sps, sps_size);
+        patch->cache_key_len = sps_size;
+        patch->cache_value_len = new_sps_size;
+    }
+    *patched_sps = patch->cache_value;
+    return new_sps_size;
+}
+
+unsigned char *
+h264_sps_patch_apply(h264_sps_patch_t *patch, unsigned char *data, int *data_len,
+                     const h264_nal_unit_t *nal_units, int nal_count)
+{
+    static const unsigned char nal_marker[] = { 0x0, 0x0, 0x0, 0x1 };
+    const unsigned char *patched_sps = NULL;
+    int sps_start = 0, sps_end = 0;
+    int sps_size = 0;
+    int modified_data_len;
+    unsigned char *modified_data;
+
+    for (int i = 0; i < nal_count; i++) {
+        if (nal_units[i].nal_type == NAL_UNIT_TYPE_SPS) {
+            sps_start = nal_units[i].offset;
+            sps_size = nal_units[i].size;
+            break;
+        }
+    }
+    if (nal_count == 0) {
+        sps_size = h264_sps_patch_find(data, *data_len, &sps_start);
+    }
+    if (sps_size <= 0) {
+        logger_log(patch->logger, LOGGER_ERR, "Could not find sps boundaries");
+        return data;
+    }
+    sps_end = sps_start + sps_size;
+
+    int new_sps_size = h264_sps_patch_get(patch, data + sps_start, sps_size, &patched_sps);
+    if (new_sps_size == 0) {
+        return data;
+    }
+
+    if (patch->mode == H264_SPS_PATCH_INJECT) {
+        modified_data_len = *data_len + new_sps_size + sizeof(nal_marker);
+    } else {
+        modified_data_len = *data_len - sps_size + new_sps_size;
+    }
+    if (modified_data_len > patch->buffer_size) {
+        unsigned char *buffer = realloc(patch->buffer, modified_data_len);
+        if (!buffer) {
+            return data;
+        }
+        patch->buffer = buffer;
+        patch->buffer_size = modified_data_len;
+    }
+
+    modified_data = patch->buffer;
+    memcpy(modified_data, data, sps_start);
+    memcpy(modified_data + sps_start, patched_sps, new_sps_size);
+    if (patch->mode == H264_SPS_PATCH_INJECT) {
+        memcpy(modified_data + sps_start + new_sps_size, nal_marker, sizeof(nal_marker));
+        memcpy(modified_data + sps_start + new_sps_size + sizeof(nal_marker), data + sps_start, *data_len - sps_start);
+    } else {
+        memcpy(modified_data + sps_start + new_sps_size, data + sps_end, *data_len - sps_end);
+    }
+    *data_len = modified_data_len;
+    return modified_data;
+}
+
+void
+h264_sps_patch_destroy(h264_sps_patch_t *patch)
+{
+    if (patch) {
+        free(patch->buffer);
+        free(patch);
+    }
+}
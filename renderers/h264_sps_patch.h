@@ -0,0 +1,56 @@
+/**
+ * RPiPlay - An open-source AirPlay mirroring server for Raspberry Pi
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+/*
+ * Limits how many frames an H.264 decoder holds back for reordering by
+ * writing VUI bitstream restrictions into the codec data. AirPlay mirroring
+ * streams carry no B-frames, so a depth of 0 or 1 is safe and lets the
+ * decoder output every frame as soon as it is decoded.
+ */
+
+#ifndef H264_SPS_PATCH_H
+#define H264_SPS_PATCH_H
+
+#include "../lib/logger.h"
+#include "../lib/stream.h"
+#include "video_renderer.h"
+
+typedef enum h264_sps_patch_mode_e {
+    /* Put a minimal SPS carrying only the restriction in front of the sender's,
+     * which is what the Raspberry Pi firmware decoder picks up */
+    H264_SPS_PATCH_INJECT,
+    /* Rewrite the VUI of the sender's own SPS, for decoders that use the active SPS */
+    H264_SPS_PATCH_REWRITE
+} h264_sps_patch_mode_t;
+
+typedef struct h264_sps_patch_s h264_sps_patch_t;
+
+/* The reorder depth for a renderer config, resolving -1 to its latency profile's default */
+int h264_sps_patch_reorder_depth(video_renderer_config_t const *config);
+
+h264_sps_patch_t *h264_sps_patch_init(logger_t *logger, h264_sps_patch_mode_t mode, int reorder_depth);
+/**
+ * Patches the SPS in a codec data frame. Returns data itself if the frame holds no SPS or it
+ * could not be patched, otherwise an internal buffer valid until the next call, with *data_len
+ * updated.
+ */
+unsigned char *h264_sps_patch_apply(h264_sps_patch_t *patch, unsigned char *data, int *data_len,
+                                    const h264_nal_unit_t *nal_units, int nal_count);
+void h264_sps_patch_destroy(h264_sps_patch_t *patch);
+
+#endif //H264_SPS_PATCH_H
@@ -0,0 +1,257 @@
+/**
+ * RPiPlay - An open-source AirPlay mirroring server for Raspberry Pi
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "h264_test_clip.h"
+
+#define NAL_UNIT_TYPE_NON_IDR 1
+#define NAL_UNIT_TYPE_IDR 5
+#define NAL_UNIT_TYPE_SPS 7
+#define NAL_UNIT_TYPE_PPS 8
+
+#define PROFILE_BASELINE 66
+/* frame_num is 8 bits, log2_max_frame_num_minus4 = 4 */
+#define FRAME_NUM_BITS 8
+
+#define SLICE_TYPE_P_ALL 5
+#define SLICE_TYPE_I_ALL 7
+/* I_16x16_2_0_0: DC prediction, no coded AC or chroma */
+#define MB_TYPE_I16X16_DC 3
+
+typedef struct bit_writer_s {
+    unsigned char *data;
+    int size;
+    int pos;
+    int error;
+} bit_writer_t;
+
+static void
+bit_write(bit_writer_t *w, unsigned int value, int bits)
+{
+    if (w->pos + bits > w->size * 8) {
+        w->error = 1;
+        return;
+    }
+    while (bits-- > 0) {
+        unsigned char mask = 1 << (7 - (w->pos & 7));
+        if ((value >> bits) & 1) {
+            w->data[w->pos >> 3] |= mask;
+        } else {
+            w->data[w->pos >> 3] &= ~mask;
+        }
+        w->pos++;
+    }
+}
+
+static void
+bit_write_ue(bit_writer_t *w, unsigned int value)
+{
+    int bits = 0;
+    while ((value + 1) >> (bits + 1)) {
+        bits++;
+    }
+    bit_write(w, 0, bits);
+    bit_write(w, value + 1, bits + 1);
+}
+
+/* Every signed value this writes is 0 */
+static void
+bit_write_se_zero(bit_writer_t *w)
+{
+    bit_write_ue(w, 0);
+}
+
+static void
+bit_write_trailing(bit_writer_t *w)
+{
+    bit_write(w, 1, 1);
+    while (w->pos & 7) {
+        bit_write(w, 0, 1);
+    }
+}
+
+/* The lowest level whose frame size fits mbs macroblocks, 0 if none does */
+static int
+h264_test_clip_level(int mbs)
+{
+    if (mbs <= 1620) return 30;
+    if (mbs <= 3600) return 31;
+    if (mbs <= 8192) return 40;
+    return 0;
+}
+
+/* Appends a start code, the NAL header and rbsp with emulation prevention, returns the new length */
+static int
+h264_test_clip_put_nal(unsigned char *out, int len, int nal_ref_idc, int nal_type, const unsigned char *rbsp, int rbsp_size)
+{
+    int zeros = 0;
+    out[len++] = 0x00;
+    out[len++] = 0x00;
+    out[len++] = 0x00;
+    out[len++] = 0x01;
+    out[len++] = (unsigned char) ((nal_ref_idc << 5) | nal_type);
+    for (int i = 0; i < rbsp_size; i++) {
+        if (zeros >= 2 && rbsp[i] <= 0x03) {
+            out[len++] = 0x03;
+            zeros = 0;
+        }
+        out[len++] = rbsp[i];
+        zeros = rbsp[i] == 0 ? zeros + 1 : 0;
+    }
+    return len;
+}
+
+/* Room for a NAL of rbsp_size bytes, with its start code and the worst case of emulation prevention */
+#define NAL_ROOM(rbsp_size) (5 + (rbsp_size) * 3 / 2 + 1)
+
+static void
+h264_test_clip_write_sps(bit_writer_t *w, int width_mbs, int height_mbs, int level)
+{
+    bit_write(w, PROFILE_BASELINE, 8);
+    // constraint_set0_flag and constraint_set1_flag: constrained baseline
+    bit_write(w, 0xc0, 8);
+    bit_write(w, level, 8);
+    bit_write_ue(w, 0);                          // seq_parameter_set_id
+    bit_write_ue(w, FRAME_NUM_BITS - 4);         // log2_max_frame_num_minus4
+    bit_write_ue(w, 2);                          // pic_order_cnt_type, output in decoding order
+    bit_write_ue(w, 1);                          // max_num_ref_frames
+    bit_write(w, 0, 1);                          // gaps_in_frame_num_value_allowed_flag
+    bit_write_ue(w, width_mbs - 1);
+    bit_write_ue(w, height_mbs - 1);
+    bit_write(w, 1, 1);                          // frame_mbs_only_flag
+    bit_write(w, 1, 1);                          // direct_8x8_inference_flag
+    bit_write(w, 0, 1);                          // frame_cropping_flag
+    bit_write(w, 0, 1);                          // vui_parameters_present_flag
+    bit_write_trailing(w);
+}
+
+static void
+h264_test_clip_write_pps(bit_writer_t *w)
+{
+    bit_write_ue(w, 0);                          // pic_parameter_set_id
+    bit_write_ue(w, 0);                          // seq_parameter_set_id
+    bit_write(w, 0, 1);                          // entropy_coding_mode_flag, CAVLC
+    bit_write(w, 0, 1);                          // bottom_field_pic_order_in_frame_present_flag
+    bit_write_ue(w, 0);                          // num_slice_groups_minus1
+    bit_write_ue(w, 0);                          // num_ref_idx_l0_default_active_minus1
+    bit_write_ue(w, 0);                          // num_ref_idx_l1_default_active_minus1
+    bit_write(w, 0, 1);                          // weighted_pred_flag
+    bit_write(w, 0, 2);                          // weighted_bipred_idc
+    bit_write_se_zero(w);                        // pic_init_qp_minus26
+    bit_write_se_zero(w);                        // pic_init_qs_minus26
+    bit_write_se_zero(w);                        // chroma_qp_index_offset
+    bit_write(w, 1, 1);                          // deblocking_filter_control_present_flag
+    bit_write(w, 0, 1);                          // constrained_intra_pred_flag
+    bit_write(w, 0, 1);                          // redundant_pic_cnt_present_flag
+    bit_write_trailing(w);
+}
+
+static void
+h264_test_clip_write_slice(bit_writer_t *w, int idr, int frame_num, int idr_pic_id, int mbs)
+{
+    bit_write_ue(w, 0);                          // first_mb_in_slice
+    bit_write_ue(w, idr ? SLICE_TYPE_I_ALL : SLICE_TYPE_P_ALL);
+    bit_write_ue(w, 0);                          // pic_parameter_set_id
+    bit_write(w, frame_num, FRAME_NUM_BITS);
+    if (idr) {
+        bit_write_ue(w, idr_pic_id);
+        bit_write(w, 0, 1);                      // no_output_of_prior_pics_flag
+        bit_write(w, 0, 1);                      // long_term_reference_flag
+    } else {
+        bit_write(w, 0, 1);                      // num_ref_idx_active_override_flag
+        bit_write(w, 0, 1);                      // ref_pic_list_modification_flag_l0
+        bit_write(w, 0, 1);                      // adaptive_ref_pic_marking_mode_flag
+    }
+    bit_write_se_zero(w);                        // slice_qp_delta
+    bit_write_ue(w, 1);                          // disable_deblocking_filter_idc
+
+    if (!idr) {
+        bit_write_ue(w, mbs);                    // mb_skip_run over the whole picture
+    } else {
+        for (int i = 0; i < mbs; i++) {
+            bit_write_ue(w, MB_TYPE_I16X16_DC);
+            bit_write_ue(w, 0);                  // intra_chroma_pred_mode, DC
+            bit_write_se_zero(w);                // mb_qp_delta
+            // Intra16x16DCLevel with no coefficients, coeff_token for nC 0
+            bit_write(w, 1, 1);
+        }
+    }
+    bit_write_trailing(w);
+}
+
+int
+h264_test_clip_build(h264_test_clip_t *clip, int width, int height, int frame_count, int gop)
+{
+    int width_mbs = width / 16, height_mbs = height / 16;
+    int mbs = width_mbs * height_mbs;
+    int level = h264_test_clip_level(mbs);
+    // An IDR takes a byte per macroblock, the rest is headers
+    int rbsp_size = mbs + 64;
+    unsigned char *rbsp;
+
+    memset(clip, 0, sizeof(h264_test_clip_t));
+    if (width % 16 || height % 16 || mbs <= 0 || !level || frame_count <= 0 || gop <= 0) {
+        return -1;
+    }
+    rbsp = calloc(1, rbsp_size);
+    clip->codec_data = malloc(2 * NAL_ROOM(64));
+    clip->frames = calloc(frame_count, sizeof(unsigned char *));
+    clip->frame_lens = calloc(frame_count, sizeof(int));
+    if (!rbsp || !clip->codec_data || !clip->frames || !clip->frame_lens) {
+        free(rbsp);
+        h264_test_clip_free(clip);
+        return -1;
+    }
+
+    bit_writer_t w = { rbsp, 64, 0, 0 };
+    h264_test_clip_write_sps(&w, width_mbs, height_mbs, level);
+    clip->codec_data_len = h264_test_clip_put_nal(clip->codec_data, 0, 3, NAL_UNIT_TYPE_SPS, rbsp, w.pos / 8);
+    w.pos = 0;
+    h264_test_clip_write_pps(&w);
+    clip->codec_data_len = h264_test_clip_put_nal(clip->codec_data, clip->codec_data_len, 3, NAL_UNIT_TYPE_PPS, rbsp, w.pos / 8);
+
+    for (int i = 0; i < frame_count; i++) {
+        int idr = i % gop == 0;
+        bit_writer_t slice = { rbsp, rbsp_size, 0, 0 };
+        h264_test_clip_write_slice(&slice, idr, (i % gop) % (1 << FRAME_NUM_BITS), (i / gop) & 0xffff, mbs);
+        if (slice.error || !(clip->frames[i] = malloc(NAL_ROOM(slice.pos / 8)))) {
+            free(rbsp);
+            h264_test_clip_free(clip);
+            return -1;
+        }
+        clip->frame_lens[i] = h264_test_clip_put_nal(clip->frames[i], 0, idr ? 3 : 2,
+                                                     idr ? NAL_UNIT_TYPE_IDR : NAL_UNIT_TYPE_NON_IDR, rbsp, slice.pos / 8);
+        clip->frame_count = i + 1;
+    }
+    free(rbsp);
+    return 0;
+}
+
+void
+h264_test_clip_free(h264_test_clip_t *clip)
+{
+    for (int i = 0; clip->frames && i < clip->frame_count; i++) {
+        free(clip->frames[i]);
+    }
+    free(clip->frames);
+    free(clip->frame_lens);
+    free(clip->codec_data);
+    memset(clip, 0, sizeof(h264_test_clip_t));
+}
@@ -0,0 +1,54 @@
+/**
+ * RPiPlay - An open-source AirPlay mirroring server for Raspberry Pi
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+/*
+ * A short H.264 stream written from scratch, for trying out a decoder without
+ * a sender. Constrained baseline with CAVLC: every GOP is a grey IDR of intra
+ * 16x16 DC macroblocks followed by P frames that skip every macroblock, so the
+ * clip is a few KB however large the picture. The frames are laid out as the
+ * mirror stream hands them to a renderer: the codec data with the SPS and PPS,
+ * then one Annex B access unit per frame.
+ */
+
+#ifndef H264_TEST_CLIP_H
+#define H264_TEST_CLIP_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct h264_test_clip_s {
+    unsigned char *codec_data;
+    int codec_data_len;
+    unsigned char **frames;
+    int *frame_lens;
+    int frame_count;
+} h264_test_clip_t;
+
+/**
+ * Builds frame_count frames of width x height pixels, both multiples of 16, with an IDR every
+ * gop frames. Returns 0, or -1 if the size is not one an H.264 level allows or memory ran out.
+ */
+int h264_test_clip_build(h264_test_clip_t *clip, int width, int height, int frame_count, int gop);
+void h264_test_clip_free(h264_test_clip_t *clip);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //H264_TEST_CLIP_H
@@ -0,0 +1,489 @@
+/**
+ * RPiPlay - An open-source AirPlay mirroring server for Raspberry Pi
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+#include "now_playing.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#include <libavcodec/avcodec.h>
+#include <libswscale/swscale.h>
+
+#include "../lib/threads.h"
+#include "../lib/thread_attr.h"
+
+/* Decoded cover art kept for senders that show the same images again */
+#define COVERART_CACHE_SIZE 8
+/* Used when the display size is unknown */
+#define DEFAULT_BOX_SIZE 360
+/* Progress comes in RTP time, which senders run at 44.1 kHz */
+#define PROGRESS_RATE 44100
+#define MAX_TEXT_LEN 128
+
+typedef struct {
+    uint64_t hash;
+    int len;
+    unsigned char *rgba;
+    int width;
+    int height;
+    uint64_t last_used;
+} coverart_entry_t;
+
+struct now_playing_s {
+    logger_t *logger;
+    video_renderer_t *renderer;
+    int box_size;
+
+    /* Newest data of each kind not processed yet, protected by mutex */
+    mutex_handle_t mutex;
+    cond_handle_t cond;
+    unsigned char *metadata;
+    int metadata_len;
+    unsigned char *coverart;
+    int coverart_len;
+    bool have_coverart;
+    unsigned int progress[3];
+    bool have_progress;
+    bool clear;
+    bool running;
+    thread_handle_t thread;
+
+    /* Only used by the worker */
+    coverart_entry_t cache[COVERART_CACHE_SIZE];
+    uint64_t cache_clock;
+    bool shown;
+    uint64_t shown_hash;
+    int shown_len;
+
+    uint64_t coverarts;
+    uint64_t decoded;
+    uint64_t cache_hits;
+    uint64_t replaced;
+    uint64_t errors;
+};
+
+/* FNV-1a */
+static uint64_t
+now_playing_hash(const unsigned char *data, int len)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (int i = 0; i < len; i++) {
+        hash ^= data[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static void
+now_playing_copy_text(char *dst, const unsigned char *src, uint32_t len)
+{
+    if (len > MAX_TEXT_LEN - 1) {
+        len = MAX_TEXT_LEN - 1;
+    }
+    memcpy(dst, src, len);
+    dst[len] = '\0';
+}
+
+/* Walks the DMAP items, descending into the mlit listing item that senders wrap them in */
+static void
+now_playing_parse_dmap(const unsigned char *data, int len, char *title, char *artist, char *album)
+{
+    while (len >= 8) {
+        uint32_t item_len = ((uint32_t) data[4] << 24) | ((uint32_t) data[5] << 16) | ((uint32_t) data[6] << 8) | data[7];
+        if (item_len > (uint32_t) len - 8) {
+            return;
+        }
+        if (!memcmp(data, "mlit", 4)) {
+            now_playing_parse_dmap(data + 8, (int) item_len, title, artist, album);
+        } else if (!memcmp(data, "minm", 4)) {
+            now_playing_copy_text(title, data + 8, item_len);
+        } else if (!memcmp(data, "asar", 4)) {
+            now_playing_copy_text(artist, data + 8, item_len);
+        } else if (!memcmp(data, "asal", 4)) {
+            now_playing_copy_text(album, data + 8, item_len);
+        }
+        data += 8 + item_len;
+        len -= 8 + (int) item_len;
+    }
+}
+
+static void
+now_playing_process_metadata(now_playing_t *now_playing, const unsigned char *data, int len)
+{
+    char title[MAX_TEXT_LEN] = "", artist[MAX_TEXT_LEN] = "", album[MAX_TEXT_LEN] = "";
+
+    now_playing_parse_dmap(data, len, title, artist, album);
+    if (!title[0] && !artist[0] && !album[0]) {
+        return;
+    }
+    logger_log(now_playing->logger, LOGGER_INFO, "Now playing: %s%s%s%s%s%s", title,
+               artist[0] ? " by " : "", artist, album[0] ? " (" : "", album, album[0] ? ")" : "");
+}
+
+/* Decodes a JPEG or PNG into frame, the data has AV_INPUT_BUFFER_PADDING_SIZE zero bytes behind it */
+static int
+now_playing_decode(const unsigned char *data, int len, AVFrame *frame)
+{
+    enum AVCodecID codec_id = AV_CODEC_ID_NONE;
+    const AVCodec *codec;
+    AVCodecContext *decoder = NULL;
+    AVPacket *packet = NULL;
+    int ret = -1;
+
+    if (len >= 3 && data[0] == 0xff && data[1] == 0xd8 && data[2] == 0xff) {
+        codec_id = AV_CODEC_ID_MJPEG;
+    } else if (len >= 8 && !memcmp(data, "\x89PNG\r\n\x1a\n", 8)) {
+        codec_id = AV_CODEC_ID_PNG;
+    }
+    if (codec_id == AV_CODEC_ID_NONE || !(codec = avcodec_find_decoder(codec_id)) ||
+        !(decoder = avcodec_alloc_context3(codec)) || !(packet = av_packet_alloc())) {
+        goto out;
+    }
+    decoder->thread_count = 1;
+    if (avcodec_open2(decoder, codec, NULL) < 0) {
+        goto out;
+    }
+    packet->data = (uint8_t *) data;
+    packet->size = len;
+    if (avcodec_send_packet(decoder, packet) < 0) {
+        goto out;
+    }
+    avcodec_send_packet(decoder, NULL);
+    ret = avcodec_receive_frame(decoder, frame) < 0 ? -1 : 0;
+
+    out:
+    av_packet_free(&packet);
+    avcodec_free_context(&decoder);
+    return ret;
+}
+
+/* Scales the frame to fit the box into a new RGBA image */
+static unsigned char *
+now_playing_scale(now_playing_t *now_playing, AVFrame *frame, int *width, int *height)
+{
+    struct SwsContext *sws;
+    unsigned char *rgba;
+    int w = now_playing->box_size, h = now_playing->box_size;
+
+    if (frame->width <= 0 || frame->height <= 0) {
+        return NULL;
+    }
+    if (frame->width >= frame->height) {
+        h = (int) ((int64_t) frame->height * w / frame->width);
+    } else {
+        w = (int) ((int64_t) frame->width * h / frame->height);
+    }
+    if (w < 1) w = 1;
+    if (h < 1) h = 1;
+    sws = sws_getContext(frame->width, frame->height, frame->format, w, h, AV_PIX_FMT_RGBA,
+                         SWS_BILINEAR, NULL, NULL, NULL);
+    if (!sws || !(rgba = malloc((size_t) w * h * 4))) {
+        sws_freeContext(sws);
+        return NULL;
+    }
+    uint8_t *dst[4] = { rgba, NULL, NULL, NULL };
+    int dst_linesize[4] = { w * 4, 0, 0, 0 };
+    sws_scale(sws, (const uint8_t * const *) frame->data, frame->linesize, 0, frame->height, dst, dst_linesize);
+    sws_freeContext(sws);
+    *width = w;
+    *height = h;
+    return rgba;
+}
+
+/* Finds the image in the cache or decodes it into the least recently used entry */
+static coverart_entry_t *
+now_playing_lookup(now_playing_t *now_playing, const unsigned char *data, int len, uint64_t hash)
+{
+    coverart_entry_t *entry = &now_playing->cache[0];
+    AVFrame *frame;
+
+    for (int i = 0; i < COVERART_CACHE_SIZE; i++) {
+        coverart_entry_t *candidate = &now_playing->cache[i];
+        if (candidate->rgba && candidate->hash == hash && candidate->len == len) {
+            candidate->last_used = ++now_playing->cache_clock;
+            __atomic_fetch_add(&now_playing->cache_hits, 1, __ATOMIC_RELAXED);
+            return candidate;
+        }
+        if (!candidate->rgba || (entry->rgba && candidate->last_used < entry->last_used)) {
+            entry = candidate;
+        }
+    }
+
+    if (!(frame = av_frame_alloc())) {
+        return NULL;
+    }
+    unsigned char *rgba = NULL;
+    int width = 0, height = 0;
+    if (now_playing_decode(data, len, frame) == 0) {
+        rgba = now_playing_scale(now_playing, frame, &width, &height);
+    }
+    av_frame_free(&frame);
+    if (!rgba) {
+        return NULL;
+    }
+    __atomic_fetch_add(&now_playing->decoded, 1, __ATOMIC_RELAXED);
+    free(entry->rgba);
+    entry->rgba = rgba;
+    entry->width = width;
+    entry->height = height;
+    entry->hash = hash;
+    entry->len = len;
+    entry->last_used = ++now_playing->cache_clock;
+    return entry;
+}
+
+static void
+now_playing_hide(now_playing_t *now_playing)
+{
+    if (now_playing->shown && now_playing->renderer && now_playing->renderer->funcs->set_overlay) {
+        now_playing->renderer->funcs->set_overlay(now_playing->renderer, NULL, 0, 0, 0);
+    }
+    now_playing->shown = false;
+}
+
+static void
+now_playing_process_coverart(now_playing_t *now_playing, const unsigned char *data, int len)
+{
+    uint64_t hash;
+    coverart_entry_t *entry;
+    bool superseded;
+
+    if (len <= 0) {
+        now_playing_hide(now_playing);
+        return;
+    }
+    hash = now_playing_hash(data, len);
+    if (now_playing->shown && now_playing->shown_hash == hash && now_playing->shown_len == len) {
+        return;
+    }
+    if (!(entry = now_playing_lookup(now_playing, data, len, hash))) {
+        logger_log(now_playing->logger, LOGGER_DEBUG, "Could not decode %d bytes of cover art", len);
+        __atomic_fetch_add(&now_playing->errors, 1, __ATOMIC_RELAXED);
+        now_playing_hide(now_playing);
+        return;
+    }
+
+    // A clear or newer cover art that came in meanwhile wins over this one
+    MUTEX_LOCK(now_playing->mutex);
+    superseded = now_playing->clear || now_playing->have_coverart;
+    MUTEX_UNLOCK(now_playing->mutex);
+    if (superseded) {
+        __atomic_fetch_add(&now_playing->replaced, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    if (now_playing->renderer && now_playing->renderer->funcs->set_overlay) {
+        now_playing->renderer->funcs->set_overlay(now_playing->renderer, entry->rgba, entry->width, entry->height,
+                                                  entry->width * 4);
+        now_playing->shown = true;
+        now_playing->shown_hash = hash;
+        now_playing->shown_len = len;
+    }
+}
+
+static THREAD_RETVAL
+now_playing_thread(void *arg)
+{
+    now_playing_t *now_playing = arg;
+
+    thread_attr_apply(now_playing->logger, THREAD_ROLE_NONE, "rp-nowplaying");
+#if defined(__linux__)
+    // Only this thread, decoding cover art must not hold up audio or video
+    setpriority(PRIO_PROCESS, (id_t) syscall(SYS_gettid), 19);
+#endif
+
+    MUTEX_LOCK(now_playing->mutex);
+    while (now_playing->running) {
+        if (!now_playing->clear && !now_playing->metadata && !now_playing->have_coverart && !now_playing->have_progress) {
+            COND_WAIT(now_playing->cond, now_playing->mutex);
+            continue;
+        }
+        bool clear = now_playing->clear;
+        unsigned char *metadata = now_playing->metadata;
+        int metadata_len = now_playing->metadata_len;
+        unsigned char *coverart = now_playing->coverart;
+        int coverart_len = now_playing->coverart_len;
+        bool have_coverart = now_playing->have_coverart;
+        bool have_progress = now_playing->have_progress;
+        unsigned int start = now_playing->progress[0], curr = now_playing->progress[1], end = now_playing->progress[2];
+        now_playing->clear = false;
+        now_playing->metadata = NULL;
+        now_playing->coverart = NULL;
+        now_playing->have_coverart = false;
+        now_playing->have_progress = false;
+        MUTEX_UNLOCK(now_playing->mutex);
+
+        if (clear) {
+            now_playing_hide(now_playing);
+        }
+        if (metadata) {
+            now_playing_process_metadata(now_playing, metadata, metadata_len);
+            free(metadata);
+        }
+        if (have_progress) {
+            logger_log(now_playing->logger, LOGGER_DEBUG, "Track position %u of %u seconds",
+                       (curr - start) / PROGRESS_RATE, (end - start) / PROGRESS_RATE);
+        }
+        if (have_coverart) {
+            now_playing_process_coverart(now_playing, coverart, coverart_len);
+            free(coverart);
+        }
+
+        MUTEX_LOCK(now_playing->mutex);
+    }
+    MUTEX_UNLOCK(now_playing->mutex);
+    return 0;
+}
+
+now_playing_t *
+now_playing_init(logger_t *logger, video_renderer_t *renderer, int width, int height)
+{
+    now_playing_t *now_playing = calloc(1, sizeof(now_playing_t));
+    if (!now_playing) {
+        return NULL;
+    }
+    now_playing->logger = logger;
+    now_playing->renderer = renderer;
+    now_playing->box_size = (width < height ? width : height) / 3;
+    if (now_playing->box_size <= 0) {
+        now_playing->box_size = DEFAULT_BOX_SIZE;
+    }
+    MUTEX_CREATE(now_playing->mutex);
+    COND_CREATE(now_playing->cond);
+    now_playing->running = true;
+    THREAD_CREATE(now_playing->thread, now_playing_thread, now_playing);
+    return now_playing;
+}
+
+void
+now_playing_set_metadata(now_playing_t *now_playing, const void *buffer, int buflen)
+{
+    unsigned char *metadata;
+
+    if (buflen <= 0 || !(metadata = malloc(buflen))) {
+        return;
+    }
+    memcpy(metadata, buffer, buflen);
+    MUTEX_LOCK(now_playing->mutex);
+    free(now_playing->metadata);
+    now_playing->metadata = metadata;
+    now_playing->metadata_len = buflen;
+    COND_SIGNAL(now_playing->cond);
+    MUTEX_UNLOCK(now_playing->mutex);
+}
+
+void
+now_playing_set_coverart(now_playing_t *now_playing, const void *buffer, int buflen)
+{
+    unsigned char *coverart = NULL;
+
+    if (buflen < 0) {
+        buflen = 0;
+    }
+    // With the padding the decoder may read past the end
+    if (buflen > 0) {
+        if (!(coverart = malloc(buflen + AV_INPUT_BUFFER_PADDING_SIZE))) {
+            return;
+        }
+        memcpy(coverart, buffer, buflen);
+        memset(coverart + buflen, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+    }
+    __atomic_fetch_add(&now_playing->coverarts, 1, __ATOMIC_RELAXED);
+    MUTEX_LOCK(now_playing->mutex);
+    if (now_playing->have_coverart) {
+        __atomic_fetch_add(&now_playing->replaced, 1, __ATOMIC_RELAXED);
+    }
+    free(now_playing->coverart);
+    now_playing->coverart = coverart;
+    now_playing->coverart_len = buflen;
+    now_playing->have_coverart = true;
+    COND_SIGNAL(now_playing->cond);
+    MUTEX_UNLOCK(now_playing->mutex);
+}
+
+void
+now_playing_set_progress(now_playing_t *now_playing, unsigned int start, unsigned int curr, unsigned int end)
+{
+    MUTEX_LOCK(now_playing->mutex);
+    now_playing->progress[0] = start;
+    now_playing->progress[1] = curr;
+    now_playing->progress[2] = end;
+    now_playing->have_progress = true;
+    COND_SIGNAL(now_playing->cond);
+    MUTEX_UNLOCK(now_playing->mutex);
+}
+
+void
+now_playing_clear(now_playing_t *now_playing)
+{
+    MUTEX_LOCK(now_playing->mutex);
+    free(now_playing->metadata);
+    free(now_playing->coverart);
+    now_playing->metadata = NULL;
+    now_playing->coverart = NULL;
+    now_playing->have_coverart = false;
+    now_playing->have_progress = false;
+    now_playing->clear = true;
+    COND_SIGNAL(now_playing->cond);
+    MUTEX_UNLOCK(now_playing->mutex);
+}
+
+void
+now_playing_get_stats(now_playing_t *now_playing, now_playing_stats_t *stats)
+{
+    stats->coverarts = __atomic_load_n(&now_playing->coverarts, __ATOMIC_RELAXED);
+    stats->decoded = __atomic_load_n(&now_playing->decoded, __ATOMIC_RELAXED);
+    stats->cache_hits = __atomic_load_n(&now_playing->cache_hits, __ATOMIC_RELAXED);
+    stats->replaced = __atomic_load_n(&now_playing->replaced, __ATOMIC_RELAXED);
+    stats->errors = __atomic_load_n(&now_playing->errors, __ATOMIC_RELAXED);
+}
+
+void
+now_playing_destroy(now_playing_t *now_playing)
+{
+    if (!now_playing) {
+        return;
+    }
+    MUTEX_LOCK(now_playing->mutex);
+    now_playing->running = false;
+    COND_SIGNAL(now_playing->cond);
+    MUTEX_UNLOCK(now_playing->mutex);
+    THREAD_JOIN(now_playing->thread);
+    now_playing_hide(now_playing);
+
+    if (now_playing->coverarts > 0) {
+        logger_log(now_playing->logger, LOGGER_INFO, "now playing decoded %llu of %llu cover art images, %llu cache hits, %llu replaced, %llu errors",
+                   (unsigned long long) now_playing->decoded, (unsigned long long) now_playing->coverarts,
+                   (unsigned long long) now_playing->cache_hits, (unsigned long long) now_playing->replaced,
+                   (unsigned long long) now_playing->errors);
+    }
+    for (int i = 0; i < COVERART_CACHE_SIZE; i++) {
+        free(now_playing->cache[i].rgba);
+    }
+    free(now_playing->metadata);
+    free(now_playing->coverart);
+    COND_DESTROY(now_playing->cond);
+    MUTEX_DESTROY(now_playing->mutex);
+    free(now_playing);
+}
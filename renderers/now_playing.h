@@ -0,0 +1,71 @@
+/**
+ * RPiPlay - An open-source AirPlay mirroring server for Raspberry Pi
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+/*
+ * Track info and cover art of the audio session that has the main output.
+ * The set functions only copy their data and wake a worker thread at the
+ * lowest scheduling priority, so SET_PARAMETER and the audio path never wait
+ * for a decode. Only the newest data of each kind is kept, anything replaced
+ * before the worker got to it is dropped. Cover art is decoded with
+ * libavcodec, scaled to fit a square a third of the display's shorter side
+ * and shown with the video renderer's set_overlay, the last few images are
+ * kept by hash so a sender going back and forth does not decode them again.
+ * Track names and progress are logged.
+ */
+
+#ifndef NOW_PLAYING_H
+#define NOW_PLAYING_H
+
+#include <stdint.h>
+#include "../lib/logger.h"
+#include "video_renderer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct now_playing_s now_playing_t;
+
+typedef struct now_playing_stats_s {
+    uint64_t coverarts;
+    /* Cover art decoded, and found in the cache instead */
+    uint64_t decoded;
+    uint64_t cache_hits;
+    /* Cover art replaced by a newer one before it was shown */
+    uint64_t replaced;
+    uint64_t errors;
+} now_playing_stats_t;
+
+/* renderer may be NULL or lack set_overlay, then cover art is only counted. width and height are the display's */
+now_playing_t *now_playing_init(logger_t *logger, video_renderer_t *renderer, int width, int height);
+/* DMAP encoded, as in the SET_PARAMETER body */
+void now_playing_set_metadata(now_playing_t *now_playing, const void *buffer, int buflen);
+/* JPEG or PNG, an empty image hides the cover art */
+void now_playing_set_coverart(now_playing_t *now_playing, const void *buffer, int buflen);
+/* RTP times of the track's start, the current position and its end */
+void now_playing_set_progress(now_playing_t *now_playing, unsigned int start, unsigned int curr, unsigned int end);
+/* Hides the cover art and drops anything not processed yet, when the session ends */
+void now_playing_clear(now_playing_t *now_playing);
+void now_playing_get_stats(now_playing_t *now_playing, now_playing_stats_t *stats);
+void now_playing_destroy(now_playing_t *now_playing);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //NOW_PLAYING_H
@@ -0,0 +1,67 @@
+/**
+ * RPiPlay - An open-source AirPlay mirroring server for Raspberry Pi
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+#include "pcm_gain.h"
+
+#include <math.h>
+
+#include "dsp_kernels.h"
+
+#define PCM_GAIN_UNITY 32768
+
+/* AirPlay sends -144 for mute */
+#define PCM_GAIN_MUTE_VOLUME -144.0f
+
+void pcm_gain_init(pcm_gain_t *gain) {
+    gain->target = PCM_GAIN_UNITY;
+    gain->current = PCM_GAIN_UNITY;
+}
+
+void pcm_gain_set_volume(pcm_gain_t *gain, float volume) {
+    if (volume <= PCM_GAIN_MUTE_VOLUME) {
+        gain->target = 0;
+        return;
+    }
+    if (volume > 0.0f) volume = 0.0f;
+    // Twice the volume in dB, as the OMX and ALSA renderers set their mixers
+    gain->target = (int32_t) lrintf(powf(10.0f, volume * 2.0f / 20.0f) * PCM_GAIN_UNITY);
+}
+
+/* Rounded Q15 multiply, the same as vqrdmulh and pmulhrsw for gains below unity */
+static inline int16_t pcm_gain_scale(int16_t sample, int32_t gain) {
+    return (int16_t) (((int32_t) sample * gain + (1 << 14)) >> 15);
+}
+
+void pcm_gain_apply(pcm_gain_t *gain, int16_t *samples, int frames) {
+    if (frames <= 0) return;
+
+    if (gain->current != gain->target) {
+        // Linear ramp over this buffer, both channels of a frame get the same gain
+        int32_t start = gain->current;
+        int32_t delta = gain->target - start;
+        for (int i = 0; i < frames; i++) {
+            int32_t frame_gain = start + (int32_t) ((int64_t) delta * (i + 1) / frames);
+            samples[2 * i] = pcm_gain_scale(samples[2 * i], frame_gain);
+            samples[2 * i + 1] = pcm_gain_scale(samples[2 * i + 1], frame_gain);
+        }
+        gain->current = gain->target;
+        return;
+    }
+    if (gain->current >= PCM_GAIN_UNITY) return;
+    dsp_kernels_get()->gain(samples, frames * 2, (int16_t) gain->current);
+}
@@ -0,0 +1,52 @@
+/**
+ * RPiPlay - An open-source AirPlay mirroring server for Raspberry Pi
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+/*
+ * Software volume for outputs without a mixer of their own, applied to the
+ * decoded PCM before it goes to any sink. Interleaved 16-bit stereo is scaled
+ * by a Q15 gain with NEON, SSSE3 or AVX2 where the CPU has them. A new volume is
+ * ramped in over the next buffer, so steps don't click.
+ * Not thread safe, callers serialise access.
+ */
+
+#ifndef PCM_GAIN_H
+#define PCM_GAIN_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct pcm_gain_s {
+    /* Q15, 32768 is unity */
+    int32_t target;
+    int32_t current;
+} pcm_gain_t;
+
+void pcm_gain_init(pcm_gain_t *gain);
+/* AirPlay volume, 0 to -30 and -144 for mute, mapped like the OMX and ALSA mixers do */
+void pcm_gain_set_volume(pcm_gain_t *gain, float volume);
+/* Scales frames of interleaved stereo in place */
+void pcm_gain_apply(pcm_gain_t *gain, int16_t *samples, int frames);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //PCM_GAIN_H
@@ -0,0 +1,347 @@
+/**
+ * RPiPlay - An open-source AirPlay mirroring server for Raspberry Pi
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+#include "pcm_scheduler.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "../lib/spsc_ring.h"
+#include "../lib/trace.h"
+#include "aac_decoder.h"
+
+#define PCM_SCHEDULER_RATE AAC_DECODER_SAMPLE_RATE
+#define PCM_SCHEDULER_CHANNELS AAC_DECODER_CHANNELS
+#define PCM_SCHEDULER_FRAME_BYTES (PCM_SCHEDULER_CHANNELS * (int) sizeof(int16_t))
+
+/* Decoded packets waiting for the reader, about 750 ms */
+#define PCM_SCHEDULER_QUEUE_PACKETS 64
+
+/* Beyond this error from pts, output is realigned instead of slewed, in us */
+#define PCM_SCHEDULER_MAX_ERROR 40000
+/* Gaps and overlaps between packets are evened out from this size on, in frames */
+#define PCM_SCHEDULER_GAP_FRAMES 44
+
+/* Drift correction: rate change per second of error, and its limit */
+#define PCM_SCHEDULER_SYNC_GAIN 0.1
+#define PCM_SCHEDULER_MAX_ADJUST 0.001
+
+struct pcm_scheduler_s {
+    spsc_ring_t *queue;
+
+    /* Pusher only: packets queued so far. How many of them the latest flush drops */
+    uint64_t pushed;
+    uint64_t flush_until;
+    int64_t delay;
+
+    /* Reader only: packets taken off the queue, the one being read, the frames read from it
+     * and the silence still due before it */
+    uint64_t popped;
+    uint64_t flush_seen;
+    stream_frame_t *current;
+    int offset;
+    int gap;
+    uint64_t next_pts;
+    bool has_next_pts;
+
+    /* Reader only: set once the first sample has been aligned to its pts plus delay. Linear resampler
+     * state: position past the last input frame, and that frame */
+    bool synced;
+    double sync_error;
+    double phase;
+    int16_t last[PCM_SCHEDULER_CHANNELS];
+
+    /* Counters, updated atomically */
+    uint64_t dropped_packets;
+    uint64_t underruns;
+    uint64_t realigns;
+    uint64_t concealed_frames;
+    bool has_presentation_offset;
+    int64_t presentation_offset;
+};
+
+static const int16_t pcm_scheduler_silence[PCM_SCHEDULER_CHANNELS];
+
+pcm_scheduler_t *
+pcm_scheduler_init(void)
+{
+    pcm_scheduler_t *scheduler = calloc(1, sizeof(pcm_scheduler_t));
+    if (!scheduler) {
+        return NULL;
+    }
+    scheduler->queue = spsc_ring_init(PCM_SCHEDULER_QUEUE_PACKETS);
+    if (!scheduler->queue) {
+        free(scheduler);
+        return NULL;
+    }
+    return scheduler;
+}
+
+void
+pcm_scheduler_push(pcm_scheduler_t *scheduler, stream_frame_t *frame)
+{
+    trace_event(TRACE_AUDIO_RENDERED, frame->data_len, frame->pts);
+    // Never wait for the reader, a packet that doesn't fit would be late anyway
+    if (spsc_ring_push(scheduler->queue, frame) < 0) {
+        __atomic_add_fetch(&scheduler->dropped_packets, 1, __ATOMIC_RELAXED);
+        stream_frame_unref(frame);
+        return;
+    }
+    scheduler->pushed++;
+}
+
+void
+pcm_scheduler_flush(pcm_scheduler_t *scheduler)
+{
+    // The reader drops the packets queued so far, packets can't be taken back from this end
+    __atomic_store_n(&scheduler->flush_until, scheduler->pushed, __ATOMIC_RELEASE);
+}
+
+void
+pcm_scheduler_set_delay(pcm_scheduler_t *scheduler, int64_t delay)
+{
+    __atomic_store_n(&scheduler->delay, delay, __ATOMIC_RELAXED);
+}
+
+static int
+pcm_scheduler_frame_count(stream_frame_t *frame)
+{
+    return frame->data_len / PCM_SCHEDULER_FRAME_BYTES;
+}
+
+static void
+pcm_scheduler_release_current(pcm_scheduler_t *scheduler)
+{
+    stream_frame_unref(scheduler->current);
+    scheduler->current = NULL;
+}
+
+/*
+ * Makes sure there is a packet to read from, dropping what a flush asked to.
+ * A packet that doesn't follow on from the previous one gets the gap before it
+ * filled with silence, or its overlap skipped.
+ */
+static bool
+pcm_scheduler_head(pcm_scheduler_t *scheduler)
+{
+    uint64_t flush_until = __atomic_load_n(&scheduler->flush_until, __ATOMIC_ACQUIRE);
+    if (flush_until != scheduler->flush_seen) {
+        scheduler->flush_seen = flush_until;
+        if (scheduler->current) {
+            pcm_scheduler_release_current(scheduler);
+        }
+        scheduler->has_next_pts = false;
+        scheduler->synced = false;
+    }
+    while (scheduler->popped < flush_until) {
+        stream_frame_t *frame = spsc_ring_pop(scheduler->queue);
+        if (!frame) {
+            return false;
+        }
+        scheduler->popped++;
+        stream_frame_unref(frame);
+    }
+
+    while (!scheduler->current) {
+        stream_frame_t *frame = spsc_ring_pop(scheduler->queue);
+        if (!frame) {
+            return false;
+        }
+        scheduler->popped++;
+        int count = pcm_scheduler_frame_count(frame);
+        int64_t gap = 0;
+        if (scheduler->has_next_pts) {
+            gap = ((int64_t) frame->pts - (int64_t) scheduler->next_pts) * PCM_SCHEDULER_RATE / 1000000;
+        }
+        if (count <= 0 || gap <= -count) {
+            stream_frame_unref(frame);
+            continue;
+        }
+        scheduler->current = frame;
+        scheduler->offset = 0;
+        scheduler->gap = 0;
+        scheduler->next_pts = frame->pts + (uint64_t) count * 1000000 / PCM_SCHEDULER_RATE;
+        scheduler->has_next_pts = true;
+        // Gaps too large to be slewed out are left to the realignment
+        if (gap >= PCM_SCHEDULER_GAP_FRAMES && gap < (int64_t) PCM_SCHEDULER_MAX_ERROR * PCM_SCHEDULER_RATE / 1000000) {
+            scheduler->gap = (int) gap;
+            __atomic_add_fetch(&scheduler->concealed_frames, gap, __ATOMIC_RELAXED);
+        } else if (gap <= -PCM_SCHEDULER_GAP_FRAMES) {
+            scheduler->offset = (int) -gap;
+        }
+    }
+    return true;
+}
+
+/* Returns the next input frame, NULL once the queue ran dry */
+static const int16_t *
+pcm_scheduler_peek(pcm_scheduler_t *scheduler)
+{
+    if (!pcm_scheduler_head(scheduler)) {
+        return NULL;
+    }
+    if (scheduler->gap > 0) {
+        return pcm_scheduler_silence;
+    }
+    return (const int16_t *) scheduler->current->data + scheduler->offset * PCM_SCHEDULER_CHANNELS;
+}
+
+/* Moves past the frame pcm_scheduler_peek returned */
+static void
+pcm_scheduler_advance(pcm_scheduler_t *scheduler)
+{
+    if (scheduler->gap > 0) {
+        scheduler->gap--;
+    } else if (++scheduler->offset >= pcm_scheduler_frame_count(scheduler->current)) {
+        pcm_scheduler_release_current(scheduler);
+    }
+}
+
+/* Skips frames input frames, returns false once the queue ran dry */
+static bool
+pcm_scheduler_skip(pcm_scheduler_t *scheduler, int64_t frames)
+{
+    while (frames > 0) {
+        if (!pcm_scheduler_head(scheduler)) {
+            return false;
+        }
+        if (scheduler->gap > 0) {
+            int skip = frames < scheduler->gap ? (int) frames : scheduler->gap;
+            scheduler->gap -= skip;
+            frames -= skip;
+            continue;
+        }
+        int left = pcm_scheduler_frame_count(scheduler->current) - scheduler->offset;
+        if (frames < left) {
+            scheduler->offset += (int) frames;
+            return true;
+        }
+        frames -= left;
+        pcm_scheduler_release_current(scheduler);
+    }
+    return true;
+}
+
+/* Returns the pts of the next output frame, past what the resampler already took in */
+static double
+pcm_scheduler_get_pts(pcm_scheduler_t *scheduler)
+{
+    double frames = scheduler->offset - scheduler->gap - (1.0 - scheduler->phase);
+    return (double) scheduler->current->pts + frames * 1000000.0 / PCM_SCHEDULER_RATE;
+}
+
+int
+pcm_scheduler_read(pcm_scheduler_t *scheduler, int16_t *out, int frames, uint64_t play_time)
+{
+    int done = 0, count = 0;
+    double step = 1.0;
+
+    if (pcm_scheduler_head(scheduler)) {
+        int64_t delay = __atomic_load_n(&scheduler->delay, __ATOMIC_RELAXED);
+        if (!scheduler->synced) {
+            scheduler->phase = 1.0;
+        }
+        int64_t sync_error = (int64_t) ((double) play_time - pcm_scheduler_get_pts(scheduler)) - delay;
+        if (scheduler->synced && (sync_error > PCM_SCHEDULER_MAX_ERROR || sync_error < -PCM_SCHEDULER_MAX_ERROR)) {
+            __atomic_add_fetch(&scheduler->realigns, 1, __ATOMIC_RELAXED);
+            scheduler->synced = false;
+            scheduler->phase = 1.0;
+        }
+
+        if (!scheduler->synced) {
+            // Sample-accurate start: pad with silence when early, skip frames when late
+            int64_t offset = sync_error * PCM_SCHEDULER_RATE / 1000000;
+            if (offset < 0) {
+                done = -offset < frames ? (int) -offset : frames;
+                memset(out, 0, done * PCM_SCHEDULER_FRAME_BYTES);
+            } else if (!pcm_scheduler_skip(scheduler, offset)) {
+                done = frames;
+                memset(out, 0, done * PCM_SCHEDULER_FRAME_BYTES);
+            }
+            scheduler->synced = done < frames;
+            scheduler->sync_error = 0;
+        } else {
+            // Slew the output rate to remove the remaining drift
+            scheduler->sync_error += ((double) sync_error - scheduler->sync_error) / 8.0;
+            double adjust = scheduler->sync_error / 1000000.0 * PCM_SCHEDULER_SYNC_GAIN;
+            if (adjust > PCM_SCHEDULER_MAX_ADJUST) adjust = PCM_SCHEDULER_MAX_ADJUST;
+            if (adjust < -PCM_SCHEDULER_MAX_ADJUST) adjust = -PCM_SCHEDULER_MAX_ADJUST;
+            step = 1.0 + adjust;
+        }
+        if (scheduler->synced) {
+            __atomic_store_n(&scheduler->presentation_offset, delay + (int64_t) scheduler->sync_error, __ATOMIC_RELAXED);
+        }
+    } else if (scheduler->synced) {
+        __atomic_add_fetch(&scheduler->underruns, 1, __ATOMIC_RELAXED);
+        scheduler->synced = false;
+    }
+    __atomic_store_n(&scheduler->has_presentation_offset, scheduler->synced, __ATOMIC_RELAXED);
+
+    if (scheduler->synced) {
+        // Linear interpolation between the last frame taken in and the next one
+        for (; done < frames; done++, count++) {
+            const int16_t *next;
+            while (scheduler->phase >= 1.0) {
+                if (!(next = pcm_scheduler_peek(scheduler))) break;
+                memcpy(scheduler->last, next, PCM_SCHEDULER_FRAME_BYTES);
+                pcm_scheduler_advance(scheduler);
+                scheduler->phase -= 1.0;
+            }
+            if (scheduler->phase >= 1.0 || !(next = pcm_scheduler_peek(scheduler))) {
+                // Ran dry, the next packet is aligned with its pts again
+                __atomic_add_fetch(&scheduler->underruns, 1, __ATOMIC_RELAXED);
+                scheduler->synced = false;
+                break;
+            }
+            int32_t frac = (int32_t) (scheduler->phase * 65536.0);
+            for (int c = 0; c < PCM_SCHEDULER_CHANNELS; c++) {
+                out[done * PCM_SCHEDULER_CHANNELS + c] =
+                        (int16_t) ((scheduler->last[c] * (65536 - frac) + next[c] * frac) >> 16);
+            }
+            scheduler->phase += step;
+        }
+    }
+    memset(out + done * PCM_SCHEDULER_CHANNELS, 0, (frames - done) * PCM_SCHEDULER_FRAME_BYTES);
+    return count;
+}
+
+void
+pcm_scheduler_get_stats(pcm_scheduler_t *scheduler, pcm_scheduler_stats_t *stats)
+{
+    stats->queued_packets = spsc_ring_count(scheduler->queue);
+    stats->dropped_packets = __atomic_load_n(&scheduler->dropped_packets, __ATOMIC_RELAXED);
+    stats->underruns = __atomic_load_n(&scheduler->underruns, __ATOMIC_RELAXED);
+    stats->realigns = __atomic_load_n(&scheduler->realigns, __ATOMIC_RELAXED);
+    stats->concealed_frames = __atomic_load_n(&scheduler->concealed_frames, __ATOMIC_RELAXED);
+    stats->has_presentation_offset = __atomic_load_n(&scheduler->has_presentation_offset, __ATOMIC_RELAXED);
+    stats->presentation_offset = __atomic_load_n(&scheduler->presentation_offset, __ATOMIC_RELAXED);
+}
+
+void
+pcm_scheduler_destroy(pcm_scheduler_t *scheduler)
+{
+    if (scheduler) {
+        stream_frame_t *frame;
+        stream_frame_unref(scheduler->current);
+        while ((frame = spsc_ring_pop(scheduler->queue))) {
+            stream_frame_unref(frame);
+        }
+        spsc_ring_destroy(scheduler->queue);
+        free(scheduler);
+    }
+}
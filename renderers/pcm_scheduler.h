@@ -0,0 +1,75 @@
+/**
+ * RPiPlay - An open-source AirPlay mirroring server for Raspberry Pi
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+/*
+ * Decoded PCM for renderers that pull their output instead of taking every
+ * packet as it is decoded. The thread that decodes pushes the aac_decoder's
+ * frames; the output thread asks for a number of frames that will be heard at
+ * a given local time and gets them lined up with their pts. Gaps between
+ * packets are filled with silence, the first sample after a start, flush or
+ * underrun is placed sample-accurately, and the drift between sender and
+ * output is slewed out with a linear resampler.
+ * One thread may push, flush and set the delay, one other thread may read.
+ * get_stats may be called from any thread.
+ */
+
+#ifndef PCM_SCHEDULER_H
+#define PCM_SCHEDULER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "../lib/stream.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct pcm_scheduler_s pcm_scheduler_t;
+
+typedef struct pcm_scheduler_stats_s {
+    unsigned int queued_packets;
+    /* Packets dropped because the reader fell behind */
+    uint64_t dropped_packets;
+    /* Reads that ran out of packets, and that found the output too far off pts to slew */
+    uint64_t underruns;
+    uint64_t realigns;
+    /* Frames of silence filled in for gaps between packets */
+    uint64_t concealed_frames;
+    /* Time from its pts until the latest sample read will be heard in us, for av_sync */
+    bool has_presentation_offset;
+    int64_t presentation_offset;
+} pcm_scheduler_stats_t;
+
+pcm_scheduler_t *pcm_scheduler_init(void);
+/* Takes over the caller's reference to frame */
+void pcm_scheduler_push(pcm_scheduler_t *scheduler, stream_frame_t *frame);
+/* Drops what was pushed so far, the next packet is aligned with its pts again */
+void pcm_scheduler_flush(pcm_scheduler_t *scheduler);
+/* Plays packets delay us later than their pts otherwise would be */
+void pcm_scheduler_set_delay(pcm_scheduler_t *scheduler, int64_t delay);
+/* Fills out with frames interleaved stereo frames, the first of which is heard at play_time in raop_ntp's
+ * local time. Returns how many of them came from packets, the rest is silence */
+int pcm_scheduler_read(pcm_scheduler_t *scheduler, int16_t *out, int frames, uint64_t play_time);
+void pcm_scheduler_get_stats(pcm_scheduler_t *scheduler, pcm_scheduler_stats_t *stats);
+void pcm_scheduler_destroy(pcm_scheduler_t *scheduler);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //PCM_SCHEDULER_H
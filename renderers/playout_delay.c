@@ -0,0 +1,89 @@
+/**
+ * RPiPlay - An open-source AirPlay mirroring server for Raspberry Pi
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+#include "playout_delay.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* Share of frames that should arrive in time, and the room left for decoding them, in us */
+#define PLAYOUT_DELAY_PERCENTILE 95
+#define PLAYOUT_DELAY_DECODE_TIME 30000
+
+/* The target is taken from the window every this many frames */
+#define PLAYOUT_DELAY_INTERVAL 32
+
+/* How far the delay moves per frame towards its target, and its limit, in us */
+#define PLAYOUT_DELAY_RISE 2000
+#define PLAYOUT_DELAY_FALL 250
+#define PLAYOUT_DELAY_MAX 500000
+
+static int playout_delay_compare(const void *a, const void *b) {
+    int32_t x = *(const int32_t *) a, y = *(const int32_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+static int64_t playout_delay_target(const playout_delay_t *delay) {
+    int32_t sorted[PLAYOUT_DELAY_WINDOW];
+    unsigned int count = delay->count < PLAYOUT_DELAY_WINDOW ? delay->count : PLAYOUT_DELAY_WINDOW;
+    int64_t target;
+
+    memcpy(sorted, delay->window, count * sizeof(int32_t));
+    qsort(sorted, count, sizeof(int32_t), playout_delay_compare);
+    target = (int64_t) sorted[(count - 1) * PLAYOUT_DELAY_PERCENTILE / 100] + PLAYOUT_DELAY_DECODE_TIME;
+    if (target < 0) return 0;
+    if (target > PLAYOUT_DELAY_MAX) return PLAYOUT_DELAY_MAX;
+    return target;
+}
+
+void playout_delay_reset(playout_delay_t *delay) {
+    memset(delay, 0, sizeof(playout_delay_t));
+}
+
+int64_t playout_delay_update(playout_delay_t *delay, int64_t arrival_delay) {
+    if (arrival_delay > PLAYOUT_DELAY_MAX) arrival_delay = PLAYOUT_DELAY_MAX;
+    if (arrival_delay < -PLAYOUT_DELAY_MAX) arrival_delay = -PLAYOUT_DELAY_MAX;
+    delay->window[delay->count % PLAYOUT_DELAY_WINDOW] = (int32_t) arrival_delay;
+    delay->count++;
+
+    if (delay->count == 1) {
+        // Nothing known about the jitter yet, the first frame only gets time to be decoded
+        delay->target = playout_delay_target(delay);
+        delay->current = delay->target;
+        delay->min = delay->current;
+        delay->max = delay->current;
+    } else if (delay->count % PLAYOUT_DELAY_INTERVAL == 0) {
+        delay->target = playout_delay_target(delay);
+    }
+
+    if (delay->current < delay->target) {
+        delay->current += delay->target - delay->current < PLAYOUT_DELAY_RISE ? delay->target - delay->current : PLAYOUT_DELAY_RISE;
+    } else if (delay->current > delay->target) {
+        delay->current -= delay->current - delay->target < PLAYOUT_DELAY_FALL ? delay->current - delay->target : PLAYOUT_DELAY_FALL;
+    }
+    if (delay->current < delay->min) delay->min = delay->current;
+    if (delay->current > delay->max) delay->max = delay->current;
+    return delay->current;
+}
+
+void playout_delay_log(const playout_delay_t *delay, logger_t *logger, const char *name) {
+    if (delay->count == 0) return;
+    logger_log(logger, LOGGER_INFO, "%s: playout delay %.1f ms over %llu frames, aiming for %.1f ms, between %.1f and %.1f ms",
+               name, delay->current / 1000.0, (unsigned long long) delay->count, delay->target / 1000.0,
+               delay->min / 1000.0, delay->max / 1000.0);
+}
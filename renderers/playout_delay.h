@@ -0,0 +1,54 @@
+/**
+ * RPiPlay - An open-source AirPlay mirroring server for Raspberry Pi
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+/*
+ * Playout delay for renderers that present frames against the local clock.
+ * Frames are presented their playout delay after their pts. The delay follows
+ * a high percentile of how late after their pts the last few seconds of frames
+ * arrived, plus room for decoding, so it stays low on a wired link and grows
+ * on a jittery one. It rises quickly when frames start coming in later and
+ * falls slowly once they are on time again, a little per frame either way, so
+ * the picture never jumps.
+ * Not thread safe, callers serialise access.
+ */
+
+#ifndef PLAYOUT_DELAY_H
+#define PLAYOUT_DELAY_H
+
+#include <stdint.h>
+#include "../lib/logger.h"
+
+#define PLAYOUT_DELAY_WINDOW 256
+
+typedef struct playout_delay_s {
+    /* Arrival delays of the latest frames, in us */
+    int32_t window[PLAYOUT_DELAY_WINDOW];
+    unsigned int count;
+    /* Delay aimed for and the one frames are presented with now, in us */
+    int64_t target;
+    int64_t current;
+    int64_t min;
+    int64_t max;
+} playout_delay_t;
+
+void playout_delay_reset(playout_delay_t *delay);
+/* Takes how long after its pts a frame arrived, returns the delay it is presented with */
+int64_t playout_delay_update(playout_delay_t *delay, int64_t arrival_delay);
+void playout_delay_log(const playout_delay_t *delay, logger_t *logger, const char *name);
+
+#endif //PLAYOUT_DELAY_H
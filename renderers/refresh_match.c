@@ -0,0 +1,103 @@
+/**
+ * RPiPlay - An open-source AirPlay mirroring server for Raspberry Pi
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+
+#include "refresh_match.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* How long one measurement of the frame rate takes, and how many in a row have to agree, in us */
+#define REFRESH_MATCH_PERIOD 1000000
+#define REFRESH_MATCH_STEADY 5
+
+/* Frame rates senders encode at, and how far off a measurement may be, in percent */
+static const int refresh_match_rates[] = { 24, 25, 30, 48, 50, 60 };
+#define REFRESH_MATCH_TOLERANCE 2
+
+void refresh_match_reset(refresh_match_t *match, int refresh) {
+    memset(match, 0, sizeof(refresh_match_t));
+    match->refresh = refresh;
+}
+
+/* The common rate frames frames over span us of pts come to, 0 if they are none */
+static int refresh_match_common_rate(unsigned int frames, uint64_t span) {
+    if (frames < 2 || span == 0) return 0;
+    double fps = (frames - 1) * 1000000.0 / span;
+    for (unsigned int i = 0; i < sizeof(refresh_match_rates) / sizeof(refresh_match_rates[0]); i++) {
+        double rate = refresh_match_rates[i];
+        if (fps * 100 >= rate * (100 - REFRESH_MATCH_TOLERANCE) && fps * 100 <= rate * (100 + REFRESH_MATCH_TOLERANCE)) {
+            return refresh_match_rates[i];
+        }
+    }
+    return 0;
+}
+
+int refresh_match_update(refresh_match_t *match, uint64_t pts, uint64_t now) {
+    if (!match->frames || pts < match->first_pts) {
+        // The first frame, or the sender's clock started over
+        match->first_pts = pts;
+        match->first_time = now;
+        match->frames = 1;
+        return 0;
+    }
+    match->frames++;
+    if (now - match->first_time < REFRESH_MATCH_PERIOD) {
+        return 0;
+    }
+
+    int rate = refresh_match_common_rate(match->frames, pts - match->first_pts);
+    match->first_pts = pts;
+    match->first_time = now;
+    match->frames = 1;
+    if (rate && rate == match->rate) {
+        match->steady++;
+    } else {
+        match->rate = rate;
+        match->steady = rate ? 1 : 0;
+    }
+
+    if (match->steady < REFRESH_MATCH_STEADY || (match->refresh && match->refresh % rate == 0)) {
+        return 0;
+    }
+    if (match->last_switch && now - match->last_switch < REFRESH_MATCH_INTERVAL) {
+        return 0;
+    }
+    return rate;
+}
+
+int refresh_match_pick(int current, int rate, const int *refresh_rates, int count) {
+    int best = 0;
+    for (int i = 0; i < count; i++) {
+        int refresh = refresh_rates[i];
+        if (refresh <= 0 || refresh % rate != 0) continue;
+        if (!best || abs(refresh - current) < abs(best - current) ||
+            (abs(refresh - current) == abs(best - current) && refresh > best)) {
+            best = refresh;
+        }
+    }
+    return best;
+}
+
+void refresh_match_switched(refresh_match_t *match, int refresh, uint64_t now) {
+    if (refresh) {
+        match->refresh = refresh;
+    }
+    // A failed switch waits as long as a successful one, rather than being retried every second
+    match->last_switch = now ? now : 1;
+}
@@ -0,0 +1,61 @@
+/**
+ * RPiPlay - An open-source AirPlay mirroring server for Raspberry Pi
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+
+/*
+ * Picks the display refresh rate for a stream's frame rate. Frames judder when
+ * the refresh rate is no multiple of the frame rate, 30 or 60 fps on a 50 Hz
+ * output, however fast they are decoded. The frame rate is measured on the
+ * pts of every second of frames and has to settle on a common rate several
+ * times in a row before a switch is asked for, which a static screen sending
+ * few frames never does. Switches are at least REFRESH_MATCH_INTERVAL apart,
+ * so a sender that keeps changing its rate doesn't make the display flicker.
+ * Not thread safe, callers serialise access.
+ */
+
+#ifndef REFRESH_MATCH_H
+#define REFRESH_MATCH_H
+
+#include <stdint.h>
+
+/* Least time between two switches of the display mode, in us */
+#define REFRESH_MATCH_INTERVAL 30000000
+
+typedef struct refresh_match_s {
+    /* Refresh rate the display runs at, 0 if unknown */
+    int refresh;
+    /* The common rate the last measurements came to and how many in a row did */
+    int rate;
+    int steady;
+    /* The measurement going on: its first pts and local time in us, and the frames since */
+    uint64_t first_pts;
+    uint64_t first_time;
+    unsigned int frames;
+    /* Local time of the last switch in us, 0 if there was none */
+    uint64_t last_switch;
+} refresh_match_t;
+
+void refresh_match_reset(refresh_match_t *match, int refresh);
+/* Takes a frame's pts and the local time in us, returns the frame rate to match the display to, or 0 to leave it */
+int refresh_match_update(refresh_match_t *match, uint64_t pts, uint64_t now);
+/* The one of count refresh rates that shows rate frames per second evenly and is closest to current, 0 if none does */
+int refresh_match_pick(int current, int rate, const int *refresh_rates, int count);
+/* The display now runs at refresh, or could not be switched when it is 0 */
+void refresh_match_switched(refresh_match_t *match, int refresh, uint64_t now);
+
+#endif //REFRESH_MATCH_H
@@ -0,0 +1,499 @@
+/**
+ * RPiPlay - An open-source AirPlay mirroring server for Raspberry Pi
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+#include "thumbnailer.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <netinet/in.h>
+
+#include <libavcodec/avcodec.h>
+#include <libswscale/swscale.h>
+
+#include "../lib/threads.h"
+
+/* Time between thumbnails in us, keyframes in between are not decoded */
+#define THUMBNAIL_INTERVAL 1000000
+/* MJPEG qscale, from 2 (best) to 31 */
+#define THUMBNAIL_QUALITY 6
+#define MAX_PARAMETER_SETS_LEN 1024
+
+/* How often the server thread looks for shutdown, and how long a client may take */
+#define ACCEPT_POLL_MS 200
+#define CLIENT_TIMEOUT_MS 2000
+
+struct thumbnailer_s {
+    logger_t *logger;
+    int width;
+
+    /* Held while a frame is processed, each session's frame_bus has a thread of its own */
+    mutex_handle_t decode_mutex;
+    AVCodecContext *decoder;
+    AVCodecContext *encoder;
+    struct SwsContext *sws;
+    AVPacket *packet;
+    AVFrame *frame;
+    AVFrame *scaled;
+    unsigned char parameter_sets[MAX_PARAMETER_SETS_LEN];
+    int parameter_sets_len;
+    /* Parameter sets followed by the IDR frame, with the padding the decoder reads past the end */
+    unsigned char *input;
+    int input_size;
+    uint64_t last_pts;
+    bool have_last_pts;
+
+    /* Newest thumbnail, protected by mutex */
+    mutex_handle_t mutex;
+    unsigned char *jpeg;
+    int jpeg_len;
+    time_t jpeg_time;
+
+    int server_sock;
+    int running;
+    thread_handle_t thread;
+
+    uint64_t keyframes;
+    uint64_t thumbnails;
+    uint64_t errors;
+    uint64_t requests;
+};
+
+static bool
+thumbnailer_is_idr(const frame_bus_frame_t *frame)
+{
+    if (frame->nal_count == 0) {
+        return frame->keyframe;
+    }
+    for (int i = 0; i < frame->nal_count; i++) {
+        if (frame->nal_units[i].nal_type == 5) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static int
+thumbnailer_open_decoder(thumbnailer_t *thumbnailer)
+{
+    const AVCodec *codec = avcodec_find_decoder(AV_CODEC_ID_H264);
+    if (!codec || !(thumbnailer->decoder = avcodec_alloc_context3(codec))) {
+        return -1;
+    }
+    // One thread and no deblocking, a thumbnail does not need either
+    thumbnailer->decoder->thread_count = 1;
+    thumbnailer->decoder->skip_loop_filter = AVDISCARD_ALL;
+    thumbnailer->decoder->flags |= AV_CODEC_FLAG_LOW_DELAY;
+    thumbnailer->decoder->flags2 |= AV_CODEC_FLAG2_FAST;
+    return avcodec_open2(thumbnailer->decoder, codec, NULL) < 0 ? -1 : 0;
+}
+
+static int
+thumbnailer_open_encoder(thumbnailer_t *thumbnailer, int width, int height)
+{
+    const AVCodec *codec;
+
+    if (thumbnailer->encoder && thumbnailer->encoder->width == width && thumbnailer->encoder->height == height) {
+        return 0;
+    }
+    avcodec_free_context(&thumbnailer->encoder);
+    if (!(codec = avcodec_find_encoder(AV_CODEC_ID_MJPEG)) ||
+        !(thumbnailer->encoder = avcodec_alloc_context3(codec))) {
+        return -1;
+    }
+    thumbnailer->encoder->width = width;
+    thumbnailer->encoder->height = height;
+    thumbnailer->encoder->pix_fmt = AV_PIX_FMT_YUVJ420P;
+    thumbnailer->encoder->color_range = AVCOL_RANGE_JPEG;
+    thumbnailer->encoder->time_base = (AVRational) { 1, 1 };
+    thumbnailer->encoder->flags |= AV_CODEC_FLAG_QSCALE;
+    thumbnailer->encoder->global_quality = FF_QP2LAMBDA * THUMBNAIL_QUALITY;
+    if (avcodec_open2(thumbnailer->encoder, codec, NULL) < 0) {
+        avcodec_free_context(&thumbnailer->encoder);
+        return -1;
+    }
+    return 0;
+}
+
+/* Decodes the IDR frame on its own into thumbnailer->frame */
+static int
+thumbnailer_decode(thumbnailer_t *thumbnailer, const frame_bus_frame_t *frame)
+{
+    int size = thumbnailer->parameter_sets_len + frame->data_len;
+    int ret;
+
+    if (size + AV_INPUT_BUFFER_PADDING_SIZE > thumbnailer->input_size) {
+        unsigned char *input = realloc(thumbnailer->input, size + AV_INPUT_BUFFER_PADDING_SIZE);
+        if (!input) {
+            return -1;
+        }
+        thumbnailer->input = input;
+        thumbnailer->input_size = size + AV_INPUT_BUFFER_PADDING_SIZE;
+    }
+    memcpy(thumbnailer->input, thumbnailer->parameter_sets, thumbnailer->parameter_sets_len);
+    memcpy(thumbnailer->input + thumbnailer->parameter_sets_len, frame->data, frame->data_len);
+    memset(thumbnailer->input + size, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+
+    thumbnailer->packet->data = thumbnailer->input;
+    thumbnailer->packet->size = size;
+    ret = avcodec_send_packet(thumbnailer->decoder, thumbnailer->packet);
+    thumbnailer->packet->data = NULL;
+    thumbnailer->packet->size = 0;
+    if (ret < 0) {
+        avcodec_flush_buffers(thumbnailer->decoder);
+        return -1;
+    }
+    // Drain, so the picture comes out now and the next keyframe starts from a clean decoder
+    avcodec_send_packet(thumbnailer->decoder, NULL);
+    ret = avcodec_receive_frame(thumbnailer->decoder, thumbnailer->frame);
+    avcodec_flush_buffers(thumbnailer->decoder);
+    return ret < 0 ? -1 : 0;
+}
+
+/* Scales thumbnailer->frame down and makes it the newest thumbnail */
+static int
+thumbnailer_encode(thumbnailer_t *thumbnailer)
+{
+    AVFrame *frame = thumbnailer->frame;
+    AVFrame *scaled = thumbnailer->scaled;
+    int width = thumbnailer->width < frame->width ? thumbnailer->width : frame->width;
+    int height = (int) ((int64_t) frame->height * width / frame->width) & ~1;
+    int ret = -1;
+
+    width &= ~1;
+    if (width < 2 || height < 2) {
+        goto out;
+    }
+    thumbnailer->sws = sws_getCachedContext(thumbnailer->sws, frame->width, frame->height, frame->format,
+                                            width, height, AV_PIX_FMT_YUVJ420P, SWS_BILINEAR, NULL, NULL, NULL);
+    if (!thumbnailer->sws || thumbnailer_open_encoder(thumbnailer, width, height) < 0) {
+        goto out;
+    }
+    if (scaled->width != width || scaled->height != height) {
+        av_frame_unref(scaled);
+        scaled->width = width;
+        scaled->height = height;
+        scaled->format = AV_PIX_FMT_YUVJ420P;
+        if (av_frame_get_buffer(scaled, 0) < 0) {
+            av_frame_unref(scaled);
+            goto out;
+        }
+    }
+    if (av_frame_make_writable(scaled) < 0) {
+        goto out;
+    }
+    sws_scale(thumbnailer->sws, (const uint8_t * const *) frame->data, frame->linesize, 0, frame->height,
+              scaled->data, scaled->linesize);
+    scaled->pts = 0;
+    scaled->quality = thumbnailer->encoder->global_quality;
+
+    if (avcodec_send_frame(thumbnailer->encoder, scaled) < 0 ||
+        avcodec_receive_packet(thumbnailer->encoder, thumbnailer->packet) < 0) {
+        goto out;
+    }
+    unsigned char *jpeg = malloc(thumbnailer->packet->size);
+    if (jpeg) {
+        memcpy(jpeg, thumbnailer->packet->data, thumbnailer->packet->size);
+        MUTEX_LOCK(thumbnailer->mutex);
+        free(thumbnailer->jpeg);
+        thumbnailer->jpeg = jpeg;
+        thumbnailer->jpeg_len = thumbnailer->packet->size;
+        thumbnailer->jpeg_time = time(NULL);
+        MUTEX_UNLOCK(thumbnailer->mutex);
+        ret = 0;
+    }
+    av_packet_unref(thumbnailer->packet);
+
+    out:
+    av_frame_unref(frame);
+    return ret;
+}
+
+#if defined(__linux__)
+/* The priority belongs to the thread calling in, which a new subscription may replace */
+static __thread bool thumbnailer_lowered_priority;
+#endif
+
+static void
+thumbnailer_process_locked(thumbnailer_t *thumbnailer, const frame_bus_frame_t *frame)
+{
+    // The decoder is opened for H.264, HEVC sessions keep the last thumbnail
+    if (frame->kind != FRAME_BUS_AUDIO && frame->codec != VIDEO_CODEC_H264) {
+        return;
+    }
+    if (frame->kind == FRAME_BUS_CODEC) {
+        if (frame->data_len <= MAX_PARAMETER_SETS_LEN) {
+            memcpy(thumbnailer->parameter_sets, frame->data, frame->data_len);
+            thumbnailer->parameter_sets_len = frame->data_len;
+        }
+        return;
+    }
+    if (frame->kind != FRAME_BUS_VIDEO || !thumbnailer_is_idr(frame)) {
+        return;
+    }
+    __atomic_fetch_add(&thumbnailer->keyframes, 1, __ATOMIC_RELAXED);
+    if (!thumbnailer->parameter_sets_len ||
+        (thumbnailer->have_last_pts && frame->pts >= thumbnailer->last_pts &&
+         frame->pts - thumbnailer->last_pts < THUMBNAIL_INTERVAL)) {
+        return;
+    }
+    thumbnailer->last_pts = frame->pts;
+    thumbnailer->have_last_pts = true;
+
+#if defined(__linux__)
+    if (!thumbnailer_lowered_priority) {
+        // Only this thread, the display pipeline keeps its priority
+        setpriority(PRIO_PROCESS, (id_t) syscall(SYS_gettid), 19);
+        thumbnailer_lowered_priority = true;
+    }
+#endif
+
+    if (thumbnailer_decode(thumbnailer, frame) < 0 || thumbnailer_encode(thumbnailer) < 0) {
+        __atomic_fetch_add(&thumbnailer->errors, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    __atomic_fetch_add(&thumbnailer->thumbnails, 1, __ATOMIC_RELAXED);
+}
+
+void
+thumbnailer_process(thumbnailer_t *thumbnailer, const frame_bus_frame_t *frame)
+{
+    MUTEX_LOCK(thumbnailer->decode_mutex);
+    thumbnailer_process_locked(thumbnailer, frame);
+    MUTEX_UNLOCK(thumbnailer->decode_mutex);
+}
+
+static void
+thumbnailer_send_all(int sock, const void *data, size_t size)
+{
+    const char *p = data;
+    while (size > 0) {
+        ssize_t sent = send(sock, p, size, MSG_NOSIGNAL);
+        if (sent <= 0) {
+            return;
+        }
+        p += sent;
+        size -= sent;
+    }
+}
+
+static void
+thumbnailer_serve(thumbnailer_t *thumbnailer, int sock)
+{
+    struct timeval timeout = { CLIENT_TIMEOUT_MS / 1000, (CLIENT_TIMEOUT_MS % 1000) * 1000 };
+    char request[1024];
+    char header[256];
+    char date[64];
+    int request_len = 0;
+    unsigned char *jpeg = NULL;
+    int jpeg_len = 0;
+    time_t jpeg_time = 0;
+    struct tm tm;
+
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    // The request line is all that matters, read until the end of the headers
+    while (request_len < (int) sizeof(request) - 1) {
+        ssize_t ret = recv(sock, request + request_len, sizeof(request) - 1 - request_len, 0);
+        if (ret <= 0) {
+            break;
+        }
+        request_len += ret;
+        request[request_len] = '\0';
+        if (strstr(request, "\r\n\r\n")) {
+            break;
+        }
+    }
+    request[request_len] = '\0';
+    __atomic_fetch_add(&thumbnailer->requests, 1, __ATOMIC_RELAXED);
+
+    if (strncmp(request, "GET ", 4) != 0) {
+        const char *response = "HTTP/1.1 405 Method Not Allowed\r\nAllow: GET\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+        thumbnailer_send_all(sock, response, strlen(response));
+        return;
+    }
+
+    MUTEX_LOCK(thumbnailer->mutex);
+    if (thumbnailer->jpeg && (jpeg = malloc(thumbnailer->jpeg_len))) {
+        memcpy(jpeg, thumbnailer->jpeg, thumbnailer->jpeg_len);
+        jpeg_len = thumbnailer->jpeg_len;
+        jpeg_time = thumbnailer->jpeg_time;
+    }
+    MUTEX_UNLOCK(thumbnailer->mutex);
+
+    if (!jpeg) {
+        const char *response = "HTTP/1.1 404 Not Found\r\nContent-Type: text/plain\r\nContent-Length: 25\r\n"
+                               "Cache-Control: no-store\r\nConnection: close\r\n\r\nNothing is being mirrored";
+        thumbnailer_send_all(sock, response, strlen(response));
+        return;
+    }
+    strftime(date, sizeof(date), "%a, %d %b %Y %H:%M:%S GMT", gmtime_r(&jpeg_time, &tm));
+    snprintf(header, sizeof(header), "HTTP/1.1 200 OK\r\nContent-Type: image/jpeg\r\nContent-Length: %d\r\n"
+                                     "Last-Modified: %s\r\nCache-Control: no-store\r\nConnection: close\r\n\r\n",
+             jpeg_len, date);
+    thumbnailer_send_all(sock, header, strlen(header));
+    thumbnailer_send_all(sock, jpeg, jpeg_len);
+    free(jpeg);
+}
+
+static THREAD_RETVAL
+thumbnailer_server_thread(void *arg)
+{
+    thumbnailer_t *thumbnailer = arg;
+
+    while (__atomic_load_n(&thumbnailer->running, __ATOMIC_ACQUIRE)) {
+        struct pollfd pfd = { thumbnailer->server_sock, POLLIN, 0 };
+        if (poll(&pfd, 1, ACCEPT_POLL_MS) <= 0) {
+            continue;
+        }
+        int sock = accept(thumbnailer->server_sock, NULL, NULL);
+        if (sock < 0) {
+            continue;
+        }
+        thumbnailer_serve(thumbnailer, sock);
+        close(sock);
+    }
+    return 0;
+}
+
+/* Listens on port for IPv6 and IPv4, or IPv4 only where there is no IPv6 */
+static int
+thumbnailer_listen(unsigned short port)
+{
+    int one = 1, zero = 0;
+    int sock = socket(AF_INET6, SOCK_STREAM, 0);
+
+    if (sock >= 0) {
+        struct sockaddr_in6 addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin6_family = AF_INET6;
+        addr.sin6_addr = in6addr_any;
+        addr.sin6_port = htons(port);
+        setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        setsockopt(sock, IPPROTO_IPV6, IPV6_V6ONLY, &zero, sizeof(zero));
+        if (bind(sock, (struct sockaddr *) &addr, sizeof(addr)) == 0 && listen(sock, 8) == 0) {
+            return sock;
+        }
+        close(sock);
+    }
+    if ((sock = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+        return -1;
+    }
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(sock, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(sock, 8) < 0) {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+thumbnailer_t *
+thumbnailer_init(logger_t *logger, unsigned short port, int width)
+{
+    thumbnailer_t *thumbnailer = calloc(1, sizeof(thumbnailer_t));
+    if (!thumbnailer) {
+        return NULL;
+    }
+    thumbnailer->logger = logger;
+    thumbnailer->width = width > 0 ? width : THUMBNAILER_DEFAULT_WIDTH;
+    thumbnailer->server_sock = -1;
+    MUTEX_CREATE(thumbnailer->mutex);
+    MUTEX_CREATE(thumbnailer->decode_mutex);
+
+    if (thumbnailer_open_decoder(thumbnailer) < 0 || !(thumbnailer->packet = av_packet_alloc()) ||
+        !(thumbnailer->frame = av_frame_alloc()) || !(thumbnailer->scaled = av_frame_alloc())) {
+        logger_log(logger, LOGGER_ERR, "thumbnailer could not set up the H.264 decoder");
+        thumbnailer_destroy(thumbnailer);
+        return NULL;
+    }
+    if ((thumbnailer->server_sock = thumbnailer_listen(port)) < 0) {
+        logger_log(logger, LOGGER_ERR, "thumbnailer could not listen on port %u", port);
+        thumbnailer_destroy(thumbnailer);
+        return NULL;
+    }
+    thumbnailer->running = 1;
+    THREAD_CREATE(thumbnailer->thread, thumbnailer_server_thread, thumbnailer);
+    logger_log(logger, LOGGER_INFO, "thumbnailer serving %d pixel wide keyframe previews on port %u",
+               thumbnailer->width, port);
+    return thumbnailer;
+}
+
+void
+thumbnailer_clear(thumbnailer_t *thumbnailer)
+{
+    MUTEX_LOCK(thumbnailer->mutex);
+    free(thumbnailer->jpeg);
+    thumbnailer->jpeg = NULL;
+    thumbnailer->jpeg_len = 0;
+    MUTEX_UNLOCK(thumbnailer->mutex);
+}
+
+void
+thumbnailer_get_stats(thumbnailer_t *thumbnailer, thumbnailer_stats_t *stats)
+{
+    stats->keyframes = __atomic_load_n(&thumbnailer->keyframes, __ATOMIC_RELAXED);
+    stats->thumbnails = __atomic_load_n(&thumbnailer->thumbnails, __ATOMIC_RELAXED);
+    stats->errors = __atomic_load_n(&thumbnailer->errors, __ATOMIC_RELAXED);
+    stats->requests = __atomic_load_n(&thumbnailer->requests, __ATOMIC_RELAXED);
+}
+
+void
+thumbnailer_destroy(thumbnailer_t *thumbnailer)
+{
+    if (!thumbnailer) {
+        return;
+    }
+    if (thumbnailer->keyframes > 0) {
+        logger_log(thumbnailer->logger, LOGGER_INFO, "thumbnailer made %llu thumbnails of %llu keyframes, %llu errors, %llu requests",
+                   (unsigned long long) thumbnailer->thumbnails, (unsigned long long) thumbnailer->keyframes,
+                   (unsigned long long) thumbnailer->errors, (unsigned long long) thumbnailer->requests);
+    }
+    if (thumbnailer->running) {
+        __atomic_store_n(&thumbnailer->running, 0, __ATOMIC_RELEASE);
+        THREAD_JOIN(thumbnailer->thread);
+    }
+    if (thumbnailer->server_sock >= 0) {
+        close(thumbnailer->server_sock);
+    }
+    sws_freeContext(thumbnailer->sws);
+    avcodec_free_context(&thumbnailer->encoder);
+    avcodec_free_context(&thumbnailer->decoder);
+    av_frame_free(&thumbnailer->scaled);
+    av_frame_free(&thumbnailer->frame);
+    av_packet_free(&thumbnailer->packet);
+    free(thumbnailer->input);
+    free(thumbnailer->jpeg);
+    MUTEX_DESTROY(thumbnailer->mutex);
+    MUTEX_DESTROY(thumbnailer->decode_mutex);
+    free(thumbnailer);
+}
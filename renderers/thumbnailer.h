@@ -0,0 +1,62 @@
+/**
+ * RPiPlay - An open-source AirPlay mirroring server for Raspberry Pi
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+/*
+ * Keyframe previews of the mirrored screen, e.g. for a room booking dashboard.
+ * Only IDR frames are decoded, at most one per second, by a software decoder
+ * of its own with the loop filter skipped, on a frame_bus thread at the lowest
+ * scheduling priority. They are scaled down to a small JPEG, and the newest
+ * one is served over HTTP to any GET on the given port.
+ */
+
+#ifndef THUMBNAILER_H
+#define THUMBNAILER_H
+
+#include <stdint.h>
+#include "../lib/logger.h"
+#include "../lib/frame_bus.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define THUMBNAILER_DEFAULT_WIDTH 320
+
+typedef struct thumbnailer_s thumbnailer_t;
+
+typedef struct thumbnailer_stats_s {
+    uint64_t keyframes;
+    /* Keyframes decoded and encoded, the others came within a second of the last one */
+    uint64_t thumbnails;
+    uint64_t errors;
+    uint64_t requests;
+} thumbnailer_stats_t;
+
+thumbnailer_t *thumbnailer_init(logger_t *logger, unsigned short port, int width);
+/* Takes the codec and video frames of a frame_bus subscriber */
+void thumbnailer_process(thumbnailer_t *thumbnailer, const frame_bus_frame_t *frame);
+/* Forgets the last thumbnail when the session ends */
+void thumbnailer_clear(thumbnailer_t *thumbnailer);
+void thumbnailer_get_stats(thumbnailer_t *thumbnailer, thumbnailer_stats_t *stats);
+void thumbnailer_destroy(thumbnailer_t *thumbnailer);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //THUMBNAILER_H
@@ -0,0 +1,511 @@
+/**
+ * RPiPlay - An open-source AirPlay mirroring server for Raspberry Pi
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+#include "v4l2_output.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <linux/videodev2.h>
+
+#include <libavcodec/avcodec.h>
+#include <libswscale/swscale.h>
+
+#include "../lib/threads.h"
+
+/* Two buffers, one the consumer reads while the next is filled */
+#define V4L2_OUTPUT_BUFFERS 2
+#define MAX_PARAMETER_SETS_LEN 1024
+
+typedef struct {
+    void *start;
+    size_t length;
+} v4l2_output_buffer_t;
+
+struct v4l2_output_s {
+    logger_t *logger;
+    char *device;
+    int fd;
+    int fps;
+    bool h264;
+
+    /* Held while a frame is processed, each session's frame_bus has a thread of its own */
+    mutex_handle_t mutex;
+    AVCodecContext *decoder;
+    struct SwsContext *sws;
+    AVPacket *packet;
+    AVFrame *frame;
+    unsigned char parameter_sets[MAX_PARAMETER_SETS_LEN];
+    int parameter_sets_len;
+    /* The parameter sets go in front of the next frame handed to the decoder or device */
+    bool parameter_sets_pending;
+    /* Parameter sets followed by the frame, with the padding the decoder reads past the end */
+    unsigned char *input;
+    int input_size;
+    uint64_t last_written_pts;
+    bool have_last_written_pts;
+    bool lowered_priority;
+
+    /* Set once the first picture told the size, the device keeps it */
+    bool configured;
+    int width;
+    int height;
+    unsigned int bytesperline;
+    unsigned int sizeimage;
+    v4l2_output_buffer_t buffers[V4L2_OUTPUT_BUFFERS];
+    int buffer_count;
+    /* Buffers queued at least once, the others are free without a dequeue */
+    int buffers_used;
+    /* For devices without mmap streaming, and for H.264 */
+    unsigned char *picture;
+
+    uint64_t frames;
+    uint64_t written;
+    uint64_t skipped;
+    uint64_t errors;
+};
+
+static int
+v4l2_output_open_decoder(v4l2_output_t *output)
+{
+    static const char *decoders[] = { "h264_v4l2m2m", "h264" };
+
+    for (int i = 0; i < (int) (sizeof(decoders) / sizeof(decoders[0])); i++) {
+        const AVCodec *codec = avcodec_find_decoder_by_name(decoders[i]);
+        if (!codec || !(output->decoder = avcodec_alloc_context3(codec))) {
+            continue;
+        }
+        output->decoder->flags |= AV_CODEC_FLAG_LOW_DELAY;
+        if (avcodec_open2(output->decoder, codec, NULL) == 0) {
+            logger_log(output->logger, LOGGER_INFO, "v4l2_output decoding with %s", decoders[i]);
+            return 0;
+        }
+        avcodec_free_context(&output->decoder);
+    }
+    return -1;
+}
+
+/* Sets the device up for width x height pictures, or H.264 of that size, at the frame rate */
+static int
+v4l2_output_configure(v4l2_output_t *output, int width, int height)
+{
+    struct v4l2_format format;
+    struct v4l2_streamparm parm;
+    struct v4l2_requestbuffers request;
+
+    memset(&format, 0, sizeof(format));
+    format.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+    format.fmt.pix.width = width;
+    format.fmt.pix.height = height;
+    format.fmt.pix.field = V4L2_FIELD_NONE;
+    format.fmt.pix.colorspace = V4L2_COLORSPACE_REC709;
+    if (output->h264) {
+        format.fmt.pix.pixelformat = V4L2_PIX_FMT_H264;
+        // Room for a keyframe with its parameter sets
+        format.fmt.pix.sizeimage = width * height;
+    } else {
+        format.fmt.pix.pixelformat = V4L2_PIX_FMT_YUV420;
+        format.fmt.pix.bytesperline = width;
+        format.fmt.pix.sizeimage = width * height * 3 / 2;
+    }
+    if (ioctl(output->fd, VIDIOC_S_FMT, &format) < 0) {
+        logger_log(output->logger, LOGGER_ERR, "v4l2_output could not set %s to %dx%d: %s",
+                   output->device, width, height, strerror(errno));
+        return -1;
+    }
+    output->width = format.fmt.pix.width;
+    output->height = format.fmt.pix.height;
+    output->bytesperline = output->h264 ? 0 : format.fmt.pix.bytesperline;
+    output->sizeimage = format.fmt.pix.sizeimage;
+    if (!output->h264 && (output->width != width || output->height != height ||
+                          output->bytesperline < (unsigned int) width ||
+                          output->sizeimage < output->bytesperline * height * 3 / 2)) {
+        logger_log(output->logger, LOGGER_ERR, "v4l2_output %s does not take %dx%d YU12", output->device, width, height);
+        return -1;
+    }
+
+    // Consumers read at the rate the device announces
+    memset(&parm, 0, sizeof(parm));
+    parm.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+    parm.parm.output.timeperframe.numerator = 1;
+    parm.parm.output.timeperframe.denominator = output->fps;
+    ioctl(output->fd, VIDIOC_S_PARM, &parm);
+
+    memset(&request, 0, sizeof(request));
+    request.count = V4L2_OUTPUT_BUFFERS;
+    request.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+    request.memory = V4L2_MEMORY_MMAP;
+    if (!output->h264 && ioctl(output->fd, VIDIOC_REQBUFS, &request) == 0 && request.count > 0) {
+        output->buffer_count = request.count < V4L2_OUTPUT_BUFFERS ? request.count : V4L2_OUTPUT_BUFFERS;
+        for (int i = 0; i < output->buffer_count; i++) {
+            struct v4l2_buffer buffer;
+            memset(&buffer, 0, sizeof(buffer));
+            buffer.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+            buffer.memory = V4L2_MEMORY_MMAP;
+            buffer.index = i;
+            void *start = MAP_FAILED;
+            if (ioctl(output->fd, VIDIOC_QUERYBUF, &buffer) == 0) {
+                start = mmap(NULL, buffer.length, PROT_READ | PROT_WRITE, MAP_SHARED, output->fd, buffer.m.offset);
+            }
+            if (start == MAP_FAILED) {
+                output->buffer_count = i;
+                break;
+            }
+            output->buffers[i].start = start;
+            output->buffers[i].length = buffer.length;
+        }
+        enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+        if (output->buffer_count == 0 || ioctl(output->fd, VIDIOC_STREAMON, &type) < 0) {
+            for (int i = 0; i < output->buffer_count; i++) {
+                munmap(output->buffers[i].start, output->buffers[i].length);
+            }
+            output->buffer_count = 0;
+        }
+    }
+    if (output->buffer_count == 0) {
+        // Pictures are written with write() from a buffer of our own
+        if (!(output->picture = malloc(output->sizeimage))) {
+            return -1;
+        }
+    }
+    output->configured = true;
+    logger_log(output->logger, LOGGER_INFO, "v4l2_output writing %dx%d %s at %d fps to %s%s", output->width, output->height,
+               output->h264 ? "H.264" : "YU12", output->fps, output->device, output->buffer_count ? " through mmap'd buffers" : "");
+    return 0;
+}
+
+/* A buffer to fill, NULL if the consumer holds all of them */
+static unsigned char *
+v4l2_output_get_buffer(v4l2_output_t *output, int *index)
+{
+    if (output->buffer_count == 0) {
+        *index = -1;
+        return output->picture;
+    }
+    if (output->buffers_used < output->buffer_count) {
+        *index = output->buffers_used++;
+        return output->buffers[*index].start;
+    }
+    struct v4l2_buffer buffer;
+    memset(&buffer, 0, sizeof(buffer));
+    buffer.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+    buffer.memory = V4L2_MEMORY_MMAP;
+    if (ioctl(output->fd, VIDIOC_DQBUF, &buffer) < 0) {
+        return NULL;
+    }
+    *index = buffer.index;
+    return output->buffers[buffer.index].start;
+}
+
+static int
+v4l2_output_put_buffer(v4l2_output_t *output, int index, unsigned int size, uint64_t pts)
+{
+    if (index < 0) {
+        return write(output->fd, output->picture, size) == (ssize_t) size ? 0 : -1;
+    }
+    struct v4l2_buffer buffer;
+    memset(&buffer, 0, sizeof(buffer));
+    buffer.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+    buffer.memory = V4L2_MEMORY_MMAP;
+    buffer.index = index;
+    buffer.bytesused = size;
+    buffer.field = V4L2_FIELD_NONE;
+    buffer.timestamp.tv_sec = pts / 1000000;
+    buffer.timestamp.tv_usec = pts % 1000000;
+    return ioctl(output->fd, VIDIOC_QBUF, &buffer);
+}
+
+/* Scales frame into the YU12 picture at dst, letterboxed if its aspect ratio differs */
+static int
+v4l2_output_convert(v4l2_output_t *output, AVFrame *frame, unsigned char *dst)
+{
+    int width = output->width, height = output->height;
+    unsigned int stride = output->bytesperline;
+    unsigned char *y = dst;
+    unsigned char *u = y + stride * height;
+    unsigned char *v = u + stride / 2 * (height / 2);
+
+    if ((int64_t) frame->width * height > (int64_t) width * frame->height) {
+        height = (int) ((int64_t) frame->height * width / frame->width) & ~1;
+    } else {
+        width = (int) ((int64_t) frame->width * height / frame->height) & ~1;
+    }
+    if (width < 2 || height < 2) {
+        return -1;
+    }
+    int x = (output->width - width) / 2 & ~1;
+    int top = (output->height - height) / 2 & ~1;
+    if (width != output->width || height != output->height) {
+        // Black in limited range
+        memset(y, 16, stride * output->height);
+        memset(u, 128, stride / 2 * (output->height / 2) * 2);
+    }
+    output->sws = sws_getCachedContext(output->sws, frame->width, frame->height, frame->format,
+                                       width, height, AV_PIX_FMT_YUV420P, SWS_BILINEAR, NULL, NULL, NULL);
+    if (!output->sws) {
+        return -1;
+    }
+    uint8_t *planes[3] = {
+        y + top * stride + x,
+        u + top / 2 * (stride / 2) + x / 2,
+        v + top / 2 * (stride / 2) + x / 2
+    };
+    int linesizes[3] = { (int) stride, (int) stride / 2, (int) stride / 2 };
+    sws_scale(output->sws, (const uint8_t * const *) frame->data, frame->linesize, 0, frame->height, planes, linesizes);
+    return 0;
+}
+
+/* Whether a picture at pts is due, at most fps of them a second are written */
+static bool
+v4l2_output_due(v4l2_output_t *output, uint64_t pts)
+{
+    uint64_t interval = 1000000 / output->fps;
+    // A quarter interval of slack, so 60 fps sources give an even 30 and not a beat
+    return !output->have_last_written_pts || pts < output->last_written_pts ||
+           pts - output->last_written_pts >= interval - interval / 4;
+}
+
+static void
+v4l2_output_write_picture(v4l2_output_t *output, AVFrame *frame)
+{
+    unsigned char *dst;
+    int index;
+    uint64_t pts = frame->pts == AV_NOPTS_VALUE ? 0 : (uint64_t) frame->pts;
+
+    if (!v4l2_output_due(output, pts)) {
+        __atomic_fetch_add(&output->skipped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    if (!output->configured && v4l2_output_configure(output, frame->width & ~1, frame->height & ~1) < 0) {
+        __atomic_fetch_add(&output->errors, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    if (!(dst = v4l2_output_get_buffer(output, &index))) {
+        __atomic_fetch_add(&output->skipped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    if (v4l2_output_convert(output, frame, dst) < 0 ||
+        v4l2_output_put_buffer(output, index, output->bytesperline * output->height * 3 / 2, pts) < 0) {
+        __atomic_fetch_add(&output->errors, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    output->last_written_pts = pts;
+    output->have_last_written_pts = true;
+    __atomic_fetch_add(&output->written, 1, __ATOMIC_RELAXED);
+}
+
+/* The frame with the pending parameter sets in front, in output->input */
+static int
+v4l2_output_prepare_input(v4l2_output_t *output, const frame_bus_frame_t *frame)
+{
+    int prefix = output->parameter_sets_pending ? output->parameter_sets_len : 0;
+    int size = prefix + frame->data_len;
+
+    if (size + AV_INPUT_BUFFER_PADDING_SIZE > output->input_size) {
+        unsigned char *input = realloc(output->input, size + AV_INPUT_BUFFER_PADDING_SIZE);
+        if (!input) {
+            return -1;
+        }
+        output->input = input;
+        output->input_size = size + AV_INPUT_BUFFER_PADDING_SIZE;
+    }
+    memcpy(output->input, output->parameter_sets, prefix);
+    memcpy(output->input + prefix, frame->data, frame->data_len);
+    memset(output->input + size, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+    output->parameter_sets_pending = false;
+    return size;
+}
+
+static void
+v4l2_output_decode(v4l2_output_t *output, const frame_bus_frame_t *frame)
+{
+    int size = v4l2_output_prepare_input(output, frame);
+    int ret;
+
+    if (size < 0) {
+        return;
+    }
+    output->packet->data = output->input;
+    output->packet->size = size;
+    output->packet->pts = (int64_t) frame->pts;
+    ret = avcodec_send_packet(output->decoder, output->packet);
+    output->packet->data = NULL;
+    output->packet->size = 0;
+    if (ret < 0) {
+        __atomic_fetch_add(&output->errors, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    while (avcodec_receive_frame(output->decoder, output->frame) == 0) {
+        v4l2_output_write_picture(output, output->frame);
+        av_frame_unref(output->frame);
+    }
+}
+
+static void
+v4l2_output_pass_through(v4l2_output_t *output, const frame_bus_frame_t *frame)
+{
+    // Every keyframe carries the parameter sets, so a consumer can start at any of them
+    if (frame->keyframe) {
+        output->parameter_sets_pending = true;
+    }
+    // Frames can't be left out of a stream that is not decoded, so all of them are written
+    int size = v4l2_output_prepare_input(output, frame);
+    if (size < 0 || write(output->fd, output->input, size) != size) {
+        __atomic_fetch_add(&output->errors, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    __atomic_fetch_add(&output->written, 1, __ATOMIC_RELAXED);
+}
+
+static void
+v4l2_output_process_locked(v4l2_output_t *output, const frame_bus_frame_t *frame)
+{
+    // The decoder and the device are set up for H.264, HEVC sessions are not shown
+    if (frame->codec != VIDEO_CODEC_H264) {
+        return;
+    }
+    if (frame->kind == FRAME_BUS_CODEC) {
+        if (frame->data_len <= MAX_PARAMETER_SETS_LEN) {
+            memcpy(output->parameter_sets, frame->data, frame->data_len);
+            output->parameter_sets_len = frame->data_len;
+            output->parameter_sets_pending = true;
+        }
+        if (output->h264 && !output->configured && frame->width > 0 && frame->height > 0 &&
+            v4l2_output_configure(output, frame->width, frame->height) < 0) {
+            __atomic_fetch_add(&output->errors, 1, __ATOMIC_RELAXED);
+        }
+        return;
+    }
+    if (frame->kind != FRAME_BUS_VIDEO || !output->parameter_sets_len) {
+        return;
+    }
+    __atomic_fetch_add(&output->frames, 1, __ATOMIC_RELAXED);
+
+#if defined(__linux__)
+    if (!output->lowered_priority) {
+        // Only this thread, the display pipeline keeps its priority
+        setpriority(PRIO_PROCESS, (id_t) syscall(SYS_gettid), 19);
+        output->lowered_priority = true;
+    }
+#endif
+
+    if (output->h264) {
+        if (output->configured) {
+            v4l2_output_pass_through(output, frame);
+        }
+    } else {
+        v4l2_output_decode(output, frame);
+    }
+}
+
+void
+v4l2_output_process(v4l2_output_t *output, const frame_bus_frame_t *frame)
+{
+    MUTEX_LOCK(output->mutex);
+    v4l2_output_process_locked(output, frame);
+    MUTEX_UNLOCK(output->mutex);
+}
+
+v4l2_output_t *
+v4l2_output_init(logger_t *logger, const char *device, int fps, bool h264)
+{
+    struct v4l2_capability capability;
+    v4l2_output_t *output = calloc(1, sizeof(v4l2_output_t));
+    if (!output) {
+        return NULL;
+    }
+    output->logger = logger;
+    output->fps = fps > 0 ? fps : V4L2_OUTPUT_DEFAULT_FPS;
+    output->h264 = h264;
+    output->device = strdup(device);
+    MUTEX_CREATE(output->mutex);
+
+    output->fd = open(device, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (output->fd < 0) {
+        logger_log(logger, LOGGER_ERR, "v4l2_output could not open %s: %s", device, strerror(errno));
+        v4l2_output_destroy(output);
+        return NULL;
+    }
+    memset(&capability, 0, sizeof(capability));
+    if (ioctl(output->fd, VIDIOC_QUERYCAP, &capability) < 0 ||
+        !((capability.capabilities & V4L2_CAP_DEVICE_CAPS ? capability.device_caps : capability.capabilities) &
+          V4L2_CAP_VIDEO_OUTPUT)) {
+        logger_log(logger, LOGGER_ERR, "v4l2_output %s is not a video output device, e.g. of v4l2loopback", device);
+        v4l2_output_destroy(output);
+        return NULL;
+    }
+    if (!h264 && (v4l2_output_open_decoder(output) < 0 || !(output->frame = av_frame_alloc()))) {
+        logger_log(logger, LOGGER_ERR, "v4l2_output could not set up an H.264 decoder");
+        v4l2_output_destroy(output);
+        return NULL;
+    }
+    if (!(output->packet = av_packet_alloc())) {
+        v4l2_output_destroy(output);
+        return NULL;
+    }
+    return output;
+}
+
+void
+v4l2_output_get_stats(v4l2_output_t *output, v4l2_output_stats_t *stats)
+{
+    stats->frames = __atomic_load_n(&output->frames, __ATOMIC_RELAXED);
+    stats->written = __atomic_load_n(&output->written, __ATOMIC_RELAXED);
+    stats->skipped = __atomic_load_n(&output->skipped, __ATOMIC_RELAXED);
+    stats->errors = __atomic_load_n(&output->errors, __ATOMIC_RELAXED);
+}
+
+void
+v4l2_output_destroy(v4l2_output_t *output)
+{
+    if (!output) {
+        return;
+    }
+    if (output->frames > 0) {
+        logger_log(output->logger, LOGGER_INFO, "v4l2_output wrote %llu of %llu frames, %llu skipped, %llu errors",
+                   (unsigned long long) output->written, (unsigned long long) output->frames,
+                   (unsigned long long) output->skipped, (unsigned long long) output->errors);
+    }
+    if (output->buffer_count > 0) {
+        enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+        ioctl(output->fd, VIDIOC_STREAMOFF, &type);
+        for (int i = 0; i < output->buffer_count; i++) {
+            munmap(output->buffers[i].start, output->buffers[i].length);
+        }
+    }
+    if (output->fd >= 0) {
+        close(output->fd);
+    }
+    sws_freeContext(output->sws);
+    avcodec_free_context(&output->decoder);
+    av_frame_free(&output->frame);
+    av_packet_free(&output->packet);
+    free(output->input);
+    free(output->picture);
+    free(output->device);
+    MUTEX_DESTROY(output->mutex);
+    free(output);
+}
@@ -0,0 +1,68 @@
+/**
+ * RPiPlay - An open-source AirPlay mirroring server for Raspberry Pi
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+/*
+ * The mirrored screen as a camera, written to a v4l2loopback device for
+ * video call apps on the same host. Every frame is decoded, on the V4L2
+ * memory-to-memory decoder where libavcodec has one, by a decoder of its own
+ * on a frame_bus thread at the lowest scheduling priority, so the display
+ * never waits for it. At most fps pictures a second are converted to YU12
+ * into the device's mmap'd buffers, the rest are decoded and left; the
+ * device keeps the size of the first one and later ones, e.g. after the
+ * sender rotated, are letterboxed into it. With h264 set the access units
+ * are written as they are, for consumers that take H.264 from the device.
+ */
+
+#ifndef V4L2_OUTPUT_H
+#define V4L2_OUTPUT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "../lib/logger.h"
+#include "../lib/frame_bus.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define V4L2_OUTPUT_DEFAULT_FPS 30
+
+typedef struct v4l2_output_s v4l2_output_t;
+
+typedef struct v4l2_output_stats_s {
+    uint64_t frames;
+    /* Pictures written to the device */
+    uint64_t written;
+    /* Pictures decoded but not written, as they came sooner than the frame rate allows
+     * or the device had no buffer free */
+    uint64_t skipped;
+    uint64_t errors;
+} v4l2_output_stats_t;
+
+/* Opens device, NULL if it is not a video output device */
+v4l2_output_t *v4l2_output_init(logger_t *logger, const char *device, int fps, bool h264);
+/* Takes the codec and video frames of a frame_bus subscriber */
+void v4l2_output_process(v4l2_output_t *output, const frame_bus_frame_t *frame);
+void v4l2_output_get_stats(v4l2_output_t *output, v4l2_output_stats_t *stats);
+void v4l2_output_destroy(v4l2_output_t *output);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //V4L2_OUTPUT_H
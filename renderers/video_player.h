@@ -0,0 +1,69 @@
+/**
+ * RPiPlay - An open-source AirPlay mirroring server for Raspberry Pi
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+/*
+ * Plays a video URL a sender handed over, typically HLS, with GStreamer's
+ * playbin: the receiver fetches the stream itself and decodes it with the
+ * highest ranked decoder, a hardware one where there is one, instead of the
+ * sender decoding, encoding and mirroring it. The picture goes to the sink
+ * the gstreamer video renderer is configured with. Times are in seconds.
+ * All functions may be called from any thread, they don't wait for the
+ * stream. Errors and the end of the stream are picked up as the state is
+ * polled, which senders do every second or so.
+ */
+
+#ifndef VIDEO_PLAYER_H
+#define VIDEO_PLAYER_H
+
+#include <stdbool.h>
+#include "../lib/logger.h"
+#include "video_renderer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct video_player_s video_player_t;
+
+typedef struct video_player_state_s {
+    /* 0 until known, e.g. for a live stream */
+    double duration;
+    double position;
+    /* 0 while paused, 1 while playing */
+    double rate;
+    /* Loaded far enough to show a picture and be sought in */
+    bool ready;
+} video_player_state_t;
+
+/* NULL if GStreamer has no playbin */
+video_player_t *video_player_init(logger_t *logger, video_renderer_config_t const *config);
+/* Replaces what is playing. Starts at start_seconds, or at start_fraction of the duration once that is known */
+void video_player_play(video_player_t *player, const char *url, double start_seconds, double start_fraction);
+void video_player_seek(video_player_t *player, double position);
+/* 0 pauses, anything else plays on at normal speed */
+void video_player_set_rate(video_player_t *player, double rate);
+void video_player_stop(video_player_t *player);
+/* Returns false while nothing plays, also once the stream ended or failed */
+bool video_player_get_state(video_player_t *player, video_player_state_t *state);
+void video_player_destroy(video_player_t *player);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //VIDEO_PLAYER_H
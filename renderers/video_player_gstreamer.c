@@ -0,0 +1,192 @@
+/**
+ * RPiPlay - An open-source AirPlay mirroring server for Raspberry Pi
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+#include "video_player.h"
+#include <stdlib.h>
+#include <gst/gst.h>
+
+extern const char *video_renderer_gstreamer_sink_element(logger_t *logger, video_sink_t configured);
+
+struct video_player_s {
+    logger_t *logger;
+    GstElement *playbin;
+    GstBus *bus;
+    /* Guards everything below and the state changes of playbin */
+    GMutex mutex;
+    bool playing;
+    bool paused;
+    /* Prerolled since the last play, seek or unpause */
+    bool ready;
+    /* Where to seek to once playbin prerolled, 0 for the start */
+    double start_seconds;
+    double start_fraction;
+};
+
+video_player_t *video_player_init(logger_t *logger, video_renderer_config_t const *config) {
+    video_player_t *player;
+    GstElement *sink;
+
+    gst_init(NULL, NULL);
+    player = calloc(1, sizeof(video_player_t));
+    if (!player) {
+        return NULL;
+    }
+    player->logger = logger;
+    player->playbin = gst_element_factory_make("playbin", "video_player");
+    if (!player->playbin) {
+        logger_log(logger, LOGGER_ERR, "GStreamer has no playbin, video URLs can't be played");
+        free(player);
+        return NULL;
+    }
+    sink = gst_element_factory_make(video_renderer_gstreamer_sink_element(logger, config->sink), NULL);
+    if (sink) {
+        g_object_set(player->playbin, "video-sink", sink, NULL);
+    }
+    player->bus = gst_element_get_bus(player->playbin);
+    g_mutex_init(&player->mutex);
+    return player;
+}
+
+static void video_player_seek_to(video_player_t *player, double position) {
+    if (!gst_element_seek_simple(player->playbin, GST_FORMAT_TIME, GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_KEY_UNIT,
+                                 (gint64) (position * GST_SECOND))) {
+        logger_log(player->logger, LOGGER_WARNING, "Could not seek the video URL to %.1f s", position);
+    }
+}
+
+/* Takes what the pipeline posted since the last poll. Called with the mutex held */
+static void video_player_poll_bus(video_player_t *player) {
+    GstMessage *message;
+
+    while ((message = gst_bus_pop_filtered(player->bus, GST_MESSAGE_ERROR | GST_MESSAGE_EOS | GST_MESSAGE_ASYNC_DONE))) {
+        switch (GST_MESSAGE_TYPE(message)) {
+        case GST_MESSAGE_ERROR: {
+            GError *error = NULL;
+            gst_message_parse_error(message, &error, NULL);
+            logger_log(player->logger, LOGGER_ERR, "Video URL playback failed: %s", error ? error->message : "unknown error");
+            g_clear_error(&error);
+            gst_element_set_state(player->playbin, GST_STATE_NULL);
+            player->playing = false;
+            break;
+        }
+        case GST_MESSAGE_EOS:
+            logger_log(player->logger, LOGGER_INFO, "Video URL played to its end");
+            gst_element_set_state(player->playbin, GST_STATE_NULL);
+            player->playing = false;
+            break;
+        case GST_MESSAGE_ASYNC_DONE:
+            player->ready = true;
+            if (player->start_seconds > 0 || player->start_fraction > 0) {
+                gint64 duration = 0;
+                double position = player->start_seconds;
+                if (position <= 0 && gst_element_query_duration(player->playbin, GST_FORMAT_TIME, &duration) && duration > 0) {
+                    position = player->start_fraction * duration / GST_SECOND;
+                }
+                player->start_seconds = 0;
+                player->start_fraction = 0;
+                if (position > 0) video_player_seek_to(player, position);
+            }
+            break;
+        default:
+            break;
+        }
+        gst_message_unref(message);
+    }
+}
+
+void video_player_play(video_player_t *player, const char *url, double start_seconds, double start_fraction) {
+    g_mutex_lock(&player->mutex);
+    gst_element_set_state(player->playbin, GST_STATE_NULL);
+    // Messages of what played before
+    gst_bus_set_flushing(player->bus, TRUE);
+    gst_bus_set_flushing(player->bus, FALSE);
+    g_object_set(player->playbin, "uri", url, NULL);
+    player->start_seconds = start_seconds;
+    player->start_fraction = start_fraction;
+    player->ready = false;
+    player->paused = false;
+    player->playing = gst_element_set_state(player->playbin, GST_STATE_PLAYING) != GST_STATE_CHANGE_FAILURE;
+    if (!player->playing) {
+        logger_log(player->logger, LOGGER_ERR, "Could not start playing the video URL");
+    }
+    g_mutex_unlock(&player->mutex);
+}
+
+void video_player_seek(video_player_t *player, double position) {
+    g_mutex_lock(&player->mutex);
+    if (player->playing) {
+        if (player->ready) {
+            player->ready = false;
+            video_player_seek_to(player, position);
+        } else {
+            // Not prerolled yet, seeking now would be lost
+            player->start_seconds = position;
+            player->start_fraction = 0;
+        }
+    }
+    g_mutex_unlock(&player->mutex);
+}
+
+void video_player_set_rate(video_player_t *player, double rate) {
+    g_mutex_lock(&player->mutex);
+    if (player->playing && (rate == 0) != player->paused) {
+        player->paused = rate == 0;
+        gst_element_set_state(player->playbin, player->paused ? GST_STATE_PAUSED : GST_STATE_PLAYING);
+    }
+    g_mutex_unlock(&player->mutex);
+}
+
+void video_player_stop(video_player_t *player) {
+    g_mutex_lock(&player->mutex);
+    if (player->playing) {
+        gst_element_set_state(player->playbin, GST_STATE_NULL);
+        player->playing = false;
+    }
+    g_mutex_unlock(&player->mutex);
+}
+
+bool video_player_get_state(video_player_t *player, video_player_state_t *state) {
+    gint64 duration = 0, position = 0;
+    bool playing;
+
+    g_mutex_lock(&player->mutex);
+    video_player_poll_bus(player);
+    playing = player->playing;
+    if (playing) {
+        if (gst_element_query_duration(player->playbin, GST_FORMAT_TIME, &duration) && duration > 0) {
+            state->duration = (double) duration / GST_SECOND;
+        }
+        if (gst_element_query_position(player->playbin, GST_FORMAT_TIME, &position) && position > 0) {
+            state->position = (double) position / GST_SECOND;
+        }
+        state->rate = player->paused ? 0.0 : 1.0;
+        state->ready = player->ready;
+    }
+    g_mutex_unlock(&player->mutex);
+    return playing;
+}
+
+void video_player_destroy(video_player_t *player) {
+    if (player) {
+        gst_element_set_state(player->playbin, GST_STATE_NULL);
+        gst_object_unref(player->bus);
+        gst_object_unref(player->playbin);
+        g_mutex_clear(&player->mutex);
+        free(player);
+    }
+}
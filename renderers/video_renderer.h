@@ -30,10 +30,12 @@
 extern "C" {
 #endif
 
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include "../lib/logger.h"
 #include "../lib/raop_ntp.h"
+#include "../lib/stream.h"
 
 typedef enum background_mode_e {
     BACKGROUND_MODE_ON,   // Always show background
@@ -44,7 +46,10 @@ typedef enum background_mode_e {
 typedef enum video_renderer_type_e {
     VIDEO_RENDERER_DUMMY,
     VIDEO_RENDERER_RPI,
-    VIDEO_RENDERER_GSTREAMER
+    VIDEO_RENDERER_GSTREAMER,
+    VIDEO_RENDERER_KMS,
+    VIDEO_RENDERER_FFMPEG,
+    VIDEO_RENDERER_MMAL
 } video_renderer_type_t;
 
 typedef enum flip_mode_e {
@@ -54,18 +59,122 @@ typedef enum flip_mode_e {
     FLIP_BOTH
 } flip_mode_t;
 
+typedef enum video_sink_e {
+    VIDEO_SINK_AUTO, // autovideosink, rotation and flipping on the CPU
+    VIDEO_SINK_GL,   // glimagesink, colour conversion, rotation and flipping on the GPU
+    VIDEO_SINK_KMS,  // kmssink, imports DMABufs from hardware decoders
+    VIDEO_SINK_WAYLAND // waylandsink, hands DMABufs to the compositor and paces by its frame callbacks
+} video_sink_t;
+
+#define VIDEO_RENDERER_MAX_CLONES 3
+
+typedef struct video_renderer_clone_s {
+    /* dispmanx display number, e.g. 2 and 7 for the two HDMI ports of a Pi 4 */
+    int display;
+    int rotation;
+} video_renderer_clone_t;
+
 typedef struct video_renderer_config_s {
     background_mode_t background_mode;
     bool low_latency;
     int rotation;
     flip_mode_t flip;
+    /* Number and size in bytes of the decoder input buffers, 0 keeps the decoder's default */
+    int decoder_buffers;
+    int decoder_buffer_size;
+    /* Frames the decoder may hold back for reordering, -1 picks the default of the latency profile */
+    int reorder_depth;
+    /* Delay between a frame's pts and its presentation in ms (GStreamer renderer) */
+    int presentation_latency;
+    /* GStreamer decoder element, NULL or "auto" probes for a hardware decoder (GStreamer renderer) */
+    const char *decoder;
+    /* Video sink of the GStreamer renderer */
+    video_sink_t sink;
+    /* libavcodec hwaccel device type such as vaapi, vdpau or drm, NULL or "none" decodes on the CPU (ffmpeg renderer) */
+    const char *hwaccel;
+    /* Cell of a grid of tile_count that the video is shown in, for several senders at once.
+     * A tile_count of 0 or 1 is the whole screen (rpi and ffmpeg renderers) */
+    int tile;
+    int tile_count;
+    /* Further displays that show the same decoded picture, each with a rotation of its own (rpi renderer) */
+    int clone_count;
+    video_renderer_clone_t clones[VIDEO_RENDERER_MAX_CLONES];
+    /* Scale decoded frames down to the size they are shown at before they go any further (rpi renderer) */
+    bool downscale;
+    /* Switch the display to a refresh rate the stream's frame rate divides (rpi and kms renderers) */
+    bool match_refresh;
 } video_renderer_config_t;
 
+/* The part of a screen_w x screen_h screen that config's tile covers, in a grid as square as it gets */
+static inline void video_renderer_tile_rect(video_renderer_config_t const *config, int screen_w, int screen_h,
+                                            int *x, int *y, int *w, int *h) {
+    int columns = 1, rows;
+
+    while (columns * columns < config->tile_count) columns++;
+    rows = config->tile_count > 1 ? (config->tile_count + columns - 1) / columns : 1;
+    *w = screen_w / columns;
+    *h = screen_h / rows;
+    *x = (config->tile % columns) * *w;
+    *y = (config->tile / columns) * *h;
+}
+
+typedef struct video_renderer_stats_s {
+    /* Frames taken but not shown yet, including those inside the decoder */
+    unsigned int queued_frames;
+    /* Time from taking a frame to showing it in us, 0 if unknown */
+    uint64_t decoder_latency;
+    /* Frames the renderer dropped itself */
+    uint64_t dropped_frames;
+    /* Time from its pts until the latest frame was shown in us, for av_sync */
+    bool has_presentation_offset;
+    int64_t presentation_offset;
+    /* The renderer holds frames back until their pts plus its own latency */
+    bool paced;
+    /* Times the decoder reported corrupt input or failed to decode, counted from init. What it shows
+     * is smeared until the next IDR, so the mirror pipeline skips ahead to that */
+    uint64_t decode_errors;
+} video_renderer_stats_t;
+
+typedef struct video_renderer_caps_s {
+    /* Largest picture and frame rate the renderer can show */
+    int max_width;
+    int max_height;
+    int max_fps;
+    /* The renderer decodes H.265 fast enough to mirror in it, see set_codec */
+    bool hevc;
+} video_renderer_caps_t;
+
+typedef struct video_renderer_memory_s {
+    /* Heap memory of the renderer's own queues and buffers */
+    size_t host_bytes;
+    /* Decoder and display buffers outside the heap, on the GPU, in CMA or in the kernel */
+    size_t device_bytes;
+    /* Memory of the GPU the decoder runs on, and the part of it that is free, 0 if unknown */
+    size_t device_total;
+    size_t device_free;
+} video_renderer_memory_t;
+
 typedef struct video_renderer_s video_renderer_t;
 
+/**
+ * Called by the renderer once a frame is on screen, with its pts and the local time it showed up at,
+ * both in us on the clock of raop_ntp_get_local_time. Renderers call it from a thread of their own
+ * or from the one that renders, so it has to be cheap and must not call back into the renderer.
+ * Frames the renderer can't tell apart on the way to the screen aren't reported.
+ */
+typedef void (*video_renderer_presented_func_t)(void *cls, uint64_t pts, uint64_t display_time);
+
 typedef struct video_renderer_funcs_s {
     void (*start)(video_renderer_t *renderer);
-    void (*render_buffer)(video_renderer_t *renderer, raop_ntp_t *ntp, unsigned char *data, int data_len, uint64_t pts, int type);
+    /**
+     * Decode and display one frame
+     * @param nal_units where the NAL units in data start, so the renderer doesn't need to scan for them.
+     *        nal_count is 0 if the frame was not indexed.
+     * @return 0, or -1 if the decoder was too busy to take all of the frame. The caller should
+     *         then skip to the next IDR frame.
+     */
+    int (*render_buffer)(video_renderer_t *renderer, raop_ntp_t *ntp, unsigned char *data, int data_len, uint64_t pts, int type,
+                          const h264_nal_unit_t *nal_units, int nal_count);
     void (*flush)(video_renderer_t *renderer);
     void (*destroy)(video_renderer_t *renderer);
     /**
@@ -77,17 +186,98 @@ typedef struct video_renderer_funcs_s {
      *       -1: a connection lost
      */
     void (*update_background)(video_renderer_t *renderer, int type);
+    /**
+     * Optional zero-copy input, may be left NULL
+     * acquire_buffer returns writable decoder input memory of at least size bytes,
+     * or NULL if the renderer can't provide it and render_buffer should be used.
+     * An acquired buffer is either filled and passed to submit_buffer,
+     * or handed back unused through release_buffer.
+     */
+    unsigned char *(*acquire_buffer)(video_renderer_t *renderer, int size, void **handle);
+    void (*submit_buffer)(video_renderer_t *renderer, raop_ntp_t *ntp, void *handle, int data_len, uint64_t pts, int type,
+                          const h264_nal_unit_t *nal_units, int nal_count);
+    void (*release_buffer)(video_renderer_t *renderer, void *handle);
+    /* Optional, may be left NULL: log the renderer's counters, called from the main thread */
+    void (*log_stats)(video_renderer_t *renderer);
+    /**
+     * Optional, may be left NULL: like render_buffer, but takes over the caller's reference to frame,
+     * so the renderer can queue frame->data without copying it. The renderer drops the reference
+     * with stream_frame_unref once it is done with the data, which may be after this returns.
+     * nal_units is only valid during the call.
+     */
+    int (*render_frame)(video_renderer_t *renderer, raop_ntp_t *ntp, stream_frame_t *frame, int type,
+                        const h264_nal_unit_t *nal_units, int nal_count);
+    /**
+     * Optional, may be left NULL. get_stats is called from the thread that renders and has to be cheap,
+     * get_caps from the main thread. Both fill in what they know and leave the other fields alone.
+     */
+    void (*get_stats)(video_renderer_t *renderer, video_renderer_stats_t *stats);
+    void (*get_caps)(video_renderer_t *renderer, video_renderer_caps_t *caps);
+    /**
+     * Optional, may be left NULL by renderers that only decode H.264. Called from the thread that
+     * renders, before the codec data of a stream in another codec than the previous one.
+     * Frames queued for the old codec may be dropped.
+     */
+    void (*set_codec)(video_renderer_t *renderer, video_codec_t codec);
+    /**
+     * Optional, may be left NULL by renderers that can't change settings while running. Applies the
+     * rotation, flip and low_latency of config, the rest of it is as the renderer was created with.
+     * Called from the main thread while no frame is being rendered. A renderer that has to restart
+     * its decoder for it drops frames up to the next IDR after the next codec data.
+     */
+    void (*reconfigure)(video_renderer_t *renderer, video_renderer_config_t const *config);
+    /**
+     * Optional, may be left NULL by renderers that can't let go of their decoder. suspend releases the
+     * decoder and what it holds on the GPU while nobody is connected, but keeps what makes resume quicker
+     * than init. resume brings the renderer back to where start left it, it returns -1 if it can't.
+     * Both are only called while there is no session, or back to back while no frame is being rendered
+     * to rebuild a renderer that stopped taking frames, after which the session's frames go on.
+     */
+    void (*suspend)(video_renderer_t *renderer);
+    int (*resume)(video_renderer_t *renderer);
+    /**
+     * Optional, may be left NULL. Shows an RGBA image of width x height pixels, rows stride bytes apart,
+     * centred over the video or the background until the next call, rgba NULL hides it. The renderer
+     * copies the pixels. Only called from the now-playing worker, also while a stream is rendered.
+     */
+    void (*set_overlay)(video_renderer_t *renderer, const uint8_t *rgba, int width, int height, int stride);
+    /**
+     * Optional, may be left NULL by renderers whose decoder only takes whole frames. Takes a video frame
+     * in parts of whole NAL units as they arrive, part counting from 0, all with the frame's pts. The
+     * last part, which may be empty, ends the frame. nal_units are relative to this part's data.
+     * @return 0, or -1 like render_buffer, no more parts of the frame follow then.
+     */
+    int (*render_part)(video_renderer_t *renderer, raop_ntp_t *ntp, unsigned char *data, int data_len, uint64_t pts,
+                       const h264_nal_unit_t *nal_units, int nal_count, int part, bool last);
+    /* Optional, may be left NULL: what the renderer's buffers take, called while no frame is being rendered */
+    void (*get_memory)(video_renderer_t *renderer, video_renderer_memory_t *memory);
 } video_renderer_funcs_t;
 
 typedef struct video_renderer_s {
     video_renderer_funcs_t const *funcs;
     logger_t *logger;
     video_renderer_type_t type;
+    /* Set through video_renderer_set_presented before start, NULL if nobody asked */
+    video_renderer_presented_func_t presented;
+    void *presented_cls;
 } video_renderer_t;
 
+static inline void video_renderer_set_presented(video_renderer_t *renderer, video_renderer_presented_func_t func, void *cls) {
+    renderer->presented_cls = cls;
+    renderer->presented = func;
+}
+
+/* For the renderers, see video_renderer_presented_func_t */
+static inline void video_renderer_frame_presented(video_renderer_t *renderer, uint64_t pts, uint64_t display_time) {
+    if (renderer->presented && pts) renderer->presented(renderer->presented_cls, pts, display_time);
+}
+
 video_renderer_t *video_renderer_dummy_init(logger_t *logger, video_renderer_config_t const *config);
 video_renderer_t *video_renderer_rpi_init(logger_t *logger, video_renderer_config_t const *config);
+video_renderer_t *video_renderer_mmal_init(logger_t *logger, video_renderer_config_t const *config);
 video_renderer_t *video_renderer_gstreamer_init(logger_t *logger, video_renderer_config_t const *config);
+video_renderer_t *video_renderer_kms_init(logger_t *logger, video_renderer_config_t const *config);
+video_renderer_t *video_renderer_ffmpeg_init(logger_t *logger, video_renderer_config_t const *config);
 
 #ifdef __cplusplus
 }
@@ -17,6 +17,12 @@
  * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
  */
 
+/*
+ * Measurement sink: discards the video but counts frames, bytes, IDRs and NAL unit
+ * types and records when frames arrive, so the network and decryption side can be
+ * benchmarked without a display. The summary is logged on destroy and through log_stats.
+ */
+
 #include "video_renderer.h"
 
 #include <stdlib.h>
@@ -26,8 +32,22 @@
 #include <stdbool.h>
 #include <unistd.h>
 
+#include "../lib/threads.h"
+#include "arrival_stats.h"
+
+#define NAL_TYPES 32
+
 typedef struct video_renderer_dummy_s {
     video_renderer_t base;
+
+    /* render_buffer runs on the mirror thread, log_stats on the main thread */
+    mutex_handle_t stats_mutex;
+    arrival_stats_t arrival;
+    uint64_t idr_frames;
+    uint64_t codec_configs;
+    uint64_t unindexed_frames;
+    uint64_t flushes;
+    uint64_t nal_units[NAL_TYPES];
 } video_renderer_dummy_t;
 
 static const video_renderer_funcs_t video_renderer_dummy_funcs;
@@ -41,20 +61,100 @@ video_renderer_t *video_renderer_dummy_init(logger_t *logger, video_renderer_con
     renderer->base.logger = logger;
     renderer->base.funcs = &video_renderer_dummy_funcs;
     renderer->base.type = VIDEO_RENDERER_DUMMY;
+    MUTEX_CREATE(renderer->stats_mutex);
     return &renderer->base;
 }
 
 static void video_renderer_dummy_start(video_renderer_t *renderer) {
 }
 
-static void video_renderer_dummy_render_buffer(video_renderer_t *renderer, raop_ntp_t *ntp, unsigned char *data, int data_len, uint64_t pts, int type) {
+/* Finds the NAL units of a frame the mirror didn't index, data uses 4 byte start codes */
+static void video_renderer_dummy_count_nal_units(video_renderer_dummy_t *r, const unsigned char *data, int data_len) {
+    for (int i = 0; i + 4 < data_len; i++) {
+        if (data[i] == 0 && data[i + 1] == 0 && data[i + 2] == 0 && data[i + 3] == 1) {
+            int nal_type = data[i + 4] & 0x1f;
+            r->nal_units[nal_type]++;
+            if (nal_type == 5) r->idr_frames++;
+            i += 4;
+        }
+    }
+}
+
+static int video_renderer_dummy_render_buffer(video_renderer_t *renderer, raop_ntp_t *ntp, unsigned char *data, int data_len, uint64_t pts, int type,
+                                              const h264_nal_unit_t *nal_units, int nal_count) {
+    video_renderer_dummy_t *r = (video_renderer_dummy_t *) renderer;
+    uint64_t arrival = raop_ntp_get_local_time(ntp);
+    bool idr = false;
+
+    MUTEX_LOCK(r->stats_mutex);
+    if (type == 0) {
+        // SPS and PPS, not a frame
+        r->codec_configs++;
+        r->nal_units[7]++;
+        r->nal_units[8]++;
+        MUTEX_UNLOCK(r->stats_mutex);
+        return 0;
+    }
+    if (nal_count == 0) {
+        r->unindexed_frames++;
+        video_renderer_dummy_count_nal_units(r, data, data_len);
+    }
+    for (int i = 0; i < nal_count; i++) {
+        r->nal_units[nal_units[i].nal_type & 0x1f]++;
+        if (nal_units[i].nal_type == 5) idr = true;
+    }
+    if (idr) r->idr_frames++;
+    arrival_stats_add(&r->arrival, arrival, pts, data_len);
+    MUTEX_UNLOCK(r->stats_mutex);
+    return 0;
+}
+
+static void video_renderer_dummy_log_stats(video_renderer_t *renderer) {
+    video_renderer_dummy_t *r = (video_renderer_dummy_t *) renderer;
+    char nal_counts[512];
+    int len = 0;
+
+    MUTEX_LOCK(r->stats_mutex);
+    arrival_stats_log(&r->arrival, renderer->logger, "Video");
+    logger_log(renderer->logger, LOGGER_INFO, "Video: %llu IDR frames, %llu SPS/PPS, %llu frames not indexed, %llu flushes",
+               (unsigned long long) r->idr_frames, (unsigned long long) r->codec_configs,
+               (unsigned long long) r->unindexed_frames, (unsigned long long) r->flushes);
+    for (int i = 0; i < NAL_TYPES && len < sizeof(nal_counts); i++) {
+        if (r->nal_units[i]) {
+            len += snprintf(nal_counts + len, sizeof(nal_counts) - len, " %d:%llu", i, (unsigned long long) r->nal_units[i]);
+        }
+    }
+    MUTEX_UNLOCK(r->stats_mutex);
+    logger_log(renderer->logger, LOGGER_INFO, "Video: NAL units by type%s", len ? nal_counts : " none");
 }
 
 static void video_renderer_dummy_flush(video_renderer_t *renderer) {
+    video_renderer_dummy_t *r = (video_renderer_dummy_t *) renderer;
+    MUTEX_LOCK(r->stats_mutex);
+    r->flushes++;
+    MUTEX_UNLOCK(r->stats_mutex);
+}
+
+/* Nothing to apply, logged so a reload can be followed without a display */
+static void video_renderer_dummy_reconfigure(video_renderer_t *renderer, video_renderer_config_t const *config) {
+    logger_log(renderer->logger, LOGGER_DEBUG, "Video: rotation %d, flip %d, low latency %s",
+               config->rotation, (int) config->flip, config->low_latency ? "on" : "off");
+}
+
+static void video_renderer_dummy_suspend(video_renderer_t *renderer) {
+    logger_log(renderer->logger, LOGGER_DEBUG, "Video: suspended");
+}
+
+static int video_renderer_dummy_resume(video_renderer_t *renderer) {
+    logger_log(renderer->logger, LOGGER_DEBUG, "Video: resumed");
+    return 0;
 }
 
 static void video_renderer_dummy_destroy(video_renderer_t *renderer) {
     if (renderer) {
+        video_renderer_dummy_t *r = (video_renderer_dummy_t *) renderer;
+        video_renderer_dummy_log_stats(renderer);
+        MUTEX_DESTROY(r->stats_mutex);
         free(renderer);
     }
 }
@@ -69,4 +169,8 @@ static const video_renderer_funcs_t video_renderer_dummy_funcs = {
     .flush = video_renderer_dummy_flush,
     .destroy = video_renderer_dummy_destroy,
     .update_background = video_renderer_dummy_update_background,
+    .log_stats = video_renderer_dummy_log_stats,
+    .reconfigure = video_renderer_dummy_reconfigure,
+    .suspend = video_renderer_dummy_suspend,
+    .resume = video_renderer_dummy_resume,
 };
@@ -0,0 +1,737 @@
+/**
+ * RPiPlay - An open-source AirPlay mirroring server for Raspberry Pi
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+/*
+ * H264 renderer using libavcodec for decoding and SDL2 for display.
+ * Decoding uses slice threading and AV_CODEC_FLAG_LOW_DELAY, so a frame
+ * leaves the decoder as soon as it has been decoded instead of after one
+ * frame of delay per frame thread. A VAAPI, VDPAU or DRM hwaccel can be
+ * used instead, its frames are copied back for display.
+ * Frames are decoded on the mirror thread and the newest one is handed to
+ * a display thread, which owns all SDL state.
+ */
+
+#include "video_renderer.h"
+
+#include <stdlib.h>
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include <libavcodec/avcodec.h>
+#include <libavutil/hwcontext.h>
+#include <libavutil/pixdesc.h>
+#include <SDL.h>
+
+#include "../lib/threads.h"
+#include "../lib/trace.h"
+
+/* How long the display thread sleeps between checks for window events and shutdown */
+#define DISPLAY_WAIT_MS 100
+
+typedef struct video_renderer_ffmpeg_s {
+    video_renderer_t base;
+    video_renderer_config_t const *config;
+
+    /* Decoder state, used by whoever holds decode_mutex */
+    AVCodecContext *codec_context;
+    AVBufferRef *hw_device;
+    enum AVPixelFormat hw_format;
+    AVPacket *packet;
+    AVFrame *frame;
+    AVFrame *sw_frame;
+    mutex_handle_t decode_mutex;
+
+    /* Newest decoded frame waiting for the display thread, protected by display_mutex */
+    AVFrame *pending;
+    bool have_pending;
+    bool clear;
+    bool window_visible;
+    int background_visits;
+    bool running;
+    /* As configured, or as reconfigure changed them since */
+    int rotation;
+    flip_mode_t flip;
+    /* Overlay pixels, kept for a display thread started by resume, and whether the display thread has them yet */
+    unsigned char *overlay;
+    int overlay_width;
+    int overlay_height;
+    bool overlay_changed;
+    /* Time from its pts until the latest frame was shown */
+    bool has_presentation_offset;
+    int64_t presentation_offset;
+    mutex_handle_t display_mutex;
+    cond_handle_t display_cond;
+    thread_handle_t thread;
+
+    uint64_t input_frames;
+    uint64_t decode_errors;
+    uint64_t frames_decoded;
+    uint64_t frames_replaced;
+    uint64_t frames_shown;
+    /* Moving average of the time a packet spends in the decoder in us, written under decode_mutex */
+    uint64_t decode_time;
+
+    /* Desktop size and refresh rate when the renderer started */
+    SDL_DisplayMode display_mode;
+} video_renderer_ffmpeg_t;
+
+static const video_renderer_funcs_t video_renderer_ffmpeg_funcs;
+
+static enum AVPixelFormat video_renderer_ffmpeg_get_format(AVCodecContext *context, const enum AVPixelFormat *formats) {
+    video_renderer_ffmpeg_t *r = context->opaque;
+
+    for (const enum AVPixelFormat *format = formats; *format != AV_PIX_FMT_NONE; format++) {
+        if (*format == r->hw_format) return *format;
+    }
+    logger_log(r->base.logger, LOGGER_WARNING, "The hwaccel can't decode this stream, decoding on the CPU");
+    return avcodec_default_get_format(context, formats);
+}
+
+static int video_renderer_ffmpeg_init_hwaccel(video_renderer_ffmpeg_t *r, const AVCodec *codec, const char *name) {
+    enum AVHWDeviceType type = av_hwdevice_find_type_by_name(name);
+    int ret;
+
+    if (type == AV_HWDEVICE_TYPE_NONE) {
+        logger_log(r->base.logger, LOGGER_ERR, "Unknown hwaccel %s", name);
+        return -1;
+    }
+    r->hw_format = AV_PIX_FMT_NONE;
+    for (int i = 0;; i++) {
+        const AVCodecHWConfig *hw_config = avcodec_get_hw_config(codec, i);
+        if (!hw_config) break;
+        if ((hw_config->methods & AV_CODEC_HW_CONFIG_METHOD_HW_DEVICE_CTX) && hw_config->device_type == type) {
+            r->hw_format = hw_config->pix_fmt;
+            break;
+        }
+    }
+    if (r->hw_format == AV_PIX_FMT_NONE) {
+        logger_log(r->base.logger, LOGGER_ERR, "The %s decoder does not support the %s hwaccel", codec->name, name);
+        return -1;
+    }
+    if ((ret = av_hwdevice_ctx_create(&r->hw_device, type, NULL, NULL, 0)) < 0) {
+        logger_log(r->base.logger, LOGGER_ERR, "Could not open the %s device: %s", name, av_err2str(ret));
+        return -1;
+    }
+    r->codec_context->hw_device_ctx = av_buffer_ref(r->hw_device);
+    r->codec_context->get_format = video_renderer_ffmpeg_get_format;
+    logger_log(r->base.logger, LOGGER_INFO, "Decoding video with the %s hwaccel", name);
+    return 0;
+}
+
+/* The codec context and its hwaccel device, all that suspend lets go of */
+static int video_renderer_ffmpeg_open_codec(video_renderer_ffmpeg_t *r) {
+    const AVCodec *codec;
+    int ret;
+
+    if (!(codec = avcodec_find_decoder(AV_CODEC_ID_H264))) {
+        logger_log(r->base.logger, LOGGER_ERR, "libavcodec has no H.264 decoder");
+        return -1;
+    }
+    if (!(r->codec_context = avcodec_alloc_context3(codec))) return -1;
+    r->codec_context->opaque = r;
+
+    // Frame threads each hold a frame back, slice threads split one frame and add no delay
+    r->codec_context->thread_count = 0;
+    r->codec_context->thread_type = FF_THREAD_SLICE;
+    r->codec_context->flags |= AV_CODEC_FLAG_LOW_DELAY;
+    r->codec_context->flags2 |= AV_CODEC_FLAG2_FAST;
+
+    if (r->config->hwaccel && strcmp(r->config->hwaccel, "none") &&
+        video_renderer_ffmpeg_init_hwaccel(r, codec, r->config->hwaccel) < 0) {
+        logger_log(r->base.logger, LOGGER_WARNING, "Falling back to decoding on the CPU");
+    }
+
+    if ((ret = avcodec_open2(r->codec_context, codec, NULL)) < 0) {
+        logger_log(r->base.logger, LOGGER_ERR, "Could not open the H.264 decoder: %s", av_err2str(ret));
+        return -1;
+    }
+    return 0;
+}
+
+static int video_renderer_ffmpeg_init_decoder(video_renderer_ffmpeg_t *r) {
+    if (video_renderer_ffmpeg_open_codec(r) < 0) return -1;
+    r->packet = av_packet_alloc();
+    r->frame = av_frame_alloc();
+    r->sw_frame = av_frame_alloc();
+    r->pending = av_frame_alloc();
+    if (!r->packet || !r->frame || !r->sw_frame || !r->pending) return -1;
+    return 0;
+}
+
+/* Hands the decoded frame over to the display thread, replacing one it hasn't shown yet */
+static void video_renderer_ffmpeg_queue_frame(video_renderer_ffmpeg_t *r, AVFrame *frame) {
+    MUTEX_LOCK(r->display_mutex);
+    if (r->have_pending) {
+        av_frame_unref(r->pending);
+        r->frames_replaced++;
+    }
+    av_frame_move_ref(r->pending, frame);
+    r->have_pending = true;
+    COND_SIGNAL(r->display_cond);
+    MUTEX_UNLOCK(r->display_mutex);
+}
+
+static uint64_t video_renderer_ffmpeg_now_us(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (uint64_t) time.tv_sec * 1000000 + time.tv_nsec / 1000;
+}
+
+/* Must be called with decode_mutex held */
+static int video_renderer_ffmpeg_decode(video_renderer_ffmpeg_t *r, AVPacket *packet) {
+    uint64_t start = video_renderer_ffmpeg_now_us();
+    int ret = avcodec_send_packet(r->codec_context, packet);
+    if (ret < 0) {
+        r->decode_errors++;
+        logger_log(r->base.logger, LOGGER_DEBUG, "Decoder rejected %d bytes: %s", packet->size, av_err2str(ret));
+        return 0;
+    }
+    while ((ret = avcodec_receive_frame(r->codec_context, r->frame)) == 0) {
+        r->frames_decoded++;
+        if (r->frame->decode_error_flags) {
+            // Concealed, but whatever went missing stays missing until the next IDR
+            r->decode_errors++;
+        }
+        if (r->frame->format == r->hw_format && r->hw_device) {
+            // SDL can't show hwaccel surfaces, copy the frame back
+            ret = av_hwframe_transfer_data(r->sw_frame, r->frame, 0);
+            av_frame_unref(r->frame);
+            if (ret < 0) {
+                r->decode_errors++;
+                continue;
+            }
+            video_renderer_ffmpeg_queue_frame(r, r->sw_frame);
+        } else {
+            video_renderer_ffmpeg_queue_frame(r, r->frame);
+        }
+    }
+    r->decode_time = (r->decode_time * 7 + (video_renderer_ffmpeg_now_us() - start)) / 8;
+    return 0;
+}
+
+static SDL_Texture *video_renderer_ffmpeg_update_texture(video_renderer_ffmpeg_t *r, SDL_Renderer *sdl_renderer,
+                                                         SDL_Texture *texture, int *texture_format,
+                                                         int *texture_width, int *texture_height, AVFrame *frame) {
+    Uint32 format;
+
+    switch (frame->format) {
+    case AV_PIX_FMT_YUV420P:
+    case AV_PIX_FMT_YUVJ420P:
+        format = SDL_PIXELFORMAT_IYUV;
+        break;
+    case AV_PIX_FMT_NV12:
+        format = SDL_PIXELFORMAT_NV12;
+        break;
+    default:
+        logger_log(r->base.logger, LOGGER_ERR, "Can't show frames in %s format", av_get_pix_fmt_name(frame->format));
+        return texture;
+    }
+
+    // A smaller picture goes into the corner of the texture there is, see video_renderer_ffmpeg_draw
+    int allocated_w = 0, allocated_h = 0;
+    if (texture) SDL_QueryTexture(texture, NULL, NULL, &allocated_w, &allocated_h);
+    if (!texture || *texture_format != frame->format || allocated_w < frame->width || allocated_h < frame->height) {
+        int w = frame->width, h = frame->height;
+        if (texture && *texture_format == frame->format) {
+            // The size changed, most likely as the sender rotated. A square texture takes it turning back as well.
+            w = h = w > h ? w : h;
+        }
+        if (texture) SDL_DestroyTexture(texture);
+        texture = SDL_CreateTexture(sdl_renderer, format, SDL_TEXTUREACCESS_STREAMING, w, h);
+        if (!texture) {
+            logger_log(r->base.logger, LOGGER_ERR, "Could not create a %dx%d texture: %s", w, h, SDL_GetError());
+            return NULL;
+        }
+        *texture_format = frame->format;
+    }
+    if (*texture_width != frame->width || *texture_height != frame->height) {
+        if (*texture_width) {
+            logger_log(r->base.logger, LOGGER_INFO, "Video size changed from %dx%d to %dx%d",
+                       *texture_width, *texture_height, frame->width, frame->height);
+        }
+        *texture_width = frame->width;
+        *texture_height = frame->height;
+    }
+
+    SDL_Rect rect = { 0, 0, frame->width, frame->height };
+    if (format == SDL_PIXELFORMAT_IYUV) {
+        SDL_UpdateYUVTexture(texture, &rect, frame->data[0], frame->linesize[0], frame->data[1], frame->linesize[1],
+                             frame->data[2], frame->linesize[2]);
+    } else {
+        SDL_UpdateNVTexture(texture, &rect, frame->data[0], frame->linesize[0], frame->data[1], frame->linesize[1]);
+    }
+    return texture;
+}
+
+/* Draws the overlay centred in the window, scaled down if it does not fit */
+static void video_renderer_ffmpeg_draw_overlay(SDL_Renderer *sdl_renderer, SDL_Texture *overlay, int width, int height) {
+    int window_w, window_h;
+    SDL_Rect dst;
+
+    SDL_GetRendererOutputSize(sdl_renderer, &window_w, &window_h);
+    dst.w = width;
+    dst.h = height;
+    if (dst.w > window_w) {
+        dst.h = (int) ((int64_t) dst.h * window_w / dst.w);
+        dst.w = window_w;
+    }
+    if (dst.h > window_h) {
+        dst.w = (int) ((int64_t) dst.w * window_h / dst.h);
+        dst.h = window_h;
+    }
+    dst.x = (window_w - dst.w) / 2;
+    dst.y = (window_h - dst.h) / 2;
+    SDL_RenderCopy(sdl_renderer, overlay, NULL, &dst);
+}
+
+/* Draws the width x height picture in the top left corner of the texture as large as fits the window, rotated
+ * and flipped, or only the background without one, and the overlay on top */
+static void video_renderer_ffmpeg_draw(SDL_Renderer *sdl_renderer, SDL_Texture *texture, int width, int height,
+                                       int rotation, flip_mode_t flip_mode,
+                                       SDL_Texture *overlay, int overlay_width, int overlay_height) {
+    int window_w, window_h;
+    rotation = ((rotation % 360) + 360) % 360;
+    bool sideways = rotation == 90 || rotation == 270;
+    int shown_w = sideways ? height : width, shown_h = sideways ? width : height;
+    int flip = SDL_FLIP_NONE;
+    SDL_Rect dst;
+
+    SDL_GetRendererOutputSize(sdl_renderer, &window_w, &window_h);
+    if ((int64_t) shown_w * window_h > (int64_t) shown_h * window_w) {
+        dst.w = window_w;
+        dst.h = (int) ((int64_t) shown_h * window_w / shown_w);
+    } else {
+        dst.h = window_h;
+        dst.w = (int) ((int64_t) shown_w * window_h / shown_h);
+    }
+    // SDL rotates around the centre of dst, which is given in unrotated orientation
+    if (sideways) {
+        int w = dst.w;
+        dst.w = dst.h;
+        dst.h = w;
+    }
+    dst.x = (window_w - dst.w) / 2;
+    dst.y = (window_h - dst.h) / 2;
+
+    if (flip_mode == FLIP_HORIZONTAL || flip_mode == FLIP_BOTH) flip |= SDL_FLIP_HORIZONTAL;
+    if (flip_mode == FLIP_VERTICAL || flip_mode == FLIP_BOTH) flip |= SDL_FLIP_VERTICAL;
+
+    SDL_SetRenderDrawColor(sdl_renderer, 0, 0, 0, 255);
+    SDL_RenderClear(sdl_renderer);
+    SDL_Rect src = { 0, 0, width, height };
+    if (texture) SDL_RenderCopyEx(sdl_renderer, texture, &src, &dst, rotation, NULL, (SDL_RendererFlip) flip);
+    if (overlay) video_renderer_ffmpeg_draw_overlay(sdl_renderer, overlay, overlay_width, overlay_height);
+    SDL_RenderPresent(sdl_renderer);
+}
+
+static THREAD_RETVAL video_renderer_ffmpeg_thread(void *arg) {
+    video_renderer_ffmpeg_t *r = arg;
+    SDL_Window *window;
+    SDL_Renderer *sdl_renderer;
+    SDL_Texture *texture = NULL;
+    int texture_format = AV_PIX_FMT_NONE, texture_width = 0, texture_height = 0;
+    SDL_Texture *overlay_texture = NULL;
+    int overlay_width = 0, overlay_height = 0;
+    AVFrame *frame = av_frame_alloc();
+    bool visible = false;
+    // The texture holds the frame on screen, the overlay is drawn over it again when it changes
+    bool video_shown = false;
+
+    if (r->config->tile_count > 1 && r->display_mode.w > 0 && r->display_mode.h > 0) {
+        // A borderless window over this renderer's cell when several senders are shown at once
+        int x, y, w, h;
+        video_renderer_tile_rect(r->config, r->display_mode.w, r->display_mode.h, &x, &y, &w, &h);
+        window = SDL_CreateWindow("RPiPlay", x, y, w, h, SDL_WINDOW_BORDERLESS | SDL_WINDOW_HIDDEN);
+    } else {
+        window = SDL_CreateWindow("RPiPlay", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, 1280, 720,
+                                  SDL_WINDOW_FULLSCREEN_DESKTOP | SDL_WINDOW_HIDDEN);
+    }
+    sdl_renderer = window ? SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC) : NULL;
+    if (!sdl_renderer || !frame) {
+        logger_log(r->base.logger, LOGGER_ERR, "Could not create the video window: %s", SDL_GetError());
+        if (window) SDL_DestroyWindow(window);
+        av_frame_free(&frame);
+        return 0;
+    }
+
+    MUTEX_LOCK(r->display_mutex);
+    r->overlay_changed = r->overlay != NULL;
+    while (r->running) {
+        struct timespec deadline;
+        bool have_frame = false, clear = false, overlay_changed = false;
+        unsigned char *overlay = NULL;
+        uint64_t shown_pts = 0;
+
+        if (!r->have_pending && !r->clear && !r->overlay_changed && visible == (r->window_visible || r->overlay)) {
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += DISPLAY_WAIT_MS * 1000000L;
+            deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+            deadline.tv_nsec %= 1000000000L;
+            COND_TIMEDWAIT(r->display_cond, r->display_mutex, deadline);
+        }
+        if (r->have_pending) {
+            av_frame_move_ref(frame, r->pending);
+            r->have_pending = false;
+            have_frame = true;
+        }
+        clear = r->clear;
+        r->clear = false;
+        if (r->overlay_changed) {
+            r->overlay_changed = false;
+            overlay_changed = true;
+            overlay_width = r->overlay_width;
+            overlay_height = r->overlay_height;
+            if (r->overlay && (overlay = malloc((size_t) overlay_width * overlay_height * 4))) {
+                memcpy(overlay, r->overlay, (size_t) overlay_width * overlay_height * 4);
+            }
+        }
+        int rotation = r->rotation;
+        flip_mode_t flip = r->flip;
+        bool want_visible = r->window_visible || r->overlay || have_frame;
+        MUTEX_UNLOCK(r->display_mutex);
+
+        SDL_Event event;
+        while (SDL_PollEvent(&event)) {
+            // The window is only closed when RPiPlay stops
+        }
+
+        if (want_visible != visible) {
+            if (want_visible) {
+                SDL_ShowWindow(window);
+            } else {
+                SDL_HideWindow(window);
+            }
+            visible = want_visible;
+        }
+        if (overlay_changed) {
+            if (overlay_texture) SDL_DestroyTexture(overlay_texture);
+            overlay_texture = NULL;
+            if (overlay) {
+                overlay_texture = SDL_CreateTexture(sdl_renderer, SDL_PIXELFORMAT_RGBA32, SDL_TEXTUREACCESS_STATIC,
+                                                    overlay_width, overlay_height);
+                if (overlay_texture) {
+                    SDL_UpdateTexture(overlay_texture, NULL, overlay, overlay_width * 4);
+                    SDL_SetTextureBlendMode(overlay_texture, SDL_BLENDMODE_BLEND);
+                } else {
+                    logger_log(r->base.logger, LOGGER_ERR, "Could not create a %dx%d overlay texture: %s",
+                               overlay_width, overlay_height, SDL_GetError());
+                }
+                free(overlay);
+            }
+        }
+        if (clear) {
+            video_shown = false;
+        }
+        if ((clear || overlay_changed) && !have_frame) {
+            video_renderer_ffmpeg_draw(sdl_renderer, video_shown ? texture : NULL, texture_width, texture_height, rotation, flip,
+                                       overlay_texture, overlay_width, overlay_height);
+        }
+        if (have_frame) {
+            texture = video_renderer_ffmpeg_update_texture(r, sdl_renderer, texture, &texture_format,
+                                                          &texture_width, &texture_height, frame);
+            video_shown = texture != NULL;
+            if (texture) {
+                video_renderer_ffmpeg_draw(sdl_renderer, texture, texture_width, texture_height, rotation, flip,
+                                           overlay_texture, overlay_width, overlay_height);
+                r->frames_shown++;
+                // The decoder passes the packet's pts on, presenting waited for the vsync
+                if (frame->pts != AV_NOPTS_VALUE && frame->pts > 0) shown_pts = (uint64_t) frame->pts;
+            }
+            av_frame_unref(frame);
+        }
+
+        MUTEX_LOCK(r->display_mutex);
+        if (shown_pts) {
+            uint64_t now = raop_ntp_get_local_time(NULL);
+            r->presentation_offset = (int64_t) (now - shown_pts);
+            r->has_presentation_offset = true;
+            video_renderer_frame_presented(&r->base, shown_pts, now);
+        }
+    }
+    MUTEX_UNLOCK(r->display_mutex);
+
+    if (texture) SDL_DestroyTexture(texture);
+    if (overlay_texture) SDL_DestroyTexture(overlay_texture);
+    SDL_DestroyRenderer(sdl_renderer);
+    SDL_DestroyWindow(window);
+    av_frame_free(&frame);
+    return 0;
+}
+
+video_renderer_t *video_renderer_ffmpeg_init(logger_t *logger, video_renderer_config_t const *config) {
+    video_renderer_ffmpeg_t *renderer;
+
+    renderer = calloc(1, sizeof(video_renderer_ffmpeg_t));
+    if (!renderer) {
+        return NULL;
+    }
+    renderer->base.logger = logger;
+    renderer->base.funcs = &video_renderer_ffmpeg_funcs;
+    renderer->base.type = VIDEO_RENDERER_FFMPEG;
+    renderer->config = config;
+    renderer->rotation = config->rotation;
+    renderer->flip = config->flip;
+    renderer->hw_format = AV_PIX_FMT_NONE;
+    MUTEX_CREATE(renderer->decode_mutex);
+    MUTEX_CREATE(renderer->display_mutex);
+    COND_CREATE(renderer->display_cond);
+
+    if (SDL_Init(SDL_INIT_VIDEO) < 0) {
+        logger_log(logger, LOGGER_ERR, "Could not initialize SDL: %s", SDL_GetError());
+        video_renderer_ffmpeg_funcs.destroy(&renderer->base);
+        return NULL;
+    }
+    if (SDL_GetDesktopDisplayMode(0, &renderer->display_mode) < 0) {
+        logger_log(logger, LOGGER_WARNING, "Could not query the display mode: %s", SDL_GetError());
+    }
+    if (video_renderer_ffmpeg_init_decoder(renderer) < 0) {
+        video_renderer_ffmpeg_funcs.destroy(&renderer->base);
+        return NULL;
+    }
+
+    renderer->running = true;
+    THREAD_CREATE(renderer->thread, video_renderer_ffmpeg_thread, renderer);
+    if (!renderer->thread) {
+        renderer->running = false;
+        video_renderer_ffmpeg_funcs.destroy(&renderer->base);
+        return NULL;
+    }
+
+    video_renderer_ffmpeg_funcs.update_background(&renderer->base, 0);
+    return &renderer->base;
+}
+
+static void video_renderer_ffmpeg_start(video_renderer_t *renderer) {
+}
+
+static int video_renderer_ffmpeg_render_buffer(video_renderer_t *renderer, raop_ntp_t *ntp, unsigned char *data, int data_len,
+                                               uint64_t pts, int type, const h264_nal_unit_t *nal_units, int nal_count) {
+    video_renderer_ffmpeg_t *r = (video_renderer_ffmpeg_t *)renderer;
+
+    if (data_len == 0) return 0;
+    logger_log(renderer->logger, LOGGER_DEBUG, "Got h264 data of %d bytes", data_len);
+
+    // Not reference counted, so the decoder copies it into a padded buffer of its own
+    MUTEX_LOCK(r->decode_mutex);
+    r->input_frames++;
+    r->packet->data = data;
+    r->packet->size = data_len;
+    r->packet->pts = pts;
+    video_renderer_ffmpeg_decode(r, r->packet);
+    av_packet_unref(r->packet);
+    MUTEX_UNLOCK(r->decode_mutex);
+
+    trace_event(TRACE_VIDEO_RENDERED, data_len, pts);
+    return 0;
+}
+
+static unsigned char *video_renderer_ffmpeg_acquire_buffer(video_renderer_t *renderer, int size, void **handle) {
+    AVBufferRef *buffer;
+
+    if (size <= 0) return NULL;
+    // The decoder reads up to AV_INPUT_BUFFER_PADDING_SIZE bytes past the end
+    if (!(buffer = av_buffer_alloc(size + AV_INPUT_BUFFER_PADDING_SIZE))) return NULL;
+    *handle = buffer;
+    return buffer->data;
+}
+
+static void video_renderer_ffmpeg_submit_buffer(video_renderer_t *renderer, raop_ntp_t *ntp, void *handle, int data_len,
+                                                uint64_t pts, int type, const h264_nal_unit_t *nal_units, int nal_count) {
+    video_renderer_ffmpeg_t *r = (video_renderer_ffmpeg_t *)renderer;
+    AVBufferRef *buffer = handle;
+
+    logger_log(renderer->logger, LOGGER_DEBUG, "Got h264 data of %d bytes in place", data_len);
+    memset(buffer->data + data_len, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+
+    // The packet takes over the buffer, so the decoder keeps a reference instead of copying
+    MUTEX_LOCK(r->decode_mutex);
+    r->input_frames++;
+    r->packet->buf = buffer;
+    r->packet->data = buffer->data;
+    r->packet->size = data_len;
+    r->packet->pts = pts;
+    video_renderer_ffmpeg_decode(r, r->packet);
+    av_packet_unref(r->packet);
+    MUTEX_UNLOCK(r->decode_mutex);
+
+    trace_event(TRACE_VIDEO_RENDERED, data_len, pts);
+}
+
+static void video_renderer_ffmpeg_release_buffer(video_renderer_t *renderer, void *handle) {
+    AVBufferRef *buffer = handle;
+    av_buffer_unref(&buffer);
+}
+
+static void video_renderer_ffmpeg_flush(video_renderer_t *renderer) {
+    video_renderer_ffmpeg_t *r = (video_renderer_ffmpeg_t *)renderer;
+
+    MUTEX_LOCK(r->decode_mutex);
+    logger_log(renderer->logger, LOGGER_INFO, "Video: %llu frames in, %llu decoded, %llu shown, "
+               "%llu replaced before they were shown, %llu decode errors",
+               (unsigned long long) r->input_frames, (unsigned long long) r->frames_decoded,
+               (unsigned long long) r->frames_shown, (unsigned long long) r->frames_replaced,
+               (unsigned long long) r->decode_errors);
+    avcodec_flush_buffers(r->codec_context);
+    MUTEX_UNLOCK(r->decode_mutex);
+
+    MUTEX_LOCK(r->display_mutex);
+    if (r->have_pending) {
+        av_frame_unref(r->pending);
+        r->have_pending = false;
+    }
+    r->clear = true;
+    COND_SIGNAL(r->display_cond);
+    MUTEX_UNLOCK(r->display_mutex);
+}
+
+static void video_renderer_ffmpeg_get_stats(video_renderer_t *renderer, video_renderer_stats_t *stats) {
+    video_renderer_ffmpeg_t *r = (video_renderer_ffmpeg_t *)renderer;
+
+    // Called from the mirror thread, the only one that decodes
+    stats->decoder_latency = r->decode_time;
+    stats->decode_errors = r->decode_errors;
+    MUTEX_LOCK(r->display_mutex);
+    stats->queued_frames = r->have_pending ? 1 : 0;
+    stats->dropped_frames = r->frames_replaced;
+    stats->has_presentation_offset = r->has_presentation_offset;
+    stats->presentation_offset = r->presentation_offset;
+    MUTEX_UNLOCK(r->display_mutex);
+}
+
+static void video_renderer_ffmpeg_get_caps(video_renderer_t *renderer, video_renderer_caps_t *caps) {
+    video_renderer_ffmpeg_t *r = (video_renderer_ffmpeg_t *)renderer;
+    caps->max_width = r->display_mode.w;
+    caps->max_height = r->display_mode.h;
+    caps->max_fps = r->display_mode.refresh_rate;
+}
+
+static void video_renderer_ffmpeg_update_background(video_renderer_t *renderer, int type) {
+    video_renderer_ffmpeg_t *r = (video_renderer_ffmpeg_t *)renderer;
+    if (type < 0) {
+        r->background_visits--;
+    } else if (type > 0) {
+        r->background_visits++;
+    }
+    if (r->background_visits < 0) {
+        r->background_visits = 0;
+    }
+
+    // The window is the background, video shows it whenever frames arrive
+    MUTEX_LOCK(r->display_mutex);
+    r->window_visible = r->config->background_mode == BACKGROUND_MODE_ON ||
+                        (r->config->background_mode == BACKGROUND_MODE_AUTO && r->background_visits > 0);
+    COND_SIGNAL(r->display_cond);
+    MUTEX_UNLOCK(r->display_mutex);
+}
+
+static void video_renderer_ffmpeg_destroy(video_renderer_t *renderer) {
+    video_renderer_ffmpeg_t *r = (video_renderer_ffmpeg_t *)renderer;
+
+    if (!renderer) return;
+
+    if (r->running) {
+        MUTEX_LOCK(r->display_mutex);
+        r->running = false;
+        COND_SIGNAL(r->display_cond);
+        MUTEX_UNLOCK(r->display_mutex);
+        THREAD_JOIN(r->thread);
+    }
+
+    free(r->overlay);
+    av_frame_free(&r->pending);
+    av_frame_free(&r->sw_frame);
+    av_frame_free(&r->frame);
+    av_packet_free(&r->packet);
+    avcodec_free_context(&r->codec_context);
+    av_buffer_unref(&r->hw_device);
+    SDL_QuitSubSystem(SDL_INIT_VIDEO);
+
+    COND_DESTROY(r->display_cond);
+    MUTEX_DESTROY(r->display_mutex);
+    MUTEX_DESTROY(r->decode_mutex);
+    free(renderer);
+}
+
+/* The display thread picks the new orientation up with the next frame, low latency makes no difference here */
+static void video_renderer_ffmpeg_reconfigure(video_renderer_t *renderer, video_renderer_config_t const *config) {
+    video_renderer_ffmpeg_t *r = (video_renderer_ffmpeg_t *)renderer;
+    MUTEX_LOCK(r->display_mutex);
+    r->rotation = config->rotation;
+    r->flip = config->flip;
+    MUTEX_UNLOCK(r->display_mutex);
+}
+
+/* The window and the display thread stay, the decoder and the GPU device it decodes on go */
+static void video_renderer_ffmpeg_suspend(video_renderer_t *renderer) {
+    video_renderer_ffmpeg_t *r = (video_renderer_ffmpeg_t *)renderer;
+    MUTEX_LOCK(r->decode_mutex);
+    avcodec_free_context(&r->codec_context);
+    av_buffer_unref(&r->hw_device);
+    r->hw_format = AV_PIX_FMT_NONE;
+    MUTEX_UNLOCK(r->decode_mutex);
+}
+
+static int video_renderer_ffmpeg_resume(video_renderer_t *renderer) {
+    video_renderer_ffmpeg_t *r = (video_renderer_ffmpeg_t *)renderer;
+    int ret;
+    MUTEX_LOCK(r->decode_mutex);
+    ret = video_renderer_ffmpeg_open_codec(r);
+    MUTEX_UNLOCK(r->decode_mutex);
+    return ret;
+}
+
+/* The display thread makes a texture of the copy, the window shows while there is an overlay */
+static void video_renderer_ffmpeg_set_overlay(video_renderer_t *renderer, const uint8_t *rgba, int width, int height, int stride) {
+    video_renderer_ffmpeg_t *r = (video_renderer_ffmpeg_t *)renderer;
+    unsigned char *overlay = NULL;
+
+    if (rgba && width > 0 && height > 0) {
+        if (!(overlay = malloc((size_t) width * height * 4))) return;
+        for (int y = 0; y < height; y++) {
+            memcpy(overlay + (size_t) y * width * 4, rgba + (size_t) y * stride, (size_t) width * 4);
+        }
+    }
+    MUTEX_LOCK(r->display_mutex);
+    free(r->overlay);
+    r->overlay = overlay;
+    r->overlay_width = width;
+    r->overlay_height = height;
+    r->overlay_changed = true;
+    COND_SIGNAL(r->display_cond);
+    MUTEX_UNLOCK(r->display_mutex);
+}
+
+static const video_renderer_funcs_t video_renderer_ffmpeg_funcs = {
+    .start = video_renderer_ffmpeg_start,
+    .render_buffer = video_renderer_ffmpeg_render_buffer,
+    .flush = video_renderer_ffmpeg_flush,
+    .destroy = video_renderer_ffmpeg_destroy,
+    .update_background = video_renderer_ffmpeg_update_background,
+    .acquire_buffer = video_renderer_ffmpeg_acquire_buffer,
+    .submit_buffer = video_renderer_ffmpeg_submit_buffer,
+    .release_buffer = video_renderer_ffmpeg_release_buffer,
+    .get_stats = video_renderer_ffmpeg_get_stats,
+    .get_caps = video_renderer_ffmpeg_get_caps,
+    .reconfigure = video_renderer_ffmpeg_reconfigure,
+    .suspend = video_renderer_ffmpeg_suspend,
+    .resume = video_renderer_ffmpeg_resume,
+    .set_overlay = video_renderer_ffmpeg_set_overlay,
+};
@@ -22,97 +22,302 @@
 #include <gst/gst.h>
 #include <gst/app/gstappsrc.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../lib/trace.h"
+#include "h264_sps_patch.h"
+#include "gstreamer_clock.h"
+#include "gstreamer_pool.h"
+
+/* Pooled input buffers cover all but the largest keyframes */
+#define VIDEO_POOL_BUFFER_SIZE (256 * 1024)
+#define VIDEO_POOL_MIN_BUFFERS 4
+
+/* Low-latency bounds: compressed data waiting in appsrc and in the decoder's input queue,
+ * and decoded frames waiting for the sink, where the oldest are dropped */
+#define LOW_LATENCY_APPSRC_MAX_BYTES (512 * 1024)
+#define LOW_LATENCY_INPUT_QUEUE_BUFFERS 4
+#define LOW_LATENCY_OUTPUT_QUEUE_BUFFERS 2
+
+/* Frames in a row with more than this much queued before a buffering warning is logged */
+#define BUFFERING_WARNING_BYTES (256 * 1024)
+#define BUFFERING_WARNING_FRAMES 60
+
+/* Frames pushed recently whose push time is kept to time the decoder by, more than it holds at once */
+#define DECODE_TIMING_SLOTS 16
+
+typedef struct video_renderer_gstreamer_pushed_s {
+    /* Running time the frame was stamped with, 0 while the slot is rewritten */
+    guint64 pts;
+    uint64_t pushed_at;
+} video_renderer_gstreamer_pushed_t;
+
+typedef struct video_renderer_gstreamer_stats_s {
+    /* Bytes waiting in appsrc and in the input queue, peak since the last flush */
+    guint64 appsrc_bytes;
+    guint queue_bytes;
+    guint64 peak_appsrc_bytes;
+    guint peak_queue_bytes;
+    /* Frames dropped because appsrc was full, or while waiting for the next IDR */
+    unsigned int dropped_frames;
+} video_renderer_gstreamer_stats_t;
 
 typedef struct video_renderer_gstreamer_s {
     video_renderer_t base;
+    /* Kept to rebuild the pipeline when the stream switches codec */
+    video_renderer_config_t config;
+    const char *methods[2];
+    gboolean needs_flip;
+    /* Decoder element per video_codec_t, NULL if the codec can't be decoded */
+    const char *decoders[2];
+    video_codec_t codec;
+    bool started;
     GstElement *appsrc, *pipeline, *sink;
+    h264_sps_patch_t *sps_patch;
+    /* Frames are shown at their pts unless low-latency mode renders them as soon as they are decoded */
+    bool sync;
+    /* Shared with the audio renderer of the tile, see video_renderer_gstreamer_get_clock */
+    gstreamer_clock_t *clock;
+    gstreamer_pool_t pool;
+
+    /* Low-latency mode bounds the queues and drops frames up to the next IDR once appsrc is full */
+    bool low_latency;
+    bool skip_to_idr;
+    GstElement *input_queue;
+    unsigned int buffered_frames;
+    video_renderer_gstreamer_stats_t stats;
+
+    /* Written by the thread that pushes, matched by the sink probe on the streaming thread by pts */
+    video_renderer_gstreamer_pushed_t pushed[DECODE_TIMING_SLOTS];
+    unsigned int push_count;
+    /* Moving average of the time from appsrc to the sink in us, with sync on only */
+    uint64_t decode_time;
 } video_renderer_gstreamer_t;
 
 static const video_renderer_funcs_t video_renderer_gstreamer_funcs;
 
-static gboolean check_plugins(void)
+/* Probed in this order when no decoder is configured, the last one decodes on the CPU */
+static const char *probed_decoders[] = {"v4l2h264dec", "vaapih264dec", "nvh264dec", "avdec_h264", NULL};
+static const char *probed_hevc_decoders[] = {"v4l2slh265dec", "v4l2h265dec", "vaapih265dec", "nvh265dec", "avdec_h265", NULL};
+
+static gboolean is_software_decoder(const char *decoder)
+{
+    return !strcmp(decoder, "avdec_h264") || !strcmp(decoder, "avdec_h265") || !strcmp(decoder, "decodebin");
+}
+
+static gboolean has_element(const char *name)
+{
+    GstElementFactory *factory = gst_element_factory_find(name);
+    if (!factory) {
+        return FALSE;
+    }
+    gst_object_unref(factory);
+    return TRUE;
+}
+
+static const char *choose_decoder(logger_t *logger, const char *configured)
+{
+    int i;
+
+    if (configured && strcmp(configured, "auto")) {
+        return configured;
+    }
+    for (i = 0; probed_decoders[i]; i++) {
+        if (has_element(probed_decoders[i])) {
+            logger_log(logger, LOGGER_INFO, "Using the %s video decoder", probed_decoders[i]);
+            return probed_decoders[i];
+        }
+    }
+    // Let decodebin pick whatever is there
+    return "decodebin";
+}
+
+/* autovideosink ends up on ximagesink under XWayland, which copies every frame and has no vsync */
+static video_sink_t choose_sink(logger_t *logger, video_sink_t configured)
+{
+    if (configured == VIDEO_SINK_AUTO && getenv("WAYLAND_DISPLAY") && has_element("waylandsink")) {
+        logger_log(logger, LOGGER_INFO, "Using waylandsink on the Wayland session");
+        return VIDEO_SINK_WAYLAND;
+    }
+    return configured;
+}
+
+static const char *sink_element(video_sink_t sink)
+{
+    switch (sink) {
+    case VIDEO_SINK_GL:
+        return "glimagesink";
+    case VIDEO_SINK_KMS:
+        return "kmssink";
+    case VIDEO_SINK_WAYLAND:
+        return "waylandsink";
+    case VIDEO_SINK_AUTO:
+    default:
+        return "autovideosink";
+    }
+}
+
+// Not static because the video URL player shows its video on the same sink
+const char *video_renderer_gstreamer_sink_element(logger_t *logger, video_sink_t configured)
+{
+    return sink_element(choose_sink(logger, configured));
+}
+
+/* The HEVC pipeline always probes, senders only mirror in HEVC when a hardware decoder is found */
+static const char *choose_hevc_decoder(logger_t *logger)
+{
+    int i;
+
+    if (!has_element("h265parse")) {
+        return NULL;
+    }
+    for (i = 0; probed_hevc_decoders[i]; i++) {
+        if (has_element(probed_hevc_decoders[i])) {
+            logger_log(logger, LOGGER_INFO, "Using the %s video decoder for HEVC", probed_hevc_decoders[i]);
+            return probed_hevc_decoders[i];
+        }
+    }
+    return NULL;
+}
+
+static gboolean check_plugins(const char **needed)
 {
     int i;
     gboolean ret;
-    GstRegistry *registry;
-    const gchar *needed[] = {"app", "libav", "playback", "autodetect", "videoparsersbad", NULL};
 
-    registry = gst_registry_get();
     ret = TRUE;
-    for (i = 0; i < g_strv_length((gchar **)needed); i++) {
-        GstPlugin *plugin;
-        plugin = gst_registry_find_plugin(registry, needed[i]);
-        if (!plugin) {
-            g_print("Required gstreamer plugin '%s' not found\n", needed[i]);
+    for (i = 0; needed[i]; i++) {
+        if (!has_element(needed[i])) {
+            g_print("Required gstreamer element '%s' not found\n", needed[i]);
             ret = FALSE;
-            continue;
         }
-        gst_object_unref(plugin);
     }
     return ret;
 }
 
-video_renderer_t *video_renderer_gstreamer_init(logger_t *logger, video_renderer_config_t const *config) {
-    video_renderer_gstreamer_t *renderer;
-    GError *error = NULL;
+static const char *rotation_method(int rotation)
+{
+    switch (rotation) {
+    case 90:
+    case -270:
+        return "clockwise";
+    case -90:
+    case 270:
+        return "counterclockwise";
+    case 180:
+    case -180:
+        return "rotate-180";
+    default:
+        return NULL;
+    }
+}
 
-    renderer = calloc(1, sizeof(video_renderer_gstreamer_t));
-    assert(renderer);
+static const char *flip_method(flip_mode_t flip)
+{
+    switch (flip) {
+    case FLIP_HORIZONTAL:
+        return "horizontal-flip";
+    case FLIP_VERTICAL:
+        return "vertical-flip";
+    case FLIP_BOTH:
+        return "rotate-180";
+    case FLIP_NONE:
+    default:
+        return NULL;
+    }
+}
 
-    gst_init(NULL, NULL);
+/*
+ * Sees each decoded frame reach the sink. With sync on, the sink holds it until its running time plus the
+ * latency on the shared clock, which runs on the local time, so that is when it shows, unless it came late.
+ */
+static GstPadProbeReturn video_renderer_gstreamer_sink_probe(GstPad *pad, GstPadProbeInfo *info, gpointer data) {
+    video_renderer_gstreamer_t *r = data;
+    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
 
-    renderer->base.logger = logger;
-    renderer->base.funcs = &video_renderer_gstreamer_funcs;
-    renderer->base.type = VIDEO_RENDERER_GSTREAMER;
+    if (GST_BUFFER_PTS_IS_VALID(buffer) && GST_BUFFER_PTS(buffer) > 0) {
+        uint64_t pts = gstreamer_clock_local_time(r->clock, GST_BUFFER_PTS(buffer));
+        uint64_t due = pts + gstreamer_clock_get_latency(r->clock) / GST_USECOND;
+        uint64_t now = raop_ntp_get_local_time(NULL);
+        video_renderer_frame_presented(&r->base, pts, now > due ? now : due);
 
-    assert(check_plugins());
-
-    // Begin the video pipeline
-    GString *launch = g_string_new("appsrc name=video_source stream-type=0 format=GST_FORMAT_TIME is-live=true !"
-                                   "queue ! decodebin ! videoconvert ! ");
-    // Setup rotation
-    if (config->rotation != 0) {
-        switch (config->rotation) {
-        case 90:
-        case -270:
-            g_string_append(launch, "videoflip method=clockwise ! ");
-            break;
-        case -90:
-        case 270:
-            g_string_append(launch, "videoflip method=counterclockwise ! ");
+        // Frames the decoder dropped or that were overwritten in the meantime are just not timed
+        for (int i = 0; i < DECODE_TIMING_SLOTS; i++) {
+            video_renderer_gstreamer_pushed_t *slot = &r->pushed[i];
+            if (__atomic_load_n(&slot->pts, __ATOMIC_ACQUIRE) != GST_BUFFER_PTS(buffer)) continue;
+            uint64_t pushed_at = __atomic_load_n(&slot->pushed_at, __ATOMIC_RELAXED);
+            if (now > pushed_at) {
+                uint64_t decode_time = __atomic_load_n(&r->decode_time, __ATOMIC_RELAXED);
+                __atomic_store_n(&r->decode_time, (decode_time * 7 + (now - pushed_at)) / 8, __ATOMIC_RELAXED);
+            }
             break;
-        case 180:
-        case -180:
-            g_string_append(launch, "videoflip method=rotate-180 ! ");
-            break;
-        default:
-            printf("Error: Rotation must be +/- 0,90,180,270\n");
-            g_string_free(launch, TRUE);
-            free(renderer);
-            return NULL;
         }
     }
+    return GST_PAD_PROBE_OK;
+}
 
-    // Setup flip
-    if (config->flip != FLIP_NONE) {
-        switch (config->flip) {
-        case FLIP_HORIZONTAL:
-            g_string_append(launch, "videoflip method=horizontal-flip ! ");
-            break;
-        case FLIP_VERTICAL:
-            g_string_append(launch, "videoflip method=vertical-flip ! ");
-            break;
-        case FLIP_BOTH:
-            g_string_append(launch, "videoflip method=rotate-180 ! ");
-            break;
-        case FLIP_NONE:
-        default:
-            break;
+/* Builds the pipeline for codec from the configuration kept at init, the elements were checked for already */
+static void video_renderer_gstreamer_launch(video_renderer_gstreamer_t *renderer, video_codec_t codec) {
+    video_renderer_config_t const *config = &renderer->config;
+    const char *decoder = renderer->decoders[codec];
+    GError *error = NULL;
+    gboolean needs_convert, cpu_flip;
+    int i;
+
+    // The default path always converts, videoconvert passes frames through when the sink takes
+    // them as they are. The GL path converts and flips on the GPU, kmssink and waylandsink import
+    // decoder DMABufs and only need conversion when videoflip has to work on system memory.
+    cpu_flip = renderer->needs_flip && config->sink != VIDEO_SINK_GL;
+    switch (config->sink) {
+    case VIDEO_SINK_GL:
+        needs_convert = FALSE;
+        break;
+    case VIDEO_SINK_KMS:
+    case VIDEO_SINK_WAYLAND:
+        needs_convert = cpu_flip;
+        break;
+    case VIDEO_SINK_AUTO:
+    default:
+        // autovideosink may pick a sink that can't take the decoder's format or memory as it is
+        needs_convert = TRUE;
+        break;
+    }
+
+    GString *launch = g_string_new("appsrc name=video_source stream-type=0 format=GST_FORMAT_TIME is-live=true ");
+    g_string_append_printf(launch, "caps=%s,stream-format=byte-stream,alignment=au ",
+                           codec == VIDEO_CODEC_H265 ? "video/x-h265" : "video/x-h264");
+    if (renderer->low_latency) {
+        g_string_append_printf(launch, "max-bytes=%d block=false ! queue name=input_queue max-size-buffers=%d "
+                               "max-size-bytes=0 max-size-time=0 ! ", LOW_LATENCY_APPSRC_MAX_BYTES,
+                               LOW_LATENCY_INPUT_QUEUE_BUFFERS);
+    } else {
+        g_string_append(launch, "! queue name=input_queue ! ");
+    }
+    if (strcmp(decoder, "decodebin")) {
+        g_string_append(launch, codec == VIDEO_CODEC_H265 ? "h265parse ! " : "h264parse ! ");
+    }
+    g_string_append_printf(launch, "%s ! ", decoder);
+    if (renderer->low_latency) {
+        // Decoded frames don't reference each other, so a slow sink can lose the oldest ones safely
+        g_string_append_printf(launch, "queue leaky=downstream max-size-buffers=%d max-size-bytes=0 max-size-time=0 ! ",
+                               LOW_LATENCY_OUTPUT_QUEUE_BUFFERS);
+    }
+    if (needs_convert) {
+        g_string_append(launch, "videoconvert ! ");
+    }
+    if (config->sink == VIDEO_SINK_GL) {
+        g_string_append(launch, "glupload ! glcolorconvert ! ");
+    }
+    // Setup rotation and flip
+    for (i = 0; i < 2; i++) {
+        if (renderer->methods[i]) {
+            g_string_append_printf(launch, "%s method=%s ! ", cpu_flip ? "videoflip" : "glvideoflip", renderer->methods[i]);
         }
     }
 
     // Finish the pipeline
-    g_string_append(launch, "autovideosink name=video_sink sync=false");
+    g_string_append_printf(launch, "%s name=video_sink sync=%s", sink_element(config->sink),
+                           renderer->sync ? "true" : "false");
 
     renderer->pipeline = gst_parse_launch(launch->str, &error);
     g_assert(renderer->pipeline);
@@ -120,44 +325,472 @@ video_renderer_t *video_renderer_gstreamer_init(logger_t *logger, video_renderer
 
     renderer->appsrc = gst_bin_get_by_name(GST_BIN(renderer->pipeline), "video_source");
     renderer->sink = gst_bin_get_by_name(GST_BIN(renderer->pipeline), "video_sink");
+    renderer->input_queue = gst_bin_get_by_name(GST_BIN(renderer->pipeline), "input_queue");
+    if (renderer->sync) {
+        gstreamer_clock_attach(renderer->clock, renderer->pipeline);
+        // Without sync the buffers carry no pts to tell the frames apart by
+        GstPad *sink_pad = gst_element_get_static_pad(renderer->sink, "sink");
+        if (sink_pad) {
+            gst_pad_add_probe(sink_pad, GST_PAD_PROBE_TYPE_BUFFER, video_renderer_gstreamer_sink_probe, renderer, NULL);
+            gst_object_unref(sink_pad);
+        }
+    }
+    renderer->codec = codec;
+}
+
+static void video_renderer_gstreamer_teardown(video_renderer_gstreamer_t *renderer) {
+    gst_app_src_end_of_stream(GST_APP_SRC(renderer->appsrc));
+    gst_element_set_state(renderer->pipeline, GST_STATE_NULL);
+    gst_object_unref(renderer->appsrc);
+    gst_object_unref(renderer->sink);
+    gst_object_unref(renderer->input_queue);
+    gst_object_unref(renderer->pipeline);
+}
+
+video_renderer_t *video_renderer_gstreamer_init(logger_t *logger, video_renderer_config_t const *config) {
+    video_renderer_gstreamer_t *renderer;
+    const char *decoder;
+    const char *needed[12];
+    gboolean needs_convert, cpu_flip;
+    int n;
+
+    renderer = calloc(1, sizeof(video_renderer_gstreamer_t));
+    assert(renderer);
+
+    gst_init(NULL, NULL);
+
+    renderer->base.logger = logger;
+    renderer->base.funcs = &video_renderer_gstreamer_funcs;
+    renderer->base.type = VIDEO_RENDERER_GSTREAMER;
+    renderer->config = *config;
+    renderer->config.sink = choose_sink(logger, config->sink);
+    config = &renderer->config;
+
+    if (config->rotation != 0 && !rotation_method(config->rotation)) {
+        printf("Error: Rotation must be +/- 0,90,180,270\n");
+        free(renderer);
+        return NULL;
+    }
+    renderer->methods[0] = config->rotation != 0 ? rotation_method(config->rotation) : NULL;
+    renderer->methods[1] = flip_method(config->flip);
+    renderer->needs_flip = renderer->methods[0] || renderer->methods[1];
+
+    decoder = choose_decoder(logger, config->decoder);
+    cpu_flip = renderer->needs_flip && config->sink != VIDEO_SINK_GL;
+    switch (config->sink) {
+    case VIDEO_SINK_GL:
+        needs_convert = FALSE;
+        break;
+    case VIDEO_SINK_KMS:
+    case VIDEO_SINK_WAYLAND:
+        if (renderer->needs_flip) logger_log(logger, LOGGER_WARNING, "%s can't rotate or flip, doing it on the CPU",
+                                             sink_element(config->sink));
+        needs_convert = cpu_flip;
+        break;
+    case VIDEO_SINK_AUTO:
+    default:
+        needs_convert = TRUE;
+        break;
+    }
+
+    n = 0;
+    needed[n++] = "appsrc";
+    needed[n++] = "queue";
+    needed[n++] = decoder;
+    if (strcmp(decoder, "decodebin")) needed[n++] = "h264parse";
+    if (needs_convert) needed[n++] = "videoconvert";
+    if (cpu_flip) needed[n++] = "videoflip";
+    if (config->sink == VIDEO_SINK_GL) {
+        needed[n++] = "glupload";
+        needed[n++] = "glcolorconvert";
+        needed[n++] = "glimagesink";
+        if (renderer->needs_flip) needed[n++] = "glvideoflip";
+    } else {
+        needed[n++] = sink_element(config->sink);
+    }
+    needed[n] = NULL;
+    if (!check_plugins(needed)) {
+        logger_log(logger, LOGGER_ERR, "Missing GStreamer elements for the %s video pipeline", decoder);
+        free(renderer);
+        return NULL;
+    }
+    renderer->decoders[VIDEO_CODEC_H264] = decoder;
+    renderer->decoders[VIDEO_CODEC_H265] = choose_hevc_decoder(logger);
+
+    // Decoders honour the VUI bitstream restriction of the active SPS, so it is rewritten in place
+    renderer->sps_patch = h264_sps_patch_init(logger, H264_SPS_PATCH_REWRITE, h264_sps_patch_reorder_depth(config));
+    assert(renderer->sps_patch);
+
+    if (gstreamer_pool_init(&renderer->pool, VIDEO_POOL_BUFFER_SIZE, VIDEO_POOL_MIN_BUFFERS) < 0) {
+        logger_log(logger, LOGGER_ERR, "Could not create the video buffer pool");
+        h264_sps_patch_destroy(renderer->sps_patch);
+        free(renderer);
+        return NULL;
+    }
+
+    // Kept in low-latency mode as well, reconfigure may turn sync on
+    renderer->clock = gstreamer_clock_create(config->presentation_latency);
+    assert(renderer->clock);
+
+    renderer->low_latency = config->low_latency;
+    renderer->sync = !config->low_latency;
+    video_renderer_gstreamer_launch(renderer, VIDEO_CODEC_H264);
 
     return &renderer->base;
 }
 
+// Not static because the audio renderer runs its pipeline on the same clock, to stay in sync
+gstreamer_clock_t *video_renderer_gstreamer_get_clock(video_renderer_t *renderer) {
+    return ((video_renderer_gstreamer_t *)renderer)->clock;
+}
+
 static void video_renderer_gstreamer_start(video_renderer_t *renderer) {
     video_renderer_gstreamer_t *r = (video_renderer_gstreamer_t *)renderer;
-    gst_element_set_state(r->pipeline, GST_STATE_PLAYING);
+    r->started = true;
+    if (r->sync) {
+        gstreamer_clock_start(r->clock, r->pipeline);
+    } else {
+        gst_element_set_state(r->pipeline, GST_STATE_PLAYING);
+    }
+}
+
+static void video_renderer_gstreamer_stamp_buffer(video_renderer_gstreamer_t *r, GstBuffer *buffer, uint64_t pts) {
+    if (r->sync) {
+        video_renderer_gstreamer_pushed_t *slot = &r->pushed[r->push_count++ % DECODE_TIMING_SLOTS];
+
+        GST_BUFFER_PTS(buffer) = gstreamer_clock_stamp(r->clock, pts);
+        __atomic_store_n(&slot->pts, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&slot->pushed_at, raop_ntp_get_local_time(NULL), __ATOMIC_RELAXED);
+        __atomic_store_n(&slot->pts, GST_BUFFER_PTS(buffer), __ATOMIC_RELEASE);
+    }
+}
+
+static bool video_renderer_gstreamer_is_idr(video_codec_t codec, const h264_nal_unit_t *nal_units, int nal_count) {
+    for (int i = 0; i < nal_count; i++) {
+        if (video_nal_is_keyframe(codec, nal_units[i].nal_type)) return true;
+    }
+    return false;
 }
 
-static void video_renderer_gstreamer_render_buffer(video_renderer_t *renderer, raop_ntp_t *ntp, unsigned char *data, int data_len, uint64_t pts, int type) {
+static void video_renderer_gstreamer_update_levels(video_renderer_gstreamer_t *r) {
+    video_renderer_gstreamer_stats_t *stats = &r->stats;
+
+    stats->appsrc_bytes = gst_app_src_get_current_level_bytes(GST_APP_SRC(r->appsrc));
+    g_object_get(r->input_queue, "current-level-bytes", &stats->queue_bytes, NULL);
+    if (stats->appsrc_bytes > stats->peak_appsrc_bytes) stats->peak_appsrc_bytes = stats->appsrc_bytes;
+    if (stats->queue_bytes > stats->peak_queue_bytes) stats->peak_queue_bytes = stats->queue_bytes;
+
+    if (stats->appsrc_bytes + stats->queue_bytes > BUFFERING_WARNING_BYTES) {
+        if (++r->buffered_frames == BUFFERING_WARNING_FRAMES) {
+            logger_log(r->base.logger, LOGGER_WARNING, "Video is buffering: %llu bytes in appsrc, %u bytes in the decoder queue",
+                       (unsigned long long) stats->appsrc_bytes, stats->queue_bytes);
+        }
+    } else {
+        r->buffered_frames = 0;
+    }
+}
+
+/* Returns true if the frame should be dropped because appsrc is full in low-latency mode,
+ * or because the pipeline was rebuilt and hasn't seen an IDR since */
+static bool video_renderer_gstreamer_drop_frame(video_renderer_gstreamer_t *r, int type,
+                                                const h264_nal_unit_t *nal_units, int nal_count) {
+    bool idr;
+
+    video_renderer_gstreamer_update_levels(r);
+    if (type == 0) return false;
+
+    // Frames after a dropped one can't be decoded, so everything up to the next IDR goes too
+    idr = video_renderer_gstreamer_is_idr(r->codec, nal_units, nal_count);
+    if (r->skip_to_idr && !idr) {
+        r->stats.dropped_frames++;
+        return true;
+    }
+    r->skip_to_idr = false;
+    if (r->low_latency && !idr && r->stats.appsrc_bytes >= LOW_LATENCY_APPSRC_MAX_BYTES) {
+        logger_log(r->base.logger, LOGGER_DEBUG, "appsrc holds %llu bytes, dropping video up to the next IDR",
+                   (unsigned long long) r->stats.appsrc_bytes);
+        r->skip_to_idr = true;
+        r->stats.dropped_frames++;
+        return true;
+    }
+    return false;
+}
+
+static int video_renderer_gstreamer_render_buffer(video_renderer_t *renderer, raop_ntp_t *ntp, unsigned char *data, int data_len, uint64_t pts, int type,
+                                                  const h264_nal_unit_t *nal_units, int nal_count) {
     video_renderer_gstreamer_t *r = (video_renderer_gstreamer_t *)renderer;
     GstBuffer *buffer;
 
     assert(data_len != 0);
 
-    buffer = gst_buffer_new_and_alloc(data_len);
+    if (video_renderer_gstreamer_drop_frame(r, type, nal_units, nal_count)) {
+        return -1;
+    }
+    if (type == 0 && r->codec == VIDEO_CODEC_H264) {
+        data = h264_sps_patch_apply(r->sps_patch, data, &data_len, nal_units, nal_count);
+    }
+
+    buffer = gstreamer_pool_get(&r->pool, data_len);
     assert(buffer != NULL);
-    GST_BUFFER_DTS(buffer) = (GstClockTime)pts;
+    video_renderer_gstreamer_stamp_buffer(r, buffer, pts);
     gst_buffer_fill(buffer, 0, data, data_len);
     gst_app_src_push_buffer(GST_APP_SRC(r->appsrc), buffer);
+    trace_event(TRACE_VIDEO_RENDERED, data_len, pts);
+    return 0;
+}
+
+static int video_renderer_gstreamer_render_frame(video_renderer_t *renderer, raop_ntp_t *ntp, stream_frame_t *frame, int type,
+                                                 const h264_nal_unit_t *nal_units, int nal_count) {
+    video_renderer_gstreamer_t *r = (video_renderer_gstreamer_t *)renderer;
+    GstBuffer *buffer;
+    int ret;
+
+    if (type == 0) {
+        // Codec data may get rewritten into the patcher's own storage, it is small enough to copy
+        ret = video_renderer_gstreamer_render_buffer(renderer, ntp, frame->data, frame->data_len, frame->pts,
+                                                     type, nal_units, nal_count);
+        stream_frame_unref(frame);
+        return ret;
+    }
+    if (video_renderer_gstreamer_drop_frame(r, type, nal_units, nal_count)) {
+        stream_frame_unref(frame);
+        return -1;
+    }
+
+    // The pipeline holds the frame until the decoder has consumed it
+    buffer = gst_buffer_new_wrapped_full(GST_MEMORY_FLAG_READONLY, frame->data, frame->data_len, 0, frame->data_len,
+                                         frame, (GDestroyNotify) stream_frame_unref);
+    assert(buffer != NULL);
+    video_renderer_gstreamer_stamp_buffer(r, buffer, frame->pts);
+    trace_event(TRACE_VIDEO_RENDERED, frame->data_len, frame->pts);
+    gst_app_src_push_buffer(GST_APP_SRC(r->appsrc), buffer);
+    return 0;
+}
+
+typedef struct video_renderer_gstreamer_frame_s {
+    GstBuffer *buffer;
+    GstMapInfo map;
+} video_renderer_gstreamer_frame_t;
+
+static unsigned char *video_renderer_gstreamer_acquire_buffer(video_renderer_t *renderer, int size, void **handle) {
+    video_renderer_gstreamer_t *r = (video_renderer_gstreamer_t *)renderer;
+    video_renderer_gstreamer_frame_t *frame;
+
+    if (size <= 0) return NULL;
+    frame = malloc(sizeof(video_renderer_gstreamer_frame_t));
+    if (!frame) return NULL;
+
+    frame->buffer = gstreamer_pool_get(&r->pool, size);
+    if (!frame->buffer) {
+        free(frame);
+        return NULL;
+    }
+    if (!gst_buffer_map(frame->buffer, &frame->map, GST_MAP_WRITE)) {
+        gst_buffer_unref(frame->buffer);
+        free(frame);
+        return NULL;
+    }
+    *handle = frame;
+    return frame->map.data;
+}
+
+static void video_renderer_gstreamer_submit_buffer(video_renderer_t *renderer, raop_ntp_t *ntp, void *handle, int data_len, uint64_t pts, int type,
+                                                   const h264_nal_unit_t *nal_units, int nal_count) {
+    video_renderer_gstreamer_t *r = (video_renderer_gstreamer_t *)renderer;
+    video_renderer_gstreamer_frame_t *frame = handle;
+    GstBuffer *buffer = frame->buffer;
+
+    gst_buffer_unmap(buffer, &frame->map);
+    free(frame);
+
+    if (video_renderer_gstreamer_drop_frame(r, type, nal_units, nal_count)) {
+        gst_buffer_unref(buffer);
+        return;
+    }
+    gst_buffer_set_size(buffer, data_len);
+    video_renderer_gstreamer_stamp_buffer(r, buffer, pts);
+    gst_app_src_push_buffer(GST_APP_SRC(r->appsrc), buffer);
+    trace_event(TRACE_VIDEO_RENDERED, data_len, pts);
+}
+
+static void video_renderer_gstreamer_release_buffer(video_renderer_t *renderer, void *handle) {
+    video_renderer_gstreamer_frame_t *frame = handle;
+    gst_buffer_unmap(frame->buffer, &frame->map);
+    gst_buffer_unref(frame->buffer);
+    free(frame);
+}
+
+/*
+ * Drops what appsrc and the elements behind it still hold with a flush-start and flush-stop, instead of
+ * letting the sink play it out. The pipeline stays in PLAYING and keeps its decoder, and the running time
+ * is not reset, so the clock's mapping of pts carries on.
+ */
+static void video_renderer_gstreamer_discard(video_renderer_gstreamer_t *r) {
+    if (!r->started || GST_STATE(r->pipeline) != GST_STATE_PLAYING) {
+        return;
+    }
+    // appsrc empties its own queue on the flush-stop
+    gst_element_send_event(r->appsrc, gst_event_new_flush_start());
+    gst_element_send_event(r->appsrc, gst_event_new_flush_stop(FALSE));
 }
 
 void video_renderer_gstreamer_flush(video_renderer_t *renderer) {
+    video_renderer_gstreamer_t *r = (video_renderer_gstreamer_t *)renderer;
+    video_renderer_gstreamer_stats_t *stats = &r->stats;
+
+    video_renderer_gstreamer_discard(r);
 
+    logger_log(renderer->logger, LOGGER_INFO, "Video queues peaked at %llu bytes in appsrc and %u bytes in the decoder queue, "
+               "%u frames dropped", (unsigned long long) stats->peak_appsrc_bytes, stats->peak_queue_bytes,
+               stats->dropped_frames);
+    memset(stats, 0, sizeof(video_renderer_gstreamer_stats_t));
+    r->buffered_frames = 0;
+    // The decoder lost its reference frames with the flush
+    r->skip_to_idr = true;
 }
 
-void video_renderer_gstreamer_destroy(video_renderer_t *renderer) {
+/* The caps of appsrc and the parser are fixed, so a new codec gets a pipeline of its own */
+static void video_renderer_gstreamer_set_codec(video_renderer_t *renderer, video_codec_t codec) {
+    video_renderer_gstreamer_t *r = (video_renderer_gstreamer_t *)renderer;
+
+    if (codec == r->codec) {
+        return;
+    }
+    if (!r->decoders[codec]) {
+        logger_log(renderer->logger, LOGGER_ERR, "No GStreamer decoder for %s, the video can't be shown",
+                   codec == VIDEO_CODEC_H265 ? "HEVC" : "H.264");
+        return;
+    }
+    logger_log(renderer->logger, LOGGER_INFO, "Rebuilding the video pipeline for %s with %s",
+               codec == VIDEO_CODEC_H265 ? "HEVC" : "H.264", r->decoders[codec]);
+    video_renderer_gstreamer_teardown(r);
+    video_renderer_gstreamer_launch(r, codec);
+    r->skip_to_idr = false;
+    if (r->started) {
+        video_renderer_gstreamer_start(renderer);
+    }
+}
+
+/* Rotation, flip and the latency profile are all part of the pipeline, so it is rebuilt for them */
+static void video_renderer_gstreamer_reconfigure(video_renderer_t *renderer, video_renderer_config_t const *config) {
+    video_renderer_gstreamer_t *r = (video_renderer_gstreamer_t *)renderer;
+    const char *methods[2];
+    const char *needed[3];
+    gboolean needs_flip;
+    int reorder_depth;
+
+    if (config->rotation != 0 && !rotation_method(config->rotation)) {
+        logger_log(renderer->logger, LOGGER_ERR, "Rotation must be +/- 0,90,180,270, keeping the video as it is");
+        return;
+    }
+    methods[0] = config->rotation != 0 ? rotation_method(config->rotation) : NULL;
+    methods[1] = flip_method(config->flip);
+    needs_flip = methods[0] || methods[1];
+    if (needs_flip && !r->needs_flip) {
+        // Only the flipping elements can be missing, the rest of the pipeline stays the same
+        if (r->config.sink == VIDEO_SINK_GL) {
+            needed[0] = "glvideoflip";
+            needed[1] = NULL;
+        } else {
+            needed[0] = "videoflip";
+            needed[1] = "videoconvert";
+            needed[2] = NULL;
+        }
+        if (!check_plugins(needed)) {
+            logger_log(renderer->logger, LOGGER_ERR, "Missing GStreamer elements to rotate or flip, keeping the video as it is");
+            return;
+        }
+    }
+
+    reorder_depth = h264_sps_patch_reorder_depth(config);
+    if (reorder_depth != h264_sps_patch_reorder_depth(&r->config)) {
+        h264_sps_patch_destroy(r->sps_patch);
+        r->sps_patch = h264_sps_patch_init(renderer->logger, H264_SPS_PATCH_REWRITE, reorder_depth);
+        assert(r->sps_patch);
+    }
+    r->config.rotation = config->rotation;
+    r->config.flip = config->flip;
+    r->config.low_latency = config->low_latency;
+    r->methods[0] = methods[0];
+    r->methods[1] = methods[1];
+    r->needs_flip = needs_flip;
+    r->low_latency = config->low_latency;
+    r->sync = !config->low_latency;
+
+    video_renderer_gstreamer_teardown(r);
+    video_renderer_gstreamer_launch(r, r->codec);
+    // The new decoder needs codec data and an IDR before it can show anything
+    r->skip_to_idr = true;
+    if (r->started) {
+        video_renderer_gstreamer_start(renderer);
+    }
+}
+
+/* In NULL the elements give back the decoder and the display, the parsed pipeline stays for resume */
+static void video_renderer_gstreamer_suspend(video_renderer_t *renderer) {
     video_renderer_gstreamer_t *r = (video_renderer_gstreamer_t *)renderer;
-    gst_app_src_end_of_stream(GST_APP_SRC(r->appsrc));
     gst_element_set_state(r->pipeline, GST_STATE_NULL);
-    gst_object_unref(r->pipeline);
+}
+
+static int video_renderer_gstreamer_resume(video_renderer_t *renderer) {
+    video_renderer_gstreamer_t *r = (video_renderer_gstreamer_t *)renderer;
+    if (r->started) {
+        video_renderer_gstreamer_start(renderer);
+    }
+    return 0;
+}
+
+void video_renderer_gstreamer_destroy(video_renderer_t *renderer) {
+    video_renderer_gstreamer_t *r = (video_renderer_gstreamer_t *)renderer;
+    video_renderer_gstreamer_teardown(r);
     if (renderer) {
+        gstreamer_clock_unref(r->clock);
+        gstreamer_pool_destroy(&r->pool);
+        h264_sps_patch_destroy(r->sps_patch);
         free(renderer);
     }
 }
 
-void video_renderer_gstreamer_update_background(video_renderer_t *renderer, int type) {
+static void video_renderer_gstreamer_get_stats(video_renderer_t *renderer, video_renderer_stats_t *stats) {
+    video_renderer_gstreamer_t *r = (video_renderer_gstreamer_t *)renderer;
+    guint queued = 0;
+
+    g_object_get(r->input_queue, "current-level-buffers", &queued, NULL);
+    stats->queued_frames = queued;
+    stats->dropped_frames = r->stats.dropped_frames;
+    // Measured from appsrc to the sink, the -pl latency the sink then holds frames for is intended, not lag
+    stats->decoder_latency = __atomic_load_n(&r->decode_time, __ATOMIC_RELAXED);
+    stats->has_presentation_offset = r->sync;
+    stats->presentation_offset = r->sync ? (int64_t) (gstreamer_clock_get_latency(r->clock) / GST_USECOND) : 0;
+    stats->paced = r->sync;
+}
+
+/* Compressed frames in appsrc and the decoder queue, and the input buffers the pool keeps at least */
+static void video_renderer_gstreamer_get_memory(video_renderer_t *renderer, video_renderer_memory_t *memory) {
+    video_renderer_gstreamer_t *r = (video_renderer_gstreamer_t *)renderer;
+    guint queue_bytes = 0;
+
+    g_object_get(r->input_queue, "current-level-bytes", &queue_bytes, NULL);
+    memory->host_bytes = gst_app_src_get_current_level_bytes(GST_APP_SRC(r->appsrc)) + queue_bytes +
+                         (size_t) VIDEO_POOL_MIN_BUFFERS * VIDEO_POOL_BUFFER_SIZE;
+}
 
+static void video_renderer_gstreamer_get_caps(video_renderer_t *renderer, video_renderer_caps_t *caps) {
+    video_renderer_gstreamer_t *r = (video_renderer_gstreamer_t *)renderer;
+    const char *hevc_decoder = r->decoders[VIDEO_CODEC_H265];
+
+    // HEVC in software costs more than H.264 and buys nothing on a LAN, so it is only offered in hardware
+    caps->hevc = hevc_decoder && !is_software_decoder(hevc_decoder);
+    caps->max_width = 1920;
+    caps->max_height = 1080;
+    caps->max_fps = 60;
+}
+
+/*
+ * The sink's window is all there is for a background. This is called on connection threads without the
+ * tile's lock, while set_codec may be rebuilding the pipeline, so stale frames are left to flush.
+ */
+void video_renderer_gstreamer_update_background(video_renderer_t *renderer, int type) {
 }
 
 static const video_renderer_funcs_t video_renderer_gstreamer_funcs = {
@@ -166,4 +799,15 @@ static const video_renderer_funcs_t video_renderer_gstreamer_funcs = {
     .flush = video_renderer_gstreamer_flush,
     .destroy = video_renderer_gstreamer_destroy,
     .update_background = video_renderer_gstreamer_update_background,
+    .acquire_buffer = video_renderer_gstreamer_acquire_buffer,
+    .submit_buffer = video_renderer_gstreamer_submit_buffer,
+    .release_buffer = video_renderer_gstreamer_release_buffer,
+    .render_frame = video_renderer_gstreamer_render_frame,
+    .get_stats = video_renderer_gstreamer_get_stats,
+    .get_caps = video_renderer_gstreamer_get_caps,
+    .set_codec = video_renderer_gstreamer_set_codec,
+    .reconfigure = video_renderer_gstreamer_reconfigure,
+    .suspend = video_renderer_gstreamer_suspend,
+    .resume = video_renderer_gstreamer_resume,
+    .get_memory = video_renderer_gstreamer_get_memory,
 };
@@ -0,0 +1,1431 @@
+/**
+ * RPiPlay - An open-source AirPlay mirroring server for Raspberry Pi
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+/*
+ * H264 and HEVC renderer using a V4L2 stateful decoder and a KMS overlay plane,
+ * for the Raspberry Pi 4 and other boards without the legacy OpenMAX stack.
+ * Compressed frames are written into the decoder's OUTPUT queue, decoded
+ * frames are exported from its CAPTURE queue as DMABUFs, imported as DRM
+ * framebuffers and scanned out directly, so decoded frames are never copied.
+ * Frames are put on screen at the display's vblank, the newest one decoded
+ * since the last vblank, so uneven arrival doesn't turn into uneven frame times.
+ * With several tiles every one gets an overlay plane of its own on the same
+ * CRTC, so the display hardware composes them and no pixel is copied.
+ */
+
+#include "video_renderer.h"
+
+#include <stdlib.h>
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <linux/videodev2.h>
+
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+#include <drm_fourcc.h>
+
+#include "../lib/threads.h"
+#include "../lib/trace.h"
+#include "h264_sps_patch.h"
+#include "refresh_match.h"
+
+#define MIN(X, Y) (((X) < (Y)) ? (X) : (Y))
+
+/* Where the Raspberry Pi's bcm2835-codec decoder lives, other nodes are probed if it isn't */
+#define KMS_DECODER_DEVICE "/dev/video10"
+#define KMS_MAX_VIDEO_DEVICES 32
+#define KMS_MAX_CARDS 4
+
+/* Compressed input buffers, unless configured otherwise */
+#define KMS_OUTPUT_BUFFERS 8
+#define KMS_OUTPUT_BUFFER_SIZE (512 * 1024)
+#define KMS_MAX_OUTPUT_BUFFERS 32
+
+/* Decoded frames on top of the decoder's minimum: one on screen, one waiting to replace it */
+#define KMS_EXTRA_CAPTURE_BUFFERS 2
+#define KMS_MAX_CAPTURE_BUFFERS 32
+
+/* How long render_buffer waits for the decoder to free an input buffer */
+#define INPUT_BUFFER_TIMEOUT_MS 100
+
+/* How often the display thread checks whether it should stop */
+#define DISPLAY_POLL_TIMEOUT_MS 100
+/* Polls destroy waits for a vblank event another tile's thread may read */
+#define KMS_VBLANK_DRAIN_POLLS 5
+
+typedef struct video_renderer_kms_output_s {
+    void *start;
+    size_t length;
+    /* Handed to the receive thread by acquire_buffer and not submitted or released yet */
+    bool acquired;
+} video_renderer_kms_output_t;
+
+typedef struct video_renderer_kms_capture_s {
+    int dmabuf_fd;
+    uint32_t handle;
+    uint32_t fb_id;
+    /* The framebuffer still has the size from before a resolution change, it is replaced before the
+     * buffer is decoded into again. Only the frame on screen during the change is left like this. */
+    bool stale;
+} video_renderer_kms_capture_t;
+
+typedef struct video_renderer_kms_s {
+    video_renderer_t base;
+    video_renderer_config_t const *config;
+
+    int decoder_fd;
+    video_codec_t codec;
+    /* Some decoder takes HEVC, probed at init */
+    bool has_hevc;
+
+    /* Compressed input, the free list is shared by the receive and the mirror thread */
+    video_renderer_kms_output_t output[KMS_MAX_OUTPUT_BUFFERS];
+    unsigned int output_count;
+    unsigned int output_free[KMS_MAX_OUTPUT_BUFFERS];
+    unsigned int output_free_count;
+    /* Bumped when the decoder is reopened for another codec. Buffers the receive thread still held
+     * then stay mapped in retired until their stale handle comes back. */
+    unsigned int output_generation;
+    video_renderer_kms_output_t retired[KMS_MAX_OUTPUT_BUFFERS];
+    mutex_handle_t output_mutex;
+
+    /* Decoded frames and everything on screen, owned by whoever holds display_mutex */
+    video_renderer_kms_capture_t capture[KMS_MAX_CAPTURE_BUFFERS];
+    unsigned int capture_count;
+    bool capture_streaming;
+    /* Bytes in each decoded frame buffer, a new resolution that fits keeps them */
+    uint32_t capture_size;
+    uint32_t frame_width;
+    uint32_t frame_height;
+    uint32_t frame_pitch;
+    struct v4l2_rect visible;
+    int displayed;
+    /* Decoded frame waiting for the next vblank and its pts, -1 if there is none */
+    int pending;
+    uint64_t pending_pts;
+    /* A vblank event was asked for and hasn't come in yet, or the driver has none to give */
+    bool vblank_requested;
+    bool vblank_unavailable;
+    mutex_handle_t display_mutex;
+
+    int drm_fd;
+    uint32_t connector_id;
+    int crtc_index;
+    uint32_t crtc_id;
+    uint32_t plane_id;
+    drmModeModeInfo mode;
+    drmModeCrtc *saved_crtc;
+    /* With refresh rate matching, on the mirror thread. mode_switched is set once mode is no longer the saved one */
+    refresh_match_t refresh_match;
+    bool mode_switched;
+
+    /* Black framebuffer on the primary plane, behind the video */
+    int background_visits;
+    uint32_t background_handle;
+    uint32_t background_fb;
+    bool background_shown;
+
+    thread_handle_t thread;
+    bool running;
+
+    uint64_t input_frames;
+    uint64_t input_timeouts;
+    uint64_t split_frames;
+    uint64_t frames_shown;
+    uint64_t frames_skipped;
+    /* Pictures the decoder flagged as broken */
+    uint64_t decode_errors;
+    /* Time from its pts until the latest frame was shown */
+    bool has_presentation_offset;
+    int64_t presentation_offset;
+
+    h264_sps_patch_t *sps_patch;
+} video_renderer_kms_t;
+
+static const video_renderer_funcs_t video_renderer_kms_funcs;
+
+/*
+ * The card the tiles of a multi-view share. Only the first opener of a card is its DRM master and
+ * may set planes, so the other tiles use duplicates of that descriptor. Their vblank events all
+ * arrive on it and may be read by any tile's thread, the handler takes the right tile's lock.
+ */
+static pthread_mutex_t kms_card_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int kms_card_fd = -1;
+static int kms_card_users = 0;
+
+static int video_renderer_kms_ioctl(int fd, unsigned long request, void *arg) {
+    int ret;
+    do {
+        ret = ioctl(fd, request, arg);
+    } while (ret < 0 && errno == EINTR);
+    return ret;
+}
+
+static uint64_t video_renderer_kms_now_ms(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (uint64_t) time.tv_sec * 1000 + time.tv_nsec / 1000000;
+}
+
+static uint32_t video_renderer_kms_pixelformat(video_codec_t codec) {
+    return codec == VIDEO_CODEC_H265 ? V4L2_PIX_FMT_HEVC : V4L2_PIX_FMT_H264;
+}
+
+static const char *video_renderer_kms_codec_name(video_codec_t codec) {
+    return codec == VIDEO_CODEC_H265 ? "HEVC" : "H.264";
+}
+
+static bool video_renderer_kms_is_decoder(int fd, uint32_t pixelformat) {
+    struct v4l2_capability cap;
+    struct v4l2_fmtdesc fmt;
+    uint32_t caps;
+
+    memset(&cap, 0, sizeof(cap));
+    if (video_renderer_kms_ioctl(fd, VIDIOC_QUERYCAP, &cap) < 0) return false;
+    caps = (cap.capabilities & V4L2_CAP_DEVICE_CAPS) ? cap.device_caps : cap.capabilities;
+    if (!(caps & V4L2_CAP_VIDEO_M2M_MPLANE) || !(caps & V4L2_CAP_STREAMING)) return false;
+
+    memset(&fmt, 0, sizeof(fmt));
+    fmt.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+    while (video_renderer_kms_ioctl(fd, VIDIOC_ENUM_FMT, &fmt) == 0) {
+        if (fmt.pixelformat == pixelformat) return true;
+        fmt.index++;
+    }
+    return false;
+}
+
+/* Opens the first decoder node that takes pixelformat, its path goes into path */
+static int video_renderer_kms_find_decoder(uint32_t pixelformat, char *path, size_t path_size) {
+    int fd;
+
+    snprintf(path, path_size, "%s", KMS_DECODER_DEVICE);
+    fd = open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (fd >= 0 && video_renderer_kms_is_decoder(fd, pixelformat)) {
+        return fd;
+    }
+    if (fd >= 0) close(fd);
+
+    for (int i = 0; i < KMS_MAX_VIDEO_DEVICES; i++) {
+        snprintf(path, path_size, "/dev/video%d", i);
+        fd = open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+        if (fd < 0) continue;
+        if (video_renderer_kms_is_decoder(fd, pixelformat)) {
+            return fd;
+        }
+        close(fd);
+    }
+    return -1;
+}
+
+static int video_renderer_kms_init_decoder(video_renderer_kms_t *r, video_codec_t codec) {
+    struct v4l2_format fmt;
+    struct v4l2_requestbuffers req;
+    struct v4l2_event_subscription sub;
+    int type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+    char path[32];
+
+    r->codec = codec;
+    if ((r->decoder_fd = video_renderer_kms_find_decoder(video_renderer_kms_pixelformat(codec), path, sizeof(path))) < 0) {
+        logger_log(r->base.logger, LOGGER_ERR, "No V4L2 stateful %s decoder found", video_renderer_kms_codec_name(codec));
+        return -1;
+    }
+    logger_log(r->base.logger, LOGGER_INFO, "Using the V4L2 %s decoder at %s", video_renderer_kms_codec_name(codec), path);
+
+    memset(&fmt, 0, sizeof(fmt));
+    fmt.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+    fmt.fmt.pix_mp.pixelformat = video_renderer_kms_pixelformat(codec);
+    fmt.fmt.pix_mp.width = 1920;
+    fmt.fmt.pix_mp.height = 1080;
+    fmt.fmt.pix_mp.num_planes = 1;
+    fmt.fmt.pix_mp.plane_fmt[0].sizeimage = r->config->decoder_buffer_size > 0 ?
+                                            r->config->decoder_buffer_size : KMS_OUTPUT_BUFFER_SIZE;
+    if (video_renderer_kms_ioctl(r->decoder_fd, VIDIOC_S_FMT, &fmt) < 0) {
+        logger_log(r->base.logger, LOGGER_ERR, "Could not set the decoder input format: %s", strerror(errno));
+        return -1;
+    }
+
+    memset(&req, 0, sizeof(req));
+    req.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+    req.memory = V4L2_MEMORY_MMAP;
+    req.count = r->config->decoder_buffers > 0 ? r->config->decoder_buffers : KMS_OUTPUT_BUFFERS;
+    if (req.count > KMS_MAX_OUTPUT_BUFFERS) req.count = KMS_MAX_OUTPUT_BUFFERS;
+    if (video_renderer_kms_ioctl(r->decoder_fd, VIDIOC_REQBUFS, &req) < 0 || req.count == 0) {
+        logger_log(r->base.logger, LOGGER_ERR, "Could not allocate decoder input buffers: %s", strerror(errno));
+        return -1;
+    }
+
+    for (unsigned int i = 0; i < req.count && i < KMS_MAX_OUTPUT_BUFFERS; i++) {
+        struct v4l2_buffer buf;
+        struct v4l2_plane planes[VIDEO_MAX_PLANES];
+
+        memset(&buf, 0, sizeof(buf));
+        memset(planes, 0, sizeof(planes));
+        buf.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+        buf.memory = V4L2_MEMORY_MMAP;
+        buf.index = i;
+        buf.m.planes = planes;
+        buf.length = 1;
+        if (video_renderer_kms_ioctl(r->decoder_fd, VIDIOC_QUERYBUF, &buf) < 0) {
+            logger_log(r->base.logger, LOGGER_ERR, "Could not query decoder input buffer %u", i);
+            return -1;
+        }
+        r->output[i].length = planes[0].length;
+        r->output[i].start = mmap(NULL, planes[0].length, PROT_READ | PROT_WRITE, MAP_SHARED,
+                                  r->decoder_fd, planes[0].m.mem_offset);
+        if (r->output[i].start == MAP_FAILED) {
+            r->output[i].start = NULL;
+            logger_log(r->base.logger, LOGGER_ERR, "Could not map decoder input buffer %u", i);
+            return -1;
+        }
+        r->output_count++;
+        r->output_free[r->output_free_count++] = i;
+    }
+    logger_log(r->base.logger, LOGGER_DEBUG, "Decoder has %u input buffers of %zu bytes",
+               r->output_count, r->output[0].length);
+
+    memset(&sub, 0, sizeof(sub));
+    sub.type = V4L2_EVENT_SOURCE_CHANGE;
+    if (video_renderer_kms_ioctl(r->decoder_fd, VIDIOC_SUBSCRIBE_EVENT, &sub) < 0) {
+        logger_log(r->base.logger, LOGGER_ERR, "Could not subscribe to decoder source changes");
+        return -1;
+    }
+
+    if (video_renderer_kms_ioctl(r->decoder_fd, VIDIOC_STREAMON, &type) < 0) {
+        logger_log(r->base.logger, LOGGER_ERR, "Could not start the decoder input: %s", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+static bool video_renderer_kms_plane_supports(drmModePlane *plane, uint32_t format) {
+    for (uint32_t i = 0; i < plane->count_formats; i++) {
+        if (plane->formats[i] == format) return true;
+    }
+    return false;
+}
+
+/* Picks a connected output on this card, its CRTC and an overlay plane that can show NV12, a tile the tile-th of them */
+static int video_renderer_kms_find_output(video_renderer_kms_t *r) {
+    drmModeRes *res;
+    drmModePlaneRes *planes;
+    int crtc_index = -1;
+    int skip = r->config->tile_count > 1 ? r->config->tile : 0;
+
+    if (!(res = drmModeGetResources(r->drm_fd))) return -1;
+
+    for (int i = 0; i < res->count_connectors && !r->crtc_id; i++) {
+        drmModeConnector *connector = drmModeGetConnector(r->drm_fd, res->connectors[i]);
+        if (!connector) continue;
+        if (connector->connection == DRM_MODE_CONNECTED && connector->count_modes > 0) {
+            drmModeEncoder *encoder = connector->encoder_id ? drmModeGetEncoder(r->drm_fd, connector->encoder_id) : NULL;
+            for (int j = 0; j < res->count_crtcs; j++) {
+                bool current = encoder && encoder->crtc_id == res->crtcs[j];
+                bool possible = encoder && (encoder->possible_crtcs & (1 << j));
+                if (current || (!encoder && j == 0) || (possible && crtc_index < 0)) {
+                    crtc_index = j;
+                    if (current) break;
+                }
+            }
+            if (crtc_index >= 0) {
+                r->connector_id = connector->connector_id;
+                r->crtc_id = res->crtcs[crtc_index];
+                r->crtc_index = crtc_index;
+                r->mode = connector->modes[0];
+            }
+            if (encoder) drmModeFreeEncoder(encoder);
+        }
+        drmModeFreeConnector(connector);
+    }
+    drmModeFreeResources(res);
+    if (!r->crtc_id) return -1;
+
+    // Keep the mode the console is using if there is one
+    r->saved_crtc = drmModeGetCrtc(r->drm_fd, r->crtc_id);
+    if (r->saved_crtc && r->saved_crtc->mode_valid) {
+        r->mode = r->saved_crtc->mode;
+    }
+
+    // Without DRM_CLIENT_CAP_UNIVERSAL_PLANES only overlay planes are listed
+    if (!(planes = drmModeGetPlaneResources(r->drm_fd))) return -1;
+    for (uint32_t i = 0; i < planes->count_planes && !r->plane_id; i++) {
+        drmModePlane *plane = drmModeGetPlane(r->drm_fd, planes->planes[i]);
+        if (!plane) continue;
+        if ((plane->possible_crtcs & (1 << crtc_index)) && video_renderer_kms_plane_supports(plane, DRM_FORMAT_NV12) &&
+            skip-- == 0) {
+            r->plane_id = plane->plane_id;
+        }
+        drmModeFreePlane(plane);
+    }
+    drmModeFreePlaneResources(planes);
+    return r->plane_id ? 0 : -1;
+}
+
+static int video_renderer_kms_init_display(video_renderer_kms_t *r) {
+    char path[32];
+    bool tiled = r->config->tile_count > 1;
+
+    pthread_mutex_lock(&kms_card_mutex);
+    if (tiled && kms_card_fd >= 0) {
+        // Another tile has the card already
+        if ((r->drm_fd = fcntl(kms_card_fd, F_DUPFD_CLOEXEC, 0)) >= 0 && video_renderer_kms_find_output(r) == 0) {
+            kms_card_users++;
+            pthread_mutex_unlock(&kms_card_mutex);
+            logger_log(r->base.logger, LOGGER_INFO, "Showing tile %d on plane %u at %ux%u",
+                       r->config->tile + 1, r->plane_id, r->mode.hdisplay, r->mode.vdisplay);
+            return 0;
+        }
+        pthread_mutex_unlock(&kms_card_mutex);
+        if (r->drm_fd >= 0) close(r->drm_fd);
+        r->drm_fd = -1;
+        logger_log(r->base.logger, LOGGER_ERR, "The display has no NV12 overlay plane left for tile %d", r->config->tile + 1);
+        return -1;
+    }
+    for (int i = 0; i < KMS_MAX_CARDS; i++) {
+        snprintf(path, sizeof(path), "/dev/dri/card%d", i);
+        if ((r->drm_fd = open(path, O_RDWR | O_CLOEXEC)) < 0) continue;
+        if (video_renderer_kms_find_output(r) == 0) {
+            logger_log(r->base.logger, LOGGER_INFO, "Showing video on plane %u of %s at %ux%u",
+                       r->plane_id, path, r->mode.hdisplay, r->mode.vdisplay);
+            if (tiled && (kms_card_fd = fcntl(r->drm_fd, F_DUPFD_CLOEXEC, 0)) >= 0) {
+                kms_card_users = 1;
+            }
+            pthread_mutex_unlock(&kms_card_mutex);
+            return 0;
+        }
+        if (r->saved_crtc) drmModeFreeCrtc(r->saved_crtc);
+        r->saved_crtc = NULL;
+        r->connector_id = r->crtc_id = r->plane_id = 0;
+        close(r->drm_fd);
+    }
+    pthread_mutex_unlock(&kms_card_mutex);
+    r->drm_fd = -1;
+    logger_log(r->base.logger, LOGGER_ERR, "No KMS display with an NV12 overlay plane found");
+    return -1;
+}
+
+/* Lets go of the card the tiles share once the last of them is gone */
+static void video_renderer_kms_release_card(video_renderer_kms_t *r) {
+    if (r->config->tile_count <= 1) return;
+    pthread_mutex_lock(&kms_card_mutex);
+    if (kms_card_fd >= 0 && --kms_card_users == 0) {
+        close(kms_card_fd);
+        kms_card_fd = -1;
+    }
+    pthread_mutex_unlock(&kms_card_mutex);
+}
+
+static int video_renderer_kms_create_background(video_renderer_kms_t *r) {
+    struct drm_mode_create_dumb create;
+    struct drm_mode_map_dumb map;
+    void *pixels;
+
+    memset(&create, 0, sizeof(create));
+    create.width = r->mode.hdisplay;
+    create.height = r->mode.vdisplay;
+    create.bpp = 32;
+    if (drmIoctl(r->drm_fd, DRM_IOCTL_MODE_CREATE_DUMB, &create) < 0) return -1;
+    r->background_handle = create.handle;
+
+    memset(&map, 0, sizeof(map));
+    map.handle = create.handle;
+    if (drmIoctl(r->drm_fd, DRM_IOCTL_MODE_MAP_DUMB, &map) < 0) return -1;
+    pixels = mmap(NULL, create.size, PROT_READ | PROT_WRITE, MAP_SHARED, r->drm_fd, map.offset);
+    if (pixels == MAP_FAILED) return -1;
+    memset(pixels, 0, create.size);
+    munmap(pixels, create.size);
+
+    return drmModeAddFB(r->drm_fd, create.width, create.height, 24, 32, create.pitch,
+                        create.handle, &r->background_fb);
+}
+
+static void video_renderer_kms_destroy_background(video_renderer_kms_t *r) {
+    if (r->background_fb) {
+        drmModeRmFB(r->drm_fd, r->background_fb);
+        r->background_fb = 0;
+    }
+    if (r->background_handle) {
+        struct drm_mode_destroy_dumb destroy = { .handle = r->background_handle };
+        drmIoctl(r->drm_fd, DRM_IOCTL_MODE_DESTROY_DUMB, &destroy);
+        r->background_handle = 0;
+    }
+}
+
+/* Must be called with display_mutex held */
+static void video_renderer_kms_render_background(video_renderer_kms_t *r) {
+    if (r->background_shown) return;
+    if (drmModeSetCrtc(r->drm_fd, r->crtc_id, r->background_fb, 0, 0, &r->connector_id, 1, &r->mode) < 0) {
+        logger_log(r->base.logger, LOGGER_ERR, "Could not show the background: %s", strerror(errno));
+        return;
+    }
+    r->background_shown = true;
+}
+
+/* Must be called with display_mutex held */
+static void video_renderer_kms_remove_background(video_renderer_kms_t *r) {
+    drmModeCrtc *saved = r->saved_crtc;
+    if (!r->background_shown) return;
+    // Give the display back to whatever was on it, the console usually
+    if (saved && saved->buffer_id) {
+        drmModeSetCrtc(r->drm_fd, saved->crtc_id, saved->buffer_id, saved->x, saved->y,
+                       &r->connector_id, 1, &saved->mode);
+        r->background_shown = false;
+    }
+}
+
+static void video_renderer_kms_update_background(video_renderer_t *renderer, int type) {
+    video_renderer_kms_t *r = (video_renderer_kms_t *)renderer;
+    if (type < 0) {
+        r->background_visits--;
+    } else if (type > 0) {
+        r->background_visits++;
+    }
+    if (r->background_visits < 0) {
+        r->background_visits = 0;
+    }
+
+    MUTEX_LOCK(r->display_mutex);
+    if (r->config->background_mode == BACKGROUND_MODE_ON) {
+        video_renderer_kms_render_background(r);
+    } else if (r->config->background_mode == BACKGROUND_MODE_AUTO) {
+        // Show background when connection is made and hide background when all connections are gone
+        if (r->background_visits > 0) {
+            video_renderer_kms_render_background(r);
+        } else {
+            video_renderer_kms_remove_background(r);
+        }
+    }
+    MUTEX_UNLOCK(r->display_mutex);
+}
+
+/* (Re)creates the framebuffer of a decoded frame buffer for the current frame size */
+static int video_renderer_kms_add_fb(video_renderer_kms_t *r, video_renderer_kms_capture_t *capture) {
+    uint32_t handles[4] = { 0 }, pitches[4] = { 0 }, offsets[4] = { 0 };
+
+    if (capture->fb_id) {
+        drmModeRmFB(r->drm_fd, capture->fb_id);
+        capture->fb_id = 0;
+    }
+    capture->stale = false;
+    // Contiguous NV12: the interleaved chroma plane follows the luma plane in the same buffer
+    handles[0] = handles[1] = capture->handle;
+    pitches[0] = pitches[1] = r->frame_pitch;
+    offsets[1] = r->frame_pitch * r->frame_height;
+    return drmModeAddFB2(r->drm_fd, r->frame_width, r->frame_height, DRM_FORMAT_NV12,
+                         handles, pitches, offsets, &capture->fb_id, 0);
+}
+
+/* Hands a decoded frame back to the decoder to be decoded into again */
+static void video_renderer_kms_requeue_capture(video_renderer_kms_t *r, int index) {
+    struct v4l2_buffer buf;
+    struct v4l2_plane planes[VIDEO_MAX_PLANES];
+
+    if (r->capture[index].stale && video_renderer_kms_add_fb(r, &r->capture[index]) < 0) {
+        logger_log(r->base.logger, LOGGER_ERR, "Could not create a framebuffer for frame buffer %d: %s", index, strerror(errno));
+    }
+
+    memset(&buf, 0, sizeof(buf));
+    memset(planes, 0, sizeof(planes));
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+    buf.memory = V4L2_MEMORY_MMAP;
+    buf.index = index;
+    buf.m.planes = planes;
+    buf.length = 1;
+    video_renderer_kms_ioctl(r->decoder_fd, VIDIOC_QBUF, &buf);
+}
+
+/* Must be called with display_mutex held */
+static void video_renderer_kms_hide_video(video_renderer_kms_t *r) {
+    drmModeSetPlane(r->drm_fd, r->plane_id, r->crtc_id, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    if (r->displayed >= 0) {
+        video_renderer_kms_requeue_capture(r, r->displayed);
+        r->displayed = -1;
+    }
+    if (r->pending >= 0) {
+        video_renderer_kms_requeue_capture(r, r->pending);
+        r->pending = -1;
+    }
+}
+
+/* Must be called with display_mutex held */
+static void video_renderer_kms_release_capture(video_renderer_kms_t *r) {
+    struct v4l2_requestbuffers req;
+    int type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+
+    if (r->capture_streaming) {
+        video_renderer_kms_ioctl(r->decoder_fd, VIDIOC_STREAMOFF, &type);
+        r->capture_streaming = false;
+    }
+    // Also after a resize that failed half way, which stopped streaming already
+    if (r->capture_count) {
+        drmModeSetPlane(r->drm_fd, r->plane_id, r->crtc_id, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+        r->displayed = -1;
+        r->pending = -1;
+    }
+    for (unsigned int i = 0; i < r->capture_count; i++) {
+        video_renderer_kms_capture_t *capture = &r->capture[i];
+        if (capture->fb_id) drmModeRmFB(r->drm_fd, capture->fb_id);
+        if (capture->handle) {
+            struct drm_gem_close gem_close = { .handle = capture->handle };
+            drmIoctl(r->drm_fd, DRM_IOCTL_GEM_CLOSE, &gem_close);
+        }
+        if (capture->dmabuf_fd >= 0) close(capture->dmabuf_fd);
+    }
+    r->capture_count = 0;
+
+    memset(&req, 0, sizeof(req));
+    req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+    req.memory = V4L2_MEMORY_MMAP;
+    video_renderer_kms_ioctl(r->decoder_fd, VIDIOC_REQBUFS, &req);
+}
+
+static void video_renderer_kms_update_visible(video_renderer_kms_t *r) {
+    struct v4l2_selection selection;
+
+    // The decoded picture may be smaller than the buffers, which are padded to whole macroblocks
+    memset(&selection, 0, sizeof(selection));
+    selection.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    selection.target = V4L2_SEL_TGT_COMPOSE;
+    if (video_renderer_kms_ioctl(r->decoder_fd, VIDIOC_G_SELECTION, &selection) == 0) {
+        r->visible = selection.r;
+    } else {
+        r->visible.left = r->visible.top = 0;
+        r->visible.width = r->frame_width;
+        r->visible.height = r->frame_height;
+    }
+}
+
+/*
+ * Takes a new resolution into the decoded frame buffers there are, when they are large and many enough,
+ * as after the sender rotated. The frame on screen stays there until the first one in the new size
+ * replaces it. Must be called with display_mutex held
+ */
+static int video_renderer_kms_resize_capture(video_renderer_kms_t *r, struct v4l2_format *fmt, int min_buffers) {
+    int type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+
+    if (!r->capture_streaming || fmt->fmt.pix_mp.plane_fmt[0].sizeimage > r->capture_size ||
+        (unsigned int) min_buffers + KMS_EXTRA_CAPTURE_BUFFERS > r->capture_count) {
+        return -1;
+    }
+    if (video_renderer_kms_ioctl(r->decoder_fd, VIDIOC_STREAMOFF, &type) < 0) return -1;
+    r->capture_streaming = false;
+    if (r->pending >= 0) {
+        r->pending = -1;
+        r->frames_skipped++;
+    }
+
+    uint32_t old_width = r->visible.width, old_height = r->visible.height;
+    r->frame_width = fmt->fmt.pix_mp.width;
+    r->frame_height = fmt->fmt.pix_mp.height;
+    r->frame_pitch = fmt->fmt.pix_mp.plane_fmt[0].bytesperline;
+    video_renderer_kms_update_visible(r);
+
+    for (unsigned int i = 0; i < r->capture_count; i++) {
+        if ((int) i == r->displayed) {
+            // Scanned out right now, removing its framebuffer would blank the plane
+            r->capture[i].stale = true;
+            continue;
+        }
+        if (video_renderer_kms_add_fb(r, &r->capture[i]) < 0) {
+            logger_log(r->base.logger, LOGGER_ERR, "Could not create a framebuffer for frame buffer %u: %s",
+                       i, strerror(errno));
+            return -1;
+        }
+        video_renderer_kms_requeue_capture(r, (int) i);
+    }
+    if (video_renderer_kms_ioctl(r->decoder_fd, VIDIOC_STREAMON, &type) < 0) return -1;
+    r->capture_streaming = true;
+
+    logger_log(r->base.logger, LOGGER_INFO, "Video size changed from %ux%u to %ux%u, keeping the %u frame buffers",
+               old_width, old_height, r->visible.width, r->visible.height, r->capture_count);
+    return 0;
+}
+
+/* (Re)creates the decoded frame buffers after the decoder reported the stream format.
+ * Must be called with display_mutex held */
+static int video_renderer_kms_setup_capture(video_renderer_kms_t *r) {
+    struct v4l2_format fmt;
+    struct v4l2_control ctrl;
+    struct v4l2_requestbuffers req;
+    int type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+
+    memset(&fmt, 0, sizeof(fmt));
+    fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+    if (video_renderer_kms_ioctl(r->decoder_fd, VIDIOC_G_FMT, &fmt) < 0) return -1;
+    if (fmt.fmt.pix_mp.pixelformat != V4L2_PIX_FMT_NV12) {
+        fmt.fmt.pix_mp.pixelformat = V4L2_PIX_FMT_NV12;
+        if (video_renderer_kms_ioctl(r->decoder_fd, VIDIOC_S_FMT, &fmt) < 0 ||
+            fmt.fmt.pix_mp.pixelformat != V4L2_PIX_FMT_NV12) {
+            logger_log(r->base.logger, LOGGER_ERR, "Decoder can't output NV12");
+            return -1;
+        }
+    }
+    if (fmt.fmt.pix_mp.num_planes != 1) {
+        logger_log(r->base.logger, LOGGER_ERR, "Decoder uses %d planes for NV12, only contiguous NV12 is supported",
+                   fmt.fmt.pix_mp.num_planes);
+        return -1;
+    }
+
+    memset(&ctrl, 0, sizeof(ctrl));
+    ctrl.id = V4L2_CID_MIN_BUFFERS_FOR_CAPTURE;
+    if (video_renderer_kms_ioctl(r->decoder_fd, VIDIOC_G_CTRL, &ctrl) < 0) {
+        ctrl.value = 4;
+    }
+
+    if (video_renderer_kms_resize_capture(r, &fmt, ctrl.value) == 0) {
+        return 0;
+    }
+    video_renderer_kms_release_capture(r);
+
+    r->frame_width = fmt.fmt.pix_mp.width;
+    r->frame_height = fmt.fmt.pix_mp.height;
+    r->frame_pitch = fmt.fmt.pix_mp.plane_fmt[0].bytesperline;
+    video_renderer_kms_update_visible(r);
+
+    memset(&req, 0, sizeof(req));
+    req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+    req.memory = V4L2_MEMORY_MMAP;
+    req.count = MIN(ctrl.value + KMS_EXTRA_CAPTURE_BUFFERS, KMS_MAX_CAPTURE_BUFFERS);
+    if (video_renderer_kms_ioctl(r->decoder_fd, VIDIOC_REQBUFS, &req) < 0 || req.count == 0) {
+        logger_log(r->base.logger, LOGGER_ERR, "Could not allocate decoded frame buffers: %s", strerror(errno));
+        return -1;
+    }
+
+    for (unsigned int i = 0; i < req.count && i < KMS_MAX_CAPTURE_BUFFERS; i++) {
+        video_renderer_kms_capture_t *capture = &r->capture[i];
+        struct v4l2_exportbuffer expbuf;
+
+        memset(capture, 0, sizeof(video_renderer_kms_capture_t));
+        capture->dmabuf_fd = -1;
+        r->capture_count++;
+
+        memset(&expbuf, 0, sizeof(expbuf));
+        expbuf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+        expbuf.index = i;
+        expbuf.plane = 0;
+        expbuf.flags = O_RDONLY | O_CLOEXEC;
+        if (video_renderer_kms_ioctl(r->decoder_fd, VIDIOC_EXPBUF, &expbuf) < 0) {
+            logger_log(r->base.logger, LOGGER_ERR, "Could not export decoded frame buffer %u: %s", i, strerror(errno));
+            return -1;
+        }
+        capture->dmabuf_fd = expbuf.fd;
+        if (drmPrimeFDToHandle(r->drm_fd, capture->dmabuf_fd, &capture->handle) < 0) {
+            logger_log(r->base.logger, LOGGER_ERR, "Could not import decoded frame buffer %u: %s", i, strerror(errno));
+            return -1;
+        }
+        if (video_renderer_kms_add_fb(r, capture) < 0) {
+            logger_log(r->base.logger, LOGGER_ERR, "Could not create a framebuffer for frame buffer %u: %s",
+                       i, strerror(errno));
+            return -1;
+        }
+    }
+    r->capture_size = fmt.fmt.pix_mp.plane_fmt[0].sizeimage;
+
+    for (unsigned int i = 0; i < r->capture_count; i++) {
+        struct v4l2_buffer buf;
+        struct v4l2_plane planes[VIDEO_MAX_PLANES];
+
+        memset(&buf, 0, sizeof(buf));
+        memset(planes, 0, sizeof(planes));
+        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+        buf.memory = V4L2_MEMORY_MMAP;
+        buf.index = i;
+        buf.m.planes = planes;
+        buf.length = 1;
+        if (video_renderer_kms_ioctl(r->decoder_fd, VIDIOC_QBUF, &buf) < 0) return -1;
+    }
+    if (video_renderer_kms_ioctl(r->decoder_fd, VIDIOC_STREAMON, &type) < 0) return -1;
+    r->capture_streaming = true;
+
+    logger_log(r->base.logger, LOGGER_INFO, "Decoding %ux%u video into %u frame buffers",
+               r->visible.width, r->visible.height, r->capture_count);
+    return 0;
+}
+
+/* Scales the visible part of a frame to fit the screen, keeping its aspect ratio.
+ * Must be called with display_mutex held */
+static void video_renderer_kms_show_frame(video_renderer_kms_t *r, int index) {
+    int tile_x = 0, tile_y = 0, tile_w = r->mode.hdisplay, tile_h = r->mode.vdisplay;
+    uint32_t src_w = r->visible.width, src_h = r->visible.height;
+    uint32_t dst_w, dst_h;
+
+    if (!src_w || !src_h) return;
+    if (r->config->tile_count > 1) {
+        video_renderer_tile_rect(r->config, r->mode.hdisplay, r->mode.vdisplay, &tile_x, &tile_y, &tile_w, &tile_h);
+    }
+    uint32_t screen_w = tile_w, screen_h = tile_h;
+    if ((uint64_t) src_w * screen_h > (uint64_t) src_h * screen_w) {
+        dst_w = screen_w;
+        dst_h = (uint32_t) ((uint64_t) src_h * screen_w / src_w);
+    } else {
+        dst_h = screen_h;
+        dst_w = (uint32_t) ((uint64_t) src_w * screen_h / src_h);
+    }
+
+    // The overlay plane needs an active CRTC underneath it
+    if (!r->background_shown && !(r->saved_crtc && r->saved_crtc->mode_valid)) {
+        video_renderer_kms_render_background(r);
+    }
+    if (drmModeSetPlane(r->drm_fd, r->plane_id, r->crtc_id, r->capture[index].fb_id, 0,
+                        tile_x + (screen_w - dst_w) / 2, tile_y + (screen_h - dst_h) / 2, dst_w, dst_h,
+                        (uint32_t) r->visible.left << 16, (uint32_t) r->visible.top << 16,
+                        src_w << 16, src_h << 16) < 0) {
+        logger_log(r->base.logger, LOGGER_ERR, "Could not show decoded frame: %s", strerror(errno));
+    }
+}
+
+/* Puts the pending frame on screen, and hands the one it replaces back to the decoder.
+ * Must be called with display_mutex held */
+static void video_renderer_kms_present(video_renderer_kms_t *r) {
+    if (r->pending < 0) return;
+
+    video_renderer_kms_show_frame(r, r->pending);
+    r->frames_shown++;
+    if (r->pending_pts) {
+        uint64_t now = raop_ntp_get_local_time(NULL);
+        r->presentation_offset = (int64_t) (now - r->pending_pts);
+        r->has_presentation_offset = true;
+        video_renderer_frame_presented(&r->base, r->pending_pts, now);
+    }
+
+    // The frame that was on screen until now can be decoded into again
+    if (r->displayed >= 0) {
+        video_renderer_kms_requeue_capture(r, r->displayed);
+    }
+    r->displayed = r->pending;
+    r->pending = -1;
+}
+
+/* Called without any display_mutex held, by the thread of whichever tile read the event */
+static void video_renderer_kms_vblank_handler(int fd, unsigned int sequence, unsigned int tv_sec, unsigned int tv_usec,
+                                              void *data) {
+    video_renderer_kms_t *r = data;
+    MUTEX_LOCK(r->display_mutex);
+    r->vblank_requested = false;
+    video_renderer_kms_present(r);
+    MUTEX_UNLOCK(r->display_mutex);
+}
+
+/* Asks for an event at the next vblank, or presents right away if the driver can't send one.
+ * Must be called with display_mutex held */
+static void video_renderer_kms_request_vblank(video_renderer_kms_t *r) {
+    drmVBlank vblank;
+
+    if (r->vblank_requested) return;
+    if (!r->vblank_unavailable) {
+        memset(&vblank, 0, sizeof(vblank));
+        vblank.request.type = DRM_VBLANK_RELATIVE | DRM_VBLANK_EVENT;
+        if (r->crtc_index == 1) {
+            vblank.request.type |= DRM_VBLANK_SECONDARY;
+        } else if (r->crtc_index > 1) {
+            vblank.request.type |= (r->crtc_index << DRM_VBLANK_HIGH_CRTC_SHIFT) & DRM_VBLANK_HIGH_CRTC_MASK;
+        }
+        vblank.request.sequence = 1;
+        vblank.request.signal = (unsigned long) r;
+        if (drmWaitVBlank(r->drm_fd, &vblank) == 0) {
+            r->vblank_requested = true;
+            return;
+        }
+        logger_log(r->base.logger, LOGGER_WARNING, "No vblank events from the display (%s), frames are shown as decoded",
+                   strerror(errno));
+        r->vblank_unavailable = true;
+    }
+    video_renderer_kms_present(r);
+}
+
+/* Keeps the newest decoded frame for the next vblank and hands the others back to the decoder.
+ * Must be called with display_mutex held */
+static void video_renderer_kms_dequeue_frames(video_renderer_kms_t *r) {
+    struct v4l2_buffer buf;
+    struct v4l2_plane planes[VIDEO_MAX_PLANES];
+    bool dequeued = false;
+
+    while (1) {
+        memset(&buf, 0, sizeof(buf));
+        memset(planes, 0, sizeof(planes));
+        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+        buf.memory = V4L2_MEMORY_MMAP;
+        buf.m.planes = planes;
+        buf.length = 1;
+        if (video_renderer_kms_ioctl(r->decoder_fd, VIDIOC_DQBUF, &buf) < 0) break;
+
+        if ((buf.flags & V4L2_BUF_FLAG_ERROR) || planes[0].bytesused == 0) {
+            if (buf.flags & V4L2_BUF_FLAG_ERROR) r->decode_errors++;
+            video_renderer_kms_ioctl(r->decoder_fd, VIDIOC_QBUF, &buf);
+            continue;
+        }
+        if (r->pending >= 0) {
+            // Decoded faster than the display shows frames, only the newest one matters
+            video_renderer_kms_requeue_capture(r, r->pending);
+            r->frames_skipped++;
+        }
+        r->pending = buf.index;
+        // The decoder copies the timestamp of the input buffer, which carries the pts
+        r->pending_pts = (uint64_t) buf.timestamp.tv_sec * 1000000 + buf.timestamp.tv_usec;
+        dequeued = true;
+    }
+    if (dequeued) video_renderer_kms_request_vblank(r);
+}
+
+static void video_renderer_kms_handle_events(video_renderer_kms_t *r) {
+    struct v4l2_event event;
+
+    while (1) {
+        memset(&event, 0, sizeof(event));
+        if (video_renderer_kms_ioctl(r->decoder_fd, VIDIOC_DQEVENT, &event) < 0) break;
+        if (event.type == V4L2_EVENT_SOURCE_CHANGE &&
+            (event.u.src_change.changes & V4L2_EVENT_SRC_CH_RESOLUTION)) {
+            if (video_renderer_kms_setup_capture(r) < 0) {
+                logger_log(r->base.logger, LOGGER_ERR, "Could not set up decoded frame buffers");
+                video_renderer_kms_release_capture(r);
+            }
+        }
+    }
+}
+
+static THREAD_RETVAL video_renderer_kms_thread(void *arg) {
+    video_renderer_kms_t *r = arg;
+    drmEventContext event_context = {
+        .version = 2,
+        .vblank_handler = video_renderer_kms_vblank_handler,
+    };
+
+    while (__atomic_load_n(&r->running, __ATOMIC_ACQUIRE)) {
+        struct pollfd pfd[2] = {
+            { .fd = r->decoder_fd, .events = POLLIN | POLLPRI },
+            { .fd = r->drm_fd, .events = POLLIN },
+        };
+        int ret = poll(pfd, 2, DISPLAY_POLL_TIMEOUT_MS);
+        if (ret <= 0) continue;
+
+        if (pfd[1].revents & POLLIN) {
+            drmHandleEvent(r->drm_fd, &event_context);
+        }
+        MUTEX_LOCK(r->display_mutex);
+        if (pfd[0].revents & POLLPRI) {
+            video_renderer_kms_handle_events(r);
+        }
+        if ((pfd[0].revents & POLLIN) && r->capture_streaming) {
+            video_renderer_kms_dequeue_frames(r);
+        }
+        MUTEX_UNLOCK(r->display_mutex);
+
+        // Polling a decoder with nothing queued reports an error right away
+        if ((pfd[0].revents & POLLERR) && !(pfd[0].revents & (POLLIN | POLLPRI)) && !(pfd[1].revents & POLLIN)) {
+            sleepms(10);
+        }
+    }
+    return 0;
+}
+
+/* Moves input buffers the decoder is done with to the free list.
+ * Must be called with output_mutex held */
+static void video_renderer_kms_reclaim_output(video_renderer_kms_t *r) {
+    struct v4l2_buffer buf;
+    struct v4l2_plane planes[VIDEO_MAX_PLANES];
+
+    while (1) {
+        memset(&buf, 0, sizeof(buf));
+        memset(planes, 0, sizeof(planes));
+        buf.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+        buf.memory = V4L2_MEMORY_MMAP;
+        buf.m.planes = planes;
+        buf.length = 1;
+        if (video_renderer_kms_ioctl(r->decoder_fd, VIDIOC_DQBUF, &buf) < 0) break;
+        r->output_free[r->output_free_count++] = buf.index;
+    }
+}
+
+/* Returns the index of a free input buffer, waiting up to timeout_ms for one, or -1 */
+static int video_renderer_kms_get_output(video_renderer_kms_t *r, int timeout_ms) {
+    uint64_t deadline = video_renderer_kms_now_ms() + timeout_ms;
+    int index = -1;
+
+    while (1) {
+        MUTEX_LOCK(r->output_mutex);
+        if (!r->output_free_count) {
+            video_renderer_kms_reclaim_output(r);
+        }
+        if (r->output_free_count) {
+            index = r->output_free[--r->output_free_count];
+        }
+        MUTEX_UNLOCK(r->output_mutex);
+
+        uint64_t now = video_renderer_kms_now_ms();
+        if (index >= 0 || now >= deadline) {
+            return index;
+        }
+        struct pollfd pfd = { .fd = r->decoder_fd, .events = POLLOUT };
+        poll(&pfd, 1, (int) (deadline - now));
+    }
+}
+
+static void video_renderer_kms_put_output(video_renderer_kms_t *r, int index) {
+    MUTEX_LOCK(r->output_mutex);
+    r->output_free[r->output_free_count++] = index;
+    MUTEX_UNLOCK(r->output_mutex);
+}
+
+static int video_renderer_kms_queue_output(video_renderer_kms_t *r, int index, int data_len, uint64_t pts) {
+    struct v4l2_buffer buf;
+    struct v4l2_plane planes[VIDEO_MAX_PLANES];
+
+    memset(&buf, 0, sizeof(buf));
+    memset(planes, 0, sizeof(planes));
+    buf.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+    buf.memory = V4L2_MEMORY_MMAP;
+    buf.index = index;
+    buf.m.planes = planes;
+    buf.length = 1;
+    planes[0].bytesused = data_len;
+    buf.timestamp.tv_sec = pts / 1000000;
+    buf.timestamp.tv_usec = pts % 1000000;
+    if (video_renderer_kms_ioctl(r->decoder_fd, VIDIOC_QBUF, &buf) < 0) {
+        logger_log(r->base.logger, LOGGER_ERR, "Video decoder refused processing buffer: %s", strerror(errno));
+        video_renderer_kms_put_output(r, index);
+        return -1;
+    }
+    return 0;
+}
+
+video_renderer_t *video_renderer_kms_init(logger_t *logger, video_renderer_config_t const *config) {
+    video_renderer_kms_t *renderer;
+
+    renderer = calloc(1, sizeof(video_renderer_kms_t));
+    if (!renderer) {
+        return NULL;
+    }
+    renderer->base.logger = logger;
+    renderer->base.funcs = &video_renderer_kms_funcs;
+    renderer->base.type = VIDEO_RENDERER_KMS;
+    renderer->config = config;
+    renderer->decoder_fd = -1;
+    renderer->drm_fd = -1;
+    renderer->displayed = -1;
+    renderer->pending = -1;
+    MUTEX_CREATE(renderer->output_mutex);
+    MUTEX_CREATE(renderer->display_mutex);
+
+    if (config->rotation != 0 || config->flip != FLIP_NONE) {
+        logger_log(logger, LOGGER_WARNING, "The kms renderer does not support rotation or flipping yet");
+    }
+
+    // The V4L2 decoders keep as many frames as the SPS allows, same as the OpenMAX one
+    renderer->sps_patch = h264_sps_patch_init(logger, H264_SPS_PATCH_REWRITE, h264_sps_patch_reorder_depth(config));
+    if (!renderer->sps_patch ||
+        video_renderer_kms_init_display(renderer) < 0 ||
+        video_renderer_kms_create_background(renderer) < 0 ||
+        video_renderer_kms_init_decoder(renderer, VIDEO_CODEC_H264) < 0) {
+        video_renderer_kms_funcs.destroy(&renderer->base);
+        return NULL;
+    }
+    char path[32];
+    int hevc_fd = video_renderer_kms_find_decoder(V4L2_PIX_FMT_HEVC, path, sizeof(path));
+    if (hevc_fd >= 0) {
+        logger_log(logger, LOGGER_INFO, "HEVC streams will be decoded at %s", path);
+        renderer->has_hevc = true;
+        close(hevc_fd);
+    }
+
+    renderer->running = true;
+    THREAD_CREATE(renderer->thread, video_renderer_kms_thread, renderer);
+    if (!renderer->thread) {
+        renderer->running = false;
+        video_renderer_kms_funcs.destroy(&renderer->base);
+        return NULL;
+    }
+
+    refresh_match_reset(&renderer->refresh_match, renderer->mode.vrefresh);
+    video_renderer_kms_update_background(&renderer->base, 0);
+    return &renderer->base;
+}
+
+static void video_renderer_kms_start(video_renderer_t *renderer) {
+}
+
+/*
+ * Switches the CRTC to the connector's mode of the same size whose refresh rate the stream's frame rate
+ * divides, once refresh_match finds the frame rate steady. Whatever the primary plane shows stays.
+ */
+static void video_renderer_kms_match_refresh(video_renderer_kms_t *r, uint64_t pts) {
+    uint64_t now = video_renderer_kms_now_ms() * 1000;
+    int rate = refresh_match_update(&r->refresh_match, pts, now);
+    if (!rate) return;
+
+    drmModeConnector *connector = drmModeGetConnector(r->drm_fd, r->connector_id);
+    int refresh = 0;
+    if (connector) {
+        int *rates = calloc(connector->count_modes, sizeof(int));
+        int count = rates ? connector->count_modes : 0;
+        for (int i = 0; i < count; i++) {
+            drmModeModeInfo *mode = &connector->modes[i];
+            // Modes of another size or scan don't count
+            bool fits = mode->hdisplay == r->mode.hdisplay && mode->vdisplay == r->mode.vdisplay &&
+                        (mode->flags & DRM_MODE_FLAG_INTERLACE) == (r->mode.flags & DRM_MODE_FLAG_INTERLACE);
+            rates[i] = fits ? (int) mode->vrefresh : 0;
+        }
+        refresh = refresh_match_pick(r->mode.vrefresh, rate, rates, count);
+        for (int i = 0; i < count && refresh; i++) {
+            if (rates[i] != refresh) continue;
+            MUTEX_LOCK(r->display_mutex);
+            drmModeCrtc *crtc = drmModeGetCrtc(r->drm_fd, r->crtc_id);
+            if (crtc && drmModeSetCrtc(r->drm_fd, r->crtc_id, crtc->buffer_id, crtc->x, crtc->y,
+                                       &r->connector_id, 1, &connector->modes[i]) == 0) {
+                logger_log(r->base.logger, LOGGER_INFO, "Switched the display from %u Hz to %d Hz for %d fps video",
+                           r->mode.vrefresh, refresh, rate);
+                r->mode = connector->modes[i];
+                r->mode_switched = true;
+            } else {
+                logger_log(r->base.logger, LOGGER_WARNING, "Could not switch the display to %d Hz for %d fps video: %s",
+                           refresh, rate, strerror(errno));
+                refresh = 0;
+            }
+            if (crtc) drmModeFreeCrtc(crtc);
+            MUTEX_UNLOCK(r->display_mutex);
+            break;
+        }
+        free(rates);
+        drmModeFreeConnector(connector);
+    }
+    if (!refresh) {
+        logger_log(r->base.logger, LOGGER_DEBUG, "No %ux%u display mode fits %d fps video",
+                   r->mode.hdisplay, r->mode.vdisplay, rate);
+    }
+    refresh_match_switched(&r->refresh_match, refresh, now);
+}
+
+static int video_renderer_kms_render_buffer(video_renderer_t *renderer, raop_ntp_t *ntp, unsigned char *data, int data_len,
+                                            uint64_t pts, int type, const h264_nal_unit_t *nal_units, int nal_count) {
+    video_renderer_kms_t *r = (video_renderer_kms_t *)renderer;
+    int offset = 0;
+
+    if (data_len == 0) return 0;
+
+    logger_log(renderer->logger, LOGGER_DEBUG, "Got h264 data of %d bytes", data_len);
+    r->input_frames++;
+
+    if (type == 0 && r->codec == VIDEO_CODEC_H264) {
+        data = h264_sps_patch_apply(r->sps_patch, data, &data_len, nal_units, nal_count);
+    }
+    if (r->config->match_refresh) {
+        video_renderer_kms_match_refresh(r, pts);
+    }
+
+    // Stateful decoders parse the byte stream themselves, so a frame may span several buffers
+    while (offset < data_len) {
+        int index = video_renderer_kms_get_output(r, INPUT_BUFFER_TIMEOUT_MS);
+        if (index < 0) {
+            // Give up on the rest of the frame rather than stall the mirror pipeline
+            r->input_timeouts++;
+            logger_log(renderer->logger, LOGGER_WARNING, "Video decoder busy for %d ms, dropped %d of %d bytes (%llu times)",
+                       INPUT_BUFFER_TIMEOUT_MS, data_len - offset, data_len, (unsigned long long) r->input_timeouts);
+            return -1;
+        }
+        int chunk_size = MIN(data_len - offset, (int) r->output[index].length);
+        memcpy(r->output[index].start, data + offset, chunk_size);
+        if (offset == 0 && chunk_size < data_len) {
+            r->split_frames++;
+        }
+        offset += chunk_size;
+        if (video_renderer_kms_queue_output(r, index, chunk_size, pts) < 0) {
+            return -1;
+        }
+    }
+    trace_event(TRACE_VIDEO_RENDERED, data_len, pts);
+    return 0;
+}
+
+static unsigned char *video_renderer_kms_acquire_buffer(video_renderer_t *renderer, int size, void **handle) {
+    video_renderer_kms_t *r = (video_renderer_kms_t *)renderer;
+    int index = -1;
+
+    // Frames that need more than one input buffer go through render_buffer
+    if (size <= 0 || (size_t) size > r->output[0].length) return NULL;
+
+    // Don't block, the caller is the network receive thread and falls back to its own buffer
+    MUTEX_LOCK(r->output_mutex);
+    if (!r->output_free_count) {
+        video_renderer_kms_reclaim_output(r);
+    }
+    if (r->output_free_count) {
+        index = r->output_free[--r->output_free_count];
+        r->output[index].acquired = true;
+    }
+    MUTEX_UNLOCK(r->output_mutex);
+    if (index < 0) return NULL;
+
+    *handle = (void *) (intptr_t) ((r->output_generation << 8) | (index + 1));
+    return r->output[index].start;
+}
+
+/* Returns the input buffer index of an acquired handle, or -1 for one from before the decoder was reopened,
+ * whose retired mapping is dropped. Must be called with output_mutex held */
+static int video_renderer_kms_take_handle(video_renderer_kms_t *r, void *handle) {
+    unsigned int value = (unsigned int) (intptr_t) handle;
+    int index = (int) (value & 0xff) - 1;
+
+    if ((value >> 8) != (r->output_generation & 0xffffff)) {
+        video_renderer_kms_output_t *retired = &r->retired[index];
+        if (retired->start) {
+            munmap(retired->start, retired->length);
+            retired->start = NULL;
+        }
+        return -1;
+    }
+    r->output[index].acquired = false;
+    return index;
+}
+
+static void video_renderer_kms_submit_buffer(video_renderer_t *renderer, raop_ntp_t *ntp, void *handle, int data_len,
+                                             uint64_t pts, int type, const h264_nal_unit_t *nal_units, int nal_count) {
+    video_renderer_kms_t *r = (video_renderer_kms_t *)renderer;
+    int index;
+
+    MUTEX_LOCK(r->output_mutex);
+    index = video_renderer_kms_take_handle(r, handle);
+    MUTEX_UNLOCK(r->output_mutex);
+    if (index < 0) {
+        // Written for the decoder of the previous codec
+        return;
+    }
+    logger_log(renderer->logger, LOGGER_DEBUG, "Got h264 data of %d bytes in place", data_len);
+    r->input_frames++;
+    if (r->config->match_refresh) {
+        video_renderer_kms_match_refresh(r, pts);
+    }
+    if (video_renderer_kms_queue_output(r, index, data_len, pts) == 0) {
+        trace_event(TRACE_VIDEO_RENDERED, data_len, pts);
+    }
+}
+
+static void video_renderer_kms_release_buffer(video_renderer_t *renderer, void *handle) {
+    video_renderer_kms_t *r = (video_renderer_kms_t *)renderer;
+    int index;
+
+    MUTEX_LOCK(r->output_mutex);
+    index = video_renderer_kms_take_handle(r, handle);
+    if (index >= 0) {
+        r->output_free[r->output_free_count++] = index;
+    }
+    MUTEX_UNLOCK(r->output_mutex);
+}
+
+static void video_renderer_kms_get_stats(video_renderer_t *renderer, video_renderer_stats_t *stats) {
+    video_renderer_kms_t *r = (video_renderer_kms_t *)renderer;
+    uint64_t done;
+
+    MUTEX_LOCK(r->display_mutex);
+    done = r->frames_shown + r->frames_skipped;
+    stats->queued_frames = r->input_frames > done ? (unsigned int) (r->input_frames - done) : 0;
+    stats->dropped_frames = r->frames_skipped;
+    stats->decode_errors = r->decode_errors;
+    stats->has_presentation_offset = r->has_presentation_offset;
+    stats->presentation_offset = r->presentation_offset;
+    MUTEX_UNLOCK(r->display_mutex);
+}
+
+/* The V4L2 buffers on both sides of the decoder and the background, all in CMA or other kernel memory */
+static void video_renderer_kms_get_memory(video_renderer_t *renderer, video_renderer_memory_t *memory) {
+    video_renderer_kms_t *r = (video_renderer_kms_t *)renderer;
+
+    MUTEX_LOCK(r->output_mutex);
+    for (unsigned int i = 0; i < r->output_count; i++) {
+        memory->device_bytes += r->output[i].length;
+    }
+    MUTEX_UNLOCK(r->output_mutex);
+    MUTEX_LOCK(r->display_mutex);
+    memory->device_bytes += (size_t) r->capture_count * r->capture_size;
+    if (r->background_fb) {
+        memory->device_bytes += (size_t) r->mode.hdisplay * r->mode.vdisplay * 4;
+    }
+    MUTEX_UNLOCK(r->display_mutex);
+}
+
+static void video_renderer_kms_get_caps(video_renderer_t *renderer, video_renderer_caps_t *caps) {
+    video_renderer_kms_t *r = (video_renderer_kms_t *)renderer;
+    caps->max_width = r->mode.hdisplay;
+    caps->max_height = r->mode.vdisplay;
+    caps->max_fps = r->mode.vrefresh;
+    caps->hevc = r->has_hevc;
+}
+
+static void video_renderer_kms_flush(video_renderer_t *renderer) {
+    video_renderer_kms_t *r = (video_renderer_kms_t *)renderer;
+    int type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+
+    logger_log(renderer->logger, LOGGER_INFO, "Video: %llu frames in, %llu shown, %llu replaced before they were shown, "
+               "%llu split over several buffers, %llu decoder timeouts",
+               (unsigned long long) r->input_frames, (unsigned long long) r->frames_shown,
+               (unsigned long long) r->frames_skipped, (unsigned long long) r->split_frames,
+               (unsigned long long) r->input_timeouts);
+
+    // Stopping the input queue drops whatever the decoder has not parsed yet and returns all buffers
+    MUTEX_LOCK(r->output_mutex);
+    video_renderer_kms_ioctl(r->decoder_fd, VIDIOC_STREAMOFF, &type);
+    r->output_free_count = 0;
+    for (unsigned int i = 0; i < r->output_count; i++) {
+        r->output_free[r->output_free_count++] = i;
+    }
+    video_renderer_kms_ioctl(r->decoder_fd, VIDIOC_STREAMON, &type);
+    MUTEX_UNLOCK(r->output_mutex);
+
+    MUTEX_LOCK(r->display_mutex);
+    video_renderer_kms_hide_video(r);
+    MUTEX_UNLOCK(r->display_mutex);
+}
+
+/* Stops and closes the decoder, the display thread must not be running. Input buffers the receive
+ * thread still holds are retired rather than unmapped when retire is set. */
+static void video_renderer_kms_close_decoder(video_renderer_kms_t *r, bool retire) {
+    int type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+
+    if (r->decoder_fd < 0) return;
+
+    MUTEX_LOCK(r->display_mutex);
+    if (r->drm_fd >= 0) video_renderer_kms_release_capture(r);
+    MUTEX_UNLOCK(r->display_mutex);
+
+    MUTEX_LOCK(r->output_mutex);
+    video_renderer_kms_ioctl(r->decoder_fd, VIDIOC_STREAMOFF, &type);
+    for (unsigned int i = 0; i < r->output_count; i++) {
+        if (retire && r->output[i].acquired) {
+            if (r->retired[i].start) munmap(r->retired[i].start, r->retired[i].length);
+            r->retired[i] = r->output[i];
+        } else {
+            munmap(r->output[i].start, r->output[i].length);
+        }
+        r->output[i].start = NULL;
+        r->output[i].acquired = false;
+    }
+    r->output_count = 0;
+    r->output_free_count = 0;
+    r->output_generation++;
+    // The mappings keep the buffers alive after the queue goes away with the file
+    close(r->decoder_fd);
+    r->decoder_fd = -1;
+    MUTEX_UNLOCK(r->output_mutex);
+}
+
+/* The input format can only change without buffers, so the decoder is reopened for the new codec,
+ * which may also be a different device */
+static void video_renderer_kms_set_codec(video_renderer_t *renderer, video_codec_t codec) {
+    video_renderer_kms_t *r = (video_renderer_kms_t *)renderer;
+
+    if (codec == r->codec) return;
+    if (codec == VIDEO_CODEC_H265 && !r->has_hevc) {
+        logger_log(renderer->logger, LOGGER_ERR, "No V4L2 decoder takes HEVC, the video can't be shown");
+        return;
+    }
+
+    if (r->running) {
+        __atomic_store_n(&r->running, false, __ATOMIC_RELEASE);
+        THREAD_JOIN(r->thread);
+    }
+    video_renderer_kms_close_decoder(r, true);
+
+    MUTEX_LOCK(r->output_mutex);
+    if (video_renderer_kms_init_decoder(r, codec) < 0) {
+        logger_log(renderer->logger, LOGGER_ERR, "Could not switch the decoder to %s", video_renderer_kms_codec_name(codec));
+    }
+    MUTEX_UNLOCK(r->output_mutex);
+
+    if (r->decoder_fd >= 0) {
+        r->running = true;
+        THREAD_CREATE(r->thread, video_renderer_kms_thread, r);
+        if (!r->thread) r->running = false;
+    }
+}
+
+/* Handles the vblank event still asked for, which on a shared card another tile's thread may be reading */
+static void video_renderer_kms_drain_vblank(video_renderer_kms_t *r) {
+    drmEventContext event_context = {
+        .version = 2,
+        .vblank_handler = video_renderer_kms_vblank_handler,
+    };
+
+    for (int i = 0; i < KMS_VBLANK_DRAIN_POLLS; i++) {
+        MUTEX_LOCK(r->display_mutex);
+        bool requested = r->vblank_requested;
+        MUTEX_UNLOCK(r->display_mutex);
+        if (!requested) return;
+        struct pollfd pfd = { .fd = r->drm_fd, .events = POLLIN };
+        if (poll(&pfd, 1, DISPLAY_POLL_TIMEOUT_MS) > 0) {
+            drmHandleEvent(r->drm_fd, &event_context);
+        }
+    }
+}
+
+static void video_renderer_kms_destroy(video_renderer_t *renderer) {
+    video_renderer_kms_t *r = (video_renderer_kms_t *)renderer;
+
+    if (!renderer) return;
+
+    if (r->running) {
+        __atomic_store_n(&r->running, false, __ATOMIC_RELEASE);
+        THREAD_JOIN(r->thread);
+    }
+    if (r->drm_fd >= 0) video_renderer_kms_drain_vblank(r);
+
+    video_renderer_kms_close_decoder(r, false);
+    for (unsigned int i = 0; i < KMS_MAX_OUTPUT_BUFFERS; i++) {
+        if (r->retired[i].start) munmap(r->retired[i].start, r->retired[i].length);
+    }
+
+    if (r->drm_fd >= 0) {
+        MUTEX_LOCK(r->display_mutex);
+        video_renderer_kms_remove_background(r);
+        // The console gets its own mode back as well
+        if (r->mode_switched && r->saved_crtc && r->saved_crtc->mode_valid) {
+            drmModeSetCrtc(r->drm_fd, r->saved_crtc->crtc_id, r->saved_crtc->buffer_id, r->saved_crtc->x, r->saved_crtc->y,
+                           &r->connector_id, 1, &r->saved_crtc->mode);
+        }
+        MUTEX_UNLOCK(r->display_mutex);
+        video_renderer_kms_destroy_background(r);
+        if (r->saved_crtc) drmModeFreeCrtc(r->saved_crtc);
+        close(r->drm_fd);
+        video_renderer_kms_release_card(r);
+    }
+
+    h264_sps_patch_destroy(r->sps_patch);
+    MUTEX_DESTROY(r->output_mutex);
+    MUTEX_DESTROY(r->display_mutex);
+    free(renderer);
+}
+
+static const video_renderer_funcs_t video_renderer_kms_funcs = {
+    .start = video_renderer_kms_start,
+    .render_buffer = video_renderer_kms_render_buffer,
+    .flush = video_renderer_kms_flush,
+    .destroy = video_renderer_kms_destroy,
+    .update_background = video_renderer_kms_update_background,
+    .acquire_buffer = video_renderer_kms_acquire_buffer,
+    .submit_buffer = video_renderer_kms_submit_buffer,
+    .release_buffer = video_renderer_kms_release_buffer,
+    .get_stats = video_renderer_kms_get_stats,
+    .get_caps = video_renderer_kms_get_caps,
+    .set_codec = video_renderer_kms_set_codec,
+    .get_memory = video_renderer_kms_get_memory,
+};
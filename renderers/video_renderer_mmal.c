@@ -0,0 +1,598 @@
+/**
+ * RPiPlay - An open-source AirPlay mirroring server for Raspberry Pi
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+#include "video_renderer.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "bcm_host.h"
+#include "videocore_memory.h"
+#include "interface/mmal/mmal.h"
+#include "interface/mmal/util/mmal_util.h"
+#include "interface/mmal/util/mmal_util_params.h"
+#include "interface/mmal/util/mmal_connection.h"
+#include "interface/mmal/util/mmal_default_components.h"
+#include "../lib/latency_histogram.h"
+#include "../lib/trace.h"
+#include "h264_sps_patch.h"
+
+/*
+ * H264 renderer using MMAL for hardware accelerated decoding on the
+ * Raspberry Pi. The decoder's output is tunnelled to vc.ril.video_render
+ * on the VideoCore. Its input buffers are shared with the VideoCore, so
+ * the mirror thread decrypts frames straight into them, and they come
+ * back through a callback instead of being polled for as with OpenMAX.
+ * Frames are shown as soon as they are decoded, there is no clock.
+ */
+
+#define MIN(X, Y) (((X) < (Y)) ? (X) : (Y))
+#define LAYER_VIDEO 2
+#define LAYER_BACKGROUND 1
+
+/* Input buffers unless the config asks for others, big enough for most frames of a 1080p stream */
+#define INPUT_BUFFERS 12
+#define INPUT_BUFFER_SIZE (256 * 1024)
+
+/* How long render_buffer waits for the decoder to hand an input buffer back */
+#define INPUT_BUFFER_TIMEOUT_MS 100
+
+/* What the VideoCore IV H.264 decoder keeps up with: 1080p30, or 720p60 */
+#define DECODER_MAX_WIDTH 1920
+#define DECODER_MAX_HEIGHT 1080
+#define DECODER_MAX_PIXEL_RATE (1920 * 1080 * 30)
+
+typedef struct video_renderer_mmal_s {
+    video_renderer_t base;
+    video_renderer_config_t const *config;
+    /* As configured, or as reconfigure changed them since */
+    int rotation;
+    flip_mode_t flip;
+
+    uint16_t background_visits;
+    DISPMANX_ELEMENT_HANDLE_T background_element;
+
+    MMAL_COMPONENT_T *decoder;
+    MMAL_COMPONENT_T *render;
+    MMAL_CONNECTION_T *connection;
+    /* Zero-copy input buffers, the decoder's input callback puts them back on the pool's queue */
+    MMAL_POOL_T *input_pool;
+
+    /* The components are gone until resume */
+    bool suspended;
+
+    uint64_t input_frames;
+    uint64_t input_timeouts;
+    /* Frames that did not fit one input buffer, and the buffers they took */
+    uint64_t split_frames;
+    uint64_t split_buffers;
+    /* Errors the decoder reported on its control port, counted on an MMAL thread */
+    uint64_t decoder_errors;
+
+    /* How far behind its pts each frame reaches the decoder, in us */
+    latency_histogram_t *video_delay;
+
+    /* Puts the reorder depth in front of the sender's SPS */
+    h264_sps_patch_t *sps_patch;
+} video_renderer_mmal_t;
+
+static const video_renderer_funcs_t video_renderer_mmal_funcs;
+
+/* A 1x1 black dispmanx element behind the video, stretched over the screen */
+static void video_renderer_mmal_render_background(video_renderer_mmal_t *renderer) {
+    DISPMANX_DISPLAY_HANDLE_T display;
+    DISPMANX_UPDATE_HANDLE_T update;
+    DISPMANX_RESOURCE_HANDLE_T resource;
+    VC_RECT_T dst_rect, src_rect;
+    uint32_t vc_image_ptr;
+    uint16_t image = 0x0000;
+
+    if (renderer->background_element) {
+        return;
+    }
+    display = vc_dispmanx_display_open(0);
+    resource = vc_dispmanx_resource_create(VC_IMAGE_RGB565, 1, 1, &vc_image_ptr);
+    vc_dispmanx_rect_set(&dst_rect, 0, 0, 1, 1);
+    vc_dispmanx_resource_write_data(resource, VC_IMAGE_RGB565, sizeof(image), &image, &dst_rect);
+    vc_dispmanx_rect_set(&src_rect, 0, 0, 1 << 16, 1 << 16);
+    vc_dispmanx_rect_set(&dst_rect, 0, 0, 0, 0);
+
+    update = vc_dispmanx_update_start(0);
+    renderer->background_element = vc_dispmanx_element_add(update, display, LAYER_BACKGROUND, &dst_rect, resource,
+                                                           &src_rect, DISPMANX_PROTECTION_NONE, NULL, NULL,
+                                                           DISPMANX_STEREOSCOPIC_MONO);
+    vc_dispmanx_update_submit_sync(update);
+}
+
+static void video_renderer_mmal_remove_background(video_renderer_mmal_t *renderer) {
+    if (renderer->background_element) {
+        DISPMANX_UPDATE_HANDLE_T update = vc_dispmanx_update_start(0);
+        vc_dispmanx_element_remove(update, renderer->background_element);
+        vc_dispmanx_update_submit_sync(update);
+    }
+    renderer->background_element = 0;
+}
+
+static void video_renderer_mmal_update_background(video_renderer_t *renderer, int type) {
+    video_renderer_mmal_t *r = (video_renderer_mmal_t *)renderer;
+    if (type < 0 && r->background_visits > 0) {
+        r->background_visits--;
+    } else if (type > 0) {
+        r->background_visits++;
+    }
+
+    if (r->config->background_mode == BACKGROUND_MODE_ON) {
+        video_renderer_mmal_render_background(r);
+    } else if (r->config->background_mode == BACKGROUND_MODE_AUTO) {
+        if (r->background_visits > 0) {
+            video_renderer_mmal_render_background(r);
+        } else {
+            video_renderer_mmal_remove_background(r);
+        }
+    }
+}
+
+/* The transform bits are a horizontal mirror, a vertical one and a transpose done first, flips are in screen space */
+static MMAL_DISPLAYTRANSFORM_T video_renderer_mmal_transform(int rotation, flip_mode_t flip) {
+    int transform;
+
+    switch ((rotation % 360 + 360) % 360) {
+    case 90:
+        transform = MMAL_DISPLAY_ROT90;
+        break;
+    case 180:
+        transform = MMAL_DISPLAY_ROT180;
+        break;
+    case 270:
+        transform = MMAL_DISPLAY_ROT270;
+        break;
+    default:
+        transform = MMAL_DISPLAY_ROT0;
+        break;
+    }
+    switch (flip) {
+    case FLIP_HORIZONTAL:
+        transform ^= 1;
+        break;
+    case FLIP_VERTICAL:
+        transform ^= 2;
+        break;
+    case FLIP_BOTH:
+        transform ^= 3;
+        break;
+    default:
+        break;
+    }
+    return (MMAL_DISPLAYTRANSFORM_T) transform;
+}
+
+/* Fullscreen, or the config's tile of the screen, with the renderer's rotation and flipping */
+static int video_renderer_mmal_setup_display(video_renderer_mmal_t *renderer) {
+    MMAL_DISPLAYREGION_T region;
+    uint32_t screen_w, screen_h;
+
+    if (renderer->rotation % 90 != 0 || renderer->rotation < -270 || renderer->rotation > 270) {
+        logger_log(renderer->base.logger, LOGGER_ERR, "Rotation must be +/- 0, 90, 180 or 270");
+        return -1;
+    }
+    memset(&region, 0, sizeof(region));
+    region.hdr.id = MMAL_PARAMETER_DISPLAYREGION;
+    region.hdr.size = sizeof(region);
+    region.set = MMAL_DISPLAY_SET_FULLSCREEN | MMAL_DISPLAY_SET_LAYER | MMAL_DISPLAY_SET_TRANSFORM;
+    region.fullscreen = MMAL_TRUE;
+    region.layer = LAYER_VIDEO;
+    region.transform = video_renderer_mmal_transform(renderer->rotation, renderer->flip);
+
+    if (renderer->config->tile_count > 1 && graphics_get_display_size(0, &screen_w, &screen_h) >= 0) {
+        int x, y, w, h;
+        video_renderer_tile_rect(renderer->config, screen_w, screen_h, &x, &y, &w, &h);
+        region.set |= MMAL_DISPLAY_SET_DEST_RECT;
+        region.fullscreen = MMAL_FALSE;
+        region.dest_rect.x = x;
+        region.dest_rect.y = y;
+        region.dest_rect.width = w;
+        region.dest_rect.height = h;
+    }
+    if (mmal_port_parameter_set(renderer->render->input[0], &region.hdr) != MMAL_SUCCESS) {
+        logger_log(renderer->base.logger, LOGGER_ERR, "Could not set the video display region");
+        return -1;
+    }
+    return 0;
+}
+
+static void video_renderer_mmal_control_callback(MMAL_PORT_T *port, MMAL_BUFFER_HEADER_T *buffer) {
+    video_renderer_mmal_t *renderer = (video_renderer_mmal_t *) port->userdata;
+    if (buffer->cmd == MMAL_EVENT_ERROR) {
+        uint64_t errors = __atomic_add_fetch(&renderer->decoder_errors, 1, __ATOMIC_RELAXED);
+        logger_log(renderer->base.logger, LOGGER_ERR, "Video decoder error %d (%llu times)",
+                   *(MMAL_STATUS_T *) buffer->data, (unsigned long long) errors);
+    }
+    mmal_buffer_header_release(buffer);
+}
+
+/* The decoder is done with an input buffer, releasing it puts it back on the pool's queue */
+static void video_renderer_mmal_input_callback(MMAL_PORT_T *port, MMAL_BUFFER_HEADER_T *buffer) {
+    mmal_buffer_header_release(buffer);
+}
+
+static void video_renderer_mmal_destroy_decoder(video_renderer_mmal_t *renderer) {
+    if (renderer->connection) {
+        mmal_connection_destroy(renderer->connection);
+        renderer->connection = NULL;
+    }
+    if (renderer->decoder) {
+        if (renderer->decoder->input[0]->is_enabled) {
+            mmal_port_disable(renderer->decoder->input[0]);
+        }
+        if (renderer->decoder->control->is_enabled) {
+            mmal_port_disable(renderer->decoder->control);
+        }
+        mmal_component_disable(renderer->decoder);
+    }
+    if (renderer->input_pool) {
+        mmal_port_pool_destroy(renderer->decoder->input[0], renderer->input_pool);
+        renderer->input_pool = NULL;
+    }
+    if (renderer->render) {
+        mmal_component_destroy(renderer->render);
+        renderer->render = NULL;
+    }
+    if (renderer->decoder) {
+        mmal_component_destroy(renderer->decoder);
+        renderer->decoder = NULL;
+    }
+}
+
+static int video_renderer_mmal_init_decoder(video_renderer_mmal_t *renderer) {
+    MMAL_PORT_T *input;
+
+    bcm_host_init();
+    video_renderer_mmal_update_background(&renderer->base, 0);
+
+    if (mmal_component_create(MMAL_COMPONENT_DEFAULT_VIDEO_DECODER, &renderer->decoder) != MMAL_SUCCESS ||
+        mmal_component_create(MMAL_COMPONENT_DEFAULT_VIDEO_RENDERER, &renderer->render) != MMAL_SUCCESS) {
+        logger_log(renderer->base.logger, LOGGER_ERR, "Could not create the MMAL video decoder and renderer");
+        video_renderer_mmal_destroy_decoder(renderer);
+        return -1;
+    }
+
+    renderer->decoder->control->userdata = (struct MMAL_PORT_USERDATA_T *) renderer;
+    if (mmal_port_enable(renderer->decoder->control, video_renderer_mmal_control_callback) != MMAL_SUCCESS) {
+        video_renderer_mmal_destroy_decoder(renderer);
+        return -1;
+    }
+
+    input = renderer->decoder->input[0];
+    input->format->type = MMAL_ES_TYPE_VIDEO;
+    input->format->encoding = MMAL_ENCODING_H264;
+    input->format->flags = MMAL_ES_FORMAT_FLAG_FRAMED;
+    if (mmal_port_format_commit(input) != MMAL_SUCCESS) {
+        logger_log(renderer->base.logger, LOGGER_ERR, "Could not set the video decoder's input format");
+        video_renderer_mmal_destroy_decoder(renderer);
+        return -1;
+    }
+
+    // Payloads in memory the VideoCore maps as well, so nothing is copied when a buffer is sent
+    if (mmal_port_parameter_set_boolean(input, MMAL_PARAMETER_ZERO_COPY, MMAL_TRUE) != MMAL_SUCCESS) {
+        logger_log(renderer->base.logger, LOGGER_WARNING, "Video decoder input is not zero-copy");
+    }
+    input->buffer_num = renderer->config->decoder_buffers > 0 ? renderer->config->decoder_buffers : INPUT_BUFFERS;
+    input->buffer_size = renderer->config->decoder_buffer_size > 0 ? renderer->config->decoder_buffer_size : INPUT_BUFFER_SIZE;
+    if (input->buffer_num < input->buffer_num_min) {
+        input->buffer_num = input->buffer_num_min;
+    }
+    if (input->buffer_size < input->buffer_size_min) {
+        input->buffer_size = input->buffer_size_min;
+    }
+    renderer->input_pool = mmal_port_pool_create(input, input->buffer_num, input->buffer_size);
+    if (!renderer->input_pool) {
+        logger_log(renderer->base.logger, LOGGER_ERR, "Could not allocate %u video decoder input buffers of %u bytes",
+                   input->buffer_num, input->buffer_size);
+        video_renderer_mmal_destroy_decoder(renderer);
+        return -1;
+    }
+    if (mmal_port_enable(input, video_renderer_mmal_input_callback) != MMAL_SUCCESS) {
+        video_renderer_mmal_destroy_decoder(renderer);
+        return -1;
+    }
+    logger_log(renderer->base.logger, LOGGER_DEBUG, "Video decoder uses %u input buffers of %u bytes",
+               input->buffer_num, input->buffer_size);
+
+    // Decoded pictures stay on the VideoCore, the tunnel follows the decoder's size changes on its own
+    renderer->decoder->output[0]->format->encoding = MMAL_ENCODING_OPAQUE;
+    if (mmal_port_format_commit(renderer->decoder->output[0]) != MMAL_SUCCESS ||
+        mmal_connection_create(&renderer->connection, renderer->decoder->output[0], renderer->render->input[0],
+                               MMAL_CONNECTION_FLAG_TUNNELLING | MMAL_CONNECTION_FLAG_ALLOCATION_ON_INPUT) != MMAL_SUCCESS) {
+        logger_log(renderer->base.logger, LOGGER_ERR, "Could not connect the video decoder to the renderer");
+        video_renderer_mmal_destroy_decoder(renderer);
+        return -1;
+    }
+    if (video_renderer_mmal_setup_display(renderer) != 0 || mmal_connection_enable(renderer->connection) != MMAL_SUCCESS) {
+        video_renderer_mmal_destroy_decoder(renderer);
+        return -1;
+    }
+    return 0;
+}
+
+video_renderer_t *video_renderer_mmal_init(logger_t *logger, video_renderer_config_t const *config) {
+    video_renderer_mmal_t *renderer;
+    renderer = calloc(1, sizeof(video_renderer_mmal_t));
+    if (!renderer) {
+        return NULL;
+    }
+
+    renderer->base.logger = logger;
+    renderer->base.funcs = &video_renderer_mmal_funcs;
+    renderer->base.type = VIDEO_RENDERER_MMAL;
+    renderer->config = config;
+    renderer->rotation = config->rotation;
+    renderer->flip = config->flip;
+
+    renderer->video_delay = latency_histogram_init();
+    if (!renderer->video_delay) {
+        free(renderer);
+        return NULL;
+    }
+    renderer->sps_patch = h264_sps_patch_init(logger, H264_SPS_PATCH_INJECT, h264_sps_patch_reorder_depth(config));
+    if (!renderer->sps_patch) {
+        latency_histogram_destroy(renderer->video_delay);
+        free(renderer);
+        return NULL;
+    }
+    if (video_renderer_mmal_init_decoder(renderer) != 0) {
+        h264_sps_patch_destroy(renderer->sps_patch);
+        latency_histogram_destroy(renderer->video_delay);
+        free(renderer);
+        return NULL;
+    }
+    return &renderer->base;
+}
+
+static void video_renderer_mmal_start(video_renderer_t *renderer) {
+    video_renderer_mmal_t *r = (video_renderer_mmal_t *)renderer;
+    mmal_component_enable(r->render);
+    mmal_component_enable(r->decoder);
+}
+
+static void video_renderer_mmal_record_delay(video_renderer_mmal_t *r, raop_ntp_t *ntp, uint64_t pts) {
+    latency_histogram_record(r->video_delay, ((int64_t) raop_ntp_get_local_time(ntp)) - ((int64_t) pts));
+}
+
+/* Sends a filled buffer to the decoder, or hands it back to the pool if the decoder won't take it */
+static void video_renderer_mmal_send(video_renderer_mmal_t *r, MMAL_BUFFER_HEADER_T *buffer, int length, uint64_t pts,
+                                     uint32_t flags) {
+    buffer->length = length;
+    buffer->offset = 0;
+    buffer->flags = flags;
+    buffer->pts = pts;
+    buffer->dts = MMAL_TIME_UNKNOWN;
+    if (mmal_port_send_buffer(r->decoder->input[0], buffer) != MMAL_SUCCESS) {
+        logger_log(r->base.logger, LOGGER_ERR, "Video decoder refused processing buffer");
+        mmal_buffer_header_release(buffer);
+    }
+}
+
+static int video_renderer_mmal_render_buffer(video_renderer_t *renderer, raop_ntp_t *ntp, unsigned char *data, int data_len,
+                                             uint64_t pts, int type, const h264_nal_unit_t *nal_units, int nal_count) {
+    video_renderer_mmal_t *r = (video_renderer_mmal_t *)renderer;
+
+    if (data_len == 0) return 0;
+    r->input_frames++;
+
+    if (type == 0) {
+        data = h264_sps_patch_apply(r->sps_patch, data, &data_len, nal_units, nal_count);
+    }
+    video_renderer_mmal_record_delay(r, ntp, pts);
+
+    uint32_t buffer_size = r->decoder->input[0]->buffer_size;
+    if ((uint32_t) data_len > buffer_size) {
+        r->split_frames++;
+        r->split_buffers += (data_len + buffer_size - 1) / buffer_size;
+    }
+    int offset = 0;
+    while (offset < data_len) {
+        MMAL_BUFFER_HEADER_T *buffer = mmal_queue_timedwait(r->input_pool->queue, INPUT_BUFFER_TIMEOUT_MS);
+        if (!buffer) {
+            // Give up on the rest of the frame rather than stall the mirror pipeline
+            r->input_timeouts++;
+            logger_log(renderer->logger, LOGGER_WARNING, "Video decoder busy for %d ms, dropped %d of %d bytes (%llu times)",
+                       INPUT_BUFFER_TIMEOUT_MS, data_len - offset, data_len, (unsigned long long) r->input_timeouts);
+            return -1;
+        }
+        int chunk_size = MIN(data_len - offset, (int) buffer->alloc_size);
+        uint32_t flags = offset == 0 ? MMAL_BUFFER_HEADER_FLAG_FRAME_START : 0;
+        memcpy(buffer->data, data + offset, chunk_size);
+        offset += chunk_size;
+        if (offset == data_len) {
+            flags |= MMAL_BUFFER_HEADER_FLAG_FRAME_END;
+        }
+        video_renderer_mmal_send(r, buffer, chunk_size, pts, flags);
+    }
+    trace_event(TRACE_VIDEO_RENDERED, data_len, pts);
+    return 0;
+}
+
+static unsigned char *video_renderer_mmal_acquire_buffer(video_renderer_t *renderer, int size, void **handle) {
+    video_renderer_mmal_t *r = (video_renderer_mmal_t *)renderer;
+
+    // Frames that need more than one input buffer go through render_buffer
+    if (r->suspended || size <= 0 || (uint32_t) size > r->decoder->input[0]->buffer_size) return NULL;
+
+    // Don't block, the caller is the network receive thread and falls back to its own buffer
+    MMAL_BUFFER_HEADER_T *buffer = mmal_queue_get(r->input_pool->queue);
+    if (!buffer) {
+        return NULL;
+    }
+    *handle = buffer;
+    return buffer->data;
+}
+
+static void video_renderer_mmal_submit_buffer(video_renderer_t *renderer, raop_ntp_t *ntp, void *handle, int data_len,
+                                              uint64_t pts, int type, const h264_nal_unit_t *nal_units, int nal_count) {
+    video_renderer_mmal_t *r = (video_renderer_mmal_t *)renderer;
+
+    r->input_frames++;
+    video_renderer_mmal_record_delay(r, ntp, pts);
+    video_renderer_mmal_send(r, handle, data_len, pts, MMAL_BUFFER_HEADER_FLAG_FRAME_START | MMAL_BUFFER_HEADER_FLAG_FRAME_END);
+    trace_event(TRACE_VIDEO_RENDERED, data_len, pts);
+}
+
+/* Unlike an OpenMAX input buffer, an unused one goes straight back to the pool */
+static void video_renderer_mmal_release_buffer(video_renderer_t *renderer, void *handle) {
+    mmal_buffer_header_release(handle);
+}
+
+/* Discards whatever the decoder and the renderer still hold, the input buffers come back through the callback */
+static void video_renderer_mmal_flush(video_renderer_t *renderer) {
+    video_renderer_mmal_t *r = (video_renderer_mmal_t *)renderer;
+
+    if (!r->suspended) {
+        mmal_port_flush(r->decoder->input[0]);
+        mmal_port_flush(r->decoder->output[0]);
+        mmal_port_flush(r->render->input[0]);
+    }
+
+    latency_histogram_stats_t stats;
+    latency_histogram_get_stats(r->video_delay, &stats);
+    if (stats.count) {
+        logger_log(renderer->logger, LOGGER_INFO, "Video delay over %llu frames: p50 = %llu us, p95 = %llu us, p99 = %llu us, max = %llu us",
+                   (unsigned long long) stats.count, (unsigned long long) stats.p50, (unsigned long long) stats.p95,
+                   (unsigned long long) stats.p99, (unsigned long long) stats.max);
+    }
+    latency_histogram_reset(r->video_delay);
+
+    if (r->split_frames) {
+        logger_log(renderer->logger, LOGGER_INFO, "Video decoder input: %llu frames larger than %u bytes were split into %llu buffers",
+                   (unsigned long long) r->split_frames, r->decoder ? r->decoder->input[0]->buffer_size : 0,
+                   (unsigned long long) r->split_buffers);
+    }
+    r->split_frames = 0;
+    r->split_buffers = 0;
+}
+
+static void video_renderer_mmal_destroy(video_renderer_t *renderer) {
+    video_renderer_mmal_t *r = (video_renderer_mmal_t *)renderer;
+    if (renderer) {
+        if (r->input_frames) video_renderer_mmal_flush(renderer);
+        if (!r->suspended) video_renderer_mmal_destroy_decoder(r);
+        video_renderer_mmal_remove_background(r);
+        latency_histogram_destroy(r->video_delay);
+        h264_sps_patch_destroy(r->sps_patch);
+        free(renderer);
+    }
+}
+
+/* The components and the input pool go, the background, the SPS patch and the counters stay */
+static void video_renderer_mmal_suspend(video_renderer_t *renderer) {
+    video_renderer_mmal_t *r = (video_renderer_mmal_t *)renderer;
+
+    video_renderer_mmal_destroy_decoder(r);
+    r->suspended = true;
+}
+
+static int video_renderer_mmal_resume(video_renderer_t *renderer) {
+    video_renderer_mmal_t *r = (video_renderer_mmal_t *)renderer;
+
+    if (video_renderer_mmal_init_decoder(r) != 0) {
+        return -1;
+    }
+    r->suspended = false;
+    video_renderer_mmal_start(renderer);
+    return 0;
+}
+
+/* Frames are shown as soon as they are decoded, so only what the decoder holds is known */
+static void video_renderer_mmal_get_stats(video_renderer_t *renderer, video_renderer_stats_t *stats) {
+    video_renderer_mmal_t *r = (video_renderer_mmal_t *)renderer;
+
+    stats->decode_errors = __atomic_load_n(&r->decoder_errors, __ATOMIC_RELAXED);
+    if (r->suspended) return;
+    stats->queued_frames = r->decoder->input[0]->buffer_num - mmal_queue_length(r->input_pool->queue);
+    stats->dropped_frames = r->input_timeouts;
+}
+
+/* The HDMI mode, limited to what the decoder can keep up with */
+static void video_renderer_mmal_get_caps(video_renderer_t *renderer, video_renderer_caps_t *caps) {
+    uint32_t width, height;
+    TV_DISPLAY_STATE_T state;
+    int fps = 60;
+
+    if (graphics_get_display_size(0, &width, &height) < 0) {
+        return;
+    }
+    memset(&state, 0, sizeof(state));
+    if (vc_tv_get_display_state(&state) == 0 && (state.state & (VC_HDMI_HDMI | VC_HDMI_DVI)) &&
+        state.display.hdmi.frame_rate > 0) {
+        fps = state.display.hdmi.frame_rate;
+    }
+    if (width > DECODER_MAX_WIDTH || height > DECODER_MAX_HEIGHT) {
+        if (width * DECODER_MAX_HEIGHT > height * DECODER_MAX_WIDTH) {
+            height = height * DECODER_MAX_WIDTH / width;
+            width = DECODER_MAX_WIDTH;
+        } else {
+            width = width * DECODER_MAX_HEIGHT / height;
+            height = DECODER_MAX_HEIGHT;
+        }
+    }
+    caps->max_width = width;
+    caps->max_height = height;
+    caps->max_fps = MIN(fps, (int) (DECODER_MAX_PIXEL_RATE / (width * height)));
+}
+
+/* Rotation and flip are a display region setting of the renderer's input port */
+static void video_renderer_mmal_reconfigure(video_renderer_t *renderer, video_renderer_config_t const *config) {
+    video_renderer_mmal_t *r = (video_renderer_mmal_t *)renderer;
+
+    if (config->low_latency != r->config->low_latency) {
+        logger_log(renderer->logger, LOGGER_WARNING, "The mmal renderer only changes low-latency mode on a restart");
+    }
+    r->rotation = config->rotation;
+    r->flip = config->flip;
+    if (!r->suspended && video_renderer_mmal_setup_display(r) != 0) {
+        logger_log(renderer->logger, LOGGER_ERR, "Could not change the video orientation");
+    }
+}
+
+/* The decoder's input pool is shared with the VideoCore for zero-copy input, its output stays there */
+static void video_renderer_mmal_get_memory(video_renderer_t *renderer, video_renderer_memory_t *memory) {
+    video_renderer_mmal_t *r = (video_renderer_mmal_t *)renderer;
+
+    memory->device_total = videocore_memory_get("gpu");
+    memory->device_free = videocore_memory_get("reloc");
+    if (r->suspended) return;
+    MMAL_PORT_T *input = r->decoder->input[0], *output = r->decoder->output[0];
+    memory->device_bytes = (size_t) input->buffer_num * input->buffer_size + (size_t) output->buffer_num * output->buffer_size;
+}
+
+static const video_renderer_funcs_t video_renderer_mmal_funcs = {
+    .start = video_renderer_mmal_start,
+    .render_buffer = video_renderer_mmal_render_buffer,
+    .flush = video_renderer_mmal_flush,
+    .destroy = video_renderer_mmal_destroy,
+    .update_background = video_renderer_mmal_update_background,
+    .acquire_buffer = video_renderer_mmal_acquire_buffer,
+    .submit_buffer = video_renderer_mmal_submit_buffer,
+    .release_buffer = video_renderer_mmal_release_buffer,
+    .get_stats = video_renderer_mmal_get_stats,
+    .get_caps = video_renderer_mmal_get_caps,
+    .reconfigure = video_renderer_mmal_reconfigure,
+    .suspend = video_renderer_mmal_suspend,
+    .resume = video_renderer_mmal_resume,
+    .get_memory = video_renderer_mmal_get_memory,
+};
@@ -25,11 +25,18 @@
 #include <string.h>
 #include <stdbool.h>
 #include <unistd.h>
+#include <errno.h>
+#include <time.h>
 
 #include "bcm_host.h"
+#include "videocore_memory.h"
 #include "ilclient.h"
 #include "../lib/threads.h"
-#include "h264-bitstream/h264_stream.h"
+#include "../lib/latency_histogram.h"
+#include "../lib/trace.h"
+#include "h264_sps_patch.h"
+#include "playout_delay.h"
+#include "refresh_match.h"
 
 /*
  * H264 renderer using OpenMAX for hardware accelerated decoding
@@ -38,30 +45,132 @@
 */
 
 #define MIN(X, Y) (((X) < (Y)) ? (X) : (Y))
+#define LAYER_OVERLAY 3
 #define LAYER_VIDEO 2
 #define LAYER_BACKGROUND 1
 
+/* How long render_buffer waits for the decoder to free an input buffer */
+#define INPUT_BUFFER_TIMEOUT_MS 100
+
+/* Frames arriving this much later than their playout delay allows restart the clock, in us */
+#define VIDEO_RESYNC_DELAY 100000
+
+/* How long flush waits in total for the pipeline's ports to be flushed */
+#define FLUSH_TIMEOUT_MS 250
+
+/* Decoder, scheduler, clock and resize tunnels, and one from the splitter to each renderer */
+#define MAX_RENDERERS (1 + VIDEO_RENDERER_MAX_CLONES)
+#define MAX_TUNNELS (4 + MAX_RENDERERS)
+
+/* Decoder input port plus both ends of every tunnel */
+#define FLUSH_MAX_PORTS (1 + 2 * MAX_TUNNELS)
+
+/* Paced frames followed on their way to the screen for the presented callback, the oldest give way */
+#define PRESENTING_FRAMES 32
+
+/* HDMI modes looked through for one with a matching refresh rate */
+#define MAX_HDMI_MODES 64
+
+/* What the VideoCore IV H.264 decoder keeps up with: 1080p30, or 720p60 */
+#define DECODER_MAX_WIDTH 1920
+#define DECODER_MAX_HEIGHT 1080
+#define DECODER_MAX_PIXEL_RATE (1920 * 1080 * 30)
+
 typedef struct video_renderer_rpi_s {
     video_renderer_t base;
     video_renderer_config_t const *config;
+    /* As configured, or as reconfigure changed them since */
+    int rotation;
+    flip_mode_t flip;
 
     uint16_t background_visits;
     DISPMANX_ELEMENT_HANDLE_T background_element;
 
+    /* Shown over the video by set_overlay */
+    DISPMANX_ELEMENT_HANDLE_T overlay_element;
+    DISPMANX_RESOURCE_HANDLE_T overlay_resource;
+
     ILCLIENT_T *client;
     COMPONENT_T *video_decoder;
     COMPONENT_T *video_renderer;
     COMPONENT_T *video_scheduler;
     COMPONENT_T *clock;
 
-    COMPONENT_T *components[5];
-    TUNNEL_T tunnels[4];
+    /* Only with clones: feeds the decoded picture to video_renderer and one renderer per clone */
+    COMPONENT_T *video_splitter;
+    COMPONENT_T *clone_renderers[VIDEO_RENDERER_MAX_CLONES];
+
+    /* Only with downscaling: sits right behind the decoder, its output tunnel is resize_tunnel */
+    COMPONENT_T *resize;
+    int resize_tunnel;
+
+    /* NULL terminated */
+    COMPONENT_T *components[5 + MAX_RENDERERS + 1];
+    int component_count;
+    /* Zero terminated, the splitter's tunnels follow the others from splitter_tunnel on */
+    TUNNEL_T tunnels[MAX_TUNNELS + 1];
+    int tunnel_count;
+    int splitter_tunnel;
 
     uint64_t first_packet_time;
     uint64_t input_frames;
+    /* Bytes render_part took of the frame so far */
+    int part_bytes;
+
+    /* The components are gone until resume */
+    bool suspended;
+
+    /* Components behind the decoder are executing, and the tunnels to them are set up for this size */
+    bool warmed_up;
+    bool tunnels_ready;
+    OMX_U32 frame_width;
+    OMX_U32 frame_height;
+    /* What resize hands on, the frame's size if it needs no scaling */
+    OMX_U32 scaled_width;
+    OMX_U32 scaled_height;
+
+    /* Size of a single decoder input buffer */
+    OMX_U32 input_buffer_size;
+
+    /* Signalled whenever the decoder hands an input buffer back */
+    mutex_handle_t input_mutex;
+    cond_handle_t input_cond;
+    uint64_t input_timeouts;
+    /* Stream errors the decoder reported, on the ilclient thread */
+    uint64_t decode_errors;
+
+    /* Frames that did not fit one input buffer, and the buffers they took */
+    uint64_t split_frames;
+    uint64_t split_buffers;
+
+    /* How far behind its presentation time each frame reaches the decoder, in us */
+    latency_histogram_t *video_delay;
+    /* Delay frames are presented with after their pts, on the mirror thread, and a copy the audio renderer reads */
+    playout_delay_t playout;
+    int64_t playout_delay;
+    int64_t last_video_delay;
+
+    /* Timestamp the latest frame went to the decoder with, and the paced frames not reported presented yet,
+     * as pts and timestamp in a ring starting at presenting_first */
+    uint64_t last_timestamp;
+    uint64_t presenting[PRESENTING_FRAMES][2];
+    unsigned int presenting_first;
+    unsigned int presenting_count;
+
+    /* Puts the reorder depth in front of the sender's SPS */
+    h264_sps_patch_t *sps_patch;
+
+    /* With refresh rate matching: the HDMI mode to go back to, if it was switched away from */
+    refresh_match_t refresh_match;
+    bool hdmi_switched;
+    HDMI_MODE_T saved_hdmi_mode;
+    HDMI_RES_GROUP_T saved_hdmi_group;
+    uint32_t saved_hdmi_code;
+    int saved_hdmi_rate;
 } video_renderer_rpi_t;
 
 static const video_renderer_funcs_t video_renderer_rpi_funcs;
+static void video_renderer_rpi_warm_up(video_renderer_rpi_t *r);
 
 /* From: https://github.com/popcornmix/omxplayer/blob/master/omxplayer.cpp#L455
  * Licensed under the GPLv2 */
@@ -110,12 +219,77 @@ static void video_renderer_rpi_remove_background(video_renderer_rpi_t *renderer)
     renderer->background_element = 0;
 }
 
+static void video_renderer_rpi_remove_overlay(video_renderer_rpi_t *renderer) {
+    if (renderer->overlay_element) {
+        DISPMANX_UPDATE_HANDLE_T update = vc_dispmanx_update_start(0);
+        vc_dispmanx_element_remove(update, renderer->overlay_element);
+        vc_dispmanx_update_submit_sync(update);
+    }
+    if (renderer->overlay_resource) {
+        vc_dispmanx_resource_delete(renderer->overlay_resource);
+    }
+    renderer->overlay_element = 0;
+    renderer->overlay_resource = 0;
+}
+
+/* A dispmanx element above the video, centred on the main display and blended by its alpha */
+static void video_renderer_rpi_set_overlay(video_renderer_t *renderer, const uint8_t *rgba, int width, int height, int stride) {
+    video_renderer_rpi_t *r = (video_renderer_rpi_t *)renderer;
+    DISPMANX_DISPLAY_HANDLE_T display;
+    DISPMANX_UPDATE_HANDLE_T update;
+    DISPMANX_MODEINFO_T info;
+    VC_DISPMANX_ALPHA_T alpha = { DISPMANX_FLAGS_ALPHA_FROM_SOURCE, 255, 0 };
+    VC_RECT_T dst_rect, src_rect;
+    uint32_t vc_image_ptr;
+    // The resource takes rows on a 32 byte pitch
+    int pitch = (width * 4 + 31) & ~31;
+    unsigned char *image;
+
+    video_renderer_rpi_remove_overlay(r);
+    if (!rgba || width <= 0 || height <= 0) {
+        return;
+    }
+    if (!(image = calloc(height, pitch))) {
+        return;
+    }
+    for (int y = 0; y < height; y++) {
+        memcpy(image + (size_t) y * pitch, rgba + (size_t) y * stride, (size_t) width * 4);
+    }
+
+    display = vc_dispmanx_display_open(0);
+    if (vc_dispmanx_display_get_info(display, &info) != 0) {
+        logger_log(renderer->logger, LOGGER_ERR, "Could not get the display size for the overlay");
+        free(image);
+        return;
+    }
+    r->overlay_resource = vc_dispmanx_resource_create(VC_IMAGE_RGBA32, width, height, &vc_image_ptr);
+    if (!r->overlay_resource) {
+        logger_log(renderer->logger, LOGGER_ERR, "Could not create a %dx%d overlay resource", width, height);
+        free(image);
+        return;
+    }
+    vc_dispmanx_rect_set(&dst_rect, 0, 0, width, height);
+    vc_dispmanx_resource_write_data(r->overlay_resource, VC_IMAGE_RGBA32, pitch, image, &dst_rect);
+    free(image);
+
+    vc_dispmanx_rect_set(&src_rect, 0, 0, width << 16, height << 16);
+    vc_dispmanx_rect_set(&dst_rect, (info.width - width) / 2, (info.height - height) / 2, width, height);
+
+    update = vc_dispmanx_update_start(0);
+    r->overlay_element = vc_dispmanx_element_add(update, display, LAYER_OVERLAY, &dst_rect, r->overlay_resource,
+                                                 &src_rect, DISPMANX_PROTECTION_NONE, &alpha, NULL,
+                                                 DISPMANX_STEREOSCOPIC_MONO);
+    vc_dispmanx_update_submit_sync(update);
+}
+
 static void video_renderer_rpi_update_background(video_renderer_t *renderer, int type) {
     video_renderer_rpi_t *r = (video_renderer_rpi_t *)renderer;
     if (type < 0) {
         r->background_visits--;
     } else if (type > 0) {
         r->background_visits++;
+        // A stream is likely to follow
+        video_renderer_rpi_warm_up(r);
     }
     if (r->background_visits < 0) {
         r->background_visits = 0;
@@ -134,9 +308,9 @@ static void video_renderer_rpi_update_background(video_renderer_t *renderer, int
 }
 
 static void video_renderer_rpi_destroy_decoder(video_renderer_rpi_t *renderer) {
-    ilclient_disable_tunnel(&renderer->tunnels[0]);
-    ilclient_disable_tunnel(&renderer->tunnels[1]);
-    ilclient_disable_tunnel(&renderer->tunnels[2]);
+    for (int i = 0; i < renderer->tunnel_count; i++) {
+        ilclient_disable_tunnel(&renderer->tunnels[i]);
+    }
     ilclient_disable_port_buffers(renderer->video_decoder, 130, NULL, NULL, NULL);
     ilclient_teardown_tunnels(renderer->tunnels);
 
@@ -153,9 +327,159 @@ static void omx_event_handler(void *userdata, COMPONENT_T *comp, OMX_U32 data) {
     logger_log(renderer->base.logger, LOGGER_DEBUG, "Video renderer config change: %p: %d", comp, data);
 }
 
+static void omx_error_handler(void *userdata, COMPONENT_T *comp, OMX_U32 data) {
+    video_renderer_rpi_t *renderer = (video_renderer_rpi_t *) userdata;
+    // Errors of state changes and tunnel setup are handled where they are made
+    if (comp != renderer->video_decoder || (data != OMX_ErrorStreamCorrupt && data != OMX_ErrorFormatNotDetected)) {
+        return;
+    }
+    uint64_t errors = __atomic_add_fetch(&renderer->decode_errors, 1, __ATOMIC_RELAXED);
+    logger_log(renderer->base.logger, LOGGER_WARNING, "Video decoder error 0x%x (%llu times)", (unsigned int) data,
+               (unsigned long long) errors);
+}
+
+static void omx_empty_buffer_done(void *userdata, COMPONENT_T *comp) {
+    video_renderer_rpi_t *renderer = (video_renderer_rpi_t *) userdata;
+    MUTEX_LOCK(renderer->input_mutex);
+    COND_BROADCAST(renderer->input_cond);
+    MUTEX_UNLOCK(renderer->input_mutex);
+}
+
+/* Waits at most timeout_ms for a free decoder input buffer, returns NULL if there is none by then */
+static OMX_BUFFERHEADERTYPE *video_renderer_rpi_get_input_buffer(video_renderer_rpi_t *renderer, int timeout_ms) {
+    OMX_BUFFERHEADERTYPE *buffer = ilclient_get_input_buffer(renderer->video_decoder, 130, 0);
+    if (buffer || timeout_ms <= 0) {
+        return buffer;
+    }
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    MUTEX_LOCK(renderer->input_mutex);
+    while ((buffer = ilclient_get_input_buffer(renderer->video_decoder, 130, 0)) == NULL) {
+        if (COND_TIMEDWAIT(renderer->input_cond, renderer->input_mutex, deadline) == ETIMEDOUT) {
+            buffer = ilclient_get_input_buffer(renderer->video_decoder, 130, 0);
+            break;
+        }
+    }
+    MUTEX_UNLOCK(renderer->input_mutex);
+    return buffer;
+}
+
+/* Creates a component and adds it to the ones that change state together */
+static int video_renderer_rpi_create_component(video_renderer_rpi_t *renderer, COMPONENT_T **component, char *name,
+                                               ILCLIENT_CREATE_FLAGS_T flags) {
+    if (ilclient_create_component(renderer->client, component, name, flags) != 0) {
+        return -1;
+    }
+    renderer->components[renderer->component_count++] = *component;
+    return 0;
+}
+
+/*
+ * Shows what video_renderer gets on display, or on the default display if it is -1,
+ * in the config's tile of it with the given rotation and the renderer's flipping.
+ */
+static int video_renderer_rpi_setup_display(video_renderer_rpi_t *renderer, COMPONENT_T *video_renderer,
+                                            int display, int rotation) {
+    OMX_CONFIG_DISPLAYREGIONTYPE display_region;
+    memset(&display_region, 0, sizeof(OMX_CONFIG_DISPLAYREGIONTYPE));
+    display_region.nSize = sizeof(OMX_CONFIG_DISPLAYREGIONTYPE);
+    display_region.nVersion.nVersion = OMX_VERSION;
+    display_region.nPortIndex = 90;
+    display_region.set = OMX_DISPLAY_SET_FULLSCREEN | OMX_DISPLAY_SET_LAYER;
+    display_region.fullscreen = OMX_TRUE;
+    display_region.layer = LAYER_VIDEO;
+    if (display >= 0) {
+        display_region.set |= OMX_DISPLAY_SET_NUM;
+        display_region.num = display;
+    }
+
+    // Several senders at once each get their own cell of the screen, the aspect ratio is kept within it
+    uint32_t screen_w, screen_h;
+    if (renderer->config->tile_count > 1 && graphics_get_display_size(display >= 0 ? display : 0, &screen_w, &screen_h) >= 0) {
+        int x, y, w, h;
+        video_renderer_tile_rect(renderer->config, screen_w, screen_h, &x, &y, &w, &h);
+        display_region.set |= OMX_DISPLAY_SET_DEST_RECT;
+        display_region.fullscreen = OMX_FALSE;
+        display_region.dest_rect.x_offset = x;
+        display_region.dest_rect.y_offset = y;
+        display_region.dest_rect.width = w;
+        display_region.dest_rect.height = h;
+    }
+
+    if (OMX_SetConfig(ilclient_get_handle(video_renderer), OMX_IndexConfigDisplayRegion,
+                      &display_region) != OMX_ErrorNone) {
+        logger_log(renderer->base.logger, LOGGER_DEBUG, "Could not set renderer to fullscreen");
+        return -13;
+    }
+
+    // Setup rotation, also set when it is 0 so reconfigure can turn it back
+    {
+        OMX_CONFIG_ROTATIONTYPE omx_rotation;
+        memset(&omx_rotation, 0, sizeof(OMX_CONFIG_ROTATIONTYPE));
+        omx_rotation.nSize = sizeof(OMX_CONFIG_ROTATIONTYPE);
+        // Check the rotation here
+        if (rotation % 90 != 0 || rotation < -270 || rotation > 270) {
+            printf("Error: Rotation must be +/- 0,90,180,270\n");
+            return -15;
+        }
+        omx_rotation.nRotation = rotation;
+        omx_rotation.nPortIndex = 90;
+        omx_rotation.nVersion.nVersion = OMX_VERSION;
+        OMX_ERRORTYPE error = OMX_SetConfig(ilclient_get_handle(video_renderer), OMX_IndexConfigCommonRotate,
+                                            &omx_rotation);
+        if (error != OMX_ErrorNone) {
+            printf("Error: %x\n", error);
+            return -15;
+        }
+    }
+
+    // Setup flipping
+    {
+        OMX_CONFIG_MIRRORTYPE omx_mirror;
+        memset(&omx_mirror, 0, sizeof(OMX_CONFIG_MIRRORTYPE));
+        omx_mirror.nSize = sizeof(OMX_CONFIG_MIRRORTYPE);
+        switch (renderer->flip) {
+        case FLIP_HORIZONTAL:
+            omx_mirror.eMirror = OMX_MirrorHorizontal;
+            break;
+        case FLIP_VERTICAL:
+            omx_mirror.eMirror = OMX_MirrorVertical;
+            break;
+        case FLIP_BOTH:
+            omx_mirror.eMirror = OMX_MirrorBoth;
+            break;
+        default:
+            omx_mirror.eMirror = OMX_MirrorNone;
+            break;
+        }
+        omx_mirror.nPortIndex = 90;
+        omx_mirror.nVersion.nVersion = OMX_VERSION;
+        OMX_ERRORTYPE error = OMX_SetConfig(ilclient_get_handle(video_renderer), OMX_IndexConfigCommonMirror,
+                                            &omx_mirror);
+        if (error != OMX_ErrorNone) {
+            printf("Error: %x\n", error);
+            return -15;
+        }
+    }
+    return 0;
+}
+
 static int video_renderer_rpi_init_decoder(video_renderer_rpi_t *renderer) {
     memset(renderer->components, 0, sizeof(renderer->components));
     memset(renderer->tunnels, 0, sizeof(renderer->tunnels));
+    renderer->component_count = 0;
+    renderer->tunnel_count = 0;
+    renderer->resize = NULL;
+    renderer->video_scheduler = NULL;
+    renderer->video_splitter = NULL;
 
     bcm_host_init();
 
@@ -171,20 +495,18 @@ static int video_renderer_rpi_init_decoder(video_renderer_rpi_t *renderer) {
     }
 
     // Create video_decode
-    if (ilclient_create_component(renderer->client, &renderer->video_decoder, "video_decode",
-                                  ILCLIENT_DISABLE_ALL_PORTS | ILCLIENT_ENABLE_INPUT_BUFFERS) != 0) {
+    if (video_renderer_rpi_create_component(renderer, &renderer->video_decoder, "video_decode",
+                                            ILCLIENT_DISABLE_ALL_PORTS | ILCLIENT_ENABLE_INPUT_BUFFERS) != 0) {
         video_renderer_rpi_destroy_decoder(renderer);
         return -14;
     }
-    renderer->components[0] = renderer->video_decoder;
 
     // Create video_renderer
-    if (ilclient_create_component(renderer->client, &renderer->video_renderer, "video_render",
-                                  ILCLIENT_DISABLE_ALL_PORTS) != 0) {
+    if (video_renderer_rpi_create_component(renderer, &renderer->video_renderer, "video_render",
+                                            ILCLIENT_DISABLE_ALL_PORTS) != 0) {
         video_renderer_rpi_destroy_decoder(renderer);
         return -14;
     }
-    renderer->components[1] = renderer->video_renderer;
 
     // Register to video stalls
     OMX_CONFIG_REQUESTCALLBACKTYPE request_callback;
@@ -200,14 +522,14 @@ static int video_renderer_rpi_init_decoder(video_renderer_rpi_t *renderer) {
         return -14;
     }
     ilclient_set_configchanged_callback(renderer->client, omx_event_handler, renderer);
+    ilclient_set_error_callback(renderer->client, omx_error_handler, renderer);
+    ilclient_set_empty_buffer_done_callback(renderer->client, omx_empty_buffer_done, renderer);
 
     // Create clock
-    if (ilclient_create_component(renderer->client, &renderer->clock, "clock",
-                                  ILCLIENT_DISABLE_ALL_PORTS) != 0) {
+    if (video_renderer_rpi_create_component(renderer, &renderer->clock, "clock", ILCLIENT_DISABLE_ALL_PORTS) != 0) {
         video_renderer_rpi_destroy_decoder(renderer);
         return -14;
     }
-    renderer->components[2] = renderer->clock;
 
     // Set the reference clock to the video clock
     OMX_TIME_CONFIG_ACTIVEREFCLOCKTYPE active_ref_clock;
@@ -226,104 +548,107 @@ static int video_renderer_rpi_init_decoder(video_renderer_rpi_t *renderer) {
     memset(&clock_state, 0, sizeof(OMX_TIME_CONFIG_CLOCKSTATETYPE));
     clock_state.nSize = sizeof(OMX_TIME_CONFIG_CLOCKSTATETYPE);
     clock_state.nVersion.nVersion = OMX_VERSION;
-    clock_state.eState = OMX_TIME_ClockStateWaitingForStartTime;
-    clock_state.nWaitMask = 1;
+    if (renderer->config->low_latency) {
+        // Nothing waits on the video start time, the clock is only still needed by the audio renderer
+        clock_state.eState = OMX_TIME_ClockStateRunning;
+    } else {
+        clock_state.eState = OMX_TIME_ClockStateWaitingForStartTime;
+        clock_state.nWaitMask = 1;
+    }
     if (OMX_SetParameter(ilclient_get_handle(renderer->clock), OMX_IndexConfigTimeClockState,
                          &clock_state) != OMX_ErrorNone) {
         video_renderer_rpi_destroy_decoder(renderer);
         return -13;
     }
 
-    // Create video_scheduler
-    if (ilclient_create_component(renderer->client, &renderer->video_scheduler, "video_scheduler",
-                                  ILCLIENT_DISABLE_ALL_PORTS) != 0) {
-        video_renderer_rpi_destroy_decoder(renderer);
-        return -14;
+    // With clones, one decoder feeds every display through a splitter instead of each display decoding on its own
+    COMPONENT_T *sink = renderer->video_renderer;
+    int sink_port = 90;
+    if (renderer->config->clone_count > 0) {
+        if (video_renderer_rpi_create_component(renderer, &renderer->video_splitter, "video_splitter",
+                                                ILCLIENT_DISABLE_ALL_PORTS) != 0) {
+            video_renderer_rpi_destroy_decoder(renderer);
+            return -14;
+        }
+        for (int i = 0; i < renderer->config->clone_count; i++) {
+            if (video_renderer_rpi_create_component(renderer, &renderer->clone_renderers[i], "video_render",
+                                                    ILCLIENT_DISABLE_ALL_PORTS) != 0) {
+                video_renderer_rpi_destroy_decoder(renderer);
+                return -14;
+            }
+        }
+        sink = renderer->video_splitter;
+        sink_port = 250;
     }
-    renderer->components[3] = renderer->video_scheduler;
 
-    // Create tunnels
-    set_tunnel(&renderer->tunnels[0], renderer->video_decoder, 131, renderer->video_scheduler, 10);
-    set_tunnel(&renderer->tunnels[1], renderer->video_scheduler, 11, renderer->video_renderer, 90);
-    set_tunnel(&renderer->tunnels[2], renderer->clock, 80, renderer->video_scheduler, 12);
+    // With downscaling, the ISP's resize component shrinks decoded frames to the size they are shown at,
+    // so the scheduler, the splitter and the renderers only move display sized pictures around
+    COMPONENT_T *decoder_sink = renderer->config->low_latency ? sink : NULL;
+    int decoder_sink_port = sink_port;
+    if (renderer->config->downscale) {
+        if (video_renderer_rpi_create_component(renderer, &renderer->resize, "resize",
+                                                ILCLIENT_DISABLE_ALL_PORTS) != 0) {
+            video_renderer_rpi_destroy_decoder(renderer);
+            return -14;
+        }
+        decoder_sink = renderer->resize;
+        decoder_sink_port = 60;
+    }
 
-    // Setup renderer
-    OMX_CONFIG_DISPLAYREGIONTYPE display_region;
-    memset(&display_region, 0, sizeof(OMX_CONFIG_DISPLAYREGIONTYPE));
-    display_region.nSize = sizeof(OMX_CONFIG_DISPLAYREGIONTYPE);
-    display_region.nVersion.nVersion = OMX_VERSION;
-    display_region.nPortIndex = 90;
-    display_region.set = OMX_DISPLAY_SET_FULLSCREEN | OMX_DISPLAY_SET_LAYER;
-    display_region.fullscreen = OMX_TRUE;
-    display_region.layer = LAYER_VIDEO;
+    if (renderer->config->low_latency) {
+        // Decoded frames go straight to the renderer and are shown as soon as they are ready
+        set_tunnel(&renderer->tunnels[0], renderer->video_decoder, 131, decoder_sink, decoder_sink_port);
+        renderer->tunnel_count = 1;
+    } else {
+        // Create video_scheduler
+        if (video_renderer_rpi_create_component(renderer, &renderer->video_scheduler, "video_scheduler",
+                                                ILCLIENT_DISABLE_ALL_PORTS) != 0) {
+            video_renderer_rpi_destroy_decoder(renderer);
+            return -14;
+        }
 
-    if (OMX_SetConfig(ilclient_get_handle(renderer->video_renderer), OMX_IndexConfigDisplayRegion,
-                      &display_region) != OMX_ErrorNone) {
-        logger_log(renderer->base.logger, LOGGER_DEBUG, "Could not set renderer to fullscreen");
+        // Create tunnels
+        if (!renderer->resize) {
+            decoder_sink = renderer->video_scheduler;
+            decoder_sink_port = 10;
+        }
+        set_tunnel(&renderer->tunnels[0], renderer->video_decoder, 131, decoder_sink, decoder_sink_port);
+        set_tunnel(&renderer->tunnels[1], renderer->video_scheduler, 11, sink, sink_port);
+        set_tunnel(&renderer->tunnels[2], renderer->clock, 80, renderer->video_scheduler, 12);
+        renderer->tunnel_count = 3;
+        sink = renderer->video_scheduler;
+        sink_port = 10;
+    }
+    if (renderer->resize) {
+        renderer->resize_tunnel = renderer->tunnel_count;
+        set_tunnel(&renderer->tunnels[renderer->tunnel_count++], renderer->resize, 61, sink, sink_port);
+    }
+    renderer->splitter_tunnel = renderer->tunnel_count;
+    if (renderer->video_splitter) {
+        set_tunnel(&renderer->tunnels[renderer->tunnel_count++], renderer->video_splitter, 251, renderer->video_renderer, 90);
+        for (int i = 0; i < renderer->config->clone_count; i++) {
+            set_tunnel(&renderer->tunnels[renderer->tunnel_count++], renderer->video_splitter, 252 + i,
+                       renderer->clone_renderers[i], 90);
+        }
+    }
+
+    // Setup renderers
+    int error = video_renderer_rpi_setup_display(renderer, renderer->video_renderer, -1, renderer->rotation);
+    for (int i = 0; i < renderer->config->clone_count && !error; i++) {
+        error = video_renderer_rpi_setup_display(renderer, renderer->clone_renderers[i], renderer->config->clones[i].display,
+                                                 renderer->config->clones[i].rotation);
+    }
+    if (error) {
         video_renderer_rpi_destroy_decoder(renderer);
-        return -13;
+        return error;
     }
 
     // Setup clock tunnel
-    if (ilclient_setup_tunnel(&renderer->tunnels[2], 0, 0) != 0) {
+    if (renderer->video_scheduler && ilclient_setup_tunnel(&renderer->tunnels[2], 0, 0) != 0) {
         video_renderer_rpi_destroy_decoder(renderer);
         return -15;
     }
 
-    // Setup rotation
-    if (renderer->config->rotation != 0) {
-        int rotation = renderer->config->rotation;
-        OMX_CONFIG_ROTATIONTYPE omx_rotation;
-        memset(&omx_rotation, 0, sizeof(OMX_CONFIG_ROTATIONTYPE));
-        omx_rotation.nSize = sizeof(OMX_CONFIG_ROTATIONTYPE);
-        // Check the rotation here
-        if (rotation != 90 && rotation != -90 && rotation != 180 && rotation != -180 && rotation != 270 && rotation != -270) {
-            printf("Error: Rotation must be +/- 0,90,180,270\n");
-            video_renderer_rpi_destroy_decoder(renderer);
-            return -15;
-        }
-        omx_rotation.nRotation = rotation;
-        omx_rotation.nPortIndex = 90;
-        omx_rotation.nVersion.nVersion = OMX_VERSION;
-        OMX_ERRORTYPE error = OMX_SetConfig(ilclient_get_handle(renderer->video_renderer), OMX_IndexConfigCommonRotate,
-                                            &omx_rotation);
-        if (error != OMX_ErrorNone) {
-            printf("Error: %x\n", error);
-            video_renderer_rpi_destroy_decoder(renderer);
-            return -15;
-        }
-    }
-
-    // Setup flipping
-    if (renderer->config->flip != FLIP_NONE) {
-        OMX_CONFIG_MIRRORTYPE omx_mirror;
-        memset(&omx_mirror, 0, sizeof(OMX_CONFIG_MIRRORTYPE));
-        omx_mirror.nSize = sizeof(OMX_CONFIG_MIRRORTYPE);
-        switch (renderer->config->flip) {
-        case FLIP_HORIZONTAL:
-            omx_mirror.eMirror = OMX_MirrorHorizontal;
-            break;
-        case FLIP_VERTICAL:
-            omx_mirror.eMirror = OMX_MirrorVertical;
-            break;
-        case FLIP_BOTH:
-            omx_mirror.eMirror = OMX_MirrorBoth;
-            break;
-        default:
-            omx_mirror.eMirror = OMX_MirrorNone;
-            break;
-        }
-        omx_mirror.nPortIndex = 90;
-        omx_mirror.nVersion.nVersion = OMX_VERSION;
-        OMX_ERRORTYPE error = OMX_SetConfig(ilclient_get_handle(renderer->video_renderer), OMX_IndexConfigCommonMirror,
-                                            &omx_mirror);
-        if (error != OMX_ErrorNone) {
-            printf("Error: %x\n", error);
-            video_renderer_rpi_destroy_decoder(renderer);
-            return -15;
-        }
-    }
-
     // Set decoder format
     ilclient_change_component_state(renderer->video_decoder, OMX_StateIdle);
     OMX_VIDEO_PARAM_PORTFORMATTYPE format;
@@ -334,12 +659,53 @@ static int video_renderer_rpi_init_decoder(video_renderer_rpi_t *renderer) {
     format.eCompressionFormat = OMX_VIDEO_CodingAVC;
 
     if (OMX_SetParameter(ilclient_get_handle(renderer->video_decoder), OMX_IndexParamVideoPortFormat,
-                         &format) != OMX_ErrorNone ||
-        ilclient_enable_port_buffers(renderer->video_decoder, 130, NULL, NULL, NULL) != 0) {
+                         &format) != OMX_ErrorNone) {
+        video_renderer_rpi_destroy_decoder(renderer);
+        return -15;
+    }
+
+    OMX_PARAM_PORTDEFINITIONTYPE port_definition;
+    memset(&port_definition, 0, sizeof(OMX_PARAM_PORTDEFINITIONTYPE));
+    port_definition.nSize = sizeof(OMX_PARAM_PORTDEFINITIONTYPE);
+    port_definition.nVersion.nVersion = OMX_VERSION;
+    port_definition.nPortIndex = 130;
+    if (OMX_GetParameter(ilclient_get_handle(renderer->video_decoder), OMX_IndexParamPortDefinition,
+                         &port_definition) != OMX_ErrorNone) {
         video_renderer_rpi_destroy_decoder(renderer);
         return -15;
     }
 
+    // More input buffers let the decoder queue more frames before render_buffer has to wait,
+    // larger ones save a round trip per chunk on frames that would otherwise be split
+    if (renderer->config->decoder_buffers > 0 || renderer->config->decoder_buffer_size > 0) {
+        if (renderer->config->decoder_buffers > 0) {
+            port_definition.nBufferCountActual = renderer->config->decoder_buffers;
+            if (port_definition.nBufferCountActual < port_definition.nBufferCountMin) {
+                port_definition.nBufferCountActual = port_definition.nBufferCountMin;
+            }
+        }
+        if (renderer->config->decoder_buffer_size > 0) {
+            OMX_U32 alignment = port_definition.nBufferAlignment ? port_definition.nBufferAlignment : 1;
+            port_definition.nBufferSize = (renderer->config->decoder_buffer_size + alignment - 1) / alignment * alignment;
+        }
+        if (OMX_SetParameter(ilclient_get_handle(renderer->video_decoder), OMX_IndexParamPortDefinition,
+                             &port_definition) != OMX_ErrorNone) {
+            logger_log(renderer->base.logger, LOGGER_WARNING, "Could not set %d decoder input buffers of %d bytes",
+                       renderer->config->decoder_buffers, renderer->config->decoder_buffer_size);
+        }
+        OMX_GetParameter(ilclient_get_handle(renderer->video_decoder), OMX_IndexParamPortDefinition, &port_definition);
+    }
+    logger_log(renderer->base.logger, LOGGER_DEBUG, "Video decoder uses %u input buffers of %u bytes",
+               port_definition.nBufferCountActual, port_definition.nBufferSize);
+
+    if (ilclient_enable_port_buffers(renderer->video_decoder, 130, NULL, NULL, NULL) != 0) {
+        video_renderer_rpi_destroy_decoder(renderer);
+        return -15;
+    }
+
+    // Remember the input buffer size, frames that fit can be decrypted straight into a buffer
+    renderer->input_buffer_size = port_definition.nBufferSize;
+
     // Components are started in video_renderer_start()
 
     return 1;
@@ -356,13 +722,47 @@ video_renderer_t *video_renderer_rpi_init(logger_t *logger, video_renderer_confi
     renderer->base.funcs = &video_renderer_rpi_funcs;
     renderer->base.type = VIDEO_RENDERER_RPI;
     renderer->config = config;
+    renderer->rotation = config->rotation;
+    renderer->flip = config->flip;
 
     renderer->first_packet_time = 0;
     renderer->input_frames = 0;
 
+    renderer->video_delay = latency_histogram_init();
+    if (!renderer->video_delay) {
+        free(renderer);
+        return NULL;
+    }
+    renderer->sps_patch = h264_sps_patch_init(logger, H264_SPS_PATCH_INJECT, h264_sps_patch_reorder_depth(config));
+    if (!renderer->sps_patch) {
+        latency_histogram_destroy(renderer->video_delay);
+        free(renderer);
+        return NULL;
+    }
+    MUTEX_CREATE(renderer->input_mutex);
+    COND_CREATE(renderer->input_cond);
+
+    if (config->match_refresh) {
+        TV_DISPLAY_STATE_T state;
+        memset(&state, 0, sizeof(state));
+        if (vc_tv_get_display_state(&state) == 0 && (state.state & (VC_HDMI_HDMI | VC_HDMI_DVI))) {
+            renderer->saved_hdmi_mode = (state.state & VC_HDMI_HDMI) ? HDMI_MODE_HDMI : HDMI_MODE_DVI;
+            renderer->saved_hdmi_group = state.display.hdmi.group;
+            renderer->saved_hdmi_code = state.display.hdmi.mode;
+            renderer->saved_hdmi_rate = state.display.hdmi.frame_rate;
+            refresh_match_reset(&renderer->refresh_match, renderer->saved_hdmi_rate);
+        } else {
+            logger_log(logger, LOGGER_WARNING, "No HDMI display, its refresh rate can't be matched to the video");
+        }
+    }
+
     if (video_renderer_rpi_init_decoder(renderer) != 1) {
+        COND_DESTROY(renderer->input_cond);
+        MUTEX_DESTROY(renderer->input_mutex);
+        h264_sps_patch_destroy(renderer->sps_patch);
+        latency_histogram_destroy(renderer->video_delay);
         free(renderer);
-        renderer = NULL;
+        return NULL;
     }
 
     return &renderer->base;
@@ -378,89 +778,368 @@ COMPONENT_T *video_renderer_rpi_get_clock(video_renderer_rpi_t *renderer) {
     return renderer->clock;
 }
 
+// Not static because the audio renderer presents its packets with the same delay, to stay in sync
+int64_t video_renderer_rpi_get_playout_delay(video_renderer_rpi_t *renderer) {
+    return __atomic_load_n(&renderer->playout_delay, __ATOMIC_RELAXED);
+}
+
+/*
+ * Brings the components behind the decoder to executing while their ports are still disabled,
+ * so that only the tunnels are left to set up once the first frame tells the decoder its size.
+ */
+static void video_renderer_rpi_warm_up(video_renderer_rpi_t *r) {
+    if (r->warmed_up) return;
+    if (r->video_scheduler) {
+        ilclient_change_component_state(r->video_scheduler, OMX_StateExecuting);
+    }
+    if (r->video_splitter) {
+        ilclient_change_component_state(r->video_splitter, OMX_StateExecuting);
+    }
+    if (r->resize) {
+        ilclient_change_component_state(r->resize, OMX_StateExecuting);
+    }
+    ilclient_change_component_state(r->video_renderer, OMX_StateExecuting);
+    for (int i = 0; i < r->config->clone_count; i++) {
+        ilclient_change_component_state(r->clone_renderers[i], OMX_StateExecuting);
+    }
+    r->warmed_up = true;
+}
+
 static void video_renderer_rpi_start(video_renderer_t *renderer) {
     video_renderer_rpi_t *r = (video_renderer_rpi_t *)renderer;
     ilclient_change_component_state(r->clock, OMX_StateExecuting);
     ilclient_change_component_state(r->video_decoder, OMX_StateExecuting);
+    video_renderer_rpi_warm_up(r);
 }
 
-static void video_renderer_rpi_render_buffer(video_renderer_t *renderer, raop_ntp_t *ntp, unsigned char *data, int data_len,
-                                  uint64_t pts, int type) {
-    if (data_len == 0) return;
+/*
+ * The size a frame_w x frame_h frame is scaled to: fitted into the largest picture any of the displays
+ * shows, turned as that display is, but never larger than the frame. The ISP wants a width that is a
+ * multiple of 16 and an even height.
+ */
+static void video_renderer_rpi_scaled_size(video_renderer_rpi_t *r, OMX_U32 frame_w, OMX_U32 frame_h,
+                                           OMX_U32 *width, OMX_U32 *height) {
+    uint32_t max_w = 0, max_h = 0;
+
+    for (int i = -1; i < r->config->clone_count; i++) {
+        uint32_t screen_w, screen_h;
+        int display = i < 0 ? 0 : r->config->clones[i].display;
+        int rotation = i < 0 ? r->rotation : r->config->clones[i].rotation;
+        if (graphics_get_display_size(display, &screen_w, &screen_h) < 0) {
+            continue;
+        }
+        if (i < 0 && r->config->tile_count > 1) {
+            int x, y, w, h;
+            video_renderer_tile_rect(r->config, screen_w, screen_h, &x, &y, &w, &h);
+            screen_w = w;
+            screen_h = h;
+        }
+        if (rotation % 180 != 0) {
+            uint32_t swap = screen_w;
+            screen_w = screen_h;
+            screen_h = swap;
+        }
+        if (screen_w * screen_h > max_w * max_h) {
+            max_w = screen_w;
+            max_h = screen_h;
+        }
+    }
+
+    *width = frame_w;
+    *height = frame_h;
+    if (!max_w || !max_h || (frame_w <= max_w && frame_h <= max_h)) {
+        return;
+    }
+    if ((uint64_t) frame_w * max_h > (uint64_t) frame_h * max_w) {
+        *width = max_w;
+        *height = (OMX_U32) ((uint64_t) frame_h * max_w / frame_w);
+    } else {
+        *width = (OMX_U32) ((uint64_t) frame_w * max_h / frame_h);
+        *height = max_h;
+    }
+    *width = *width >= 16 ? *width & ~15u : 16;
+    *height = *height >= 2 ? *height & ~1u : 2;
+}
 
-    video_renderer_rpi_t *r = (video_renderer_rpi_t *)renderer;
+/* Sets resize's output port to the scaled size of the current frame, the port has to be disabled */
+static int video_renderer_rpi_setup_resize(video_renderer_rpi_t *r) {
+    OMX_PARAM_PORTDEFINITIONTYPE port_definition;
+    memset(&port_definition, 0, sizeof(OMX_PARAM_PORTDEFINITIONTYPE));
+    port_definition.nSize = sizeof(OMX_PARAM_PORTDEFINITIONTYPE);
+    port_definition.nVersion.nVersion = OMX_VERSION;
+    port_definition.nPortIndex = 61;
+    if (OMX_GetParameter(ilclient_get_handle(r->resize), OMX_IndexParamPortDefinition,
+                         &port_definition) != OMX_ErrorNone) {
+        return -1;
+    }
 
-    logger_log(renderer->logger, LOGGER_DEBUG, "Got h264 data of %d bytes", data_len);
-    r->input_frames++;
+    video_renderer_rpi_scaled_size(r, r->frame_width, r->frame_height, &r->scaled_width, &r->scaled_height);
+    port_definition.format.image.nFrameWidth = r->scaled_width;
+    port_definition.format.image.nFrameHeight = r->scaled_height;
+    port_definition.format.image.nStride = 0;
+    port_definition.format.image.nSliceHeight = 0;
+    port_definition.format.image.eColorFormat = OMX_COLOR_FormatYUV420PackedPlanar;
+    if (OMX_SetParameter(ilclient_get_handle(r->resize), OMX_IndexParamPortDefinition,
+                         &port_definition) != OMX_ErrorNone) {
+        return -1;
+    }
+    logger_log(r->base.logger, LOGGER_DEBUG, "Scaling %ux%u video to %ux%u", r->frame_width, r->frame_height,
+               r->scaled_width, r->scaled_height);
+    return 0;
+}
 
-    uint8_t *modified_data = NULL;
+/* Brings resize's output to the scaled size of the current frame once its tunnel is up */
+static void video_renderer_rpi_update_resize(video_renderer_rpi_t *r) {
+    OMX_U32 width, height;
 
-    if (type == 0) {
-        // This reduces the Raspberry Pi H264 decode pipeline delay from about 11 to 6 frames for RPiPlay.
-        // Described at https://www.raspberrypi.org/forums/viewtopic.php?t=41053
-        logger_log(renderer->logger, LOGGER_DEBUG, "Injecting max_dec_frame_buffering");
-        int sps_start, sps_end;
-        int sps_size = find_nal_unit(data, data_len, &sps_start, &sps_end);
-        if (sps_size > 0) {
-            const int sps_wiggle_room = 12;
-            const unsigned char nal_marker[] = { 0x0, 0x0, 0x0, 0x1 };
-            int modified_data_len = data_len + sps_wiggle_room + sizeof(nal_marker);
-            modified_data = malloc(modified_data_len);
-
-            h264_stream_t *h = h264_new();
-            h->nal->nal_unit_type = NAL_UNIT_TYPE_SPS;
-            h->sps->vui.bitstream_restriction_flag = 1;
-            h->sps->vui.max_dec_frame_buffering = 4;
-
-            int new_sps_size = write_nal_unit(h, modified_data + sps_start, sps_wiggle_room);
-            if (new_sps_size > 0 && new_sps_size <= sps_wiggle_room) {
-                memcpy(modified_data, data, sps_start);
-                memcpy(modified_data + sps_start + new_sps_size, nal_marker, sizeof(nal_marker));
-                memcpy(modified_data + sps_start + new_sps_size + sizeof(nal_marker), data + sps_start, data_len - sps_start);
-                data = modified_data;
-                data_len = data_len + new_sps_size + sizeof(nal_marker);
-            } else {
-                free(modified_data);
-                modified_data = NULL;
-            }
-            h264_free(h);
-        } else {
-            logger_log(renderer->logger, LOGGER_ERR, "Could not find sps boundaries");
-        }
+    video_renderer_rpi_scaled_size(r, r->frame_width, r->frame_height, &width, &height);
+    if (width == r->scaled_width && height == r->scaled_height) {
+        return;
     }
+    ilclient_disable_tunnel(&r->tunnels[r->resize_tunnel]);
+    if (video_renderer_rpi_setup_resize(r) != 0) {
+        logger_log(r->base.logger, LOGGER_ERR, "Could not scale video to %ux%u", width, height);
+    }
+    ilclient_enable_tunnel(&r->tunnels[r->resize_tunnel]);
+}
 
+static void video_renderer_rpi_check_port_settings(video_renderer_rpi_t *r, raop_ntp_t *ntp) {
     if (ilclient_remove_event(r->video_decoder, OMX_EventPortSettingsChanged, 131, 0, 0, 1) == 0) {
-        logger_log(renderer->logger, LOGGER_DEBUG, "Port settings changed!!");
+        logger_log(r->base.logger, LOGGER_DEBUG, "Port settings changed!!");
 
         uint64_t time_diff = raop_ntp_get_local_time(ntp) - r->first_packet_time;
-        logger_log(renderer->logger, LOGGER_DEBUG, "Video pipeline delay is %llu frames or %llu us",
+        logger_log(r->base.logger, LOGGER_DEBUG, "Video pipeline delay is %llu frames or %llu us",
                    r->input_frames, time_diff);
 
+        OMX_PARAM_PORTDEFINITIONTYPE port_definition;
+        memset(&port_definition, 0, sizeof(OMX_PARAM_PORTDEFINITIONTYPE));
+        port_definition.nSize = sizeof(OMX_PARAM_PORTDEFINITIONTYPE);
+        port_definition.nVersion.nVersion = OMX_VERSION;
+        port_definition.nPortIndex = 131;
+        OMX_GetParameter(ilclient_get_handle(r->video_decoder), OMX_IndexParamPortDefinition, &port_definition);
+        OMX_U32 width = port_definition.format.video.nFrameWidth;
+        OMX_U32 height = port_definition.format.video.nFrameHeight;
+
+        if (r->tunnels_ready) {
+            if (width == r->frame_width && height == r->frame_height) {
+                // Same stream format as before the last flush, the existing tunnels carry on
+                logger_log(r->base.logger, LOGGER_DEBUG, "Video size unchanged at %ux%u, keeping tunnels", width, height);
+                return;
+            }
+            // A rotated sender: only the decoder's output port takes on the new size, like omxplayer does it.
+            // The tunnels, the scheduler and the renderers stay up and scale whatever comes through.
+            uint64_t start = raop_ntp_get_local_time(ntp);
+            if (r->resize) {
+                // resize's input has to take on the new size as well
+                ilclient_disable_tunnel(&r->tunnels[0]);
+                ilclient_enable_tunnel(&r->tunnels[0]);
+            } else {
+                ilclient_disable_port(r->video_decoder, 131);
+                ilclient_enable_port(r->video_decoder, 131);
+            }
+            logger_log(r->base.logger, LOGGER_INFO, "Video size changed from %ux%u to %ux%u, decoder output reconfigured in %llu us",
+                       r->frame_width, r->frame_height, width, height,
+                       (unsigned long long) (raop_ntp_get_local_time(ntp) - start));
+            r->frame_width = width;
+            r->frame_height = height;
+            if (r->resize) {
+                video_renderer_rpi_update_resize(r);
+            }
+            return;
+        }
+
+        video_renderer_rpi_warm_up(r);
+
         if (ilclient_setup_tunnel(&r->tunnels[0], 0, 0) != 0) {
-            logger_log(renderer->logger, LOGGER_ERR, "Could not setup decoder tunnel");
+            logger_log(r->base.logger, LOGGER_ERR, "Could not setup decoder tunnel");
+            return;
         }
 
-        ilclient_change_component_state(r->video_scheduler, OMX_StateExecuting);
+        if (r->resize) {
+            r->frame_width = width;
+            r->frame_height = height;
+            if (video_renderer_rpi_setup_resize(r) != 0 || ilclient_setup_tunnel(&r->tunnels[r->resize_tunnel], 0, 0) != 0) {
+                logger_log(r->base.logger, LOGGER_ERR, "Could not setup resize tunnel");
+                return;
+            }
+        }
+
+        if (r->video_scheduler && ilclient_setup_tunnel(&r->tunnels[1], 0, 1000) != 0) {
+            logger_log(r->base.logger, LOGGER_ERR, "Could not setup scheduler tunnel");
+            return;
+        }
+
+        // The splitter takes on its input's format right away, so there is nothing to wait for on its outputs
+        for (int i = r->splitter_tunnel; i < r->tunnel_count; i++) {
+            if (ilclient_setup_tunnel(&r->tunnels[i], 0, 0) != 0) {
+                logger_log(r->base.logger, LOGGER_ERR, "Could not setup tunnel to display %d", i - r->splitter_tunnel);
+                return;
+            }
+        }
+
+        r->frame_width = width;
+        r->frame_height = height;
+        r->tunnels_ready = true;
+    }
+}
+
+static int64_t video_renderer_rpi_record_delay(video_renderer_rpi_t *r, raop_ntp_t *ntp, uint64_t pts) {
+    int64_t video_delay = ((int64_t) raop_ntp_get_local_time(ntp)) - ((int64_t) pts);
+    latency_histogram_record(r->video_delay, video_delay);
+    r->last_video_delay = video_delay;
+    if (!r->config->low_latency && pts) {
+        __atomic_store_n(&r->playout_delay, playout_delay_update(&r->playout, video_delay), __ATOMIC_RELAXED);
+    }
+    return video_delay;
+}
+
+/*
+ * The clock starts at the local time of the first frame, so from then on a frame is shown
+ * once the local clock reaches its timestamp, its pts plus the playout delay.
+ */
+static void video_renderer_rpi_stamp_buffer(video_renderer_rpi_t *r, raop_ntp_t *ntp, OMX_BUFFERHEADERTYPE *buffer,
+                                            uint64_t pts, int64_t video_delay) {
+    if (video_delay > r->playout_delay + VIDEO_RESYNC_DELAY)
+        r->first_packet_time = 0;
+
+    if (!r->config->low_latency) buffer->nTimeStamp = ilclient_ticks_from_s64(pts + r->playout_delay);
+    if (r->first_packet_time == 0) {
+        buffer->nFlags = OMX_BUFFERFLAG_STARTTIME;
+        r->first_packet_time = raop_ntp_get_local_time(ntp);
+        if (!r->config->low_latency) buffer->nTimeStamp = ilclient_ticks_from_s64(r->first_packet_time);
+    }
+    r->last_timestamp = (uint64_t) ilclient_ticks_to_s64(buffer->nTimeStamp);
+}
+
+/*
+ * The scheduler shows a frame once the clock's media time reaches its timestamp. The media time started
+ * at the timestamp of the first frame when that frame came out of the decoder, a little after the local
+ * time it went in with, so the difference between the two clocks now is taken off each frame's timestamp.
+ * Polled from the mirror thread as frames go in, a frame is reported one frame interval late at most.
+ */
+static void video_renderer_rpi_report_presented(video_renderer_rpi_t *r, raop_ntp_t *ntp, uint64_t pts) {
+    if (!r->base.presented || r->config->low_latency) return;
+
+    if (pts) {
+        if (r->presenting_count == PRESENTING_FRAMES) {
+            r->presenting_first = (r->presenting_first + 1) % PRESENTING_FRAMES;
+            r->presenting_count--;
+        }
+        unsigned int last = (r->presenting_first + r->presenting_count) % PRESENTING_FRAMES;
+        r->presenting[last][0] = pts;
+        r->presenting[last][1] = r->last_timestamp;
+        r->presenting_count++;
+    }
 
-        if (ilclient_setup_tunnel(&r->tunnels[1], 0, 1000) != 0) {
-            logger_log(renderer->logger, LOGGER_ERR, "Could not setup scheduler tunnel");
+    OMX_TIME_CONFIG_TIMESTAMPTYPE media_time;
+    memset(&media_time, 0, sizeof(OMX_TIME_CONFIG_TIMESTAMPTYPE));
+    media_time.nSize = sizeof(OMX_TIME_CONFIG_TIMESTAMPTYPE);
+    media_time.nVersion.nVersion = OMX_VERSION;
+    media_time.nPortIndex = OMX_ALL;
+    if (OMX_GetConfig(ilclient_get_handle(r->clock), OMX_IndexConfigTimeCurrentMediaTime, &media_time) != OMX_ErrorNone) {
+        return;
+    }
+    int64_t media = ilclient_ticks_to_s64(media_time.nTimestamp);
+    int64_t skew = (int64_t) raop_ntp_get_local_time(ntp) - media;
+    while (r->presenting_count && (int64_t) r->presenting[r->presenting_first][1] <= media) {
+        uint64_t *frame = r->presenting[r->presenting_first];
+        video_renderer_frame_presented(&r->base, frame[0], (uint64_t) ((int64_t) frame[1] + skew));
+        r->presenting_first = (r->presenting_first + 1) % PRESENTING_FRAMES;
+        r->presenting_count--;
+    }
+}
+
+/*
+ * Switches HDMI to the mode of the same size whose refresh rate the stream's frame rate divides, once
+ * refresh_match finds the frame rate steady. Only HDMI goes through tvservice, composite is left alone.
+ */
+static void video_renderer_rpi_match_refresh(video_renderer_rpi_t *r, raop_ntp_t *ntp, uint64_t pts) {
+    uint64_t now = raop_ntp_get_local_time(ntp);
+    int rate = refresh_match_update(&r->refresh_match, pts, now);
+    if (!rate) return;
+
+    TV_DISPLAY_STATE_T state;
+    TV_SUPPORTED_MODE_NEW_T modes[MAX_HDMI_MODES];
+    int rates[MAX_HDMI_MODES];
+    uint32_t codes[MAX_HDMI_MODES];
+    int count = 0, refresh = 0;
+
+    memset(&state, 0, sizeof(state));
+    if (vc_tv_get_display_state(&state) == 0 && (state.state & (VC_HDMI_HDMI | VC_HDMI_DVI))) {
+        int modes_count = vc_tv_hdmi_get_supported_modes_new(state.display.hdmi.group, modes, MAX_HDMI_MODES, NULL, NULL);
+        for (int i = 0; i < modes_count; i++) {
+            if (modes[i].width == state.display.hdmi.width && modes[i].height == state.display.hdmi.height &&
+                modes[i].scan_mode == state.display.hdmi.scan_mode) {
+                rates[count] = modes[i].frame_rate;
+                codes[count++] = modes[i].code;
+            }
         }
+        refresh = refresh_match_pick(state.display.hdmi.frame_rate, rate, rates, count);
+    }
+    for (int i = 0; i < count && refresh; i++) {
+        if (rates[i] != refresh) continue;
+        HDMI_MODE_T mode = (state.state & VC_HDMI_HDMI) ? HDMI_MODE_HDMI : HDMI_MODE_DVI;
+        if (vc_tv_hdmi_power_on_explicit_new(mode, state.display.hdmi.group, codes[i]) != 0) {
+            logger_log(r->base.logger, LOGGER_WARNING, "Could not switch HDMI to %d Hz for %d fps video", refresh, rate);
+            refresh = 0;
+        } else {
+            logger_log(r->base.logger, LOGGER_INFO, "Switched HDMI from %d Hz to %d Hz for %d fps video",
+                       state.display.hdmi.frame_rate, refresh, rate);
+            r->hdmi_switched = true;
+        }
+        break;
+    }
+    if (!refresh) {
+        logger_log(r->base.logger, LOGGER_DEBUG, "No %ux%u HDMI mode fits %d fps video",
+                   state.display.hdmi.width, state.display.hdmi.height, rate);
+    }
+    refresh_match_switched(&r->refresh_match, refresh, now);
+}
+
+/* Puts HDMI back into the mode it was in before the first switch */
+static void video_renderer_rpi_restore_hdmi(video_renderer_rpi_t *r) {
+    if (!r->hdmi_switched) return;
+    if (vc_tv_hdmi_power_on_explicit_new(r->saved_hdmi_mode, r->saved_hdmi_group, r->saved_hdmi_code) != 0) {
+        logger_log(r->base.logger, LOGGER_WARNING, "Could not switch HDMI back to its mode");
+    }
+    r->hdmi_switched = false;
+}
+
+static int video_renderer_rpi_render_buffer(video_renderer_t *renderer, raop_ntp_t *ntp, unsigned char *data, int data_len,
+                                            uint64_t pts, int type, const h264_nal_unit_t *nal_units, int nal_count) {
+    if (data_len == 0) return 0;
+
+    video_renderer_rpi_t *r = (video_renderer_rpi_t *)renderer;
 
-        ilclient_change_component_state(r->video_renderer, OMX_StateExecuting);
+    logger_log(renderer->logger, LOGGER_DEBUG, "Got h264 data of %d bytes", data_len);
+    r->input_frames++;
+
+    if (type == 0) {
+        // This reduces the Raspberry Pi H264 decode pipeline delay from about 11 to 6 frames for RPiPlay.
+        // Described at https://www.raspberrypi.org/forums/viewtopic.php?t=41053
+        data = h264_sps_patch_apply(r->sps_patch, data, &data_len, nal_units, nal_count);
     }
 
+    video_renderer_rpi_check_port_settings(r, ntp);
+    if (r->config->match_refresh) {
+        video_renderer_rpi_match_refresh(r, ntp, pts);
+    }
+
+    int64_t video_delay = video_renderer_rpi_record_delay(r, ntp, pts);
+    if ((OMX_U32) data_len > r->input_buffer_size) {
+        r->split_frames++;
+        r->split_buffers += (data_len + r->input_buffer_size - 1) / r->input_buffer_size;
+    }
     int offset = 0;
     while (offset < data_len) {
-        OMX_BUFFERHEADERTYPE *buffer = ilclient_get_input_buffer(r->video_decoder, 130, 0);
-        if (buffer == NULL) logger_log(renderer->logger, LOGGER_ERR, "Got NULL buffer!");
-        if (!buffer)
-            exit(-1);
-            //break;
-
-        int64_t video_delay = ((int64_t) raop_ntp_get_local_time(ntp)) - ((int64_t) pts);
-        logger_log(renderer->logger, LOGGER_DEBUG, "Video delay is %lld", video_delay);
-        if (video_delay > 100000)
-            r->first_packet_time = 0;
+        OMX_BUFFERHEADERTYPE *buffer = video_renderer_rpi_get_input_buffer(r, INPUT_BUFFER_TIMEOUT_MS);
+        if (!buffer) {
+            // Give up on the rest of the frame rather than stall the mirror pipeline
+            r->input_timeouts++;
+            logger_log(renderer->logger, LOGGER_WARNING, "Video decoder busy for %d ms, dropped %d of %d bytes (%llu times)",
+                       INPUT_BUFFER_TIMEOUT_MS, data_len - offset, data_len, (unsigned long long) r->input_timeouts);
+            return -1;
+        }
 
         int chunk_size = MIN(data_len - offset, buffer->nAllocLen);
         memcpy(buffer->pBuffer, data + offset, chunk_size);
@@ -470,12 +1149,7 @@ static void video_renderer_rpi_render_buffer(video_renderer_t *renderer, raop_nt
         buffer->nFilledLen = chunk_size;
         buffer->nOffset = 0;
 
-        if (!r->config->low_latency) buffer->nTimeStamp = ilclient_ticks_from_s64(pts);
-        if (r->first_packet_time == 0) {
-            buffer->nFlags = OMX_BUFFERFLAG_STARTTIME;
-            r->first_packet_time = raop_ntp_get_local_time(ntp);
-            if (!r->config->low_latency) buffer->nTimeStamp = ilclient_ticks_from_s64(r->first_packet_time);
-        }
+        video_renderer_rpi_stamp_buffer(r, ntp, buffer, pts, video_delay);
 
         // Mark the last buffer if we had to split the data (probably not necessary)
         if (chunk_size < data_len && offset == data_len) {
@@ -487,49 +1161,345 @@ static void video_renderer_rpi_render_buffer(video_renderer_t *renderer, raop_nt
         }
 
     }
+    video_renderer_rpi_report_presented(r, ntp, pts);
+    trace_event(TRACE_VIDEO_RENDERED, data_len, pts);
+    return 0;
+}
+
+/*
+ * The decoder takes a frame in as many buffers as it comes in, it only decodes the frame once it sees
+ * OMX_BUFFERFLAG_ENDOFFRAME, but parses the slices before that as they are emptied into it.
+ */
+static int video_renderer_rpi_render_part(video_renderer_t *renderer, raop_ntp_t *ntp, unsigned char *data, int data_len,
+                                          uint64_t pts, const h264_nal_unit_t *nal_units, int nal_count, int part, bool last) {
+    video_renderer_rpi_t *r = (video_renderer_rpi_t *)renderer;
+
+    if (data_len == 0 && !last) return 0;
+
+    if (part == 0) {
+        r->input_frames++;
+        r->part_bytes = 0;
+        video_renderer_rpi_check_port_settings(r, ntp);
+        if (r->config->match_refresh) {
+            video_renderer_rpi_match_refresh(r, ntp, pts);
+        }
+        video_renderer_rpi_record_delay(r, ntp, pts);
+    }
+
+    int offset = 0;
+    do {
+        OMX_BUFFERHEADERTYPE *buffer = video_renderer_rpi_get_input_buffer(r, INPUT_BUFFER_TIMEOUT_MS);
+        if (!buffer) {
+            r->input_timeouts++;
+            logger_log(renderer->logger, LOGGER_WARNING, "Video decoder busy for %d ms, dropped the rest of a frame from part %d (%llu times)",
+                       INPUT_BUFFER_TIMEOUT_MS, part, (unsigned long long) r->input_timeouts);
+            return -1;
+        }
+
+        int chunk_size = MIN(data_len - offset, buffer->nAllocLen);
+        memcpy(buffer->pBuffer, data + offset, chunk_size);
+        offset += chunk_size;
+
+        buffer->nFilledLen = chunk_size;
+        buffer->nOffset = 0;
+        buffer->nFlags = 0;
+        video_renderer_rpi_stamp_buffer(r, ntp, buffer, pts, r->last_video_delay);
+        if (last && offset == data_len) {
+            buffer->nFlags |= OMX_BUFFERFLAG_ENDOFFRAME;
+        }
+
+        if (OMX_EmptyThisBuffer(ilclient_get_handle(r->video_decoder), buffer) != OMX_ErrorNone) {
+            logger_log(renderer->logger, LOGGER_ERR, "Video decoder refused processing buffer");
+        }
+    } while (offset < data_len);
+
+    r->part_bytes += data_len;
+    if (last) {
+        video_renderer_rpi_report_presented(r, ntp, pts);
+        trace_event(TRACE_VIDEO_RENDERED, r->part_bytes, pts);
+    }
+    return 0;
+}
+
+static unsigned char *video_renderer_rpi_acquire_buffer(video_renderer_t *renderer, int size, void **handle) {
+    video_renderer_rpi_t *r = (video_renderer_rpi_t *)renderer;
+
+    // Frames that need more than one input buffer go through render_buffer
+    if (size <= 0 || size > r->input_buffer_size) return NULL;
 
-    if (modified_data) {
-        // We overwrote the data buffer to inject the max_dec_frame_buffering before,
-        // so we need to free the data buffer here
-        free(modified_data);
+    // Don't block, the caller is the network receive thread and falls back to its own buffer
+    OMX_BUFFERHEADERTYPE *buffer = ilclient_get_input_buffer(r->video_decoder, 130, 0);
+    if (!buffer) {
+        return NULL;
     }
+    if (buffer->nAllocLen < size) {
+        // Should not happen since all port buffers have the same size, return it empty
+        buffer->nFilledLen = 0;
+        buffer->nFlags = 0;
+        OMX_EmptyThisBuffer(ilclient_get_handle(r->video_decoder), buffer);
+        return NULL;
+    }
+    *handle = buffer;
+    return buffer->pBuffer;
 }
 
-static void video_renderer_rpi_flush(video_renderer_t *renderer) {
+static void video_renderer_rpi_submit_buffer(video_renderer_t *renderer, raop_ntp_t *ntp, void *handle, int data_len,
+                                             uint64_t pts, int type, const h264_nal_unit_t *nal_units, int nal_count) {
     video_renderer_rpi_t *r = (video_renderer_rpi_t *)renderer;
-    OMX_BUFFERHEADERTYPE *buffer = ilclient_get_input_buffer(r->video_decoder, 130, 1);
-    if (buffer == NULL) logger_log(renderer->logger, LOGGER_ERR, "Got NULL buffer while flushing!");
-    if (!buffer)
-        return;
+    OMX_BUFFERHEADERTYPE *buffer = handle;
 
+    logger_log(renderer->logger, LOGGER_DEBUG, "Got h264 data of %d bytes in place", data_len);
+    r->input_frames++;
+
+    video_renderer_rpi_check_port_settings(r, ntp);
+    if (r->config->match_refresh) {
+        video_renderer_rpi_match_refresh(r, ntp, pts);
+    }
+
+    buffer->nFilledLen = data_len;
+    buffer->nOffset = 0;
+    buffer->nFlags = 0;
+    video_renderer_rpi_stamp_buffer(r, ntp, buffer, pts, video_renderer_rpi_record_delay(r, ntp, pts));
+    buffer->nFlags |= OMX_BUFFERFLAG_ENDOFFRAME;
+
+    if (OMX_EmptyThisBuffer(ilclient_get_handle(r->video_decoder), buffer) != OMX_ErrorNone) {
+        logger_log(renderer->logger, LOGGER_ERR, "Video decoder refused processing buffer");
+    }
+    video_renderer_rpi_report_presented(r, ntp, pts);
+    trace_event(TRACE_VIDEO_RENDERED, data_len, pts);
+}
+
+static void video_renderer_rpi_release_buffer(video_renderer_t *renderer, void *handle) {
+    video_renderer_rpi_t *r = (video_renderer_rpi_t *)renderer;
+    OMX_BUFFERHEADERTYPE *buffer = handle;
+
+    // There is no way to give an input buffer back unused, so submit it empty
     buffer->nFilledLen = 0;
-    buffer->nFlags = OMX_BUFFERFLAG_TIME_UNKNOWN | OMX_BUFFERFLAG_EOS;
+    buffer->nOffset = 0;
+    buffer->nFlags = 0;
     if (OMX_EmptyThisBuffer(ilclient_get_handle(r->video_decoder), buffer) != OMX_ErrorNone) {
-        logger_log(renderer->logger, LOGGER_ERR, "Video decoder refused processing buffer while flushing!");
+        logger_log(renderer->logger, LOGGER_ERR, "Video decoder refused processing buffer");
     }
+}
 
-    // Wait until EOS reaches renderer
-    ilclient_wait_for_event(r->video_renderer, OMX_EventBufferFlag, 90, 0, OMX_BUFFERFLAG_EOS, 0,
-                            ILCLIENT_BUFFER_FLAG_EOS, -1);
-    ilclient_flush_tunnels(r->tunnels, 0);
+static uint64_t video_renderer_rpi_now_ms(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (uint64_t) time.tv_sec * 1000 + time.tv_nsec / 1000000;
+}
+
+/*
+ * Discards whatever is queued in the pipeline instead of draining it with an EOS buffer.
+ * The flush commands go out to all ports at once and the wait for them is bounded,
+ * so a stuck decoder can't block the caller.
+ */
+static void video_renderer_rpi_flush(video_renderer_t *renderer) {
+    video_renderer_rpi_t *r = (video_renderer_rpi_t *)renderer;
+    COMPONENT_T *components[FLUSH_MAX_PORTS];
+    OMX_U32 ports[FLUSH_MAX_PORTS];
+    int port_count = 0;
+
+    components[port_count] = r->video_decoder;
+    ports[port_count++] = 130;
+    for (TUNNEL_T *tunnel = r->tunnels; tunnel->source && port_count + 2 <= FLUSH_MAX_PORTS; tunnel++) {
+        components[port_count] = tunnel->source;
+        ports[port_count++] = tunnel->source_port;
+        components[port_count] = tunnel->sink;
+        ports[port_count++] = tunnel->sink_port;
+    }
+
+    for (int i = 0; i < port_count; i++) {
+        if (OMX_SendCommand(ilclient_get_handle(components[i]), OMX_CommandFlush, ports[i], NULL) != OMX_ErrorNone) {
+            logger_log(renderer->logger, LOGGER_ERR, "Could not flush video port %u", ports[i]);
+            components[i] = NULL;
+        }
+    }
+
+    uint64_t deadline = video_renderer_rpi_now_ms() + FLUSH_TIMEOUT_MS;
+    for (int i = 0; i < port_count; i++) {
+        if (!components[i]) continue;
+        uint64_t now = video_renderer_rpi_now_ms();
+        int timeout = now < deadline ? (int) (deadline - now) : 0;
+        if (ilclient_wait_for_event(components[i], OMX_EventCmdComplete, OMX_CommandFlush, 0, ports[i], 0,
+                                    ILCLIENT_PORT_FLUSH, timeout) != 0) {
+            logger_log(renderer->logger, LOGGER_WARNING, "Video port %u not flushed within %d ms", ports[i], FLUSH_TIMEOUT_MS);
+        }
+    }
 
     r->first_packet_time = 0;
+    // Flushed frames never show
+    r->presenting_count = 0;
+
+    playout_delay_log(&r->playout, renderer->logger, "Video");
+    playout_delay_reset(&r->playout);
+    __atomic_store_n(&r->playout_delay, 0, __ATOMIC_RELAXED);
+
+    latency_histogram_stats_t stats;
+    latency_histogram_get_stats(r->video_delay, &stats);
+    if (stats.count) {
+        logger_log(renderer->logger, LOGGER_INFO, "Video delay over %llu frames: p50 = %llu us, p95 = %llu us, p99 = %llu us, max = %llu us",
+                   (unsigned long long) stats.count, (unsigned long long) stats.p50, (unsigned long long) stats.p95,
+                   (unsigned long long) stats.p99, (unsigned long long) stats.max);
+    }
+    latency_histogram_reset(r->video_delay);
+
+    if (r->split_frames) {
+        logger_log(renderer->logger, LOGGER_INFO, "Video decoder input: %llu frames larger than %u bytes were split into %llu buffers",
+                   (unsigned long long) r->split_frames, r->input_buffer_size, (unsigned long long) r->split_buffers);
+    }
+    r->split_frames = 0;
+    r->split_buffers = 0;
 }
 
 static void video_renderer_rpi_destroy(video_renderer_t *renderer) {
     video_renderer_rpi_t *r = (video_renderer_rpi_t *)renderer;
     if (renderer) {
-        // Only flush if data was sent through, gets stuck otherwise
+        // Only flush if data was sent through
         if (r->first_packet_time) video_renderer_rpi_flush(renderer);
-        video_renderer_rpi_destroy_decoder(r);
+        if (!r->suspended) video_renderer_rpi_destroy_decoder(r);
+        video_renderer_rpi_restore_hdmi(r);
+        video_renderer_rpi_remove_overlay(r);
+        COND_DESTROY(r->input_cond);
+        MUTEX_DESTROY(r->input_mutex);
+        latency_histogram_destroy(r->video_delay);
+        h264_sps_patch_destroy(r->sps_patch);
         free(renderer);
     }
 }
 
+/* Only the OpenMAX components go, the background, the SPS patch and the counters stay */
+static void video_renderer_rpi_suspend(video_renderer_t *renderer) {
+    video_renderer_rpi_t *r = (video_renderer_rpi_t *)renderer;
+
+    video_renderer_rpi_destroy_decoder(r);
+    // Nobody is watching, the next sender starts from the display's own mode
+    if (r->hdmi_switched) {
+        video_renderer_rpi_restore_hdmi(r);
+        refresh_match_reset(&r->refresh_match, r->saved_hdmi_rate);
+    }
+    r->warmed_up = false;
+    r->tunnels_ready = false;
+    r->frame_width = 0;
+    r->frame_height = 0;
+    r->scaled_width = 0;
+    r->scaled_height = 0;
+    r->first_packet_time = 0;
+    r->presenting_count = 0;
+    playout_delay_reset(&r->playout);
+    __atomic_store_n(&r->playout_delay, 0, __ATOMIC_RELAXED);
+    r->suspended = true;
+}
+
+static int video_renderer_rpi_resume(video_renderer_t *renderer) {
+    video_renderer_rpi_t *r = (video_renderer_rpi_t *)renderer;
+
+    if (video_renderer_rpi_init_decoder(r) != 1) {
+        return -1;
+    }
+    r->suspended = false;
+    video_renderer_rpi_start(renderer);
+    return 0;
+}
+
+/* Frames are held back until their pts plus the playout delay, unless in low-latency mode */
+static void video_renderer_rpi_get_stats(video_renderer_t *renderer, video_renderer_stats_t *stats) {
+    video_renderer_rpi_t *r = (video_renderer_rpi_t *)renderer;
+
+    stats->decode_errors = __atomic_load_n(&r->decode_errors, __ATOMIC_RELAXED);
+    if (r->config->low_latency || r->playout.count == 0) return;
+    stats->decoder_latency = r->playout.current > r->last_video_delay ? r->playout.current - r->last_video_delay : 0;
+    stats->has_presentation_offset = true;
+    stats->presentation_offset = r->playout.current;
+    stats->paced = true;
+}
+
+/* The HDMI mode, limited to what the decoder can keep up with */
+static void video_renderer_rpi_get_caps(video_renderer_t *renderer, video_renderer_caps_t *caps) {
+    TV_DISPLAY_STATE_T state;
+    uint32_t width, height;
+    int fps = 60;
+
+    if (graphics_get_display_size(0, &width, &height) < 0) {
+        return;
+    }
+    memset(&state, 0, sizeof(state));
+    if (vc_tv_get_display_state(&state) == 0 && (state.state & (VC_HDMI_HDMI | VC_HDMI_DVI)) &&
+        state.display.hdmi.frame_rate > 0) {
+        fps = state.display.hdmi.frame_rate;
+    }
+    if (width > DECODER_MAX_WIDTH || height > DECODER_MAX_HEIGHT) {
+        // Keep the aspect ratio of the screen, e.g. 4K TVs get 1920x1080
+        if (width * DECODER_MAX_HEIGHT > height * DECODER_MAX_WIDTH) {
+            height = height * DECODER_MAX_WIDTH / width;
+            width = DECODER_MAX_WIDTH;
+        } else {
+            width = width * DECODER_MAX_HEIGHT / height;
+            height = DECODER_MAX_HEIGHT;
+        }
+    }
+    caps->max_width = width;
+    caps->max_height = height;
+    caps->max_fps = MIN(fps, (int) (DECODER_MAX_PIXEL_RATE / (width * height)));
+}
+
+/* Rotation and flip are display settings of the video_render components, the clock is set up for good */
+static void video_renderer_rpi_reconfigure(video_renderer_t *renderer, video_renderer_config_t const *config) {
+    video_renderer_rpi_t *r = (video_renderer_rpi_t *)renderer;
+
+    if (config->low_latency != r->config->low_latency) {
+        logger_log(renderer->logger, LOGGER_WARNING, "The rpi renderer only changes low-latency mode on a restart");
+    }
+    r->rotation = config->rotation;
+    r->flip = config->flip;
+    int error = video_renderer_rpi_setup_display(r, r->video_renderer, -1, r->rotation);
+    for (int i = 0; i < r->config->clone_count && !error; i++) {
+        error = video_renderer_rpi_setup_display(r, r->clone_renderers[i], r->config->clones[i].display,
+                                                 r->config->clones[i].rotation);
+    }
+    if (error) {
+        logger_log(renderer->logger, LOGGER_ERR, "Could not change the video orientation: %d", error);
+    }
+    // Turning the picture by 90 degrees turns the size it is shown at as well
+    if (r->resize && r->tunnels_ready) {
+        video_renderer_rpi_update_resize(r);
+    }
+}
+
+/* The buffers of the decoder's input port 130 and output port 131, both on the VideoCore */
+static void video_renderer_rpi_get_memory(video_renderer_t *renderer, video_renderer_memory_t *memory) {
+    video_renderer_rpi_t *r = (video_renderer_rpi_t *)renderer;
+
+    memory->device_total = videocore_memory_get("gpu");
+    memory->device_free = videocore_memory_get("reloc");
+    if (r->suspended) return;
+    for (OMX_U32 port = 130; port <= 131; port++) {
+        OMX_PARAM_PORTDEFINITIONTYPE port_definition;
+        memset(&port_definition, 0, sizeof(OMX_PARAM_PORTDEFINITIONTYPE));
+        port_definition.nSize = sizeof(OMX_PARAM_PORTDEFINITIONTYPE);
+        port_definition.nVersion.nVersion = OMX_VERSION;
+        port_definition.nPortIndex = port;
+        if (OMX_GetParameter(ilclient_get_handle(r->video_decoder), OMX_IndexParamPortDefinition,
+                             &port_definition) == OMX_ErrorNone && port_definition.bEnabled) {
+            memory->device_bytes += (size_t) port_definition.nBufferCountActual * port_definition.nBufferSize;
+        }
+    }
+}
+
 static const video_renderer_funcs_t video_renderer_rpi_funcs = {
     .start = video_renderer_rpi_start,
     .render_buffer = video_renderer_rpi_render_buffer,
     .flush = video_renderer_rpi_flush,
     .destroy = video_renderer_rpi_destroy,
     .update_background = video_renderer_rpi_update_background,
+    .acquire_buffer = video_renderer_rpi_acquire_buffer,
+    .submit_buffer = video_renderer_rpi_submit_buffer,
+    .release_buffer = video_renderer_rpi_release_buffer,
+    .get_stats = video_renderer_rpi_get_stats,
+    .get_caps = video_renderer_rpi_get_caps,
+    .reconfigure = video_renderer_rpi_reconfigure,
+    .suspend = video_renderer_rpi_suspend,
+    .resume = video_renderer_rpi_resume,
+    .set_overlay = video_renderer_rpi_set_overlay,
+    .render_part = video_renderer_rpi_render_part,
+    .get_memory = video_renderer_rpi_get_memory,
 };
@@ -0,0 +1,47 @@
+/**
+ * RPiPlay - An open-source AirPlay mirroring server for Raspberry Pi
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+/*
+ * Memory of the VideoCore, which holds the decoders' buffers and the display's
+ * layers on a Pi. gpu is the part of the RAM split off for it with gpu_mem,
+ * reloc the free part of its relocatable heap, where decoder buffers come from.
+ * Asked through the firmware like vcgencmd get_mem, bcm_host_init must have
+ * been called.
+ */
+
+#ifndef VIDEOCORE_MEMORY_H
+#define VIDEOCORE_MEMORY_H
+
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include "bcm_host.h"
+
+/* Bytes of name in a get_mem answer like "gpu=76M", 0 if the firmware can't tell */
+static inline size_t videocore_memory_get(const char *name) {
+    char response[64];
+    char unit = 'M';
+    unsigned long value;
+
+    if (vc_gencmd(response, sizeof(response), "get_mem %s", name) != 0) return 0;
+    const char *equals = strchr(response, '=');
+    if (!equals || sscanf(equals + 1, "%lu%c", &value, &unit) < 1) return 0;
+    return (size_t) value << (unit == 'K' ? 10 : unit == 'G' ? 30 : 20);
+}
+
+#endif //VIDEOCORE_MEMORY_H
@@ -23,15 +23,53 @@
 #include <unistd.h>
 #include <string>
 #include <vector>
+#include <algorithm>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
 #include <fstream>
+#include <sstream>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/utsname.h>
 
 #include "log.h"
+#include "rpiplay_common.h"
 #include "lib/raop.h"
 #include "lib/stream.h"
 #include "lib/logger.h"
 #include "lib/dnssd.h"
+#include "lib/trace.h"
+#include "lib/thread_attr.h"
+#include "lib/thread_stats.h"
+#include "lib/process_memory.h"
+#include "lib/netutils.h"
+#include "lib/cpu_features.h"
+#include "lib/crypto.h"
 #include "renderers/video_renderer.h"
 #include "renderers/audio_renderer.h"
+#include "renderers/dsp_kernels.h"
+#include "renderers/av_sync.h"
+#include "renderers/pcm_gain.h"
+#include "renderers/h264_test_clip.h"
+#if defined(HAS_AAC_DECODER)
+#include "renderers/aac_decoder.h"
+#include "renderers/alac_decoder.h"
+#endif
+#if defined(HAS_THUMBNAILER)
+#include "renderers/thumbnailer.h"
+#endif
+#if defined(HAS_V4L2_OUTPUT)
+#include "renderers/v4l2_output.h"
+#endif
+#if defined(HAS_NOW_PLAYING)
+#include "renderers/now_playing.h"
+#endif
+#if defined(HAS_GSTREAMER_RENDERER)
+#include "renderers/video_player.h"
+#endif
 
 #define VERSION "1.2"
 
@@ -39,84 +77,216 @@
 #define DEFAULT_BACKGROUND_MODE BACKGROUND_MODE_ON
 #define DEFAULT_AUDIO_DEVICE AUDIO_DEVICE_HDMI
 #define DEFAULT_LOW_LATENCY false
+#define DEFAULT_LATENCY_BUDGET 0
 #define DEFAULT_DEBUG_LOG false
 #define DEFAULT_ROTATE 0
 #define DEFAULT_FLIP FLIP_NONE
+#define DEFAULT_DECODER_BUFFERS 0
+#define DEFAULT_DECODER_BUFFER_SIZE 0
+#define DEFAULT_REORDER_DEPTH -1
+#define DEFAULT_PRESENTATION_LATENCY 100
+#define DEFAULT_VIDEO_DECODER "auto"
+#define DEFAULT_VIDEO_SINK VIDEO_SINK_AUTO
+#define DEFAULT_HWACCEL "none"
+#define DEFAULT_SESSIONS 1
+#define MAX_SESSIONS 4
+#define TRACE_CAPACITY 65536
+#define DEFAULT_STALL_TIMEOUT 1000
+// A renderer stuck inside a call this many stall timeouts can't be rebuilt in place
+#define STALL_EXIT_FACTOR 5
+// The clip -vr auto decodes with every renderer: two seconds of 720p at 30 fps, a keyframe a second
+#define PROBE_WIDTH 1280
+#define PROBE_HEIGHT 720
+#define PROBE_FRAMES 60
+#define PROBE_GOP 30
+#define PROBE_TIMEOUT_MS 3000
 #define DEFAULT_HW_ADDRESS { (char) 0x48, (char) 0x5d, (char) 0x60, (char) 0x7c, (char) 0xee, (char) 0x22 }
 
-int start_server(std::vector<char> hw_addr, std::string name, bool debug_log,
+int start_server(std::vector<char> hw_addr, std::string name, bool debug_log, unsigned int latency_budget,
+                 const char *keyfile, const char *record_dir, const char *mp4_dir,
+                 std::vector<std::string> const &restream_destinations,
+                 unsigned short thumbnail_port, int thumbnail_width, std::vector<std::string> const &audio_sinks,
                  video_renderer_config_t const *video_config, audio_renderer_config_t const *audio_config);
 
 int stop_server();
 
-typedef video_renderer_t *(*video_init_func_t)(logger_t *logger, video_renderer_config_t const *config);
-typedef audio_renderer_t *(*audio_init_func_t)(logger_t *logger, video_renderer_t *video_renderer, audio_renderer_config_t const *config);
-
-typedef struct video_renderer_list_entry_s {
-    const char *name;
-    const char *description;
-    video_init_func_t init_func;
-} video_renderer_list_entry_t;
-
-typedef struct audio_renderer_list_entry_s {
-    const char *name;
-    const char *description;
-    audio_init_func_t init_func;
-} audio_renderer_list_entry_t;
-
-static bool running = false;
 static dnssd_t *dnssd = NULL;
 static raop_t *raop = NULL;
 static video_init_func_t video_init_func = NULL;
 static audio_init_func_t audio_init_func = NULL;
-static video_renderer_t *video_renderer = NULL;
-static audio_renderer_t *audio_renderer = NULL;
-static logger_t *render_logger = NULL;
+// -vr auto and -ar auto, the renderer is picked when the renderers are first started
+static bool auto_video_renderer = false;
+static bool auto_audio_renderer = false;
 
-static const video_renderer_list_entry_t video_renderers[] = {
-#if defined(HAS_RPI_RENDERER)
-    {"rpi", "Raspberry Pi OpenMAX accelerated H.264 renderer", video_renderer_rpi_init},
-#endif
-#if defined(HAS_GSTREAMER_RENDERER)
-    {"gstreamer", "GStreamer H.264 renderer", video_renderer_gstreamer_init},
-#endif
-#if defined(HAS_DUMMY_RENDERER)
-    {"dummy", "Dummy renderer; does not actually display video", video_renderer_dummy_init},
-#endif
+typedef struct tile_s tile_t;
+
+// One sender's connection
+typedef struct session_s {
+    tile_t *tile;
+    // Order of connecting, a later sender takes a tile over from an earlier one
+    uint64_t serial;
+    // The sender's latest parameter sets, handed to the decoder ahead of its first IDR, and their codec
+    std::vector<unsigned char> codec;
+    video_codec_t video_codec;
+    int codec_nal_count;
+    h264_nal_unit_t codec_nal_units[H264_MAX_NAL_UNITS];
+    // Last volume the sender asked for, applied once it has the audio
+    float volume;
+    bool has_volume;
+    // What the sender's audio packets hold, from its SETUP
+    raop_audio_format_t audio_format;
+    // The renderer takes the parts of the frame that is coming in parts, and how late its first part came in
+    bool part_owned;
+    int64_t part_arrival_offset;
+} session_t;
+
+// Renderers shown in one tile of the screen, one tile unless -mv is given. The first one has the audio.
+struct tile_s {
+    video_renderer_config_t video_config;
+    video_renderer_t *video_renderer;
+    audio_renderer_t *audio_renderer;
+    // Sessions the renderers take frames from, each guarded by its mutex, which is held while rendering
+    std::mutex video_mutex;
+    session_t *video_owner;
+    video_codec_t video_codec;
+    // Set when the renderer was reconfigured, the owner's parameter sets go in again ahead of its next frame
+    bool resend_codec;
+    std::mutex audio_mutex;
+    session_t *audio_owner;
+    // Keeps the tile's video in sync with its audio, NULL for tiles without audio
+    av_sync_t *av_sync;
+    // Delay the audio renderer was last set to, under audio_mutex
+    int64_t audio_delay;
+    // Time from pts until the latest frame the video renderer reported on screen, see video_frame_presented
+    std::atomic<int64_t> presented_offset;
+    std::atomic<bool> has_presented_offset;
+    // Sessions shown in the tile or waiting to take it over, only touched on the httpd thread
+    int session_count;
+    // For the stall watchdog: since when the video renderer refuses every frame, 0 while it takes them,
+    // under video_mutex, and since when the call handing it the current frame runs, 0 between calls
+    int64_t video_failing_since;
+    std::atomic<int64_t> video_call_started;
+    unsigned int video_rebuilds;
 };
 
-static const audio_renderer_list_entry_t audio_renderers[] = {
-#if defined(HAS_RPI_RENDERER)
-    {"rpi", "AAC renderer using fdk-aac for decoding and OpenMAX for rendering", audio_renderer_rpi_init},
+static tile_t tiles[MAX_SESSIONS];
+static int tile_count = 0;
+static uint64_t session_serial = 0;
+#if defined(HAS_AAC_DECODER)
+// Decode for the renderers that take PCM, only touched with the first tile's audio_mutex held once created
+static aac_decoder_t *audio_decoder = NULL;
+static alac_decoder_t *alac_decoder = NULL;
+// Holds the decoded PCM for a renderer that pulls it, pushed to from the audio thread
+static pcm_scheduler_t *audio_scheduler = NULL;
 #endif
-#if defined(HAS_GSTREAMER_RENDERER)
-    {"gstreamer", "GStreamer audio renderer", audio_renderer_gstreamer_init},
+// --soft-volume, or an output without a mixer: the volume scales the decoded PCM of the first tile
+static bool force_software_volume = false;
+static bool software_volume = false;
+static pcm_gain_t audio_gain;
+// --buffered-audio: let senders push music ahead, offered where the audio is decoded here
+static bool buffered_audio = false;
+#if defined(HAS_THUMBNAILER)
+static thumbnailer_t *thumbnailer = NULL;
 #endif
-#if defined(HAS_ALSA_RENDERER)
-    {"alsa", "Alsa renderer", audio_renderer_alsa_init},
+#if defined(HAS_V4L2_OUTPUT)
+static v4l2_output_t *v4l2_output = NULL;
 #endif
-#if defined(HAS_DUMMY_RENDERER)
-    {"dummy", "Dummy renderer; does not actually play audio", audio_renderer_dummy_init},
+// --now-playing: cover art of the first tile's audio over the video, track names in the log
+static bool show_now_playing = false;
+#if defined(HAS_NOW_PLAYING)
+// Created by the renderer thread before the renderers count as ready, no session gets to it before that
+static now_playing_t *now_playing = NULL;
 #endif
-};
-
-static void signal_handler(int sig) {
-    switch (sig) {
-        case SIGINT:
-        case SIGTERM:
-            running = 0;
-            break;
-    }
-}
-
-static void init_signals(void) {
-    struct sigaction sigact;
+// --video-url: play the video URLs senders hand over on the airplay port, rather than have them mirror
+static bool video_url = false;
+// --audio-only: no video renderer, senders are offered audio alone. Always on in builds without video renderers
+#if defined(AUDIO_ONLY)
+static bool audio_only = true;
+#else
+static bool audio_only = false;
+#endif
+#if defined(HAS_GSTREAMER_RENDERER)
+static video_player_t *video_player = NULL;
+#endif
+// Devices of the further --audio-sink renderers, which keep pointers to their configs
+static audio_renderer_config_t audio_sink_configs[AUDIO_RENDERER_MAX_SINKS - 1];
+static std::string audio_sink_devices[AUDIO_RENDERER_MAX_SINKS - 1];
+// Display mode advertised to senders instead of the renderer's, 0 where -dm leaves it to the renderer
+static int display_width = 0;
+static int display_height = 0;
+static int display_fps = 0;
+// Connections to the server, the thumbnail goes when the last one does
+static int open_connections = 0;
+static logger_t *render_logger = NULL;
+// Renderers are created on a thread of their own while the server is already advertised,
+// sessions wait for them in session_init. With --idle they are suspended on SIGALRM once
+// the last session has been gone for idle_timeout seconds, and resumed by the next one.
+enum renderer_state_t { RENDERERS_PENDING, RENDERERS_READY, RENDERERS_SUSPENDED, RENDERERS_FAILED };
+static std::thread renderer_thread;
+static std::mutex renderer_mutex;
+static std::condition_variable renderer_cond;
+static renderer_state_t renderer_state = RENDERERS_PENDING;
+static int renderer_users = 0;
+static unsigned int idle_timeout = 0;
+// --stall-timeout ms a video renderer may refuse frames before the watchdog rebuilds it, 0 disables it
+static unsigned int stall_timeout = DEFAULT_STALL_TIMEOUT;
+static std::thread watchdog_thread;
+static std::mutex watchdog_mutex;
+static std::condition_variable watchdog_cond;
+static bool watchdog_running = false;
+// --metrics port, 0 serves no metrics
+static unsigned short metrics_port = 0;
+// --session-log file, nullptr writes no session summaries
+static const char *session_log = nullptr;
+// --memory session_mb[:total_mb] and --max-sessions, 0 leaves them unlimited
+static unsigned int session_memory_mb = 0;
+static unsigned int total_memory_mb = 0;
+static unsigned int max_sessions = 0;
+// --decrypt-threads count, -1 takes the cores besides the decrypt stage's own, up to 3
+static int decrypt_threads = -1;
+// --cpu-limit percent of all cores busy that counts as overloaded, 0 stops watching
+static unsigned int cpu_limit = 90;
+// --thermal-limit degrees Celsius of the SoC to stay below, 0 stops watching
+static unsigned int thermal_limit = 80;
+// --reconnect-grace seconds a sender that went away may take to come back and keep its clock estimate
+static unsigned int reconnect_grace = 10;
+// --lock-memory faults in and locks the mirror buffers and the real-time threads' stacks
+static bool lock_memory = false;
+// --coalesce-static leaves out mirrored frames that only repeat the picture before them
+static bool coalesce_static = false;
+// --thin-tiles thins the video of every tile but the first, the one that is heard
+static bool thin_tiles = false;
+// --schedule-decode hands the senders' frames to the renderers earliest deadline first
+static bool schedule_decode = false;
+// --progressive hands large mirrored frames to the decoder NAL by NAL as they arrive
+static bool progressive = false;
+// --reactor receives each session's timing, audio and UDP video on one epoll thread
+static bool session_reactor = false;
+// --mirror-udp takes mirror video over UDP from senders asking for the fragment framing
+static bool mirror_udp = false;
+// --ptp offers senders to sync to their PTP clock instead of their NTP server
+static bool ptp = false;
+// --shm-output name of the shared memory object the mirrored access units are published in
+static const char *shm_output_name = nullptr;
+// --v4l2-output device[:fps|:h264] the mirrored screen is written to as a camera
+static const char *v4l2_output_device = nullptr;
+static int v4l2_output_fps = 0;
+static bool v4l2_output_h264 = false;
+// --config file with the settings SIGHUP reloads, read on top of the command line's
+static const char *config_file = nullptr;
+static video_renderer_config_t base_video_config;
+static unsigned int base_latency_budget;
 
-    sigact.sa_handler = signal_handler;
-    sigemptyset(&sigact.sa_mask);
-    sigact.sa_flags = 0;
-    sigaction(SIGINT, &sigact, NULL);
-    sigaction(SIGTERM, &sigact, NULL);
+// The signals main waits for. Blocked before any thread starts, so every thread inherits the mask
+// and they are only ever taken by sigwaitinfo.
+static void init_signals(sigset_t *signals) {
+    sigemptyset(signals);
+    sigaddset(signals, SIGINT);
+    sigaddset(signals, SIGTERM);
+    sigaddset(signals, SIGUSR1);
+    sigaddset(signals, SIGHUP);
+    sigaddset(signals, SIGALRM);
+    pthread_sigmask(SIG_BLOCK, signals, NULL);
 }
 
 static int parse_hw_addr(std::string str, std::vector<char> &hw_addr) {
@@ -139,62 +309,652 @@ std::string find_mac() {
     return mac_address;
 }
 
-static video_init_func_t find_video_init_func(const char *name) {
-    for (int i = 0; i < sizeof(video_renderers)/sizeof(video_renderers[0]); i++) {
-        if (!strcmp(name, video_renderers[i].name)) {
-            return video_renderers[i].init_func;
+// Splits an ALSA device[@ms] argument into the device and its output delay
+static std::string parse_audio_sink(std::string sink, int *output_delay) {
+    size_t separator = sink.rfind('@');
+    *output_delay = separator != std::string::npos ? atoi(sink.c_str() + separator + 1) : 0;
+    return sink.substr(0, separator);
+}
+
+static flip_mode_t parse_flip(std::string flip_type) {
+    return flip_type == "horiz" ? FLIP_HORIZONTAL :
+           flip_type == "vert" ? FLIP_VERTICAL :
+           flip_type == "both" ? FLIP_BOTH :
+           FLIP_NONE;
+}
+
+// Reads the options SIGHUP reloads, -r, -f, -l and -L, one per line as on the command line.
+// # starts a comment. Returns false if the file can't be opened.
+static bool read_config_file(const char *file, video_renderer_config_t *video_config, unsigned int *latency_budget) {
+    std::ifstream stream(file);
+    if (!stream) return false;
+
+    std::string line;
+    while (std::getline(stream, line)) {
+        std::istringstream words(line.substr(0, line.find('#')));
+        std::string option, value;
+        if (!(words >> option)) continue;
+        if (option == "-l") {
+            video_config->low_latency = !video_config->low_latency;
+            continue;
+        }
+        if (option != "-r" && option != "-f" && option != "-L") {
+            LOGW("%s: %s can only be given on the command line, ignoring it", file, option.c_str());
+            continue;
+        }
+        if (!(words >> value)) {
+            LOGW("%s: %s needs a value", file, option.c_str());
+            continue;
+        }
+        if (option == "-r") {
+            video_config->rotation = atoi(value.c_str());
+        } else if (option == "-f") {
+            video_config->flip = parse_flip(value);
+        } else {
+            *latency_budget = atoi(value.c_str());
         }
     }
-    return NULL;
+    return true;
+}
+
+// Where -vr auto and -ar auto keep their pick, empty without a home directory
+static std::string renderer_cache_path() {
+    const char *cache = getenv("XDG_CACHE_HOME");
+    if (cache && *cache) return std::string(cache) + "/rpiplay/renderers";
+    const char *home = getenv("HOME");
+    if (home && *home) return std::string(home) + "/.cache/rpiplay/renderers";
+    return "";
+}
+
+// A pick only holds for the renderers of this build on the same kernel and board
+static std::string renderer_cache_key() {
+    std::string key = VERSION;
+    for (size_t i = 0; i < video_renderer_count; i++) key += std::string(" ") + video_renderers[i].name;
+    key += " /";
+    for (size_t i = 0; i < audio_renderer_count; i++) key += std::string(" ") + audio_renderers[i].name;
+    struct utsname uts;
+    if (uname(&uts) == 0) key += std::string(" ") + uts.release + " " + uts.machine;
+    std::ifstream model_stream("/proc/device-tree/model");
+    std::string model;
+    if (std::getline(model_stream, model, '\0') && !model.empty()) key += " " + model;
+    std::replace(key.begin(), key.end(), '\n', ' ');
+    return key;
+}
+
+// Reads the cached picks into video and audio, left alone if the cache is missing or stale
+static void read_renderer_cache(const std::string &path, std::string *video, std::string *audio) {
+    std::ifstream stream(path);
+    std::string line;
+    if (!std::getline(stream, line) || line.compare(0, 4, "key ") != 0 || line.substr(4) != renderer_cache_key()) return;
+    while (std::getline(stream, line)) {
+        if (line.compare(0, 6, "video ") == 0) *video = line.substr(6);
+        if (line.compare(0, 6, "audio ") == 0) *audio = line.substr(6);
+    }
+}
+
+static void write_renderer_cache(const std::string &path, const std::string &video, const std::string &audio) {
+    // Creates the directories on the way, ~/.cache may not exist yet either
+    for (size_t separator = path.find('/', 1); separator != std::string::npos; separator = path.find('/', separator + 1)) {
+        mkdir(path.substr(0, separator).c_str(), 0755);
+    }
+    std::ofstream stream(path);
+    stream << "key " << renderer_cache_key() << "\n";
+    if (!video.empty()) stream << "video " << video << "\n";
+    if (!audio.empty()) stream << "audio " << audio << "\n";
+    if (!stream) LOGW("Could not save the renderers picked to %s", path.c_str());
+}
+
+// Microseconds until the renderer has taken the generated clip, or -1 if it can't start or play it
+static int64_t probe_video_renderer(const video_renderer_list_entry_t *entry, video_renderer_config_t const *video_config) {
+    video_renderer_config_t config = *video_config;
+    config.background_mode = BACKGROUND_MODE_OFF;
+    config.low_latency = true;
+    config.tile = 0;
+    config.tile_count = 1;
+    config.clone_count = 0;
+
+    // Built for every renderer, one may rewrite the frames it is given in place
+    h264_test_clip_t clip;
+    if (h264_test_clip_build(&clip, PROBE_WIDTH, PROBE_HEIGHT, PROBE_FRAMES, PROBE_GOP) < 0) return -1;
+    video_renderer_t *renderer = entry->init_func(render_logger, &config);
+    if (!renderer) {
+        h264_test_clip_free(&clip);
+        return -1;
+    }
+    renderer->funcs->start(renderer);
+
+    // Every frame is due right away, so paced renderers don't hold them back
+    auto t0 = std::chrono::steady_clock::now();
+    bool failed = renderer->funcs->render_buffer(renderer, NULL, clip.codec_data, clip.codec_data_len,
+                                                 raop_ntp_get_local_time(NULL), 0, NULL, 0) < 0;
+    for (int i = 0; i < clip.frame_count && !failed; i++) {
+        failed = renderer->funcs->render_buffer(renderer, NULL, clip.frames[i], clip.frame_lens[i],
+                                                raop_ntp_get_local_time(NULL), 1, NULL, 0) < 0;
+    }
+    video_renderer_stats_t stats = {};
+    while (!failed && renderer->funcs->get_stats) {
+        stats = {};
+        renderer->funcs->get_stats(renderer, &stats);
+        if (stats.queued_frames == 0) break;
+        failed = std::chrono::steady_clock::now() - t0 > std::chrono::milliseconds(PROBE_TIMEOUT_MS);
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    int64_t elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - t0).count();
+    if (stats.dropped_frames >= (uint64_t) clip.frame_count) failed = true;
+    renderer->funcs->destroy(renderer);
+    h264_test_clip_free(&clip);
+    return failed ? -1 : elapsed;
 }
 
-static audio_init_func_t find_audio_init_func(const char *name) {
-    for (int i = 0; i < sizeof(audio_renderers)/sizeof(audio_renderers[0]); i++) {
-        if (!strcmp(name, audio_renderers[i].name)) {
-            return audio_renderers[i].init_func;
+// Renderers are listed hardware first, so a later one only wins by a clear margin
+static const video_renderer_list_entry_t *probe_video_renderers(video_renderer_config_t const *video_config) {
+    const video_renderer_list_entry_t *best = NULL;
+    int64_t best_time = 0;
+    for (size_t i = 0; i < video_renderer_count; i++) {
+        const video_renderer_list_entry_t &entry = video_renderers[i];
+        // Always works and shows nothing
+        if (!strcmp(entry.name, "dummy")) continue;
+        int64_t time = probe_video_renderer(&entry, video_config);
+        if (time < 0) {
+            LOGI("Video renderer %s failed the probe", entry.name);
+            continue;
+        }
+        LOGI("Video renderer %s took the probe clip in %lld ms", entry.name, (long long) (time / 1000));
+        if (!best || time < best_time * 3 / 4) {
+            best = &entry;
+            best_time = time;
         }
     }
+    return best;
+}
+
+// The AAC-ELD and ALAC decoders are the same whichever renderer plays the PCM, so opening the output is the test
+static const audio_renderer_list_entry_t *probe_audio_renderers(audio_renderer_config_t const *audio_config) {
+    for (size_t i = 0; i < audio_renderer_count; i++) {
+        const audio_renderer_list_entry_t &entry = audio_renderers[i];
+        if (!strcmp(entry.name, "dummy")) continue;
+        audio_renderer_t *renderer = entry.init_func(render_logger, NULL, audio_config);
+        if (renderer) {
+            renderer->funcs->destroy(renderer);
+            return &entry;
+        }
+        LOGI("Audio renderer %s failed the probe", entry.name);
+    }
     return NULL;
 }
 
+// Resolves -vr auto and -ar auto, from the cache if this build and host have been probed before
+static void select_auto_renderers(video_renderer_config_t const *video_config, audio_renderer_config_t const *audio_config) {
+    std::string path = renderer_cache_path();
+    std::string video_name, audio_name;
+    if (!path.empty()) read_renderer_cache(path, &video_name, &audio_name);
+    bool probed = false;
+
+    if (auto_video_renderer && !audio_only) {
+        if ((video_init_func = find_video_init_func(video_name.c_str()))) {
+            LOGI("Using the %s video renderer picked before", video_name.c_str());
+        } else {
+            const video_renderer_list_entry_t *entry = probe_video_renderers(video_config);
+            if (!entry) {
+                LOGW("No video renderer passed the probe, using %s", video_renderers[0].name);
+                entry = &video_renderers[0];
+            } else {
+                LOGI("Picked the %s video renderer", entry->name);
+                video_name = entry->name;
+                probed = true;
+            }
+            video_init_func = entry->init_func;
+        }
+    }
+    if (auto_audio_renderer && audio_config->device != AUDIO_DEVICE_NONE) {
+        if ((audio_init_func = find_audio_init_func(audio_name.c_str()))) {
+            LOGI("Using the %s audio renderer picked before", audio_name.c_str());
+        } else {
+            const audio_renderer_list_entry_t *entry = probe_audio_renderers(audio_config);
+            if (!entry) {
+                LOGW("No audio renderer passed the probe, using %s", audio_renderers[0].name);
+                entry = &audio_renderers[0];
+            } else {
+                LOGI("Picked the %s audio renderer", entry->name);
+                audio_name = entry->name;
+                probed = true;
+            }
+            audio_init_func = entry->init_func;
+        }
+    }
+    if (probed && !path.empty()) write_renderer_cache(path, video_name, audio_name);
+}
+
 void print_info(char *name) {
     printf("RPiPlay %s: An open-source AirPlay mirroring server for Raspberry Pi\n", VERSION);
-    printf("Usage: %s [-n name] [-b (on|auto|off)] [-r (90|180|270)] [-l] [-a (hdmi|analog|off)] [-vr renderer] [-ar renderer]\n", name);
+    printf("Usage: %s [-n name] [-b (on|auto|off)] [-r (90|180|270)] [-l] [-L ms] [-a (hdmi|analog|off)] [-vr renderer] [-ar renderer]\n", name);
     printf("Options:\n");
     printf("-n name               Specify the network name of the AirPlay server\n");
     printf("-b (on|auto|off)      Show black background always, only during active connection, or never\n");
     printf("-r (90|180|270)       Specify image rotation in multiples of 90 degrees\n");
     printf("-f (horiz|vert|both)  Specify image flipping (horiz = horizontal, vert = vertical, both = both)\n");
     printf("-l                    Enable low-latency mode (disables render clock)\n");
-    printf("-a (hdmi|analog|off)  Set audio output device\n");
+    printf("-L ms                 Skip to the next keyframe when video is more than ms behind (0 = off)\n");
+    printf("-vb count[:KB]        Number and size of video decoder input buffers (rpi renderer, 0 = decoder default)\n");
+    printf("-rd depth             Frames the video decoder may hold back for reordering (default 4, 1 with -l)\n");
+    printf("-vd decoder           GStreamer video decoder element, or auto (gstreamer renderer)\n");
+    printf("-vs (auto|gl|kms|wayland) GStreamer video sink, gl, kms and wayland keep frames off the CPU (gstreamer renderer)\n");
+    printf("-hw (none|vaapi|vdpau|drm) libavcodec hwaccel to decode with (ffmpeg renderer)\n");
+    printf("-mv count             Show up to count senders at once, each in a tile of the screen (rpi, kms and ffmpeg renderers)\n");
+    printf("-dm WxH[@fps]         Display mode offered to senders, e.g. 1280x720@30 for a Pi Zero (default from the renderer)\n");
+    printf("--clone display[:rotation] Also show the video on another display, decoded once, repeatable (rpi renderer)\n");
+    printf("--downscale           Scale decoded video down to the display's size on the GPU before rendering (rpi renderer)\n");
+    printf("--match-refresh       Switch the display to a refresh rate matching the video's frame rate (rpi and kms renderers)\n");
+    printf("--thread role:policy[:prio][@cpu,...] Scheduling of the mirror, audio, ntp or httpd threads, policy other, fifo or rr, repeatable\n");
+    printf("--net key=value[,...] Socket tuning: mirror-rcvbuf and audio-rcvbuf in KB, quickack, busy-poll in us, timing-tos\n");
+    printf("--idle s              Release the decoder and audio device after s seconds without senders (0 = never)\n");
+    printf("--stall-timeout ms    Rebuild a video decoder that takes no frames for ms (default: 1000, 0 = never)\n");
+    printf("--memory MB[:total MB] Frame buffers a sender and all of them may hold, frames over it are dropped (0 = unlimited)\n");
+    printf("--max-sessions count  Refuse senders beyond count streaming at once (0 = unlimited)\n");
+    printf("--decrypt-threads n   Extra parts large video frames are decrypted in (default: spare cores, up to 3)\n");
+    printf("--cpu-limit percent   CPU load at which senders are refused and video degraded, 0 off (default: 90)\n");
+    printf("--thermal-limit C     SoC temperature to stay below by thinning video ahead of it, 0 off (default: 80)\n");
+    printf("--reconnect-grace s   Keep a lost sender's clock estimate and renderers for s seconds (default: 10)\n");
+    printf("--lock-memory         Fault in and lock the video buffers and real-time thread stacks at session start\n");
+    printf("--coalesce-static     Don't decode or show again frames that repeat the picture before them\n");
+    printf("--thin-tiles          With -mv, leave the frames nothing references out of every tile but the first\n");
+    printf("--progressive         Decode large frames slice by slice as they arrive (rpi renderer)\n");
+    printf("--schedule-decode     Hand the frames of all senders to the decoders earliest deadline first\n");
+    printf("--audio-only          Only play audio, for speakers: no video renderer, senders are not offered mirroring\n");
+    printf("--video-url           Fetch and play the videos senders hand over instead of mirroring them (needs GStreamer)\n");
+    printf("--reactor             Receive each session's timing, audio and UDP video on one thread\n");
+    printf("--mirror-udp          Take mirror video over UDP from senders that ask for rpiplay's framing\n");
+    printf("--ptp                 Sync to the senders' PTP clock where they offer it (binds ports 319 and 320)\n");
+    printf("--config file         Read -r, -f, -l and -L from file too, and again on SIGHUP\n");
+    printf("-pl ms                Delay between a frame's timestamp and its presentation (gstreamer renderers)\n");
+    printf("--soft-volume         Apply the volume to the decoded audio instead of the output's mixer\n");
+    printf("--buffered-audio      Let senders buffer music seconds ahead, waking the audio thread a few times a second\n");
+    printf("--now-playing         Show the cover art of the music being played over the video, and log the track\n");
+    printf("--audio-buffer ms[:segment_ms] Size of the audio sink's buffer and of its segments (gstreamer renderer)\n");
+    printf("-k file               Keep the pairing identity in file, created if missing\n");
+    printf("-t file               Record a packet trace, written to file on SIGUSR1 and exit\n");
+    printf("--record dir          Save every mirror and audio session to dir for replaying with rpiplay-replay\n");
+    printf("--mp4 dir             Save every session to dir as an MP4 file, without transcoding\n");
+    printf("--restream host:port  Send the mirrored H.264 on to host as RTP without decoding it, repeatable\n");
+    printf("--shm-output name     Publish the mirrored video in /dev/shm/name for other processes to read\n");
+    printf("--v4l2-output device[:fps|:h264] Write the mirrored screen to a v4l2loopback device as a camera (default 30 fps)\n");
+    printf("--thumbnail port[:width] Serve a JPEG preview of the mirrored screen over HTTP on port (default width 320)\n");
+    printf("--metrics port        Serve Prometheus metrics on port at /metrics, and as JSON at /metrics.json\n");
+    printf("--session-log file    Append a line of JSON summing up every connection to file as it closes\n");
+    printf("-a (hdmi|analog|off)  Set audio output device, or an ALSA device hw:...[@ms] delayed by ms (alsa renderer)\n");
+    printf("--audio-sink device[@ms] Also play the audio on another ALSA device, decoded once, repeatable (alsa renderer)\n");
     printf("-vr renderer          Set video renderer to use. Available renderers:\n");
-    for (int i = 0; i < sizeof(video_renderers)/sizeof(video_renderers[0]); i++) {
+    for (size_t i = 0; i < video_renderer_count; i++) {
         printf("    %s: %s%s\n", video_renderers[i].name, video_renderers[i].description, i == 0 ? " [Default]" : "");
     }
+    printf("    auto: The one that decodes a test clip fastest, probed once and remembered\n");
     printf("-ar renderer          Set audio renderer to use. Available renderers:\n");
-    for (int i = 0; i < sizeof(audio_renderers)/sizeof(audio_renderers[0]); i++) {
+    for (size_t i = 0; i < audio_renderer_count; i++) {
         printf("    %s: %s%s\n", audio_renderers[i].name, audio_renderers[i].description, i == 0 ? " [Default]" : "");
     }
+    printf("    auto: The first one whose output opens, probed once and remembered\n");
     printf("-d                    Enable debug logging\n");
     printf("-v/-h                 Displays this help and version information\n");
 }
 
+static void dump_trace(const char *filename) {
+    int count = trace_dump(filename);
+    if (count < 0) {
+        LOGE("Could not write trace to %s", filename);
+    } else {
+        LOGI("Wrote %d trace events to %s", count, filename);
+    }
+}
+
+static long long ms_since(std::chrono::steady_clock::time_point t0) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - t0).count();
+}
+
+// With renderer_mutex held. Video goes first, the rpi audio renderer takes its clock from it.
+static int resume_renderers() {
+    auto t0 = std::chrono::steady_clock::now();
+    for (int i = 0; i < tile_count; i++) {
+        video_renderer_t *video_renderer = tiles[i].video_renderer;
+        if (video_renderer && video_renderer->funcs->resume && video_renderer->funcs->resume(video_renderer) < 0) {
+            LOGE("Could not resume the video renderer");
+            return -1;
+        }
+    }
+    for (int i = 0; i < tile_count; i++) {
+        audio_renderer_t *audio_renderer = tiles[i].audio_renderer;
+        if (audio_renderer && audio_renderer->funcs->resume && audio_renderer->funcs->resume(audio_renderer) < 0) {
+            LOGE("Could not resume the audio renderer");
+            return -1;
+        }
+    }
+    renderer_state = RENDERERS_READY;
+    LOGI("Resumed the renderers in %lld ms", ms_since(t0));
+    return 0;
+}
+
+static int64_t steady_ms() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// With renderer_mutex and the tile's mutexes held: takes the tile's renderers down and up again the way
+// --idle does, the audio renderer may take its clock from the video renderer. The sessions, their RTSP
+// connections and NTP sync go on, and the picture comes back with the sender's next IDR.
+static int rebuild_tile_renderers(tile_t *tile) {
+    video_renderer_t *video_renderer = tile->video_renderer;
+    audio_renderer_t *audio_renderer = tile->audio_renderer;
+    bool with_audio = audio_renderer && audio_renderer->funcs->suspend && audio_renderer->funcs->resume;
+
+    if (with_audio) audio_renderer->funcs->suspend(audio_renderer);
+    video_renderer->funcs->suspend(video_renderer);
+    if (video_renderer->funcs->resume(video_renderer) < 0) return -1;
+    if (with_audio && audio_renderer->funcs->resume(audio_renderer) < 0) return -1;
+    tile->resend_codec = true;
+    tile->has_presented_offset = false;
+    if (tile->av_sync) av_sync_flush(tile->av_sync);
+    return 0;
+}
+
+// Returns false once rpiplay is on its way out
+static bool watchdog_check(tile_t *tile) {
+    int tile_number = (int) (tile - tiles) + 1;
+    int64_t now = steady_ms();
+    int64_t call_started = tile->video_call_started.load(std::memory_order_relaxed);
+    if (call_started && now - call_started >= (int64_t) stall_timeout * STALL_EXIT_FACTOR) {
+        // The stuck thread holds the tile, and a clean stop would wait for it forever
+        LOGE("The video renderer of tile %d has been stuck in a call for %lld ms, exiting to be restarted",
+             tile_number, (long long) (now - call_started));
+        _exit(1);
+    }
+
+    std::lock_guard<std::mutex> lock(renderer_mutex);
+    if (renderer_state != RENDERERS_READY) return true;
+    // Held by a call in progress, which is looked at again next time
+    std::unique_lock<std::mutex> video_lock(tile->video_mutex, std::try_to_lock);
+    if (!video_lock.owns_lock()) return true;
+    if (!tile->video_failing_since || now - tile->video_failing_since < (int64_t) stall_timeout) return true;
+
+    video_renderer_t *video_renderer = tile->video_renderer;
+    int64_t stalled = now - tile->video_failing_since;
+    tile->video_failing_since = 0;
+    if (!video_renderer->funcs->suspend || !video_renderer->funcs->resume) {
+        LOGW("The video renderer of tile %d took no frames for %lld ms and can't be rebuilt", tile_number, (long long) stalled);
+        return true;
+    }
+    std::lock_guard<std::mutex> audio_lock(tile->audio_mutex);
+    auto t0 = std::chrono::steady_clock::now();
+    if (rebuild_tile_renderers(tile) < 0) {
+        LOGE("Could not rebuild the renderers of tile %d", tile_number);
+        renderer_state = RENDERERS_FAILED;
+        kill(getpid(), SIGTERM);
+        return false;
+    }
+    tile->video_rebuilds++;
+    LOGW("The video renderer of tile %d took no frames for %lld ms, rebuilt it in %lld ms (%u times)", tile_number,
+         (long long) stalled, ms_since(t0), tile->video_rebuilds);
+    return true;
+}
+
+static void watchdog_thread_func() {
+    thread_attr_apply(render_logger, THREAD_ROLE_NONE, "rp-watchdog");
+    auto interval = std::chrono::milliseconds(std::max(stall_timeout / 4, 50u));
+    std::unique_lock<std::mutex> lock(watchdog_mutex);
+    while (!watchdog_cond.wait_for(lock, interval, [] { return !watchdog_running; })) {
+        lock.unlock();
+        bool running = true;
+        for (int i = 0; i < tile_count && running; i++) {
+            running = watchdog_check(&tiles[i]);
+        }
+        lock.lock();
+        if (!running) break;
+    }
+}
+
+// With the tile's video_mutex held, around the calls that hand the renderer a frame
+static void video_call_begin(tile_t *tile) {
+    tile->video_call_started.store(steady_ms(), std::memory_order_relaxed);
+}
+
+static int video_call_end(tile_t *tile, int ret) {
+    tile->video_call_started.store(0, std::memory_order_relaxed);
+    if (ret == 0) {
+        tile->video_failing_since = 0;
+    } else if (!tile->video_failing_since) {
+        tile->video_failing_since = steady_ms();
+    }
+    return ret;
+}
+
+static void suspend_renderers() {
+    std::lock_guard<std::mutex> lock(renderer_mutex);
+    // A sender may have connected since the alarm went off
+    if (renderer_state != RENDERERS_READY || renderer_users > 0) return;
+
+    auto t0 = std::chrono::steady_clock::now();
+    for (int i = 0; i < tile_count; i++) {
+        audio_renderer_t *audio_renderer = tiles[i].audio_renderer;
+        if (audio_renderer && audio_renderer->funcs->suspend) audio_renderer->funcs->suspend(audio_renderer);
+    }
+    for (int i = 0; i < tile_count; i++) {
+        video_renderer_t *video_renderer = tiles[i].video_renderer;
+        if (video_renderer && video_renderer->funcs->suspend) video_renderer->funcs->suspend(video_renderer);
+    }
+    renderer_state = RENDERERS_SUSPENDED;
+    LOGI("Suspended the renderers after %u s without senders, in %lld ms", idle_timeout, ms_since(t0));
+}
+
+// Blocks until the renderer thread is done and resumes the renderers if they are suspended,
+// returns false if there are none to render to
+static bool acquire_renderers() {
+    std::unique_lock<std::mutex> lock(renderer_mutex);
+    renderer_cond.wait(lock, [] { return renderer_state != RENDERERS_PENDING; });
+    if (renderer_state == RENDERERS_SUSPENDED && resume_renderers() < 0) {
+        renderer_state = RENDERERS_FAILED;
+        kill(getpid(), SIGTERM);
+    }
+    if (renderer_state != RENDERERS_READY) return false;
+    renderer_users++;
+    alarm(0);
+    return true;
+}
+
+// A sender that only lost its network for a moment finds the decoder as it left it
+static void release_renderers() {
+    std::lock_guard<std::mutex> lock(renderer_mutex);
+    if (--renderer_users == 0 && idle_timeout) alarm(std::max(idle_timeout, reconnect_grace));
+}
+
+static bool renderers_ready() {
+    std::lock_guard<std::mutex> lock(renderer_mutex);
+    return renderer_state == RENDERERS_READY;
+}
+
+static void log_renderer_stats() {
+    if (!renderers_ready()) return;
+    for (int i = 0; i < tile_count; i++) {
+        video_renderer_t *video_renderer = tiles[i].video_renderer;
+        audio_renderer_t *audio_renderer = tiles[i].audio_renderer;
+        if (video_renderer && video_renderer->funcs->log_stats) {
+            video_renderer->funcs->log_stats(video_renderer);
+        }
+        if (audio_renderer && audio_renderer->funcs->log_stats) {
+            audio_renderer->funcs->log_stats(audio_renderer);
+        }
+        if (tiles[i].av_sync) {
+            av_sync_stats_t stats;
+            av_sync_get_stats(tiles[i].av_sync, &stats);
+            LOGI("A/V sync: video %.1f ms and audio %.1f ms after pts, video held to %.1f ms, audio delayed by %.1f ms, "
+                 "%llu adjustments", stats.video_offset / 1000.0, stats.audio_offset / 1000.0, stats.video_hold / 1000.0,
+                 stats.audio_delay / 1000.0, (unsigned long long) stats.adjustments);
+        }
+    }
+#if defined(HAS_AAC_DECODER)
+    if (audio_decoder) {
+        aac_decoder_stats_t stats;
+        aac_decoder_get_stats(audio_decoder, &stats);
+        LOGI("AAC decoder: %llu packets, %llu errors, %llu concealed, %llu us decoding", (unsigned long long) stats.packets,
+             (unsigned long long) stats.errors, (unsigned long long) stats.concealed, (unsigned long long) stats.decode_time);
+    }
+    if (alac_decoder) {
+        aac_decoder_stats_t stats;
+        alac_decoder_get_stats(alac_decoder, &stats);
+        if (stats.packets) {
+            LOGI("ALAC decoder: %llu packets, %llu errors, %llu concealed, %llu us decoding", (unsigned long long) stats.packets,
+                 (unsigned long long) stats.errors, (unsigned long long) stats.concealed, (unsigned long long) stats.decode_time);
+        }
+    }
+#endif
+}
+
+static double mib(size_t bytes) {
+    return bytes / (1024.0 * 1024.0);
+}
+
+// with_renderers while nobody else can be rendering, which is before sessions start or from the main thread
+static void log_memory_report(bool with_renderers) {
+    process_memory_t process;
+    if (process_memory_get(&process) == 0) {
+        LOGI("Memory: %.1f MiB resident, %.1f MiB at most, %.1f MiB anonymous, %.1f MiB file pages, %.1f MiB swapped",
+             mib(process.rss), mib(process.peak_rss), mib(process.anon), mib(process.file), mib(process.swap));
+    }
+    if (raop) {
+        raop_memory_stats_t stats;
+        raop_get_memory_stats(raop, &stats);
+        LOGI("Memory: frame buffers %.1f MiB, %.1f MiB at most, budget %.1f MiB, audio jitter buffers %.1f MiB, "
+             "log rings %.1f KiB", mib(stats.frame_bytes), mib(stats.frame_peak), mib(stats.frame_limit),
+             mib(stats.audio_buffer_bytes), (stats.logger_bytes + logger_get_size(render_logger)) / 1024.0);
+    }
+    for (int i = 0; with_renderers && i < tile_count; i++) {
+        video_renderer_t *video_renderer = tiles[i].video_renderer;
+        if (!video_renderer || !video_renderer->funcs->get_memory) continue;
+        video_renderer_memory_t memory = {};
+        video_renderer->funcs->get_memory(video_renderer, &memory);
+        LOGI("Memory: video renderer %d %.1f MiB on the heap, %.1f MiB of decoder and display buffers",
+             i, mib(memory.host_bytes), mib(memory.device_bytes));
+        if (i == 0 && memory.device_total) {
+            LOGI("Memory: GPU %.0f MiB, %.1f MiB free", mib(memory.device_total), mib(memory.device_free));
+        }
+    }
+#if defined(HAS_AAC_DECODER)
+    if (audio_decoder) {
+        aac_decoder_stats_t stats;
+        aac_decoder_get_stats(audio_decoder, &stats);
+        if (stats.instance_bytes) {
+            LOGI("Memory: AAC decoder instance %.1f KiB", stats.instance_bytes / 1024.0);
+        }
+    }
+#endif
+    // What the code and constant tables of each take, the decoders' ROM tables among them
+    const char *libraries[] = {program_invocation_short_name, "libavcodec", "libgst", "libopenmaxil", "libmmal",
+                               "libbcm_host", "libasound", "libplist"};
+    const int library_count = sizeof(libraries) / sizeof(libraries[0]);
+    size_t resident[library_count];
+    if (process_memory_get_libraries(libraries, resident, library_count) == 0) {
+        std::string line;
+        for (int i = 0; i < library_count; i++) {
+            if (!resident[i]) continue;
+            char entry[64];
+            snprintf(entry, sizeof(entry), "%s%s %.1f MiB", line.empty() ? "" : ", ", libraries[i], mib(resident[i]));
+            line += entry;
+        }
+        LOGI("Memory: resident code and tables %s", line.c_str());
+    }
+}
+
+static void log_thread_stats() {
+    thread_stats_t threads[THREAD_STATS_MAX_THREADS];
+    int count = thread_stats_get(threads, THREAD_STATS_MAX_THREADS);
+    for (int i = 0; i < count; i++) {
+        LOGI("Thread %s (%d): %.3f s CPU, %llu voluntary and %llu involuntary context switches, %llu bytes from frame pools",
+             threads[i].name, threads[i].tid, threads[i].cpu_time / 1000000.0,
+             (unsigned long long) threads[i].voluntary_switches, (unsigned long long) threads[i].involuntary_switches,
+             (unsigned long long) threads[i].pool_bytes);
+    }
+}
+
+// Applies the settings of the config file to the running renderers, sessions keep going
+static void reload_settings() {
+    video_renderer_config_t video_config = base_video_config;
+    unsigned int latency_budget = base_latency_budget;
+
+    if (!config_file) {
+        LOGI("No --config file, nothing to reload");
+        return;
+    }
+    if (!renderers_ready()) {
+        LOGW("The renderers are starting or suspended, not reloading");
+        return;
+    }
+    if (!read_config_file(config_file, &video_config, &latency_budget)) {
+        LOGE("Could not read %s, keeping the current settings", config_file);
+        return;
+    }
+    raop_set_video_latency_budget(raop, latency_budget);
+
+    for (int i = 0; i < tile_count; i++) {
+        tile_t *tile = &tiles[i];
+        if (!tile->video_renderer) continue;
+        if (!tile->video_renderer->funcs->reconfigure) {
+            LOGW("The video renderer can't change its settings while running, restart rpiplay for them");
+            break;
+        }
+        // The renderer keeps a pointer to the tile's config, which stays as it was created with
+        video_renderer_config_t tile_config = tile->video_config;
+        tile_config.rotation = video_config.rotation;
+        tile_config.flip = video_config.flip;
+        tile_config.low_latency = video_config.low_latency;
+
+        std::lock_guard<std::mutex> lock(tile->video_mutex);
+        tile->video_renderer->funcs->reconfigure(tile->video_renderer, &tile_config);
+        tile->resend_codec = true;
+    }
+    LOGI("Reloaded %s: rotation %d, flip %d, low latency %s, latency budget %u ms", config_file,
+         video_config.rotation, (int) video_config.flip, video_config.low_latency ? "on" : "off", latency_budget);
+}
+
 int main(int argc, char *argv[]) {
-    init_signals();
+    sigset_t signals;
+    init_signals(&signals);
     
     std::string server_name = DEFAULT_NAME;
     std::vector<char> server_hw_addr = DEFAULT_HW_ADDRESS;
     bool debug_log = DEFAULT_DEBUG_LOG;
+    unsigned int latency_budget = DEFAULT_LATENCY_BUDGET;
+    const char *keyfile = nullptr;
+    const char *trace_file = nullptr;
+    const char *record_dir = nullptr;
+    const char *mp4_dir = nullptr;
+    std::vector<std::string> restream_destinations;
+    std::vector<std::string> audio_sinks;
+    std::string alsa_device;
+    unsigned short thumbnail_port = 0;
+    int thumbnail_width = 0;
 
     video_renderer_config_t video_config;
     video_config.background_mode = DEFAULT_BACKGROUND_MODE;
     video_config.low_latency = DEFAULT_LOW_LATENCY;
     video_config.rotation = DEFAULT_ROTATE;
     video_config.flip = DEFAULT_FLIP;
+    video_config.decoder_buffers = DEFAULT_DECODER_BUFFERS;
+    video_config.decoder_buffer_size = DEFAULT_DECODER_BUFFER_SIZE;
+    video_config.reorder_depth = DEFAULT_REORDER_DEPTH;
+    video_config.presentation_latency = DEFAULT_PRESENTATION_LATENCY;
+    video_config.decoder = DEFAULT_VIDEO_DECODER;
+    video_config.sink = DEFAULT_VIDEO_SINK;
+    video_config.hwaccel = DEFAULT_HWACCEL;
+    video_config.tile = 0;
+    video_config.tile_count = DEFAULT_SESSIONS;
+    video_config.clone_count = 0;
+    video_config.downscale = false;
+    video_config.match_refresh = false;
     
     audio_renderer_config_t audio_config;
     audio_config.device = DEFAULT_AUDIO_DEVICE;
+    audio_config.alsaString = nullptr;
+    audio_config.output_delay = 0;
     audio_config.low_latency = DEFAULT_LOW_LATENCY;
+    audio_config.presentation_latency = DEFAULT_PRESENTATION_LATENCY;
+    audio_config.sink_buffer_time = 0;
+    audio_config.sink_latency_time = 0;
     
     // Default to the best available renderer
     video_init_func = video_renderers[0].init_func;
@@ -226,21 +986,200 @@ int main(int argc, char *argv[]) {
                                       AUDIO_DEVICE_NONE;
                 audio_config.alsaString = nullptr;
             } else {
-                audio_config.alsaString = argv[i];
+                alsa_device = parse_audio_sink(audio_device_name, &audio_config.output_delay);
+                audio_config.alsaString = alsa_device.c_str();
             }
 
         } else if (arg == "-l") {
             video_config.low_latency = !video_config.low_latency;
             audio_config.low_latency = !audio_config.low_latency;
+        } else if (arg == "-L") {
+            if (i == argc - 1) continue;
+            latency_budget = atoi(argv[++i]);
+        } else if (arg == "-vb") {
+            if (i == argc - 1) continue;
+            std::string buffers(argv[++i]);
+            size_t separator = buffers.find(':');
+            video_config.decoder_buffers = atoi(buffers.substr(0, separator).c_str());
+            if (separator != std::string::npos) {
+                video_config.decoder_buffer_size = atoi(buffers.substr(separator + 1).c_str()) * 1024;
+            }
+        } else if (arg == "-rd") {
+            if (i == argc - 1) continue;
+            video_config.reorder_depth = atoi(argv[++i]);
+        } else if (arg == "-vd") {
+            if (i == argc - 1) continue;
+            video_config.decoder = argv[++i];
+        } else if (arg == "-vs") {
+            if (i == argc - 1) continue;
+            std::string sink(argv[++i]);
+            video_config.sink = sink == "gl" ? VIDEO_SINK_GL :
+                                sink == "kms" ? VIDEO_SINK_KMS :
+                                sink == "wayland" ? VIDEO_SINK_WAYLAND :
+                                VIDEO_SINK_AUTO;
+        } else if (arg == "-hw") {
+            if (i == argc - 1) continue;
+            video_config.hwaccel = argv[++i];
+        } else if (arg == "-mv") {
+            if (i == argc - 1) continue;
+            video_config.tile_count = atoi(argv[++i]);
+            if (video_config.tile_count < 1 || video_config.tile_count > MAX_SESSIONS) {
+                fprintf(stderr, "Error: -mv takes 1 to %d senders.\n", MAX_SESSIONS);
+                exit(1);
+            }
+        } else if (arg == "-dm") {
+            if (i == argc - 1) continue;
+            int fields = sscanf(argv[++i], "%dx%d@%d", &display_width, &display_height, &display_fps);
+            if (fields < 2 || display_width <= 0 || display_height <= 0 || (fields == 3 && display_fps <= 0)) {
+                fprintf(stderr, "Error: -dm takes WxH or WxH@fps, e.g. 1280x720@30.\n");
+                exit(1);
+            }
+        } else if (arg == "--clone") {
+            if (i == argc - 1) continue;
+            if (video_config.clone_count == VIDEO_RENDERER_MAX_CLONES) {
+                fprintf(stderr, "Error: At most %d --clone displays.\n", VIDEO_RENDERER_MAX_CLONES);
+                exit(1);
+            }
+            std::string clone(argv[++i]);
+            size_t separator = clone.find(':');
+            video_renderer_clone_t *display = &video_config.clones[video_config.clone_count++];
+            display->display = atoi(clone.c_str());
+            display->rotation = separator != std::string::npos ? atoi(clone.c_str() + separator + 1) : 0;
+        } else if (arg == "--downscale") {
+            video_config.downscale = true;
+        } else if (arg == "--match-refresh") {
+            video_config.match_refresh = true;
+        } else if (arg == "--thread") {
+            if (i == argc - 1) continue;
+            if (thread_attr_parse(argv[++i]) < 0) {
+                fprintf(stderr, "Error: --thread takes role:policy[:priority][@cpu,...], e.g. audio:fifo:60@3.\n");
+                exit(1);
+            }
+        } else if (arg == "--net") {
+            if (i == argc - 1) continue;
+            if (netutils_tuning_parse(argv[++i]) < 0) {
+                fprintf(stderr, "Error: --net takes key=value[,key=value...], e.g. mirror-rcvbuf=4096,busy-poll=50.\n");
+                exit(1);
+            }
+        } else if (arg == "--idle") {
+            if (i == argc - 1) continue;
+            idle_timeout = atoi(argv[++i]);
+        } else if (arg == "--stall-timeout") {
+            if (i == argc - 1) continue;
+            stall_timeout = atoi(argv[++i]);
+        } else if (arg == "--config") {
+            if (i == argc - 1) continue;
+            config_file = argv[++i];
+        } else if (arg == "-pl") {
+            if (i == argc - 1) continue;
+            video_config.presentation_latency = atoi(argv[++i]);
+            audio_config.presentation_latency = video_config.presentation_latency;
+        } else if (arg == "--soft-volume") {
+            force_software_volume = true;
+        } else if (arg == "--buffered-audio") {
+            buffered_audio = true;
+        } else if (arg == "--now-playing") {
+            show_now_playing = true;
+        } else if (arg == "--audio-buffer") {
+            if (i == argc - 1) continue;
+            std::string buffer(argv[++i]);
+            size_t separator = buffer.find(':');
+            audio_config.sink_buffer_time = atoi(buffer.c_str());
+            audio_config.sink_latency_time = separator != std::string::npos ? atoi(buffer.c_str() + separator + 1) : 0;
+        } else if (arg == "-k") {
+            if (i == argc - 1) continue;
+            keyfile = argv[++i];
+        } else if (arg == "-t") {
+            if (i == argc - 1) continue;
+            trace_file = argv[++i];
+        } else if (arg == "--record") {
+            if (i == argc - 1) continue;
+            record_dir = argv[++i];
+        } else if (arg == "--mp4") {
+            if (i == argc - 1) continue;
+            mp4_dir = argv[++i];
+        } else if (arg == "--restream") {
+            if (i == argc - 1) continue;
+            restream_destinations.push_back(argv[++i]);
+        } else if (arg == "--audio-sink") {
+            if (i == argc - 1) continue;
+            if (audio_sinks.size() == AUDIO_RENDERER_MAX_SINKS - 1) {
+                fprintf(stderr, "Error: At most %d --audio-sink devices.\n", AUDIO_RENDERER_MAX_SINKS - 1);
+                exit(1);
+            }
+            audio_sinks.push_back(argv[++i]);
+        } else if (arg == "--metrics") {
+            if (i == argc - 1) continue;
+            metrics_port = atoi(argv[++i]);
+        } else if (arg == "--session-log") {
+            if (i == argc - 1) continue;
+            session_log = argv[++i];
+        } else if (arg == "--memory") {
+            if (i == argc - 1) continue;
+            std::string memory(argv[++i]);
+            size_t separator = memory.find(':');
+            session_memory_mb = atoi(memory.c_str());
+            total_memory_mb = separator != std::string::npos ? atoi(memory.c_str() + separator + 1) : 0;
+        } else if (arg == "--max-sessions") {
+            if (i == argc - 1) continue;
+            max_sessions = atoi(argv[++i]);
+        } else if (arg == "--decrypt-threads") {
+            if (i == argc - 1) continue;
+            decrypt_threads = atoi(argv[++i]);
+        } else if (arg == "--cpu-limit") {
+            if (i == argc - 1) continue;
+            cpu_limit = atoi(argv[++i]);
+        } else if (arg == "--thermal-limit") {
+            if (i == argc - 1) continue;
+            thermal_limit = atoi(argv[++i]);
+        } else if (arg == "--reconnect-grace") {
+            if (i == argc - 1) continue;
+            reconnect_grace = atoi(argv[++i]);
+        } else if (arg == "--lock-memory") {
+            lock_memory = true;
+        } else if (arg == "--coalesce-static") {
+            coalesce_static = true;
+        } else if (arg == "--thin-tiles") {
+            thin_tiles = true;
+        } else if (arg == "--progressive") {
+            progressive = true;
+        } else if (arg == "--schedule-decode") {
+            schedule_decode = true;
+        } else if (arg == "--audio-only") {
+            audio_only = true;
+        } else if (arg == "--video-url") {
+            video_url = true;
+        } else if (arg == "--reactor") {
+            session_reactor = true;
+        } else if (arg == "--mirror-udp") {
+            mirror_udp = true;
+        } else if (arg == "--ptp") {
+            ptp = true;
+        } else if (arg == "--shm-output") {
+            if (i == argc - 1) continue;
+            shm_output_name = argv[++i];
+        } else if (arg == "--v4l2-output") {
+            if (i == argc - 1) continue;
+            char *separator = strchr(argv[++i], ':');
+            if (separator) {
+                *separator = '\0';
+                v4l2_output_h264 = strcmp(separator + 1, "h264") == 0;
+                if (!v4l2_output_h264) v4l2_output_fps = atoi(separator + 1);
+            }
+            v4l2_output_device = argv[i];
+        } else if (arg == "--thumbnail") {
+            if (i == argc - 1) continue;
+            std::string thumbnail(argv[++i]);
+            size_t separator = thumbnail.find(':');
+            thumbnail_port = atoi(thumbnail.c_str());
+            if (separator != std::string::npos) {
+                thumbnail_width = atoi(thumbnail.c_str() + separator + 1);
+            }
         } else if (arg == "-r") {
             video_config.rotation = atoi(argv[++i]);
         } else if (arg == "-f") {
             if (i == argc - 1) continue;
-            std::string flip_type(argv[++i]);
-            video_config.flip = flip_type == "horiz" ? FLIP_HORIZONTAL :
-                                flip_type == "vert" ? FLIP_VERTICAL :
-                                flip_type == "both" ? FLIP_BOTH :
-                                FLIP_NONE;
+            video_config.flip = parse_flip(argv[++i]);
         } else if (arg == "-d") {
             debug_log = !debug_log;
         } else if (arg == "-vr") {
@@ -248,8 +1187,9 @@ int main(int argc, char *argv[]) {
                 fprintf(stderr, "Error: You must supply the name of a video renderer after the -vr argument.\n");
                 exit(1);
             }
-            video_init_func = find_video_init_func(argv[++i]);
-            if (!video_init_func) {
+            auto_video_renderer = !strcmp(argv[++i], "auto");
+            video_init_func = find_video_init_func(argv[i]);
+            if (!video_init_func && !auto_video_renderer) {
                 fprintf(stderr, "Error: Unable to locate video renderer \"%s\".\n", argv[i]);
                 exit(1);
             }
@@ -258,8 +1198,9 @@ int main(int argc, char *argv[]) {
                 fprintf(stderr, "Error: You must supply the name of an audio renderer after the -ar argument.\n");
                 exit(1);
             }
-            audio_init_func = find_audio_init_func(argv[++i]);
-            if (!audio_init_func) {
+            auto_audio_renderer = !strcmp(argv[++i], "auto");
+            audio_init_func = find_audio_init_func(argv[i]);
+            if (!audio_init_func && !auto_audio_renderer) {
                 fprintf(stderr, "Error: Unable to locate audio renderer \"%s\".\n", argv[i]);
                 exit(1);
             }
@@ -269,95 +1210,845 @@ int main(int argc, char *argv[]) {
         }
     }
 
+    if (config_file) {
+        base_video_config = video_config;
+        base_latency_budget = latency_budget;
+        if (!read_config_file(config_file, &video_config, &latency_budget)) {
+            fprintf(stderr, "Error: Unable to read the config file \"%s\".\n", config_file);
+            exit(1);
+        }
+    }
+
     std::string mac_address = find_mac();
     if (!mac_address.empty()) {
         server_hw_addr.clear();
         parse_hw_addr(mac_address, server_hw_addr);
     }
 
-    if (start_server(server_hw_addr, server_name, debug_log, &video_config, &audio_config) != 0) {
+    if (trace_file && trace_init(TRACE_CAPACITY) < 0) {
+        LOGE("Could not allocate the trace buffer");
+        trace_file = nullptr;
+    }
+
+    if (start_server(server_hw_addr, server_name, debug_log, latency_budget, keyfile, record_dir,
+                     mp4_dir, restream_destinations, thumbnail_port, thumbnail_width, audio_sinks,
+                     &video_config, &audio_config) != 0) {
         return 1;
     }
 
-    running = true;
-    while (running) {
-        sleep(1);
+    for (bool running = true; running; ) {
+        siginfo_t info;
+        if (sigwaitinfo(&signals, &info) < 0) {
+            if (errno != EINTR) LOGE("Waiting for signals failed: %s", strerror(errno));
+            continue;
+        }
+        switch (info.si_signo) {
+            case SIGINT:
+            case SIGTERM:
+                running = false;
+                break;
+            case SIGUSR1:
+                if (trace_file) {
+                    dump_trace(trace_file);
+                }
+                log_renderer_stats();
+                log_thread_stats();
+                log_memory_report(renderers_ready());
+                break;
+            case SIGHUP:
+                reload_settings();
+                break;
+            case SIGALRM:
+                suspend_renderers();
+                break;
+        }
     }
 
     LOGI("Stopping...");
     stop_server();
+    if (trace_file) {
+        dump_trace(trace_file);
+        trace_destroy();
+    }
+    return renderer_state == RENDERERS_FAILED ? 1 : 0;
 }
 
 // Server callbacks
+// The first session's renderer draws the background for all of them
 extern "C" void conn_init(void *cls) {
+    video_renderer_t *video_renderer = tiles[0].video_renderer;
+    __atomic_add_fetch(&open_connections, 1, __ATOMIC_RELAXED);
     if (video_renderer) video_renderer->funcs->update_background(video_renderer, 1);
 }
 
 extern "C" void conn_destroy(void *cls) {
+    video_renderer_t *video_renderer = tiles[0].video_renderer;
+    int remaining = __atomic_sub_fetch(&open_connections, 1, __ATOMIC_RELAXED);
     if (video_renderer) video_renderer->funcs->update_background(video_renderer, -1);
+#if defined(HAS_THUMBNAILER)
+    if (thumbnailer && remaining == 0) thumbnailer_clear(thumbnailer);
+#else
+    (void) remaining;
+#endif
+}
+
+// Called on the httpd thread only. A new sender gets the first free tile, or takes over the one whose
+// sender has been shown longest, without the renderers being torn down.
+extern "C" void *session_init(void *cls) {
+    // Keeps the connection's requests, SETUP included, from being handled before there is anything to render to
+    if (!acquire_renderers()) return NULL;
+
+    tile_t *tile = NULL;
+    uint64_t oldest = UINT64_MAX;
+    for (int i = 0; i < tile_count && oldest; i++) {
+        std::lock_guard<std::mutex> lock(tiles[i].video_mutex);
+        // A tile still waiting for its sender's first IDR counts as the newest
+        uint64_t serial = tiles[i].session_count == 0 ? 0 : tiles[i].video_owner ? tiles[i].video_owner->serial : UINT64_MAX;
+        if (!tile || serial < oldest) {
+            tile = &tiles[i];
+            oldest = serial;
+        }
+    }
+    session_t *session = new session_t();
+    session->tile = tile;
+    session->serial = ++session_serial;
+    session->audio_format.compression = RAOP_AUDIO_CT_AAC_ELD;
+    tile->session_count++;
+    LOGI("Sender %llu shown in tile %d", (unsigned long long) session->serial, (int) (tile - tiles) + 1);
+    return session;
+}
+
+extern "C" void session_destroy(void *cls, void *session_cls) {
+    session_t *session = (session_t *) session_cls;
+    tile_t *tile = session->tile;
+    {
+        std::lock_guard<std::mutex> lock(tile->video_mutex);
+        if (tile->video_owner == session) tile->video_owner = NULL;
+    }
+    {
+        std::lock_guard<std::mutex> lock(tile->audio_mutex);
+#if defined(HAS_NOW_PLAYING)
+        if (now_playing && tile == &tiles[0] && (tile->audio_owner == session || !tile->audio_owner)) {
+            now_playing_clear(now_playing);
+        }
+#endif
+        if (tile->audio_owner == session) tile->audio_owner = NULL;
+    }
+    tile->session_count--;
+    delete session;
+    release_renderers();
+}
+
+#if defined(HAS_THUMBNAILER)
+extern "C" void thumbnail_frame(void *cls, const frame_bus_frame_t *frame) {
+    thumbnailer_process((thumbnailer_t *) cls, frame);
+}
+#endif
+
+#if defined(HAS_V4L2_OUTPUT)
+extern "C" void v4l2_output_frame(void *cls, const frame_bus_frame_t *frame) {
+    v4l2_output_process((v4l2_output_t *) cls, frame);
+}
+#endif
+
+// Returns false if the renderer wants the AAC packet itself
+static bool audio_render_pcm(session_t *session, audio_renderer_t *audio_renderer, raop_ntp_t *ntp, aac_decode_struct *data) {
+    if (!audio_renderer->funcs->render_pcm && !audio_renderer->funcs->set_pcm_source) return false;
+#if defined(HAS_AAC_DECODER)
+    stream_frame_t *pcm = NULL;
+    if (session->audio_format.compression == RAOP_AUDIO_CT_AAC_ELD) {
+        pcm = data->data_len > 0 ? aac_decoder_decode(audio_decoder, data->data, data->data_len, data->pts)
+                                 : aac_decoder_conceal(audio_decoder, data->pts);
+    } else if (session->audio_format.compression == RAOP_AUDIO_CT_ALAC) {
+        pcm = data->data_len > 0 ? alac_decoder_decode(alac_decoder, data->data, data->data_len, data->pts)
+                                 : alac_decoder_conceal(alac_decoder, data->pts);
+    }
+    if (pcm && software_volume) pcm_gain_apply(&audio_gain, (int16_t *) pcm->data, pcm->data_len / (AAC_DECODER_CHANNELS * 2));
+    if (pcm && audio_scheduler) {
+        pcm_scheduler_push(audio_scheduler, pcm);
+    } else if (pcm) {
+        audio_renderer->funcs->render_pcm(audio_renderer, ntp, pcm);
+    }
+#endif
+    return true;
+}
+
+// With the tile's audio_mutex held
+static void audio_apply_volume(tile_t *tile, float volume) {
+    if (software_volume && tile == &tiles[0]) {
+        pcm_gain_set_volume(&audio_gain, volume);
+    } else {
+        tile->audio_renderer->funcs->set_volume(tile->audio_renderer, volume);
+    }
+}
+
+// With the tile's audio_mutex held: sets the decoder up for the format of the session taking the audio
+static void audio_switch_format(session_t *session) {
+#if defined(HAS_AAC_DECODER)
+    const raop_audio_format_t *format = &session->audio_format;
+    if (format->compression == RAOP_AUDIO_CT_ALAC && alac_decoder) {
+        alac_decoder_config_t config = ALAC_DECODER_DEFAULT_CONFIG;
+        if (format->samples_per_frame > 0) config.frame_length = format->samples_per_frame;
+        if (format->sample_rate > 0) config.sample_rate = format->sample_rate;
+        if (alac_decoder_set_config(alac_decoder, &config) < 0) session->audio_format.compression = 0;
+    }
+#endif
+}
+
+// With the tile's audio_mutex held: whether the session's audio is played. A sender that connected
+// later takes the audio over with its first packet, the packets of the earlier ones are dropped from then on.
+static bool audio_owned(session_t *session) {
+    tile_t *tile = session->tile;
+    if (tile->audio_owner == session) return true;
+    if (tile->audio_owner && tile->audio_owner->serial > session->serial) return false;
+    tile->audio_owner = session;
+#if defined(HAS_AAC_DECODER)
+    if (audio_decoder) aac_decoder_flush(audio_decoder);
+#endif
+    audio_switch_format(session);
+    if (session->has_volume) audio_apply_volume(tile, session->volume);
+    return true;
+}
+
+// With the tile's video_mutex held: whether the session's frame goes to the renderer. A sender that
+// connected later takes the renderer over at its first IDR, its SPS and PPS go in just ahead of it.
+// The decoder is not flushed, it only reconfigures itself if the picture size changes.
+// With the tile's video_mutex held: sets the renderer up for the codec of the parameter sets it gets next
+static void video_switch_codec(tile_t *tile, video_codec_t codec) {
+    if (tile->video_codec == codec) return;
+    if (tile->video_renderer->funcs->set_codec) {
+        tile->video_renderer->funcs->set_codec(tile->video_renderer, codec);
+    } else {
+        LOGE("The video renderer can't decode %s", codec == VIDEO_CODEC_H265 ? "HEVC" : "H.264");
+    }
+    tile->video_codec = codec;
+}
+
+static bool video_owned(session_t *session, raop_ntp_t *ntp, h264_decode_struct *data) {
+    tile_t *tile = session->tile;
+    if (data->frame_type == 0) {
+        session->codec.assign(data->data, data->data + data->data_len);
+        session->codec_nal_count = data->nal_count;
+        memcpy(session->codec_nal_units, data->nal_units, data->nal_count * sizeof(h264_nal_unit_t));
+        session->video_codec = data->codec;
+    }
+    if (tile->video_owner == session) {
+        if (data->frame_type == 0) {
+            video_switch_codec(tile, data->codec);
+            tile->resend_codec = false;
+        } else if (tile->resend_codec && !session->codec.empty()) {
+            tile->resend_codec = false;
+            tile->video_renderer->funcs->render_buffer(tile->video_renderer, ntp, session->codec.data(), session->codec.size(),
+                                                       0, 0, session->codec_nal_units, session->codec_nal_count);
+        }
+        return true;
+    }
+    if (tile->video_owner && tile->video_owner->serial > session->serial) return false;
+    if (!data->idr || session->codec.empty()) return false;
+
+    if (tile->video_owner) {
+        LOGI("Sender %llu takes over tile %d from sender %llu", (unsigned long long) session->serial,
+             (int) (tile - tiles) + 1, (unsigned long long) tile->video_owner->serial);
+    }
+    tile->video_owner = session;
+    tile->resend_codec = false;
+#if defined(HAS_GSTREAMER_RENDERER)
+    // Mirroring takes the screen back from a video URL
+    if (video_player && tile == &tiles[0]) video_player_stop(video_player);
+#endif
+    // Another sender's network and clock, its sync starts over
+    tile->has_presented_offset = false;
+    if (tile->av_sync) av_sync_reset(tile->av_sync);
+    video_switch_codec(tile, session->video_codec);
+    tile->video_renderer->funcs->render_buffer(tile->video_renderer, ntp, session->codec.data(), session->codec.size(), 0, 0,
+                                               session->codec_nal_units, session->codec_nal_count);
+    return true;
+}
+
+// Before the tile's video_mutex is taken, so audio and the other senders go on meanwhile: holds a frame
+// back until the tile's A/V sync releases it. Returns how long after its pts the frame came in.
+static int64_t video_sync_hold(tile_t *tile, raop_ntp_t *ntp, h264_decode_struct *data) {
+    if (!tile->av_sync || data->frame_type == 0 || !data->pts) return 0;
+    uint64_t now = raop_ntp_get_local_time(ntp);
+    uint64_t release = av_sync_video_release_time(tile->av_sync, data->pts);
+    if (release > now) {
+        std::this_thread::sleep_for(std::chrono::microseconds(std::min<uint64_t>(release - now, AV_SYNC_MAX_CORRECTION)));
+    }
+    return (int64_t) (now - data->pts);
+}
+
+// From the video renderer's own thread or the one rendering: the frame with pts went on screen
+static void video_frame_presented(void *cls, uint64_t pts, uint64_t display_time) {
+    tile_t *tile = (tile_t *) cls;
+    tile->presented_offset.store((int64_t) (display_time - pts), std::memory_order_relaxed);
+    tile->has_presented_offset.store(true, std::memory_order_release);
+}
+
+// What the renderer says about how long after their pts frames are shown, measured on screen if it reports that
+static void video_presentation_stats(tile_t *tile, video_renderer_stats_t *stats) {
+    video_renderer_t *video_renderer = tile->video_renderer;
+    if (video_renderer->funcs->get_stats) video_renderer->funcs->get_stats(video_renderer, stats);
+    if (tile->has_presented_offset.load(std::memory_order_acquire)) {
+        stats->has_presentation_offset = true;
+        stats->presentation_offset = tile->presented_offset.load(std::memory_order_relaxed);
+    }
+}
+
+// With the tile's video_mutex held, after the owner's frame went to the renderer
+static void video_sync_report(tile_t *tile, h264_decode_struct *data, int64_t arrival_offset) {
+    if (!tile->av_sync || data->frame_type == 0 || !data->pts) return;
+    video_renderer_stats_t stats = {};
+    video_presentation_stats(tile, &stats);
+    if (stats.has_presentation_offset) {
+        av_sync_report_video(tile->av_sync, arrival_offset, stats.presentation_offset, stats.paced);
+    }
+}
+
+// With the tile's audio_mutex held, after the owner's packet went to the renderer
+static void audio_sync_update(tile_t *tile) {
+    audio_renderer_t *audio_renderer = tile->audio_renderer;
+    if (!tile->av_sync) return;
+    audio_renderer_stats_t stats = {};
+    bool can_delay = audio_renderer->funcs->set_delay != NULL;
+#if defined(HAS_AAC_DECODER)
+    // A renderer that pulls its PCM is lined up by the scheduler
+    pcm_scheduler_t *scheduler = audio_renderer->funcs->set_pcm_source ? audio_scheduler : NULL;
+    if (scheduler) {
+        pcm_scheduler_stats_t scheduler_stats;
+        pcm_scheduler_get_stats(scheduler, &scheduler_stats);
+        stats.has_presentation_offset = scheduler_stats.has_presentation_offset;
+        stats.presentation_offset = scheduler_stats.presentation_offset;
+        can_delay = true;
+    } else
+#endif
+    if (audio_renderer->funcs->get_stats) {
+        audio_renderer->funcs->get_stats(audio_renderer, &stats);
+    }
+    if (stats.has_presentation_offset) {
+        av_sync_report_audio(tile->av_sync, stats.presentation_offset, can_delay);
+    }
+    int64_t delay = av_sync_get_audio_delay(tile->av_sync);
+    if (can_delay && delay != tile->audio_delay) {
+#if defined(HAS_AAC_DECODER)
+        if (scheduler) pcm_scheduler_set_delay(scheduler, delay);
+        else
+#endif
+        audio_renderer->funcs->set_delay(audio_renderer, delay);
+        tile->audio_delay = delay;
+    }
+}
+
+static void audio_render(session_t *session, audio_renderer_t *audio_renderer, raop_ntp_t *ntp, aac_decode_struct *data) {
+    // Lost packets are only concealed for renderers that take PCM, the others only play AAC-ELD
+    if (!audio_render_pcm(session, audio_renderer, ntp, data) && data->data_len > 0 &&
+        session->audio_format.compression == RAOP_AUDIO_CT_AAC_ELD) {
+        audio_renderer->funcs->render_buffer(audio_renderer, ntp, data->data, data->data_len, data->pts);
+    }
 }
 
 extern "C" void audio_process(void *cls, raop_ntp_t *ntp, aac_decode_struct *data) {
+    session_t *session = (session_t *) cls;
+    audio_renderer_t *audio_renderer = session->tile->audio_renderer;
+    if (audio_renderer == NULL) return;
+    std::lock_guard<std::mutex> lock(session->tile->audio_mutex);
+    if (!audio_owned(session)) return;
+    audio_render(session, audio_renderer, ntp, data);
+    audio_sync_update(session->tile);
+}
+
+extern "C" int video_process(void *cls, raop_ntp_t *ntp, h264_decode_struct *data) {
+    session_t *session = (session_t *) cls;
+    video_renderer_t *video_renderer = session->tile->video_renderer;
+    int64_t arrival_offset = video_sync_hold(session->tile, ntp, data);
+    std::lock_guard<std::mutex> lock(session->tile->video_mutex);
+    if (!video_owned(session, ntp, data)) return 0;
+    video_call_begin(session->tile);
+    int ret = video_renderer->funcs->render_buffer(video_renderer, ntp, data->data, data->data_len, data->pts,
+                                                   data->frame_type, data->nal_units, data->nal_count);
+    video_call_end(session->tile, ret);
+    video_sync_report(session->tile, data, arrival_offset);
+    return ret;
+}
+
+// Only the first part of a frame waits for A/V sync and may take the tile over, the others follow it
+extern "C" int video_process_part(void *cls, raop_ntp_t *ntp, h264_decode_struct *data) {
+    session_t *session = (session_t *) cls;
+    video_renderer_t *video_renderer = session->tile->video_renderer;
+    if (data->part == 0) session->part_arrival_offset = video_sync_hold(session->tile, ntp, data);
+    std::lock_guard<std::mutex> lock(session->tile->video_mutex);
+    if (data->part == 0) {
+        session->part_owned = video_owned(session, ntp, data);
+    } else if (session->tile->video_owner != session) {
+        session->part_owned = false;
+    }
+    if (!session->part_owned) return 0;
+    video_call_begin(session->tile);
+    int ret = video_renderer->funcs->render_part(video_renderer, ntp, data->data, data->data_len, data->pts,
+                                                 data->nal_units, data->nal_count, data->part, !data->partial);
+    video_call_end(session->tile, ret);
+    if (!data->partial) video_sync_report(session->tile, data, session->part_arrival_offset);
+    return ret;
+}
+
+extern "C" void audio_process_frame(void *cls, raop_ntp_t *ntp, stream_frame_t *frame, aac_decode_struct *data) {
+    session_t *session = (session_t *) cls;
+    audio_renderer_t *audio_renderer = session->tile->audio_renderer;
     if (audio_renderer != NULL) {
-        audio_renderer->funcs->render_buffer(audio_renderer, ntp, data->data, data->data_len, data->pts);
+        std::lock_guard<std::mutex> lock(session->tile->audio_mutex);
+        if (!audio_owned(session)) {
+        } else if (!audio_renderer->funcs->render_pcm && audio_renderer->funcs->render_frame &&
+                   session->audio_format.compression == RAOP_AUDIO_CT_AAC_ELD) {
+            audio_renderer->funcs->render_frame(audio_renderer, ntp, frame);
+            audio_sync_update(session->tile);
+            return;
+        } else {
+            audio_render(session, audio_renderer, ntp, data);
+            audio_sync_update(session->tile);
+        }
+    }
+    stream_frame_unref(frame);
+}
+
+extern "C" int video_process_frame(void *cls, raop_ntp_t *ntp, stream_frame_t *frame, h264_decode_struct *data) {
+    session_t *session = (session_t *) cls;
+    video_renderer_t *video_renderer = session->tile->video_renderer;
+    int64_t arrival_offset = video_sync_hold(session->tile, ntp, data);
+    std::lock_guard<std::mutex> lock(session->tile->video_mutex);
+    int ret = 0;
+    if (!video_owned(session, ntp, data)) {
+    } else if (video_renderer->funcs->render_frame) {
+        video_call_begin(session->tile);
+        ret = video_renderer->funcs->render_frame(video_renderer, ntp, frame, data->frame_type,
+                                                  data->nal_units, data->nal_count);
+        video_call_end(session->tile, ret);
+        video_sync_report(session->tile, data, arrival_offset);
+        return ret;
+    } else {
+        video_call_begin(session->tile);
+        ret = video_renderer->funcs->render_buffer(video_renderer, ntp, data->data, data->data_len, data->pts,
+                                                   data->frame_type, data->nal_units, data->nal_count);
+        video_call_end(session->tile, ret);
+        video_sync_report(session->tile, data, arrival_offset);
+    }
+    stream_frame_unref(frame);
+    return ret;
+}
+
+// Only the sender being shown gets the renderer's backlog, the others are dropped anyway
+extern "C" void video_get_stats(void *cls, raop_renderer_stats_t *stats) {
+    session_t *session = (session_t *) cls;
+    std::lock_guard<std::mutex> lock(session->tile->video_mutex);
+    if (session->tile->video_owner == session) {
+        video_renderer_stats_t renderer_stats = {};
+        video_presentation_stats(session->tile, &renderer_stats);
+        stats->queued_frames = renderer_stats.queued_frames;
+        stats->latency = renderer_stats.decoder_latency;
+        stats->dropped_frames = renderer_stats.dropped_frames;
+        stats->has_display_offset = renderer_stats.has_presentation_offset;
+        stats->display_offset = renderer_stats.presentation_offset;
+        // Only the first tile is heard, so it is the one looked at
+        stats->thin = thin_tiles && session->tile != &tiles[0];
+        stats->priority = session->tile == &tiles[0] && tile_count > 1;
+        stats->decode_errors = renderer_stats.decode_errors;
+    }
+}
+
+extern "C" void get_display_caps(void *cls, raop_display_caps_t *caps) {
+    video_renderer_t *video_renderer = tiles[0].video_renderer;
+    audio_renderer_t *audio_renderer = tiles[0].audio_renderer;
+    if (video_renderer != NULL && video_renderer->funcs->get_caps) {
+        video_renderer_caps_t video_caps = {};
+        video_renderer->funcs->get_caps(video_renderer, &video_caps);
+        if (video_caps.max_width > 0 && video_caps.max_height > 0) {
+            caps->width = video_caps.max_width;
+            caps->height = video_caps.max_height;
+        }
+        if (video_caps.max_fps > 0) caps->refresh_rate = video_caps.max_fps;
+        caps->hevc = video_caps.hevc;
+    }
+    // Senders shown in a tile need no more than the tile's size
+    if (tile_count > 1) {
+        int x, y, w, h;
+        video_renderer_tile_rect(&tiles[0].video_config, caps->width, caps->height, &x, &y, &w, &h);
+        caps->width = w;
+        caps->height = h;
+    }
+    if (display_width > 0) {
+        caps->width = display_width;
+        caps->height = display_height;
     }
+    if (display_fps > 0) {
+        caps->refresh_rate = display_fps;
+        caps->max_fps = display_fps;
+    }
+    if (audio_renderer != NULL && audio_renderer->funcs->get_caps) {
+        audio_renderer_caps_t audio_caps = {};
+        audio_renderer->funcs->get_caps(audio_renderer, &audio_caps);
+        caps->audio_output_latency = audio_caps.output_latency;
+    }
+#if defined(HAS_AAC_DECODER)
+    caps->buffered_audio = buffered_audio && audio_renderer != NULL &&
+                           (audio_renderer->funcs->render_pcm || audio_renderer->funcs->set_pcm_source);
+#endif
+}
+
+// Decoder input buffers only go to the sender being shown
+extern "C" unsigned char *video_acquire_buffer(void *cls, int size, void **handle) {
+    session_t *session = (session_t *) cls;
+    video_renderer_t *video_renderer = session->tile->video_renderer;
+    std::lock_guard<std::mutex> lock(session->tile->video_mutex);
+    if (session->tile->video_owner == session && video_renderer->funcs->acquire_buffer) {
+        return video_renderer->funcs->acquire_buffer(video_renderer, size, handle);
+    }
+    return NULL;
 }
 
-extern "C" void video_process(void *cls, raop_ntp_t *ntp, h264_decode_struct *data) {
-    if (video_renderer != NULL) {
-        video_renderer->funcs->render_buffer(video_renderer, ntp, data->data, data->data_len, data->pts, data->frame_type);
+extern "C" void video_submit_buffer(void *cls, raop_ntp_t *ntp, void *handle, h264_decode_struct *data) {
+    session_t *session = (session_t *) cls;
+    video_renderer_t *video_renderer = session->tile->video_renderer;
+    int64_t arrival_offset = video_sync_hold(session->tile, ntp, data);
+    std::lock_guard<std::mutex> lock(session->tile->video_mutex);
+    if (!video_owned(session, ntp, data)) {
+        // Taken over since the buffer was acquired
+        video_renderer->funcs->release_buffer(video_renderer, handle);
+        return;
     }
+    // A decoder that handed out the buffer is taking frames
+    video_call_begin(session->tile);
+    video_renderer->funcs->submit_buffer(video_renderer, ntp, handle, data->data_len, data->pts, data->frame_type,
+                                         data->nal_units, data->nal_count);
+    video_call_end(session->tile, 0);
+    video_sync_report(session->tile, data, arrival_offset);
 }
 
+extern "C" void video_release_buffer(void *cls, void *handle) {
+    session_t *session = (session_t *) cls;
+    std::lock_guard<std::mutex> lock(session->tile->video_mutex);
+    session->tile->video_renderer->funcs->release_buffer(session->tile->video_renderer, handle);
+}
+
+// Flushes from a sender that has been taken over leave the renderers alone, they are busy with the new one
 extern "C" void audio_flush(void *cls) {
-    if (audio_renderer) audio_renderer->funcs->flush(audio_renderer);
+    session_t *session = (session_t *) cls;
+    audio_renderer_t *audio_renderer = session->tile->audio_renderer;
+    if (audio_renderer == NULL) return;
+    std::lock_guard<std::mutex> lock(session->tile->audio_mutex);
+    if (session->tile->audio_owner != session) return;
+#if defined(HAS_AAC_DECODER)
+    if (audio_decoder) aac_decoder_flush(audio_decoder);
+    if (audio_scheduler) pcm_scheduler_flush(audio_scheduler);
+#endif
+    audio_renderer->funcs->flush(audio_renderer);
+    if (session->tile->av_sync) av_sync_flush(session->tile->av_sync);
 }
 
 extern "C" void video_flush(void *cls) {
-    if (video_renderer) video_renderer->funcs->flush(video_renderer);
+    session_t *session = (session_t *) cls;
+    video_renderer_t *video_renderer = session->tile->video_renderer;
+    std::lock_guard<std::mutex> lock(session->tile->video_mutex);
+    if (session->tile->video_owner != session) return;
+    video_renderer->funcs->flush(video_renderer);
+    session->tile->has_presented_offset = false;
+    if (session->tile->av_sync) av_sync_flush(session->tile->av_sync);
 }
 
-extern "C" void audio_set_volume(void *cls, float volume) {
-    if (audio_renderer != NULL) {
-        audio_renderer->funcs->set_volume(audio_renderer, volume);
+extern "C" void audio_set_format(void *cls, const raop_audio_format_t *format) {
+    session_t *session = (session_t *) cls;
+    audio_renderer_t *audio_renderer = session->tile->audio_renderer;
+    if (audio_renderer == NULL) return;
+    std::lock_guard<std::mutex> lock(session->tile->audio_mutex);
+    session->audio_format = *format;
+    bool decoded = audio_renderer->funcs->render_pcm || audio_renderer->funcs->set_pcm_source;
+    if (format->compression == RAOP_AUDIO_CT_ALAC && decoded) {
+        LOGI("Playing ALAC audio, %d samples per frame", format->samples_per_frame);
+    } else if (format->compression != RAOP_AUDIO_CT_AAC_ELD) {
+        LOGW("The audio renderer can't play audio of compression type %d, it is dropped", format->compression);
+        session->audio_format.compression = 0;
     }
+    if (session->tile->audio_owner == session) audio_switch_format(session);
 }
 
-extern "C" void log_callback(void *cls, int level, const char *msg) {
-    switch (level) {
-        case LOGGER_DEBUG: {
-            LOGD("%s", msg);
-            break;
+extern "C" void audio_set_volume(void *cls, float volume) {
+    session_t *session = (session_t *) cls;
+    audio_renderer_t *audio_renderer = session->tile->audio_renderer;
+    if (audio_renderer == NULL) return;
+    std::lock_guard<std::mutex> lock(session->tile->audio_mutex);
+    session->volume = volume;
+    session->has_volume = true;
+    if (session->tile->audio_owner == session) audio_apply_volume(session->tile, volume);
+}
+
+#if defined(HAS_NOW_PLAYING)
+// Whether the track info of the session is the one to show: that of the first tile's audio, or
+// of any sender there while nobody's audio is played yet, since it often comes before the first packet
+static bool now_playing_owned(session_t *session) {
+    if (!now_playing || session->tile != &tiles[0]) return false;
+    std::lock_guard<std::mutex> lock(session->tile->audio_mutex);
+    return session->tile->audio_owner == session || !session->tile->audio_owner;
+}
+#endif
+
+// The now_playing worker takes copies, nothing is decoded on the calling thread
+extern "C" void audio_set_metadata(void *cls, const void *buffer, int buflen) {
+#if defined(HAS_NOW_PLAYING)
+    if (now_playing_owned((session_t *) cls)) now_playing_set_metadata(now_playing, buffer, buflen);
+#endif
+}
+
+extern "C" void audio_set_coverart(void *cls, const void *buffer, int buflen) {
+#if defined(HAS_NOW_PLAYING)
+    if (now_playing_owned((session_t *) cls)) now_playing_set_coverart(now_playing, buffer, buflen);
+#endif
+}
+
+extern "C" void audio_set_progress(void *cls, unsigned int start, unsigned int curr, unsigned int end) {
+#if defined(HAS_NOW_PLAYING)
+    if (now_playing_owned((session_t *) cls)) now_playing_set_progress(now_playing, start, curr, end);
+#endif
+}
+
+#if defined(HAS_GSTREAMER_RENDERER)
+extern "C" void video_url_play(void *cls, const char *url, double start_seconds, double start_fraction) {
+    video_player_play(video_player, url, start_seconds, start_fraction);
+}
+
+extern "C" void video_url_scrub(void *cls, double position) {
+    video_player_seek(video_player, position);
+}
+
+extern "C" void video_url_rate(void *cls, double rate) {
+    video_player_set_rate(video_player, rate);
+}
+
+extern "C" void video_url_stop(void *cls) {
+    video_player_stop(video_player);
+}
+
+extern "C" int video_url_get_playback(void *cls, raop_video_playback_t *playback) {
+    video_player_state_t state = {};
+    if (!video_player_get_state(video_player, &state)) return -1;
+    playback->duration = state.duration;
+    playback->position = state.position;
+    playback->rate = state.rate;
+    playback->ready_to_play = state.ready;
+    return 0;
+}
+#endif
+
+// Creates and starts the renderers of every tile, the slow part of starting up with OpenMAX
+static int init_renderers(video_renderer_config_t const *video_config, audio_renderer_config_t const *audio_config,
+                          std::vector<std::string> const &audio_sinks) {
+    for (int i = 0; i < tile_count; i++) {
+        tile_t *tile = &tiles[i];
+        tile->video_config = *video_config;
+        tile->video_config.tile = i;
+        tile->video_config.tile_count = tile_count;
+        if (i > 0) {
+            // The display is the first tile's, which also picks its refresh rate
+            tile->video_config.background_mode = BACKGROUND_MODE_OFF;
+            tile->video_config.match_refresh = false;
         }
-        case LOGGER_WARNING: {
-            LOGW("%s", msg);
-            break;
+        if (audio_only) continue;
+        if ((tile->video_renderer = video_init_func(render_logger, &tile->video_config)) == NULL) {
+            LOGE("Could not init video renderer");
+            return -1;
         }
-        case LOGGER_INFO: {
-            LOGI("%s", msg);
-            break;
+        if (i == 0 && video_config->clone_count && tile->video_renderer->type != VIDEO_RENDERER_RPI) {
+            LOGW("Only the rpi renderer shows the video on further displays, --clone is ignored");
         }
-        case LOGGER_ERR: {
-            LOGE("%s", msg);
-            break;
+    }
+
+    // Only the sender in the first tile is heard
+    if (audio_config->device == AUDIO_DEVICE_NONE) {
+        LOGI("Audio disabled");
+    } else if ((tiles[0].audio_renderer = audio_init_func(render_logger, tiles[0].video_renderer, audio_config)) == NULL) {
+        LOGE("Could not init audio renderer");
+        return -1;
+    }
+
+    // Further ALSA devices play the same decoded audio, each aligned to the pts by its own output latency
+    if (!audio_sinks.empty() && tiles[0].audio_renderer) {
+#if defined(HAS_ALSA_RENDERER)
+        if (audio_init_func != audio_renderer_alsa_init) {
+            LOGE("--audio-sink needs the alsa renderer");
+            return -1;
         }
-        default:
-            break;
+        audio_renderer_t *sinks[AUDIO_RENDERER_MAX_SINKS] = { tiles[0].audio_renderer };
+        int sink_count = 1;
+        for (const std::string &sink : audio_sinks) {
+            audio_renderer_config_t *config = &audio_sink_configs[sink_count - 1];
+            *config = *audio_config;
+            audio_sink_devices[sink_count - 1] = parse_audio_sink(sink, &config->output_delay);
+            config->alsaString = audio_sink_devices[sink_count - 1].c_str();
+            if ((sinks[sink_count] = audio_init_func(render_logger, tiles[0].video_renderer, config)) == NULL) {
+                LOGE("Could not init audio sink %s", config->alsaString);
+                return -1;
+            }
+            sink_count++;
+        }
+        if ((tiles[0].audio_renderer = audio_renderer_fanout_init(render_logger, sinks, sink_count)) == NULL) {
+            LOGE("Could not init audio fanout");
+            return -1;
+        }
+#else
+        LOGE("--audio-sink needs RPiPlay built with ALSA");
+        return -1;
+#endif
     }
 
+#if defined(HAS_AAC_DECODER)
+    if (tiles[0].audio_renderer && (tiles[0].audio_renderer->funcs->render_pcm || tiles[0].audio_renderer->funcs->set_pcm_source) &&
+        (audio_decoder = aac_decoder_init(render_logger)) == NULL) {
+        LOGE("Could not init AAC decoder");
+        return -1;
+    }
+    if (audio_decoder && (alac_decoder = alac_decoder_init(render_logger)) == NULL) {
+        LOGE("Could not init ALAC decoder");
+        return -1;
+    }
+    if (audio_decoder && tiles[0].audio_renderer->funcs->set_pcm_source) {
+        if ((audio_scheduler = pcm_scheduler_init()) == NULL) {
+            LOGE("Could not init PCM scheduler");
+            return -1;
+        }
+        tiles[0].audio_renderer->funcs->set_pcm_source(tiles[0].audio_renderer, audio_scheduler);
+    }
+    if (audio_decoder) {
+        audio_renderer_caps_t audio_caps = {};
+        if (tiles[0].audio_renderer->funcs->get_caps) tiles[0].audio_renderer->funcs->get_caps(tiles[0].audio_renderer, &audio_caps);
+        software_volume = force_software_volume || audio_caps.software_volume;
+        pcm_gain_init(&audio_gain);
+        if (software_volume) LOGI("Applying the volume to the decoded audio");
+    }
+#endif
+    if (force_software_volume && !software_volume) {
+        LOGW("The audio renderer decodes itself, --soft-volume is ignored");
+    }
+
+    for (int i = 0; i < tile_count; i++) {
+        if (tiles[i].audio_renderer && tiles[i].video_renderer && (tiles[i].av_sync = av_sync_init(render_logger)) == NULL) {
+            LOGE("Could not init A/V sync");
+            return -1;
+        }
+    }
+
+    for (int i = 0; i < tile_count; i++) {
+        if (tiles[i].video_renderer) {
+            video_renderer_set_presented(tiles[i].video_renderer, video_frame_presented, &tiles[i]);
+            tiles[i].video_renderer->funcs->start(tiles[i].video_renderer);
+        }
+        if (tiles[i].audio_renderer) tiles[i].audio_renderer->funcs->start(tiles[i].audio_renderer);
+    }
+
+    return 0;
+}
+
+static void renderer_thread_func(video_renderer_config_t const *video_config, audio_renderer_config_t const *audio_config,
+                                 std::vector<std::string> const &audio_sinks, std::chrono::steady_clock::time_point t0) {
+    thread_attr_apply(render_logger, THREAD_ROLE_NONE, "rp-renderinit");
+    renderer_state_t state = RENDERERS_FAILED;
+    select_auto_renderers(video_config, audio_config);
+    if (init_renderers(video_config, audio_config, audio_sinks) == 0) {
+        // Senders learn from the TXT record whether they may mirror in HEVC. No connection gets past
+        // session_init before this is done, so nothing reads the record or /info meanwhile.
+        raop_display_caps_t caps = {};
+        get_display_caps(NULL, &caps);
+        if (caps.hevc) {
+            LOGI("Video renderer decodes HEVC, offering it to senders");
+            dnssd_set_hevc(dnssd, caps.hevc);
+        }
+        if (caps.buffered_audio) {
+            LOGI("Audio is decoded here, offering buffered audio to senders");
+            dnssd_set_buffered_audio(dnssd, caps.buffered_audio);
+        } else if (buffered_audio) {
+            LOGW("Buffered audio needs an audio renderer that takes PCM, not offering it");
+        }
+        if (progressive && !audio_only) {
+            bool parts = true;
+            for (int i = 0; i < tile_count; i++) {
+                if (!tiles[i].video_renderer->funcs->render_part) parts = false;
+            }
+            if (parts) {
+                raop_set_progressive_video(raop, 1);
+            } else {
+                LOGW("--progressive needs a video renderer that takes frames in parts, large frames go in whole");
+            }
+        }
+        // Updates the TXT records in place, senders keep the receiver in their lists
+        raop_update_info(raop);
+#if defined(HAS_NOW_PLAYING)
+        if (show_now_playing) {
+            video_renderer_t *video_renderer = tiles[0].video_renderer;
+            if (video_renderer && !video_renderer->funcs->set_overlay) {
+                LOGW("The video renderer can't show cover art, track info is only logged");
+            }
+            now_playing = now_playing_init(render_logger, video_renderer, caps.width, caps.height);
+        }
+#endif
+        state = RENDERERS_READY;
+        LOGI("Renderers ready after %lld ms", ms_since(t0));
+        log_memory_report(true);
+    }
+    {
+        std::lock_guard<std::mutex> lock(renderer_mutex);
+        renderer_state = state;
+        if (state == RENDERERS_READY && idle_timeout) alarm(idle_timeout);
+    }
+    renderer_cond.notify_all();
+    if (state == RENDERERS_FAILED) {
+        // Stops main's sigwaitinfo, which is where a failed start ends up
+        kill(getpid(), SIGTERM);
+    }
 }
 
-int start_server(std::vector<char> hw_addr, std::string name, bool debug_log,
+int start_server(std::vector<char> hw_addr, std::string name, bool debug_log, unsigned int latency_budget,
+                 const char *keyfile, const char *record_dir, const char *mp4_dir,
+                 std::vector<std::string> const &restream_destinations,
+                 unsigned short thumbnail_port, int thumbnail_width, std::vector<std::string> const &audio_sinks,
                  video_renderer_config_t const *video_config, audio_renderer_config_t const *audio_config) {
+    auto t0 = std::chrono::steady_clock::now();
     raop_callbacks_t raop_cbs;
     memset(&raop_cbs, 0, sizeof(raop_cbs));
+    tile_count = video_config->tile_count > 1 ? video_config->tile_count : 1;
+    if (audio_only) {
+        if (tile_count > 1 || video_url || thumbnail_port || v4l2_output_device || shm_output_name ||
+            !restream_destinations.empty()) {
+            LOGE("There is no video with --audio-only for -mv, --video-url, --thumbnail, --v4l2-output, "
+                 "--shm-output or --restream");
+            return -1;
+        }
+        LOGI("Playing audio only, senders are not offered mirroring");
+    }
     raop_cbs.conn_init = conn_init;
     raop_cbs.conn_destroy = conn_destroy;
     raop_cbs.audio_process = audio_process;
     raop_cbs.video_process = video_process;
+    raop_cbs.video_acquire_buffer = video_acquire_buffer;
+    raop_cbs.video_submit_buffer = video_submit_buffer;
+    raop_cbs.video_release_buffer = video_release_buffer;
+    raop_cbs.audio_process_frame = audio_process_frame;
+    raop_cbs.video_process_frame = video_process_frame;
+    raop_cbs.video_process_part = video_process_part;
+    raop_cbs.video_get_stats = video_get_stats;
+    raop_cbs.get_display_caps = get_display_caps;
     raop_cbs.audio_flush = audio_flush;
     raop_cbs.video_flush = video_flush;
     raop_cbs.audio_set_volume = audio_set_volume;
+    raop_cbs.audio_set_metadata = audio_set_metadata;
+    raop_cbs.audio_set_coverart = audio_set_coverart;
+    raop_cbs.audio_set_progress = audio_set_progress;
+    raop_cbs.audio_set_format = audio_set_format;
+    raop_cbs.session_init = session_init;
+    raop_cbs.session_destroy = session_destroy;
+#if defined(HAS_GSTREAMER_RENDERER)
+    if (video_url) {
+        raop_cbs.video_url_play = video_url_play;
+        raop_cbs.video_url_scrub = video_url_scrub;
+        raop_cbs.video_url_rate = video_url_rate;
+        raop_cbs.video_url_stop = video_url_stop;
+        raop_cbs.video_url_get_playback = video_url_get_playback;
+    }
+#endif
 
     raop = raop_init(10, &raop_cbs);
     if (raop == NULL) {
@@ -367,32 +2058,130 @@ int start_server(std::vector<char> hw_addr, std::string name, bool debug_log,
 
     raop_set_log_callback(raop, log_callback, NULL);
     raop_set_log_level(raop, debug_log ? RAOP_LOG_DEBUG : LOGGER_INFO);
+    if (keyfile && raop_set_keyfile(raop, keyfile) < 0) {
+        return -1;
+    }
+    raop_set_video_latency_budget(raop, latency_budget);
+    raop_set_capture_dir(raop, record_dir);
+    raop_set_mp4_dir(raop, mp4_dir);
+    raop_set_session_log(raop, session_log);
+    raop_set_memory_budget(raop, (size_t) session_memory_mb * 1024 * 1024, (size_t) total_memory_mb * 1024 * 1024);
+    raop_set_max_sessions(raop, max_sessions);
+    if (decrypt_threads < 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        decrypt_threads = cores > 4 ? 3 : cores > 1 ? (int) cores - 1 : 0;
+    }
+    raop_set_decrypt_threads(raop, decrypt_threads);
+    raop_set_reconnect_grace(raop, reconnect_grace * 1000);
+    raop_set_lock_memory(raop, lock_memory);
+    raop_set_coalesce_static(raop, coalesce_static);
+    thread_attr_set_lock_stacks(lock_memory);
+    raop_set_session_reactor(raop, session_reactor);
+    raop_set_mirror_udp(raop, mirror_udp);
+    raop_set_ptp(raop, ptp);
+    raop_set_audio_only(raop, audio_only);
+    if (raop_set_cpu_limit(raop, cpu_limit) < 0) {
+        LOGW("Could not start watching the CPU load");
+    }
+    if (raop_set_thermal_limit(raop, thermal_limit) < 0) {
+        LOGW("Could not start watching the temperature");
+    }
+    if (raop_set_decode_scheduling(raop, schedule_decode) < 0) {
+        LOGW("Could not set up the decode scheduler");
+    }
+    // Keeps the senders' receive and decrypt stages from competing for the same cores
+    raop_set_cpu_affinity(raop, tile_count > 1);
+    for (const std::string &destination : restream_destinations) {
+        // host:port, with IPv6 addresses in brackets
+        size_t separator = destination.rfind(':');
+        if (separator == std::string::npos) {
+            LOGE("Restream destination %s has no port", destination.c_str());
+            return -1;
+        }
+        std::string host = destination.substr(0, separator);
+        if (host.size() > 2 && host.front() == '[' && host.back() == ']') {
+            host = host.substr(1, host.size() - 2);
+        }
+        if (raop_add_restream(raop, host.c_str(), atoi(destination.c_str() + separator + 1)) < 0) {
+            return -1;
+        }
+    }
+    if (shm_output_name && raop_set_shm_output(raop, shm_output_name) < 0) {
+        return -1;
+    }
 
     render_logger = logger_init();
     logger_set_callback(render_logger, log_callback, NULL);
     logger_set_level(render_logger, debug_log ? LOGGER_DEBUG : LOGGER_INFO);
 
     if (video_config->low_latency) logger_log(render_logger, LOGGER_INFO, "Using low-latency mode");
+    char cpu_features[64];
+    cpu_features_describe(cpu_features_get(), cpu_features, sizeof(cpu_features));
+    logger_log(render_logger, LOGGER_DEBUG, "CPU features: %s, audio kernels: %s, AES: %s", cpu_features,
+               dsp_kernels_get()->name, aes_get_impl_name());
 
-    if ((video_renderer = video_init_func(render_logger, video_config)) == NULL) {
-        LOGE("Could not init video renderer");
+    if (thumbnail_port) {
+#if defined(HAS_THUMBNAILER)
+        if ((thumbnailer = thumbnailer_init(render_logger, thumbnail_port, thumbnail_width)) == NULL) {
+            LOGE("Could not init the thumbnailer");
+            return -1;
+        }
+        // Keyframes only and a short queue, it must never take anything away from the display
+        frame_bus_subscriber_config_t thumbnail_config = {
+            "thumbnailer", FRAME_BUS_VIDEO | FRAME_BUS_CODEC, 4, 0, FRAME_BUS_DROP_NEWEST, thumbnail_frame, thumbnailer
+        };
+        if (raop_add_frame_consumer(raop, &thumbnail_config) < 0) {
+            return -1;
+        }
+#else
+        LOGE("Thumbnails need RPiPlay built with libavcodec and libswscale");
         return -1;
+#endif
     }
-
-    if (audio_config->device == AUDIO_DEVICE_NONE) {
-        LOGI("Audio disabled");
-    } else if ((audio_renderer = audio_init_func(render_logger, video_renderer, audio_config)) ==
-               NULL) {
-        LOGE("Could not init audio renderer");
+    if (v4l2_output_device) {
+#if defined(HAS_V4L2_OUTPUT)
+        if ((v4l2_output = v4l2_output_init(render_logger, v4l2_output_device, v4l2_output_fps, v4l2_output_h264)) == NULL) {
+            LOGE("Could not init the V4L2 output");
+            return -1;
+        }
+        // Every frame is decoded, after a drop it waits for the next keyframe rather than hold up the display
+        frame_bus_subscriber_config_t v4l2_output_config = {
+            "v4l2_output", FRAME_BUS_VIDEO | FRAME_BUS_CODEC, 16, 0, FRAME_BUS_DROP_TO_KEYFRAME, v4l2_output_frame, v4l2_output
+        };
+        if (raop_add_frame_consumer(raop, &v4l2_output_config) < 0) {
+            return -1;
+        }
+#else
+        LOGE("The V4L2 output needs RPiPlay built with libavcodec, libswscale and the V4L2 headers");
         return -1;
+#endif
+    }
+#if !defined(HAS_NOW_PLAYING)
+    if (show_now_playing) {
+        LOGE("Now playing needs RPiPlay built with libavcodec and libswscale");
+        return -1;
+    }
+#endif
+    if (video_url) {
+#if defined(HAS_GSTREAMER_RENDERER)
+        if ((video_player = video_player_init(render_logger, video_config)) == NULL) {
+            LOGE("Could not init the video URL player");
+            return -1;
+        }
+#else
+        LOGE("--video-url needs RPiPlay built with GStreamer");
+        return -1;
+#endif
     }
-
-    if (video_renderer) video_renderer->funcs->start(video_renderer);
-    if (audio_renderer) audio_renderer->funcs->start(audio_renderer);
 
     unsigned short port = 0;
     raop_start(raop, &port);
     raop_set_port(raop, port);
+    if (metrics_port && raop_start_metrics(raop, &metrics_port) < 0) {
+        LOGE("Could not serve metrics on port %u", metrics_port);
+        return -1;
+    }
+    auto t_listening = std::chrono::steady_clock::now();
 
     int error;
     dnssd = dnssd_init(name.c_str(), strlen(name.c_str()), hw_addr.data(), hw_addr.size(), &error);
@@ -403,19 +2192,88 @@ int start_server(std::vector<char> hw_addr, std::string name, bool debug_log,
 
     raop_set_dnssd(raop, dnssd);
 
+    // Nothing listens on the airplay port unless video URLs are played there
+    unsigned short airplay_port = port + 1;
+    if (video_url) {
+        if (raop_start_video(raop, &airplay_port) < 0) {
+            LOGE("Could not serve video URLs on port %u", airplay_port);
+            return -1;
+        }
+        dnssd_set_video_url(dnssd, 1);
+        LOGI("Playing video URLs on port %u", airplay_port);
+    }
+
+    dnssd_set_ptp(dnssd, ptp);
+    dnssd_set_audio_only(dnssd, audio_only);
+
+    // HEVC is only offered once the renderer thread knows it can be decoded
     dnssd_register_raop(dnssd, port);
-    dnssd_register_airplay(dnssd, port + 1);
+    dnssd_register_airplay(dnssd, airplay_port);
+
+    /* Serialize the /info response once the TXT records exist */
+    raop_update_info(raop);
+
+    auto t_advertised = std::chrono::steady_clock::now();
+    LOGI("Listening after %lld ms, advertised after %lld ms",
+         (long long) std::chrono::duration_cast<std::chrono::milliseconds>(t_listening - t0).count(),
+         (long long) std::chrono::duration_cast<std::chrono::milliseconds>(t_advertised - t0).count());
+    renderer_thread = std::thread(renderer_thread_func, video_config, audio_config, std::cref(audio_sinks), t0);
+    if (stall_timeout && !audio_only) {
+        watchdog_running = true;
+        watchdog_thread = std::thread(watchdog_thread_func);
+    }
 
     return 0;
 }
 
 int stop_server() {
+    if (renderer_thread.joinable()) renderer_thread.join();
+    {
+        std::lock_guard<std::mutex> lock(watchdog_mutex);
+        watchdog_running = false;
+    }
+    watchdog_cond.notify_all();
+    if (watchdog_thread.joinable()) watchdog_thread.join();
     raop_destroy(raop);
     dnssd_unregister_raop(dnssd);
     dnssd_unregister_airplay(dnssd);
+#if defined(HAS_GSTREAMER_RENDERER)
+    video_player_destroy(video_player);
+    video_player = NULL;
+#endif
     // If we don't destroy these two in the correct order, we get a deadlock from the ilclient library
-    if (audio_renderer) audio_renderer->funcs->destroy(audio_renderer);
-    if (video_renderer) video_renderer->funcs->destroy(video_renderer);
+    for (int i = 0; i < tile_count; i++) {
+        if (tiles[i].audio_renderer) tiles[i].audio_renderer->funcs->destroy(tiles[i].audio_renderer);
+        tiles[i].audio_renderer = NULL;
+        av_sync_destroy(tiles[i].av_sync);
+        tiles[i].av_sync = NULL;
+    }
+#if defined(HAS_NOW_PLAYING)
+    // Before the video renderers, the worker may be showing cover art on the first one
+    now_playing_destroy(now_playing);
+    now_playing = NULL;
+#endif
+#if defined(HAS_AAC_DECODER)
+    pcm_scheduler_destroy(audio_scheduler);
+    audio_scheduler = NULL;
+    aac_decoder_destroy(audio_decoder);
+    audio_decoder = NULL;
+    alac_decoder_destroy(alac_decoder);
+    alac_decoder = NULL;
+#endif
+    for (int i = 0; i < tile_count; i++) {
+        if (tiles[i].video_renderer) tiles[i].video_renderer->funcs->destroy(tiles[i].video_renderer);
+        tiles[i].video_renderer = NULL;
+    }
+    tile_count = 0;
+#if defined(HAS_THUMBNAILER)
+    thumbnailer_destroy(thumbnailer);
+    thumbnailer = NULL;
+#endif
+#if defined(HAS_V4L2_OUTPUT)
+    v4l2_output_destroy(v4l2_output);
+    v4l2_output = NULL;
+#endif
     logger_destroy(render_logger);
     return 0;
 }
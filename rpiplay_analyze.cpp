@@ -0,0 +1,519 @@
+/**
+ * RPiPlay - An open-source AirPlay mirroring server for Raspberry Pi
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+/*
+ * Sums up captures taken with rpiplay --record without playing them: bitrate,
+ * GOP structure, jitter of the arrival times against the sender's timestamps
+ * and, for mirror sessions, the macroblock rate a decoder has to sustain.
+ * Captures are mapped and read through their index, the video frames are
+ * split between threads that each decrypt their share at its key offset, so
+ * an hour of mirroring takes seconds. A table goes to stderr and JSON to
+ * stdout.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include <unistd.h>
+
+extern "C" {
+#include "lib/logger.h"
+#include "lib/byteutils.h"
+#include "lib/mirror_buffer.h"
+#include "lib/mirror_capture.h"
+#include "lib/audio_capture.h"
+#include "lib/stream.h"
+}
+
+/* Samples per second of the RTP timestamps of audio captures */
+#define AUDIO_SAMPLE_RATE 44100
+/* Timestamp steps beyond this are a new stream rather than jitter, in us */
+#define MAX_TRANSIT_STEP 10000000
+
+typedef struct {
+    /* Set once the worker decrypted the frame */
+    bool parsed;
+    bool keyframe;
+    /* Nothing predicts from it, a decoder may skip it */
+    bool disposable;
+    int slices;
+} frame_result_t;
+
+typedef struct {
+    uint64_t index;
+    video_codec_t codec;
+    int width;
+    int height;
+} codec_change_t;
+
+typedef struct {
+    mirror_capture_map_t *map;
+    const mirror_capture_header_t *header;
+    const capture_file_index_entry_t *index;
+    const std::vector<codec_change_t> *codecs;
+    std::vector<frame_result_t> *results;
+    uint64_t begin;
+    uint64_t end;
+    logger_t *logger;
+    pthread_t thread;
+} worker_t;
+
+typedef struct {
+    double p50;
+    double p99;
+    double max;
+} percentiles_t;
+
+typedef struct {
+    std::string file;
+    std::string kind;
+    bool indexed;
+    double duration;
+    uint64_t frames;
+    uint64_t bytes;
+    double mean_kbps;
+    double peak_kbps;
+    /* RFC 3550 interarrival jitter, and the steps in transit time it is made of, in ms */
+    double jitter_ms;
+    percentiles_t transit_step;
+    percentiles_t interarrival;
+    /* Mirror sessions only */
+    std::string codec;
+    int width;
+    int height;
+    uint64_t keyframes;
+    uint64_t disposable;
+    uint64_t undecryptable;
+    double gop_min;
+    double gop_mean;
+    double gop_max;
+    double gop_seconds;
+    double keyframe_bytes;
+    double other_bytes;
+    double mean_fps;
+    double mean_mbps;
+    double peak_mbps;
+    std::string level;
+    /* Audio sessions only */
+    uint64_t control_packets;
+} report_t;
+
+/* Frames a decoder of each H.264 level can take in macroblocks per second, table A-1 */
+static const struct {
+    const char *name;
+    double max_mbps;
+} h264_levels[] = {
+    {"3.1", 108000}, {"3.2", 216000}, {"4.1", 245760}, {"4.2", 522240},
+    {"5.0", 589824}, {"5.1", 983040}, {"5.2", 2073600}, {"6.2", 16711680}
+};
+
+static percentiles_t get_percentiles(std::vector<double> &values) {
+    percentiles_t result = {0, 0, 0};
+    if (values.empty()) {
+        return result;
+    }
+    std::sort(values.begin(), values.end());
+    result.p50 = values[values.size() / 2];
+    result.p99 = values[std::min(values.size() - 1, (size_t) (values.size() * 0.99))];
+    result.max = values.back();
+    return result;
+}
+
+/* The codec change in force at frame index, NULL before the first one */
+static const codec_change_t *find_codec(const std::vector<codec_change_t> &codecs, uint64_t index) {
+    auto it = std::upper_bound(codecs.begin(), codecs.end(), index,
+                               [](uint64_t value, const codec_change_t &change) { return value < change.index; });
+    return it == codecs.begin() ? nullptr : &*(it - 1);
+}
+
+/* Same test as raop_rtp_mirror: an hvcC has reserved bits set where an avcC has profile data */
+static bool is_hvcc(const unsigned char *payload, uint32_t payload_size) {
+    if (payload_size < 23 || payload[0] != 1 || (payload[4] & 0xfc) == 0xfc) {
+        return false;
+    }
+    return (payload[13] & 0xf0) == 0xf0 && (payload[15] & 0xfc) == 0xfc && (payload[16] & 0xfc) == 0xfc &&
+           (payload[17] & 0xf8) == 0xf8 && (payload[18] & 0xf8) == 0xf8;
+}
+
+/* Decrypts the video frames of its range and finds their NAL units, results go to the frames' own slots */
+static void *worker_thread(void *arg) {
+    worker_t *worker = (worker_t *) arg;
+    std::vector<unsigned char> payload;
+    mirror_buffer_t *buffer = mirror_buffer_init(worker->logger, worker->header->aeskey, worker->header->ecdh_secret);
+    if (!buffer) {
+        return NULL;
+    }
+    mirror_buffer_init_aes(buffer, worker->header->stream_connection_id);
+
+    for (uint64_t i = worker->begin; i < worker->end; i++) {
+        const capture_file_index_entry_t *entry = &worker->index[i];
+        mirror_capture_frame_t frame;
+        if (entry->type != 0 || entry->payload_size < 5) {
+            continue;
+        }
+        const codec_change_t *codec = find_codec(*worker->codecs, i);
+        const unsigned char *record = capture_file_map_get_record(worker->map, entry);
+        memcpy(&frame, record, sizeof(frame));
+        if (!codec || !frame.has_key_offset) {
+            continue;
+        }
+        payload.assign(record + sizeof(frame), record + sizeof(frame) + entry->payload_size);
+        mirror_buffer_seek(buffer, frame.key_offset);
+        mirror_buffer_decrypt_in_place(buffer, payload.data(), (int) payload.size());
+
+        frame_result_t &result = (*worker->results)[i];
+        bool first_slice = true;
+        size_t pos = 0;
+        while (pos + 4 < payload.size()) {
+            uint32_t nal_size = byteutils_get_int_be(payload.data(), (int) pos);
+            pos += 4;
+            if (nal_size == 0 || nal_size > payload.size() - pos) {
+                break;
+            }
+            int nal_type = video_nal_type(codec->codec, payload[pos]);
+            if (video_nal_is_slice(codec->codec, nal_type)) {
+                result.keyframe |= video_nal_is_keyframe(codec->codec, nal_type);
+                if (first_slice) {
+                    result.disposable = video_nal_is_disposable(codec->codec, payload[pos]);
+                    first_slice = false;
+                }
+                result.slices++;
+            }
+            pos += nal_size;
+        }
+        // A wrong key gives random lengths, which end the walk before a slice is found
+        result.parsed = result.slices > 0;
+    }
+    mirror_buffer_destroy(buffer);
+    return NULL;
+}
+
+/* Bitrate per second of arrival time, and the transit steps between consecutive frames */
+static void add_timing(report_t *report, const capture_file_index_entry_t *index,
+                       const std::vector<uint64_t> &frames, double pts_per_us) {
+    std::map<uint64_t, uint64_t> second_bytes;
+    std::vector<double> steps, interarrival;
+    double jitter = 0;
+
+    if (frames.empty()) {
+        return;
+    }
+    uint64_t first = index[frames.front()].arrival_time;
+    uint64_t last = index[frames.back()].arrival_time;
+    for (size_t i = 0; i < frames.size(); i++) {
+        const capture_file_index_entry_t *entry = &index[frames[i]];
+        report->bytes += entry->payload_size;
+        second_bytes[(entry->arrival_time - first) / 1000000] += entry->payload_size;
+        if (i == 0) {
+            continue;
+        }
+        const capture_file_index_entry_t *prev = &index[frames[i - 1]];
+        double arrival_step = (double) entry->arrival_time - (double) prev->arrival_time;
+        double pts_step = ((double) entry->pts - (double) prev->pts) / pts_per_us;
+        interarrival.push_back(arrival_step / 1000.0);
+        double d = std::fabs(arrival_step - pts_step);
+        if (d > MAX_TRANSIT_STEP) {
+            continue;
+        }
+        steps.push_back(d / 1000.0);
+        jitter += (d - jitter) / 16.0;
+    }
+    report->frames = frames.size();
+    report->duration = (last - first) / 1000000.0;
+    report->mean_kbps = report->duration > 0 ? report->bytes * 8 / report->duration / 1000.0 : 0;
+    for (auto &second : second_bytes) {
+        report->peak_kbps = std::max(report->peak_kbps, second.second * 8 / 1000.0);
+    }
+    report->jitter_ms = jitter / 1000.0;
+    report->transit_step = get_percentiles(steps);
+    report->interarrival = get_percentiles(interarrival);
+}
+
+static bool analyze_mirror(logger_t *logger, const char *filename, int threads, report_t *report) {
+    mirror_capture_header_t header;
+    mirror_capture_map_t *map = mirror_capture_map_open(filename, &header);
+    uint64_t count;
+
+    if (!map) {
+        return false;
+    }
+    const capture_file_index_entry_t *index = capture_file_map_get_index(map, &count);
+    report->kind = "mirror";
+    report->indexed = capture_file_map_is_indexed(map);
+
+    // Codec frames are not encrypted and few, the workers look up the one in force for each frame
+    std::vector<codec_change_t> codecs;
+    std::vector<uint64_t> video;
+    for (uint64_t i = 0; i < count; i++) {
+        if (index[i].type == 1) {
+            mirror_capture_frame_t frame;
+            const unsigned char *record = capture_file_map_get_record(map, &index[i]);
+            memcpy(&frame, record, sizeof(frame));
+            codec_change_t change;
+            change.index = i;
+            change.codec = is_hvcc(record + sizeof(frame), index[i].payload_size) ? VIDEO_CODEC_H265 : VIDEO_CODEC_H264;
+            change.width = (int) byteutils_get_float(frame.header, 56);
+            change.height = (int) byteutils_get_float(frame.header, 60);
+            codecs.push_back(change);
+        } else if (index[i].type == 0) {
+            video.push_back(i);
+        }
+    }
+
+    std::vector<frame_result_t> results(count);
+    std::vector<worker_t> workers(threads);
+    uint64_t per_worker = (count + threads - 1) / threads;
+    for (int i = 0; i < threads; i++) {
+        worker_t *worker = &workers[i];
+        worker->map = map;
+        worker->header = &header;
+        worker->index = index;
+        worker->codecs = &codecs;
+        worker->results = &results;
+        worker->begin = std::min(count, i * per_worker);
+        worker->end = std::min(count, (i + 1) * per_worker);
+        worker->logger = logger;
+        if (pthread_create(&worker->thread, NULL, worker_thread, worker)) {
+            worker_thread(worker);
+            worker->thread = 0;
+        }
+    }
+    for (int i = 0; i < threads; i++) {
+        if (workers[i].thread) {
+            pthread_join(workers[i].thread, NULL);
+        }
+    }
+
+    add_timing(report, index, video, 1.0);
+
+    // GOP structure and the macroblocks decoded per second of arrival time
+    std::map<uint64_t, double> second_mbs;
+    std::vector<double> gops;
+    uint64_t gop_frames = 0, keyframe_bytes = 0, other_bytes = 0, last_keyframe_time = 0;
+    double gop_time = 0;
+    const codec_change_t *last_codec = nullptr;
+    uint64_t first_arrival = video.empty() ? 0 : index[video.front()].arrival_time;
+    for (uint64_t i : video) {
+        const frame_result_t &result = results[i];
+        const codec_change_t *codec = find_codec(codecs, i);
+        if (!result.parsed || !codec) {
+            report->undecryptable++;
+            continue;
+        }
+        last_codec = codec;
+        second_mbs[(index[i].arrival_time - first_arrival) / 1000000] +=
+            (double) ((codec->width + 15) / 16) * ((codec->height + 15) / 16);
+        if (result.keyframe) {
+            if (report->keyframes > 0) {
+                gops.push_back((double) gop_frames);
+                gop_time += (index[i].arrival_time - last_keyframe_time) / 1000000.0;
+            }
+            report->keyframes++;
+            keyframe_bytes += index[i].payload_size;
+            last_keyframe_time = index[i].arrival_time;
+            gop_frames = 0;
+        } else {
+            other_bytes += index[i].payload_size;
+        }
+        report->disposable += result.disposable;
+        gop_frames++;
+    }
+    if (last_codec) {
+        report->codec = last_codec->codec == VIDEO_CODEC_H265 ? "h265" : "h264";
+        report->width = last_codec->width;
+        report->height = last_codec->height;
+    }
+    if (!gops.empty()) {
+        report->gop_min = *std::min_element(gops.begin(), gops.end());
+        report->gop_max = *std::max_element(gops.begin(), gops.end());
+        double sum = 0;
+        for (double gop : gops) sum += gop;
+        report->gop_mean = sum / gops.size();
+        report->gop_seconds = gop_time / gops.size();
+    }
+    uint64_t decoded = report->frames - report->undecryptable;
+    report->keyframe_bytes = report->keyframes ? (double) keyframe_bytes / report->keyframes : 0;
+    report->other_bytes = decoded > report->keyframes ? (double) other_bytes / (decoded - report->keyframes) : 0;
+    double total_mbs = 0;
+    for (auto &second : second_mbs) {
+        total_mbs += second.second;
+        report->peak_mbps = std::max(report->peak_mbps, second.second);
+    }
+    report->mean_fps = report->duration > 0 ? decoded / report->duration : 0;
+    report->mean_mbps = report->duration > 0 ? total_mbs / report->duration : 0;
+    report->level = "above 6.2";
+    for (size_t i = 0; i < sizeof(h264_levels) / sizeof(h264_levels[0]); i++) {
+        if (report->peak_mbps <= h264_levels[i].max_mbps) {
+            report->level = h264_levels[i].name;
+            break;
+        }
+    }
+    capture_file_map_close(map);
+    return true;
+}
+
+static bool analyze_audio(const char *filename, report_t *report) {
+    audio_capture_header_t header;
+    audio_capture_map_t *map = audio_capture_map_open(filename, &header);
+    uint64_t count;
+
+    if (!map) {
+        return false;
+    }
+    const capture_file_index_entry_t *index = capture_file_map_get_index(map, &count);
+    report->kind = "audio";
+    report->indexed = capture_file_map_is_indexed(map);
+    std::vector<uint64_t> packets;
+    for (uint64_t i = 0; i < count; i++) {
+        if (index[i].type == AUDIO_CAPTURE_CHANNEL_DATA) {
+            packets.push_back(i);
+        } else {
+            report->control_packets++;
+        }
+    }
+    // Resent packets arrive out of order, the jitter is of the packets in arrival order as RFC 3550 has it
+    add_timing(report, index, packets, AUDIO_SAMPLE_RATE / 1000000.0);
+    capture_file_map_close(map);
+    return true;
+}
+
+static void print_table(const report_t &report) {
+    fprintf(stderr, "%s (%s%s)\n", report.file.c_str(), report.kind.c_str(), report.indexed ? "" : ", no index");
+    fprintf(stderr, "  %.1f s, %llu %s, %.0f kbit/s mean, %.0f kbit/s peak\n", report.duration,
+            (unsigned long long) report.frames, report.kind == "mirror" ? "frames" : "packets",
+            report.mean_kbps, report.peak_kbps);
+    fprintf(stderr, "  jitter %.2f ms, transit steps p50 %.2f p99 %.2f max %.1f ms, interarrival p50 %.1f p99 %.1f max %.1f ms\n",
+            report.jitter_ms, report.transit_step.p50, report.transit_step.p99, report.transit_step.max,
+            report.interarrival.p50, report.interarrival.p99, report.interarrival.max);
+    if (report.kind == "mirror") {
+        fprintf(stderr, "  %s %dx%d, %.1f fps, %llu keyframes, GOP %.0f/%.1f/%.0f frames (%.1f s), %llu disposable\n",
+                report.codec.c_str(), report.width, report.height, report.mean_fps, (unsigned long long) report.keyframes,
+                report.gop_min, report.gop_mean, report.gop_max, report.gop_seconds, (unsigned long long) report.disposable);
+        fprintf(stderr, "  keyframes %.0f bytes, other frames %.0f bytes, %.0f MB/s mean, %.0f MB/s peak (level %s)%s\n",
+                report.keyframe_bytes, report.other_bytes, report.mean_mbps, report.peak_mbps, report.level.c_str(),
+                report.undecryptable ? ", some frames could not be decrypted" : "");
+    } else {
+        fprintf(stderr, "  %llu control packets\n", (unsigned long long) report.control_packets);
+    }
+}
+
+static std::string json_escape(const std::string &value) {
+    std::string escaped;
+    for (char c : value) {
+        if (c == '"' || c == '\\') {
+            escaped += '\\';
+            escaped += c;
+        } else if ((unsigned char) c >= 0x20) {
+            escaped += c;
+        }
+    }
+    return escaped;
+}
+
+static void print_json(const std::vector<report_t> &reports) {
+    printf("{\n");
+    printf("  \"captures\": [\n");
+    for (size_t i = 0; i < reports.size(); i++) {
+        const report_t &r = reports[i];
+        printf("    {\"file\": \"%s\", \"kind\": \"%s\", \"indexed\": %s, \"duration_s\": %.3f, \"frames\": %llu, "
+               "\"bytes\": %llu, \"mean_kbps\": %.1f, \"peak_kbps\": %.1f, \"jitter_ms\": %.3f, "
+               "\"transit_step_ms\": {\"p50\": %.3f, \"p99\": %.3f, \"max\": %.3f}, "
+               "\"interarrival_ms\": {\"p50\": %.3f, \"p99\": %.3f, \"max\": %.3f}",
+               json_escape(r.file).c_str(), r.kind.c_str(), r.indexed ? "true" : "false", r.duration,
+               (unsigned long long) r.frames, (unsigned long long) r.bytes, r.mean_kbps, r.peak_kbps, r.jitter_ms,
+               r.transit_step.p50, r.transit_step.p99, r.transit_step.max,
+               r.interarrival.p50, r.interarrival.p99, r.interarrival.max);
+        if (r.kind == "mirror") {
+            printf(", \"codec\": \"%s\", \"width\": %d, \"height\": %d, \"mean_fps\": %.2f, \"keyframes\": %llu, "
+                   "\"gop_frames\": {\"min\": %.0f, \"mean\": %.2f, \"max\": %.0f}, \"gop_s\": %.3f, \"disposable\": %llu, "
+                   "\"keyframe_bytes\": %.0f, \"other_frame_bytes\": %.0f, \"mean_mbps\": %.0f, \"peak_mbps\": %.0f, "
+                   "\"h264_level\": \"%s\", \"undecryptable\": %llu}",
+                   r.codec.c_str(), r.width, r.height, r.mean_fps, (unsigned long long) r.keyframes,
+                   r.gop_min, r.gop_mean, r.gop_max, r.gop_seconds, (unsigned long long) r.disposable,
+                   r.keyframe_bytes, r.other_bytes, r.mean_mbps, r.peak_mbps, r.level.c_str(),
+                   (unsigned long long) r.undecryptable);
+        } else {
+            printf(", \"control_packets\": %llu}", (unsigned long long) r.control_packets);
+        }
+        printf("%s\n", i + 1 < reports.size() ? "," : "");
+    }
+    printf("  ]\n");
+    printf("}\n");
+}
+
+void print_info(char *name) {
+    printf("Usage: %s [options] capture...\n", name);
+    printf("Options:\n");
+    printf("-j threads            Threads decrypting mirror captures (default: one per core)\n");
+    printf("-h                    Displays this help\n");
+}
+
+int main(int argc, char *argv[]) {
+    std::vector<std::string> files;
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    int threads = cores > 0 ? (int) cores : 1;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg(argv[i]);
+        if (arg == "-j") {
+            if (i == argc - 1) continue;
+            threads = atoi(argv[++i]);
+        } else if (arg == "-h") {
+            print_info(argv[0]);
+            exit(0);
+        } else {
+            files.push_back(arg);
+        }
+    }
+    if (files.empty()) {
+        fprintf(stderr, "Error: No capture given.\n");
+        exit(1);
+    }
+    if (threads < 1) {
+        threads = 1;
+    }
+
+    logger_t *logger = logger_init();
+    logger_set_level(logger, LOGGER_ERR);
+
+    std::vector<report_t> reports;
+    int ret = 0;
+    for (const std::string &file : files) {
+        report_t report = report_t();
+        report.file = file;
+        if (!analyze_mirror(logger, file.c_str(), threads, &report) && !analyze_audio(file.c_str(), &report)) {
+            fprintf(stderr, "Error: %s is no capture of rpiplay --record.\n", file.c_str());
+            ret = 1;
+            continue;
+        }
+        print_table(report);
+        reports.push_back(report);
+    }
+
+    print_json(reports);
+    logger_destroy(logger);
+    return ret;
+}
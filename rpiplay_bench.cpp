@@ -0,0 +1,1305 @@
+/**
+ * RPiPlay - An open-source AirPlay mirroring server for Raspberry Pi
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+/*
+ * Micro-benchmarks for the per-packet and per-frame paths in lib/, printed
+ * as JSON on stdout so runs on different boards and builds can be compared
+ * with a script. With -check it instead compares the output of those paths
+ * against known results and exits non-zero if one differs.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <time.h>
+#include <sys/utsname.h>
+
+extern "C" {
+#include "lib/logger.h"
+#include "lib/mirror_buffer.h"
+#include "lib/raop_buffer.h"
+#include "lib/raop_ntp.h"
+#include "lib/raop_rtp.h"
+#include "lib/raop_rtp_mirror.h"
+#include "lib/http_request.h"
+#include "lib/audio_capture.h"
+#include "lib/stream.h"
+#include "lib/crypto.h"
+#include "lib/pairing.h"
+#include "lib/fairplay.h"
+#include "lib/cpu_features.h"
+}
+#include "renderers/dsp_kernels.h"
+extern "C" {
+#include "renderers/h264_sps_patch.h"
+}
+#if defined(HAS_AAC_DECODER)
+#include "renderers/aac_decoder.h"
+#endif
+
+#define DEFAULT_MIN_TIME 0.5
+
+typedef struct bench_result_s {
+    std::string name;
+    int size;
+    uint64_t iterations;
+    double ns_per_op;
+    /* Payload bytes per op, 0 for benchmarks without a meaningful throughput */
+    int bytes_per_op;
+} bench_result_t;
+
+/* Runs one batch of iterations of a benchmark */
+typedef void (*bench_func_t)(void *opaque, uint64_t iterations);
+
+static double min_time = DEFAULT_MIN_TIME;
+static const char *filter = nullptr;
+static std::vector<bench_result_t> results;
+static int check_failures = 0;
+
+static const unsigned char bench_aeskey[16] = {
+    0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6, 0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c
+};
+static const unsigned char bench_aesiv[16] = {
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f
+};
+static const unsigned char bench_ecdh_secret[32] = { 0x42 };
+
+static uint64_t now_ns() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (uint64_t) time.tv_sec * 1000000000ULL + time.tv_nsec;
+}
+
+/* Doubles the batch until one batch takes at least min_time, then reports that batch */
+static void run_bench(const std::string &name, int size, int bytes_per_op, bench_func_t func, void *opaque) {
+    if (filter && name.find(filter) == std::string::npos) {
+        return;
+    }
+    uint64_t iterations = 1;
+    uint64_t elapsed;
+    while (1) {
+        uint64_t start = now_ns();
+        func(opaque, iterations);
+        elapsed = now_ns() - start;
+        if (elapsed >= (uint64_t) (min_time * 1e9) || iterations >= (1ULL << 40)) {
+            break;
+        }
+        // Aim a bit past min_time so the last batch does not fall just short
+        uint64_t next = elapsed > 0 ? (uint64_t) (iterations * min_time * 1.2e9 / elapsed) : iterations * 100;
+        iterations = next > iterations * 100 ? iterations * 100 : next > iterations ? next : iterations * 2;
+    }
+    bench_result_t result;
+    result.name = name;
+    result.size = size;
+    result.iterations = iterations;
+    result.ns_per_op = (double) elapsed / iterations;
+    result.bytes_per_op = bytes_per_op;
+    results.push_back(result);
+    fprintf(stderr, "%-24s %8d %14.1f ns/op\n", name.c_str(), size, result.ns_per_op);
+}
+
+static void check(const std::string &name, bool passed) {
+    if (filter && name.find(filter) == std::string::npos) {
+        return;
+    }
+    fprintf(stderr, "%-32s %s\n", name.c_str(), passed ? "ok" : "FAILED");
+    if (!passed) {
+        check_failures++;
+    }
+}
+
+/*
+ * A 720p baseline SPS without a VUI, and what the rewrite makes of it for reorder depths 4 and 1:
+ * a VUI with every flag cleared but the bitstream restriction, as h264-bitstream writes it.
+ */
+static void check_sps_patch(logger_t *logger) {
+    static const unsigned char codec_data[] = {
+        0x00, 0x00, 0x00, 0x01, 0x67, 0x42, 0xc0, 0x1f, 0xf4, 0x02, 0x80, 0x2d, 0xc8,
+        0x00, 0x00, 0x00, 0x01, 0x68, 0xce, 0x3c, 0x80
+    };
+    static const unsigned char patched_depth_4[] = {
+        0x00, 0x00, 0x00, 0x01, 0x67, 0x42, 0xc0, 0x1f, 0xf4, 0x02, 0x80, 0x2d, 0xd0, 0x0d, 0xa0, 0x88, 0x44, 0xa5, 0x80,
+        0x00, 0x00, 0x00, 0x01, 0x68, 0xce, 0x3c, 0x80
+    };
+    static const unsigned char patched_depth_1[] = {
+        0x00, 0x00, 0x00, 0x01, 0x67, 0x42, 0xc0, 0x1f, 0xf4, 0x02, 0x80, 0x2d, 0xd0, 0x0d, 0xa0, 0x88, 0x45, 0x28,
+        0x00, 0x00, 0x00, 0x01, 0x68, 0xce, 0x3c, 0x80
+    };
+    const struct {
+        int depth;
+        const unsigned char *expected;
+        int expected_len;
+    } cases[] = {
+        { 4, patched_depth_4, (int) sizeof(patched_depth_4) },
+        { 1, patched_depth_1, (int) sizeof(patched_depth_1) },
+    };
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        h264_sps_patch_t *patch = h264_sps_patch_init(logger, H264_SPS_PATCH_REWRITE, cases[i].depth);
+        bool passed = true;
+        // The second round comes out of the cache
+        for (int round = 0; round < 2; round++) {
+            std::vector<unsigned char> data(codec_data, codec_data + sizeof(codec_data));
+            int data_len = (int) data.size();
+            unsigned char *patched = h264_sps_patch_apply(patch, data.data(), &data_len, NULL, 0);
+            passed = passed && data_len == cases[i].expected_len && !memcmp(patched, cases[i].expected, data_len);
+        }
+        h264_sps_patch_destroy(patch);
+        check("sps_patch_no_vui_depth_" + std::to_string(cases[i].depth), passed);
+    }
+}
+
+/*
+ * mirror_buffer_decrypt as it was before the CTR context carried the keystream position between
+ * frames: the unused end of a frame's last block is kept and XORed into the next frame by hand.
+ * It only holds for frames at least as long as that rest, every frame here has a block or more.
+ */
+typedef struct {
+    aes_ctx_t *ctx;
+    uint8_t og[16];
+    int next_decrypt_count;
+} legacy_mirror_buffer_t;
+
+static void legacy_mirror_decrypt(legacy_mirror_buffer_t *legacy, const unsigned char *input, unsigned char *output, int len) {
+    for (int i = 0; i < legacy->next_decrypt_count; i++) {
+        output[i] = input[i] ^ legacy->og[16 - legacy->next_decrypt_count + i];
+    }
+    int encrypt_len = (len - legacy->next_decrypt_count) / 16 * 16;
+    aes_ctr_decrypt(legacy->ctx, input + legacy->next_decrypt_count, output + legacy->next_decrypt_count, encrypt_len);
+    int rest_len = (len - legacy->next_decrypt_count) % 16;
+    int rest_start = len - rest_len;
+    legacy->next_decrypt_count = 0;
+    if (rest_len > 0) {
+        memset(legacy->og, 0, 16);
+        memcpy(legacy->og, input + rest_start, rest_len);
+        aes_ctr_decrypt(legacy->ctx, legacy->og, legacy->og, 16);
+        memcpy(output + rest_start, legacy->og, rest_len);
+        legacy->next_decrypt_count = 16 - rest_len;
+    }
+}
+
+static void legacy_mirror_seek(legacy_mirror_buffer_t *legacy, uint64_t offset) {
+    aes_ctr_seek(legacy->ctx, offset / 16);
+    legacy->next_decrypt_count = 0;
+    if (offset % 16 > 0) {
+        memset(legacy->og, 0, 16);
+        aes_ctr_decrypt(legacy->ctx, legacy->og, legacy->og, 16);
+        legacy->next_decrypt_count = 16 - (int) (offset % 16);
+    }
+}
+
+/* The stream key and IV mirror_buffer_init_aes derives, done over here so the reference shares no code with it */
+static aes_ctx_t *legacy_mirror_init_aes(uint64_t stream_connection_id) {
+    unsigned char eaeskey[64] = {};
+    unsigned char hash1[64], hash2[64];
+    char label[64];
+    sha_ctx_t *ctx = sha_init();
+
+    sha_update(ctx, bench_aeskey, 16);
+    sha_update(ctx, bench_ecdh_secret, 32);
+    sha_final(ctx, eaeskey, NULL);
+    snprintf(label, sizeof(label), "AirPlayStreamKey%" PRIu64, stream_connection_id);
+    sha_reset(ctx);
+    sha_update(ctx, (const uint8_t *) label, (int) strlen(label));
+    sha_update(ctx, eaeskey, 16);
+    sha_final(ctx, hash1, NULL);
+    snprintf(label, sizeof(label), "AirPlayStreamIV%" PRIu64, stream_connection_id);
+    sha_reset(ctx);
+    sha_update(ctx, (const uint8_t *) label, (int) strlen(label));
+    sha_update(ctx, eaeskey, 16);
+    sha_final(ctx, hash2, NULL);
+    sha_destroy(ctx);
+    return aes_ctr_init(hash1, hash2);
+}
+
+/*
+ * A synthetic stream, as there are no recorded ones: frames of 16 bytes to 64 KiB, with seeks forward
+ * to any offset now and then as after a lost UDP frame, must decrypt exactly as the old code did.
+ * Frames shorter than a block, which the old code got wrong, must match one decrypt of the whole stream.
+ */
+static void check_mirror_buffer(logger_t *logger) {
+    const uint64_t connection_id = 2497441178417290163ULL;
+    uint32_t seed = 12345;
+    auto next_random = [&seed](uint32_t range) {
+        seed = seed * 1103515245 + 12345;
+        return (seed >> 8) % range;
+    };
+
+    mirror_buffer_t *buffer = mirror_buffer_init(logger, bench_aeskey, bench_ecdh_secret);
+    mirror_buffer_init_aes(buffer, connection_id);
+    legacy_mirror_buffer_t legacy = {};
+    legacy.ctx = legacy_mirror_init_aes(connection_id);
+    bool passed = true;
+    uint64_t offset = 0;
+    for (int frame = 0; frame < 2000 && passed; frame++) {
+        if (next_random(10) == 0) {
+            offset += next_random(100000);
+            mirror_buffer_seek(buffer, offset);
+            legacy_mirror_seek(&legacy, offset);
+        }
+        int len = 16 + (int) next_random(65536 - 16 + 1);
+        std::vector<unsigned char> input(len), output(len), expected(len);
+        for (int i = 0; i < len; i++) input[i] = (unsigned char) next_random(256);
+        mirror_buffer_decrypt(buffer, input.data(), output.data(), len);
+        legacy_mirror_decrypt(&legacy, input.data(), expected.data(), len);
+        passed = output == expected && mirror_buffer_get_offset(buffer) == offset + len;
+        offset += len;
+    }
+    aes_ctr_destroy(legacy.ctx);
+    mirror_buffer_destroy(buffer);
+    check("mirror_buffer_legacy_frames", passed);
+
+    buffer = mirror_buffer_init(logger, bench_aeskey, bench_ecdh_secret);
+    mirror_buffer_init_aes(buffer, connection_id);
+    std::vector<unsigned char> stream(100000), output(stream.size()), expected(stream.size());
+    for (size_t i = 0; i < stream.size(); i++) stream[i] = (unsigned char) next_random(256);
+    size_t pos = 0;
+    while (pos < stream.size()) {
+        size_t len = next_random(20);
+        if (len > stream.size() - pos) len = stream.size() - pos;
+        mirror_buffer_decrypt(buffer, stream.data() + pos, output.data() + pos, (int) len);
+        pos += len;
+    }
+    mirror_buffer_destroy(buffer);
+    legacy = {};
+    legacy.ctx = legacy_mirror_init_aes(connection_id);
+    legacy_mirror_decrypt(&legacy, stream.data(), expected.data(), (int) stream.size());
+    aes_ctr_destroy(legacy.ctx);
+    check("mirror_buffer_short_frames", output == expected);
+}
+
+/*
+ * FairPlay setup messages and ciphertexts from a fixed generator, mode i % 4 each, with the keys
+ * playfair_decrypt gave for them before its arithmetic was replaced by tables
+ */
+static void fairplay_messages(unsigned char setup[16], unsigned char handshake[164], unsigned char cipher[72], int i) {
+    uint32_t seed = 54321;
+    for (int n = 0; n <= i; n++) {
+        for (int j = 0; j < 164; j++) {
+            seed = seed * 1103515245 + 12345;
+            handshake[j] = (unsigned char) (seed >> 16);
+        }
+        for (int j = 0; j < 72; j++) {
+            seed = seed * 1103515245 + 12345;
+            cipher[j] = (unsigned char) (seed >> 16);
+        }
+    }
+    handshake[4] = 0x03;
+    handshake[12] = (unsigned char) (i % 4);
+    memset(setup, 0, 16);
+    setup[4] = 0x03;
+    setup[14] = (unsigned char) (i % 4);
+}
+
+static void check_fairplay(logger_t *logger) {
+    static const unsigned char expected[8][16] = {
+        { 0x4b, 0x4a, 0xb2, 0x0e, 0xa0, 0xc4, 0x71, 0xd3, 0x1e, 0x41, 0xae, 0x06, 0xac, 0x4a, 0xfe, 0x1c },
+        { 0x15, 0x2f, 0xcb, 0x51, 0x4b, 0xab, 0x87, 0xb1, 0x17, 0xf0, 0x19, 0x1d, 0xfc, 0x82, 0xb6, 0x02 },
+        { 0x50, 0x9e, 0x82, 0x7a, 0x55, 0x36, 0x83, 0x51, 0xb9, 0xa4, 0x53, 0x7b, 0x32, 0xb4, 0x46, 0xe5 },
+        { 0xf9, 0xba, 0x4f, 0x18, 0x4b, 0x2a, 0x29, 0xc4, 0x39, 0xd3, 0x13, 0x5b, 0x63, 0xcc, 0x61, 0x58 },
+        { 0xa6, 0x45, 0x40, 0x82, 0x68, 0xe6, 0x3e, 0xaa, 0x63, 0xca, 0xda, 0x3a, 0xf6, 0xc7, 0xc3, 0x47 },
+        { 0xa9, 0x3d, 0xfc, 0x90, 0xac, 0x2d, 0xe0, 0x8f, 0x17, 0xab, 0xbd, 0x7d, 0xcf, 0x4b, 0x28, 0x09 },
+        { 0xcf, 0x6c, 0xb9, 0x2d, 0x37, 0x82, 0xc9, 0xb5, 0xae, 0x8f, 0x14, 0xa2, 0xd9, 0x07, 0xfb, 0xbd },
+        { 0x70, 0xad, 0xc8, 0x5c, 0xc1, 0x76, 0xc4, 0xb8, 0xcb, 0xa3, 0x98, 0xab, 0x11, 0x12, 0xcc, 0xd8 },
+    };
+    for (int i = 0; i < 8; i++) {
+        unsigned char setup[16], handshake[164], cipher[72], reply[142], key[16];
+        fairplay_messages(setup, handshake, cipher, i);
+        fairplay_t *fp = fairplay_init(logger);
+        bool passed = fairplay_setup(fp, setup, reply) == 0 && fairplay_handshake(fp, handshake, reply) == 0 &&
+                      fairplay_decrypt(fp, cipher, key) == 0 && !memcmp(key, expected[i], 16);
+        fairplay_destroy(fp);
+        check("fairplay_decrypt_mode_" + std::to_string(i % 4) + (i < 4 ? "" : "_b"), passed);
+    }
+}
+
+static int run_checks(logger_t *logger) {
+    check_sps_patch(logger);
+    check_mirror_buffer(logger);
+    check_fairplay(logger);
+    return check_failures > 0 ? 1 : 0;
+}
+
+typedef struct {
+    mirror_buffer_t *buffer;
+    std::vector<unsigned char> data;
+} mirror_decrypt_bench_t;
+
+static void mirror_decrypt_bench(void *opaque, uint64_t iterations) {
+    mirror_decrypt_bench_t *bench = (mirror_decrypt_bench_t *) opaque;
+    for (uint64_t i = 0; i < iterations; i++) {
+        mirror_buffer_decrypt_in_place(bench->buffer, bench->data.data(), (int) bench->data.size());
+    }
+}
+
+typedef struct {
+    aes_ctx_t *ctx;
+    std::vector<unsigned char> data;
+} aes_bench_t;
+
+static void aes_ctr_bench(void *opaque, uint64_t iterations) {
+    aes_bench_t *bench = (aes_bench_t *) opaque;
+    for (uint64_t i = 0; i < iterations; i++) {
+        aes_ctr_reset(bench->ctx);
+        aes_ctr_decrypt(bench->ctx, bench->data.data(), bench->data.data(), (int) bench->data.size());
+    }
+}
+
+static void aes_cbc_bench(void *opaque, uint64_t iterations) {
+    aes_bench_t *bench = (aes_bench_t *) opaque;
+    aes_batch_item_t item = { bench->data.data(), bench->data.data(), (int) bench->data.size(), NULL };
+    for (uint64_t i = 0; i < iterations; i++) {
+        aes_decrypt_batch(bench->ctx, &item, 1);
+    }
+}
+
+typedef struct {
+    raop_buffer_t *buffer;
+    std::vector<unsigned char> packet;
+    std::vector<unsigned char> output;
+} audio_decrypt_bench_t;
+
+static void audio_decrypt_bench(void *opaque, uint64_t iterations) {
+    audio_decrypt_bench_t *bench = (audio_decrypt_bench_t *) opaque;
+    unsigned int output_len;
+    for (uint64_t i = 0; i < iterations; i++) {
+        raop_buffer_decrypt(bench->buffer, bench->packet.data(), bench->output.data(),
+                            (unsigned int) bench->packet.size() - 12, &output_len);
+    }
+}
+
+typedef struct {
+    raop_buffer_t *buffer;
+    std::vector<unsigned char> packet;
+    unsigned short seqnum;
+    uint64_t timestamp;
+} jitter_buffer_bench_t;
+
+/* One op is a packet through enqueue and dequeue, every other pair of packets arrives swapped */
+static void jitter_buffer_bench(void *opaque, uint64_t iterations) {
+    jitter_buffer_bench_t *bench = (jitter_buffer_bench_t *) opaque;
+    unsigned char *packet = bench->packet.data();
+    for (uint64_t i = 0; i < iterations; i++) {
+        unsigned short seqnum = bench->seqnum + i;
+        if ((seqnum & 3) == 0) {
+            seqnum++;
+        } else if ((seqnum & 3) == 1) {
+            seqnum--;
+        }
+        uint32_t rtp_timestamp = (uint32_t) seqnum * 352;
+        packet[2] = seqnum >> 8;
+        packet[3] = seqnum;
+        packet[4] = rtp_timestamp >> 24;
+        packet[5] = rtp_timestamp >> 16;
+        packet[6] = rtp_timestamp >> 8;
+        packet[7] = rtp_timestamp;
+        raop_buffer_enqueue(bench->buffer, packet, (unsigned short) bench->packet.size(),
+                            bench->timestamp + (uint64_t) seqnum * 7982, 0, 1);
+
+        unsigned int payload_size;
+        uint64_t timestamp;
+        int lost;
+        while (raop_buffer_dequeue(bench->buffer, &payload_size, &timestamp, 0, &lost) || lost) {
+        }
+    }
+    bench->seqnum += iterations;
+}
+
+typedef struct {
+    std::vector<unsigned char> frame;
+    h264_nal_unit_t nal_units[H264_MAX_NAL_UNITS];
+} nal_rewrite_bench_t;
+
+typedef struct {
+    mirror_buffer_t *buffer;
+    bool fused;
+    std::vector<unsigned char> encrypted;
+    std::vector<unsigned char> frame;
+    h264_nal_unit_t nal_units[H264_MAX_NAL_UNITS];
+} mirror_decrypt_nals_bench_t;
+
+static void mirror_decrypt_nals_bench(void *opaque, uint64_t iterations) {
+    mirror_decrypt_nals_bench_t *bench = (mirror_decrypt_nals_bench_t *) opaque;
+    unsigned char *data = bench->frame.data();
+    int size = (int) bench->frame.size();
+    int nal_count;
+    for (uint64_t i = 0; i < iterations; i++) {
+        // Start over from the same ciphertext, so every round walks valid lengths
+        memcpy(data, bench->encrypted.data(), size);
+        mirror_buffer_seek(bench->buffer, 0);
+        if (bench->fused) {
+            raop_rtp_mirror_decrypt_nals(bench->buffer, data, size, VIDEO_CODEC_H264, bench->nal_units, &nal_count);
+        } else {
+            mirror_buffer_decrypt_in_place(bench->buffer, data, size);
+            raop_rtp_mirror_rewrite_nals(data, size, VIDEO_CODEC_H264, bench->nal_units, &nal_count);
+        }
+    }
+}
+
+typedef struct {
+    void (*gain)(int16_t *samples, int count, int16_t gain);
+    void (*unmix)(const int32_t *u, const int32_t *v, int16_t *out, int count, int mix_bits, int mix_res);
+    std::vector<int16_t> samples;
+    std::vector<int32_t> u;
+    std::vector<int32_t> v;
+} dsp_bench_t;
+
+static void pcm_gain_bench(void *opaque, uint64_t iterations) {
+    dsp_bench_t *bench = (dsp_bench_t *) opaque;
+    for (uint64_t i = 0; i < iterations; i++) {
+        // Close to unity so the samples don't decay to 0 over the iterations
+        bench->gain(bench->samples.data(), (int) bench->samples.size(), 32767);
+    }
+}
+
+static void alac_unmix_bench(void *opaque, uint64_t iterations) {
+    dsp_bench_t *bench = (dsp_bench_t *) opaque;
+    for (uint64_t i = 0; i < iterations; i++) {
+        bench->unmix(bench->u.data(), bench->v.data(), bench->samples.data(), (int) bench->u.size(), 2, 3);
+    }
+}
+
+static void nal_rewrite_bench(void *opaque, uint64_t iterations) {
+    nal_rewrite_bench_t *bench = (nal_rewrite_bench_t *) opaque;
+    unsigned char *data = bench->frame.data();
+    int nal_count;
+    for (uint64_t i = 0; i < iterations; i++) {
+        raop_rtp_mirror_rewrite_nals(data, (int) bench->frame.size(), VIDEO_CODEC_H264, bench->nal_units, &nal_count);
+        // Put the lengths back for the next round
+        for (int j = 0; j < nal_count; j++) {
+            int size = bench->nal_units[j].size;
+            unsigned char *prefix = data + bench->nal_units[j].offset - 4;
+            prefix[0] = size >> 24;
+            prefix[1] = size >> 16;
+            prefix[2] = size >> 8;
+            prefix[3] = size;
+        }
+    }
+}
+
+typedef struct {
+    raop_ntp_t *ntp;
+    uint64_t remote_time;
+    uint64_t sink;
+} ntp_convert_bench_t;
+
+static void ntp_convert_bench(void *opaque, uint64_t iterations) {
+    ntp_convert_bench_t *bench = (ntp_convert_bench_t *) opaque;
+    uint64_t sink = 0;
+    for (uint64_t i = 0; i < iterations; i++) {
+        sink += raop_ntp_convert_remote_time(bench->ntp, bench->remote_time + i * 7982);
+    }
+    bench->sink += sink;
+}
+
+typedef struct {
+    raop_ntp_t *ntp;
+    raop_rtp_t *rtp;
+    raop_rtp_mirror_t *mirror;
+} restart_bench_t;
+
+/*
+ * One op starts a session's NTP, audio or mirror threads and stops them again, which is what a
+ * reconnect or a presenter switch waits for. Stopping has to wake threads that block on a socket.
+ */
+static void restart_ntp_bench(void *opaque, uint64_t iterations) {
+    restart_bench_t *bench = (restart_bench_t *) opaque;
+    unsigned short port;
+    for (uint64_t i = 0; i < iterations; i++) {
+        raop_ntp_start(bench->ntp, &port);
+        raop_ntp_stop(bench->ntp);
+    }
+}
+
+static void restart_audio_bench(void *opaque, uint64_t iterations) {
+    restart_bench_t *bench = (restart_bench_t *) opaque;
+    unsigned short control_port, data_port;
+    for (uint64_t i = 0; i < iterations; i++) {
+        raop_rtp_start_audio(bench->rtp, 1, 0, &control_port, &data_port);
+        raop_rtp_stop(bench->rtp);
+    }
+}
+
+static void restart_mirror_bench(void *opaque, uint64_t iterations) {
+    restart_bench_t *bench = (restart_bench_t *) opaque;
+    unsigned short port;
+    for (uint64_t i = 0; i < iterations; i++) {
+        raop_rtp_start_mirror(bench->mirror, 0, &port);
+        raop_rtp_mirror_stop(bench->mirror);
+    }
+}
+
+/* The requests of a typical iOS mirror and audio session, from connect to the first feedback */
+static const char *rtsp_session[] = {
+    "GET /info RTSP/1.0\r\n"
+    "X-Apple-ProtocolVersion: 1\r\n"
+    "CSeq: 0\r\n"
+    "DACP-ID: 14413BE4996FEA4D\r\n"
+    "Active-Remote: 2543110914\r\n"
+    "User-Agent: AirPlay/550.10\r\n"
+    "\r\n",
+    "POST /pair-setup RTSP/1.0\r\n"
+    "Content-Length: 32\r\n"
+    "Content-Type: application/octet-stream\r\n"
+    "CSeq: 1\r\n"
+    "DACP-ID: 14413BE4996FEA4D\r\n"
+    "Active-Remote: 2543110914\r\n"
+    "User-Agent: AirPlay/550.10\r\n"
+    "\r\n"
+    "0123456789abcdef0123456789abcdef",
+    "POST /fp-setup RTSP/1.0\r\n"
+    "X-Apple-ET: 32\r\n"
+    "Content-Length: 16\r\n"
+    "Content-Type: application/octet-stream\r\n"
+    "CSeq: 3\r\n"
+    "DACP-ID: 14413BE4996FEA4D\r\n"
+    "Active-Remote: 2543110914\r\n"
+    "User-Agent: AirPlay/550.10\r\n"
+    "\r\n"
+    "FPLY\x03\x01\x01\x7f\x7f\x7f\x7f\x04\x02\x7f\x02\xbb",
+    "SETUP rtsp://192.168.1.20/2497441178417290163 RTSP/1.0\r\n"
+    "Content-Length: 48\r\n"
+    "Content-Type: application/x-apple-binary-plist\r\n"
+    "CSeq: 5\r\n"
+    "DACP-ID: 14413BE4996FEA4D\r\n"
+    "Active-Remote: 2543110914\r\n"
+    "User-Agent: AirPlay/550.10\r\n"
+    "\r\n"
+    "bplist00\xd1\x01\x02Wstreams\xa1\x03\xd2\x04\x05\x06\x07Ttype\x10n"
+    "\x08\x0b\x13\x15\x1a\x1f\x21\x23\x25\x27\x29\x2b\x2d\x2f\x31",
+    "GET_PARAMETER rtsp://192.168.1.20/2497441178417290163 RTSP/1.0\r\n"
+    "Content-Length: 8\r\n"
+    "Content-Type: text/parameters\r\n"
+    "CSeq: 6\r\n"
+    "DACP-ID: 14413BE4996FEA4D\r\n"
+    "Active-Remote: 2543110914\r\n"
+    "User-Agent: AirPlay/550.10\r\n"
+    "\r\n"
+    "volume\r\n",
+    "RECORD rtsp://192.168.1.20/2497441178417290163 RTSP/1.0\r\n"
+    "CSeq: 7\r\n"
+    "DACP-ID: 14413BE4996FEA4D\r\n"
+    "Active-Remote: 2543110914\r\n"
+    "User-Agent: AirPlay/550.10\r\n"
+    "\r\n",
+    "SET_PARAMETER rtsp://192.168.1.20/2497441178417290163 RTSP/1.0\r\n"
+    "Content-Length: 20\r\n"
+    "Content-Type: text/parameters\r\n"
+    "CSeq: 8\r\n"
+    "DACP-ID: 14413BE4996FEA4D\r\n"
+    "Active-Remote: 2543110914\r\n"
+    "User-Agent: AirPlay/550.10\r\n"
+    "\r\n"
+    "volume: -11.123877\r\n",
+    "POST /feedback RTSP/1.0\r\n"
+    "CSeq: 9\r\n"
+    "DACP-ID: 14413BE4996FEA4D\r\n"
+    "Active-Remote: 2543110914\r\n"
+    "User-Agent: AirPlay/550.10\r\n"
+    "\r\n",
+};
+
+typedef struct {
+    http_request_t *request;
+    int errors;
+} rtsp_parse_bench_t;
+
+/* One op is the whole session, parsed the way httpd does with a reset after every request */
+static void rtsp_parse_bench(void *opaque, uint64_t iterations) {
+    rtsp_parse_bench_t *bench = (rtsp_parse_bench_t *) opaque;
+    for (uint64_t i = 0; i < iterations; i++) {
+        for (size_t j = 0; j < sizeof(rtsp_session)/sizeof(rtsp_session[0]); j++) {
+            http_request_add_data(bench->request, rtsp_session[j], (int) strlen(rtsp_session[j]));
+            if (!http_request_is_complete(bench->request) || http_request_has_error(bench->request)) {
+                bench->errors++;
+            }
+            http_request_reset(bench->request);
+        }
+    }
+}
+
+typedef struct {
+    x25519_key_t *ecdh_ours;
+    x25519_key_t *ecdh_theirs;
+    ed25519_key_t *ed;
+    unsigned char message[2 * X25519_KEY_SIZE];
+    unsigned char signature[PAIRING_SIG_SIZE];
+    pairing_t *pairing;
+    unsigned char client_ecdh[X25519_KEY_SIZE];
+    unsigned char client_ed[ED25519_KEY_SIZE];
+    int errors;
+} pair_verify_bench_t;
+
+/* What the key pool of pairing takes off the pair-verify path */
+static void x25519_generate_bench(void *opaque, uint64_t iterations) {
+    for (uint64_t i = 0; i < iterations; i++) {
+        x25519_key_destroy(x25519_key_generate());
+    }
+}
+
+static void x25519_derive_bench(void *opaque, uint64_t iterations) {
+    pair_verify_bench_t *bench = (pair_verify_bench_t *) opaque;
+    unsigned char secret[X25519_KEY_SIZE];
+    for (uint64_t i = 0; i < iterations; i++) {
+        x25519_derive_secret(secret, bench->ecdh_ours, bench->ecdh_theirs);
+    }
+}
+
+static void ed25519_sign_bench(void *opaque, uint64_t iterations) {
+    pair_verify_bench_t *bench = (pair_verify_bench_t *) opaque;
+    for (uint64_t i = 0; i < iterations; i++) {
+        ed25519_sign(bench->signature, sizeof(bench->signature), bench->message, sizeof(bench->message), bench->ed);
+    }
+}
+
+static void ed25519_verify_bench(void *opaque, uint64_t iterations) {
+    pair_verify_bench_t *bench = (pair_verify_bench_t *) opaque;
+    for (uint64_t i = 0; i < iterations; i++) {
+        if (!ed25519_verify(bench->signature, sizeof(bench->signature), bench->message, sizeof(bench->message), bench->ed)) {
+            bench->errors++;
+        }
+    }
+}
+
+/* One op is the receiver side of the first pair-verify request, generating its ephemeral key inline */
+static void pair_verify_bench(void *opaque, uint64_t iterations) {
+    pair_verify_bench_t *bench = (pair_verify_bench_t *) opaque;
+    for (uint64_t i = 0; i < iterations; i++) {
+        pairing_session_t *session = pairing_session_init(bench->pairing);
+        pairing_session_set_setup_status(session);
+        if (pairing_session_handshake(session, bench->client_ecdh, bench->client_ed) < 0 ||
+            pairing_session_get_signature(session, bench->signature) < 0) {
+            bench->errors++;
+        }
+        pairing_session_destroy(session);
+    }
+}
+
+typedef struct {
+    logger_t *logger;
+    unsigned char setup[16];
+    unsigned char handshake[164];
+    unsigned char cipher[72];
+    int errors;
+} fairplay_bench_t;
+
+/* One op is the FairPlay work of a connecting sender: both fp-setup requests, then the key in SETUP */
+static void fairplay_handshake_bench(void *opaque, uint64_t iterations) {
+    fairplay_bench_t *bench = (fairplay_bench_t *) opaque;
+    unsigned char reply[142], key[16];
+    for (uint64_t i = 0; i < iterations; i++) {
+        fairplay_t *fp = fairplay_init(bench->logger);
+        if (fairplay_setup(fp, bench->setup, reply) < 0 || fairplay_handshake(fp, bench->handshake, reply) < 0 ||
+            fairplay_decrypt(fp, bench->cipher, key) < 0) {
+            bench->errors++;
+        }
+        fairplay_destroy(fp);
+    }
+}
+
+static int rtsp_session_bytes() {
+    int bytes = 0;
+    for (size_t j = 0; j < sizeof(rtsp_session)/sizeof(rtsp_session[0]); j++) {
+        bytes += (int) strlen(rtsp_session[j]);
+    }
+    return bytes;
+}
+
+#if defined(HAS_AAC_DECODER)
+/*
+ * 16 AAC-ELD frames of 480 samples in the stream format AirPlay sends, encoded at 128 kbit/s from a few
+ * tones and noise with fdk-aac's encoder, so the decoder runs its whole path without a capture
+ */
+static const unsigned short eld_frame_sizes[] = {
+    176, 178, 178, 177, 174, 177, 166, 177, 178, 169, 176, 180, 165, 179, 176, 174
+};
+
+static const unsigned char eld_frames[] = {
+    0x7d, 0x5c, 0x63, 0xfb, 0xdf, 0x49, 0x63, 0x01, 0xd8, 0x84, 0xc0, 0x77, 0x08, 0x11, 0x82, 0x04,
+    0x4e, 0xb7, 0xb8, 0x5c, 0x6f, 0xd8, 0x5c, 0x97, 0xdc, 0xde, 0x1e, 0xc9, 0x18, 0xac, 0x3e, 0xd8,
+    0x8b, 0xa1, 0xb6, 0x7e, 0x8b, 0xf7, 0x3e, 0x93, 0x24, 0x50, 0x79, 0x51, 0xd4, 0x77, 0x65, 0x32,
+    0x4f, 0x34, 0xed, 0x8d, 0x11, 0x42, 0x44, 0x00, 0x58, 0x8e, 0x16, 0x23, 0xc2, 0xe5, 0x6b, 0x2a,
+    0x57, 0x32, 0xbc, 0x92, 0xa4, 0x0e, 0x7a, 0x4a, 0x2e, 0x62, 0xe5, 0xef, 0x60, 0x90, 0x4e, 0x5a,
+    0x9f, 0xc8, 0xdf, 0x72, 0xb0, 0x5b, 0x28, 0xff, 0x0e, 0x7c, 0x56, 0x19, 0x72, 0x1c, 0x3b, 0x9f,
+    0x27, 0x70, 0x29, 0xf7, 0x1c, 0x7c, 0xf3, 0x00, 0x6f, 0xff, 0xd4, 0x0f, 0x61, 0x9d, 0x32, 0xb5,
+    0x4d, 0x5e, 0x1e, 0x14, 0xa7, 0x51, 0xcf, 0x56, 0x59, 0x4b, 0x52, 0x8c, 0x54, 0x13, 0xc3, 0x0f,
+    0xe8, 0xf6, 0x53, 0x58, 0x62, 0xc2, 0x2c, 0x1d, 0x42, 0x76, 0xd3, 0xa7, 0x0a, 0xed, 0xa0, 0x56,
+    0xf1, 0x29, 0x9d, 0x13, 0x47, 0x09, 0x70, 0x37, 0x1b, 0xc3, 0xeb, 0xa0, 0xf7, 0xcf, 0x62, 0xc8,
+    0x53, 0x50, 0x58, 0x67, 0x54, 0xc8, 0x48, 0x33, 0x6e, 0xf2, 0xdf, 0x1d, 0xad, 0x7b, 0xb5, 0x46,
+    0x7d, 0x5c, 0x43, 0xfb, 0xdf, 0x4b, 0x62, 0x12, 0x58, 0x88, 0xc0, 0x7b, 0x08, 0x11, 0x82, 0x04,
+    0x5e, 0x86, 0x64, 0x69, 0x2b, 0x3c, 0x99, 0x49, 0x5c, 0x37, 0xf0, 0x17, 0x00, 0xc5, 0xf6, 0x34,
+    0x24, 0x2a, 0xe7, 0xd3, 0xe6, 0x53, 0x1f, 0x51, 0x80, 0x15, 0x99, 0x10, 0xd7, 0x7c, 0xfe, 0x50,
+    0xb9, 0xc2, 0x7e, 0xc7, 0x2b, 0x61, 0x80, 0x59, 0x12, 0x16, 0x23, 0x9b, 0x97, 0x91, 0x4d, 0xe4,
+    0x79, 0x10, 0x13, 0xbf, 0x20, 0x69, 0x7b, 0xc7, 0xf8, 0x73, 0x72, 0xb6, 0xea, 0xcb, 0x41, 0xa7,
+    0x57, 0x8c, 0x5c, 0xcd, 0xd3, 0x1f, 0x81, 0xfb, 0xf6, 0x91, 0x75, 0xb2, 0xab, 0xc4, 0xd6, 0x2c,
+    0x35, 0x77, 0x14, 0xad, 0x20, 0xd5, 0x6d, 0x13, 0xb0, 0xe0, 0xb0, 0x38, 0xd9, 0x58, 0x25, 0x0e,
+    0xd2, 0x86, 0xb6, 0x67, 0xf0, 0x68, 0x2a, 0xc6, 0x40, 0x9a, 0xeb, 0x5c, 0x5a, 0xd3, 0x19, 0x08,
+    0x33, 0xa7, 0x84, 0xf7, 0xec, 0xf0, 0xc1, 0x54, 0x92, 0x41, 0x44, 0x7b, 0xca, 0xdb, 0xb6, 0x40,
+    0xad, 0xf7, 0x65, 0x7a, 0x53, 0x95, 0xf0, 0xb9, 0xf6, 0x54, 0x1b, 0x70, 0xaf, 0xa5, 0x3f, 0xdd,
+    0xb3, 0x70, 0x66, 0xba, 0x9c, 0x82, 0x2e, 0x59, 0x6d, 0xbc, 0xc5, 0x1f, 0x19, 0x71, 0xdf, 0x8d,
+    0xe2, 0x40, 0x7d, 0x5c, 0x67, 0xfb, 0xdf, 0x49, 0x63, 0x01, 0xd8, 0x84, 0xa0, 0x89, 0x08, 0x11,
+    0x82, 0x04, 0x3c, 0xf3, 0x90, 0xd3, 0x7e, 0xc6, 0x71, 0x8f, 0x6e, 0x79, 0x39, 0xe4, 0xa2, 0xb0,
+    0xfe, 0x91, 0x14, 0x8f, 0xae, 0x58, 0xc3, 0xea, 0x9b, 0x57, 0xab, 0x85, 0x56, 0xbf, 0x96, 0x95,
+    0x1e, 0x73, 0x95, 0x05, 0x8d, 0x11, 0x62, 0x46, 0xc8, 0x58, 0x8e, 0x78, 0x5e, 0x4c, 0x91, 0xe2,
+    0x71, 0x75, 0x04, 0xa9, 0x52, 0x77, 0xe4, 0x0d, 0x0e, 0xdc, 0xf5, 0x08, 0xed, 0x71, 0xfd, 0x22,
+    0x1c, 0x93, 0x32, 0xdf, 0xd4, 0xb5, 0xe9, 0xb9, 0x17, 0x93, 0x8f, 0x74, 0x41, 0x81, 0x78, 0x54,
+    0x90, 0x29, 0x3e, 0xb7, 0x3f, 0x7a, 0x0d, 0x8e, 0xcd, 0x42, 0x1e, 0x8d, 0xbf, 0x67, 0x16, 0xae,
+    0x63, 0x85, 0xfd, 0xb8, 0x7e, 0xf9, 0xcd, 0xf8, 0x9e, 0xdb, 0x16, 0x8e, 0x4f, 0xf8, 0xff, 0xdb,
+    0x69, 0x6d, 0x9e, 0x27, 0xce, 0xb7, 0x5e, 0x73, 0xbf, 0x01, 0xc9, 0xb1, 0x26, 0x92, 0xbb, 0x76,
+    0x62, 0x12, 0x44, 0xf4, 0xa1, 0xcf, 0xdf, 0xbe, 0xa0, 0xd3, 0x49, 0x39, 0x95, 0x20, 0xf5, 0xd5,
+    0x2d, 0xce, 0xe9, 0xd8, 0x5d, 0x55, 0x52, 0x76, 0x8d, 0x7d, 0x5b, 0x15, 0x12, 0xea, 0x71, 0xcc,
+    0xd7, 0x57, 0x15, 0x30, 0x7d, 0x5c, 0x03, 0xfb, 0xdf, 0x43, 0x63, 0x01, 0xd8, 0x84, 0xc0, 0x79,
+    0x08, 0x11, 0x82, 0x04, 0x6f, 0xac, 0xdc, 0x68, 0x67, 0xb1, 0xea, 0x1d, 0xf1, 0xfc, 0xb4, 0x80,
+    0xc4, 0x4d, 0x5f, 0xaf, 0x17, 0x9a, 0xff, 0x27, 0x89, 0x7f, 0xf8, 0x7d, 0xc7, 0x44, 0x09, 0x13,
+    0xe8, 0x27, 0xa5, 0x1a, 0xfa, 0xe7, 0xac, 0x6e, 0x9b, 0x09, 0x99, 0x8f, 0x21, 0x62, 0x3c, 0x5d,
+    0xde, 0x4a, 0x2b, 0x99, 0x5e, 0xd4, 0x89, 0x28, 0x8e, 0xfc, 0x81, 0x6a, 0xdf, 0x2f, 0xc8, 0xb0,
+    0xc3, 0xda, 0xe8, 0xd6, 0x67, 0x13, 0x57, 0x39, 0x95, 0x4e, 0xe7, 0xfc, 0x4f, 0x62, 0xd0, 0xf8,
+    0xc4, 0xbe, 0x11, 0xfc, 0x09, 0x4f, 0x3d, 0x03, 0x7a, 0x2c, 0x86, 0xcb, 0x60, 0xd6, 0x41, 0x41,
+    0x32, 0xcd, 0x94, 0x0c, 0x21, 0x2c, 0xe6, 0x11, 0xc8, 0xf2, 0xc2, 0x24, 0x77, 0x69, 0xd6, 0x6a,
+    0xf2, 0x5b, 0xcc, 0x7b, 0xaf, 0xf0, 0x72, 0x9c, 0x57, 0x79, 0x19, 0xcd, 0x3d, 0xa9, 0xb2, 0x58,
+    0x23, 0x43, 0x49, 0xe7, 0xaf, 0xb1, 0x6c, 0xec, 0xf2, 0x30, 0x85, 0x2f, 0x2b, 0xdf, 0x2f, 0x64,
+    0xe5, 0x07, 0x9e, 0xbb, 0xeb, 0x9f, 0x9d, 0x5a, 0x57, 0x29, 0xf0, 0xa9, 0xe5, 0x97, 0x96, 0x7c,
+    0x06, 0xcb, 0x36, 0xad, 0x4c, 0x7d, 0x5c, 0x63, 0xfb, 0xdf, 0x43, 0x63, 0x01, 0xd8, 0x84, 0xc0,
+    0x7b, 0x08, 0x11, 0x82, 0x04, 0x6f, 0xad, 0xe0, 0xe0, 0xcf, 0x24, 0x31, 0x87, 0x6c, 0x6c, 0x54,
+    0x20, 0x6a, 0xcf, 0xed, 0x11, 0x48, 0x86, 0x5b, 0x03, 0xd7, 0x06, 0xab, 0x45, 0x32, 0x59, 0x55,
+    0xf3, 0xae, 0x57, 0x08, 0x28, 0x9e, 0xb1, 0xa2, 0x6c, 0x2a, 0x46, 0x4c, 0x85, 0x88, 0xef, 0x3a,
+    0xbd, 0xc8, 0x33, 0x6f, 0x20, 0x08, 0xe7, 0xa8, 0x0c, 0x43, 0x2e, 0x03, 0xb2, 0xaf, 0xe0, 0x00,
+    0x1c, 0x4b, 0x30, 0x32, 0x95, 0x81, 0xf5, 0xcf, 0x27, 0x9e, 0x38, 0x7d, 0x1a, 0xa6, 0xb3, 0x21,
+    0x06, 0xf3, 0x58, 0x0b, 0x64, 0x8b, 0xad, 0xa5, 0xbb, 0x2b, 0xd6, 0xa1, 0x30, 0x9d, 0x42, 0xf2,
+    0x04, 0xb4, 0x2a, 0x79, 0x2b, 0x20, 0x3c, 0xc6, 0x9a, 0x84, 0xc4, 0x1d, 0x85, 0x46, 0x97, 0xd8,
+    0xf9, 0xcd, 0xf8, 0x9f, 0xe8, 0xe9, 0x67, 0x90, 0x75, 0x58, 0x10, 0x17, 0x0e, 0x9c, 0x26, 0x33,
+    0xce, 0xbc, 0x69, 0x88, 0x89, 0x79, 0xd8, 0x17, 0x9e, 0x3b, 0x70, 0xe1, 0xbe, 0xdd, 0xd9, 0x6d,
+    0xbd, 0x2d, 0xaf, 0x81, 0xa7, 0x60, 0x95, 0xcd, 0x28, 0xcb, 0x61, 0x70, 0xb1, 0x96, 0x5a, 0x12,
+    0x99, 0x9c, 0xc0, 0x7d, 0x5c, 0x63, 0xfb, 0xdf, 0x4b, 0x63, 0x01, 0xd8, 0x84, 0xc0, 0x79, 0x08,
+    0x11, 0x82, 0x04, 0x5f, 0x5c, 0xee, 0xcd, 0x54, 0xdf, 0xb0, 0x21, 0x7e, 0xc5, 0xbe, 0xd3, 0x0e,
+    0x09, 0xbe, 0xd6, 0x2e, 0x63, 0x7e, 0xbf, 0x1d, 0x57, 0xea, 0x9c, 0x19, 0x9c, 0x9e, 0x29, 0x45,
+    0x9a, 0xa9, 0xa2, 0xd4, 0x9d, 0xa1, 0xa2, 0x28, 0x48, 0x66, 0x3c, 0x85, 0x88, 0xf1, 0x35, 0x4b,
+    0xaa, 0x98, 0xe5, 0xec, 0x52, 0x25, 0x23, 0x9e, 0xa0, 0x76, 0xeb, 0xe5, 0xbe, 0x43, 0x59, 0x20,
+    0x10, 0xfb, 0xea, 0xbb, 0xa7, 0xfe, 0x06, 0xb7, 0x5c, 0xf7, 0x4f, 0x08, 0x73, 0x59, 0x6b, 0x10,
+    0x1f, 0xcd, 0x04, 0xd2, 0xe5, 0x2e, 0xe9, 0x71, 0x96, 0x45, 0x10, 0x45, 0x32, 0x5d, 0x8b, 0xaa,
+    0xbf, 0x7c, 0x08, 0x45, 0xc3, 0xbd, 0x8e, 0x43, 0x27, 0xa4, 0x00, 0x68, 0x70, 0x43, 0x88, 0x0b,
+    0xe3, 0x06, 0x3f, 0x41, 0xf9, 0xd6, 0xdc, 0x67, 0x18, 0xa7, 0x18, 0xcd, 0xd6, 0x29, 0x1b, 0x84,
+    0x82, 0x8d, 0xf4, 0xd2, 0xf5, 0xaa, 0x63, 0x7b, 0xdf, 0x5b, 0x66, 0x53, 0xe1, 0x36, 0x91, 0xc2,
+    0xfe, 0x4d, 0x94, 0x75, 0x50, 0x53, 0xe5, 0x5f, 0x48, 0xcb, 0x7b, 0x07, 0xbe, 0x7b, 0x16, 0x61,
+    0xa2, 0x89, 0x6c, 0x80, 0x7d, 0x5c, 0xe3, 0xfb, 0xdf, 0x4b, 0x43, 0x01, 0xd8, 0x84, 0xc0, 0x77,
+    0x08, 0x11, 0x82, 0x04, 0x4e, 0xb7, 0xb1, 0xc2, 0xb7, 0xf0, 0x42, 0xdd, 0xef, 0x3f, 0xd4, 0x20,
+    0x03, 0x52, 0xf8, 0x22, 0x21, 0xf2, 0xf8, 0xf5, 0x99, 0xfe, 0xeb, 0x28, 0x22, 0x58, 0x82, 0x60,
+    0xcf, 0x25, 0x9e, 0xa1, 0x92, 0x1c, 0x68, 0xc9, 0x0b, 0x11, 0xe1, 0xc5, 0x49, 0x94, 0x9c, 0xe3,
+    0xea, 0x94, 0xba, 0x11, 0xcf, 0x50, 0x00, 0x3f, 0x9b, 0xff, 0x9e, 0x39, 0xcf, 0xfa, 0x5b, 0xfd,
+    0x52, 0xec, 0x69, 0xaf, 0xee, 0xef, 0xd2, 0xfb, 0xb7, 0xe2, 0x82, 0x08, 0x87, 0x70, 0x0b, 0xb1,
+    0x2f, 0x41, 0x6d, 0xc1, 0xa6, 0xe5, 0xbc, 0x77, 0xf7, 0x0c, 0x4a, 0x45, 0x9d, 0x4e, 0x7d, 0x5d,
+    0x16, 0x11, 0x5f, 0x30, 0xfd, 0x43, 0xc6, 0x2a, 0x54, 0x32, 0x2b, 0x1f, 0x81, 0xf5, 0x2a, 0xac,
+    0x59, 0xe1, 0x9c, 0xae, 0x56, 0x8b, 0x4e, 0xaf, 0x42, 0xb4, 0x62, 0x29, 0xd2, 0xe9, 0xe1, 0x92,
+    0xf9, 0x73, 0x96, 0x64, 0x88, 0xa6, 0xab, 0xaf, 0x42, 0x1b, 0x22, 0x8b, 0x96, 0x56, 0x7e, 0xac,
+    0xf4, 0xec, 0x39, 0x4a, 0x2f, 0x13, 0x8a, 0x1e, 0x77, 0x40, 0x7d, 0x5c, 0x63, 0xfb, 0xdf, 0x47,
+    0x63, 0x01, 0xd8, 0x84, 0xc0, 0x7a, 0x08, 0x11, 0x82, 0x04, 0x57, 0x19, 0x83, 0xaa, 0xaa, 0xf2,
+    0x67, 0x36, 0xfa, 0xc7, 0xa3, 0x82, 0x11, 0x9e, 0x7e, 0x9e, 0x28, 0x87, 0xf4, 0xe0, 0x00, 0xde,
+    0x6d, 0x71, 0x24, 0x09, 0xd6, 0x60, 0xd5, 0x3e, 0xfa, 0x77, 0x23, 0x84, 0xf5, 0x8d, 0x11, 0x23,
+    0x46, 0x48, 0x58, 0x8f, 0x1a, 0x4a, 0x8a, 0x8e, 0xe3, 0xa2, 0x54, 0x08, 0xe7, 0xa8, 0xa0, 0xab,
+    0x1e, 0xb1, 0xed, 0x90, 0x95, 0xdd, 0xa4, 0x46, 0x00, 0x0e, 0x62, 0x1b, 0x77, 0x2f, 0x82, 0xf3,
+    0x76, 0x0b, 0x0f, 0x8d, 0xfa, 0xbd, 0xab, 0x6c, 0xfd, 0xc5, 0x03, 0xfc, 0x53, 0xae, 0x2b, 0xee,
+    0x07, 0x97, 0xd1, 0xb8, 0x8f, 0xa1, 0xf8, 0xa4, 0x7f, 0x7e, 0xfe, 0xc6, 0xf5, 0xb0, 0x6a, 0x50,
+    0x30, 0x3e, 0x27, 0xa1, 0xfe, 0x40, 0x87, 0x0c, 0xf5, 0x7f, 0x3d, 0xf5, 0x2a, 0xc3, 0x1d, 0xd0,
+    0x10, 0xd5, 0x44, 0x6e, 0x40, 0x71, 0x2c, 0xec, 0xe1, 0x7b, 0x61, 0xef, 0x9a, 0xea, 0x6f, 0x89,
+    0x67, 0x5d, 0xa1, 0x4d, 0xf7, 0xf0, 0x4c, 0x6c, 0xec, 0x90, 0xf2, 0xae, 0x8e, 0x45, 0x7e, 0x47,
+    0x25, 0x84, 0xe7, 0x30, 0xed, 0xfe, 0xd5, 0x27, 0xea, 0x83, 0x70, 0x7d, 0x5c, 0xc3, 0xfb, 0xdf,
+    0x43, 0x62, 0x32, 0xd8, 0x4c, 0xc0, 0x7b, 0x08, 0x11, 0x82, 0x04, 0x73, 0xc7, 0x06, 0xf9, 0x3a,
+    0x98, 0xcf, 0x62, 0x94, 0x7d, 0xd6, 0xfd, 0x89, 0x4a, 0x9e, 0x7b, 0xec, 0x83, 0x12, 0xf2, 0x11,
+    0xa1, 0xa6, 0x57, 0x9c, 0x9a, 0x29, 0xba, 0xa1, 0x1a, 0x06, 0xb5, 0x8c, 0x8d, 0x28, 0x2c, 0x68,
+    0x8a, 0x13, 0x36, 0x42, 0xc4, 0x77, 0xd4, 0x0a, 0x39, 0xb7, 0x13, 0x22, 0x54, 0x25, 0x73, 0xd4,
+    0x02, 0x07, 0x8b, 0xf6, 0x3d, 0x30, 0x9a, 0xb2, 0x0f, 0xfb, 0x3f, 0x40, 0x0f, 0xef, 0x32, 0xe1,
+    0x7b, 0xd4, 0xe8, 0x20, 0x16, 0x92, 0x58, 0xa7, 0x35, 0xc6, 0x64, 0x95, 0x00, 0x23, 0x94, 0x80,
+    0xb6, 0xb2, 0xe0, 0x13, 0x81, 0x00, 0x9a, 0xdb, 0x01, 0x2e, 0xd7, 0x3a, 0x45, 0x8e, 0x2e, 0x09,
+    0x2e, 0x4b, 0x2c, 0x95, 0x16, 0xfc, 0x95, 0x8e, 0xa2, 0x02, 0x1f, 0x0c, 0x9a, 0xbf, 0xaa, 0xf9,
+    0x69, 0xa3, 0x02, 0x2a, 0x44, 0xdb, 0x29, 0x04, 0xa1, 0x8b, 0x11, 0xcf, 0x4d, 0x78, 0x4d, 0x85,
+    0xc9, 0x9b, 0xf7, 0xd1, 0x6f, 0x83, 0x59, 0x1d, 0xf4, 0xa4, 0xeb, 0x84, 0x94, 0xd6, 0x72, 0xe5,
+    0x1c, 0x01, 0x07, 0x94, 0x8d, 0xd5, 0xc2, 0x5e, 0xc6, 0xe6, 0x36, 0x11, 0x90, 0x7e, 0x9f, 0x96,
+    0x82, 0x24, 0x20, 0x49, 0x08, 0x11, 0xe3, 0xa0, 0xc1, 0x7a, 0xaa, 0x5f, 0x8c, 0xfc, 0xc7, 0xfa,
+    0x5f, 0x27, 0x60, 0x56, 0x9f, 0xef, 0xf0, 0x06, 0x5f, 0xab, 0x7e, 0xbb, 0xa2, 0xbe, 0x87, 0xfb,
+    0x80, 0x5f, 0xe4, 0x76, 0x80, 0x9e, 0xa1, 0xa1, 0x24, 0xc8, 0x8b, 0x10, 0x05, 0x85, 0x61, 0x62,
+    0x3d, 0x74, 0xaa, 0x94, 0x49, 0xae, 0x60, 0x49, 0x32, 0x2e, 0x88, 0x17, 0x09, 0xfc, 0x9d, 0xab,
+    0x92, 0x39, 0x3a, 0x62, 0x71, 0xfe, 0xfe, 0x88, 0xcd, 0x77, 0x7f, 0xaa, 0xfe, 0xe5, 0xa4, 0x88,
+    0x88, 0xe9, 0x3d, 0xe5, 0x07, 0xf4, 0xf0, 0x04, 0x75, 0x7f, 0x69, 0xfe, 0x07, 0x52, 0x7b, 0x90,
+    0x55, 0x38, 0xb9, 0xcb, 0xe1, 0x87, 0x10, 0x8c, 0x50, 0x88, 0xcf, 0x86, 0x0e, 0xb3, 0xa5, 0xc4,
+    0x97, 0x58, 0x67, 0x69, 0x96, 0x4f, 0x4a, 0x27, 0xba, 0x29, 0xf8, 0x03, 0xaf, 0x44, 0xc8, 0x73,
+    0xe0, 0xed, 0x43, 0xac, 0x82, 0x89, 0x02, 0x20, 0xea, 0xf9, 0x5d, 0xca, 0x20, 0x67, 0x49, 0xcd,
+    0xc4, 0x0d, 0x81, 0x65, 0x3e, 0xdc, 0xae, 0x68, 0xcb, 0x9c, 0xb2, 0x83, 0x4c, 0x91, 0x3d, 0x35,
+    0x91, 0x4d, 0x58, 0xc5, 0x60, 0x80, 0x7d, 0x5c, 0x43, 0xfb, 0xdf, 0x4b, 0x63, 0x01, 0xd8, 0x84,
+    0xc0, 0x77, 0x08, 0x11, 0x82, 0x04, 0x6b, 0x8d, 0xf2, 0x74, 0xa9, 0xbf, 0x61, 0x78, 0xdf, 0xc9,
+    0x76, 0x73, 0x10, 0x25, 0x49, 0xfc, 0x83, 0x96, 0xcb, 0x48, 0xb3, 0xfe, 0xff, 0xf5, 0x6b, 0x1b,
+    0x55, 0x35, 0x2e, 0x45, 0xa0, 0x13, 0x7c, 0xd3, 0xb4, 0x34, 0x44, 0x99, 0x93, 0x21, 0x62, 0x3c,
+    0x4b, 0x95, 0x79, 0x4c, 0xc3, 0xc8, 0x40, 0x4e, 0xfc, 0xca, 0x09, 0x47, 0xe0, 0xbc, 0x8e, 0xb2,
+    0x72, 0x63, 0x18, 0x7e, 0xb3, 0xe4, 0x2a, 0x6c, 0xeb, 0xec, 0x5f, 0x25, 0xd1, 0x23, 0x0c, 0x74,
+    0x2f, 0x1e, 0x20, 0x09, 0xed, 0x2b, 0x24, 0x50, 0xb6, 0xe4, 0xba, 0x2e, 0x54, 0x2a, 0x6d, 0xcc,
+    0xd5, 0x5a, 0xe4, 0x4b, 0x0c, 0xed, 0xc6, 0x63, 0x13, 0x94, 0xc8, 0x87, 0x8a, 0x54, 0x8b, 0x9d,
+    0xcc, 0xe5, 0x00, 0xf7, 0x3a, 0xbf, 0x63, 0x8c, 0x10, 0x8c, 0x21, 0xeb, 0xe2, 0xbb, 0x44, 0x6e,
+    0x1a, 0x6c, 0xaf, 0x3c, 0x22, 0x5b, 0xae, 0xa5, 0x1a, 0x8a, 0xe9, 0x9e, 0x76, 0xec, 0x7b, 0x5b,
+    0x4a, 0x21, 0xf3, 0xb6, 0x89, 0xeb, 0x5b, 0xf5, 0x56, 0xe5, 0x88, 0x96, 0x72, 0xeb, 0x96, 0xca,
+    0xc2, 0xbf, 0x2d, 0xfa, 0x44, 0x00, 0x7d, 0x4c, 0x63, 0xfb, 0xdf, 0x49, 0x63, 0x01, 0xd8, 0x94,
+    0xc0, 0x79, 0x08, 0x11, 0x82, 0x04, 0x4e, 0xb7, 0xb8, 0x71, 0x4d, 0xfb, 0x19, 0x48, 0xdc, 0x8f,
+    0xe0, 0x87, 0x0c, 0x19, 0x6f, 0xab, 0x8a, 0xbb, 0x07, 0x46, 0x23, 0x25, 0x4f, 0xf7, 0xb9, 0xcb,
+    0xb2, 0xdc, 0x57, 0x4b, 0x8c, 0x45, 0x8b, 0x64, 0xf5, 0x8d, 0x11, 0x63, 0x66, 0x48, 0x58, 0x8e,
+    0x73, 0xaa, 0x5d, 0x32, 0xfd, 0x5b, 0xcd, 0x41, 0x04, 0xae, 0x7c, 0x80, 0xe6, 0xf6, 0x9f, 0xe2,
+    0xe1, 0xcb, 0xcd, 0x7b, 0x2a, 0x18, 0x00, 0xff, 0x46, 0x1a, 0x28, 0xce, 0x41, 0xc9, 0xa7, 0x40,
+    0x1e, 0xd2, 0x4b, 0x0d, 0xd6, 0xc9, 0x01, 0x96, 0x57, 0x45, 0x64, 0x9c, 0x03, 0xbe, 0x61, 0xbc,
+    0x58, 0xae, 0x34, 0x3a, 0x11, 0x4d, 0xea, 0x41, 0xa6, 0x20, 0x1d, 0x96, 0xf8, 0x7b, 0x27, 0x55,
+    0xaa, 0x6b, 0x82, 0x2b, 0x7a, 0x55, 0x2a, 0xce, 0xb5, 0x7f, 0x1f, 0xe6, 0x0a, 0xce, 0xf3, 0xf1,
+    0xcb, 0x2c, 0x29, 0x92, 0x52, 0xaa, 0xa5, 0xd7, 0x16, 0x4b, 0x16, 0x12, 0x59, 0x46, 0x47, 0xeb,
+    0x3c, 0xb4, 0x72, 0xec, 0xe4, 0x15, 0x1c, 0xe3, 0xae, 0x20, 0x5e, 0x4c, 0xa2, 0x57, 0x9e, 0x73,
+    0xd7, 0x6f, 0x5e, 0x81, 0x33, 0x7d, 0xf7, 0x61, 0x44, 0x84, 0x7d, 0x4c, 0xe3, 0xfb, 0xdf, 0x49,
+    0x62, 0x96, 0x01, 0xe0, 0x20, 0x46, 0x08, 0x11, 0x5c, 0x74, 0x78, 0xd8, 0xd4, 0x6f, 0xd8, 0xce,
+    0x0b, 0xdd, 0x1e, 0x77, 0x78, 0x47, 0x08, 0x23, 0x53, 0xfb, 0x88, 0x0b, 0xac, 0x15, 0x0e, 0x07,
+    0x5b, 0x24, 0x26, 0x84, 0x3b, 0x17, 0x30, 0x5c, 0xdc, 0x4a, 0x82, 0x86, 0x88, 0x91, 0xa3, 0x1c,
+    0x2c, 0x47, 0x7a, 0x84, 0xa5, 0x4e, 0xd5, 0xec, 0x10, 0x43, 0x9e, 0xa0, 0x38, 0x2f, 0xa8, 0xff,
+    0x65, 0x74, 0x93, 0x88, 0x6b, 0x86, 0x07, 0x96, 0xc6, 0x7a, 0xf3, 0x9f, 0xc0, 0x84, 0x98, 0x15,
+    0x40, 0x51, 0xcb, 0x1d, 0xfd, 0xbe, 0xe2, 0x2f, 0xf1, 0xe8, 0xc6, 0x6e, 0xfa, 0xd3, 0x50, 0xe3,
+    0x72, 0x15, 0xf1, 0x89, 0x6f, 0x90, 0x23, 0xda, 0x2a, 0xe9, 0xce, 0x2d, 0xad, 0xba, 0x26, 0xf7,
+    0x51, 0x7f, 0xaf, 0xed, 0x66, 0x9c, 0xe4, 0x53, 0x11, 0xac, 0xeb, 0x94, 0x1e, 0x0e, 0x9a, 0x5b,
+    0x1d, 0xb7, 0x8c, 0x8b, 0xc2, 0x63, 0x19, 0x75, 0xf0, 0x8a, 0xb2, 0xde, 0x99, 0x5b, 0x4d, 0x8a,
+    0x8d, 0x85, 0x05, 0xeb, 0x2b, 0x99, 0x5c, 0xf6, 0x1d, 0x96, 0x9b, 0x74, 0xa8, 0x52, 0x44, 0x7d,
+    0x5c, 0x63, 0xfb, 0xdf, 0x41, 0x63, 0x95, 0x81, 0xe4, 0x20, 0x46, 0x08, 0x11, 0xcf, 0x91, 0xbd,
+    0x8e, 0x2a, 0x6f, 0xd8, 0xde, 0x8d, 0xfb, 0x9f, 0xbb, 0x13, 0x0c, 0x04, 0xf2, 0xff, 0xfa, 0xa8,
+    0x0b, 0xce, 0xa7, 0x08, 0x5f, 0x79, 0xfa, 0xc6, 0xc8, 0x3a, 0x42, 0x53, 0xb0, 0xe5, 0x3a, 0x06,
+    0xca, 0x0b, 0x1a, 0x22, 0xc6, 0xcc, 0x90, 0xb0, 0xa0, 0x4e, 0xfa, 0x5d, 0x28, 0x6e, 0x9d, 0x42,
+    0xac, 0x13, 0xbf, 0x20, 0x05, 0xf5, 0xbf, 0x4f, 0xc6, 0x07, 0x9f, 0x55, 0x66, 0x2a, 0x48, 0xc9,
+    0x96, 0x31, 0xeb, 0x93, 0x0e, 0x80, 0x25, 0x11, 0x7e, 0x12, 0xc0, 0xa1, 0x8c, 0x90, 0xd4, 0x90,
+    0x5b, 0x46, 0x63, 0x05, 0x9c, 0xb4, 0x2a, 0x1d, 0x72, 0x9c, 0x1d, 0x4e, 0x51, 0x54, 0x4c, 0xac,
+    0x20, 0xc4, 0x62, 0xca, 0xfc, 0x9e, 0x62, 0x2c, 0x64, 0x9e, 0xb7, 0xce, 0x6c, 0xd9, 0x8b, 0xd2,
+    0xfd, 0x47, 0x1b, 0x94, 0x2f, 0x9a, 0x6f, 0xef, 0x04, 0xa2, 0xc3, 0x22, 0xba, 0xbb, 0xed, 0xa6,
+    0x0e, 0xbd, 0x27, 0x57, 0x47, 0xaa, 0x49, 0x83, 0xd3, 0x60, 0x24, 0x26, 0x44, 0xb1, 0x01, 0x5a,
+    0xc7, 0xa2, 0x06, 0x18, 0xd1, 0x24, 0xb4, 0x84, 0x32, 0x6f, 0x20, 0x8d, 0xf3, 0x1d, 0xc0, 0x84,
+    0x70, 0x88, 0x7d, 0x5c, 0x63, 0xfb, 0xdf, 0x45, 0x63, 0x95, 0x81, 0xe8, 0x20, 0x46, 0x08, 0x11,
+    0x9e, 0x47, 0x38, 0x38, 0xa9, 0x9e, 0x47, 0x63, 0x8e, 0x51, 0xe3, 0xd6, 0x65, 0x00, 0xd4, 0xff,
+    0xc5, 0xba, 0x05, 0xde, 0xd9, 0x8c, 0x0e, 0x77, 0x43, 0xd7, 0x00, 0x38, 0x71, 0xae, 0xb8, 0x97,
+    0xa0, 0x8d, 0xe3, 0x3c, 0xed, 0x8d, 0x11, 0x23, 0x66, 0x48, 0x58, 0x8f, 0x13, 0x57, 0x85, 0x1c,
+    0x9d, 0x11, 0x2a, 0x07, 0x3e, 0x6a, 0x0a, 0xe7, 0x3a, 0xb7, 0xa5, 0xa3, 0x71, 0x58, 0x0d, 0xd7,
+    0x37, 0x87, 0xf7, 0x62, 0x53, 0xb9, 0xff, 0xac, 0x40, 0xe0, 0xd9, 0xc1, 0xca, 0x08, 0xd2, 0x25,
+    0x14, 0x3d, 0x89, 0x92, 0xb4, 0xcf, 0x75, 0x8e, 0x70, 0x7b, 0x4d, 0x1a, 0x16, 0xda, 0xe2, 0x7b,
+    0x1e, 0xe0, 0x69, 0x18, 0xc0, 0x86, 0x6a, 0x8e, 0xe3, 0xbd, 0xc9, 0x25, 0x56, 0x90, 0xc9, 0x49,
+    0x8e, 0x5c, 0x7f, 0xe0, 0x5e, 0x72, 0xb9, 0xc1, 0x9f, 0x3a, 0x91, 0xc2, 0x6c, 0xd5, 0x1f, 0xbe,
+    0x4a, 0x2d, 0x9a, 0xaa, 0x83, 0x45, 0x89, 0xa4, 0x42, 0x8a, 0x88, 0xb4, 0x84, 0x90, 0x98, 0x5b,
+    0x66, 0x53, 0x12, 0xe7, 0x79, 0x13, 0x70, 0xce, 0xaf, 0x2d, 0xf9, 0xf4, 0x1e, 0x6f, 0xca, 0x6b,
+    0x0d, 0x40, 0x7d, 0x58, 0x63, 0xfb, 0xdf, 0x49, 0x63, 0x95, 0x81, 0xe4, 0x20, 0x46, 0x08, 0x11,
+    0x7d, 0x0e, 0xf0, 0x71, 0x53, 0x7e, 0xc1, 0xeb, 0xdf, 0x86, 0xf9, 0xa4, 0xc2, 0x01, 0x3c, 0xbf,
+    0xfa, 0x54, 0x80, 0xa5, 0xae, 0x58, 0xfc, 0x0e, 0xea, 0x10, 0xf6, 0x28, 0xa8, 0xa6, 0x59, 0x85,
+    0x93, 0x74, 0x34, 0x44, 0x99, 0x93, 0x21, 0x62, 0x3d, 0x2e, 0x25, 0x29, 0xbc, 0xaf, 0x80, 0x95,
+    0x2a, 0x27, 0x8f, 0x60, 0x31, 0x05, 0xed, 0x5f, 0x53, 0xa8, 0xc4, 0x60, 0x85, 0x96, 0x4c, 0x2c,
+    0x02, 0x4c, 0x7e, 0x6f, 0xda, 0x08, 0x99, 0x68, 0xc4, 0x63, 0xa0, 0x0e, 0xe6, 0x89, 0x9d, 0xc8,
+    0xb3, 0xab, 0x4a, 0xc1, 0xc2, 0xea, 0x45, 0xdc, 0x0a, 0x78, 0x7c, 0xad, 0x42, 0x38, 0xac, 0x26,
+    0xac, 0xe7, 0x3b, 0xa4, 0xe2, 0x16, 0xce, 0x7d, 0x8b, 0x17, 0x4d, 0x3c, 0xca, 0x67, 0xc6, 0xfc,
+    0x2c, 0x4c, 0x33, 0x67, 0xb7, 0x29, 0xd7, 0x6c, 0x89, 0xa2, 0xdb, 0x86, 0xa9, 0xb8, 0x69, 0x7d,
+    0x76, 0x54, 0xf5, 0x14, 0xd2, 0x6d, 0xb2, 0xf1, 0x19, 0xc6, 0xec, 0xa5, 0x23, 0xd9, 0x97, 0xac,
+    0x76, 0x4f, 0xb2, 0x4c, 0x62, 0xfc, 0xda, 0xbe, 0xbb, 0x0a, 0x88, 0x6a, 0xf3, 0xaf, 0xbd, 0x80,
+};
+
+typedef struct {
+    aac_decoder_t *decoder;
+    std::vector<std::vector<unsigned char>> frames;
+    size_t next;
+} aac_decode_bench_t;
+
+static void aac_decode_bench(void *opaque, uint64_t iterations) {
+    aac_decode_bench_t *bench = (aac_decode_bench_t *) opaque;
+    for (uint64_t i = 0; i < iterations; i++) {
+        stream_frame_t *pcm;
+        if (bench->frames.empty()) {
+            pcm = aac_decoder_conceal(bench->decoder, i * 11609);
+        } else {
+            std::vector<unsigned char> &frame = bench->frames[bench->next];
+            pcm = aac_decoder_decode(bench->decoder, frame.data(), (int) frame.size(), i * 11609);
+            if (++bench->next == bench->frames.size()) {
+                bench->next = 0;
+                aac_decoder_flush(bench->decoder);
+            }
+        }
+        if (pcm) stream_frame_unref(pcm);
+    }
+}
+
+/* Decrypts the AAC-ELD frames of an audio capture recorded with rpiplay --record */
+static bool load_aac_frames(logger_t *logger, const char *filename, std::vector<std::vector<unsigned char>> &frames) {
+    audio_capture_header_t header;
+    audio_capture_packet_t packet;
+    audio_capture_reader_t *reader = audio_capture_reader_open(filename, &header);
+    if (!reader) {
+        return false;
+    }
+    raop_buffer_t *buffer = raop_buffer_init(logger, header.aeskey, header.aesiv, header.ecdh_secret);
+    std::vector<unsigned char> data;
+    int ret;
+    while ((ret = audio_capture_reader_next(reader, &packet)) > 0) {
+        data.resize(packet.size);
+        if (audio_capture_reader_data(reader, data.data(), packet.size) < 0) {
+            ret = -1;
+            break;
+        }
+        if (packet.channel != AUDIO_CAPTURE_CHANNEL_DATA || packet.size <= 12) {
+            continue;
+        }
+        std::vector<unsigned char> frame(packet.size - 12);
+        unsigned int frame_len;
+        raop_buffer_decrypt(buffer, data.data(), frame.data(), packet.size - 12, &frame_len);
+        frame.resize(frame_len);
+        frames.push_back(frame);
+    }
+    raop_buffer_destroy(buffer);
+    audio_capture_reader_close(reader);
+    return ret == 0;
+}
+#endif
+
+static std::string json_escape(const std::string &value) {
+    std::string escaped;
+    for (char c : value) {
+        if (c == '"' || c == '\\') {
+            escaped += '\\';
+            escaped += c;
+        } else if ((unsigned char) c >= 0x20) {
+            escaped += c;
+        }
+    }
+    return escaped;
+}
+
+/* Board model if the device tree has one, e.g. "Raspberry Pi 4 Model B Rev 1.4" */
+static std::string board_model() {
+    char model[128] = {};
+    FILE *file = fopen("/proc/device-tree/model", "rb");
+    if (file) {
+        size_t ret = fread(model, 1, sizeof(model) - 1, file);
+        model[ret] = '\0';
+        fclose(file);
+    }
+    return model;
+}
+
+static void print_json() {
+    struct utsname name;
+    if (uname(&name) < 0) {
+        memset(&name, 0, sizeof(name));
+    }
+    printf("{\n");
+    printf("  \"machine\": \"%s\",\n", json_escape(name.machine).c_str());
+    printf("  \"model\": \"%s\",\n", json_escape(board_model()).c_str());
+    printf("  \"min_time\": %.3f,\n", min_time);
+    char cpu_features[64];
+    cpu_features_describe(cpu_features_get(), cpu_features, sizeof(cpu_features));
+    printf("  \"cpu_features\": \"%s\",\n", cpu_features);
+    printf("  \"dsp_kernels\": \"%s\",\n", dsp_kernels_get()->name);
+    printf("  \"aes\": \"%s\",\n", aes_get_impl_name());
+    printf("  \"results\": [\n");
+    for (size_t i = 0; i < results.size(); i++) {
+        const bench_result_t &result = results[i];
+        printf("    {\"name\": \"%s\", \"size\": %d, \"iterations\": %llu, \"ns_per_op\": %.1f",
+               json_escape(result.name).c_str(), result.size, (unsigned long long) result.iterations, result.ns_per_op);
+        if (result.bytes_per_op > 0) {
+            printf(", \"mb_per_s\": %.2f", result.bytes_per_op * 1000.0 / result.ns_per_op);
+        }
+        printf("}%s\n", i + 1 < results.size() ? "," : "");
+    }
+    printf("  ]\n");
+    printf("}\n");
+}
+
+void print_info(char *name) {
+    printf("Usage: %s [-t seconds] [-f filter] [-audio capture] [-check]\n", name);
+    printf("Options:\n");
+    printf("-t seconds            Run every benchmark for at least this long (default %.1f)\n", DEFAULT_MIN_TIME);
+    printf("-f filter             Only run benchmarks whose name contains filter\n");
+    printf("-audio capture        Decode the AAC-ELD frames of an audio capture instead of concealing\n");
+    printf("-check                Check the output of the paths against known results instead of timing them\n");
+    printf("-h                    Displays this help\n");
+}
+
+int main(int argc, char *argv[]) {
+    const char *audio_capture_file = nullptr;
+    bool check_mode = false;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg(argv[i]);
+        if (arg == "-t") {
+            if (i == argc - 1) continue;
+            min_time = atof(argv[++i]);
+        } else if (arg == "-f") {
+            if (i == argc - 1) continue;
+            filter = argv[++i];
+        } else if (arg == "-audio") {
+            if (i == argc - 1) continue;
+            audio_capture_file = argv[++i];
+        } else if (arg == "-check") {
+            check_mode = true;
+        } else if (arg == "-h") {
+            print_info(argv[0]);
+            exit(0);
+        }
+    }
+
+    logger_t *logger = logger_init();
+    logger_set_level(logger, LOGGER_ERR);
+
+    if (check_mode) {
+        int status = run_checks(logger);
+        logger_destroy(logger);
+        return status;
+    }
+
+    static const int mirror_sizes[] = { 1024, 16384, 65536, 262144 };
+    for (size_t i = 0; i < sizeof(mirror_sizes)/sizeof(mirror_sizes[0]); i++) {
+        mirror_decrypt_bench_t bench;
+        bench.buffer = mirror_buffer_init(logger, bench_aeskey, bench_ecdh_secret);
+        mirror_buffer_init_aes(bench.buffer, 2497441178417290163ULL);
+        bench.data.assign(mirror_sizes[i], 0x5a);
+        run_bench("mirror_decrypt", mirror_sizes[i], mirror_sizes[i], mirror_decrypt_bench, &bench);
+        mirror_buffer_destroy(bench.buffer);
+    }
+
+    {
+        // The AES implementations side by side, the kernel's engine where there is one. The constant time
+        // check runs each on an all zero key and data and on random ones, a table based AES gets faster
+        // with fewer distinct lookups
+        static const aes_impl_t impls[] = { AES_IMPL_EVP, AES_IMPL_BITSLICED, AES_IMPL_AF_ALG };
+        static const char *impl_names[] = { "openssl", "bitsliced", "af_alg" };
+        unsigned char zero_key[16] = { 0 };
+        std::vector<unsigned char> random_data(16384);
+        srand(1);
+        for (size_t i = 0; i < random_data.size(); i++) {
+            random_data[i] = (unsigned char) rand();
+        }
+        for (int i = 0; i < 3; i++) {
+            aes_set_impl(impls[i]);
+            if (impls[i] == AES_IMPL_AF_ALG && !strcmp(aes_get_impl_name(), "openssl")) {
+                continue;
+            }
+            std::string name(impl_names[i]);
+            aes_bench_t bench;
+            bench.ctx = aes_ctr_init(bench_aeskey, bench_aesiv);
+            bench.data.assign(65536, 0x5a);
+            run_bench("aes_ctr_" + name, 65536, 65536, aes_ctr_bench, &bench);
+            aes_ctr_destroy(bench.ctx);
+
+            bench.ctx = aes_cbc_init(bench_aeskey, bench_aesiv, AES_DECRYPT);
+            bench.data.assign(512, 0x5a);
+            run_bench("aes_cbc_decrypt_" + name, 512, 512, aes_cbc_bench, &bench);
+            aes_cbc_destroy(bench.ctx);
+
+            bench.ctx = aes_ctr_init(zero_key, zero_key);
+            bench.data.assign(16384, 0);
+            run_bench("aes_ct_zeros_" + name, 16384, 16384, aes_ctr_bench, &bench);
+            aes_ctr_destroy(bench.ctx);
+            bench.ctx = aes_ctr_init(random_data.data(), random_data.data() + 16);
+            bench.data = random_data;
+            run_bench("aes_ct_random_" + name, 16384, 16384, aes_ctr_bench, &bench);
+            aes_ctr_destroy(bench.ctx);
+        }
+        aes_set_impl(AES_IMPL_AUTO);
+    }
+
+    static const int audio_sizes[] = { 128, 256, 512 };
+    for (size_t i = 0; i < sizeof(audio_sizes)/sizeof(audio_sizes[0]); i++) {
+        audio_decrypt_bench_t bench;
+        bench.buffer = raop_buffer_init(logger, bench_aeskey, bench_aesiv, bench_ecdh_secret);
+        bench.packet.assign(12 + audio_sizes[i], 0x5a);
+        bench.output.resize(audio_sizes[i]);
+        run_bench("audio_decrypt", audio_sizes[i], audio_sizes[i], audio_decrypt_bench, &bench);
+        raop_buffer_destroy(bench.buffer);
+    }
+
+    {
+        jitter_buffer_bench_t bench;
+        bench.buffer = raop_buffer_init(logger, bench_aeskey, bench_aesiv, bench_ecdh_secret);
+        bench.packet.assign(12 + 256, 0x5a);
+        bench.packet[0] = 0x80;
+        bench.packet[1] = 0x60;
+        bench.seqnum = 0;
+        bench.timestamp = 1000000;
+        run_bench("jitter_buffer_reorder", 256, 256, jitter_buffer_bench, &bench);
+        raop_buffer_destroy(bench.buffer);
+    }
+
+    {
+        // A 352 frame ALAC packet, the runtime pick against plain C
+        dsp_bench_t bench;
+        bench.samples.assign(2 * 352, 1000);
+        bench.u.assign(352, 1000);
+        bench.v.assign(352, -200);
+        const dsp_kernels_t *kernels = dsp_kernels_get();
+        bench.gain = dsp_gain_c;
+        bench.unmix = dsp_unmix_c;
+        run_bench("pcm_gain_c", 352, 2 * 352 * 2, pcm_gain_bench, &bench);
+        run_bench("alac_unmix_c", 352, 2 * 352 * 2, alac_unmix_bench, &bench);
+        bench.gain = kernels->gain;
+        bench.unmix = kernels->unmix;
+        run_bench("pcm_gain", 352, 2 * 352 * 2, pcm_gain_bench, &bench);
+        run_bench("alac_unmix", 352, 2 * 352 * 2, alac_unmix_bench, &bench);
+    }
+
+    static const int nal_counts[] = { 1, 4, 32 };
+    for (size_t i = 0; i < sizeof(nal_counts)/sizeof(nal_counts[0]); i++) {
+        // The rewrite only touches the NAL headers, so the cost goes with the NAL count, not the frame size
+        nal_rewrite_bench_t bench;
+        int frame_size = 65536;
+        int nal_size = frame_size / nal_counts[i] - 4;
+        for (int j = 0; j < nal_counts[i]; j++) {
+            unsigned char prefix[5] = { (unsigned char) (nal_size >> 24), (unsigned char) (nal_size >> 16),
+                                        (unsigned char) (nal_size >> 8), (unsigned char) nal_size, 0x41 };
+            bench.frame.insert(bench.frame.end(), prefix, prefix + 5);
+            bench.frame.insert(bench.frame.end(), nal_size - 1, 0x5a);
+        }
+        run_bench("nal_rewrite", nal_counts[i], 0, nal_rewrite_bench, &bench);
+    }
+
+    static const int idr_sizes[] = { 65536, 307200 };
+    for (size_t i = 0; i < sizeof(idr_sizes)/sizeof(idr_sizes[0]); i++) {
+        // An IDR in four slices, decrypted and then rewritten against the one pass kernel
+        mirror_decrypt_nals_bench_t bench;
+        int nal_size = idr_sizes[i] / 4 - 4;
+        for (int j = 0; j < 4; j++) {
+            unsigned char prefix[5] = { (unsigned char) (nal_size >> 24), (unsigned char) (nal_size >> 16),
+                                        (unsigned char) (nal_size >> 8), (unsigned char) nal_size, 0x65 };
+            bench.frame.insert(bench.frame.end(), prefix, prefix + 5);
+            bench.frame.insert(bench.frame.end(), nal_size - 1, 0x5a);
+        }
+        // CTR mode, decrypting the plain frame gives the ciphertext of it
+        bench.buffer = mirror_buffer_init(logger, bench_aeskey, bench_ecdh_secret);
+        mirror_buffer_init_aes(bench.buffer, 2497441178417290163ULL);
+        bench.encrypted = bench.frame;
+        mirror_buffer_decrypt_in_place(bench.buffer, bench.encrypted.data(), (int) bench.encrypted.size());
+        bench.fused = false;
+        run_bench("mirror_decrypt_rewrite", idr_sizes[i], idr_sizes[i], mirror_decrypt_nals_bench, &bench);
+        bench.fused = true;
+        run_bench("mirror_decrypt_nals", idr_sizes[i], idr_sizes[i], mirror_decrypt_nals_bench, &bench);
+        mirror_buffer_destroy(bench.buffer);
+    }
+
+    {
+        static const unsigned char loopback[] = { 127, 0, 0, 1 };
+        ntp_convert_bench_t bench;
+        bench.ntp = raop_ntp_init(logger, loopback, sizeof(loopback), 0);
+        bench.remote_time = 3800000000ULL * 1000000ULL;
+        bench.sink = 0;
+        run_bench("ntp_convert_remote_time", 0, 0, ntp_convert_bench, &bench);
+        raop_ntp_destroy(bench.ntp);
+    }
+
+    {
+        static const unsigned char loopback[] = { 127, 0, 0, 1 };
+        // A port nobody answers on, so the NTP thread sits waiting for a response when it is stopped
+        restart_bench_t bench;
+        raop_callbacks_t callbacks;
+        memset(&callbacks, 0, sizeof(callbacks));
+        bench.ntp = raop_ntp_init(logger, loopback, sizeof(loopback), 9);
+        bench.rtp = raop_rtp_init(logger, &callbacks, bench.ntp, loopback, sizeof(loopback),
+                                  bench_aeskey, bench_aesiv, bench_ecdh_secret);
+        bench.mirror = raop_rtp_mirror_init(logger, &callbacks, bench.ntp, loopback, sizeof(loopback),
+                                            bench_aeskey, bench_ecdh_secret);
+        run_bench("restart_ntp", 0, 0, restart_ntp_bench, &bench);
+        run_bench("restart_audio", 0, 0, restart_audio_bench, &bench);
+        run_bench("restart_mirror", 0, 0, restart_mirror_bench, &bench);
+        raop_rtp_mirror_destroy(bench.mirror);
+        raop_rtp_destroy(bench.rtp);
+        raop_ntp_destroy(bench.ntp);
+    }
+
+    {
+        rtsp_parse_bench_t bench;
+        bench.request = http_request_init();
+        bench.errors = 0;
+        run_bench("rtsp_parse_session", (int) (sizeof(rtsp_session)/sizeof(rtsp_session[0])), rtsp_session_bytes(),
+                  rtsp_parse_bench, &bench);
+        if (bench.errors) {
+            fprintf(stderr, "rtsp_parse_session: %d requests did not parse\n", bench.errors);
+        }
+        http_request_destroy(bench.request);
+    }
+
+    {
+        pair_verify_bench_t bench;
+        bench.ecdh_ours = x25519_key_generate();
+        bench.ecdh_theirs = x25519_key_generate();
+        bench.ed = ed25519_key_generate();
+        x25519_key_get_raw(bench.message, bench.ecdh_ours);
+        x25519_key_get_raw(bench.message + X25519_KEY_SIZE, bench.ecdh_theirs);
+        x25519_key_get_raw(bench.client_ecdh, bench.ecdh_theirs);
+        ed25519_key_get_raw(bench.client_ed, bench.ed);
+        // Without pairing_start_key_pool, so the pair_verify number includes the key generation the pool saves
+        bench.pairing = pairing_init_generate();
+        bench.errors = 0;
+        run_bench("x25519_generate", 0, 0, x25519_generate_bench, &bench);
+        run_bench("x25519_derive", 0, 0, x25519_derive_bench, &bench);
+        ed25519_sign(bench.signature, sizeof(bench.signature), bench.message, sizeof(bench.message), bench.ed);
+        run_bench("ed25519_verify", 0, 0, ed25519_verify_bench, &bench);
+        run_bench("ed25519_sign", 0, 0, ed25519_sign_bench, &bench);
+        run_bench("pair_verify", 0, 0, pair_verify_bench, &bench);
+        if (bench.errors) {
+            fprintf(stderr, "pair_verify: %d operations failed\n", bench.errors);
+        }
+        pairing_destroy(bench.pairing);
+        ed25519_key_destroy(bench.ed);
+        x25519_key_destroy(bench.ecdh_theirs);
+        x25519_key_destroy(bench.ecdh_ours);
+    }
+
+    {
+        fairplay_bench_t bench;
+        bench.logger = logger;
+        bench.errors = 0;
+        fairplay_messages(bench.setup, bench.handshake, bench.cipher, 3);
+        run_bench("fairplay_handshake", 0, 0, fairplay_handshake_bench, &bench);
+        if (bench.errors) {
+            fprintf(stderr, "fairplay_handshake: %d operations failed\n", bench.errors);
+        }
+    }
+
+#if defined(HAS_AAC_DECODER)
+    {
+        aac_decode_bench_t bench;
+        bench.next = 0;
+        bench.decoder = aac_decoder_init(logger);
+        if (bench.decoder) {
+            run_bench("aac_conceal", 480, 0, aac_decode_bench, &bench);
+            // Real frames from the capture, or the built-in ones
+            if (audio_capture_file && !load_aac_frames(logger, audio_capture_file, bench.frames)) {
+                fprintf(stderr, "Error: Could not read audio capture \"%s\".\n", audio_capture_file);
+                exit(1);
+            }
+            if (bench.frames.empty()) {
+                const unsigned char *frame = eld_frames;
+                for (size_t i = 0; i < sizeof(eld_frame_sizes) / sizeof(eld_frame_sizes[0]); i++) {
+                    bench.frames.emplace_back(frame, frame + eld_frame_sizes[i]);
+                    frame += eld_frame_sizes[i];
+                }
+            }
+            aac_decoder_flush(bench.decoder);
+            run_bench("aac_decode", 480, 0, aac_decode_bench, &bench);
+            aac_decoder_destroy(bench.decoder);
+        }
+    }
+#else
+    if (audio_capture_file) {
+        fprintf(stderr, "Built without the AAC decoder, ignoring the audio capture\n");
+    }
+#endif
+
+    print_json();
+    logger_destroy(logger);
+    return 0;
+}
@@ -0,0 +1,105 @@
+/**
+ * RPiPlay - An open-source AirPlay mirroring server for Raspberry Pi
+ * Copyright (C) 2019 Florian Draschbacher
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+#include <cstring>
+
+#include "log.h"
+#include "rpiplay_common.h"
+
+const video_renderer_list_entry_t video_renderers[] = {
+#if defined(HAS_RPI_RENDERER)
+    {"rpi", "Raspberry Pi OpenMAX accelerated H.264 renderer", video_renderer_rpi_init},
+#endif
+#if defined(HAS_MMAL_RENDERER)
+    {"mmal", "Raspberry Pi MMAL accelerated H.264 renderer with zero-copy input", video_renderer_mmal_init},
+#endif
+#if defined(HAS_GSTREAMER_RENDERER)
+    {"gstreamer", "GStreamer H.264 renderer", video_renderer_gstreamer_init},
+#endif
+#if defined(HAS_KMS_RENDERER)
+    {"kms", "V4L2 accelerated H.264 renderer showing frames on a KMS plane", video_renderer_kms_init},
+#endif
+#if defined(HAS_FFMPEG_RENDERER)
+    {"ffmpeg", "libavcodec H.264 renderer with SDL2 output", video_renderer_ffmpeg_init},
+#endif
+#if defined(HAS_DUMMY_RENDERER)
+    {"dummy", "Dummy renderer; does not actually display video", video_renderer_dummy_init},
+#endif
+};
+const size_t video_renderer_count = sizeof(video_renderers)/sizeof(video_renderers[0]);
+
+const audio_renderer_list_entry_t audio_renderers[] = {
+#if defined(HAS_RPI_RENDERER)
+    {"rpi", "OpenMAX audio renderer", audio_renderer_rpi_init},
+#endif
+#if defined(HAS_GSTREAMER_RENDERER)
+    {"gstreamer", "GStreamer audio renderer", audio_renderer_gstreamer_init},
+#endif
+#if defined(HAS_ALSA_RENDERER)
+    {"alsa", "Alsa renderer", audio_renderer_alsa_init},
+#endif
+#if defined(HAS_PIPEWIRE_RENDERER)
+    {"pipewire", "PipeWire renderer", audio_renderer_pipewire_init},
+#endif
+#if defined(HAS_DUMMY_RENDERER)
+    {"dummy", "Dummy renderer; does not actually play audio", audio_renderer_dummy_init},
+#endif
+};
+const size_t audio_renderer_count = sizeof(audio_renderers)/sizeof(audio_renderers[0]);
+
+video_init_func_t find_video_init_func(const char *name) {
+    for (size_t i = 0; i < video_renderer_count; i++) {
+        if (!strcmp(name, video_renderers[i].name)) {
+            return video_renderers[i].init_func;
+        }
+    }
+    return NULL;
+}
+
+audio_init_func_t find_audio_init_func(const char *name) {
+    for (size_t i = 0; i < audio_renderer_count; i++) {
+        if (!strcmp(name, audio_renderers[i].name)) {
+            return audio_renderers[i].init_func;
+        }
+    }
+    return NULL;
+}
+
+extern "C" void log_callback(void *cls, int level, const char *msg) {
+    switch (level) {
+        case LOGGER_DEBUG: {
+            LOGD("%s", msg);
+            break;
+        }
+        case LOGGER_WARNING: {
+            LOGW("%s", msg);
+            break;
+        }
+        case LOGGER_INFO: {
+            LOGI("%s", msg);
+            break;
+        }
+        case LOGGER_ERR: {
+            LOGE("%s", msg);
+            break;
+        }
+        default:
+            break;
+    }
+}
@@ -0,0 +1,62 @@
+/**
+ * RPiPlay - An open-source AirPlay mirroring server for Raspberry Pi
+ * Copyright (C) 2019 Florian Draschbacher
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+/*
+ * The renderers the build has and the log callback, shared by rpiplay and the
+ * tools that drive the same renderers and library.
+ */
+
+#ifndef RPIPLAY_COMMON_H
+#define RPIPLAY_COMMON_H
+
+#include <stddef.h>
+
+#include "lib/logger.h"
+#include "renderers/video_renderer.h"
+#include "renderers/audio_renderer.h"
+
+typedef video_renderer_t *(*video_init_func_t)(logger_t *logger, video_renderer_config_t const *config);
+typedef audio_renderer_t *(*audio_init_func_t)(logger_t *logger, video_renderer_t *video_renderer, audio_renderer_config_t const *config);
+
+typedef struct video_renderer_list_entry_s {
+    const char *name;
+    const char *description;
+    video_init_func_t init_func;
+} video_renderer_list_entry_t;
+
+typedef struct audio_renderer_list_entry_s {
+    const char *name;
+    const char *description;
+    audio_init_func_t init_func;
+} audio_renderer_list_entry_t;
+
+// The first of each is the default
+extern const video_renderer_list_entry_t video_renderers[];
+extern const size_t video_renderer_count;
+extern const audio_renderer_list_entry_t audio_renderers[];
+extern const size_t audio_renderer_count;
+
+// NULL if the build has no renderer of that name
+video_init_func_t find_video_init_func(const char *name);
+audio_init_func_t find_audio_init_func(const char *name);
+
+// Passes the library's and the renderers' messages on to log.h
+extern "C" void log_callback(void *cls, int level, const char *msg);
+
+#endif //RPIPLAY_COMMON_H
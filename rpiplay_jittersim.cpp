@@ -0,0 +1,457 @@
+/**
+ * RPiPlay - An open-source AirPlay mirroring server for Raspberry Pi
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+/*
+ * Runs the audio jitter buffer and its resend scheduler against a simulated
+ * network on virtual time, for every depth limit with and without
+ * adaptation, and prints how much latency each one costs and how many
+ * glitches it still lets through as JSON on stdout. Loss follows a
+ * Gilbert-Elliott model, delay a base plus Pareto distributed queueing, and
+ * reordering holds packets back by a few packet durations. Every setting
+ * sees the same first transmissions, only the resends differ.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <queue>
+#include <random>
+#include <string>
+#include <vector>
+#include <sys/utsname.h>
+
+extern "C" {
+#include "lib/logger.h"
+#include "lib/raop_buffer.h"
+#include "lib/latency_histogram.h"
+}
+
+#define DEFAULT_PACKETS 30000
+/* 480 samples of AAC-ELD at 44.1 kHz, in microseconds */
+#define DEFAULT_PACKET_DURATION 10884
+#define DEFAULT_DEPTHS "4,8,16,32,64"
+/* The receive thread wakes up at least this often to send resend requests, as raop_rtp's select does */
+#define TICK_INTERVAL 5000
+/* Time given to the last packets and their resends before a run ends */
+#define DRAIN_TIME 2000000
+/* The sender keeps this many packets for resending */
+#define SENDER_HISTORY 1000
+#define PAYLOAD_SIZE 128
+#define MAX_DELAY 10000000.0
+
+typedef struct {
+    int packets;
+    int packet_duration;
+    /* Gilbert-Elliott: transition probabilities between the good and bad state, and loss in each */
+    double p_good_bad;
+    double p_bad_good;
+    double loss_good;
+    double loss_bad;
+    /* One way delay, base plus Pareto with shape alpha and scale xm above it */
+    double base_delay;
+    double pareto_alpha;
+    double pareto_scale;
+    /* Share of packets held back by 1 to reorder_distance packet durations */
+    double reorder;
+    int reorder_distance;
+    unsigned int seed;
+} sim_network_t;
+
+typedef struct {
+    uint64_t time;
+    int index;
+    bool resend;
+} sim_event_t;
+
+struct sim_event_later {
+    bool operator()(const sim_event_t &a, const sim_event_t &b) const {
+        return a.time > b.time;
+    }
+};
+
+typedef struct {
+    int max_depth;
+    bool adaptive;
+    uint64_t played;
+    uint64_t glitches;
+    double mean_depth;
+    latency_histogram_stats_t latency;
+    raop_buffer_stats_t buffer;
+} sim_result_t;
+
+typedef struct {
+    const sim_network_t *network;
+    std::mt19937 random;
+    std::priority_queue<sim_event_t, std::vector<sim_event_t>, sim_event_later> events;
+    uint64_t now;
+    int sent;
+} sim_state_t;
+
+static const unsigned char sim_aeskey[16] = {
+    0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6, 0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c
+};
+static const unsigned char sim_aesiv[16] = {
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f
+};
+static const unsigned char sim_ecdh_secret[32] = { 0x42 };
+
+/* Starts close to the wrap so every run crosses it */
+static const unsigned short first_seqnum = 65000;
+/* Virtual time starts here rather than at 0, which enqueue takes as now */
+static const uint64_t start_time = 1000000;
+
+static uint64_t send_time(const sim_network_t *network, int index) {
+    return start_time + (uint64_t) index * network->packet_duration;
+}
+
+static double uniform(std::mt19937 &random) {
+    return std::uniform_real_distribution<double>(0.0, 1.0)(random);
+}
+
+static double sample_delay(const sim_network_t *network, std::mt19937 &random) {
+    double delay = network->base_delay;
+    if (network->pareto_scale > 0 && network->pareto_alpha > 0) {
+        double u = 1.0 - uniform(random);
+        delay += network->pareto_scale * (pow(u, -1.0 / network->pareto_alpha) - 1.0);
+    }
+    return delay < MAX_DELAY ? delay : MAX_DELAY;
+}
+
+/* Loss of the Gilbert-Elliott chain in its steady state, used for resends that don't follow the stream */
+static double average_loss(const sim_network_t *network) {
+    double transitions = network->p_good_bad + network->p_bad_good;
+    double bad = transitions > 0 ? network->p_good_bad / transitions : 0;
+    return (1.0 - bad) * network->loss_good + bad * network->loss_bad;
+}
+
+/* Arrival time of every first transmission, 0 for the lost ones */
+static std::vector<uint64_t> simulate_stream(const sim_network_t *network) {
+    std::mt19937 random(network->seed);
+    std::vector<uint64_t> arrivals(network->packets);
+    bool bad = false;
+
+    for (int i = 0; i < network->packets; i++) {
+        bad = bad ? uniform(random) >= network->p_bad_good : uniform(random) < network->p_good_bad;
+        if (uniform(random) < (bad ? network->loss_bad : network->loss_good)) {
+            arrivals[i] = 0;
+            continue;
+        }
+        double delay = sample_delay(network, random);
+        if (network->reorder > 0 && uniform(random) < network->reorder) {
+            delay += (double) (1 + random() % network->reorder_distance) * network->packet_duration;
+        }
+        arrivals[i] = send_time(network, i) + (uint64_t) delay;
+    }
+    return arrivals;
+}
+
+static uint64_t sim_clock(void *opaque) {
+    return ((sim_state_t *) opaque)->now;
+}
+
+/* The sender answers from its history, each request and resend crossing the network on its own */
+static int sim_resend(void *opaque, unsigned short seqnum, unsigned short count) {
+    sim_state_t *state = (sim_state_t *) opaque;
+    const sim_network_t *network = state->network;
+    double loss = average_loss(network);
+    unsigned short newest = (unsigned short) (first_seqnum + state->sent - 1);
+
+    if (uniform(state->random) < loss) {
+        return 0;
+    }
+    uint64_t request_arrival = state->now + (uint64_t) sample_delay(network, state->random);
+    for (unsigned short i = 0; i < count; i++) {
+        int index = state->sent - 1 - (unsigned short) (newest - (unsigned short) (seqnum + i));
+        if (index < 0 || index < state->sent - SENDER_HISTORY || uniform(state->random) < loss) {
+            continue;
+        }
+        sim_event_t event;
+        event.time = request_arrival + (uint64_t) sample_delay(network, state->random);
+        event.index = index;
+        event.resend = true;
+        state->events.push(event);
+    }
+    return 0;
+}
+
+static sim_result_t simulate(logger_t *logger, const sim_network_t *network, const std::vector<uint64_t> &arrivals,
+                             int max_depth, bool adaptive) {
+    sim_state_t state;
+    sim_result_t result;
+    unsigned char packet[12 + PAYLOAD_SIZE];
+    int next = 0;
+    int newest = -1;
+    double depth_sum = 0;
+    uint64_t depth_samples = 0;
+
+    memset(&result, 0, sizeof(result));
+    result.max_depth = max_depth;
+    result.adaptive = adaptive;
+    state.network = network;
+    state.random.seed(network->seed ^ 0x5bd1e995);
+    state.now = start_time;
+    state.sent = 0;
+
+    raop_buffer_t *buffer = raop_buffer_init(logger, sim_aeskey, sim_aesiv, sim_ecdh_secret);
+    raop_buffer_set_clock(buffer, sim_clock, &state);
+    raop_buffer_set_depth(buffer, max_depth, !adaptive);
+    latency_histogram_t *latency = latency_histogram_init();
+
+    memset(packet, 0x5a, sizeof(packet));
+    packet[0] = 0x80;
+    packet[1] = 0x60;
+
+    uint64_t end_time = send_time(network, network->packets - 1) + DRAIN_TIME;
+    uint64_t next_tick = start_time;
+    while (state.now < end_time) {
+        /* Packets go out on schedule, the lost ones are only known to the sender */
+        while (next < network->packets && send_time(network, next) <= state.now) {
+            if (arrivals[next]) {
+                sim_event_t event;
+                event.time = arrivals[next];
+                event.index = next;
+                event.resend = false;
+                state.events.push(event);
+            }
+            state.sent = ++next;
+        }
+
+        while (!state.events.empty() && state.events.top().time <= state.now) {
+            sim_event_t event = state.events.top();
+            state.events.pop();
+            unsigned short seqnum = (unsigned short) (first_seqnum + event.index);
+            packet[2] = seqnum >> 8;
+            packet[3] = seqnum;
+            if (!event.resend) {
+                if (event.index > newest) {
+                    newest = event.index;
+                } else {
+                    raop_buffer_note_reorder(buffer, newest - event.index);
+                }
+            }
+            raop_buffer_enqueue(buffer, packet, sizeof(packet), send_time(network, event.index), event.time, 1);
+        }
+
+        unsigned int payload_size;
+        uint64_t timestamp;
+        int lost;
+        void *payload;
+        while ((payload = raop_buffer_dequeue(buffer, &payload_size, &timestamp, 0, &lost)) || lost) {
+            if (payload) {
+                /* The timestamps are the send times, so this is the latency up to playout */
+                latency_histogram_record(latency, (int64_t) (state.now - timestamp));
+                result.played++;
+            } else {
+                result.glitches++;
+            }
+        }
+        raop_buffer_handle_resends(buffer, sim_resend, &state);
+
+        if (state.now >= next_tick) {
+            raop_buffer_stats_t stats;
+            raop_buffer_get_stats(buffer, &stats);
+            depth_sum += stats.target_depth;
+            depth_samples++;
+            next_tick += TICK_INTERVAL;
+        }
+
+        /* Jump to whatever happens next */
+        uint64_t wakeup = next_tick;
+        if (next < network->packets && send_time(network, next) < wakeup) {
+            wakeup = send_time(network, next);
+        }
+        if (!state.events.empty() && state.events.top().time < wakeup) {
+            wakeup = state.events.top().time;
+        }
+        state.now = wakeup > state.now ? wakeup : state.now + 1;
+    }
+
+    raop_buffer_get_stats(buffer, &result.buffer);
+    latency_histogram_get_stats(latency, &result.latency);
+    result.mean_depth = depth_samples ? depth_sum / depth_samples : 0;
+    latency_histogram_destroy(latency);
+    raop_buffer_destroy(buffer);
+    return result;
+}
+
+static std::vector<int> parse_depths(const char *list) {
+    std::vector<int> depths;
+    while (*list) {
+        char *end;
+        long depth = strtol(list, &end, 10);
+        if (end == list) {
+            break;
+        }
+        if (depth > 0) {
+            depths.push_back((int) depth);
+        }
+        list = *end == ',' ? end + 1 : end;
+    }
+    return depths;
+}
+
+static std::string json_escape(const std::string &value) {
+    std::string escaped;
+    for (char c : value) {
+        if (c == '"' || c == '\\') {
+            escaped += '\\';
+            escaped += c;
+        } else if ((unsigned char) c >= 0x20) {
+            escaped += c;
+        }
+    }
+    return escaped;
+}
+
+static void print_json(const sim_network_t *network, const std::vector<sim_result_t> &results) {
+    struct utsname name;
+    if (uname(&name) < 0) {
+        memset(&name, 0, sizeof(name));
+    }
+    printf("{\n");
+    printf("  \"machine\": \"%s\",\n", json_escape(name.machine).c_str());
+    printf("  \"network\": {\"packets\": %d, \"packet_duration_us\": %d, \"p_good_bad\": %g, \"p_bad_good\": %g, "
+           "\"loss_good\": %g, \"loss_bad\": %g, \"base_delay_ms\": %g, \"pareto_alpha\": %g, \"pareto_scale_ms\": %g, "
+           "\"reorder\": %g, \"reorder_distance\": %d, \"seed\": %u},\n",
+           network->packets, network->packet_duration, network->p_good_bad, network->p_bad_good,
+           network->loss_good, network->loss_bad, network->base_delay / 1000.0, network->pareto_alpha,
+           network->pareto_scale / 1000.0, network->reorder, network->reorder_distance, network->seed);
+    printf("  \"results\": [\n");
+    for (size_t i = 0; i < results.size(); i++) {
+        const sim_result_t &result = results[i];
+        uint64_t total = result.played + result.glitches;
+        printf("    {\"max_depth\": %d, \"adaptive\": %s, \"played\": %llu, \"glitches\": %llu, \"glitch_rate\": %.6f, "
+               "\"p50_ms\": %.2f, \"p95_ms\": %.2f, \"p99_ms\": %.2f, \"max_ms\": %.2f, \"mean_depth\": %.1f, "
+               "\"resend_requests\": %llu, \"recovered\": %llu, \"too_late\": %llu}%s\n",
+               result.max_depth, result.adaptive ? "true" : "false",
+               (unsigned long long) result.played, (unsigned long long) result.glitches,
+               total ? (double) result.glitches / total : 0.0,
+               result.latency.p50 / 1000.0, result.latency.p95 / 1000.0, result.latency.p99 / 1000.0,
+               result.latency.max / 1000.0, result.mean_depth,
+               (unsigned long long) result.buffer.resend_requests, (unsigned long long) result.buffer.recovered_packets,
+               (unsigned long long) result.buffer.too_late_packets, i + 1 < results.size() ? "," : "");
+    }
+    printf("  ]\n");
+    printf("}\n");
+}
+
+void print_info(char *name) {
+    printf("Usage: %s [options]\n", name);
+    printf("Options:\n");
+    printf("-n packets            Packets per run (default %d)\n", DEFAULT_PACKETS);
+    printf("-duration us          Packet duration (default %d)\n", DEFAULT_PACKET_DURATION);
+    printf("-depths list          Depth limits to run, comma separated (default %s)\n", DEFAULT_DEPTHS);
+    printf("-loss percent         Loss in the good state (default 0.1)\n");
+    printf("-burst p r percent    Gilbert-Elliott: chance to enter and leave the bad state per packet,\n");
+    printf("                      and loss in it (default 0.005 0.3 50)\n");
+    printf("-delay ms             Base one way delay (default 5)\n");
+    printf("-pareto alpha ms      Shape and scale of the queueing delay on top (default 1.5 2)\n");
+    printf("-reorder percent n    Hold back that share of packets by up to n packet durations (default 1 3)\n");
+    printf("-seed n               Random seed (default 1)\n");
+    printf("-h                    Displays this help\n");
+}
+
+int main(int argc, char *argv[]) {
+    sim_network_t network;
+    const char *depth_list = DEFAULT_DEPTHS;
+
+    network.packets = DEFAULT_PACKETS;
+    network.packet_duration = DEFAULT_PACKET_DURATION;
+    network.p_good_bad = 0.005;
+    network.p_bad_good = 0.3;
+    network.loss_good = 0.001;
+    network.loss_bad = 0.5;
+    network.base_delay = 5000;
+    network.pareto_alpha = 1.5;
+    network.pareto_scale = 2000;
+    network.reorder = 0.01;
+    network.reorder_distance = 3;
+    network.seed = 1;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg(argv[i]);
+        if (arg == "-n") {
+            if (i == argc - 1) continue;
+            network.packets = atoi(argv[++i]);
+        } else if (arg == "-duration") {
+            if (i == argc - 1) continue;
+            network.packet_duration = atoi(argv[++i]);
+        } else if (arg == "-depths") {
+            if (i == argc - 1) continue;
+            depth_list = argv[++i];
+        } else if (arg == "-loss") {
+            if (i == argc - 1) continue;
+            network.loss_good = atof(argv[++i]) / 100.0;
+        } else if (arg == "-burst") {
+            if (i >= argc - 3) continue;
+            network.p_good_bad = atof(argv[++i]);
+            network.p_bad_good = atof(argv[++i]);
+            network.loss_bad = atof(argv[++i]) / 100.0;
+        } else if (arg == "-delay") {
+            if (i == argc - 1) continue;
+            network.base_delay = atof(argv[++i]) * 1000.0;
+        } else if (arg == "-pareto") {
+            if (i >= argc - 2) continue;
+            network.pareto_alpha = atof(argv[++i]);
+            network.pareto_scale = atof(argv[++i]) * 1000.0;
+        } else if (arg == "-reorder") {
+            if (i >= argc - 2) continue;
+            network.reorder = atof(argv[++i]) / 100.0;
+            network.reorder_distance = atoi(argv[++i]);
+        } else if (arg == "-seed") {
+            if (i == argc - 1) continue;
+            network.seed = (unsigned int) strtoul(argv[++i], nullptr, 10);
+        } else if (arg == "-h") {
+            print_info(argv[0]);
+            exit(0);
+        }
+    }
+
+    std::vector<int> depths = parse_depths(depth_list);
+    if (network.packets <= 0 || network.packet_duration <= 0 || depths.empty()) {
+        fprintf(stderr, "Error: Nothing to simulate.\n");
+        exit(1);
+    }
+    if (network.reorder_distance < 1) {
+        network.reorder_distance = 1;
+    }
+
+    logger_t *logger = logger_init();
+    logger_set_level(logger, LOGGER_ERR);
+
+    std::vector<uint64_t> arrivals = simulate_stream(&network);
+    std::vector<sim_result_t> results;
+    for (size_t i = 0; i < depths.size(); i++) {
+        for (int adaptive = 1; adaptive >= 0; adaptive--) {
+            sim_result_t result = simulate(logger, &network, arrivals, depths[i], adaptive);
+            uint64_t total = result.played + result.glitches;
+            fprintf(stderr, "%-8s %3d  glitches %7.3f%%  p50 %7.1f ms  p99 %7.1f ms  depth %5.1f\n",
+                    adaptive ? "adaptive" : "fixed", result.max_depth,
+                    total ? 100.0 * result.glitches / total : 0.0,
+                    result.latency.p50 / 1000.0, result.latency.p99 / 1000.0, result.mean_depth);
+            results.push_back(result);
+        }
+    }
+
+    print_json(&network, results);
+    logger_destroy(logger);
+    return 0;
+}
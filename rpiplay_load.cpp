@@ -0,0 +1,1015 @@
+/**
+ * RPiPlay - An open-source AirPlay mirroring server for Raspberry Pi
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+/*
+ * Mirrors to a receiver the way an iOS sender would, to soak-test its latency
+ * and CPU usage. Every session runs the full handshake and then streams either
+ * synthetic H.264 and AAC-ELD at the requested rates or sessions recorded with
+ * rpiplay --record, re-encrypted with the keys of the new session.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/utsname.h>
+#include <openssl/rand.h>
+
+#include "log.h"
+#include "rpiplay_common.h"
+#include "lib/raop_client.h"
+#include "lib/logger.h"
+
+extern "C" {
+#include "lib/mirror_buffer.h"
+#include "lib/raop_buffer.h"
+#include "lib/raop_ntp.h"
+#include "lib/mirror_capture.h"
+#include "lib/audio_capture.h"
+#include "lib/byteutils.h"
+}
+
+#define DEFAULT_PORT 7000
+#define DEFAULT_SESSIONS 1
+#define DEFAULT_DURATION 60
+#define DEFAULT_FPS 30
+#define DEFAULT_VIDEO_BITRATE 4000
+#define DEFAULT_AUDIO_BITRATE 64
+#define DEFAULT_WIDTH 1920
+#define DEFAULT_HEIGHT 1080
+#define DEFAULT_GOP 120
+
+#define AUDIO_SAMPLE_RATE 44100
+#define AUDIO_FRAME_SAMPLES 480
+#define SYNC_INTERVAL 1000000
+#define FEEDBACK_INTERVAL 2000000
+
+typedef struct load_config_s {
+    std::string host;
+    unsigned short port;
+    int duration;
+    int fps;
+    int video_bitrate;
+    int audio_bitrate;
+    int width;
+    int height;
+    int gop;
+    bool video;
+    bool audio;
+    const char *mirror_capture;
+    const char *audio_capture;
+    /* Port of the receiver's --metrics server, 0 to not scrape it */
+    unsigned short metrics_port;
+} load_config_t;
+
+typedef struct video_frame_s {
+    std::vector<unsigned char> data;
+    bool is_codec;
+    float width;
+    float height;
+    /* Capture time relative to the start of the stream, in us */
+    uint64_t offset;
+} video_frame_t;
+
+static logger_t *logger = NULL;
+static volatile sig_atomic_t running = 1;
+
+static void signal_handler(int sig) {
+    switch (sig) {
+    case SIGINT:
+    case SIGTERM:
+        running = 0;
+        break;
+    }
+}
+
+/* Writes the RBSP of a synthetic H.264 NAL unit */
+class bit_writer {
+public:
+    std::vector<unsigned char> rbsp;
+
+    void put_bit(int bit) {
+        cache = (cache << 1) | (bit & 1);
+        if (++cached == 8) {
+            rbsp.push_back(cache);
+            cache = 0;
+            cached = 0;
+        }
+    }
+
+    void put_bits(uint32_t value, int count) {
+        for (int i = count - 1; i >= 0; i--) {
+            put_bit(value >> i);
+        }
+    }
+
+    void put_ue(uint32_t value) {
+        int length = 32 - __builtin_clz(value + 1);
+        put_bits(0, length - 1);
+        put_bits(value + 1, length);
+    }
+
+    void put_se(int32_t value) {
+        put_ue(value <= 0 ? -2 * value : 2 * value - 1);
+    }
+
+    void put_trailing_bits() {
+        put_bit(1);
+        while (cached) {
+            put_bit(0);
+        }
+    }
+
+private:
+    unsigned char cache = 0;
+    int cached = 0;
+};
+
+/* Inserts the emulation prevention bytes an RBSP needs to become a NAL unit */
+static std::vector<unsigned char> make_nal(int nal_header, const std::vector<unsigned char> &rbsp) {
+    std::vector<unsigned char> nal;
+    nal.reserve(rbsp.size() + rbsp.size() / 64 + 1);
+    nal.push_back(nal_header);
+    int zeros = 0;
+    for (unsigned char b : rbsp) {
+        if (zeros >= 2 && b <= 3) {
+            nal.push_back(3);
+            zeros = 0;
+        }
+        nal.push_back(b);
+        zeros = b == 0 ? zeros + 1 : 0;
+    }
+    return nal;
+}
+
+static void append_nal(std::vector<unsigned char> &frame, const std::vector<unsigned char> &nal) {
+    size_t offset = frame.size();
+    frame.resize(offset + 4 + nal.size());
+    byteutils_put_int_be(frame.data(), offset, nal.size());
+    memcpy(frame.data() + offset + 4, nal.data(), nal.size());
+}
+
+/*
+ * A gray picture in CAVLC baseline: IDR frames code every macroblock as
+ * I_16x16 DC prediction without residual, the frames in between skip every
+ * macroblock. Frames are padded with filler NAL units to the bitrate, which
+ * the receiver has to carry through its whole pipeline like real data.
+ */
+class synthetic_video {
+public:
+    synthetic_video(const load_config_t *config)
+        : fps(config->fps), gop(config->gop), width(config->width), height(config->height) {
+        mb_width = (width + 15) / 16;
+        mb_height = (height + 15) / 16;
+        frame_budget = (uint64_t) config->video_bitrate * 1000 / 8 / fps;
+        make_sps();
+        make_pps();
+    }
+
+    void next(video_frame_t &frame) {
+        frame.data.clear();
+        frame.is_codec = false;
+        frame.offset = index * 1000000 / fps;
+        if (index == 0 && !codec_sent) {
+            make_avcc(frame.data);
+            frame.is_codec = true;
+            frame.width = width;
+            frame.height = height;
+            codec_sent = true;
+            return;
+        }
+        int position = index % gop;
+        if (position == 0) {
+            append_nal(frame.data, make_idr(index / gop));
+        } else {
+            append_nal(frame.data, make_p(position));
+        }
+        pad(frame.data);
+        index++;
+    }
+
+private:
+    int fps;
+    int gop;
+    int width;
+    int height;
+    int mb_width;
+    int mb_height;
+    uint64_t frame_budget;
+    uint64_t index = 0;
+    bool codec_sent = false;
+    std::vector<unsigned char> sps;
+    std::vector<unsigned char> pps;
+
+    void make_sps() {
+        bit_writer writer;
+        writer.put_bits(66, 8);  // profile_idc, baseline
+        writer.put_bits(0xc0, 8);  // constraint_set0_flag, constraint_set1_flag
+        writer.put_bits(42, 8);  // level_idc
+        writer.put_ue(0);  // seq_parameter_set_id
+        writer.put_ue(0);  // log2_max_frame_num_minus4
+        writer.put_ue(2);  // pic_order_cnt_type
+        writer.put_ue(1);  // max_num_ref_frames
+        writer.put_bit(0);  // gaps_in_frame_num_value_allowed_flag
+        writer.put_ue(mb_width - 1);
+        writer.put_ue(mb_height - 1);
+        writer.put_bit(1);  // frame_mbs_only_flag
+        writer.put_bit(1);  // direct_8x8_inference_flag
+        int crop_right = (mb_width * 16 - width) / 2;
+        int crop_bottom = (mb_height * 16 - height) / 2;
+        writer.put_bit(crop_right || crop_bottom);
+        if (crop_right || crop_bottom) {
+            writer.put_ue(0);
+            writer.put_ue(crop_right);
+            writer.put_ue(0);
+            writer.put_ue(crop_bottom);
+        }
+        writer.put_bit(0);  // vui_parameters_present_flag
+        writer.put_trailing_bits();
+        sps = make_nal(0x67, writer.rbsp);
+    }
+
+    void make_pps() {
+        bit_writer writer;
+        writer.put_ue(0);  // pic_parameter_set_id
+        writer.put_ue(0);  // seq_parameter_set_id
+        writer.put_bit(0);  // entropy_coding_mode_flag, CAVLC
+        writer.put_bit(0);  // bottom_field_pic_order_in_frame_present_flag
+        writer.put_ue(0);  // num_slice_groups_minus1
+        writer.put_ue(0);  // num_ref_idx_l0_default_active_minus1
+        writer.put_ue(0);  // num_ref_idx_l1_default_active_minus1
+        writer.put_bit(0);  // weighted_pred_flag
+        writer.put_bits(0, 2);  // weighted_bipred_idc
+        writer.put_se(0);  // pic_init_qp_minus26
+        writer.put_se(0);  // pic_init_qs_minus26
+        writer.put_se(0);  // chroma_qp_index_offset
+        writer.put_bit(1);  // deblocking_filter_control_present_flag
+        writer.put_bit(0);  // constrained_intra_pred_flag
+        writer.put_bit(0);  // redundant_pic_cnt_present_flag
+        writer.put_trailing_bits();
+        pps = make_nal(0x68, writer.rbsp);
+    }
+
+    void make_avcc(std::vector<unsigned char> &avcc) {
+        avcc.push_back(1);
+        avcc.insert(avcc.end(), sps.begin() + 1, sps.begin() + 4);
+        avcc.push_back(0xff);
+        avcc.push_back(0xe1);
+        avcc.push_back(sps.size() >> 8);
+        avcc.push_back(sps.size() & 0xff);
+        avcc.insert(avcc.end(), sps.begin(), sps.end());
+        avcc.push_back(1);
+        avcc.push_back(pps.size() >> 8);
+        avcc.push_back(pps.size() & 0xff);
+        avcc.insert(avcc.end(), pps.begin(), pps.end());
+    }
+
+    std::vector<unsigned char> make_idr(uint64_t idr_pic_id) {
+        bit_writer writer;
+        writer.put_ue(0);  // first_mb_in_slice
+        writer.put_ue(7);  // slice_type, I
+        writer.put_ue(0);  // pic_parameter_set_id
+        writer.put_bits(0, 4);  // frame_num
+        writer.put_ue(idr_pic_id & 0xffff);
+        writer.put_bit(0);  // no_output_of_prior_pics_flag
+        writer.put_bit(0);  // long_term_reference_flag
+        writer.put_se(0);  // slice_qp_delta
+        writer.put_ue(1);  // disable_deblocking_filter_idc
+        for (int i = 0; i < mb_width * mb_height; i++) {
+            // mb_type I_16x16_2_0_0 (DC prediction, no coded blocks), intra_chroma_pred_mode DC,
+            // mb_qp_delta 0 and an empty Intra16x16DCLevel
+            writer.put_bits(0x27, 8);
+        }
+        writer.put_trailing_bits();
+        return make_nal(0x65, writer.rbsp);
+    }
+
+    std::vector<unsigned char> make_p(int frame_num) {
+        bit_writer writer;
+        writer.put_ue(0);  // first_mb_in_slice
+        writer.put_ue(5);  // slice_type, P
+        writer.put_ue(0);  // pic_parameter_set_id
+        writer.put_bits(frame_num & 0xf, 4);
+        writer.put_bit(0);  // num_ref_idx_active_override_flag
+        writer.put_bit(0);  // ref_pic_list_modification_flag_l0
+        writer.put_bit(0);  // adaptive_ref_pic_marking_mode_flag
+        writer.put_se(0);  // slice_qp_delta
+        writer.put_ue(1);  // disable_deblocking_filter_idc
+        writer.put_ue(mb_width * mb_height);  // mb_skip_run
+        writer.put_trailing_bits();
+        return make_nal(0x41, writer.rbsp);
+    }
+
+    void pad(std::vector<unsigned char> &data) {
+        // Length prefix, NAL header and the trailing 0x80 of the filler NAL unit
+        if (data.size() + 6 > frame_budget) {
+            return;
+        }
+        size_t filler = frame_budget - data.size() - 6;
+        size_t offset = data.size();
+        data.resize(frame_budget, 0xff);
+        byteutils_put_int_be(data.data(), offset, filler + 2);
+        data[offset + 4] = 0x0c;
+        data[data.size() - 1] = 0x80;
+    }
+};
+
+/* Replays the frames of a mirror capture in a loop, decrypted with the keys it was recorded with */
+class capture_video {
+public:
+    capture_video(const char *filename) : filename(filename) {}
+
+    ~capture_video() {
+        close();
+    }
+
+    bool open() {
+        mirror_capture_header_t header;
+        reader = mirror_capture_reader_open(filename, &header);
+        if (!reader) {
+            return false;
+        }
+        buffer = mirror_buffer_init(logger, header.aeskey, header.ecdh_secret);
+        mirror_buffer_init_aes(buffer, header.stream_connection_id);
+        have_first = false;
+        return true;
+    }
+
+    bool next(video_frame_t &frame) {
+        mirror_capture_frame_t capture_frame;
+        while (true) {
+            int ret = mirror_capture_reader_next(reader, &capture_frame);
+            if (ret == 0) {
+                // Loop, one frame interval after the last frame
+                close();
+                base = last_offset + 1000000 / DEFAULT_FPS;
+                if (!open() || (ret = mirror_capture_reader_next(reader, &capture_frame)) == 0) {
+                    return false;
+                }
+            }
+            if (ret < 0) {
+                return false;
+            }
+            frame.data.resize(capture_frame.payload_size);
+            if (mirror_capture_reader_payload(reader, frame.data.data(), capture_frame.payload_size) < 0) {
+                return false;
+            }
+            int type = capture_frame.header[4];
+            if (type != 0 && type != 1) {
+                continue;
+            }
+            frame.is_codec = type == 1;
+            if (frame.is_codec) {
+                frame.width = byteutils_get_float(capture_frame.header, 56);
+                frame.height = byteutils_get_float(capture_frame.header, 60);
+            } else {
+                if (capture_frame.has_key_offset) {
+                    mirror_buffer_seek(buffer, capture_frame.key_offset);
+                }
+                mirror_buffer_decrypt_in_place(buffer, frame.data.data(), frame.data.size());
+            }
+            uint64_t timestamp = raop_ntp_timestamp_to_micro_seconds(byteutils_get_long(capture_frame.header, 8), false);
+            if (!have_first && timestamp) {
+                first_timestamp = timestamp;
+                have_first = true;
+            }
+            if (have_first && timestamp > first_timestamp && base + timestamp - first_timestamp > last_offset) {
+                last_offset = base + timestamp - first_timestamp;
+            }
+            frame.offset = last_offset;
+            return true;
+        }
+    }
+
+private:
+    const char *filename;
+    mirror_capture_reader_t *reader = NULL;
+    mirror_buffer_t *buffer = NULL;
+    uint64_t first_timestamp = 0;
+    bool have_first = false;
+    uint64_t base = 0;
+    uint64_t last_offset = 0;
+
+    void close() {
+        if (buffer) {
+            mirror_buffer_destroy(buffer);
+            buffer = NULL;
+        }
+        if (reader) {
+            mirror_capture_reader_close(reader);
+            reader = NULL;
+        }
+    }
+};
+
+/*
+ * A silent AAC-ELD frame for the 44.1 kHz stereo configuration iOS uses, padded
+ * with fill elements to the bitrate. Decodes to silence at any size.
+ */
+static void make_silent_aac(int bitrate, std::vector<unsigned char> &frame) {
+    static const unsigned char header[] = {0x14, 0xa0, 0x02, 0xa8, 0x00, 0xa1, 0x0a};
+    size_t size = (size_t) bitrate * 1000 / 8 * AUDIO_FRAME_SAMPLES / AUDIO_SAMPLE_RATE;
+    if (size < sizeof(header) + 1) {
+        size = sizeof(header) + 1;
+    }
+    frame.assign(size, 0x5a);
+    memcpy(frame.data(), header, sizeof(header));
+    frame[size - 1] = 0x50;
+}
+
+/* Replays the AAC-ELD frames of an audio capture in a loop */
+class capture_audio {
+public:
+    capture_audio(const char *filename) : filename(filename) {}
+
+    ~capture_audio() {
+        close();
+    }
+
+    bool open() {
+        audio_capture_header_t header;
+        reader = audio_capture_reader_open(filename, &header);
+        if (!reader) {
+            return false;
+        }
+        buffer = raop_buffer_init(logger, header.aeskey, header.aesiv, header.ecdh_secret);
+        return true;
+    }
+
+    bool next(std::vector<unsigned char> &frame) {
+        audio_capture_packet_t packet;
+        bool looped = false;
+        while (true) {
+            int ret = audio_capture_reader_next(reader, &packet);
+            if (ret == 0) {
+                close();
+                if (looped || !open()) {
+                    return false;
+                }
+                looped = true;
+                continue;
+            }
+            if (ret < 0) {
+                return false;
+            }
+            data.resize(packet.size);
+            if (audio_capture_reader_data(reader, data.data(), packet.size) < 0) {
+                return false;
+            }
+            if (packet.channel != AUDIO_CAPTURE_CHANNEL_DATA || packet.size <= 12) {
+                continue;
+            }
+            // The packets iOS sends while nothing plays carry no audio
+            if (packet.size == 16 && data[12] == 0x00 && data[13] == 0x68 && data[14] == 0x34 && data[15] == 0x00) {
+                continue;
+            }
+            frame.resize(packet.size - 12);
+            unsigned int frame_len;
+            raop_buffer_decrypt(buffer, data.data(), frame.data(), packet.size - 12, &frame_len);
+            frame.resize(frame_len);
+            return true;
+        }
+    }
+
+private:
+    const char *filename;
+    audio_capture_reader_t *reader = NULL;
+    raop_buffer_t *buffer = NULL;
+    std::vector<unsigned char> data;
+
+    void close() {
+        if (buffer) {
+            raop_buffer_destroy(buffer);
+            buffer = NULL;
+        }
+        if (reader) {
+            audio_capture_reader_close(reader);
+            reader = NULL;
+        }
+    }
+};
+
+typedef struct load_session_s {
+    int id;
+    const load_config_t *config;
+    pthread_t thread;
+    bool failed;
+    raop_client_stats_t stats;
+    uint64_t duration;
+    /* Frames that went out more than one frame interval after they were due */
+    uint64_t late_frames;
+    uint64_t max_lateness;
+    /* /metrics.json of the receiver, scraped before the teardown while the session still exists */
+    std::string metrics;
+} load_session_t;
+
+static void sleep_until(raop_client_t *client, uint64_t time) {
+    uint64_t now = raop_client_get_time(client);
+    if (time > now) {
+        struct timespec delay;
+        delay.tv_sec = (time - now) / 1000000;
+        delay.tv_nsec = (time - now) % 1000000 * 1000;
+        nanosleep(&delay, NULL);
+    }
+}
+
+static bool run_session(load_session_t *session, raop_client_t *client) {
+    const load_config_t *config = session->config;
+    synthetic_video *video_synthetic = NULL;
+    capture_video *video_capture = NULL;
+    capture_audio *audio_capture = NULL;
+    std::vector<unsigned char> silent_frame;
+    video_frame_t frame;
+    std::vector<unsigned char> audio_frame;
+    bool ok = false;
+
+    if (raop_client_connect(client) < 0) {
+        return false;
+    }
+    if (config->video) {
+        if (raop_client_setup_mirror(client) < 0) {
+            return false;
+        }
+        if (config->mirror_capture) {
+            video_capture = new capture_video(config->mirror_capture);
+            if (!video_capture->open()) {
+                LOGE("Could not open mirror capture %s", config->mirror_capture);
+                goto cleanup;
+            }
+        } else {
+            video_synthetic = new synthetic_video(config);
+        }
+    }
+    if (config->audio) {
+        if (raop_client_setup_audio(client) < 0) {
+            goto cleanup;
+        }
+        if (config->audio_capture) {
+            audio_capture = new capture_audio(config->audio_capture);
+            if (!audio_capture->open()) {
+                LOGE("Could not open audio capture %s", config->audio_capture);
+                goto cleanup;
+            }
+        } else {
+            make_silent_aac(config->audio_bitrate, silent_frame);
+        }
+    }
+
+    {
+        uint64_t start = raop_client_get_time(client);
+        uint64_t end = start + (uint64_t) config->duration * 1000000;
+        uint64_t frame_interval = 1000000 / config->fps;
+        uint64_t next_video = UINT64_MAX;
+        uint64_t next_audio = config->audio ? start : UINT64_MAX;
+        uint64_t next_sync = next_audio;
+        uint64_t next_feedback = start + FEEDBACK_INTERVAL;
+        uint64_t audio_packets = 0;
+        uint32_t rtp_start;
+        RAND_bytes((unsigned char *) &rtp_start, sizeof(rtp_start));
+
+        bool video_pending = false;
+        if (config->video) {
+            video_pending = video_capture ? video_capture->next(frame) : (video_synthetic->next(frame), true);
+            next_video = video_pending ? start + frame.offset : UINT64_MAX;
+        }
+
+        while (running) {
+            uint64_t next = next_video;
+            if (next_audio < next) next = next_audio;
+            if (next_sync < next) next = next_sync;
+            if (next_feedback < next) next = next_feedback;
+            if (next >= end) {
+                ok = true;
+                break;
+            }
+            sleep_until(client, next);
+
+            if (next == next_sync) {
+                // The sync packet goes out ahead of the audio packet due at the same time
+                uint32_t rtp_time = rtp_start + (next_sync - start) * AUDIO_SAMPLE_RATE / 1000000;
+                raop_client_send_sync(client, rtp_time, next_sync);
+                next_sync += SYNC_INTERVAL;
+            } else if (next == next_audio) {
+                const std::vector<unsigned char> *payload = &silent_frame;
+                if (audio_capture) {
+                    if (!audio_capture->next(audio_frame)) {
+                        LOGE("Could not read audio capture %s", config->audio_capture);
+                        break;
+                    }
+                    payload = &audio_frame;
+                }
+                if (raop_client_send_audio(client, payload->data(), payload->size(),
+                                           rtp_start + audio_packets * AUDIO_FRAME_SAMPLES) < 0) {
+                    break;
+                }
+                audio_packets++;
+                next_audio = start + audio_packets * AUDIO_FRAME_SAMPLES * 1000000 / AUDIO_SAMPLE_RATE;
+            } else if (next == next_video) {
+                int ret;
+                if (frame.is_codec) {
+                    ret = raop_client_send_codec(client, frame.data.data(), frame.data.size(), frame.width, frame.height,
+                                                 next_video);
+                } else {
+                    ret = raop_client_send_video(client, frame.data.data(), frame.data.size(), next_video);
+                    uint64_t lateness = raop_client_get_time(client) - next_video;
+                    if (lateness > frame_interval) {
+                        session->late_frames++;
+                    }
+                    if (lateness > session->max_lateness) {
+                        session->max_lateness = lateness;
+                    }
+                }
+                if (ret < 0) {
+                    break;
+                }
+                video_pending = video_capture ? video_capture->next(frame) : (video_synthetic->next(frame), true);
+                if (!video_pending) {
+                    LOGE("Could not read mirror capture %s", config->mirror_capture);
+                    break;
+                }
+                next_video = start + frame.offset;
+            } else {
+                if (raop_client_feedback(client) < 0) {
+                    break;
+                }
+                next_feedback += FEEDBACK_INTERVAL;
+            }
+        }
+        session->duration = raop_client_get_time(client) - start;
+    }
+
+    cleanup:
+    delete video_synthetic;
+    delete video_capture;
+    delete audio_capture;
+    return ok;
+}
+
+/* GETs /metrics.json from the receiver's metrics server into body */
+static bool fetch_metrics(const std::string &host, unsigned short port, std::string &body) {
+    struct addrinfo hints = {}, *addresses;
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &addresses)) {
+        return false;
+    }
+    int fd = -1;
+    for (struct addrinfo *address = addresses; address && fd < 0; address = address->ai_next) {
+        fd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+        if (fd >= 0 && connect(fd, address->ai_addr, address->ai_addrlen) < 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(addresses);
+    if (fd < 0) {
+        return false;
+    }
+
+    std::string request = "GET /metrics.json HTTP/1.1\r\nHost: " + host + "\r\n\r\n";
+    std::string response;
+    bool ok = send(fd, request.data(), request.size(), MSG_NOSIGNAL) == (ssize_t) request.size();
+    size_t header_end = std::string::npos;
+    size_t content_length = 0;
+    while (ok) {
+        char buffer[4096];
+        ssize_t ret = recv(fd, buffer, sizeof(buffer), 0);
+        if (ret <= 0) {
+            ok = false;
+            break;
+        }
+        response.append(buffer, ret);
+        if (header_end == std::string::npos && (header_end = response.find("\r\n\r\n")) != std::string::npos) {
+            header_end += 4;
+            size_t length = response.find("Content-Length:");
+            if (response.compare(0, 12, "HTTP/1.1 200") || length == std::string::npos || length > header_end) {
+                ok = false;
+                break;
+            }
+            content_length = strtoul(response.c_str() + length + 15, NULL, 10);
+        }
+        if (header_end != std::string::npos && response.size() >= header_end + content_length) {
+            break;
+        }
+    }
+    close(fd);
+    if (ok) {
+        body = response.substr(header_end, content_length);
+    }
+    return ok;
+}
+
+/* Value of "key":"..." in a line of /metrics.json, empty if the line has none */
+static std::string json_field(const std::string &line, const std::string &key) {
+    std::string prefix = "\"" + key + "\":\"";
+    size_t start = line.find(prefix);
+    if (start == std::string::npos) {
+        return "";
+    }
+    start += prefix.size();
+    return line.substr(start, line.find('"', start) - start);
+}
+
+typedef struct display_latency_s {
+    double p50;
+    double p95;
+    double p99;
+    uint64_t count;
+} display_latency_t;
+
+/* Picks the glass-to-glass latency of every receiver session out of a scrape, one sample per line */
+static void parse_display_latency(const std::string &metrics, std::map<std::string, display_latency_t> &latencies) {
+    size_t start = 0;
+    while (start < metrics.size()) {
+        size_t end = metrics.find('\n', start);
+        if (end == std::string::npos) end = metrics.size();
+        std::string line = metrics.substr(start, end - start);
+        start = end + 1;
+
+        std::string name = json_field(line, "name");
+        size_t value = line.find("\"value\":");
+        if (json_field(line, "stage") != "display" || value == std::string::npos) {
+            continue;
+        }
+        double seconds = strtod(line.c_str() + value + 8, NULL);
+        display_latency_t &latency = latencies[json_field(line, "session")];
+        if (name == "raop_video_latency_seconds_count") {
+            latency.count = (uint64_t) seconds;
+        } else if (name == "raop_video_latency_seconds") {
+            std::string quantile = json_field(line, "quantile");
+            if (quantile == "0.5") latency.p50 = seconds * 1000;
+            else if (quantile == "0.95") latency.p95 = seconds * 1000;
+            else if (quantile == "0.99") latency.p99 = seconds * 1000;
+        }
+    }
+}
+
+static std::string json_escape(const std::string &value) {
+    std::string escaped;
+    for (char c : value) {
+        if (c == '"' || c == '\\') {
+            escaped += '\\';
+            escaped += c;
+        } else if ((unsigned char) c >= 0x20) {
+            escaped += c;
+        }
+    }
+    return escaped;
+}
+
+/* Prints the glass-to-glass latency as JSON like rpiplay-bench does, so it can be kept with its results */
+static void print_display_latency(const load_config_t *config, const std::map<std::string, display_latency_t> &latencies) {
+    struct utsname name;
+    if (uname(&name) < 0) {
+        memset(&name, 0, sizeof(name));
+    }
+    printf("{\n");
+    printf("  \"machine\": \"%s\",\n", json_escape(name.machine).c_str());
+    printf("  \"receiver\": \"%s\",\n", json_escape(config->host).c_str());
+    printf("  \"fps\": %d,\n", config->fps);
+    printf("  \"video_kbps\": %d,\n", config->video_bitrate);
+    printf("  \"results\": [\n");
+    size_t i = 0;
+    for (const auto &latency : latencies) {
+        printf("    {\"name\": \"glass_to_glass\", \"session\": \"%s\", \"frames\": %llu, "
+               "\"p50_ms\": %.1f, \"p95_ms\": %.1f, \"p99_ms\": %.1f}%s\n",
+               json_escape(latency.first).c_str(), (unsigned long long) latency.second.count, latency.second.p50,
+               latency.second.p95, latency.second.p99, ++i < latencies.size() ? "," : "");
+    }
+    printf("  ]\n");
+    printf("}\n");
+}
+
+static void *session_thread(void *arg) {
+    load_session_t *session = (load_session_t *) arg;
+    raop_client_t *client = raop_client_init(logger, session->config->host.c_str(), session->config->port);
+    if (!client) {
+        session->failed = true;
+        return NULL;
+    }
+    session->failed = !run_session(session, client);
+    if (!session->failed && session->config->metrics_port) {
+        if (!fetch_metrics(session->config->host, session->config->metrics_port, session->metrics)) {
+            LOGW("Could not scrape the receiver's metrics on port %u", session->config->metrics_port);
+        }
+    }
+    raop_client_get_stats(client, &session->stats);
+    raop_client_teardown(client);
+    raop_client_destroy(client);
+    return NULL;
+}
+
+static void print_session(const char *name, const load_session_t *session, const raop_client_stats_t *stats,
+                          uint64_t duration, int sessions) {
+    double seconds = duration / 1000000.0;
+    if (seconds <= 0) seconds = 1;
+    LOGI("%s: handshake %.1f ms, %llu frames (%.2f Mbit/s), %llu late (max %.1f ms), "
+         "send blocked %.1f ms (max %.1f ms), %llu audio packets (%.1f kbit/s), %llu time requests",
+         name, stats->handshake_time / 1000.0 / sessions, (unsigned long long) stats->video_frames,
+         stats->video_bytes * 8 / seconds / 1000000, (unsigned long long) session->late_frames,
+         session->max_lateness / 1000.0, stats->video_send_time / 1000.0, stats->video_send_time_max / 1000.0,
+         (unsigned long long) stats->audio_packets, stats->audio_bytes * 8 / seconds / 1000,
+         (unsigned long long) stats->timing_requests);
+}
+
+void print_info(char *name) {
+    printf("Usage: %s [-c sessions] [-t seconds] [-fps n] [-vb kbit/s] [-ab kbit/s] [-s WxH] [-g frames] "
+           "[-mirror capture] [-audio capture] [-novideo] [-noaudio] [-d] host[:port]\n", name);
+    printf("Options:\n");
+    printf("-c sessions           Mirror this many sessions at once (default %d)\n", DEFAULT_SESSIONS);
+    printf("-t seconds            Stream for this long (default %d)\n", DEFAULT_DURATION);
+    printf("-fps n                Synthetic video frame rate (default %d)\n", DEFAULT_FPS);
+    printf("-vb kbit/s            Synthetic video bitrate (default %d)\n", DEFAULT_VIDEO_BITRATE);
+    printf("-ab kbit/s            Synthetic audio bitrate (default %d)\n", DEFAULT_AUDIO_BITRATE);
+    printf("-s WxH                Synthetic video size (default %dx%d)\n", DEFAULT_WIDTH, DEFAULT_HEIGHT);
+    printf("-g frames             Synthetic video keyframe interval (default %d)\n", DEFAULT_GOP);
+    printf("-mirror capture       Stream the video of a mirror capture recorded with rpiplay --record\n");
+    printf("-audio capture        Stream the audio of an audio capture recorded with rpiplay --record\n");
+    printf("-novideo              Do not set up the mirror stream\n");
+    printf("-noaudio              Do not set up the audio stream\n");
+    printf("-metrics port         Print the receiver's glass-to-glass latency from its --metrics port as JSON\n");
+    printf("-d                    Enable debug logging\n");
+    printf("-h                    Displays this help\n");
+    printf("The receiver port defaults to %d\n", DEFAULT_PORT);
+}
+
+int main(int argc, char *argv[]) {
+    load_config_t config;
+    config.port = DEFAULT_PORT;
+    config.duration = DEFAULT_DURATION;
+    config.fps = DEFAULT_FPS;
+    config.video_bitrate = DEFAULT_VIDEO_BITRATE;
+    config.audio_bitrate = DEFAULT_AUDIO_BITRATE;
+    config.width = DEFAULT_WIDTH;
+    config.height = DEFAULT_HEIGHT;
+    config.gop = DEFAULT_GOP;
+    config.video = true;
+    config.audio = true;
+    config.mirror_capture = NULL;
+    config.audio_capture = NULL;
+    config.metrics_port = 0;
+    int sessions = DEFAULT_SESSIONS;
+    bool debug_log = false;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg(argv[i]);
+        if (arg == "-c") {
+            if (i == argc - 1) continue;
+            sessions = atoi(argv[++i]);
+        } else if (arg == "-t") {
+            if (i == argc - 1) continue;
+            config.duration = atoi(argv[++i]);
+        } else if (arg == "-fps") {
+            if (i == argc - 1) continue;
+            config.fps = atoi(argv[++i]);
+        } else if (arg == "-vb") {
+            if (i == argc - 1) continue;
+            config.video_bitrate = atoi(argv[++i]);
+        } else if (arg == "-ab") {
+            if (i == argc - 1) continue;
+            config.audio_bitrate = atoi(argv[++i]);
+        } else if (arg == "-s") {
+            if (i == argc - 1) continue;
+            if (sscanf(argv[++i], "%dx%d", &config.width, &config.height) != 2) {
+                fprintf(stderr, "Error: Invalid size \"%s\", expected WxH.\n", argv[i]);
+                exit(1);
+            }
+        } else if (arg == "-g") {
+            if (i == argc - 1) continue;
+            config.gop = atoi(argv[++i]);
+        } else if (arg == "-mirror") {
+            if (i == argc - 1) continue;
+            config.mirror_capture = argv[++i];
+        } else if (arg == "-audio") {
+            if (i == argc - 1) continue;
+            config.audio_capture = argv[++i];
+        } else if (arg == "-novideo") {
+            config.video = false;
+        } else if (arg == "-noaudio") {
+            config.audio = false;
+        } else if (arg == "-metrics") {
+            if (i == argc - 1) continue;
+            config.metrics_port = atoi(argv[++i]);
+        } else if (arg == "-d") {
+            debug_log = !debug_log;
+        } else if (arg == "-h") {
+            print_info(argv[0]);
+            exit(0);
+        } else {
+            config.host = arg;
+        }
+    }
+    if (config.host.empty()) {
+        print_info(argv[0]);
+        exit(1);
+    }
+    size_t separator = config.host.rfind(':');
+    if (separator != std::string::npos && config.host.find(':') == separator) {
+        config.port = atoi(config.host.c_str() + separator + 1);
+        config.host.resize(separator);
+    }
+    if (sessions < 1 || config.fps < 1 || config.gop < 1 || config.width < 16 || config.height < 16) {
+        fprintf(stderr, "Error: Invalid session count, frame rate, keyframe interval or size.\n");
+        exit(1);
+    }
+
+    struct sigaction sigact;
+    sigact.sa_handler = signal_handler;
+    sigemptyset(&sigact.sa_mask);
+    sigact.sa_flags = 0;
+    sigaction(SIGINT, &sigact, NULL);
+    sigaction(SIGTERM, &sigact, NULL);
+
+    logger = logger_init();
+    logger_set_callback(logger, log_callback, NULL);
+    logger_set_level(logger, debug_log ? LOGGER_DEBUG : LOGGER_INFO);
+
+    std::vector<load_session_t> session_list(sessions);
+    for (int i = 0; i < sessions; i++) {
+        load_session_t *session = &session_list[i];
+        session->id = i;
+        session->config = &config;
+        if (pthread_create(&session->thread, NULL, session_thread, session)) {
+            LOGE("Could not start session %d", i);
+            session->failed = true;
+            session->thread = 0;
+        }
+    }
+
+    load_session_t total = {};
+    uint64_t max_duration = 0;
+    int failed = 0;
+    std::map<std::string, display_latency_t> display_latency;
+    for (int i = 0; i < sessions; i++) {
+        load_session_t *session = &session_list[i];
+        if (session->thread) {
+            pthread_join(session->thread, NULL);
+        }
+        std::string name = "Session " + std::to_string(i);
+        if (session->failed) {
+            LOGE("%s failed", name.c_str());
+            failed++;
+            continue;
+        }
+        print_session(name.c_str(), session, &session->stats, session->duration, 1);
+        // Every scrape has the sessions still streaming, later ones replace the earlier numbers
+        parse_display_latency(session->metrics, display_latency);
+        total.stats.handshake_time += session->stats.handshake_time;
+        total.stats.video_frames += session->stats.video_frames;
+        total.stats.video_bytes += session->stats.video_bytes;
+        total.stats.video_send_time += session->stats.video_send_time;
+        if (session->stats.video_send_time_max > total.stats.video_send_time_max) {
+            total.stats.video_send_time_max = session->stats.video_send_time_max;
+        }
+        total.stats.audio_packets += session->stats.audio_packets;
+        total.stats.audio_bytes += session->stats.audio_bytes;
+        total.stats.timing_requests += session->stats.timing_requests;
+        total.late_frames += session->late_frames;
+        if (session->max_lateness > total.max_lateness) {
+            total.max_lateness = session->max_lateness;
+        }
+        if (session->duration > max_duration) {
+            max_duration = session->duration;
+        }
+    }
+    if (sessions > 1 && failed < sessions) {
+        print_session("Total", &total, &total.stats, max_duration, sessions - failed);
+    }
+    if (config.metrics_port) {
+        for (auto it = display_latency.begin(); it != display_latency.end();) {
+            it = it->second.count ? std::next(it) : display_latency.erase(it);
+        }
+        if (display_latency.empty()) {
+            LOGW("The receiver reported no glass-to-glass latency, its video renderer may not know when frames are shown");
+        }
+        print_display_latency(&config, display_latency);
+    }
+
+    logger_destroy(logger);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,345 @@
+/**
+ * RPiPlay - An open-source AirPlay mirroring server for Raspberry Pi
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+/*
+ * Runs the NTP clock discipline of raop_ntp against a simulated iOS timing
+ * responder on virtual time, with and without the burst of requests at the
+ * start and the frequency tracking, and prints how long each takes to
+ * converge and how far off it stays as JSON on stdout. The sender's clock
+ * runs at a drift against ours, each way of the network has a base delay of
+ * its own, so an asymmetry shows as the bias it causes, plus Pareto
+ * distributed queueing, and requests or responses may be lost. Every
+ * variant sees the same network.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+#include <sys/utsname.h>
+
+extern "C" {
+#include "lib/logger.h"
+#include "lib/raop_ntp.h"
+}
+
+#define DEFAULT_DURATION 600
+/* The clock estimate is checked this often, in us */
+#define CHECK_INTERVAL 100000
+/* raop_ntp's thread gives up on a response after this long and polls again, in us */
+#define RESPONSE_TIMEOUT 300000
+/* The sender's clock counts from its last boot plus the seconds from 1900 to 1970, in us */
+#define REMOTE_EPOCH (2208988800ull * 1000000 + 86400ull * 1000000)
+#define MAX_DELAY 10000000.0
+
+typedef struct {
+    double duration;
+    /* Base one way delay to the sender and back, in us */
+    double delay_to;
+    double delay_from;
+    /* Queueing on top of each way, Pareto with shape alpha and scale xm */
+    double pareto_alpha;
+    double pareto_scale;
+    /* Chance for each packet to be lost */
+    double loss;
+    /* Rate of the sender's clock against ours, in ppm */
+    double drift;
+    /* Time the sender takes to answer, uniform between 0 and twice this, in us */
+    double turnaround;
+    /* Error below which the estimate counts as converged, in us */
+    double threshold;
+    unsigned int seed;
+} sim_network_t;
+
+typedef struct {
+    double p50;
+    double p99;
+    double max;
+} percentiles_t;
+
+typedef struct {
+    std::string name;
+    int discipline;
+    /* Until the first estimate and until the error stays below the threshold, -1 if it never does, in s */
+    double first_estimate;
+    double converged;
+    /* Of the error over the second half of the run, in us */
+    double bias;
+    double rms;
+    percentiles_t error;
+    /* Requests lost or answered too late */
+    uint64_t timeouts;
+    raop_ntp_stats_t ntp;
+} sim_result_t;
+
+static const struct {
+    const char *name;
+    int discipline;
+} variants[] = {
+    {"full", 0},
+    {"no-burst", RAOP_NTP_NO_BURST},
+    {"no-skew", RAOP_NTP_NO_SKEW},
+    {"neither", RAOP_NTP_NO_BURST | RAOP_NTP_NO_SKEW}
+};
+
+/* Local time at which the simulation starts, in us */
+static const uint64_t start_time = 1000000;
+
+static double uniform(std::mt19937 &random) {
+    return std::uniform_real_distribution<double>(0.0, 1.0)(random);
+}
+
+static double sample_delay(const sim_network_t *network, double base, std::mt19937 &random) {
+    double delay = base;
+    if (network->pareto_scale > 0 && network->pareto_alpha > 0) {
+        double u = 1.0 - uniform(random);
+        delay += network->pareto_scale * (pow(u, -1.0 / network->pareto_alpha) - 1.0);
+    }
+    return delay < MAX_DELAY ? delay : MAX_DELAY;
+}
+
+/* The sender's clock at local time, which is the true time of the simulation */
+static uint64_t remote_time(const sim_network_t *network, uint64_t local_time) {
+    return REMOTE_EPOCH + local_time + (uint64_t) ((double) local_time * network->drift / 1000000.0);
+}
+
+static uint64_t sim_clock(void *opaque) {
+    return *(uint64_t *) opaque;
+}
+
+static percentiles_t get_percentiles(std::vector<double> &values) {
+    percentiles_t result = {0, 0, 0};
+    if (values.empty()) {
+        return result;
+    }
+    std::sort(values.begin(), values.end());
+    result.p50 = values[values.size() / 2];
+    result.p99 = values[std::min(values.size() - 1, (size_t) (values.size() * 0.99))];
+    result.max = values.back();
+    return result;
+}
+
+static sim_result_t simulate(logger_t *logger, const sim_network_t *network, const char *name, int discipline) {
+    static const unsigned char loopback[] = { 127, 0, 0, 1 };
+    std::mt19937 random(network->seed);
+    sim_result_t result;
+    uint64_t now = start_time;
+    uint64_t end_time = start_time + (uint64_t) (network->duration * 1000000.0);
+    uint64_t next_request = start_time;
+    uint64_t last_bad = start_time;
+    bool converged = false;
+    std::vector<double> errors;
+    double error_sum = 0, error_squares = 0;
+
+    result.name = name;
+    result.discipline = discipline;
+    result.first_estimate = -1;
+    result.timeouts = 0;
+
+    raop_ntp_t *ntp = raop_ntp_init(logger, loopback, sizeof(loopback), 0);
+    raop_ntp_set_clock(ntp, sim_clock, &now);
+    raop_ntp_set_discipline(ntp, discipline);
+
+    for (now = start_time; now < end_time; now += CHECK_INTERVAL) {
+        // Exchanges done by now; the next request waits for the response or its timeout
+        while (next_request + RESPONSE_TIMEOUT <= now) {
+            uint64_t t0 = next_request;
+            uint64_t check_time = now;
+            now = t0;
+            uint64_t interval = raop_ntp_simulate_request(ntp);
+            bool lost = uniform(random) < network->loss;
+            double to = sample_delay(network, network->delay_to, random);
+            double turnaround = uniform(random) * 2.0 * network->turnaround;
+            double from = sample_delay(network, network->delay_from, random);
+            lost |= uniform(random) < network->loss;
+            uint64_t rtt = (uint64_t) (to + turnaround + from);
+            if (!lost && rtt < RESPONSE_TIMEOUT) {
+                uint64_t t1 = remote_time(network, t0 + (uint64_t) to);
+                uint64_t t2 = remote_time(network, t0 + (uint64_t) (to + turnaround));
+                now = t0 + rtt;
+                raop_ntp_simulate_response(ntp, t0, t1, t2, now);
+            } else {
+                rtt = RESPONSE_TIMEOUT;
+                result.timeouts++;
+            }
+            now = check_time;
+            next_request = t0 + rtt + interval;
+        }
+
+        raop_ntp_sync_t sync;
+        if (!raop_ntp_get_sync(ntp, &sync)) {
+            continue;
+        }
+        if (result.first_estimate < 0) {
+            result.first_estimate = (now - start_time) / 1000000.0;
+        }
+        double error = (double) (int64_t) (raop_ntp_convert_local_time(ntp, now) - remote_time(network, now));
+        if (fabs(error) > network->threshold) {
+            last_bad = now;
+            converged = false;
+        } else if (!converged) {
+            converged = true;
+            last_bad = now;
+        }
+        if (now - start_time >= (end_time - start_time) / 2) {
+            errors.push_back(fabs(error));
+            error_sum += error;
+            error_squares += error * error;
+        }
+    }
+
+    result.converged = converged ? (last_bad - start_time) / 1000000.0 : -1;
+    result.bias = errors.empty() ? 0 : error_sum / errors.size();
+    result.rms = errors.empty() ? 0 : sqrt(error_squares / errors.size());
+    result.error = get_percentiles(errors);
+    raop_ntp_get_stats(ntp, &result.ntp);
+    raop_ntp_destroy(ntp);
+    return result;
+}
+
+static std::string json_escape(const std::string &value) {
+    std::string escaped;
+    for (char c : value) {
+        if (c == '"' || c == '\\') {
+            escaped += '\\';
+            escaped += c;
+        } else if ((unsigned char) c >= 0x20) {
+            escaped += c;
+        }
+    }
+    return escaped;
+}
+
+static void print_json(const sim_network_t *network, const std::vector<sim_result_t> &results) {
+    struct utsname name;
+    if (uname(&name) < 0) {
+        memset(&name, 0, sizeof(name));
+    }
+    printf("{\n");
+    printf("  \"machine\": \"%s\",\n", json_escape(name.machine).c_str());
+    printf("  \"network\": {\"duration_s\": %g, \"delay_to_ms\": %g, \"delay_from_ms\": %g, \"pareto_alpha\": %g, "
+           "\"pareto_scale_ms\": %g, \"loss\": %g, \"drift_ppm\": %g, \"turnaround_us\": %g, \"threshold_us\": %g, "
+           "\"asymmetry_bias_us\": %g, \"seed\": %u},\n",
+           network->duration, network->delay_to / 1000.0, network->delay_from / 1000.0, network->pareto_alpha,
+           network->pareto_scale / 1000.0, network->loss, network->drift, network->turnaround, network->threshold,
+           (network->delay_to - network->delay_from) / 2.0, network->seed);
+    printf("  \"results\": [\n");
+    for (size_t i = 0; i < results.size(); i++) {
+        const sim_result_t &result = results[i];
+        printf("    {\"variant\": \"%s\", \"burst\": %s, \"skew\": %s, \"first_estimate_s\": %.2f, \"converged_s\": %.2f, "
+               "\"bias_us\": %.1f, \"rms_us\": %.1f, \"p50_us\": %.1f, \"p99_us\": %.1f, \"max_us\": %.1f, "
+               "\"skew_ppm\": %.2f, \"requests\": %llu, \"responses\": %llu, \"timeouts\": %llu, \"rejected\": %llu}%s\n",
+               result.name.c_str(), result.discipline & RAOP_NTP_NO_BURST ? "false" : "true",
+               result.discipline & RAOP_NTP_NO_SKEW ? "false" : "true", result.first_estimate, result.converged,
+               result.bias, result.rms, result.error.p50, result.error.p99, result.error.max, result.ntp.skew,
+               (unsigned long long) result.ntp.requests, (unsigned long long) result.ntp.responses,
+               (unsigned long long) result.timeouts, (unsigned long long) result.ntp.rejected, i + 1 < results.size() ? "," : "");
+    }
+    printf("  ]\n");
+    printf("}\n");
+}
+
+void print_info(char *name) {
+    printf("Usage: %s [options]\n", name);
+    printf("Options:\n");
+    printf("-t seconds            Length of a run (default %d)\n", DEFAULT_DURATION);
+    printf("-delay to from        Base one way delay to the sender and back in ms (default 3 3)\n");
+    printf("-pareto alpha ms      Shape and scale of the queueing delay on top of each (default 1.5 1)\n");
+    printf("-loss percent         Loss of each request and response (default 1)\n");
+    printf("-drift ppm            Rate of the sender's clock against ours (default 40)\n");
+    printf("-turnaround us        Mean time the sender takes to answer (default 100)\n");
+    printf("-threshold us         Error the estimate has converged below (default 1000)\n");
+    printf("-seed n               Random seed (default 1)\n");
+    printf("-h                    Displays this help\n");
+}
+
+int main(int argc, char *argv[]) {
+    sim_network_t network;
+
+    network.duration = DEFAULT_DURATION;
+    network.delay_to = 3000;
+    network.delay_from = 3000;
+    network.pareto_alpha = 1.5;
+    network.pareto_scale = 1000;
+    network.loss = 0.01;
+    network.drift = 40;
+    network.turnaround = 100;
+    network.threshold = 1000;
+    network.seed = 1;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg(argv[i]);
+        if (arg == "-t") {
+            if (i == argc - 1) continue;
+            network.duration = atof(argv[++i]);
+        } else if (arg == "-delay") {
+            if (i >= argc - 2) continue;
+            network.delay_to = atof(argv[++i]) * 1000.0;
+            network.delay_from = atof(argv[++i]) * 1000.0;
+        } else if (arg == "-pareto") {
+            if (i >= argc - 2) continue;
+            network.pareto_alpha = atof(argv[++i]);
+            network.pareto_scale = atof(argv[++i]) * 1000.0;
+        } else if (arg == "-loss") {
+            if (i == argc - 1) continue;
+            network.loss = atof(argv[++i]) / 100.0;
+        } else if (arg == "-drift") {
+            if (i == argc - 1) continue;
+            network.drift = atof(argv[++i]);
+        } else if (arg == "-turnaround") {
+            if (i == argc - 1) continue;
+            network.turnaround = atof(argv[++i]);
+        } else if (arg == "-threshold") {
+            if (i == argc - 1) continue;
+            network.threshold = atof(argv[++i]);
+        } else if (arg == "-seed") {
+            if (i == argc - 1) continue;
+            network.seed = (unsigned int) strtoul(argv[++i], nullptr, 10);
+        } else if (arg == "-h") {
+            print_info(argv[0]);
+            exit(0);
+        }
+    }
+
+    if (network.duration <= 0 || network.threshold <= 0) {
+        fprintf(stderr, "Error: Nothing to simulate.\n");
+        exit(1);
+    }
+
+    logger_t *logger = logger_init();
+    logger_set_level(logger, LOGGER_ERR);
+
+    std::vector<sim_result_t> results;
+    for (const auto &variant : variants) {
+        sim_result_t result = simulate(logger, &network, variant.name, variant.discipline);
+        fprintf(stderr, "%-9s first %5.2f s  converged %7.2f s  bias %8.1f us  rms %8.1f us  p99 %8.1f us  skew %6.2f ppm\n",
+                result.name.c_str(), result.first_estimate, result.converged, result.bias, result.rms,
+                result.error.p99, result.ntp.skew);
+        results.push_back(result);
+    }
+
+    print_json(&network, results);
+    logger_destroy(logger);
+    return 0;
+}
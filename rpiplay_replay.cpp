@@ -0,0 +1,732 @@
+/**
+ * RPiPlay - An open-source AirPlay mirroring server for Raspberry Pi
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+/*
+ * Plays a mirror or audio session recorded with rpiplay --record through the
+ * same decrypt, NAL rewrite, jitter buffer and renderer paths a live sender
+ * would take. With -bench it pushes an Annex-B stream or the frames of an
+ * audio recording straight into the renderer as fast as it takes them.
+ */
+
+#include <stddef.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "rpiplay_common.h"
+#include "lib/raop.h"
+#include "lib/stream.h"
+#include "lib/logger.h"
+extern "C" {
+#include "lib/audio_capture.h"
+#include "lib/raop_buffer.h"
+}
+#include "renderers/video_renderer.h"
+#include "renderers/audio_renderer.h"
+#if defined(HAS_AAC_DECODER)
+#include "renderers/aac_decoder.h"
+#include "renderers/alac_decoder.h"
+#endif
+
+#define DEFAULT_LOW_LATENCY false
+#define DEFAULT_LATENCY_BUDGET 0
+#define DEFAULT_REORDER_DEPTH -1
+#define DEFAULT_PRESENTATION_LATENCY 100
+#define DEFAULT_AUDIO_DEVICE AUDIO_DEVICE_HDMI
+
+/* How long -bench waits for the renderer to finish what it was given, in us */
+#define BENCH_DRAIN_TIMEOUT 10000000
+
+/* A unit of the stream -bench pushes, as the mirror path hands it over: codec data or one access unit */
+typedef struct bench_unit_s {
+    std::vector<unsigned char> data;
+    std::vector<h264_nal_unit_t> nal_units;
+    /* 0 for codec data, 1 for a frame, like h264_decode_struct */
+    int type;
+    bool keyframe;
+} bench_unit_t;
+
+static video_renderer_t *video_renderer = NULL;
+static audio_renderer_t *audio_renderer = NULL;
+#if defined(HAS_AAC_DECODER)
+static aac_decoder_t *audio_decoder = NULL;
+static alac_decoder_t *alac_decoder = NULL;
+static pcm_scheduler_t *audio_scheduler = NULL;
+#endif
+// What the capture's packets hold, captures from before it was recorded are AAC-ELD
+static int audio_compression = RAOP_AUDIO_CT_AAC_ELD;
+
+static bool is_audio_capture(const char *filename) {
+    char magic[8] = {};
+    FILE *file = fopen(filename, "rb");
+    if (!file) {
+        return false;
+    }
+    size_t ret = fread(magic, 1, sizeof(magic), file);
+    fclose(file);
+    return ret == sizeof(magic) && !memcmp(magic, AUDIO_CAPTURE_MAGIC, sizeof(magic));
+}
+
+/* Elementary streams start with a start code, captures with their magic */
+static bool is_annexb(const char *filename) {
+    unsigned char start[4] = {};
+    FILE *file = fopen(filename, "rb");
+    if (!file) {
+        return false;
+    }
+    size_t ret = fread(start, 1, sizeof(start), file);
+    fclose(file);
+    return ret == sizeof(start) && start[0] == 0 && start[1] == 0 &&
+           (start[2] == 1 || (start[2] == 0 && start[3] == 1));
+}
+
+static bool is_hevc_file(const std::string &filename) {
+    static const char *suffixes[] = { ".h265", ".265", ".hevc" };
+    for (size_t i = 0; i < sizeof(suffixes)/sizeof(suffixes[0]); i++) {
+        size_t length = strlen(suffixes[i]);
+        if (filename.size() > length && filename.compare(filename.size() - length, length, suffixes[i]) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Splits an Annex-B stream into the units the mirror path hands over: parameter sets as codec
+ * data, everything else as access units, which start at an access unit delimiter, a NAL unit
+ * other than a slice after the slices of a picture, or the first slice of a new picture.
+ */
+static bool load_annexb(const char *filename, video_codec_t codec, std::vector<bench_unit_t> &units) {
+    FILE *file = fopen(filename, "rb");
+    if (!file) {
+        return false;
+    }
+    std::vector<unsigned char> stream;
+    unsigned char chunk[65536];
+    size_t ret;
+    while ((ret = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+        stream.insert(stream.end(), chunk, chunk + ret);
+    }
+    bool error = ferror(file);
+    fclose(file);
+    if (error) {
+        return false;
+    }
+
+    int header_size = codec == VIDEO_CODEC_H265 ? 2 : 1;
+    bench_unit_t *unit = nullptr;
+    bool unit_has_slice = false;
+    size_t size = stream.size();
+    size_t pos = 0;
+    while (pos + 3 <= size && !(stream[pos] == 0 && stream[pos + 1] == 0 && stream[pos + 2] == 1)) pos++;
+    while (pos + 3 <= size) {
+        size_t start = pos + 3;
+        size_t end = start;
+        while (end + 3 <= size && !(stream[end] == 0 && stream[end + 1] == 0 && stream[end + 2] == 1)) end++;
+        pos = end + 3 <= size ? end : size;
+        if (end + 3 > size) end = size;
+        // Trailing zeros are the leading zero of a four byte start code or padding
+        while (end > start && stream[end - 1] == 0) end--;
+        if (end - start <= (size_t) header_size) {
+            continue;
+        }
+
+        int nal_type = video_nal_type(codec, stream[start]);
+        bool parameter_set = codec == VIDEO_CODEC_H265 ? nal_type >= 32 && nal_type <= 34 : nal_type == 7 || nal_type == 8;
+        bool delimiter = nal_type == (codec == VIDEO_CODEC_H265 ? 35 : 9);
+        bool slice = video_nal_is_slice(codec, nal_type);
+        // first_mb_in_slice of 0 or first_slice_segment_in_pic_flag, both the first bit after the header
+        bool first_slice = slice && (stream[start + header_size] & 0x80);
+        bool suffix = codec == VIDEO_CODEC_H265 && nal_type == 40;
+        int type = parameter_set ? 0 : 1;
+        if (!unit || unit->type != type ||
+            (type == 1 && unit_has_slice && (delimiter || first_slice || (!slice && !suffix)))) {
+            units.push_back(bench_unit_t());
+            unit = &units.back();
+            unit->type = type;
+            unit->keyframe = false;
+            unit_has_slice = false;
+        }
+        static const unsigned char start_code[4] = { 0, 0, 0, 1 };
+        unit->data.insert(unit->data.end(), start_code, start_code + 4);
+        h264_nal_unit_t nal_unit;
+        nal_unit.offset = (int) unit->data.size();
+        nal_unit.size = (int) (end - start);
+        nal_unit.nal_type = nal_type;
+        unit->nal_units.push_back(nal_unit);
+        unit->data.insert(unit->data.end(), stream.begin() + start, stream.begin() + end);
+        if (video_nal_is_keyframe(codec, nal_type)) unit->keyframe = true;
+        if (slice) unit_has_slice = true;
+    }
+    return !units.empty();
+}
+
+/* Decrypts the frames of an audio capture recorded with rpiplay --record */
+static bool load_audio_frames(logger_t *logger, const char *filename, audio_capture_header_t *header,
+                              std::vector<std::vector<unsigned char>> &frames) {
+    audio_capture_packet_t packet;
+    audio_capture_reader_t *reader = audio_capture_reader_open(filename, header);
+    if (!reader) {
+        return false;
+    }
+    raop_buffer_t *buffer = raop_buffer_init(logger, header->aeskey, header->aesiv, header->ecdh_secret);
+    std::vector<unsigned char> data;
+    int ret;
+    while ((ret = audio_capture_reader_next(reader, &packet)) > 0) {
+        data.resize(packet.size);
+        if (audio_capture_reader_data(reader, data.data(), packet.size) < 0) {
+            ret = -1;
+            break;
+        }
+        if (packet.channel != AUDIO_CAPTURE_CHANNEL_DATA || packet.size <= 12) {
+            continue;
+        }
+        std::vector<unsigned char> frame(packet.size - 12);
+        unsigned int frame_len;
+        raop_buffer_decrypt(buffer, data.data(), frame.data(), packet.size - 12, &frame_len);
+        frame.resize(frame_len);
+        frames.push_back(frame);
+    }
+    raop_buffer_destroy(buffer);
+    audio_capture_reader_close(reader);
+    return ret == 0 && !frames.empty();
+}
+
+void print_info(char *name) {
+    printf("Usage: %s [-vr renderer] [-ar renderer] [-max] [-bench] [-loss pct] [-jitter ms] [-l] [-L ms] [-rd depth] [-d] capture\n", name);
+    printf("Options:\n");
+    printf("-vr renderer          Set video renderer to use:");
+    for (size_t i = 0; i < video_renderer_count; i++) {
+        printf(" %s%s", video_renderers[i].name, i == 0 ? " [Default]" : "");
+    }
+    printf("\n");
+    printf("-ar renderer          Set audio renderer to use:");
+    for (size_t i = 0; i < audio_renderer_count; i++) {
+        printf(" %s%s", audio_renderers[i].name, i == 0 ? " [Default]" : "");
+    }
+    printf("\n");
+    printf("-max                  Replay mirror frames as fast as the renderer takes them instead of at the recorded pace\n");
+    printf("-bench                Push an Annex-B stream (.h264, or .h265/.hevc) or an audio capture's frames into the\n"
+           "                      renderer as fast as it takes them, and print its rate, submit latency and CPU time as JSON\n");
+    printf("-loss pct             Drop pct percent of the audio data packets\n");
+    printf("-jitter ms            Delay every audio packet by up to ms\n");
+    printf("-l                    Enable low-latency mode (disables render clock)\n");
+    printf("-L ms                 Skip to the next keyframe when video is more than ms behind (0 = off)\n");
+    printf("-rd depth             Frames the video decoder may hold back for reordering (default 4, 1 with -l)\n");
+    printf("-static               Leave out frames that repeat the picture before them, as rpiplay --coalesce-static\n");
+    printf("-d                    Enable debug logging\n");
+    printf("-h                    Displays this help\n");
+}
+
+// Returns false if the renderer wants the AAC packet itself
+static bool audio_render_pcm(raop_ntp_t *ntp, aac_decode_struct *data) {
+    if (!audio_renderer->funcs->render_pcm && !audio_renderer->funcs->set_pcm_source) return false;
+#if defined(HAS_AAC_DECODER)
+    stream_frame_t *pcm = NULL;
+    if (audio_compression == RAOP_AUDIO_CT_AAC_ELD) {
+        pcm = data->data_len > 0 ? aac_decoder_decode(audio_decoder, data->data, data->data_len, data->pts)
+                                 : aac_decoder_conceal(audio_decoder, data->pts);
+    } else if (audio_compression == RAOP_AUDIO_CT_ALAC) {
+        pcm = data->data_len > 0 ? alac_decoder_decode(alac_decoder, data->data, data->data_len, data->pts)
+                                 : alac_decoder_conceal(alac_decoder, data->pts);
+    }
+    if (pcm && audio_scheduler) {
+        pcm_scheduler_push(audio_scheduler, pcm);
+    } else if (pcm) {
+        audio_renderer->funcs->render_pcm(audio_renderer, ntp, pcm);
+    }
+#endif
+    return true;
+}
+
+extern "C" void audio_process(void *cls, raop_ntp_t *ntp, aac_decode_struct *data) {
+    if (audio_renderer != NULL && !audio_render_pcm(ntp, data) && data->data_len > 0 &&
+        audio_compression == RAOP_AUDIO_CT_AAC_ELD) {
+        audio_renderer->funcs->render_buffer(audio_renderer, ntp, data->data, data->data_len, data->pts);
+    }
+}
+
+extern "C" void audio_process_frame(void *cls, raop_ntp_t *ntp, stream_frame_t *frame, aac_decode_struct *data) {
+    if (audio_renderer != NULL && !audio_renderer->funcs->render_pcm && audio_renderer->funcs->render_frame &&
+        audio_compression == RAOP_AUDIO_CT_AAC_ELD) {
+        audio_renderer->funcs->render_frame(audio_renderer, ntp, frame);
+        return;
+    }
+    audio_process(cls, ntp, data);
+    stream_frame_unref(frame);
+}
+
+extern "C" void audio_set_format(void *cls, const raop_audio_format_t *format) {
+    audio_compression = format->compression;
+#if defined(HAS_AAC_DECODER)
+    if (audio_compression == RAOP_AUDIO_CT_ALAC && alac_decoder) {
+        alac_decoder_config_t config = ALAC_DECODER_DEFAULT_CONFIG;
+        if (format->samples_per_frame > 0) config.frame_length = format->samples_per_frame;
+        if (alac_decoder_set_config(alac_decoder, &config) < 0) audio_compression = 0;
+    }
+#endif
+    if (audio_compression != RAOP_AUDIO_CT_AAC_ELD && audio_compression != RAOP_AUDIO_CT_ALAC) {
+        LOGW("Audio of compression type %d can't be played, it is dropped", format->compression);
+    }
+}
+
+extern "C" void audio_flush(void *cls) {
+#if defined(HAS_AAC_DECODER)
+    if (audio_decoder) aac_decoder_flush(audio_decoder);
+    if (audio_scheduler) pcm_scheduler_flush(audio_scheduler);
+#endif
+    if (audio_renderer) audio_renderer->funcs->flush(audio_renderer);
+}
+
+extern "C" int video_process(void *cls, raop_ntp_t *ntp, h264_decode_struct *data) {
+    return video_renderer->funcs->render_buffer(video_renderer, ntp, data->data, data->data_len, data->pts,
+                                                data->frame_type, data->nal_units, data->nal_count);
+}
+
+extern "C" int video_process_frame(void *cls, raop_ntp_t *ntp, stream_frame_t *frame, h264_decode_struct *data) {
+    if (video_renderer->funcs->render_frame) {
+        return video_renderer->funcs->render_frame(video_renderer, ntp, frame, data->frame_type,
+                                                   data->nal_units, data->nal_count);
+    }
+    int ret = video_process(cls, ntp, data);
+    stream_frame_unref(frame);
+    return ret;
+}
+
+extern "C" void video_get_stats(void *cls, raop_renderer_stats_t *stats) {
+    if (video_renderer->funcs->get_stats) {
+        video_renderer_stats_t renderer_stats = {};
+        video_renderer->funcs->get_stats(video_renderer, &renderer_stats);
+        stats->queued_frames = renderer_stats.queued_frames;
+        stats->latency = renderer_stats.decoder_latency;
+        stats->dropped_frames = renderer_stats.dropped_frames;
+    }
+}
+
+extern "C" unsigned char *video_acquire_buffer(void *cls, int size, void **handle) {
+    if (video_renderer->funcs->acquire_buffer) {
+        return video_renderer->funcs->acquire_buffer(video_renderer, size, handle);
+    }
+    return NULL;
+}
+
+extern "C" void video_submit_buffer(void *cls, raop_ntp_t *ntp, void *handle, h264_decode_struct *data) {
+    video_renderer->funcs->submit_buffer(video_renderer, ntp, handle, data->data_len, data->pts, data->frame_type,
+                                         data->nal_units, data->nal_count);
+}
+
+extern "C" void video_release_buffer(void *cls, void *handle) {
+    video_renderer->funcs->release_buffer(video_renderer, handle);
+}
+
+extern "C" void video_flush(void *cls) {
+    video_renderer->funcs->flush(video_renderer);
+}
+
+static double cpu_time(const struct rusage *usage) {
+    return usage->ru_utime.tv_sec + usage->ru_utime.tv_usec / 1e6 + usage->ru_stime.tv_sec + usage->ru_stime.tv_usec / 1e6;
+}
+
+/* Waits until the renderer has nothing queued any more, returns when that was */
+static uint64_t bench_drain(raop_ntp_t *ntp, bool video) {
+    uint64_t start = raop_ntp_get_local_time(ntp);
+    while (1) {
+        uint64_t now = raop_ntp_get_local_time(ntp);
+        unsigned int queued = 0;
+        if (video && video_renderer->funcs->get_stats) {
+            video_renderer_stats_t stats = {};
+            video_renderer->funcs->get_stats(video_renderer, &stats);
+            queued = stats.queued_frames;
+        } else if (!video && audio_renderer->funcs->get_stats) {
+            audio_renderer_stats_t stats = {};
+            audio_renderer->funcs->get_stats(audio_renderer, &stats);
+            queued = stats.queued_packets;
+        }
+        if (queued == 0) {
+            return now;
+        }
+        if (now - start >= BENCH_DRAIN_TIMEOUT) {
+            LOGW("The renderer still holds %u after %d s, counting them as done", queued, BENCH_DRAIN_TIMEOUT / 1000000);
+            return now;
+        }
+        usleep(1000);
+    }
+}
+
+/*
+ * Logs a -bench run and prints it as JSON on stdout, in the manner of rpiplay-bench, so runs on
+ * different boards, OS images and renderers can be compared with a script. The CPU time is that
+ * of the whole process, renderer and decoder threads included.
+ */
+static void bench_report(const char *kind, const char *renderer, const char *codec, int units, int refused,
+                         uint64_t dropped, std::vector<uint64_t> &submit_times, double wall, double cpu) {
+    std::sort(submit_times.begin(), submit_times.end());
+    uint64_t total = 0;
+    for (uint64_t submit_time : submit_times) total += submit_time;
+    size_t count = submit_times.size();
+    double mean = count ? (double) total / count : 0.0;
+    uint64_t p50 = count ? submit_times[count / 2] : 0;
+    uint64_t p99 = count ? submit_times[std::min(count - 1, count * 99 / 100)] : 0;
+    uint64_t max = count ? submit_times.back() : 0;
+    double rate = wall > 0 ? units / wall : 0.0;
+
+    LOGI("%s renderer %s: %d %s in %.2f s, %.1f per second, %d refused, %llu dropped", kind, renderer, units,
+         !strcmp(kind, "video") ? "frames" : "packets", wall, rate, refused, (unsigned long long) dropped);
+    LOGI("Submit %.0f us mean, %llu us median, %llu us p99, %llu us max, CPU time %.2f s, %.1f%% of a core",
+         mean, (unsigned long long) p50, (unsigned long long) p99, (unsigned long long) max, cpu,
+         wall > 0 ? cpu * 100 / wall : 0.0);
+    printf("{\"kind\": \"%s\", \"renderer\": \"%s\", \"codec\": \"%s\", \"units\": %d, \"refused\": %d, "
+           "\"dropped\": %llu, \"wall_s\": %.3f, \"per_second\": %.2f, \"submit_us_mean\": %.1f, "
+           "\"submit_us_p50\": %llu, \"submit_us_p99\": %llu, \"submit_us_max\": %llu, \"cpu_s\": %.3f, "
+           "\"cpu_us_per_unit\": %.1f}\n", kind, renderer, codec, units, refused, (unsigned long long) dropped, wall,
+           rate, mean, (unsigned long long) p50, (unsigned long long) p99, (unsigned long long) max, cpu,
+           units > 0 ? cpu * 1e6 / units : 0.0);
+}
+
+/*
+ * Hands every access unit of an Annex-B stream to the video renderer as soon as it returns from
+ * the one before. A frame the renderer refuses is counted and skipped up to the next keyframe,
+ * as a live session would.
+ */
+static int bench_video(logger_t *logger, const char *filename, const char *renderer) {
+    static const unsigned char loopback[] = { 127, 0, 0, 1 };
+    video_codec_t codec = is_hevc_file(filename) ? VIDEO_CODEC_H265 : VIDEO_CODEC_H264;
+    std::vector<bench_unit_t> units;
+    if (!load_annexb(filename, codec, units)) {
+        LOGE("Could not read an Annex-B stream from %s", filename);
+        return -1;
+    }
+    if (codec == VIDEO_CODEC_H265 && !video_renderer->funcs->set_codec) {
+        LOGE("The %s video renderer only decodes H.264", renderer);
+        return -1;
+    }
+    raop_ntp_t *ntp = raop_ntp_init(logger, loopback, sizeof(loopback), 0);
+    if (!ntp) {
+        return -1;
+    }
+    if (video_renderer->funcs->set_codec) {
+        video_renderer->funcs->set_codec(video_renderer, codec);
+    }
+
+    std::vector<uint64_t> submit_times;
+    int frames = 0;
+    int refused = 0;
+    bool skip = false;
+    struct rusage usage_start, usage_end;
+    getrusage(RUSAGE_SELF, &usage_start);
+    uint64_t start = raop_ntp_get_local_time(ntp);
+    for (bench_unit_t &unit : units) {
+        if (unit.type == 1 && skip && !unit.keyframe) {
+            continue;
+        }
+        int nal_count = unit.nal_units.size() <= H264_MAX_NAL_UNITS ? (int) unit.nal_units.size() : 0;
+        uint64_t submitted = raop_ntp_get_local_time(ntp);
+        int ret = video_renderer->funcs->render_buffer(video_renderer, ntp, unit.data.data(), (int) unit.data.size(),
+                                                       submitted, unit.type, nal_count ? unit.nal_units.data() : NULL,
+                                                       nal_count);
+        if (unit.type != 1) {
+            continue;
+        }
+        submit_times.push_back(raop_ntp_get_local_time(ntp) - submitted);
+        skip = ret < 0;
+        if (ret < 0) {
+            refused++;
+        } else {
+            frames++;
+        }
+    }
+    uint64_t end = bench_drain(ntp, true);
+    getrusage(RUSAGE_SELF, &usage_end);
+
+    video_renderer_stats_t stats = {};
+    if (video_renderer->funcs->get_stats) {
+        video_renderer->funcs->get_stats(video_renderer, &stats);
+    }
+    bench_report("video", renderer, codec == VIDEO_CODEC_H265 ? "h265" : "h264", frames, refused, stats.dropped_frames,
+                 submit_times, (end - start) / 1e6, cpu_time(&usage_end) - cpu_time(&usage_start));
+    raop_ntp_destroy(ntp);
+    return frames;
+}
+
+/*
+ * Hands the decrypted frames of an audio recording to the audio renderer, through the decoder for
+ * renderers that take PCM, as soon as it returns from the one before. Renderers that write to a
+ * device block on it, their rate is the device's.
+ */
+static int bench_audio(logger_t *logger, const char *filename, const char *renderer) {
+    static const unsigned char loopback[] = { 127, 0, 0, 1 };
+    audio_capture_header_t header;
+    std::vector<std::vector<unsigned char>> frames;
+    if (!load_audio_frames(logger, filename, &header, frames)) {
+        LOGE("Could not read the audio frames of %s", filename);
+        return -1;
+    }
+    raop_ntp_t *ntp = raop_ntp_init(logger, loopback, sizeof(loopback), 0);
+    if (!ntp) {
+        return -1;
+    }
+    if (header.compression) {
+        raop_audio_format_t format = { header.compression, 0, header.samples_per_frame, 44100 };
+        audio_set_format(NULL, &format);
+    }
+
+    std::vector<uint64_t> submit_times;
+    struct rusage usage_start, usage_end;
+    getrusage(RUSAGE_SELF, &usage_start);
+    uint64_t start = raop_ntp_get_local_time(ntp);
+    for (std::vector<unsigned char> &frame : frames) {
+        aac_decode_struct data;
+        data.data = frame.data();
+        data.data_len = (int) frame.size();
+        data.pts = raop_ntp_get_local_time(ntp);
+        audio_process(NULL, ntp, &data);
+        submit_times.push_back(raop_ntp_get_local_time(ntp) - data.pts);
+    }
+    uint64_t end = bench_drain(ntp, false);
+    getrusage(RUSAGE_SELF, &usage_end);
+
+    audio_renderer_stats_t stats = {};
+    if (audio_renderer->funcs->get_stats) {
+        audio_renderer->funcs->get_stats(audio_renderer, &stats);
+    }
+    bench_report("audio", renderer, audio_compression == RAOP_AUDIO_CT_ALAC ? "alac" : "aac-eld", (int) frames.size(), 0,
+                 stats.dropped_packets, submit_times, (end - start) / 1e6, cpu_time(&usage_end) - cpu_time(&usage_start));
+    raop_ntp_destroy(ntp);
+    return (int) frames.size();
+}
+
+int main(int argc, char *argv[]) {
+    const char *capture_file = nullptr;
+    bool realtime = true;
+    bool debug_log = false;
+    int loss_percent = 0;
+    int jitter_ms = 0;
+    unsigned int latency_budget = DEFAULT_LATENCY_BUDGET;
+    bool coalesce_static = false;
+    bool bench = false;
+    video_init_func_t video_init_func = video_renderers[0].init_func;
+    audio_init_func_t audio_init_func = audio_renderers[0].init_func;
+    const char *video_renderer_name = video_renderers[0].name;
+    const char *audio_renderer_name = audio_renderers[0].name;
+
+    video_renderer_config_t video_config = {};
+    video_config.background_mode = BACKGROUND_MODE_OFF;
+    video_config.low_latency = DEFAULT_LOW_LATENCY;
+    video_config.flip = FLIP_NONE;
+    video_config.reorder_depth = DEFAULT_REORDER_DEPTH;
+    video_config.presentation_latency = DEFAULT_PRESENTATION_LATENCY;
+    video_config.decoder = "auto";
+    video_config.sink = VIDEO_SINK_AUTO;
+    video_config.hwaccel = "none";
+
+    audio_renderer_config_t audio_config = {};
+    audio_config.device = DEFAULT_AUDIO_DEVICE;
+    audio_config.low_latency = DEFAULT_LOW_LATENCY;
+    audio_config.presentation_latency = DEFAULT_PRESENTATION_LATENCY;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg(argv[i]);
+        if (arg == "-vr") {
+            if (i == argc - 1) continue;
+            video_init_func = find_video_init_func(argv[++i]);
+            video_renderer_name = argv[i];
+            if (!video_init_func) {
+                fprintf(stderr, "Error: Unable to locate video renderer \"%s\".\n", argv[i]);
+                exit(1);
+            }
+        } else if (arg == "-ar") {
+            if (i == argc - 1) continue;
+            audio_init_func = find_audio_init_func(argv[++i]);
+            audio_renderer_name = argv[i];
+            if (!audio_init_func) {
+                fprintf(stderr, "Error: Unable to locate audio renderer \"%s\".\n", argv[i]);
+                exit(1);
+            }
+        } else if (arg == "-max") {
+            realtime = false;
+        } else if (arg == "-bench") {
+            bench = true;
+        } else if (arg == "-loss") {
+            if (i == argc - 1) continue;
+            loss_percent = atoi(argv[++i]);
+        } else if (arg == "-jitter") {
+            if (i == argc - 1) continue;
+            jitter_ms = atoi(argv[++i]);
+        } else if (arg == "-l") {
+            video_config.low_latency = !video_config.low_latency;
+            audio_config.low_latency = video_config.low_latency;
+        } else if (arg == "-L") {
+            if (i == argc - 1) continue;
+            latency_budget = atoi(argv[++i]);
+        } else if (arg == "-rd") {
+            if (i == argc - 1) continue;
+            video_config.reorder_depth = atoi(argv[++i]);
+        } else if (arg == "-static") {
+            coalesce_static = true;
+        } else if (arg == "-d") {
+            debug_log = !debug_log;
+        } else if (arg == "-h") {
+            print_info(argv[0]);
+            exit(0);
+        } else {
+            capture_file = argv[i];
+        }
+    }
+    if (!capture_file) {
+        print_info(argv[0]);
+        exit(1);
+    }
+
+    bool audio_capture = is_audio_capture(capture_file);
+    bool annexb = !audio_capture && is_annexb(capture_file);
+    if (annexb && !bench) {
+        fprintf(stderr, "Error: \"%s\" is an elementary stream, it can only be played with -bench.\n", capture_file);
+        exit(1);
+    }
+    if (bench) {
+        // Nothing is held back for its pts, frames go to the decoder as it takes them
+        realtime = false;
+        video_config.low_latency = true;
+        audio_config.low_latency = true;
+    }
+
+    raop_callbacks_t raop_cbs;
+    memset(&raop_cbs, 0, sizeof(raop_cbs));
+    raop_cbs.audio_process = audio_process;
+    raop_cbs.audio_process_frame = audio_process_frame;
+    raop_cbs.audio_flush = audio_flush;
+    raop_cbs.audio_set_format = audio_set_format;
+    raop_cbs.video_process = video_process;
+    raop_cbs.video_process_frame = video_process_frame;
+    raop_cbs.video_acquire_buffer = video_acquire_buffer;
+    raop_cbs.video_submit_buffer = video_submit_buffer;
+    raop_cbs.video_release_buffer = video_release_buffer;
+    raop_cbs.video_get_stats = video_get_stats;
+    raop_cbs.video_flush = video_flush;
+
+    raop_t *raop = raop_init(1, &raop_cbs);
+    if (raop == NULL) {
+        LOGE("Error initializing raop!");
+        return 1;
+    }
+    raop_set_log_callback(raop, log_callback, NULL);
+    raop_set_log_level(raop, debug_log ? RAOP_LOG_DEBUG : LOGGER_INFO);
+    raop_set_video_latency_budget(raop, latency_budget);
+    raop_set_coalesce_static(raop, coalesce_static);
+
+    logger_t *render_logger = logger_init();
+    logger_set_callback(render_logger, log_callback, NULL);
+    logger_set_level(render_logger, debug_log ? LOGGER_DEBUG : LOGGER_INFO);
+
+    if ((video_renderer = video_init_func(render_logger, &video_config)) == NULL) {
+        LOGE("Could not init video renderer");
+        raop_destroy(raop);
+        logger_destroy(render_logger);
+        return 1;
+    }
+    // The video renderer is kept around for audio captures too, some audio renderers follow its clock
+    if (audio_capture && (audio_renderer = audio_init_func(render_logger, video_renderer, &audio_config)) == NULL) {
+        LOGE("Could not init audio renderer");
+        raop_destroy(raop);
+        video_renderer->funcs->destroy(video_renderer);
+        logger_destroy(render_logger);
+        return 1;
+    }
+#if defined(HAS_AAC_DECODER)
+    if (audio_renderer && (audio_renderer->funcs->render_pcm || audio_renderer->funcs->set_pcm_source) &&
+        ((audio_decoder = aac_decoder_init(render_logger)) == NULL ||
+         (alac_decoder = alac_decoder_init(render_logger)) == NULL ||
+         (audio_renderer->funcs->set_pcm_source && (audio_scheduler = pcm_scheduler_init()) == NULL))) {
+        LOGE("Could not init the audio decoders");
+        aac_decoder_destroy(audio_decoder);
+        alac_decoder_destroy(alac_decoder);
+        audio_renderer->funcs->destroy(audio_renderer);
+        raop_destroy(raop);
+        video_renderer->funcs->destroy(video_renderer);
+        logger_destroy(render_logger);
+        return 1;
+    }
+    if (audio_scheduler) audio_renderer->funcs->set_pcm_source(audio_renderer, audio_scheduler);
+#endif
+    video_renderer->funcs->start(video_renderer);
+    if (audio_renderer) audio_renderer->funcs->start(audio_renderer);
+
+    struct timeval start;
+    struct rusage usage;
+    gettimeofday(&start, NULL);
+
+    int replayed;
+    if (bench && annexb) {
+        replayed = bench_video(render_logger, capture_file, video_renderer_name);
+    } else if (bench && audio_capture) {
+        replayed = bench_audio(render_logger, capture_file, audio_renderer_name);
+    } else {
+        replayed = audio_capture ? raop_replay_audio(raop, capture_file, loss_percent, jitter_ms)
+                                 : raop_replay_mirror(raop, capture_file, realtime);
+    }
+
+    // The whole process, renderer threads included, so runs with and without -static can be compared
+    struct timeval end;
+    gettimeofday(&end, NULL);
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+        double wall = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+        double user = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6;
+        double system = usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+        LOGI("CPU time %.2f s user and %.2f s system over %.1f s, %.1f%% of a core, %ld voluntary context switches",
+             user, system, wall, wall > 0 ? (user + system) * 100 / wall : 0.0, usage.ru_nvcsw);
+    }
+
+    if (video_renderer->funcs->log_stats) {
+        video_renderer->funcs->log_stats(video_renderer);
+    }
+    if (audio_renderer && audio_renderer->funcs->log_stats) {
+        audio_renderer->funcs->log_stats(audio_renderer);
+    }
+#if defined(HAS_AAC_DECODER)
+    if (audio_decoder) {
+        aac_decoder_stats_t stats;
+        aac_decoder_get_stats(audio_decoder, &stats);
+        LOGI("AAC decoder: %llu packets, %llu errors, %llu concealed, %llu us decoding", (unsigned long long) stats.packets,
+             (unsigned long long) stats.errors, (unsigned long long) stats.concealed, (unsigned long long) stats.decode_time);
+    }
+    if (alac_decoder) {
+        aac_decoder_stats_t stats;
+        alac_decoder_get_stats(alac_decoder, &stats);
+        if (stats.packets) {
+            LOGI("ALAC decoder: %llu packets, %llu errors, %llu concealed, %llu us decoding", (unsigned long long) stats.packets,
+                 (unsigned long long) stats.errors, (unsigned long long) stats.concealed, (unsigned long long) stats.decode_time);
+        }
+    }
+#endif
+    raop_destroy(raop);
+    if (audio_renderer) audio_renderer->funcs->destroy(audio_renderer);
+#if defined(HAS_AAC_DECODER)
+    pcm_scheduler_destroy(audio_scheduler);
+    aac_decoder_destroy(audio_decoder);
+    alac_decoder_destroy(alac_decoder);
+#endif
+    video_renderer->funcs->destroy(video_renderer);
+    logger_destroy(render_logger);
+    return replayed < 0 ? 1 : 0;
+}